@@ -13,6 +13,8 @@ include(../globaldefs.pri)
 # Precompile QML files to avoid writing qmlcache on portable versions.
 # Since this binds the app against the Qt runtime version, we will only
 # do this for Windows and Mac, since they ship with the Qt runtime.
+# Packagers that pin the Qt runtime can opt in elsewhere by passing
+# CONFIG+=qtquickcompiler to qmake.
 win32|macx {
     CONFIG(release, debug|release) {
         CONFIG += qtquickcompiler
@@ -46,7 +48,7 @@ win32 {
         LIBS += -L$$(DXSDK_DIR)/Lib/x64
     }
 
-    LIBS += ws2_32.lib winmm.lib dxva2.lib ole32.lib gdi32.lib user32.lib d3d9.lib dwmapi.lib dbghelp.lib
+    LIBS += ws2_32.lib winmm.lib dxva2.lib ole32.lib gdi32.lib user32.lib d3d9.lib dwmapi.lib dbghelp.lib avrt.lib iphlpapi.lib pdh.lib psapi.lib d3d11.lib dxgi.lib d3dcompiler.lib
 }
 macx {
     INCLUDEPATH += $$PWD/../libs/mac/include
@@ -73,10 +75,25 @@ unix:!macx {
         }
     }
 
+    packagesExist(libpipewire-0.3) {
+        PKGCONFIG += libpipewire-0.3
+        CONFIG += pipewire
+    }
+
+    packagesExist(libpulse) {
+        PKGCONFIG += libpulse
+        CONFIG += libpulse
+    }
+
     packagesExist(libavcodec) {
         PKGCONFIG += libavcodec libavutil
         CONFIG += ffmpeg
 
+        packagesExist(libavformat) {
+            PKGCONFIG += libavformat
+            CONFIG += libavformat
+        }
+
         packagesExist(libva) {
             packagesExist(libva-x11) {
                 CONFIG += libva-x11
@@ -88,6 +105,11 @@ unix:!macx {
                 CONFIG += libva-drm
             }
             CONFIG += libva
+
+            # QSV decoding runs on a QSV device derived from VAAPI
+            packagesExist(libmfx) {
+                CONFIG += qsv
+            }
         }
 
         packagesExist(vdpau) {
@@ -103,6 +125,31 @@ unix:!macx {
             PKGCONFIG += libdrm
             CONFIG += libdrm
         }
+
+        packagesExist(xcb-present) {
+            PKGCONFIG += xcb xcb-present
+            CONFIG += xcb-present
+        }
+
+        packagesExist(wayland-client) {
+            PKGCONFIG += wayland-client
+            CONFIG += wayland
+
+            # The DMA-BUF renderer generates its protocol bindings
+            packagesExist(libdrm):packagesExist(wayland-protocols):packagesExist(wayland-scanner) {
+                CONFIG += wayland-dmabuf
+            }
+        }
+
+        packagesExist(egl):packagesExist(glesv2) {
+            PKGCONFIG += egl glesv2
+            CONFIG += egl
+        }
+
+        packagesExist(ffnvcodec) {
+            PKGCONFIG += ffnvcodec
+            CONFIG += ffnvcodec
+        }
     }
 }
 win32 {
@@ -114,7 +161,7 @@ win32:!winrt {
 }
 macx {
     LIBS += -lssl -lcrypto -lavcodec.58 -lavutil.56 -lopus -framework SDL2 -framework SDL2_ttf
-    LIBS += -lobjc -framework VideoToolbox -framework AVFoundation -framework CoreVideo -framework CoreGraphics -framework CoreMedia -framework AppKit
+    LIBS += -lobjc -framework VideoToolbox -framework AVFoundation -framework CoreVideo -framework CoreGraphics -framework CoreMedia -framework AppKit -framework Metal -framework QuartzCore -framework IOKit
 
     # For libsoundio
     LIBS += -framework CoreAudio -framework AudioUnit
@@ -130,24 +177,54 @@ SOURCES += \
     backend/nvhttp.cpp \
     backend/nvpairingmanager.cpp \
     backend/computermanager.cpp \
+    backend/computerpollscheduler.cpp \
+    backend/negotiationcache.cpp \
     backend/boxartmanager.cpp \
     backend/richpresencemanager.cpp \
     cli/commandlineparser.cpp \
     cli/quitstream.cpp \
     cli/startstream.cpp \
+    cli/benchmark.cpp \
+    cli/headlessstream.cpp \
+    cli/daemon.cpp \
     settings/streamingpreferences.cpp \
     streaming/input.cpp \
+    streaming/inputtimerqueue.cpp \
     streaming/session.cpp \
     streaming/audio/audio.cpp \
+    streaming/audio/audiomixer.cpp \
+    streaming/audio/jitterbuffer.cpp \
+    streaming/audio/audiodecoder.cpp \
+    streaming/audio/parallelopusdecoder.cpp \
+    streaming/audio/packetqueue.cpp \
     streaming/audio/renderers/sdlaud.cpp \
+    streaming/audio/renderers/nullaudiorenderer.cpp \
     gui/computermodel.cpp \
     gui/appmodel.cpp \
     streaming/streamutils.cpp \
+    streaming/video/frametracer.cpp \
+    streaming/metricsexporter.cpp \
+    streaming/maintenancethread.cpp \
+    streaming/cpudispatch.cpp \
+    streaming/sessionhistory.cpp \
+    streaming/decodeoverloaddetector.cpp \
+    streaming/bitratecontroller.cpp \
+    streaming/gpuusage.cpp \
+    streaming/threadplacement.cpp \
+    streaming/avsyncclock.cpp \
+    streaming/latencyprobe.cpp \
+    streaming/scriptedinput.cpp \
+    streaming/analogresponse.cpp \
+    streaming/capturefile.cpp \
+    streaming/pathmtu.cpp \
     backend/autoupdatechecker.cpp \
     path.cpp \
     settings/mappingmanager.cpp \
     gui/sdlgamepadkeynavigation.cpp \
     streaming/video/overlaymanager.cpp \
+    streaming/video/decodercache.cpp \
+    streaming/video/nullvid.cpp \
+    streaming/video/videostats.cpp \
     backend/systemproperties.cpp
 
 HEADERS += \
@@ -158,25 +235,57 @@ HEADERS += \
     backend/nvhttp.h \
     backend/nvpairingmanager.h \
     backend/computermanager.h \
+    backend/computerpollscheduler.h \
+    backend/negotiationcache.h \
     backend/boxartmanager.h \
     backend/richpresencemanager.h \
     cli/commandlineparser.h \
     cli/quitstream.h \
     cli/startstream.h \
+    cli/benchmark.h \
+    cli/headlessstream.h \
+    cli/daemon.h \
     settings/streamingpreferences.h \
     streaming/input.h \
+    streaming/inputtimerqueue.h \
     streaming/session.h \
+    streaming/audio/audiomixer.h \
+    streaming/audio/jitterbuffer.h \
+    streaming/audio/audiodecoder.h \
+    streaming/audio/parallelopusdecoder.h \
+    streaming/audio/packetqueue.h \
+    streaming/audio/renderers/framering.h \
     streaming/audio/renderers/renderer.h \
     streaming/audio/renderers/sdl.h \
+    streaming/audio/renderers/nullaudiorenderer.h \
     gui/computermodel.h \
     gui/appmodel.h \
     streaming/video/decoder.h \
+    streaming/video/frametimehistogram.h \
+    streaming/video/frametracer.h \
+    streaming/metricsexporter.h \
+    streaming/maintenancethread.h \
+    streaming/cpudispatch.h \
+    streaming/sessionhistory.h \
+    streaming/decodeoverloaddetector.h \
+    streaming/bitratecontroller.h \
+    streaming/gpuusage.h \
+    streaming/threadplacement.h \
+    streaming/avsyncclock.h \
+    streaming/latencyprobe.h \
+    streaming/scriptedinput.h \
+    streaming/analogresponse.h \
+    streaming/capturefile.h \
+    streaming/pathmtu.h \
     streaming/streamutils.h \
     backend/autoupdatechecker.h \
     path.h \
     settings/mappingmanager.h \
     gui/sdlgamepadkeynavigation.h \
     streaming/video/overlaymanager.h \
+    streaming/video/decodercache.h \
+    streaming/video/nullvid.h \
+    streaming/video/videostats.h \
     backend/systemproperties.h
 
 # Platform-specific renderers and decoders
@@ -186,18 +295,39 @@ ffmpeg {
     DEFINES += HAVE_FFMPEG
     SOURCES += \
         streaming/video/ffmpeg.cpp \
+        streaming/video/bitstreamanalytics.cpp \
+        streaming/video/framegraph.cpp \
+        streaming/video/framepool.cpp \
+        streaming/video/hwdevicecache.cpp \
         streaming/video/ffmpeg-renderers/sdlvid.cpp \
+        streaming/video/ffmpeg-renderers/main10converter.cpp \
         streaming/video/ffmpeg-renderers/cuda.cpp \
         streaming/video/ffmpeg-renderers/pacer/pacer.cpp \
-        streaming/video/ffmpeg-renderers/pacer/nullthreadedvsyncsource.cpp
+        streaming/video/ffmpeg-renderers/pacer/nullthreadedvsyncsource.cpp \
+        streaming/video/screenshot.cpp
 
     HEADERS += \
         streaming/video/ffmpeg.h \
+        streaming/video/bitstreamanalytics.h \
+        streaming/video/framegraph.h \
+        streaming/video/framepool.h \
+        streaming/video/hwdevicecache.h \
         streaming/video/ffmpeg-renderers/renderer.h \
         streaming/video/ffmpeg-renderers/sdlvid.h \
+        streaming/video/ffmpeg-renderers/main10converter.h \
         streaming/video/ffmpeg-renderers/cuda.h \
+        streaming/video/ffmpeg-renderers/upscalecost.h \
         streaming/video/ffmpeg-renderers/pacer/pacer.h \
-        streaming/video/ffmpeg-renderers/pacer/nullthreadedvsyncsource.h
+        streaming/video/ffmpeg-renderers/pacer/spscqueue.h \
+        streaming/video/ffmpeg-renderers/pacer/nullthreadedvsyncsource.h \
+        streaming/video/screenshot.h
+}
+libavformat {
+    message(Stream recording enabled)
+
+    DEFINES += HAVE_AVFORMAT
+    SOURCES += streaming/recorder.cpp
+    HEADERS += streaming/recorder.h
 }
 libva {
     message(VAAPI renderer selected)
@@ -225,6 +355,14 @@ libva-wayland {
     PKGCONFIG += libva-drm
     DEFINES += HAVE_LIBVA_DRM
 }
+qsv {
+    message(QSV renderer selected)
+
+    PKGCONFIG += libmfx
+    DEFINES += HAVE_QSV
+    SOURCES += streaming/video/ffmpeg-renderers/qsv.cpp
+    HEADERS += streaming/video/ffmpeg-renderers/qsv.h
+}
 libvdpau {
     message(VDPAU renderer selected)
 
@@ -236,15 +374,79 @@ mmal {
     message(MMAL renderer selected)
 
     DEFINES += HAVE_MMAL
-    SOURCES += streaming/video/ffmpeg-renderers/mmal.cpp
-    HEADERS += streaming/video/ffmpeg-renderers/mmal.h
+    SOURCES += \
+        streaming/video/ffmpeg-renderers/mmal.cpp \
+        streaming/video/mmalvid.cpp
+    HEADERS += \
+        streaming/video/ffmpeg-renderers/mmal.h \
+        streaming/video/mmalvid.h
 }
 libdrm {
     message(DRM renderer selected)
 
     DEFINES += HAVE_DRM
-    SOURCES += streaming/video/ffmpeg-renderers/drm.cpp
-    HEADERS += streaming/video/ffmpeg-renderers/drm.h
+    SOURCES += \
+        streaming/video/ffmpeg-renderers/drm.cpp \
+        streaming/video/ffmpeg-renderers/pacer/drmvsyncsource.cpp
+    HEADERS += \
+        streaming/video/ffmpeg-renderers/drm.h \
+        streaming/video/ffmpeg-renderers/pacer/drmvsyncsource.h
+}
+xcb-present {
+    message(X11 Present V-sync source selected)
+
+    DEFINES += HAVE_X11_PRESENT
+    SOURCES += streaming/video/ffmpeg-renderers/pacer/x11vsyncsource.cpp
+    HEADERS += streaming/video/ffmpeg-renderers/pacer/x11vsyncsource.h
+}
+wayland {
+    message(Wayland V-sync source selected)
+
+    DEFINES += HAVE_WAYLAND
+    SOURCES += streaming/video/ffmpeg-renderers/pacer/waylandvsyncsource.cpp
+    HEADERS += streaming/video/ffmpeg-renderers/pacer/waylandvsyncsource.h
+}
+wayland-dmabuf {
+    message(Wayland DMA-BUF renderer selected)
+
+    DEFINES += HAVE_WAYLAND_DMABUF
+    SOURCES += streaming/video/ffmpeg-renderers/wayland.cpp
+    HEADERS += streaming/video/ffmpeg-renderers/wayland.h
+
+    WAYLAND_PROTOCOLS_DIR = $$system(pkg-config --variable=pkgdatadir wayland-protocols)
+    WAYLAND_SCANNER = $$system(pkg-config --variable=wayland_scanner wayland-scanner)
+    WAYLAND_PROTOCOLS = \
+        $$WAYLAND_PROTOCOLS_DIR/stable/presentation-time/presentation-time.xml \
+        $$WAYLAND_PROTOCOLS_DIR/stable/viewporter/viewporter.xml \
+        $$WAYLAND_PROTOCOLS_DIR/unstable/linux-dmabuf/linux-dmabuf-unstable-v1.xml
+
+    wayland_client_header.input = WAYLAND_PROTOCOLS
+    wayland_client_header.output = ${QMAKE_FILE_BASE}-client-protocol.h
+    wayland_client_header.commands = $$WAYLAND_SCANNER client-header ${QMAKE_FILE_NAME} ${QMAKE_FILE_OUT}
+    wayland_client_header.variable_out = HEADERS
+    wayland_client_header.CONFIG += target_predeps no_link
+
+    wayland_client_code.input = WAYLAND_PROTOCOLS
+    wayland_client_code.output = ${QMAKE_FILE_BASE}-protocol.c
+    wayland_client_code.commands = $$WAYLAND_SCANNER private-code ${QMAKE_FILE_NAME} ${QMAKE_FILE_OUT}
+    wayland_client_code.variable_out = SOURCES
+
+    QMAKE_EXTRA_COMPILERS += wayland_client_header wayland_client_code
+    INCLUDEPATH += $$OUT_PWD
+}
+egl {
+    message(EGL renderer selected)
+
+    DEFINES += HAVE_EGL
+    SOURCES += streaming/video/ffmpeg-renderers/eglvid.cpp
+    HEADERS += streaming/video/ffmpeg-renderers/eglvid.h
+}
+egl:ffnvcodec {
+    message(CUDA-GL interop enabled)
+
+    # The CUDA driver API is loaded at runtime by ffnvcodec
+    DEFINES += HAVE_CUDA_GL
+    LIBS += -ldl
 }
 config_SL {
     message(Steam Link build configuration selected)
@@ -260,24 +462,50 @@ config_SL {
         streaming/audio/renderers/slaud.h
 }
 win32:!winrt {
-    message(DXVA2 renderer selected)
+    message(DXVA2 and D3D11VA renderers selected)
 
     SOURCES += \
         streaming/video/ffmpeg-renderers/dxva2.cpp \
+        streaming/video/ffmpeg-renderers/d3d11va.cpp \
         streaming/video/ffmpeg-renderers/pacer/dxvsyncsource.cpp
 
     HEADERS += \
         streaming/video/ffmpeg-renderers/dxva2.h \
+        streaming/video/ffmpeg-renderers/d3d11va.h \
         streaming/video/ffmpeg-renderers/pacer/dxvsyncsource.h
+
+    message(WASAPI audio renderer selected)
+
+    DEFINES += HAVE_WASAPI
+    SOURCES += streaming/audio/renderers/wasapiaudiorenderer.cpp
+    HEADERS += streaming/audio/renderers/wasapiaudiorenderer.h
 }
 macx {
     message(VideoToolbox renderer selected)
 
     SOURCES += \
-        streaming/video/ffmpeg-renderers/vt.mm
+        streaming/video/ffmpeg-renderers/vt.mm \
+        streaming/video/ffmpeg-renderers/pacer/displaylinkvsyncsource.mm \
+        streaming/video/vtvid.mm
 
     HEADERS += \
-        streaming/video/ffmpeg-renderers/vt.h
+        streaming/video/ffmpeg-renderers/vt.h \
+        streaming/video/ffmpeg-renderers/pacer/displaylinkvsyncsource.h \
+        streaming/video/vtvid.h
+}
+pipewire {
+    message(PipeWire audio renderer selected)
+
+    DEFINES += HAVE_PIPEWIRE
+    SOURCES += streaming/audio/renderers/pipewireaudiorenderer.cpp
+    HEADERS += streaming/audio/renderers/pipewireaudiorenderer.h
+}
+libpulse {
+    message(PulseAudio audio renderer selected)
+
+    DEFINES += HAVE_PULSEAUDIO
+    SOURCES += streaming/audio/renderers/pulseaudiorenderer.cpp
+    HEADERS += streaming/audio/renderers/pulseaudiorenderer.h
 }
 soundio {
     message(libsoundio audio renderer selected)
@@ -310,6 +538,9 @@ else:unix: LIBS += -L$$OUT_PWD/../moonlight-common-c/ -lmoonlight-common-c
 INCLUDEPATH += $$PWD/../moonlight-common-c/moonlight-common-c/src
 DEPENDPATH += $$PWD/../moonlight-common-c/moonlight-common-c/src
 
+# The FEC benchmark calls the Reed-Solomon decoder directly
+INCLUDEPATH += $$PWD/../moonlight-common-c/moonlight-common-c/reedsolomon
+
 win32:CONFIG(release, debug|release): LIBS += -L$$OUT_PWD/../qmdnsengine/release/ -lqmdnsengine
 else:win32:CONFIG(debug, debug|release): LIBS += -L$$OUT_PWD/../qmdnsengine/debug/ -lqmdnsengine
 else:unix: LIBS += -L$$OUT_PWD/../qmdnsengine/ -lqmdnsengine
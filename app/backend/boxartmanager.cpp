@@ -2,21 +2,38 @@
 #include "../path.h"
 
 #include <QImageReader>
-#include <QImageWriter>
+#include <QBuffer>
+#include <QSaveFile>
+#include <QFileInfo>
+#include <QGuiApplication>
+#include <QScreen>
+
+// The size the AppView delegates draw box art at
+#define BOX_ART_WIDTH 200
+#define BOX_ART_HEIGHT 267
+
+// About 300 thumbnails at 1x scale
+#define BOX_ART_MEMORY_CACHE_BYTES (64 * 1024 * 1024)
+
+bool BoxArtManager::s_FetchingPaused;
+QList<BoxArtManager*> BoxArtManager::s_Instances;
 
 BoxArtManager::BoxArtManager(QObject *parent) :
     QObject(parent),
     m_BoxArtDir(Path::getBoxArtCacheDir()),
-    m_ThreadPool(this)
-{
+    m_ThreadPool(this),
     // 4 is a good balance between fast loading for large
     // app grids and not crushing GFE with tons of requests
-    // and causing UI jank from constantly stalling to decode
-    // new images.
-    m_ThreadPool.setMaxThreadCount(4);
+    m_MaxConcurrentFetches(4)
+{
+    // Saving is quick, so a couple of threads keep
+    // up with the fetches
+    m_ThreadPool.setMaxThreadCount(2);
     if (!m_BoxArtDir.exists()) {
         m_BoxArtDir.mkpath(".");
     }
+
+    s_Instances.append(this);
 }
 
 QString
@@ -36,15 +53,16 @@ BoxArtManager::getFilePathForBoxArt(NvComputer* computer, int appId)
     return dir.filePath(QString::number(appId) + ".png");
 }
 
-class NetworkBoxArtLoadTask : public QObject, public QRunnable
+class BoxArtSaveTask : public QObject, public QRunnable
 {
     Q_OBJECT
 
 public:
-    NetworkBoxArtLoadTask(BoxArtManager* boxArtManager, NvComputer* computer, NvApp& app)
+    BoxArtSaveTask(BoxArtManager* boxArtManager, NvComputer* computer, NvApp& app, QByteArray imageData)
         : m_Bam(boxArtManager),
           m_Computer(computer),
-          m_App(app)
+          m_App(app),
+          m_ImageData(imageData)
     {
         connect(this, SIGNAL(boxArtFetchCompleted(NvComputer*,NvApp,QUrl)),
                 boxArtManager, SLOT(handleBoxArtLoadComplete(NvComputer*,NvApp,QUrl)));
@@ -56,37 +74,209 @@ signals:
 private:
     void run()
     {
-        QUrl image = m_Bam->loadBoxArtFromNetwork(m_Computer, m_App.id);
-        if (image.isEmpty()) {
-            // Give it another shot if it fails once
-            image = m_Bam->loadBoxArtFromNetwork(m_Computer, m_App.id);
-        }
-        emit boxArtFetchCompleted(m_Computer, m_App, image);
+        // Writing the file would stall the UI, so only the
+        // request itself runs on the main thread
+        emit boxArtFetchCompleted(m_Computer, m_App,
+                                  m_Bam->saveBoxArt(m_Computer, m_App.id, m_ImageData));
     }
 
     BoxArtManager* m_Bam;
     NvComputer* m_Computer;
     NvApp m_App;
+    QByteArray m_ImageData;
 };
 
+BoxArtManager::~BoxArtManager()
+{
+    s_Instances.removeOne(this);
+
+    // Pending requests would otherwise call back into us
+    m_FetchQueue.clear();
+    for (NvHttpRequest* request : m_PendingRequests.keys()) {
+        request->cancel();
+    }
+    m_ThreadPool.waitForDone();
+}
+
 QUrl BoxArtManager::loadBoxArt(NvComputer* computer, NvApp& app)
 {
     // Try to open the cached file
     QString cacheFilePath = getFilePathForBoxArt(computer, app.id);
     if (QFile::exists(cacheFilePath)) {
-        return QUrl::fromLocalFile(cacheFilePath);
+        return getBoxArtUrl(computer, app.id);
     }
 
-    // If we get here, we need to fetch asynchronously.
-    // Kick off a worker on our thread pool to do just that.
-    NetworkBoxArtLoadTask* netLoadTask = new NetworkBoxArtLoadTask(this, computer, app);
-    m_ThreadPool.start(netLoadTask);
+    // If we get here, we need to fetch asynchronously
+    // and notify the caller once it's ready.
+    queueFetch(computer, app, true);
 
     // Return the placeholder then we can notify the caller
     // later when the real image is ready.
     return QUrl("qrc:/res/no_app_image.png");
 }
 
+QUrl BoxArtManager::getBoxArtUrl(NvComputer* computer, int appId)
+{
+    QFileInfo file(getFilePathForBoxArt(computer, appId));
+    return QUrl("image://boxart/" + computer->uuid + "/" + QString::number(appId) + "/" +
+                QString::number(file.lastModified().toMSecsSinceEpoch()));
+}
+
+void BoxArtManager::queueFetch(NvComputer* computer, NvApp& app, bool visible)
+{
+    // The same app may be asked for again before its fetch is done
+    int index = findQueuedFetch(computer, app);
+    if (index >= 0) {
+        m_FetchQueue[index].visible |= visible;
+        return;
+    }
+    else if (findPendingRequest(computer, app) != nullptr) {
+        return;
+    }
+
+    BoxArtFetch fetch;
+    fetch.computer = computer;
+    fetch.app = app;
+    fetch.visible = visible;
+    fetch.retryOnFailure = true;
+    m_FetchQueue.append(fetch);
+    startQueuedFetches();
+}
+
+void BoxArtManager::prefetchBoxArt(NvComputer* computer, NvApp& app)
+{
+    if (!QFile::exists(getFilePathForBoxArt(computer, app.id))) {
+        queueFetch(computer, app, false);
+    }
+}
+
+void BoxArtManager::invalidateBoxArt(NvComputer* computer, NvApp& app)
+{
+    QFile::remove(getFilePathForBoxArt(computer, app.id));
+}
+
+void BoxArtManager::cancelAllBoxArt(NvComputer* computer)
+{
+    for (int i = m_FetchQueue.count() - 1; i >= 0; i--) {
+        if (m_FetchQueue[i].computer == computer) {
+            m_FetchQueue.removeAt(i);
+        }
+    }
+
+    for (NvHttpRequest* request : m_PendingRequests.keys()) {
+        if (m_PendingRequests[request].computer == computer) {
+            m_PendingRequests.remove(request);
+            request->cancel();
+        }
+    }
+
+    // Saves already in progress still use the computer
+    m_ThreadPool.waitForDone();
+
+    startQueuedFetches();
+}
+
+void BoxArtManager::setMaxConcurrentFetches(int maxFetches)
+{
+    m_MaxConcurrentFetches = maxFetches;
+}
+
+void BoxArtManager::setFetchingPaused(bool paused)
+{
+    s_FetchingPaused = paused;
+
+    if (!paused) {
+        for (BoxArtManager* manager : s_Instances) {
+            manager->startQueuedFetches();
+        }
+    }
+}
+
+int BoxArtManager::findQueuedFetch(NvComputer* computer, NvApp& app)
+{
+    for (int i = 0; i < m_FetchQueue.count(); i++) {
+        if (m_FetchQueue[i].computer == computer && m_FetchQueue[i].app == app) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+NvHttpRequest* BoxArtManager::findPendingRequest(NvComputer* computer, NvApp& app)
+{
+    for (auto i = m_PendingRequests.constBegin(); i != m_PendingRequests.constEnd(); ++i) {
+        if (i.value().computer == computer && i.value().app == app) {
+            return i.key();
+        }
+    }
+
+    return nullptr;
+}
+
+void BoxArtManager::setBoxArtVisible(NvComputer* computer, NvApp& app, bool visible)
+{
+    int index = findQueuedFetch(computer, app);
+    if (index >= 0) {
+        m_FetchQueue[index].visible = visible;
+    }
+}
+
+void BoxArtManager::cancelBoxArt(NvComputer* computer, NvApp& app)
+{
+    int index = findQueuedFetch(computer, app);
+    if (index >= 0) {
+        m_FetchQueue.removeAt(index);
+        return;
+    }
+
+    NvHttpRequest* request = findPendingRequest(computer, app);
+    if (request != nullptr) {
+        m_PendingRequests.remove(request);
+        request->cancel();
+        startQueuedFetches();
+    }
+}
+
+void BoxArtManager::startQueuedFetches()
+{
+    while (!s_FetchingPaused && m_PendingRequests.count() < m_MaxConcurrentFetches && !m_FetchQueue.isEmpty()) {
+        // Visible apps go first, then the rest in the order they were asked for
+        int next = 0;
+        for (int i = 0; i < m_FetchQueue.count(); i++) {
+            if (m_FetchQueue[i].visible) {
+                next = i;
+                break;
+            }
+        }
+
+        BoxArtFetch fetch = m_FetchQueue.takeAt(next);
+        NvHTTP http(fetch.computer->activeAddress, fetch.computer->serverCert);
+        NvHttpRequest* request = http.getBoxArtAsync(fetch.app.id);
+        m_PendingRequests.insert(request, fetch);
+
+        connect(request, SIGNAL(completed()), this, SLOT(handleBoxArtRequestCompleted()));
+    }
+}
+
+void BoxArtManager::handleBoxArtRequestCompleted()
+{
+    NvHttpRequest* request = qobject_cast<NvHttpRequest*>(sender());
+    BoxArtFetch fetch = m_PendingRequests.take(request);
+
+    if (request->isSucceeded()) {
+        m_ThreadPool.start(new BoxArtSaveTask(this, fetch.computer,
+                                              fetch.app, request->getResponse()));
+    }
+    else if (fetch.retryOnFailure) {
+        // Give it another shot if it fails once
+        fetch.retryOnFailure = false;
+        m_FetchQueue.prepend(fetch);
+    }
+
+    startQueuedFetches();
+}
+
 void BoxArtManager::handleBoxArtLoadComplete(NvComputer* computer, NvApp app, QUrl image)
 {
     if (!image.isEmpty()) {
@@ -94,24 +284,105 @@ void BoxArtManager::handleBoxArtLoadComplete(NvComputer* computer, NvApp app, QU
     }
 }
 
-QUrl BoxArtManager::loadBoxArtFromNetwork(NvComputer* computer, int appId)
+QUrl BoxArtManager::saveBoxArt(NvComputer* computer, int appId, QByteArray imageData)
+{
+    // Only the header is checked here. The image is decoded when
+    // it's displayed, at the size it's displayed at.
+    QBuffer buffer(&imageData);
+    QImageReader reader(&buffer);
+    if (!reader.canRead()) {
+        return QUrl();
+    }
+
+    // Write it atomically, since the image provider may read
+    // it on another thread as soon as it exists
+    QSaveFile file(getFilePathForBoxArt(computer, appId));
+    if (!file.open(QIODevice::WriteOnly) ||
+            file.write(imageData) != imageData.size() ||
+            !file.commit()) {
+        return QUrl();
+    }
+
+    return getBoxArtUrl(computer, appId);
+}
+
+BoxArtImageProvider* BoxArtImageProvider::s_Instance;
+
+BoxArtImageProvider::BoxArtImageProvider()
+    : QQuickImageProvider(QQuickImageProvider::Image,
+                          QQmlImageProviderBase::ForceAsynchronousImageLoading),
+      m_BoxArtDir(Path::getBoxArtCacheDir()),
+      m_Cache(BOX_ART_MEMORY_CACHE_BYTES)
+{
+    // Decode at the physical size the delegates end up drawing
+    qreal scale = QGuiApplication::primaryScreen() != nullptr ?
+                QGuiApplication::primaryScreen()->devicePixelRatio() : 1;
+    m_DefaultSize = QSize(qRound(BOX_ART_WIDTH * scale), qRound(BOX_ART_HEIGHT * scale));
+
+    s_Instance = this;
+}
+
+BoxArtImageProvider::~BoxArtImageProvider()
+{
+    if (s_Instance == this) {
+        s_Instance = nullptr;
+    }
+}
+
+void BoxArtImageProvider::releaseMemoryCache()
 {
-    NvHTTP http(computer->activeAddress, computer->serverCert);
+    // The provider lives as long as the QML engine, which outlives any
+    // caller on the main thread
+    if (s_Instance != nullptr) {
+        QMutexLocker lock(&s_Instance->m_CacheLock);
+        s_Instance->m_Cache.clear();
+    }
+}
+
+QImage BoxArtImageProvider::requestImage(const QString& id, QSize* size, const QSize& requestedSize)
+{
+    QSize targetSize = requestedSize.isValid() ? requestedSize : m_DefaultSize;
+    QString key = id + "@" + QString::number(targetSize.width()) + "x" + QString::number(targetSize.height());
+
+    {
+        QMutexLocker lock(&m_CacheLock);
+        QImage* cachedImage = m_Cache.object(key);
+        if (cachedImage != nullptr) {
+            *size = cachedImage->size();
+            return *cachedImage;
+        }
+    }
+
+    // Drop the modification time to get <uuid>/<app ID>
+    QString fileId = id.left(id.lastIndexOf('/'));
 
-    QString cachePath = getFilePathForBoxArt(computer, appId);
     QImage image;
-    try {
-        image = http.getBoxArt(appId);
-    } catch (...) {}
-
-    // Cache the box art on disk if it loaded
-    if (!image.isNull()) {
-        if (image.save(cachePath)) {
-            return QUrl::fromLocalFile(cachePath);
+    QImageReader reader(m_BoxArtDir.filePath(fileId + ".png"));
+    QSize originalSize = reader.size();
+    if ((originalSize.width() == 130 && originalSize.height() == 180) || // GFE 2.0 placeholder image
+            (originalSize.width() == 628 && originalSize.height() == 888)) { // GFE 3.0 placeholder image
+        // AppView can no longer tell the host's placeholders by their
+        // size once they're scaled, so they're swapped for our own
+        image.load(":/res/no_app_image.png");
+    }
+    else {
+        // The delegates stretch box art to fill, so this draws the same
+        if (originalSize.isValid()) {
+            reader.setScaledSize(targetSize);
         }
+        image = reader.read();
     }
 
-    return QUrl();
+    if (image.isNull()) {
+        qWarning() << "Unable to decode box art" << id << "-" << reader.errorString();
+        return image;
+    }
+
+    *size = image.size();
+
+    QMutexLocker lock(&m_CacheLock);
+    m_Cache.insert(key, new QImage(image), image.bytesPerLine() * image.height());
+    return image;
 }
 
 #include "boxartmanager.moc"
@@ -5,19 +5,52 @@
 #include <QImage>
 #include <QThreadPool>
 #include <QRunnable>
+#include <QCache>
+#include <QMutex>
+#include <QQuickImageProvider>
 
 class BoxArtManager : public QObject
 {
     Q_OBJECT
 
-    friend class NetworkBoxArtLoadTask;
+    friend class BoxArtSaveTask;
 
 public:
     explicit BoxArtManager(QObject *parent = nullptr);
 
+    ~BoxArtManager();
+
     QUrl
     loadBoxArt(NvComputer* computer, NvApp& app);
 
+    // Box art for visible apps is fetched before the rest
+    void
+    setBoxArtVisible(NvComputer* computer, NvApp& app, bool visible);
+
+    // Drops the fetch if it hasn't finished yet
+    void
+    cancelBoxArt(NvComputer* computer, NvApp& app);
+
+    // Fetches box art behind everything visible if it isn't cached yet
+    void
+    prefetchBoxArt(NvComputer* computer, NvApp& app);
+
+    // Deletes the cached box art, so it's fetched again
+    void
+    invalidateBoxArt(NvComputer* computer, NvApp& app);
+
+    // Must be called before the computer is deleted
+    void
+    cancelAllBoxArt(NvComputer* computer);
+
+    void
+    setMaxConcurrentFetches(int maxFetches);
+
+    // Holds back queued fetches of every BoxArtManager while set, such as
+    // during a stream. Fetches already in flight are left to finish.
+    static void
+    setFetchingPaused(bool paused);
+
 signals:
     void
     boxArtLoadComplete(NvComputer* computer, NvApp app, QUrl image);
@@ -28,13 +61,74 @@ private slots:
     void
     handleBoxArtLoadComplete(NvComputer* computer, NvApp app, QUrl image);
 
+    void
+    handleBoxArtRequestCompleted();
+
 private:
+    struct BoxArtFetch
+    {
+        NvComputer* computer;
+        NvApp app;
+        bool visible;
+        bool retryOnFailure;
+    };
+
+    int
+    findQueuedFetch(NvComputer* computer, NvApp& app);
+
+    NvHttpRequest*
+    findPendingRequest(NvComputer* computer, NvApp& app);
+
+    void
+    queueFetch(NvComputer* computer, NvApp& app, bool visible);
+
+    void
+    startQueuedFetches();
+
+    // Stores the image exactly as the host sent it
     QUrl
-    loadBoxArtFromNetwork(NvComputer* computer, int appId);
+    saveBoxArt(NvComputer* computer, int appId, QByteArray imageData);
 
     QString
     getFilePathForBoxArt(NvComputer* computer, int appId);
 
+    QUrl
+    getBoxArtUrl(NvComputer* computer, int appId);
+
+    static bool s_FetchingPaused;
+    static QList<BoxArtManager*> s_Instances;
+
     QDir m_BoxArtDir;
     QThreadPool m_ThreadPool;
+    int m_MaxConcurrentFetches;
+    QList<BoxArtFetch> m_FetchQueue;
+    QHash<NvHttpRequest*, BoxArtFetch> m_PendingRequests;
+};
+
+// Serves the cached box art to QML as image://boxart/<uuid>/<app ID>/<mtime>.
+// The file's modification time is only there so replaced box art gets a
+// new URL, which keeps QML's pixmap cache and ours from showing the old one.
+// Images are decoded on QML's image loading threads at the size the app
+// grid draws them, and the most recently used ones are kept in memory so
+// scrolling back through a large grid doesn't decode them again.
+class BoxArtImageProvider : public QQuickImageProvider
+{
+public:
+    BoxArtImageProvider();
+
+    ~BoxArtImageProvider();
+
+    QImage requestImage(const QString& id, QSize* size, const QSize& requestedSize) override;
+
+    // Empties the in-memory cache of the provider that's in use, if any.
+    // The box art is decoded again from disk when it's next requested.
+    static void releaseMemoryCache();
+
+private:
+    static BoxArtImageProvider* s_Instance;
+
+    QDir m_BoxArtDir;
+    QSize m_DefaultSize;
+    QMutex m_CacheLock;
+    QCache<QString, QImage> m_Cache;
 };
@@ -1,5 +1,7 @@
 #include "computermanager.h"
+#include "boxartmanager.h"
 #include "nvhttp.h"
+#include "negotiationcache.h"
 #include "settings/streamingpreferences.h"
 
 #include <Limelight.h>
@@ -10,146 +12,23 @@
 #include <QCoreApplication>
 
 #define SER_HOSTS "hosts"
+#define SER_MDNSCACHE "mdnscache"
+#define SER_MDNSHOSTNAME "hostname"
+#define SER_MDNSADDRESSES "addresses"
+#define SER_MDNSEXPIRY "expiry"
 
-class PcMonitorThread : public QThread
-{
-    Q_OBJECT
-
-#define TRIES_BEFORE_OFFLINING 2
-#define POLLS_PER_APPLIST_FETCH 10
-
-public:
-    PcMonitorThread(NvComputer* computer)
-        : m_Computer(computer)
-    {
-        setObjectName("Polling thread for " + computer->name);
-    }
-
-private:
-    bool tryPollComputer(QString address, bool& changed)
-    {
-        NvHTTP http(address, m_Computer->serverCert);
-
-        QString serverInfo;
-        try {
-            serverInfo = http.getServerInfo(NvHTTP::NvLogLevel::NVLL_NONE);
-        } catch (...) {
-            return false;
-        }
-
-        NvComputer newState(address, serverInfo, QSslCertificate());
-
-        // Ensure the machine that responded is the one we intended to contact
-        if (m_Computer->uuid != newState.uuid) {
-            qInfo() << "Found unexpected PC " << newState.name << " looking for " << m_Computer->name;
-            return false;
-        }
-
-        changed = m_Computer->update(newState);
-        return true;
-    }
-
-    bool updateAppList(bool& changed)
-    {
-        Q_ASSERT(m_Computer->activeAddress != nullptr);
+// Host changes that arrive within this long of each other are saved together
+#define SAVE_HOSTS_DELAY_MS 1000
 
-        NvHTTP http(m_Computer->activeAddress, m_Computer->serverCert);
-
-        QVector<NvApp> appList;
-
-        try {
-            appList = http.getAppList();
-            if (appList.isEmpty()) {
-                return false;
-            }
-        } catch (...) {
-            return false;
-        }
-
-        QWriteLocker lock(&m_Computer->lock);
-        if (m_Computer->appList != appList) {
-            m_Computer->appList = appList;
-            m_Computer->sortAppList();
-            changed = true;
-        }
-
-        return true;
-    }
-
-    void run() override
-    {
-        // Always fetch the applist the first time
-        int pollsSinceLastAppListFetch = POLLS_PER_APPLIST_FETCH;
-        while (!isInterruptionRequested()) {
-            bool stateChanged = false;
-            bool online = false;
-            bool wasOnline = m_Computer->state == NvComputer::CS_ONLINE;
-            for (int i = 0; i < TRIES_BEFORE_OFFLINING && !online; i++) {
-                for (auto& address : m_Computer->uniqueAddresses()) {
-                    if (isInterruptionRequested()) {
-                        return;
-                    }
-
-                    if (tryPollComputer(address, stateChanged)) {
-                        if (!wasOnline) {
-                            qInfo() << m_Computer->name << "is now online at" << m_Computer->activeAddress;
-                        }
-                        online = true;
-                        break;
-                    }
-                }
-            }
-
-            // Check if we failed after all retry attempts
-            // Note: we don't need to acquire the read lock here,
-            // because we're on the writing thread.
-            if (!online && m_Computer->state != NvComputer::CS_OFFLINE) {
-                qInfo() << m_Computer->name << "is now offline";
-                m_Computer->state = NvComputer::CS_OFFLINE;
-                stateChanged = true;
-            }
-
-            // Grab the applist if it's empty or it's been long enough that we need to refresh
-            pollsSinceLastAppListFetch++;
-            if (m_Computer->state == NvComputer::CS_ONLINE &&
-                    m_Computer->pairState == NvComputer::PS_PAIRED &&
-                    (m_Computer->appList.isEmpty() || pollsSinceLastAppListFetch >= POLLS_PER_APPLIST_FETCH)) {
-                // Notify prior to the app list poll since it may take a while, and we don't
-                // want to delay onlining of a machine, especially if we already have a cached list.
-                if (stateChanged) {
-                    emit computerStateChanged(m_Computer);
-                    stateChanged = false;
-                }
-
-                if (updateAppList(stateChanged)) {
-                    pollsSinceLastAppListFetch = 0;
-                }
-            }
-
-            if (stateChanged) {
-                // Tell anyone listening that we've changed state
-                emit computerStateChanged(m_Computer);
-            }
-
-            // Wait a bit to poll again, but do it in 100 ms chunks
-            // so we can be interrupted reasonably quickly.
-            // FIXME: QWaitCondition would be better.
-            for (int i = 0; i < 30 && !isInterruptionRequested(); i++) {
-                QThread::msleep(100);
-            }
-        }
-    }
-
-signals:
-   void computerStateChanged(NvComputer* computer);
-
-private:
-    NvComputer* m_Computer;
-};
+// How long a resolved address is trusted when the A/AAAA record's
+// own TTL isn't in our cache. This is what RFC 6762 recommends for
+// host records.
+#define MDNS_DEFAULT_HOST_TTL_SECS 120
 
 ComputerManager::ComputerManager(QObject *parent)
     : QObject(parent),
       m_PollingRef(0),
+      m_BoxArtPrefetcher(new BoxArtManager(this)),
       m_MdnsBrowser(nullptr)
 {
     QSettings settings;
@@ -160,9 +39,36 @@ ComputerManager::ComputerManager(QObject *parent)
         settings.setArrayIndex(i);
         NvComputer* computer = new NvComputer(settings);
         m_KnownHosts[computer->uuid] = computer;
+        m_SavedHostOrder.append(computer->uuid);
     }
     settings.endArray();
 
+    int mdnsHosts = settings.beginReadArray(SER_MDNSCACHE);
+    for (int i = 0; i < mdnsHosts; i++) {
+        settings.setArrayIndex(i);
+
+        MdnsCachedHost cachedHost;
+        for (const QString& address : settings.value(SER_MDNSADDRESSES).toStringList()) {
+            cachedHost.addresses.append(QHostAddress(address));
+        }
+        cachedHost.expiry = settings.value(SER_MDNSEXPIRY).toDateTime();
+        m_MdnsHostCache[settings.value(SER_MDNSHOSTNAME).toString()] = cachedHost;
+    }
+    settings.endArray();
+
+    m_SaveHostsTimer.setSingleShot(true);
+    m_SaveHostsTimer.setInterval(SAVE_HOSTS_DELAY_MS);
+    connect(&m_SaveHostsTimer, &QTimer::timeout,
+            this, &ComputerManager::handleSaveHostsTimerFired);
+
+    connect(&m_PollScheduler, &ComputerPollScheduler::computerStateChanged,
+            this, &ComputerManager::handleComputerStateChanged);
+    connect(&m_PollScheduler, &ComputerPollScheduler::appListChanged,
+            this, &ComputerManager::handleAppListChanged);
+
+    // Prefetching stays out of the way of the app grid's own fetches
+    m_BoxArtPrefetcher->setMaxConcurrentFetches(1);
+
     // To quit in a timely manner, we must block additional requests
     // after we receive the aboutToQuit() signal. This is neccessary
     // because NvHTTP uses aboutToQuit() to abort requests in progres
@@ -186,14 +92,16 @@ ComputerManager::~ComputerManager()
     delete m_MdnsBrowser;
     m_MdnsBrowser = nullptr;
 
-    // Interrupt polling
-    for (ComputerPollingEntry* entry : m_PollEntries) {
-        entry->interrupt();
-    }
+    // Cancel all polling and prefetching
+    m_PollScheduler.removeAllComputers();
+    delete m_BoxArtPrefetcher;
 
-    // Delete all polling entries (and associated threads)
-    for (ComputerPollingEntry* entry : m_PollEntries) {
-        delete entry;
+    // Write out the last batch of changes before the hosts are gone
+    if (m_SaveHostsTimer.isActive()) {
+        m_SaveHostsTimer.stop();
+        lock.unlock();
+        saveHosts();
+        lock.relock();
     }
 
     // Destroy all NvComputer objects now that polling is halted
@@ -202,18 +110,109 @@ ComputerManager::~ComputerManager()
     }
 }
 
+void ComputerManager::saveMdnsHostCache()
+{
+    QSettings settings;
+
+    settings.remove(SER_MDNSCACHE);
+    settings.beginWriteArray(SER_MDNSCACHE);
+    int i = 0;
+    for (auto host = m_MdnsHostCache.constBegin(); host != m_MdnsHostCache.constEnd(); ++host) {
+        QStringList addresses;
+        for (const QHostAddress& address : host.value().addresses) {
+            addresses.append(address.toString());
+        }
+
+        settings.setArrayIndex(i++);
+        settings.setValue(SER_MDNSHOSTNAME, host.key());
+        settings.setValue(SER_MDNSADDRESSES, addresses);
+        settings.setValue(SER_MDNSEXPIRY, host.value().expiry);
+    }
+    settings.endArray();
+}
+
+class HostSaveTask : public QRunnable
+{
+public:
+    HostSaveTask(ComputerManager* cm)
+        : m_ComputerManager(cm) {}
+
+    void run()
+    {
+        m_ComputerManager->saveHosts();
+    }
+
+private:
+    ComputerManager* m_ComputerManager;
+};
+
+void ComputerManager::markHostDirty(NvComputer* computer)
+{
+    {
+        QMutexLocker lock(&m_DirtyHostsLock);
+        m_DirtyHosts.insert(computer->uuid);
+    }
+
+    scheduleSaveHosts();
+}
+
+void ComputerManager::scheduleSaveHosts()
+{
+    // Let the changes from a round of polls pile up
+    // rather than writing after each one
+    if (!m_SaveHostsTimer.isActive()) {
+        m_SaveHostsTimer.start();
+    }
+}
+
+void ComputerManager::handleSaveHostsTimerFired()
+{
+    // Punt to a worker thread to avoid stalling the UI
+    // while the settings are written out
+    QThreadPool::globalInstance()->start(new HostSaveTask(this));
+}
+
 void ComputerManager::saveHosts()
 {
+    QMutexLocker saveLock(&m_SaveLock);
+
+    QSet<QString> dirtyHosts;
+    {
+        QMutexLocker lock(&m_DirtyHostsLock);
+        dirtyHosts.swap(m_DirtyHosts);
+    }
+
     QSettings settings;
+
+    // Hosts can't be deleted while they're being written out
     QReadLocker lock(&m_Lock);
 
-    settings.remove(SER_HOSTS);
-    settings.beginWriteArray(SER_HOSTS);
-    for (int i = 0; i < m_KnownHosts.count(); i++) {
-        settings.setArrayIndex(i);
-        m_KnownHosts.value(m_KnownHosts.keys()[i])->serialize(settings);
+    bool hostListChanged = m_SavedHostOrder.count() != m_KnownHosts.count();
+    for (int i = 0; i < m_SavedHostOrder.count() && !hostListChanged; i++) {
+        hostListChanged = !m_KnownHosts.contains(m_SavedHostOrder[i]);
+    }
+
+    if (hostListChanged) {
+        // Hosts were added or removed, so write the whole list again
+        m_SavedHostOrder = m_KnownHosts.keys();
+
+        settings.remove(SER_HOSTS);
+        settings.beginWriteArray(SER_HOSTS);
+        for (int i = 0; i < m_SavedHostOrder.count(); i++) {
+            settings.setArrayIndex(i);
+            m_KnownHosts.value(m_SavedHostOrder[i])->serialize(settings);
+        }
+        settings.endArray();
+    }
+    else if (!dirtyHosts.isEmpty()) {
+        // Only rewrite the hosts that changed, leaving the rest in place
+        settings.beginWriteArray(SER_HOSTS, m_SavedHostOrder.count());
+        for (const QString& uuid : dirtyHosts) {
+            settings.setArrayIndex(m_SavedHostOrder.indexOf(uuid));
+            m_KnownHosts.value(uuid)->serialize(settings);
+        }
+        settings.endArray();
     }
-    settings.endArray();
 }
 
 QHostAddress ComputerManager::getBestGlobalAddressV6(QVector<QHostAddress> &addresses)
@@ -266,20 +265,20 @@ void ComputerManager::startPolling()
         // Start an MDNS query for GameStream hosts
         m_MdnsBrowser = new QMdnsEngine::Browser(&m_MdnsServer, "_nvstream._tcp.local.", &m_MdnsCache);
         connect(m_MdnsBrowser, &QMdnsEngine::Browser::serviceAdded,
-                this, [this](const QMdnsEngine::Service& service) {
-            qInfo() << "Discovered mDNS host:" << service.hostname();
-
-            MdnsPendingComputer* pendingComputer = new MdnsPendingComputer(&m_MdnsServer, service);
-            connect(pendingComputer, &MdnsPendingComputer::resolvedHost,
-                    this, &ComputerManager::handleMdnsServiceResolved);
-            m_PendingResolution.append(pendingComputer);
-        });
+                this, &ComputerManager::handleMdnsServiceAdded);
+
+        // The browser sends one query now and then waits a long time
+        // before asking again, so a lost packet or a host that's slow
+        // to answer stalls discovery. Follow up with a short burst,
+        // spaced the way RFC 6762 section 5.2 asks for.
+        QTimer::singleShot(1000, this, SLOT(sendMdnsQuery()));
+        QTimer::singleShot(3000, this, SLOT(sendMdnsQuery()));
     }
     else {
         qWarning() << "mDNS is disabled by user preference";
     }
 
-    // Start polling threads for each known host
+    // Start polling each known host
     QMapIterator<QString, NvComputer*> i(m_KnownHosts);
     while (i.hasNext()) {
         i.next();
@@ -294,26 +293,116 @@ void ComputerManager::startPollingComputer(NvComputer* computer)
         return;
     }
 
-    ComputerPollingEntry* pollingEntry;
+    // The poll scheduler runs on the main thread, and we may be
+    // on the thread pool adding a new host
+    QMetaObject::invokeMethod(this, "pollComputer", Qt::QueuedConnection,
+                              Q_ARG(QString, computer->uuid));
+}
+
+void ComputerManager::pollComputer(QString uuid)
+{
+    NvComputer* computer;
 
-    if (!m_PollEntries.contains(computer->uuid)) {
-        pollingEntry = m_PollEntries[computer->uuid] = new ComputerPollingEntry();
+    {
+        QReadLocker lock(&m_Lock);
+
+        // Polling may have stopped or the host may have been
+        // deleted since this was queued
+        if (m_PollingRef == 0) {
+            return;
+        }
+
+        computer = m_KnownHosts.value(uuid);
+        if (computer == nullptr) {
+            return;
+        }
     }
-    else {
-        pollingEntry = m_PollEntries[computer->uuid];
+
+    m_PollScheduler.addComputer(computer);
+}
+
+void ComputerManager::sendMdnsQuery()
+{
+    // Discovery may have stopped since this was scheduled
+    if (m_MdnsBrowser == nullptr) {
+        return;
     }
 
-    if (!pollingEntry->isActive()) {
-        PcMonitorThread* thread = new PcMonitorThread(computer);
-        connect(thread, SIGNAL(computerStateChanged(NvComputer*)),
-                this, SLOT(handleComputerStateChanged(NvComputer*)));
-        pollingEntry->setActiveThread(thread);
-        thread->start();
+    QMdnsEngine::Query query;
+    query.setName("_nvstream._tcp.local.");
+    query.setType(QMdnsEngine::PTR);
+
+    QMdnsEngine::Message message;
+    message.addQuery(query);
+
+    // Known-answer suppression (RFC 6762 section 7.1). Hosts that see
+    // their own answer in the query don't send it again, which keeps a
+    // LAN full of hosts from all answering every query in the burst.
+    QList<QMdnsEngine::Record> knownAnswers;
+    if (m_MdnsCache.lookupRecords(query.name(), QMdnsEngine::PTR, knownAnswers)) {
+        for (const QMdnsEngine::Record& record : knownAnswers) {
+            message.addRecord(record);
+        }
+    }
+
+    m_MdnsServer.sendMessageToAll(message);
+}
+
+void ComputerManager::handleMdnsServiceAdded(const QMdnsEngine::Service& service)
+{
+    qInfo() << "Discovered mDNS host:" << service.hostname();
+
+    QString hostname = service.hostname();
+    if (m_MdnsHostCache.contains(hostname)) {
+        // Resolving takes a couple of seconds, so start with the
+        // addresses from last time. A stale one just fails its
+        // serverinfo query.
+        addMdnsHost(m_MdnsHostCache[hostname].addresses);
+
+        if (QDateTime::currentDateTimeUtc() < m_MdnsHostCache[hostname].expiry) {
+            // They're still good, so there's nothing to resolve
+            return;
+        }
     }
+
+    MdnsPendingComputer* pendingComputer = new MdnsPendingComputer(&m_MdnsServer, service);
+    connect(pendingComputer, &MdnsPendingComputer::resolvedHost,
+            this, &ComputerManager::handleMdnsServiceResolved);
+    m_PendingResolution.append(pendingComputer);
 }
 
 void ComputerManager::handleMdnsServiceResolved(MdnsPendingComputer* computer,
                                                 QVector<QHostAddress>& addresses)
+{
+    QString hostname = computer->hostname();
+
+    // We've already tried these if they were cached
+    if (!m_MdnsHostCache.contains(hostname) || m_MdnsHostCache[hostname].addresses != addresses) {
+        addMdnsHost(addresses);
+    }
+
+    // Remember them for as long as the host's records say they're good
+    quint32 ttl = MDNS_DEFAULT_HOST_TTL_SECS;
+    QList<QMdnsEngine::Record> records;
+    if (m_MdnsCache.lookupRecords(hostname.toUtf8(), QMdnsEngine::A, records) ||
+            m_MdnsCache.lookupRecords(hostname.toUtf8(), QMdnsEngine::AAAA, records)) {
+        ttl = records.first().ttl();
+        for (const QMdnsEngine::Record& record : records) {
+            ttl = qMin(ttl, record.ttl());
+        }
+    }
+
+    MdnsCachedHost cachedHost;
+    cachedHost.addresses = addresses;
+    cachedHost.expiry = QDateTime::currentDateTimeUtc().addSecs(ttl);
+    m_MdnsHostCache[hostname] = cachedHost;
+    saveMdnsHostCache();
+
+    m_PendingResolution.removeOne(computer);
+    computer->deleteLater();
+}
+
+void ComputerManager::addMdnsHost(QVector<QHostAddress>& addresses)
 {
     QHostAddress v6Global = getBestGlobalAddressV6(addresses);
     bool added = false;
@@ -346,13 +435,13 @@ void ComputerManager::handleMdnsServiceResolved(MdnsPendingComputer* computer,
             }
         }
     }
-
-    m_PendingResolution.removeOne(computer);
-    computer->deleteLater();
 }
 
 void ComputerManager::handleComputerStateChanged(NvComputer* computer)
 {
+    // Everyone handling the signal sees the same copy of the change
+    computer->publishSnapshot();
+
     emit computerStateChanged(computer);
 
     if (computer->pendingQuit && computer->currentGameId == 0) {
@@ -361,7 +450,22 @@ void ComputerManager::handleComputerStateChanged(NvComputer* computer)
     }
 
     // Save updated hosts to QSettings
-    saveHosts();
+    markHostDirty(computer);
+}
+
+void ComputerManager::handleAppListChanged(NvComputer* computer, QVector<NvApp> oldAppList)
+{
+    // Warm up the box art cache for new apps, so the app grid is
+    // filled in the first time it's opened
+    for (NvApp& app : computer->appList) {
+        int oldIndex = oldAppList.indexOf(app);
+        if (oldIndex >= 0 && oldAppList[oldIndex].name != app.name) {
+            // The host may have swapped the game behind this ID
+            m_BoxArtPrefetcher->invalidateBoxArt(computer, app);
+        }
+
+        m_BoxArtPrefetcher->prefetchBoxArt(computer, app);
+    }
 }
 
 QVector<NvComputer*> ComputerManager::getComputers()
@@ -371,58 +475,37 @@ QVector<NvComputer*> ComputerManager::getComputers()
     return QVector<NvComputer*>::fromList(m_KnownHosts.values());
 }
 
-class DeferredHostDeletionTask : public QRunnable
+void ComputerManager::deleteHost(NvComputer* computer)
 {
-public:
-    DeferredHostDeletionTask(ComputerManager* cm, NvComputer* computer)
-        : m_Computer(computer),
-          m_ComputerManager(cm) {}
-
-    void run()
     {
-        ComputerPollingEntry* pollingEntry;
-
-        // Only do the minimum amount of work while holding the writer lock.
-        // We must release it before calling saveHosts().
-        {
-            QWriteLocker lock(&m_ComputerManager->m_Lock);
-
-            pollingEntry = m_ComputerManager->m_PollEntries.take(m_Computer->uuid);
-
-            m_ComputerManager->m_KnownHosts.remove(m_Computer->uuid);
-        }
-
-        // Persist the new host list
-        m_ComputerManager->saveHosts();
-
-        // Delete the polling entry first. This will stop all polling threads too.
-        delete pollingEntry;
-
-        // Finally, delete the computer itself. This must be done
-        // last because the polling thread might be using it.
-        delete m_Computer;
+        // This waits for a save that's writing the host out
+        QWriteLocker lock(&m_Lock);
+        m_KnownHosts.remove(computer->uuid);
     }
 
-private:
-    NvComputer* m_Computer;
-    ComputerManager* m_ComputerManager;
-};
+    // This cancels any poll of the host that's in flight
+    m_PollScheduler.removeComputer(computer);
+    cancelProbes(computer);
+    m_BoxArtPrefetcher->cancelAllBoxArt(computer);
 
-void ComputerManager::deleteHost(NvComputer* computer)
-{
-    // Punt to a worker thread to avoid stalling the
-    // UI while waiting for the polling thread to die
-    QThreadPool::globalInstance()->start(new DeferredHostDeletionTask(this, computer));
+    // Persist the new host list with the next batch
+    scheduleSaveHosts();
+
+    // Nothing is polling or saving the computer anymore, so it can go
+    delete computer;
 }
 
 void ComputerManager::handleAboutToQuit()
 {
-    QWriteLocker lock(&m_Lock);
-
-    // Interrupt polling threads immediately, so they
-    // avoid making additional requests while quitting
-    for (ComputerPollingEntry* entry : m_PollEntries) {
-        entry->interrupt();
+    // Cancel polling immediately, so we avoid
+    // making additional requests while quitting
+    m_PollScheduler.removeAllComputers();
+
+    // Start the last batch of host changes now, since the timer won't
+    // fire again. Quitting waits for the thread pool to finish.
+    if (m_SaveHostsTimer.isActive()) {
+        m_SaveHostsTimer.stop();
+        handleSaveHostsTimerFired();
     }
 }
 
@@ -483,6 +566,96 @@ void ComputerManager::pairHost(NvComputer* computer, QString pin)
     QThreadPool::globalInstance()->start(pairing);
 }
 
+class PendingWakeTask : public QObject, public QRunnable
+{
+    Q_OBJECT
+
+public:
+    PendingWakeTask(ComputerManager* computerManager, NvComputer* computer)
+        : m_Computer(computer)
+    {
+        connect(this, &PendingWakeTask::wakeCompleted,
+                computerManager, &ComputerManager::handleWakeCompleted);
+    }
+
+signals:
+    void wakeCompleted(QString uuid, bool success);
+
+private:
+    void run()
+    {
+        emit wakeCompleted(m_Computer->uuid, m_Computer->wake());
+    }
+
+    NvComputer* m_Computer;
+};
+
+void ComputerManager::setStreamingComputer(QString uuid)
+{
+    NvComputer* computer;
+
+    {
+        QReadLocker lock(&m_Lock);
+        computer = m_KnownHosts.value(uuid);
+    }
+
+    // The poll scheduler and box art fetches live on the main thread
+    m_PollScheduler.setStreamingComputer(computer);
+    BoxArtManager::setFetchingPaused(!uuid.isEmpty());
+}
+
+void ComputerManager::wakeHost(NvComputer* computer)
+{
+    // Resolving the addresses and sending the bursts of packets
+    // would stall the UI
+    PendingWakeTask* wake = new PendingWakeTask(this, computer);
+    QThreadPool::globalInstance()->start(wake);
+}
+
+void ComputerManager::handleWakeCompleted(QString uuid, bool success)
+{
+    if (!success) {
+        return;
+    }
+
+    NvComputer* computer;
+
+    {
+        QReadLocker lock(&m_Lock);
+
+        // The host may have been deleted, or polling stopped,
+        // while the packets were being sent
+        if (m_PollingRef == 0) {
+            return;
+        }
+
+        computer = m_KnownHosts.value(uuid);
+        if (computer == nullptr || computer->state == NvComputer::CS_ONLINE) {
+            return;
+        }
+    }
+
+    m_PollScheduler.fastPollComputer(computer);
+}
+
+void ComputerManager::handleQuitAppSucceeded(QString uuid)
+{
+    NvComputer* computer;
+
+    {
+        QReadLocker lock(&m_Lock);
+
+        // The host may have been deleted while the quit was running
+        computer = m_KnownHosts.value(uuid);
+        if (computer == nullptr) {
+            return;
+        }
+    }
+
+    // This completes the pending quit
+    handleComputerStateChanged(computer);
+}
+
 class PendingQuitTask : public QObject, public QRunnable
 {
     Q_OBJECT
@@ -493,11 +666,15 @@ public:
     {
         connect(this, &PendingQuitTask::quitAppFailed,
                 computerManager, &ComputerManager::quitAppCompleted);
+        connect(this, &PendingQuitTask::quitAppSucceeded,
+                computerManager, &ComputerManager::handleQuitAppSucceeded);
     }
 
 signals:
     void quitAppFailed(QString error);
 
+    void quitAppSucceeded(QString uuid);
+
 private:
     void run()
     {
@@ -507,6 +684,14 @@ private:
             if (m_Computer->currentGameId != 0) {
                 http.quitApp();
             }
+
+            // quitApp() has already checked that nothing is running, so the
+            // quit can complete without waiting for the next poll to see it
+            {
+                QWriteLocker lock(&m_Computer->lock);
+                m_Computer->currentGameId = 0;
+            }
+            emit quitAppSucceeded(m_Computer->uuid);
         } catch (const GfeHttpResponseException& e) {
             {
                 QWriteLocker lock(&m_Computer->lock);
@@ -541,6 +726,87 @@ void ComputerManager::quitRunningApp(NvComputer* computer)
     QThreadPool::globalInstance()->start(quit);
 }
 
+void ComputerManager::probeComputer(NvComputer* computer)
+{
+    QVector<QString> addresses;
+    QSslCertificate serverCert;
+
+    {
+        QReadLocker lock(&computer->lock);
+        addresses = computer->uniqueAddresses();
+        serverCert = computer->serverCert;
+    }
+
+    if (addresses.isEmpty()) {
+        emit computerProbeFailed(computer);
+        return;
+    }
+
+    // Unlike a poll, every address is tried right away
+    for (const QString& address : addresses) {
+        NvHTTP http(address, serverCert);
+        NvHttpRequest* request = http.getServerInfoAsync(NvHTTP::NvLogLevel::NVLL_NONE);
+
+        ProbeRequest probe;
+        probe.computer = computer;
+        probe.address = address;
+        m_ProbeRequests.insert(request, probe);
+
+        connect(request, &NvHttpRequest::completed,
+                this, &ComputerManager::handleProbeCompleted);
+    }
+}
+
+void ComputerManager::cancelProbes(NvComputer* computer)
+{
+    for (auto it = m_ProbeRequests.begin(); it != m_ProbeRequests.end();) {
+        if (it->computer == computer) {
+            it.key()->cancel();
+            it = m_ProbeRequests.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+}
+
+void ComputerManager::handleProbeCompleted()
+{
+    // The request deletes itself once we return
+    NvHttpRequest* request = qobject_cast<NvHttpRequest*>(sender());
+    auto it = m_ProbeRequests.find(request);
+    if (it == m_ProbeRequests.end()) {
+        return;
+    }
+
+    ProbeRequest probe = it.value();
+    m_ProbeRequests.erase(it);
+
+    if (request->isSucceeded()) {
+        NvComputer newState(probe.address, NvHTTP::parseServerInfo(request->getResponse()), QSslCertificate());
+
+        // Ensure the machine that responded is the one we intended to contact
+        if (probe.computer->uuid == newState.uuid) {
+            // The first address to answer wins
+            cancelProbes(probe.computer);
+            NegotiationCache::addressSucceeded(probe.computer->uuid, probe.address);
+
+            probe.computer->update(newState);
+            handleComputerStateChanged(probe.computer);
+            return;
+        }
+    }
+
+    for (const ProbeRequest& other : m_ProbeRequests) {
+        if (other.computer == probe.computer) {
+            // Another address might still answer
+            return;
+        }
+    }
+
+    emit computerProbeFailed(probe.computer);
+}
+
 void ComputerManager::stopPollingAsync()
 {
     QWriteLocker lock(&m_Lock);
@@ -561,10 +827,8 @@ void ComputerManager::stopPollingAsync()
     delete m_MdnsBrowser;
     m_MdnsBrowser = nullptr;
 
-    // Interrupt all threads, but don't wait for them to terminate
-    for (ComputerPollingEntry* entry : m_PollEntries) {
-        entry->interrupt();
-    }
+    // Cancel the polls in flight
+    m_PollScheduler.removeAllComputers();
 }
 
 class PendingAddTask : public QObject, public QRunnable
@@ -627,12 +891,26 @@ private:
 
         qInfo() << "Processing new PC at" << m_Address << "from" << (m_Mdns ? "mDNS" : "user") << m_MdnsIpv6Address;
 
+        // Start with the global IPv6 address if the IPv4 or link-local
+        // IPv6 address just failed, and fall back to the other one
+        QString firstAddress = m_Address;
+        QString secondAddress = m_MdnsIpv6Address.isNull() ? QString() : m_MdnsIpv6Address.toString();
+        if (!secondAddress.isEmpty() && NegotiationCache::hasAddressFailed(firstAddress)) {
+            qSwap(firstAddress, secondAddress);
+        }
+
         // Perform initial serverinfo fetch over HTTP since we don't know which cert to use
+        http.setAddress(firstAddress);
         QString serverInfo = fetchServerInfo(http);
-        if (serverInfo.isEmpty() && !m_MdnsIpv6Address.isNull()) {
-            // Retry using the global IPv6 address if the IPv4 or link-local IPv6 address fails
-            http.setAddress(m_MdnsIpv6Address.toString());
-            serverInfo = fetchServerInfo(http);
+        if (serverInfo.isEmpty()) {
+            NegotiationCache::addressFailed(firstAddress);
+            if (!secondAddress.isEmpty()) {
+                http.setAddress(secondAddress);
+                serverInfo = fetchServerInfo(http);
+                if (serverInfo.isEmpty()) {
+                    NegotiationCache::addressFailed(secondAddress);
+                }
+            }
         }
         if (serverInfo.isEmpty()) {
             return;
@@ -640,6 +918,7 @@ private:
 
         // Create initial newComputer using HTTP serverinfo with no pinned cert
         NvComputer* newComputer = new NvComputer(http.address(), serverInfo, QSslCertificate());
+        NegotiationCache::addressSucceeded(newComputer->uuid, http.address());
 
         // Check if we have a record of this host UUID to pull the pinned cert
         NvComputer* existingComputer;
@@ -651,8 +930,10 @@ private:
             }
         }
 
-        // Fetch serverinfo again over HTTPS with the pinned cert
-        if (existingComputer != nullptr) {
+        // Fetch serverinfo again over HTTPS with the pinned cert, unless
+        // the host just refused it and we'd only get the HTTP answer again
+        if (existingComputer != nullptr &&
+                !NegotiationCache::isHttpsRejected(http.address(), http.serverCert())) {
             serverInfo = fetchServerInfo(http);
             if (serverInfo.isEmpty()) {
                 return;
@@ -710,6 +991,12 @@ private:
                     emit computerAddCompleted(true);
                 }
 
+                // An mDNS announcement means the host just came up, so poll
+                // it now rather than waiting out the offline backoff
+                if (m_Mdns) {
+                    m_ComputerManager->startPollingComputer(existingComputer);
+                }
+
                 // Tell our client if something changed
                 if (changed) {
                     qInfo() << existingComputer->name << "is now at" << existingComputer->activeAddress;
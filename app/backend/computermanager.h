@@ -2,18 +2,25 @@
 
 #include "nvcomputer.h"
 #include "nvpairingmanager.h"
+#include "computerpollscheduler.h"
 
 #include <qmdnsengine/server.h>
 #include <qmdnsengine/cache.h>
 #include <qmdnsengine/browser.h>
 #include <qmdnsengine/service.h>
 #include <qmdnsengine/resolver.h>
+#include <qmdnsengine/message.h>
+#include <qmdnsengine/query.h>
+#include <qmdnsengine/record.h>
+#include <qmdnsengine/dns.h>
 
-#include <QThread>
 #include <QReadWriteLock>
+#include <QMutex>
+#include <QSet>
 #include <QSettings>
 #include <QRunnable>
 #include <QTimer>
+#include <QDateTime>
 
 class MdnsPendingComputer : public QObject
 {
@@ -79,85 +86,16 @@ private:
     QVector<QHostAddress> m_Addresses;
 };
 
-class ComputerPollingEntry
-{
-public:
-    ComputerPollingEntry()
-        : m_ActiveThread(nullptr)
-    {
-
-    }
-
-    virtual ~ComputerPollingEntry()
-    {
-        interrupt();
-
-        // interrupt() should have taken care of this
-        Q_ASSERT(m_ActiveThread == nullptr);
-
-        for (QThread* thread : m_InactiveList) {
-            thread->wait();
-            delete thread;
-        }
-    }
-
-    bool isActive()
-    {
-        cleanInactiveList();
-
-        return m_ActiveThread != nullptr;
-    }
-
-    void setActiveThread(QThread* thread)
-    {
-        cleanInactiveList();
-
-        Q_ASSERT(!isActive());
-        m_ActiveThread = thread;
-    }
-
-    void interrupt()
-    {
-        cleanInactiveList();
-
-        if (m_ActiveThread != nullptr) {
-            // Interrupt the active thread
-            m_ActiveThread->requestInterruption();
-
-            // Place it on the inactive list awaiting death
-            m_InactiveList.append(m_ActiveThread);
-
-            m_ActiveThread = nullptr;
-        }
-    }
-
-private:
-    void cleanInactiveList()
-    {
-        QMutableListIterator<QThread*> i(m_InactiveList);
-
-        // Reap any threads that have finished
-        while (i.hasNext()) {
-            i.next();
-
-            QThread* thread = i.value();
-            if (thread->isFinished()) {
-                delete thread;
-                i.remove();
-            }
-        }
-    }
-
-    QThread* m_ActiveThread;
-    QList<QThread*> m_InactiveList;
-};
+class BoxArtManager;
 
 class ComputerManager : public QObject
 {
     Q_OBJECT
 
-    friend class DeferredHostDeletionTask;
+    friend class HostSaveTask;
     friend class PendingAddTask;
+    friend class PendingWakeTask;
+    friend class PendingQuitTask;
 
 public:
     explicit ComputerManager(QObject *parent = nullptr);
@@ -172,8 +110,21 @@ public:
 
     void pairHost(NvComputer* computer, QString pin);
 
+    // Sends the wake packets on the thread pool, then watches closely
+    // for the computer to come back if we're polling
+    void wakeHost(NvComputer* computer);
+
+    // Cuts polling down to the computer with this UUID and pauses box art
+    // fetches while it's streamed from. An empty UUID resumes everything.
+    Q_INVOKABLE void setStreamingComputer(QString uuid);
+
     void quitRunningApp(NvComputer* computer);
 
+    // Asks a known computer for its serverinfo on all of its addresses at
+    // once, without discovery or polling. computerStateChanged is emitted
+    // when one answers, or computerProbeFailed if none of them do.
+    void probeComputer(NvComputer* computer);
+
     QVector<NvComputer*> getComputers();
 
     // computer is deleted inside this call
@@ -188,26 +139,86 @@ signals:
 
     void quitAppCompleted(QVariant error);
 
+    void computerProbeFailed(NvComputer* computer);
+
 private slots:
     void handleAboutToQuit();
 
     void handleComputerStateChanged(NvComputer* computer);
 
+    void handleMdnsServiceAdded(const QMdnsEngine::Service& service);
+
     void handleMdnsServiceResolved(MdnsPendingComputer* computer, QVector<QHostAddress>& addresses);
 
+    void sendMdnsQuery();
+
+    void pollComputer(QString uuid);
+
+    void handleAppListChanged(NvComputer* computer, QVector<NvApp> oldAppList);
+
+    void handleWakeCompleted(QString uuid, bool success);
+
+    void handleQuitAppSucceeded(QString uuid);
+
+    void handleSaveHostsTimerFired();
+
+    void handleProbeCompleted();
+
 private:
+    // Queues the host to be written out with the next batch
+    void markHostDirty(NvComputer* computer);
+
+    // Starts the countdown to the next batch if it isn't running. A host
+    // being added or removed only needs this, since the save notices.
+    void scheduleSaveHosts();
+
+    // Writes the dirty hosts, or the whole host list if hosts were
+    // added or removed since the last save
     void saveHosts();
 
     QHostAddress getBestGlobalAddressV6(QVector<QHostAddress>& addresses);
 
     void startPollingComputer(NvComputer* computer);
 
+    void addMdnsHost(QVector<QHostAddress>& addresses);
+
+    void saveMdnsHostCache();
+
+    void cancelProbes(NvComputer* computer);
+
+    struct MdnsCachedHost
+    {
+        QVector<QHostAddress> addresses;
+        QDateTime expiry;
+    };
+
     int m_PollingRef;
     QReadWriteLock m_Lock;
     QMap<QString, NvComputer*> m_KnownHosts;
-    QMap<QString, ComputerPollingEntry*> m_PollEntries;
+
+    // Only one save runs at a time, and it owns the list of which host
+    // is at each index of the hosts array in QSettings
+    QMutex m_SaveLock;
+    QStringList m_SavedHostOrder;
+
+    QMutex m_DirtyHostsLock;
+    QSet<QString> m_DirtyHosts;
+    QTimer m_SaveHostsTimer;
+    ComputerPollScheduler m_PollScheduler;
+    BoxArtManager* m_BoxArtPrefetcher;
     QMdnsEngine::Server m_MdnsServer;
     QMdnsEngine::Browser* m_MdnsBrowser;
     QMdnsEngine::Cache m_MdnsCache;
     QVector<MdnsPendingComputer*> m_PendingResolution;
+
+    struct ProbeRequest
+    {
+        NvComputer* computer;
+        QString address;
+    };
+
+    QHash<NvHttpRequest*, ProbeRequest> m_ProbeRequests;
+
+    // Addresses mDNS hostnames resolved to, kept across runs
+    QHash<QString, MdnsCachedHost> m_MdnsHostCache;
 };
@@ -0,0 +1,531 @@
+#include "computerpollscheduler.h"
+#include "negotiationcache.h"
+
+#include <QCryptographicHash>
+#include <QSslCertificate>
+
+#define TRIES_BEFORE_OFFLINING 2
+#define POLLS_PER_APPLIST_FETCH 10
+
+// A few polls at a time keeps up with hundreds of hosts, since an online
+// host answers within milliseconds and is only polled every few seconds
+#define MAX_CONCURRENT_POLLS 8
+
+#define POLL_INTERVAL_MS 3000
+
+// How often the host being streamed from is polled during the stream
+#define STREAMING_POLL_INTERVAL_MS 30000
+#define OFFLINE_POLL_MAX_INTERVAL_MS 30000
+
+// How long an address gets to answer before the next one is tried
+// alongside it. This is the connection attempt delay from Happy Eyeballs.
+#define ADDRESS_STAGGER_MS 250
+
+// A host that was just woken is tried this often for a while. The
+// addresses keep being raced with fresh requests, since a connection
+// attempt that started while the host was asleep only finds out it's
+// back on the next SYN retransmit, which can be seconds away.
+#define FAST_POLL_INTERVAL_MS 250
+#define FAST_POLL_DURATION_MS 60000
+#define FAST_POLL_MAX_REQUESTS 8
+
+ComputerPollScheduler::HostPollState::HostPollState(NvComputer* computer)
+    : computer(computer),
+      http(computer->uniqueAddresses().first(), computer->serverCert),
+      polling(false),
+      appListRequest(nullptr),
+      nextAddressIndex(0),
+      nextAddressTime(0),
+      tries(0),
+      wasOnline(false),
+      stateChanged(false),
+      // Always fetch the applist the first time
+      pollsSinceLastAppListFetch(POLLS_PER_APPLIST_FETCH),
+      offlinePolls(0),
+      nextPollTime(0),
+      wakeTime(0),
+      fastPollEndTime(0)
+{
+
+}
+
+ComputerPollScheduler::ComputerPollScheduler(QObject* parent)
+    : QObject(parent),
+      m_ActivePolls(0),
+      m_StreamingComputer(nullptr)
+{
+    m_Timer.setSingleShot(true);
+    connect(&m_Timer, &QTimer::timeout, this, &ComputerPollScheduler::runDuePolls);
+    m_Clock.start();
+}
+
+ComputerPollScheduler::~ComputerPollScheduler()
+{
+    removeAllComputers();
+}
+
+void ComputerPollScheduler::addComputer(NvComputer* computer)
+{
+    HostPollState* host = m_Hosts.value(computer);
+    if (host == nullptr) {
+        host = new HostPollState(computer);
+        m_Hosts.insert(computer, host);
+    }
+    else {
+        // We were just told the host is there (by an mDNS announcement),
+        // so forget about any backoff from when it was offline
+        host->offlinePolls = 0;
+        if (!host->polling) {
+            host->nextPollTime = 0;
+        }
+    }
+
+    runDuePolls();
+}
+
+void ComputerPollScheduler::removeComputer(NvComputer* computer)
+{
+    if (computer == m_StreamingComputer) {
+        m_StreamingComputer = nullptr;
+    }
+
+    HostPollState* host = m_Hosts.take(computer);
+    if (host == nullptr) {
+        return;
+    }
+
+    cancelPoll(host);
+    delete host;
+
+    // Let another host have the slot
+    runDuePolls();
+}
+
+void ComputerPollScheduler::removeAllComputers()
+{
+    m_Timer.stop();
+
+    for (HostPollState* host : m_Hosts) {
+        cancelPoll(host);
+        delete host;
+    }
+    m_Hosts.clear();
+
+    Q_ASSERT(m_ActivePolls == 0);
+    Q_ASSERT(m_Requests.isEmpty());
+}
+
+void ComputerPollScheduler::fastPollComputer(NvComputer* computer)
+{
+    HostPollState* host = m_Hosts.value(computer);
+    if (host == nullptr) {
+        return;
+    }
+
+    host->wakeTime = m_Clock.elapsed();
+    host->fastPollEndTime = host->wakeTime + FAST_POLL_DURATION_MS;
+    host->offlinePolls = 0;
+    if (!host->polling) {
+        host->nextPollTime = 0;
+    }
+    else {
+        host->nextAddressTime = 0;
+    }
+
+    runDuePolls();
+}
+
+void ComputerPollScheduler::setStreamingComputer(NvComputer* computer)
+{
+    if (computer == m_StreamingComputer) {
+        return;
+    }
+
+    m_StreamingComputer = computer;
+
+    for (HostPollState* host : m_Hosts) {
+        if (computer != nullptr) {
+            // Give up on polls of the other hosts that are in flight.
+            // They're started over once the stream ends.
+            if (isPollingPaused(host)) {
+                cancelPoll(host);
+            }
+            else if (!host->polling) {
+                host->nextPollTime = m_Clock.elapsed() + STREAMING_POLL_INTERVAL_MS;
+            }
+        }
+        else if (!host->polling) {
+            // Everything may have changed while we were streaming
+            host->nextPollTime = 0;
+        }
+    }
+
+    runDuePolls();
+}
+
+bool ComputerPollScheduler::isPollingPaused(HostPollState* host)
+{
+    return m_StreamingComputer != nullptr && host->computer != m_StreamingComputer;
+}
+
+bool ComputerPollScheduler::isFastPolling(HostPollState* host)
+{
+    return host->fastPollEndTime > m_Clock.elapsed();
+}
+
+bool ComputerPollScheduler::canStartNextAddress(HostPollState* host)
+{
+    if (host->nextAddressIndex < host->addresses.count()) {
+        return true;
+    }
+
+    // Start another round of requests for a host we're waiting to wake up
+    return isFastPolling(host) && host->serverInfoRequests.count() < FAST_POLL_MAX_REQUESTS;
+}
+
+void ComputerPollScheduler::runDuePolls()
+{
+    qint64 now = m_Clock.elapsed();
+
+    // Bring in the next address of hosts that haven't answered yet
+    for (HostPollState* host : m_Hosts) {
+        if (host->polling && host->appListRequest == nullptr &&
+                !isPollingPaused(host) &&
+                canStartNextAddress(host) &&
+                host->nextAddressTime <= now) {
+            startNextAddress(host);
+        }
+    }
+
+    while (m_ActivePolls < MAX_CONCURRENT_POLLS) {
+        // Hosts that were online last time go first, so hosts that are
+        // timing out can't hold up the ones that answer right away
+        HostPollState* next = nullptr;
+        for (HostPollState* host : m_Hosts) {
+            if (host->polling || host->nextPollTime > now || isPollingPaused(host)) {
+                continue;
+            }
+
+            if (next == nullptr ||
+                    (host->wasOnline && !next->wasOnline) ||
+                    (host->wasOnline == next->wasOnline && host->nextPollTime < next->nextPollTime)) {
+                next = host;
+            }
+        }
+
+        if (next == nullptr) {
+            break;
+        }
+
+        beginPoll(next);
+    }
+
+    scheduleNextRun();
+}
+
+void ComputerPollScheduler::scheduleNextRun()
+{
+    bool found = false;
+    qint64 nextRunTime = 0;
+    for (HostPollState* host : m_Hosts) {
+        if (isPollingPaused(host)) {
+            continue;
+        }
+
+        qint64 hostTime;
+        if (host->polling) {
+            if (host->appListRequest != nullptr ||
+                    !canStartNextAddress(host)) {
+                continue;
+            }
+
+            hostTime = host->nextAddressTime;
+        }
+        else if (m_ActivePolls < MAX_CONCURRENT_POLLS) {
+            hostTime = host->nextPollTime;
+        }
+        else {
+            // A finished poll will run us again to fill its slot
+            continue;
+        }
+
+        if (!found || hostTime < nextRunTime) {
+            nextRunTime = hostTime;
+            found = true;
+        }
+    }
+
+    if (found) {
+        m_Timer.start((int)qMax(nextRunTime - m_Clock.elapsed(), (qint64)0));
+    }
+    else {
+        m_Timer.stop();
+    }
+}
+
+void ComputerPollScheduler::beginPoll(HostPollState* host)
+{
+    host->polling = true;
+    m_ActivePolls++;
+
+    host->addresses = NegotiationCache::orderAddresses(host->computer->uuid,
+                                                       host->computer->uniqueAddresses());
+    host->tries = 0;
+    host->wasOnline = host->computer->state == NvComputer::CS_ONLINE;
+    host->stateChanged = false;
+
+    if (host->addresses.isEmpty()) {
+        finishPoll(host, false);
+        return;
+    }
+
+    startRace(host);
+}
+
+void ComputerPollScheduler::startRace(HostPollState* host)
+{
+    Q_ASSERT(host->serverInfoRequests.isEmpty());
+
+    // The addresses start in order, so the one that worked last
+    // time gets a head start on the others and the ones that just
+    // failed go last
+    host->nextAddressIndex = 0;
+    startNextAddress(host);
+}
+
+void ComputerPollScheduler::startNextAddress(HostPollState* host)
+{
+    // Fast polling goes around the addresses again
+    int index = host->nextAddressIndex++ % host->addresses.count();
+
+    host->http.setAddress(host->addresses[index]);
+    host->http.setServerCert(host->computer->serverCert);
+
+    NvHttpRequest* request = host->http.getServerInfoAsync(NvHTTP::NvLogLevel::NVLL_NONE);
+    host->serverInfoRequests.insert(request, index);
+    trackRequest(host, request);
+
+    host->nextAddressTime = m_Clock.elapsed() + ADDRESS_STAGGER_MS;
+}
+
+void ComputerPollScheduler::cancelServerInfoRequests(HostPollState* host)
+{
+    for (NvHttpRequest* request : host->serverInfoRequests.keys()) {
+        m_Requests.remove(request);
+        request->cancel();
+    }
+    host->serverInfoRequests.clear();
+}
+
+void ComputerPollScheduler::handleServerInfoCompleted(HostPollState* host, NvHttpRequest* request)
+{
+    int index = host->serverInfoRequests.take(request);
+
+    if (request->isSucceeded()) {
+        NvComputer newState(host->addresses[index], NvHTTP::parseServerInfo(request->getResponse()), QSslCertificate());
+
+        // Ensure the machine that responded is the one we intended to contact
+        if (host->computer->uuid == newState.uuid) {
+            // The first address to answer wins the race
+            cancelServerInfoRequests(host);
+            NegotiationCache::addressSucceeded(host->computer->uuid, host->addresses[index]);
+
+            if (host->computer->update(newState)) {
+                host->stateChanged = true;
+            }
+
+            if (!host->wasOnline) {
+                qInfo() << host->computer->name << "is now online at" << host->computer->activeAddress;
+            }
+
+            if (host->wakeTime != 0) {
+                qInfo() << host->computer->name << "came online"
+                        << m_Clock.elapsed() - host->wakeTime << "ms after being woken";
+                host->wakeTime = 0;
+                host->fastPollEndTime = 0;
+            }
+
+            pollAppListIfNeeded(host);
+            return;
+        }
+
+        qInfo() << "Found unexpected PC " << newState.name << " looking for " << host->computer->name;
+    }
+    else {
+        NegotiationCache::addressFailed(host->addresses[index]);
+    }
+
+    // Don't wait out the stagger delay once an address has failed
+    if (host->nextAddressIndex < host->addresses.count()) {
+        startNextAddress(host);
+        return;
+    }
+
+    // Keep waiting if another address is still in the race
+    if (!host->serverInfoRequests.isEmpty()) {
+        return;
+    }
+
+    // Every address failed, so go around again until we're out of tries
+    if (++host->tries < TRIES_BEFORE_OFFLINING) {
+        startRace(host);
+        return;
+    }
+
+    if (host->computer->state != NvComputer::CS_OFFLINE) {
+        qInfo() << host->computer->name << "is now offline";
+
+        QWriteLocker lock(&host->computer->lock);
+        host->computer->state = NvComputer::CS_OFFLINE;
+        host->stateChanged = true;
+    }
+
+    finishPoll(host, false);
+}
+
+void ComputerPollScheduler::pollAppListIfNeeded(HostPollState* host)
+{
+    NvComputer* computer = host->computer;
+
+    // Grab the applist if it's empty or it's been long enough that we need to refresh
+    host->pollsSinceLastAppListFetch++;
+    if (computer->state == NvComputer::CS_ONLINE &&
+            computer->pairState == NvComputer::PS_PAIRED &&
+            (computer->appList.isEmpty() || host->pollsSinceLastAppListFetch >= POLLS_PER_APPLIST_FETCH)) {
+        Q_ASSERT(computer->activeAddress != nullptr);
+
+        host->http.setAddress(computer->activeAddress);
+        host->http.setServerCert(computer->serverCert);
+        host->appListRequest = host->http.getAppListAsync();
+        trackRequest(host, host->appListRequest);
+
+        // Notify while the app list request is out since it may take a while, and we
+        // don't want to delay onlining of a machine, especially if we already have a
+        // cached list.
+        if (host->stateChanged) {
+            host->stateChanged = false;
+            emit computerStateChanged(computer);
+        }
+        return;
+    }
+
+    finishPoll(host, true);
+}
+
+void ComputerPollScheduler::handleAppListCompleted(HostPollState* host, NvHttpRequest* request)
+{
+    if (request->isSucceeded()) {
+        QByteArray response = request->getResponse();
+        QByteArray hash = QCryptographicHash::hash(response, QCryptographicHash::Sha256);
+
+        if (hash == host->appListHash && !host->computer->appList.isEmpty()) {
+            // Nothing changed since the last fetch
+            host->pollsSinceLastAppListFetch = 0;
+        }
+        else {
+            QVector<NvApp> appList = NvHTTP::parseAppList(QString::fromUtf8(response));
+            if (!appList.isEmpty()) {
+                QVector<NvApp> oldAppList;
+
+                {
+                    // NvApp only compares IDs, but the response changing
+                    // means a name or HDR support might have too
+                    QWriteLocker lock(&host->computer->lock);
+                    oldAppList = host->computer->appList;
+                    host->computer->appList = appList;
+                    host->computer->sortAppList();
+                    host->stateChanged = true;
+                }
+
+                host->appListHash = hash;
+                host->pollsSinceLastAppListFetch = 0;
+
+                emit appListChanged(host->computer, oldAppList);
+            }
+        }
+    }
+
+    finishPoll(host, true);
+}
+
+void ComputerPollScheduler::trackRequest(HostPollState* host, NvHttpRequest* request)
+{
+    m_Requests.insert(request, host);
+    connect(request, &NvHttpRequest::completed,
+            this, &ComputerPollScheduler::handleRequestCompleted);
+}
+
+void ComputerPollScheduler::handleRequestCompleted()
+{
+    // The request deletes itself once we return
+    NvHttpRequest* request = static_cast<NvHttpRequest*>(sender());
+    HostPollState* host = m_Requests.take(request);
+    if (host == nullptr) {
+        return;
+    }
+
+    if (request == host->appListRequest) {
+        host->appListRequest = nullptr;
+        handleAppListCompleted(host, request);
+    }
+    else {
+        handleServerInfoCompleted(host, request);
+    }
+}
+
+void ComputerPollScheduler::finishPoll(HostPollState* host, bool online)
+{
+    Q_ASSERT(host->serverInfoRequests.isEmpty() && host->appListRequest == nullptr);
+    host->polling = false;
+    m_ActivePolls--;
+
+    // Back off from hosts that don't answer, since every try
+    // at an offline host waits for the request to time out
+    int interval;
+    if (host->computer == m_StreamingComputer) {
+        interval = STREAMING_POLL_INTERVAL_MS;
+    }
+    else if (online) {
+        host->offlinePolls = 0;
+        interval = POLL_INTERVAL_MS;
+    }
+    else if (isFastPolling(host)) {
+        interval = FAST_POLL_INTERVAL_MS;
+    }
+    else {
+        if (host->wakeTime != 0) {
+            qInfo() << host->computer->name << "didn't come online within"
+                    << FAST_POLL_DURATION_MS << "ms of being woken";
+            host->wakeTime = 0;
+        }
+
+        interval = qMin(POLL_INTERVAL_MS << qMin(host->offlinePolls, 4), OFFLINE_POLL_MAX_INTERVAL_MS);
+        host->offlinePolls++;
+    }
+    host->nextPollTime = m_Clock.elapsed() + interval;
+
+    if (host->stateChanged) {
+        host->stateChanged = false;
+
+        // Tell anyone listening that we've changed state
+        emit computerStateChanged(host->computer);
+    }
+
+    runDuePolls();
+}
+
+void ComputerPollScheduler::cancelPoll(HostPollState* host)
+{
+    cancelServerInfoRequests(host);
+
+    if (host->appListRequest != nullptr) {
+        m_Requests.remove(host->appListRequest);
+        host->appListRequest->cancel();
+        host->appListRequest = nullptr;
+    }
+
+    if (host->polling) {
+        host->polling = false;
+        m_ActivePolls--;
+    }
+}
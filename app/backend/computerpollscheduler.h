@@ -0,0 +1,128 @@
+#pragma once
+
+#include "nvcomputer.h"
+#include "nvhttp.h"
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QTimer>
+
+// Polls the known hosts from the main thread's event loop. Only a few
+// hosts are polled at a time, however many there are, and a host that
+// stops answering is polled less and less often until it's seen again.
+//
+// A host's addresses are raced against each other, starting one a little
+// after the other, and the first to answer as the right PC wins.
+class ComputerPollScheduler : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ComputerPollScheduler(QObject* parent = nullptr);
+
+    virtual ~ComputerPollScheduler();
+
+    // Starts polling the computer, or polls it again right away
+    // if it's already being polled but hasn't been seen lately
+    void addComputer(NvComputer* computer);
+
+    // The computer isn't touched again once this returns
+    void removeComputer(NvComputer* computer);
+
+    void removeAllComputers();
+
+    // Polls a computer that was just sent a wake packet far more often
+    // for a while, so it's seen as soon as it's back. Does nothing if
+    // the computer isn't being polled.
+    void fastPollComputer(NvComputer* computer);
+
+    // While a computer is being streamed from, only it is polled, and far
+    // less often, so the stream has the network to itself. Passing nullptr
+    // polls every host again right away.
+    void setStreamingComputer(NvComputer* computer);
+
+signals:
+    void computerStateChanged(NvComputer* computer);
+
+    void appListChanged(NvComputer* computer, QVector<NvApp> oldAppList);
+
+private slots:
+    void runDuePolls();
+
+    void handleRequestCompleted();
+
+private:
+    class HostPollState
+    {
+    public:
+        explicit HostPollState(NvComputer* computer);
+
+        NvComputer* computer;
+
+        // Kept for the life of the host, so its network access
+        // manager isn't set up again on every poll
+        NvHTTP http;
+
+        bool polling;
+
+        // The serverinfo requests racing each other, by address index
+        QHash<NvHttpRequest*, int> serverInfoRequests;
+        NvHttpRequest* appListRequest;
+
+        QVector<QString> addresses;
+        int nextAddressIndex;
+        qint64 nextAddressTime;
+        int tries;
+        bool wasOnline;
+        bool stateChanged;
+
+        int pollsSinceLastAppListFetch;
+
+        // Hash of the last applist response we parsed, so an
+        // unchanged list isn't parsed again
+        QByteArray appListHash;
+
+        int offlinePolls;
+        qint64 nextPollTime;
+
+        // When the computer was woken and until when it's fast polled,
+        // or 0 if it isn't
+        qint64 wakeTime;
+        qint64 fastPollEndTime;
+    };
+
+    bool isFastPolling(HostPollState* host);
+
+    bool isPollingPaused(HostPollState* host);
+
+    bool canStartNextAddress(HostPollState* host);
+
+    void beginPoll(HostPollState* host);
+
+    void startRace(HostPollState* host);
+
+    void startNextAddress(HostPollState* host);
+
+    void cancelServerInfoRequests(HostPollState* host);
+
+    void pollAppListIfNeeded(HostPollState* host);
+
+    void handleServerInfoCompleted(HostPollState* host, NvHttpRequest* request);
+
+    void handleAppListCompleted(HostPollState* host, NvHttpRequest* request);
+
+    void trackRequest(HostPollState* host, NvHttpRequest* request);
+
+    void finishPoll(HostPollState* host, bool online);
+
+    void cancelPoll(HostPollState* host);
+
+    void scheduleNextRun();
+
+    QHash<NvComputer*, HostPollState*> m_Hosts;
+    QHash<NvHttpRequest*, HostPollState*> m_Requests;
+    int m_ActivePolls;
+    NvComputer* m_StreamingComputer;
+    QTimer m_Timer;
+    QElapsedTimer m_Clock;
+};
@@ -2,20 +2,63 @@
 #include "computermanager.h"
 #include <QTimer>
 
+// How long a known computer has to answer directly before we start
+// discovering and polling as well
+#define POLLING_FALLBACK_DELAY_MS 1500
+
 ComputerSeeker::ComputerSeeker(ComputerManager *manager, QString computerName, QObject *parent)
     : QObject(parent), m_ComputerManager(manager), m_ComputerName(computerName),
-      m_TimeoutTimer(new QTimer(this))
+      m_TimeoutTimer(new QTimer(this)),
+      m_PollingFallbackTimer(new QTimer(this)),
+      m_ProbedComputer(nullptr),
+      m_Polling(false)
 {
     m_TimeoutTimer->setSingleShot(true);
     connect(m_TimeoutTimer, &QTimer::timeout,
             this, &ComputerSeeker::onTimeout);
+    m_PollingFallbackTimer->setSingleShot(true);
+    connect(m_PollingFallbackTimer, &QTimer::timeout,
+            this, &ComputerSeeker::startPolling);
     connect(m_ComputerManager, &ComputerManager::computerStateChanged,
             this, &ComputerSeeker::onComputerUpdated);
+    connect(m_ComputerManager, &ComputerManager::computerProbeFailed,
+            this, &ComputerSeeker::onComputerProbeFailed);
 }
 
 void ComputerSeeker::start(int timeout)
 {
     m_TimeoutTimer->start(timeout);
+
+    // A computer we've paired with is asked directly on the addresses we
+    // saved, which skips discovery and the poll schedule entirely
+    m_ProbedComputer = findKnownComputer();
+    if (m_ProbedComputer != nullptr && isOnline(m_ProbedComputer)) {
+        // Polling already found it online, like when we've been running
+        // in the background for a while. It's reported from the event
+        // loop so our caller doesn't hear back before start() returns.
+        NvComputer* computer = m_ProbedComputer;
+        QTimer::singleShot(0, this, [this, computer]() {
+            onComputerUpdated(computer);
+        });
+    }
+    else if (m_ProbedComputer != nullptr) {
+        m_PollingFallbackTimer->start(POLLING_FALLBACK_DELAY_MS);
+        m_ComputerManager->probeComputer(m_ProbedComputer);
+    }
+    else {
+        startPolling();
+    }
+}
+
+void ComputerSeeker::startPolling()
+{
+    if (m_Polling || !m_TimeoutTimer->isActive()) {
+        return;
+    }
+
+    m_Polling = true;
+    m_PollingFallbackTimer->stop();
+
     // Seek desired computer by both connecting to it directly (this may fail
     // if m_ComputerName is UUID, or the name that doesn't resolve to an IP
     // address) and by polling it using mDNS, hopefully one of these methods
@@ -24,13 +67,37 @@ void ComputerSeeker::start(int timeout)
     m_ComputerManager->startPolling();
 }
 
+void ComputerSeeker::onComputerProbeFailed(NvComputer *computer)
+{
+    if (computer == m_ProbedComputer) {
+        startPolling();
+    }
+}
+
+NvComputer *ComputerSeeker::findKnownComputer() const
+{
+    for (NvComputer *computer : m_ComputerManager->getComputers()) {
+        if (matchComputer(computer) &&
+                computer->pairState == NvComputer::PS_PAIRED &&
+                !computer->serverCert.isNull()) {
+            return computer;
+        }
+    }
+
+    return nullptr;
+}
+
 void ComputerSeeker::onComputerUpdated(NvComputer *computer)
 {
     if (!m_TimeoutTimer->isActive()) {
         return;
     }
     if (matchComputer(computer) && isOnline(computer)) {
-        m_ComputerManager->stopPollingAsync();
+        if (m_Polling) {
+            m_ComputerManager->stopPollingAsync();
+            m_Polling = false;
+        }
+        m_PollingFallbackTimer->stop();
         m_TimeoutTimer->stop();
         emit computerFound(computer);
     }
@@ -61,6 +128,10 @@ bool ComputerSeeker::isOnline(NvComputer *computer) const
 void ComputerSeeker::onTimeout()
 {
     m_TimeoutTimer->stop();
-    m_ComputerManager->stopPollingAsync();
+    m_PollingFallbackTimer->stop();
+    if (m_Polling) {
+        m_ComputerManager->stopPollingAsync();
+        m_Polling = false;
+    }
     emit errorTimeout();
 }
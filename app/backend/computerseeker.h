@@ -12,6 +12,8 @@ class ComputerSeeker : public QObject
 public:
     explicit ComputerSeeker(ComputerManager *manager, QString computerName, QObject *parent = nullptr);
 
+    // A known, paired computer is asked for its serverinfo directly first.
+    // Discovery and polling only start if that doesn't find it quickly.
     void start(int timeout);
 
 signals:
@@ -20,14 +22,20 @@ signals:
 
 private slots:
     void onComputerUpdated(NvComputer *computer);
+    void onComputerProbeFailed(NvComputer *computer);
     void onTimeout();
+    void startPolling();
 
 private:
     bool matchComputer(NvComputer *computer) const;
     bool isOnline(NvComputer *computer) const;
+    NvComputer *findKnownComputer() const;
 
 private:
     ComputerManager *m_ComputerManager;
     QString m_ComputerName;
     QTimer *m_TimeoutTimer;
+    QTimer *m_PollingFallbackTimer;
+    NvComputer *m_ProbedComputer;
+    bool m_Polling;
 };
@@ -2,6 +2,8 @@
 #include "utils.h"
 
 #include <QDebug>
+#include <QRunnable>
+#include <QThreadPool>
 
 #include <openssl/pem.h>
 #include <openssl/rsa.h>
@@ -13,18 +15,45 @@
 #define SER_CERT "certificate"
 #define SER_KEY "key"
 
-IdentityManager* IdentityManager::s_Im = nullptr;
+QAtomicPointer<IdentityManager> IdentityManager::s_Im;
+QMutex IdentityManager::s_InitLock;
+
+class IdentityLoadTask : public QRunnable
+{
+public:
+    void run() override
+    {
+        IdentityManager::get();
+    }
+};
 
 IdentityManager*
 IdentityManager::get()
 {
-    // This will always be called first on the main thread,
-    // so it's safe to initialize without locks.
-    if (s_Im == nullptr) {
-        s_Im = new IdentityManager();
+    IdentityManager* im = s_Im.loadAcquire();
+    if (im != nullptr) {
+        return im;
+    }
+
+    // If the thread pool is already generating the identity,
+    // this waits for it to finish
+    QMutexLocker lock(&s_InitLock);
+
+    im = s_Im.loadAcquire();
+    if (im == nullptr) {
+        im = new IdentityManager();
+        s_Im.storeRelease(im);
     }
 
-    return s_Im;
+    return im;
+}
+
+void
+IdentityManager::prepareAsync()
+{
+    if (s_Im.loadAcquire() == nullptr) {
+        QThreadPool::globalInstance()->start(new IdentityLoadTask());
+    }
 }
 
 void IdentityManager::createCredentials(QSettings& settings)
@@ -102,6 +131,8 @@ void IdentityManager::createCredentials(QSettings& settings)
     settings.setValue(SER_KEY, m_CachedPrivateKey);
 
     qInfo() << "Wrote new identity credentials to settings";
+
+    parseCredentials();
 }
 
 IdentityManager::IdentityManager()
@@ -115,71 +146,79 @@ IdentityManager::IdentityManager()
         qInfo() << "No existing credentials found";
         createCredentials(settings);
     }
-    else if (getSslCertificate().isNull()) {
-        qWarning() << "Certificate is unreadable";
-        createCredentials(settings);
-    }
-    else if (getSslKey().isNull()) {
-        qWarning() << "Private key is unreadable";
-        createCredentials(settings);
+    else {
+        parseCredentials();
+
+        if (m_CachedSslCert.isNull()) {
+            qWarning() << "Certificate is unreadable";
+            createCredentials(settings);
+        }
+        else if (m_CachedSslKey.isNull()) {
+            qWarning() << "Private key is unreadable";
+            createCredentials(settings);
+        }
     }
 
     // We should have valid credentials now. If not, we're screwed
-    if (getSslCertificate().isNull()) {
+    if (m_CachedSslCert.isNull()) {
         qFatal("Newly generated certificate is unreadable");
     }
-    if (getSslKey().isNull()) {
+    if (m_CachedSslKey.isNull()) {
         qFatal("Newly generated private key is unreadable");
     }
+
+    // Every request uses this, so only build it once
+    m_CachedSslConfig = QSslConfiguration::defaultConfiguration();
+    m_CachedSslConfig.setLocalCertificate(m_CachedSslCert);
+    m_CachedSslConfig.setPrivateKey(m_CachedSslKey);
 }
 
 QSslCertificate
 IdentityManager::getSslCertificate()
 {
-    if (m_CachedSslCert.isNull()) {
-        m_CachedSslCert = QSslCertificate(m_CachedPemCert);
-    }
     return m_CachedSslCert;
 }
 
 QSslKey
 IdentityManager::getSslKey()
 {
-    if (m_CachedSslKey.isNull()) {
-        BIO* bio = BIO_new_mem_buf(m_CachedPrivateKey.data(), -1);
-        THROW_BAD_ALLOC_IF_NULL(bio);
+    return m_CachedSslKey;
+}
+
+void
+IdentityManager::parseCredentials()
+{
+    m_CachedSslCert = QSslCertificate(m_CachedPemCert);
+
+    BIO* bio = BIO_new_mem_buf(m_CachedPrivateKey.data(), -1);
+    THROW_BAD_ALLOC_IF_NULL(bio);
 
-        EVP_PKEY* pk = PEM_read_bio_PrivateKey(bio, nullptr, nullptr, nullptr);
-        BIO_free(bio);
+    EVP_PKEY* pk = PEM_read_bio_PrivateKey(bio, nullptr, nullptr, nullptr);
+    BIO_free(bio);
 
-        bio = BIO_new(BIO_s_mem());
-        THROW_BAD_ALLOC_IF_NULL(bio);
+    bio = BIO_new(BIO_s_mem());
+    THROW_BAD_ALLOC_IF_NULL(bio);
 
-        // We must write out our PEM in the old PKCS1 format for SecureTransport
-        // on macOS/iOS to be able to read it.
+    // We must write out our PEM in the old PKCS1 format for SecureTransport
+    // on macOS/iOS to be able to read it.
 #ifdef Q_OS_DARWIN
-        PEM_write_bio_PrivateKey_traditional(bio, pk, nullptr, nullptr, 0, nullptr, 0);
+    PEM_write_bio_PrivateKey_traditional(bio, pk, nullptr, nullptr, 0, nullptr, 0);
 #else
-        PEM_write_bio_PrivateKey(bio, pk, nullptr, nullptr, 0, nullptr, 0);
+    PEM_write_bio_PrivateKey(bio, pk, nullptr, nullptr, 0, nullptr, 0);
 #endif
 
-        BUF_MEM* mem;
-        BIO_get_mem_ptr(bio, &mem);
-        m_CachedSslKey = QSslKey(QByteArray::fromRawData(mem->data, (int)mem->length), QSsl::Rsa);
+    BUF_MEM* mem;
+    BIO_get_mem_ptr(bio, &mem);
+    m_CachedSslKey = QSslKey(QByteArray::fromRawData(mem->data, (int)mem->length), QSsl::Rsa);
 
-        BIO_free(bio);
-        EVP_PKEY_free(pk);
-    }
-    return m_CachedSslKey;
+    BIO_free(bio);
+    EVP_PKEY_free(pk);
 }
 
 QSslConfiguration
 IdentityManager::getSslConfig()
 {
-    QSslConfiguration sslConfig(QSslConfiguration::defaultConfiguration());
-    sslConfig.setLocalCertificate(getSslCertificate());
-    sslConfig.setPrivateKey(getSslKey());
-    return sslConfig;
+    return m_CachedSslConfig;
 }
 
 QString
@@ -4,6 +4,8 @@
 #include <QSslCertificate>
 #include <QSslKey>
 #include <QSettings>
+#include <QAtomicPointer>
+#include <QMutex>
 
 class IdentityManager
 {
@@ -20,10 +22,18 @@ public:
     QSslConfiguration
     getSslConfig();
 
+    // Blocks until the identity is loaded, or generated if this is
+    // the first launch
     static
     IdentityManager*
     get();
 
+    // Starts loading or generating the identity on the thread pool, so
+    // the first request doesn't have to wait for the key to be created
+    static
+    void
+    prepareAsync();
+
 private:
     IdentityManager();
 
@@ -36,14 +46,19 @@ private:
     void
     createCredentials(QSettings& settings);
 
+    void
+    parseCredentials();
+
     // Initialized in constructor
     QByteArray m_CachedPrivateKey;
     QByteArray m_CachedPemCert;
+    QSslCertificate m_CachedSslCert;
+    QSslKey m_CachedSslKey;
+    QSslConfiguration m_CachedSslConfig;
 
     // Lazy initialized
     QString m_CachedUniqueId;
-    QSslCertificate m_CachedSslCert;
-    QSslKey m_CachedSslKey;
 
-    static IdentityManager* s_Im;
+    static QAtomicPointer<IdentityManager> s_Im;
+    static QMutex s_InitLock;
 };
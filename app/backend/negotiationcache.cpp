@@ -0,0 +1,196 @@
+#include "negotiationcache.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QSettings>
+
+#define SER_NEGOTIATION "negotiation"
+#define SER_ADDRESS "address"
+#define SER_TIME "time"
+
+// How long the last address that answered keeps its place at the front
+#define LAST_ADDRESS_TTL_MS (7 * 24 * 60 * 60 * 1000LL)
+
+// The saved time of the last address is only rewritten this often,
+// since every successful poll refreshes it
+#define LAST_ADDRESS_SAVE_INTERVAL_MS (60 * 60 * 1000LL)
+
+// How long a failed address stays at the back. This is a few polls, so
+// an address that comes back is first again soon.
+#define FAILED_ADDRESS_TTL_MS (30 * 1000LL)
+
+// How long HTTPS is skipped after the host refused it. Pairing from this
+// client forgets the refusal right away.
+#define HTTPS_REJECTION_TTL_MS (5 * 60 * 1000LL)
+
+QMutex NegotiationCache::s_Lock;
+bool NegotiationCache::s_AddressesLoaded;
+QHash<QString, NegotiationCache::AddressEntry> NegotiationCache::s_LastAddresses;
+QHash<QString, qint64> NegotiationCache::s_FailedAddresses;
+QHash<QString, qint64> NegotiationCache::s_HttpsRejections;
+
+void NegotiationCache::loadAddresses()
+{
+    if (s_AddressesLoaded) {
+        return;
+    }
+
+    s_AddressesLoaded = true;
+
+    QSettings settings;
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+    settings.beginGroup(SER_NEGOTIATION);
+    for (const QString& uuid : settings.childGroups()) {
+        settings.beginGroup(uuid);
+
+        AddressEntry entry;
+        entry.address = settings.value(SER_ADDRESS).toString();
+        entry.timeMs = settings.value(SER_TIME).toLongLong();
+        if (!entry.address.isEmpty() && now - entry.timeMs < LAST_ADDRESS_TTL_MS) {
+            s_LastAddresses.insert(uuid, entry);
+        }
+
+        settings.endGroup();
+
+        // Stale entries age out of the settings too
+        if (!s_LastAddresses.contains(uuid)) {
+            settings.remove(uuid);
+        }
+    }
+    settings.endGroup();
+}
+
+QVector<QString> NegotiationCache::orderAddresses(const QString& uuid, const QVector<QString>& addresses)
+{
+    QMutexLocker lock(&s_Lock);
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+    loadAddresses();
+
+    QString lastAddress;
+    auto lastIt = s_LastAddresses.find(uuid);
+    if (lastIt != s_LastAddresses.end()) {
+        if (now - lastIt->timeMs < LAST_ADDRESS_TTL_MS) {
+            lastAddress = lastIt->address;
+        }
+        else {
+            s_LastAddresses.erase(lastIt);
+        }
+    }
+
+    // Keep the given order otherwise, since it's already by preference
+    QVector<QString> working;
+    QVector<QString> failed;
+    for (const QString& address : addresses) {
+        auto failedIt = s_FailedAddresses.find(address);
+        if (failedIt != s_FailedAddresses.end() && now - *failedIt >= FAILED_ADDRESS_TTL_MS) {
+            s_FailedAddresses.erase(failedIt);
+            failedIt = s_FailedAddresses.end();
+        }
+
+        if (address == lastAddress) {
+            working.prepend(address);
+        }
+        else if (failedIt != s_FailedAddresses.end()) {
+            failed.append(address);
+        }
+        else {
+            working.append(address);
+        }
+    }
+
+    return working + failed;
+}
+
+void NegotiationCache::addressSucceeded(const QString& uuid, const QString& address)
+{
+    QMutexLocker lock(&s_Lock);
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+    loadAddresses();
+
+    s_FailedAddresses.remove(address);
+
+    AddressEntry& entry = s_LastAddresses[uuid];
+    bool save = entry.address != address || now - entry.timeMs >= LAST_ADDRESS_SAVE_INTERVAL_MS;
+    entry.address = address;
+    if (!save) {
+        return;
+    }
+
+    entry.timeMs = now;
+
+    QSettings settings;
+    settings.beginGroup(SER_NEGOTIATION);
+    settings.beginGroup(uuid);
+    settings.setValue(SER_ADDRESS, address);
+    settings.setValue(SER_TIME, now);
+}
+
+void NegotiationCache::addressFailed(const QString& address)
+{
+    QMutexLocker lock(&s_Lock);
+
+    s_FailedAddresses.insert(address, QDateTime::currentMSecsSinceEpoch());
+}
+
+bool NegotiationCache::hasAddressFailed(const QString& address)
+{
+    QMutexLocker lock(&s_Lock);
+
+    auto it = s_FailedAddresses.find(address);
+    return it != s_FailedAddresses.end() &&
+            QDateTime::currentMSecsSinceEpoch() - *it < FAILED_ADDRESS_TTL_MS;
+}
+
+QString NegotiationCache::getHttpsKey(const QString& address, const QSslCertificate& serverCert)
+{
+    // A new certificate from pairing again is a fresh start
+    return address + "/" + serverCert.digest(QCryptographicHash::Sha256).toHex();
+}
+
+bool NegotiationCache::isHttpsRejected(const QString& address, const QSslCertificate& serverCert)
+{
+    QMutexLocker lock(&s_Lock);
+    QString key = getHttpsKey(address, serverCert);
+
+    auto it = s_HttpsRejections.find(key);
+    if (it == s_HttpsRejections.end()) {
+        return false;
+    }
+    else if (QDateTime::currentMSecsSinceEpoch() - *it >= HTTPS_REJECTION_TTL_MS) {
+        s_HttpsRejections.erase(it);
+        return false;
+    }
+
+    return true;
+}
+
+void NegotiationCache::setHttpsRejected(const QString& address, const QSslCertificate& serverCert, bool rejected)
+{
+    QMutexLocker lock(&s_Lock);
+    QString key = getHttpsKey(address, serverCert);
+
+    if (rejected) {
+        s_HttpsRejections.insert(key, QDateTime::currentMSecsSinceEpoch());
+    }
+    else {
+        s_HttpsRejections.remove(key);
+    }
+}
+
+void NegotiationCache::forgetHttpsOutcomes(const QString& address)
+{
+    QMutexLocker lock(&s_Lock);
+    QString prefix = address + "/";
+
+    for (auto it = s_HttpsRejections.begin(); it != s_HttpsRejections.end();) {
+        if (it.key().startsWith(prefix)) {
+            it = s_HttpsRejections.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <QHash>
+#include <QMutex>
+#include <QSslCertificate>
+#include <QString>
+#include <QVector>
+
+// Remembers how each host was last reached, so the first request goes
+// straight to what worked last time instead of repeating the same failed
+// attempts on every poll and launch:
+// - The address that last answered as the host, which is kept across
+//   restarts and tried first.
+// - Addresses that just failed, which are tried last for a little while.
+// - Whether the host just refused HTTPS with our pinned certificate (by
+//   not recognizing us as paired), so serverinfo goes straight to HTTP.
+//
+// Every entry ages out, since hosts move between networks and get paired
+// and unpaired. Safe to use from any thread.
+class NegotiationCache
+{
+public:
+    // Returns the addresses with the one that last answered as the host
+    // first and the ones that recently failed last
+    static QVector<QString> orderAddresses(const QString& uuid, const QVector<QString>& addresses);
+
+    static void addressSucceeded(const QString& uuid, const QString& address);
+
+    static void addressFailed(const QString& address);
+
+    static bool hasAddressFailed(const QString& address);
+
+    // Whether the host at the address refused HTTPS with this server
+    // certificate pinned recently
+    static bool isHttpsRejected(const QString& address, const QSslCertificate& serverCert);
+
+    static void setHttpsRejected(const QString& address, const QSslCertificate& serverCert, bool rejected);
+
+    // Forgets the HTTPS outcomes for the address after pairing with it
+    static void forgetHttpsOutcomes(const QString& address);
+
+private:
+    static QString getHttpsKey(const QString& address, const QSslCertificate& serverCert);
+
+    static void loadAddresses();
+
+    struct AddressEntry
+    {
+        QString address;
+        qint64 timeMs;
+    };
+
+    static QMutex s_Lock;
+    static bool s_AddressesLoaded;
+    static QHash<QString, AddressEntry> s_LastAddresses;
+    static QHash<QString, qint64> s_FailedAddresses;
+    static QHash<QString, qint64> s_HttpsRejections;
+};
@@ -4,6 +4,9 @@
 #include <QHostInfo>
 #include <QNetworkInterface>
 
+#define WOL_BURST_COUNT 3
+#define WOL_BURST_INTERVAL_MS 100
+
 #define SER_NAME "hostname"
 #define SER_UUID "uuid"
 #define SER_MAC "mac"
@@ -92,16 +95,22 @@ void NvComputer::sortAppList()
 }
 
 NvComputer::NvComputer(QString address, QString serverInfo, QSslCertificate serverCert)
+    : NvComputer(address, NvHTTP::parseServerInfo(serverInfo.toUtf8()), serverCert)
+{
+
+}
+
+NvComputer::NvComputer(QString address, const NvServerInfo& serverInfo, QSslCertificate serverCert)
 {
     this->serverCert = serverCert;
 
-    this->name = NvHTTP::getXmlString(serverInfo, "hostname");
+    this->name = serverInfo.hostname;
     if (this->name.isEmpty()) {
         this->name = "UNKNOWN";
     }
 
-    this->uuid = NvHTTP::getXmlString(serverInfo, "uniqueid");
-    QString newMacString = NvHTTP::getXmlString(serverInfo, "mac");
+    this->uuid = serverInfo.uniqueId;
+    QString newMacString = serverInfo.mac;
     if (newMacString != "00:00:00:00:00:00") {
         QStringList macOctets = newMacString.split(':');
         for (QString macOctet : macOctets) {
@@ -109,23 +118,21 @@ NvComputer::NvComputer(QString address, QString serverInfo, QSslCertificate serv
         }
     }
 
-    QString codecSupport = NvHTTP::getXmlString(serverInfo, "ServerCodecModeSupport");
-    if (!codecSupport.isEmpty()) {
-        this->serverCodecModeSupport = codecSupport.toInt();
+    if (!serverInfo.serverCodecModeSupport.isEmpty()) {
+        this->serverCodecModeSupport = serverInfo.serverCodecModeSupport.toInt();
     }
     else {
         this->serverCodecModeSupport = 0;
     }
 
-    QString maxLumaPixelsHEVC = NvHTTP::getXmlString(serverInfo, "MaxLumaPixelsHEVC");
-    if (!maxLumaPixelsHEVC.isEmpty()) {
-        this->maxLumaPixelsHEVC = maxLumaPixelsHEVC.toInt();
+    if (!serverInfo.maxLumaPixelsHEVC.isEmpty()) {
+        this->maxLumaPixelsHEVC = serverInfo.maxLumaPixelsHEVC.toInt();
     }
     else {
         this->maxLumaPixelsHEVC = 0;
     }
 
-    this->displayModes = NvHTTP::getDisplayModeList(serverInfo);
+    this->displayModes = serverInfo.displayModes;
     std::stable_sort(this->displayModes.begin(), this->displayModes.end(),
                      [](const NvDisplayMode& mode1, const NvDisplayMode& mode2) {
         return mode1.width * mode1.height * mode1.refreshRate <
@@ -133,18 +140,18 @@ NvComputer::NvComputer(QString address, QString serverInfo, QSslCertificate serv
     });
 
     // We can get an IPv4 loopback address if we're using the GS IPv6 Forwarder
-    this->localAddress = NvHTTP::getXmlString(serverInfo, "LocalIP");
+    this->localAddress = serverInfo.localIp;
     if (this->localAddress.startsWith("127.")) {
         this->localAddress = QString();
     }
 
-    this->remoteAddress = NvHTTP::getXmlString(serverInfo, "ExternalIP");
-    this->pairState = NvHTTP::getXmlString(serverInfo, "PairStatus") == "1" ?
+    this->remoteAddress = serverInfo.externalIp;
+    this->pairState = serverInfo.pairStatus == "1" ?
                 PS_PAIRED : PS_NOT_PAIRED;
     this->currentGameId = NvHTTP::getCurrentGame(serverInfo);
-    this->appVersion = NvHTTP::getXmlString(serverInfo, "appversion");
-    this->gfeVersion = NvHTTP::getXmlString(serverInfo, "GfeVersion");
-    this->gpuModel = NvHTTP::getXmlString(serverInfo, "gputype");
+    this->appVersion = serverInfo.appVersion;
+    this->gfeVersion = serverInfo.gfeVersion;
+    this->gpuModel = serverInfo.gpuType;
     this->activeAddress = address;
     this->state = NvComputer::CS_ONLINE;
     this->pendingQuit = false;
@@ -207,8 +214,9 @@ bool NvComputer::wake()
         }
     }
 
-    // Try all unique address strings or host names
-    bool success = false;
+    // Resolve all unique address strings or host names up front,
+    // so the bursts below aren't spread out by DNS lookups
+    QVector<QHostAddress> targets;
     for (QString& addressString : addressList) {
         QHostInfo hostInfo = QHostInfo::fromName(addressString);
 
@@ -217,17 +225,38 @@ bool NvComputer::wake()
             continue;
         }
 
-        // Try all IP addresses that this string resolves to
-        for (QHostAddress& address : hostInfo.addresses()) {
-            QUdpSocket sock;
+        for (const QHostAddress& address : hostInfo.addresses()) {
+            if (!targets.contains(address)) {
+                targets.append(address);
+            }
+        }
+    }
+
+    // One socket per address family is bound once and used for every packet
+    QUdpSocket sock4, sock6;
+    sock4.bind(QHostAddress::AnyIPv4, 0);
+    sock6.bind(QHostAddress::AnyIPv6, 0);
+
+    // A single packet is easily lost while a switch or Wi-Fi link is
+    // waking up too, so the whole set is sent a few times
+    bool success = false;
+    for (int burst = 0; burst < WOL_BURST_COUNT; burst++) {
+        if (burst != 0) {
+            QThread::msleep(WOL_BURST_INTERVAL_MS);
+        }
+
+        for (const QHostAddress& address : targets) {
+            QUdpSocket& sock = address.protocol() == QAbstractSocket::IPv6Protocol ? sock6 : sock4;
 
             // Send to all ports
             for (quint16 port : WOL_PORTS) {
-                if (sock.writeDatagram(wolPayload, address, port)) {
-                    qInfo().nospace().noquote() << "Sent WoL packet to " << name << " via " << address.toString() << ":" << port;
+                if (sock.writeDatagram(wolPayload, address, port) == wolPayload.size()) {
+                    if (burst == 0) {
+                        qInfo().nospace().noquote() << "Sent WoL packet to " << name << " via " << address.toString() << ":" << port;
+                    }
                     success = true;
                 }
-                else {
+                else if (burst == 0) {
                     qWarning() << "Send failed:" << sock.error();
                 }
             }
@@ -237,6 +266,86 @@ bool NvComputer::wake()
     return success;
 }
 
+void NvComputer::publishSnapshot()
+{
+    NvComputerSnapshot* snapshot = new NvComputerSnapshot();
+
+    {
+        QReadLocker readLocker(&lock);
+        snapshot->version = m_Snapshot.isNull() ? 0 : m_Snapshot->version + 1;
+        snapshot->name = name;
+        snapshot->uuid = uuid;
+        snapshot->state = state;
+        snapshot->pairState = pairState;
+        snapshot->currentGameId = currentGameId;
+        snapshot->wakeable = !macAddress.isEmpty();
+        snapshot->appList = appList;
+    }
+
+    // Changes are taken from the snapshots rather than update(), since
+    // the poll scheduler and pairing also write some fields directly
+    snapshot->changes = m_Snapshot.isNull() ?
+                NvComputer::CF_ALL : snapshot->diff(*m_Snapshot);
+
+    m_Snapshot = QSharedPointer<const NvComputerSnapshot>(snapshot);
+}
+
+int NvComputerSnapshot::changesSince(const NvComputerSnapshot& older) const
+{
+    if (version == older.version + 1) {
+        return changes;
+    }
+
+    return diff(older);
+}
+
+int NvComputerSnapshot::diff(const NvComputerSnapshot& older) const
+{
+    int changes = NvComputer::CF_NONE;
+
+    if (name != older.name) {
+        changes |= NvComputer::CF_NAME;
+    }
+    if (state != older.state) {
+        changes |= NvComputer::CF_STATE;
+    }
+    if (pairState != older.pairState) {
+        changes |= NvComputer::CF_PAIR_STATE;
+    }
+    if (currentGameId != older.currentGameId) {
+        changes |= NvComputer::CF_CURRENT_GAME;
+    }
+    if (wakeable != older.wakeable) {
+        changes |= NvComputer::CF_MAC_ADDRESS;
+    }
+
+    // NvApp only compares IDs
+    if (appList.count() != older.appList.count()) {
+        changes |= NvComputer::CF_APP_LIST;
+    }
+    else {
+        for (int i = 0; i < appList.count(); i++) {
+            if (appList[i].id != older.appList[i].id ||
+                    appList[i].name != older.appList[i].name ||
+                    appList[i].hdrSupported != older.appList[i].hdrSupported) {
+                changes |= NvComputer::CF_APP_LIST;
+                break;
+            }
+        }
+    }
+
+    return changes;
+}
+
+QSharedPointer<const NvComputerSnapshot> NvComputer::getSnapshot()
+{
+    if (m_Snapshot.isNull()) {
+        publishSnapshot();
+    }
+
+    return m_Snapshot;
+}
+
 QVector<QString> NvComputer::uniqueAddresses()
 {
     QVector<QString> uniqueAddressList;
@@ -270,9 +379,9 @@ QVector<QString> NvComputer::uniqueAddresses()
     return uniqueAddressList;
 }
 
-bool NvComputer::update(NvComputer& that)
+int NvComputer::update(NvComputer& that)
 {
-    bool changed = false;
+    int changes = CF_NONE;
 
     // Lock us for write and them for read
     QWriteLocker thisLock(&this->lock);
@@ -281,43 +390,43 @@ bool NvComputer::update(NvComputer& that)
     // UUID may not change or we're talking to a new PC
     Q_ASSERT(this->uuid == that.uuid);
 
-#define ASSIGN_IF_CHANGED(field)       \
+#define ASSIGN_IF_CHANGED(field, flag) \
     if (this->field != that.field) {   \
         this->field = that.field;      \
-        changed = true;                \
+        changes |= flag;               \
     }
 
-#define ASSIGN_IF_CHANGED_AND_NONEMPTY(field) \
-    if (!that.field.isEmpty() &&              \
-        this->field != that.field) {          \
-        this->field = that.field;             \
-        changed = true;                       \
+#define ASSIGN_IF_CHANGED_AND_NONEMPTY(field, flag) \
+    if (!that.field.isEmpty() &&                    \
+        this->field != that.field) {                \
+        this->field = that.field;                   \
+        changes |= flag;                            \
     }
 
-#define ASSIGN_IF_CHANGED_AND_NONNULL(field)  \
-    if (!that.field.isNull() &&               \
-        this->field != that.field) {          \
-        this->field = that.field;             \
-        changed = true;                       \
+#define ASSIGN_IF_CHANGED_AND_NONNULL(field, flag)  \
+    if (!that.field.isNull() &&                     \
+        this->field != that.field) {                \
+        this->field = that.field;                   \
+        changes |= flag;                            \
     }
 
-    ASSIGN_IF_CHANGED(name);
-    ASSIGN_IF_CHANGED_AND_NONEMPTY(macAddress);
-    ASSIGN_IF_CHANGED_AND_NONEMPTY(localAddress);
-    ASSIGN_IF_CHANGED_AND_NONEMPTY(remoteAddress);
-    ASSIGN_IF_CHANGED_AND_NONEMPTY(ipv6Address);
-    ASSIGN_IF_CHANGED_AND_NONEMPTY(manualAddress);
-    ASSIGN_IF_CHANGED(pairState);
-    ASSIGN_IF_CHANGED(serverCodecModeSupport);
-    ASSIGN_IF_CHANGED(currentGameId);
-    ASSIGN_IF_CHANGED(activeAddress);
-    ASSIGN_IF_CHANGED(state);
-    ASSIGN_IF_CHANGED(gfeVersion);
-    ASSIGN_IF_CHANGED(appVersion);
-    ASSIGN_IF_CHANGED(maxLumaPixelsHEVC);
-    ASSIGN_IF_CHANGED(gpuModel);
-    ASSIGN_IF_CHANGED_AND_NONNULL(serverCert);
-    ASSIGN_IF_CHANGED_AND_NONEMPTY(appList);
-    ASSIGN_IF_CHANGED_AND_NONEMPTY(displayModes);
-    return changed;
+    ASSIGN_IF_CHANGED(name, CF_NAME);
+    ASSIGN_IF_CHANGED_AND_NONEMPTY(macAddress, CF_MAC_ADDRESS);
+    ASSIGN_IF_CHANGED_AND_NONEMPTY(localAddress, CF_ADDRESSES);
+    ASSIGN_IF_CHANGED_AND_NONEMPTY(remoteAddress, CF_ADDRESSES);
+    ASSIGN_IF_CHANGED_AND_NONEMPTY(ipv6Address, CF_ADDRESSES);
+    ASSIGN_IF_CHANGED_AND_NONEMPTY(manualAddress, CF_ADDRESSES);
+    ASSIGN_IF_CHANGED(pairState, CF_PAIR_STATE);
+    ASSIGN_IF_CHANGED(serverCodecModeSupport, CF_SERVER_INFO);
+    ASSIGN_IF_CHANGED(currentGameId, CF_CURRENT_GAME);
+    ASSIGN_IF_CHANGED(activeAddress, CF_ADDRESSES);
+    ASSIGN_IF_CHANGED(state, CF_STATE);
+    ASSIGN_IF_CHANGED(gfeVersion, CF_SERVER_INFO);
+    ASSIGN_IF_CHANGED(appVersion, CF_SERVER_INFO);
+    ASSIGN_IF_CHANGED(maxLumaPixelsHEVC, CF_SERVER_INFO);
+    ASSIGN_IF_CHANGED(gpuModel, CF_SERVER_INFO);
+    ASSIGN_IF_CHANGED_AND_NONNULL(serverCert, CF_SERVER_INFO);
+    ASSIGN_IF_CHANGED_AND_NONEMPTY(appList, CF_APP_LIST);
+    ASSIGN_IF_CHANGED_AND_NONEMPTY(displayModes, CF_SERVER_INFO);
+    return changes;
 }
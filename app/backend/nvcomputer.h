@@ -6,10 +6,13 @@
 #include <QReadWriteLock>
 #include <QSettings>
 #include <QRunnable>
+#include <QSharedPointer>
+
+class NvComputerSnapshot;
 
 class NvComputer
 {
-    friend class PcMonitorThread;
+    friend class ComputerPollScheduler;
     friend class ComputerManager;
     friend class PendingQuitTask;
 
@@ -21,9 +24,13 @@ private:
 public:
     explicit NvComputer(QString address, QString serverInfo, QSslCertificate serverCert);
 
+    explicit NvComputer(QString address, const NvServerInfo& serverInfo, QSslCertificate serverCert);
+
     explicit NvComputer(QSettings& settings);
 
-    bool
+    // Returns the ChangeFlags for the fields that were copied over,
+    // or CF_NONE if nothing changed
+    int
     update(NvComputer& that);
 
     bool
@@ -35,6 +42,16 @@ public:
     void
     serialize(QSettings& settings);
 
+    // Main thread only. Takes a new snapshot of the computer for the
+    // UI, which ComputerManager does before announcing each change.
+    void
+    publishSnapshot();
+
+    // Main thread only. The snapshot never changes, so it can be read
+    // without the lock.
+    QSharedPointer<const NvComputerSnapshot>
+    getSnapshot();
+
     enum PairState
     {
         PS_UNKNOWN,
@@ -49,6 +66,23 @@ public:
         CS_OFFLINE
     };
 
+    enum ChangeFlag
+    {
+        CF_NONE         = 0,
+        CF_NAME         = 0x01,
+        CF_ADDRESSES    = 0x02,
+        CF_MAC_ADDRESS  = 0x04,
+        CF_PAIR_STATE   = 0x08,
+        CF_STATE        = 0x10,
+        CF_CURRENT_GAME = 0x20,
+        CF_APP_LIST     = 0x40,
+
+        // Codec support, versions, GPU, certificate and display modes
+        CF_SERVER_INFO  = 0x80,
+
+        CF_ALL          = 0xFF
+    };
+
     // Ephemeral traits
     ComputerState state;
     PairState pairState;
@@ -74,4 +108,39 @@ public:
 
     // Synchronization
     QReadWriteLock lock;
+
+private:
+    QSharedPointer<const NvComputerSnapshot> m_Snapshot;
+};
+
+// What the UI shows of a computer as of one change to it
+class NvComputerSnapshot
+{
+    friend class NvComputer;
+
+public:
+    // What differs from an older snapshot of the same computer, which
+    // may be from several changes ago
+    int
+    changesSince(const NvComputerSnapshot& older) const;
+
+    // Goes up by one with each snapshot of the same computer
+    quint64 version;
+
+    // The ChangeFlags for what differs from the snapshot before this one.
+    // The app list flag is also set when an app was renamed or its HDR
+    // support changed.
+    int changes;
+
+    QString name;
+    QString uuid;
+    NvComputer::ComputerState state;
+    NvComputer::PairState pairState;
+    int currentGameId;
+    bool wakeable;
+    QVector<NvApp> appList;
+
+private:
+    int
+    diff(const NvComputerSnapshot& older) const;
 };
@@ -1,4 +1,5 @@
 #include "nvhttp.h"
+#include "negotiationcache.h"
 #include <Limelight.h>
 
 #include <QDebug>
@@ -8,17 +9,29 @@
 #include <QTimer>
 #include <QXmlStreamReader>
 #include <QSslKey>
-#include <QImageReader>
+#include <QImage>
 #include <QtEndian>
 #include <QNetworkProxy>
+#include <QElapsedTimer>
+#include <QCryptographicHash>
+#include <QCoreApplication>
+#include <QThread>
 
 #define REQUEST_TIMEOUT_MS 5000
 #define LAUNCH_TIMEOUT_MS 120000
 #define RESUME_TIMEOUT_MS 30000
 #define QUIT_TIMEOUT_MS 30000
 
+QNetworkAccessManager* NvHTTP::s_SharedNam;
+QHash<QString, QByteArray> NvHttpRequest::s_TlsSessions;
+QMutex NvHttpRequest::s_TlsSessionsLock;
+
 NvHTTP::NvHTTP(QString address, QSslCertificate serverCert) :
-    m_ServerCert(serverCert)
+    m_ServerCert(serverCert),
+    m_FullHandshakeRequests(0),
+    m_FullHandshakeTimeMs(0),
+    m_ResumedRequests(0),
+    m_ResumedTimeMs(0)
 {
     m_BaseUrlHttp.setScheme("http");
     m_BaseUrlHttps.setScheme("https");
@@ -30,8 +43,6 @@ NvHTTP::NvHTTP(QString address, QSslCertificate serverCert) :
     // Never use a proxy server
     QNetworkProxy noProxy(QNetworkProxy::NoProxy);
     m_Nam.setProxy(noProxy);
-
-    connect(&m_Nam, &QNetworkAccessManager::sslErrors, this, &NvHTTP::handleSslErrors);
 }
 
 void NvHTTP::setServerCert(QSslCertificate serverCert)
@@ -54,6 +65,11 @@ QString NvHTTP::address()
     return m_Address;
 }
 
+QSslCertificate NvHTTP::serverCert()
+{
+    return m_ServerCert;
+}
+
 QVector<int>
 NvHTTP::parseQuad(QString quad)
 {
@@ -76,14 +92,19 @@ NvHTTP::parseQuad(QString quad)
 
 int
 NvHTTP::getCurrentGame(QString serverInfo)
+{
+    return getCurrentGame(parseServerInfo(serverInfo.toUtf8()));
+}
+
+int
+NvHTTP::getCurrentGame(const NvServerInfo& serverInfo)
 {
     // GFE 2.8 started keeping currentgame set to the last game played. As a result, it no longer
     // has the semantics that its name would indicate. To contain the effects of this change as much
     // as possible, we'll force the current game to zero if the server isn't in a streaming session.
-    QString serverState = getXmlString(serverInfo, "state");
-    if (serverState != nullptr && serverState.endsWith("_SERVER_BUSY"))
+    if (serverInfo.state != nullptr && serverInfo.state.endsWith("_SERVER_BUSY"))
     {
-        return getXmlString(serverInfo, "currentgame").toInt();
+        return serverInfo.currentGame.toInt();
     }
     else
     {
@@ -91,13 +112,93 @@ NvHTTP::getCurrentGame(QString serverInfo)
     }
 }
 
+static const struct
+{
+    QLatin1String tagName;
+    QString NvServerInfo::* field;
+} k_ServerInfoFields[] = {
+    { QLatin1String("hostname"), &NvServerInfo::hostname },
+    { QLatin1String("uniqueid"), &NvServerInfo::uniqueId },
+    { QLatin1String("mac"), &NvServerInfo::mac },
+    { QLatin1String("ServerCodecModeSupport"), &NvServerInfo::serverCodecModeSupport },
+    { QLatin1String("MaxLumaPixelsHEVC"), &NvServerInfo::maxLumaPixelsHEVC },
+    { QLatin1String("LocalIP"), &NvServerInfo::localIp },
+    { QLatin1String("ExternalIP"), &NvServerInfo::externalIp },
+    { QLatin1String("PairStatus"), &NvServerInfo::pairStatus },
+    { QLatin1String("state"), &NvServerInfo::state },
+    { QLatin1String("currentgame"), &NvServerInfo::currentGame },
+    { QLatin1String("appversion"), &NvServerInfo::appVersion },
+    { QLatin1String("GfeVersion"), &NvServerInfo::gfeVersion },
+    { QLatin1String("gputype"), &NvServerInfo::gpuType },
+};
+
+NvServerInfo
+NvHTTP::parseServerInfo(const QByteArray& serverInfo)
+{
+    QXmlStreamReader xmlReader(serverInfo);
+    NvServerInfo info;
+
+    while (!xmlReader.atEnd())
+    {
+        if (xmlReader.readNext() != QXmlStreamReader::StartElement)
+        {
+            continue;
+        }
+
+        auto name = xmlReader.name();
+        if (name == QLatin1String("DisplayMode"))
+        {
+            NvDisplayMode mode = {};
+            info.displayModes.append(mode);
+            continue;
+        }
+        else if (!info.displayModes.isEmpty())
+        {
+            if (name == QLatin1String("Width"))
+            {
+                info.displayModes.last().width = xmlReader.readElementText().toInt();
+                continue;
+            }
+            else if (name == QLatin1String("Height"))
+            {
+                info.displayModes.last().height = xmlReader.readElementText().toInt();
+                continue;
+            }
+            else if (name == QLatin1String("RefreshRate"))
+            {
+                info.displayModes.last().refreshRate = xmlReader.readElementText().toInt();
+                continue;
+            }
+        }
+
+        for (const auto& field : k_ServerInfoFields)
+        {
+            // Like getXmlString(), the first element with the name wins
+            if (name == field.tagName)
+            {
+                QString& value = info.*field.field;
+                QString text = xmlReader.readElementText();
+                if (value.isNull())
+                {
+                    // An empty element still counts as present
+                    value = text.isNull() ? QString("") : text;
+                }
+                break;
+            }
+        }
+    }
+
+    return info;
+}
+
 QString
 NvHTTP::getServerInfo(NvLogLevel logLevel)
 {
     QString serverInfo;
 
-    // Check if we have a pinned cert for this host yet
-    if (!m_ServerCert.isNull())
+    // Check if we have a pinned cert for this host yet, and that
+    // the host didn't just refuse it
+    if (!m_ServerCert.isNull() && !NegotiationCache::isHttpsRejected(m_Address, m_ServerCert))
     {
         try
         {
@@ -116,6 +217,7 @@ NvHTTP::getServerInfo(NvLogLevel logLevel)
             if (e.getStatusCode() == 401)
             {
                 // Certificate validation error, fallback to HTTP
+                NegotiationCache::setHttpsRejected(m_Address, m_ServerCert, true);
                 serverInfo = openConnectionToString(m_BaseUrlHttp,
                                                     "serverinfo",
                                                     nullptr,
@@ -132,7 +234,7 @@ NvHTTP::getServerInfo(NvLogLevel logLevel)
     }
     else
     {
-        // Only use HTTP prior to pairing
+        // Only use HTTP prior to pairing or after a refusal
         serverInfo = openConnectionToString(m_BaseUrlHttp,
                                             "serverinfo",
                                             nullptr,
@@ -168,6 +270,56 @@ getSurroundAudioInfoString(int audioConfig)
     return QString::number(channelMask << 16 | channelCount);
 }
 
+QString
+NvHTTP::getLaunchArguments(int appId,
+                           PSTREAM_CONFIGURATION streamConfig,
+                           bool sops,
+                           bool localAudio,
+                           int gamepadMask)
+{
+    int riKeyId;
+
+    memcpy(&riKeyId, streamConfig->remoteInputAesIv, sizeof(riKeyId));
+    riKeyId = qFromBigEndian(riKeyId);
+
+    return "appid="+QString::number(appId)+
+            "&mode="+QString::number(streamConfig->width)+"x"+
+            QString::number(streamConfig->height)+"x"+
+            // Using an FPS value over 60 causes SOPS to default to 720p60,
+            // so force it to 60 when starting. This won't impact our ability
+            // to get > 60 FPS while actually streaming though.
+            QString::number(streamConfig->fps > 60 ? 60 : streamConfig->fps)+
+            "&additionalStates=1&sops="+QString::number(sops ? 1 : 0)+
+            "&rikey="+QByteArray(streamConfig->remoteInputAesKey, sizeof(streamConfig->remoteInputAesKey)).toHex()+
+            "&rikeyid="+QString::number(riKeyId)+
+            (streamConfig->enableHdr ?
+                "&hdrMode=1&clientHdrCapVersion=0&clientHdrCapSupportedFlagsInUint32=0&clientHdrCapMetaDataId=NV_STATIC_METADATA_TYPE_1&clientHdrCapDisplayData=0x0x0x0x0x0x0x0x0x0x0" :
+                 "")+
+            "&localAudioPlayMode="+QString::number(localAudio ? 1 : 0)+
+            "&surroundAudioInfo="+getSurroundAudioInfoString(streamConfig->audioConfiguration)+
+            "&remoteControllersBitmap="+QString::number(gamepadMask)+
+            "&gcmap="+QString::number(gamepadMask);
+}
+
+QString
+NvHTTP::getResumeArguments(PSTREAM_CONFIGURATION streamConfig)
+{
+    int riKeyId;
+
+    memcpy(&riKeyId, streamConfig->remoteInputAesIv, sizeof(riKeyId));
+    riKeyId = qFromBigEndian(riKeyId);
+
+    return "rikey="+QString(QByteArray(streamConfig->remoteInputAesKey, sizeof(streamConfig->remoteInputAesKey)).toHex())+
+            "&rikeyid="+QString::number(riKeyId)+
+            "&surroundAudioInfo="+getSurroundAudioInfoString(streamConfig->audioConfiguration);
+}
+
+QString
+NvHTTP::getBoxArtArguments(int appId)
+{
+    return "appid="+QString::number(appId)+"&AssetType=2&AssetIdx=0";
+}
+
 void
 NvHTTP::launchApp(int appId,
                   PSTREAM_CONFIGURATION streamConfig,
@@ -175,31 +327,10 @@ NvHTTP::launchApp(int appId,
                   bool localAudio,
                   int gamepadMask)
 {
-    int riKeyId;
-
-    memcpy(&riKeyId, streamConfig->remoteInputAesIv, sizeof(riKeyId));
-    riKeyId = qFromBigEndian(riKeyId);
-
     QString response =
             openConnectionToString(m_BaseUrlHttps,
                                    "launch",
-                                   "appid="+QString::number(appId)+
-                                   "&mode="+QString::number(streamConfig->width)+"x"+
-                                   QString::number(streamConfig->height)+"x"+
-                                   // Using an FPS value over 60 causes SOPS to default to 720p60,
-                                   // so force it to 60 when starting. This won't impact our ability
-                                   // to get > 60 FPS while actually streaming though.
-                                   QString::number(streamConfig->fps > 60 ? 60 : streamConfig->fps)+
-                                   "&additionalStates=1&sops="+QString::number(sops ? 1 : 0)+
-                                   "&rikey="+QByteArray(streamConfig->remoteInputAesKey, sizeof(streamConfig->remoteInputAesKey)).toHex()+
-                                   "&rikeyid="+QString::number(riKeyId)+
-                                   (streamConfig->enableHdr ?
-                                       "&hdrMode=1&clientHdrCapVersion=0&clientHdrCapSupportedFlagsInUint32=0&clientHdrCapMetaDataId=NV_STATIC_METADATA_TYPE_1&clientHdrCapDisplayData=0x0x0x0x0x0x0x0x0x0x0" :
-                                        "")+
-                                   "&localAudioPlayMode="+QString::number(localAudio ? 1 : 0)+
-                                   "&surroundAudioInfo="+getSurroundAudioInfoString(streamConfig->audioConfiguration)+
-                                   "&remoteControllersBitmap="+QString::number(gamepadMask)+
-                                   "&gcmap="+QString::number(gamepadMask),
+                                   getLaunchArguments(appId, streamConfig, sops, localAudio, gamepadMask),
                                    LAUNCH_TIMEOUT_MS);
 
     // Throws if the request failed
@@ -209,17 +340,10 @@ NvHTTP::launchApp(int appId,
 void
 NvHTTP::resumeApp(PSTREAM_CONFIGURATION streamConfig)
 {
-    int riKeyId;
-
-    memcpy(&riKeyId, streamConfig->remoteInputAesIv, sizeof(riKeyId));
-    riKeyId = qFromBigEndian(riKeyId);
-
     QString response =
             openConnectionToString(m_BaseUrlHttps,
                                    "resume",
-                                   "rikey="+QString(QByteArray(streamConfig->remoteInputAesKey, sizeof(streamConfig->remoteInputAesKey)).toHex())+
-                                   "&rikeyid="+QString::number(riKeyId)+
-                                   "&surroundAudioInfo="+getSurroundAudioInfoString(streamConfig->audioConfiguration),
+                                   getResumeArguments(streamConfig),
                                    RESUME_TIMEOUT_MS);
 
     // Throws if the request failed
@@ -284,6 +408,12 @@ NvHTTP::getAppList()
                                             NvLogLevel::NVLL_ERROR);
     verifyResponseStatus(appxml);
 
+    return parseAppList(appxml);
+}
+
+QVector<NvApp>
+NvHTTP::parseAppList(QString appxml)
+{
     QXmlStreamReader xmlReader(appxml);
     QVector<NvApp> apps;
     while (!xmlReader.atEnd()) {
@@ -313,8 +443,8 @@ NvHTTP::getAppList()
     return apps;
 }
 
-void
-NvHTTP::verifyResponseStatus(QString xml)
+bool
+NvHTTP::parseResponseStatus(const QByteArray& xml, int* statusCode, QString* statusMessage)
 {
     QXmlStreamReader xmlReader(xml);
 
@@ -322,38 +452,46 @@ NvHTTP::verifyResponseStatus(QString xml)
     {
         if (xmlReader.name() == "root")
         {
-            int statusCode = xmlReader.attributes().value("status_code").toInt();
-            if (statusCode == 200)
+            *statusCode = xmlReader.attributes().value("status_code").toInt();
+            if (*statusCode == 200)
             {
                 // Successful
-                return;
+                return true;
             }
             else
             {
-                QString statusMessage = xmlReader.attributes().value("status_message").toString();
-                if (statusCode != 401) {
+                *statusMessage = xmlReader.attributes().value("status_message").toString();
+                if (*statusCode != 401) {
                     // 401 is expected for unpaired PCs when we fetch serverinfo over HTTPS
-                    qWarning() << "Request failed:" << statusCode << statusMessage;
+                    qWarning() << "Request failed:" << *statusCode << *statusMessage;
                 }
-                throw GfeHttpResponseException(statusCode, statusMessage);
+                return false;
             }
         }
     }
+
+    return true;
+}
+
+void
+NvHTTP::verifyResponseStatus(QString xml)
+{
+    int statusCode = 0;
+    QString statusMessage;
+
+    if (!parseResponseStatus(xml.toUtf8(), &statusCode, &statusMessage)) {
+        throw GfeHttpResponseException(statusCode, statusMessage);
+    }
 }
 
 QImage
 NvHTTP::getBoxArt(int appId)
 {
-    QNetworkReply* reply = openConnection(m_BaseUrlHttps,
-                                          "appasset",
-                                          "appid="+QString::number(appId)+
-                                          "&AssetType=2&AssetIdx=0",
-                                          REQUEST_TIMEOUT_MS,
-                                          NvLogLevel::NVLL_VERBOSE);
-    QImage image = QImageReader(reply).read();
-    delete reply;
-
-    return image;
+    return QImage::fromData(openConnection(m_BaseUrlHttps,
+                                           "appasset",
+                                           getBoxArtArguments(appId),
+                                           REQUEST_TIMEOUT_MS,
+                                           NvLogLevel::NVLL_VERBOSE));
 }
 
 QByteArray
@@ -391,26 +529,123 @@ NvHTTP::getXmlString(QString xml,
     return nullptr;
 }
 
-void NvHTTP::handleSslErrors(QNetworkReply* reply, const QList<QSslError>& errors)
+void NvHTTP::logRequestTimings(QString name)
 {
-    bool ignoreErrors = true;
-
-    if (m_ServerCert.isNull()) {
-        // We should never make an HTTPS request without a cert
-        Q_ASSERT(!m_ServerCert.isNull());
-        return;
+    if (m_FullHandshakeRequests != 0) {
+        qInfo().noquote() << name << "HTTPS requests with full TLS handshake:"
+                          << m_FullHandshakeRequests << "averaging"
+                          << m_FullHandshakeTimeMs / m_FullHandshakeRequests << "ms";
     }
+    if (m_ResumedRequests != 0) {
+        qInfo().noquote() << name << "HTTPS requests resuming a TLS session:"
+                          << m_ResumedRequests << "averaging"
+                          << m_ResumedTimeMs / m_ResumedRequests << "ms";
+    }
+}
 
-    for (auto error : errors) {
-        if (m_ServerCert != error.certificate()) {
-            ignoreErrors = false;
-            break;
-        }
+QUrl
+NvHTTP::buildUrl(QUrl baseUrl,
+                 QString command,
+                 QString arguments)
+{
+    QUrl url(baseUrl);
+    url.setPath("/" + command);
+
+    // Use a common UID for Moonlight clients to allow them to quit
+    // games for each other (otherwise GFE gets screwed up and it requires
+    // manual intervention to solve).
+    url.setQuery("uniqueid=0123456789ABCDEF&uuid=" +
+                 QUuid::createUuid().toRfc4122().toHex() +
+                 ((arguments != nullptr) ? ("&" + arguments) : ""));
+
+    return url;
+}
+
+QNetworkAccessManager*
+NvHTTP::getSharedNetworkAccessManager()
+{
+    // Async requests are all driven by the main thread's event loop
+    Q_ASSERT(QThread::currentThread() == QCoreApplication::instance()->thread());
+
+    if (s_SharedNam == nullptr) {
+        s_SharedNam = new QNetworkAccessManager(QCoreApplication::instance());
+
+        // Never use a proxy server
+        s_SharedNam->setProxy(QNetworkProxy(QNetworkProxy::NoProxy));
     }
 
-    if (ignoreErrors) {
-        reply->ignoreSslErrors(errors);
+    return s_SharedNam;
+}
+
+NvHttpRequest*
+NvHTTP::startAsyncRequest(QUrl baseUrl,
+                          QString command,
+                          QString arguments,
+                          int timeoutMs,
+                          NvLogLevel logLevel,
+                          bool verifyStatus)
+{
+    NvHttpRequest* request = new NvHttpRequest(getSharedNetworkAccessManager(),
+                                               buildUrl(baseUrl, command, arguments),
+                                               m_ServerCert, timeoutMs, logLevel);
+    request->m_AutoDelete = true;
+    request->m_VerifyStatus = verifyStatus;
+    request->start();
+    return request;
+}
+
+NvHttpRequest*
+NvHTTP::getServerInfoAsync(NvLogLevel logLevel)
+{
+    // Like getServerInfo(), HTTPS is only tried once we have a pinned
+    // cert the host didn't just refuse, and a certificate error falls
+    // back to HTTP
+    if (!m_ServerCert.isNull() && !NegotiationCache::isHttpsRejected(m_Address, m_ServerCert)) {
+        NvHttpRequest* request = new NvHttpRequest(getSharedNetworkAccessManager(),
+                                                   buildUrl(m_BaseUrlHttps, "serverinfo", nullptr),
+                                                   m_ServerCert, REQUEST_TIMEOUT_MS, logLevel);
+        request->m_AutoDelete = true;
+        request->m_VerifyStatus = true;
+        request->m_FallbackUrl = buildUrl(m_BaseUrlHttp, "serverinfo", nullptr);
+        request->start();
+        return request;
     }
+
+    return startAsyncRequest(m_BaseUrlHttp, "serverinfo", nullptr, REQUEST_TIMEOUT_MS, logLevel, true);
+}
+
+NvHttpRequest*
+NvHTTP::getAppListAsync()
+{
+    return startAsyncRequest(m_BaseUrlHttps, "applist", nullptr,
+                             REQUEST_TIMEOUT_MS, NvLogLevel::NVLL_ERROR, true);
+}
+
+NvHttpRequest*
+NvHTTP::launchAppAsync(int appId,
+                       PSTREAM_CONFIGURATION streamConfig,
+                       bool sops,
+                       bool localAudio,
+                       int gamepadMask)
+{
+    return startAsyncRequest(m_BaseUrlHttps, "launch",
+                             getLaunchArguments(appId, streamConfig, sops, localAudio, gamepadMask),
+                             LAUNCH_TIMEOUT_MS, NvLogLevel::NVLL_VERBOSE, true);
+}
+
+NvHttpRequest*
+NvHTTP::resumeAppAsync(PSTREAM_CONFIGURATION streamConfig)
+{
+    return startAsyncRequest(m_BaseUrlHttps, "resume",
+                             getResumeArguments(streamConfig),
+                             RESUME_TIMEOUT_MS, NvLogLevel::NVLL_VERBOSE, true);
+}
+
+NvHttpRequest*
+NvHTTP::getBoxArtAsync(int appId)
+{
+    return startAsyncRequest(m_BaseUrlHttps, "appasset", getBoxArtArguments(appId),
+                             REQUEST_TIMEOUT_MS, NvLogLevel::NVLL_VERBOSE, false);
 }
 
 QString
@@ -420,92 +655,271 @@ NvHTTP::openConnectionToString(QUrl baseUrl,
                                int timeoutMs,
                                NvLogLevel logLevel)
 {
-    QNetworkReply* reply = openConnection(baseUrl, command, arguments, timeoutMs, logLevel);
-    QString ret;
-
-    QTextStream stream(reply);
-    stream.setCodec("UTF-8");
-    ret = stream.readAll();
-    delete reply;
-
-    return ret;
+    return QString::fromUtf8(openConnection(baseUrl, command, arguments, timeoutMs, logLevel));
 }
 
-QNetworkReply*
+QByteArray
 NvHTTP::openConnection(QUrl baseUrl,
                        QString command,
                        QString arguments,
                        int timeoutMs,
                        NvLogLevel logLevel)
 {
-    // Build a URL for the request
-    QUrl url(baseUrl);
-    url.setPath("/" + command);
+    NvHttpRequest request(&m_Nam, buildUrl(baseUrl, command, arguments),
+                          m_ServerCert, timeoutMs, logLevel);
 
-    // Use a common UID for Moonlight clients to allow them to quit
-    // games for each other (otherwise GFE gets screwed up and it requires
-    // manual intervention to solve).
-    url.setQuery("uniqueid=0123456789ABCDEF&uuid=" +
-                 QUuid::createUuid().toRfc4122().toHex() +
-                 ((arguments != nullptr) ? ("&" + arguments) : ""));
+    // Run the request and wait for it to finish or time out
+    QEventLoop loop;
+    connect(&request, &NvHttpRequest::completed, &loop, &QEventLoop::quit);
+    connect(QCoreApplication::instance(), SIGNAL(aboutToQuit()), &loop, SLOT(quit()));
+    request.start();
+    if (!request.isFinished()) {
+        loop.exec(QEventLoop::ExcludeUserInputEvents);
+    }
 
-    QNetworkRequest request(url);
+    // We must clear out cached authentication and connections or
+    // GFE will puke next time
+    m_Nam.clearAccessCache();
+
+    if (!request.isFinished()) {
+        // We're quitting, so give up on it
+        request.cancel();
+        throw QtNetworkReplyException(QNetworkReply::TimeoutError, "Request timed out");
+    }
+
+    if (request.isSucceeded() && request.m_Url.scheme() == "https") {
+        if (request.isResumedSession()) {
+            m_ResumedRequests++;
+            m_ResumedTimeMs += request.getElapsedMs();
+        }
+        else {
+            m_FullHandshakeRequests++;
+            m_FullHandshakeTimeMs += request.getElapsedMs();
+        }
+    }
+
+    // Throws if the request failed
+    request.throwIfFailed();
+
+    return request.getResponse();
+}
+
+NvHttpRequest::NvHttpRequest(QNetworkAccessManager* nam,
+                             QUrl url,
+                             QSslCertificate serverCert,
+                             int timeoutMs,
+                             NvHTTP::NvLogLevel logLevel) :
+    m_Nam(nam),
+    m_Url(url),
+    m_ServerCert(serverCert),
+    m_TimeoutMs(timeoutMs),
+    m_LogLevel(logLevel),
+    m_AutoDelete(false),
+    m_VerifyStatus(false),
+    m_Reply(nullptr),
+    m_ElapsedMs(0),
+    m_ResumedSession(false),
+    m_Cancelled(false),
+    m_Finished(false),
+    m_StatusCode(0),
+    m_NetworkError(QNetworkReply::NoError)
+{
+    m_TimeoutTimer.setSingleShot(true);
+    connect(&m_TimeoutTimer, &QTimer::timeout, this, &NvHttpRequest::handleTimeout);
+}
+
+NvHttpRequest::~NvHttpRequest()
+{
+    if (m_Reply != nullptr) {
+        m_Reply->disconnect(this);
+        m_Reply->abort();
+        delete m_Reply;
+    }
+}
+
+QString NvHttpRequest::getTlsSessionKey()
+{
+    // A session is only good for the certificate it was made with, so
+    // re-pairing starts over with a full handshake
+    return m_Url.host() + ":" + QString::number(m_Url.port()) + "/" +
+            m_ServerCert.digest(QCryptographicHash::Sha256).toHex();
+}
+
+void NvHttpRequest::start()
+{
+    QNetworkRequest request(m_Url);
+
+    // GFE can't handle connections being reused, so every request gets
+    // a new one. Resuming the last TLS session with the host at least
+    // skips the certificate exchange and key agreement of a full handshake.
+    request.setRawHeader("Connection", "close");
 
     // Add our client certificate
-    request.setSslConfiguration(IdentityManager::get()->getSslConfig());
+    QSslConfiguration sslConfig = IdentityManager::get()->getSslConfig();
+    m_ResumedSession = false;
+    if (m_Url.scheme() == "https") {
+        sslConfig.setSslOption(QSsl::SslOptionDisableSessionPersistence, false);
+
+        QMutexLocker lock(&s_TlsSessionsLock);
+        QByteArray session = s_TlsSessions.value(getTlsSessionKey());
+        if (!session.isEmpty()) {
+            sslConfig.setSessionTicket(session);
+            m_ResumedSession = true;
+        }
+    }
+    request.setSslConfiguration(sslConfig);
 
-    QNetworkReply* reply = m_Nam.get(request);
+    if (m_LogLevel >= NvHTTP::NvLogLevel::NVLL_VERBOSE) {
+        qInfo() << "Executing request:" << m_Url.toString();
+    }
 
-    // Run the request with a timeout if requested
-    QEventLoop loop;
-    connect(reply, SIGNAL(finished()), &loop, SLOT(quit()));
-    connect(QCoreApplication::instance(), SIGNAL(aboutToQuit()), &loop, SLOT(quit()));
-    if (timeoutMs) {
-        QTimer::singleShot(timeoutMs, &loop, SLOT(quit()));
+    m_ElapsedTimer.start();
+    m_Reply = m_Nam->get(request);
+    connect(m_Reply, &QNetworkReply::finished, this, &NvHttpRequest::handleFinished);
+    connect(m_Reply, &QNetworkReply::sslErrors, this, &NvHttpRequest::handleSslErrors);
+
+    if (m_TimeoutMs) {
+        m_TimeoutTimer.start(m_TimeoutMs);
+    }
+}
+
+void NvHttpRequest::cancel()
+{
+    m_Cancelled = true;
+    m_TimeoutTimer.stop();
+
+    if (m_Reply != nullptr && !m_Reply->isFinished()) {
+        // This finishes the reply right away
+        m_Reply->abort();
     }
-    if (logLevel >= NvLogLevel::NVLL_VERBOSE) {
-        qInfo() << "Executing request:" << url.toString();
+    else if (m_AutoDelete) {
+        deleteLater();
     }
-    loop.exec(QEventLoop::ExcludeUserInputEvents);
+}
 
-    // Abort the request if it timed out
-    if (!reply->isFinished())
-    {
-        if (logLevel >= NvLogLevel::NVLL_ERROR) {
-            qWarning() << "Aborting timed out request for" << url.toString();
+void NvHttpRequest::handleTimeout()
+{
+    if (m_Reply != nullptr && !m_Reply->isFinished()) {
+        if (m_LogLevel >= NvHTTP::NvLogLevel::NVLL_ERROR) {
+            qWarning() << "Aborting timed out request for" << m_Url.toString();
         }
-        reply->abort();
+
+        m_Reply->abort();
     }
+}
 
-    // We must clear out cached authentication and connections or
-    // GFE will puke next time
-    m_Nam.clearAccessCache();
+void NvHttpRequest::handleSslErrors(const QList<QSslError>& errors)
+{
+    bool ignoreErrors = true;
 
-    // Handle error
-    if (reply->error() != QNetworkReply::NoError)
-    {
-        if (logLevel >= NvLogLevel::NVLL_ERROR) {
-            qWarning() << command << " request failed with error " << reply->error();
+    if (m_ServerCert.isNull()) {
+        // We should never make an HTTPS request without a cert
+        Q_ASSERT(!m_ServerCert.isNull());
+        return;
+    }
+
+    for (auto error : errors) {
+        if (m_ServerCert != error.certificate()) {
+            ignoreErrors = false;
+            break;
+        }
+    }
+
+    if (ignoreErrors) {
+        m_Reply->ignoreSslErrors(errors);
+    }
+}
+
+void NvHttpRequest::handleFinished()
+{
+    // The reply can't be deleted from its own signal, so it's kept
+    // until a fallback request replaces it or we're destroyed
+    QNetworkReply* reply = m_Reply;
+    m_TimeoutTimer.stop();
+    m_ElapsedMs = m_ElapsedTimer.elapsed();
+
+    if (m_Cancelled) {
+        if (m_AutoDelete) {
+            deleteLater();
         }
+        return;
+    }
 
-        if (reply->error() == QNetworkReply::SslHandshakeFailedError) {
+    QString command = m_Url.path().mid(1);
+    m_StatusCode = 0;
+    m_NetworkError = reply->error();
+    m_ErrorText.clear();
+
+    if (m_NetworkError != QNetworkReply::NoError) {
+        if (m_LogLevel >= NvHTTP::NvLogLevel::NVLL_ERROR) {
+            qWarning() << command << " request failed with error " << m_NetworkError;
+        }
+
+        if (m_NetworkError == QNetworkReply::SslHandshakeFailedError) {
             // This will trigger falling back to HTTP for the serverinfo query
             // then pairing again to get the updated certificate.
-            GfeHttpResponseException exception(401, "Server certificate mismatch");
-            delete reply;
-            throw exception;
+            m_StatusCode = 401;
+            m_ErrorText = "Server certificate mismatch";
+
+            // Don't offer a session the host rejected again
+            QMutexLocker lock(&s_TlsSessionsLock);
+            s_TlsSessions.remove(getTlsSessionKey());
         }
-        else if (reply->error() == QNetworkReply::OperationCanceledError) {
-            QtNetworkReplyException exception(QNetworkReply::TimeoutError, "Request timed out");
-            delete reply;
-            throw exception;
+        else if (m_NetworkError == QNetworkReply::OperationCanceledError) {
+            m_NetworkError = QNetworkReply::TimeoutError;
+            m_ErrorText = "Request timed out";
         }
         else {
-            QtNetworkReplyException exception(reply->error(), reply->errorString());
-            delete reply;
-            throw exception;
+            m_ErrorText = reply->errorString();
+        }
+    }
+    else {
+        m_Response = reply->readAll();
+
+        if (m_Url.scheme() == "https") {
+            QByteArray session = reply->sslConfiguration().sessionTicket();
+            if (!session.isEmpty()) {
+                QMutexLocker lock(&s_TlsSessionsLock);
+                s_TlsSessions.insert(getTlsSessionKey(), session);
+            }
         }
+
+        if (m_VerifyStatus) {
+            NvHTTP::parseResponseStatus(m_Response, &m_StatusCode, &m_ErrorText);
+        }
+    }
+
+    if (m_StatusCode == 401 && !m_FallbackUrl.isEmpty()) {
+        // Certificate validation error, fallback to HTTP
+        NegotiationCache::setHttpsRejected(m_Url.host(), m_ServerCert, true);
+        m_Url = m_FallbackUrl;
+        m_FallbackUrl.clear();
+        m_Response.clear();
+        m_Reply->deleteLater();
+        m_Reply = nullptr;
+        start();
+        return;
     }
 
-    return reply;
+    m_Finished = true;
+    emit completed();
+
+    if (m_AutoDelete) {
+        deleteLater();
+    }
+}
+
+bool NvHttpRequest::isSucceeded()
+{
+    return m_Finished && m_NetworkError == QNetworkReply::NoError && (m_StatusCode == 0 || m_StatusCode == 200);
+}
+
+void NvHttpRequest::throwIfFailed()
+{
+    if (m_StatusCode != 0 && m_StatusCode != 200) {
+        throw GfeHttpResponseException(m_StatusCode, m_ErrorText);
+    }
+    else if (m_NetworkError != QNetworkReply::NoError) {
+        throw QtNetworkReplyException(m_NetworkError, m_ErrorText);
+    }
 }
@@ -7,6 +7,10 @@
 #include <QUrl>
 #include <QNetworkAccessManager>
 #include <QNetworkReply>
+#include <QHash>
+#include <QMutex>
+#include <QElapsedTimer>
+#include <QTimer>
 
 class NvApp
 {
@@ -43,6 +47,27 @@ public:
     int refreshRate;
 };
 
+// The fields of a serverinfo response that we use, as they appeared in
+// the XML. A field is null if its element wasn't in the response.
+class NvServerInfo
+{
+public:
+    QString hostname;
+    QString uniqueId;
+    QString mac;
+    QString serverCodecModeSupport;
+    QString maxLumaPixelsHEVC;
+    QString localIp;
+    QString externalIp;
+    QString pairStatus;
+    QString state;
+    QString currentGame;
+    QString appVersion;
+    QString gfeVersion;
+    QString gpuType;
+    QVector<NvDisplayMode> displayModes;
+};
+
 class GfeHttpResponseException : public std::exception
 {
 public:
@@ -113,6 +138,8 @@ private:
     QString m_ErrorText;
 };
 
+class NvHttpRequest;
+
 class NvHTTP : public QObject
 {
     Q_OBJECT
@@ -130,6 +157,16 @@ public:
     int
     getCurrentGame(QString serverInfo);
 
+    static
+    int
+    getCurrentGame(const NvServerInfo& serverInfo);
+
+    // Reads every field we need from a serverinfo response in one pass,
+    // rather than scanning the XML again for each one
+    static
+    NvServerInfo
+    parseServerInfo(const QByteArray& serverInfo);
+
     QString
     getServerInfo(NvLogLevel logLevel);
 
@@ -137,6 +174,11 @@ public:
     void
     verifyResponseStatus(QString xml);
 
+    // Returns false and the status if xml holds a failed response
+    static
+    bool
+    parseResponseStatus(const QByteArray& xml, int* statusCode, QString* statusMessage);
+
     static
     QString
     getXmlString(QString xml,
@@ -160,6 +202,8 @@ public:
 
     QString address();
 
+    QSslCertificate serverCert();
+
     static
     QVector<int>
     parseQuad(QString quad);
@@ -180,27 +224,187 @@ public:
     QVector<NvApp>
     getAppList();
 
+    static
+    QVector<NvApp>
+    parseAppList(QString appxml);
+
     QImage
     getBoxArt(int appId);
 
+    // These start a request without blocking and return right away. They
+    // must be called on the main thread, and they all share one network
+    // access manager. The request deletes itself after emitting completed()
+    // or being cancelled, and it doesn't depend on this object staying alive.
+    NvHttpRequest*
+    getServerInfoAsync(NvLogLevel logLevel);
+
+    NvHttpRequest*
+    getAppListAsync();
+
+    NvHttpRequest*
+    launchAppAsync(int appId,
+                   PSTREAM_CONFIGURATION streamConfig,
+                   bool sops,
+                   bool localAudio,
+                   int gamepadMask);
+
+    NvHttpRequest*
+    resumeAppAsync(PSTREAM_CONFIGURATION streamConfig);
+
+    NvHttpRequest*
+    getBoxArtAsync(int appId);
+
     static
     QVector<NvDisplayMode>
     getDisplayModeList(QString serverInfo);
 
+    // Logs how long this object's HTTPS requests took, split by whether
+    // they could resume an earlier TLS session
+    void
+    logRequestTimings(QString name);
+
     QUrl m_BaseUrlHttp;
     QUrl m_BaseUrlHttps;
 private:
-    void
-    handleSslErrors(QNetworkReply* reply, const QList<QSslError>& errors);
-
-    QNetworkReply*
+    QByteArray
     openConnection(QUrl baseUrl,
                    QString command,
                    QString arguments,
                    int timeoutMs,
                    NvLogLevel logLevel);
 
+    NvHttpRequest*
+    startAsyncRequest(QUrl baseUrl,
+                      QString command,
+                      QString arguments,
+                      int timeoutMs,
+                      NvLogLevel logLevel,
+                      bool verifyStatus);
+
+    static
+    QUrl
+    buildUrl(QUrl baseUrl,
+             QString command,
+             QString arguments);
+
+    static
+    QString
+    getLaunchArguments(int appId,
+                       PSTREAM_CONFIGURATION streamConfig,
+                       bool sops,
+                       bool localAudio,
+                       int gamepadMask);
+
+    static
+    QString
+    getResumeArguments(PSTREAM_CONFIGURATION streamConfig);
+
+    static
+    QString
+    getBoxArtArguments(int appId);
+
+    static
+    QNetworkAccessManager*
+    getSharedNetworkAccessManager();
+
     QString m_Address;
     QNetworkAccessManager m_Nam;
     QSslCertificate m_ServerCert;
+
+    int m_FullHandshakeRequests;
+    qint64 m_FullHandshakeTimeMs;
+    int m_ResumedRequests;
+    qint64 m_ResumedTimeMs;
+
+    static QNetworkAccessManager* s_SharedNam;
+};
+
+// One request to the host. The blocking NvHTTP methods run one on their
+// own network access manager and wait for it, and the async methods hand
+// it to the caller.
+class NvHttpRequest : public QObject
+{
+    Q_OBJECT
+
+    friend class NvHTTP;
+
+public:
+    NvHttpRequest(QNetworkAccessManager* nam,
+                  QUrl url,
+                  QSslCertificate serverCert,
+                  int timeoutMs,
+                  NvHTTP::NvLogLevel logLevel);
+
+    ~NvHttpRequest();
+
+    // Stops the request without emitting completed(). It can't be
+    // called after completed() has been emitted.
+    void cancel();
+
+    bool isFinished()
+    {
+        return m_Finished;
+    }
+
+    bool isSucceeded();
+
+    // Throws the same exceptions the blocking NvHTTP methods do
+    void throwIfFailed();
+
+    QByteArray getResponse()
+    {
+        return m_Response;
+    }
+
+    bool isResumedSession()
+    {
+        return m_ResumedSession;
+    }
+
+    qint64 getElapsedMs()
+    {
+        return m_ElapsedMs;
+    }
+
+signals:
+    void completed();
+
+private slots:
+    void handleFinished();
+
+    void handleTimeout();
+
+    void handleSslErrors(const QList<QSslError>& errors);
+
+private:
+    void start();
+
+    QString getTlsSessionKey();
+
+    QNetworkAccessManager* m_Nam;
+    QUrl m_Url;
+    QUrl m_FallbackUrl;
+    QSslCertificate m_ServerCert;
+    int m_TimeoutMs;
+    NvHTTP::NvLogLevel m_LogLevel;
+    bool m_AutoDelete;
+    bool m_VerifyStatus;
+
+    QNetworkReply* m_Reply;
+    QTimer m_TimeoutTimer;
+    QElapsedTimer m_ElapsedTimer;
+    qint64 m_ElapsedMs;
+    bool m_ResumedSession;
+    bool m_Cancelled;
+    bool m_Finished;
+
+    QByteArray m_Response;
+    int m_StatusCode;
+    QNetworkReply::NetworkError m_NetworkError;
+    QString m_ErrorText;
+
+    // TLS sessions by host, port and server certificate, shared by every
+    // request since NvHTTP objects are created and destroyed all the time
+    static QHash<QString, QByteArray> s_TlsSessions;
+    static QMutex s_TlsSessionsLock;
 };
@@ -1,8 +1,12 @@
 #include "nvpairingmanager.h"
+#include "negotiationcache.h"
 #include "utils.h"
 
+#include <QRunnable>
+#include <QSemaphore>
+#include <QThreadPool>
+
 #include <openssl/bio.h>
-#include <openssl/aes.h>
 #include <openssl/rand.h>
 #include <openssl/pem.h>
 #include <openssl/x509.h>
@@ -10,8 +14,56 @@
 
 #define REQUEST_TIMEOUT_MS 5000
 
+// Signs our pairing secret on the thread pool while we wait on the host,
+// since it doesn't depend on anything the host sends us
+class PairingSignatureTask : public QRunnable
+{
+public:
+    PairingSignatureTask(NvPairingManager* pairingManager, QByteArray message)
+        : m_PairingManager(pairingManager),
+          m_Message(message)
+    {
+        setAutoDelete(false);
+        QThreadPool::globalInstance()->start(this);
+    }
+
+    ~PairingSignatureTask()
+    {
+        // Don't leave the task running with a dangling pointer to us
+        if (!QThreadPool::globalInstance()->tryTake(this)) {
+            m_Done.acquire();
+        }
+    }
+
+    QByteArray getSignature()
+    {
+        // The pairing itself runs on the thread pool, so sign it ourselves
+        // if there's no other thread to take the task
+        if (QThreadPool::globalInstance()->tryTake(this)) {
+            run();
+        }
+
+        m_Done.acquire();
+        m_Done.release();
+        return m_Signature;
+    }
+
+    void run() override
+    {
+        m_Signature = m_PairingManager->signMessage(m_Message);
+        m_Done.release();
+    }
+
+private:
+    NvPairingManager* m_PairingManager;
+    QByteArray m_Message;
+    QByteArray m_Signature;
+    QSemaphore m_Done;
+};
+
 NvPairingManager::NvPairingManager(QString address) :
-    m_Http(address, QSslCertificate())
+    m_Http(address, QSslCertificate()),
+    m_ServerCert(nullptr)
 {
     QByteArray cert = IdentityManager::get()->getCertificate();
     BIO *bio = BIO_new_mem_buf(cert.data(), -1);
@@ -34,12 +86,21 @@ NvPairingManager::NvPairingManager(QString address) :
     {
         throw std::runtime_error("Unable to load private key");
     }
+
+    m_EncryptCtx = EVP_CIPHER_CTX_new();
+    THROW_BAD_ALLOC_IF_NULL(m_EncryptCtx);
+
+    m_DecryptCtx = EVP_CIPHER_CTX_new();
+    THROW_BAD_ALLOC_IF_NULL(m_DecryptCtx);
 }
 
 NvPairingManager::~NvPairingManager()
 {
     X509_free(m_Cert);
+    X509_free(m_ServerCert);
     EVP_PKEY_free(m_PrivateKey);
+    EVP_CIPHER_CTX_free(m_EncryptCtx);
+    EVP_CIPHER_CTX_free(m_DecryptCtx);
 }
 
 QByteArray
@@ -51,44 +112,37 @@ NvPairingManager::generateRandomBytes(int length)
 }
 
 QByteArray
-NvPairingManager::encrypt(QByteArray plaintext, AES_KEY* key)
+NvPairingManager::encrypt(QByteArray plaintext)
 {
     QByteArray ciphertext(plaintext.size(), 0);
+    int length = 0;
 
-    for (int i = 0; i < plaintext.size(); i += 16)
-    {
-        AES_encrypt(reinterpret_cast<unsigned char*>(&plaintext.data()[i]),
-                    reinterpret_cast<unsigned char*>(&ciphertext.data()[i]),
-                    key);
-    }
+    // Each 16 byte block is encrypted on its own (ECB without padding)
+    EVP_EncryptUpdate(m_EncryptCtx,
+                      reinterpret_cast<unsigned char*>(ciphertext.data()), &length,
+                      reinterpret_cast<const unsigned char*>(plaintext.constData()), plaintext.size());
+    ciphertext.resize(length);
 
     return ciphertext;
 }
 
 QByteArray
-NvPairingManager::decrypt(QByteArray ciphertext, AES_KEY* key)
+NvPairingManager::decrypt(QByteArray ciphertext)
 {
     QByteArray plaintext(ciphertext.size(), 0);
+    int length = 0;
 
-    for (int i = 0; i < plaintext.size(); i += 16)
-    {
-        AES_decrypt(reinterpret_cast<unsigned char*>(&ciphertext.data()[i]),
-                    reinterpret_cast<unsigned char*>(&plaintext.data()[i]),
-                    key);
-    }
+    EVP_DecryptUpdate(m_DecryptCtx,
+                      reinterpret_cast<unsigned char*>(plaintext.data()), &length,
+                      reinterpret_cast<const unsigned char*>(ciphertext.constData()), ciphertext.size());
+    plaintext.resize(length);
 
     return plaintext;
 }
 
 QByteArray
-NvPairingManager::getSignatureFromPemCert(QByteArray certificate)
+NvPairingManager::getSignatureFromCert(X509* cert)
 {
-    BIO* bio = BIO_new_mem_buf(certificate.data(), -1);
-    THROW_BAD_ALLOC_IF_NULL(bio);
-
-    X509* cert = PEM_read_bio_X509(bio, nullptr, nullptr, nullptr);
-    BIO_free_all(bio);
-
 #if (OPENSSL_VERSION_NUMBER < 0x10002000L)
     ASN1_BIT_STRING *asnSignature = cert->signature;
 #elif (OPENSSL_VERSION_NUMBER < 0x10100000L)
@@ -99,22 +153,12 @@ NvPairingManager::getSignatureFromPemCert(QByteArray certificate)
     X509_get0_signature(&asnSignature, NULL, cert);
 #endif
 
-    QByteArray signature(reinterpret_cast<char*>(asnSignature->data), asnSignature->length);
-
-    X509_free(cert);
-
-    return signature;
+    return QByteArray(reinterpret_cast<char*>(asnSignature->data), asnSignature->length);
 }
 
 bool
-NvPairingManager::verifySignature(QByteArray data, QByteArray signature, QByteArray serverCertificate)
+NvPairingManager::verifySignature(QByteArray data, QByteArray signature, X509* cert)
 {
-    BIO* bio = BIO_new_mem_buf(serverCertificate.data(), -1);
-    THROW_BAD_ALLOC_IF_NULL(bio);
-
-    X509* cert = PEM_read_bio_X509(bio, nullptr, nullptr, nullptr);
-    BIO_free_all(bio);
-
     EVP_PKEY* pubKey = X509_get_pubkey(cert);
     THROW_BAD_ALLOC_IF_NULL(pubKey);
 
@@ -127,7 +171,6 @@ NvPairingManager::verifySignature(QByteArray data, QByteArray signature, QByteAr
 
     EVP_PKEY_free(pubKey);
     EVP_MD_CTX_destroy(mdctx);
-    X509_free(cert);
 
     return result > 0;
 }
@@ -186,9 +229,21 @@ NvPairingManager::pair(QString appVersion, QString pin, QSslCertificate& serverC
     QByteArray salt = generateRandomBytes(16);
     QByteArray saltedPin = saltPin(salt, pin);
 
-    AES_KEY encKey, decKey;
-    AES_set_decrypt_key(reinterpret_cast<const unsigned char*>(QCryptographicHash::hash(saltedPin, hashAlgo).data()), 128, &decKey);
-    AES_set_encrypt_key(reinterpret_cast<const unsigned char*>(QCryptographicHash::hash(saltedPin, hashAlgo).data()), 128, &encKey);
+    // Only the first 128 bits of the hash are used as the AES key
+    QByteArray aesKey = QCryptographicHash::hash(saltedPin, hashAlgo);
+    EVP_EncryptInit_ex(m_EncryptCtx, EVP_aes_128_ecb(), nullptr,
+                       reinterpret_cast<const unsigned char*>(aesKey.constData()), nullptr);
+    EVP_CIPHER_CTX_set_padding(m_EncryptCtx, 0);
+    EVP_DecryptInit_ex(m_DecryptCtx, EVP_aes_128_ecb(), nullptr,
+                       reinterpret_cast<const unsigned char*>(aesKey.constData()), nullptr);
+    EVP_CIPHER_CTX_set_padding(m_DecryptCtx, 0);
+
+    // Nothing we send the host depends on the PIN being right until it
+    // has sent us its pairing secret, so our half is prepared while the
+    // host waits for the user to type the PIN
+    QByteArray randomChallenge = generateRandomBytes(16);
+    QByteArray clientSecretData = generateRandomBytes(16);
+    PairingSignatureTask clientSecretSignature(this, clientSecretData);
 
     QString getCert = m_Http.openConnectionToString(m_Http.m_BaseUrlHttp,
                                                     "pair",
@@ -211,7 +266,16 @@ NvPairingManager::pair(QString appVersion, QString pin, QSslCertificate& serverC
     }
 
     serverCert = QSslCertificate(serverCertStr);
-    if (serverCert.isNull()) {
+    if (!serverCert.isNull()) {
+        // Parse it once for both the signature checks below
+        BIO* bio = BIO_new_mem_buf(serverCertStr.data(), -1);
+        THROW_BAD_ALLOC_IF_NULL(bio);
+
+        X509_free(m_ServerCert);
+        m_ServerCert = PEM_read_bio_X509(bio, nullptr, nullptr, nullptr);
+        BIO_free_all(bio);
+    }
+    if (serverCert.isNull() || m_ServerCert == nullptr) {
         Q_ASSERT(!serverCert.isNull());
 
         qCritical() << "Failed to parse plaincert";
@@ -222,8 +286,7 @@ NvPairingManager::pair(QString appVersion, QString pin, QSslCertificate& serverC
     // Pin this cert for TLS
     m_Http.setServerCert(serverCert);
 
-    QByteArray randomChallenge = generateRandomBytes(16);
-    QByteArray encryptedChallenge = encrypt(randomChallenge, &encKey);
+    QByteArray encryptedChallenge = encrypt(randomChallenge);
     QString challengeXml = m_Http.openConnectionToString(m_Http.m_BaseUrlHttp,
                                                          "pair",
                                                          "devicename=roth&updateState=1&clientchallenge=" +
@@ -237,28 +300,17 @@ NvPairingManager::pair(QString appVersion, QString pin, QSslCertificate& serverC
         return PairState::FAILED;
     }
 
-    QByteArray challengeResponseData = decrypt(m_Http.getXmlStringFromHex(challengeXml, "challengeresponse"), &decKey);
-    QByteArray clientSecretData = generateRandomBytes(16);
+    QByteArray challengeResponseData = decrypt(m_Http.getXmlStringFromHex(challengeXml, "challengeresponse"));
     QByteArray challengeResponse;
     QByteArray serverResponse(challengeResponseData.data(), hashLength);
 
-#if (OPENSSL_VERSION_NUMBER < 0x10002000L)
-    ASN1_BIT_STRING *asnSignature = m_Cert->signature;
-#elif (OPENSSL_VERSION_NUMBER < 0x10100000L)
-    ASN1_BIT_STRING *asnSignature;
-    X509_get0_signature(&asnSignature, NULL, m_Cert);
-#else
-    const ASN1_BIT_STRING *asnSignature;
-    X509_get0_signature(&asnSignature, NULL, m_Cert);
-#endif
-
     challengeResponse.append(challengeResponseData.data() + hashLength, 16);
-    challengeResponse.append(reinterpret_cast<char*>(asnSignature->data), asnSignature->length);
+    challengeResponse.append(getSignatureFromCert(m_Cert));
     challengeResponse.append(clientSecretData);
 
     QByteArray paddedHash = QCryptographicHash::hash(challengeResponse, hashAlgo);
     paddedHash.resize(32);
-    QByteArray encryptedChallengeResponseHash = encrypt(paddedHash, &encKey);
+    QByteArray encryptedChallengeResponseHash = encrypt(paddedHash);
     QString respXml = m_Http.openConnectionToString(m_Http.m_BaseUrlHttp,
                                                     "pair",
                                                     "devicename=roth&updateState=1&serverchallengeresp=" +
@@ -278,7 +330,7 @@ NvPairingManager::pair(QString appVersion, QString pin, QSslCertificate& serverC
 
     if (!verifySignature(serverSecret,
                          serverSignature,
-                         serverCertStr))
+                         m_ServerCert))
     {
         qCritical() << "MITM detected";
         m_Http.openConnectionToString(m_Http.m_BaseUrlHttp, "unpair", nullptr, REQUEST_TIMEOUT_MS);
@@ -287,7 +339,7 @@ NvPairingManager::pair(QString appVersion, QString pin, QSslCertificate& serverC
 
     QByteArray expectedResponseData;
     expectedResponseData.append(randomChallenge);
-    expectedResponseData.append(getSignatureFromPemCert(serverCertStr));
+    expectedResponseData.append(getSignatureFromCert(m_ServerCert));
     expectedResponseData.append(serverSecret);
     if (QCryptographicHash::hash(expectedResponseData, hashAlgo) != serverResponse)
     {
@@ -298,7 +350,7 @@ NvPairingManager::pair(QString appVersion, QString pin, QSslCertificate& serverC
 
     QByteArray clientPairingSecret;
     clientPairingSecret.append(clientSecretData);
-    clientPairingSecret.append(signMessage(clientSecretData));
+    clientPairingSecret.append(clientSecretSignature.getSignature());
 
     QString secretRespXml = m_Http.openConnectionToString(m_Http.m_BaseUrlHttp,
                                                           "pair",
@@ -325,5 +377,8 @@ NvPairingManager::pair(QString appVersion, QString pin, QSslCertificate& serverC
         return PairState::FAILED;
     }
 
+    // The host accepts us over HTTPS from now on
+    NegotiationCache::forgetHttpsOutcomes(m_Http.address());
+
     return PairState::PAIRED;
 }
@@ -3,12 +3,13 @@
 #include "identitymanager.h"
 #include "nvhttp.h"
 
-#include <openssl/aes.h>
 #include <openssl/x509.h>
 #include <openssl/evp.h>
 
 class NvPairingManager
 {
+    friend class PairingSignatureTask;
+
 public:
     enum PairState
     {
@@ -33,21 +34,27 @@ private:
     saltPin(QByteArray salt, QString pin);
 
     QByteArray
-    encrypt(QByteArray plaintext, AES_KEY* key);
+    encrypt(QByteArray plaintext);
 
     QByteArray
-    decrypt(QByteArray ciphertext, AES_KEY* key);
+    decrypt(QByteArray ciphertext);
 
     QByteArray
-    getSignatureFromPemCert(QByteArray certificate);
+    getSignatureFromCert(X509* cert);
 
     bool
-    verifySignature(QByteArray data, QByteArray signature, QByteArray serverCertificate);
+    verifySignature(QByteArray data, QByteArray signature, X509* cert);
 
     QByteArray
     signMessage(QByteArray message);
 
     NvHTTP m_Http;
     X509* m_Cert;
+    X509* m_ServerCert;
     EVP_PKEY* m_PrivateKey;
+
+    // These are keyed with the salted PIN once pairing starts. The EVP
+    // interface uses the CPU's AES instructions where it has them.
+    EVP_CIPHER_CTX* m_EncryptCtx;
+    EVP_CIPHER_CTX* m_DecryptCtx;
 };
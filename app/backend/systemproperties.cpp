@@ -1,9 +1,32 @@
 #include "systemproperties.h"
 
 #include <QGuiApplication>
+#include <QScreen>
+#include <QSettings>
 
 #include "streaming/session.h"
 #include "streaming/streamutils.h"
+#include "streaming/video/decodercache.h"
+
+#ifdef HAVE_FFMPEG
+#include "streaming/video/ffmpeg.h"
+#endif
+
+#define SER_VIDEOINFO "systemvideoinfo"
+#define SER_FINGERPRINT "fingerprint"
+#define SER_HWACCEL "hwaccel"
+#define SER_MAXFPS "maxfps"
+#define SER_DESKTOPRES "desktopres"
+#define SER_NATIVERES "nativeres"
+#define SER_CAPABILITY "capabilitybenchmark"
+#define SER_WIDTH "width"
+#define SER_HEIGHT "height"
+#define SER_FPS "fps"
+#define SER_VIDEOCODEC "videocodec"
+
+// Software decoding must keep up with this much more than the stream's
+// frame rate to leave room for complex scenes and the rest of the client
+#define SW_DECODE_HEADROOM 1.25
 
 SystemProperties::SystemProperties()
 {
@@ -28,29 +51,185 @@ SystemProperties::SystemProperties()
     hasDiscordIntegration = false;
 #endif
 
-    unmappedGamepads = SdlInputHandler::getUnmappedGamepads();
+    // Anything that requires talking to SDL waits until it's first read,
+    // which is after the first frame of the UI has been drawn
+    videoInfoLoaded = false;
+    unmappedGamepadsLoaded = false;
+    capabilityBenchmarkLoaded = false;
 
-    // Populate data that requires talking to SDL. We do it all in one shot
-    // and cache the results to speed up future queries on this data.
-    querySdlVideoInfo();
+    recommendedWidth = 1280;
+    recommendedHeight = 720;
+    recommendedFps = 60;
+    recommendedVideoCodec = StreamingPreferences::VCC_AUTO;
 
-    Q_ASSERT(maximumStreamingFrameRate >= 60);
-    Q_ASSERT(!monitorDesktopResolutions.isEmpty());
-    Q_ASSERT(!monitorNativeResolutions.isEmpty());
+    connect(qApp, &QGuiApplication::screenAdded,
+            this, &SystemProperties::handleScreensChanged);
+    connect(qApp, &QGuiApplication::screenRemoved,
+            this, &SystemProperties::handleScreensChanged);
 }
 
 QRect SystemProperties::getDesktopResolution(int displayIndex)
 {
+    ensureVideoInfo();
+
     // Returns default constructed QRect if out of bounds
     return monitorDesktopResolutions.value(displayIndex);
 }
 
 QRect SystemProperties::getNativeResolution(int displayIndex)
 {
+    ensureVideoInfo();
+
     // Returns default constructed QRect if out of bounds
     return monitorNativeResolutions.value(displayIndex);
 }
 
+bool SystemProperties::getHasHardwareAcceleration()
+{
+    ensureVideoInfo();
+    return hasHardwareAcceleration;
+}
+
+int SystemProperties::getMaximumStreamingFrameRate()
+{
+    ensureVideoInfo();
+    return maximumStreamingFrameRate;
+}
+
+bool SystemProperties::getHasCapabilityBenchmark()
+{
+    if (!capabilityBenchmarkLoaded) {
+        capabilityBenchmarkLoaded = loadCapabilityBenchmark();
+    }
+
+    return capabilityBenchmarkLoaded;
+}
+
+QString SystemProperties::getUnmappedGamepads()
+{
+    // This depends on what's plugged in, so it's never persisted
+    if (!unmappedGamepadsLoaded) {
+        unmappedGamepads = SdlInputHandler::getUnmappedGamepads();
+        unmappedGamepadsLoaded = true;
+    }
+
+    return unmappedGamepads;
+}
+
+void SystemProperties::handleScreensChanged()
+{
+    // The display list and refresh rates no longer match what we have,
+    // so query them again the next time they're read
+    if (videoInfoLoaded) {
+        videoInfoLoaded = false;
+        emit videoInfoChanged();
+    }
+
+    // A benchmark from a different display setup no longer applies
+    if (capabilityBenchmarkLoaded) {
+        capabilityBenchmarkLoaded = false;
+        emit capabilityBenchmarkChanged();
+    }
+}
+
+void SystemProperties::ensureVideoInfo()
+{
+    if (videoInfoLoaded) {
+        return;
+    }
+
+    videoInfoLoaded = true;
+
+    // Populate data that requires talking to SDL. We do it all in one shot
+    // and persist the results, since initializing SDL video and probing
+    // for hardware decoding is slow and the answers only change along with
+    // the displays, GPU or drivers.
+    QString fingerprint = getDisplayFingerprint();
+    if (!loadCachedVideoInfo(fingerprint)) {
+        querySdlVideoInfo();
+        storeCachedVideoInfo(fingerprint);
+    }
+
+    Q_ASSERT(maximumStreamingFrameRate >= 60);
+    Q_ASSERT(!monitorDesktopResolutions.isEmpty());
+    Q_ASSERT(!monitorNativeResolutions.isEmpty());
+}
+
+QString SystemProperties::getDisplayFingerprint()
+{
+    QStringList components;
+
+    components.append(DecoderCapabilityCache::getGpuFingerprint());
+    components.append(QGuiApplication::platformName());
+    components.append(qgetenv("XDG_SESSION_TYPE"));
+
+    for (QScreen* screen : QGuiApplication::screens()) {
+        components.append(QString("%1:%2x%3@%4*%5")
+                          .arg(screen->name())
+                          .arg(screen->size().width())
+                          .arg(screen->size().height())
+                          .arg(screen->refreshRate())
+                          .arg(screen->devicePixelRatio()));
+    }
+
+    return components.join('|');
+}
+
+bool SystemProperties::loadCachedVideoInfo(const QString& fingerprint)
+{
+    QSettings settings;
+
+    settings.beginGroup(SER_VIDEOINFO);
+
+    if (settings.value(SER_FINGERPRINT).toString() != fingerprint) {
+        return false;
+    }
+
+    QList<QRect> desktopResolutions, nativeResolutions;
+    for (const QVariant& rect : settings.value(SER_DESKTOPRES).toList()) {
+        desktopResolutions.append(rect.toRect());
+    }
+    for (const QVariant& rect : settings.value(SER_NATIVERES).toList()) {
+        nativeResolutions.append(rect.toRect());
+    }
+
+    int maxFps = settings.value(SER_MAXFPS).toInt();
+    if (desktopResolutions.isEmpty() || nativeResolutions.isEmpty() || maxFps < 60) {
+        return false;
+    }
+
+    monitorDesktopResolutions = desktopResolutions;
+    monitorNativeResolutions = nativeResolutions;
+    maximumStreamingFrameRate = maxFps;
+    hasHardwareAcceleration = settings.value(SER_HWACCEL).toBool();
+    return true;
+}
+
+void SystemProperties::storeCachedVideoInfo(const QString& fingerprint)
+{
+    // Don't remember a failure to talk to SDL at all
+    if (monitorDesktopResolutions.isEmpty() || monitorNativeResolutions.isEmpty()) {
+        return;
+    }
+
+    QVariantList desktopResolutions, nativeResolutions;
+    for (const QRect& rect : monitorDesktopResolutions) {
+        desktopResolutions.append(rect);
+    }
+    for (const QRect& rect : monitorNativeResolutions) {
+        nativeResolutions.append(rect);
+    }
+
+    QSettings settings;
+
+    settings.beginGroup(SER_VIDEOINFO);
+    settings.setValue(SER_FINGERPRINT, fingerprint);
+    settings.setValue(SER_HWACCEL, hasHardwareAcceleration);
+    settings.setValue(SER_MAXFPS, maximumStreamingFrameRate);
+    settings.setValue(SER_DESKTOPRES, desktopResolutions);
+    settings.setValue(SER_NATIVERES, nativeResolutions);
+}
+
 void SystemProperties::querySdlVideoInfo()
 {
     monitorDesktopResolutions.clear();
@@ -102,7 +281,8 @@ void SystemProperties::querySdlVideoInfo()
         }
     }
 
-    SDL_Window* testWindow = SDL_CreateWindow("", 0, 0, 1280, 720, SDL_WINDOW_HIDDEN);
+    SDL_Window* testWindow = SDL_CreateWindow("", 0, 0, 1280, 720,
+                                              SDL_WINDOW_HIDDEN | StreamUtils::getPlatformWindowFlags());
     if (!testWindow) {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
                      "Failed to create window for hardware decode test: %s",
@@ -121,3 +301,161 @@ void SystemProperties::querySdlVideoInfo()
 
     SDL_QuitSubSystem(SDL_INIT_VIDEO);
 }
+
+bool SystemProperties::loadCapabilityBenchmark()
+{
+    QSettings settings;
+
+    settings.beginGroup(SER_CAPABILITY);
+
+    if (settings.value(SER_FINGERPRINT).toString() != getDisplayFingerprint()) {
+        return false;
+    }
+
+    int width = settings.value(SER_WIDTH).toInt();
+    int height = settings.value(SER_HEIGHT).toInt();
+    int fps = settings.value(SER_FPS).toInt();
+    if (width <= 0 || height <= 0 || fps <= 0) {
+        return false;
+    }
+
+    recommendedWidth = width;
+    recommendedHeight = height;
+    recommendedFps = fps;
+    recommendedVideoCodec = settings.value(SER_VIDEOCODEC, StreamingPreferences::VCC_AUTO).toInt();
+    return true;
+}
+
+bool SystemProperties::canDecodeInRealTime(SDL_Window* window, int videoFormat,
+                                           int width, int height, int fps,
+                                           double softwareRate720p, bool* hardware)
+{
+    *hardware = Session::isHardwareDecodeAvailable(window,
+                                                   StreamingPreferences::VDS_AUTO,
+                                                   videoFormat,
+                                                   width, height, fps);
+    if (*hardware) {
+        return true;
+    }
+
+    // Software decoding time grows roughly with the number of pixels,
+    // so scale the rate measured on the 720p test frame
+    double softwareRate = softwareRate720p * (1280.0 * 720.0) / (width * height);
+    return softwareRate >= fps * SW_DECODE_HEADROOM;
+}
+
+void SystemProperties::runCapabilityBenchmark()
+{
+    static const int k_Heights[] = { 720, 1080, 1440, 2160 };
+
+    // The largest display bounds the useful resolution and the frame rate
+    // tops out at what the displays can show (and 120 FPS beyond that)
+    ensureVideoInfo();
+
+    int maxWidth = 0, maxHeight = 0;
+    for (const QRect& rect : monitorNativeResolutions) {
+        if (rect.width() * rect.height() > maxWidth * maxHeight) {
+            maxWidth = rect.width();
+            maxHeight = rect.height();
+        }
+    }
+
+    QList<int> frameRates;
+    frameRates.append(60);
+    if (qMin(maximumStreamingFrameRate, 120) > 60) {
+        frameRates.append(qMin(maximumStreamingFrameRate, 120));
+    }
+
+    if (SDL_InitSubSystem(SDL_INIT_VIDEO) != 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "SDL_InitSubSystem(SDL_INIT_VIDEO) failed: %s",
+                     SDL_GetError());
+        return;
+    }
+
+    SDL_Window* testWindow = SDL_CreateWindow("", 0, 0, 1280, 720,
+                                              SDL_WINDOW_HIDDEN | StreamUtils::getPlatformWindowFlags());
+    if (!testWindow) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Failed to create window for capability benchmark: %s",
+                     SDL_GetError());
+        SDL_QuitSubSystem(SDL_INIT_VIDEO);
+        return;
+    }
+
+    double h264SoftwareRate = 0, hevcSoftwareRate = 0;
+#ifdef HAVE_FFMPEG
+    h264SoftwareRate = FFmpegVideoDecoder::measureSoftwareDecodeRate(VIDEO_FORMAT_H264);
+    hevcSoftwareRate = FFmpegVideoDecoder::measureSoftwareDecodeRate(VIDEO_FORMAT_H265);
+#endif
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Software decoding rate at 720p: %.0f FPS H.264, %.0f FPS HEVC",
+                h264SoftwareRate, hevcSoftwareRate);
+
+    // 720p60 is always the floor, even if nothing keeps up with it
+    int bestWidth = 1280, bestHeight = 720, bestFps = 60;
+    bool bestHevc = false;
+
+    for (int fps : frameRates) {
+        for (int height : k_Heights) {
+            int width = height * 16 / 9;
+
+            // Frame rates above 60 FPS are never worth a lower resolution
+            if (fps > 60 && (width != bestWidth || height != bestHeight)) {
+                continue;
+            }
+
+            if (height != 720 && (width > maxWidth || height > maxHeight)) {
+                break;
+            }
+
+            bool hevcHardware, h264Hardware;
+            bool hevcWorks = canDecodeInRealTime(testWindow, VIDEO_FORMAT_H265,
+                                                 width, height, fps,
+                                                 hevcSoftwareRate, &hevcHardware);
+            bool h264Works = canDecodeInRealTime(testWindow, VIDEO_FORMAT_H264,
+                                                 width, height, fps,
+                                                 h264SoftwareRate, &h264Hardware);
+
+            if (!hevcWorks && !h264Works) {
+                continue;
+            }
+
+            bestWidth = width;
+            bestHeight = height;
+            bestFps = fps;
+
+            // HEVC is only worth it when the GPU decodes it, since it costs
+            // far more CPU than H.264 to decode in software
+            bestHevc = hevcWorks && hevcHardware;
+        }
+    }
+
+    SDL_DestroyWindow(testWindow);
+
+    SDL_QuitSubSystem(SDL_INIT_VIDEO);
+
+    recommendedWidth = bestWidth;
+    recommendedHeight = bestHeight;
+    recommendedFps = bestFps;
+    recommendedVideoCodec = bestHevc ? StreamingPreferences::VCC_FORCE_HEVC :
+                                       StreamingPreferences::VCC_FORCE_H264;
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Recommended stream settings: %dx%d at %d FPS using %s",
+                recommendedWidth, recommendedHeight, recommendedFps,
+                bestHevc ? "HEVC" : "H.264");
+
+    QSettings settings;
+
+    settings.beginGroup(SER_CAPABILITY);
+    settings.setValue(SER_FINGERPRINT, getDisplayFingerprint());
+    settings.setValue(SER_WIDTH, recommendedWidth);
+    settings.setValue(SER_HEIGHT, recommendedHeight);
+    settings.setValue(SER_FPS, recommendedFps);
+    settings.setValue(SER_VIDEOCODEC, recommendedVideoCodec);
+
+    capabilityBenchmarkLoaded = true;
+    emit capabilityBenchmarkChanged();
+}
@@ -3,6 +3,8 @@
 #include <QObject>
 #include <QRect>
 
+#include <SDL.h>
+
 class SystemProperties : public QObject
 {
     Q_OBJECT
@@ -10,24 +12,64 @@ class SystemProperties : public QObject
 public:
     SystemProperties();
 
-    Q_PROPERTY(bool hasHardwareAcceleration MEMBER hasHardwareAcceleration CONSTANT)
+    Q_PROPERTY(bool hasHardwareAcceleration READ getHasHardwareAcceleration NOTIFY videoInfoChanged)
     Q_PROPERTY(bool isRunningWayland MEMBER isRunningWayland CONSTANT)
     Q_PROPERTY(bool isRunningXWayland MEMBER isRunningXWayland CONSTANT)
     Q_PROPERTY(bool isWow64 MEMBER isWow64 CONSTANT)
     Q_PROPERTY(bool hasBrowser MEMBER hasBrowser CONSTANT)
     Q_PROPERTY(bool hasDiscordIntegration MEMBER hasDiscordIntegration CONSTANT)
-    Q_PROPERTY(QString unmappedGamepads MEMBER unmappedGamepads NOTIFY unmappedGamepadsChanged)
-    Q_PROPERTY(int maximumStreamingFrameRate MEMBER maximumStreamingFrameRate CONSTANT)
+    Q_PROPERTY(QString unmappedGamepads READ getUnmappedGamepads NOTIFY unmappedGamepadsChanged)
+    Q_PROPERTY(int maximumStreamingFrameRate READ getMaximumStreamingFrameRate NOTIFY videoInfoChanged)
+    Q_PROPERTY(bool hasCapabilityBenchmark READ getHasCapabilityBenchmark NOTIFY capabilityBenchmarkChanged)
+    Q_PROPERTY(int recommendedWidth MEMBER recommendedWidth NOTIFY capabilityBenchmarkChanged)
+    Q_PROPERTY(int recommendedHeight MEMBER recommendedHeight NOTIFY capabilityBenchmarkChanged)
+    Q_PROPERTY(int recommendedFps MEMBER recommendedFps NOTIFY capabilityBenchmarkChanged)
+    Q_PROPERTY(int recommendedVideoCodec MEMBER recommendedVideoCodec NOTIFY capabilityBenchmarkChanged)
 
     Q_INVOKABLE QRect getDesktopResolution(int displayIndex);
     Q_INVOKABLE QRect getNativeResolution(int displayIndex);
 
+    // Finds the highest resolution and frame rate that this PC can decode
+    // in real time, preferring hardware decoding, and stores them as the
+    // recommended settings. This blocks for a few seconds.
+    Q_INVOKABLE void runCapabilityBenchmark();
+
+    bool getHasHardwareAcceleration();
+    QString getUnmappedGamepads();
+    int getMaximumStreamingFrameRate();
+    bool getHasCapabilityBenchmark();
+
 signals:
     void unmappedGamepadsChanged();
 
+    void videoInfoChanged();
+
+    void capabilityBenchmarkChanged();
+
+private slots:
+    void handleScreensChanged();
+
 private:
+    // The SDL-derived properties aren't needed to show the first window,
+    // so they're only queried when something first reads them
+    void ensureVideoInfo();
+
     void querySdlVideoInfo();
 
+    bool loadCachedVideoInfo(const QString& fingerprint);
+
+    void storeCachedVideoInfo(const QString& fingerprint);
+
+    static QString getDisplayFingerprint();
+
+    bool loadCapabilityBenchmark();
+
+    // Whether the stream can be decoded at its full frame rate, through
+    // hardware decoding or the measured software decoding rate
+    static bool canDecodeInRealTime(SDL_Window* window, int videoFormat,
+                                    int width, int height, int fps,
+                                    double softwareRate720p, bool* hardware);
+
     bool hasHardwareAcceleration;
     bool isRunningWayland;
     bool isRunningXWayland;
@@ -38,5 +80,12 @@ private:
     int maximumStreamingFrameRate;
     QList<QRect> monitorDesktopResolutions;
     QList<QRect> monitorNativeResolutions;
+    int recommendedWidth;
+    int recommendedHeight;
+    int recommendedFps;
+    int recommendedVideoCodec;
+    bool videoInfoLoaded;
+    bool unmappedGamepadsLoaded;
+    bool capabilityBenchmarkLoaded;
 };
 
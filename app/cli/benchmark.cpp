@@ -0,0 +1,1041 @@
+#include "benchmark.h"
+
+#include "backend/nvhttp.h"
+#include "streaming/analogresponse.h"
+#include "streaming/input.h"
+#include "streaming/session.h"
+#include "streaming/audio/audiodecoder.h"
+#include "streaming/streamutils.h"
+
+#ifdef HAVE_FFMPEG
+#include "streaming/video/framepool.h"
+#include "streaming/video/ffmpeg-renderers/pacer/spscqueue.h"
+#endif
+
+#include <Limelight.h>
+
+extern "C" {
+#include <rs.h>
+}
+
+#include <opus.h>
+
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QVector>
+
+#include <algorithm>
+
+#if defined(Q_OS_WIN32)
+#include <qt_windows.h>
+#else
+#include <sys/resource.h>
+#endif
+
+// How long rendering may continue after the last frame was submitted
+#define BENCHMARK_DRAIN_MS 250
+
+// Audio packets decoded before allocations are counted, so the pipeline
+// has settled into its steady state
+#define BENCHMARK_AUDIO_WARMUP_PACKETS 100
+
+// Enough parses of a serverinfo response to take a measurable amount of time
+#define BENCHMARK_SERVERINFO_ITERATIONS 10000
+
+// An FEC block of a large frame at 20% FEC, with every parity shard
+// needed to recover it
+#define BENCHMARK_FEC_DATA_SHARDS 100
+#define BENCHMARK_FEC_PARITY_SHARDS 20
+#define BENCHMARK_FEC_ITERATIONS 200
+
+// Seed of the frame loss and jitter applied to a replay, so every pass
+// and every run loses and delays the same frames
+#define BENCHMARK_IMPAIRMENT_SEED 0x4D4C4252
+
+// Each microbenchmark is timed this many times, after a warmup pass
+#define BENCHMARK_MICRO_REPETITIONS 5
+
+// Iterations of the paths that take well under a microsecond
+#define BENCHMARK_MICRO_ITERATIONS 1000000
+
+// Iterations of the serverinfo XML paths, which take tens of microseconds
+#define BENCHMARK_MICRO_XML_ITERATIONS 2000
+
+// A second of 5 ms audio packets, decoded 10 times per repetition
+#define BENCHMARK_MICRO_AUDIO_PACKETS 200
+
+// Frames handed to the consumer thread, and the depth of the queue between
+// them, which matches the Pacer's
+#define BENCHMARK_MICRO_HANDOFF_ITERATIONS 20000
+#define BENCHMARK_MICRO_HANDOFF_QUEUE 8
+
+namespace CliBenchmark
+{
+
+static const char* getDecoderName(StreamingPreferences::VideoDecoderSelection vds)
+{
+    switch (vds)
+    {
+    case StreamingPreferences::VDS_FORCE_HARDWARE:
+        return "hardware";
+    case StreamingPreferences::VDS_FORCE_SOFTWARE:
+        return "software";
+    case StreamingPreferences::VDS_FORCE_D3D11VA:
+        return "d3d11va";
+    default:
+        return "auto";
+    }
+}
+
+// User and kernel time of the whole process
+static Uint64 getProcessCpuTimeUs()
+{
+#if defined(Q_OS_WIN32)
+    FILETIME creationTime, exitTime, kernelTime, userTime;
+    if (!GetProcessTimes(GetCurrentProcess(), &creationTime, &exitTime, &kernelTime, &userTime)) {
+        return 0;
+    }
+
+    ULARGE_INTEGER kernel, user;
+    kernel.LowPart = kernelTime.dwLowDateTime;
+    kernel.HighPart = kernelTime.dwHighDateTime;
+    user.LowPart = userTime.dwLowDateTime;
+    user.HighPart = userTime.dwHighDateTime;
+
+    // FILETIMEs are in 100 ns units
+    return (kernel.QuadPart + user.QuadPart) / 10;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+
+    return (Uint64)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 +
+            usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+#endif
+}
+
+// Counts every allocation made through SDL while the audio pass runs
+static SDL_atomic_t s_AllocationCount;
+static SDL_malloc_func s_RealMalloc;
+static SDL_calloc_func s_RealCalloc;
+static SDL_realloc_func s_RealRealloc;
+static SDL_free_func s_RealFree;
+
+static void* SDLCALL countingMalloc(size_t size)
+{
+    SDL_AtomicIncRef(&s_AllocationCount);
+    return s_RealMalloc(size);
+}
+
+static void* SDLCALL countingCalloc(size_t nmemb, size_t size)
+{
+    SDL_AtomicIncRef(&s_AllocationCount);
+    return s_RealCalloc(nmemb, size);
+}
+
+static void* SDLCALL countingRealloc(void* mem, size_t size)
+{
+    SDL_AtomicIncRef(&s_AllocationCount);
+    return s_RealRealloc(mem, size);
+}
+
+// Accepts every frame and reports a queue that's always at its target,
+// so frames take the same jitter buffer path as with a real device
+// without anything being played.
+class BenchmarkAudioRenderer : public IAudioRenderer
+{
+public:
+    BenchmarkAudioRenderer()
+        : m_Buffer(nullptr),
+          m_BufferSize(0),
+          m_FrameDurationUs(0)
+    {
+    }
+
+    virtual ~BenchmarkAudioRenderer()
+    {
+        SDL_free(m_Buffer);
+    }
+
+    virtual bool prepareForPlayback(const OPUS_MULTISTREAM_CONFIGURATION* opusConfig)
+    {
+        // Room for the jitter buffer stretching a frame
+        m_BufferSize = opusConfig->samplesPerFrame * 2 * opusConfig->channelCount * sizeof(float);
+        m_Buffer = SDL_malloc(m_BufferSize);
+        m_FrameDurationUs = (int)((Sint64)opusConfig->samplesPerFrame * 1000000 / opusConfig->sampleRate);
+        return m_Buffer != nullptr;
+    }
+
+    virtual void* getAudioBuffer(int* size)
+    {
+        *size = SDL_min(*size, m_BufferSize);
+        return m_Buffer;
+    }
+
+    virtual bool submitAudio(int)
+    {
+        return true;
+    }
+
+    virtual int getCapabilities()
+    {
+        return CAPABILITY_DIRECT_SUBMIT;
+    }
+
+    virtual bool getQueueStatus(int* queuedUs, int* targetUs)
+    {
+        *queuedUs = *targetUs = 2 * m_FrameDurationUs;
+        return true;
+    }
+
+    virtual AudioFormat getAudioBufferFormat()
+    {
+        return AudioFormatFloat;
+    }
+
+private:
+    void* m_Buffer;
+    int m_BufferSize;
+    int m_FrameDurationUs;
+};
+
+static void printHistogram(const char* name, const FrameTimeHistogram& histogram)
+{
+    fprintf(stdout,
+            "  %s p50/p95/p99/max: %.2f/%.2f/%.2f/%.2f ms\n",
+            name,
+            (float)histogram.getPercentileUs(50) / 1000,
+            (float)histogram.getPercentileUs(95) / 1000,
+            (float)histogram.getPercentileUs(99) / 1000,
+            (float)histogram.maxUs / 1000);
+}
+
+Runner::Runner(QString capturePath, bool realtime,
+               QList<StreamingPreferences::VideoDecoderSelection> decoders,
+               int lossPercent, int jitterMs, int ratePercent)
+    : m_CapturePath(capturePath),
+      m_Realtime(realtime),
+      m_Decoders(decoders),
+      m_LossPercent(lossPercent),
+      m_JitterMs(jitterMs),
+      m_RatePercent(ratePercent),
+      m_Window(nullptr),
+      m_Decoder(nullptr),
+      m_SubmittedFrames(0),
+      m_LostFrames(0)
+{
+    SDL_AtomicSet(&m_FeederDone, 0);
+    SDL_AtomicSet(&m_Stopping, 0);
+}
+
+// This is how a serverinfo response used to be parsed, with a QString
+// copy of the body and a new reader for each field
+static int parseServerInfoPerField(const QByteArray& response)
+{
+    static const char* const k_Fields[] = {
+        "hostname", "uniqueid", "mac", "ServerCodecModeSupport", "MaxLumaPixelsHEVC",
+        "LocalIP", "ExternalIP", "PairStatus", "appversion", "GfeVersion", "gputype",
+    };
+
+    QString serverInfo = QString::fromUtf8(response);
+    int statusCode = 0;
+    QString statusMessage;
+    NvHTTP::parseResponseStatus(serverInfo.toUtf8(), &statusCode, &statusMessage);
+
+    int length = 0;
+    for (const char* field : k_Fields) {
+        length += NvHTTP::getXmlString(serverInfo, field).length();
+    }
+
+    if (NvHTTP::getXmlString(serverInfo, "state").endsWith("_SERVER_BUSY")) {
+        length += NvHTTP::getXmlString(serverInfo, "currentgame").toInt();
+    }
+    length += NvHTTP::getDisplayModeList(serverInfo).count();
+
+    return length;
+}
+
+static int parseServerInfoSinglePass(const QByteArray& response)
+{
+    int statusCode = 0;
+    QString statusMessage;
+    NvHTTP::parseResponseStatus(response, &statusCode, &statusMessage);
+
+    NvServerInfo info = NvHTTP::parseServerInfo(response);
+    return info.hostname.length() + info.uniqueId.length() + info.mac.length() +
+            info.serverCodecModeSupport.length() + info.maxLumaPixelsHEVC.length() +
+            info.localIp.length() + info.externalIp.length() + info.pairStatus.length() +
+            info.appVersion.length() + info.gfeVersion.length() + info.gpuType.length() +
+            NvHTTP::getCurrentGame(info) + info.displayModes.count();
+}
+
+int runServerInfoBenchmark(QString serverInfoPath)
+{
+    QFile file(serverInfoPath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        fprintf(stderr, "Unable to read serverinfo response: %s\n", qPrintable(serverInfoPath));
+        return 1;
+    }
+
+    QByteArray response = file.readAll();
+
+    struct {
+        const char* name;
+        int (*parse)(const QByteArray&);
+    } passes[] = {
+        { "Per-field scans", parseServerInfoPerField },
+        { "Single pass", parseServerInfoSinglePass },
+    };
+
+    fprintf(stdout,
+            "Parsing %s (%d bytes) %d times\n",
+            qPrintable(serverInfoPath),
+            response.size(),
+            BENCHMARK_SERVERINFO_ITERATIONS);
+
+    for (const auto& pass : passes) {
+        // The result is kept so the parsing can't be optimized away
+        int checksum = 0;
+        Uint64 startTimeUs = StreamUtils::getTimeUs();
+        for (int i = 0; i < BENCHMARK_SERVERINFO_ITERATIONS; i++) {
+            checksum += pass.parse(response);
+        }
+        Uint64 elapsedUs = StreamUtils::getTimeUs() - startTimeUs;
+
+        fprintf(stdout,
+                "  %-16s %8.2f us per response (checksum %d)\n",
+                pass.name,
+                (double)elapsedUs / BENCHMARK_SERVERINFO_ITERATIONS,
+                checksum);
+    }
+
+    return 0;
+}
+
+int runFecBenchmark()
+{
+    // Packet payloads from small to the largest that fit a 1500 byte MTU
+    static const int k_ShardSizes[] = { 256, 512, 1024, 1392 };
+    const int totalShards = BENCHMARK_FEC_DATA_SHARDS + BENCHMARK_FEC_PARITY_SHARDS;
+
+    reed_solomon_init();
+
+    reed_solomon* rs = reed_solomon_new(BENCHMARK_FEC_DATA_SHARDS, BENCHMARK_FEC_PARITY_SHARDS);
+    if (rs == nullptr) {
+        fprintf(stderr, "Unable to create Reed-Solomon codec\n");
+        return 1;
+    }
+
+    fprintf(stdout,
+            "Recovering %d lost of %d data shards with %d parity shards %d times\n",
+            BENCHMARK_FEC_PARITY_SHARDS,
+            BENCHMARK_FEC_DATA_SHARDS,
+            BENCHMARK_FEC_PARITY_SHARDS,
+            BENCHMARK_FEC_ITERATIONS);
+
+    int ret = 0;
+    for (int shardSize : k_ShardSizes) {
+        QByteArray original(totalShards * shardSize, 0);
+        for (int i = 0; i < original.size(); i++) {
+            original[i] = (char)(i * 31 + (i >> 8));
+        }
+
+        unsigned char* shards[totalShards];
+        unsigned char marks[totalShards];
+        for (int i = 0; i < totalShards; i++) {
+            shards[i] = (unsigned char*)original.data() + i * shardSize;
+        }
+
+        if (reed_solomon_encode(rs, shards, totalShards, shardSize) != 0) {
+            fprintf(stderr, "Unable to encode %d byte shards\n", shardSize);
+            ret = 1;
+            break;
+        }
+
+        QByteArray damaged;
+        Uint64 elapsedUs = 0;
+        for (int i = 0; i < BENCHMARK_FEC_ITERATIONS; i++) {
+            // Lose a different run of data shards each time, so the
+            // decode matrix isn't the same on every pass
+            damaged = original;
+            memset(marks, 0, sizeof(marks));
+            for (int j = 0; j < totalShards; j++) {
+                shards[j] = (unsigned char*)damaged.data() + j * shardSize;
+            }
+            for (int j = 0; j < BENCHMARK_FEC_PARITY_SHARDS; j++) {
+                int lost = (i + j * 5) % BENCHMARK_FEC_DATA_SHARDS;
+                marks[lost] = 1;
+                memset(shards[lost], 0, shardSize);
+            }
+
+            Uint64 startTimeUs = StreamUtils::getTimeUs();
+            int err = reed_solomon_reconstruct(rs, shards, marks, totalShards, shardSize);
+            elapsedUs += StreamUtils::getTimeUs() - startTimeUs;
+
+            if (err != 0 || memcmp(damaged.constData(), original.constData(),
+                                   BENCHMARK_FEC_DATA_SHARDS * shardSize) != 0) {
+                fprintf(stderr, "Recovery of %d byte shards failed\n", shardSize);
+                ret = 1;
+                break;
+            }
+        }
+
+        if (ret != 0) {
+            break;
+        }
+
+        double recoveredBytes = (double)BENCHMARK_FEC_PARITY_SHARDS * shardSize * BENCHMARK_FEC_ITERATIONS;
+        fprintf(stdout,
+                "  %4d byte shards %8.2f us per block %8.2f MB/s recovered\n",
+                shardSize,
+                (double)elapsedUs / BENCHMARK_FEC_ITERATIONS,
+                elapsedUs != 0 ? recoveredBytes / elapsedUs : 0);
+    }
+
+    reed_solomon_release(rs);
+    return ret;
+}
+
+// Result of timing one hot path, reported as the fastest and the median
+// of several repetitions so a single preemption doesn't skew the numbers
+struct MicrobenchmarkResult
+{
+    const char* name;
+    int iterations;
+    double minNsPerOp;
+    double medianNsPerOp;
+    Sint64 checksum;
+};
+
+// Runs op(i) for iterations values of i, after an untimed warmup pass.
+// The returned values are summed so the work can't be optimized away.
+template <typename Op>
+static MicrobenchmarkResult timeMicrobenchmark(const char* name, int iterations, Op op)
+{
+    MicrobenchmarkResult result = {};
+    double nsPerOp[BENCHMARK_MICRO_REPETITIONS];
+
+    result.name = name;
+    result.iterations = iterations;
+
+    for (int i = 0; i < iterations / 10; i++) {
+        result.checksum += op(i);
+    }
+    result.checksum = 0;
+
+    for (int rep = 0; rep < BENCHMARK_MICRO_REPETITIONS; rep++) {
+        Uint64 startTimeUs = StreamUtils::getTimeUs();
+        for (int i = 0; i < iterations; i++) {
+            result.checksum += op(i);
+        }
+        nsPerOp[rep] = (double)(StreamUtils::getTimeUs() - startTimeUs) * 1000 / iterations;
+    }
+
+    std::sort(nsPerOp, nsPerOp + BENCHMARK_MICRO_REPETITIONS);
+    result.minNsPerOp = nsPerOp[0];
+    result.medianNsPerOp = nsPerOp[BENCHMARK_MICRO_REPETITIONS / 2];
+    return result;
+}
+
+// A serverinfo response like the ones GFE and Sunshine send, so the
+// XML benchmarks don't need a saved response
+static QByteArray getSampleServerInfo()
+{
+    QByteArray displayModes;
+    static const int k_Modes[][3] = {
+        { 3840, 2160, 60 }, { 2560, 1440, 144 }, { 2560, 1440, 60 },
+        { 1920, 1080, 240 }, { 1920, 1080, 60 }, { 1280, 720, 60 },
+    };
+    for (const auto& mode : k_Modes) {
+        displayModes += QString("<DisplayMode><Width>%1</Width><Height>%2</Height>"
+                                "<RefreshRate>%3</RefreshRate></DisplayMode>")
+                        .arg(mode[0]).arg(mode[1]).arg(mode[2]).toUtf8();
+    }
+
+    return "<?xml version=\"1.0\" encoding=\"utf-8\"?>"
+           "<root status_code=\"200\">"
+           "<hostname>BENCHMARK-PC</hostname>"
+           "<appversion>7.1.431.-1</appversion>"
+           "<GfeVersion>3.23.0.74</GfeVersion>"
+           "<uniqueid>0123456789ABCDEF0123456789ABCDEF</uniqueid>"
+           "<HttpsPort>47984</HttpsPort>"
+           "<ExternalPort>47989</ExternalPort>"
+           "<MaxLumaPixelsHEVC>1869449984</MaxLumaPixelsHEVC>"
+           "<mac>01:23:45:67:89:AB</mac>"
+           "<LocalIP>192.168.1.10</LocalIP>"
+           "<ServerCodecModeSupport>259</ServerCodecModeSupport>"
+           "<SupportedDisplayMode>" + displayModes + "</SupportedDisplayMode>"
+           "<PairStatus>1</PairStatus>"
+           "<currentgame>0</currentgame>"
+           "<state>SUNSHINE_SERVER_FREE</state>"
+           "<gputype>NVIDIA GeForce RTX 3080</gputype>"
+           "</root>";
+}
+
+// Opus packets of a stereo tone at the size the host sends them
+static QList<QByteArray> encodeSampleAudio(int sampleRate, int samplesPerFrame, int frames)
+{
+    QList<QByteArray> packets;
+    int err;
+
+    OpusEncoder* encoder = opus_encoder_create(sampleRate, 2, OPUS_APPLICATION_RESTRICTED_LOWDELAY, &err);
+    if (encoder == nullptr) {
+        return packets;
+    }
+
+    opus_encoder_ctl(encoder, OPUS_SET_BITRATE(128000));
+
+    QVector<float> pcm(samplesPerFrame * 2);
+    unsigned char packet[AUDIO_PACKET_MAX_SIZE];
+    for (int frame = 0; frame < frames; frame++) {
+        for (int i = 0; i < samplesPerFrame; i++) {
+            double t = (double)(frame * samplesPerFrame + i) / sampleRate;
+            pcm[i * 2] = (float)(0.5 * SDL_sin(2 * M_PI * 440 * t));
+            pcm[i * 2 + 1] = (float)(0.5 * SDL_sin(2 * M_PI * 660 * t));
+        }
+
+        int length = opus_encode_float(encoder, pcm.constData(), samplesPerFrame, packet, sizeof(packet));
+        if (length <= 0) {
+            packets.clear();
+            break;
+        }
+
+        packets.append(QByteArray((const char*)packet, length));
+    }
+
+    opus_encoder_destroy(encoder);
+    return packets;
+}
+
+#ifdef HAVE_FFMPEG
+// Hands frames from the pool to a consumer thread the way the decoder
+// thread hands them to the Pacer, and times the round trip of each frame
+class FrameHandoffBenchmark
+{
+public:
+    FrameHandoffBenchmark()
+        : m_Pool(BENCHMARK_MICRO_HANDOFF_QUEUE),
+          m_Thread(nullptr)
+    {
+        SDL_AtomicSet(&m_Consumed, 0);
+        m_Thread = SDL_CreateThread(consumerThreadProc, "MicroConsumer", this);
+    }
+
+    ~FrameHandoffBenchmark()
+    {
+        m_Queue.stopWaiting();
+        SDL_WaitThread(m_Thread, nullptr);
+    }
+
+    bool isReady()
+    {
+        return m_Thread != nullptr;
+    }
+
+    int handOff(int)
+    {
+        AVFrame* frame = m_Pool.getFrame();
+        if (frame == nullptr) {
+            return 0;
+        }
+
+        int target = SDL_AtomicGet(&m_Consumed) + 1;
+        while (!m_Queue.enqueue(frame)) {
+            SDL_Delay(0);
+        }
+
+        // Wait for the consumer, so this measures the wakeup as well as
+        // the queue operations
+        while (SDL_AtomicGet(&m_Consumed) < target) {
+            SDL_CPUPauseInstruction();
+        }
+
+        return 1;
+    }
+
+private:
+    static int consumerThreadProc(void* context)
+    {
+        auto me = reinterpret_cast<FrameHandoffBenchmark*>(context);
+        AVFrame* frame;
+
+        while (me->m_Queue.waitForItems(-1)) {
+            while (me->m_Queue.dequeue(frame)) {
+                me->m_Pool.releaseFrame(frame);
+                SDL_AtomicIncRef(&me->m_Consumed);
+            }
+        }
+
+        return 0;
+    }
+
+    FramePool m_Pool;
+    SpscQueue<AVFrame*, BENCHMARK_MICRO_HANDOFF_QUEUE> m_Queue;
+    SDL_atomic_t m_Consumed;
+    SDL_Thread* m_Thread;
+};
+#endif
+
+int runMicrobenchmarks()
+{
+    QVector<MicrobenchmarkResult> results;
+
+    // Aspect ratio scaling, once per window resize and per overlay update
+    results.append(timeMicrobenchmark("StreamUtils::scaleSourceToDestinationSurface",
+                                      BENCHMARK_MICRO_ITERATIONS,
+                                      [](int i) {
+        SDL_Rect src = { 0, 0, 1280 + (i & 0xFF) * 8, 720 + (i & 0x7F) * 4 };
+        SDL_Rect dst = { 0, 0, 1920 + (i & 0x3F), 1080 };
+        StreamUtils::scaleSourceToDestinationSurface(&src, &dst);
+        return dst.x + dst.y + dst.w + dst.h;
+    }));
+
+    // Input translation done for every key, stick and trigger event
+    results.append(timeMicrobenchmark("SdlInputHandler::getVirtualKey",
+                                      BENCHMARK_MICRO_ITERATIONS,
+                                      [](int i) {
+        return (int)SdlInputHandler::getVirtualKey((SDL_Scancode)(i % SDL_NUM_SCANCODES));
+    }));
+
+    AnalogResponse analogResponse;
+    analogResponse.initialize(10, 5, StreamingPreferences::GRC_QUADRATIC);
+    results.append(timeMicrobenchmark("AnalogResponse::processStick",
+                                      BENCHMARK_MICRO_ITERATIONS,
+                                      [&analogResponse](int i) {
+        short x, y;
+        analogResponse.processStick((short)(i * 7919), (short)(i * 104729), &x, &y);
+        return x + y;
+    }));
+    results.append(timeMicrobenchmark("AnalogResponse::processTrigger",
+                                      BENCHMARK_MICRO_ITERATIONS,
+                                      [&analogResponse](int i) {
+        return (int)analogResponse.processTrigger((short)(i & 0x7FFF));
+    }));
+
+    // Host polling parses a serverinfo response every few seconds per host
+    QByteArray serverInfo = getSampleServerInfo();
+    QString serverInfoString = QString::fromUtf8(serverInfo);
+    results.append(timeMicrobenchmark("NvHTTP::getXmlString",
+                                      BENCHMARK_MICRO_XML_ITERATIONS,
+                                      [&serverInfoString](int) {
+        return NvHTTP::getXmlString(serverInfoString, "gputype").length();
+    }));
+    results.append(timeMicrobenchmark("NvHTTP::parseServerInfo",
+                                      BENCHMARK_MICRO_XML_ITERATIONS,
+                                      [&serverInfo](int) {
+        return parseServerInfoSinglePass(serverInfo);
+    }));
+
+    // Opus decode into the renderer's buffer for every audio packet
+    OPUS_MULTISTREAM_CONFIGURATION opusConfig = {};
+    opusConfig.sampleRate = 48000;
+    opusConfig.channelCount = 2;
+    opusConfig.streams = 1;
+    opusConfig.coupledStreams = 1;
+    opusConfig.samplesPerFrame = 240;
+    opusConfig.mapping[0] = 0;
+    opusConfig.mapping[1] = 1;
+
+    QList<QByteArray> packets = encodeSampleAudio(opusConfig.sampleRate,
+                                                  opusConfig.samplesPerFrame,
+                                                  BENCHMARK_MICRO_AUDIO_PACKETS);
+    BenchmarkAudioRenderer audioRenderer;
+    AudioDecoder audioDecoder;
+    if (packets.isEmpty() ||
+            !audioRenderer.prepareForPlayback(&opusConfig) ||
+            !audioDecoder.initialize(&opusConfig) ||
+            !audioDecoder.prepareForRenderer(&audioRenderer)) {
+        fprintf(stderr, "Unable to initialize the audio decoder\n");
+        return 1;
+    }
+    results.append(timeMicrobenchmark("AudioDecoder::decodeAndSubmit",
+                                      BENCHMARK_MICRO_AUDIO_PACKETS * 10,
+                                      [&](int i) {
+        const QByteArray& packet = packets.at(i % packets.size());
+        return (int)audioDecoder.decodeAndSubmit(&audioRenderer,
+                                                 (const unsigned char*)packet.constData(),
+                                                 packet.size(),
+                                                 false);
+    }));
+
+#ifdef HAVE_FFMPEG
+    // The decoder to Pacer frame handoff, once per video frame
+    FrameHandoffBenchmark handoff;
+    if (!handoff.isReady()) {
+        fprintf(stderr, "Unable to start the frame consumer thread\n");
+        return 1;
+    }
+    results.append(timeMicrobenchmark("FramePool/SpscQueue handoff",
+                                      BENCHMARK_MICRO_HANDOFF_ITERATIONS,
+                                      [&handoff](int i) {
+        return handoff.handOff(i);
+    }));
+#endif
+
+    // One object per path with a fixed key order (QJsonObject sorts its
+    // keys), so runs can be compared with a plain diff or a script
+    QJsonArray benchmarks;
+    for (const MicrobenchmarkResult& result : results) {
+        QJsonObject entry;
+        entry["name"] = result.name;
+        entry["iterations"] = result.iterations;
+        entry["repetitions"] = BENCHMARK_MICRO_REPETITIONS;
+        entry["min_ns_per_op"] = qRound(result.minNsPerOp * 10) / 10.0;
+        entry["median_ns_per_op"] = qRound(result.medianNsPerOp * 10) / 10.0;
+        entry["checksum"] = (double)result.checksum;
+        benchmarks.append(entry);
+    }
+
+    QJsonObject root;
+    root["version"] = 1;
+    root["benchmarks"] = benchmarks;
+
+    fprintf(stdout, "%s", QJsonDocument(root).toJson(QJsonDocument::Indented).constData());
+    fflush(stdout);
+    return 0;
+}
+
+int Runner::run()
+{
+    if (!m_Reader.open(m_CapturePath)) {
+        fprintf(stderr, "Unable to read capture: %s\n", qPrintable(m_CapturePath));
+        return 1;
+    }
+
+    if (SDL_InitSubSystem(SDL_INIT_VIDEO) != 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "SDL_InitSubSystem(SDL_INIT_VIDEO) failed: %s",
+                     SDL_GetError());
+        return 1;
+    }
+
+    const CAPTURE_FILE_HEADER* header = m_Reader.getHeader();
+    m_Window = SDL_CreateWindow("Moonlight Benchmark",
+                                SDL_WINDOWPOS_CENTERED,
+                                SDL_WINDOWPOS_CENTERED,
+                                (int)header->width,
+                                (int)header->height,
+                                StreamUtils::getPlatformWindowFlags());
+    if (m_Window == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "SDL_CreateWindow() failed: %s",
+                     SDL_GetError());
+        SDL_QuitSubSystem(SDL_INIT_VIDEO);
+        return 1;
+    }
+
+    // The renderers reach the overlays through the active session, so
+    // stand in for one while the benchmark runs.
+    NvApp app;
+    app.id = 0;
+    app.hdrSupported = false;
+    Session session(nullptr, app);
+    Session::s_ActiveSessionSemaphore.acquire();
+    Session::s_ActiveSession = &session;
+
+    fprintf(stdout,
+            "Replaying %s (%ux%u, %u FPS) %s\n",
+            qPrintable(m_CapturePath),
+            header->width,
+            header->height,
+            header->frameRate,
+            m_Realtime ? "at the captured timing" : "as fast as possible");
+    if (m_LossPercent != 0 || m_JitterMs != 0 || m_RatePercent != 100) {
+        fprintf(stdout,
+                "Emulating %d%% frame loss and %d ms of jitter at %d%% of the captured rate\n",
+                m_LossPercent,
+                m_JitterMs,
+                m_RatePercent);
+    }
+
+    int failedPasses = 0;
+    for (StreamingPreferences::VideoDecoderSelection vds : m_Decoders) {
+        if (SDL_AtomicGet(&m_Stopping)) {
+            break;
+        }
+
+        if (!runPass(vds)) {
+            failedPasses++;
+        }
+    }
+
+    if (header->audioChannelCount != 0 && !SDL_AtomicGet(&m_Stopping) && !runAudioPass()) {
+        failedPasses++;
+    }
+
+    Session::s_ActiveSession = nullptr;
+    Session::s_ActiveSessionSemaphore.release();
+
+    SDL_DestroyWindow(m_Window);
+    m_Window = nullptr;
+    SDL_QuitSubSystem(SDL_INIT_VIDEO);
+
+    return failedPasses == 0 ? 0 : 1;
+}
+
+bool Runner::runPass(StreamingPreferences::VideoDecoderSelection vds)
+{
+    const CAPTURE_FILE_HEADER* header = m_Reader.getHeader();
+
+    fprintf(stdout, "\nDecoder: %s\n", getDecoderName(vds));
+
+    // V-sync would cap the throughput at the display's refresh rate
+    if (!Session::chooseDecoder(vds, m_Window, (int)header->videoFormat,
+                                (int)header->width, (int)header->height,
+                                (int)header->frameRate, m_Realtime, false,
+                                StreamingPreferences::PM_BALANCED, false, false,
+                                false, m_Decoder)) {
+        fprintf(stdout, "  Unable to initialize the decoder\n");
+        return false;
+    }
+
+    fprintf(stdout,
+            "  Hardware accelerated: %s\n",
+            m_Decoder->isHardwareAccelerated() ? "yes" : "no");
+
+    m_Reader.rewind();
+    m_SubmittedFrames = 0;
+    m_LostFrames = 0;
+    SDL_AtomicSet(&m_FeederDone, 0);
+
+    Uint64 startTimeUs = StreamUtils::getTimeUs();
+    Uint64 startCpuTimeUs = getProcessCpuTimeUs();
+    Uint64 endTimeUs = 0, endCpuTimeUs = 0;
+    Uint32 drainEndTime = 0;
+
+    SDL_Thread* feederThread = SDL_CreateThread(feederThreadProc, "Benchmark", this);
+    if (feederThread == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unable to create benchmark thread: %s",
+                     SDL_GetError());
+        delete m_Decoder;
+        m_Decoder = nullptr;
+        return false;
+    }
+
+    // Run the render loop like Session::exec() until the capture is done
+    for (;;) {
+        SDL_Event event;
+
+        if (SDL_WaitEventTimeout(&event, 10)) {
+            switch (event.type) {
+            case SDL_QUIT:
+                SDL_AtomicSet(&m_Stopping, 1);
+                break;
+
+            case SDL_USEREVENT:
+                SDL_assert(event.user.code == SDL_CODE_FRAME_READY);
+                m_Decoder->renderFrameOnMainThread();
+                break;
+            }
+        }
+
+        if (SDL_AtomicGet(&m_FeederDone)) {
+            if (drainEndTime == 0) {
+                endTimeUs = StreamUtils::getTimeUs();
+                endCpuTimeUs = getProcessCpuTimeUs();
+                drainEndTime = SDL_GetTicks() + BENCHMARK_DRAIN_MS;
+            }
+            else if (SDL_TICKS_PASSED(SDL_GetTicks(), drainEndTime)) {
+                break;
+            }
+        }
+    }
+
+    SDL_WaitThread(feederThread, nullptr);
+
+    VIDEO_STATS stats = {};
+    bool haveStats = m_Decoder->getGlobalVideoStats(stats);
+
+    delete m_Decoder;
+    m_Decoder = nullptr;
+
+    float elapsedSec = (float)(endTimeUs - startTimeUs) / 1000000;
+    fprintf(stdout,
+            "  Frames submitted: %d in %.2f seconds (%d lost)\n"
+            "  CPU usage: %.1f%% of one core\n",
+            m_SubmittedFrames,
+            elapsedSec,
+            m_LostFrames,
+            elapsedSec > 0 ? (float)(endCpuTimeUs - startCpuTimeUs) / 10000 / elapsedSec : 0);
+
+    if (haveStats && elapsedSec > 0) {
+        fprintf(stdout,
+                "  Decoded: %u frames (%.2f FPS)\n"
+                "  Rendered: %u frames (%.2f FPS)\n"
+                "  Dropped by the pacer: %u frames\n",
+                stats.decodedFrames,
+                stats.decodedFrames / elapsedSec,
+                stats.renderedFrames,
+                stats.renderedFrames / elapsedSec,
+                stats.pacerDroppedFrames);
+
+        // Only pipelined decoding (ASYNC_DECODE=1) hands frames off
+        // through the decode queue
+        if (stats.queuedDecodeUnits != 0) {
+            fprintf(stdout,
+                    "  Decode queue handoff: %.3f ms average (depth %.2f average, %u max)\n",
+                    (float)stats.totalDecodeQueueTime / 1000 / stats.queuedDecodeUnits,
+                    (float)stats.totalDecodeQueueDepth / stats.queuedDecodeUnits,
+                    stats.maxDecodeQueueDepth);
+        }
+
+        printHistogram("Decode", stats.decodeTimes);
+        printHistogram("Frame queue", stats.pacerTimes);
+        printHistogram("Render", stats.renderTimes);
+    }
+
+    fflush(stdout);
+    return m_SubmittedFrames != 0;
+}
+
+bool Runner::runAudioPass()
+{
+    const CAPTURE_FILE_HEADER* header = m_Reader.getHeader();
+    OPUS_MULTISTREAM_CONFIGURATION opusConfig = {};
+
+    fprintf(stdout, "\nAudio (%u channels)\n", header->audioChannelCount);
+
+    opusConfig.sampleRate = (int)header->audioSampleRate;
+    opusConfig.channelCount = (int)header->audioChannelCount;
+    opusConfig.streams = (int)header->audioStreams;
+    opusConfig.coupledStreams = (int)header->audioCoupledStreams;
+    opusConfig.samplesPerFrame = (int)header->audioSamplesPerFrame;
+    SDL_memcpy(opusConfig.mapping, header->audioMapping, sizeof(header->audioMapping));
+
+    BenchmarkAudioRenderer renderer;
+    AudioDecoder decoder;
+    if (!renderer.prepareForPlayback(&opusConfig) ||
+            !decoder.initialize(&opusConfig) ||
+            !decoder.prepareForRenderer(&renderer)) {
+        fprintf(stdout, "  Unable to initialize the audio decoder\n");
+        return false;
+    }
+
+    SDL_GetMemoryFunctions(&s_RealMalloc, &s_RealCalloc, &s_RealRealloc, &s_RealFree);
+
+    const CAPTURE_RECORD_HEADER* record;
+    const Uint8* payload;
+    int decodedPackets = 0;
+    int measuredPackets = 0;
+    Uint64 startTimeUs = 0;
+
+    m_Reader.rewind();
+    while (!SDL_AtomicGet(&m_Stopping) && m_Reader.readRecord(&record, &payload)) {
+        if (record->type != CAPTURE_RECORD_AUDIO) {
+            continue;
+        }
+
+        if (decodedPackets == BENCHMARK_AUDIO_WARMUP_PACKETS) {
+            SDL_AtomicSet(&s_AllocationCount, 0);
+            SDL_SetMemoryFunctions(countingMalloc, countingCalloc, countingRealloc, s_RealFree);
+            startTimeUs = StreamUtils::getTimeUs();
+        }
+
+        decoder.decodeAndSubmit(&renderer, payload, (int)record->length, false);
+        decodedPackets++;
+
+        if (decodedPackets > BENCHMARK_AUDIO_WARMUP_PACKETS) {
+            measuredPackets++;
+        }
+    }
+
+    Uint64 elapsedUs = StreamUtils::getTimeUs() - startTimeUs;
+    SDL_SetMemoryFunctions(s_RealMalloc, s_RealCalloc, s_RealRealloc, s_RealFree);
+
+    if (measuredPackets == 0) {
+        fprintf(stdout,
+                "  Only %d packets captured, at least %d are needed\n",
+                decodedPackets,
+                BENCHMARK_AUDIO_WARMUP_PACKETS + 1);
+        return false;
+    }
+
+    int allocations = SDL_AtomicGet(&s_AllocationCount);
+    fprintf(stdout,
+            "  Packets decoded: %d\n"
+            "  Decode and submit: %.1f us per packet\n"
+            "  Allocations: %.2f per packet\n",
+            measuredPackets,
+            (float)elapsedUs / measuredPackets,
+            (float)allocations / measuredPackets);
+
+    fflush(stdout);
+    return allocations == 0;
+}
+
+// xorshift32, which is plenty for choosing lost frames and delays
+static Uint32 nextRandom(Uint32* state)
+{
+    Uint32 x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+int Runner::feederThreadProc(void* context)
+{
+    Runner* me = (Runner*)context;
+    QVector<LENTRY> entries;
+    const CAPTURE_RECORD_HEADER* record;
+    const Uint8* payload;
+    Uint32 startTime = SDL_GetTicks();
+    Uint32 firstTimestampMs = 0;
+    bool haveFirstTimestamp = false;
+    Uint32 random = BENCHMARK_IMPAIRMENT_SEED;
+
+    while (!SDL_AtomicGet(&me->m_Stopping) && me->m_Reader.readRecord(&record, &payload)) {
+        DECODE_UNIT du;
+
+        if (record->type != CAPTURE_RECORD_VIDEO ||
+                !me->m_Reader.getDecodeUnit(record, payload, entries, &du)) {
+            continue;
+        }
+
+        if (!haveFirstTimestamp) {
+            firstTimestampMs = record->timestampMs;
+            haveFirstTimestamp = true;
+        }
+
+        // A lost frame never reaches the decoder. IDR frames are spared,
+        // since there's no host to send another one.
+        if (me->m_LossPercent != 0 && du.frameType != FRAME_TYPE_IDR &&
+                (int)(nextRandom(&random) % 100) < me->m_LossPercent) {
+            me->m_LostFrames++;
+            continue;
+        }
+
+        if (me->m_Realtime) {
+            // Submit each frame when it arrived during the capture, scaled
+            // to the requested rate and held back by up to the jitter.
+            // Frames stay in order, like they would behind the reassembly
+            // in moonlight-common-c.
+            Uint32 dueTime = startTime +
+                    (Uint32)((Uint64)(record->timestampMs - firstTimestampMs) * 100 / me->m_RatePercent);
+            if (me->m_JitterMs != 0) {
+                dueTime += nextRandom(&random) % (Uint32)(me->m_JitterMs + 1);
+            }
+            Uint32 now = SDL_GetTicks();
+            if (!SDL_TICKS_PASSED(now, dueTime)) {
+                SDL_Delay(dueTime - now);
+            }
+        }
+
+        // The capture's frames are already reassembled
+        du.receiveTimeMs = LiGetMillis();
+
+        // There's no host to send an IDR frame, so decoding just moves on
+        me->m_Decoder->submitDecodeUnit(&du);
+        me->m_SubmittedFrames++;
+    }
+
+    SDL_AtomicSet(&me->m_FeederDone, 1);
+    return 0;
+}
+
+}
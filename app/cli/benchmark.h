@@ -0,0 +1,76 @@
+#pragma once
+
+#include "settings/streamingpreferences.h"
+#include "streaming/capturefile.h"
+
+#include <QList>
+#include <QString>
+
+#include <SDL.h>
+
+class IVideoDecoder;
+
+namespace CliBenchmark
+{
+
+// Times parsing a saved serverinfo response with a separate scan of the
+// XML for each field against NvHTTP::parseServerInfo(). Returns the
+// process exit code.
+int runServerInfoBenchmark(QString serverInfoPath);
+
+// Times recovering lost video packets with moonlight-common-c's
+// Reed-Solomon decoder at several shard sizes. Returns the process
+// exit code.
+int runFecBenchmark();
+
+// Times the client's per-frame and per-event hot paths in isolation and
+// prints the results as JSON, so they can be tracked across builds.
+// Returns the process exit code.
+int runMicrobenchmarks();
+
+// Replays a stream capture through each requested decoder and prints
+// the throughput, frame time percentiles and CPU usage of every pass.
+// This runs without a host or the UI, so it can qualify client hardware
+// and catch performance regressions. The capture's audio is also decoded
+// to check that the audio path doesn't allocate once it's running.
+//
+// Network conditions can be emulated on top of the capture: lossPercent
+// of the frames are dropped before reaching the decoder, and in realtime
+// replays each frame is held back by up to jitterMs and the captured
+// timing is played at ratePercent of its speed. The same frames are
+// affected on every pass, so decoders can be compared under identical
+// conditions.
+class Runner
+{
+public:
+    Runner(QString capturePath, bool realtime,
+           QList<StreamingPreferences::VideoDecoderSelection> decoders,
+           int lossPercent, int jitterMs, int ratePercent);
+
+    // Returns the process exit code
+    int run();
+
+private:
+    bool runPass(StreamingPreferences::VideoDecoderSelection vds);
+
+    bool runAudioPass();
+
+    static int feederThreadProc(void* context);
+
+    QString m_CapturePath;
+    bool m_Realtime;
+    QList<StreamingPreferences::VideoDecoderSelection> m_Decoders;
+    int m_LossPercent;
+    int m_JitterMs;
+    int m_RatePercent;
+
+    CaptureReader m_Reader;
+    SDL_Window* m_Window;
+    IVideoDecoder* m_Decoder;
+    int m_SubmittedFrames;
+    int m_LostFrames;
+    SDL_atomic_t m_FeederDone;
+    SDL_atomic_t m_Stopping;
+};
+
+}
@@ -166,6 +166,9 @@ GlobalCommandLineParser::ParseResult GlobalCommandLineParser::parse(const QStrin
         "Available actions:\n"
         "  quit            Quit the currently running app\n"
         "  stream          Start streaming an app\n"
+        "  benchmark       Replay a capture through the video decoders\n"
+        "  history         Show the performance of past sessions\n"
+        "  daemon          Stay running and take requests on a local socket\n"
         "\n"
         "See 'moonlight <action> --help' for help of specific action."
     );
@@ -184,6 +187,12 @@ GlobalCommandLineParser::ParseResult GlobalCommandLineParser::parse(const QStrin
         return QuitRequested;
     } else if (action == "stream") {
         return StreamRequested;
+    } else if (action == "benchmark") {
+        return BenchmarkRequested;
+    } else if (action == "history") {
+        return HistoryRequested;
+    } else if (action == "daemon") {
+        return DaemonRequested;
     } else {
         parser.showError(QString("Invalid action: %1").arg(action));
     }
@@ -231,7 +240,14 @@ QString QuitCommandLineParser::getHost() const
     return m_Host;
 }
 
+// Scripted mouse motion events per second in headless streams
+#define DEFAULT_HEADLESS_INPUT_RATE 60
+
 StreamCommandLineParser::StreamCommandLineParser()
+    : m_Headless(false),
+      m_HeadlessVideoDiscarded(true),
+      m_DurationSecs(0),
+      m_InputRate(DEFAULT_HEADLESS_INPUT_RATE)
 {
     m_WindowModeMap = {
         {"fullscreen", StreamingPreferences::WM_FULLSCREEN},
@@ -251,6 +267,13 @@ StreamCommandLineParser::StreamCommandLineParser()
         {"auto",     StreamingPreferences::VDS_AUTO},
         {"software", StreamingPreferences::VDS_FORCE_HARDWARE},
         {"hardware", StreamingPreferences::VDS_FORCE_SOFTWARE},
+        {"d3d11va",  StreamingPreferences::VDS_FORCE_D3D11VA},
+    };
+    m_PacingModeMap = {
+        {"balanced",       StreamingPreferences::PM_BALANCED},
+        {"lowest-latency", StreamingPreferences::PM_LOWEST_LATENCY},
+        {"smoothest",      StreamingPreferences::PM_SMOOTHEST},
+        {"just-in-time",   StreamingPreferences::PM_JUST_IN_TIME},
     };
 }
 
@@ -288,8 +311,20 @@ void StreamCommandLineParser::parse(const QStringList &args, StreamingPreference
     parser.addToggleOption("game-optimization", "game optimizations");
     parser.addToggleOption("audio-on-host", "audio on host PC");
     parser.addToggleOption("frame-pacing", "frame pacing");
+    parser.addChoiceOption("pacing-mode", "frame pacing mode", m_PacingModeMap.keys());
+    parser.addToggleOption("vrr", "variable refresh rate mode");
+    parser.addToggleOption("sharpening", "sharpening of upscaled video");
+    parser.addToggleOption("error-concealment", "showing damaged frames while recovering from packet loss");
     parser.addChoiceOption("video-codec", "video codec", m_VideoCodecMap.keys());
     parser.addChoiceOption("video-decoder", "video decoder", m_VideoDecoderMap.keys());
+    parser.addValueOption("replay-buffer", "seconds of instant replay (0 for none)");
+    parser.addOption(QCommandLineOption("startup-profile", "Write the time taken by each startup stage to <file> as CSV.", "file"));
+    parser.addOption(QCommandLineOption("window-geometry", "Stream in a borderless window placed by <geometry>, given as <x>,<y>,<width>x<height>, like for tiling streams from several hosts.", "geometry"));
+    parser.addOption(QCommandLineOption("headless", "Stream without the UI, a window or an audio device, and print a JSON stats summary when the stream ends."));
+    parser.addChoiceOption("headless-video", "what a headless stream does with video", QStringList({"discard", "decode"}));
+    parser.addOption(QCommandLineOption("duration", "End a headless stream after <seconds>.", "seconds"));
+    parser.addOption(QCommandLineOption("input-rate", "Send <events> scripted mouse motion events per second in a headless stream (default 60, 0 for none).", "events"));
+    parser.addOption(QCommandLineOption("stats-file", "Write the headless stats summary to <file> instead of stdout.", "file"));
 
     if (!parser.parse(args)) {
         parser.showError(parser.errorText());
@@ -297,6 +332,46 @@ void StreamCommandLineParser::parse(const QStringList &args, StreamingPreference
 
     parser.handleUnknownOptions();
 
+    m_StartupProfilePath = parser.value("startup-profile");
+
+    // Resolve --window-geometry option
+    if (parser.isSet("window-geometry")) {
+        QRegularExpression re("^(-?\\d+),(-?\\d+),(\\d+)x(\\d+)$", QRegularExpression::CaseInsensitiveOption);
+        auto match = re.match(parser.value("window-geometry"));
+        if (!match.hasMatch() || match.captured(3).toInt() == 0 || match.captured(4).toInt() == 0) {
+            parser.showError(QString("Invalid window-geometry format: %1").arg(parser.value("window-geometry")));
+        }
+        m_WindowGeometry = QRect(match.captured(1).toInt(), match.captured(2).toInt(),
+                                 match.captured(3).toInt(), match.captured(4).toInt());
+    }
+
+    // Resolve the headless options, which mean nothing with the UI up
+    m_Headless = parser.isSet("headless");
+    if (!m_Headless) {
+        QStringList headlessOnly = {"headless-video", "duration", "input-rate", "stats-file"};
+        for (const QString& name : headlessOnly) {
+            if (parser.isSet(name)) {
+                parser.showError(QString("--%1 requires --headless").arg(name));
+            }
+        }
+    }
+    if (parser.isSet("headless-video")) {
+        m_HeadlessVideoDiscarded = parser.getChoiceOptionValue("headless-video").compare("decode", Qt::CaseInsensitive) != 0;
+    }
+    if (parser.isSet("duration")) {
+        m_DurationSecs = parser.getIntOption("duration");
+        if (m_DurationSecs < 0) {
+            parser.showError("Duration must not be negative");
+        }
+    }
+    if (parser.isSet("input-rate")) {
+        m_InputRate = parser.getIntOption("input-rate");
+        if (!inRange(m_InputRate, 0, 1000)) {
+            parser.showError("Input rate must be in range: 0 - 1000");
+        }
+    }
+    m_StatsPath = parser.value("stats-file");
+
     // Resolve display's width and height
     QRegularExpression resolutionRexExp("^(720|1080|1440|4K|resolution)$");
     QStringList resoOptions = parser.optionNames().filter(resolutionRexExp);
@@ -376,6 +451,20 @@ void StreamCommandLineParser::parse(const QStringList &args, StreamingPreference
     // Resolve --frame-pacing and --no-frame-pacing options
     preferences->framePacing = parser.getToggleOptionValue("frame-pacing", preferences->framePacing);
 
+    // Resolve --pacing-mode option
+    if (parser.isSet("pacing-mode")) {
+        preferences->pacingMode = mapValue(m_PacingModeMap, parser.getChoiceOptionValue("pacing-mode"));
+    }
+
+    // Resolve --vrr and --no-vrr options
+    preferences->variableRefreshRate = parser.getToggleOptionValue("vrr", preferences->variableRefreshRate);
+
+    // Resolve --sharpening and --no-sharpening options
+    preferences->videoSharpening = parser.getToggleOptionValue("sharpening", preferences->videoSharpening);
+
+    // Resolve --error-concealment and --no-error-concealment options
+    preferences->errorConcealment = parser.getToggleOptionValue("error-concealment", preferences->errorConcealment);
+
     // Resolve --video-codec option
     if (parser.isSet("video-codec")) {
         preferences->videoCodecConfig = mapValue(m_VideoCodecMap, parser.getChoiceOptionValue("video-codec"));
@@ -386,6 +475,26 @@ void StreamCommandLineParser::parse(const QStringList &args, StreamingPreference
         preferences->videoDecoderSelection = mapValue(m_VideoDecoderMap, parser.getChoiceOptionValue("video-decoder"));
     }
 
+    // Resolve --replay-buffer option
+    if (parser.isSet("replay-buffer")) {
+        preferences->replayBufferSecs = parser.getIntOption("replay-buffer");
+        if (!inRange(preferences->replayBufferSecs, 0, 600)) {
+            parser.showError("Replay buffer must be in range: 0 - 600");
+        }
+    }
+
+    // A tiled window is never full screen
+    if (m_WindowGeometry.isValid()) {
+        preferences->windowMode = StreamingPreferences::WM_WINDOWED;
+    }
+
+    // A headless stream has no display to go full screen on or sync to
+    if (m_Headless) {
+        preferences->windowMode = StreamingPreferences::WM_WINDOWED;
+        preferences->enableVsync = false;
+        preferences->framePacing = false;
+    }
+
     // This method will not return and terminates the process if --version or
     // --help is specified
     parser.handleHelpAndVersionOptions();
@@ -412,3 +521,284 @@ QString StreamCommandLineParser::getAppName() const
 {
     return m_AppName;
 }
+
+QString StreamCommandLineParser::getStartupProfilePath() const
+{
+    return m_StartupProfilePath;
+}
+
+QRect StreamCommandLineParser::getWindowGeometry() const
+{
+    return m_WindowGeometry;
+}
+
+bool StreamCommandLineParser::isHeadless() const
+{
+    return m_Headless;
+}
+
+bool StreamCommandLineParser::isHeadlessVideoDiscarded() const
+{
+    return m_HeadlessVideoDiscarded;
+}
+
+int StreamCommandLineParser::getDurationSecs() const
+{
+    return m_DurationSecs;
+}
+
+int StreamCommandLineParser::getInputRate() const
+{
+    return m_InputRate;
+}
+
+QString StreamCommandLineParser::getStatsPath() const
+{
+    return m_StatsPath;
+}
+
+BenchmarkCommandLineParser::BenchmarkCommandLineParser()
+    : m_Fec(false),
+      m_Micro(false),
+      m_Realtime(false),
+      m_LossPercent(0),
+      m_JitterMs(0),
+      m_RatePercent(100)
+{
+    m_VideoDecoderMap = {
+        {"auto",     StreamingPreferences::VDS_AUTO},
+        {"hardware", StreamingPreferences::VDS_FORCE_HARDWARE},
+        {"software", StreamingPreferences::VDS_FORCE_SOFTWARE},
+        {"d3d11va",  StreamingPreferences::VDS_FORCE_D3D11VA},
+    };
+}
+
+BenchmarkCommandLineParser::~BenchmarkCommandLineParser()
+{
+}
+
+void BenchmarkCommandLineParser::parse(const QStringList &args)
+{
+    CommandLineParser parser;
+    parser.setupCommonOptions();
+    parser.setApplicationDescription(
+        "\n"
+        "Replays a stream capture through the video decoders and reports their performance.\n"
+        "Hardware and software decoding are both measured unless a decoder is selected."
+    );
+    parser.addPositionalArgument("benchmark", "Run benchmark");
+    parser.addPositionalArgument("capture", "Stream capture to replay", "<capture>");
+
+    parser.addFlagOption("realtime", "the captured frame timing instead of decoding as fast as possible");
+    parser.addChoiceOption("video-decoder", "video decoder", m_VideoDecoderMap.keys());
+    parser.addOption(QCommandLineOption("loss", "Drop <percent> of the frames before they reach the decoder.", "percent"));
+    parser.addOption(QCommandLineOption("jitter", "Hold each frame back by up to <ms> (implies --realtime).", "ms"));
+    parser.addOption(QCommandLineOption("rate", "Replay at <percent> of the captured frame rate (implies --realtime).", "percent"));
+    parser.addOption(QCommandLineOption("serverinfo", "Time the serverinfo XML parsing on <file> instead of replaying a capture.", "file"));
+    parser.addOption(QCommandLineOption("fec", "Time FEC recovery of lost video packets instead of replaying a capture."));
+    parser.addOption(QCommandLineOption("micro", "Time the client's hot paths in isolation and print the results as JSON instead of replaying a capture."));
+
+    if (!parser.parse(args)) {
+        parser.showError(parser.errorText());
+    }
+
+    parser.handleUnknownOptions();
+
+    // This method will not return and terminates the process if --version or
+    // --help is specified
+    parser.handleHelpAndVersionOptions();
+
+    m_Realtime = parser.isSet("realtime");
+
+    if (parser.isSet("loss")) {
+        m_LossPercent = parser.getIntOption("loss");
+        if (m_LossPercent < 0 || m_LossPercent > 100) {
+            parser.showError("Loss must be between 0 and 100 percent");
+        }
+    }
+    if (parser.isSet("jitter")) {
+        m_JitterMs = parser.getIntOption("jitter");
+        if (m_JitterMs < 0) {
+            parser.showError("Jitter can't be negative");
+        }
+        m_Realtime = true;
+    }
+    if (parser.isSet("rate")) {
+        m_RatePercent = parser.getIntOption("rate");
+        if (m_RatePercent <= 0) {
+            parser.showError("Rate must be positive");
+        }
+        m_Realtime = true;
+    }
+
+    // Resolve --video-decoder option
+    if (parser.isSet("video-decoder")) {
+        m_Decoders.append(mapValue(m_VideoDecoderMap, parser.getChoiceOptionValue("video-decoder")));
+    }
+    else {
+        m_Decoders.append(StreamingPreferences::VDS_FORCE_HARDWARE);
+        m_Decoders.append(StreamingPreferences::VDS_FORCE_SOFTWARE);
+    }
+
+    m_Fec = parser.isSet("fec");
+    m_Micro = parser.isSet("micro");
+    m_ServerInfoPath = parser.value("serverinfo");
+    if (m_Fec || m_Micro || !m_ServerInfoPath.isEmpty()) {
+        return;
+    }
+
+    // Verify that the capture has been provided
+    auto posArgs = parser.positionalArguments();
+    if (posArgs.length() < 2) {
+        parser.showError("Capture not provided");
+    }
+    m_CapturePath = parser.positionalArguments().at(1);
+}
+
+QString BenchmarkCommandLineParser::getCapturePath() const
+{
+    return m_CapturePath;
+}
+
+QString BenchmarkCommandLineParser::getServerInfoPath() const
+{
+    return m_ServerInfoPath;
+}
+
+bool BenchmarkCommandLineParser::isFec() const
+{
+    return m_Fec;
+}
+
+bool BenchmarkCommandLineParser::isMicro() const
+{
+    return m_Micro;
+}
+
+bool BenchmarkCommandLineParser::isRealtime() const
+{
+    return m_Realtime;
+}
+
+int BenchmarkCommandLineParser::getLossPercent() const
+{
+    return m_LossPercent;
+}
+
+int BenchmarkCommandLineParser::getJitterMs() const
+{
+    return m_JitterMs;
+}
+
+int BenchmarkCommandLineParser::getRatePercent() const
+{
+    return m_RatePercent;
+}
+
+QList<StreamingPreferences::VideoDecoderSelection> BenchmarkCommandLineParser::getDecoders() const
+{
+    return m_Decoders;
+}
+
+// Sessions shown by the history action unless --limit is given
+#define DEFAULT_HISTORY_LIMIT 20
+
+HistoryCommandLineParser::HistoryCommandLineParser()
+    : m_Limit(DEFAULT_HISTORY_LIMIT)
+{
+}
+
+HistoryCommandLineParser::~HistoryCommandLineParser()
+{
+}
+
+void HistoryCommandLineParser::parse(const QStringList &args)
+{
+    CommandLineParser parser;
+    parser.setupCommonOptions();
+    parser.setApplicationDescription(
+        "\n"
+        "Shows a summary of the most recent sessions, oldest first."
+    );
+    parser.addPositionalArgument("history", "Show session history");
+
+    parser.addOption(QCommandLineOption("host", "Only show sessions streamed from <host>.", "host"));
+    parser.addOption(QCommandLineOption("limit", "Show the last <count> sessions, or all of them if 0.", "count"));
+
+    if (!parser.parse(args)) {
+        parser.showError(parser.errorText());
+    }
+
+    parser.handleUnknownOptions();
+
+    // This method will not return and terminates the process if --version or
+    // --help is specified
+    parser.handleHelpAndVersionOptions();
+
+    m_Host = parser.value("host");
+    if (parser.isSet("limit")) {
+        m_Limit = parser.getIntOption("limit");
+        if (m_Limit < 0) {
+            parser.showError("Limit can't be negative");
+        }
+    }
+}
+
+QString HistoryCommandLineParser::getHost() const
+{
+    return m_Host;
+}
+
+int HistoryCommandLineParser::getLimit() const
+{
+    return m_Limit;
+}
+
+// The local socket name the daemon listens on unless --socket is given
+#define DEFAULT_DAEMON_SOCKET "MoonlightControl"
+
+DaemonCommandLineParser::DaemonCommandLineParser()
+    : m_SocketName(DEFAULT_DAEMON_SOCKET)
+{
+}
+
+DaemonCommandLineParser::~DaemonCommandLineParser()
+{
+}
+
+void DaemonCommandLineParser::parse(const QStringList &args)
+{
+    CommandLineParser parser;
+    parser.setupCommonOptions();
+    parser.setApplicationDescription(
+        "\n"
+        "Keeps running in the background and takes requests to list hosts,\n"
+        "launch and quit apps, and report stream stats on a local socket.\n"
+        "Each request is one line of JSON, like {\"command\": \"list\"}."
+    );
+    parser.addPositionalArgument("daemon", "Run in the background");
+
+    parser.addOption(QCommandLineOption("socket", "Listen on the local socket named <name>.", "name"));
+
+    if (!parser.parse(args)) {
+        parser.showError(parser.errorText());
+    }
+
+    parser.handleUnknownOptions();
+
+    // This method will not return and terminates the process if --version or
+    // --help is specified
+    parser.handleHelpAndVersionOptions();
+
+    if (parser.isSet("socket")) {
+        m_SocketName = parser.value("socket");
+        if (m_SocketName.isEmpty()) {
+            parser.showError("Socket name can't be empty");
+        }
+    }
+}
+
+QString DaemonCommandLineParser::getSocketName() const
+{
+    return m_SocketName;
+}
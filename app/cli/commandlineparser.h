@@ -3,6 +3,7 @@
 #include "settings/streamingpreferences.h"
 
 #include <QMap>
+#include <QRect>
 #include <QString>
 
 class GlobalCommandLineParser
@@ -12,6 +13,9 @@ public:
         NormalStartRequested,
         StreamRequested,
         QuitRequested,
+        BenchmarkRequested,
+        HistoryRequested,
+        DaemonRequested,
     };
 
     GlobalCommandLineParser();
@@ -45,12 +49,88 @@ public:
 
     QString getHost() const;
     QString getAppName() const;
+    QString getStartupProfilePath() const;
+    QRect getWindowGeometry() const;
+    bool isHeadless() const;
+    bool isHeadlessVideoDiscarded() const;
+    int getDurationSecs() const;
+    int getInputRate() const;
+    QString getStatsPath() const;
 
 private:
     QString m_Host;
     QString m_AppName;
+    QString m_StartupProfilePath;
+    QRect m_WindowGeometry;
+    bool m_Headless;
+    bool m_HeadlessVideoDiscarded;
+    int m_DurationSecs;
+    int m_InputRate;
+    QString m_StatsPath;
     QMap<QString, StreamingPreferences::WindowMode> m_WindowModeMap;
     QMap<QString, StreamingPreferences::AudioConfig> m_AudioConfigMap;
     QMap<QString, StreamingPreferences::VideoCodecConfig> m_VideoCodecMap;
     QMap<QString, StreamingPreferences::VideoDecoderSelection> m_VideoDecoderMap;
+    QMap<QString, StreamingPreferences::PacingMode> m_PacingModeMap;
+};
+
+class BenchmarkCommandLineParser
+{
+public:
+    BenchmarkCommandLineParser();
+    virtual ~BenchmarkCommandLineParser();
+
+    void parse(const QStringList &args);
+
+    QString getCapturePath() const;
+    QString getServerInfoPath() const;
+    bool isFec() const;
+    bool isMicro() const;
+    bool isRealtime() const;
+    int getLossPercent() const;
+    int getJitterMs() const;
+    int getRatePercent() const;
+    QList<StreamingPreferences::VideoDecoderSelection> getDecoders() const;
+
+private:
+    QString m_CapturePath;
+    QString m_ServerInfoPath;
+    bool m_Fec;
+    bool m_Micro;
+    bool m_Realtime;
+    int m_LossPercent;
+    int m_JitterMs;
+    int m_RatePercent;
+    QList<StreamingPreferences::VideoDecoderSelection> m_Decoders;
+    QMap<QString, StreamingPreferences::VideoDecoderSelection> m_VideoDecoderMap;
+};
+
+class HistoryCommandLineParser
+{
+public:
+    HistoryCommandLineParser();
+    virtual ~HistoryCommandLineParser();
+
+    void parse(const QStringList &args);
+
+    QString getHost() const;
+    int getLimit() const;
+
+private:
+    QString m_Host;
+    int m_Limit;
+};
+
+class DaemonCommandLineParser
+{
+public:
+    DaemonCommandLineParser();
+    virtual ~DaemonCommandLineParser();
+
+    void parse(const QStringList &args);
+
+    QString getSocketName() const;
+
+private:
+    QString m_SocketName;
 };
@@ -0,0 +1,457 @@
+#include "daemon.h"
+#include "headlessstream.h"
+#include "startstream.h"
+#include "backend/computermanager.h"
+#include "backend/computerseeker.h"
+#include "settings/streamingpreferences.h"
+#include "streaming/session.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonParseError>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QTimer>
+
+#define COMPUTER_SEEK_TIMEOUT 10000
+
+// How long something listening on our socket has to answer before
+// we decide the socket was left behind by a daemon that died
+#define SOCKET_PROBE_TIMEOUT_MS 500
+
+// No request comes anywhere near this, so a client sending more without
+// a line break is disconnected rather than buffered forever
+#define MAX_REQUEST_SIZE (64 * 1024)
+
+namespace CliDaemon
+{
+
+Server::Server(QString socketName, QObject* parent)
+    : QObject(parent),
+      m_SocketName(socketName),
+      m_Server(nullptr),
+      m_ComputerManager(nullptr),
+      m_QuitPending(false),
+      m_Launcher(nullptr),
+      m_Session(nullptr),
+      m_LaunchPending(false),
+      m_QuitRunningApp(false)
+{
+}
+
+Server::~Server()
+{
+}
+
+bool Server::start(ComputerManager* manager)
+{
+    m_ComputerManager = manager;
+    connect(m_ComputerManager, &ComputerManager::quitAppCompleted,
+            this, &Server::onQuitAppCompleted);
+
+    m_Server = new QLocalServer(this);
+    m_Server->setSocketOptions(QLocalServer::UserAccessOption);
+    connect(m_Server, &QLocalServer::newConnection,
+            this, &Server::onNewConnection);
+
+    if (!m_Server->listen(m_SocketName)) {
+        // A daemon that crashed leaves its socket behind on Unix, which
+        // is only still in use if something answers on it
+        QLocalSocket probe;
+        probe.connectToServer(m_SocketName);
+        if (m_Server->serverError() != QAbstractSocket::AddressInUseError ||
+                probe.waitForConnected(SOCKET_PROBE_TIMEOUT_MS)) {
+            qWarning() << "Unable to listen on" << m_SocketName << ":" << m_Server->errorString();
+            return false;
+        }
+
+        QLocalServer::removeServer(m_SocketName);
+        if (!m_Server->listen(m_SocketName)) {
+            qWarning() << "Unable to listen on" << m_SocketName << ":" << m_Server->errorString();
+            return false;
+        }
+    }
+
+    // Keep every host's state current, so requests for a host that's
+    // online don't have to wait for it to be found
+    m_ComputerManager->startPolling();
+
+    qInfo() << "Taking requests on" << m_Server->fullServerName();
+    return true;
+}
+
+void Server::onNewConnection()
+{
+    while (m_Server->hasPendingConnections()) {
+        QLocalSocket* socket = m_Server->nextPendingConnection();
+        connect(socket, &QLocalSocket::readyRead,
+                this, &Server::onReadyRead);
+        connect(socket, &QLocalSocket::disconnected,
+                socket, &QObject::deleteLater);
+    }
+}
+
+void Server::onReadyRead()
+{
+    QLocalSocket* socket = qobject_cast<QLocalSocket*>(sender());
+    if (socket == nullptr) {
+        return;
+    }
+
+    while (socket->canReadLine()) {
+        QByteArray line = socket->readLine().trimmed();
+        if (line.isEmpty()) {
+            continue;
+        }
+
+        ReplyTarget target;
+        target.socket = socket;
+
+        QJsonParseError error;
+        QJsonDocument document = QJsonDocument::fromJson(line, &error);
+        if (!document.isObject()) {
+            replyError(target, "Requests must be a JSON object");
+            continue;
+        }
+
+        QJsonObject request = document.object();
+        target.id = request.value("id");
+        handleRequest(target, request);
+    }
+
+    if (socket->bytesAvailable() > MAX_REQUEST_SIZE) {
+        qWarning() << "Disconnecting client that sent an oversized request";
+        socket->abort();
+    }
+}
+
+void Server::handleRequest(const ReplyTarget& target, const QJsonObject& request)
+{
+    QString command = request.value("command").toString().toLower();
+
+    if (command == "list") {
+        listHosts(target);
+    }
+    else if (command == "prepare") {
+        prepareLaunch(target, request.value("host").toString());
+    }
+    else if (command == "launch") {
+        launch(target,
+               request.value("host").toString(),
+               request.value("app").toString(),
+               request.value("quitRunningApp").toBool());
+    }
+    else if (command == "quit") {
+        quitApp(target, request.value("host").toString());
+    }
+    else if (command == "stats") {
+        getStats(target);
+    }
+    else if (command == "shutdown") {
+        if (m_Launcher != nullptr) {
+            replyError(target, "A stream is running");
+            return;
+        }
+
+        reply(target, QJsonObject());
+        target.socket->flush();
+        QCoreApplication::quit();
+    }
+    else {
+        replyError(target, QString("Unknown command: %1").arg(command));
+    }
+}
+
+void Server::listHosts(const ReplyTarget& target)
+{
+    QJsonArray hosts;
+    for (NvComputer* computer : m_ComputerManager->getComputers()) {
+        QSharedPointer<const NvComputerSnapshot> snapshot = computer->getSnapshot();
+
+        QJsonObject host;
+        host["name"] = snapshot->name;
+        host["uuid"] = snapshot->uuid;
+        switch (snapshot->state) {
+        case NvComputer::CS_ONLINE:
+            host["state"] = "online";
+            break;
+        case NvComputer::CS_OFFLINE:
+            host["state"] = "offline";
+            break;
+        default:
+            host["state"] = "unknown";
+            break;
+        }
+        host["paired"] = snapshot->pairState == NvComputer::PS_PAIRED;
+
+        QJsonArray apps;
+        for (const NvApp& app : snapshot->appList) {
+            apps.append(app.name);
+            if (app.id == snapshot->currentGameId) {
+                host["runningApp"] = app.name;
+            }
+        }
+        host["apps"] = apps;
+
+        hosts.append(host);
+    }
+
+    QJsonObject response;
+    response["hosts"] = hosts;
+    reply(target, response);
+}
+
+void Server::prepareLaunch(const ReplyTarget& target, QString host)
+{
+    seekComputer(target, host, [target](NvComputer* computer) {
+        // This does nothing while a stream is running, which already
+        // has everything open
+        Session::prepareLaunch(computer);
+        reply(target, QJsonObject());
+    });
+}
+
+void Server::launch(const ReplyTarget& target, QString host, QString appName, bool quitRunningApp)
+{
+    if (m_Launcher != nullptr) {
+        replyError(target, "A stream is already running");
+        return;
+    }
+    if (host.isEmpty() || appName.isEmpty()) {
+        replyError(target, "A host and app are required");
+        return;
+    }
+
+    // Read the preferences again for each stream, in case they've been
+    // changed in the UI since the last one
+    StreamingPreferences* preferences = new StreamingPreferences(this);
+    m_Launcher = new CliStartStream::Launcher(host, appName, preferences, this);
+    preferences->setParent(m_Launcher);
+
+    connect(m_Launcher, &CliStartStream::Launcher::sessionCreated,
+            this, &Server::onSessionCreated);
+    connect(m_Launcher, &CliStartStream::Launcher::failed,
+            this, &Server::onLaunchFailed);
+    connect(m_Launcher, &CliStartStream::Launcher::appQuitRequired,
+            this, &Server::onAppQuitRequired);
+
+    m_LaunchTarget = target;
+    m_LaunchPending = true;
+    m_QuitRunningApp = quitRunningApp;
+    m_StreamHost = host;
+    m_StreamApp = appName;
+    m_LaunchError.clear();
+    m_StreamTimer.invalidate();
+
+    m_Launcher->execute(m_ComputerManager);
+}
+
+void Server::quitApp(const ReplyTarget& target, QString host)
+{
+    seekComputer(target, host, [this, target](NvComputer* computer) {
+        if (computer->currentGameId == 0) {
+            reply(target, QJsonObject());
+            return;
+        }
+        if (m_QuitPending) {
+            replyError(target, "Another quit is in progress");
+            return;
+        }
+
+        m_QuitTarget = target;
+        m_QuitPending = true;
+        m_ComputerManager->quitRunningApp(computer);
+    });
+}
+
+void Server::onQuitAppCompleted(QVariant error)
+{
+    // These also come from the launcher quitting an app to stream
+    if (!m_QuitPending) {
+        return;
+    }
+
+    m_QuitPending = false;
+
+    QString errorMessage = error.toString();
+    if (errorMessage.isEmpty()) {
+        reply(m_QuitTarget, QJsonObject());
+    }
+    else {
+        replyError(m_QuitTarget, QString("Quitting app failed, reason: %1").arg(errorMessage));
+    }
+}
+
+void Server::getStats(const ReplyTarget& target)
+{
+    QJsonObject response;
+    bool streaming = m_Session != nullptr && m_StreamTimer.isValid();
+    response["streaming"] = streaming;
+
+    if (streaming) {
+        response["host"] = m_StreamHost;
+        response["app"] = m_StreamApp;
+        CliHeadlessStream::addSessionStats(response, m_Session, (double)m_StreamTimer.elapsed() / 1000);
+    }
+    else if (!m_LastStreamStats.isEmpty()) {
+        response["lastStream"] = m_LastStreamStats;
+    }
+
+    reply(target, response);
+}
+
+void Server::seekComputer(const ReplyTarget& target, QString host,
+                          std::function<void(NvComputer*)> onFound)
+{
+    if (host.isEmpty()) {
+        replyError(target, "A host is required");
+        return;
+    }
+
+    ComputerSeeker* seeker = new ComputerSeeker(m_ComputerManager, host, this);
+    connect(seeker, &ComputerSeeker::computerFound,
+            this, [seeker, target, onFound](NvComputer* computer) {
+        seeker->deleteLater();
+
+        if (computer->pairState != NvComputer::PS_PAIRED) {
+            replyError(target, QString("Computer %1 has not been paired").arg(computer->name));
+            return;
+        }
+
+        onFound(computer);
+    });
+    connect(seeker, &ComputerSeeker::errorTimeout,
+            this, [seeker, target, host]() {
+        seeker->deleteLater();
+        replyError(target, QString("Failed to connect to %1").arg(host));
+    });
+    seeker->start(COMPUTER_SEEK_TIMEOUT);
+}
+
+void Server::onSessionCreated(QString, Session* session)
+{
+    m_Session = session;
+
+    connect(session, &Session::stageFailed,
+            this, &Server::onStageFailed);
+    connect(session, &Session::displayLaunchError,
+            this, &Server::onLaunchError);
+    connect(session, &Session::connectionStarted,
+            this, &Server::onConnectionStarted);
+    connect(session, &Session::sessionFinished,
+            this, &Server::onSessionFinished);
+
+    // Keep other hosts' polls off the network while we stream
+    m_ComputerManager->setStreamingComputer(session->getComputerUuid());
+
+    // Session::exec() runs until the stream is over, so it's started
+    // from the event loop like the UI does rather than from this signal
+    QTimer::singleShot(0, session, [session]() {
+        session->exec(0, 0);
+    });
+}
+
+void Server::onLaunchFailed(QString text)
+{
+    finishLaunch(text);
+
+    m_Launcher->deleteLater();
+    m_Launcher = nullptr;
+}
+
+void Server::onAppQuitRequired(QString appName)
+{
+    if (m_QuitRunningApp) {
+        m_Launcher->quitRunningApp();
+    }
+    else {
+        onLaunchFailed(QString("%1 is already running on the host").arg(appName));
+    }
+}
+
+void Server::onStageFailed(QString stage, long errorCode)
+{
+    m_LaunchError = QString("Starting %1 failed: Error %2").arg(stage).arg(errorCode);
+}
+
+void Server::onLaunchError(QString text)
+{
+    m_LaunchError = text;
+}
+
+void Server::onConnectionStarted()
+{
+    m_StreamTimer.start();
+    finishLaunch(QString());
+}
+
+void Server::onSessionFinished()
+{
+    if (m_LaunchPending) {
+        finishLaunch(m_LaunchError.isEmpty() ? "The stream ended before it started" : m_LaunchError);
+    }
+
+    m_LastStreamStats = QJsonObject();
+    m_LastStreamStats["host"] = m_StreamHost;
+    m_LastStreamStats["app"] = m_StreamApp;
+    if (!m_LaunchError.isEmpty()) {
+        m_LastStreamStats["error"] = m_LaunchError;
+    }
+    if (m_StreamTimer.isValid()) {
+        CliHeadlessStream::addSessionStats(m_LastStreamStats, m_Session,
+                                           (double)m_StreamTimer.elapsed() / 1000);
+        m_StreamTimer.invalidate();
+    }
+
+    m_ComputerManager->setStreamingComputer("");
+
+    // Deleting the session waits for its cleanup to finish, which still
+    // reads the preferences owned by the launcher
+    m_Session->deleteLater();
+    m_Session = nullptr;
+    m_Launcher->deleteLater();
+    m_Launcher = nullptr;
+}
+
+void Server::finishLaunch(QString error)
+{
+    if (!m_LaunchPending) {
+        return;
+    }
+
+    m_LaunchPending = false;
+    if (error.isEmpty()) {
+        reply(m_LaunchTarget, QJsonObject());
+    }
+    else {
+        replyError(m_LaunchTarget, error);
+    }
+}
+
+void Server::reply(const ReplyTarget& target, QJsonObject response)
+{
+    if (target.socket.isNull()) {
+        return;
+    }
+
+    if (!response.contains("result")) {
+        response["result"] = "ok";
+    }
+    if (!target.id.isUndefined()) {
+        response["id"] = target.id;
+    }
+
+    target.socket->write(QJsonDocument(response).toJson(QJsonDocument::Compact) + '\n');
+}
+
+void Server::replyError(const ReplyTarget& target, QString error)
+{
+    QJsonObject response;
+    response["result"] = "failed";
+    response["error"] = error;
+    reply(target, response);
+}
+
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <QElapsedTimer>
+#include <QJsonObject>
+#include <QJsonValue>
+#include <QObject>
+#include <QPointer>
+#include <QVariant>
+
+#include <functional>
+
+class ComputerManager;
+class NvComputer;
+class QLocalServer;
+class QLocalSocket;
+class Session;
+
+namespace CliStartStream
+{
+class Launcher;
+}
+
+namespace CliDaemon
+{
+
+// Keeps running in the background for automation, so each request doesn't
+// pay for starting Moonlight and finding the host again. Hosts stay polled,
+// and the TLS session and decoder state of the last launch stay warm like
+// they do in the UI.
+//
+// Requests come in on a local socket as one JSON object per line with a
+// "command" of list, prepare, launch, quit, stats or shutdown. Each gets
+// a one line reply with a "result" of "ok" or "failed", and an "error"
+// if it failed. An "id" in the request is copied into its reply, since
+// a launch is only answered once the stream is up. Streams are shown in
+// a window like those started with the stream action, one at a time.
+class Server : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit Server(QString socketName, QObject* parent = nullptr);
+
+    virtual ~Server();
+
+    // Returns false if we can't listen on the socket
+    bool start(ComputerManager* manager);
+
+private slots:
+    void onNewConnection();
+    void onReadyRead();
+    void onQuitAppCompleted(QVariant error);
+    void onSessionCreated(QString appName, Session* session);
+    void onLaunchFailed(QString text);
+    void onAppQuitRequired(QString appName);
+    void onStageFailed(QString stage, long errorCode);
+    void onLaunchError(QString text);
+    void onConnectionStarted();
+    void onSessionFinished();
+
+private:
+    // Where the reply to a request goes. The client may be gone by the
+    // time it's ready.
+    struct ReplyTarget {
+        QPointer<QLocalSocket> socket;
+        QJsonValue id;
+    };
+
+    void handleRequest(const ReplyTarget& target, const QJsonObject& request);
+
+    void listHosts(const ReplyTarget& target);
+
+    void prepareLaunch(const ReplyTarget& target, QString host);
+
+    void launch(const ReplyTarget& target, QString host, QString appName, bool quitRunningApp);
+
+    void quitApp(const ReplyTarget& target, QString host);
+
+    void getStats(const ReplyTarget& target);
+
+    // Finds a paired host by name, UUID or address, which is immediate
+    // for hosts our polling has already found online
+    void seekComputer(const ReplyTarget& target, QString host,
+                      std::function<void(NvComputer*)> onFound);
+
+    void finishLaunch(QString error);
+
+    static void reply(const ReplyTarget& target, QJsonObject response);
+
+    static void replyError(const ReplyTarget& target, QString error);
+
+    QString m_SocketName;
+    QLocalServer* m_Server;
+    ComputerManager* m_ComputerManager;
+
+    // Host app quits are only reported as done, not for which host
+    ReplyTarget m_QuitTarget;
+    bool m_QuitPending;
+
+    CliStartStream::Launcher* m_Launcher;
+    Session* m_Session;
+    ReplyTarget m_LaunchTarget;
+    bool m_LaunchPending;
+    bool m_QuitRunningApp;
+    QString m_StreamHost;
+    QString m_StreamApp;
+    QString m_LaunchError;
+    QElapsedTimer m_StreamTimer;
+
+    // What the stats request reports once the stream is over
+    QJsonObject m_LastStreamStats;
+};
+
+}
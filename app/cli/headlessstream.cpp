@@ -0,0 +1,232 @@
+#include "headlessstream.h"
+#include "startstream.h"
+#include "streaming/session.h"
+#include "streaming/scriptedinput.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTimer>
+
+namespace CliHeadlessStream
+{
+
+static QJsonObject histogramToJson(const FrameTimeHistogram& histogram)
+{
+    QJsonObject json;
+    json["p50"] = (double)histogram.getPercentileUs(50) / 1000;
+    json["p95"] = (double)histogram.getPercentileUs(95) / 1000;
+    json["p99"] = (double)histogram.getPercentileUs(99) / 1000;
+    json["max"] = (double)histogram.maxUs / 1000;
+    return json;
+}
+
+void addSessionStats(QJsonObject& json, Session* session, double streamSecs)
+{
+    json["streamSecs"] = streamSecs;
+    json["packetSize"] = session->getPacketSize();
+
+    VIDEO_STATS videoStats;
+    if (session->getVideoStats(videoStats)) {
+        QJsonObject video;
+        video["totalFrames"] = (qint64)videoStats.totalFrames;
+        video["receivedFrames"] = (qint64)videoStats.receivedFrames;
+        video["decodedFrames"] = (qint64)videoStats.decodedFrames;
+        video["renderedFrames"] = (qint64)videoStats.renderedFrames;
+        video["networkDroppedFrames"] = (qint64)videoStats.networkDroppedFrames;
+        video["pacerDroppedFrames"] = (qint64)videoStats.pacerDroppedFrames;
+        video["idrFrames"] = (qint64)videoStats.idrFrames;
+        video["idrRequests"] = (qint64)videoStats.idrRequests;
+        video["rfiRecoveries"] = (qint64)videoStats.rfiRecoveries;
+        video["concealedFrames"] = (qint64)videoStats.concealedFrames;
+        video["lossBursts"] = (qint64)videoStats.lossBursts;
+        video["maxLossBurst"] = (qint64)videoStats.maxLossBurst;
+        if (videoStats.receivedFrames != 0) {
+            video["arrivalJitterMs"] = (double)videoStats.totalArrivalJitter / videoStats.receivedFrames / 1000;
+        }
+        if (streamSecs > 0) {
+            video["receivedFps"] = videoStats.receivedFrames / streamSecs;
+        }
+        if (videoStats.totalFrames != 0) {
+            video["networkDropPercent"] = (double)videoStats.networkDroppedFrames / videoStats.totalFrames * 100;
+        }
+        video["reassemblyMs"] = histogramToJson(videoStats.reassemblyTimes);
+        if (videoStats.decodeTimes.count != 0) {
+            video["decodeMs"] = histogramToJson(videoStats.decodeTimes);
+        }
+        if (videoStats.renderTimes.count != 0) {
+            video["renderMs"] = histogramToJson(videoStats.renderTimes);
+        }
+        json["video"] = video;
+    }
+
+    AUDIO_STATS audioStats;
+    session->getAudioStats(audioStats);
+    QJsonObject audio;
+    audio["receivedPackets"] = (qint64)audioStats.receivedPackets;
+    audio["lostPackets"] = (qint64)audioStats.lostPackets;
+    audio["fecDecodedPackets"] = (qint64)audioStats.fecDecodedPackets;
+    audio["concealedPackets"] = (qint64)audioStats.concealedPackets;
+    audio["maxJitterUs"] = (qint64)audioStats.maxJitterUs;
+    json["audio"] = audio;
+
+    QJsonObject input;
+    input["scriptedEvents"] = ScriptedInput::getEventsSent();
+    json["input"] = input;
+}
+
+Runner::Runner(CliStartStream::Launcher* launcher,
+               QString host, QString appName,
+               int durationSecs, QString statsPath,
+               QObject* parent)
+    : QObject(parent),
+      m_Launcher(launcher),
+      m_Host(host),
+      m_AppName(appName),
+      m_DurationSecs(durationSecs),
+      m_StatsPath(statsPath),
+      m_Session(nullptr),
+      m_DurationTimer(0)
+{
+    connect(m_Launcher, &CliStartStream::Launcher::sessionCreated,
+            this, &Runner::onSessionCreated);
+    connect(m_Launcher, &CliStartStream::Launcher::failed,
+            this, &Runner::onLaunchFailed);
+    connect(m_Launcher, &CliStartStream::Launcher::appQuitRequired,
+            this, &Runner::onAppQuitRequired);
+}
+
+Runner::~Runner()
+{
+    if (m_DurationTimer != 0) {
+        SDL_RemoveTimer(m_DurationTimer);
+    }
+}
+
+void Runner::start(ComputerManager* manager)
+{
+    m_Launcher->execute(manager);
+}
+
+void Runner::onSessionCreated(QString, Session* session)
+{
+    m_Session = session;
+
+    connect(session, &Session::stageFailed,
+            this, &Runner::onStageFailed);
+    connect(session, &Session::displayLaunchError,
+            this, &Runner::onLaunchError);
+    connect(session, &Session::displayLaunchWarning,
+            this, &Runner::onLaunchWarning);
+    connect(session, &Session::connectionStarted,
+            this, &Runner::onConnectionStarted);
+    connect(session, &Session::sessionFinished,
+            this, &Runner::onSessionFinished);
+
+    // Session::exec() runs until the stream is over, so it's started
+    // from the event loop like the UI does rather than from this signal
+    QTimer::singleShot(0, session, [session]() {
+        session->exec(0, 0);
+    });
+}
+
+void Runner::onLaunchFailed(QString text)
+{
+    m_Error = text;
+    finish();
+}
+
+void Runner::onAppQuitRequired(QString appName)
+{
+    // Quitting someone else's game isn't something to do unattended
+    m_Error = QString("%1 is already running on the host").arg(appName);
+    finish();
+}
+
+void Runner::onStageFailed(QString stage, long errorCode)
+{
+    m_Error = QString("Starting %1 failed: Error %2").arg(stage).arg(errorCode);
+}
+
+void Runner::onLaunchError(QString text)
+{
+    m_Error = text;
+}
+
+void Runner::onLaunchWarning(QString text)
+{
+    m_Warnings.append(text);
+}
+
+void Runner::onConnectionStarted()
+{
+    m_StreamTimer.start();
+
+    if (m_DurationSecs > 0) {
+        m_DurationTimer = SDL_AddTimer(m_DurationSecs * 1000, durationTimerCallback, nullptr);
+    }
+}
+
+Uint32 Runner::durationTimerCallback(Uint32, void*)
+{
+    // The session ends the stream like the user closed the window
+    SDL_Event event;
+    event.type = SDL_QUIT;
+    event.quit.timestamp = SDL_GetTicks();
+    SDL_PushEvent(&event);
+
+    return 0;
+}
+
+void Runner::onSessionFinished()
+{
+    if (m_DurationTimer != 0) {
+        SDL_RemoveTimer(m_DurationTimer);
+        m_DurationTimer = 0;
+    }
+
+    finish();
+}
+
+void Runner::writeSummary()
+{
+    QJsonObject summary;
+    summary["host"] = m_Host;
+    summary["app"] = m_AppName;
+    summary["result"] = m_Error.isEmpty() && m_StreamTimer.isValid() ? "ok" : "failed";
+    if (!m_Error.isEmpty()) {
+        summary["error"] = m_Error;
+    }
+    summary["warnings"] = QJsonArray::fromStringList(m_Warnings);
+
+    if (m_Session != nullptr && m_StreamTimer.isValid()) {
+        addSessionStats(summary, m_Session, (double)m_StreamTimer.elapsed() / 1000);
+    }
+
+    QByteArray json = QJsonDocument(summary).toJson(QJsonDocument::Compact) + '\n';
+    if (m_StatsPath.isEmpty()) {
+        fputs(json.constData(), stdout);
+        fflush(stdout);
+    }
+    else {
+        QFile file(m_StatsPath);
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) {
+            qWarning() << "Unable to write stats summary:" << m_StatsPath;
+            return;
+        }
+
+        file.write(json);
+    }
+}
+
+void Runner::finish()
+{
+    writeSummary();
+
+    QCoreApplication::exit(m_Error.isEmpty() && m_StreamTimer.isValid() ? 0 : 1);
+}
+
+}
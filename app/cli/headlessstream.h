@@ -0,0 +1,76 @@
+#pragma once
+
+#include <QElapsedTimer>
+#include <QJsonObject>
+#include <QObject>
+#include <QStringList>
+
+#include <SDL.h>
+
+class ComputerManager;
+class Session;
+
+namespace CliStartStream
+{
+class Launcher;
+}
+
+namespace CliHeadlessStream
+{
+
+// Adds the stats of a session's stream to a JSON summary. The video stats
+// are final once the session has finished, and a second or so behind
+// while it's still streaming.
+void addSessionStats(QJsonObject& json, Session* session, double streamSecs);
+
+// Runs a stream from the command line without loading the UI, for soak
+// testing hosts and networks with many clients per machine. Anything the
+// UI would have asked the user is treated as a failure. Once the stream
+// ends, a JSON summary of the session is written and the app quits with
+// an exit code of 0 if it streamed without errors.
+class Runner : public QObject
+{
+    Q_OBJECT
+
+public:
+    // A duration of 0 streams until the host ends the stream. The summary
+    // goes to stdout if statsPath is empty.
+    explicit Runner(CliStartStream::Launcher* launcher,
+                    QString host, QString appName,
+                    int durationSecs, QString statsPath,
+                    QObject* parent = nullptr);
+
+    virtual ~Runner();
+
+    void start(ComputerManager* manager);
+
+private slots:
+    void onSessionCreated(QString appName, Session* session);
+    void onLaunchFailed(QString text);
+    void onAppQuitRequired(QString appName);
+    void onStageFailed(QString stage, long errorCode);
+    void onLaunchError(QString text);
+    void onLaunchWarning(QString text);
+    void onConnectionStarted();
+    void onSessionFinished();
+
+private:
+    static Uint32 durationTimerCallback(Uint32 interval, void* param);
+
+    void writeSummary();
+
+    void finish();
+
+    CliStartStream::Launcher* m_Launcher;
+    QString m_Host;
+    QString m_AppName;
+    int m_DurationSecs;
+    QString m_StatsPath;
+    Session* m_Session;
+    SDL_TimerID m_DurationTimer;
+    QElapsedTimer m_StreamTimer;
+    QString m_Error;
+    QStringList m_Warnings;
+};
+
+}
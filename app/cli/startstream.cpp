@@ -4,6 +4,9 @@
 #include "streaming/session.h"
 
 #include <QCoreApplication>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
 #include <QTimer>
 
 #define COMPUTER_SEEK_TIMEOUT 10000
@@ -60,6 +63,8 @@ public:
             if (m_State == StateInit) {
                 m_State = StateSeekComputer;
                 m_ComputerManager = event.computerManager;
+                m_StartupTimer.start();
+                m_LastStageTimeMs = 0;
 
                 m_ComputerSeeker = new ComputerSeeker(m_ComputerManager, m_ComputerName, q);
                 q->connect(m_ComputerSeeker, &ComputerSeeker::computerFound,
@@ -80,10 +85,18 @@ public:
         case Event::ComputerFound:
             if (m_State == StateSeekComputer) {
                 if (event.computer->pairState == NvComputer::PS_PAIRED) {
+                    recordStartupStage("host discovery");
                     m_State = StateSeekApp;
                     m_Computer = event.computer;
                     m_TimeoutTimer->start(APP_SEEK_TIMEOUT);
                     emit q->searchingApp();
+
+                    // A computer found by asking it directly isn't polled, so
+                    // its app list is only refreshed if the saved one lacks the app
+                    if (getAppIndex() == -1) {
+                        m_ComputerManager->startPolling();
+                        m_PollingForAppList = true;
+                    }
                 } else {
                     m_State = StateFailure;
                     QString msg = QString("Computer %1 has not been paired. "
@@ -101,8 +114,17 @@ public:
                     app = m_Computer->appList[index];
                     m_TimeoutTimer->stop();
                     if (isNotStreaming() || isStreamingApp(app)) {
+                        recordStartupStage("app list");
                         m_State = StateStartSession;
+                        stopPollingForAppList();
                         session = new Session(m_Computer, app, m_Preferences);
+                        if (m_WindowGeometry.isValid()) {
+                            session->setWindowGeometry(m_WindowGeometry);
+                        }
+                        if (!m_StartupProfilePath.isEmpty()) {
+                            q->connect(session, &Session::startupProfileReady,
+                                       q, &Launcher::onStartupProfileReady);
+                        }
                         emit q->sessionCreated(app.name, session);
                     } else {
                         emit q->appQuitRequired(getCurrentAppName());
@@ -123,6 +145,7 @@ public:
         case Event::AppQuitCompleted:
             if (m_State == StateSeekApp && !event.errorMessage.isEmpty()) {
                 m_State = StateFailure;
+                stopPollingForAppList();
                 emit q->failed(QString("Quitting app failed, reason: %1").arg(event.errorMessage));
             }
             break;
@@ -134,12 +157,21 @@ public:
             }
             if (m_State == StateSeekApp) {
                 m_State = StateFailure;
+                stopPollingForAppList();
                 emit q->failed(QString("Failed to find application %1").arg(m_AppName));
             }
             break;
         }
     }
 
+    void stopPollingForAppList()
+    {
+        if (m_PollingForAppList) {
+            m_ComputerManager->stopPollingAsync();
+            m_PollingForAppList = false;
+        }
+    }
+
     int getAppIndex() const
     {
         for (int i = 0; i < m_Computer->appList.length(); i++) {
@@ -160,6 +192,13 @@ public:
         return m_Computer->currentGameId == app.id;
     }
 
+    void recordStartupStage(const char* stage)
+    {
+        qint64 now = m_StartupTimer.elapsed();
+        m_StartupProfile.append(QString("%1,%2,%3").arg(stage).arg(now - m_LastStageTimeMs).arg(now));
+        m_LastStageTimeMs = now;
+    }
+
     QString getCurrentAppName() const
     {
         for (NvApp app : m_Computer->appList) {
@@ -178,7 +217,13 @@ public:
     ComputerSeeker *m_ComputerSeeker;
     NvComputer *m_Computer;
     State m_State;
+    bool m_PollingForAppList;
     QTimer *m_TimeoutTimer;
+    QString m_StartupProfilePath;
+    QRect m_WindowGeometry;
+    QElapsedTimer m_StartupTimer;
+    qint64 m_LastStageTimeMs;
+    QStringList m_StartupProfile;
 };
 
 Launcher::Launcher(QString computer, QString app,
@@ -191,6 +236,7 @@ Launcher::Launcher(QString computer, QString app,
     d->m_AppName = app;
     d->m_Preferences = preferences;
     d->m_State = StateInit;
+    d->m_PollingForAppList = false;
     d->m_TimeoutTimer = new QTimer(this);
     d->m_TimeoutTimer->setSingleShot(true);
     connect(d->m_TimeoutTimer, &QTimer::timeout,
@@ -216,6 +262,18 @@ void Launcher::quitRunningApp()
     d->handleEvent(event);
 }
 
+void Launcher::setStartupProfilePath(QString path)
+{
+    Q_D(Launcher);
+    d->m_StartupProfilePath = path;
+}
+
+void Launcher::setWindowGeometry(QRect geometry)
+{
+    Q_D(Launcher);
+    d->m_WindowGeometry = geometry;
+}
+
 bool Launcher::isExecuted() const
 {
     Q_D(const Launcher);
@@ -245,6 +303,26 @@ void Launcher::onTimeout()
     d->handleEvent(event);
 }
 
+void Launcher::onStartupProfileReady(QStringList stages)
+{
+    Q_D(Launcher);
+
+    // Host lookup is timed here and everything after by the session,
+    // which measures elapsed time from when it started
+    QFile file(d->m_StartupProfilePath);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) {
+        qWarning() << "Unable to write startup profile:" << d->m_StartupProfilePath;
+        return;
+    }
+
+    QStringList lines;
+    lines.append("stage,duration_ms,elapsed_ms");
+    lines.append(d->m_StartupProfile);
+    lines.append(stages);
+    file.write(lines.join('\n').toUtf8());
+    file.write("\n");
+}
+
 void Launcher::onQuitAppCompleted(QVariant error)
 {
     Q_D(Launcher);
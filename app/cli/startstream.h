@@ -1,6 +1,7 @@
 #pragma once
 
 #include <QObject>
+#include <QRect>
 #include <QVariant>
 
 class ComputerManager;
@@ -28,6 +29,12 @@ public:
     Q_INVOKABLE void quitRunningApp();
     Q_INVOKABLE bool isExecuted() const;
 
+    // Writes the time taken by each startup stage to path as CSV
+    void setStartupProfilePath(QString path);
+
+    // See Session::setWindowGeometry()
+    void setWindowGeometry(QRect geometry);
+
 signals:
     void searchingComputer();
     void searchingApp();
@@ -40,6 +47,7 @@ private slots:
     void onComputerUpdated(NvComputer *computer);
     void onTimeout();
     void onQuitAppCompleted(QVariant error);
+    void onStartupProfileReady(QStringList stages);
 
 private:
     QScopedPointer<LauncherPrivate> m_DPtr;
@@ -1,5 +1,6 @@
 import QtQuick 2.9
 import QtQuick.Controls 2.2
+import QtQuick.Window 2.2
 
 import AppModel 1.0
 import ComputerManager 1.0
@@ -9,6 +10,7 @@ CenteredGridView {
     property int computerIndex
     property AppModel appModel : createModel()
     property bool activated
+    property bool boxArtReleased: false
 
     id: appGrid
     focus: true
@@ -17,6 +19,17 @@ CenteredGridView {
     bottomMargin: 5
     cellWidth: 230; cellHeight: 297;
 
+    // Keep a couple of rows built past each edge, so their box art
+    // has finished loading by the time they scroll into view
+    cacheBuffer: cellHeight * 2
+
+    function releaseBoxArt()
+    {
+        // Unload the box art textures while a stream is running.
+        // They're loaded again from the disk cache when we return.
+        boxArtReleased = true
+    }
+
     function computerLost()
     {
         // Go back to the PC view on PC loss
@@ -33,6 +46,7 @@ CenteredGridView {
     StackView.onActivated: {
         appModel.computerLost.connect(computerLost)
         activated = true
+        boxArtReleased = false
 
         // Highlight the first item if a gamepad is connected
         if (currentIndex == -1 && SdlGamepadKeyNavigation.getConnectedGamepads() > 0) {
@@ -58,28 +72,43 @@ CenteredGridView {
         width: 220; height: 287;
         grid: appGrid
 
+        // Box art for tiles on screen is fetched ahead of the ones in the
+        // grid's cache buffer, and tiles that are scrolled far enough away
+        // to be destroyed stop waiting for theirs
+        property bool onScreen: y + height > appGrid.contentY && y < appGrid.contentY + appGrid.height
+        onOnScreenChanged: appModel.setBoxArtVisible(index, onScreen)
+        Component.onCompleted: appModel.setBoxArtVisible(index, onScreen)
+        Component.onDestruction: appModel.cancelBoxArt(index)
+
+        // Get ready for a launch while the user is still deciding
+        onHoveredChanged: if (hovered) appModel.prepareLaunch(index)
+        onHighlightedChanged: if (highlighted) appModel.prepareLaunch(index)
+
         Image {
             property bool isPlaceholder: false
 
             id: appIcon
             anchors.horizontalCenter: parent.horizontalCenter
             y: 10
-            source: model.boxart
-
-            onSourceSizeChanged: {
-                if ((sourceSize.width == 130 && sourceSize.height == 180) || // GFE 2.0 placeholder image
-                    (sourceSize.width == 628 && sourceSize.height == 888) || // GFE 3.0 placeholder image
-                    (sourceSize.width == 200 && sourceSize.height == 266))   // Our no_app_image.png
-                {
-                    isPlaceholder = true
-                }
-                else
-                {
-                    isPlaceholder = false
-                }
+            width: 200
+            height: 267
+            source: boxArtReleased ? "" : model.boxart
+
+            // Decode on QML's loader threads at the size that's drawn,
+            // so scrolling never waits on an image
+            asynchronous: true
+            sourceSize {
+                width: 200 * Screen.devicePixelRatio
+                height: 267 * Screen.devicePixelRatio
+            }
 
-                width = 200
-                height = 267
+            onStatusChanged: {
+                if (status == Image.Ready) {
+                    // The box art provider swaps the host's placeholders for our
+                    // no_app_image.png, which it hands back without scaling
+                    isPlaceholder = source == "qrc:/res/no_app_image.png" ||
+                            (implicitWidth == 200 && implicitHeight == 266)
+                }
             }
 
             // Display a tooltip with the full name if it's truncated
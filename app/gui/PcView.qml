@@ -29,6 +29,27 @@ CenteredGridView {
         // Setup signals on CM
         ComputerManager.computerAddCompleted.connect(addComplete)
 
+        // Opening the gamepads waits until the first frame is up at startup
+        if (window.initialized) {
+            enableGamepadNavigation()
+        }
+        else {
+            window.startupCompleted.connect(handleStartupCompleted)
+        }
+    }
+
+    StackView.onDeactivating: {
+        ComputerManager.computerAddCompleted.disconnect(addComplete)
+    }
+
+    function handleStartupCompleted()
+    {
+        window.startupCompleted.disconnect(handleStartupCompleted)
+        enableGamepadNavigation()
+    }
+
+    function enableGamepadNavigation()
+    {
         // This is a bit of a hack to do this here as opposed to main.qml, but
         // we need it enabled before calling getConnectedGamepads() and PcView
         // is never destroyed, so it should be okay.
@@ -40,10 +61,6 @@ CenteredGridView {
         }
     }
 
-    StackView.onDeactivating: {
-        ComputerManager.computerAddCompleted.disconnect(addComplete)
-    }
-
     function pairingComplete(error)
     {
         // Close the PIN dialog
@@ -24,7 +24,53 @@ Flickable {
         }
     }
 
+    function applyRecommendedSettings() {
+        StreamingPreferences.width = SystemProperties.recommendedWidth
+        StreamingPreferences.height = SystemProperties.recommendedHeight
+        StreamingPreferences.fps = SystemProperties.recommendedFps
+        StreamingPreferences.videoCodecConfig = SystemProperties.recommendedVideoCodec
+        StreamingPreferences.videoDecoderSelection = StreamingPreferences.VDS_AUTO
+
+        StreamingPreferences.bitrateKbps = StreamingPreferences.getDefaultBitrate(StreamingPreferences.width,
+                                                                                  StreamingPreferences.height,
+                                                                                  StreamingPreferences.fps);
+        slider.value = StreamingPreferences.bitrateKbps
+
+        for (var i = 0; i < resolutionListModel.count; i++) {
+            if (parseInt(resolutionListModel.get(i).video_width) === StreamingPreferences.width &&
+                    parseInt(resolutionListModel.get(i).video_height) === StreamingPreferences.height) {
+                resolutionComboBox.currentIndex = i
+                break
+            }
+        }
+
+        fpsComboBox.reinitialize()
+
+        for (var j = 0; j < codecListModel.count; j++) {
+            if (codecListModel.get(j).val === StreamingPreferences.videoCodecConfig) {
+                codecComboBox.currentIndex = j
+                break
+            }
+        }
+
+        for (var k = 0; k < decoderListModel.count; k++) {
+            if (decoderListModel.get(k).val === StreamingPreferences.videoDecoderSelection) {
+                decoderComboBox.currentIndex = k
+                break
+            }
+        }
+    }
+
     StackView.onActivated: {
+        // Tune the defaults to this PC the first time the settings are
+        // opened, but never override stream settings the user picked
+        if (!SystemProperties.hasCapabilityBenchmark &&
+                StreamingPreferences.width === 1280 && StreamingPreferences.height === 720 &&
+                StreamingPreferences.fps === 60) {
+            SystemProperties.runCapabilityBenchmark()
+            applyRecommendedSettings()
+        }
+
         // This enables Tab and BackTab based navigation rather than arrow keys.
         // It is required to shift focus between controls on the settings page.
         SdlGamepadKeyNavigation.setUiNavMode(true)
@@ -283,6 +329,23 @@ Flickable {
                     }
                 }
 
+                Button {
+                    id: detectSettingsButton
+                    text: qsTr("Detect the best settings for this PC")
+                    font.pointSize: 12
+                    hoverEnabled: true
+
+                    onClicked: {
+                        SystemProperties.runCapabilityBenchmark()
+                        applyRecommendedSettings()
+                    }
+
+                    ToolTip.delay: 1000
+                    ToolTip.timeout: 5000
+                    ToolTip.visible: hovered
+                    ToolTip.text: qsTr("Picks the highest resolution, frame rate, and codec that this PC can decode smoothly")
+                }
+
                 Label {
                     width: parent.width
                     id: bitrateTitle
@@ -317,6 +380,40 @@ Flickable {
                     }
                 }
 
+                CheckBox {
+                    id: autoBitrateCheck
+                    hoverEnabled: true
+                    text: "Lower the bitrate automatically on poor connections"
+                    font.pointSize:  12
+                    checked: StreamingPreferences.autoBitrate
+                    onCheckedChanged: {
+                        StreamingPreferences.autoBitrate = checked
+                    }
+
+                    ToolTip.delay: 1000
+                    ToolTip.timeout: 5000
+                    ToolTip.visible: hovered
+                    ToolTip.text: "When checked, the bitrate is lowered while frames are being lost and raised back up to the bitrate above once the connection recovers. " +
+                                  "Each change briefly restarts the video stream."
+                }
+
+                CheckBox {
+                    id: autoResolutionCheck
+                    hoverEnabled: true
+                    text: "Lower the resolution automatically if decoding can't keep up"
+                    font.pointSize:  12
+                    checked: StreamingPreferences.autoResolution
+                    onCheckedChanged: {
+                        StreamingPreferences.autoResolution = checked
+                    }
+
+                    ToolTip.delay: 1000
+                    ToolTip.timeout: 5000
+                    ToolTip.visible: hovered
+                    ToolTip.text: "When checked, the resolution is stepped down while this PC is too slow to decode the stream in real time. " +
+                                  "Each change briefly restarts the video stream."
+                }
+
                 Label {
                     width: parent.width
                     id: windowModeTitle
@@ -409,6 +506,136 @@ Flickable {
                     ToolTip.visible: hovered
                     ToolTip.text: "Frame pacing reduces micro-stutter by delaying frames that come in too early"
                 }
+
+                AutoResizingComboBox {
+                    // ignore setting the index at first, and actually set it when the component is loaded
+                    Component.onCompleted: {
+                        var saved_pm = StreamingPreferences.pacingMode
+                        currentIndex = 0
+                        for (var i = 0; i < pacingModeListModel.count; i++) {
+                            var el_pm = pacingModeListModel.get(i).val;
+                            if (saved_pm === el_pm) {
+                                currentIndex = i
+                                break
+                            }
+                        }
+                        activated(currentIndex)
+                    }
+
+                    id: pacingModeComboBox
+                    enabled: framePacingCheck.checked
+                    hoverEnabled: true
+                    textRole: "text"
+                    model: ListModel {
+                        id: pacingModeListModel
+                        ListElement {
+                            text: "Balanced"
+                            val: StreamingPreferences.PM_BALANCED
+                        }
+                        ListElement {
+                            text: "Lowest latency"
+                            val: StreamingPreferences.PM_LOWEST_LATENCY
+                        }
+                        ListElement {
+                            text: "Smoothest"
+                            val: StreamingPreferences.PM_SMOOTHEST
+                        }
+                        ListElement {
+                            text: "Just in time"
+                            val: StreamingPreferences.PM_JUST_IN_TIME
+                        }
+                    }
+                    // ::onActivated must be used, as it only listens for when the index is changed by a human
+                    onActivated : {
+                        StreamingPreferences.pacingMode = pacingModeListModel.get(currentIndex).val
+                    }
+
+                    ToolTip.delay: 1000
+                    ToolTip.timeout: 5000
+                    ToolTip.visible: hovered
+                    ToolTip.text: "Lowest latency queues as few frames as possible. Smoothest keeps extra frames queued to absorb network and decoder jitter. Just in time waits until right before the display refreshes to pick the newest frame, which saves the most latency but drops more frames when rendering times vary."
+                }
+
+                CheckBox {
+                    id: vrrCheck
+                    hoverEnabled: true
+                    text: "Variable refresh rate (G-SYNC/FreeSync)"
+                    font.pointSize:  12
+                    checked: StreamingPreferences.variableRefreshRate
+                    onCheckedChanged: {
+                        StreamingPreferences.variableRefreshRate = checked
+                    }
+                    ToolTip.delay: 1000
+                    ToolTip.timeout: 5000
+                    ToolTip.visible: hovered
+                    ToolTip.text: "On displays that support it, frames are shown as soon as they are decoded and the stream frame rate is capped just below the display's maximum refresh rate"
+                }
+
+                CheckBox {
+                    id: sharpeningCheck
+                    hoverEnabled: true
+                    text: "Sharpen upscaled video"
+                    font.pointSize:  12
+                    checked: StreamingPreferences.videoSharpening
+                    onCheckedChanged: {
+                        StreamingPreferences.videoSharpening = checked
+                    }
+                    ToolTip.delay: 1000
+                    ToolTip.timeout: 5000
+                    ToolTip.visible: hovered
+                    ToolTip.text: "When the stream resolution is lower than your display's, the GPU sharpens the video as it is scaled up. It turns itself off if it takes too long on your GPU."
+                }
+
+                CheckBox {
+                    id: errorConcealmentCheck
+                    hoverEnabled: true
+                    text: "Keep video moving during packet loss"
+                    font.pointSize:  12
+                    checked: StreamingPreferences.errorConcealment
+                    onCheckedChanged: {
+                        StreamingPreferences.errorConcealment = checked
+                    }
+                    ToolTip.delay: 1000
+                    ToolTip.timeout: 5000
+                    ToolTip.visible: hovered
+                    ToolTip.text: "Frames damaged by packet loss are shown with the errors hidden as well as possible instead of freezing the video until the host sends a clean frame"
+                }
+
+                CheckBox {
+                    id: powerSavingCheck
+                    hoverEnabled: true
+                    text: "Save power while on battery"
+                    font.pointSize:  12
+                    checked: StreamingPreferences.powerSaving
+                    onCheckedChanged: {
+                        StreamingPreferences.powerSaving = checked
+                    }
+                    ToolTip.delay: 1000
+                    ToolTip.timeout: 5000
+                    ToolTip.visible: hovered
+                    ToolTip.text: "When streaming on battery power, frames are shown as soon as they arrive instead of being paced to the display, and Moonlight wakes the CPU less often. This can add a little stutter and input latency."
+                }
+
+                CheckBox {
+                    id: replayBufferCheck
+                    hoverEnabled: true
+                    text: "Keep the last 30 seconds for instant replay"
+                    font.pointSize:  12
+                    checked: StreamingPreferences.replayBufferSecs > 0
+                    onCheckedChanged: {
+                        // Keep a length set from the command line
+                        if (checked && StreamingPreferences.replayBufferSecs === 0) {
+                            StreamingPreferences.replayBufferSecs = 30
+                        }
+                        else if (!checked) {
+                            StreamingPreferences.replayBufferSecs = 0
+                        }
+                    }
+                    ToolTip.delay: 1000
+                    ToolTip.timeout: 5000
+                    ToolTip.visible: hovered
+                    ToolTip.text: "Keeps the stream in memory so Ctrl+Alt+Shift+B saves what just happened to your Videos folder. Moonlight asks the host for a key frame every 30 seconds while this is on. Ctrl+Alt+Shift+R records the stream whether or not this is on."
+                }
             }
         }
 
@@ -583,6 +810,148 @@ Flickable {
                     ToolTip.visible: hovered
                     ToolTip.text: "When enabled, holding the Start button will toggle mouse mode"
                 }
+
+                CheckBox {
+                    id: absoluteTouchCheck
+                    hoverEnabled: true
+                    text: "Direct touchscreen input"
+                    font.pointSize:  12
+                    checked: StreamingPreferences.absoluteTouchMode
+                    onCheckedChanged: {
+                        StreamingPreferences.absoluteTouchMode = checked
+                    }
+
+                    ToolTip.delay: 1000
+                    ToolTip.timeout: 5000
+                    ToolTip.visible: hovered
+                    ToolTip.text: "When checked, touching the screen clicks where you touch and a second finger right clicks. " +
+                                  "When unchecked, the touchscreen acts as a trackpad."
+                }
+
+                CheckBox {
+                    id: localCursorCheck
+                    hoverEnabled: true
+                    text: "Draw the mouse cursor locally"
+                    font.pointSize:  12
+                    checked: StreamingPreferences.localCursor
+                    onCheckedChanged: {
+                        StreamingPreferences.localCursor = checked
+                    }
+
+                    ToolTip.delay: 1000
+                    ToolTip.timeout: 5000
+                    ToolTip.visible: hovered
+                    ToolTip.text: "When checked, your own mouse cursor is shown over the stream and moves without waiting on the host. " +
+                                  "This suits desktop use, but games that capture the mouse won't work well with it."
+                }
+
+                Label {
+                    width: parent.width
+                    id: gamepadDeadzoneTitle
+                    text: qsTr("Gamepad stick deadzone: ")
+                    font.pointSize: 12
+                    wrapMode: Text.Wrap
+                }
+
+                Label {
+                    width: parent.width
+                    id: gamepadDeadzoneDesc
+                    text: qsTr("Raise the deadzone if a worn stick drifts when it's released.")
+                    font.pointSize: 9
+                    wrapMode: Text.Wrap
+                }
+
+                Slider {
+                    value: StreamingPreferences.gamepadDeadzone
+
+                    stepSize: 1
+                    from: 0
+                    to: 30
+
+                    snapMode: "SnapOnRelease"
+                    width: Math.min(gamepadDeadzoneDesc.implicitWidth, parent.width)
+
+                    onValueChanged: {
+                        gamepadDeadzoneTitle.text = "Gamepad stick deadzone: " + value + "%"
+                        StreamingPreferences.gamepadDeadzone = value
+                    }
+                }
+
+                Label {
+                    width: parent.width
+                    id: gamepadAntiDeadzoneTitle
+                    text: qsTr("Gamepad anti-deadzone: ")
+                    font.pointSize: 12
+                    wrapMode: Text.Wrap
+                }
+
+                Label {
+                    width: parent.width
+                    id: gamepadAntiDeadzoneDesc
+                    text: qsTr("Raise the anti-deadzone if a game ignores small stick movements.")
+                    font.pointSize: 9
+                    wrapMode: Text.Wrap
+                }
+
+                Slider {
+                    value: StreamingPreferences.gamepadAntiDeadzone
+
+                    stepSize: 1
+                    from: 0
+                    to: 30
+
+                    snapMode: "SnapOnRelease"
+                    width: Math.min(gamepadAntiDeadzoneDesc.implicitWidth, parent.width)
+
+                    onValueChanged: {
+                        gamepadAntiDeadzoneTitle.text = "Gamepad anti-deadzone: " + value + "%"
+                        StreamingPreferences.gamepadAntiDeadzone = value
+                    }
+                }
+
+                AutoResizingComboBox {
+                    // ignore setting the index at first, and actually set it when the component is loaded
+                    Component.onCompleted: {
+                        var saved_curve = StreamingPreferences.gamepadResponseCurve
+                        currentIndex = 0
+                        for (var i = 0; i < gamepadCurveListModel.count; i++) {
+                            var el_curve = gamepadCurveListModel.get(i).val;
+                            if (saved_curve === el_curve) {
+                                currentIndex = i
+                                break
+                            }
+                        }
+                        activated(currentIndex)
+                    }
+
+                    id: gamepadCurveComboBox
+                    hoverEnabled: true
+                    textRole: "text"
+                    model: ListModel {
+                        id: gamepadCurveListModel
+                        ListElement {
+                            text: "Linear stick response"
+                            val: StreamingPreferences.GRC_LINEAR
+                        }
+                        ListElement {
+                            text: "Quadratic stick response"
+                            val: StreamingPreferences.GRC_QUADRATIC
+                        }
+                        ListElement {
+                            text: "Cubic stick response"
+                            val: StreamingPreferences.GRC_CUBIC
+                        }
+                    }
+                    // ::onActivated must be used, as it only listens for when the index is changed by a human
+                    onActivated : {
+                        StreamingPreferences.gamepadResponseCurve = gamepadCurveListModel.get(currentIndex).val
+                    }
+
+                    ToolTip.delay: 1000
+                    ToolTip.timeout: 5000
+                    ToolTip.visible: hovered
+                    ToolTip.text: "Quadratic and cubic responses give finer control near the center of the stick"
+                }
             }
         }
 
@@ -642,6 +1011,12 @@ Flickable {
                     // ignore setting the index at first, and actually set it when the component is loaded
                     Component.onCompleted: {
                         var saved_vds = StreamingPreferences.videoDecoderSelection
+                        // Direct3D 11 decoding is only available on Windows
+                        if (Qt.platform.os === "windows") {
+                            decoderListModel.append({"text": "Force Direct3D 11 decoding",
+                                                     "val": StreamingPreferences.VDS_FORCE_D3D11VA})
+                        }
+
                         currentIndex = 0
                         for (var i = 0; i < decoderListModel.count; i++) {
                             var el_vds = decoderListModel.get(i).val;
@@ -2,6 +2,7 @@ import QtQuick 2.0
 import QtQuick.Controls 2.2
 import QtQuick.Window 2.2
 
+import ComputerManager 1.0
 import SdlGamepadKeyNavigation 1.0
 import Session 1.0
 
@@ -31,6 +32,14 @@ Item {
         stageLabel.visible = false
         hintText.visible = false
 
+        // Stop the spinner animation and let the view underneath us drop
+        // its box art, since nothing is drawn until the stream ends
+        stageSpinner.running = false
+        var previousView = stackView.get(StackView.index - 1)
+        if (previousView && previousView.releaseBoxArt) {
+            previousView.releaseBoxArt()
+        }
+
         // Hide the window now that streaming has begun
         window.visible = false
     }
@@ -64,6 +73,9 @@ Item {
 
     function sessionFinished()
     {
+        // Poll every host again before the Qt window reappears
+        ComputerManager.setStreamingComputer("")
+
         // Enable GUI gamepad usage now
         SdlGamepadKeyNavigation.enable()
 
@@ -116,6 +128,10 @@ Item {
         session.quitStarting.connect(quitStarting)
         session.sessionFinished.connect(sessionFinished)
 
+        // Keep other hosts' polls and box art fetches
+        // off the network while we stream
+        ComputerManager.setStreamingComputer(session.getComputerUuid())
+
         // Kick off the stream
         streamLoader.active = true
     }
@@ -1,10 +1,22 @@
 #include "appmodel.h"
 
+// How long a tile must keep focus before we prepare to launch it
+#define PREPARE_LAUNCH_DELAY_MS 300
+
+// Preparing again within this long only restarts the grace period of
+// what's already open, which isn't worth the host request
+#define PREPARE_LAUNCH_INTERVAL_MS 30000
+
 AppModel::AppModel(QObject *parent)
     : QAbstractListModel(parent)
 {
     connect(&m_BoxArtManager, &BoxArtManager::boxArtLoadComplete,
             this, &AppModel::handleBoxArtLoaded);
+
+    m_PrepareLaunchTimer.setSingleShot(true);
+    m_PrepareLaunchTimer.setInterval(PREPARE_LAUNCH_DELAY_MS);
+    connect(&m_PrepareLaunchTimer, &QTimer::timeout,
+            this, &AppModel::handlePrepareLaunchTimeout);
 }
 
 void AppModel::initialize(ComputerManager* computerManager, int computerIndex)
@@ -15,8 +27,11 @@ void AppModel::initialize(ComputerManager* computerManager, int computerIndex)
 
     Q_ASSERT(computerIndex < m_ComputerManager->getComputers().count());
     m_Computer = m_ComputerManager->getComputers().at(computerIndex);
-    m_Apps = m_Computer->appList;
-    m_CurrentGameId = m_Computer->currentGameId;
+
+    QSharedPointer<const NvComputerSnapshot> snapshot = m_Computer->getSnapshot();
+    m_Apps = snapshot->appList;
+    m_CurrentGameId = snapshot->currentGameId;
+    m_Snapshot = snapshot;
 }
 
 int AppModel::getRunningAppIndex()
@@ -53,6 +68,24 @@ Session* AppModel::createSessionForApp(int appIndex)
     return new Session(m_Computer, app);
 }
 
+void AppModel::prepareLaunch(int appIndex)
+{
+    Q_ASSERT(appIndex < m_Apps.count());
+
+    // Nothing we prepare depends on the app, only the host
+    if (m_LastPrepareTimer.isValid() && m_LastPrepareTimer.elapsed() < PREPARE_LAUNCH_INTERVAL_MS) {
+        return;
+    }
+
+    m_PrepareLaunchTimer.start();
+}
+
+void AppModel::handlePrepareLaunchTimeout()
+{
+    m_LastPrepareTimer.start();
+    Session::prepareLaunch(m_Computer);
+}
+
 int AppModel::rowCount(const QModelIndex &parent) const
 {
     // For list models only the root node (an invalid parent) should return the list's size. For all
@@ -76,15 +109,36 @@ QVariant AppModel::data(const QModelIndex &index, int role) const
     case NameRole:
         return app.name;
     case RunningRole:
-        return m_Computer->currentGameId == app.id;
+        return m_CurrentGameId == app.id;
     case BoxArtRole:
-        // FIXME: const-correctness
-        return const_cast<BoxArtManager&>(m_BoxArtManager).loadBoxArt(m_Computer, app);
+        return getBoxArtUrl(app);
     default:
         return QVariant();
     }
 }
 
+QUrl AppModel::getBoxArtUrl(NvApp& app) const
+{
+    // The view asks again every time a delegate is created, which is
+    // constantly while a large grid scrolls, so the cache file is only
+    // looked for the first time
+    auto it = m_BoxArtUrls.constFind(app.id);
+    if (it != m_BoxArtUrls.constEnd()) {
+        return it.value();
+    }
+
+    // FIXME: const-correctness
+    QUrl url = const_cast<BoxArtManager&>(m_BoxArtManager).loadBoxArt(m_Computer, app);
+
+    // The placeholder isn't kept, so a failed fetch is tried again
+    // the next time the app scrolls into view
+    if (url.scheme() == "image") {
+        m_BoxArtUrls.insert(app.id, url);
+    }
+
+    return url;
+}
+
 QHash<int, QByteArray> AppModel::roleNames() const
 {
     QHash<int, QByteArray> names;
@@ -101,6 +155,21 @@ void AppModel::quitRunningApp()
     m_ComputerManager->quitRunningApp(m_Computer);
 }
 
+void AppModel::setBoxArtVisible(int appIndex, bool visible)
+{
+    // Delegates may outlive their app after a list change
+    if (appIndex >= 0 && appIndex < m_Apps.count()) {
+        m_BoxArtManager.setBoxArtVisible(m_Computer, m_Apps[appIndex], visible);
+    }
+}
+
+void AppModel::cancelBoxArt(int appIndex)
+{
+    if (appIndex >= 0 && appIndex < m_Apps.count()) {
+        m_BoxArtManager.cancelBoxArt(m_Computer, m_Apps[appIndex]);
+    }
+}
+
 void AppModel::handleComputerStateChanged(NvComputer* computer)
 {
     // Ignore updates for computers that aren't ours
@@ -108,56 +177,101 @@ void AppModel::handleComputerStateChanged(NvComputer* computer)
         return;
     }
 
+    QSharedPointer<const NvComputerSnapshot> snapshot = computer->getSnapshot();
+
     // If the computer has gone offline or we've been unpaired,
     // signal the UI so we can go back to the PC view.
-    if (m_Computer->state == NvComputer::CS_OFFLINE ||
-            m_Computer->pairState == NvComputer::PS_NOT_PAIRED) {
+    if (snapshot->state == NvComputer::CS_OFFLINE ||
+            snapshot->pairState == NvComputer::PS_NOT_PAIRED) {
         emit computerLost();
         return;
     }
 
+    int changes = snapshot->changesSince(*m_Snapshot);
+    m_Snapshot = snapshot;
+
     // First, process additions/removals from the app list. This
     // is required because the new game may now be running, so
-    // we can't check that first.
-    if (computer->appList != m_Apps) {
-        // Just reset the whole thing if the list changes
-        beginResetModel();
-        m_Apps = computer->appList;
-        m_CurrentGameId = computer->currentGameId;
-        endResetModel();
-        return;
+    // we can't check that first. Most polls don't touch the list,
+    // so it's only walked when it changed.
+    if (changes & NvComputer::CF_APP_LIST) {
+        updateAppList(snapshot->appList);
     }
 
     // Finally, process changes to the active app
-    if (computer->currentGameId != m_CurrentGameId) {
-        // First, invalidate the running state of newly running game
+    if ((changes & NvComputer::CF_CURRENT_GAME) && snapshot->currentGameId != m_CurrentGameId) {
+        // Update our internal state first, since the view
+        // reads it back while handling dataChanged()
+        int oldGameId = m_CurrentGameId;
+        m_CurrentGameId = snapshot->currentGameId;
+
+        // Invalidate the running state of the newly running game
+        // and the old game (if they exist)
         for (int i = 0; i < m_Apps.count(); i++) {
-            if (m_Apps[i].id == computer->currentGameId) {
+            if ((m_Apps[i].id == m_CurrentGameId || m_Apps[i].id == oldGameId) && m_Apps[i].id != 0) {
                 emit dataChanged(createIndex(i, 0),
                                  createIndex(i, 0),
                                  QVector<int>() << RunningRole);
-                break;
             }
         }
+    }
+}
 
-        // Next, invalidate the running state of the old game (if it exists)
-        if (m_CurrentGameId != 0) {
-            for (int i = 0; i < m_Apps.count(); i++) {
-                if (m_Apps[i].id == m_CurrentGameId) {
-                    emit dataChanged(createIndex(i, 0),
-                                     createIndex(i, 0),
-                                     QVector<int>() << RunningRole);
-                    break;
-                }
-            }
+void AppModel::updateAppList(const QVector<NvApp>& newList)
+{
+    // Apply only the differences, so the view keeps its position
+    // and delegates for apps that are still there. Apps are matched
+    // by ID, so a renamed app stays the same row.
+    for (int i = m_Apps.count() - 1; i >= 0; i--) {
+        if (!newList.contains(m_Apps[i])) {
+            m_BoxArtUrls.remove(m_Apps[i].id);
+            beginRemoveRows(QModelIndex(), i, i);
+            m_Apps.remove(i);
+            endRemoveRows();
+        }
+    }
+
+    for (int i = 0; i < newList.count(); i++) {
+        if (i < m_Apps.count() && m_Apps[i] == newList[i]) {
+            continue;
+        }
+
+        int oldIndex = m_Apps.indexOf(newList[i], i);
+        if (oldIndex >= 0) {
+            // A rename moved it in the sorted list
+            beginMoveRows(QModelIndex(), oldIndex, oldIndex, QModelIndex(), i);
+            m_Apps.move(oldIndex, i);
+            endMoveRows();
         }
+        else {
+            beginInsertRows(QModelIndex(), i, i);
+            m_Apps.insert(i, newList[i]);
+            endInsertRows();
+        }
+    }
+
+    Q_ASSERT(m_Apps.count() == newList.count());
 
-        // Now update our internal state
-        m_CurrentGameId = m_Computer->currentGameId;
+    for (int i = 0; i < m_Apps.count(); i++) {
+        if (m_Apps[i].name != newList[i].name) {
+            // The box art of a renamed app is fetched again, since the
+            // host may have swapped the game behind its ID
+            m_Apps[i] = newList[i];
+            m_BoxArtUrls.remove(m_Apps[i].id);
+            emit dataChanged(createIndex(i, 0),
+                             createIndex(i, 0),
+                             QVector<int>() << NameRole << BoxArtRole);
+        }
+        else if (m_Apps[i].hdrSupported != newList[i].hdrSupported) {
+            m_Apps[i] = newList[i];
+            emit dataChanged(createIndex(i, 0),
+                             createIndex(i, 0),
+                             QVector<int>() << NameRole);
+        }
     }
 }
 
-void AppModel::handleBoxArtLoaded(NvComputer* computer, NvApp app, QUrl /* image */)
+void AppModel::handleBoxArtLoaded(NvComputer* computer, NvApp app, QUrl image)
 {
     Q_ASSERT(computer == m_Computer);
 
@@ -165,6 +279,8 @@ void AppModel::handleBoxArtLoaded(NvComputer* computer, NvApp app, QUrl /* image
 
     // Make sure we're not delivering a callback to an app that's already been removed
     if (index >= 0) {
+        m_BoxArtUrls.insert(app.id, image);
+
         // Let our view know the box art data has changed for this app
         emit dataChanged(createIndex(index, 0),
                          createIndex(index, 0),
@@ -5,6 +5,8 @@
 #include "streaming/session.h"
 
 #include <QAbstractListModel>
+#include <QElapsedTimer>
+#include <QTimer>
 
 class AppModel : public QAbstractListModel
 {
@@ -31,6 +33,15 @@ public:
 
     Q_INVOKABLE void quitRunningApp();
 
+    // Called by the AppView delegates as they scroll in and out of view
+    Q_INVOKABLE void setBoxArtVisible(int appIndex, bool visible);
+
+    Q_INVOKABLE void cancelBoxArt(int appIndex);
+
+    // Called when a tile is focused or hovered, since it's likely to be
+    // launched next. Tiles the user only passes over don't start anything.
+    Q_INVOKABLE void prepareLaunch(int appIndex);
+
     QVariant data(const QModelIndex &index, int role) const override;
 
     int rowCount(const QModelIndex &parent) const override;
@@ -42,13 +53,28 @@ private slots:
 
     void handleBoxArtLoaded(NvComputer* computer, NvApp app, QUrl image);
 
+    void handlePrepareLaunchTimeout();
+
 signals:
     void computerLost();
 
 private:
+    void updateAppList(const QVector<NvApp>& newList);
+
+    QUrl getBoxArtUrl(NvApp& app) const;
+
     NvComputer* m_Computer;
     BoxArtManager m_BoxArtManager;
     ComputerManager* m_ComputerManager;
     QVector<NvApp> m_Apps;
+
+    // Box art URLs by app ID, so scrolling doesn't touch the disk
+    mutable QHash<int, QUrl> m_BoxArtUrls;
     int m_CurrentGameId;
+
+    // The last snapshot we applied, to tell what changed in the next one
+    QSharedPointer<const NvComputerSnapshot> m_Snapshot;
+
+    QTimer m_PrepareLaunchTimer;
+    QElapsedTimer m_LastPrepareTimer;
 };
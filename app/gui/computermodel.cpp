@@ -1,7 +1,5 @@
 #include "computermodel.h"
 
-#include <QThreadPool>
-
 ComputerModel::ComputerModel(QObject* object)
     : QAbstractListModel(object) {}
 
@@ -13,7 +11,17 @@ void ComputerModel::initialize(ComputerManager* computerManager)
     connect(m_ComputerManager, &ComputerManager::pairingCompleted,
             this, &ComputerModel::handlePairingCompleted);
 
+    loadComputers();
+}
+
+void ComputerModel::loadComputers()
+{
     m_Computers = m_ComputerManager->getComputers();
+
+    m_Snapshots.clear();
+    for (NvComputer* computer : m_Computers) {
+        m_Snapshots.append(computer->getSnapshot());
+    }
 }
 
 QVariant ComputerModel::data(const QModelIndex& index, int role) const
@@ -24,8 +32,7 @@ QVariant ComputerModel::data(const QModelIndex& index, int role) const
 
     Q_ASSERT(index.row() < m_Computers.count());
 
-    NvComputer* computer = m_Computers[index.row()];
-    QReadLocker lock(&computer->lock);
+    const NvComputerSnapshot* computer = m_Snapshots[index.row()].data();
 
     switch (role) {
     case NameRole:
@@ -37,7 +44,7 @@ QVariant ComputerModel::data(const QModelIndex& index, int role) const
     case BusyRole:
         return computer->currentGameId != 0;
     case WakeableRole:
-        return !computer->macAddress.isEmpty();
+        return computer->wakeable;
     case StatusUnknownRole:
         return computer->state == NvComputer::CS_UNKNOWN;
     default:
@@ -75,12 +82,13 @@ Session* ComputerModel::createSessionForCurrentGame(int computerIndex)
     Q_ASSERT(computerIndex < m_Computers.count());
 
     NvComputer* computer = m_Computers[computerIndex];
+    QSharedPointer<const NvComputerSnapshot> snapshot = m_Snapshots[computerIndex];
 
     // We must currently be streaming a game to use this function
-    Q_ASSERT(computer->currentGameId != 0);
+    Q_ASSERT(snapshot->currentGameId != 0);
 
-    for (NvApp& app : computer->appList) {
-        if (app.id == computer->currentGameId) {
+    for (NvApp app : snapshot->appList) {
+        if (app.id == snapshot->currentGameId) {
             return new Session(computer, app);
         }
     }
@@ -101,31 +109,16 @@ void ComputerModel::deleteComputer(int computerIndex)
 
     // Remove the now invalid item
     m_Computers.removeAt(computerIndex);
+    m_Snapshots.removeAt(computerIndex);
 
     endRemoveRows();
 }
 
-class DeferredWakeHostTask : public QRunnable
-{
-public:
-    DeferredWakeHostTask(NvComputer* computer)
-        : m_Computer(computer) {}
-
-    void run()
-    {
-        m_Computer->wake();
-    }
-
-private:
-    NvComputer* m_Computer;
-};
-
 void ComputerModel::wakeComputer(int computerIndex)
 {
     Q_ASSERT(computerIndex < m_Computers.count());
 
-    DeferredWakeHostTask* wakeTask = new DeferredWakeHostTask(m_Computers[computerIndex]);
-    QThreadPool::globalInstance()->start(wakeTask);
+    m_ComputerManager->wakeHost(m_Computers[computerIndex]);
 }
 
 void ComputerModel::pairComputer(int computerIndex, QString pin)
@@ -145,15 +138,44 @@ void ComputerModel::handleComputerStateChanged(NvComputer* computer)
     // If this is an existing computer, we can report the data changed
     int index = m_Computers.indexOf(computer);
     if (index >= 0) {
-        // Let the view know that this specific computer changed
-        emit dataChanged(createIndex(index, 0), createIndex(index, 0));
+        QSharedPointer<const NvComputerSnapshot> snapshot = computer->getSnapshot();
+        if (snapshot == m_Snapshots[index]) {
+            // We already have this one
+            return;
+        }
+
+        // Let the view know which of this computer's roles changed, so
+        // its delegate doesn't re-evaluate the rest on every poll
+        int changes = snapshot->changesSince(*m_Snapshots[index]);
+        m_Snapshots[index] = snapshot;
+
+        QVector<int> roles;
+        if (changes & NvComputer::CF_NAME) {
+            roles << NameRole;
+        }
+        if (changes & NvComputer::CF_STATE) {
+            roles << OnlineRole << StatusUnknownRole;
+        }
+        if (changes & NvComputer::CF_PAIR_STATE) {
+            roles << PairedRole;
+        }
+        if (changes & NvComputer::CF_CURRENT_GAME) {
+            roles << BusyRole;
+        }
+        if (changes & NvComputer::CF_MAC_ADDRESS) {
+            roles << WakeableRole;
+        }
+
+        if (!roles.isEmpty()) {
+            emit dataChanged(createIndex(index, 0), createIndex(index, 0), roles);
+        }
     }
     else {
         // This is a new PC which may be inserted at an arbitrary point
         // in our computer list (since it comes from CM's QMap). Reload
         // the whole model state to ensure it stays consistent.
         beginResetModel();
-        m_Computers = m_ComputerManager->getComputers();
+        loadComputers();
         endResetModel();
     }
 }
@@ -46,6 +46,11 @@ private slots:
     void handlePairingCompleted(NvComputer* computer, QString error);
 
 private:
+    void loadComputers();
+
     QVector<NvComputer*> m_Computers;
+
+    // Read by data() in place of the computers themselves
+    QVector<QSharedPointer<const NvComputerSnapshot>> m_Snapshots;
     ComputerManager* m_ComputerManager;
 };
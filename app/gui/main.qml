@@ -120,6 +120,10 @@ ApplicationWindow {
 
     property bool initialized: false
 
+    // Emitted once the first frame is up. Anything the first view
+    // doesn't need to draw itself waits for this.
+    signal startupCompleted()
+
     // BUG: Using onAfterSynchronizing: here causes very strange
     // failures on Linux. Many shaders fail to compile and we
     // eventually segfault deep inside the Qt OpenGL code.
@@ -150,6 +154,11 @@ ApplicationWindow {
                 unmappedGamepadDialog.unmappedGamepads = SystemProperties.unmappedGamepads
                 unmappedGamepadDialog.open()
             }
+
+            AutoUpdateChecker.onUpdateAvailable.connect(updateButton.updateAvailable)
+            AutoUpdateChecker.start()
+
+            startupCompleted()
         }
     }
 
@@ -254,11 +263,6 @@ ApplicationWindow {
                     updateButton.visible = true
                 }
 
-                Component.onCompleted: {
-                    AutoUpdateChecker.onUpdateAvailable.connect(updateAvailable)
-                    AutoUpdateChecker.start()
-                }
-
                 Keys.onDownPressed: {
                     stackView.currentItem.forceActiveFocus(Qt.TabFocus)
                 }
@@ -8,6 +8,12 @@
 
 #define AXIS_NAVIGATION_REPEAT_DELAY 150
 
+// While a gamepad is attached, we poll quickly enough that a button press
+// gets to the UI within a frame. Otherwise, we only need to notice a
+// gamepad being plugged in, so we wake up far less often.
+#define ACTIVE_POLLING_INTERVAL_MS 16
+#define IDLE_POLLING_INTERVAL_MS 1000
+
 SdlGamepadKeyNavigation::SdlGamepadKeyNavigation()
     : m_Enabled(false),
       m_UiNavMode(false),
@@ -61,10 +67,9 @@ void SdlGamepadKeyNavigation::enable()
         }
     }
 
-    // Poll every 50 ms for a new joystick event
-    m_PollingTimer->start(50);
-
     m_Enabled = true;
+
+    updatePollingInterval();
 }
 
 void SdlGamepadKeyNavigation::disable()
@@ -155,9 +160,23 @@ void SdlGamepadKeyNavigation::onPollingTimerFired()
             break;
         }
         case SDL_CONTROLLERDEVICEADDED:
+        {
             SDL_GameController* gc = SDL_GameControllerOpen(event.cdevice.which);
             if (gc != nullptr) {
                 m_Gamepads.append(gc);
+                updatePollingInterval();
+            }
+            break;
+        }
+        case SDL_CONTROLLERDEVICEREMOVED:
+            for (int i = 0; i < m_Gamepads.count(); i++) {
+                SDL_Joystick* joystick = SDL_GameControllerGetJoystick(m_Gamepads[i]);
+                if (SDL_JoystickInstanceID(joystick) == event.cdevice.which) {
+                    SDL_GameControllerClose(m_Gamepads[i]);
+                    m_Gamepads.removeAt(i);
+                    updatePollingInterval();
+                    break;
+                }
             }
             break;
         }
@@ -208,6 +227,18 @@ void SdlGamepadKeyNavigation::onPollingTimerFired()
     }
 }
 
+void SdlGamepadKeyNavigation::updatePollingInterval()
+{
+    if (!m_Enabled) {
+        return;
+    }
+
+    int interval = m_Gamepads.isEmpty() ? IDLE_POLLING_INTERVAL_MS : ACTIVE_POLLING_INTERVAL_MS;
+    if (!m_PollingTimer->isActive() || m_PollingTimer->interval() != interval) {
+        m_PollingTimer->start(interval);
+    }
+}
+
 void SdlGamepadKeyNavigation::sendKey(QEvent::Type type, Qt::Key key, Qt::KeyboardModifiers modifiers)
 {
     QGuiApplication* app = static_cast<QGuiApplication*>(QGuiApplication::instance());
@@ -25,6 +25,8 @@ public:
 private:
     void sendKey(QEvent::Type type, Qt::Key key, Qt::KeyboardModifiers modifiers = Qt::NoModifier);
 
+    void updatePollingInterval();
+
 private slots:
     void onPollingTimerFired();
 
@@ -9,6 +9,8 @@
 #include <QPalette>
 #include <QFont>
 #include <QCursor>
+#include <QElapsedTimer>
+#include <QQuickWindow>
 
 // Don't let SDL hook our main function, since Qt is already
 // doing the same thing. This needs to be before any headers
@@ -25,14 +27,21 @@
 #endif
 
 #include "cli/quitstream.h"
+#include "cli/benchmark.h"
 #include "cli/startstream.h"
+#include "cli/headlessstream.h"
+#include "cli/daemon.h"
 #include "cli/commandlineparser.h"
 #include "path.h"
 #include "gui/computermodel.h"
 #include "gui/appmodel.h"
+#include "backend/boxartmanager.h"
 #include "backend/autoupdatechecker.h"
+#include "backend/identitymanager.h"
 #include "backend/systemproperties.h"
 #include "streaming/session.h"
+#include "streaming/cpudispatch.h"
+#include "streaming/sessionhistory.h"
 #include "settings/streamingpreferences.h"
 #include "gui/sdlgamepadkeynavigation.h"
 
@@ -62,10 +71,36 @@ static bool s_LogLimitReached = false;
 static QFile* s_LoggerFile;
 #endif
 
-void logToLoggerStream(QString& message)
-{
-    QMutexLocker lock(&s_LoggerLock);
+// Messages are handed to a writer thread through this ring, so a thread
+// that logs never waits on the file or the console. Must be a power of 2.
+#define LOG_RING_SLOTS 512
+
+// Longer messages are written by the logging thread itself
+#define LOG_RING_MESSAGE_SIZE 512
 
+struct LogRingSlot
+{
+    // Equal to the slot's position when it's free and one past it once
+    // its message has been published
+    SDL_atomic_t sequence;
+    int length;
+    char message[LOG_RING_MESSAGE_SIZE];
+};
+
+static LogRingSlot s_LogRing[LOG_RING_SLOTS];
+static SDL_atomic_t s_LogRingHead;
+static SDL_atomic_t s_LogRingDropped;
+
+// Only read with s_LoggerLock held
+static Uint32 s_LogRingTail;
+
+static SDL_Thread* s_LogWriterThread;
+static SDL_sem* s_LogWriterSemaphore;
+static SDL_atomic_t s_LogWriterStopping;
+
+// s_LoggerLock must be held
+static void writeLogMessage(const QString& message)
+{
 #ifdef LOG_TO_FILE
     if (s_LogLimitReached) {
         return;
@@ -81,6 +116,129 @@ void logToLoggerStream(QString& message)
 #endif
 
     s_LoggerStream << message;
+}
+
+// s_LoggerLock must be held, which makes the holder the ring's only reader
+static void drainLogRing()
+{
+    for (;;) {
+        LogRingSlot* slot = &s_LogRing[s_LogRingTail & (LOG_RING_SLOTS - 1)];
+        if ((Uint32)SDL_AtomicGet(&slot->sequence) != s_LogRingTail + 1) {
+            break;
+        }
+
+        writeLogMessage(QString::fromUtf8(slot->message, slot->length));
+
+        // Free the slot for the writer's next lap around the ring
+        SDL_AtomicSet(&slot->sequence, (int)(s_LogRingTail + LOG_RING_SLOTS));
+        s_LogRingTail++;
+    }
+
+    int dropped = SDL_AtomicSet(&s_LogRingDropped, 0);
+    if (dropped != 0) {
+        writeLogMessage(QString("%1 log messages dropped\n").arg(dropped));
+    }
+}
+
+static bool enqueueLogMessage(const QByteArray& message)
+{
+    if (message.size() > LOG_RING_MESSAGE_SIZE) {
+        return false;
+    }
+
+    Uint32 head = (Uint32)SDL_AtomicGet(&s_LogRingHead);
+    LogRingSlot* slot;
+    for (;;) {
+        slot = &s_LogRing[head & (LOG_RING_SLOTS - 1)];
+        Uint32 sequence = (Uint32)SDL_AtomicGet(&slot->sequence);
+        if (sequence == head) {
+            if (SDL_AtomicCAS(&s_LogRingHead, (int)head, (int)(head + 1))) {
+                break;
+            }
+        }
+        else if ((Sint32)(sequence - head) < 0) {
+            // The writer is a whole ring behind. Dropping the message is
+            // better than stalling a streaming thread on it.
+            SDL_AtomicIncRef(&s_LogRingDropped);
+            return true;
+        }
+
+        head = (Uint32)SDL_AtomicGet(&s_LogRingHead);
+    }
+
+    SDL_memcpy(slot->message, message.constData(), message.size());
+    slot->length = message.size();
+    SDL_AtomicSet(&slot->sequence, (int)(head + 1));
+
+    SDL_SemPost(s_LogWriterSemaphore);
+    return true;
+}
+
+static int logWriterThreadProc(void*)
+{
+    while (SDL_AtomicGet(&s_LogWriterStopping) == 0) {
+        SDL_SemWait(s_LogWriterSemaphore);
+
+        // Each message posts once, and all of them are handled together
+        while (SDL_SemTryWait(s_LogWriterSemaphore) == 0);
+
+        QMutexLocker lock(&s_LoggerLock);
+        drainLogRing();
+        s_LoggerStream.flush();
+    }
+
+    return 0;
+}
+
+static void stopLogWriter()
+{
+    SDL_AtomicSet(&s_LogWriterStopping, 1);
+    SDL_SemPost(s_LogWriterSemaphore);
+    SDL_WaitThread(s_LogWriterThread, nullptr);
+    s_LogWriterThread = nullptr;
+
+    // Write anything queued after the writer's last pass
+    QMutexLocker lock(&s_LoggerLock);
+    drainLogRing();
+    s_LoggerStream.flush();
+}
+
+static void startLogWriter()
+{
+    for (int i = 0; i < LOG_RING_SLOTS; i++) {
+        SDL_AtomicSet(&s_LogRing[i].sequence, i);
+    }
+
+    s_LogWriterSemaphore = SDL_CreateSemaphore(0);
+    if (s_LogWriterSemaphore == nullptr) {
+        return;
+    }
+
+    s_LogWriterThread = SDL_CreateThread(logWriterThreadProc, "LogWriter", nullptr);
+    if (s_LogWriterThread == nullptr) {
+        SDL_DestroySemaphore(s_LogWriterSemaphore);
+        s_LogWriterSemaphore = nullptr;
+        return;
+    }
+
+    // Every exit from main() goes through here before the stream is destroyed
+    atexit(stopLogWriter);
+}
+
+// Messages that may be followed by the process dying are written before
+// returning, along with everything queued ahead of them
+void logToLoggerStream(QString& message, bool synchronous = false)
+{
+    if (!synchronous && s_LogWriterThread != nullptr &&
+            SDL_AtomicGet(&s_LogWriterStopping) == 0 &&
+            enqueueLogMessage(message.toUtf8())) {
+        return;
+    }
+
+    QMutexLocker lock(&s_LoggerLock);
+
+    drainLogRing();
+    writeLogMessage(message);
     s_LoggerStream.flush();
 }
 
@@ -115,7 +273,7 @@ void sdlLogToDiskHandler(void*, int category, SDL_LogPriority priority, const ch
     QTime logTime = QTime::fromMSecsSinceStartOfDay(s_LoggerTime.elapsed());
     QString txt = QString("%1 - SDL %2 (%3): %4\n").arg(logTime.toString()).arg(priorityTxt).arg(category).arg(message);
 
-    logToLoggerStream(txt);
+    logToLoggerStream(txt, priority == SDL_LOG_PRIORITY_CRITICAL);
 }
 
 void qtLogToDiskHandler(QtMsgType type, const QMessageLogContext&, const QString& msg)
@@ -143,7 +301,7 @@ void qtLogToDiskHandler(QtMsgType type, const QMessageLogContext&, const QString
     QTime logTime = QTime::fromMSecsSinceStartOfDay(s_LoggerTime.elapsed());
     QString txt = QString("%1 - Qt %2: %3\n").arg(logTime.toString()).arg(typeTxt).arg(msg);
 
-    logToLoggerStream(txt);
+    logToLoggerStream(txt, type == QtCriticalMsg || type == QtFatalMsg);
 }
 
 #ifdef HAVE_FFMPEG
@@ -227,6 +385,10 @@ LONG WINAPI UnhandledExceptionHandler(struct _EXCEPTION_POINTERS *ExceptionInfo)
 
 int main(int argc, char *argv[])
 {
+    // Measures how long it takes to get the first frame of the UI on screen
+    QElapsedTimer startupTimer;
+    startupTimer.start();
+
     SDL_SetMainReady();
 
     // Set the app version for the QCommandLineParser's showVersion() command
@@ -239,6 +401,16 @@ int main(int argc, char *argv[])
     QCoreApplication::setOrganizationDomain("moonlight-stream.com");
     QCoreApplication::setApplicationName("Moonlight");
 
+    // Headless streams must be known before logging and the platform are
+    // set up, which is before the command line is parsed for real
+    bool headless = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--headless") == 0) {
+            headless = true;
+            break;
+        }
+    }
+
     if (QFile(QDir::currentPath() + "/portable.dat").exists()) {
         qInfo() << "Running in portable mode from:" << QDir::currentPath();
         QSettings::setDefaultFormat(QSettings::IniFormat);
@@ -256,14 +428,29 @@ int main(int argc, char *argv[])
 #ifdef USE_CUSTOM_LOGGER
 #ifdef LOG_TO_FILE
     QDir tempDir(Path::getLogDir());
-    s_LoggerFile = new QFile(tempDir.filePath(QString("Moonlight-%1.log").arg(QDateTime::currentSecsSinceEpoch())));
+    // Clients started together for several hosts each get their own log
+    s_LoggerFile = new QFile(tempDir.filePath(QString("Moonlight-%1-%2.log")
+                                              .arg(QDateTime::currentSecsSinceEpoch())
+                                              .arg(QCoreApplication::applicationPid())));
     if (s_LoggerFile->open(QIODevice::WriteOnly)) {
         qInfo() << "Redirecting log output to " << s_LoggerFile->fileName();
         s_LoggerStream.setDevice(s_LoggerFile);
     }
+#else
+    if (headless) {
+        // Keep stdout for the stats summary
+        QFile* stderrFile = new QFile();
+        if (stderrFile->open(stderr, QIODevice::WriteOnly)) {
+            s_LoggerStream.setDevice(stderrFile);
+        }
+        else {
+            delete stderrFile;
+        }
+    }
 #endif
 
     s_LoggerTime.start();
+    startLogWriter();
     qInstallMessageHandler(qtLogToDiskHandler);
     SDL_LogSetOutputFunction(sdlLogToDiskHandler, nullptr);
 
@@ -299,6 +486,14 @@ int main(int argc, char *argv[])
     }
 #endif
 
+    if (headless) {
+        // Nothing is ever shown or played, and the machine running
+        // the stream may not have a display or audio device at all
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+        qputenv("SDL_VIDEODRIVER", "dummy");
+        qputenv("SDL_AUDIODRIVER", "dummy");
+    }
+
     // We don't want system proxies to apply to us
     QNetworkProxyFactory::setUseSystemConfiguration(false);
 
@@ -326,6 +521,9 @@ int main(int argc, char *argv[])
     // initializing the SDL video subsystem to have any effect.
     SDL_SetHint(SDL_HINT_VIDEO_ALLOW_SCREENSAVER, "1");
 
+    // Pick the SIMD kernels before anything can use them
+    CpuDispatch::initialize();
+
     if (SDL_InitSubSystem(SDL_INIT_TIMER) != 0) {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
                      "SDL_InitSubSystem(SDL_INIT_TIMER) failed: %s",
@@ -450,6 +648,8 @@ int main(int argc, char *argv[])
 
     QQmlApplicationEngine engine;
     QString initialView;
+    CliHeadlessStream::Runner* headlessRunner = nullptr;
+    CliDaemon::Server* daemon = nullptr;
 
     GlobalCommandLineParser parser;
     switch (parser.parse(app.arguments())) {
@@ -465,6 +665,16 @@ int main(int argc, char *argv[])
             QString host    = streamParser.getHost();
             QString appName = streamParser.getAppName();
             auto launcher   = new CliStartStream::Launcher(host, appName, preferences, &app);
+            launcher->setStartupProfilePath(streamParser.getStartupProfilePath());
+            launcher->setWindowGeometry(streamParser.getWindowGeometry());
+            if (streamParser.isHeadless()) {
+                Session::setHeadless(streamParser.isHeadlessVideoDiscarded(),
+                                     streamParser.getInputRate());
+                headlessRunner = new CliHeadlessStream::Runner(launcher, host, appName,
+                                                               streamParser.getDurationSecs(),
+                                                               streamParser.getStatsPath(),
+                                                               &app);
+            }
             engine.rootContext()->setContextProperty("launcher", launcher);
             break;
         }
@@ -477,17 +687,103 @@ int main(int argc, char *argv[])
             engine.rootContext()->setContextProperty("launcher", launcher);
             break;
         }
+    case GlobalCommandLineParser::BenchmarkRequested:
+        {
+            // The benchmark runs without the UI
+            BenchmarkCommandLineParser benchmarkParser;
+            benchmarkParser.parse(app.arguments());
+            if (!benchmarkParser.getServerInfoPath().isEmpty()) {
+                return CliBenchmark::runServerInfoBenchmark(benchmarkParser.getServerInfoPath());
+            }
+            else if (benchmarkParser.isFec()) {
+                return CliBenchmark::runFecBenchmark();
+            }
+            else if (benchmarkParser.isMicro()) {
+                return CliBenchmark::runMicrobenchmarks();
+            }
+
+            CliBenchmark::Runner runner(benchmarkParser.getCapturePath(),
+                                        benchmarkParser.isRealtime(),
+                                        benchmarkParser.getDecoders(),
+                                        benchmarkParser.getLossPercent(),
+                                        benchmarkParser.getJitterMs(),
+                                        benchmarkParser.getRatePercent());
+            return runner.run();
+        }
+    case GlobalCommandLineParser::HistoryRequested:
+        {
+            HistoryCommandLineParser historyParser;
+            historyParser.parse(app.arguments());
+            return SessionHistory::print(historyParser.getHost(), historyParser.getLimit());
+        }
+    case GlobalCommandLineParser::DaemonRequested:
+        {
+            DaemonCommandLineParser daemonParser;
+            daemonParser.parse(app.arguments());
+            daemon = new CliDaemon::Server(daemonParser.getSocketName(), &app);
+            break;
+        }
+    }
+
+    // Generating the identity on first launch takes a while, so get it
+    // started before the first request to a host needs it
+    IdentityManager::prepareAsync();
+
+    if (headlessRunner != nullptr) {
+        // Headless streams run without loading the UI
+        headlessRunner->start(new ComputerManager(&app));
+        int err = app.exec();
+
+        Session::releaseWarmVideo();
+        QThreadPool::globalInstance()->waitForDone(30000);
+        return err;
+    }
+
+    if (daemon != nullptr) {
+        // The daemon also runs without loading the UI
+        if (!daemon->start(new ComputerManager(&app))) {
+            return 1;
+        }
+        int err = app.exec();
+
+        Session::releaseWarmVideo();
+        QThreadPool::globalInstance()->waitForDone(30000);
+        return err;
     }
 
     engine.rootContext()->setContextProperty("initialView", initialView);
 
+    // The engine takes ownership of the provider
+    engine.addImageProvider("boxart", new BoxArtImageProvider());
+
     // Load the main.qml file
     engine.load(QUrl(QStringLiteral("qrc:/gui/main.qml")));
     if (engine.rootObjects().isEmpty())
         return -1;
 
+    QQuickWindow* mainWindow = qobject_cast<QQuickWindow*>(engine.rootObjects().first());
+    if (mainWindow != nullptr) {
+        // Set STARTUP_BENCHMARK=1 to exit once the first frame is up, so the
+        // startup time can be measured over many runs
+        bool exitAfterFirstFrame = qgetenv("STARTUP_BENCHMARK") == "1";
+        QMetaObject::Connection* firstFrameConnection = new QMetaObject::Connection();
+        *firstFrameConnection = QObject::connect(mainWindow, &QQuickWindow::frameSwapped, &app,
+                                                 [firstFrameConnection, startupTimer, exitAfterFirstFrame]() {
+            QObject::disconnect(*firstFrameConnection);
+            delete firstFrameConnection;
+
+            qInfo() << "First frame rendered after" << startupTimer.elapsed() << "ms";
+            if (exitAfterFirstFrame) {
+                QCoreApplication::quit();
+            }
+        }, Qt::QueuedConnection);
+    }
+
     int err = app.exec();
 
+    // Free the decoder device before SDL_Quit() closes the display it uses
+    Session::releaseWarmVideo();
+
     // Give worker tasks time to properly exit. Fixes PendingQuitTask
     // sometimes freezing and blocking process exit.
     QThreadPool::globalInstance()->waitForDone(30000);
@@ -8,6 +8,9 @@
 
 QString Path::s_LogDir;
 QString Path::s_BoxArtCacheDir;
+QString Path::s_RecordingDir;
+QString Path::s_ScreenshotDir;
+QString Path::s_SessionHistoryPath;
 
 QString Path::getLogDir()
 {
@@ -21,6 +24,24 @@ QString Path::getBoxArtCacheDir()
     return s_BoxArtCacheDir;
 }
 
+QString Path::getRecordingDir()
+{
+    Q_ASSERT(!s_RecordingDir.isEmpty());
+    return s_RecordingDir;
+}
+
+QString Path::getScreenshotDir()
+{
+    Q_ASSERT(!s_ScreenshotDir.isEmpty());
+    return s_ScreenshotDir;
+}
+
+QString Path::getSessionHistoryPath()
+{
+    Q_ASSERT(!s_SessionHistoryPath.isEmpty());
+    return s_SessionHistoryPath;
+}
+
 QByteArray Path::readDataFile(QString fileName)
 {
     QFile dataFile(getDataFilePath(fileName));
@@ -64,6 +85,9 @@ void Path::initialize(bool portable)
     if (portable) {
         s_LogDir = QDir::currentPath();
         s_BoxArtCacheDir = QDir::currentPath() + "/boxart";
+        s_RecordingDir = QDir::currentPath() + "/recordings";
+        s_ScreenshotDir = QDir::currentPath() + "/screenshots";
+        s_SessionHistoryPath = QDir::currentPath() + "/session-history.jsonl";
     }
     else {
 #ifdef Q_OS_DARWIN
@@ -74,5 +98,8 @@ void Path::initialize(bool portable)
         s_LogDir = QDir::tempPath();
 #endif
         s_BoxArtCacheDir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/boxart";
+        s_RecordingDir = QStandardPaths::writableLocation(QStandardPaths::MoviesLocation) + "/Moonlight";
+        s_ScreenshotDir = QStandardPaths::writableLocation(QStandardPaths::PicturesLocation) + "/Moonlight";
+        s_SessionHistoryPath = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/session-history.jsonl";
     }
 }
@@ -9,6 +9,15 @@ public:
 
     static QString getBoxArtCacheDir();
 
+    // Where stream recordings and replays are saved. It may not exist yet.
+    static QString getRecordingDir();
+
+    // Where screenshots of the stream are saved. It may not exist yet.
+    static QString getScreenshotDir();
+
+    // The append-only summary of past sessions. Its directory may not exist yet.
+    static QString getSessionHistoryPath();
+
     static QByteArray readDataFile(QString fileName);
 
     // Only safe to use directly for Qt classes
@@ -19,4 +28,7 @@ public:
 private:
     static QString s_LogDir;
     static QString s_BoxArtCacheDir;
+    static QString s_RecordingDir;
+    static QString s_ScreenshotDir;
+    static QString s_SessionHistoryPath;
 };
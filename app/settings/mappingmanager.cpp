@@ -10,8 +10,35 @@
 #define SER_GUID "guid"
 #define SER_MAPPING "mapping"
 
+QMutex MappingManager::s_Lock;
+bool MappingManager::s_Loaded;
+QMap<QString, SdlGamepadMapping> MappingManager::s_Mappings;
+QByteArray MappingManager::s_MergedMappings;
+int MappingManager::s_MergedMappingCount;
+
+// Returns the value of a mapping's platform field, or an empty string if
+// it applies to every platform
+static QByteArray getMappingPlatform(const QByteArray& mapping)
+{
+    int start = mapping.indexOf("platform:");
+    if (start < 0) {
+        return QByteArray();
+    }
+
+    start += (int)strlen("platform:");
+    int end = mapping.indexOf(',', start);
+    return mapping.mid(start, end < 0 ? -1 : end - start);
+}
+
 MappingManager::MappingManager()
 {
+    QMutexLocker lock(&s_Lock);
+
+    if (s_Loaded) {
+        m_Mappings = s_Mappings;
+        return;
+    }
+
     QSettings settings;
 
     // First load existing saved mappings. This ensures the user's
@@ -34,6 +61,9 @@ MappingManager::MappingManager()
 
     // Save the updated mappings to settings
     save();
+
+    s_Mappings = m_Mappings;
+    s_Loaded = true;
 }
 
 void MappingManager::save()
@@ -52,21 +82,30 @@ void MappingManager::save()
     settings.endArray();
 }
 
-void MappingManager::applyMappings()
+void MappingManager::buildMergedMappings(const QMap<QString, SdlGamepadMapping>& userMappings)
 {
+    QByteArray platform = SDL_GetPlatform();
+    QMap<QByteArray, QByteArray> mappings;
+    int lineCount = 0;
+
+    // SDL would skip the other platforms' mappings and replace a GUID's
+    // mapping with each later one, so leave both out up front
     QByteArray mappingData = Path::readDataFile("gamecontrollerdb.txt");
     if (!mappingData.isEmpty()) {
-        int newMappings = SDL_GameControllerAddMappingsFromRW(
-                    SDL_RWFromConstMem(mappingData.constData(), mappingData.size()), 1);
-        if (newMappings < 0) {
-            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                         "Error loading gamepad mappings: %s",
-                         SDL_GetError());
-        }
-        else {
-            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
-                        "Loaded %d new gamepad mappings",
-                        newMappings);
+        for (const QByteArray& line : mappingData.split('\n')) {
+            QByteArray mapping = line.trimmed();
+            if (mapping.isEmpty() || mapping.startsWith('#')) {
+                continue;
+            }
+
+            lineCount++;
+
+            QByteArray mappingPlatform = getMappingPlatform(mapping);
+            if (!mappingPlatform.isEmpty() && mappingPlatform != platform) {
+                continue;
+            }
+
+            mappings[mapping.left(mapping.indexOf(','))] = mapping;
         }
     }
     else {
@@ -74,21 +113,62 @@ void MappingManager::applyMappings()
                      "Unable to load gamepad mapping file");
     }
 
-    QList<SdlGamepadMapping> mappings = m_Mappings.values();
-    for (const SdlGamepadMapping& mapping : mappings) {
-        QString sdlMappingString = mapping.getSdlMappingString();
-        int ret = SDL_GameControllerAddMapping(qPrintable(sdlMappingString));
-        if (ret < 0) {
-            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
-                        "Unable to add mapping: %s",
-                        qPrintable(sdlMappingString));
+    // The user's mappings override the database
+    for (const SdlGamepadMapping& mapping : userMappings) {
+        QByteArray sdlMappingString = mapping.getSdlMappingString().toUtf8();
+        if (sdlMappingString.isEmpty()) {
+            continue;
         }
-        else if (ret == 1) {
-            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
-                        "Loaded saved user mapping: %s",
-                        qPrintable(sdlMappingString));
+
+        QByteArray mappingPlatform = getMappingPlatform(sdlMappingString);
+        if (!mappingPlatform.isEmpty() && mappingPlatform != platform) {
+            continue;
+        }
+
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Loaded saved user mapping: %s",
+                    sdlMappingString.constData());
+        mappings[mapping.getGuid().toUtf8()] = sdlMappingString;
+    }
+
+    s_MergedMappings.clear();
+    for (const QByteArray& mapping : mappings) {
+        s_MergedMappings += mapping;
+        s_MergedMappings += '\n';
+    }
+    s_MergedMappingCount = mappings.count();
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Merged %d gamepad mappings for %s from %d database lines and %d user mappings",
+                s_MergedMappingCount,
+                platform.constData(),
+                lineCount,
+                userMappings.count());
+}
+
+void MappingManager::applyMappings()
+{
+    QMutexLocker lock(&s_Lock);
+
+    if (s_MergedMappingCount == 0) {
+        buildMergedMappings(m_Mappings);
+        if (s_MergedMappingCount == 0) {
+            return;
         }
     }
+
+    int newMappings = SDL_GameControllerAddMappingsFromRW(
+                SDL_RWFromConstMem(s_MergedMappings.constData(), s_MergedMappings.size()), 1);
+    if (newMappings < 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Error loading gamepad mappings: %s",
+                     SDL_GetError());
+    }
+    else {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Loaded %d new gamepad mappings",
+                    newMappings);
+    }
 }
 
 void MappingManager::addMapping(QString mappingString)
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <QMutex>
 #include <QSettings>
 
 class SdlGamepadMapping
@@ -55,6 +56,10 @@ private:
     QString m_Mapping;
 };
 
+// The saved mappings and the bundled database are only read once per
+// process. The first applyMappings() merges them into one set of mapping
+// lines for this platform, with one line per GUID, which later calls hand
+// to SDL as is each time the game controller subsystem starts.
 class MappingManager
 {
 public:
@@ -69,6 +74,15 @@ public:
     void save();
 
 private:
+    // s_Lock must be held
+    static void buildMergedMappings(const QMap<QString, SdlGamepadMapping>& userMappings);
+
     QMap<QString, SdlGamepadMapping> m_Mappings;
+
+    static QMutex s_Lock;
+    static bool s_Loaded;
+    static QMap<QString, SdlGamepadMapping> s_Mappings;
+    static QByteArray s_MergedMappings;
+    static int s_MergedMappingCount;
 };
 
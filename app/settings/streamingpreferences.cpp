@@ -1,12 +1,18 @@
 #include "streamingpreferences.h"
 
+#include <QMetaProperty>
+#include <QMutex>
+#include <QRunnable>
 #include <QSettings>
+#include <QThreadPool>
 
 #define SER_STREAMSETTINGS "streamsettings"
 #define SER_WIDTH "width"
 #define SER_HEIGHT "height"
 #define SER_FPS "fps"
 #define SER_BITRATE "bitrate"
+#define SER_AUTOBITRATE "autobitrate"
+#define SER_AUTORESOLUTION "autoresolution"
 #define SER_FULLSCREEN "fullscreen"
 #define SER_VSYNC "vsync"
 #define SER_GAMEOPTS "gameopts"
@@ -25,16 +31,118 @@
 #define SER_CONNWARNINGS "connwarnings"
 #define SER_RICHPRESENCE "richpresence"
 #define SER_GAMEPADMOUSE "gamepadmouse"
+#define SER_ABSOLUTETOUCH "absolutetouch"
+#define SER_LOCALCURSOR "localcursor"
+#define SER_GAMEPADDEADZONE "gamepaddeadzone"
+#define SER_GAMEPADANTIDEADZONE "gamepadantideadzone"
+#define SER_GAMEPADCURVE "gamepadcurve"
+#define SER_PACINGMODE "pacingmode"
+#define SER_VRR "vrr"
+#define SER_SHARPENING "sharpening"
+#define SER_ERRORCONCEALMENT "errorconcealment"
+#define SER_POWERSAVING "powersaving"
+#define SER_REPLAYBUFFERSECS "replaybuffersecs"
+
+// Every key we keep, including ones only read to migrate old settings
+static const char* const k_Keys[] = {
+    SER_WIDTH,
+    SER_HEIGHT,
+    SER_FPS,
+    SER_BITRATE,
+    SER_AUTOBITRATE,
+    SER_AUTORESOLUTION,
+    SER_FULLSCREEN,
+    SER_VSYNC,
+    SER_GAMEOPTS,
+    SER_HOSTAUDIO,
+    SER_MULTICONT,
+    SER_AUDIOCFG,
+    SER_VIDEOCFG,
+    SER_VIDEODEC,
+    SER_WINDOWMODE,
+    SER_UNSUPPORTEDFPS,
+    SER_MDNS,
+    SER_QUITAPPAFTER,
+    SER_MOUSEACCELERATION,
+    SER_STARTWINDOWED,
+    SER_FRAMEPACING,
+    SER_CONNWARNINGS,
+    SER_RICHPRESENCE,
+    SER_GAMEPADMOUSE,
+    SER_ABSOLUTETOUCH,
+    SER_LOCALCURSOR,
+    SER_GAMEPADDEADZONE,
+    SER_GAMEPADANTIDEADZONE,
+    SER_GAMEPADCURVE,
+    SER_PACINGMODE,
+    SER_VRR,
+    SER_SHARPENING,
+    SER_ERRORCONCEALMENT,
+    SER_POWERSAVING,
+    SER_REPLAYBUFFERSECS,
+};
+
+// The stored preferences are read once and shared by every instance, so
+// creating one doesn't go back to the registry or property list. Saving
+// updates this copy right away and writes it out in the background.
+static QMutex s_CacheLock;
+static QVariantHash s_Cache;
+static bool s_CacheLoaded;
+static bool s_WritePending;
+static QList<StreamingPreferences*> s_Instances;
+
+class PreferencesWriteTask : public QRunnable
+{
+    void run() override
+    {
+        QVariantHash values;
+
+        // Anything saved after this point queues another write
+        s_CacheLock.lock();
+        values = s_Cache;
+        s_WritePending = false;
+        s_CacheLock.unlock();
+
+        QSettings settings;
+        for (auto it = values.constBegin(); it != values.constEnd(); ++it) {
+            settings.setValue(it.key(), it.value());
+        }
+    }
+};
 
 StreamingPreferences::StreamingPreferences(QObject *parent)
     : QObject(parent)
 {
     reload();
+
+    s_CacheLock.lock();
+    s_Instances.append(this);
+    s_CacheLock.unlock();
+}
+
+StreamingPreferences::~StreamingPreferences()
+{
+    s_CacheLock.lock();
+    s_Instances.removeOne(this);
+    s_CacheLock.unlock();
 }
 
 void StreamingPreferences::reload()
 {
-    QSettings settings;
+    QVariantHash settings;
+
+    s_CacheLock.lock();
+    if (!s_CacheLoaded) {
+        QSettings storedSettings;
+        for (const char* key : k_Keys) {
+            if (storedSettings.contains(key)) {
+                s_Cache.insert(key, storedSettings.value(key));
+            }
+        }
+        s_CacheLoaded = true;
+    }
+    settings = s_Cache;
+    s_CacheLock.unlock();
 
 #ifdef Q_OS_DARWIN
     recommendedFullScreenMode = WindowMode::WM_FULLSCREEN_DESKTOP;
@@ -46,6 +154,8 @@ void StreamingPreferences::reload()
     height = settings.value(SER_HEIGHT, 720).toInt();
     fps = settings.value(SER_FPS, 60).toInt();
     bitrateKbps = settings.value(SER_BITRATE, getDefaultBitrate(width, height, fps)).toInt();
+    autoBitrate = settings.value(SER_AUTOBITRATE, false).toBool();
+    autoResolution = settings.value(SER_AUTORESOLUTION, false).toBool();
     enableVsync = settings.value(SER_VSYNC, true).toBool();
     gameOptimizations = settings.value(SER_GAMEOPTS, true).toBool();
     playAudioOnHost = settings.value(SER_HOSTAUDIO, false).toBool();
@@ -59,6 +169,12 @@ void StreamingPreferences::reload()
     connectionWarnings = settings.value(SER_CONNWARNINGS, true).toBool();
     richPresence = settings.value(SER_RICHPRESENCE, true).toBool();
     gamepadMouse = settings.value(SER_GAMEPADMOUSE, true).toBool();
+    absoluteTouchMode = settings.value(SER_ABSOLUTETOUCH, false).toBool();
+    localCursor = settings.value(SER_LOCALCURSOR, false).toBool();
+    gamepadDeadzone = settings.value(SER_GAMEPADDEADZONE, 0).toInt();
+    gamepadAntiDeadzone = settings.value(SER_GAMEPADANTIDEADZONE, 0).toInt();
+    gamepadResponseCurve = static_cast<GamepadResponseCurve>(settings.value(SER_GAMEPADCURVE,
+                                                             static_cast<int>(GamepadResponseCurve::GRC_LINEAR)).toInt());
     audioConfig = static_cast<AudioConfig>(settings.value(SER_AUDIOCFG,
                                                   static_cast<int>(AudioConfig::AC_STEREO)).toInt());
     videoCodecConfig = static_cast<VideoCodecConfig>(settings.value(SER_VIDEOCFG,
@@ -69,33 +185,111 @@ void StreamingPreferences::reload()
                                                         // Try to load from the old preference value too
                                                         static_cast<int>(settings.value(SER_FULLSCREEN, true).toBool() ?
                                                                              recommendedFullScreenMode : WindowMode::WM_WINDOWED)).toInt());
+    pacingMode = static_cast<PacingMode>(settings.value(SER_PACINGMODE,
+                                                        static_cast<int>(PacingMode::PM_BALANCED)).toInt());
+    variableRefreshRate = settings.value(SER_VRR, false).toBool();
+    videoSharpening = settings.value(SER_SHARPENING, false).toBool();
+    errorConcealment = settings.value(SER_ERRORCONCEALMENT, false).toBool();
+    powerSaving = settings.value(SER_POWERSAVING, false).toBool();
+    replayBufferSecs = settings.value(SER_REPLAYBUFFERSECS, 0).toInt();
+
+    store(m_LoadedValues);
 }
 
 void StreamingPreferences::save()
 {
-    QSettings settings;
-
-    settings.setValue(SER_WIDTH, width);
-    settings.setValue(SER_HEIGHT, height);
-    settings.setValue(SER_FPS, fps);
-    settings.setValue(SER_BITRATE, bitrateKbps);
-    settings.setValue(SER_VSYNC, enableVsync);
-    settings.setValue(SER_GAMEOPTS, gameOptimizations);
-    settings.setValue(SER_HOSTAUDIO, playAudioOnHost);
-    settings.setValue(SER_MULTICONT, multiController);
-    settings.setValue(SER_UNSUPPORTEDFPS, unsupportedFps);
-    settings.setValue(SER_MDNS, enableMdns);
-    settings.setValue(SER_QUITAPPAFTER, quitAppAfter);
-    settings.setValue(SER_MOUSEACCELERATION, mouseAcceleration);
-    settings.setValue(SER_STARTWINDOWED, startWindowed);
-    settings.setValue(SER_FRAMEPACING, framePacing);
-    settings.setValue(SER_CONNWARNINGS, connectionWarnings);
-    settings.setValue(SER_RICHPRESENCE, richPresence);
-    settings.setValue(SER_GAMEPADMOUSE, gamepadMouse);
-    settings.setValue(SER_AUDIOCFG, static_cast<int>(audioConfig));
-    settings.setValue(SER_VIDEOCFG, static_cast<int>(videoCodecConfig));
-    settings.setValue(SER_VIDEODEC, static_cast<int>(videoDecoderSelection));
-    settings.setValue(SER_WINDOWMODE, static_cast<int>(windowMode));
+    QVariantHash values;
+    bool queueWrite;
+
+    store(values);
+    m_LoadedValues = values;
+
+    s_CacheLock.lock();
+    for (auto it = values.constBegin(); it != values.constEnd(); ++it) {
+        s_Cache.insert(it.key(), it.value());
+    }
+    queueWrite = !s_WritePending;
+    s_WritePending = true;
+    QList<StreamingPreferences*> instances = s_Instances;
+    s_CacheLock.unlock();
+
+    if (queueWrite) {
+        QThreadPool::globalInstance()->start(new PreferencesWriteTask());
+    }
+
+    for (StreamingPreferences* instance : instances) {
+        if (instance != this) {
+            instance->refresh();
+        }
+    }
+}
+
+void StreamingPreferences::refresh()
+{
+    QVariantHash current;
+
+    // Keep changes that were made to this instance without saving, like
+    // the command line's overrides
+    store(current);
+    if (current != m_LoadedValues) {
+        return;
+    }
+
+    const QMetaObject* metaObject = this->metaObject();
+    QVariantList oldValues;
+    for (int i = metaObject->propertyOffset(); i < metaObject->propertyCount(); i++) {
+        oldValues.append(metaObject->property(i).read(this));
+    }
+
+    reload();
+
+    for (int i = metaObject->propertyOffset(); i < metaObject->propertyCount(); i++) {
+        QMetaProperty property = metaObject->property(i);
+        if (property.hasNotifySignal() &&
+                property.read(this) != oldValues[i - metaObject->propertyOffset()]) {
+            property.notifySignal().invoke(this);
+        }
+    }
+}
+
+void StreamingPreferences::store(QVariantHash& settings)
+{
+    settings.clear();
+
+    settings.insert(SER_WIDTH, width);
+    settings.insert(SER_HEIGHT, height);
+    settings.insert(SER_FPS, fps);
+    settings.insert(SER_BITRATE, bitrateKbps);
+    settings.insert(SER_AUTOBITRATE, autoBitrate);
+    settings.insert(SER_AUTORESOLUTION, autoResolution);
+    settings.insert(SER_VSYNC, enableVsync);
+    settings.insert(SER_GAMEOPTS, gameOptimizations);
+    settings.insert(SER_HOSTAUDIO, playAudioOnHost);
+    settings.insert(SER_MULTICONT, multiController);
+    settings.insert(SER_UNSUPPORTEDFPS, unsupportedFps);
+    settings.insert(SER_MDNS, enableMdns);
+    settings.insert(SER_QUITAPPAFTER, quitAppAfter);
+    settings.insert(SER_MOUSEACCELERATION, mouseAcceleration);
+    settings.insert(SER_STARTWINDOWED, startWindowed);
+    settings.insert(SER_FRAMEPACING, framePacing);
+    settings.insert(SER_CONNWARNINGS, connectionWarnings);
+    settings.insert(SER_RICHPRESENCE, richPresence);
+    settings.insert(SER_GAMEPADMOUSE, gamepadMouse);
+    settings.insert(SER_ABSOLUTETOUCH, absoluteTouchMode);
+    settings.insert(SER_LOCALCURSOR, localCursor);
+    settings.insert(SER_GAMEPADDEADZONE, gamepadDeadzone);
+    settings.insert(SER_GAMEPADANTIDEADZONE, gamepadAntiDeadzone);
+    settings.insert(SER_GAMEPADCURVE, static_cast<int>(gamepadResponseCurve));
+    settings.insert(SER_AUDIOCFG, static_cast<int>(audioConfig));
+    settings.insert(SER_VIDEOCFG, static_cast<int>(videoCodecConfig));
+    settings.insert(SER_VIDEODEC, static_cast<int>(videoDecoderSelection));
+    settings.insert(SER_WINDOWMODE, static_cast<int>(windowMode));
+    settings.insert(SER_PACINGMODE, static_cast<int>(pacingMode));
+    settings.insert(SER_VRR, variableRefreshRate);
+    settings.insert(SER_SHARPENING, videoSharpening);
+    settings.insert(SER_ERRORCONCEALMENT, errorConcealment);
+    settings.insert(SER_POWERSAVING, powerSaving);
+    settings.insert(SER_REPLAYBUFFERSECS, replayBufferSecs);
 }
 
 int StreamingPreferences::getDefaultBitrate(int width, int height, int fps)
@@ -2,6 +2,7 @@
 
 #include <QObject>
 #include <QRect>
+#include <QVariantHash>
 
 class StreamingPreferences : public QObject
 {
@@ -10,11 +11,18 @@ class StreamingPreferences : public QObject
 public:
     StreamingPreferences(QObject *parent = nullptr);
 
+    ~StreamingPreferences();
+
     Q_INVOKABLE static int
     getDefaultBitrate(int width, int height, int fps);
 
+    // Shares the values with every other instance right away and writes
+    // them to disk in the background. Other instances emit their change
+    // signals, unless they have changes of their own that weren't saved.
     Q_INVOKABLE void save();
 
+    // Reads what was last saved by any instance. Only the first load
+    // touches QSettings.
     void reload();
 
     enum AudioConfig
@@ -37,7 +45,8 @@ public:
     {
         VDS_AUTO,
         VDS_FORCE_HARDWARE,
-        VDS_FORCE_SOFTWARE
+        VDS_FORCE_SOFTWARE,
+        VDS_FORCE_D3D11VA
     };
     Q_ENUM(VideoDecoderSelection)
 
@@ -49,10 +58,29 @@ public:
     };
     Q_ENUM(WindowMode)
 
+    enum PacingMode
+    {
+        PM_BALANCED,
+        PM_LOWEST_LATENCY,
+        PM_SMOOTHEST,
+        PM_JUST_IN_TIME
+    };
+    Q_ENUM(PacingMode)
+
+    enum GamepadResponseCurve
+    {
+        GRC_LINEAR,
+        GRC_QUADRATIC,
+        GRC_CUBIC
+    };
+    Q_ENUM(GamepadResponseCurve)
+
     Q_PROPERTY(int width MEMBER width NOTIFY displayModeChanged)
     Q_PROPERTY(int height MEMBER height NOTIFY displayModeChanged)
     Q_PROPERTY(int fps MEMBER fps NOTIFY displayModeChanged)
     Q_PROPERTY(int bitrateKbps MEMBER bitrateKbps NOTIFY bitrateChanged)
+    Q_PROPERTY(bool autoBitrate MEMBER autoBitrate NOTIFY autoBitrateChanged)
+    Q_PROPERTY(bool autoResolution MEMBER autoResolution NOTIFY autoResolutionChanged)
     Q_PROPERTY(bool enableVsync MEMBER enableVsync NOTIFY enableVsyncChanged)
     Q_PROPERTY(bool gameOptimizations MEMBER gameOptimizations NOTIFY gameOptimizationsChanged)
     Q_PROPERTY(bool playAudioOnHost MEMBER playAudioOnHost NOTIFY playAudioOnHostChanged)
@@ -66,10 +94,21 @@ public:
     Q_PROPERTY(bool connectionWarnings MEMBER connectionWarnings NOTIFY connectionWarningsChanged)
     Q_PROPERTY(bool richPresence MEMBER richPresence NOTIFY richPresenceChanged)
     Q_PROPERTY(bool gamepadMouse MEMBER gamepadMouse NOTIFY gamepadMouseChanged)
+    Q_PROPERTY(bool absoluteTouchMode MEMBER absoluteTouchMode NOTIFY absoluteTouchModeChanged)
+    Q_PROPERTY(bool localCursor MEMBER localCursor NOTIFY localCursorChanged)
+    Q_PROPERTY(int gamepadDeadzone MEMBER gamepadDeadzone NOTIFY gamepadDeadzoneChanged)
+    Q_PROPERTY(int gamepadAntiDeadzone MEMBER gamepadAntiDeadzone NOTIFY gamepadAntiDeadzoneChanged)
+    Q_PROPERTY(GamepadResponseCurve gamepadResponseCurve MEMBER gamepadResponseCurve NOTIFY gamepadResponseCurveChanged)
     Q_PROPERTY(AudioConfig audioConfig MEMBER audioConfig NOTIFY audioConfigChanged)
     Q_PROPERTY(VideoCodecConfig videoCodecConfig MEMBER videoCodecConfig NOTIFY videoCodecConfigChanged)
     Q_PROPERTY(VideoDecoderSelection videoDecoderSelection MEMBER videoDecoderSelection NOTIFY videoDecoderSelectionChanged)
     Q_PROPERTY(WindowMode windowMode MEMBER windowMode NOTIFY windowModeChanged)
+    Q_PROPERTY(PacingMode pacingMode MEMBER pacingMode NOTIFY pacingModeChanged)
+    Q_PROPERTY(bool variableRefreshRate MEMBER variableRefreshRate NOTIFY variableRefreshRateChanged)
+    Q_PROPERTY(bool videoSharpening MEMBER videoSharpening NOTIFY videoSharpeningChanged)
+    Q_PROPERTY(bool errorConcealment MEMBER errorConcealment NOTIFY errorConcealmentChanged)
+    Q_PROPERTY(bool powerSaving MEMBER powerSaving NOTIFY powerSavingChanged)
+    Q_PROPERTY(int replayBufferSecs MEMBER replayBufferSecs NOTIFY replayBufferSecsChanged)
     Q_PROPERTY(WindowMode recommendedFullScreenMode MEMBER recommendedFullScreenMode CONSTANT)
 
     // Directly accessible members for preferences
@@ -77,6 +116,8 @@ public:
     int height;
     int fps;
     int bitrateKbps;
+    bool autoBitrate;
+    bool autoResolution;
     bool enableVsync;
     bool gameOptimizations;
     bool playAudioOnHost;
@@ -90,15 +131,31 @@ public:
     bool connectionWarnings;
     bool richPresence;
     bool gamepadMouse;
+    bool absoluteTouchMode;
+    bool localCursor;
+    int gamepadDeadzone;
+    int gamepadAntiDeadzone;
+    GamepadResponseCurve gamepadResponseCurve;
     AudioConfig audioConfig;
     VideoCodecConfig videoCodecConfig;
     VideoDecoderSelection videoDecoderSelection;
     WindowMode windowMode;
     WindowMode recommendedFullScreenMode;
+    PacingMode pacingMode;
+    bool variableRefreshRate;
+    bool videoSharpening;
+    bool errorConcealment;
+    bool powerSaving;
+
+    // Seconds of the stream kept in memory for saving an instant replay,
+    // or 0 to keep none
+    int replayBufferSecs;
 
 signals:
     void displayModeChanged();
     void bitrateChanged();
+    void autoBitrateChanged();
+    void autoResolutionChanged();
     void enableVsyncChanged();
     void gameOptimizationsChanged();
     void playAudioOnHostChanged();
@@ -116,5 +173,25 @@ signals:
     void connectionWarningsChanged();
     void richPresenceChanged();
     void gamepadMouseChanged();
+    void absoluteTouchModeChanged();
+    void localCursorChanged();
+    void gamepadDeadzoneChanged();
+    void gamepadAntiDeadzoneChanged();
+    void gamepadResponseCurveChanged();
+    void pacingModeChanged();
+    void variableRefreshRateChanged();
+    void videoSharpeningChanged();
+    void errorConcealmentChanged();
+    void powerSavingChanged();
+    void replayBufferSecsChanged();
+
+private:
+    void store(QVariantHash& settings);
+
+    // Picks up values saved by another instance
+    void refresh();
+
+    // What this instance last loaded or saved
+    QVariantHash m_LoadedValues;
 };
 
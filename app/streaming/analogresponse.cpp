@@ -0,0 +1,100 @@
+#include "analogresponse.h"
+
+#include <QtMath>
+
+static float applyResponse(float input, float deadzone, float antiDeadzone,
+                           StreamingPreferences::GamepadResponseCurve curve)
+{
+    if (input <= deadzone) {
+        return 0;
+    }
+
+    // Rescale the travel past the deadzone to 0-1
+    float value = qMin((input - deadzone) / (1 - deadzone), 1.0f);
+
+    switch (curve)
+    {
+    case StreamingPreferences::GRC_QUADRATIC:
+        value = value * value;
+        break;
+    case StreamingPreferences::GRC_CUBIC:
+        value = value * value * value;
+        break;
+    default:
+        break;
+    }
+
+    return antiDeadzone + (1 - antiDeadzone) * value;
+}
+
+AnalogResponse::AnalogResponse()
+    : m_Passthrough(true)
+{
+    SDL_zero(m_StickTable);
+    SDL_zero(m_TriggerTable);
+}
+
+void AnalogResponse::initialize(int deadzonePercent, int antiDeadzonePercent,
+                                StreamingPreferences::GamepadResponseCurve curve)
+{
+    // Leave the values exactly as SDL reports them unless shaping was asked for
+    m_Passthrough = deadzonePercent == 0 && antiDeadzonePercent == 0 &&
+            curve == StreamingPreferences::GRC_LINEAR;
+    if (m_Passthrough) {
+        return;
+    }
+
+    float deadzone = qBound(0, deadzonePercent, 99) / 100.0f;
+    float antiDeadzone = qBound(0, antiDeadzonePercent, 99) / 100.0f;
+
+    for (int i = 0; i < ANALOG_RESPONSE_STICK_POINTS; i++) {
+        float input = (float)i / (ANALOG_RESPONSE_STICK_POINTS - 1);
+        m_StickTable[i] = (Uint16)qRound(applyResponse(input, deadzone, antiDeadzone, curve) * 32767);
+    }
+
+    // Triggers don't get a curve, since games rarely expect one
+    for (int i = 0; i < 256; i++) {
+        float input = i / 255.0f;
+        m_TriggerTable[i] = (unsigned char)qRound(applyResponse(input, deadzone, antiDeadzone,
+                                                                StreamingPreferences::GRC_LINEAR) * 255);
+    }
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Gamepad deadzone: %d%%, anti-deadzone: %d%%, response curve: %d",
+                deadzonePercent,
+                antiDeadzonePercent,
+                curve);
+}
+
+void AnalogResponse::processStick(short rawX, short rawY, short* x, short* y)
+{
+    if (m_Passthrough) {
+        *x = rawX;
+        *y = rawY;
+        return;
+    }
+
+    float magnitude = qSqrt((float)rawX * rawX + (float)rawY * rawY);
+    if (magnitude < 1) {
+        *x = *y = 0;
+        return;
+    }
+
+    // Sticks reach past a radius of 32767 on the diagonals, which is
+    // treated as the edge of the circle
+    float position = qMin(magnitude, 32767.0f) * (ANALOG_RESPONSE_STICK_POINTS - 1) / 32767;
+    int index = qMin((int)position, ANALOG_RESPONSE_STICK_POINTS - 2);
+    float fraction = position - index;
+    float output = m_StickTable[index] + (m_StickTable[index + 1] - m_StickTable[index]) * fraction;
+
+    // Keep the stick's direction and only change how far it's pushed
+    float scale = output / magnitude;
+    *x = (short)qBound(-32767.0f, rawX * scale, 32767.0f);
+    *y = (short)qBound(-32767.0f, rawY * scale, 32767.0f);
+}
+
+unsigned char AnalogResponse::processTrigger(short rawValue)
+{
+    unsigned char value = (unsigned char)(rawValue * 255UL / 32767);
+    return m_Passthrough ? value : m_TriggerTable[value];
+}
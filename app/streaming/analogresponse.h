@@ -0,0 +1,43 @@
+#pragma once
+
+#include "settings/streamingpreferences.h"
+
+#include <SDL.h>
+
+// Number of points in the stick response table. Magnitudes between two
+// points are interpolated.
+#define ANALOG_RESPONSE_STICK_POINTS 1025
+
+// Shapes the analog sticks and triggers of a gamepad before they're sent.
+// Sticks get a radial deadzone, so the deadzone is the same in every
+// direction and doesn't snap diagonal motion to the axes. Past the
+// deadzone, the response curve maps the rest of the stick's travel onto
+// the range that starts at the anti-deadzone, which makes up for the
+// deadzone a game applies on its own.
+//
+// Everything but the magnitude of the stick is precomputed into tables
+// when the session starts, so processing an update is a square root and
+// a table lookup.
+class AnalogResponse
+{
+public:
+    AnalogResponse();
+
+    void initialize(int deadzonePercent, int antiDeadzonePercent,
+                    StreamingPreferences::GamepadResponseCurve curve);
+
+    void processStick(short rawX, short rawY, short* x, short* y);
+
+    // rawValue is SDL's trigger value from 0 to 32767
+    unsigned char processTrigger(short rawValue);
+
+private:
+    bool m_Passthrough;
+
+    // Output magnitude of the stick for evenly spaced input magnitudes
+    // from 0 to 32767
+    Uint16 m_StickTable[ANALOG_RESPONSE_STICK_POINTS];
+
+    // Output trigger value for each 8-bit trigger value
+    unsigned char m_TriggerTable[256];
+};
@@ -1,5 +1,11 @@
 #include "../session.h"
 #include "renderers/renderer.h"
+#include "../capturefile.h"
+#ifdef HAVE_AVFORMAT
+#include "../recorder.h"
+#endif
+#include "../threadplacement.h"
+#include "../streamutils.h"
 
 #ifdef HAVE_SOUNDIO
 #include "renderers/soundioaudiorenderer.h"
@@ -9,10 +15,27 @@
 #include "renderers/slaud.h"
 #endif
 
+#ifdef HAVE_WASAPI
+#include "renderers/wasapiaudiorenderer.h"
+#endif
+
+#ifdef HAVE_PIPEWIRE
+#include "renderers/pipewireaudiorenderer.h"
+#endif
+
+#ifdef HAVE_PULSEAUDIO
+#include "renderers/pulseaudiorenderer.h"
+#endif
+
 #include "renderers/sdl.h"
+#include "renderers/nullaudiorenderer.h"
 
 #include <Limelight.h>
 
+// Recreating a renderer that failed is retried every 200 samples (1 second)
+// to avoid thrashing if the audio device is unavailable
+#define AUDIO_REINIT_INTERVAL_SAMPLES 200
+
 #define TRY_INIT_RENDERER(renderer, opusConfig)        \
 {                                                      \
     IAudioRenderer* __renderer = new renderer();       \
@@ -23,6 +46,12 @@
 
 IAudioRenderer* Session::createAudioRenderer(const POPUS_MULTISTREAM_CONFIGURATION opusConfig)
 {
+    // Headless streams never open an audio device
+    if (s_Headless) {
+        TRY_INIT_RENDERER(NullAudioRenderer, opusConfig)
+        return nullptr;
+    }
+
     // Handle explicit ML_AUDIO setting and fail if the requested backend fails
     QString mlAudio = qgetenv("ML_AUDIO").toLower();
     if (mlAudio == "sdl") {
@@ -35,6 +64,24 @@ IAudioRenderer* Session::createAudioRenderer(const POPUS_MULTISTREAM_CONFIGURATI
         return nullptr;
     }
 #endif
+#ifdef HAVE_WASAPI
+    else if (mlAudio == "wasapi") {
+        TRY_INIT_RENDERER(WasapiAudioRenderer, opusConfig)
+        return nullptr;
+    }
+#endif
+#ifdef HAVE_PIPEWIRE
+    else if (mlAudio == "pipewire") {
+        TRY_INIT_RENDERER(PipeWireAudioRenderer, opusConfig)
+        return nullptr;
+    }
+#endif
+#ifdef HAVE_PULSEAUDIO
+    else if (mlAudio == "pulseaudio") {
+        TRY_INIT_RENDERER(PulseAudioRenderer, opusConfig)
+        return nullptr;
+    }
+#endif
 #if defined(HAVE_SLAUDIO)
     else if (mlAudio == "slaudio") {
         TRY_INIT_RENDERER(SLAudioRenderer, opusConfig)
@@ -56,13 +103,25 @@ IAudioRenderer* Session::createAudioRenderer(const POPUS_MULTISTREAM_CONFIGURATI
 #endif
 
 #if !defined(Q_OS_WIN32) && !defined(Q_OS_DARWIN)
-    // Linux defaults to SDL due to persistent glitching issues under libsoundio.
+#ifdef HAVE_PIPEWIRE
+    // Native PipeWire and PulseAudio streams have the lowest latency on
+    // Linux. Each fails quickly if its server isn't running.
+    TRY_INIT_RENDERER(PipeWireAudioRenderer, opusConfig)
+#endif
+#ifdef HAVE_PULSEAUDIO
+    TRY_INIT_RENDERER(PulseAudioRenderer, opusConfig)
+#endif
+    // Otherwise, Linux uses SDL due to persistent glitching issues under libsoundio.
     // Platforms that libsoundio doesn't support also default to SDL.
     TRY_INIT_RENDERER(SdlAudioRenderer, opusConfig)
 #ifdef HAVE_SOUNDIO
     TRY_INIT_RENDERER(SoundIoAudioRenderer, opusConfig)
 #endif
 #else
+#ifdef HAVE_WASAPI
+    // Native WASAPI has the lowest latency on Windows
+    TRY_INIT_RENDERER(WasapiAudioRenderer, opusConfig)
+#endif
     // Windows and macOS default to libsoundio and fall back to SDL
 #ifdef HAVE_SOUNDIO
     TRY_INIT_RENDERER(SoundIoAudioRenderer, opusConfig)
@@ -141,30 +200,68 @@ int Session::arInit(int /* audioConfiguration */,
                     const POPUS_MULTISTREAM_CONFIGURATION opusConfig,
                     void* /* arContext */, int /* arFlags */)
 {
-    int error;
+    // A renderer kept across a stream restart can be used again as long
+    // as the host is sending the same layout
+    if (s_ActiveSession->m_AudioRenderer != nullptr &&
+            (s_ActiveSession->m_AudioConfig.sampleRate != opusConfig->sampleRate ||
+             s_ActiveSession->m_AudioConfig.channelCount != opusConfig->channelCount ||
+             s_ActiveSession->m_AudioConfig.samplesPerFrame != opusConfig->samplesPerFrame)) {
+        delete s_ActiveSession->m_AudioRenderer;
+        s_ActiveSession->m_AudioRenderer = nullptr;
+    }
 
     SDL_memcpy(&s_ActiveSession->m_AudioConfig, opusConfig, sizeof(*opusConfig));
+    s_ActiveSession->m_AudioLossPending = false;
+    s_ActiveSession->m_AudioLastArrivalUs = 0;
+    s_ActiveSession->m_AudioPacketsSinceArrival = 0;
 
-    s_ActiveSession->m_OpusDecoder =
-            opus_multistream_decoder_create(opusConfig->sampleRate,
-                                            opusConfig->channelCount,
-                                            opusConfig->streams,
-                                            opusConfig->coupledStreams,
-                                            opusConfig->mapping,
-                                            &error);
-    if (s_ActiveSession->m_OpusDecoder == NULL) {
-        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                     "Failed to create decoder: %d",
-                     error);
+    // The first reinitialization after a failure is attempted right away
+    s_ActiveSession->m_AudioReinitSampleCount = -AUDIO_REINIT_INTERVAL_SAMPLES;
+
+    if (s_ActiveSession->m_CaptureWriter != nullptr) {
+        s_ActiveSession->m_CaptureWriter->setAudioConfig(opusConfig);
+    }
+#ifdef HAVE_AVFORMAT
+    if (s_ActiveSession->m_Recorder != nullptr) {
+        s_ActiveSession->m_Recorder->setAudioConfig(opusConfig);
+    }
+#endif
+
+    if (!s_ActiveSession->m_AudioDecoder.initialize(opusConfig)) {
         return -1;
     }
 
-    s_ActiveSession->m_AudioRenderer = s_ActiveSession->createAudioRenderer(opusConfig);
+    if (s_ActiveSession->m_AudioRenderer != nullptr) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Reusing audio renderer from before the stream restart");
+    }
+    else {
+        s_ActiveSession->m_AudioRenderer = s_ActiveSession->createAudioRenderer(opusConfig);
+    }
     if (s_ActiveSession->m_AudioRenderer == nullptr) {
-        opus_multistream_decoder_destroy(s_ActiveSession->m_OpusDecoder);
+        s_ActiveSession->m_AudioDecoder.cleanup();
         return -2;
     }
 
+    if (!s_ActiveSession->m_AudioDecoder.prepareForRenderer(s_ActiveSession->m_AudioRenderer)) {
+        delete s_ActiveSession->m_AudioRenderer;
+        s_ActiveSession->m_AudioRenderer = nullptr;
+        s_ActiveSession->m_AudioDecoder.cleanup();
+        return -1;
+    }
+
+    SDL_AtomicSet(&s_ActiveSession->m_AudioDecoderStopping, 0);
+    if (!s_ActiveSession->m_AudioPacketQueue.initialize() ||
+            (s_ActiveSession->m_AudioDecoderThread = SDL_CreateThread(arDecoderThreadProc, "AudioDecoder", nullptr)) == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Failed to start audio decoder thread: %s",
+                     SDL_GetError());
+        delete s_ActiveSession->m_AudioRenderer;
+        s_ActiveSession->m_AudioRenderer = nullptr;
+        s_ActiveSession->m_AudioDecoder.cleanup();
+        return -1;
+    }
+
     SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
                 "Audio stream has %d channels",
                 opusConfig->channelCount);
@@ -172,99 +269,241 @@ int Session::arInit(int /* audioConfiguration */,
     return 0;
 }
 
+void Session::getAudioStats(AUDIO_STATS& stats)
+{
+    SDL_AtomicLock(&m_AudioStatsLock);
+    stats = m_AudioStats;
+    SDL_AtomicUnlock(&m_AudioStatsLock);
+}
+
+void Session::notifyAudioUnderrun()
+{
+    SDL_AtomicLock(&m_AudioStatsLock);
+    m_AudioStats.underruns++;
+    SDL_AtomicUnlock(&m_AudioStatsLock);
+}
+
 void Session::arCleanup()
 {
-    delete s_ActiveSession->m_AudioRenderer;
-    s_ActiveSession->m_AudioRenderer = nullptr;
+    // Stop decoding before anything it uses is torn down
+    SDL_AtomicSet(&s_ActiveSession->m_AudioDecoderStopping, 1);
+    s_ActiveSession->m_AudioPacketQueue.wake();
+    SDL_WaitThread(s_ActiveSession->m_AudioDecoderThread, nullptr);
+    s_ActiveSession->m_AudioDecoderThread = nullptr;
+
+    if (s_ActiveSession->m_AudioReinitThread != nullptr) {
+        SDL_WaitThread(s_ActiveSession->m_AudioReinitThread, nullptr);
+        s_ActiveSession->m_AudioReinitThread = nullptr;
+
+        delete s_ActiveSession->m_PendingAudioRenderer;
+        s_ActiveSession->m_PendingAudioRenderer = nullptr;
+    }
+
+    AUDIO_STATS stats;
+    s_ActiveSession->getAudioStats(stats);
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Audio packets received: %u, lost: %u (%u FEC decoded, %u concealed), peak jitter: %.2f ms",
+                stats.receivedPackets,
+                stats.lostPackets,
+                stats.fecDecodedPackets,
+                stats.concealedPackets,
+                stats.maxJitterUs / 1000.0f);
+
+    // Keep the audio device open if the stream is only restarting
+    if (!s_ActiveSession->m_RestartingStream) {
+        delete s_ActiveSession->m_AudioRenderer;
+        s_ActiveSession->m_AudioRenderer = nullptr;
+    }
+
+    s_ActiveSession->m_AudioDecoder.cleanup();
+}
+
+int Session::getPendingAudioFrames()
+{
+    if (s_ActiveSession == nullptr) {
+        return 0;
+    }
+
+    return s_ActiveSession->m_AudioPacketQueue.getPendingCount() + LiGetPendingAudioFrames();
+}
+
+void Session::arDecodeAndSubmit(const unsigned char* sampleData, int sampleLength, bool decodeFec)
+{
+    if (s_ActiveSession->m_AudioRenderer == nullptr) {
+        return;
+    }
 
-    opus_multistream_decoder_destroy(s_ActiveSession->m_OpusDecoder);
-    s_ActiveSession->m_OpusDecoder = nullptr;
+    if (!s_ActiveSession->m_AudioDecoder.decodeAndSubmit(s_ActiveSession->m_AudioRenderer,
+                                                         sampleData, sampleLength, decodeFec)) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Reinitializing audio renderer after failure");
+
+        delete s_ActiveSession->m_AudioRenderer;
+        s_ActiveSession->m_AudioRenderer = nullptr;
+    }
 }
 
 void Session::arDecodeAndPlaySample(char* sampleData, int sampleLength)
 {
-    int samplesDecoded;
-
-#ifndef STEAM_LINK
-    // Set this thread to high priority to reduce the chance of missing
-    // our sample delivery time. On Steam Link, this causes starvation
-    // of other threads due to severely restricted CPU time available,
-    // so we will skip it on that platform.
-    if (s_ActiveSession->m_AudioSampleCount == 0) {
-        if (SDL_SetThreadPriority(SDL_THREAD_PRIORITY_HIGH) < 0) {
-            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
-                        "Unable to set audio thread to high priority: %s",
-                        SDL_GetError());
-        }
+    arTrackArrivalJitter(sampleData != nullptr);
+
+    if (s_ActiveSession->m_CaptureWriter != nullptr) {
+        s_ActiveSession->m_CaptureWriter->writeAudio(sampleData, sampleLength);
+    }
+#ifdef HAVE_AVFORMAT
+    if (s_ActiveSession->m_Recorder != nullptr) {
+        s_ActiveSession->m_Recorder->writeAudio(sampleData, sampleLength);
     }
 #endif
 
-    // See if we need to drop this sample
-    if (s_ActiveSession->m_DropAudioEndTime != 0) {
-        if (SDL_TICKS_PASSED(SDL_GetTicks(), s_ActiveSession->m_DropAudioEndTime)) {
-            // Avoid calling SDL_GetTicks() now
-            s_ActiveSession->m_DropAudioEndTime = 0;
+    // Decoding happens on our own thread, so the receive thread never
+    // waits on the audio device. If the decoder has somehow fallen a
+    // queue's worth behind, the packet is dropped.
+    s_ActiveSession->m_AudioPacketQueue.push(sampleData, sampleLength);
+}
 
-            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
-                        "Audio drop window has ended");
-        }
-        else {
-            // We're still in the drop window
-            return;
+// Called on the receive thread for every sample, including loss reports
+void Session::arTrackArrivalJitter(bool received)
+{
+    Session* me = s_ActiveSession;
+    Uint64 now = StreamUtils::getTimeUs();
+
+    // Loss reports carry no arrival time of their own, but the lost
+    // packets still count toward the spacing expected before the next one
+    me->m_AudioPacketsSinceArrival++;
+    if (!received) {
+        return;
+    }
+
+    if (me->m_AudioLastArrivalUs != 0) {
+        Sint64 expectedUs = (Sint64)me->m_AudioPacketsSinceArrival * me->m_AudioConfig.samplesPerFrame *
+                1000000 / me->m_AudioConfig.sampleRate;
+        Sint64 deviationUs = (Sint64)(now - me->m_AudioLastArrivalUs) - expectedUs;
+
+        // The running estimate from RFC 3550 section 6.4.1
+        me->m_AudioJitterUs += (qAbs(deviationUs) - me->m_AudioJitterUs) / 16;
+
+        SDL_AtomicLock(&me->m_AudioStatsLock);
+        me->m_AudioStats.jitterUs = (uint32_t)me->m_AudioJitterUs;
+        me->m_AudioStats.maxJitterUs = qMax(me->m_AudioStats.maxJitterUs, me->m_AudioStats.jitterUs);
+        SDL_AtomicUnlock(&me->m_AudioStatsLock);
+    }
+
+    me->m_AudioLastArrivalUs = now;
+    me->m_AudioPacketsSinceArrival = 0;
+}
+
+int Session::arDecoderThreadProc(void*)
+{
+    // Reduce the chance of missing our sample delivery time
+    ThreadPlacement::applyToCurrentThread(ThreadPlacement::TR_AUDIO);
+
+    AudioPacketQueue& queue = s_ActiveSession->m_AudioPacketQueue;
+
+    while (!SDL_AtomicGet(&s_ActiveSession->m_AudioDecoderStopping)) {
+        const unsigned char* sampleData;
+        int sampleLength;
+
+        queue.wait();
+
+        while (queue.front(&sampleData, &sampleLength)) {
+            arHandlePacket(sampleData, sampleLength);
+            queue.pop();
         }
     }
 
+    return 0;
+}
+
+int Session::arReinitThreadProc(void*)
+{
+    Uint32 audioReinitStartTime = SDL_GetTicks();
+
+    s_ActiveSession->m_PendingAudioRenderer = s_ActiveSession->createAudioRenderer(&s_ActiveSession->m_AudioConfig);
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Audio reinitialization took %d ms",
+                SDL_GetTicks() - audioReinitStartTime);
+
+    // Publishes the new renderer to the decoder thread
+    SDL_AtomicSet(&s_ActiveSession->m_AudioReinitDone, 1);
+    return 0;
+}
+
+void Session::arHandlePacket(const unsigned char* sampleData, int sampleLength)
+{
     s_ActiveSession->m_AudioSampleCount++;
 
-    if (s_ActiveSession->m_AudioRenderer != nullptr) {
-        int desiredSize = sizeof(short) * s_ActiveSession->m_AudioConfig.samplesPerFrame * s_ActiveSession->m_AudioConfig.channelCount;
-        void* buffer = s_ActiveSession->m_AudioRenderer->getAudioBuffer(&desiredSize);
-        if (buffer == nullptr) {
-            return;
+    // moonlight-common-c reports each packet lost in the network as a
+    // sample without data. Hold off concealing it until the next packet
+    // arrives, since that packet may carry the lost audio as in-band FEC.
+    if (sampleData == nullptr) {
+        SDL_AtomicLock(&s_ActiveSession->m_AudioStatsLock);
+        s_ActiveSession->m_AudioStats.lostPackets++;
+        if (s_ActiveSession->m_AudioLossPending) {
+            s_ActiveSession->m_AudioStats.concealedPackets++;
         }
+        SDL_AtomicUnlock(&s_ActiveSession->m_AudioStatsLock);
 
-        samplesDecoded = opus_multistream_decode(s_ActiveSession->m_OpusDecoder,
-                                                 (unsigned char*)sampleData,
-                                                 sampleLength,
-                                                 (short*)buffer,
-                                                 desiredSize / sizeof(short) / s_ActiveSession->m_AudioConfig.channelCount,
-                                                 0);
-
-        // Update desiredSize with the number of bytes actually populated by the decoding operation
-        if (samplesDecoded > 0) {
-            SDL_assert(desiredSize >= sizeof(short) * samplesDecoded * s_ActiveSession->m_AudioConfig.channelCount);
-            desiredSize = sizeof(short) * samplesDecoded * s_ActiveSession->m_AudioConfig.channelCount;
-        }
-        else {
-            desiredSize = 0;
+        // Only the packet right before a good one can be recovered with
+        // FEC, so conceal an earlier loss now to keep the output cadence.
+        if (s_ActiveSession->m_AudioLossPending) {
+            arDecodeAndSubmit(nullptr, 0, false);
         }
 
-        if (!s_ActiveSession->m_AudioRenderer->submitAudio(desiredSize)) {
-            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
-                        "Reinitializing audio renderer after failure");
+        s_ActiveSession->m_AudioLossPending = true;
+    }
+    else {
+        SDL_AtomicLock(&s_ActiveSession->m_AudioStatsLock);
+        s_ActiveSession->m_AudioStats.receivedPackets++;
+        if (s_ActiveSession->m_AudioLossPending) {
+            s_ActiveSession->m_AudioStats.fecDecodedPackets++;
+        }
+        SDL_AtomicUnlock(&s_ActiveSession->m_AudioStatsLock);
 
-            delete s_ActiveSession->m_AudioRenderer;
-            s_ActiveSession->m_AudioRenderer = nullptr;
+        // Opus conceals the loss itself if this packet has no FEC data
+        if (s_ActiveSession->m_AudioLossPending) {
+            arDecodeAndSubmit(sampleData, sampleLength, true);
+            s_ActiveSession->m_AudioLossPending = false;
         }
-    }
 
-    // Only try to recreate the audio renderer every 200 samples (1 second)
-    // to avoid thrashing if the audio device is unavailable. It is
-    // safe to reinitialize here because we can't be torn down while
-    // the audio decoder/playback thread is still alive.
-    if (s_ActiveSession->m_AudioRenderer == nullptr && (s_ActiveSession->m_AudioSampleCount % 200) == 0) {
-        // Since we're doing this inline and audio initialization takes time, we need
-        // to drop samples to account for the time we've spent blocking audio rendering
-        // so we return to real-time playback and don't accumulate latency.
-        Uint32 audioReinitStartTime = SDL_GetTicks();
+        arDecodeAndSubmit(sampleData, sampleLength, false);
+    }
 
-        s_ActiveSession->m_AudioRenderer = s_ActiveSession->createAudioRenderer(&s_ActiveSession->m_AudioConfig);
+    // Pick up a renderer that finished initializing in the background. If
+    // the old renderer is still playing, this swaps them between frames.
+    if (s_ActiveSession->m_AudioReinitThread != nullptr && SDL_AtomicGet(&s_ActiveSession->m_AudioReinitDone)) {
+        SDL_WaitThread(s_ActiveSession->m_AudioReinitThread, nullptr);
+        s_ActiveSession->m_AudioReinitThread = nullptr;
 
-        Uint32 audioReinitStopTime = SDL_GetTicks();
+        if (s_ActiveSession->m_PendingAudioRenderer != nullptr) {
+            delete s_ActiveSession->m_AudioRenderer;
+            s_ActiveSession->m_AudioRenderer = s_ActiveSession->m_PendingAudioRenderer;
+            s_ActiveSession->m_PendingAudioRenderer = nullptr;
+            if (!s_ActiveSession->m_AudioDecoder.prepareForRenderer(s_ActiveSession->m_AudioRenderer)) {
+                delete s_ActiveSession->m_AudioRenderer;
+                s_ActiveSession->m_AudioRenderer = nullptr;
+            }
+        }
+    }
 
-        s_ActiveSession->m_DropAudioEndTime = audioReinitStopTime + (audioReinitStopTime - audioReinitStartTime);
-        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
-                    "Audio reinitialization took %d ms - starting drop window",
-                    audioReinitStopTime - audioReinitStartTime);
+    // A renderer whose device is no longer the default keeps playing
+    // while its replacement opens, so switching devices costs no more
+    // than the new device's startup. Opening a device can take hundreds
+    // of milliseconds, so it happens on another thread while we keep
+    // draining the queue. That way no latency builds up while the device
+    // is gone either.
+    bool needsReinit = s_ActiveSession->m_AudioRenderer == nullptr ||
+            s_ActiveSession->m_AudioRenderer->isDefaultDeviceChanged();
+    if (needsReinit && s_ActiveSession->m_AudioReinitThread == nullptr &&
+            s_ActiveSession->m_AudioSampleCount - s_ActiveSession->m_AudioReinitSampleCount >= AUDIO_REINIT_INTERVAL_SAMPLES) {
+        s_ActiveSession->m_AudioReinitSampleCount = s_ActiveSession->m_AudioSampleCount;
+        SDL_AtomicSet(&s_ActiveSession->m_AudioReinitDone, 0);
+        s_ActiveSession->m_AudioReinitThread = SDL_CreateThread(arReinitThreadProc, "AudioReinit", nullptr);
+        if (s_ActiveSession->m_AudioReinitThread == nullptr) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "Failed to start audio reinitialization thread: %s",
+                         SDL_GetError());
+        }
     }
 }
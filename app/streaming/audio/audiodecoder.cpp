@@ -0,0 +1,177 @@
+#include "audiodecoder.h"
+#include "streaming/avsyncclock.h"
+
+#include <QtGlobal>
+
+// Renderers tolerate 4 frames queued past their target before dropping
+// any, which caps how far audio can be held back for A/V sync
+#define AV_SYNC_MAX_DELAY_FRAMES 3
+
+AudioDecoder::AudioDecoder()
+    : m_OpusDecoder(nullptr),
+      m_ParallelDecoder(nullptr)
+{
+    SDL_zero(m_Config);
+}
+
+AudioDecoder::~AudioDecoder()
+{
+    cleanup();
+}
+
+bool AudioDecoder::initialize(const OPUS_MULTISTREAM_CONFIGURATION* opusConfig)
+{
+    int error;
+
+    SDL_assert(m_OpusDecoder == nullptr);
+
+    SDL_memcpy(&m_Config, opusConfig, sizeof(m_Config));
+
+    m_OpusDecoder = opus_multistream_decoder_create(opusConfig->sampleRate,
+                                                    opusConfig->channelCount,
+                                                    opusConfig->streams,
+                                                    opusConfig->coupledStreams,
+                                                    opusConfig->mapping,
+                                                    &error);
+    if (m_OpusDecoder == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Failed to create decoder: %d",
+                     error);
+        return false;
+    }
+
+    if (opusConfig->streams > 1 && qgetenv("ML_AUDIO_PARALLEL_DECODE") == "1") {
+        m_ParallelDecoder = new ParallelOpusDecoder();
+        if (!m_ParallelDecoder->initialize(opusConfig)) {
+            delete m_ParallelDecoder;
+            m_ParallelDecoder = nullptr;
+        }
+    }
+
+    return true;
+}
+
+void AudioDecoder::cleanup()
+{
+    delete m_ParallelDecoder;
+    m_ParallelDecoder = nullptr;
+
+    if (m_OpusDecoder != nullptr) {
+        opus_multistream_decoder_destroy(m_OpusDecoder);
+        m_OpusDecoder = nullptr;
+    }
+}
+
+bool AudioDecoder::prepareForRenderer(IAudioRenderer* renderer)
+{
+    IAudioRenderer::AudioFormat format = renderer->getAudioBufferFormat();
+    int channelCount = renderer->getAudioBufferChannelCount();
+    if (channelCount == 0) {
+        channelCount = m_Config.channelCount;
+    }
+
+    return m_Mixer.initialize(m_Config.channelCount, channelCount, format, m_Config.samplesPerFrame) &&
+            m_JitterBuffer.initialize(channelCount, m_Config.samplesPerFrame, format);
+}
+
+bool AudioDecoder::decodeAndSubmit(IAudioRenderer* renderer,
+                                   const unsigned char* sampleData, int sampleLength,
+                                   bool decodeFec)
+{
+    int samplesDecoded;
+    int channelCount = m_Mixer.getOutputChannelCount();
+    int sampleSize = m_Mixer.getOutputSampleSize();
+    int samplesPerFrame = m_Config.samplesPerFrame;
+
+    // Renderers that report their queue level get resampled audio that
+    // keeps the queue at their latency target
+    int queuedUs, targetUs;
+    bool useJitterBuffer = renderer->getQueueStatus(&queuedUs, &targetUs);
+    if (useJitterBuffer) {
+        int frameDurationUs = (int)((Sint64)samplesPerFrame * 1000000 / m_Config.sampleRate);
+
+        // This frame is heard once everything queued ahead of it has played
+        AvSyncClock::markAudioSubmitted(queuedUs + renderer->getDeviceLatencyUs());
+
+        // Holding audio back for A/V sync is done by queueing more of it
+        targetUs += AvSyncClock::getAudioDelayUs(AV_SYNC_MAX_DELAY_FRAMES * frameDurationUs);
+    }
+
+    int desiredSize = sampleSize * channelCount *
+            (useJitterBuffer ? m_JitterBuffer.getMaxOutputSamples() : samplesPerFrame);
+    void* buffer = renderer->getAudioBuffer(&desiredSize);
+    if (buffer == nullptr) {
+        return true;
+    }
+
+    // Concealed and FEC frames take their duration from the frame size,
+    // so they must always be decoded as exactly one frame.
+    void* frame = useJitterBuffer ? m_JitterBuffer.getInputBuffer() : buffer;
+    int frameSize = useJitterBuffer ? samplesPerFrame : SDL_min(desiredSize / sampleSize / channelCount, samplesPerFrame);
+
+    if (!m_Mixer.isPassthrough()) {
+        samplesDecoded = decodeFloat(sampleData, sampleLength,
+                                     m_Mixer.getInputBuffer(),
+                                     frameSize, decodeFec);
+        if (samplesDecoded > 0) {
+            m_Mixer.process(samplesDecoded, frame);
+        }
+    }
+    else if (m_Mixer.getOutputFormat() == IAudioRenderer::AudioFormatFloat) {
+        samplesDecoded = decodeFloat(sampleData, sampleLength,
+                                     (float*)frame,
+                                     frameSize, decodeFec);
+    }
+    else {
+        samplesDecoded = decode(sampleData, sampleLength,
+                                (short*)frame,
+                                frameSize, decodeFec);
+    }
+
+    if (useJitterBuffer && samplesDecoded > 0) {
+        samplesDecoded = m_JitterBuffer.process(samplesDecoded, buffer,
+                                                desiredSize / sampleSize / channelCount,
+                                                queuedUs, targetUs);
+    }
+
+    // Update desiredSize with the number of bytes actually populated by the decoding operation
+    if (samplesDecoded > 0) {
+        SDL_assert(desiredSize >= sampleSize * samplesDecoded * channelCount);
+        desiredSize = sampleSize * samplesDecoded * channelCount;
+    }
+    else {
+        desiredSize = 0;
+    }
+
+    return renderer->submitAudio(desiredSize);
+}
+
+int AudioDecoder::decodeFloat(const unsigned char* sampleData, int sampleLength,
+                              float* pcm, int frameSize, bool decodeFec)
+{
+    if (m_ParallelDecoder != nullptr) {
+        return m_ParallelDecoder->decodeFloat(sampleData, sampleLength, pcm, frameSize, decodeFec);
+    }
+
+    return opus_multistream_decode_float(m_OpusDecoder,
+                                         sampleData,
+                                         sampleLength,
+                                         pcm,
+                                         frameSize,
+                                         decodeFec ? 1 : 0);
+}
+
+int AudioDecoder::decode(const unsigned char* sampleData, int sampleLength,
+                         short* pcm, int frameSize, bool decodeFec)
+{
+    if (m_ParallelDecoder != nullptr) {
+        return m_ParallelDecoder->decode(sampleData, sampleLength, pcm, frameSize, decodeFec);
+    }
+
+    return opus_multistream_decode(m_OpusDecoder,
+                                   sampleData,
+                                   sampleLength,
+                                   pcm,
+                                   frameSize,
+                                   decodeFec ? 1 : 0);
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "renderers/renderer.h"
+#include "audiomixer.h"
+#include "jitterbuffer.h"
+#include "parallelopusdecoder.h"
+
+#include <Limelight.h>
+#include <opus_multistream.h>
+
+// Decodes Opus frames into the renderer's own buffers. Opus writes straight
+// into the renderer when no mixing or resampling is needed. Otherwise the
+// mix or resampling pass is the one that writes into the renderer. Every
+// buffer is allocated up front, so the per-frame path never allocates.
+class AudioDecoder
+{
+public:
+    AudioDecoder();
+    ~AudioDecoder();
+
+    bool initialize(const OPUS_MULTISTREAM_CONFIGURATION* opusConfig);
+
+    void cleanup();
+
+    // Sets up mixing and resampling for the layout of the renderer's
+    // buffers. This must be redone whenever the renderer is recreated,
+    // since the new device may use a different layout.
+    bool prepareForRenderer(IAudioRenderer* renderer);
+
+    // Decodes one frame, or conceals a lost one if sampleData is null.
+    // Returns false if the renderer failed and must be recreated.
+    bool decodeAndSubmit(IAudioRenderer* renderer,
+                         const unsigned char* sampleData, int sampleLength,
+                         bool decodeFec);
+
+private:
+    int decodeFloat(const unsigned char* sampleData, int sampleLength,
+                    float* pcm, int frameSize, bool decodeFec);
+
+    int decode(const unsigned char* sampleData, int sampleLength,
+               short* pcm, int frameSize, bool decodeFec);
+
+    OPUS_MULTISTREAM_CONFIGURATION m_Config;
+    OpusMSDecoder* m_OpusDecoder;
+
+    // Used instead of m_OpusDecoder for surround streams when
+    // ML_AUDIO_PARALLEL_DECODE=1
+    ParallelOpusDecoder* m_ParallelDecoder;
+    AudioMixer m_Mixer;
+    AudioJitterBuffer m_JitterBuffer;
+};
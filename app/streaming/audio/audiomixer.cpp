@@ -0,0 +1,201 @@
+#include "audiomixer.h"
+
+#include "streaming/cpudispatch.h"
+
+// -3 dB, the usual gain for folding a channel into a pair of speakers
+#define AUDIO_MIXER_FOLD_GAIN 0.7071f
+
+enum SpeakerPosition
+{
+    SP_FRONT_LEFT,
+    SP_FRONT_RIGHT,
+    SP_FRONT_CENTER,
+    SP_LFE,
+    SP_BACK_LEFT,
+    SP_BACK_RIGHT,
+    SP_SIDE_LEFT,
+    SP_SIDE_RIGHT,
+    SP_BACK_CENTER,
+    SP_NONE
+};
+
+// Speaker order for each channel count. Moonlight streams and SDL both
+// use these, and the soundio renderer remaps from them to the device.
+static const SpeakerPosition k_Layouts[AUDIO_MIXER_MAX_CHANNELS][AUDIO_MIXER_MAX_CHANNELS] = {
+    { SP_FRONT_CENTER, SP_NONE, SP_NONE, SP_NONE, SP_NONE, SP_NONE, SP_NONE, SP_NONE },
+    { SP_FRONT_LEFT, SP_FRONT_RIGHT, SP_NONE, SP_NONE, SP_NONE, SP_NONE, SP_NONE, SP_NONE },
+    { SP_FRONT_LEFT, SP_FRONT_RIGHT, SP_LFE, SP_NONE, SP_NONE, SP_NONE, SP_NONE, SP_NONE },
+    { SP_FRONT_LEFT, SP_FRONT_RIGHT, SP_BACK_LEFT, SP_BACK_RIGHT, SP_NONE, SP_NONE, SP_NONE, SP_NONE },
+    { SP_FRONT_LEFT, SP_FRONT_RIGHT, SP_LFE, SP_BACK_LEFT, SP_BACK_RIGHT, SP_NONE, SP_NONE, SP_NONE },
+    { SP_FRONT_LEFT, SP_FRONT_RIGHT, SP_FRONT_CENTER, SP_LFE, SP_BACK_LEFT, SP_BACK_RIGHT, SP_NONE, SP_NONE },
+    { SP_FRONT_LEFT, SP_FRONT_RIGHT, SP_FRONT_CENTER, SP_LFE, SP_BACK_CENTER, SP_SIDE_LEFT, SP_SIDE_RIGHT, SP_NONE },
+    { SP_FRONT_LEFT, SP_FRONT_RIGHT, SP_FRONT_CENTER, SP_LFE, SP_BACK_LEFT, SP_BACK_RIGHT, SP_SIDE_LEFT, SP_SIDE_RIGHT },
+};
+
+static int findSpeaker(int channelCount, SpeakerPosition position)
+{
+    for (int i = 0; i < channelCount; i++) {
+        if (k_Layouts[channelCount - 1][i] == position) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+// Adds the gain of an input speaker to the output channels that should
+// play it, folding it into its neighbours if the output doesn't have it
+static void addSpeaker(float matrix[AUDIO_MIXER_MAX_CHANNELS][AUDIO_MIXER_MAX_CHANNELS],
+                       int outputChannels, int input, SpeakerPosition position, float gain)
+{
+    int output = findSpeaker(outputChannels, position);
+    if (output >= 0) {
+        matrix[output][input] += gain;
+        return;
+    }
+
+    switch (position) {
+    case SP_FRONT_LEFT:
+    case SP_FRONT_RIGHT:
+        addSpeaker(matrix, outputChannels, input, SP_FRONT_CENTER, gain * AUDIO_MIXER_FOLD_GAIN);
+        break;
+
+    case SP_FRONT_CENTER:
+        addSpeaker(matrix, outputChannels, input, SP_FRONT_LEFT, gain * AUDIO_MIXER_FOLD_GAIN);
+        addSpeaker(matrix, outputChannels, input, SP_FRONT_RIGHT, gain * AUDIO_MIXER_FOLD_GAIN);
+        break;
+
+    case SP_BACK_LEFT:
+    case SP_BACK_RIGHT:
+        if (findSpeaker(outputChannels, position == SP_BACK_LEFT ? SP_SIDE_LEFT : SP_SIDE_RIGHT) >= 0) {
+            addSpeaker(matrix, outputChannels, input, position == SP_BACK_LEFT ? SP_SIDE_LEFT : SP_SIDE_RIGHT, gain);
+        }
+        else if (findSpeaker(outputChannels, SP_BACK_CENTER) >= 0) {
+            addSpeaker(matrix, outputChannels, input, SP_BACK_CENTER, gain * AUDIO_MIXER_FOLD_GAIN);
+        }
+        else {
+            addSpeaker(matrix, outputChannels, input, position == SP_BACK_LEFT ? SP_FRONT_LEFT : SP_FRONT_RIGHT, gain * AUDIO_MIXER_FOLD_GAIN);
+        }
+        break;
+
+    case SP_SIDE_LEFT:
+    case SP_SIDE_RIGHT:
+        if (findSpeaker(outputChannels, position == SP_SIDE_LEFT ? SP_BACK_LEFT : SP_BACK_RIGHT) >= 0) {
+            addSpeaker(matrix, outputChannels, input, position == SP_SIDE_LEFT ? SP_BACK_LEFT : SP_BACK_RIGHT, gain);
+        }
+        else {
+            addSpeaker(matrix, outputChannels, input, position == SP_SIDE_LEFT ? SP_FRONT_LEFT : SP_FRONT_RIGHT, gain * AUDIO_MIXER_FOLD_GAIN);
+        }
+        break;
+
+    case SP_BACK_CENTER:
+        addSpeaker(matrix, outputChannels, input, SP_BACK_LEFT, gain * AUDIO_MIXER_FOLD_GAIN);
+        addSpeaker(matrix, outputChannels, input, SP_BACK_RIGHT, gain * AUDIO_MIXER_FOLD_GAIN);
+        break;
+
+    default:
+        // The subwoofer carries nothing that small speakers could play
+        break;
+    }
+}
+
+AudioMixer::AudioMixer()
+    : m_InputChannels(0),
+      m_OutputChannels(0),
+      m_OutputFormat(IAudioRenderer::AudioFormatS16),
+      m_SamplesPerFrame(0),
+      m_Input(nullptr),
+      m_Output(nullptr)
+{
+    SDL_zero(m_Matrix);
+}
+
+AudioMixer::~AudioMixer()
+{
+    SDL_free(m_Input);
+    SDL_free(m_Output);
+}
+
+bool AudioMixer::initialize(int inputChannels, int outputChannels,
+                            IAudioRenderer::AudioFormat outputFormat,
+                            int samplesPerFrame)
+{
+    if (inputChannels < 1 || inputChannels > AUDIO_MIXER_MAX_CHANNELS ||
+            outputChannels < 1 || outputChannels > AUDIO_MIXER_MAX_CHANNELS) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unable to mix %d channels to %d channels",
+                     inputChannels,
+                     outputChannels);
+        return false;
+    }
+
+    SDL_free(m_Input);
+    SDL_free(m_Output);
+    m_Output = nullptr;
+
+    // The mixer loads whole vectors from each frame, which reads past
+    // the last frame. The padding keeps that read inside the buffer.
+    m_Input = (float*)SDL_calloc(samplesPerFrame * inputChannels + AUDIO_MIXER_MAX_CHANNELS, sizeof(float));
+    if (m_Input == nullptr) {
+        return false;
+    }
+
+    if (outputFormat == IAudioRenderer::AudioFormatS16) {
+        m_Output = (float*)SDL_malloc(samplesPerFrame * outputChannels * sizeof(float));
+        if (m_Output == nullptr) {
+            return false;
+        }
+    }
+
+    m_InputChannels = inputChannels;
+    m_OutputChannels = outputChannels;
+    m_OutputFormat = outputFormat;
+    m_SamplesPerFrame = samplesPerFrame;
+    buildMatrix();
+
+    if (!isPassthrough()) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Mixing %d audio channels to %d channels",
+                    inputChannels,
+                    outputChannels);
+    }
+
+    return true;
+}
+
+void AudioMixer::buildMatrix()
+{
+    SDL_zero(m_Matrix);
+
+    for (int i = 0; i < m_InputChannels; i++) {
+        addSpeaker(m_Matrix, m_OutputChannels, i, k_Layouts[m_InputChannels - 1][i], 1.0f);
+    }
+
+    // Scale down any output that sums several inputs, so a full scale
+    // signal on all of them can't clip
+    for (int o = 0; o < m_OutputChannels; o++) {
+        float sum = 0;
+        for (int i = 0; i < m_InputChannels; i++) {
+            sum += m_Matrix[o][i];
+        }
+
+        if (sum > 1.0f) {
+            for (int i = 0; i < m_InputChannels; i++) {
+                m_Matrix[o][i] /= sum;
+            }
+        }
+    }
+}
+
+void AudioMixer::process(int samples, void* output)
+{
+    SDL_assert(samples <= m_SamplesPerFrame);
+
+    float* mixed = m_OutputFormat == IAudioRenderer::AudioFormatFloat ? (float*)output : m_Output;
+
+    CpuDispatch::mixFrames(m_Input, m_InputChannels, mixed, m_OutputChannels, m_Matrix, samples);
+
+    if (m_OutputFormat == IAudioRenderer::AudioFormatS16) {
+        CpuDispatch::convertFloatToS16(mixed, (short*)output, samples * m_OutputChannels);
+    }
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "renderers/renderer.h"
+
+#include <SDL.h>
+
+#define AUDIO_MIXER_MAX_CHANNELS 8
+
+// Converts decoded audio to the channel layout and sample format that the
+// renderer asked for. Surround streams are folded down for stereo devices
+// here rather than by the OS mixer, and the per-frame mix is a SIMD dot
+// product against a precomputed gain matrix.
+class AudioMixer
+{
+public:
+    AudioMixer();
+    ~AudioMixer();
+
+    bool initialize(int inputChannels, int outputChannels,
+                    IAudioRenderer::AudioFormat outputFormat,
+                    int samplesPerFrame);
+
+    // If the layouts match, Opus can decode straight into the output
+    // format and process() isn't needed
+    bool isPassthrough()
+    {
+        return m_InputChannels == m_OutputChannels;
+    }
+
+    int getOutputChannelCount()
+    {
+        return m_OutputChannels;
+    }
+
+    IAudioRenderer::AudioFormat getOutputFormat()
+    {
+        return m_OutputFormat;
+    }
+
+    int getOutputSampleSize()
+    {
+        return m_OutputFormat == IAudioRenderer::AudioFormatFloat ? sizeof(float) : sizeof(short);
+    }
+
+    // Frames are decoded here as interleaved floats before mixing
+    float* getInputBuffer()
+    {
+        return m_Input;
+    }
+
+    // Mixes the decoded samples into output in the output format
+    void process(int samples, void* output);
+
+private:
+    void buildMatrix();
+
+    int m_InputChannels;
+    int m_OutputChannels;
+    IAudioRenderer::AudioFormat m_OutputFormat;
+    int m_SamplesPerFrame;
+    float* m_Input;
+
+    // Mix buffer for S16 output, which is converted in one pass afterwards
+    float* m_Output;
+
+    // Gain from each input channel to each output channel. Rows are padded
+    // to the maximum channel count so they can be loaded as whole vectors.
+    float m_Matrix[AUDIO_MIXER_MAX_CHANNELS][AUDIO_MIXER_MAX_CHANNELS];
+};
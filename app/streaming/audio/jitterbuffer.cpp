@@ -0,0 +1,122 @@
+#include "jitterbuffer.h"
+
+#include <math.h>
+
+static inline short interpolate(short a, short b, int fraction)
+{
+    return (short)(a + (((b - a) * fraction) >> 16));
+}
+
+static inline float interpolate(float a, float b, int fraction)
+{
+    return a + (b - a) * (fraction * (1.0f / 65536));
+}
+
+AudioJitterBuffer::AudioJitterBuffer()
+    : m_ChannelCount(0),
+      m_SamplesPerFrame(0),
+      m_Format(IAudioRenderer::AudioFormatS16),
+      m_Input(nullptr)
+{
+    reset();
+}
+
+AudioJitterBuffer::~AudioJitterBuffer()
+{
+    SDL_free(m_Input);
+}
+
+bool AudioJitterBuffer::initialize(int channelCount, int samplesPerFrame, IAudioRenderer::AudioFormat format)
+{
+    if (channelCount > AUDIO_JITTER_MAX_CHANNELS) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Audio jitter buffer can't handle %d channels",
+                     channelCount);
+        return false;
+    }
+
+    size_t sampleSize = format == IAudioRenderer::AudioFormatFloat ? sizeof(float) : sizeof(short);
+
+    SDL_free(m_Input);
+    m_Input = SDL_malloc(samplesPerFrame * channelCount * sampleSize);
+    if (m_Input == nullptr) {
+        return false;
+    }
+
+    m_ChannelCount = channelCount;
+    m_SamplesPerFrame = samplesPerFrame;
+    m_Format = format;
+    reset();
+    return true;
+}
+
+void AudioJitterBuffer::reset()
+{
+    SDL_zero(m_History);
+    m_Position = -1;
+    m_AverageQueuedUs = 0;
+    m_HaveAverage = false;
+}
+
+int AudioJitterBuffer::process(int inputSamples, void* output, int maxOutputSamples,
+                               int queuedUs, int targetUs)
+{
+    // Smooth out the queue level over roughly 16 frames, since it moves
+    // by a whole device period every time the renderer consumes audio.
+    if (!m_HaveAverage) {
+        m_AverageQueuedUs = queuedUs;
+        m_HaveAverage = true;
+    }
+    else {
+        m_AverageQueuedUs += (queuedUs - m_AverageQueuedUs) / 16;
+    }
+
+    // Play faster while the queue is above its target and slower while
+    // it's below. The step is how far we advance in the input per sample.
+    double adjustment = (m_AverageQueuedUs - targetUs) / AUDIO_JITTER_FULL_CORRECTION_US * AUDIO_JITTER_MAX_RATE_ADJUSTMENT;
+    double step = 1.0 + SDL_max(-AUDIO_JITTER_MAX_RATE_ADJUSTMENT, SDL_min(adjustment, AUDIO_JITTER_MAX_RATE_ADJUSTMENT));
+
+    if (m_Format == IAudioRenderer::AudioFormatFloat) {
+        return resample((const float*)m_Input, m_History.f32, inputSamples,
+                        (float*)output, maxOutputSamples, step);
+    }
+    else {
+        return resample((const short*)m_Input, m_History.s16, inputSamples,
+                        (short*)output, maxOutputSamples, step);
+    }
+}
+
+template <typename T>
+int AudioJitterBuffer::resample(const T* input, T* history, int inputSamples,
+                                T* output, int maxOutputSamples, double step)
+{
+    double position = m_Position;
+    int outputSamples = 0;
+
+    while (position < inputSamples - 1 && outputSamples < maxOutputSamples) {
+        int index = (int)floor(position);
+        int fraction = (int)((position - index) * 65536);
+        const T* a = index < 0 ? history : &input[index * m_ChannelCount];
+        const T* b = &input[(index + 1) * m_ChannelCount];
+        T* out = &output[outputSamples * m_ChannelCount];
+
+        for (int c = 0; c < m_ChannelCount; c++) {
+            out[c] = interpolate(a[c], b[c], fraction);
+        }
+
+        outputSamples++;
+        position += step;
+    }
+
+    // Carry the fractional position into the next frame. If the output
+    // filled up early, skip the rest of this frame.
+    m_Position = SDL_max(position - inputSamples, -1.0);
+
+    if (inputSamples > 0) {
+        SDL_memcpy(history,
+                   &input[(inputSamples - 1) * m_ChannelCount],
+                   m_ChannelCount * sizeof(T));
+    }
+
+    return outputSamples;
+}
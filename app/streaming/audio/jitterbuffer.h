@@ -0,0 +1,71 @@
+#pragma once
+
+#include "renderers/renderer.h"
+
+#include <SDL.h>
+
+// Largest correction the jitter buffer applies to the playback rate. At
+// 0.5% the pitch change is inaudible, yet it can absorb 5 ms of clock
+// drift per second.
+#define AUDIO_JITTER_MAX_RATE_ADJUSTMENT 0.005
+
+// Queue error at which the full rate correction is applied
+#define AUDIO_JITTER_FULL_CORRECTION_US 10000
+
+// Keeps the renderer's queue at its latency target by resampling the
+// decoded audio slightly faster or slower. This corrects for the host and
+// client audio clocks drifting apart without the clicks of dropping or
+// repeating whole frames.
+class AudioJitterBuffer
+{
+public:
+    AudioJitterBuffer();
+    ~AudioJitterBuffer();
+
+    bool initialize(int channelCount, int samplesPerFrame, IAudioRenderer::AudioFormat format);
+
+    // Forgets the measured queue level, such as after a renderer change
+    void reset();
+
+    // Frames are decoded here in the output format before they are resampled
+    void* getInputBuffer()
+    {
+        return m_Input;
+    }
+
+    // Largest number of samples per channel that process() can produce
+    int getMaxOutputSamples()
+    {
+        return m_SamplesPerFrame + (int)(m_SamplesPerFrame * AUDIO_JITTER_MAX_RATE_ADJUSTMENT) + 2;
+    }
+
+    // Resamples the decoded samples into output and returns the number of
+    // samples per channel that were written
+    int process(int inputSamples, void* output, int maxOutputSamples,
+                int queuedUs, int targetUs);
+
+private:
+    template <typename T>
+    int resample(const T* input, T* history, int inputSamples,
+                 T* output, int maxOutputSamples, double step);
+
+    int m_ChannelCount;
+    int m_SamplesPerFrame;
+    IAudioRenderer::AudioFormat m_Format;
+    void* m_Input;
+
+    // The last input sample of the previous frame, so interpolation
+    // continues smoothly across frames
+#define AUDIO_JITTER_MAX_CHANNELS 8
+    union {
+        short s16[AUDIO_JITTER_MAX_CHANNELS];
+        float f32[AUDIO_JITTER_MAX_CHANNELS];
+    } m_History;
+
+    // Position of the next output sample relative to the start of the
+    // next input frame, where -1 is m_History
+    double m_Position;
+
+    double m_AverageQueuedUs;
+    bool m_HaveAverage;
+};
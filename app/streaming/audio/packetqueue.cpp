@@ -0,0 +1,101 @@
+#include "packetqueue.h"
+#include "utils.h"
+
+AudioPacketQueue::AudioPacketQueue()
+    : m_Packets(nullptr),
+      m_Semaphore(nullptr)
+{
+    SDL_AtomicSet(&m_WriteIndex, 0);
+    SDL_AtomicSet(&m_ReadIndex, 0);
+}
+
+AudioPacketQueue::~AudioPacketQueue()
+{
+    if (m_Semaphore != nullptr) {
+        SDL_DestroySemaphore(m_Semaphore);
+    }
+
+    SDL_free(m_Packets);
+}
+
+bool AudioPacketQueue::initialize()
+{
+    SDL_AtomicSet(&m_WriteIndex, 0);
+    SDL_AtomicSet(&m_ReadIndex, 0);
+
+    if (m_Packets == nullptr) {
+        m_Packets = (Packet*)SDL_malloc(sizeof(Packet) * AUDIO_PACKET_QUEUE_SLOTS);
+        if (m_Packets == nullptr) {
+            return false;
+        }
+    }
+
+    if (m_Semaphore == nullptr) {
+        m_Semaphore = SDL_CreateSemaphore(0);
+        if (m_Semaphore == nullptr) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "Failed to create audio queue semaphore: %s",
+                         SDL_GetError());
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool AudioPacketQueue::push(const char* data, int length)
+{
+    int writeIndex = SDL_AtomicGet(&m_WriteIndex);
+
+    if (writeIndex - SDL_AtomicGet(&m_ReadIndex) >= AUDIO_PACKET_QUEUE_SLOTS) {
+        return false;
+    }
+
+    if (data != nullptr && (length < 0 || length > AUDIO_PACKET_MAX_SIZE)) {
+        SDL_LOG_RATE_LIMITED(SDL_LogWarn, SDL_LOG_CATEGORY_APPLICATION,
+                             "Dropping oversized audio packet: %d bytes",
+                             length);
+        return false;
+    }
+
+    Packet* packet = &m_Packets[writeIndex & (AUDIO_PACKET_QUEUE_SLOTS - 1)];
+    packet->lost = data == nullptr;
+    packet->length = packet->lost ? 0 : length;
+    if (!packet->lost) {
+        memcpy(packet->data, data, length);
+    }
+
+    // Publishing the write index makes the packet visible to the decoder
+    SDL_AtomicSet(&m_WriteIndex, writeIndex + 1);
+    SDL_SemPost(m_Semaphore);
+    return true;
+}
+
+void AudioPacketQueue::wait()
+{
+    SDL_SemWait(m_Semaphore);
+}
+
+void AudioPacketQueue::wake()
+{
+    SDL_SemPost(m_Semaphore);
+}
+
+bool AudioPacketQueue::front(const unsigned char** data, int* length)
+{
+    int readIndex = SDL_AtomicGet(&m_ReadIndex);
+
+    if (readIndex == SDL_AtomicGet(&m_WriteIndex)) {
+        return false;
+    }
+
+    Packet* packet = &m_Packets[readIndex & (AUDIO_PACKET_QUEUE_SLOTS - 1)];
+    *data = packet->lost ? nullptr : packet->data;
+    *length = packet->length;
+    return true;
+}
+
+void AudioPacketQueue::pop()
+{
+    SDL_AtomicIncRef(&m_ReadIndex);
+}
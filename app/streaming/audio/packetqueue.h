@@ -0,0 +1,55 @@
+#pragma once
+
+#include <SDL.h>
+
+// Enough for 160 ms of 5 ms packets, well beyond any audio latency target
+#define AUDIO_PACKET_QUEUE_SLOTS 32
+
+// Opus packets must fit in a single datagram
+#define AUDIO_PACKET_MAX_SIZE 1500
+
+// Hands Opus packets from moonlight-common-c's receive thread to the
+// audio decoder thread. It's a single producer, single consumer ring, so
+// the receive thread never waits for decoding or device I/O. Packets
+// lost in the network travel through the queue with no data.
+class AudioPacketQueue
+{
+public:
+    AudioPacketQueue();
+    ~AudioPacketQueue();
+
+    bool initialize();
+
+    // Returns false and drops the packet if the queue is full
+    bool push(const char* data, int length);
+
+    // Blocks until a packet may be available or wake() is called
+    void wait();
+
+    void wake();
+
+    // Peeks at the oldest packet without removing it. The data is null
+    // for a lost packet.
+    bool front(const unsigned char** data, int* length);
+
+    void pop();
+
+    // Packets waiting for the decoder, including the one being decoded
+    int getPendingCount()
+    {
+        return SDL_AtomicGet(&m_WriteIndex) - SDL_AtomicGet(&m_ReadIndex);
+    }
+
+private:
+    struct Packet
+    {
+        int length;
+        bool lost;
+        unsigned char data[AUDIO_PACKET_MAX_SIZE];
+    };
+
+    Packet* m_Packets;
+    SDL_atomic_t m_WriteIndex;
+    SDL_atomic_t m_ReadIndex;
+    SDL_sem* m_Semaphore;
+};
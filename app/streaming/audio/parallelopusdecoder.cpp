@@ -0,0 +1,458 @@
+#include "parallelopusdecoder.h"
+#include "packetqueue.h"
+#include "streaming/threadplacement.h"
+
+#include <QtGlobal>
+
+// Beyond this, waking more threads costs more than the decoding it saves
+#define PARALLEL_DECODE_MAX_THREADS 4
+
+ParallelOpusDecoder::ParallelOpusDecoder()
+    : m_Concealing(false),
+      m_FrameSize(0),
+      m_DecodeFec(false),
+      m_WorkerCount(0),
+      m_OwnStreamCount(0),
+      m_DoneSemaphore(nullptr)
+{
+    SDL_zero(m_Config);
+    SDL_zero(m_Decoders);
+    SDL_zero(m_StreamPcm);
+    SDL_zero(m_StreamPackets);
+    SDL_zero(m_StreamPacketLengths);
+    SDL_zero(m_StreamResults);
+    SDL_zero(m_Workers);
+    SDL_AtomicSet(&m_Stopping, 0);
+}
+
+ParallelOpusDecoder::~ParallelOpusDecoder()
+{
+    cleanup();
+}
+
+bool ParallelOpusDecoder::initialize(const OPUS_MULTISTREAM_CONFIGURATION* opusConfig)
+{
+    int error;
+
+    SDL_assert(m_Decoders[0] == nullptr);
+
+    SDL_memcpy(&m_Config, opusConfig, sizeof(m_Config));
+
+    int parts = qMin(qMin(m_Config.streams, SDL_GetCPUCount()), PARALLEL_DECODE_MAX_THREADS);
+    if (parts < 2) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Parallel Opus decoding needs more than one stream and CPU");
+        return false;
+    }
+
+    for (int i = 0; i < m_Config.streams; i++) {
+        int channels = i < m_Config.coupledStreams ? 2 : 1;
+
+        m_Decoders[i] = opus_decoder_create(m_Config.sampleRate, channels, &error);
+        if (m_Decoders[i] == nullptr) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "Failed to create decoder for stream %d: %d",
+                         i, error);
+            cleanup();
+            return false;
+        }
+
+        m_StreamPcm[i] = (float*)SDL_malloc(sizeof(float) * channels * m_Config.samplesPerFrame);
+        m_StreamPackets[i] = (unsigned char*)SDL_malloc(AUDIO_PACKET_MAX_SIZE);
+        if (m_StreamPcm[i] == nullptr || m_StreamPackets[i] == nullptr) {
+            cleanup();
+            return false;
+        }
+    }
+
+    for (int i = 0; i < m_Config.channelCount; i++) {
+        int mapping = m_Config.mapping[i];
+
+        if (mapping == 255) {
+            m_ChannelStream[i] = -1;
+            m_ChannelOffset[i] = 0;
+        }
+        else if (mapping < 2 * m_Config.coupledStreams) {
+            m_ChannelStream[i] = mapping / 2;
+            m_ChannelOffset[i] = mapping % 2;
+        }
+        else {
+            m_ChannelStream[i] = mapping - m_Config.coupledStreams;
+            m_ChannelOffset[i] = 0;
+        }
+    }
+
+    // Coupled streams take about twice as long as mono ones, so the
+    // streams are split into runs of roughly equal channel counts. The
+    // first run is ours and the rest go to the workers.
+    int totalChannels = m_Config.streams + m_Config.coupledStreams;
+    int stream = 0;
+    int channelsAssigned = 0;
+    for (int part = 0; part < parts && stream < m_Config.streams; part++) {
+        int firstStream = stream;
+        int target = totalChannels * (part + 1) / parts;
+
+        // Every part gets at least one stream and leaves one for each
+        // part after it
+        do {
+            channelsAssigned += stream < m_Config.coupledStreams ? 2 : 1;
+            stream++;
+        } while (stream < m_Config.streams - (parts - part - 1) && channelsAssigned < target);
+
+        if (part == 0) {
+            m_OwnStreamCount = stream;
+        }
+        else {
+            Worker* worker = &m_Workers[m_WorkerCount++];
+            worker->parent = this;
+            worker->firstStream = firstStream;
+            worker->streamCount = stream - firstStream;
+        }
+    }
+
+    m_DoneSemaphore = SDL_CreateSemaphore(0);
+    if (m_DoneSemaphore == nullptr) {
+        cleanup();
+        return false;
+    }
+
+    SDL_AtomicSet(&m_Stopping, 0);
+    for (int i = 0; i < m_WorkerCount; i++) {
+        m_Workers[i].startSemaphore = SDL_CreateSemaphore(0);
+        if (m_Workers[i].startSemaphore == nullptr) {
+            cleanup();
+            return false;
+        }
+
+        m_Workers[i].thread = SDL_CreateThread(ParallelOpusDecoder::workerThreadProc, "OpusDecoder", &m_Workers[i]);
+        if (m_Workers[i].thread == nullptr) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "Unable to create Opus decoder thread: %s",
+                         SDL_GetError());
+            cleanup();
+            return false;
+        }
+    }
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Decoding %d Opus streams on %d threads",
+                m_Config.streams,
+                m_WorkerCount + 1);
+    return true;
+}
+
+void ParallelOpusDecoder::cleanup()
+{
+    SDL_AtomicSet(&m_Stopping, 1);
+    for (int i = 0; i < m_WorkerCount; i++) {
+        if (m_Workers[i].thread != nullptr) {
+            SDL_SemPost(m_Workers[i].startSemaphore);
+            SDL_WaitThread(m_Workers[i].thread, nullptr);
+        }
+        if (m_Workers[i].startSemaphore != nullptr) {
+            SDL_DestroySemaphore(m_Workers[i].startSemaphore);
+        }
+    }
+    SDL_zero(m_Workers);
+    m_WorkerCount = 0;
+    m_OwnStreamCount = 0;
+
+    if (m_DoneSemaphore != nullptr) {
+        SDL_DestroySemaphore(m_DoneSemaphore);
+        m_DoneSemaphore = nullptr;
+    }
+
+    for (int i = 0; i < AUDIO_CONFIGURATION_MAX_CHANNEL_COUNT; i++) {
+        if (m_Decoders[i] != nullptr) {
+            opus_decoder_destroy(m_Decoders[i]);
+            m_Decoders[i] = nullptr;
+        }
+        SDL_free(m_StreamPcm[i]);
+        m_StreamPcm[i] = nullptr;
+        SDL_free(m_StreamPackets[i]);
+        m_StreamPackets[i] = nullptr;
+    }
+}
+
+// Reads a frame length as coded in RFC 6716 section 3.2.1. Returns the
+// number of bytes it took, or -1 if the packet is truncated.
+static int readFrameLength(const unsigned char* data, int length, int* frameLength)
+{
+    if (length < 1) {
+        return -1;
+    }
+    else if (data[0] < 252) {
+        *frameLength = data[0];
+        return 1;
+    }
+    else if (length < 2) {
+        return -1;
+    }
+    else {
+        *frameLength = 4 * data[1] + data[0];
+        return 2;
+    }
+}
+
+// Every stream but the last in a multistream packet uses the
+// self-delimiting framing of RFC 6716 appendix B, which adds the length of
+// the last frame right before the frame data. Dropping that length leaves
+// an ordinary packet that opus_decode() accepts. Returns the number of
+// bytes of data used, or -1 if the packet is malformed.
+static int unframeSelfDelimitedPacket(const unsigned char* data, int length,
+                                      unsigned char* packet, int* packetLength)
+{
+    int offset = 1;
+    int frameBytes = 0;
+    int paddingBytes = 0;
+    int frameLength;
+    int used;
+
+    if (length < 1) {
+        return -1;
+    }
+
+    switch (data[0] & 0x3) {
+    case 0:
+    case 1:
+        break;
+
+    case 2:
+        used = readFrameLength(&data[offset], length - offset, &frameLength);
+        if (used < 0) {
+            return -1;
+        }
+        offset += used;
+        frameBytes += frameLength;
+        break;
+
+    case 3:
+        if (offset >= length) {
+            return -1;
+        }
+        else {
+            int countByte = data[offset++];
+            int frameCount = countByte & 0x3F;
+
+            if (frameCount == 0) {
+                return -1;
+            }
+
+            if (countByte & 0x40) {
+                int paddingByte;
+                do {
+                    if (offset >= length) {
+                        return -1;
+                    }
+                    paddingByte = data[offset++];
+                    paddingBytes += paddingByte == 255 ? 254 : paddingByte;
+                } while (paddingByte == 255);
+            }
+
+            // VBR packets code every length but the last
+            if (countByte & 0x80) {
+                for (int i = 0; i < frameCount - 1; i++) {
+                    used = readFrameLength(&data[offset], length - offset, &frameLength);
+                    if (used < 0) {
+                        return -1;
+                    }
+                    offset += used;
+                    frameBytes += frameLength;
+                }
+            }
+        }
+        break;
+    }
+
+    int headerLength = offset;
+    used = readFrameLength(&data[offset], length - offset, &frameLength);
+    if (used < 0) {
+        return -1;
+    }
+    offset += used;
+
+    switch (data[0] & 0x3) {
+    case 1:
+        frameBytes = 2 * frameLength;
+        break;
+
+    case 3:
+        if ((data[1] & 0x80) == 0) {
+            // CBR packets code one length for all frames
+            frameBytes = (data[1] & 0x3F) * frameLength;
+            break;
+        }
+        // fall through
+
+    default:
+        frameBytes += frameLength;
+        break;
+    }
+
+    int payloadLength = frameBytes + paddingBytes;
+    if (payloadLength > length - offset) {
+        return -1;
+    }
+
+    SDL_memcpy(packet, data, headerLength);
+    SDL_memcpy(&packet[headerLength], &data[offset], payloadLength);
+    *packetLength = headerLength + payloadLength;
+    return offset + payloadLength;
+}
+
+bool ParallelOpusDecoder::splitPacket(const unsigned char* data, int length)
+{
+    if (length > AUDIO_PACKET_MAX_SIZE) {
+        return false;
+    }
+
+    for (int i = 0; i < m_Config.streams - 1; i++) {
+        int used = unframeSelfDelimitedPacket(data, length,
+                                              m_StreamPackets[i],
+                                              &m_StreamPacketLengths[i]);
+        if (used < 0) {
+            return false;
+        }
+
+        data += used;
+        length -= used;
+    }
+
+    // The last stream takes the rest of the packet
+    if (length <= 0) {
+        return false;
+    }
+    SDL_memcpy(m_StreamPackets[m_Config.streams - 1], data, length);
+    m_StreamPacketLengths[m_Config.streams - 1] = length;
+    return true;
+}
+
+void ParallelOpusDecoder::decodeStreamRange(int firstStream, int streamCount)
+{
+    for (int i = firstStream; i < firstStream + streamCount; i++) {
+        m_StreamResults[i] = opus_decode_float(m_Decoders[i],
+                                               m_Concealing ? nullptr : m_StreamPackets[i],
+                                               m_Concealing ? 0 : m_StreamPacketLengths[i],
+                                               m_StreamPcm[i],
+                                               m_FrameSize,
+                                               m_DecodeFec ? 1 : 0);
+    }
+}
+
+int ParallelOpusDecoder::workerThreadProc(void* context)
+{
+    auto worker = reinterpret_cast<Worker*>(context);
+    auto me = worker->parent;
+
+    ThreadPlacement::applyToCurrentThread(ThreadPlacement::TR_AUDIO);
+
+    for (;;) {
+        SDL_SemWait(worker->startSemaphore);
+        if (SDL_AtomicGet(&me->m_Stopping)) {
+            break;
+        }
+
+        me->decodeStreamRange(worker->firstStream, worker->streamCount);
+        SDL_SemPost(me->m_DoneSemaphore);
+    }
+
+    return 0;
+}
+
+int ParallelOpusDecoder::decodeStreams(const unsigned char* data, int length,
+                                       int frameSize, bool decodeFec)
+{
+    if (frameSize > m_Config.samplesPerFrame) {
+        frameSize = m_Config.samplesPerFrame;
+    }
+
+    m_Concealing = data == nullptr;
+    if (!m_Concealing && !splitPacket(data, length)) {
+        return OPUS_INVALID_PACKET;
+    }
+
+    m_FrameSize = frameSize;
+    m_DecodeFec = decodeFec;
+
+    for (int i = 0; i < m_WorkerCount; i++) {
+        SDL_SemPost(m_Workers[i].startSemaphore);
+    }
+
+    decodeStreamRange(0, m_OwnStreamCount);
+
+    for (int i = 0; i < m_WorkerCount; i++) {
+        SDL_SemWait(m_DoneSemaphore);
+    }
+
+    // Every stream must decode to the same duration
+    for (int i = 0; i < m_Config.streams; i++) {
+        if (m_StreamResults[i] < 0) {
+            return m_StreamResults[i];
+        }
+        else if (m_StreamResults[i] != m_StreamResults[0]) {
+            return OPUS_INVALID_PACKET;
+        }
+    }
+
+    return m_StreamResults[0];
+}
+
+int ParallelOpusDecoder::decodeFloat(const unsigned char* data, int length,
+                                     float* pcm, int frameSize, bool decodeFec)
+{
+    int samples = decodeStreams(data, length, frameSize, decodeFec);
+    if (samples <= 0) {
+        return samples;
+    }
+
+    for (int c = 0; c < m_Config.channelCount; c++) {
+        int stream = m_ChannelStream[c];
+
+        if (stream < 0) {
+            for (int i = 0; i < samples; i++) {
+                pcm[i * m_Config.channelCount + c] = 0.0f;
+            }
+        }
+        else {
+            int stride = stream < m_Config.coupledStreams ? 2 : 1;
+            const float* src = &m_StreamPcm[stream][m_ChannelOffset[c]];
+
+            for (int i = 0; i < samples; i++) {
+                pcm[i * m_Config.channelCount + c] = src[i * stride];
+            }
+        }
+    }
+
+    return samples;
+}
+
+int ParallelOpusDecoder::decode(const unsigned char* data, int length,
+                                short* pcm, int frameSize, bool decodeFec)
+{
+    int samples = decodeStreams(data, length, frameSize, decodeFec);
+    if (samples <= 0) {
+        return samples;
+    }
+
+    for (int c = 0; c < m_Config.channelCount; c++) {
+        int stream = m_ChannelStream[c];
+
+        if (stream < 0) {
+            for (int i = 0; i < samples; i++) {
+                pcm[i * m_Config.channelCount + c] = 0;
+            }
+        }
+        else {
+            int stride = stream < m_Config.coupledStreams ? 2 : 1;
+            const float* src = &m_StreamPcm[stream][m_ChannelOffset[c]];
+
+            // Rounded and clamped the same way as Opus' own s16 output
+            for (int i = 0; i < samples; i++) {
+                float sample = qBound(-32768.0f, src[i * stride] * 32768.0f, 32767.0f);
+                pcm[i * m_Config.channelCount + c] = (short)qRound(sample);
+            }
+        }
+    }
+
+    return samples;
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <SDL.h>
+
+#define AUDIO_FRAME_RING_SLOTS 16
+
+// Carries decoded frames from the decoder thread to a device thread that
+// pulls audio whenever the device asks for it. There is exactly one
+// producer and one consumer, so neither side ever waits for the other.
+// The producer writes whole frames, which the consumer reads back as a
+// continuous stream of bytes.
+class AudioFrameRing
+{
+public:
+    AudioFrameRing()
+        : m_SlotSize(0),
+          m_Slots(nullptr),
+          m_ReadOffset(0)
+    {
+        SDL_AtomicSet(&m_WriteIndex, 0);
+        SDL_AtomicSet(&m_ReadIndex, 0);
+    }
+
+    ~AudioFrameRing()
+    {
+        SDL_free(m_Slots);
+    }
+
+    // Slots must have room for the jitter buffer stretching a frame
+    bool initialize(int slotSize)
+    {
+        m_SlotSize = slotSize;
+        m_Slots = (Uint8*)SDL_malloc(slotSize * AUDIO_FRAME_RING_SLOTS);
+        return m_Slots != nullptr;
+    }
+
+    // Producer only. Returns null if the ring is full.
+    void* getWriteBuffer(int* size)
+    {
+        int writeIndex = SDL_AtomicGet(&m_WriteIndex);
+        if (writeIndex - SDL_AtomicGet(&m_ReadIndex) >= AUDIO_FRAME_RING_SLOTS) {
+            return nullptr;
+        }
+
+        *size = SDL_min(*size, m_SlotSize);
+        return &m_Slots[(writeIndex & (AUDIO_FRAME_RING_SLOTS - 1)) * m_SlotSize];
+    }
+
+    // Producer only. Publishing the write index makes the frame visible
+    // to the consumer.
+    void submit(int bytesWritten)
+    {
+        int writeIndex = SDL_AtomicGet(&m_WriteIndex);
+        m_SlotLength[writeIndex & (AUDIO_FRAME_RING_SLOTS - 1)] = bytesWritten;
+        SDL_AtomicSet(&m_WriteIndex, writeIndex + 1);
+    }
+
+    // Exact when called by the consumer, a lower bound otherwise
+    int getQueuedFrames()
+    {
+        return SDL_AtomicGet(&m_WriteIndex) - SDL_AtomicGet(&m_ReadIndex);
+    }
+
+    // Consumer only. Copies up to length bytes and returns how many bytes
+    // were copied, which is less than length if the ring runs dry.
+    int read(Uint8* buffer, int length)
+    {
+        int readIndex = SDL_AtomicGet(&m_ReadIndex);
+        int writeIndex = SDL_AtomicGet(&m_WriteIndex);
+        int bytesRead = 0;
+
+        while (bytesRead < length && readIndex != writeIndex) {
+            int slot = readIndex & (AUDIO_FRAME_RING_SLOTS - 1);
+            int bytesToCopy = SDL_min(m_SlotLength[slot] - m_ReadOffset, length - bytesRead);
+
+            memcpy(&buffer[bytesRead], &m_Slots[slot * m_SlotSize + m_ReadOffset], bytesToCopy);
+            bytesRead += bytesToCopy;
+
+            m_ReadOffset += bytesToCopy;
+            if (m_ReadOffset == m_SlotLength[slot]) {
+                m_ReadOffset = 0;
+                readIndex++;
+            }
+        }
+
+        // Return the slots we've finished to the producer
+        SDL_AtomicSet(&m_ReadIndex, readIndex);
+        return bytesRead;
+    }
+
+    // Consumer only. Drops the oldest frames until at most maxFrames are
+    // queued. Frames can only be dropped whole, so this does nothing in
+    // the middle of a frame.
+    void trim(int maxFrames)
+    {
+        int writeIndex = SDL_AtomicGet(&m_WriteIndex);
+        if (m_ReadOffset == 0 && writeIndex - SDL_AtomicGet(&m_ReadIndex) > maxFrames) {
+            SDL_AtomicSet(&m_ReadIndex, writeIndex - maxFrames);
+        }
+    }
+
+private:
+    int m_SlotSize;
+    Uint8* m_Slots;
+    int m_SlotLength[AUDIO_FRAME_RING_SLOTS];
+    SDL_atomic_t m_WriteIndex;
+    SDL_atomic_t m_ReadIndex;
+    int m_ReadOffset;
+};
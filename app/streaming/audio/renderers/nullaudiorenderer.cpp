@@ -0,0 +1,45 @@
+#include "nullaudiorenderer.h"
+
+#include <SDL.h>
+
+NullAudioRenderer::NullAudioRenderer()
+    : m_AudioBuffer(nullptr),
+      m_AudioBufferSize(0)
+{
+}
+
+NullAudioRenderer::~NullAudioRenderer()
+{
+    SDL_free(m_AudioBuffer);
+}
+
+bool NullAudioRenderer::prepareForPlayback(const OPUS_MULTISTREAM_CONFIGURATION* opusConfig)
+{
+    m_AudioBufferSize = opusConfig->samplesPerFrame * sizeof(short) * opusConfig->channelCount;
+    m_AudioBuffer = SDL_malloc(m_AudioBufferSize);
+    if (m_AudioBuffer == nullptr) {
+        return false;
+    }
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Using null audio renderer");
+    return true;
+}
+
+void* NullAudioRenderer::getAudioBuffer(int* size)
+{
+    *size = SDL_min(*size, m_AudioBufferSize);
+    return m_AudioBuffer;
+}
+
+bool NullAudioRenderer::submitAudio(int)
+{
+    return true;
+}
+
+int NullAudioRenderer::getCapabilities()
+{
+    // Decoding happens on our own thread, so there's no reason for
+    // moonlight-common-c to queue packets in front of it
+    return CAPABILITY_DIRECT_SUBMIT;
+}
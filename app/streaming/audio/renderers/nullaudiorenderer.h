@@ -0,0 +1,25 @@
+#pragma once
+
+#include "renderer.h"
+
+// Decoded audio is thrown away without ever opening a device, for
+// headless streams on machines that may not have one
+class NullAudioRenderer : public IAudioRenderer
+{
+public:
+    NullAudioRenderer();
+
+    virtual ~NullAudioRenderer();
+
+    virtual bool prepareForPlayback(const OPUS_MULTISTREAM_CONFIGURATION* opusConfig);
+
+    virtual void* getAudioBuffer(int* size);
+
+    virtual bool submitAudio(int bytesWritten);
+
+    virtual int getCapabilities();
+
+private:
+    void* m_AudioBuffer;
+    int m_AudioBufferSize;
+};
@@ -0,0 +1,278 @@
+#include "pipewireaudiorenderer.h"
+
+#include <spa/param/audio/format-utils.h>
+
+// Frames queued beyond the target are dropped once they exceed this, so
+// a burst after a network stall can't leave a lasting delay behind
+#define PIPEWIRE_MAX_EXCESS_FRAMES 4
+
+// How long to wait for the stream to be linked to a device
+#define PIPEWIRE_CONNECT_TIMEOUT_SEC 2
+
+PipeWireAudioRenderer::PipeWireAudioRenderer()
+    : m_Loop(nullptr),
+      m_Stream(nullptr),
+      m_State(PW_STREAM_STATE_UNCONNECTED),
+      m_SampleRate(0),
+      m_BytesPerFrame(0),
+      m_FrameDurationUs(0)
+{
+    pw_init(nullptr, nullptr);
+
+    SDL_zero(m_StreamEvents);
+    m_StreamEvents.version = PW_VERSION_STREAM_EVENTS;
+    m_StreamEvents.process = onProcess;
+    m_StreamEvents.state_changed = onStateChanged;
+
+    SDL_AtomicSet(&m_Errored, 0);
+    SDL_AtomicSet(&m_QuantumUs, 0);
+}
+
+PipeWireAudioRenderer::~PipeWireAudioRenderer()
+{
+    if (m_Loop != nullptr) {
+        pw_thread_loop_stop(m_Loop);
+    }
+
+    if (m_Stream != nullptr) {
+        pw_stream_destroy(m_Stream);
+    }
+
+    if (m_Loop != nullptr) {
+        pw_thread_loop_destroy(m_Loop);
+    }
+
+    pw_deinit();
+}
+
+bool PipeWireAudioRenderer::prepareForPlayback(const OPUS_MULTISTREAM_CONFIGURATION* opusConfig)
+{
+    // Moonlight's channel order, which is also the WAVEFORMATEXTENSIBLE order
+    static const enum spa_audio_channel k_Positions[] = {
+        SPA_AUDIO_CHANNEL_FL, SPA_AUDIO_CHANNEL_FR,
+        SPA_AUDIO_CHANNEL_FC, SPA_AUDIO_CHANNEL_LFE,
+        SPA_AUDIO_CHANNEL_RL, SPA_AUDIO_CHANNEL_RR,
+        SPA_AUDIO_CHANNEL_SL, SPA_AUDIO_CHANNEL_SR
+    };
+
+    if (opusConfig->channelCount > (int)SDL_arraysize(k_Positions)) {
+        return false;
+    }
+
+    m_BytesPerFrame = sizeof(float) * opusConfig->channelCount;
+    m_FrameDurationUs = (int)((Sint64)opusConfig->samplesPerFrame * 1000000 / opusConfig->sampleRate);
+    m_SampleRate = opusConfig->sampleRate;
+    SDL_AtomicSet(&m_QuantumUs, m_FrameDurationUs);
+
+    // Leave room for the jitter buffer stretching a frame by a few samples
+    if (!m_Ring.initialize((opusConfig->samplesPerFrame + opusConfig->samplesPerFrame / 100 + 2) * m_BytesPerFrame)) {
+        return false;
+    }
+
+    m_Loop = pw_thread_loop_new("Moonlight", nullptr);
+    if (m_Loop == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "pw_thread_loop_new() failed");
+        return false;
+    }
+
+    // The graph picks the smallest quantum that any of its nodes asks for
+    char latency[32];
+    SDL_snprintf(latency, sizeof(latency), "%d/%d", opusConfig->samplesPerFrame, opusConfig->sampleRate);
+
+    pw_properties* props = pw_properties_new(PW_KEY_MEDIA_TYPE, "Audio",
+                                             PW_KEY_MEDIA_CATEGORY, "Playback",
+                                             PW_KEY_MEDIA_ROLE, "Game",
+                                             PW_KEY_NODE_LATENCY, latency,
+                                             nullptr);
+
+    // This fails if there's no PipeWire daemon to connect to
+    m_Stream = pw_stream_new_simple(pw_thread_loop_get_loop(m_Loop), "Moonlight",
+                                    props, &m_StreamEvents, this);
+    if (m_Stream == nullptr) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Unable to connect to PipeWire: %d",
+                    errno);
+        return false;
+    }
+
+    struct spa_audio_info_raw info;
+    SDL_zero(info);
+    info.format = SPA_AUDIO_FORMAT_F32;
+    info.rate = opusConfig->sampleRate;
+    info.channels = opusConfig->channelCount;
+    for (int i = 0; i < opusConfig->channelCount; i++) {
+        info.position[i] = k_Positions[i];
+    }
+
+    uint8_t podBuffer[1024];
+    struct spa_pod_builder builder = SPA_POD_BUILDER_INIT(podBuffer, sizeof(podBuffer));
+    const struct spa_pod* params[1];
+    params[0] = spa_format_audio_raw_build(&builder, SPA_PARAM_EnumFormat, &info);
+
+    int err = pw_stream_connect(m_Stream, PW_DIRECTION_OUTPUT, PW_ID_ANY,
+                                (enum pw_stream_flags)(PW_STREAM_FLAG_AUTOCONNECT |
+                                                       PW_STREAM_FLAG_MAP_BUFFERS |
+                                                       PW_STREAM_FLAG_RT_PROCESS),
+                                params, 1);
+    if (err < 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "pw_stream_connect() failed: %d",
+                     err);
+        return false;
+    }
+
+    pw_thread_loop_lock(m_Loop);
+
+    err = pw_thread_loop_start(m_Loop);
+    if (err < 0) {
+        pw_thread_loop_unlock(m_Loop);
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "pw_thread_loop_start() failed: %d",
+                     err);
+        return false;
+    }
+
+    // Wait until the stream has been linked to a device, so we can fall
+    // back to another renderer if there's nothing to play to
+    while (m_State == PW_STREAM_STATE_UNCONNECTED || m_State == PW_STREAM_STATE_CONNECTING) {
+        if (pw_thread_loop_timed_wait(m_Loop, PIPEWIRE_CONNECT_TIMEOUT_SEC) != 0) {
+            break;
+        }
+    }
+
+    bool connected = m_State == PW_STREAM_STATE_PAUSED || m_State == PW_STREAM_STATE_STREAMING;
+    pw_thread_loop_unlock(m_Loop);
+
+    if (!connected) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "PipeWire stream failed to connect: %s",
+                    pw_stream_state_as_string(m_State));
+        return false;
+    }
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "PipeWire stream connected: %d channels, %s quantum",
+                opusConfig->channelCount,
+                latency);
+
+    return true;
+}
+
+void PipeWireAudioRenderer::onStateChanged(void* userdata, enum pw_stream_state, enum pw_stream_state state, const char* error)
+{
+    PipeWireAudioRenderer* me = (PipeWireAudioRenderer*)userdata;
+
+    if (state == PW_STREAM_STATE_ERROR) {
+        // The decoder thread will see this and recreate the renderer
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "PipeWire stream error: %s",
+                     error != nullptr ? error : "unknown");
+        SDL_AtomicSet(&me->m_Errored, 1);
+    }
+
+    me->m_State = state;
+    pw_thread_loop_signal(me->m_Loop, false);
+}
+
+void PipeWireAudioRenderer::onProcess(void* userdata)
+{
+    PipeWireAudioRenderer* me = (PipeWireAudioRenderer*)userdata;
+
+    pw_buffer* buffer = pw_stream_dequeue_buffer(me->m_Stream);
+    if (buffer == nullptr) {
+        return;
+    }
+
+    struct spa_data* data = &buffer->buffer->datas[0];
+    if (data->data == nullptr) {
+        pw_stream_queue_buffer(me->m_Stream, buffer);
+        return;
+    }
+
+    int frames = data->maxsize / me->m_BytesPerFrame;
+#if PW_CHECK_VERSION(0, 3, 49)
+    // Fill only as much as this cycle needs, which keeps the latency at
+    // a single quantum
+    if (buffer->requested != 0) {
+        frames = SDL_min(frames, (int)buffer->requested);
+    }
+#endif
+
+    int quantumUs = (int)((Sint64)frames * 1000000 / me->m_SampleRate);
+    SDL_AtomicSet(&me->m_QuantumUs, quantumUs);
+
+    // Drop whole frames that have piled up far beyond the target
+    me->m_Ring.trim((quantumUs + me->m_FrameDurationUs) / me->m_FrameDurationUs + 1 + PIPEWIRE_MAX_EXCESS_FRAMES);
+
+    Uint8* dst = (Uint8*)data->data;
+    int len = frames * me->m_BytesPerFrame;
+    int bytesRead = me->m_Ring.read(dst, len);
+    memset(dst + bytesRead, 0, len - bytesRead);
+
+    data->chunk->offset = 0;
+    data->chunk->stride = me->m_BytesPerFrame;
+    data->chunk->size = len;
+
+    pw_stream_queue_buffer(me->m_Stream, buffer);
+}
+
+void* PipeWireAudioRenderer::getAudioBuffer(int* size)
+{
+    // If the ring is full, skip decoding this frame entirely
+    return m_Ring.getWriteBuffer(size);
+}
+
+bool PipeWireAudioRenderer::submitAudio(int bytesWritten)
+{
+    if (SDL_AtomicGet(&m_Errored)) {
+        return false;
+    }
+
+    if (bytesWritten == 0) {
+        // Nothing to do
+        return true;
+    }
+
+    m_Ring.submit(bytesWritten);
+    return true;
+}
+
+bool PipeWireAudioRenderer::getQueueStatus(int* queuedUs, int* targetUs)
+{
+    *queuedUs = m_Ring.getQueuedFrames() * m_FrameDurationUs;
+
+    // The graph drains the ring a quantum at a time, so keep a quantum
+    // plus a frame of network jitter queued
+    *targetUs = SDL_AtomicGet(&m_QuantumUs) + m_FrameDurationUs;
+    return true;
+}
+
+int PipeWireAudioRenderer::getDeviceLatencyUs()
+{
+    // This is safe to call from any thread
+    struct pw_time time;
+#if PW_CHECK_VERSION(0, 3, 50)
+    int err = pw_stream_get_time_n(m_Stream, &time, sizeof(time));
+#else
+    int err = pw_stream_get_time(m_Stream, &time);
+#endif
+    if (err < 0 || time.rate.denom == 0) {
+        return 0;
+    }
+
+    // The delay is counted in graph clock ticks
+    return (int)(time.delay * 1000000 * time.rate.num / time.rate.denom);
+}
+
+IAudioRenderer::AudioFormat PipeWireAudioRenderer::getAudioBufferFormat()
+{
+    return AudioFormatFloat;
+}
+
+int PipeWireAudioRenderer::getCapabilities()
+{
+    // Decoding happens on our own thread, so there's no reason for
+    // moonlight-common-c to queue packets in front of it
+    return CAPABILITY_DIRECT_SUBMIT;
+}
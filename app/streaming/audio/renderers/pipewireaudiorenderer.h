@@ -0,0 +1,59 @@
+#pragma once
+
+#include "renderer.h"
+#include "framering.h"
+
+#include <SDL.h>
+
+#include <pipewire/pipewire.h>
+
+// Plays audio through a native PipeWire stream. The graph pulls audio
+// from us on its real-time thread, and we ask for a quantum of a single
+// Opus frame so nothing waits on a larger server buffer. PipeWire maps
+// the stream's channels to the device layout itself.
+class PipeWireAudioRenderer : public IAudioRenderer
+{
+public:
+    PipeWireAudioRenderer();
+
+    virtual ~PipeWireAudioRenderer();
+
+    virtual bool prepareForPlayback(const OPUS_MULTISTREAM_CONFIGURATION* opusConfig);
+
+    virtual void* getAudioBuffer(int* size);
+
+    virtual bool submitAudio(int bytesWritten);
+
+    virtual int getCapabilities();
+
+    virtual bool getQueueStatus(int* queuedUs, int* targetUs);
+
+    virtual int getDeviceLatencyUs();
+
+    virtual AudioFormat getAudioBufferFormat();
+
+private:
+    static void onProcess(void* userdata);
+
+    static void onStateChanged(void* userdata, enum pw_stream_state old,
+                               enum pw_stream_state state, const char* error);
+
+    pw_thread_loop* m_Loop;
+    pw_stream* m_Stream;
+    pw_stream_events m_StreamEvents;
+
+    // Written on the loop thread while the loop lock is held
+    pw_stream_state m_State;
+    SDL_atomic_t m_Errored;
+
+    int m_SampleRate;
+    int m_BytesPerFrame;
+
+    // The quantum can be raised by other clients in the graph, so this
+    // tracks what the process callback is actually asked for
+    SDL_atomic_t m_QuantumUs;
+
+    // Frames from the decoder thread wait here until the graph pulls them
+    AudioFrameRing m_Ring;
+    int m_FrameDurationUs;
+};
@@ -0,0 +1,279 @@
+#include "pulseaudiorenderer.h"
+
+// Frames queued beyond the target are dropped once they exceed this, so
+// a burst after a network stall can't leave a lasting delay behind
+#define PULSEAUDIO_MAX_EXCESS_FRAMES 4
+
+// Number of frames the server holds in its own buffer
+#define PULSEAUDIO_TARGET_FRAMES 2
+
+PulseAudioRenderer::PulseAudioRenderer()
+    : m_MainLoop(nullptr),
+      m_Context(nullptr),
+      m_Stream(nullptr),
+      m_BytesPerFrame(0),
+      m_FrameDurationUs(0)
+{
+    SDL_AtomicSet(&m_Errored, 0);
+    SDL_AtomicSet(&m_DeviceLatencyUs, 0);
+}
+
+PulseAudioRenderer::~PulseAudioRenderer()
+{
+    // Nothing else touches the stream or context once the loop has stopped
+    if (m_MainLoop != nullptr) {
+        pa_threaded_mainloop_stop(m_MainLoop);
+    }
+
+    if (m_Stream != nullptr) {
+        pa_stream_disconnect(m_Stream);
+        pa_stream_unref(m_Stream);
+    }
+
+    if (m_Context != nullptr) {
+        pa_context_disconnect(m_Context);
+        pa_context_unref(m_Context);
+    }
+
+    if (m_MainLoop != nullptr) {
+        pa_threaded_mainloop_free(m_MainLoop);
+    }
+}
+
+bool PulseAudioRenderer::prepareForPlayback(const OPUS_MULTISTREAM_CONFIGURATION* opusConfig)
+{
+    m_BytesPerFrame = sizeof(float) * opusConfig->channelCount;
+    m_FrameDurationUs = (int)((Sint64)opusConfig->samplesPerFrame * 1000000 / opusConfig->sampleRate);
+
+    // Leave room for the jitter buffer stretching a frame by a few samples
+    if (!m_Ring.initialize((opusConfig->samplesPerFrame + opusConfig->samplesPerFrame / 100 + 2) * m_BytesPerFrame)) {
+        return false;
+    }
+
+    m_MainLoop = pa_threaded_mainloop_new();
+    if (m_MainLoop == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "pa_threaded_mainloop_new() failed");
+        return false;
+    }
+
+    m_Context = pa_context_new(pa_threaded_mainloop_get_api(m_MainLoop), "Moonlight");
+    if (m_Context == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "pa_context_new() failed");
+        return false;
+    }
+
+    pa_context_set_state_callback(m_Context, contextStateCallback, this);
+
+    // Don't spawn a server if one isn't already running
+    if (pa_context_connect(m_Context, nullptr, PA_CONTEXT_NOAUTOSPAWN, nullptr) < 0) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Unable to connect to PulseAudio: %s",
+                    pa_strerror(pa_context_errno(m_Context)));
+        return false;
+    }
+
+    pa_threaded_mainloop_lock(m_MainLoop);
+
+    if (pa_threaded_mainloop_start(m_MainLoop) < 0) {
+        pa_threaded_mainloop_unlock(m_MainLoop);
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "pa_threaded_mainloop_start() failed");
+        return false;
+    }
+
+    bool ret = connect(opusConfig);
+    pa_threaded_mainloop_unlock(m_MainLoop);
+
+    return ret;
+}
+
+// Called with the main loop locked
+bool PulseAudioRenderer::connect(const OPUS_MULTISTREAM_CONFIGURATION* opusConfig)
+{
+    for (;;) {
+        pa_context_state_t state = pa_context_get_state(m_Context);
+        if (state == PA_CONTEXT_READY) {
+            break;
+        }
+        else if (!PA_CONTEXT_IS_GOOD(state)) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "Unable to connect to PulseAudio: %s",
+                        pa_strerror(pa_context_errno(m_Context)));
+            return false;
+        }
+
+        pa_threaded_mainloop_wait(m_MainLoop);
+    }
+
+    pa_sample_spec spec;
+    spec.format = PA_SAMPLE_FLOAT32NE;
+    spec.rate = opusConfig->sampleRate;
+    spec.channels = opusConfig->channelCount;
+
+    // Moonlight's channel order is the WAVEFORMATEXTENSIBLE order
+    pa_channel_map map;
+    if (pa_channel_map_init_extend(&map, opusConfig->channelCount, PA_CHANNEL_MAP_WAVEEX) == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unsupported PulseAudio channel count: %d",
+                     opusConfig->channelCount);
+        return false;
+    }
+
+    m_Stream = pa_stream_new(m_Context, "Moonlight", &spec, &map);
+    if (m_Stream == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "pa_stream_new() failed: %s",
+                     pa_strerror(pa_context_errno(m_Context)));
+        return false;
+    }
+
+    pa_stream_set_state_callback(m_Stream, streamStateCallback, this);
+    pa_stream_set_write_callback(m_Stream, writeCallback, this);
+
+    // Ask the server to keep just a few frames buffered and to request
+    // more each time a frame has been played
+    pa_buffer_attr attr;
+    attr.maxlength = (uint32_t)-1;
+    attr.tlength = PULSEAUDIO_TARGET_FRAMES * opusConfig->samplesPerFrame * m_BytesPerFrame;
+    attr.prebuf = (uint32_t)-1;
+    attr.minreq = opusConfig->samplesPerFrame * m_BytesPerFrame;
+    attr.fragsize = (uint32_t)-1;
+
+    if (pa_stream_connect_playback(m_Stream, nullptr, &attr,
+                                   (pa_stream_flags_t)(PA_STREAM_ADJUST_LATENCY |
+                                                       PA_STREAM_AUTO_TIMING_UPDATE |
+                                                       PA_STREAM_INTERPOLATE_TIMING),
+                                   nullptr, nullptr) < 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "pa_stream_connect_playback() failed: %s",
+                     pa_strerror(pa_context_errno(m_Context)));
+        return false;
+    }
+
+    for (;;) {
+        pa_stream_state_t state = pa_stream_get_state(m_Stream);
+        if (state == PA_STREAM_READY) {
+            break;
+        }
+        else if (!PA_STREAM_IS_GOOD(state)) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "PulseAudio stream failed to connect: %s",
+                         pa_strerror(pa_context_errno(m_Context)));
+            return false;
+        }
+
+        pa_threaded_mainloop_wait(m_MainLoop);
+    }
+
+    const pa_buffer_attr* actualAttr = pa_stream_get_buffer_attr(m_Stream);
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "PulseAudio stream connected: %d channels, %u byte target, %u byte request",
+                opusConfig->channelCount,
+                actualAttr->tlength,
+                actualAttr->minreq);
+
+    return true;
+}
+
+void PulseAudioRenderer::contextStateCallback(pa_context*, void* userdata)
+{
+    PulseAudioRenderer* me = (PulseAudioRenderer*)userdata;
+
+    pa_threaded_mainloop_signal(me->m_MainLoop, 0);
+}
+
+void PulseAudioRenderer::streamStateCallback(pa_stream* stream, void* userdata)
+{
+    PulseAudioRenderer* me = (PulseAudioRenderer*)userdata;
+
+    // The decoder thread will see this and recreate the renderer
+    if (!PA_STREAM_IS_GOOD(pa_stream_get_state(stream))) {
+        SDL_AtomicSet(&me->m_Errored, 1);
+    }
+
+    pa_threaded_mainloop_signal(me->m_MainLoop, 0);
+}
+
+void PulseAudioRenderer::writeCallback(pa_stream* stream, size_t length, void* userdata)
+{
+    PulseAudioRenderer* me = (PulseAudioRenderer*)userdata;
+
+    void* data;
+    if (pa_stream_begin_write(stream, &data, &length) < 0) {
+        return;
+    }
+
+    // Only whole frames may be written
+    int len = (int)(length / me->m_BytesPerFrame) * me->m_BytesPerFrame;
+    if (len == 0) {
+        pa_stream_cancel_write(stream);
+        return;
+    }
+
+    // The stream's latency can only be read with the main loop locked,
+    // so sample it here for the decoder thread
+    pa_usec_t latencyUs;
+    int negative;
+    if (pa_stream_get_latency(stream, &latencyUs, &negative) == 0) {
+        SDL_AtomicSet(&me->m_DeviceLatencyUs, negative ? 0 : (int)SDL_min(latencyUs, (pa_usec_t)1000000));
+    }
+
+    // Drop whole frames that have piled up far beyond the target
+    me->m_Ring.trim(PULSEAUDIO_TARGET_FRAMES + 1 + PULSEAUDIO_MAX_EXCESS_FRAMES);
+
+    Uint8* dst = (Uint8*)data;
+    int bytesRead = me->m_Ring.read(dst, len);
+    memset(dst + bytesRead, 0, len - bytesRead);
+
+    pa_stream_write(stream, data, len, nullptr, 0, PA_SEEK_RELATIVE);
+}
+
+void* PulseAudioRenderer::getAudioBuffer(int* size)
+{
+    // If the ring is full, skip decoding this frame entirely
+    return m_Ring.getWriteBuffer(size);
+}
+
+bool PulseAudioRenderer::submitAudio(int bytesWritten)
+{
+    if (SDL_AtomicGet(&m_Errored)) {
+        return false;
+    }
+
+    if (bytesWritten == 0) {
+        // Nothing to do
+        return true;
+    }
+
+    m_Ring.submit(bytesWritten);
+    return true;
+}
+
+bool PulseAudioRenderer::getQueueStatus(int* queuedUs, int* targetUs)
+{
+    *queuedUs = m_Ring.getQueuedFrames() * m_FrameDurationUs;
+
+    // The server asks for a frame at a time, so keep that plus a frame
+    // of network jitter queued
+    *targetUs = 2 * m_FrameDurationUs;
+    return true;
+}
+
+int PulseAudioRenderer::getDeviceLatencyUs()
+{
+    return SDL_AtomicGet(&m_DeviceLatencyUs);
+}
+
+IAudioRenderer::AudioFormat PulseAudioRenderer::getAudioBufferFormat()
+{
+    return AudioFormatFloat;
+}
+
+int PulseAudioRenderer::getCapabilities()
+{
+    // Decoding happens on our own thread, so there's no reason for
+    // moonlight-common-c to queue packets in front of it
+    return CAPABILITY_DIRECT_SUBMIT;
+}
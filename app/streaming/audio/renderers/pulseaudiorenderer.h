@@ -0,0 +1,54 @@
+#pragma once
+
+#include "renderer.h"
+#include "framering.h"
+
+#include <SDL.h>
+
+#include <pulse/pulseaudio.h>
+
+// Plays audio through a native PulseAudio stream with a server buffer of
+// only a couple of Opus frames. The server asks for more audio every
+// frame, and PulseAudio maps the stream's channels to the device itself.
+class PulseAudioRenderer : public IAudioRenderer
+{
+public:
+    PulseAudioRenderer();
+
+    virtual ~PulseAudioRenderer();
+
+    virtual bool prepareForPlayback(const OPUS_MULTISTREAM_CONFIGURATION* opusConfig);
+
+    virtual void* getAudioBuffer(int* size);
+
+    virtual bool submitAudio(int bytesWritten);
+
+    virtual int getCapabilities();
+
+    virtual bool getQueueStatus(int* queuedUs, int* targetUs);
+
+    virtual int getDeviceLatencyUs();
+
+    virtual AudioFormat getAudioBufferFormat();
+
+private:
+    bool connect(const OPUS_MULTISTREAM_CONFIGURATION* opusConfig);
+
+    static void contextStateCallback(pa_context* context, void* userdata);
+
+    static void streamStateCallback(pa_stream* stream, void* userdata);
+
+    static void writeCallback(pa_stream* stream, size_t length, void* userdata);
+
+    pa_threaded_mainloop* m_MainLoop;
+    pa_context* m_Context;
+    pa_stream* m_Stream;
+    SDL_atomic_t m_Errored;
+    SDL_atomic_t m_DeviceLatencyUs;
+
+    int m_BytesPerFrame;
+
+    // Frames from the decoder thread wait here until the server asks for them
+    AudioFrameRing m_Ring;
+    int m_FrameDurationUs;
+};
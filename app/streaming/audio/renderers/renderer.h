@@ -5,14 +5,55 @@
 class IAudioRenderer
 {
 public:
+    enum AudioFormat
+    {
+        AudioFormatS16,
+        AudioFormatFloat
+    };
+
     virtual ~IAudioRenderer() {}
 
     virtual bool prepareForPlayback(const OPUS_MULTISTREAM_CONFIGURATION* opusConfig) = 0;
 
+    // Sample format and channel count of the buffers from getAudioBuffer(),
+    // which the renderer picks while preparing for playback. Audio is mixed
+    // down or up if the channel count differs from the stream's. A channel
+    // count of 0 takes the stream's layout as is.
+    virtual AudioFormat getAudioBufferFormat() {
+        return AudioFormatS16;
+    }
+
+    virtual int getAudioBufferChannelCount() {
+        return 0;
+    }
+
     virtual void* getAudioBuffer(int* size) = 0;
 
     // Return false if an unrecoverable error has occurred and the renderer must be reinitialized
     virtual bool submitAudio(int bytesWritten) = 0;
 
     virtual int getCapabilities() = 0;
+
+    // Reports how much audio is queued for playback and how much the
+    // renderer would like queued. Renderers that report this must also
+    // accept frames a few samples shorter or longer than an Opus frame,
+    // because the jitter buffer resamples to hold the queue at its target.
+    virtual bool getQueueStatus(int* /* queuedUs */, int* /* targetUs */) {
+        return false;
+    }
+
+    // Returns how long audio takes to be heard once it leaves the queue
+    // reported by getQueueStatus(), or 0 if the renderer can't tell.
+    // Called on the audio decoder thread.
+    virtual int getDeviceLatencyUs() {
+        return 0;
+    }
+
+    // Returns true once the device being played to is no longer the
+    // default. The renderer keeps playing until a replacement for the new
+    // default has been opened in the background. Called on the audio
+    // decoder thread.
+    virtual bool isDefaultDeviceChanged() {
+        return false;
+    }
 };
@@ -18,9 +18,56 @@ public:
 
     virtual int getCapabilities();
 
+    virtual bool getQueueStatus(int* queuedUs, int* targetUs);
+
+    virtual int getDeviceLatencyUs();
+
+    virtual AudioFormat getAudioBufferFormat();
+
+    virtual int getAudioBufferChannelCount();
+
 private:
+    static void audioCallback(void* userdata, Uint8* stream, int len);
+
+    static int audioEventWatch(void* userdata, SDL_Event* event);
+
+    int adjustLatency(int queuedFrames, bool underrun);
+
     SDL_AudioDeviceID m_AudioDevice;
-    void* m_AudioBuffer;
+    SDL_atomic_t m_DeviceRemoved;
+    int m_ChannelCount;
+    int m_DeviceLatencyUs;
     int m_FrameDurationMs;
     int m_FrameSize;
+    int m_SlotSize;
+
+    // Decoded frames are handed to SDL's audio callback through a single
+    // producer, single consumer ring of frame slots. The decoder thread
+    // only advances m_WriteIndex and the callback only advances
+    // m_ReadIndex, so neither side ever waits for the other.
+#define SDL_AUDIO_RING_SLOTS 16
+    Uint8* m_Ring;
+    int m_SlotLength[SDL_AUDIO_RING_SLOTS];
+    SDL_atomic_t m_WriteIndex;
+    SDL_atomic_t m_ReadIndex;
+
+    // Owned by the audio callback. The target latency grows after an
+    // underrun and shrinks again once playback has been steady. Frames
+    // queued beyond the target are dropped to bring the latency back down.
+#define SDL_AUDIO_MIN_TARGET_MS 10
+#define SDL_AUDIO_MAX_TARGET_MS 20
+#define SDL_AUDIO_WINDOW_MS 1000
+#define SDL_AUDIO_STEADY_WINDOWS 10
+#define SDL_AUDIO_MAX_EXCESS_FRAMES 4
+    int m_ReadOffset;
+    int m_TargetFrames;
+    int m_MinTargetFrames;
+    int m_MaxTargetFrames;
+    int m_WindowMinQueuedFrames;
+    int m_WindowCallbacks;
+    int m_WindowCallbackCount;
+    int m_SteadyWindows;
+    bool m_Underrun;
+    bool m_RunningDry;
+    SDL_atomic_t m_TargetLatencyUs;
 };
@@ -1,4 +1,6 @@
 #include "sdl.h"
+#include "streaming/metricsexporter.h"
+#include "streaming/session.h"
 
 #include <Limelight.h>
 #include <SDL.h>
@@ -7,8 +9,25 @@
 
 SdlAudioRenderer::SdlAudioRenderer()
     : m_AudioDevice(0),
-      m_AudioBuffer(nullptr)
+      m_ChannelCount(0),
+      m_DeviceLatencyUs(0),
+      m_Ring(nullptr),
+      m_ReadOffset(0),
+      m_TargetFrames(0),
+      m_MinTargetFrames(0),
+      m_MaxTargetFrames(0),
+      m_WindowMinQueuedFrames(SDL_MAX_SINT32),
+      m_WindowCallbacks(0),
+      m_WindowCallbackCount(0),
+      m_SteadyWindows(0),
+      m_Underrun(false),
+      m_RunningDry(false)
 {
+    SDL_AtomicSet(&m_WriteIndex, 0);
+    SDL_AtomicSet(&m_ReadIndex, 0);
+    SDL_AtomicSet(&m_TargetLatencyUs, 0);
+    SDL_AtomicSet(&m_DeviceRemoved, 0);
+
     SDL_assert(!SDL_WasInit(SDL_INIT_AUDIO));
     if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
@@ -24,8 +43,13 @@ bool SdlAudioRenderer::prepareForPlayback(const OPUS_MULTISTREAM_CONFIGURATION*
 
     SDL_zero(want);
     want.freq = opusConfig->sampleRate;
-    want.format = AUDIO_S16;
+    // Take the device's own channel count and mix into it ourselves, so
+    // surround streams don't go through SDL's much slower converter. Float
+    // samples keep the mix from clipping.
+    want.format = AUDIO_F32SYS;
     want.channels = opusConfig->channelCount;
+    want.callback = audioCallback;
+    want.userdata = this;
 
     // This is supposed to be a power of 2, but our
     // frames contain a non-power of 2 number of samples,
@@ -33,10 +57,7 @@ bool SdlAudioRenderer::prepareForPlayback(const OPUS_MULTISTREAM_CONFIGURATION*
     // Specifying non-Po2 seems to work for our supported platforms.
     want.samples = opusConfig->samplesPerFrame;
 
-    m_FrameSize = opusConfig->samplesPerFrame * sizeof(short) * opusConfig->channelCount;
-    m_FrameDurationMs = opusConfig->samplesPerFrame / 48;
-
-    m_AudioDevice = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
+    m_AudioDevice = SDL_OpenAudioDevice(NULL, 0, &want, &have, SDL_AUDIO_ALLOW_CHANNELS_CHANGE);
     if (m_AudioDevice == 0) {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
                      "Failed to open audio device: %s",
@@ -44,22 +65,53 @@ bool SdlAudioRenderer::prepareForPlayback(const OPUS_MULTISTREAM_CONFIGURATION*
         return false;
     }
 
-    m_AudioBuffer = malloc(m_FrameSize);
-    if (m_AudioBuffer == nullptr) {
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Desired audio buffer: %u samples (%lu bytes)",
+                want.samples,
+                want.samples * sizeof(float) * want.channels);
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Obtained audio buffer: %u samples (%u bytes, %u channels)",
+                have.samples,
+                have.size,
+                have.channels);
+
+    m_ChannelCount = have.channels;
+    m_FrameSize = opusConfig->samplesPerFrame * sizeof(float) * m_ChannelCount;
+    m_FrameDurationMs = opusConfig->samplesPerFrame / 48;
+
+    // The callback takes a whole device buffer at a time
+    m_DeviceLatencyUs = (int)((Sint64)have.samples * 1000000 / have.freq);
+
+    // Leave room for the jitter buffer stretching a frame by a few samples
+    m_SlotSize = m_FrameSize + (opusConfig->samplesPerFrame / 100 + 2) * sizeof(float) * m_ChannelCount;
+
+    // The device is still paused, so the callback can't run before the ring exists
+    m_Ring = (Uint8*)malloc(m_SlotSize * SDL_AUDIO_RING_SLOTS);
+    if (m_Ring == nullptr) {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
                      "Failed to allocate audio buffer");
         return false;
     }
 
-    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
-                "Desired audio buffer: %u samples (%lu bytes)",
-                want.samples,
-                want.samples * sizeof(short) * want.channels);
+    // The callback needs at least a device buffer's worth of frames queued
+    int framesPerCallback = (have.samples + opusConfig->samplesPerFrame - 1) / opusConfig->samplesPerFrame;
+    int frameDurationMs = SDL_max(m_FrameDurationMs, 1);
+    m_MinTargetFrames = SDL_max((SDL_AUDIO_MIN_TARGET_MS + frameDurationMs - 1) / frameDurationMs, framesPerCallback);
+    m_MaxTargetFrames = SDL_min(SDL_max(SDL_AUDIO_MAX_TARGET_MS / frameDurationMs, m_MinTargetFrames + framesPerCallback),
+                                SDL_AUDIO_RING_SLOTS - 1);
+    m_TargetFrames = m_MinTargetFrames;
+    SDL_AtomicSet(&m_TargetLatencyUs, m_TargetFrames * m_FrameDurationMs * 1000);
+    m_WindowCallbackCount = SDL_max((int)((Uint64)SDL_AUDIO_WINDOW_MS * have.freq / 1000 / have.samples), 1);
 
     SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
-                "Obtained audio buffer: %u samples (%u bytes)",
-                have.samples,
-                have.size);
+                "Audio latency target: %d-%d frames",
+                m_MinTargetFrames,
+                m_MaxTargetFrames);
+
+    // SDL's hotplug thread reports our device going away long before
+    // the main loop would see the event
+    SDL_AddEventWatch(audioEventWatch, this);
 
     // Start playback
     SDL_PauseAudioDevice(m_AudioDevice, 0);
@@ -69,55 +121,181 @@ bool SdlAudioRenderer::prepareForPlayback(const OPUS_MULTISTREAM_CONFIGURATION*
 
 SdlAudioRenderer::~SdlAudioRenderer()
 {
+    SDL_DelEventWatch(audioEventWatch, this);
+
     if (m_AudioDevice != 0) {
         // Stop playback
         SDL_PauseAudioDevice(m_AudioDevice, 1);
         SDL_CloseAudioDevice(m_AudioDevice);
     }
 
-    if (m_AudioBuffer != nullptr) {
-        free(m_AudioBuffer);
+    if (m_Ring != nullptr) {
+        free(m_Ring);
     }
 
     SDL_QuitSubSystem(SDL_INIT_AUDIO);
     SDL_assert(!SDL_WasInit(SDL_INIT_AUDIO));
 }
 
-void* SdlAudioRenderer::getAudioBuffer(int*)
+void* SdlAudioRenderer::getAudioBuffer(int* size)
 {
-    return m_AudioBuffer;
+    int writeIndex = SDL_AtomicGet(&m_WriteIndex);
+
+    // If the ring is full, skip decoding this frame entirely
+    if (writeIndex - SDL_AtomicGet(&m_ReadIndex) >= SDL_AUDIO_RING_SLOTS) {
+        return nullptr;
+    }
+
+    *size = SDL_min(*size, m_SlotSize);
+    return &m_Ring[(writeIndex & (SDL_AUDIO_RING_SLOTS - 1)) * m_SlotSize];
+}
+
+int SdlAudioRenderer::audioEventWatch(void* userdata, SDL_Event* event)
+{
+    SdlAudioRenderer* me = (SdlAudioRenderer*)userdata;
+
+    if (event->type == SDL_AUDIODEVICEREMOVED && !event->adevice.iscapture &&
+            event->adevice.which == me->m_AudioDevice) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Audio device removed");
+        SDL_AtomicSet(&me->m_DeviceRemoved, 1);
+    }
+
+    return 1;
 }
 
 bool SdlAudioRenderer::submitAudio(int bytesWritten)
 {
+    // SDL can't have two copies of the audio subsystem running, so the
+    // session reopens the default device only once we're gone
+    if (SDL_AtomicGet(&m_DeviceRemoved)) {
+        return false;
+    }
+
     if (bytesWritten == 0) {
         // Nothing to do
         return true;
     }
 
-    // Don't queue if there's already more than 30 ms of audio data waiting
-    // in Moonlight's audio queue.
-    if (LiGetPendingAudioFrames() * m_FrameDurationMs > 30) {
-        return true;
+    // getAudioBuffer() already checked that this slot is free. Publishing
+    // the write index makes the frame visible to the audio callback.
+    int writeIndex = SDL_AtomicGet(&m_WriteIndex);
+    m_SlotLength[writeIndex & (SDL_AUDIO_RING_SLOTS - 1)] = bytesWritten;
+    SDL_AtomicSet(&m_WriteIndex, writeIndex + 1);
+
+    MetricsExporter::setAudioQueueDepth(writeIndex + 1 - SDL_AtomicGet(&m_ReadIndex));
+
+    return true;
+}
+
+void SdlAudioRenderer::audioCallback(void* userdata, Uint8* stream, int len)
+{
+    SdlAudioRenderer* me = (SdlAudioRenderer*)userdata;
+    int readIndex = SDL_AtomicGet(&me->m_ReadIndex);
+    int writeIndex = SDL_AtomicGet(&me->m_WriteIndex);
+    bool underrun = false;
+
+    while (len > 0) {
+        if (readIndex == writeIndex) {
+            // Play silence until the next frame arrives. Running dry before
+            // the first frame is just the stream starting up.
+            SDL_memset(stream, 0, len);
+            underrun = readIndex != 0;
+            break;
+        }
+
+        int slot = readIndex & (SDL_AUDIO_RING_SLOTS - 1);
+        int bytesToCopy = SDL_min(me->m_SlotLength[slot] - me->m_ReadOffset, len);
+
+        memcpy(stream, &me->m_Ring[slot * me->m_SlotSize + me->m_ReadOffset], bytesToCopy);
+        stream += bytesToCopy;
+        len -= bytesToCopy;
+
+        me->m_ReadOffset += bytesToCopy;
+        if (me->m_ReadOffset == me->m_SlotLength[slot]) {
+            me->m_ReadOffset = 0;
+            readIndex++;
+        }
     }
 
-    // Provide backpressure on the queue to ensure too many frames don't build up
-    // in SDL's audio queue.
-    while (SDL_GetQueuedAudioSize(m_AudioDevice) / m_FrameSize > 10) {
-        SDL_Delay(1);
+    // Count each time we run dry once, not every callback until we recover
+    if (underrun && !me->m_RunningDry && Session::get() != nullptr) {
+        Session::get()->notifyAudioUnderrun();
     }
+    me->m_RunningDry = underrun;
 
-    if (SDL_QueueAudio(m_AudioDevice, m_AudioBuffer, bytesWritten) < 0) {
-        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                     "Failed to queue audio sample: %s",
-                     SDL_GetError());
+    // Frames can only be dropped whole
+    int excessFrames = me->adjustLatency(writeIndex - readIndex, underrun);
+    if (me->m_ReadOffset == 0) {
+        readIndex += excessFrames;
+    }
+
+    SDL_AtomicSet(&me->m_ReadIndex, readIndex);
+}
+
+// Returns the number of frames that stayed queued beyond the target
+// for the whole window that just ended
+int SdlAudioRenderer::adjustLatency(int queuedFrames, bool underrun)
+{
+    m_WindowMinQueuedFrames = SDL_min(m_WindowMinQueuedFrames, queuedFrames);
+
+    if (underrun) {
+        m_Underrun = true;
+        m_SteadyWindows = 0;
+        if (m_TargetFrames < m_MaxTargetFrames) {
+            m_TargetFrames++;
+        }
+    }
+
+    if (++m_WindowCallbacks < m_WindowCallbackCount) {
+        return 0;
+    }
+
+    // This window is over. Give back some latency after enough steady windows.
+    if (!m_Underrun && ++m_SteadyWindows >= SDL_AUDIO_STEADY_WINDOWS) {
+        m_SteadyWindows = 0;
+        if (m_TargetFrames > m_MinTargetFrames) {
+            m_TargetFrames--;
+        }
     }
 
+    // The jitter buffer may hold the queue a little above our target to
+    // keep audio in sync with video, so only drop frames beyond that
+    int excessFrames = SDL_max(m_WindowMinQueuedFrames - m_TargetFrames - SDL_AUDIO_MAX_EXCESS_FRAMES, 0);
+
+    m_Underrun = false;
+    m_WindowCallbacks = 0;
+    m_WindowMinQueuedFrames = SDL_MAX_SINT32;
+    SDL_AtomicSet(&m_TargetLatencyUs, m_TargetFrames * m_FrameDurationMs * 1000);
+
+    return excessFrames;
+}
+
+bool SdlAudioRenderer::getQueueStatus(int* queuedUs, int* targetUs)
+{
+    *queuedUs = (SDL_AtomicGet(&m_WriteIndex) - SDL_AtomicGet(&m_ReadIndex)) * m_FrameDurationMs * 1000;
+    *targetUs = SDL_AtomicGet(&m_TargetLatencyUs);
     return true;
 }
 
+int SdlAudioRenderer::getDeviceLatencyUs()
+{
+    return m_DeviceLatencyUs;
+}
+
+IAudioRenderer::AudioFormat SdlAudioRenderer::getAudioBufferFormat()
+{
+    return AudioFormatFloat;
+}
+
+int SdlAudioRenderer::getAudioBufferChannelCount()
+{
+    return m_ChannelCount;
+}
+
 int SdlAudioRenderer::getCapabilities()
 {
-    // Direct submit can't be used because we use LiGetPendingAudioFrames()
-    return 0;
+    // Packets are decoded on our own thread either way, so going through
+    // moonlight-common-c's queue and thread would only add a hop
+    return CAPABILITY_DIRECT_SUBMIT;
 }
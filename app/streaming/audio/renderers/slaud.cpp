@@ -1,4 +1,5 @@
 #include "slaud.h"
+#include "streaming/session.h"
 
 #include <SDL.h>
 
@@ -77,14 +78,14 @@ bool SLAudioRenderer::submitAudio(int bytesWritten)
         return true;
     }
 
-    if (LiGetPendingAudioFrames() * m_FrameDuration < m_MaxQueuedAudioMs) {
+    if (Session::getPendingAudioFrames() * m_FrameDuration < m_MaxQueuedAudioMs) {
         SLAudio_SubmitFrame(m_AudioStream);
         m_AudioBuffer = nullptr;
     }
     else {
         SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
                     "Too many queued audio frames: %d",
-                    LiGetPendingAudioFrames());
+                    Session::getPendingAudioFrames());
     }
 
     return true;
@@ -92,7 +93,7 @@ bool SLAudioRenderer::submitAudio(int bytesWritten)
 
 int SLAudioRenderer::getCapabilities()
 {
-    return CAPABILITY_SLOW_OPUS_DECODER;
+    return CAPABILITY_SLOW_OPUS_DECODER | CAPABILITY_DIRECT_SUBMIT;
 }
 
 void SLAudioRenderer::slLogCallback(void*, ESLAudioLog logLevel, const char *message)
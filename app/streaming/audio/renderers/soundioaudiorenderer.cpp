@@ -21,16 +21,40 @@ const double SoundIoAudioRenderer::k_MinSampleLengthSec = 0.025;
 const double SoundIoAudioRenderer::k_MinSampleLengthSec = k_RawSampleLengthSec;
 #endif
 
+// Each underflow raises the amount buffered by this many packets
+#define LATENCY_RAISE_PACKETS 2
+
+// The amount buffered is lowered a packet after this long without underflows
+#define LATENCY_STABLE_PERIOD_MS 30000
+
+// Underflows this soon after raising it were already on their way
+#define LATENCY_SETTLE_TIME_MS 1000
+
+QHash<QString, int> SoundIoAudioRenderer::s_TunedBufferPackets;
+SDL_SpinLock SoundIoAudioRenderer::s_TunedBufferPacketsLock;
+
 SoundIoAudioRenderer::SoundIoAudioRenderer()
-    : m_OpusChannelCount(0),
+    : m_BufferChannelCount(0),
       m_SoundIo(nullptr),
       m_Device(nullptr),
       m_OutputStream(nullptr),
       m_RingBuffer(nullptr),
       m_Latency(0),
-      m_Errored(false)
+      m_TargetQueuedUs(0),
+      m_SamplesPerFrame(0),
+      m_BufferPackets(0),
+      m_MinBufferPackets(0),
+      m_MaxBufferPackets(0),
+      m_LastUnderflows(0),
+      m_LastUnderflowTime(0),
+      m_LastLatencyChangeTime(0),
+      m_LatencyLowered(false),
+      m_Errored(false),
+      m_DefaultDeviceChanged(false)
 {
-
+    SDL_AtomicSet(&m_DeviceLatencyUs, 0);
+    SDL_AtomicSet(&m_MinWriteFrames, 0);
+    SDL_AtomicSet(&m_Underflows, 0);
 }
 
 SoundIoAudioRenderer::~SoundIoAudioRenderer()
@@ -39,6 +63,14 @@ SoundIoAudioRenderer::~SoundIoAudioRenderer()
                 "Audio latency: %f",
                 m_Latency);
 
+    if (m_BufferPackets != 0) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Audio buffer settled at %d packets (%d ms) after %d underflows",
+                    m_BufferPackets,
+                    (int)(m_BufferPackets * k_RawSampleLengthSec * 1000),
+                    SDL_AtomicGet(&m_Underflows));
+    }
+
     if (m_OutputStream != nullptr) {
         soundio_outstream_destroy(m_OutputStream);
     }
@@ -144,9 +176,6 @@ bool SoundIoAudioRenderer::prepareForPlayback(const OPUS_MULTISTREAM_CONFIGURATI
     // Flush events to update with new device arrivals
     soundio_flush_events(m_SoundIo);
 
-    // Remember the actual channel count for later
-    m_OpusChannelCount = opusConfig->channelCount;
-
     int outputDeviceIndex = soundio_default_output_device_index(m_SoundIo);
     if (outputDeviceIndex < 0) {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
@@ -172,12 +201,47 @@ bool SoundIoAudioRenderer::prepareForPlayback(const OPUS_MULTISTREAM_CONFIGURATI
         return false;
     }
 
-    m_OutputStream->format = SoundIoFormatS16NE;
+    m_DeviceId = QString::fromUtf8(m_Device->id);
+    m_SamplesPerFrame = opusConfig->samplesPerFrame;
+
+#ifdef Q_OS_LINUX
+    // PulseAudio and ALSA need the large writes (see comment on k_MinSampleLengthSec),
+    // so we need a buffer at least double that size to allow packets to arrive
+    // while we're writing to the sink. Devices that cope with smaller writes
+    // get them once they've played without underflowing for a while.
+    m_BufferPackets = (int)(k_MinSampleLengthSec / k_RawSampleLengthSec) * 2;
+    m_MinBufferPackets = 4;
+#else
+    if (m_SoundIo->current_backend == SoundIoBackendWasapi) {
+        // 15 ms buffer seems to be fine for WASAPI
+        m_BufferPackets = 3;
+    }
+    else {
+        // 30 ms buffer on CoreAudio to avoid glitching on macOS
+        m_BufferPackets = 6;
+    }
+    m_MinBufferPackets = 2;
+#endif
+    m_MaxBufferPackets = 24;
+
+    // Float output lets us downmix without clipping
+    m_OutputStream->format = soundio_device_supports_format(m_Device, SoundIoFormatFloat32NE) ?
+                SoundIoFormatFloat32NE : SoundIoFormatS16NE;
     m_OutputStream->sample_rate = opusConfig->sampleRate;
-    m_OutputStream->software_latency = k_MinSampleLengthSec;
+
+    // Start from what worked for this device last time
+    SDL_AtomicLock(&s_TunedBufferPacketsLock);
+    m_BufferPackets = s_TunedBufferPackets.value(m_DeviceId, m_BufferPackets);
+    SDL_AtomicUnlock(&s_TunedBufferPacketsLock);
+    applyBufferPackets();
+
+    // The software latency is fixed once the stream is open, so raising
+    // it only takes effect the next time the device is opened
+    m_OutputStream->software_latency = (double)SDL_AtomicGet(&m_MinWriteFrames) / opusConfig->sampleRate;
     m_OutputStream->name = "Moonlight";
     m_OutputStream->userdata = this;
     m_OutputStream->error_callback = sioErrorCallback;
+    m_OutputStream->underflow_callback = sioUnderflowCallback;
     m_OutputStream->write_callback = sioWriteCallback;
 
     SoundIoChannelLayout bestLayout = m_Device->current_layout;
@@ -188,11 +252,6 @@ bool SoundIoAudioRenderer::prepareForPlayback(const OPUS_MULTISTREAM_CONFIGURATI
         }
     }
 
-    if (bestLayout.channel_count < opusConfig->channelCount) {
-        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
-                    "No compatible channel layouts found. Some channels may not be played!");
-    }
-
     m_OutputStream->layout = bestLayout;
 
     SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
@@ -235,33 +294,36 @@ bool SoundIoAudioRenderer::prepareForPlayback(const OPUS_MULTISTREAM_CONFIGURATI
         }
     }
 
-    int packetsToBuffer;
-
-#ifdef Q_OS_LINUX
-    // PulseAudio and ALSA need the large buffer (see comment on k_MinSampleLengthSec),
-    // so we need a buffer at least double that size to allow packets to arrive
-    // while we're writing to the sink.
-    packetsToBuffer = (int)(k_MinSampleLengthSec / k_RawSampleLengthSec) * 2;
-#else
-    if (m_SoundIo->current_backend == SoundIoBackendWasapi) {
-        // 15 ms buffer seems to be fine for WASAPI
-        packetsToBuffer = 3;
+    // If the device can't play every channel of the stream, have the
+    // stream mixed down to stereo rather than losing the missing channels
+    int playableChannels = 0;
+    for (int i = 0; i < m_EffectiveLayout.channel_count; i++) {
+        if (m_EffectiveLayout.channels[i] - 1 < opusConfig->channelCount) {
+            playableChannels++;
+        }
+    }
+    if (playableChannels < opusConfig->channelCount) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Device layout can only play %d of %d channels. Mixing down to stereo.",
+                    playableChannels,
+                    opusConfig->channelCount);
+        m_BufferChannelCount = 2;
     }
     else {
-        // 30 ms buffer on CoreAudio to avoid glitching on macOS
-        packetsToBuffer = 6;
+        m_BufferChannelCount = opusConfig->channelCount;
     }
-#endif
 
     SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
                 "Audio buffer size: %d packets",
-                packetsToBuffer);
+                m_BufferPackets);
 
+    // The ring is sized for the most we'd ever buffer, so the amount can
+    // change without recreating it
     m_RingBuffer = soundio_ring_buffer_create(m_SoundIo,
                                               m_OutputStream->bytes_per_sample *
-                                              m_OpusChannelCount *
+                                              m_BufferChannelCount *
                                               opusConfig->samplesPerFrame *
-                                              packetsToBuffer);
+                                              m_MaxBufferPackets);
     if (m_RingBuffer == nullptr) {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
                      "soundio_ring_buffer_create() failed");
@@ -281,9 +343,77 @@ bool SoundIoAudioRenderer::prepareForPlayback(const OPUS_MULTISTREAM_CONFIGURATI
     // This is a gross hack, but it works remarkably well.
     SDL_Delay(500);
 
+    // Underflows while the stream started up don't count
+    m_LastUnderflows = SDL_AtomicGet(&m_Underflows);
+    m_LastUnderflowTime = m_LastLatencyChangeTime = SDL_GetTicks();
+
     return true;
 }
 
+void SoundIoAudioRenderer::applyBufferPackets()
+{
+    int sampleRate = m_OutputStream->sample_rate;
+
+#ifdef Q_OS_LINUX
+    // Half the buffer is written at a time, like the 25 ms writes in
+    // the original 50 ms buffer
+    SDL_AtomicSet(&m_MinWriteFrames, m_SamplesPerFrame * m_BufferPackets / 2);
+#else
+    SDL_AtomicSet(&m_MinWriteFrames, (int)(sampleRate * k_MinSampleLengthSec));
+#endif
+
+    // Keep the ring half full so packets can arrive early or late
+    m_TargetQueuedUs = (int)((Sint64)m_SamplesPerFrame * m_BufferPackets * 1000000 / 2 / sampleRate);
+}
+
+void SoundIoAudioRenderer::adjustLatency()
+{
+    int underflows = SDL_AtomicGet(&m_Underflows);
+    Uint32 now = SDL_GetTicks();
+    int oldBufferPackets = m_BufferPackets;
+
+    if (underflows != m_LastUnderflows) {
+        m_LastUnderflows = underflows;
+        m_LastUnderflowTime = now;
+
+        if (m_LatencyLowered) {
+            // This device can't go as low as the amount we just tried
+            m_MinBufferPackets = qMax(m_MinBufferPackets, m_BufferPackets + 1);
+            m_LatencyLowered = false;
+        }
+
+        if (SDL_TICKS_PASSED(now, m_LastLatencyChangeTime + LATENCY_SETTLE_TIME_MS)) {
+            m_BufferPackets = qMin(m_BufferPackets + LATENCY_RAISE_PACKETS, m_MaxBufferPackets);
+        }
+    }
+    else if (SDL_TICKS_PASSED(now, m_LastUnderflowTime + LATENCY_STABLE_PERIOD_MS) &&
+             SDL_TICKS_PASSED(now, m_LastLatencyChangeTime + LATENCY_STABLE_PERIOD_MS) &&
+             m_BufferPackets > m_MinBufferPackets) {
+        m_BufferPackets--;
+        m_LatencyLowered = true;
+    }
+    else if (m_LatencyLowered && SDL_TICKS_PASSED(now, m_LastLatencyChangeTime + LATENCY_STABLE_PERIOD_MS)) {
+        // The lower amount held up
+        m_LatencyLowered = false;
+    }
+
+    if (m_BufferPackets != oldBufferPackets) {
+        m_LastLatencyChangeTime = now;
+        applyBufferPackets();
+
+        SDL_AtomicLock(&s_TunedBufferPacketsLock);
+        s_TunedBufferPackets.insert(m_DeviceId, m_BufferPackets);
+        SDL_AtomicUnlock(&s_TunedBufferPacketsLock);
+
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Audio buffer %s to %d packets (%d ms) after %d underflows",
+                    m_BufferPackets > oldBufferPackets ? "raised" : "lowered",
+                    m_BufferPackets,
+                    (int)(m_BufferPackets * k_RawSampleLengthSec * 1000),
+                    underflows);
+    }
+}
+
 void* SoundIoAudioRenderer::getAudioBuffer(int* size)
 {
     // We must always write a full frame of audio. If we don't,
@@ -292,7 +422,7 @@ void* SoundIoAudioRenderer::getAudioBuffer(int* size)
     // the case, round our bytes free down to the next multiple
     // of our frame size.
     int bytesFree = soundio_ring_buffer_free_count(m_RingBuffer);
-    int bytesPerFrame = m_OpusChannelCount * m_OutputStream->bytes_per_sample;
+    int bytesPerFrame = m_BufferChannelCount * m_OutputStream->bytes_per_sample;
     *size = qMin(*size, (bytesFree / bytesPerFrame) * bytesPerFrame);
     return soundio_ring_buffer_write_ptr(m_RingBuffer);
 }
@@ -311,12 +441,45 @@ bool SoundIoAudioRenderer::submitAudio(int bytesWritten)
     // Flush events to update with new device arrivals
     soundio_flush_events(m_SoundIo);
 
+    adjustLatency();
+
     // Advance the write pointer
     soundio_ring_buffer_advance_write_ptr(m_RingBuffer, bytesWritten);
 
     return true;
 }
 
+bool SoundIoAudioRenderer::getQueueStatus(int* queuedUs, int* targetUs)
+{
+    int bytesPerFrame = m_BufferChannelCount * m_OutputStream->bytes_per_sample;
+    int framesQueued = soundio_ring_buffer_fill_count(m_RingBuffer) / bytesPerFrame;
+
+    *queuedUs = (int)((Sint64)framesQueued * 1000000 / m_OutputStream->sample_rate);
+    *targetUs = m_TargetQueuedUs;
+    return true;
+}
+
+bool SoundIoAudioRenderer::isDefaultDeviceChanged()
+{
+    // Set by sioDevicesChanged() when submitAudio() flushes events
+    return m_DefaultDeviceChanged;
+}
+
+int SoundIoAudioRenderer::getDeviceLatencyUs()
+{
+    return SDL_AtomicGet(&m_DeviceLatencyUs);
+}
+
+IAudioRenderer::AudioFormat SoundIoAudioRenderer::getAudioBufferFormat()
+{
+    return m_OutputStream->format == SoundIoFormatFloat32NE ? AudioFormatFloat : AudioFormatS16;
+}
+
+int SoundIoAudioRenderer::getAudioBufferChannelCount()
+{
+    return m_BufferChannelCount;
+}
+
 int SoundIoAudioRenderer::getCapabilities()
 {
     return CAPABILITY_DIRECT_SUBMIT;
@@ -334,6 +497,14 @@ void SoundIoAudioRenderer::sioErrorCallback(SoundIoOutStream* stream, int err)
     me->m_Errored = true;
 }
 
+void SoundIoAudioRenderer::sioUnderflowCallback(SoundIoOutStream* stream)
+{
+    auto me = reinterpret_cast<SoundIoAudioRenderer*>(stream->userdata);
+
+    // Acted on by submitAudio() on the decoder thread
+    SDL_AtomicIncRef(&me->m_Underflows);
+}
+
 void SoundIoAudioRenderer::sioBackendDisconnect(SoundIo* soundio, int err)
 {
     auto me = reinterpret_cast<SoundIoAudioRenderer*>(soundio->userdata);
@@ -368,8 +539,8 @@ void SoundIoAudioRenderer::sioDevicesChanged(SoundIo* soundio)
             SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
                         "Default audio output device changed");
 
-            // Trigger reinitialization
-            me->m_Errored = true;
+            // Keep playing here until the session has opened the new device
+            me->m_DefaultDeviceChanged = true;
         }
 
         soundio_device_unref(outputDevice);
@@ -383,17 +554,18 @@ void SoundIoAudioRenderer::sioWriteCallback(SoundIoOutStream* stream, int frameC
     auto me = reinterpret_cast<SoundIoAudioRenderer*>(stream->userdata);
     char* readPtr = soundio_ring_buffer_read_ptr(me->m_RingBuffer);
     int framesLeft = soundio_ring_buffer_fill_count(me->m_RingBuffer) /
-            (me->m_OpusChannelCount * stream->bytes_per_sample);
+            (me->m_BufferChannelCount * stream->bytes_per_sample);
+    int minWriteFrames = SDL_AtomicGet(&me->m_MinWriteFrames);
     int bytesRead = 0;
 
     // Ensure we always write at least a buffer, even if it's silence, to avoid
     // busy looping when no audio data is available while libsoundio tries to keep
     // us from starving the output device.
-    frameCountMin = qMax(frameCountMin, (int)(stream->sample_rate * k_MinSampleLengthSec));
+    frameCountMin = qMax(frameCountMin, minWriteFrames);
 
     // Clamp frameCountMax to minSampleLen * 4 to stop our latency from growing if audio packets lag.
     // This makes sure that we never increase our latency far beyond what the sink is consuming.
-    frameCountMax = qMin(frameCountMax, (int)(stream->sample_rate * k_MinSampleLengthSec) * 4);
+    frameCountMax = qMin(frameCountMax, minWriteFrames * 4);
     frameCountMin = qMin(frameCountMin, frameCountMax);
 
     // Clamp framesLeft to frameCountMax
@@ -402,6 +574,7 @@ void SoundIoAudioRenderer::sioWriteCallback(SoundIoOutStream* stream, int frameC
     // Track latency on queueing-based backends
     if (me->m_SoundIo->current_backend != SoundIoBackendCoreAudio && me->m_SoundIo->current_backend != SoundIoBackendJack) {
         soundio_outstream_get_latency(stream, &me->m_Latency);
+        SDL_AtomicSet(&me->m_DeviceLatencyUs, (int)(me->m_Latency * 1000000));
     }
 
     for (;;) {
@@ -433,7 +606,7 @@ void SoundIoAudioRenderer::sioWriteCallback(SoundIoOutStream* stream, int frameC
                 // in m_EffectiveLayout to back L/R.
                 int readPtrChannel = me->m_EffectiveLayout.channels[ch] - 1;
 
-                if (frame >= framesLeft || readPtrChannel >= me->m_OpusChannelCount) {
+                if (frame >= framesLeft || readPtrChannel >= me->m_BufferChannelCount) {
                     // Write silence if we have no buffered frames left or
                     // nothing in the audio stream for this channel
                     memset(areas[ch].ptr, 0, stream->bytes_per_sample);
@@ -450,8 +623,8 @@ void SoundIoAudioRenderer::sioWriteCallback(SoundIoOutStream* stream, int frameC
 
             // Move on to the next frame if we aren't inserting silence
             if (frame < framesLeft) {
-                readPtr += stream->bytes_per_sample * me->m_OpusChannelCount;
-                bytesRead += stream->bytes_per_sample * me->m_OpusChannelCount;
+                readPtr += stream->bytes_per_sample * me->m_BufferChannelCount;
+                bytesRead += stream->bytes_per_sample * me->m_BufferChannelCount;
             }
         }
 
@@ -2,8 +2,18 @@
 
 #include "renderer.h"
 
+#include <SDL.h>
+
 #include <soundio/soundio.h>
 
+#include <QHash>
+#include <QString>
+
+// The amount of audio buffered is tuned from underflow feedback. Each
+// underflow the device reports raises it a step, and it's lowered a step
+// after a stretch without any, so it settles at the lowest amount the
+// device plays without glitching. What was learned is kept per device for
+// the next time it's opened during this run.
 class SoundIoAudioRenderer : public IAudioRenderer
 {
 public:
@@ -19,26 +29,68 @@ public:
 
     virtual int getCapabilities();
 
+    virtual bool getQueueStatus(int* queuedUs, int* targetUs);
+
+    virtual int getDeviceLatencyUs();
+
+    virtual bool isDefaultDeviceChanged();
+
+    virtual AudioFormat getAudioBufferFormat();
+
+    virtual int getAudioBufferChannelCount();
+
 private:
     int scoreChannelLayout(const struct SoundIoChannelLayout* layout, const OPUS_MULTISTREAM_CONFIGURATION* opusConfig);
 
+    // Applies m_BufferPackets to the write size and queue target
+    void applyBufferPackets();
+
+    void adjustLatency();
+
     static void sioErrorCallback(struct SoundIoOutStream* stream, int err);
 
+    static void sioUnderflowCallback(struct SoundIoOutStream* stream);
+
     static void sioWriteCallback(struct SoundIoOutStream* stream, int frameCountMin, int frameCountMax);
 
     static void sioBackendDisconnect(struct SoundIo* soundio, int err);
 
     static void sioDevicesChanged(SoundIo* soundio);
 
-    int m_OpusChannelCount;
+    int m_BufferChannelCount;
     struct SoundIo* m_SoundIo;
     struct SoundIoDevice* m_Device;
     struct SoundIoOutStream* m_OutputStream;
     struct SoundIoRingBuffer* m_RingBuffer;
     struct SoundIoChannelLayout m_EffectiveLayout;
     double m_Latency;
+    SDL_atomic_t m_DeviceLatencyUs;
+    int m_TargetQueuedUs;
+    int m_SamplesPerFrame;
+    QString m_DeviceId;
+
+    // Buffered audio in Opus packets. The ring holds m_MaxBufferPackets
+    // and is kept half full of the current amount.
+    int m_BufferPackets;
+    int m_MinBufferPackets;
+    int m_MaxBufferPackets;
+    SDL_atomic_t m_MinWriteFrames;
+    SDL_atomic_t m_Underflows;
+    int m_LastUnderflows;
+    Uint32 m_LastUnderflowTime;
+    Uint32 m_LastLatencyChangeTime;
+
+    // Set after lowering the amount buffered until it has held up for a
+    // stable period. An underflow in that time makes it the new minimum.
+    bool m_LatencyLowered;
+
     bool m_Errored;
+    bool m_DefaultDeviceChanged;
 
     static const double k_RawSampleLengthSec;
     static const double k_MinSampleLengthSec;
+
+    // Buffer sizes learned for each device, by device ID
+    static QHash<QString, int> s_TunedBufferPackets;
+    static SDL_SpinLock s_TunedBufferPacketsLock;
 };
@@ -0,0 +1,636 @@
+#include "wasapiaudiorenderer.h"
+#include "streaming/threadplacement.h"
+
+#include <QtGlobal>
+
+#include <ksmedia.h>
+
+#define SAFE_COM_RELEASE(x) if (x) { (x)->Release(); (x) = nullptr; }
+
+// Frames queued beyond the target are dropped once they exceed this, so
+// a burst after a network stall can't leave a lasting delay behind
+#define WASAPI_MAX_EXCESS_FRAMES 4
+
+// REFERENCE_TIME is in 100 ns units
+#define REFTIMES_PER_SEC 10000000
+
+WasapiNotificationClient::WasapiNotificationClient(SDL_atomic_t* defaultDeviceChanged)
+    : m_DefaultDeviceChanged(defaultDeviceChanged)
+{
+}
+
+ULONG WasapiNotificationClient::AddRef()
+{
+    return 1;
+}
+
+ULONG WasapiNotificationClient::Release()
+{
+    return 1;
+}
+
+HRESULT WasapiNotificationClient::QueryInterface(REFIID riid, void** object)
+{
+    if (IsEqualIID(riid, __uuidof(IUnknown)) || IsEqualIID(riid, __uuidof(IMMNotificationClient))) {
+        *object = static_cast<IMMNotificationClient*>(this);
+        return S_OK;
+    }
+
+    *object = nullptr;
+    return E_NOINTERFACE;
+}
+
+HRESULT WasapiNotificationClient::OnDefaultDeviceChanged(EDataFlow flow, ERole role, LPCWSTR)
+{
+    // We always open the console role's default endpoint
+    if (flow == eRender && role == eConsole) {
+        SDL_AtomicSet(m_DefaultDeviceChanged, 1);
+    }
+
+    return S_OK;
+}
+
+HRESULT WasapiNotificationClient::OnDeviceAdded(LPCWSTR)
+{
+    return S_OK;
+}
+
+HRESULT WasapiNotificationClient::OnDeviceRemoved(LPCWSTR)
+{
+    return S_OK;
+}
+
+HRESULT WasapiNotificationClient::OnDeviceStateChanged(LPCWSTR, DWORD)
+{
+    return S_OK;
+}
+
+HRESULT WasapiNotificationClient::OnPropertyValueChanged(LPCWSTR, const PROPERTYKEY)
+{
+    return S_OK;
+}
+
+WasapiAudioRenderer::WasapiAudioRenderer()
+    : m_OpusConfig(nullptr),
+      m_ExclusiveRequested(false),
+      m_Enumerator(nullptr),
+      m_NotificationRegistered(false),
+      m_Device(nullptr),
+      m_AudioClient(nullptr),
+      m_RenderClient(nullptr),
+      m_Event(nullptr),
+      m_BufferFrames(0),
+      m_Exclusive(false),
+      m_Format(AudioFormatFloat),
+      m_ChannelCount(0),
+      m_BytesPerFrame(0),
+      m_DevicePeriodUs(0),
+      m_DeviceLatencyUs(0),
+      m_InitSucceeded(false),
+      m_RenderThread(nullptr),
+      m_InitSemaphore(nullptr),
+      m_NotificationClient(&m_DefaultDeviceChanged),
+      m_FrameDurationUs(0)
+{
+    SDL_AtomicSet(&m_Stopping, 0);
+    SDL_AtomicSet(&m_Errored, 0);
+    SDL_AtomicSet(&m_DefaultDeviceChanged, 0);
+}
+
+WasapiAudioRenderer::~WasapiAudioRenderer()
+{
+    if (m_RenderThread != nullptr) {
+        // The render thread wakes at least every 200 ms to check this
+        SDL_AtomicSet(&m_Stopping, 1);
+        SDL_WaitThread(m_RenderThread, nullptr);
+    }
+
+    if (m_InitSemaphore != nullptr) {
+        SDL_DestroySemaphore(m_InitSemaphore);
+    }
+}
+
+bool WasapiAudioRenderer::prepareForPlayback(const OPUS_MULTISTREAM_CONFIGURATION* opusConfig)
+{
+    // Only used while the render thread initializes, which happens
+    // before we return
+    m_OpusConfig = opusConfig;
+    m_ExclusiveRequested = qgetenv("ML_WASAPI_EXCLUSIVE") == "1";
+
+    m_InitSemaphore = SDL_CreateSemaphore(0);
+    if (m_InitSemaphore == nullptr) {
+        return false;
+    }
+
+    // WASAPI objects are created and used on the render thread only, so
+    // none of our callers need to initialize COM
+    m_RenderThread = SDL_CreateThread(renderThreadProc, "WASAPI", this);
+    if (m_RenderThread == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unable to create WASAPI render thread: %s",
+                     SDL_GetError());
+        return false;
+    }
+
+    SDL_SemWait(m_InitSemaphore);
+    m_OpusConfig = nullptr;
+
+    if (!m_InitSucceeded) {
+        SDL_WaitThread(m_RenderThread, nullptr);
+        m_RenderThread = nullptr;
+        return false;
+    }
+
+    return true;
+}
+
+int WasapiAudioRenderer::renderThreadProc(void* context)
+{
+    WasapiAudioRenderer* me = (WasapiAudioRenderer*)context;
+
+    HRESULT comHr = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+
+    // Lets MMCSS schedule us ahead of everything else while we're
+    // waiting for the device
+    ThreadPlacement::applyToCurrentThread(ThreadPlacement::TR_AUDIO);
+
+    me->m_InitSucceeded = SUCCEEDED(comHr) && me->initializeClient();
+    bool running = me->m_InitSucceeded;
+
+    // prepareForPlayback() may return as soon as this is signalled
+    SDL_SemPost(me->m_InitSemaphore);
+
+    while (running && !SDL_AtomicGet(&me->m_Stopping)) {
+        if (WaitForSingleObject(me->m_Event, 200) != WAIT_OBJECT_0) {
+            continue;
+        }
+
+        me->renderPeriod();
+
+        // The decoder thread will see this and recreate the renderer
+        if (SDL_AtomicGet(&me->m_Errored)) {
+            break;
+        }
+    }
+
+    if (me->m_AudioClient != nullptr) {
+        me->m_AudioClient->Stop();
+    }
+
+    me->cleanupClient();
+
+    if (SUCCEEDED(comHr)) {
+        CoUninitialize();
+    }
+
+    return 0;
+}
+
+bool WasapiAudioRenderer::initializeClient()
+{
+    HRESULT hr;
+
+    hr = CoCreateInstance(__uuidof(MMDeviceEnumerator), nullptr, CLSCTX_ALL,
+                          __uuidof(IMMDeviceEnumerator), (void**)&m_Enumerator);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "CoCreateInstance(MMDeviceEnumerator) failed: %x",
+                     hr);
+        return false;
+    }
+
+    // Registering before looking up the default endpoint ensures that
+    // we can't miss a change that happens in between
+    hr = m_Enumerator->RegisterEndpointNotificationCallback(&m_NotificationClient);
+    if (SUCCEEDED(hr)) {
+        m_NotificationRegistered = true;
+    }
+    else {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "RegisterEndpointNotificationCallback() failed: %x",
+                    hr);
+    }
+
+    hr = m_Enumerator->GetDefaultAudioEndpoint(eRender, eConsole, &m_Device);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "GetDefaultAudioEndpoint() failed: %x",
+                     hr);
+        return false;
+    }
+
+    m_Event = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+    if (m_Event == nullptr) {
+        return false;
+    }
+
+    if (m_ExclusiveRequested && initializeExclusive()) {
+        m_Exclusive = true;
+    }
+    else if (!initializeShared()) {
+        return false;
+    }
+
+    hr = m_AudioClient->GetBufferSize(&m_BufferFrames);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "IAudioClient::GetBufferSize() failed: %x",
+                     hr);
+        return false;
+    }
+
+    // Audio spends a period in the endpoint buffer before the engine
+    // and device get to it
+    REFERENCE_TIME streamLatency;
+    hr = m_AudioClient->GetStreamLatency(&streamLatency);
+    m_DeviceLatencyUs = m_DevicePeriodUs + (SUCCEEDED(hr) ? (int)(streamLatency / 10) : 0);
+
+    hr = m_AudioClient->SetEventHandle(m_Event);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "IAudioClient::SetEventHandle() failed: %x",
+                     hr);
+        return false;
+    }
+
+    hr = m_AudioClient->GetService(__uuidof(IAudioRenderClient), (void**)&m_RenderClient);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "IAudioClient::GetService(IAudioRenderClient) failed: %x",
+                     hr);
+        return false;
+    }
+
+    // Leave room for the jitter buffer stretching a frame by a few samples
+    m_FrameDurationUs = (int)((Sint64)m_OpusConfig->samplesPerFrame * 1000000 / m_OpusConfig->sampleRate);
+    if (!m_Ring.initialize((m_OpusConfig->samplesPerFrame + m_OpusConfig->samplesPerFrame / 100 + 2) * m_BytesPerFrame)) {
+        return false;
+    }
+
+    // An exclusive mode device plays its whole buffer every period, so
+    // start it out with silence to avoid a glitch on the first period
+    if (m_Exclusive) {
+        BYTE* data;
+        if (SUCCEEDED(m_RenderClient->GetBuffer(m_BufferFrames, &data))) {
+            m_RenderClient->ReleaseBuffer(m_BufferFrames, AUDCLNT_BUFFERFLAGS_SILENT);
+        }
+    }
+
+    hr = m_AudioClient->Start();
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "IAudioClient::Start() failed: %x",
+                     hr);
+        return false;
+    }
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "WASAPI %s mode: %d channels, %s, %d us period, %u frame buffer",
+                m_Exclusive ? "exclusive" : "shared",
+                m_ChannelCount,
+                m_Format == AudioFormatFloat ? "float" : "S16",
+                m_DevicePeriodUs,
+                m_BufferFrames);
+
+    return true;
+}
+
+bool WasapiAudioRenderer::initializeExclusive()
+{
+    WAVEFORMATEX* mixFormat;
+    HRESULT hr;
+
+    hr = m_Device->Activate(__uuidof(IAudioClient), CLSCTX_ALL, nullptr, (void**)&m_AudioClient);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "IMMDevice::Activate(IAudioClient) failed: %x",
+                     hr);
+        return false;
+    }
+
+    // Keep the engine's speaker layout but use our own sample rate
+    hr = m_AudioClient->GetMixFormat(&mixFormat);
+    if (FAILED(hr)) {
+        SAFE_COM_RELEASE(m_AudioClient);
+        return false;
+    }
+
+    WAVEFORMATEXTENSIBLE format = {};
+    format.Format.wFormatTag = WAVE_FORMAT_EXTENSIBLE;
+    format.Format.nChannels = mixFormat->nChannels;
+    format.Format.nSamplesPerSec = m_OpusConfig->sampleRate;
+    format.Format.cbSize = sizeof(format) - sizeof(format.Format);
+    format.dwChannelMask = mixFormat->wFormatTag == WAVE_FORMAT_EXTENSIBLE ?
+                ((WAVEFORMATEXTENSIBLE*)mixFormat)->dwChannelMask : KSAUDIO_SPEAKER_STEREO;
+    CoTaskMemFree(mixFormat);
+
+    // Prefer float, since it's what the mixer produces, then S16
+    static const struct {
+        GUID subFormat;
+        WORD bitsPerSample;
+    } k_Formats[] = {
+        { KSDATAFORMAT_SUBTYPE_IEEE_FLOAT, 32 },
+        { KSDATAFORMAT_SUBTYPE_PCM, 16 },
+    };
+
+    bool supported = false;
+    for (size_t i = 0; i < SDL_arraysize(k_Formats) && !supported; i++) {
+        format.SubFormat = k_Formats[i].subFormat;
+        format.Format.wBitsPerSample = k_Formats[i].bitsPerSample;
+        format.Samples.wValidBitsPerSample = k_Formats[i].bitsPerSample;
+        format.Format.nBlockAlign = format.Format.nChannels * format.Format.wBitsPerSample / 8;
+        format.Format.nAvgBytesPerSec = format.Format.nSamplesPerSec * format.Format.nBlockAlign;
+
+        supported = m_AudioClient->IsFormatSupported(AUDCLNT_SHAREMODE_EXCLUSIVE, &format.Format, nullptr) == S_OK;
+    }
+
+    if (!supported) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Device has no usable exclusive mode format. Falling back to shared mode.");
+        SAFE_COM_RELEASE(m_AudioClient);
+        return false;
+    }
+
+    REFERENCE_TIME defaultPeriod, period;
+    hr = m_AudioClient->GetDevicePeriod(&defaultPeriod, &period);
+    if (FAILED(hr)) {
+        SAFE_COM_RELEASE(m_AudioClient);
+        return false;
+    }
+
+    hr = m_AudioClient->Initialize(AUDCLNT_SHAREMODE_EXCLUSIVE, AUDCLNT_STREAMFLAGS_EVENTCALLBACK,
+                                   period, period, &format.Format, nullptr);
+    if (hr == AUDCLNT_E_BUFFER_SIZE_NOT_ALIGNED) {
+        // Some drivers need the period rounded to their buffer alignment,
+        // which takes a fresh client to retry with
+        UINT32 alignedFrames;
+        hr = m_AudioClient->GetBufferSize(&alignedFrames);
+        SAFE_COM_RELEASE(m_AudioClient);
+        if (SUCCEEDED(hr)) {
+            period = (REFERENCE_TIME)((double)REFTIMES_PER_SEC * alignedFrames / format.Format.nSamplesPerSec + 0.5);
+            hr = m_Device->Activate(__uuidof(IAudioClient), CLSCTX_ALL, nullptr, (void**)&m_AudioClient);
+        }
+        if (SUCCEEDED(hr)) {
+            hr = m_AudioClient->Initialize(AUDCLNT_SHAREMODE_EXCLUSIVE, AUDCLNT_STREAMFLAGS_EVENTCALLBACK,
+                                           period, period, &format.Format, nullptr);
+        }
+    }
+
+    if (FAILED(hr)) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Exclusive mode initialization failed: %x. Falling back to shared mode.",
+                    hr);
+        SAFE_COM_RELEASE(m_AudioClient);
+        return false;
+    }
+
+    m_DevicePeriodUs = (int)(period / 10);
+    return setFormat(&format.Format);
+}
+
+bool WasapiAudioRenderer::initializeShared()
+{
+    WAVEFORMATEX* mixFormat;
+    HRESULT hr;
+
+    hr = m_Device->Activate(__uuidof(IAudioClient), CLSCTX_ALL, nullptr, (void**)&m_AudioClient);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "IMMDevice::Activate(IAudioClient) failed: %x",
+                     hr);
+        return false;
+    }
+
+    hr = m_AudioClient->GetMixFormat(&mixFormat);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "IAudioClient::GetMixFormat() failed: %x",
+                     hr);
+        return false;
+    }
+
+    bool initialized = false;
+
+    // The smallest engine periods are only available through IAudioClient3
+    // and only at the engine's own sample rate
+    IAudioClient3* audioClient3;
+    if (mixFormat->nSamplesPerSec == (DWORD)m_OpusConfig->sampleRate &&
+            SUCCEEDED(m_AudioClient->QueryInterface(__uuidof(IAudioClient3), (void**)&audioClient3))) {
+        UINT32 defaultPeriodFrames, fundamentalPeriodFrames, minPeriodFrames, maxPeriodFrames;
+
+        hr = audioClient3->GetSharedModeEnginePeriod(mixFormat,
+                                                     &defaultPeriodFrames,
+                                                     &fundamentalPeriodFrames,
+                                                     &minPeriodFrames,
+                                                     &maxPeriodFrames);
+        if (SUCCEEDED(hr)) {
+            hr = audioClient3->InitializeSharedAudioStream(AUDCLNT_STREAMFLAGS_EVENTCALLBACK,
+                                                           minPeriodFrames, mixFormat, nullptr);
+        }
+        audioClient3->Release();
+
+        if (SUCCEEDED(hr)) {
+            m_DevicePeriodUs = (int)((Sint64)minPeriodFrames * 1000000 / mixFormat->nSamplesPerSec);
+            initialized = true;
+        }
+        else {
+            // A failed Initialize leaves the client unusable
+            SAFE_COM_RELEASE(m_AudioClient);
+            hr = m_Device->Activate(__uuidof(IAudioClient), CLSCTX_ALL, nullptr, (void**)&m_AudioClient);
+            if (FAILED(hr)) {
+                CoTaskMemFree(mixFormat);
+                return false;
+            }
+        }
+    }
+
+    if (!initialized) {
+        // Let the engine resample if it doesn't run at our rate
+        DWORD flags = AUDCLNT_STREAMFLAGS_EVENTCALLBACK;
+        if (mixFormat->nSamplesPerSec != (DWORD)m_OpusConfig->sampleRate) {
+            flags |= AUDCLNT_STREAMFLAGS_AUTOCONVERTPCM | AUDCLNT_STREAMFLAGS_SRC_DEFAULT_QUALITY;
+            mixFormat->nSamplesPerSec = m_OpusConfig->sampleRate;
+            mixFormat->nAvgBytesPerSec = mixFormat->nSamplesPerSec * mixFormat->nBlockAlign;
+        }
+
+        REFERENCE_TIME defaultPeriod;
+        hr = m_AudioClient->GetDevicePeriod(&defaultPeriod, nullptr);
+        if (SUCCEEDED(hr)) {
+            hr = m_AudioClient->Initialize(AUDCLNT_SHAREMODE_SHARED, flags, 0, 0, mixFormat, nullptr);
+        }
+        if (FAILED(hr)) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "IAudioClient::Initialize() failed: %x",
+                         hr);
+            CoTaskMemFree(mixFormat);
+            return false;
+        }
+
+        m_DevicePeriodUs = (int)(defaultPeriod / 10);
+    }
+
+    bool ret = setFormat(mixFormat);
+    CoTaskMemFree(mixFormat);
+    return ret;
+}
+
+bool WasapiAudioRenderer::setFormat(WAVEFORMATEX* format)
+{
+    bool isFloat = format->wFormatTag == WAVE_FORMAT_IEEE_FLOAT ||
+            (format->wFormatTag == WAVE_FORMAT_EXTENSIBLE &&
+             IsEqualGUID(((WAVEFORMATEXTENSIBLE*)format)->SubFormat, KSDATAFORMAT_SUBTYPE_IEEE_FLOAT));
+
+    if (isFloat && format->wBitsPerSample == 32) {
+        m_Format = AudioFormatFloat;
+    }
+    else if (!isFloat && format->wBitsPerSample == 16) {
+        m_Format = AudioFormatS16;
+    }
+    else {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unsupported WASAPI sample format: %d bits",
+                     format->wBitsPerSample);
+        return false;
+    }
+
+    // Windows orders channels the same way as the mixer's layouts
+    if (format->nChannels < 1 || format->nChannels > 8) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unsupported WASAPI channel count: %d",
+                     format->nChannels);
+        return false;
+    }
+
+    m_ChannelCount = format->nChannels;
+    m_BytesPerFrame = format->nBlockAlign;
+    return true;
+}
+
+void WasapiAudioRenderer::renderPeriod()
+{
+    UINT32 frames = m_BufferFrames;
+    HRESULT hr;
+
+    // In shared mode, only the part of the buffer that the engine has
+    // already consumed can be refilled. Exclusive mode always hands us
+    // a whole period.
+    if (!m_Exclusive) {
+        UINT32 paddingFrames;
+        hr = m_AudioClient->GetCurrentPadding(&paddingFrames);
+        if (FAILED(hr)) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "IAudioClient::GetCurrentPadding() failed: %x",
+                         hr);
+            SDL_AtomicSet(&m_Errored, 1);
+            return;
+        }
+
+        frames -= paddingFrames;
+    }
+
+    if (frames == 0) {
+        return;
+    }
+
+    BYTE* data;
+    hr = m_RenderClient->GetBuffer(frames, &data);
+    if (FAILED(hr)) {
+        // AUDCLNT_E_DEVICE_INVALIDATED lands here when the device goes away
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "IAudioRenderClient::GetBuffer() failed: %x",
+                     hr);
+        SDL_AtomicSet(&m_Errored, 1);
+        return;
+    }
+
+    // Drop whole frames that have piled up far beyond the target
+    m_Ring.trim((m_DevicePeriodUs + m_FrameDurationUs) / m_FrameDurationUs + 1 + WASAPI_MAX_EXCESS_FRAMES);
+
+    // Zero is silence for both float and S16
+    int len = frames * m_BytesPerFrame;
+    int bytesRead = m_Ring.read(data, len);
+    memset(data + bytesRead, 0, len - bytesRead);
+
+    hr = m_RenderClient->ReleaseBuffer(frames, 0);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "IAudioRenderClient::ReleaseBuffer() failed: %x",
+                     hr);
+        SDL_AtomicSet(&m_Errored, 1);
+    }
+}
+
+void WasapiAudioRenderer::cleanupClient()
+{
+    SAFE_COM_RELEASE(m_RenderClient);
+    SAFE_COM_RELEASE(m_AudioClient);
+    SAFE_COM_RELEASE(m_Device);
+
+    // No callbacks are in flight once this returns
+    if (m_NotificationRegistered) {
+        m_Enumerator->UnregisterEndpointNotificationCallback(&m_NotificationClient);
+        m_NotificationRegistered = false;
+    }
+    SAFE_COM_RELEASE(m_Enumerator);
+
+    if (m_Event != nullptr) {
+        CloseHandle(m_Event);
+        m_Event = nullptr;
+    }
+}
+
+void* WasapiAudioRenderer::getAudioBuffer(int* size)
+{
+    // If the ring is full, skip decoding this frame entirely
+    return m_Ring.getWriteBuffer(size);
+}
+
+bool WasapiAudioRenderer::submitAudio(int bytesWritten)
+{
+    if (SDL_AtomicGet(&m_Errored)) {
+        return false;
+    }
+
+    if (bytesWritten == 0) {
+        // Nothing to do
+        return true;
+    }
+
+    m_Ring.submit(bytesWritten);
+    return true;
+}
+
+bool WasapiAudioRenderer::getQueueStatus(int* queuedUs, int* targetUs)
+{
+    *queuedUs = m_Ring.getQueuedFrames() * m_FrameDurationUs;
+
+    // The device drains the ring a period at a time, so keep a period
+    // plus a frame of network jitter queued
+    *targetUs = m_DevicePeriodUs + m_FrameDurationUs;
+    return true;
+}
+
+bool WasapiAudioRenderer::isDefaultDeviceChanged()
+{
+    return SDL_AtomicGet(&m_DefaultDeviceChanged) != 0;
+}
+
+int WasapiAudioRenderer::getDeviceLatencyUs()
+{
+    return m_DeviceLatencyUs;
+}
+
+IAudioRenderer::AudioFormat WasapiAudioRenderer::getAudioBufferFormat()
+{
+    return m_Format;
+}
+
+int WasapiAudioRenderer::getAudioBufferChannelCount()
+{
+    return m_ChannelCount;
+}
+
+int WasapiAudioRenderer::getCapabilities()
+{
+    return CAPABILITY_DIRECT_SUBMIT;
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "renderer.h"
+#include "framering.h"
+
+#include <SDL.h>
+
+#include <mmdeviceapi.h>
+#include <audioclient.h>
+
+// Flags a change of the default render endpoint. Callbacks arrive on
+// arbitrary threads, so this only sets an atomic.
+class WasapiNotificationClient : public IMMNotificationClient
+{
+public:
+    WasapiNotificationClient(SDL_atomic_t* defaultDeviceChanged);
+
+    // Owned by the renderer, so reference counting is a no-op
+    ULONG STDMETHODCALLTYPE AddRef();
+    ULONG STDMETHODCALLTYPE Release();
+    HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** object);
+
+    HRESULT STDMETHODCALLTYPE OnDefaultDeviceChanged(EDataFlow flow, ERole role, LPCWSTR deviceId);
+    HRESULT STDMETHODCALLTYPE OnDeviceAdded(LPCWSTR deviceId);
+    HRESULT STDMETHODCALLTYPE OnDeviceRemoved(LPCWSTR deviceId);
+    HRESULT STDMETHODCALLTYPE OnDeviceStateChanged(LPCWSTR deviceId, DWORD newState);
+    HRESULT STDMETHODCALLTYPE OnPropertyValueChanged(LPCWSTR deviceId, const PROPERTYKEY key);
+
+private:
+    SDL_atomic_t* m_DefaultDeviceChanged;
+};
+
+// Plays audio straight through WASAPI. Shared mode asks IAudioClient3 for
+// the engine's smallest period. With ML_WASAPI_EXCLUSIVE=1, the device is
+// opened in exclusive mode instead, which bypasses the audio engine's mix
+// buffer entirely. Both run event-driven on a pro audio MMCSS thread.
+class WasapiAudioRenderer : public IAudioRenderer
+{
+public:
+    WasapiAudioRenderer();
+
+    virtual ~WasapiAudioRenderer();
+
+    virtual bool prepareForPlayback(const OPUS_MULTISTREAM_CONFIGURATION* opusConfig);
+
+    virtual void* getAudioBuffer(int* size);
+
+    virtual bool submitAudio(int bytesWritten);
+
+    virtual int getCapabilities();
+
+    virtual bool getQueueStatus(int* queuedUs, int* targetUs);
+
+    virtual int getDeviceLatencyUs();
+
+    virtual bool isDefaultDeviceChanged();
+
+    virtual AudioFormat getAudioBufferFormat();
+
+    virtual int getAudioBufferChannelCount();
+
+private:
+    static int renderThreadProc(void* context);
+
+    bool initializeClient();
+
+    bool initializeExclusive();
+
+    bool initializeShared();
+
+    bool setFormat(WAVEFORMATEX* format);
+
+    void renderPeriod();
+
+    void cleanupClient();
+
+    const OPUS_MULTISTREAM_CONFIGURATION* m_OpusConfig;
+    bool m_ExclusiveRequested;
+
+    // Owned by the render thread, which does all of the COM work
+    IMMDeviceEnumerator* m_Enumerator;
+    bool m_NotificationRegistered;
+    IMMDevice* m_Device;
+    IAudioClient* m_AudioClient;
+    IAudioRenderClient* m_RenderClient;
+    HANDLE m_Event;
+    UINT32 m_BufferFrames;
+    bool m_Exclusive;
+
+    // Filled in by the render thread before it signals m_InitSemaphore
+    AudioFormat m_Format;
+    int m_ChannelCount;
+    int m_BytesPerFrame;
+    int m_DevicePeriodUs;
+    int m_DeviceLatencyUs;
+    bool m_InitSucceeded;
+
+    SDL_Thread* m_RenderThread;
+    SDL_sem* m_InitSemaphore;
+    SDL_atomic_t m_Stopping;
+    SDL_atomic_t m_Errored;
+    SDL_atomic_t m_DefaultDeviceChanged;
+    WasapiNotificationClient m_NotificationClient;
+
+    // Frames from the decoder thread wait here until the device asks for them
+    AudioFrameRing m_Ring;
+    int m_FrameDurationUs;
+};
@@ -0,0 +1,97 @@
+#include "avsyncclock.h"
+
+#include <QtGlobal>
+
+// Latencies are averaged over roughly the last 16 samples
+#define EWMA_SHIFT 4
+
+// Skew within this is left alone. Audio is far less noticeable when it's
+// slightly early than when it's late, so this only corrects early audio.
+#define AV_SYNC_TARGET_SKEW_US 10000
+
+// Adjusting by this much per audio frame lets the jitter buffer absorb
+// the change as a slight pitch shift
+#define AV_SYNC_DELAY_STEP_US 50
+
+AvSyncClock::VideoSlot AvSyncClock::s_VideoSlots[AV_SYNC_VIDEO_SLOTS];
+SDL_atomic_t AvSyncClock::s_VideoLatencyUs;
+SDL_atomic_t AvSyncClock::s_AudioLatencyUs;
+bool AvSyncClock::s_CorrectionEnabled;
+int AvSyncClock::s_AudioDelayUs;
+
+static void updateAverage(SDL_atomic_t* average, int sampleUs)
+{
+    int averageUs = SDL_AtomicGet(average);
+    if (averageUs == 0) {
+        averageUs = sampleUs;
+    }
+    else {
+        averageUs += (sampleUs - averageUs) >> EWMA_SHIFT;
+    }
+
+    // 0 is reserved for no measurement
+    SDL_AtomicSet(average, SDL_max(averageUs, 1));
+}
+
+void AvSyncClock::start()
+{
+    for (int i = 0; i < AV_SYNC_VIDEO_SLOTS; i++) {
+        SDL_AtomicSet(&s_VideoSlots[i].frameNumber, -1);
+    }
+
+    SDL_AtomicSet(&s_VideoLatencyUs, 0);
+    SDL_AtomicSet(&s_AudioLatencyUs, 0);
+
+    s_CorrectionEnabled = qgetenv("ML_AV_SYNC_CORRECTION") == "1";
+    s_AudioDelayUs = 0;
+}
+
+void AvSyncClock::markVideoPresented(int frameNumber, Uint64 displayTimeUs)
+{
+    VideoSlot* slot = &s_VideoSlots[frameNumber & (AV_SYNC_VIDEO_SLOTS - 1)];
+
+    // The slot may have been reused if the frame waited a long time
+    if (SDL_AtomicGet(&slot->frameNumber) != frameNumber) {
+        return;
+    }
+
+    Uint64 receiveTimeUs = slot->receiveTimeUs;
+    if (displayTimeUs < receiveTimeUs) {
+        return;
+    }
+
+    updateAverage(&s_VideoLatencyUs, (int)qMin(displayTimeUs - receiveTimeUs, (Uint64)1000000));
+}
+
+void AvSyncClock::markAudioSubmitted(int latencyUs)
+{
+    updateAverage(&s_AudioLatencyUs, qBound(0, latencyUs, 1000000));
+}
+
+bool AvSyncClock::getSkew(int* skewUs, int* audioLatencyUs, int* videoLatencyUs)
+{
+    *audioLatencyUs = SDL_AtomicGet(&s_AudioLatencyUs);
+    *videoLatencyUs = SDL_AtomicGet(&s_VideoLatencyUs);
+    *skewUs = *audioLatencyUs - *videoLatencyUs;
+    return *audioLatencyUs != 0 && *videoLatencyUs != 0;
+}
+
+int AvSyncClock::getAudioDelayUs(int maxDelayUs)
+{
+    int skewUs, audioLatencyUs, videoLatencyUs;
+    if (!s_CorrectionEnabled || !getSkew(&skewUs, &audioLatencyUs, &videoLatencyUs)) {
+        return 0;
+    }
+
+    // The delay shows up in the audio latency as the queue fills, so this
+    // settles once the skew is back within the target
+    if (skewUs < -AV_SYNC_TARGET_SKEW_US) {
+        s_AudioDelayUs += AV_SYNC_DELAY_STEP_US;
+    }
+    else if (skewUs > 0) {
+        s_AudioDelayUs -= AV_SYNC_DELAY_STEP_US;
+    }
+
+    s_AudioDelayUs = qBound(0, s_AudioDelayUs, maxDelayUs);
+    return s_AudioDelayUs;
+}
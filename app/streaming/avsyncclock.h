@@ -0,0 +1,61 @@
+#pragma once
+
+#include <SDL.h>
+
+// Number of frames whose receive time is remembered until they're
+// presented. Must be a power of 2.
+#define AV_SYNC_VIDEO_SLOTS 64
+
+// Measures how far apart audio and video reach the user. The host captures
+// both in sync and they cross the network together, so the skew is the
+// difference between each pipeline's latency from arrival to output, all
+// on the StreamUtils::getTimeUs() clock.
+//
+// With ML_AV_SYNC_CORRECTION=1, audio is also held back through the
+// jitter buffer when it's ahead of video by more than the target skew.
+class AvSyncClock
+{
+public:
+    static void start();
+
+    // Called by the video decoder when a frame has been reassembled
+    static void markVideoReceived(int frameNumber, Uint64 timeUs)
+    {
+        VideoSlot* slot = &s_VideoSlots[frameNumber & (AV_SYNC_VIDEO_SLOTS - 1)];
+        slot->receiveTimeUs = timeUs;
+        SDL_AtomicSet(&slot->frameNumber, frameNumber);
+    }
+
+    // Called by the Pacer once a frame has been rendered. displayTimeUs
+    // includes the scanout latency when the renderer can measure it.
+    static void markVideoPresented(int frameNumber, Uint64 displayTimeUs);
+
+    // Called by the audio decoder thread for each frame it submits.
+    // latencyUs is how long until that frame is heard.
+    static void markAudioSubmitted(int latencyUs);
+
+    // Returns false until both pipelines have been measured. The skew is
+    // positive when audio is heard after its video.
+    static bool getSkew(int* skewUs, int* audioLatencyUs, int* videoLatencyUs);
+
+    // Called by the audio decoder thread for each frame. Returns how much
+    // queued audio to add to the renderer's target, up to maxDelayUs.
+    static int getAudioDelayUs(int maxDelayUs);
+
+private:
+    struct VideoSlot
+    {
+        SDL_atomic_t frameNumber;
+        Uint64 receiveTimeUs;
+    };
+
+    static VideoSlot s_VideoSlots[AV_SYNC_VIDEO_SLOTS];
+
+    // Moving averages, or 0 before the first measurement
+    static SDL_atomic_t s_VideoLatencyUs;
+    static SDL_atomic_t s_AudioLatencyUs;
+
+    // Owned by the audio decoder thread
+    static bool s_CorrectionEnabled;
+    static int s_AudioDelayUs;
+};
@@ -0,0 +1,150 @@
+#include "bitratecontroller.h"
+#include "session.h"
+
+#include <Limelight.h>
+
+#include <QtGlobal>
+
+// Lost frames (out of the window's total) that make a window congested
+#define BITRATE_LOSS_THRESHOLD 0.02f
+
+// A run of lost frames this long can't be repaired by the host's FEC or
+// by a reference frame invalidation and costs us an IDR frame, so a window
+// with one is congested and acted on without waiting for a second window
+#define BITRATE_BURST_FRAMES 3
+
+// Reassembly time that makes a window congested, relative to the baseline
+#define BITRATE_REASSEMBLY_RATIO 2.0f
+#define BITRATE_REASSEMBLY_MIN_RISE_MS 2.0f
+
+// Congested windows in a row before the bitrate is cut
+#define BITRATE_DECREASE_WINDOWS 2
+#define BITRATE_DECREASE_FACTOR 0.75f
+
+// Clean windows in a row before the bitrate is raised
+#define BITRATE_INCREASE_WINDOWS 10
+#define BITRATE_INCREASE_FACTOR 1.1f
+
+// Windows ignored after a change while the stream restarts and the
+// host's encoder adjusts
+#define BITRATE_SETTLE_WINDOWS 5
+
+// The bitrate isn't lowered below this fraction of the user's choice
+#define BITRATE_FLOOR_DIVISOR 5
+#define BITRATE_FLOOR_KBPS 500
+
+bool BitrateController::s_Active;
+int BitrateController::s_MaxBitrateKbps;
+int BitrateController::s_MinBitrateKbps;
+int BitrateController::s_BitrateKbps;
+int BitrateController::s_CongestedWindows;
+int BitrateController::s_CleanWindows;
+int BitrateController::s_SettleWindows;
+float BitrateController::s_BaselineReassemblyMs;
+int BitrateController::s_Changes;
+SDL_atomic_t BitrateController::s_PoorConnection;
+
+void BitrateController::start(int maxBitrateKbps)
+{
+    SDL_assert(!s_Active);
+
+    s_MaxBitrateKbps = s_BitrateKbps = maxBitrateKbps;
+    s_MinBitrateKbps = qMin(maxBitrateKbps, qMax(BITRATE_FLOOR_KBPS, maxBitrateKbps / BITRATE_FLOOR_DIVISOR));
+    s_CongestedWindows = s_CleanWindows = 0;
+    s_SettleWindows = BITRATE_SETTLE_WINDOWS;
+    s_BaselineReassemblyMs = -1;
+    s_Changes = 0;
+    SDL_AtomicSet(&s_PoorConnection, 0);
+
+    s_Active = true;
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Automatic bitrate enabled: %d-%d Kbps",
+                s_MinBitrateKbps, s_MaxBitrateKbps);
+}
+
+void BitrateController::stop()
+{
+    if (!s_Active) {
+        return;
+    }
+
+    s_Active = false;
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Automatic bitrate: %d changes, ended at %d Kbps",
+                s_Changes, s_BitrateKbps);
+}
+
+void BitrateController::changeBitrate(int bitrateKbps, const char* reason)
+{
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Automatic bitrate: %d -> %d Kbps (%s)",
+                s_BitrateKbps, bitrateKbps, reason);
+
+    s_BitrateKbps = bitrateKbps;
+    s_CongestedWindows = s_CleanWindows = 0;
+    s_SettleWindows = BITRATE_SETTLE_WINDOWS;
+    s_Changes++;
+
+    Session::get()->requestStreamRestart(0, 0, bitrateKbps);
+}
+
+void BitrateController::reportVideoStats(const VIDEO_STATS& stats)
+{
+    if (!s_Active || stats.totalFrames == 0) {
+        return;
+    }
+
+    if (s_SettleWindows > 0) {
+        s_SettleWindows--;
+        return;
+    }
+
+    float lossRate = (float)stats.networkDroppedFrames / stats.totalFrames;
+    float reassemblyMs = stats.receivedFrames != 0 ?
+                (float)stats.totalReassemblyTime / stats.receivedFrames / 1000 : 0;
+
+    // The baseline follows the reassembly time down right away but only
+    // creeps up, so a sustained climb stands out against it
+    bool reassemblyRising = false;
+    if (stats.receivedFrames != 0) {
+        if (s_BaselineReassemblyMs < 0 || reassemblyMs < s_BaselineReassemblyMs) {
+            s_BaselineReassemblyMs = reassemblyMs;
+        }
+        else {
+            reassemblyRising = reassemblyMs > s_BaselineReassemblyMs * BITRATE_REASSEMBLY_RATIO &&
+                    reassemblyMs - s_BaselineReassemblyMs > BITRATE_REASSEMBLY_MIN_RISE_MS;
+            s_BaselineReassemblyMs += (reassemblyMs - s_BaselineReassemblyMs) / 64;
+        }
+    }
+
+    const char* reason = nullptr;
+    bool urgent = false;
+    if (stats.maxLossBurst >= BITRATE_BURST_FRAMES) {
+        reason = "loss burst";
+        urgent = true;
+    }
+    else if (lossRate >= BITRATE_LOSS_THRESHOLD) {
+        reason = "frame loss";
+    }
+    else if (SDL_AtomicGet(&s_PoorConnection)) {
+        reason = "poor connection";
+    }
+    else if (reassemblyRising) {
+        reason = "rising reassembly time";
+    }
+
+    if (reason != nullptr) {
+        s_CleanWindows = 0;
+        if ((++s_CongestedWindows >= BITRATE_DECREASE_WINDOWS || urgent) && s_BitrateKbps > s_MinBitrateKbps) {
+            changeBitrate(qMax(s_MinBitrateKbps, (int)(s_BitrateKbps * BITRATE_DECREASE_FACTOR)), reason);
+        }
+    }
+    else {
+        s_CongestedWindows = 0;
+        if (++s_CleanWindows >= BITRATE_INCREASE_WINDOWS && s_BitrateKbps < s_MaxBitrateKbps) {
+            changeBitrate(qMin(s_MaxBitrateKbps, (int)(s_BitrateKbps * BITRATE_INCREASE_FACTOR)), "recovered");
+        }
+    }
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "video/decoder.h"
+
+#include <SDL.h>
+
+// Picks the stream bitrate from what the connection can sustain. Windows
+// with lost frames, a reassembly time climbing above its usual level, or
+// a poor connection status from the host count as congested, and two of
+// those in a row cut the bitrate by a quarter. A burst of several lost
+// frames in a row cuts it straight away, since the host's FEC can't cover
+// it and it ends in an IDR frame. After enough clean windows it's raised
+// in small steps back toward the bitrate the user chose.
+//
+// New bitrates are applied by restarting the stream within the session,
+// so changes are spaced out to let each one settle before it's judged.
+// Enabled with the autoBitrate preference.
+class BitrateController
+{
+public:
+    // maxBitrateKbps is where the stream starts and the highest bitrate
+    // the controller will return to
+    static void start(int maxBitrateKbps);
+
+    static void stop();
+
+    static bool isActive()
+    {
+        return s_Active;
+    }
+
+    // Called by the decoder thread once per stats window
+    static void reportVideoStats(const VIDEO_STATS& stats);
+
+    static void setConnectionStatus(int connectionStatus)
+    {
+        SDL_AtomicSet(&s_PoorConnection, connectionStatus == CONN_STATUS_POOR);
+    }
+
+private:
+    static void changeBitrate(int bitrateKbps, const char* reason);
+
+    static bool s_Active;
+    static int s_MaxBitrateKbps;
+    static int s_MinBitrateKbps;
+    static int s_BitrateKbps;
+    static int s_CongestedWindows;
+    static int s_CleanWindows;
+    static int s_SettleWindows;
+    static float s_BaselineReassemblyMs;
+    static int s_Changes;
+    static SDL_atomic_t s_PoorConnection;
+};
@@ -0,0 +1,408 @@
+#include "capturefile.h"
+
+CaptureReader::CaptureReader()
+    : m_Data(nullptr),
+      m_Size(0),
+      m_Header(nullptr),
+      m_Offset(0)
+{
+}
+
+CaptureReader::~CaptureReader()
+{
+    if (m_Data != nullptr) {
+        m_File.unmap((uchar*)m_Data);
+    }
+}
+
+bool CaptureReader::open(const QString& path)
+{
+    m_File.setFileName(path);
+    if (!m_File.open(QIODevice::ReadOnly)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unable to open capture %s: %s",
+                     qPrintable(path),
+                     qPrintable(m_File.errorString()));
+        return false;
+    }
+
+    m_Size = m_File.size();
+    if (m_Size < (qint64)sizeof(CAPTURE_FILE_HEADER)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Capture %s is truncated",
+                     qPrintable(path));
+        return false;
+    }
+
+    m_Data = m_File.map(0, m_Size);
+    if (m_Data == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unable to map capture %s: %s",
+                     qPrintable(path),
+                     qPrintable(m_File.errorString()));
+        return false;
+    }
+
+    m_Header = (const CAPTURE_FILE_HEADER*)m_Data;
+    if (memcmp(m_Header->magic, CAPTURE_FILE_MAGIC, sizeof(m_Header->magic)) != 0 ||
+            m_Header->version != CAPTURE_FILE_VERSION) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "%s is not a supported capture",
+                     qPrintable(path));
+        m_Header = nullptr;
+        return false;
+    }
+
+    rewind();
+    return true;
+}
+
+void CaptureReader::rewind()
+{
+    m_Offset = sizeof(CAPTURE_FILE_HEADER);
+}
+
+bool CaptureReader::readRecord(const CAPTURE_RECORD_HEADER** record, const Uint8** payload)
+{
+    if (m_Offset + (qint64)sizeof(CAPTURE_RECORD_HEADER) > m_Size) {
+        return false;
+    }
+
+    const CAPTURE_RECORD_HEADER* header = (const CAPTURE_RECORD_HEADER*)&m_Data[m_Offset];
+    qint64 payloadOffset = m_Offset + sizeof(*header);
+
+    // A record cut short by an unclean stop ends the capture, as does the index
+    if (header->type == CAPTURE_RECORD_INDEX || payloadOffset + header->length > m_Size) {
+        return false;
+    }
+
+    *record = header;
+    *payload = &m_Data[payloadOffset];
+
+    m_Offset = payloadOffset + header->length;
+    m_Offset = (m_Offset + CAPTURE_RECORD_ALIGNMENT - 1) & ~(qint64)(CAPTURE_RECORD_ALIGNMENT - 1);
+    return true;
+}
+
+bool CaptureReader::getDecodeUnit(const CAPTURE_RECORD_HEADER* record, const Uint8* payload,
+                                  QVector<LENTRY>& entries, PDECODE_UNIT du)
+{
+    Uint32 offset = 0;
+
+    SDL_assert(record->type == CAPTURE_RECORD_VIDEO);
+
+    SDL_zerop(du);
+    du->frameNumber = record->frameNumber;
+    du->frameType = record->frameType;
+
+    entries.clear();
+    while (offset + sizeof(CAPTURE_BUFFER_HEADER) <= record->length) {
+        const CAPTURE_BUFFER_HEADER* buffer = (const CAPTURE_BUFFER_HEADER*)&payload[offset];
+        offset += sizeof(*buffer);
+
+        if (buffer->length > record->length - offset) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "Frame %d in the capture is corrupt",
+                        record->frameNumber);
+            return false;
+        }
+
+        LENTRY entry = {};
+        entry.data = (char*)&payload[offset];
+        entry.length = (int)buffer->length;
+        entry.bufferType = (int)buffer->bufferType;
+        entries.append(entry);
+
+        du->fullLength += entry.length;
+        offset += buffer->length;
+    }
+
+    // Link the entries only once the vector is done reallocating
+    for (int i = 0; i < entries.size(); i++) {
+        entries[i].next = i + 1 < entries.size() ? &entries[i + 1] : nullptr;
+    }
+    du->bufferList = entries.isEmpty() ? nullptr : &entries[0];
+
+    return !entries.isEmpty();
+}
+
+static const Uint8 k_Padding[CAPTURE_RECORD_ALIGNMENT] = {};
+
+CaptureWriter::CaptureWriter()
+    : m_Thread(nullptr),
+      m_DataSemaphore(nullptr),
+      m_StartTimeMs(0),
+      m_Lock(0),
+      m_Ring(nullptr),
+      m_Head(0),
+      m_Tail(0),
+      m_DroppedRecords(0),
+      m_HeaderDirty(false)
+{
+    SDL_AtomicSet(&m_Stopping, 0);
+
+    SDL_zero(m_Header);
+    memcpy(m_Header.magic, CAPTURE_FILE_MAGIC, sizeof(m_Header.magic));
+    m_Header.version = CAPTURE_FILE_VERSION;
+}
+
+CaptureWriter::~CaptureWriter()
+{
+    if (m_Thread != nullptr) {
+        SDL_AtomicSet(&m_Stopping, 1);
+        SDL_SemPost(m_DataSemaphore);
+        SDL_WaitThread(m_Thread, nullptr);
+    }
+
+    if (m_DataSemaphore != nullptr) {
+        SDL_DestroySemaphore(m_DataSemaphore);
+    }
+
+    SDL_free(m_Ring);
+}
+
+bool CaptureWriter::start(const QString& path)
+{
+    m_File.setFileName(path);
+    if (!m_File.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unable to open capture file: %s",
+                     qPrintable(m_File.errorString()));
+        return false;
+    }
+
+    // The header is rewritten as the stream formats become known
+    if (m_File.write((const char*)&m_Header, sizeof(m_Header)) != sizeof(m_Header)) {
+        return false;
+    }
+
+    m_Ring = (Uint8*)SDL_malloc(CAPTURE_RING_SIZE);
+    m_DataSemaphore = SDL_CreateSemaphore(0);
+    if (m_Ring == nullptr || m_DataSemaphore == nullptr) {
+        return false;
+    }
+
+    // Reserve about an hour of video so the index rarely grows while streaming
+    m_Index.reserve(60 * 60 * 60);
+    m_StartTimeMs = LiGetMillis();
+
+    m_Thread = SDL_CreateThread(writerThreadProc, "CaptureWriter", this);
+    if (m_Thread == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unable to create capture writer thread: %s",
+                     SDL_GetError());
+        return false;
+    }
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Capturing stream to %s",
+                qPrintable(path));
+    return true;
+}
+
+void CaptureWriter::setVideoFormat(int videoFormat, int width, int height, int frameRate)
+{
+    SDL_AtomicLock(&m_Lock);
+    m_Header.videoFormat = (Uint32)videoFormat;
+    m_Header.width = (Uint32)width;
+    m_Header.height = (Uint32)height;
+    m_Header.frameRate = (Uint32)frameRate;
+    m_HeaderDirty = true;
+    SDL_AtomicUnlock(&m_Lock);
+}
+
+void CaptureWriter::setAudioConfig(const OPUS_MULTISTREAM_CONFIGURATION* opusConfig)
+{
+    SDL_AtomicLock(&m_Lock);
+    m_Header.audioSampleRate = (Uint32)opusConfig->sampleRate;
+    m_Header.audioChannelCount = (Uint32)opusConfig->channelCount;
+    m_Header.audioStreams = (Uint32)opusConfig->streams;
+    m_Header.audioCoupledStreams = (Uint32)opusConfig->coupledStreams;
+    m_Header.audioSamplesPerFrame = (Uint32)opusConfig->samplesPerFrame;
+    memcpy(m_Header.audioMapping, opusConfig->mapping, SDL_min(sizeof(m_Header.audioMapping), sizeof(opusConfig->mapping)));
+    m_HeaderDirty = true;
+    SDL_AtomicUnlock(&m_Lock);
+}
+
+void CaptureWriter::copyToRing(Uint64 position, const void* data, Uint32 length)
+{
+    Uint32 offset = (Uint32)(position & (CAPTURE_RING_SIZE - 1));
+    Uint32 firstLength = SDL_min(length, CAPTURE_RING_SIZE - offset);
+
+    memcpy(&m_Ring[offset], data, firstLength);
+    if (firstLength < length) {
+        memcpy(m_Ring, (const Uint8*)data + firstLength, length - firstLength);
+    }
+}
+
+void CaptureWriter::writeVideo(PDECODE_UNIT du)
+{
+    CAPTURE_RECORD_HEADER record = {};
+
+    record.type = CAPTURE_RECORD_VIDEO;
+    record.frameNumber = du->frameNumber;
+    record.frameType = du->frameType;
+    record.timestampMs = (Uint32)(du->receiveTimeMs - m_StartTimeMs);
+    for (PLENTRY entry = du->bufferList; entry != nullptr; entry = entry->next) {
+        record.length += sizeof(CAPTURE_BUFFER_HEADER) + entry->length;
+    }
+
+    Uint32 recordSize = (sizeof(record) + record.length + CAPTURE_RECORD_ALIGNMENT - 1) & ~(CAPTURE_RECORD_ALIGNMENT - 1);
+
+    SDL_AtomicLock(&m_Lock);
+
+    if (m_Head - m_Tail + recordSize > CAPTURE_RING_SIZE) {
+        m_DroppedRecords++;
+        SDL_AtomicUnlock(&m_Lock);
+        return;
+    }
+
+    CAPTURE_INDEX_ENTRY indexEntry;
+    indexEntry.offset = sizeof(CAPTURE_FILE_HEADER) + m_Head;
+    indexEntry.timestampMs = record.timestampMs;
+    indexEntry.frameType = record.frameType;
+    m_Index.append(indexEntry);
+
+    Uint64 position = m_Head;
+    copyToRing(position, &record, sizeof(record));
+    position += sizeof(record);
+
+    for (PLENTRY entry = du->bufferList; entry != nullptr; entry = entry->next) {
+        CAPTURE_BUFFER_HEADER buffer;
+
+        buffer.bufferType = (Uint32)entry->bufferType;
+        buffer.length = (Uint32)entry->length;
+        copyToRing(position, &buffer, sizeof(buffer));
+        position += sizeof(buffer);
+
+        copyToRing(position, entry->data, buffer.length);
+        position += buffer.length;
+    }
+
+    copyToRing(position, k_Padding, (Uint32)(m_Head + recordSize - position));
+    m_Head += recordSize;
+
+    SDL_AtomicUnlock(&m_Lock);
+
+    SDL_SemPost(m_DataSemaphore);
+}
+
+void CaptureWriter::writeAudio(const char* data, int length)
+{
+    CAPTURE_RECORD_HEADER record = {};
+
+    record.type = CAPTURE_RECORD_AUDIO;
+    record.length = (Uint32)length;
+    record.timestampMs = (Uint32)(LiGetMillis() - m_StartTimeMs);
+
+    Uint32 recordSize = (sizeof(record) + record.length + CAPTURE_RECORD_ALIGNMENT - 1) & ~(CAPTURE_RECORD_ALIGNMENT - 1);
+
+    SDL_AtomicLock(&m_Lock);
+
+    if (m_Head - m_Tail + recordSize > CAPTURE_RING_SIZE) {
+        m_DroppedRecords++;
+        SDL_AtomicUnlock(&m_Lock);
+        return;
+    }
+
+    copyToRing(m_Head, &record, sizeof(record));
+    copyToRing(m_Head + sizeof(record), data, record.length);
+    copyToRing(m_Head + sizeof(record) + record.length, k_Padding, recordSize - sizeof(record) - record.length);
+    m_Head += recordSize;
+
+    SDL_AtomicUnlock(&m_Lock);
+
+    // Audio packets are small, so let them batch up with the next frame
+}
+
+bool CaptureWriter::flushRing()
+{
+    CAPTURE_FILE_HEADER header;
+    bool headerDirty;
+
+    SDL_AtomicLock(&m_Lock);
+    Uint64 head = m_Head;
+    Uint64 tail = m_Tail;
+    headerDirty = m_HeaderDirty;
+    if (headerDirty) {
+        header = m_Header;
+        m_HeaderDirty = false;
+    }
+    SDL_AtomicUnlock(&m_Lock);
+
+    // Producers never touch the data between the tail and the head, so
+    // it can be written without holding the lock.
+    while (tail != head) {
+        Uint32 offset = (Uint32)(tail & (CAPTURE_RING_SIZE - 1));
+        Uint32 length = (Uint32)SDL_min(head - tail, (Uint64)(CAPTURE_RING_SIZE - offset));
+
+        if (m_File.write((const char*)&m_Ring[offset], length) != (qint64)length) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "Unable to write capture: %s",
+                         qPrintable(m_File.errorString()));
+            return false;
+        }
+
+        tail += length;
+    }
+
+    SDL_AtomicLock(&m_Lock);
+    m_Tail = tail;
+    SDL_AtomicUnlock(&m_Lock);
+
+    if (headerDirty) {
+        qint64 end = m_File.pos();
+        m_File.seek(0);
+        m_File.write((const char*)&header, sizeof(header));
+        m_File.seek(end);
+    }
+
+    return true;
+}
+
+void CaptureWriter::finish()
+{
+    // The streaming threads are gone by now
+    CAPTURE_RECORD_HEADER record = {};
+    record.type = CAPTURE_RECORD_INDEX;
+    record.length = (Uint32)(m_Index.size() * sizeof(CAPTURE_INDEX_ENTRY));
+
+    m_Header.indexOffset = (Uint64)m_File.pos();
+    m_File.write((const char*)&record, sizeof(record));
+    m_File.write((const char*)m_Index.constData(), record.length);
+
+    m_File.seek(0);
+    m_File.write((const char*)&m_Header, sizeof(m_Header));
+    m_File.close();
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Capture finished with %d video frames (%u records dropped)",
+                m_Index.size(),
+                m_DroppedRecords);
+}
+
+int CaptureWriter::writerThreadProc(void* context)
+{
+    CaptureWriter* me = (CaptureWriter*)context;
+    bool ok = true;
+
+    while (!SDL_AtomicGet(&me->m_Stopping)) {
+        SDL_SemWaitTimeout(me->m_DataSemaphore, 100);
+
+        if (ok) {
+            ok = me->flushRing();
+        }
+        else {
+            // Keep draining the ring so a failed disk drops records quietly
+            SDL_AtomicLock(&me->m_Lock);
+            me->m_Tail = me->m_Head;
+            SDL_AtomicUnlock(&me->m_Lock);
+        }
+    }
+
+    if (ok && me->flushRing()) {
+        me->finish();
+    }
+
+    return 0;
+}
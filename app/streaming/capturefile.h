@@ -0,0 +1,152 @@
+#pragma once
+
+#include <Limelight.h>
+#include <SDL.h>
+
+#include <QFile>
+#include <QVector>
+
+// A capture holds the compressed video and audio of a stream in the order
+// it was received, so a session can be replayed without a host. All fields
+// are little-endian and every record starts on an 8 byte boundary, which
+// lets readers walk a mapped file in place.
+//
+// The file is a CaptureFileHeader followed by records. Each record is a
+// CaptureRecordHeader and its payload:
+//
+//  - Video: the decode unit's buffers, each one a CaptureBufferHeader
+//    followed by the buffer data.
+//  - Audio: a single Opus packet.
+//  - Index: the CaptureIndexEntry of every video record, written last.
+//    If the capture wasn't finished cleanly, there is no index and readers
+//    just scan the records.
+#define CAPTURE_FILE_MAGIC "MLCAPTR1"
+#define CAPTURE_FILE_VERSION 1
+#define CAPTURE_RECORD_ALIGNMENT 8
+
+// Size of the buffer between the streaming threads and the capture's
+// writer thread. Must be a power of 2.
+#define CAPTURE_RING_SIZE (32 * 1024 * 1024)
+
+#define CAPTURE_RECORD_VIDEO 1
+#define CAPTURE_RECORD_AUDIO 2
+#define CAPTURE_RECORD_INDEX 3
+
+#pragma pack(push, 1)
+typedef struct _CAPTURE_FILE_HEADER {
+    char magic[8];
+    Uint32 version;
+    Uint32 videoFormat;
+    Uint32 width;
+    Uint32 height;
+    Uint32 frameRate;
+    Uint32 audioSampleRate;
+    Uint32 audioChannelCount;
+    Uint32 audioStreams;
+    Uint32 audioCoupledStreams;
+    Uint32 audioSamplesPerFrame;
+    Uint8 audioMapping[8];
+    Uint64 indexOffset;
+} CAPTURE_FILE_HEADER, *PCAPTURE_FILE_HEADER;
+
+typedef struct _CAPTURE_RECORD_HEADER {
+    Uint32 type;
+    Uint32 length;
+    Sint32 frameNumber;
+    Sint32 frameType;
+    // Milliseconds since the capture started
+    Uint32 timestampMs;
+    Uint32 reserved;
+} CAPTURE_RECORD_HEADER, *PCAPTURE_RECORD_HEADER;
+
+typedef struct _CAPTURE_BUFFER_HEADER {
+    Uint32 bufferType;
+    Uint32 length;
+} CAPTURE_BUFFER_HEADER, *PCAPTURE_BUFFER_HEADER;
+
+typedef struct _CAPTURE_INDEX_ENTRY {
+    Uint64 offset;
+    Uint32 timestampMs;
+    Sint32 frameType;
+} CAPTURE_INDEX_ENTRY, *PCAPTURE_INDEX_ENTRY;
+#pragma pack(pop)
+
+// Reads a capture through a memory mapping, so replaying it doesn't copy
+// the frame data until the decoder does.
+class CaptureReader
+{
+public:
+    CaptureReader();
+    ~CaptureReader();
+
+    bool open(const QString& path);
+
+    const CAPTURE_FILE_HEADER* getHeader()
+    {
+        return m_Header;
+    }
+
+    // Returns the next record of any type, or false at the end of the
+    // captured stream. The payload stays valid as long as the reader.
+    bool readRecord(const CAPTURE_RECORD_HEADER** record, const Uint8** payload);
+
+    // Builds a decode unit from a video record. The entries are filled in
+    // with the record's buffers, which point into the mapped file.
+    bool getDecodeUnit(const CAPTURE_RECORD_HEADER* record, const Uint8* payload,
+                       QVector<LENTRY>& entries, PDECODE_UNIT du);
+
+    void rewind();
+
+private:
+    QFile m_File;
+    const Uint8* m_Data;
+    qint64 m_Size;
+    const CAPTURE_FILE_HEADER* m_Header;
+    qint64 m_Offset;
+};
+
+// Writes a capture of the stream as it arrives. The streaming threads only
+// copy their data into a bounded ring buffer, and a writer thread moves it
+// to disk. If the disk can't keep up, records are dropped rather than
+// stalling the streaming threads.
+class CaptureWriter
+{
+public:
+    CaptureWriter();
+
+    // Finishes the capture with its index
+    ~CaptureWriter();
+
+    bool start(const QString& path);
+
+    void setVideoFormat(int videoFormat, int width, int height, int frameRate);
+    void setAudioConfig(const OPUS_MULTISTREAM_CONFIGURATION* opusConfig);
+
+    void writeVideo(PDECODE_UNIT du);
+    void writeAudio(const char* data, int length);
+
+private:
+    void copyToRing(Uint64 position, const void* data, Uint32 length);
+    bool flushRing();
+    void finish();
+
+    static int writerThreadProc(void* context);
+
+    QFile m_File;
+    SDL_Thread* m_Thread;
+    SDL_sem* m_DataSemaphore;
+    SDL_atomic_t m_Stopping;
+    Uint64 m_StartTimeMs;
+
+    // Producers append at m_Head and the writer thread consumes at m_Tail.
+    // Both are byte counts since the start of the capture, so m_Head is
+    // also where the next record will be in the file.
+    SDL_SpinLock m_Lock;
+    Uint8* m_Ring;
+    Uint64 m_Head;
+    Uint64 m_Tail;
+    Uint32 m_DroppedRecords;
+    CAPTURE_FILE_HEADER m_Header;
+    bool m_HeaderDirty;
+    QVector<CAPTURE_INDEX_ENTRY> m_Index;
+};
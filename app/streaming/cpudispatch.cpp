@@ -0,0 +1,566 @@
+#include "cpudispatch.h"
+
+#include <QtGlobal>
+
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HAVE_SSE2_KERNELS
+#if defined(__GNUC__) || defined(_MSC_VER)
+// AVX2 kernels are built for a target above our baseline and only
+// run once SDL has confirmed the CPU supports them
+#include <immintrin.h>
+#define HAVE_AVX2_KERNELS
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define HAVE_NEON_KERNELS
+#endif
+
+#ifdef __GNUC__
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+
+// Samples in the self-test buffers. Odd sizes exercise the scalar tails.
+#define SELF_TEST_SAMPLES 1027
+#define SELF_TEST_FRAMES 37
+
+// Our scalar S16 conversion truncates, while SSE rounds to nearest
+#define SELF_TEST_S16_TOLERANCE 1
+
+// Float sums in a different order differ in the last few bits
+#define SELF_TEST_MIX_TOLERANCE 0.0001f
+
+// Rows in the 8-bit conversion self-test, starting on an odd row
+#define SELF_TEST_ROWS 5
+
+CpuDispatch::CopyPlaneFn CpuDispatch::copyPlane;
+CpuDispatch::ConvertFloatToS16Fn CpuDispatch::convertFloatToS16;
+CpuDispatch::MixFramesFn CpuDispatch::mixFrames;
+CpuDispatch::ConvertTo8BitFn CpuDispatch::convertTo8Bit;
+
+// A 2x2 ordered dither of the bits lost going from 10 to 8 bits, indexed
+// by row and column parity. It averages out to rounding to nearest.
+static const Uint16 k_Dither[2][2] = {
+    { 0, 2 },
+    { 3, 1 },
+};
+
+// The dither for a row as a pair of 16-bit lanes, to fill SIMD registers with
+static Uint32 getDitherPair(int row, int shift)
+{
+    return ((Uint32)k_Dither[row & 1][1] << (shift - 2)) << 16 |
+            (Uint32)k_Dither[row & 1][0] << (shift - 2);
+}
+
+static void copyPlaneScalar(Uint8* dst, int dstPitch, const Uint8* src, int srcPitch, int widthBytes, int height)
+{
+    if (dstPitch == srcPitch) {
+        // The whole plane is contiguous in both buffers
+        memcpy(dst, src, (size_t)srcPitch * (height - 1) + widthBytes);
+        return;
+    }
+
+    for (int y = 0; y < height; y++) {
+        memcpy(dst + (size_t)y * dstPitch, src + (size_t)y * srcPitch, widthBytes);
+    }
+}
+
+static void convertFloatToS16Scalar(const float* input, short* output, int count)
+{
+    for (int i = 0; i < count; i++) {
+        float sample = input[i] * 32767.0f;
+        output[i] = (short)SDL_max(-32768.0f, SDL_min(sample, 32767.0f));
+    }
+}
+
+static void mixFramesScalar(const float* input, int inputChannels,
+                            float* output, int outputChannels,
+                            const float matrix[8][8], int frames)
+{
+    for (int s = 0; s < frames; s++) {
+        const float* in = &input[s * inputChannels];
+        float* out = &output[s * outputChannels];
+
+        for (int o = 0; o < outputChannels; o++) {
+            float sum = 0;
+            for (int i = 0; i < inputChannels; i++) {
+                sum += in[i] * matrix[o][i];
+            }
+            out[o] = sum;
+        }
+    }
+}
+
+static void convertTo8BitScalar(Uint8* dst, int dstPitch, const Uint16* src, int srcPitch,
+                                int samples, int height, int shift, int firstRow)
+{
+    for (int y = 0; y < height; y++) {
+        const Uint16* srcRow = (const Uint16*)((const Uint8*)src + (size_t)y * srcPitch);
+        Uint8* dstRow = dst + (size_t)y * dstPitch;
+        const Uint16* dither = k_Dither[(firstRow + y) & 1];
+
+        for (int x = 0; x < samples; x++) {
+            // Saturate like the SIMD adds and packs do
+            int sample = SDL_min(srcRow[x] + (dither[x & 1] << (shift - 2)), 0xFFFF);
+            dstRow[x] = (Uint8)SDL_min(sample >> shift, 255);
+        }
+    }
+}
+
+#ifdef HAVE_SSE2_KERNELS
+// Texture memory is often write-combined, so this uses non-temporal
+// stores that don't pull the destination into the cache
+static void copyPlaneSse2(Uint8* dst, int dstPitch, const Uint8* src, int srcPitch, int widthBytes, int height)
+{
+    if (dstPitch == srcPitch || ((uintptr_t)dst & 15) != 0 || (dstPitch & 15) != 0) {
+        copyPlaneScalar(dst, dstPitch, src, srcPitch, widthBytes, height);
+        return;
+    }
+
+    for (int y = 0; y < height; y++) {
+        const Uint8* srcRow = src + (size_t)y * srcPitch;
+        Uint8* dstRow = dst + (size_t)y * dstPitch;
+        int x = 0;
+
+        for (; x + 64 <= widthBytes; x += 64) {
+            __m128i a = _mm_loadu_si128((const __m128i*)(srcRow + x));
+            __m128i b = _mm_loadu_si128((const __m128i*)(srcRow + x + 16));
+            __m128i c = _mm_loadu_si128((const __m128i*)(srcRow + x + 32));
+            __m128i d = _mm_loadu_si128((const __m128i*)(srcRow + x + 48));
+            _mm_stream_si128((__m128i*)(dstRow + x), a);
+            _mm_stream_si128((__m128i*)(dstRow + x + 16), b);
+            _mm_stream_si128((__m128i*)(dstRow + x + 32), c);
+            _mm_stream_si128((__m128i*)(dstRow + x + 48), d);
+        }
+
+        memcpy(dstRow + x, srcRow + x, widthBytes - x);
+    }
+
+    // Make the streaming stores visible before the texture is unlocked
+    _mm_sfence();
+}
+
+static void convertFloatToS16Sse2(const float* input, short* output, int count)
+{
+    int i = 0;
+
+    const __m128 scale = _mm_set1_ps(32767.0f);
+    for (; i + 8 <= count; i += 8) {
+        __m128i lo = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(&input[i]), scale));
+        __m128i hi = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(&input[i + 4]), scale));
+
+        // Packing saturates anything beyond full scale
+        _mm_storeu_si128((__m128i*)&output[i], _mm_packs_epi32(lo, hi));
+    }
+
+    convertFloatToS16Scalar(&input[i], &output[i], count - i);
+}
+
+static void mixFramesSse2(const float* input, int inputChannels,
+                          float* output, int outputChannels,
+                          const float matrix[8][8], int frames)
+{
+    for (int s = 0; s < frames; s++) {
+        const float* in = &input[s * inputChannels];
+        float* out = &output[s * outputChannels];
+
+        // Each output sample is the dot product of the input frame with
+        // that output's row of the matrix. Lanes past the end of the frame
+        // hold the next frame's samples, but their gains are zero.
+        __m128 lo = _mm_loadu_ps(in);
+        __m128 hi = inputChannels > 4 ? _mm_loadu_ps(in + 4) : _mm_setzero_ps();
+        for (int o = 0; o < outputChannels; o++) {
+            __m128 sum = _mm_add_ps(_mm_mul_ps(lo, _mm_loadu_ps(&matrix[o][0])),
+                                    _mm_mul_ps(hi, _mm_loadu_ps(&matrix[o][4])));
+            sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+            sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+            out[o] = _mm_cvtss_f32(sum);
+        }
+    }
+}
+
+static void convertTo8BitSse2(Uint8* dst, int dstPitch, const Uint16* src, int srcPitch,
+                              int samples, int height, int shift, int firstRow)
+{
+    const __m128i count = _mm_cvtsi32_si128(shift);
+
+    for (int y = 0; y < height; y++) {
+        const Uint16* srcRow = (const Uint16*)((const Uint8*)src + (size_t)y * srcPitch);
+        Uint8* dstRow = dst + (size_t)y * dstPitch;
+        const __m128i dither = _mm_set1_epi32((int)getDitherPair(firstRow + y, shift));
+        int x = 0;
+
+        for (; x + 16 <= samples; x += 16) {
+            __m128i lo = _mm_loadu_si128((const __m128i*)&srcRow[x]);
+            __m128i hi = _mm_loadu_si128((const __m128i*)&srcRow[x + 8]);
+            lo = _mm_srl_epi16(_mm_adds_epu16(lo, dither), count);
+            hi = _mm_srl_epi16(_mm_adds_epu16(hi, dither), count);
+            _mm_storeu_si128((__m128i*)&dstRow[x], _mm_packus_epi16(lo, hi));
+        }
+
+        // x is even, so the tail keeps its place in the dither pattern
+        convertTo8BitScalar(&dstRow[x], dstPitch, &srcRow[x], srcPitch,
+                            samples - x, 1, shift, firstRow + y);
+    }
+}
+#endif
+
+#ifdef HAVE_AVX2_KERNELS
+TARGET_AVX2
+static void convertFloatToS16Avx2(const float* input, short* output, int count)
+{
+    int i = 0;
+
+    const __m256 scale = _mm256_set1_ps(32767.0f);
+    for (; i + 16 <= count; i += 16) {
+        __m256i lo = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_loadu_ps(&input[i]), scale));
+        __m256i hi = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_loadu_ps(&input[i + 8]), scale));
+
+        // Packing works within each 128-bit lane, so the 64-bit
+        // quarters have to be put back in order afterwards
+        __m256i packed = _mm256_packs_epi32(lo, hi);
+        _mm256_storeu_si256((__m256i*)&output[i], _mm256_permute4x64_epi64(packed, 0xD8));
+    }
+
+    convertFloatToS16Scalar(&input[i], &output[i], count - i);
+}
+
+TARGET_AVX2
+static void convertTo8BitAvx2(Uint8* dst, int dstPitch, const Uint16* src, int srcPitch,
+                              int samples, int height, int shift, int firstRow)
+{
+    const __m128i count = _mm_cvtsi32_si128(shift);
+
+    for (int y = 0; y < height; y++) {
+        const Uint16* srcRow = (const Uint16*)((const Uint8*)src + (size_t)y * srcPitch);
+        Uint8* dstRow = dst + (size_t)y * dstPitch;
+        const __m256i dither = _mm256_set1_epi32((int)getDitherPair(firstRow + y, shift));
+        int x = 0;
+
+        for (; x + 32 <= samples; x += 32) {
+            __m256i lo = _mm256_loadu_si256((const __m256i*)&srcRow[x]);
+            __m256i hi = _mm256_loadu_si256((const __m256i*)&srcRow[x + 16]);
+            lo = _mm256_srl_epi16(_mm256_adds_epu16(lo, dither), count);
+            hi = _mm256_srl_epi16(_mm256_adds_epu16(hi, dither), count);
+
+            // See convertFloatToS16Avx2()
+            __m256i packed = _mm256_packus_epi16(lo, hi);
+            _mm256_storeu_si256((__m256i*)&dstRow[x], _mm256_permute4x64_epi64(packed, 0xD8));
+        }
+
+        convertTo8BitScalar(&dstRow[x], dstPitch, &srcRow[x], srcPitch,
+                            samples - x, 1, shift, firstRow + y);
+    }
+}
+#endif
+
+#ifdef HAVE_NEON_KERNELS
+static void convertFloatToS16Neon(const float* input, short* output, int count)
+{
+    int i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        int32x4_t lo = vcvtq_s32_f32(vmulq_n_f32(vld1q_f32(&input[i]), 32767.0f));
+        int32x4_t hi = vcvtq_s32_f32(vmulq_n_f32(vld1q_f32(&input[i + 4]), 32767.0f));
+
+        // Narrowing saturates anything beyond full scale
+        vst1q_s16(&output[i], vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi)));
+    }
+
+    convertFloatToS16Scalar(&input[i], &output[i], count - i);
+}
+
+static void mixFramesNeon(const float* input, int inputChannels,
+                          float* output, int outputChannels,
+                          const float matrix[8][8], int frames)
+{
+    for (int s = 0; s < frames; s++) {
+        const float* in = &input[s * inputChannels];
+        float* out = &output[s * outputChannels];
+
+        // See mixFramesSse2()
+        float32x4_t lo = vld1q_f32(in);
+        float32x4_t hi = inputChannels > 4 ? vld1q_f32(in + 4) : vdupq_n_f32(0);
+        for (int o = 0; o < outputChannels; o++) {
+            float32x4_t sum = vmlaq_f32(vmulq_f32(lo, vld1q_f32(&matrix[o][0])),
+                                        hi, vld1q_f32(&matrix[o][4]));
+            float32x2_t pair = vadd_f32(vget_low_f32(sum), vget_high_f32(sum));
+            out[o] = vget_lane_f32(vpadd_f32(pair, pair), 0);
+        }
+    }
+}
+
+static void convertTo8BitNeon(Uint8* dst, int dstPitch, const Uint16* src, int srcPitch,
+                              int samples, int height, int shift, int firstRow)
+{
+    // NEON shifts right by shifting left a negative amount
+    const int16x8_t count = vdupq_n_s16((int16_t)-shift);
+
+    for (int y = 0; y < height; y++) {
+        const Uint16* srcRow = (const Uint16*)((const Uint8*)src + (size_t)y * srcPitch);
+        Uint8* dstRow = dst + (size_t)y * dstPitch;
+        const uint16x8_t dither = vreinterpretq_u16_u32(vdupq_n_u32(getDitherPair(firstRow + y, shift)));
+        int x = 0;
+
+        for (; x + 16 <= samples; x += 16) {
+            uint16x8_t lo = vshlq_u16(vqaddq_u16(vld1q_u16(&srcRow[x]), dither), count);
+            uint16x8_t hi = vshlq_u16(vqaddq_u16(vld1q_u16(&srcRow[x + 8]), dither), count);
+
+            // Narrowing saturates at 255
+            vst1q_u8(&dstRow[x], vcombine_u8(vqmovn_u16(lo), vqmovn_u16(hi)));
+        }
+
+        convertTo8BitScalar(&dstRow[x], dstPitch, &srcRow[x], srcPitch,
+                            samples - x, 1, shift, firstRow + y);
+    }
+}
+#endif
+
+static SDL_bool isAlwaysSupported()
+{
+    return SDL_TRUE;
+}
+
+template <typename Fn>
+struct KernelImplementation
+{
+    const char* name;
+    SDL_bool (*isSupported)();
+    Fn function;
+};
+
+// These are ordered fastest first, and the last one is the scalar reference
+static const KernelImplementation<CpuDispatch::CopyPlaneFn> k_CopyPlaneImpls[] = {
+#ifdef HAVE_SSE2_KERNELS
+    { "SSE2", SDL_HasSSE2, copyPlaneSse2 },
+#endif
+    { "scalar", isAlwaysSupported, copyPlaneScalar },
+};
+
+static const KernelImplementation<CpuDispatch::ConvertFloatToS16Fn> k_ConvertFloatToS16Impls[] = {
+#ifdef HAVE_AVX2_KERNELS
+    { "AVX2", SDL_HasAVX2, convertFloatToS16Avx2 },
+#endif
+#ifdef HAVE_SSE2_KERNELS
+    { "SSE2", SDL_HasSSE2, convertFloatToS16Sse2 },
+#endif
+#ifdef HAVE_NEON_KERNELS
+    { "NEON", SDL_HasNEON, convertFloatToS16Neon },
+#endif
+    { "scalar", isAlwaysSupported, convertFloatToS16Scalar },
+};
+
+static const KernelImplementation<CpuDispatch::MixFramesFn> k_MixFramesImpls[] = {
+#ifdef HAVE_SSE2_KERNELS
+    { "SSE2", SDL_HasSSE2, mixFramesSse2 },
+#endif
+#ifdef HAVE_NEON_KERNELS
+    { "NEON", SDL_HasNEON, mixFramesNeon },
+#endif
+    { "scalar", isAlwaysSupported, mixFramesScalar },
+};
+
+static const KernelImplementation<CpuDispatch::ConvertTo8BitFn> k_ConvertTo8BitImpls[] = {
+#ifdef HAVE_AVX2_KERNELS
+    { "AVX2", SDL_HasAVX2, convertTo8BitAvx2 },
+#endif
+#ifdef HAVE_SSE2_KERNELS
+    { "SSE2", SDL_HasSSE2, convertTo8BitSse2 },
+#endif
+#ifdef HAVE_NEON_KERNELS
+    { "NEON", SDL_HasNEON, convertTo8BitNeon },
+#endif
+    { "scalar", isAlwaysSupported, convertTo8BitScalar },
+};
+
+// Deterministic, so a failing self-test fails the same way every time
+static float nextTestValue(Uint32* state, float range)
+{
+    *state = *state * 1664525 + 1013904223;
+    return ((*state >> 8) / (float)(1 << 24) * 2.0f - 1.0f) * range;
+}
+
+static bool testCopyPlane(CpuDispatch::CopyPlaneFn function, CpuDispatch::CopyPlaneFn reference)
+{
+    const int widthBytes = 1000;
+    const int height = 7;
+    const int srcPitch = 1024;
+
+    // Try an aligned destination pitch for the streaming path and
+    // a matching one for the contiguous path
+    const int dstPitches[] = { 1088, srcPitch };
+
+    Uint8 src[srcPitch * height];
+    Uint32 state = 1;
+    for (int i = 0; i < (int)sizeof(src); i++) {
+        src[i] = (Uint8)(nextTestValue(&state, 128.0f) + 128);
+    }
+
+    for (int p = 0; p < (int)SDL_arraysize(dstPitches); p++) {
+        size_t dstSize = (size_t)dstPitches[p] * height;
+        Uint8* storage = (Uint8*)SDL_malloc(dstSize * 2 + 32);
+        if (storage == nullptr) {
+            return false;
+        }
+
+        Uint8* expected = (Uint8*)(((uintptr_t)storage + 15) & ~(uintptr_t)15);
+        Uint8* actual = expected + ((dstSize + 15) & ~(size_t)15);
+        memset(expected, 0xCC, dstSize);
+        memset(actual, 0xCC, dstSize);
+
+        reference(expected, dstPitches[p], src, srcPitch, widthBytes, height);
+        function(actual, dstPitches[p], src, srcPitch, widthBytes, height);
+
+        bool match = memcmp(expected, actual, dstSize) == 0;
+        SDL_free(storage);
+        if (!match) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool testConvertFloatToS16(CpuDispatch::ConvertFloatToS16Fn function, CpuDispatch::ConvertFloatToS16Fn reference)
+{
+    // Include samples beyond full scale to check saturation
+    float input[SELF_TEST_SAMPLES];
+    Uint32 state = 1;
+    for (int i = 0; i < SELF_TEST_SAMPLES; i++) {
+        input[i] = nextTestValue(&state, 1.5f);
+    }
+
+    short expected[SELF_TEST_SAMPLES];
+    short actual[SELF_TEST_SAMPLES];
+    reference(input, expected, SELF_TEST_SAMPLES);
+    function(input, actual, SELF_TEST_SAMPLES);
+
+    for (int i = 0; i < SELF_TEST_SAMPLES; i++) {
+        if (qAbs(expected[i] - actual[i]) > SELF_TEST_S16_TOLERANCE) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool testMixFrames(CpuDispatch::MixFramesFn function, CpuDispatch::MixFramesFn reference)
+{
+    // The kernels read up to a frame past the end of the input
+    float input[SELF_TEST_FRAMES * 8 + 8];
+    Uint32 state = 1;
+    for (int i = 0; i < (int)SDL_arraysize(input); i++) {
+        input[i] = nextTestValue(&state, 1.0f);
+    }
+
+    for (int inputChannels = 1; inputChannels <= 8; inputChannels++) {
+        for (int outputChannels = 1; outputChannels <= 8; outputChannels++) {
+            // Gains past the input channels must be zero, like AudioMixer's
+            float matrix[8][8];
+            SDL_zero(matrix);
+            for (int o = 0; o < outputChannels; o++) {
+                for (int i = 0; i < inputChannels; i++) {
+                    matrix[o][i] = nextTestValue(&state, 1.0f);
+                }
+            }
+
+            float expected[SELF_TEST_FRAMES * 8];
+            float actual[SELF_TEST_FRAMES * 8];
+            reference(input, inputChannels, expected, outputChannels, matrix, SELF_TEST_FRAMES);
+            function(input, inputChannels, actual, outputChannels, matrix, SELF_TEST_FRAMES);
+
+            for (int i = 0; i < SELF_TEST_FRAMES * outputChannels; i++) {
+                if (qAbs(expected[i] - actual[i]) > SELF_TEST_MIX_TOLERANCE) {
+                    return false;
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+static bool testConvertTo8Bit(CpuDispatch::ConvertTo8BitFn function, CpuDispatch::ConvertTo8BitFn reference)
+{
+    // 10-bit samples in the low bits like YUV420P10, and in the high
+    // bits like P010 (where the largest ones saturate)
+    const int shifts[] = { 2, 8 };
+
+    for (int s = 0; s < (int)SDL_arraysize(shifts); s++) {
+        Uint16 src[SELF_TEST_ROWS][SELF_TEST_SAMPLES];
+        Uint32 state = 1;
+        for (int y = 0; y < SELF_TEST_ROWS; y++) {
+            for (int x = 0; x < SELF_TEST_SAMPLES; x++) {
+                int sample = (int)(nextTestValue(&state, 512.0f) + 512);
+                src[y][x] = (Uint16)(SDL_min(sample, 1023) << (shifts[s] - 2));
+            }
+        }
+
+        Uint8 expected[SELF_TEST_ROWS][SELF_TEST_SAMPLES];
+        Uint8 actual[SELF_TEST_ROWS][SELF_TEST_SAMPLES];
+        reference(&expected[0][0], SELF_TEST_SAMPLES, &src[0][0], sizeof(src[0]),
+                  SELF_TEST_SAMPLES, SELF_TEST_ROWS, shifts[s], 1);
+        function(&actual[0][0], SELF_TEST_SAMPLES, &src[0][0], sizeof(src[0]),
+                 SELF_TEST_SAMPLES, SELF_TEST_ROWS, shifts[s], 1);
+
+        if (memcmp(expected, actual, sizeof(expected)) != 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Returns the fastest implementation that the CPU supports. When testing,
+// every supported implementation is checked against the scalar reference
+// and only the ones that match can be chosen.
+template <typename Fn, size_t N>
+static Fn chooseImplementation(const char* kernelName,
+                               const KernelImplementation<Fn> (&impls)[N],
+                               bool (*test)(Fn, Fn),
+                               bool selfTest)
+{
+    Fn reference = impls[N - 1].function;
+    const KernelImplementation<Fn>* chosen = &impls[N - 1];
+
+    for (size_t i = N - 1; i-- > 0;) {
+        if (!impls[i].isSupported()) {
+            continue;
+        }
+
+        if (selfTest && !test(impls[i].function, reference)) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "%s %s kernel doesn't match the scalar reference",
+                         impls[i].name,
+                         kernelName);
+            continue;
+        }
+
+        chosen = &impls[i];
+    }
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Using %s %s kernel",
+                chosen->name,
+                kernelName);
+    return chosen->function;
+}
+
+void CpuDispatch::initialize()
+{
+    bool selfTest = qgetenv("SIMD_SELF_TEST") == "1";
+
+    copyPlane = chooseImplementation("plane copy", k_CopyPlaneImpls, testCopyPlane, selfTest);
+    convertFloatToS16 = chooseImplementation("S16 conversion", k_ConvertFloatToS16Impls, testConvertFloatToS16, selfTest);
+    mixFrames = chooseImplementation("audio mix", k_MixFramesImpls, testMixFrames, selfTest);
+    convertTo8Bit = chooseImplementation("8-bit conversion", k_ConvertTo8BitImpls, testConvertTo8Bit, selfTest);
+
+    if (selfTest) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "SIMD self-test complete");
+    }
+}
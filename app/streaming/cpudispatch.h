@@ -0,0 +1,47 @@
+#pragma once
+
+#include <SDL.h>
+
+// Most of the time in an SIMD kernel is spent in a handful of loops, which
+// we build for every instruction set that we might find and pick between
+// at runtime. initialize() checks what the CPU supports through SDL and
+// points each kernel at the fastest implementation for it, so the hot
+// paths only pay for an indirect call.
+//
+// Every SIMD implementation has a scalar reference next to it. When
+// SIMD_SELF_TEST=1 is set, initialize() checks each implementation that
+// the CPU can run against its reference and falls back to the reference
+// for any that don't match.
+class CpuDispatch
+{
+public:
+    // Copies a plane of widthBytes wide rows between buffers with different
+    // pitches. The destination may be write-combined texture memory.
+    typedef void (*CopyPlaneFn)(Uint8* dst, int dstPitch, const Uint8* src, int srcPitch,
+                                int widthBytes, int height);
+
+    // Converts float samples in [-1, 1] to S16, saturating anything beyond
+    typedef void (*ConvertFloatToS16Fn)(const float* input, short* output, int count);
+
+    // Multiplies each frame of interleaved input by a gain matrix whose
+    // rows are padded to 8 channels. Input is read up to 8 floats past
+    // its last frame.
+    typedef void (*MixFramesFn)(const float* input, int inputChannels,
+                                float* output, int outputChannels,
+                                const float matrix[8][8], int frames);
+
+    // Reduces a plane of 16-bit samples to 8 bits by shifting each one
+    // right by shift bits, with an ordered dither of the 2 lowest bits that
+    // a 10-bit sample loses. firstRow places the plane in the dither
+    // pattern, so stripes of one plane can be converted separately.
+    typedef void (*ConvertTo8BitFn)(Uint8* dst, int dstPitch, const Uint16* src, int srcPitch,
+                                    int samples, int height, int shift, int firstRow);
+
+    // Must be called once at startup, before any kernel is used
+    static void initialize();
+
+    static CopyPlaneFn copyPlane;
+    static ConvertFloatToS16Fn convertFloatToS16;
+    static MixFramesFn mixFrames;
+    static ConvertTo8BitFn convertTo8Bit;
+};
@@ -0,0 +1,160 @@
+#include "decodeoverloaddetector.h"
+#include "session.h"
+
+#include <QtGlobal>
+
+// Average decode time that makes a window overloaded, relative to the
+// frame interval. The decoder needs some headroom for the frames that
+// take longer than average.
+#define OVERLOAD_DECODE_TIME_RATIO 0.9f
+
+// Decoded frames (out of the received ones) below which a window is
+// overloaded, since the decoder is falling behind the stream
+#define OVERLOAD_DECODED_FRAMES_RATIO 0.9f
+
+// Overloaded windows in a row before acting
+#define OVERLOAD_WINDOWS 3
+
+// Windows ignored after starting and after a change while the stream
+// restarts and the decoder warms up
+#define OVERLOAD_SETTLE_WINDOWS 5
+
+// Stream heights stepped down through, highest first. The resolution
+// isn't lowered below the last one.
+static const int k_DownshiftHeights[] = { 1440, 1080, 720 };
+
+bool DecodeOverloadDetector::s_Active;
+bool DecodeOverloadDetector::s_Downshift;
+bool DecodeOverloadDetector::s_ShowWarning;
+bool DecodeOverloadDetector::s_Suggested;
+int DecodeOverloadDetector::s_Width;
+int DecodeOverloadDetector::s_Height;
+int DecodeOverloadDetector::s_Fps;
+int DecodeOverloadDetector::s_OverloadedWindows;
+int DecodeOverloadDetector::s_SettleWindows;
+int DecodeOverloadDetector::s_Changes;
+
+void DecodeOverloadDetector::start(int width, int height, int fps, bool downshift, bool showWarning)
+{
+    SDL_assert(!s_Active);
+
+    s_Width = width;
+    s_Height = height;
+    s_Fps = fps;
+    s_Downshift = downshift;
+    s_ShowWarning = showWarning;
+    s_Suggested = false;
+    s_OverloadedWindows = 0;
+    s_SettleWindows = OVERLOAD_SETTLE_WINDOWS;
+    s_Changes = 0;
+
+    s_Active = true;
+}
+
+void DecodeOverloadDetector::stop()
+{
+    if (!s_Active) {
+        return;
+    }
+
+    s_Active = false;
+
+    if (s_Changes > 0) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Decode overload: %d resolution changes, ended at %dx%d",
+                    s_Changes, s_Width, s_Height);
+    }
+}
+
+void DecodeOverloadDetector::downshift(const char* reason)
+{
+    int height = 0;
+    for (int i = 0; i < (int)SDL_arraysize(k_DownshiftHeights); i++) {
+        if (k_DownshiftHeights[i] < s_Height) {
+            height = k_DownshiftHeights[i];
+            break;
+        }
+    }
+
+    // Nothing left to step down to
+    if (height == 0) {
+        suggest(reason);
+        return;
+    }
+
+    // Keep the aspect ratio, rounded to an even width for the encoder
+    int width = (int)((qint64)s_Width * height / s_Height + 1) & ~1;
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Decode overload: %dx%d -> %dx%d (%s)",
+                s_Width, s_Height, width, height, reason);
+
+    s_Width = width;
+    s_Height = height;
+    s_SettleWindows = OVERLOAD_SETTLE_WINDOWS;
+    s_Changes++;
+
+    Session::get()->requestStreamRestart(width, height, 0);
+}
+
+void DecodeOverloadDetector::suggest(const char* reason)
+{
+    if (s_Suggested) {
+        return;
+    }
+
+    s_Suggested = true;
+
+    SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                "Decode overload: this PC can't decode %dx%d at %d FPS in real time (%s)",
+                s_Width, s_Height, s_Fps, reason);
+
+    if (s_ShowWarning) {
+        Overlay::OverlayManager& overlayManager = Session::get()->getOverlayManager();
+
+        overlayManager.updateOverlayText(Overlay::OverlayStatusUpdate, "Your PC can't decode the stream fast enough\nLower your resolution or frame rate");
+        overlayManager.setOverlayState(Overlay::OverlayStatusUpdate, true);
+    }
+}
+
+void DecodeOverloadDetector::reportVideoStats(const VIDEO_STATS& stats)
+{
+    // Windows where the stream window was hidden have no decoded frames
+    if (!s_Active || stats.decodedFrames == 0 || stats.receivedFrames == 0) {
+        return;
+    }
+
+    if (s_SettleWindows > 0) {
+        s_SettleWindows--;
+        return;
+    }
+
+    float decodeTimeUs = (float)stats.totalDecodeTime / stats.decodedFrames;
+    float frameIntervalUs = 1000000.0f / s_Fps;
+
+    const char* reason = nullptr;
+    if (decodeTimeUs > frameIntervalUs * OVERLOAD_DECODE_TIME_RATIO) {
+        reason = "decode time above the frame interval";
+    }
+    else if (stats.decodedFps < stats.receivedFps * OVERLOAD_DECODED_FRAMES_RATIO) {
+        reason = "decoder falling behind";
+    }
+
+    if (reason == nullptr) {
+        s_OverloadedWindows = 0;
+        return;
+    }
+
+    if (++s_OverloadedWindows < OVERLOAD_WINDOWS) {
+        return;
+    }
+
+    s_OverloadedWindows = 0;
+
+    if (s_Downshift) {
+        downshift(reason);
+    }
+    else {
+        suggest(reason);
+    }
+}
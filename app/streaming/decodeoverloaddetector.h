@@ -0,0 +1,53 @@
+#pragma once
+
+#include "video/decoder.h"
+
+#include <SDL.h>
+
+// Notices when the client can't decode the stream in real time, like 4K
+// HEVC on an older integrated GPU. A window is overloaded when the average
+// decode time takes up most of the frame interval or the decoder finishes
+// noticeably fewer frames than arrive. The Pacer hides this by dropping
+// frames, so without it the stream would just carry on stuttering.
+//
+// Three overloaded windows in a row step the resolution down one level,
+// keeping the aspect ratio, by restarting the stream within the session.
+// The windows after a change are ignored while the new stream settles, and
+// the resolution is never raised again during the session, so a decoder
+// that's borderline at some resolution can't make the stream bounce
+// between two of them. With the autoResolution preference off, or once
+// the lowest level is reached, the user is told to lower the resolution
+// or frame rate instead.
+class DecodeOverloadDetector
+{
+public:
+    // downshift picks whether the resolution is lowered or only suggested.
+    // The suggestion is shown on the status overlay if showWarning is set.
+    static void start(int width, int height, int fps, bool downshift, bool showWarning);
+
+    static void stop();
+
+    static bool isActive()
+    {
+        return s_Active;
+    }
+
+    // Called by the decoder thread once per stats window
+    static void reportVideoStats(const VIDEO_STATS& stats);
+
+private:
+    static void downshift(const char* reason);
+
+    static void suggest(const char* reason);
+
+    static bool s_Active;
+    static bool s_Downshift;
+    static bool s_ShowWarning;
+    static bool s_Suggested;
+    static int s_Width;
+    static int s_Height;
+    static int s_Fps;
+    static int s_OverloadedWindows;
+    static int s_SettleWindows;
+    static int s_Changes;
+};
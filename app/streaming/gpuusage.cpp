@@ -0,0 +1,640 @@
+#include "gpuusage.h"
+#include "streamutils.h"
+
+#include <QtGlobal>
+#include <QDir>
+#include <QFile>
+#include <QHash>
+#include <QSet>
+#include <QStringList>
+
+#if defined(Q_OS_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#include <pdh.h>
+#elif defined(Q_OS_DARWIN)
+#include <CoreFoundation/CoreFoundation.h>
+#include <IOKit/IOKitLib.h>
+#endif
+
+#define GPU_SAMPLE_INTERVAL_MS 1000
+
+SDL_Thread* GpuUsage::s_Thread;
+SDL_sem* GpuUsage::s_StopSemaphore;
+SDL_atomic_t GpuUsage::s_DecodePercent;
+SDL_atomic_t GpuUsage::s_RenderPercent;
+SDL_atomic_t GpuUsage::s_VideoMemoryMb;
+
+class IGpuSampler
+{
+public:
+    virtual ~IGpuSampler() {}
+
+    // Returns false if the counters can't be read on this system
+    virtual bool initialize() = 0;
+
+    // Sets either engine to -1 if it couldn't be measured this time
+    virtual void sample(int* decodePercent, int* renderPercent) = 0;
+
+    // Dedicated video memory in use as of the last sample, or -1 if
+    // it isn't known
+    virtual int getVideoMemoryMb() { return -1; }
+};
+
+#if defined(Q_OS_WIN32)
+
+// The counters Task Manager's GPU graphs are built from. There's an
+// instance for each engine of each adapter in use by each process.
+class PdhGpuSampler : public IGpuSampler
+{
+public:
+    PdhGpuSampler() :
+        m_Query(nullptr),
+        m_DecodeCounter(nullptr),
+        m_RenderCounter(nullptr),
+        m_MemoryCounter(nullptr)
+    {
+    }
+
+    virtual ~PdhGpuSampler()
+    {
+        if (m_Query != nullptr) {
+            PdhCloseQuery(m_Query);
+        }
+    }
+
+    virtual bool initialize()
+    {
+        PDH_STATUS status = PdhOpenQueryW(nullptr, 0, &m_Query);
+        if (status != ERROR_SUCCESS) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "PdhOpenQueryW() failed: %x",
+                        (unsigned int)status);
+            m_Query = nullptr;
+            return false;
+        }
+
+        if (PdhAddEnglishCounterW(m_Query, L"\\GPU Engine(*engtype_VideoDecode)\\Utilization Percentage", 0, &m_DecodeCounter) != ERROR_SUCCESS) {
+            m_DecodeCounter = nullptr;
+        }
+        if (PdhAddEnglishCounterW(m_Query, L"\\GPU Engine(*engtype_3D)\\Utilization Percentage", 0, &m_RenderCounter) != ERROR_SUCCESS) {
+            m_RenderCounter = nullptr;
+        }
+
+        // Only our own process' memory is of interest here
+        wchar_t memoryCounterPath[128];
+        swprintf(memoryCounterPath, ARRAYSIZE(memoryCounterPath),
+                 L"\\GPU Process Memory(pid_%lu_*)\\Dedicated Usage",
+                 GetCurrentProcessId());
+        if (PdhAddEnglishCounterW(m_Query, memoryCounterPath, 0, &m_MemoryCounter) != ERROR_SUCCESS) {
+            m_MemoryCounter = nullptr;
+        }
+
+        if (m_DecodeCounter == nullptr && m_RenderCounter == nullptr) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "GPU engine performance counters are unavailable");
+            return false;
+        }
+
+        // Utilization is a rate, so the first collection only sets a baseline
+        PdhCollectQueryData(m_Query);
+        return true;
+    }
+
+    virtual void sample(int* decodePercent, int* renderPercent)
+    {
+        if (PdhCollectQueryData(m_Query) != ERROR_SUCCESS) {
+            *decodePercent = *renderPercent = -1;
+            return;
+        }
+
+        *decodePercent = getBusiestEngine(m_DecodeCounter);
+        *renderPercent = getBusiestEngine(m_RenderCounter);
+    }
+
+    virtual int getVideoMemoryMb()
+    {
+        if (m_MemoryCounter == nullptr) {
+            return -1;
+        }
+
+        // There's an instance for each adapter we've used
+        QByteArray buffer;
+        DWORD itemCount;
+        PDH_FMT_COUNTERVALUE_ITEM_W* items = getCounterArray(m_MemoryCounter, PDH_FMT_LARGE, buffer, &itemCount);
+        if (items == nullptr) {
+            return -1;
+        }
+
+        LONGLONG totalBytes = 0;
+        for (DWORD i = 0; i < itemCount; i++) {
+            if (items[i].FmtValue.CStatus == PDH_CSTATUS_VALID_DATA ||
+                    items[i].FmtValue.CStatus == PDH_CSTATUS_NEW_DATA) {
+                totalBytes += items[i].FmtValue.largeValue;
+            }
+        }
+
+        return (int)(totalBytes / (1024 * 1024));
+    }
+
+private:
+    // Returns nullptr if there are no instances or they can't be read
+    static PDH_FMT_COUNTERVALUE_ITEM_W* getCounterArray(PDH_HCOUNTER counter, DWORD format,
+                                                         QByteArray& buffer, DWORD* itemCount)
+    {
+        DWORD bufferSize = 0;
+        *itemCount = 0;
+        if (PdhGetFormattedCounterArrayW(counter, format, &bufferSize, itemCount, nullptr) != PDH_MORE_DATA) {
+            return nullptr;
+        }
+
+        buffer.resize(bufferSize);
+        PDH_FMT_COUNTERVALUE_ITEM_W* items = (PDH_FMT_COUNTERVALUE_ITEM_W*)buffer.data();
+        if (PdhGetFormattedCounterArrayW(counter, format, &bufferSize, itemCount, items) != ERROR_SUCCESS) {
+            return nullptr;
+        }
+
+        return items;
+    }
+
+    // Adds up the processes using each engine and returns the busiest one
+    int getBusiestEngine(PDH_HCOUNTER counter)
+    {
+        if (counter == nullptr) {
+            return -1;
+        }
+
+        // No instances means no process has used this engine since
+        // the last sample
+        QByteArray buffer;
+        DWORD itemCount;
+        PDH_FMT_COUNTERVALUE_ITEM_W* items = getCounterArray(counter, PDH_FMT_DOUBLE, buffer, &itemCount);
+        if (items == nullptr) {
+            return itemCount == 0 ? 0 : -1;
+        }
+
+        // Instances are named pid_<pid>_luid_<luid>_phys_<n>_eng_<n>_engtype_<type>,
+        // so everything after the PID identifies the engine
+        QHash<QString, double> engines;
+        for (DWORD i = 0; i < itemCount; i++) {
+            if (items[i].FmtValue.CStatus != PDH_CSTATUS_VALID_DATA &&
+                    items[i].FmtValue.CStatus != PDH_CSTATUS_NEW_DATA) {
+                continue;
+            }
+
+            QString name = QString::fromWCharArray(items[i].szName);
+            engines[name.mid(name.indexOf("luid_"))] += items[i].FmtValue.doubleValue;
+        }
+
+        double busiest = 0;
+        for (double utilization : engines) {
+            busiest = qMax(busiest, utilization);
+        }
+
+        return qMin(100, (int)(busiest + 0.5));
+    }
+
+    PDH_HQUERY m_Query;
+    PDH_HCOUNTER m_DecodeCounter;
+    PDH_HCOUNTER m_RenderCounter;
+    PDH_HCOUNTER m_MemoryCounter;
+};
+
+#elif defined(Q_OS_DARWIN)
+
+// IOReport has per-engine residencies, but it's private API
+class IOAcceleratorGpuSampler : public IGpuSampler
+{
+public:
+    virtual bool initialize()
+    {
+        int decodePercent, renderPercent;
+        sample(&decodePercent, &renderPercent);
+        if (renderPercent < 0) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "IOAccelerator performance statistics are unavailable");
+            return false;
+        }
+
+        return true;
+    }
+
+    virtual void sample(int* decodePercent, int* renderPercent)
+    {
+        *decodePercent = *renderPercent = -1;
+
+        io_iterator_t iterator;
+        if (IOServiceGetMatchingServices(MACH_PORT_NULL, IOServiceMatching("IOAccelerator"), &iterator) != KERN_SUCCESS) {
+            return;
+        }
+
+        io_registry_entry_t service;
+        while ((service = IOIteratorNext(iterator)) != 0) {
+            CFTypeRef statistics = IORegistryEntryCreateCFProperty(service, CFSTR("PerformanceStatistics"), kCFAllocatorDefault, 0);
+            if (statistics != nullptr) {
+                if (CFGetTypeID(statistics) == CFDictionaryGetTypeID()) {
+                    CFTypeRef utilization = CFDictionaryGetValue((CFDictionaryRef)statistics, CFSTR("Device Utilization %"));
+                    int percent;
+                    if (utilization != nullptr && CFGetTypeID(utilization) == CFNumberGetTypeID() &&
+                            CFNumberGetValue((CFNumberRef)utilization, kCFNumberIntType, &percent)) {
+                        *renderPercent = qMax(*renderPercent, qBound(0, percent, 100));
+                    }
+                }
+
+                CFRelease(statistics);
+            }
+
+            IOObjectRelease(service);
+        }
+
+        IOObjectRelease(iterator);
+    }
+};
+
+#elif defined(Q_OS_LINUX)
+
+// The DRM drivers that keep per-client engine times (i915, amdgpu, msm,
+// panfrost and others) list them in the fdinfo of each open device file.
+// They're totals of nanoseconds busy, divided across an engine class's
+// instances here so a class can't exceed 100%.
+class FdinfoGpuSampler : public IGpuSampler
+{
+public:
+    FdinfoGpuSampler() :
+        m_LastDecodeNs(0),
+        m_LastRenderNs(0),
+        m_LastSampleTimeUs(0),
+        m_VideoMemoryMb(-1)
+    {
+    }
+
+    virtual bool initialize()
+    {
+        // The renderer and decoder own their DRM clients before we start
+        if (!readEngineTimes(&m_LastDecodeNs, &m_LastRenderNs, &m_VideoMemoryMb)) {
+            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                        "No DRM client engine times in fdinfo");
+            return false;
+        }
+
+        m_LastSampleTimeUs = StreamUtils::getTimeUs();
+        return true;
+    }
+
+    virtual void sample(int* decodePercent, int* renderPercent)
+    {
+        Uint64 decodeNs, renderNs;
+        if (!readEngineTimes(&decodeNs, &renderNs, &m_VideoMemoryMb)) {
+            *decodePercent = *renderPercent = -1;
+            return;
+        }
+
+        Uint64 now = StreamUtils::getTimeUs();
+        Uint64 elapsedNs = (now - m_LastSampleTimeUs) * 1000;
+
+        // Totals drop when a client closes, which spoils this sample
+        *decodePercent = getPercent(decodeNs, m_LastDecodeNs, elapsedNs);
+        *renderPercent = getPercent(renderNs, m_LastRenderNs, elapsedNs);
+
+        m_LastDecodeNs = decodeNs;
+        m_LastRenderNs = renderNs;
+        m_LastSampleTimeUs = now;
+    }
+
+    virtual int getVideoMemoryMb()
+    {
+        return m_VideoMemoryMb;
+    }
+
+private:
+    static int getPercent(Uint64 busyNs, Uint64 lastBusyNs, Uint64 elapsedNs)
+    {
+        if (busyNs < lastBusyNs || elapsedNs == 0) {
+            return -1;
+        }
+
+        return (int)qMin((Uint64)100, (busyNs - lastBusyNs) * 100 / elapsedNs);
+    }
+
+    // Sizes are in bytes, or have a KiB or MiB suffix
+    static Uint64 parseMemorySize(const QByteArray& value)
+    {
+        if (value.endsWith(" KiB")) {
+            return value.left(value.length() - 4).toULongLong() * 1024;
+        }
+        else if (value.endsWith(" MiB")) {
+            return value.left(value.length() - 4).toULongLong() * 1024 * 1024;
+        }
+        else {
+            return value.toULongLong();
+        }
+    }
+
+    static bool readEngineTimes(Uint64* decodeNs, Uint64* renderNs, int* videoMemoryMb)
+    {
+        *decodeNs = *renderNs = 0;
+        Uint64 videoMemoryBytes = 0;
+        bool haveVideoMemory = false;
+
+        // Duplicated file descriptors share a client, so each is counted once
+        QSet<QByteArray> clients;
+
+        QDir fdinfoDir("/proc/self/fdinfo");
+        for (const QString& fd : fdinfoDir.entryList(QDir::Files)) {
+            QFile file(fdinfoDir.filePath(fd));
+            if (!file.open(QFile::ReadOnly)) {
+                continue;
+            }
+
+            QByteArray clientId;
+            QHash<QByteArray, Uint64> engineNs;
+            QHash<QByteArray, Uint64> engineCapacity;
+            Uint64 clientVideoMemoryBytes = 0;
+            bool clientHasVideoMemory = false;
+            for (const QByteArray& line : file.readAll().split('\n')) {
+                int separator = line.indexOf(':');
+                if (separator < 0 || !line.startsWith("drm-")) {
+                    continue;
+                }
+
+                QByteArray key = line.left(separator);
+                QByteArray value = line.mid(separator + 1).trimmed();
+                if (key == "drm-client-id") {
+                    clientId = value;
+                }
+                else if (key.startsWith("drm-engine-capacity-")) {
+                    engineCapacity[key.mid(20)] = value.toULongLong();
+                }
+                else if (key.startsWith("drm-engine-") && value.endsWith(" ns")) {
+                    engineNs[key.mid(11)] = value.left(value.length() - 3).toULongLong();
+                }
+                else if (key == "drm-memory-vram" || key == "drm-resident-vram" ||
+                         key == "drm-resident-local0") {
+                    // amdgpu, the common memory region names, and
+                    // discrete i915/xe device memory respectively
+                    clientVideoMemoryBytes += parseMemorySize(value);
+                    clientHasVideoMemory = true;
+                }
+            }
+
+            if (clientId.isEmpty() || engineNs.isEmpty() || clients.contains(clientId)) {
+                continue;
+            }
+            clients.insert(clientId);
+
+            if (clientHasVideoMemory) {
+                videoMemoryBytes += clientVideoMemoryBytes;
+                haveVideoMemory = true;
+            }
+
+            for (auto it = engineNs.constBegin(); it != engineNs.constEnd(); ++it) {
+                Uint64 ns = it.value() / qMax((Uint64)1, engineCapacity.value(it.key(), 1));
+
+                // i915 calls them video and render, amdgpu calls them dec and gfx
+                if (it.key() == "video" || it.key() == "dec") {
+                    *decodeNs += ns;
+                }
+                else if (it.key() == "render" || it.key() == "gfx") {
+                    *renderNs += ns;
+                }
+            }
+        }
+
+        // Integrated GPUs have no memory of their own to report
+        *videoMemoryMb = haveVideoMemory ? (int)(videoMemoryBytes / (1024 * 1024)) : -1;
+        return !clients.isEmpty();
+    }
+
+    Uint64 m_LastDecodeNs;
+    Uint64 m_LastRenderNs;
+    Uint64 m_LastSampleTimeUs;
+    int m_VideoMemoryMb;
+};
+
+// From nvml.h
+typedef struct nvmlDevice_st* nvmlDevice_t;
+typedef struct {
+    unsigned int gpu;
+    unsigned int memory;
+} nvmlUtilization_t;
+typedef struct {
+    unsigned long long total;
+    unsigned long long free;
+    unsigned long long used;
+} nvmlMemory_t;
+#define NVML_SUCCESS 0
+typedef int (*PFNNVMLINIT)(void);
+typedef int (*PFNNVMLSHUTDOWN)(void);
+typedef int (*PFNNVMLDEVICEGETHANDLEBYINDEX)(unsigned int, nvmlDevice_t*);
+typedef int (*PFNNVMLDEVICEGETUTILIZATIONRATES)(nvmlDevice_t, nvmlUtilization_t*);
+typedef int (*PFNNVMLDEVICEGETDECODERUTILIZATION)(nvmlDevice_t, unsigned int*, unsigned int*);
+typedef int (*PFNNVMLDEVICEGETMEMORYINFO)(nvmlDevice_t, nvmlMemory_t*);
+
+// NVML reports the whole of the first GPU, averaged over the driver's
+// own sampling period
+class NvmlGpuSampler : public IGpuSampler
+{
+public:
+    NvmlGpuSampler() :
+        m_Library(nullptr),
+        m_Initialized(false),
+        m_Device(nullptr),
+        m_NvmlDeviceGetMemoryInfo(nullptr)
+    {
+    }
+
+    virtual ~NvmlGpuSampler()
+    {
+        if (m_Initialized) {
+            m_NvmlShutdown();
+        }
+        if (m_Library != nullptr) {
+            SDL_UnloadObject(m_Library);
+        }
+    }
+
+    virtual bool initialize()
+    {
+        m_Library = SDL_LoadObject("libnvidia-ml.so.1");
+        if (m_Library == nullptr) {
+            return false;
+        }
+
+        PFNNVMLINIT nvmlInit = (PFNNVMLINIT)SDL_LoadFunction(m_Library, "nvmlInit_v2");
+        m_NvmlShutdown = (PFNNVMLSHUTDOWN)SDL_LoadFunction(m_Library, "nvmlShutdown");
+        PFNNVMLDEVICEGETHANDLEBYINDEX nvmlDeviceGetHandleByIndex =
+                (PFNNVMLDEVICEGETHANDLEBYINDEX)SDL_LoadFunction(m_Library, "nvmlDeviceGetHandleByIndex_v2");
+        m_NvmlDeviceGetUtilizationRates =
+                (PFNNVMLDEVICEGETUTILIZATIONRATES)SDL_LoadFunction(m_Library, "nvmlDeviceGetUtilizationRates");
+        m_NvmlDeviceGetDecoderUtilization =
+                (PFNNVMLDEVICEGETDECODERUTILIZATION)SDL_LoadFunction(m_Library, "nvmlDeviceGetDecoderUtilization");
+        m_NvmlDeviceGetMemoryInfo =
+                (PFNNVMLDEVICEGETMEMORYINFO)SDL_LoadFunction(m_Library, "nvmlDeviceGetMemoryInfo");
+        if (nvmlInit == nullptr || m_NvmlShutdown == nullptr || nvmlDeviceGetHandleByIndex == nullptr ||
+                m_NvmlDeviceGetUtilizationRates == nullptr || m_NvmlDeviceGetDecoderUtilization == nullptr) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "NVML is missing required functions");
+            return false;
+        }
+
+        int err = nvmlInit();
+        if (err != NVML_SUCCESS) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "nvmlInit_v2() failed: %d",
+                        err);
+            return false;
+        }
+        m_Initialized = true;
+
+        err = nvmlDeviceGetHandleByIndex(0, &m_Device);
+        if (err != NVML_SUCCESS) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "nvmlDeviceGetHandleByIndex_v2() failed: %d",
+                        err);
+            return false;
+        }
+
+        return true;
+    }
+
+    virtual void sample(int* decodePercent, int* renderPercent)
+    {
+        unsigned int decoderUtilization, samplingPeriodUs;
+        if (m_NvmlDeviceGetDecoderUtilization(m_Device, &decoderUtilization, &samplingPeriodUs) == NVML_SUCCESS) {
+            *decodePercent = qMin(100, (int)decoderUtilization);
+        }
+        else {
+            *decodePercent = -1;
+        }
+
+        nvmlUtilization_t utilization;
+        if (m_NvmlDeviceGetUtilizationRates(m_Device, &utilization) == NVML_SUCCESS) {
+            *renderPercent = qMin(100, (int)utilization.gpu);
+        }
+        else {
+            *renderPercent = -1;
+        }
+    }
+
+    // This covers every process using the GPU, since NVML only breaks
+    // memory down per process for compute clients
+    virtual int getVideoMemoryMb()
+    {
+        nvmlMemory_t memory;
+        if (m_NvmlDeviceGetMemoryInfo == nullptr ||
+                m_NvmlDeviceGetMemoryInfo(m_Device, &memory) != NVML_SUCCESS) {
+            return -1;
+        }
+
+        return (int)(memory.used / (1024 * 1024));
+    }
+
+private:
+    void* m_Library;
+    bool m_Initialized;
+    nvmlDevice_t m_Device;
+    PFNNVMLSHUTDOWN m_NvmlShutdown;
+    PFNNVMLDEVICEGETUTILIZATIONRATES m_NvmlDeviceGetUtilizationRates;
+    PFNNVMLDEVICEGETDECODERUTILIZATION m_NvmlDeviceGetDecoderUtilization;
+    PFNNVMLDEVICEGETMEMORYINFO m_NvmlDeviceGetMemoryInfo;
+};
+
+#endif
+
+static IGpuSampler* createSampler()
+{
+    QList<IGpuSampler*> samplers;
+
+#if defined(Q_OS_WIN32)
+    samplers.append(new PdhGpuSampler());
+#elif defined(Q_OS_DARWIN)
+    samplers.append(new IOAcceleratorGpuSampler());
+#elif defined(Q_OS_LINUX)
+    samplers.append(new FdinfoGpuSampler());
+    samplers.append(new NvmlGpuSampler());
+#endif
+
+    IGpuSampler* chosen = nullptr;
+    for (IGpuSampler* sampler : samplers) {
+        if (chosen == nullptr && sampler->initialize()) {
+            chosen = sampler;
+        }
+        else {
+            delete sampler;
+        }
+    }
+
+    return chosen;
+}
+
+void GpuUsage::start()
+{
+    SDL_assert(s_Thread == nullptr);
+
+    SDL_AtomicSet(&s_DecodePercent, -1);
+    SDL_AtomicSet(&s_RenderPercent, -1);
+    SDL_AtomicSet(&s_VideoMemoryMb, -1);
+
+    s_StopSemaphore = SDL_CreateSemaphore(0);
+    if (s_StopSemaphore == nullptr) {
+        return;
+    }
+
+    s_Thread = SDL_CreateThread(samplerThreadProc, "GpuUsage", nullptr);
+    if (s_Thread == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unable to create GPU usage thread: %s",
+                     SDL_GetError());
+        SDL_DestroySemaphore(s_StopSemaphore);
+        s_StopSemaphore = nullptr;
+    }
+}
+
+void GpuUsage::stop()
+{
+    if (s_Thread == nullptr) {
+        return;
+    }
+
+    SDL_SemPost(s_StopSemaphore);
+    SDL_WaitThread(s_Thread, nullptr);
+    s_Thread = nullptr;
+
+    SDL_DestroySemaphore(s_StopSemaphore);
+    s_StopSemaphore = nullptr;
+}
+
+bool GpuUsage::getUtilization(int* decodePercent, int* renderPercent)
+{
+    *decodePercent = SDL_AtomicGet(&s_DecodePercent);
+    *renderPercent = SDL_AtomicGet(&s_RenderPercent);
+    return *decodePercent >= 0 || *renderPercent >= 0;
+}
+
+int GpuUsage::getVideoMemoryMb()
+{
+    return SDL_AtomicGet(&s_VideoMemoryMb);
+}
+
+int GpuUsage::samplerThreadProc(void*)
+{
+    // Loading the platform's counters can take a while, so it's done here
+    // rather than in the session's startup path
+    IGpuSampler* sampler = createSampler();
+    if (sampler == nullptr) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "GPU engine utilization is unavailable");
+        return 0;
+    }
+
+    while (SDL_SemWaitTimeout(s_StopSemaphore, GPU_SAMPLE_INTERVAL_MS) == SDL_MUTEX_TIMEDOUT) {
+        int decodePercent, renderPercent;
+        sampler->sample(&decodePercent, &renderPercent);
+        SDL_AtomicSet(&s_DecodePercent, decodePercent);
+        SDL_AtomicSet(&s_RenderPercent, renderPercent);
+        SDL_AtomicSet(&s_VideoMemoryMb, sampler->getVideoMemoryMb());
+    }
+
+    delete sampler;
+    return 0;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <SDL.h>
+
+// Samples how busy the GPU's video decode and 3D engines are, so a stream
+// that stutters can be told apart from one where the decoder or renderer
+// is simply saturated. A thread reads the platform's counters once a
+// second and the latest values are kept in atomics for the overlay and
+// the metrics exporter.
+//
+// Windows reads the "GPU Engine" performance counters, which cover every
+// process. Linux reads the DRM fdinfo engine times of our own GPU clients,
+// falling back to NVML for NVIDIA's driver, which doesn't provide them.
+// macOS only reports the whole GPU through the IOAccelerator statistics,
+// which is shown as the 3D engine.
+class GpuUsage
+{
+public:
+    static void start();
+
+    static void stop();
+
+    // Returns false if neither engine can be measured here. An engine that
+    // can't be measured is reported as -1.
+    static bool getUtilization(int* decodePercent, int* renderPercent);
+
+    // Dedicated video memory in use by this process (or the whole GPU
+    // with NVML), or -1 if it can't be measured here
+    static int getVideoMemoryMb();
+
+private:
+    static int samplerThreadProc(void* context);
+
+    static SDL_Thread* s_Thread;
+    static SDL_sem* s_StopSemaphore;
+    static SDL_atomic_t s_DecodePercent;
+    static SDL_atomic_t s_RenderPercent;
+    static SDL_atomic_t s_VideoMemoryMb;
+};
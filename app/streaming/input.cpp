@@ -1,6 +1,12 @@
 #include <Limelight.h>
 #include <SDL.h>
 #include "streaming/session.h"
+#include "streaming/streamutils.h"
+#include "streaming/threadplacement.h"
+#ifdef HAVE_AVFORMAT
+#include "streaming/recorder.h"
+#endif
+#include "backend/nvhttp.h"
 #include "settings/mappingmanager.h"
 #include "path.h"
 
@@ -18,7 +24,24 @@
 #define VK_NUMPAD0 0x60
 #endif
 
-#define MOUSE_POLLING_INTERVAL 5
+// Minimum time between mouse motion packets for hosts that build up input
+// lag when motion is sent as fast as it arrives
+#define MOUSE_MOVE_COALESCE_INTERVAL_US 5000
+
+// Gamepad motion within this long of the last update is sent together
+// with whatever follows it
+#define GAMEPAD_COALESCE_INTERVAL_US 500
+
+// Stick motion that stays within the same 1/8192 of the range is noise
+// and isn't worth a packet
+#define GAMEPAD_STICK_QUANTIZE_SHIFT 3
+
+// How often the gamepad thread reads the gamepads, which is
+// the highest polling rate of common wired gamepads
+#define GAMEPAD_POLL_INTERVAL_MS 1
+
+// How often it checks for gamepads when there aren't any open
+#define GAMEPAD_IDLE_POLL_INTERVAL_MS 100
 
 // How long the mouse button will be pressed for a tap to click gesture
 #define TAP_BUTTON_RELEASE_DELAY 100
@@ -49,16 +72,136 @@ const int SdlInputHandler::k_ButtonMap[] = {
     UP_FLAG, DOWN_FLAG, LEFT_FLAG, RIGHT_FLAG
 };
 
-SdlInputHandler::SdlInputHandler(StreamingPreferences& prefs, NvComputer*, int streamWidth, int streamHeight)
+const SdlInputHandler::KeyComboDefinition SdlInputHandler::k_KeyCombos[] = {
+    { SDLK_q, SDL_SCANCODE_Q, KeyComboQuit },
+    { SDLK_z, SDL_SCANCODE_Z, KeyComboUngrab },
+    { SDLK_x, SDL_SCANCODE_X, KeyComboToggleFullScreen },
+    { SDLK_s, SDL_SCANCODE_S, KeyComboToggleStatsOverlay },
+    { SDLK_r, SDL_SCANCODE_R, KeyComboToggleRecording },
+    { SDLK_b, SDL_SCANCODE_B, KeyComboSaveReplay },
+    { SDLK_p, SDL_SCANCODE_P, KeyComboScreenshot },
+    { SDLK_g, SDL_SCANCODE_G, KeyComboToggleFrameGraph },
+};
+
+SdlInputHandler::KeyMap::KeyMap()
+{
+    SDL_zero(virtualKeys);
+
+    // SDL defines SDL_SCANCODE_0 > SDL_SCANCODE_9 (and the same for the
+    // keypad), so the 0 keys are handled separately
+    for (int i = 0; i < 9; i++) {
+        virtualKeys[SDL_SCANCODE_1 + i] = VK_0 + 1 + i;
+        virtualKeys[SDL_SCANCODE_KP_1 + i] = VK_NUMPAD0 + 1 + i;
+    }
+    virtualKeys[SDL_SCANCODE_0] = VK_0;
+    virtualKeys[SDL_SCANCODE_KP_0] = VK_NUMPAD0;
+
+    for (int i = 0; i <= SDL_SCANCODE_Z - SDL_SCANCODE_A; i++) {
+        virtualKeys[SDL_SCANCODE_A + i] = VK_A + i;
+    }
+
+    for (int i = 0; i < 12; i++) {
+        virtualKeys[SDL_SCANCODE_F1 + i] = VK_F1 + i;
+        virtualKeys[SDL_SCANCODE_F13 + i] = VK_F13 + i;
+    }
+
+    virtualKeys[SDL_SCANCODE_BACKSPACE] = 0x08;
+    virtualKeys[SDL_SCANCODE_TAB] = 0x09;
+    virtualKeys[SDL_SCANCODE_CLEAR] = 0x0C;
+    virtualKeys[SDL_SCANCODE_KP_ENTER] = 0x0D; // FIXME: Is this correct?
+    virtualKeys[SDL_SCANCODE_RETURN] = 0x0D;
+    virtualKeys[SDL_SCANCODE_PAUSE] = 0x13;
+    virtualKeys[SDL_SCANCODE_CAPSLOCK] = 0x14;
+    virtualKeys[SDL_SCANCODE_ESCAPE] = 0x1B;
+    virtualKeys[SDL_SCANCODE_SPACE] = 0x20;
+    virtualKeys[SDL_SCANCODE_PAGEUP] = 0x21;
+    virtualKeys[SDL_SCANCODE_PAGEDOWN] = 0x22;
+    virtualKeys[SDL_SCANCODE_END] = 0x23;
+    virtualKeys[SDL_SCANCODE_HOME] = 0x24;
+    virtualKeys[SDL_SCANCODE_LEFT] = 0x25;
+    virtualKeys[SDL_SCANCODE_UP] = 0x26;
+    virtualKeys[SDL_SCANCODE_RIGHT] = 0x27;
+    virtualKeys[SDL_SCANCODE_DOWN] = 0x28;
+    virtualKeys[SDL_SCANCODE_SELECT] = 0x29;
+    virtualKeys[SDL_SCANCODE_EXECUTE] = 0x2B;
+    virtualKeys[SDL_SCANCODE_PRINTSCREEN] = 0x2C;
+    virtualKeys[SDL_SCANCODE_INSERT] = 0x2D;
+    virtualKeys[SDL_SCANCODE_DELETE] = 0x2E;
+    virtualKeys[SDL_SCANCODE_HELP] = 0x2F;
+    virtualKeys[SDL_SCANCODE_KP_MULTIPLY] = 0x6A;
+    virtualKeys[SDL_SCANCODE_KP_PLUS] = 0x6B;
+    virtualKeys[SDL_SCANCODE_KP_COMMA] = 0x6C;
+    virtualKeys[SDL_SCANCODE_KP_MINUS] = 0x6D;
+    virtualKeys[SDL_SCANCODE_KP_PERIOD] = 0x6E;
+    virtualKeys[SDL_SCANCODE_KP_DIVIDE] = 0x6F;
+    virtualKeys[SDL_SCANCODE_NUMLOCKCLEAR] = 0x90;
+    virtualKeys[SDL_SCANCODE_SCROLLLOCK] = 0x91;
+    virtualKeys[SDL_SCANCODE_LSHIFT] = 0xA0;
+    virtualKeys[SDL_SCANCODE_RSHIFT] = 0xA1;
+    virtualKeys[SDL_SCANCODE_LCTRL] = 0xA2;
+    virtualKeys[SDL_SCANCODE_RCTRL] = 0xA3;
+    virtualKeys[SDL_SCANCODE_LALT] = 0xA4;
+    virtualKeys[SDL_SCANCODE_RALT] = 0xA5;
+    virtualKeys[SDL_SCANCODE_AC_BACK] = 0xA6;
+    virtualKeys[SDL_SCANCODE_AC_FORWARD] = 0xA7;
+    virtualKeys[SDL_SCANCODE_AC_REFRESH] = 0xA8;
+    virtualKeys[SDL_SCANCODE_AC_STOP] = 0xA9;
+    virtualKeys[SDL_SCANCODE_AC_SEARCH] = 0xAA;
+    virtualKeys[SDL_SCANCODE_AC_BOOKMARKS] = 0xAB;
+    virtualKeys[SDL_SCANCODE_AC_HOME] = 0xAC;
+    virtualKeys[SDL_SCANCODE_SEMICOLON] = 0xBA;
+    virtualKeys[SDL_SCANCODE_EQUALS] = 0xBB;
+    virtualKeys[SDL_SCANCODE_COMMA] = 0xBC;
+    virtualKeys[SDL_SCANCODE_MINUS] = 0xBD;
+    virtualKeys[SDL_SCANCODE_PERIOD] = 0xBE;
+    virtualKeys[SDL_SCANCODE_SLASH] = 0xBF;
+    virtualKeys[SDL_SCANCODE_GRAVE] = 0xC0;
+    virtualKeys[SDL_SCANCODE_LEFTBRACKET] = 0xDB;
+    virtualKeys[SDL_SCANCODE_BACKSLASH] = 0xDC;
+    virtualKeys[SDL_SCANCODE_RIGHTBRACKET] = 0xDD;
+    virtualKeys[SDL_SCANCODE_APOSTROPHE] = 0xDE;
+    virtualKeys[SDL_SCANCODE_NONUSBACKSLASH] = 0xE2;
+}
+
+// Built once when the program loads, so translating a key is a single lookup
+const SdlInputHandler::KeyMap SdlInputHandler::s_KeyMap;
+
+short SdlInputHandler::getVirtualKey(SDL_Scancode scancode)
+{
+    if ((int)scancode < 0 || scancode >= SDL_NUM_SCANCODES) {
+        return 0;
+    }
+
+    return s_KeyMap.virtualKeys[scancode];
+}
+
+SdlInputHandler::SdlInputHandler(StreamingPreferences& prefs, NvComputer* computer, int streamWidth, int streamHeight)
     : m_MultiController(prefs.multiController),
       m_GamepadMouse(prefs.gamepadMouse),
-      m_MouseMoveTimer(0),
+      m_MouseMoveThread(nullptr),
+      m_MouseMoveSemaphore(nullptr),
+      m_MouseMoveIntervalUs(MOUSE_MOVE_COALESCE_INTERVAL_US),
+      m_HapticsThread(nullptr),
+      m_HapticsSemaphore(nullptr),
+      m_HapticsLock(nullptr),
+      m_GamepadPollThread(nullptr),
+      m_GamepadLock(nullptr),
       m_FakeCaptureActive(false),
       m_LeftButtonReleaseTimer(0),
       m_RightButtonReleaseTimer(0),
       m_DragTimer(0),
       m_DragButton(0),
       m_NumFingersDown(0),
+      m_AbsoluteTouchMode(prefs.absoluteTouchMode),
+      m_LocalCursor(prefs.localCursor),
+      m_Window(nullptr),
+      m_AbsoluteCursorHomed(false),
+      m_AbsoluteCursorX(0),
+      m_AbsoluteCursorY(0),
+      m_PrimaryFingerId(0),
+      m_SecondaryFingerId(0),
+      m_PrimaryFingerDown(false),
+      m_SecondaryFingerDown(false),
       m_StreamWidth(streamWidth),
       m_StreamHeight(streamHeight)
 {
@@ -122,24 +265,110 @@ SdlInputHandler::SdlInputHandler(StreamingPreferences& prefs, NvComputer*, int s
     // Initialize the gamepad mask with currently attached gamepads to avoid
     // causing gamepads to unexpectedly disappear and reappear on the host
     // during stream startup as we detect currently attached gamepads one at a time.
-    m_GamepadMask = getAttachedGamepadMask();
+    if (m_MultiController) {
+        m_GamepadMask = (1 << countAttachedGamepads()) - 1;
+    }
+    else {
+        // Player 1 is always present in non-MC mode
+        m_GamepadMask = 0x1;
+    }
 
     SDL_zero(m_GamepadState);
     SDL_zero(m_TouchDownEvent);
     SDL_zero(m_CumulativeDelta);
 
+    m_AnalogResponse.initialize(prefs.gamepadDeadzone, prefs.gamepadAntiDeadzone,
+                                prefs.gamepadResponseCurve);
+
     SDL_AtomicSet(&m_MouseDeltaX, 0);
     SDL_AtomicSet(&m_MouseDeltaY, 0);
+    SDL_AtomicSet(&m_MouseMovePending, 0);
+    SDL_AtomicSet(&m_MouseMoveStopping, 0);
+
+    // GFE 3.14 and 3.15 keep up with motion at the mouse's full polling
+    // rate. Every other version needs it coalesced.
+    if (computer != nullptr) {
+        QVector<int> gfeVersion = NvHTTP::parseQuad(computer->gfeVersion);
+        if (gfeVersion.size() >= 2 && gfeVersion[0] == 3 &&
+                (gfeVersion[1] == 14 || gfeVersion[1] == 15)) {
+            m_MouseMoveIntervalUs = 0;
+        }
+    }
 
-    m_MouseMoveTimer = SDL_AddTimer(MOUSE_POLLING_INTERVAL, SdlInputHandler::mouseMoveTimerCallback, this);
+    m_MouseMoveSemaphore = SDL_CreateSemaphore(0);
+    if (m_MouseMoveSemaphore != nullptr) {
+        m_MouseMoveThread = SDL_CreateThread(SdlInputHandler::mouseMoveThreadProc, "MouseMove", this);
+    }
+    if (m_MouseMoveThread == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unable to create mouse motion thread: %s",
+                     SDL_GetError());
+    }
+
+    SDL_AtomicSet(&m_HapticsStopping, 0);
+    SDL_AtomicSet(&m_RumblePendingMask, 0);
+    for (int i = 0; i < MAX_GAMEPADS; i++) {
+        SDL_AtomicSet(&m_RumbleState[i], 0);
+    }
+
+    m_HapticsLock = SDL_CreateMutex();
+    m_HapticsSemaphore = SDL_CreateSemaphore(0);
+    if (m_HapticsLock != nullptr && m_HapticsSemaphore != nullptr) {
+        m_HapticsThread = SDL_CreateThread(SdlInputHandler::hapticsThreadProc, "Haptics", this);
+    }
+    if (m_HapticsThread == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unable to create haptics thread: %s",
+                     SDL_GetError());
+    }
+
+    SDL_AtomicSet(&m_GamepadPollStopping, 0);
+    m_GamepadLock = SDL_CreateMutex();
+
+    // The Steam Link's CPU can't spare a thread waking every millisecond.
+    // Set GAMEPAD_DISABLE_POLL_THREAD=1 to only read gamepads through events.
+#ifndef STEAM_LINK
+    if (m_GamepadLock != nullptr && qgetenv("GAMEPAD_DISABLE_POLL_THREAD") != "1") {
+        m_GamepadPollThread = SDL_CreateThread(SdlInputHandler::gamepadPollThreadProc, "GamepadPoll", this);
+        if (m_GamepadPollThread == nullptr) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "Unable to create gamepad polling thread: %s",
+                         SDL_GetError());
+        }
+    }
+#endif
 }
 
 SdlInputHandler::~SdlInputHandler()
 {
+    // Stop reading the gamepads before they're closed
+    if (m_GamepadPollThread != nullptr) {
+        SDL_AtomicSet(&m_GamepadPollStopping, 1);
+        SDL_WaitThread(m_GamepadPollThread, nullptr);
+        m_GamepadPollThread = nullptr;
+    }
+    if (m_GamepadLock != nullptr) {
+        SDL_DestroyMutex(m_GamepadLock);
+    }
+
+    // Stop applying rumble before the haptic devices are closed
+    if (m_HapticsThread != nullptr) {
+        SDL_AtomicSet(&m_HapticsStopping, 1);
+        SDL_SemPost(m_HapticsSemaphore);
+        SDL_WaitThread(m_HapticsThread, nullptr);
+        m_HapticsThread = nullptr;
+    }
+    if (m_HapticsSemaphore != nullptr) {
+        SDL_DestroySemaphore(m_HapticsSemaphore);
+    }
+    if (m_HapticsLock != nullptr) {
+        SDL_DestroyMutex(m_HapticsLock);
+    }
+
     for (int i = 0; i < MAX_GAMEPADS; i++) {
         if (m_GamepadState[i].mouseEmulationTimer != 0) {
             Session::get()->notifyMouseEmulationMode(false);
-            SDL_RemoveTimer(m_GamepadState[i].mouseEmulationTimer);
+            m_TimerQueue.removeTimer(m_GamepadState[i].mouseEmulationTimer);
         }
         if (m_GamepadState[i].haptic != nullptr) {
             SDL_HapticClose(m_GamepadState[i].haptic);
@@ -149,10 +378,18 @@ SdlInputHandler::~SdlInputHandler()
         }
     }
 
-    SDL_RemoveTimer(m_MouseMoveTimer);
-    SDL_RemoveTimer(m_LeftButtonReleaseTimer);
-    SDL_RemoveTimer(m_RightButtonReleaseTimer);
-    SDL_RemoveTimer(m_DragTimer);
+    if (m_MouseMoveThread != nullptr) {
+        SDL_AtomicSet(&m_MouseMoveStopping, 1);
+        SDL_SemPost(m_MouseMoveSemaphore);
+        SDL_WaitThread(m_MouseMoveThread, nullptr);
+    }
+    if (m_MouseMoveSemaphore != nullptr) {
+        SDL_DestroySemaphore(m_MouseMoveSemaphore);
+    }
+
+    m_TimerQueue.removeTimer(m_LeftButtonReleaseTimer);
+    m_TimerQueue.removeTimer(m_RightButtonReleaseTimer);
+    m_TimerQueue.removeTimer(m_DragTimer);
 
     SDL_QuitSubSystem(SDL_INIT_HAPTIC);
     SDL_assert(!SDL_WasInit(SDL_INIT_HAPTIC));
@@ -180,11 +417,21 @@ void SdlInputHandler::handleKeyEvent(SDL_KeyboardEvent* event)
     short keyCode;
     char modifiers;
 
+    // Set modifier flags
+    modifiers = 0;
+    if (event->keysym.mod & KMOD_CTRL) {
+        modifiers |= MODIFIER_CTRL;
+    }
+    if (event->keysym.mod & KMOD_ALT) {
+        modifiers |= MODIFIER_ALT;
+    }
+    if (event->keysym.mod & KMOD_SHIFT) {
+        modifiers |= MODIFIER_SHIFT;
+    }
+
     // Check for our special key combos
-    if ((event->state == SDL_PRESSED) &&
-            (event->keysym.mod & KMOD_CTRL) &&
-            (event->keysym.mod & KMOD_ALT) &&
-            (event->keysym.mod & KMOD_SHIFT)) {
+    if (event->state == SDL_PRESSED &&
+            modifiers == (MODIFIER_CTRL | MODIFIER_ALT | MODIFIER_SHIFT)) {
         // First we test the SDLK combos for matches,
         // that way we ensure that latin keyboard users
         // can match to the key they see on their keyboards.
@@ -195,103 +442,17 @@ void SdlInputHandler::handleKeyEvent(SDL_KeyboardEvent* event)
         // any scancode tests to avoid issues in cases
         // where the SDLK for one shortcut collides with
         // the scancode of another.
-
-        // Check for quit combo (Ctrl+Alt+Shift+Q)
-        if (event->keysym.sym == SDLK_q) {
-            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
-                        "Detected quit key combo (SDLK)");
-
-            // Push a quit event to the main loop
-            SDL_Event event;
-            event.type = SDL_QUIT;
-            event.quit.timestamp = SDL_GetTicks();
-            SDL_PushEvent(&event);
-            return;
-        }
-        // Check for the unbind combo (Ctrl+Alt+Shift+Z)
-        else if (event->keysym.sym == SDLK_z) {
-            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
-                        "Detected mouse capture toggle combo (SDLK)");
-
-            // Stop handling future input
-            setCaptureActive(!isCaptureActive());
-
-            // Force raise all keys to ensure they aren't stuck,
-            // since we won't get their key up events.
-            raiseAllKeys();
-            return;
-        }
-        else if (event->keysym.sym == SDLK_x) {
-            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
-                        "Detected full-screen toggle combo (SDLK)");
-            Session::s_ActiveSession->toggleFullscreen();
-
-            // Force raise all keys just be safe across this full-screen/windowed
-            // transition just in case key events get lost.
-            raiseAllKeys();
-            return;
-        }
-        else if (event->keysym.sym == SDLK_s) {
-            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
-                        "Detected stats toggle combo (SDLK)");
-
-            // Toggle the stats overlay
-            Session::get()->getOverlayManager().setOverlayState(Overlay::OverlayDebug,
-                                                                !Session::get()->getOverlayManager().isOverlayEnabled(Overlay::OverlayDebug));
-
-            // Force raise all keys just be safe across this full-screen/windowed
-            // transition just in case key events get lost.
-            raiseAllKeys();
-            return;
-        }
-        // Check for quit combo (Ctrl+Alt+Shift+Q)
-        else if (event->keysym.scancode == SDL_SCANCODE_Q) {
-            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
-                        "Detected quit key combo (scancode)");
-
-            // Push a quit event to the main loop
-            SDL_Event event;
-            event.type = SDL_QUIT;
-            event.quit.timestamp = SDL_GetTicks();
-            SDL_PushEvent(&event);
-            return;
-        }
-        // Check for the unbind combo (Ctrl+Alt+Shift+Z)
-        else if (event->keysym.scancode == SDL_SCANCODE_Z) {
-            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
-                        "Detected mouse capture toggle combo (scancode)");
-
-            // Stop handling future input
-            setCaptureActive(!isCaptureActive());
-
-            // Force raise all keys to ensure they aren't stuck,
-            // since we won't get their key up events.
-            raiseAllKeys();
-            return;
-        }
-        // Check for the full-screen combo (Ctrl+Alt+Shift+X)
-        else if (event->keysym.scancode == SDL_SCANCODE_X) {
-            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
-                        "Detected full-screen toggle combo (scancode)");
-            Session::s_ActiveSession->toggleFullscreen();
-
-            // Force raise all keys just be safe across this full-screen/windowed
-            // transition just in case key events get lost.
-            raiseAllKeys();
-            return;
+        for (int i = 0; i < KeyComboMax; i++) {
+            if (event->keysym.sym == k_KeyCombos[i].keyCode) {
+                performKeyCombo(k_KeyCombos[i].combo, "SDLK");
+                return;
+            }
         }
-        else if (event->keysym.scancode == SDL_SCANCODE_S) {
-            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
-                        "Detected stats toggle combo (scancode)");
-
-            // Toggle the stats overlay
-            Session::get()->getOverlayManager().setOverlayState(Overlay::OverlayDebug,
-                                                                !Session::get()->getOverlayManager().isOverlayEnabled(Overlay::OverlayDebug));
-
-            // Force raise all keys just be safe across this full-screen/windowed
-            // transition just in case key events get lost.
-            raiseAllKeys();
-            return;
+        for (int i = 0; i < KeyComboMax; i++) {
+            if (event->keysym.scancode == k_KeyCombos[i].scanCode) {
+                performKeyCombo(k_KeyCombos[i].combo, "scancode");
+                return;
+            }
         }
     }
 
@@ -300,220 +461,15 @@ void SdlInputHandler::handleKeyEvent(SDL_KeyboardEvent* event)
         return;
     }
 
-    // Set modifier flags
-    modifiers = 0;
-    if (event->keysym.mod & KMOD_CTRL) {
-        modifiers |= MODIFIER_CTRL;
-    }
-    if (event->keysym.mod & KMOD_ALT) {
-        modifiers |= MODIFIER_ALT;
-    }
-    if (event->keysym.mod & KMOD_SHIFT) {
-        modifiers |= MODIFIER_SHIFT;
-    }
-
     // Set keycode. We explicitly use scancode here because GFE will try to correct
     // for AZERTY layouts on the host but it depends on receiving VK_ values matching
     // a QWERTY layout to work.
-    if (event->keysym.scancode >= SDL_SCANCODE_1 && event->keysym.scancode <= SDL_SCANCODE_9) {
-        // SDL defines SDL_SCANCODE_0 > SDL_SCANCODE_9, so we need to handle that manually
-        keyCode = (event->keysym.scancode - SDL_SCANCODE_1) + VK_0 + 1;
-    }
-    else if (event->keysym.scancode >= SDL_SCANCODE_A && event->keysym.scancode <= SDL_SCANCODE_Z) {
-        keyCode = (event->keysym.scancode - SDL_SCANCODE_A) + VK_A;
-    }
-    else if (event->keysym.scancode >= SDL_SCANCODE_F1 && event->keysym.scancode <= SDL_SCANCODE_F12) {
-        keyCode = (event->keysym.scancode - SDL_SCANCODE_F1) + VK_F1;
-    }
-    else if (event->keysym.scancode >= SDL_SCANCODE_F13 && event->keysym.scancode <= SDL_SCANCODE_F24) {
-        keyCode = (event->keysym.scancode - SDL_SCANCODE_F13) + VK_F13;
-    }
-    else if (event->keysym.scancode >= SDL_SCANCODE_KP_1 && event->keysym.scancode <= SDL_SCANCODE_KP_9) {
-        // SDL defines SDL_SCANCODE_KP_0 > SDL_SCANCODE_KP_9, so we need to handle that manually
-        keyCode = (event->keysym.scancode - SDL_SCANCODE_KP_1) + VK_NUMPAD0 + 1;
-    }
-    else {
-        switch (event->keysym.scancode) {
-            case SDL_SCANCODE_BACKSPACE:
-                keyCode = 0x08;
-                break;
-            case SDL_SCANCODE_TAB:
-                keyCode = 0x09;
-                break;
-            case SDL_SCANCODE_CLEAR:
-                keyCode = 0x0C;
-                break;
-            case SDL_SCANCODE_KP_ENTER: // FIXME: Is this correct?
-            case SDL_SCANCODE_RETURN:
-                keyCode = 0x0D;
-                break;
-            case SDL_SCANCODE_PAUSE:
-                keyCode = 0x13;
-                break;
-            case SDL_SCANCODE_CAPSLOCK:
-                keyCode = 0x14;
-                break;
-            case SDL_SCANCODE_ESCAPE:
-                keyCode = 0x1B;
-                break;
-            case SDL_SCANCODE_SPACE:
-                keyCode = 0x20;
-                break;
-            case SDL_SCANCODE_PAGEUP:
-                keyCode = 0x21;
-                break;
-            case SDL_SCANCODE_PAGEDOWN:
-                keyCode = 0x22;
-                break;
-            case SDL_SCANCODE_END:
-                keyCode = 0x23;
-                break;
-            case SDL_SCANCODE_HOME:
-                keyCode = 0x24;
-                break;
-            case SDL_SCANCODE_LEFT:
-                keyCode = 0x25;
-                break;
-            case SDL_SCANCODE_UP:
-                keyCode = 0x26;
-                break;
-            case SDL_SCANCODE_RIGHT:
-                keyCode = 0x27;
-                break;
-            case SDL_SCANCODE_DOWN:
-                keyCode = 0x28;
-                break;
-            case SDL_SCANCODE_SELECT:
-                keyCode = 0x29;
-                break;
-            case SDL_SCANCODE_EXECUTE:
-                keyCode = 0x2B;
-                break;
-            case SDL_SCANCODE_PRINTSCREEN:
-                keyCode = 0x2C;
-                break;
-            case SDL_SCANCODE_INSERT:
-                keyCode = 0x2D;
-                break;
-            case SDL_SCANCODE_DELETE:
-                keyCode = 0x2E;
-                break;
-            case SDL_SCANCODE_HELP:
-                keyCode = 0x2F;
-                break;
-            case SDL_SCANCODE_KP_0:
-                // See comment above about why we only handle SDL_SCANCODE_KP_0 here
-                keyCode = VK_NUMPAD0;
-                break;
-            case SDL_SCANCODE_0:
-                // See comment above about why we only handle SDL_SCANCODE_0 here
-                keyCode = VK_0;
-                break;
-            case SDL_SCANCODE_KP_MULTIPLY:
-                keyCode = 0x6A;
-                break;
-            case SDL_SCANCODE_KP_PLUS:
-                keyCode = 0x6B;
-                break;
-            case SDL_SCANCODE_KP_COMMA:
-                keyCode = 0x6C;
-                break;
-            case SDL_SCANCODE_KP_MINUS:
-                keyCode = 0x6D;
-                break;
-            case SDL_SCANCODE_KP_PERIOD:
-                keyCode = 0x6E;
-                break;
-            case SDL_SCANCODE_KP_DIVIDE:
-                keyCode = 0x6F;
-                break;
-            case SDL_SCANCODE_NUMLOCKCLEAR:
-                keyCode = 0x90;
-                break;
-            case SDL_SCANCODE_SCROLLLOCK:
-                keyCode = 0x91;
-                break;
-            case SDL_SCANCODE_LSHIFT:
-                keyCode = 0xA0;
-                break;
-            case SDL_SCANCODE_RSHIFT:
-                keyCode = 0xA1;
-                break;
-            case SDL_SCANCODE_LCTRL:
-                keyCode = 0xA2;
-                break;
-            case SDL_SCANCODE_RCTRL:
-                keyCode = 0xA3;
-                break;
-            case SDL_SCANCODE_LALT:
-                keyCode = 0xA4;
-                break;
-            case SDL_SCANCODE_RALT:
-                keyCode = 0xA5;
-                break;
-            case SDL_SCANCODE_AC_BACK:
-                keyCode = 0xA6;
-                break;
-            case SDL_SCANCODE_AC_FORWARD:
-                keyCode = 0xA7;
-                break;
-            case SDL_SCANCODE_AC_REFRESH:
-                keyCode = 0xA8;
-                break;
-            case SDL_SCANCODE_AC_STOP:
-                keyCode = 0xA9;
-                break;
-            case SDL_SCANCODE_AC_SEARCH:
-                keyCode = 0xAA;
-                break;
-            case SDL_SCANCODE_AC_BOOKMARKS:
-                keyCode = 0xAB;
-                break;
-            case SDL_SCANCODE_AC_HOME:
-                keyCode = 0xAC;
-                break;
-            case SDL_SCANCODE_SEMICOLON:
-                keyCode = 0xBA;
-                break;
-            case SDL_SCANCODE_EQUALS:
-                keyCode = 0xBB;
-                break;
-            case SDL_SCANCODE_COMMA:
-                keyCode = 0xBC;
-                break;
-            case SDL_SCANCODE_MINUS:
-                keyCode = 0xBD;
-                break;
-            case SDL_SCANCODE_PERIOD:
-                keyCode = 0xBE;
-                break;
-            case SDL_SCANCODE_SLASH:
-                keyCode = 0xBF;
-                break;
-            case SDL_SCANCODE_GRAVE:
-                keyCode = 0xC0;
-                break;
-            case SDL_SCANCODE_LEFTBRACKET:
-                keyCode = 0xDB;
-                break;
-            case SDL_SCANCODE_BACKSLASH:
-                keyCode = 0xDC;
-                break;
-            case SDL_SCANCODE_RIGHTBRACKET:
-                keyCode = 0xDD;
-                break;
-            case SDL_SCANCODE_APOSTROPHE:
-                keyCode = 0xDE;
-                break;
-            case SDL_SCANCODE_NONUSBACKSLASH:
-                keyCode = 0xE2;
-                break;
-            default:
-                SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
-                            "Unhandled button event: %d",
-                             event->keysym.scancode);
-                return;
-        }
+    keyCode = getVirtualKey(event->keysym.scancode);
+    if (keyCode == 0) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Unhandled button event: %d",
+                     event->keysym.scancode);
+        return;
     }
 
     // Track the key state so we always know which keys are down
@@ -530,6 +486,115 @@ void SdlInputHandler::handleKeyEvent(SDL_KeyboardEvent* event)
                         modifiers);
 }
 
+void SdlInputHandler::performKeyCombo(KeyCombo combo, const char* source)
+{
+    switch (combo) {
+    case KeyComboQuit:
+    {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Detected quit key combo (%s)",
+                    source);
+
+        // Push a quit event to the main loop
+        SDL_Event event;
+        event.type = SDL_QUIT;
+        event.quit.timestamp = SDL_GetTicks();
+        SDL_PushEvent(&event);
+        break;
+    }
+
+    case KeyComboUngrab:
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Detected mouse capture toggle combo (%s)",
+                    source);
+
+        // Stop handling future input
+        setCaptureActive(!isCaptureActive());
+
+        // Force raise all keys to ensure they aren't stuck,
+        // since we won't get their key up events.
+        raiseAllKeys();
+        break;
+
+    case KeyComboToggleFullScreen:
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Detected full-screen toggle combo (%s)",
+                    source);
+        Session::s_ActiveSession->toggleFullscreen();
+
+        // Force raise all keys just be safe across this full-screen/windowed
+        // transition just in case key events get lost.
+        raiseAllKeys();
+        break;
+
+    case KeyComboToggleStatsOverlay:
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Detected stats toggle combo (%s)",
+                    source);
+
+        // Toggle the stats overlay
+        Session::get()->getOverlayManager().setOverlayState(Overlay::OverlayDebug,
+                                                            !Session::get()->getOverlayManager().isOverlayEnabled(Overlay::OverlayDebug));
+
+        // Force raise all keys just be safe across this full-screen/windowed
+        // transition just in case key events get lost.
+        raiseAllKeys();
+        break;
+
+    case KeyComboToggleRecording:
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Detected recording toggle combo (%s)",
+                    source);
+#ifdef HAVE_AVFORMAT
+        if (Session::get()->m_Recorder != nullptr) {
+            Session::get()->m_Recorder->toggleRecording();
+            break;
+        }
+#endif
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Recording is not available");
+        break;
+
+    case KeyComboSaveReplay:
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Detected save replay combo (%s)",
+                    source);
+#ifdef HAVE_AVFORMAT
+        if (Session::get()->m_Recorder != nullptr) {
+            Session::get()->m_Recorder->saveReplay();
+            break;
+        }
+#endif
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Instant replay is not available");
+        break;
+
+    case KeyComboScreenshot:
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Detected screenshot combo (%s)",
+                    source);
+        if (Session::get()->m_VideoDecoder == nullptr ||
+                !Session::get()->m_VideoDecoder->requestScreenshot()) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "Screenshots are not available with this decoder");
+        }
+        break;
+
+    case KeyComboToggleFrameGraph:
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Detected frame graph toggle combo (%s)",
+                    source);
+
+        // Only the D3D11, EGL and SDL renderers draw the graph
+        Session::get()->getOverlayManager().setOverlayState(Overlay::OverlayFrameGraph,
+                                                            !Session::get()->getOverlayManager().isOverlayEnabled(Overlay::OverlayFrameGraph));
+        break;
+
+    default:
+        break;
+    }
+}
+
 void SdlInputHandler::handleMouseButtonEvent(SDL_MouseButtonEvent* event)
 {
     int button;
@@ -595,10 +660,49 @@ void SdlInputHandler::handleMouseMotionEvent(SDL_MouseMotionEvent* event)
         return;
     }
 
-    // Batch until the next mouse polling window or we'll get awful
-    // input lag everything except GFE 3.14 and 3.15.
-    SDL_AtomicAdd(&m_MouseDeltaX, event->xrel);
-    SDL_AtomicAdd(&m_MouseDeltaY, event->yrel);
+    if (m_LocalCursor) {
+        // Only the latest position matters, so skip ahead to the last
+        // motion event in the queue
+        SDL_Event nextEvent;
+        int x = event->x;
+        int y = event->y;
+        while (SDL_PeepEvents(&nextEvent, 1, SDL_GETEVENT, SDL_MOUSEMOTION, SDL_MOUSEMOTION) > 0) {
+            if (nextEvent.motion.which != SDL_TOUCH_MOUSEID) {
+                x = nextEvent.motion.x;
+                y = nextEvent.motion.y;
+            }
+        }
+
+        // The OS draws our cursor without waiting on the stream, and the
+        // host's cursor follows it to the same spot in the video
+        int windowWidth, windowHeight;
+        if (m_Window != nullptr) {
+            SDL_GetWindowSize(m_Window, &windowWidth, &windowHeight);
+            if (windowWidth > 0 && windowHeight > 0) {
+                moveAbsoluteCursor((float)x / windowWidth, (float)y / windowHeight);
+            }
+        }
+        return;
+    }
+
+    // In relative mode, SDL reports motion straight from the device's raw input
+    queueMouseMotion(event->xrel, event->yrel);
+}
+
+void SdlInputHandler::queueMouseMotion(int deltaX, int deltaY)
+{
+    if (m_MouseMoveThread == nullptr) {
+        LiSendMouseMoveEvent((short)deltaX, (short)deltaY);
+        return;
+    }
+
+    // Motion is accumulated here until the sender thread picks it up,
+    // which wakes only once for however many events arrive in the meantime.
+    SDL_AtomicAdd(&m_MouseDeltaX, deltaX);
+    SDL_AtomicAdd(&m_MouseDeltaY, deltaY);
+    if (SDL_AtomicCAS(&m_MouseMovePending, 0, 1)) {
+        SDL_SemPost(m_MouseMoveSemaphore);
+    }
 }
 
 void SdlInputHandler::handleMouseWheelEvent(SDL_MouseWheelEvent* event)
@@ -612,26 +716,32 @@ void SdlInputHandler::handleMouseWheelEvent(SDL_MouseWheelEvent* event)
         return;
     }
 
-    if (event->y != 0) {
-        LiSendScrollEvent((signed char)event->y);
+    // Fast wheels and trackpads queue up several events between polls.
+    // They're added up and sent as one scroll event.
+    int scrollY = event->y;
+    SDL_Event nextEvent;
+    while (SDL_PeepEvents(&nextEvent, 1, SDL_GETEVENT, SDL_MOUSEWHEEL, SDL_MOUSEWHEEL) > 0) {
+        if (nextEvent.wheel.which != SDL_TOUCH_MOUSEID) {
+            scrollY += nextEvent.wheel.y;
+        }
+    }
+
+    if (scrollY != 0) {
+        LiSendScrollEvent((signed char)qBound(-128, scrollY, 127));
     }
 }
 
 GamepadState*
 SdlInputHandler::findStateForGamepad(SDL_JoystickID id)
 {
-    int i;
-
-    for (i = 0; i < MAX_GAMEPADS; i++) {
-        if (m_GamepadState[i].jsId == id) {
-            SDL_assert(!m_MultiController || m_GamepadState[i].index == i);
-            return &m_GamepadState[i];
-        }
+    auto it = m_GamepadSlots.constFind(id);
+    if (it == m_GamepadSlots.constEnd()) {
+        // This happens for gamepads beyond MAX_GAMEPADS
+        return nullptr;
     }
 
-    // This should only happen with > 4 gamepads
-    SDL_assert(SDL_NumJoysticks() > 4);
-    return nullptr;
+    SDL_assert(!m_MultiController || m_GamepadState[*it].index == *it);
+    return &m_GamepadState[*it];
 }
 
 void SdlInputHandler::sendGamepadState(GamepadState* state)
@@ -646,6 +756,134 @@ void SdlInputHandler::sendGamepadState(GamepadState* state)
                                state->lsY,
                                state->rsX,
                                state->rsY);
+
+    state->sentButtons = state->buttons;
+    state->sentLt = state->lt;
+    state->sentRt = state->rt;
+    state->sentLsX = state->lsX;
+    state->sentLsY = state->lsY;
+    state->sentRsX = state->rsX;
+    state->sentRsY = state->rsY;
+    state->sentGamepadMask = m_GamepadMask;
+    state->lastSendTimeUs = StreamUtils::getTimeUs();
+    state->sendPending = false;
+}
+
+void SdlInputHandler::queueGamepadState(GamepadState* state)
+{
+#define STICK_CHANGED(x) ((state->x >> GAMEPAD_STICK_QUANTIZE_SHIFT) != (state->sent##x >> GAMEPAD_STICK_QUANTIZE_SHIFT))
+    if (state->buttons == state->sentButtons &&
+            state->lt == state->sentLt &&
+            state->rt == state->sentRt &&
+            m_GamepadMask == state->sentGamepadMask &&
+            !STICK_CHANGED(LsX) && !STICK_CHANGED(LsY) &&
+            !STICK_CHANGED(RsX) && !STICK_CHANGED(RsY)) {
+        state->sendPending = false;
+        return;
+    }
+#undef STICK_CHANGED
+
+    // Motion after the gamepad was idle goes out right away. Motion that
+    // follows close behind waits for flushPendingGamepadStates().
+    if (StreamUtils::getTimeUs() - state->lastSendTimeUs >= GAMEPAD_COALESCE_INTERVAL_US) {
+        sendGamepadState(state);
+    }
+    else {
+        state->sendPending = true;
+    }
+}
+
+bool SdlInputHandler::flushPendingGamepadStates()
+{
+    bool stillPending = false;
+    Uint64 now = StreamUtils::getTimeUs();
+
+    SDL_LockMutex(m_GamepadLock);
+
+    for (int i = 0; i < MAX_GAMEPADS; i++) {
+        GamepadState* state = &m_GamepadState[i];
+        if (!state->sendPending) {
+            continue;
+        }
+
+        if (now - state->lastSendTimeUs >= GAMEPAD_COALESCE_INTERVAL_US) {
+            sendGamepadState(state);
+        }
+        else {
+            stillPending = true;
+        }
+    }
+
+    SDL_UnlockMutex(m_GamepadLock);
+
+    return stillPending;
+}
+
+void SdlInputHandler::pollGamepadState(GamepadState* state)
+{
+    SDL_GameController* controller = state->controller;
+
+    short buttons = 0;
+    for (int i = 0; i < (int)SDL_arraysize(k_ButtonMap); i++) {
+        if (SDL_GameControllerGetButton(controller, (SDL_GameControllerButton)i)) {
+            buttons |= k_ButtonMap[i];
+        }
+    }
+
+    // The same conversions as the axis events get
+    state->rawLsX = SDL_GameControllerGetAxis(controller, SDL_CONTROLLER_AXIS_LEFTX);
+    state->rawLsY = -qMax(SDL_GameControllerGetAxis(controller, SDL_CONTROLLER_AXIS_LEFTY), (short)-32767);
+    state->rawRsX = SDL_GameControllerGetAxis(controller, SDL_CONTROLLER_AXIS_RIGHTX);
+    state->rawRsY = -qMax(SDL_GameControllerGetAxis(controller, SDL_CONTROLLER_AXIS_RIGHTY), (short)-32767);
+    state->lt = m_AnalogResponse.processTrigger(SDL_GameControllerGetAxis(controller, SDL_CONTROLLER_AXIS_TRIGGERLEFT));
+    state->rt = m_AnalogResponse.processTrigger(SDL_GameControllerGetAxis(controller, SDL_CONTROLLER_AXIS_TRIGGERRIGHT));
+    m_AnalogResponse.processStick(state->rawLsX, state->rawLsY, &state->lsX, &state->lsY);
+    m_AnalogResponse.processStick(state->rawRsX, state->rawRsY, &state->rsX, &state->rsY);
+
+    // Button edges go out right away, like in processControllerButtonEvent().
+    // The start button's long press, mouse emulation and the quit combo are
+    // still handled there when the button events arrive.
+    if (buttons != state->buttons) {
+        state->buttons = buttons;
+        sendGamepadState(state);
+    }
+    else {
+        queueGamepadState(state);
+    }
+}
+
+int SdlInputHandler::gamepadPollThreadProc(void* context)
+{
+    auto me = reinterpret_cast<SdlInputHandler*>(context);
+
+    ThreadPlacement::applyToCurrentThread(ThreadPlacement::TR_INPUT);
+
+    while (!SDL_AtomicGet(&me->m_GamepadPollStopping)) {
+        // SDL locks its joysticks while it reads the devices, so this is
+        // safe alongside the main thread's event pump. The events it queues
+        // are still handled on the main thread, where state that's already
+        // been sent from here isn't sent again.
+        SDL_JoystickUpdate();
+
+        bool havePolledGamepad = false;
+
+        SDL_LockMutex(me->m_GamepadLock);
+        for (int i = 0; i < MAX_GAMEPADS; i++) {
+            GamepadState* state = &me->m_GamepadState[i];
+
+            // Mouse emulation takes over the gamepad's input
+            if (state->controller != nullptr && state->mouseEmulationTimer == 0) {
+                me->pollGamepadState(state);
+                havePolledGamepad = true;
+            }
+        }
+        SDL_UnlockMutex(me->m_GamepadLock);
+
+        // Pending motion is flushed on the next pass
+        SDL_Delay(havePolledGamepad ? GAMEPAD_POLL_INTERVAL_MS : GAMEPAD_IDLE_POLL_INTERVAL_MS);
+    }
+
+    return 0;
 }
 
 Uint32 SdlInputHandler::releaseLeftButtonTimerCallback(Uint32, void*)
@@ -678,18 +916,41 @@ Uint32 SdlInputHandler::dragTimerCallback(Uint32, void *param)
     return 0;
 }
 
-Uint32 SdlInputHandler::mouseMoveTimerCallback(Uint32 interval, void *param)
+int SdlInputHandler::mouseMoveThreadProc(void* context)
 {
-    auto me = reinterpret_cast<SdlInputHandler*>(param);
+    auto me = reinterpret_cast<SdlInputHandler*>(context);
+    Uint64 lastSendTimeUs = 0;
 
-    short deltaX = (short)SDL_AtomicSet(&me->m_MouseDeltaX, 0);
-    short deltaY = (short)SDL_AtomicSet(&me->m_MouseDeltaY, 0);
+    ThreadPlacement::applyToCurrentThread(ThreadPlacement::TR_INPUT);
 
-    if (deltaX != 0 || deltaY != 0) {
-        LiSendMouseMoveEvent(deltaX, deltaY);
+    for (;;) {
+        SDL_SemWait(me->m_MouseMoveSemaphore);
+        if (SDL_AtomicGet(&me->m_MouseMoveStopping)) {
+            break;
+        }
+
+        // Motion after the mouse was idle goes out right away. Motion that
+        // follows close behind is held until the interval has passed, and
+        // everything that arrives while waiting is sent as one packet.
+        Uint64 sinceLastSendUs = StreamUtils::getTimeUs() - lastSendTimeUs;
+        if (sinceLastSendUs < me->m_MouseMoveIntervalUs) {
+            SDL_Delay((Uint32)((me->m_MouseMoveIntervalUs - sinceLastSendUs + 999) / 1000));
+        }
+
+        // Clearing this first means motion that races with sending wakes
+        // us again rather than being left behind
+        SDL_AtomicSet(&me->m_MouseMovePending, 0);
+
+        short deltaX = (short)qBound(-32767, SDL_AtomicSet(&me->m_MouseDeltaX, 0), 32767);
+        short deltaY = (short)qBound(-32767, SDL_AtomicSet(&me->m_MouseDeltaY, 0), 32767);
+
+        if (deltaX != 0 || deltaY != 0) {
+            LiSendMouseMoveEvent(deltaX, deltaY);
+            lastSendTimeUs = StreamUtils::getTimeUs();
+        }
     }
 
-    return interval;
+    return 0;
 }
 
 Uint32 SdlInputHandler::mouseEmulationTimerCallback(Uint32 interval, void *param)
@@ -728,6 +989,13 @@ Uint32 SdlInputHandler::mouseEmulationTimerCallback(Uint32 interval, void *param
 }
 
 void SdlInputHandler::handleControllerAxisEvent(SDL_ControllerAxisEvent* event)
+{
+    SDL_LockMutex(m_GamepadLock);
+    processControllerAxisEvent(event);
+    SDL_UnlockMutex(m_GamepadLock);
+}
+
+void SdlInputHandler::processControllerAxisEvent(SDL_ControllerAxisEvent* event)
 {
     SDL_JoystickID gameControllerId = event->which;
     GamepadState* state = findStateForGamepad(gameControllerId);
@@ -735,13 +1003,18 @@ void SdlInputHandler::handleControllerAxisEvent(SDL_ControllerAxisEvent* event)
         return;
     }
 
+    // The gamepad thread has already read newer values than these
+    if (m_GamepadPollThread != nullptr && state->mouseEmulationTimer == 0) {
+        return;
+    }
+
     // Batch all pending axis motion events for this gamepad to save CPU time
     SDL_Event nextEvent;
     for (;;) {
         switch (event->axis)
         {
             case SDL_CONTROLLER_AXIS_LEFTX:
-                state->lsX = event->value;
+                state->rawLsX = event->value;
                 break;
             case SDL_CONTROLLER_AXIS_LEFTY:
                 // Signed values have one more negative value than
@@ -749,19 +1022,19 @@ void SdlInputHandler::handleControllerAxisEvent(SDL_ControllerAxisEvent* event)
                 // could actually cause the value to overflow and
                 // wrap around to be negative again. Avoid that by
                 // capping the value at 32767.
-                state->lsY = -qMax(event->value, (short)-32767);
+                state->rawLsY = -qMax(event->value, (short)-32767);
                 break;
             case SDL_CONTROLLER_AXIS_RIGHTX:
-                state->rsX = event->value;
+                state->rawRsX = event->value;
                 break;
             case SDL_CONTROLLER_AXIS_RIGHTY:
-                state->rsY = -qMax(event->value, (short)-32767);
+                state->rawRsY = -qMax(event->value, (short)-32767);
                 break;
             case SDL_CONTROLLER_AXIS_TRIGGERLEFT:
-                state->lt = (unsigned char)(event->value * 255UL / 32767);
+                state->lt = m_AnalogResponse.processTrigger(event->value);
                 break;
             case SDL_CONTROLLER_AXIS_TRIGGERRIGHT:
-                state->rt = (unsigned char)(event->value * 255UL / 32767);
+                state->rt = m_AnalogResponse.processTrigger(event->value);
                 break;
             default:
                 SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
@@ -785,21 +1058,40 @@ void SdlInputHandler::handleControllerAxisEvent(SDL_ControllerAxisEvent* event)
         SDL_PeepEvents(&nextEvent, 1, SDL_GETEVENT, SDL_CONTROLLERAXISMOTION, SDL_CONTROLLERAXISMOTION);
     }
 
-    // Only send the gamepad state to the host if it's not in mouse emulation mode
+    // Each stick's deadzone depends on both of its axes, so the response
+    // is applied once the whole batch is in
+    m_AnalogResponse.processStick(state->rawLsX, state->rawLsY, &state->lsX, &state->lsY);
+    m_AnalogResponse.processStick(state->rawRsX, state->rawRsY, &state->rsX, &state->rsY);
+
+    // Only send the gamepad state to the host if it's not in mouse emulation mode.
+    // Button edges are always sent right away, but motion can be coalesced.
     if (state->mouseEmulationTimer == 0) {
-        sendGamepadState(state);
+        queueGamepadState(state);
     }
 }
 
 void SdlInputHandler::handleControllerButtonEvent(SDL_ControllerButtonEvent* event)
+{
+    SDL_LockMutex(m_GamepadLock);
+    processControllerButtonEvent(event);
+    SDL_UnlockMutex(m_GamepadLock);
+}
+
+void SdlInputHandler::processControllerButtonEvent(SDL_ControllerButtonEvent* event)
 {
     GamepadState* state = findStateForGamepad(event->which);
     if (state == NULL) {
         return;
     }
 
+    // The gamepad thread keeps the buttons up to date and sends them,
+    // so a stale event must not undo what it's already seen
+    bool polled = m_GamepadPollThread != nullptr && state->mouseEmulationTimer == 0;
+
     if (event->state == SDL_PRESSED) {
-        state->buttons |= k_ButtonMap[event->button];
+        if (!polled) {
+            state->buttons |= k_ButtonMap[event->button];
+        }
 
         if (event->button == SDL_CONTROLLER_BUTTON_START) {
             state->lastStartDownTime = SDL_GetTicks();
@@ -829,12 +1121,14 @@ void SdlInputHandler::handleControllerButtonEvent(SDL_ControllerButtonEvent* eve
         }
     }
     else {
-        state->buttons &= ~k_ButtonMap[event->button];
+        if (!polled) {
+            state->buttons &= ~k_ButtonMap[event->button];
+        }
 
         if (event->button == SDL_CONTROLLER_BUTTON_START) {
             if (SDL_GetTicks() - state->lastStartDownTime > MOUSE_EMULATION_LONG_PRESS_TIME) {
                 if (state->mouseEmulationTimer != 0) {
-                    SDL_RemoveTimer(state->mouseEmulationTimer);
+                    m_TimerQueue.removeTimer(state->mouseEmulationTimer);
                     state->mouseEmulationTimer = 0;
 
                     SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
@@ -845,7 +1139,7 @@ void SdlInputHandler::handleControllerButtonEvent(SDL_ControllerButtonEvent* eve
                     // Send the start button up event to the host, since we won't do it below
                     sendGamepadState(state);
 
-                    state->mouseEmulationTimer = SDL_AddTimer(MOUSE_EMULATION_POLLING_INTERVAL, SdlInputHandler::mouseEmulationTimerCallback, state);
+                    state->mouseEmulationTimer = m_TimerQueue.addTimer(MOUSE_EMULATION_POLLING_INTERVAL, SdlInputHandler::mouseEmulationTimerCallback, state);
 
                     SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
                                 "Mouse emulation active");
@@ -890,12 +1184,19 @@ void SdlInputHandler::handleControllerButtonEvent(SDL_ControllerButtonEvent* eve
     }
 
     // Only send the gamepad state to the host if it's not in mouse emulation mode
-    if (state->mouseEmulationTimer == 0) {
+    if (state->mouseEmulationTimer == 0 && !polled) {
         sendGamepadState(state);
     }
 }
 
 void SdlInputHandler::handleControllerDeviceEvent(SDL_ControllerDeviceEvent* event)
+{
+    SDL_LockMutex(m_GamepadLock);
+    processControllerDeviceEvent(event);
+    SDL_UnlockMutex(m_GamepadLock);
+}
+
+void SdlInputHandler::processControllerDeviceEvent(SDL_ControllerDeviceEvent* event)
 {
     GamepadState* state;
 
@@ -947,25 +1248,33 @@ void SdlInputHandler::handleControllerDeviceEvent(SDL_ControllerDeviceEvent* eve
 
         state->controller = controller;
         state->jsId = SDL_JoystickInstanceID(SDL_GameControllerGetJoystick(state->controller));
-        state->haptic = SDL_HapticOpenFromJoystick(SDL_GameControllerGetJoystick(state->controller));
-        state->hapticEffectId = -1;
-        state->hapticMethod = GAMEPAD_HAPTIC_METHOD_NONE;
-        if (state->haptic != nullptr) {
-            if ((SDL_HapticQuery(state->haptic) & SDL_HAPTIC_LEFTRIGHT) == 0) {
-                if (SDL_HapticRumbleSupported(state->haptic)) {
-                    if (SDL_HapticRumbleInit(state->haptic) == 0) {
-                        state->hapticMethod = GAMEPAD_HAPTIC_METHOD_SIMPLERUMBLE;
+        m_GamepadSlots.insert(state->jsId, i);
+        SDL_Haptic* haptic = SDL_HapticOpenFromJoystick(SDL_GameControllerGetJoystick(state->controller));
+        int hapticMethod = GAMEPAD_HAPTIC_METHOD_NONE;
+        if (haptic != nullptr) {
+            if ((SDL_HapticQuery(haptic) & SDL_HAPTIC_LEFTRIGHT) == 0) {
+                if (SDL_HapticRumbleSupported(haptic)) {
+                    if (SDL_HapticRumbleInit(haptic) == 0) {
+                        hapticMethod = GAMEPAD_HAPTIC_METHOD_SIMPLERUMBLE;
                     }
                 }
-                if (state->hapticMethod == GAMEPAD_HAPTIC_METHOD_NONE) {
-                    SDL_HapticClose(state->haptic);
-                    state->haptic = nullptr;
+                if (hapticMethod == GAMEPAD_HAPTIC_METHOD_NONE) {
+                    SDL_HapticClose(haptic);
+                    haptic = nullptr;
                 }
             } else {
-                state->hapticMethod = GAMEPAD_HAPTIC_METHOD_LEFTRIGHT;
+                hapticMethod = GAMEPAD_HAPTIC_METHOD_LEFTRIGHT;
             }
         }
 
+        // The haptics thread can only see the device once it's set up
+        SDL_LockMutex(m_HapticsLock);
+        state->haptic = haptic;
+        state->hapticMethod = hapticMethod;
+        state->hapticEffectId = -1;
+        state->hapticEffectRunning = false;
+        SDL_UnlockMutex(m_HapticsLock);
+
         SDL_JoystickGetGUIDString(SDL_JoystickGetGUID(SDL_GameControllerGetJoystick(state->controller)),
                                   guidStr, sizeof(guidStr));
         mapping = SDL_GameControllerMapping(state->controller);
@@ -1000,13 +1309,18 @@ void SdlInputHandler::handleControllerDeviceEvent(SDL_ControllerDeviceEvent* eve
         if (state != NULL) {
             if (state->mouseEmulationTimer != 0) {
                 Session::get()->notifyMouseEmulationMode(false);
-                SDL_RemoveTimer(state->mouseEmulationTimer);
+                m_TimerQueue.removeTimer(state->mouseEmulationTimer);
             }
 
             SDL_GameControllerClose(state->controller);
+
+            // Wait for any rumble being applied to this gamepad to finish
+            SDL_LockMutex(m_HapticsLock);
             if (state->haptic != nullptr) {
                 SDL_HapticClose(state->haptic);
+                state->haptic = nullptr;
             }
+            SDL_UnlockMutex(m_HapticsLock);
 
             // Remove this from the gamepad mask in MC-mode
             if (m_MultiController) {
@@ -1026,6 +1340,7 @@ void SdlInputHandler::handleControllerDeviceEvent(SDL_ControllerDeviceEvent* eve
                                        0, 0, 0, 0, 0, 0, 0);
 
             // Clear all remaining state from this slot
+            m_GamepadSlots.remove(state->jsId);
             SDL_memset(state, 0, sizeof(*state));
         }
     }
@@ -1067,27 +1382,76 @@ void SdlInputHandler::rumble(unsigned short controllerNumber, unsigned short low
         return;
     }
 
-    // Check if the controller supports haptics (and if the controller exists at all)
-    SDL_Haptic* haptic = m_GamepadState[controllerNumber].haptic;
-    if (haptic == nullptr) {
+    if (m_HapticsThread == nullptr) {
+        applyRumble(controllerNumber, lowFreqMotor, highFreqMotor);
         return;
     }
 
-    // Stop the last effect we played
-    if (m_GamepadState[controllerNumber].hapticMethod == GAMEPAD_HAPTIC_METHOD_LEFTRIGHT) {
-        if (m_GamepadState[controllerNumber].hapticEffectId >= 0) {
-            SDL_HapticDestroyEffect(haptic, m_GamepadState[controllerNumber].hapticEffectId);
+    // This replaces any state the haptics thread hasn't gotten to yet
+    SDL_AtomicSet(&m_RumbleState[controllerNumber], (int)(((Uint32)lowFreqMotor << 16) | highFreqMotor));
+
+    int pendingMask;
+    do {
+        pendingMask = SDL_AtomicGet(&m_RumblePendingMask);
+    } while (!SDL_AtomicCAS(&m_RumblePendingMask, pendingMask, pendingMask | (1 << controllerNumber)));
+
+    // The thread is already awake if anything else was pending
+    if (pendingMask == 0) {
+        SDL_SemPost(m_HapticsSemaphore);
+    }
+}
+
+int SdlInputHandler::hapticsThreadProc(void* context)
+{
+    auto me = reinterpret_cast<SdlInputHandler*>(context);
+
+    for (;;) {
+        SDL_SemWait(me->m_HapticsSemaphore);
+        if (SDL_AtomicGet(&me->m_HapticsStopping)) {
+            break;
         }
-    } else if (m_GamepadState[controllerNumber].hapticMethod == GAMEPAD_HAPTIC_METHOD_SIMPLERUMBLE) {
-        SDL_HapticRumbleStop(haptic);
+
+        int pendingMask = SDL_AtomicSet(&me->m_RumblePendingMask, 0);
+        for (unsigned short i = 0; i < MAX_GAMEPADS; i++) {
+            if (pendingMask & (1 << i)) {
+                Uint32 state = (Uint32)SDL_AtomicGet(&me->m_RumbleState[i]);
+
+                SDL_LockMutex(me->m_HapticsLock);
+                me->applyRumble(i, (unsigned short)(state >> 16), (unsigned short)state);
+                SDL_UnlockMutex(me->m_HapticsLock);
+            }
+        }
+    }
+
+    return 0;
+}
+
+void SdlInputHandler::applyRumble(unsigned short controllerNumber, unsigned short lowFreqMotor, unsigned short highFreqMotor)
+{
+    GamepadState* state = &m_GamepadState[controllerNumber];
+
+    // Check if the controller supports haptics (and if the controller exists at all)
+    SDL_Haptic* haptic = state->haptic;
+    if (haptic == nullptr) {
+        return;
     }
 
-    // If this callback is telling us to stop both motors, don't bother queuing a new effect
+    // If we're told to stop both motors, just stop the effect. It's kept
+    // around to be updated by the next rumble.
     if (lowFreqMotor == 0 && highFreqMotor == 0) {
+        if (state->hapticMethod == GAMEPAD_HAPTIC_METHOD_LEFTRIGHT) {
+            if (state->hapticEffectRunning) {
+                SDL_HapticStopEffect(haptic, state->hapticEffectId);
+                state->hapticEffectRunning = false;
+            }
+        }
+        else if (state->hapticMethod == GAMEPAD_HAPTIC_METHOD_SIMPLERUMBLE) {
+            SDL_HapticRumbleStop(haptic);
+        }
         return;
     }
 
-    if (m_GamepadState[controllerNumber].hapticMethod == GAMEPAD_HAPTIC_METHOD_LEFTRIGHT) {
+    if (state->hapticMethod == GAMEPAD_HAPTIC_METHOD_LEFTRIGHT) {
         SDL_HapticEffect effect;
         SDL_memset(&effect, 0, sizeof(effect));
         effect.type = SDL_HAPTIC_LEFTRIGHT;
@@ -1099,18 +1463,137 @@ void SdlInputHandler::rumble(unsigned short controllerNumber, unsigned short low
         effect.leftright.large_magnitude = lowFreqMotor / 2;
         effect.leftright.small_magnitude = highFreqMotor / 2;
 
-        // Play the new effect
-        m_GamepadState[controllerNumber].hapticEffectId = SDL_HapticNewEffect(haptic, &effect);
-        if (m_GamepadState[controllerNumber].hapticEffectId >= 0) {
-            SDL_HapticRunEffect(haptic, m_GamepadState[controllerNumber].hapticEffectId, 1);
+        // Updating the effect in place is much cheaper than recreating it
+        if (state->hapticEffectId >= 0 && SDL_HapticUpdateEffect(haptic, state->hapticEffectId, &effect) < 0) {
+            SDL_HapticDestroyEffect(haptic, state->hapticEffectId);
+            state->hapticEffectId = -1;
+            state->hapticEffectRunning = false;
+        }
+        if (state->hapticEffectId < 0) {
+            state->hapticEffectId = SDL_HapticNewEffect(haptic, &effect);
+        }
+
+        // Play the effect if it isn't already
+        if (state->hapticEffectId >= 0 && !state->hapticEffectRunning) {
+            state->hapticEffectRunning = SDL_HapticRunEffect(haptic, state->hapticEffectId, 1) == 0;
         }
-    } else if (m_GamepadState[controllerNumber].hapticMethod == GAMEPAD_HAPTIC_METHOD_SIMPLERUMBLE) {
+    } else if (state->hapticMethod == GAMEPAD_HAPTIC_METHOD_SIMPLERUMBLE) {
         SDL_HapticRumblePlay(haptic,
                              std::min(1.0, (GAMEPAD_HAPTIC_SIMPLE_HIFREQ_MOTOR_WEIGHT*highFreqMotor +
                                             GAMEPAD_HAPTIC_SIMPLE_LOWFREQ_MOTOR_WEIGHT*lowFreqMotor) / 65535.0),
                              SDL_HAPTIC_INFINITY);
     }
+}
 
+void SdlInputHandler::setWindow(SDL_Window* window)
+{
+    m_Window = window;
+}
+
+void SdlInputHandler::setStreamDimensions(int streamWidth, int streamHeight)
+{
+    m_StreamWidth = streamWidth;
+    m_StreamHeight = streamHeight;
+}
+
+void SdlInputHandler::moveAbsoluteCursor(float x, float y)
+{
+    if (m_Window == nullptr) {
+        return;
+    }
+
+    // Find where the video is drawn within the window, like the renderers do
+    int windowWidth, windowHeight;
+    SDL_GetWindowSize(m_Window, &windowWidth, &windowHeight);
+
+    SDL_Rect src, dst;
+    src.x = src.y = 0;
+    src.w = m_StreamWidth;
+    src.h = m_StreamHeight;
+    dst.x = dst.y = 0;
+    dst.w = windowWidth;
+    dst.h = windowHeight;
+    StreamUtils::scaleSourceToDestinationSurface(&src, &dst);
+    if (dst.w <= 0 || dst.h <= 0) {
+        return;
+    }
+
+    // Points in the letterbox land on the nearest edge of the video
+    int targetX = qBound(0, (int)((x * windowWidth - dst.x) * m_StreamWidth / dst.w), m_StreamWidth - 1);
+    int targetY = qBound(0, (int)((y * windowHeight - dst.y) * m_StreamHeight / dst.h), m_StreamHeight - 1);
+
+    if (!m_AbsoluteCursorHomed) {
+        // The host clamps the cursor to its desktop, so this leaves the
+        // cursor at its top left corner wherever it started
+        LiSendMouseMoveEvent(-32767, -32767);
+        m_AbsoluteCursorX = m_AbsoluteCursorY = 0;
+        m_AbsoluteCursorHomed = true;
+    }
+
+    short deltaX = (short)(targetX - m_AbsoluteCursorX);
+    short deltaY = (short)(targetY - m_AbsoluteCursorY);
+    if (deltaX != 0 || deltaY != 0) {
+        LiSendMouseMoveEvent(deltaX, deltaY);
+        m_AbsoluteCursorX = targetX;
+        m_AbsoluteCursorY = targetY;
+    }
+}
+
+void SdlInputHandler::handleAbsoluteTouchFingerEvent(SDL_TouchFingerEvent* event)
+{
+    switch (event->type)
+    {
+    case SDL_FINGERDOWN:
+        // The first finger clicks where it touches and a second one holds
+        // the right button. There's no delay to tell taps and drags apart.
+        if (!m_PrimaryFingerDown) {
+            m_PrimaryFingerId = event->fingerId;
+            m_PrimaryFingerDown = true;
+            moveAbsoluteCursor(event->x, event->y);
+            LiSendMouseButtonEvent(BUTTON_ACTION_PRESS, BUTTON_LEFT);
+        }
+        else if (!m_SecondaryFingerDown) {
+            m_SecondaryFingerId = event->fingerId;
+            m_SecondaryFingerDown = true;
+            LiSendMouseButtonEvent(BUTTON_ACTION_PRESS, BUTTON_RIGHT);
+        }
+        break;
+
+    case SDL_FINGERMOTION:
+        if (!m_PrimaryFingerDown || event->fingerId != m_PrimaryFingerId) {
+            break;
+        }
+
+        // Only the latest position of the finger matters, so skip ahead
+        // to the last motion event queued for it
+        for (;;) {
+            SDL_Event nextEvent;
+            if (SDL_PeepEvents(&nextEvent, 1, SDL_PEEKEVENT, SDL_FINGERMOTION, SDL_FINGERMOTION) <= 0 ||
+                    nextEvent.tfinger.fingerId != m_PrimaryFingerId ||
+                    nextEvent.tfinger.touchId != event->touchId) {
+                break;
+            }
+
+            SDL_PeepEvents(&nextEvent, 1, SDL_GETEVENT, SDL_FINGERMOTION, SDL_FINGERMOTION);
+            event->x = nextEvent.tfinger.x;
+            event->y = nextEvent.tfinger.y;
+        }
+
+        moveAbsoluteCursor(event->x, event->y);
+        break;
+
+    case SDL_FINGERUP:
+        if (m_PrimaryFingerDown && event->fingerId == m_PrimaryFingerId) {
+            moveAbsoluteCursor(event->x, event->y);
+            LiSendMouseButtonEvent(BUTTON_ACTION_RELEASE, BUTTON_LEFT);
+            m_PrimaryFingerDown = false;
+        }
+        else if (m_SecondaryFingerDown && event->fingerId == m_SecondaryFingerId) {
+            LiSendMouseButtonEvent(BUTTON_ACTION_RELEASE, BUTTON_RIGHT);
+            m_SecondaryFingerDown = false;
+        }
+        break;
+    }
 }
 
 void SdlInputHandler::handleTouchFingerEvent(SDL_TouchFingerEvent* event)
@@ -1132,6 +1615,11 @@ void SdlInputHandler::handleTouchFingerEvent(SDL_TouchFingerEvent* event)
     return;
 #endif
 
+    if (m_AbsoluteTouchMode) {
+        handleAbsoluteTouchFingerEvent(event);
+        return;
+    }
+
     // Observations on Windows 10: x and y appear to be relative to 0,0 of the window client area.
     // Although SDL documentation states they are 0.0 - 1.0 float values, they can actually be higher
     // or lower than those values as touch events continue for touches started within the client area that
@@ -1184,7 +1672,7 @@ void SdlInputHandler::handleTouchFingerEvent(SDL_TouchFingerEvent* event)
         short deltaX = static_cast<short>(event->dx * m_StreamWidth);
         short deltaY = static_cast<short>(event->dy * m_StreamHeight);
         if (deltaX != 0 || deltaY != 0) {
-            LiSendMouseMoveEvent(deltaX, deltaY);
+            queueMouseMotion(deltaX, deltaY);
         }
     }
 
@@ -1192,10 +1680,10 @@ void SdlInputHandler::handleTouchFingerEvent(SDL_TouchFingerEvent* event)
     // fingers go down
     if (event->type == SDL_FINGERDOWN &&
             (fingerIndex == 0 || fingerIndex == 1)) {
-        SDL_RemoveTimer(m_DragTimer);
-        m_DragTimer = SDL_AddTimer(DRAG_ACTIVATION_DELAY,
-                                   dragTimerCallback,
-                                   this);
+        m_TimerQueue.removeTimer(m_DragTimer);
+        m_DragTimer = m_TimerQueue.addTimer(DRAG_ACTIVATION_DELAY,
+                                           dragTimerCallback,
+                                           this);
     }
 
     if (event->type == SDL_FINGERMOTION) {
@@ -1206,7 +1694,7 @@ void SdlInputHandler::handleTouchFingerEvent(SDL_TouchFingerEvent* event)
 
         // If it's outside the deadzone delta, cancel drags and taps
         if (m_CumulativeDelta[fingerIndex] > DEAD_ZONE_DELTA) {
-            SDL_RemoveTimer(m_DragTimer);
+            m_TimerQueue.removeTimer(m_DragTimer);
             m_DragTimer = 0;
 
             // This effectively cancels the tap logic below
@@ -1216,7 +1704,7 @@ void SdlInputHandler::handleTouchFingerEvent(SDL_TouchFingerEvent* event)
 
     if (event->type == SDL_FINGERUP) {
         // Cancel the drag timer on finger up
-        SDL_RemoveTimer(m_DragTimer);
+        m_TimerQueue.removeTimer(m_DragTimer);
         m_DragTimer = 0;
 
         // Release any drag
@@ -1234,10 +1722,10 @@ void SdlInputHandler::handleTouchFingerEvent(SDL_TouchFingerEvent* event)
             LiSendMouseButtonEvent(BUTTON_ACTION_PRESS, BUTTON_RIGHT);
 
             // Queue a timer to release it in 100 ms
-            SDL_RemoveTimer(m_RightButtonReleaseTimer);
-            m_RightButtonReleaseTimer = SDL_AddTimer(TAP_BUTTON_RELEASE_DELAY,
-                                                     releaseRightButtonTimerCallback,
-                                                     nullptr);
+            m_TimerQueue.removeTimer(m_RightButtonReleaseTimer);
+            m_RightButtonReleaseTimer = m_TimerQueue.addTimer(TAP_BUTTON_RELEASE_DELAY,
+                                                             releaseRightButtonTimerCallback,
+                                                             nullptr);
         }
         // 1 finger tap
         else if (event->timestamp - m_TouchDownEvent[0].timestamp < 250) {
@@ -1245,10 +1733,10 @@ void SdlInputHandler::handleTouchFingerEvent(SDL_TouchFingerEvent* event)
             LiSendMouseButtonEvent(BUTTON_ACTION_PRESS, BUTTON_LEFT);
 
             // Queue a timer to release it in 100 ms
-            SDL_RemoveTimer(m_LeftButtonReleaseTimer);
-            m_LeftButtonReleaseTimer = SDL_AddTimer(TAP_BUTTON_RELEASE_DELAY,
-                                                    releaseLeftButtonTimerCallback,
-                                                    nullptr);
+            m_TimerQueue.removeTimer(m_LeftButtonReleaseTimer);
+            m_LeftButtonReleaseTimer = m_TimerQueue.addTimer(TAP_BUTTON_RELEASE_DELAY,
+                                                            releaseLeftButtonTimerCallback,
+                                                            nullptr);
         }
     }
 
@@ -1265,22 +1753,21 @@ void SdlInputHandler::handleTouchFingerEvent(SDL_TouchFingerEvent* event)
 
 int SdlInputHandler::getAttachedGamepadMask()
 {
-    int count;
-    int mask;
+    return m_GamepadMask;
+}
 
-    if (!m_MultiController) {
-        // Player 1 is always present in non-MC mode
-        return 0x1;
-    }
+// Only used until the arrival events for these gamepads are handled
+int SdlInputHandler::countAttachedGamepads()
+{
+    int count = 0;
 
-    count = mask = 0;
-    for (int i = 0; i < SDL_NumJoysticks(); i++) {
+    for (int i = 0; i < SDL_NumJoysticks() && count < MAX_GAMEPADS; i++) {
         if (SDL_IsGameController(i)) {
-            mask |= (1 << count++);
+            count++;
         }
     }
 
-    return mask;
+    return count;
 }
 
 void SdlInputHandler::raiseAllKeys()
@@ -1313,8 +1800,15 @@ bool SdlInputHandler::isCaptureActive()
 void SdlInputHandler::setCaptureActive(bool active)
 {
     if (active) {
+        if (m_LocalCursor) {
+            // The cursor stays visible and motion is tracked in window
+            // coordinates. The host's cursor may have been moved while
+            // we weren't capturing, so pin it again on the next motion.
+            m_FakeCaptureActive = true;
+            m_AbsoluteCursorHomed = false;
+        }
         // Try to activate SDL's relative mouse mode
-        if (SDL_SetRelativeMouseMode(SDL_TRUE) < 0) {
+        else if (SDL_SetRelativeMouseMode(SDL_TRUE) < 0) {
             // Relative mouse mode didn't work, so we'll use fake capture
             SDL_ShowCursor(SDL_DISABLE);
             m_FakeCaptureActive = true;
@@ -2,15 +2,20 @@
 
 #include "settings/streamingpreferences.h"
 #include "backend/computermanager.h"
+#include "analogresponse.h"
+#include "inputtimerqueue.h"
 
 #include <SDL.h>
 
+#include <QHash>
+
 struct GamepadState {
     SDL_GameController* controller;
     SDL_JoystickID jsId;
     SDL_Haptic* haptic;
     int hapticMethod;
     int hapticEffectId;
+    bool hapticEffectRunning;
     short index;
 
     SDL_TimerID mouseEmulationTimer;
@@ -20,9 +25,25 @@ struct GamepadState {
     short lsX, lsY;
     short rsX, rsY;
     unsigned char lt, rt;
+
+    // Sticks as SDL reported them, before the response is applied
+    short rawLsX, rawLsY;
+    short rawRsX, rawRsY;
+
+    // What the host was last sent, so stick noise isn't resent and
+    // motion can be coalesced with what follows it
+    short sentButtons;
+    short sentLsX, sentLsY;
+    short sentRsX, sentRsY;
+    unsigned char sentLt, sentRt;
+    int sentGamepadMask;
+    Uint64 lastSendTimeUs;
+    bool sendPending;
 };
 
-#define MAX_GAMEPADS 4
+// The protocol's gamepad mask has room for 16 gamepads. GeForce Experience
+// only handles the first 4, but other hosts can use all of them.
+#define MAX_GAMEPADS 16
 #define MAX_FINGERS 2
 
 #define GAMEPAD_HAPTIC_METHOD_NONE 0
@@ -40,6 +61,10 @@ public:
 
     ~SdlInputHandler();
 
+    // Windows virtual key code sent to the host for a scancode, or 0
+    // if the key isn't sent
+    static short getVirtualKey(SDL_Scancode scancode);
+
     void handleKeyEvent(SDL_KeyboardEvent* event);
 
     void handleMouseButtonEvent(SDL_MouseButtonEvent* event);
@@ -56,10 +81,21 @@ public:
 
     void handleJoystickArrivalEvent(SDL_JoyDeviceEvent* event);
 
+    // Sends gamepad motion that was held back for coalescing once its
+    // window has passed. Returns true if any is still waiting.
+    bool flushPendingGamepadStates();
+
     void rumble(unsigned short controllerNumber, unsigned short lowFreqMotor, unsigned short highFreqMotor);
 
     void handleTouchFingerEvent(SDL_TouchFingerEvent* event);
 
+    // The window that touch coordinates are relative to
+    void setWindow(SDL_Window* window);
+
+    // Absolute positions are scaled to these after a stream restart
+    void setStreamDimensions(int streamWidth, int streamHeight);
+
+    // Kept up to date as gamepads arrive and leave
     int getAttachedGamepadMask();
 
     void raiseAllKeys();
@@ -75,8 +111,31 @@ private:
     GamepadState*
     findStateForGamepad(SDL_JoystickID id);
 
+    int countAttachedGamepads();
+
     void sendGamepadState(GamepadState* state);
 
+    void handleAbsoluteTouchFingerEvent(SDL_TouchFingerEvent* event);
+
+    // Moves the host's cursor to a point in the window, where x and y
+    // range from 0 to 1
+    void moveAbsoluteCursor(float x, float y);
+
+    void queueGamepadState(GamepadState* state);
+
+    void processControllerAxisEvent(SDL_ControllerAxisEvent* event);
+
+    void processControllerButtonEvent(SDL_ControllerButtonEvent* event);
+
+    void processControllerDeviceEvent(SDL_ControllerDeviceEvent* event);
+
+    // Reads the gamepad's current state straight from SDL and sends it
+    // if it changed. m_GamepadLock must be held.
+    void pollGamepadState(GamepadState* state);
+
+    static
+    int gamepadPollThreadProc(void* context);
+
     static
     Uint32 releaseLeftButtonTimerCallback(Uint32 interval, void* param);
 
@@ -87,30 +146,112 @@ private:
     Uint32 dragTimerCallback(Uint32 interval, void* param);
 
     static
-    Uint32 mouseMoveTimerCallback(Uint32 interval, void* param);
+    int mouseMoveThreadProc(void* context);
+
+    // Hands relative motion to the mouse motion thread to be coalesced
+    void queueMouseMotion(int deltaX, int deltaY);
+
+    void applyRumble(unsigned short controllerNumber, unsigned short lowFreqMotor, unsigned short highFreqMotor);
+
+    static
+    int hapticsThreadProc(void* context);
 
     static
     Uint32 mouseEmulationTimerCallback(Uint32 interval, void* param);
 
     bool m_MultiController;
     bool m_GamepadMouse;
-    SDL_TimerID m_MouseMoveTimer;
+    // Motion is sent by its own thread as soon as it arrives, unless the
+    // host needs motion packets spaced out by m_MouseMoveIntervalUs
+    SDL_Thread* m_MouseMoveThread;
+    SDL_sem* m_MouseMoveSemaphore;
+    SDL_atomic_t m_MouseMovePending;
+    SDL_atomic_t m_MouseMoveStopping;
     SDL_atomic_t m_MouseDeltaX;
     SDL_atomic_t m_MouseDeltaY;
+    Uint64 m_MouseMoveIntervalUs;
+
+    // Rumble is applied by its own thread, since some drivers block for
+    // milliseconds and rumble arrives on the control stream's thread.
+    // Only the latest motor state of each gamepad is kept, packed as
+    // low << 16 | high, and m_RumblePendingMask flags the ones that haven't
+    // been applied yet. m_HapticsLock guards each gamepad's haptic fields.
+    SDL_Thread* m_HapticsThread;
+    SDL_sem* m_HapticsSemaphore;
+    SDL_mutex* m_HapticsLock;
+    SDL_atomic_t m_HapticsStopping;
+    SDL_atomic_t m_RumblePendingMask;
+    SDL_atomic_t m_RumbleState[MAX_GAMEPADS];
+
+    // The gamepads are read by their own thread at up to 1 kHz, so their
+    // state goes out without waiting for the main thread to pump events
+    // between renders. m_GamepadLock guards the gamepad state and mask
+    // against it.
+    SDL_Thread* m_GamepadPollThread;
+    SDL_atomic_t m_GamepadPollStopping;
+    SDL_mutex* m_GamepadLock;
     int m_GamepadMask;
     GamepadState m_GamepadState[MAX_GAMEPADS];
+    QHash<SDL_JoystickID, int> m_GamepadSlots;
+    AnalogResponse m_AnalogResponse;
     QSet<short> m_KeysDown;
     bool m_FakeCaptureActive;
 
     SDL_TouchFingerEvent m_TouchDownEvent[MAX_FINGERS];
     float m_CumulativeDelta[MAX_FINGERS];
+    // Tap, drag and mouse emulation timers all run on this one thread
+    InputTimerQueue m_TimerQueue;
     SDL_TimerID m_LeftButtonReleaseTimer;
     SDL_TimerID m_RightButtonReleaseTimer;
     SDL_TimerID m_DragTimer;
     char m_DragButton;
     int m_NumFingersDown;
+
+    // The host only takes relative motion, so the cursor is pinned to the
+    // top left corner on the first touch (or local cursor motion) and
+    // tracked from there
+    bool m_AbsoluteTouchMode;
+    bool m_LocalCursor;
+    SDL_Window* m_Window;
+    bool m_AbsoluteCursorHomed;
+    int m_AbsoluteCursorX;
+    int m_AbsoluteCursorY;
+    SDL_FingerID m_PrimaryFingerId;
+    SDL_FingerID m_SecondaryFingerId;
+    bool m_PrimaryFingerDown;
+    bool m_SecondaryFingerDown;
     int m_StreamWidth;
     int m_StreamHeight;
 
+    enum KeyCombo {
+        KeyComboQuit,
+        KeyComboUngrab,
+        KeyComboToggleFullScreen,
+        KeyComboToggleStatsOverlay,
+        KeyComboToggleRecording,
+        KeyComboSaveReplay,
+        KeyComboScreenshot,
+        KeyComboToggleFrameGraph,
+        KeyComboMax
+    };
+
+    struct KeyComboDefinition {
+        SDL_Keycode keyCode;
+        SDL_Scancode scanCode;
+        KeyCombo combo;
+    };
+
+    // Windows virtual key code for each SDL scancode, or 0 for
+    // scancodes that aren't sent to the host
+    struct KeyMap {
+        KeyMap();
+
+        short virtualKeys[SDL_NUM_SCANCODES];
+    };
+
+    void performKeyCombo(KeyCombo combo, const char* source);
+
     static const int k_ButtonMap[];
+    static const KeyComboDefinition k_KeyCombos[KeyComboMax];
+    static const KeyMap s_KeyMap;
 };
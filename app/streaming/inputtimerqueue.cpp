@@ -0,0 +1,161 @@
+#include "inputtimerqueue.h"
+#include "streaming/streamutils.h"
+#include "streaming/threadplacement.h"
+
+InputTimerQueue::InputTimerQueue()
+    : m_Thread(nullptr),
+      m_ThreadId(0),
+      m_Stopping(false),
+      m_NextId(1),
+      m_RunningId(0),
+      m_RunningRemoved(false)
+{
+    m_Lock = SDL_CreateMutex();
+    m_Cond = SDL_CreateCond();
+}
+
+InputTimerQueue::~InputTimerQueue()
+{
+    if (m_Thread != nullptr) {
+        SDL_LockMutex(m_Lock);
+        m_Stopping = true;
+        SDL_CondBroadcast(m_Cond);
+        SDL_UnlockMutex(m_Lock);
+
+        SDL_WaitThread(m_Thread, nullptr);
+    }
+
+    SDL_DestroyCond(m_Cond);
+    SDL_DestroyMutex(m_Lock);
+}
+
+SDL_TimerID InputTimerQueue::addTimer(Uint32 intervalMs, SDL_TimerCallback callback, void* param)
+{
+    SDL_TimerID id;
+
+    SDL_LockMutex(m_Lock);
+
+    // The thread is only started once a timer is first used, since most
+    // sessions never touch or emulate a mouse with a gamepad
+    if (m_Thread == nullptr) {
+        m_Thread = SDL_CreateThread(InputTimerQueue::timerThreadProc, "InputTimers", this);
+        if (m_Thread == nullptr) {
+            SDL_UnlockMutex(m_Lock);
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "Unable to create input timer thread: %s",
+                         SDL_GetError());
+            return 0;
+        }
+    }
+
+    Timer timer;
+    timer.id = id = m_NextId++;
+    timer.deadlineUs = StreamUtils::getTimeUs() + intervalMs * 1000ULL;
+    timer.intervalMs = intervalMs;
+    timer.callback = callback;
+    timer.param = param;
+    insertTimer(timer);
+
+    // Wake the thread in case this is now the earliest deadline
+    SDL_CondBroadcast(m_Cond);
+    SDL_UnlockMutex(m_Lock);
+
+    return id;
+}
+
+bool InputTimerQueue::removeTimer(SDL_TimerID id)
+{
+    bool removed = false;
+
+    if (id == 0) {
+        return false;
+    }
+
+    SDL_LockMutex(m_Lock);
+
+    for (int i = 0; i < m_Timers.size(); i++) {
+        if (m_Timers[i].id == id) {
+            m_Timers.remove(i);
+            removed = true;
+            break;
+        }
+    }
+
+    if (!removed && m_RunningId == id) {
+        m_RunningRemoved = true;
+        removed = true;
+
+        // A callback that removes its own timer can't wait for itself
+        if (SDL_ThreadID() != m_ThreadId) {
+            while (m_RunningId == id) {
+                SDL_CondWait(m_Cond, m_Lock);
+            }
+        }
+    }
+
+    SDL_UnlockMutex(m_Lock);
+
+    return removed;
+}
+
+void InputTimerQueue::insertTimer(const Timer& timer)
+{
+    int i = m_Timers.size();
+    while (i > 0 && m_Timers[i - 1].deadlineUs > timer.deadlineUs) {
+        i--;
+    }
+    m_Timers.insert(i, timer);
+}
+
+int InputTimerQueue::timerThreadProc(void* context)
+{
+    auto me = reinterpret_cast<InputTimerQueue*>(context);
+
+    ThreadPlacement::applyToCurrentThread(ThreadPlacement::TR_INPUT);
+
+    SDL_LockMutex(me->m_Lock);
+    me->m_ThreadId = SDL_ThreadID();
+
+    while (!me->m_Stopping) {
+        if (me->m_Timers.isEmpty()) {
+            SDL_CondWait(me->m_Cond, me->m_Lock);
+            continue;
+        }
+
+        Uint64 nowUs = StreamUtils::getTimeUs();
+        if (me->m_Timers.first().deadlineUs > nowUs) {
+            SDL_CondWaitTimeout(me->m_Cond, me->m_Lock,
+                                (Uint32)((me->m_Timers.first().deadlineUs - nowUs + 999) / 1000));
+            continue;
+        }
+
+        Timer timer = me->m_Timers.takeFirst();
+        me->m_RunningId = timer.id;
+        me->m_RunningRemoved = false;
+
+        // The callback may add or remove timers itself
+        SDL_UnlockMutex(me->m_Lock);
+        Uint32 nextIntervalMs = timer.callback(timer.intervalMs, timer.param);
+        SDL_LockMutex(me->m_Lock);
+
+        if (nextIntervalMs != 0 && !me->m_RunningRemoved) {
+            // Periodic timers are rescheduled from their last deadline so
+            // they don't drift, unless they've fallen a whole interval behind
+            timer.intervalMs = nextIntervalMs;
+            timer.deadlineUs += nextIntervalMs * 1000ULL;
+            if (timer.deadlineUs < nowUs) {
+                timer.deadlineUs = nowUs + nextIntervalMs * 1000ULL;
+            }
+            me->insertTimer(timer);
+        }
+
+        me->m_RunningId = 0;
+
+        // Wake anyone waiting in removeTimer() for this callback
+        SDL_CondBroadcast(me->m_Cond);
+    }
+
+    SDL_UnlockMutex(me->m_Lock);
+
+    return 0;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <SDL.h>
+
+#include <QVector>
+
+// Runs the input handler's timers (tap releases, drag activation and
+// gamepad mouse emulation) from a single thread of our own rather than
+// SDL's timer thread, which is shared with anything else in the process
+// that uses SDL_AddTimer(). Timers are kept sorted by deadline and the
+// thread sleeps until the earliest one is due, or indefinitely while none
+// are pending, so an idle session doesn't wake up at all.
+//
+// The interface mirrors SDL_AddTimer() and SDL_RemoveTimer(): a callback
+// returns the interval until it should run again, or 0 to stop.
+class InputTimerQueue
+{
+public:
+    InputTimerQueue();
+
+    // Stops the thread. Timers still pending are dropped without running.
+    ~InputTimerQueue();
+
+    // Returns 0 if the thread couldn't be started
+    SDL_TimerID addTimer(Uint32 intervalMs, SDL_TimerCallback callback, void* param);
+
+    // Returns false if the timer had already finished or was removed. If
+    // its callback is running on the queue's thread, this waits for it to
+    // return, so whatever param points to can be freed afterwards.
+    bool removeTimer(SDL_TimerID id);
+
+private:
+    struct Timer {
+        SDL_TimerID id;
+        Uint64 deadlineUs;
+        Uint32 intervalMs;
+        SDL_TimerCallback callback;
+        void* param;
+    };
+
+    // m_Lock must be held
+    void insertTimer(const Timer& timer);
+
+    static
+    int timerThreadProc(void* context);
+
+    SDL_Thread* m_Thread;
+    SDL_threadID m_ThreadId;
+    SDL_mutex* m_Lock;
+    SDL_cond* m_Cond;
+    bool m_Stopping;
+    SDL_TimerID m_NextId;
+
+    // Sorted by deadline, with timers due at the same time kept in the
+    // order they were added
+    QVector<Timer> m_Timers;
+
+    // The timer whose callback is running, if any, and whether it was
+    // removed while it ran
+    SDL_TimerID m_RunningId;
+    bool m_RunningRemoved;
+};
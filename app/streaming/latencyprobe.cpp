@@ -0,0 +1,215 @@
+#include "latencyprobe.h"
+#include "streamutils.h"
+
+#include <Limelight.h>
+
+#include <QtGlobal>
+#include <QStringList>
+
+extern "C" {
+#include <libavutil/hwcontext.h>
+#include <libavutil/pixdesc.h>
+}
+
+// How often an input is sent. A response that takes longer than this is
+// counted as missed.
+#define LATENCY_PROBE_INTERVAL_MS 1000
+
+// Change in average luminance (out of 255) that counts as a response
+#define LATENCY_PROBE_THRESHOLD 48
+
+// Only every 4th pixel of every 4th row is sampled
+#define LATENCY_PROBE_STRIDE 4
+
+bool LatencyProbe::s_Active;
+SDL_TimerID LatencyProbe::s_Timer;
+short LatencyProbe::s_KeyCode;
+int LatencyProbe::s_Region[4];
+SDL_SpinLock LatencyProbe::s_Lock;
+bool LatencyProbe::s_Armed;
+Uint64 LatencyProbe::s_InputSentTimeUs;
+int LatencyProbe::s_MissedResponses;
+int LatencyProbe::s_LastLuminance;
+Uint64 LatencyProbe::s_ResponseInputTimeUs;
+FrameTimeHistogram LatencyProbe::s_Latencies;
+
+// Hardware frames are copied into this to be read, so the render
+// thread doesn't allocate a frame for each probe
+static AVFrame* s_SoftwareFrame;
+
+void LatencyProbe::start()
+{
+    SDL_assert(!s_Active);
+
+    if (qgetenv("LATENCY_PROBE") != "1") {
+        return;
+    }
+
+    s_KeyCode = 0;
+    QByteArray keyCode = qgetenv("LATENCY_PROBE_KEY");
+    if (!keyCode.isEmpty()) {
+        s_KeyCode = (short)keyCode.toInt(nullptr, 16);
+    }
+
+    // Default to the center 10% of the frame
+    s_Region[0] = s_Region[1] = 45;
+    s_Region[2] = s_Region[3] = 10;
+
+    QStringList region = QString::fromLatin1(qgetenv("LATENCY_PROBE_REGION")).split(',');
+    if (region.size() == 4) {
+        for (int i = 0; i < 4; i++) {
+            s_Region[i] = qBound(0, region[i].trimmed().toInt(), 100);
+        }
+    }
+
+    s_SoftwareFrame = av_frame_alloc();
+    if (s_SoftwareFrame == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unable to allocate latency probe frame");
+        return;
+    }
+
+    s_Armed = false;
+    s_MissedResponses = 0;
+    s_LastLuminance = -1;
+    s_ResponseInputTimeUs = 0;
+    SDL_zero(s_Latencies);
+
+    s_Active = true;
+    s_Timer = SDL_AddTimer(LATENCY_PROBE_INTERVAL_MS, sendInputTimerCallback, nullptr);
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Latency probe enabled: %s over %d,%d %dx%d%%",
+                s_KeyCode != 0 ? "key presses" : "left clicks",
+                s_Region[0], s_Region[1], s_Region[2], s_Region[3]);
+}
+
+void LatencyProbe::stop()
+{
+    if (!s_Active) {
+        return;
+    }
+
+    SDL_RemoveTimer(s_Timer);
+    s_Timer = 0;
+    s_Active = false;
+
+    av_frame_free(&s_SoftwareFrame);
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Input-to-photon latency: %u responses, %d missed",
+                s_Latencies.count,
+                s_MissedResponses);
+    if (s_Latencies.count != 0) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Input-to-photon latency p50/p95/p99/max: %.1f/%.1f/%.1f/%.1f ms",
+                    (float)s_Latencies.getPercentileUs(50) / 1000,
+                    (float)s_Latencies.getPercentileUs(95) / 1000,
+                    (float)s_Latencies.getPercentileUs(99) / 1000,
+                    (float)s_Latencies.maxUs / 1000);
+    }
+}
+
+Uint32 LatencyProbe::sendInputTimerCallback(Uint32 interval, void*)
+{
+    SDL_AtomicLock(&s_Lock);
+    if (s_Armed) {
+        s_MissedResponses++;
+    }
+    s_Armed = true;
+    s_InputSentTimeUs = StreamUtils::getTimeUs();
+    SDL_AtomicUnlock(&s_Lock);
+
+    if (s_KeyCode != 0) {
+        LiSendKeyboardEvent(s_KeyCode, KEY_ACTION_DOWN, 0);
+        LiSendKeyboardEvent(s_KeyCode, KEY_ACTION_UP, 0);
+    }
+    else {
+        LiSendMouseButtonEvent(BUTTON_ACTION_PRESS, BUTTON_LEFT);
+        LiSendMouseButtonEvent(BUTTON_ACTION_RELEASE, BUTTON_LEFT);
+    }
+
+    return interval;
+}
+
+int LatencyProbe::getRegionLuminance(const AVFrame* frame)
+{
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get((AVPixelFormat)frame->format);
+    if (desc == nullptr || (desc->flags & AV_PIX_FMT_FLAG_RGB)) {
+        return -1;
+    }
+
+    // Luma is the first component of every YUV format
+    const AVComponentDescriptor* luma = &desc->comp[0];
+    int left = frame->width * s_Region[0] / 100;
+    int top = frame->height * s_Region[1] / 100;
+    int right = qMin(frame->width, left + qMax(1, frame->width * s_Region[2] / 100));
+    int bottom = qMin(frame->height, top + qMax(1, frame->height * s_Region[3] / 100));
+
+    Uint64 total = 0;
+    int samples = 0;
+    for (int y = top; y < bottom; y += LATENCY_PROBE_STRIDE) {
+        const Uint8* row = frame->data[luma->plane] + y * frame->linesize[luma->plane] + luma->offset;
+        for (int x = left; x < right; x += LATENCY_PROBE_STRIDE) {
+            const Uint8* sample = row + x * luma->step;
+            if (luma->depth > 8) {
+                total += ((*(const Uint16*)sample) >> luma->shift) >> (luma->depth - 8);
+            }
+            else {
+                total += *sample;
+            }
+            samples++;
+        }
+    }
+
+    return samples != 0 ? (int)(total / samples) : -1;
+}
+
+bool LatencyProbe::probeFrame(AVFrame* frame)
+{
+    int luminance;
+
+    if (frame->hw_frames_ctx != nullptr) {
+        // Mapping avoids a copy where the hardware allows it
+        s_SoftwareFrame->format = AV_PIX_FMT_NONE;
+        if (av_hwframe_map(s_SoftwareFrame, frame, AV_HWFRAME_MAP_READ) < 0) {
+            av_frame_unref(s_SoftwareFrame);
+            if (av_hwframe_transfer_data(s_SoftwareFrame, frame, 0) < 0) {
+                av_frame_unref(s_SoftwareFrame);
+                return false;
+            }
+        }
+
+        luminance = getRegionLuminance(s_SoftwareFrame);
+        av_frame_unref(s_SoftwareFrame);
+    }
+    else {
+        luminance = getRegionLuminance(frame);
+    }
+
+    if (luminance < 0) {
+        return false;
+    }
+
+    int lastLuminance = s_LastLuminance;
+    s_LastLuminance = luminance;
+    if (lastLuminance < 0 || qAbs(luminance - lastLuminance) < LATENCY_PROBE_THRESHOLD) {
+        return false;
+    }
+
+    // Changes that happen without an input waiting on them are ignored
+    SDL_AtomicLock(&s_Lock);
+    bool armed = s_Armed;
+    s_Armed = false;
+    s_ResponseInputTimeUs = s_InputSentTimeUs;
+    SDL_AtomicUnlock(&s_Lock);
+
+    return armed;
+}
+
+void LatencyProbe::markResponsePresented(Uint64 displayTimeUs)
+{
+    if (displayTimeUs > s_ResponseInputTimeUs) {
+        s_Latencies.add(displayTimeUs - s_ResponseInputTimeUs);
+    }
+}
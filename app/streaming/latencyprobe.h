@@ -0,0 +1,66 @@
+#pragma once
+
+#include "video/frametimehistogram.h"
+
+#include <SDL.h>
+
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+// Measures input-to-photon latency with LATENCY_PROBE=1. About once a
+// second, a left click (or the key whose Windows VK code is given in hex
+// by LATENCY_PROBE_KEY) is sent to the host. The host should run
+// something that changes the brightness of the probed region on each
+// input, like a page that toggles between black and white. Every frame's
+// average luminance is sampled over the region before it's rendered, and
+// the first frame that differs enough from the one before it is taken as
+// the response to the input.
+//
+// The region is given by LATENCY_PROBE_REGION as "x,y,width,height" in
+// percent of the frame, and defaults to a small area in the center.
+//
+// Latencies are from sending the input until the response is scanned out,
+// when the renderer can measure that. They're logged when the session ends.
+class LatencyProbe
+{
+public:
+    static void start();
+
+    // The pipeline threads must all be stopped before calling this
+    static void stop();
+
+    static bool isActive()
+    {
+        return s_Active;
+    }
+
+    // Called by the Pacer before each frame is rendered. Returns true if
+    // the frame is the response to the last input.
+    static bool probeFrame(AVFrame* frame);
+
+    // Called by the Pacer once the frame probeFrame() returned true for
+    // has been rendered
+    static void markResponsePresented(Uint64 displayTimeUs);
+
+private:
+    static Uint32 sendInputTimerCallback(Uint32 interval, void* param);
+
+    static int getRegionLuminance(const AVFrame* frame);
+
+    static bool s_Active;
+    static SDL_TimerID s_Timer;
+    static short s_KeyCode;
+    static int s_Region[4];
+
+    // Written by the timer and read by the render thread
+    static SDL_SpinLock s_Lock;
+    static bool s_Armed;
+    static Uint64 s_InputSentTimeUs;
+    static int s_MissedResponses;
+
+    // Owned by the render thread
+    static int s_LastLuminance;
+    static Uint64 s_ResponseInputTimeUs;
+    static FrameTimeHistogram s_Latencies;
+};
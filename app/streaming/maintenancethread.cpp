@@ -0,0 +1,93 @@
+#include "maintenancethread.h"
+#include "video/decoder.h"
+#include "backend/richpresencemanager.h"
+
+// How often the housekeeping runs. Display changes are noticed within
+// this long, which used to be immediate for window moves.
+#define MAINTENANCE_INTERVAL_MS 250
+
+SDL_Thread* MaintenanceThread::s_Thread;
+SDL_sem* MaintenanceThread::s_StopSemaphore;
+SDL_Window* MaintenanceThread::s_Window;
+RichPresenceManager* MaintenanceThread::s_Presence;
+SDL_atomic_t MaintenanceThread::s_ExpectedDisplayIndex;
+SDL_atomic_t MaintenanceThread::s_ExpectedRefreshRate;
+SDL_atomic_t MaintenanceThread::s_DisplayChangePending;
+
+void MaintenanceThread::start(SDL_Window* window, RichPresenceManager* presence)
+{
+    SDL_assert(s_Thread == nullptr);
+
+    s_StopSemaphore = SDL_CreateSemaphore(0);
+    if (s_StopSemaphore == nullptr) {
+        return;
+    }
+
+    s_Window = window;
+    s_Presence = presence;
+
+    s_Thread = SDL_CreateThread(maintenanceThreadProc, "Maintenance", nullptr);
+    if (s_Thread == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unable to create maintenance thread: %s",
+                     SDL_GetError());
+        SDL_DestroySemaphore(s_StopSemaphore);
+        s_StopSemaphore = nullptr;
+        return;
+    }
+}
+
+void MaintenanceThread::stop()
+{
+    if (s_Thread == nullptr) {
+        return;
+    }
+
+    SDL_SemPost(s_StopSemaphore);
+    SDL_WaitThread(s_Thread, nullptr);
+    s_Thread = nullptr;
+
+    SDL_DestroySemaphore(s_StopSemaphore);
+    s_StopSemaphore = nullptr;
+    s_Window = nullptr;
+    s_Presence = nullptr;
+}
+
+int MaintenanceThread::maintenanceThreadProc(void*)
+{
+    // Nothing here is urgent, so it shouldn't compete with the streaming threads
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_LOW);
+
+    while (SDL_SemWaitTimeout(s_StopSemaphore, MAINTENANCE_INTERVAL_MS) == SDL_MUTEX_TIMEDOUT) {
+        if (s_Presence != nullptr) {
+            s_Presence->runCallbacks();
+        }
+
+        // These only read what SDL has cached about the window and its
+        // display, which the main thread keeps up to date as it pumps events.
+        // The main loop gets one event per change, until it has handled it.
+        if (!SDL_AtomicGet(&s_DisplayChangePending)) {
+            int displayIndex = SDL_GetWindowDisplayIndex(s_Window);
+            SDL_DisplayMode mode;
+            if (displayIndex < 0 || SDL_GetCurrentDisplayMode(displayIndex, &mode) != 0) {
+                continue;
+            }
+
+            if (SDL_AtomicCAS(&s_ExpectedRefreshRate, -1, mode.refresh_rate)) {
+                continue;
+            }
+
+            if (displayIndex != SDL_AtomicGet(&s_ExpectedDisplayIndex) ||
+                    mode.refresh_rate != SDL_AtomicGet(&s_ExpectedRefreshRate)) {
+                SDL_AtomicSet(&s_DisplayChangePending, 1);
+
+                SDL_Event event;
+                event.type = SDL_USEREVENT;
+                event.user.code = SDL_CODE_DISPLAY_CHANGED;
+                SDL_PushEvent(&event);
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <SDL.h>
+
+class RichPresenceManager;
+
+// Runs the session's housekeeping at low priority, so the main loop only
+// wakes up for input and frames: Discord callbacks, and watching for the
+// window moving to another display or the display's refresh rate changing.
+// The stats overlay text is already built on the decoder's stats thread.
+//
+// Display changes are only detected here. The main loop is sent an
+// SDL_CODE_DISPLAY_CHANGED event and resets the presentation itself, since
+// that has to happen on the main thread.
+class MaintenanceThread
+{
+public:
+    // presence may be nullptr
+    static void start(SDL_Window* window, RichPresenceManager* presence);
+
+    static void stop();
+
+    // Called by the main loop with the display that it set the presentation
+    // up for. The refresh rate it has now is taken as the expected one, so
+    // the main loop isn't told about mode changes that it made itself.
+    static void setExpectedDisplay(int displayIndex)
+    {
+        SDL_AtomicSet(&s_ExpectedDisplayIndex, displayIndex);
+        SDL_AtomicSet(&s_ExpectedRefreshRate, -1);
+        SDL_AtomicSet(&s_DisplayChangePending, 0);
+    }
+
+private:
+    static int maintenanceThreadProc(void* context);
+
+    static SDL_Thread* s_Thread;
+    static SDL_sem* s_StopSemaphore;
+    static SDL_Window* s_Window;
+    static RichPresenceManager* s_Presence;
+    static SDL_atomic_t s_ExpectedDisplayIndex;
+    static SDL_atomic_t s_ExpectedRefreshRate;
+    static SDL_atomic_t s_DisplayChangePending;
+};
@@ -0,0 +1,231 @@
+#include "metricsexporter.h"
+#include "gpuusage.h"
+#include "session.h"
+
+#include <Limelight.h>
+
+#include <QHostAddress>
+#include <QUdpSocket>
+
+#define METRICS_INTERVAL_MS 1000
+
+SDL_atomic_t MetricsExporter::s_Active;
+SDL_Thread* MetricsExporter::s_Thread;
+SDL_sem* MetricsExporter::s_StopSemaphore;
+MetricsExporter::VideoSnapshot MetricsExporter::s_VideoSnapshots[2];
+SDL_atomic_t MetricsExporter::s_VideoSequence;
+SDL_atomic_t MetricsExporter::s_AudioQueueDepth;
+SDL_atomic_t MetricsExporter::s_ConnectionStatus;
+SDL_atomic_t MetricsExporter::s_ConnectionStatusChanges;
+
+struct ExporterTarget
+{
+    QHostAddress address;
+    quint16 port;
+};
+
+void MetricsExporter::start()
+{
+    SDL_assert(s_Thread == nullptr);
+
+    QString target = qgetenv("METRICS_STATSD");
+    if (target.isEmpty()) {
+        return;
+    }
+
+    int separator = target.lastIndexOf(':');
+    bool portOk = false;
+    ExporterTarget* exporterTarget = new ExporterTarget();
+    if (separator > 0) {
+        exporterTarget->port = target.mid(separator + 1).toUShort(&portOk);
+    }
+    if (!portOk || !exporterTarget->address.setAddress(target.left(separator))) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "METRICS_STATSD must be <ip>:<port>, not '%s'",
+                     qPrintable(target));
+        delete exporterTarget;
+        return;
+    }
+
+    SDL_zero(s_VideoSnapshots);
+    SDL_AtomicSet(&s_VideoSequence, 0);
+    SDL_AtomicSet(&s_AudioQueueDepth, 0);
+    SDL_AtomicSet(&s_ConnectionStatus, CONN_STATUS_OKAY);
+    SDL_AtomicSet(&s_ConnectionStatusChanges, 0);
+
+    s_StopSemaphore = SDL_CreateSemaphore(0);
+    if (s_StopSemaphore == nullptr) {
+        delete exporterTarget;
+        return;
+    }
+
+    SDL_AtomicSet(&s_Active, 1);
+    s_Thread = SDL_CreateThread(exporterThreadProc, "Metrics", exporterTarget);
+    if (s_Thread == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unable to create metrics thread: %s",
+                     SDL_GetError());
+        SDL_AtomicSet(&s_Active, 0);
+        SDL_DestroySemaphore(s_StopSemaphore);
+        s_StopSemaphore = nullptr;
+        delete exporterTarget;
+        return;
+    }
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Exporting metrics to StatsD at %s",
+                qPrintable(target));
+}
+
+void MetricsExporter::stop()
+{
+    if (s_Thread == nullptr) {
+        return;
+    }
+
+    SDL_AtomicSet(&s_Active, 0);
+    SDL_SemPost(s_StopSemaphore);
+    SDL_WaitThread(s_Thread, nullptr);
+    s_Thread = nullptr;
+
+    SDL_DestroySemaphore(s_StopSemaphore);
+    s_StopSemaphore = nullptr;
+}
+
+void MetricsExporter::publishVideoStats(const VIDEO_STATS& stats)
+{
+    if (!isActive()) {
+        return;
+    }
+
+    int sequence = SDL_AtomicGet(&s_VideoSequence);
+    VideoSnapshot* snapshot = &s_VideoSnapshots[((sequence >> 1) + 1) & 1];
+
+    // An odd sequence tells the exporter that this buffer is being written
+    SDL_AtomicIncRef(&s_VideoSequence);
+
+    snapshot->receivedFps = stats.receivedFps;
+    snapshot->decodedFps = stats.decodedFps;
+    snapshot->renderedFps = stats.renderedFps;
+    snapshot->networkDropRate = stats.totalFrames != 0 ?
+                (float)stats.networkDroppedFrames / stats.totalFrames : 0;
+    snapshot->pacerDropRate = stats.decodedFrames != 0 ?
+                (float)stats.pacerDroppedFrames / stats.decodedFrames : 0;
+    snapshot->avgReassemblyTimeMs = stats.receivedFrames != 0 ?
+                (float)stats.totalReassemblyTime / stats.receivedFrames / 1000 : 0;
+    snapshot->avgDecodeTimeMs = stats.decodedFrames != 0 ?
+                (float)stats.totalDecodeTime / stats.decodedFrames / 1000 : 0;
+    snapshot->avgQueueTimeMs = stats.renderedFrames != 0 ?
+                (float)stats.totalPacerTime / stats.renderedFrames / 1000 : 0;
+    snapshot->avgRenderTimeMs = stats.renderedFrames != 0 ?
+                (float)stats.totalRenderTime / stats.renderedFrames / 1000 : 0;
+    snapshot->avgPresentLatencyMs = stats.presentLatencySamples != 0 ?
+                (float)stats.totalPresentLatency / stats.presentLatencySamples / 1000 : 0;
+    snapshot->avgDecodeQueueDepth = stats.queuedDecodeUnits != 0 ?
+                (float)stats.totalDecodeQueueDepth / stats.queuedDecodeUnits : 0;
+    snapshot->maxDecodeQueueDepth = stats.maxDecodeQueueDepth;
+    snapshot->idrFrames = stats.idrFrames;
+    snapshot->idrRequests = stats.idrRequests;
+    snapshot->rfiRecoveries = stats.rfiRecoveries;
+    snapshot->avgArrivalJitterMs = stats.receivedFrames != 0 ?
+                (float)stats.totalArrivalJitter / stats.receivedFrames / 1000 : 0;
+    snapshot->lossBursts = stats.lossBursts;
+    snapshot->maxLossBurst = stats.maxLossBurst;
+
+    SDL_AtomicIncRef(&s_VideoSequence);
+}
+
+bool MetricsExporter::readVideoSnapshot(VideoSnapshot* snapshot, int* lastSequence)
+{
+    int startSequence, endSequence;
+
+    do {
+        startSequence = SDL_AtomicGet(&s_VideoSequence);
+        SDL_memcpy(snapshot, &s_VideoSnapshots[(startSequence >> 1) & 1], sizeof(*snapshot));
+        endSequence = SDL_AtomicGet(&s_VideoSequence);
+    } while (endSequence > (startSequence | 1) + 1);
+
+    // Only report windows that we haven't sent yet
+    if ((startSequence >> 1) == *lastSequence) {
+        return false;
+    }
+
+    *lastSequence = startSequence >> 1;
+    return *lastSequence != 0;
+}
+
+int MetricsExporter::exporterThreadProc(void* context)
+{
+    ExporterTarget* target = (ExporterTarget*)context;
+    QUdpSocket socket;
+    int lastVideoSequence = 0;
+    int lastStatusChanges = 0;
+    bool running = true;
+
+    while (running) {
+        // Wake up once per interval, or early to send the final report
+        running = SDL_SemWaitTimeout(s_StopSemaphore, METRICS_INTERVAL_MS) == SDL_MUTEX_TIMEDOUT;
+
+        QByteArray packet;
+        VideoSnapshot video;
+
+        if (readVideoSnapshot(&video, &lastVideoSequence)) {
+            packet += QString("moonlight.video.received_fps:%1|g\n"
+                              "moonlight.video.decoded_fps:%2|g\n"
+                              "moonlight.video.rendered_fps:%3|g\n"
+                              "moonlight.video.network_drop_rate:%4|g\n"
+                              "moonlight.video.pacer_drop_rate:%5|g\n"
+                              "moonlight.video.reassembly_ms:%6|g\n"
+                              "moonlight.video.decode_ms:%7|g\n"
+                              "moonlight.video.queue_ms:%8|g\n"
+                              "moonlight.video.render_ms:%9|g\n")
+                      .arg(video.receivedFps).arg(video.decodedFps).arg(video.renderedFps)
+                      .arg(video.networkDropRate).arg(video.pacerDropRate)
+                      .arg(video.avgReassemblyTimeMs).arg(video.avgDecodeTimeMs)
+                      .arg(video.avgQueueTimeMs).arg(video.avgRenderTimeMs).toLatin1();
+            packet += QString("moonlight.video.present_latency_ms:%1|g\n"
+                              "moonlight.video.decode_queue_depth:%2|g\n"
+                              "moonlight.video.decode_queue_depth_max:%3|g\n"
+                              "moonlight.video.idr_frames:%4|c\n"
+                              "moonlight.video.idr_requests:%5|c\n"
+                              "moonlight.video.rfi_recoveries:%6|c\n")
+                      .arg(video.avgPresentLatencyMs).arg(video.avgDecodeQueueDepth)
+                      .arg(video.maxDecodeQueueDepth).arg(video.idrFrames)
+                      .arg(video.idrRequests).arg(video.rfiRecoveries).toLatin1();
+            packet += QString("moonlight.video.arrival_jitter_ms:%1|g\n"
+                              "moonlight.video.loss_bursts:%2|c\n"
+                              "moonlight.video.loss_burst_max:%3|g\n")
+                      .arg(video.avgArrivalJitterMs).arg(video.lossBursts)
+                      .arg(video.maxLossBurst).toLatin1();
+        }
+
+        int statusChanges = SDL_AtomicGet(&s_ConnectionStatusChanges);
+        packet += QString("moonlight.audio.pending_frames:%1|g\n"
+                          "moonlight.audio.queue_depth:%2|g\n"
+                          "moonlight.connection.poor:%3|g\n"
+                          "moonlight.connection.status_changes:%4|c\n")
+                  .arg(Session::getPendingAudioFrames())
+                  .arg(SDL_AtomicGet(&s_AudioQueueDepth))
+                  .arg(SDL_AtomicGet(&s_ConnectionStatus) == CONN_STATUS_POOR ? 1 : 0)
+                  .arg(statusChanges - lastStatusChanges).toLatin1();
+        lastStatusChanges = statusChanges;
+
+        int gpuDecodePercent, gpuRenderPercent;
+        GpuUsage::getUtilization(&gpuDecodePercent, &gpuRenderPercent);
+        if (gpuDecodePercent >= 0) {
+            packet += QString("moonlight.gpu.decode_util:%1|g\n").arg(gpuDecodePercent).toLatin1();
+        }
+        if (gpuRenderPercent >= 0) {
+            packet += QString("moonlight.gpu.render_util:%1|g\n").arg(gpuRenderPercent).toLatin1();
+        }
+
+        if (socket.writeDatagram(packet, target->address, target->port) < 0) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "Unable to send metrics: %s",
+                        qPrintable(socket.errorString()));
+        }
+    }
+
+    delete target;
+    return 0;
+}
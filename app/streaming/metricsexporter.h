@@ -0,0 +1,81 @@
+#pragma once
+
+#include "video/decoder.h"
+
+#include <SDL.h>
+
+// Publishes live session metrics as StatsD gauges over UDP, so a fleet of
+// clients can be monitored without scraping logs. Exporting is enabled
+// with METRICS_STATSD=<ip>:<port>.
+//
+// The streaming threads only store values here. The decoder thread hands
+// over one snapshot per stats window and the audio and connection
+// callbacks update atomics, so none of them ever wait on the exporter
+// thread or on the network.
+class MetricsExporter
+{
+public:
+    // Starts the exporter thread if exporting is enabled
+    static void start();
+
+    // Sends a final report and stops the exporter thread
+    static void stop();
+
+    static bool isActive()
+    {
+        return SDL_AtomicGet(&s_Active) != 0;
+    }
+
+    // Called by the decoder thread once per stats window
+    static void publishVideoStats(const VIDEO_STATS& stats);
+
+    static void setAudioQueueDepth(int frames)
+    {
+        SDL_AtomicSet(&s_AudioQueueDepth, frames);
+    }
+
+    static void setConnectionStatus(int connectionStatus)
+    {
+        SDL_AtomicSet(&s_ConnectionStatus, connectionStatus);
+        SDL_AtomicIncRef(&s_ConnectionStatusChanges);
+    }
+
+private:
+    struct VideoSnapshot
+    {
+        float receivedFps;
+        float decodedFps;
+        float renderedFps;
+        float networkDropRate;
+        float pacerDropRate;
+        float avgReassemblyTimeMs;
+        float avgDecodeTimeMs;
+        float avgQueueTimeMs;
+        float avgRenderTimeMs;
+        float avgPresentLatencyMs;
+        float avgDecodeQueueDepth;
+        Uint32 maxDecodeQueueDepth;
+        Uint32 idrFrames;
+        Uint32 idrRequests;
+        Uint32 rfiRecoveries;
+        float avgArrivalJitterMs;
+        Uint32 lossBursts;
+        Uint32 maxLossBurst;
+    };
+
+    static int exporterThreadProc(void* context);
+    static bool readVideoSnapshot(VideoSnapshot* snapshot, int* lastSequence);
+
+    static SDL_atomic_t s_Active;
+    static SDL_Thread* s_Thread;
+    static SDL_sem* s_StopSemaphore;
+
+    // Double-buffered under a seqlock like the overlay text. The decoder
+    // thread is the only writer.
+    static VideoSnapshot s_VideoSnapshots[2];
+    static SDL_atomic_t s_VideoSequence;
+
+    static SDL_atomic_t s_AudioQueueDepth;
+    static SDL_atomic_t s_ConnectionStatus;
+    static SDL_atomic_t s_ConnectionStatusChanges;
+};
@@ -0,0 +1,268 @@
+#include "pathmtu.h"
+
+#include <QHostInfo>
+#include <QNetworkInterface>
+
+#include <SDL.h>
+
+#if defined(Q_OS_WIN32)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <iphlpapi.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <net/if.h>
+#include <ifaddrs.h>
+#include <unistd.h>
+#include <string.h>
+#endif
+
+// What moonlight-common-c used for every network, which fits a 1500 byte MTU
+#define DEFAULT_PACKET_SIZE 1392
+
+// The IP, UDP, RTP and video headers that go around each packet
+#define IPV4_PACKET_OVERHEAD (1500 - DEFAULT_PACKET_SIZE)
+#define IPV6_PACKET_OVERHEAD (IPV4_PACKET_OVERHEAD + 20)
+
+// Each lost packet takes more of the frame with it as they get bigger,
+// so jumbo frames are only used up to this
+#define MAX_PACKET_SIZE 8192
+
+#define MIN_PACKET_SIZE 512
+
+// Only used to pick the route, nothing is sent to it
+#define VIDEO_PORT 47998
+
+QMutex PathMtu::s_CacheLock;
+QHash<QString, PathMtu::CachedPath> PathMtu::s_Cache;
+
+static int toSockAddr(const QHostAddress& address, sockaddr_storage* sa)
+{
+    memset(sa, 0, sizeof(*sa));
+
+    if (address.protocol() == QAbstractSocket::IPv6Protocol) {
+        sockaddr_in6* sin6 = reinterpret_cast<sockaddr_in6*>(sa);
+        Q_IPV6ADDR addr = address.toIPv6Address();
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = htons(VIDEO_PORT);
+        memcpy(&sin6->sin6_addr, &addr, sizeof(sin6->sin6_addr));
+        sin6->sin6_scope_id = QNetworkInterface::interfaceIndexFromName(address.scopeId());
+        return sizeof(*sin6);
+    }
+    else {
+        sockaddr_in* sin = reinterpret_cast<sockaddr_in*>(sa);
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons(VIDEO_PORT);
+        sin->sin_addr.s_addr = htonl(address.toIPv4Address());
+        return sizeof(*sin);
+    }
+}
+
+#ifndef Q_OS_WIN32
+// Connects a UDP socket to the host, which picks the route without
+// sending anything
+static int connectRouteSocket(const QHostAddress& address)
+{
+    sockaddr_storage sa;
+    int saLen = toSockAddr(address, &sa);
+
+    int s = socket(sa.ss_family, SOCK_DGRAM, 0);
+    if (s < 0) {
+        return -1;
+    }
+
+    if (::connect(s, reinterpret_cast<sockaddr*>(&sa), saLen) < 0) {
+        close(s);
+        return -1;
+    }
+
+    return s;
+}
+#endif
+
+QString PathMtu::findRoute(const QHostAddress& address)
+{
+#if defined(Q_OS_WIN32)
+    sockaddr_storage sa;
+    toSockAddr(address, &sa);
+
+    DWORD interfaceIndex;
+    if (GetBestInterfaceEx(reinterpret_cast<sockaddr*>(&sa), &interfaceIndex) != NO_ERROR) {
+        return QString();
+    }
+
+    return QString::number(interfaceIndex);
+#else
+    int s = connectRouteSocket(address);
+    if (s < 0) {
+        return QString();
+    }
+
+    sockaddr_storage local;
+    socklen_t localLen = sizeof(local);
+    int err = getsockname(s, reinterpret_cast<sockaddr*>(&local), &localLen);
+    close(s);
+    if (err < 0) {
+        return QString();
+    }
+
+    QHostAddress localAddress(reinterpret_cast<sockaddr*>(&local));
+
+    // Find the interface that has the address the route goes out from
+    struct ifaddrs* interfaces;
+    if (getifaddrs(&interfaces) < 0) {
+        return QString();
+    }
+
+    QString route;
+    for (struct ifaddrs* ifa = interfaces; ifa != nullptr; ifa = ifa->ifa_next) {
+        if (ifa->ifa_addr != nullptr &&
+                ifa->ifa_addr->sa_family == local.ss_family &&
+                QHostAddress(ifa->ifa_addr).isEqual(localAddress, QHostAddress::TolerantConversion)) {
+            route = QString::fromLocal8Bit(ifa->ifa_name);
+            break;
+        }
+    }
+
+    freeifaddrs(interfaces);
+    return route;
+#endif
+}
+
+int PathMtu::probeMtu(const QHostAddress& address, const QString& route)
+{
+#if defined(Q_OS_WIN32)
+    MIB_IPINTERFACE_ROW row;
+    InitializeIpInterfaceEntry(&row);
+    row.Family = address.protocol() == QAbstractSocket::IPv6Protocol ? AF_INET6 : AF_INET;
+    row.InterfaceIndex = route.toULong();
+    if (GetIpInterfaceEntry(&row) != NO_ERROR) {
+        return 0;
+    }
+
+    return (int)row.NlMtu;
+#else
+    int s = socket(AF_INET, SOCK_DGRAM, 0);
+    if (s < 0) {
+        return 0;
+    }
+
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, route.toLocal8Bit().constData(), sizeof(ifr.ifr_name) - 1);
+
+    int mtu = ioctl(s, SIOCGIFMTU, &ifr) == 0 ? ifr.ifr_mtu : 0;
+    close(s);
+
+#ifdef Q_OS_LINUX
+    // Linux also knows the MTU of the path where an earlier packet too
+    // big for a later hop came back with the size that would fit
+    s = connectRouteSocket(address);
+    if (s >= 0) {
+        bool ipv6 = address.protocol() == QAbstractSocket::IPv6Protocol;
+        int pathMtu = 0;
+        socklen_t pathMtuLen = sizeof(pathMtu);
+        if (getsockopt(s,
+                       ipv6 ? IPPROTO_IPV6 : IPPROTO_IP,
+                       ipv6 ? IPV6_MTU : IP_MTU,
+                       &pathMtu, &pathMtuLen) == 0 && pathMtu > 0) {
+            mtu = mtu > 0 ? qMin(mtu, pathMtu) : pathMtu;
+        }
+        close(s);
+    }
+#else
+    Q_UNUSED(address);
+#endif
+
+    return mtu;
+#endif
+}
+
+bool PathMtu::isLocalNetwork(const QHostAddress& address)
+{
+    if (address.protocol() == QAbstractSocket::IPv6Protocol) {
+        // Link-local, site-local and ULA
+        return address.isInSubnet(QHostAddress("fe80::"), 10) ||
+                address.isInSubnet(QHostAddress("fec0::"), 10) ||
+                address.isInSubnet(QHostAddress("fc00::"), 7);
+    }
+    else {
+        return address.isInSubnet(QHostAddress("10.0.0.0"), 8) ||
+                address.isInSubnet(QHostAddress("172.16.0.0"), 12) ||
+                address.isInSubnet(QHostAddress("192.168.0.0"), 16) ||
+                address.isInSubnet(QHostAddress("169.254.0.0"), 16);
+    }
+}
+
+int PathMtu::getPacketSize(const QString& address)
+{
+    QHostAddress hostAddress(address);
+    if (hostAddress.isNull()) {
+        QHostInfo info = QHostInfo::fromName(address);
+        if (info.addresses().isEmpty()) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "Unable to resolve %s for path MTU discovery",
+                        qPrintable(address));
+            return DEFAULT_PACKET_SIZE;
+        }
+
+        hostAddress = info.addresses().first();
+    }
+
+    QString route = findRoute(hostAddress);
+    if (route.isEmpty()) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Unable to find route to %s for path MTU discovery",
+                    qPrintable(address));
+        return DEFAULT_PACKET_SIZE;
+    }
+
+    int mtu = probeMtu(hostAddress, route);
+    {
+        QMutexLocker lock(&s_CacheLock);
+
+        // A smaller MTU learned for the path during an earlier stream is
+        // kept after the OS forgets it, for as long as the route is the same
+        auto it = s_Cache.constFind(address);
+        if (it != s_Cache.constEnd() && it->route == route && it->mtu > 0) {
+            mtu = mtu > 0 ? qMin(mtu, it->mtu) : it->mtu;
+        }
+
+        if (mtu > 0) {
+            CachedPath path;
+            path.route = route;
+            path.mtu = mtu;
+            s_Cache.insert(address, path);
+        }
+    }
+
+    if (mtu <= 0) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Unable to find MTU of %s",
+                    qPrintable(route));
+        return DEFAULT_PACKET_SIZE;
+    }
+
+    bool ipv6 = hostAddress.protocol() == QAbstractSocket::IPv6Protocol;
+    int packetSize = mtu - (ipv6 ? IPV6_PACKET_OVERHEAD : IPV4_PACKET_OVERHEAD);
+
+    // Hops beyond our network are assumed to be on a 1500 byte MTU
+    if (!isLocalNetwork(hostAddress)) {
+        packetSize = qMin(packetSize, DEFAULT_PACKET_SIZE);
+    }
+
+    // Keep the size a multiple of 16 for the depacketizer's buffers
+    packetSize = qBound(MIN_PACKET_SIZE, packetSize & ~15, MAX_PACKET_SIZE);
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Path MTU to %s is %d through %s: using %d byte packets",
+                qPrintable(address),
+                mtu,
+                qPrintable(route),
+                packetSize);
+
+    return packetSize;
+}
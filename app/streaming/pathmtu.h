@@ -0,0 +1,41 @@
+#pragma once
+
+#include <QHash>
+#include <QHostAddress>
+#include <QMutex>
+#include <QString>
+
+// Picks the video packet size for a host from the MTU of the path to it,
+// so jumbo frame LANs get fewer, bigger packets and VPN or PPPoE links
+// don't fragment them. The MTU is the one of the interface the host is
+// routed through, lowered by what the kernel has learned of the path
+// where it tracks that. Hosts beyond the local network never get more
+// than the default, since the hops past the first aren't known.
+//
+// The smallest MTU seen is kept per host address while the host is still
+// reached through the same interface, so what was learned of the path
+// during one stream isn't lost once the OS forgets it.
+class PathMtu
+{
+public:
+    static int getPacketSize(const QString& address);
+
+private:
+    struct CachedPath
+    {
+        QString route;
+        int mtu;
+    };
+
+    // Names the local interface the host is reached through, or returns
+    // an empty string if there's no route to it
+    static QString findRoute(const QHostAddress& address);
+
+    // Returns 0 if the MTU can't be found
+    static int probeMtu(const QHostAddress& address, const QString& route);
+
+    static bool isLocalNetwork(const QHostAddress& address);
+
+    static QMutex s_CacheLock;
+    static QHash<QString, CachedPath> s_Cache;
+};
@@ -0,0 +1,701 @@
+#include "recorder.h"
+#include "path.h"
+
+#include <QDateTime>
+#include <QDir>
+
+// How much can wait for the writer thread before packets are dropped
+#define RECORDER_MAX_QUEUED_BYTES (64 * 1024 * 1024)
+
+// The replay normally holds up to twice its length, which at high
+// bitrates is a lot of memory. Past this it's trimmed to less.
+#define RECORDER_MAX_REPLAY_BYTES (768LL * 1024 * 1024)
+
+// Gives the host time to answer before a key frame is asked for again
+#define RECORDER_KEY_FRAME_REQUEST_INTERVAL_MS 1000
+
+#define VIDEO_STREAM_INDEX 0
+#define AUDIO_STREAM_INDEX 1
+
+StreamRecorder::StreamRecorder(int replayBufferSecs)
+    : m_ReplayBufferMs(replayBufferSecs * 1000),
+      m_Thread(nullptr),
+      m_Lock(nullptr),
+      m_Cond(nullptr),
+      m_Stopping(false),
+      m_ToggleRecordingRequested(false),
+      m_SaveReplayRequested(false),
+      m_QueuedBytes(0),
+      m_DroppedPackets(0),
+      m_HaveAudioConfig(false),
+      m_VideoNeedsKeyFrame(true),
+      m_VideoFormat(0),
+      m_Width(0),
+      m_Height(0),
+      m_FrameRate(0),
+      m_ReplayBytes(0),
+      m_LastKeyFrameRequestMs(0),
+      m_RecordingPending(false)
+{
+    SDL_AtomicSet(&m_Active, 0);
+    SDL_AtomicSet(&m_KeyFrameRequested, 0);
+    memset(&m_AudioConfig, 0, sizeof(m_AudioConfig));
+    m_Recording.context = nullptr;
+}
+
+StreamRecorder::~StreamRecorder()
+{
+    if (m_Thread != nullptr) {
+        SDL_LockMutex(m_Lock);
+        m_Stopping = true;
+        SDL_CondSignal(m_Cond);
+        SDL_UnlockMutex(m_Lock);
+
+        SDL_WaitThread(m_Thread, nullptr);
+    }
+
+    while (!m_Queue.isEmpty()) {
+        QueuedItem item = m_Queue.dequeue();
+        freeItem(item);
+    }
+
+    if (m_DroppedPackets > 0) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Recorder dropped %u packets because the disk couldn't keep up",
+                    m_DroppedPackets);
+    }
+
+    if (m_Cond != nullptr) {
+        SDL_DestroyCond(m_Cond);
+    }
+    if (m_Lock != nullptr) {
+        SDL_DestroyMutex(m_Lock);
+    }
+}
+
+bool StreamRecorder::start()
+{
+    m_Lock = SDL_CreateMutex();
+    m_Cond = SDL_CreateCond();
+    if (m_Lock == nullptr || m_Cond == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unable to create recorder synchronization: %s",
+                     SDL_GetError());
+        return false;
+    }
+
+    m_Thread = SDL_CreateThread(writerThreadProc, "Recorder", this);
+    if (m_Thread == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unable to create recorder thread: %s",
+                     SDL_GetError());
+        return false;
+    }
+
+    updateActive();
+
+    if (m_ReplayBufferMs > 0) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Keeping the last %d seconds of the stream for instant replay",
+                    m_ReplayBufferMs / 1000);
+    }
+
+    return true;
+}
+
+void StreamRecorder::setVideoFormat(int videoFormat, int width, int height, int frameRate)
+{
+    QueuedItem item;
+
+    item.type = ItemVideoFormat;
+    item.packet = nullptr;
+    item.keyFrame = false;
+    item.videoFormat = videoFormat;
+    item.width = width;
+    item.height = height;
+    item.frameRate = frameRate;
+
+    // This is queued even if the queue is full, since a file can't be
+    // started without it
+    SDL_LockMutex(m_Lock);
+    m_Queue.enqueue(item);
+    SDL_CondSignal(m_Cond);
+    SDL_UnlockMutex(m_Lock);
+
+    // A new stream always starts with a key frame
+    m_VideoNeedsKeyFrame = true;
+}
+
+void StreamRecorder::setAudioConfig(const OPUS_MULTISTREAM_CONFIGURATION* opusConfig)
+{
+    SDL_LockMutex(m_Lock);
+    memcpy(&m_AudioConfig, opusConfig, sizeof(m_AudioConfig));
+    m_HaveAudioConfig = true;
+    SDL_UnlockMutex(m_Lock);
+}
+
+bool StreamRecorder::enqueue(const QueuedItem& item)
+{
+    SDL_LockMutex(m_Lock);
+
+    if (m_QueuedBytes + item.packet->size > RECORDER_MAX_QUEUED_BYTES) {
+        m_DroppedPackets++;
+        SDL_UnlockMutex(m_Lock);
+        return false;
+    }
+
+    m_Queue.enqueue(item);
+    m_QueuedBytes += item.packet->size;
+    SDL_CondSignal(m_Cond);
+
+    SDL_UnlockMutex(m_Lock);
+    return true;
+}
+
+void StreamRecorder::freeItem(QueuedItem& item)
+{
+    if (item.packet != nullptr) {
+        av_packet_free(&item.packet);
+    }
+}
+
+void StreamRecorder::writeVideo(PDECODE_UNIT du)
+{
+    bool keyFrame = du->frameType == FRAME_TYPE_IDR;
+
+    // Once a frame is missed, the ones after it can't be decoded
+    // until the next key frame
+    if (SDL_AtomicGet(&m_Active) == 0) {
+        m_VideoNeedsKeyFrame = true;
+        return;
+    }
+    else if (m_VideoNeedsKeyFrame && !keyFrame) {
+        return;
+    }
+
+    int length = 0;
+    for (PLENTRY entry = du->bufferList; entry != nullptr; entry = entry->next) {
+        length += entry->length;
+    }
+
+    QueuedItem item;
+    item.type = ItemVideo;
+    item.keyFrame = keyFrame;
+    item.packet = av_packet_alloc();
+    if (item.packet == nullptr) {
+        return;
+    }
+
+    if (av_new_packet(item.packet, length) < 0) {
+        freeItem(item);
+        return;
+    }
+
+    int offset = 0;
+    for (PLENTRY entry = du->bufferList; entry != nullptr; entry = entry->next) {
+        memcpy(&item.packet->data[offset], entry->data, entry->length);
+        offset += entry->length;
+
+        if (keyFrame && entry->bufferType != BUFFER_TYPE_PICDATA) {
+            item.parameterSets.append(entry->data, entry->length);
+        }
+    }
+
+    item.packet->stream_index = VIDEO_STREAM_INDEX;
+    item.packet->pts = item.packet->dts = (int64_t)du->receiveTimeMs;
+    if (keyFrame) {
+        item.packet->flags |= AV_PKT_FLAG_KEY;
+    }
+
+    if (enqueue(item)) {
+        m_VideoNeedsKeyFrame = false;
+    }
+    else {
+        freeItem(item);
+        m_VideoNeedsKeyFrame = true;
+        SDL_AtomicSet(&m_KeyFrameRequested, 1);
+    }
+}
+
+void StreamRecorder::writeAudio(const char* data, int length)
+{
+    if (SDL_AtomicGet(&m_Active) == 0) {
+        return;
+    }
+
+    QueuedItem item;
+    item.type = ItemAudio;
+    item.keyFrame = false;
+    item.packet = av_packet_alloc();
+    if (item.packet == nullptr) {
+        return;
+    }
+
+    if (av_new_packet(item.packet, length) < 0) {
+        freeItem(item);
+        return;
+    }
+
+    memcpy(item.packet->data, data, length);
+    item.packet->stream_index = AUDIO_STREAM_INDEX;
+    item.packet->pts = item.packet->dts = (int64_t)LiGetMillis();
+    item.packet->flags |= AV_PKT_FLAG_KEY;
+
+    if (!enqueue(item)) {
+        freeItem(item);
+    }
+}
+
+bool StreamRecorder::takeKeyFrameRequest()
+{
+    return SDL_AtomicSet(&m_KeyFrameRequested, 0) != 0;
+}
+
+void StreamRecorder::toggleRecording()
+{
+    SDL_LockMutex(m_Lock);
+    m_ToggleRecordingRequested = true;
+    SDL_CondSignal(m_Cond);
+    SDL_UnlockMutex(m_Lock);
+}
+
+void StreamRecorder::saveReplay()
+{
+    SDL_LockMutex(m_Lock);
+    m_SaveReplayRequested = true;
+    SDL_CondSignal(m_Cond);
+    SDL_UnlockMutex(m_Lock);
+}
+
+void StreamRecorder::updateActive()
+{
+    SDL_AtomicSet(&m_Active,
+                  (m_ReplayBufferMs > 0 || m_Recording.context != nullptr || m_RecordingPending) ? 1 : 0);
+}
+
+void StreamRecorder::requestKeyFrameIfNeeded(Sint64 nowMs)
+{
+    bool needed = m_RecordingPending;
+
+    // Hosts only send key frames when asked for them, so the replay would
+    // otherwise grow from the first one for the whole stream
+    if (m_ReplayBufferMs > 0 &&
+            (m_ReplayKeyFrameTimes.isEmpty() || nowMs - m_ReplayKeyFrameTimes.last() >= m_ReplayBufferMs)) {
+        needed = true;
+    }
+
+    if (needed && nowMs - m_LastKeyFrameRequestMs >= RECORDER_KEY_FRAME_REQUEST_INTERVAL_MS) {
+        m_LastKeyFrameRequestMs = nowMs;
+        SDL_AtomicSet(&m_KeyFrameRequested, 1);
+    }
+}
+
+void StreamRecorder::trimReplay()
+{
+    Sint64 newestMs = m_Replay.last().packet->pts;
+
+    // Whole GOPs are dropped from the front as long as what's left still
+    // covers the replay length, so the replay always starts at a key frame
+    while (m_ReplayKeyFrameTimes.size() >= 2 &&
+           (m_ReplayKeyFrameTimes.at(1) <= newestMs - m_ReplayBufferMs ||
+            m_ReplayBytes > RECORDER_MAX_REPLAY_BYTES)) {
+        m_ReplayKeyFrameTimes.dequeue();
+
+        do {
+            QueuedItem item = m_Replay.dequeue();
+            m_ReplayBytes -= item.packet->size;
+            freeItem(item);
+        } while (!m_Replay.first().keyFrame);
+    }
+}
+
+void StreamRecorder::clearReplay()
+{
+    while (!m_Replay.isEmpty()) {
+        QueuedItem item = m_Replay.dequeue();
+        freeItem(item);
+    }
+
+    m_ReplayKeyFrameTimes.clear();
+    m_ReplayBytes = 0;
+}
+
+void StreamRecorder::handleItem(QueuedItem& item)
+{
+    if (item.type == ItemVideoFormat) {
+        // A file can't change format partway, so a recording carries
+        // on in a new one
+        if (m_Recording.context != nullptr) {
+            closeFile(m_Recording);
+            m_RecordingPending = true;
+        }
+
+        clearReplay();
+        m_VideoFormat = item.videoFormat;
+        m_Width = item.width;
+        m_Height = item.height;
+        m_FrameRate = item.frameRate;
+        m_ParameterSets.clear();
+        return;
+    }
+
+    if (item.type == ItemVideo) {
+        if (item.keyFrame) {
+            m_ParameterSets = item.parameterSets;
+
+            if (m_RecordingPending) {
+                m_RecordingPending = false;
+                openFile(m_Recording, "Recording", item.packet->pts);
+                updateActive();
+            }
+        }
+
+        requestKeyFrameIfNeeded(item.packet->pts);
+    }
+
+    if (m_Recording.context != nullptr && !writePacket(m_Recording, item)) {
+        closeFile(m_Recording);
+        updateActive();
+    }
+
+    if (m_ReplayBufferMs > 0 && (item.keyFrame || !m_Replay.isEmpty())) {
+        if (item.keyFrame) {
+            m_ReplayKeyFrameTimes.enqueue(item.packet->pts);
+        }
+
+        m_ReplayBytes += item.packet->size;
+        m_Replay.enqueue(item);
+        trimReplay();
+    }
+    else {
+        freeItem(item);
+    }
+}
+
+void StreamRecorder::handleToggleRecording()
+{
+    if (m_Recording.context != nullptr) {
+        closeFile(m_Recording);
+    }
+    else if (m_RecordingPending) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Recording cancelled before it started");
+        m_RecordingPending = false;
+    }
+    else {
+        // Start from the newest key frame in the replay, if there is one,
+        // rather than waiting for the host to send another
+        int start = -1;
+        for (int i = m_Replay.size() - 1; i >= 0; i--) {
+            if (m_Replay.at(i).keyFrame) {
+                start = i;
+                break;
+            }
+        }
+
+        if (start >= 0) {
+            if (openFile(m_Recording, "Recording", m_Replay.at(start).packet->pts)) {
+                for (int i = start; i < m_Replay.size(); i++) {
+                    if (!writePacket(m_Recording, m_Replay.at(i))) {
+                        closeFile(m_Recording);
+                        break;
+                    }
+                }
+            }
+        }
+        else {
+            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                        "Recording will start at the next key frame");
+            m_RecordingPending = true;
+            m_LastKeyFrameRequestMs = 0;
+            requestKeyFrameIfNeeded((Sint64)LiGetMillis());
+        }
+    }
+
+    updateActive();
+}
+
+void StreamRecorder::handleSaveReplay()
+{
+    if (m_ReplayBufferMs == 0) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Instant replay is turned off");
+        return;
+    }
+    else if (m_Replay.isEmpty()) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "No replay to save yet");
+        return;
+    }
+
+    // Packets queue up while this is written, and the disk is usually
+    // fast enough for everything to fit
+    OutputFile file;
+    if (!openFile(file, "Replay", m_Replay.first().packet->pts)) {
+        return;
+    }
+
+    for (const QueuedItem& item : m_Replay) {
+        if (!writePacket(file, item)) {
+            break;
+        }
+    }
+
+    closeFile(file);
+}
+
+bool StreamRecorder::openFile(OutputFile& file, const QString& prefix, Sint64 startTimeMs)
+{
+    char errorstring[512];
+    int err;
+
+    file.context = nullptr;
+
+    QDir dir(Path::getRecordingDir());
+    if (!dir.mkpath(".")) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unable to create %s",
+                     qPrintable(dir.path()));
+        return false;
+    }
+
+    file.path = dir.filePath(QString("Moonlight-%1-%2.mkv")
+                             .arg(prefix, QDateTime::currentDateTime().toString("yyyyMMdd-HHmmss-zzz")));
+
+    // Matroska is still playable if we don't get to finish it,
+    // unlike MP4 without its index
+    AVFormatContext* context = nullptr;
+    err = avformat_alloc_output_context2(&context, nullptr, "matroska", file.path.toUtf8().constData());
+    if (err < 0) {
+        av_strerror(err, errorstring, sizeof(errorstring));
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "avformat_alloc_output_context2() failed: %s",
+                     errorstring);
+        return false;
+    }
+
+    AVStream* video = avformat_new_stream(context, nullptr);
+    if (video == nullptr) {
+        avformat_free_context(context);
+        return false;
+    }
+
+    video->time_base = AVRational { 1, 1000 };
+    video->avg_frame_rate = AVRational { m_FrameRate, 1 };
+    video->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
+    video->codecpar->codec_id = (m_VideoFormat & VIDEO_FORMAT_MASK_H265) ? AV_CODEC_ID_HEVC : AV_CODEC_ID_H264;
+    video->codecpar->width = m_Width;
+    video->codecpar->height = m_Height;
+
+    // The muxer converts Annex B parameter sets to what Matroska stores
+    video->codecpar->extradata = (uint8_t*)av_mallocz(m_ParameterSets.size() + AV_INPUT_BUFFER_PADDING_SIZE);
+    if (video->codecpar->extradata == nullptr) {
+        avformat_free_context(context);
+        return false;
+    }
+    memcpy(video->codecpar->extradata, m_ParameterSets.constData(), m_ParameterSets.size());
+    video->codecpar->extradata_size = m_ParameterSets.size();
+
+    SDL_LockMutex(m_Lock);
+    OPUS_MULTISTREAM_CONFIGURATION opusConfig = m_AudioConfig;
+    bool haveAudio = m_HaveAudioConfig;
+    SDL_UnlockMutex(m_Lock);
+
+    if (haveAudio) {
+        AVStream* audio = avformat_new_stream(context, nullptr);
+        if (audio == nullptr) {
+            avformat_free_context(context);
+            return false;
+        }
+
+        audio->time_base = AVRational { 1, 1000 };
+        audio->codecpar->codec_type = AVMEDIA_TYPE_AUDIO;
+        audio->codecpar->codec_id = AV_CODEC_ID_OPUS;
+        audio->codecpar->sample_rate = opusConfig.sampleRate;
+#if LIBAVUTIL_VERSION_INT >= AV_VERSION_INT(57, 28, 100)
+        av_channel_layout_default(&audio->codecpar->ch_layout, opusConfig.channelCount);
+#else
+        audio->codecpar->channels = opusConfig.channelCount;
+        audio->codecpar->channel_layout = av_get_default_channel_layout(opusConfig.channelCount);
+#endif
+
+        // The OpusHead that describes the stream, as in RFC 7845
+        QByteArray opusHead("OpusHead", 8);
+        bool multistream = opusConfig.channelCount > 2 || opusConfig.streams > 1;
+        opusHead.append((char)1);
+        opusHead.append((char)opusConfig.channelCount);
+        opusHead.append(2, (char)0);
+        opusHead.append((char)(opusConfig.sampleRate & 0xFF));
+        opusHead.append((char)((opusConfig.sampleRate >> 8) & 0xFF));
+        opusHead.append((char)((opusConfig.sampleRate >> 16) & 0xFF));
+        opusHead.append((char)((opusConfig.sampleRate >> 24) & 0xFF));
+        opusHead.append(2, (char)0);
+        opusHead.append((char)(multistream ? 1 : 0));
+        if (multistream) {
+            // We get channels in the Windows order, but players expect
+            // Vorbis order for mapping family 1
+            static const int k_VorbisOrder51[] = { 0, 2, 1, 4, 5, 3 };
+            static const int k_VorbisOrder71[] = { 0, 2, 1, 6, 7, 4, 5, 3 };
+
+            opusHead.append((char)opusConfig.streams);
+            opusHead.append((char)opusConfig.coupledStreams);
+            for (int i = 0; i < opusConfig.channelCount; i++) {
+                int channel = i;
+                if (opusConfig.channelCount == 6) {
+                    channel = k_VorbisOrder51[i];
+                }
+                else if (opusConfig.channelCount == 8) {
+                    channel = k_VorbisOrder71[i];
+                }
+                opusHead.append((char)opusConfig.mapping[channel]);
+            }
+        }
+
+        audio->codecpar->extradata = (uint8_t*)av_mallocz(opusHead.size() + AV_INPUT_BUFFER_PADDING_SIZE);
+        if (audio->codecpar->extradata == nullptr) {
+            avformat_free_context(context);
+            return false;
+        }
+        memcpy(audio->codecpar->extradata, opusHead.constData(), opusHead.size());
+        audio->codecpar->extradata_size = opusHead.size();
+    }
+
+    err = avio_open(&context->pb, file.path.toUtf8().constData(), AVIO_FLAG_WRITE);
+    if (err < 0) {
+        av_strerror(err, errorstring, sizeof(errorstring));
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unable to open %s: %s",
+                     qPrintable(file.path),
+                     errorstring);
+        avformat_free_context(context);
+        return false;
+    }
+
+    err = avformat_write_header(context, nullptr);
+    if (err < 0) {
+        av_strerror(err, errorstring, sizeof(errorstring));
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "avformat_write_header() failed: %s",
+                     errorstring);
+        avio_closep(&context->pb);
+        avformat_free_context(context);
+        return false;
+    }
+
+    file.context = context;
+    file.startTimeMs = startTimeMs;
+    file.lastTimeMs[VIDEO_STREAM_INDEX] = -1;
+    file.lastTimeMs[AUDIO_STREAM_INDEX] = -1;
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Writing %s",
+                qPrintable(file.path));
+    return true;
+}
+
+bool StreamRecorder::writePacket(OutputFile& file, const QueuedItem& item)
+{
+    int streamIndex = item.packet->stream_index;
+
+    // There's no audio stream when audio didn't start
+    if (streamIndex >= (int)file.context->nb_streams) {
+        return true;
+    }
+
+    // Audio that arrived just before the first key frame is left out
+    Sint64 timeMs = item.packet->pts - file.startTimeMs;
+    if (timeMs < 0) {
+        return true;
+    }
+
+    // Packets are stamped when they arrive, which can be in the same
+    // millisecond as the one before
+    if (timeMs <= file.lastTimeMs[streamIndex]) {
+        timeMs = file.lastTimeMs[streamIndex] + 1;
+    }
+    file.lastTimeMs[streamIndex] = timeMs;
+
+    AVPacket* packet = av_packet_clone(item.packet);
+    if (packet == nullptr) {
+        return false;
+    }
+
+    packet->pts = packet->dts = timeMs;
+    av_packet_rescale_ts(packet, AVRational { 1, 1000 }, file.context->streams[streamIndex]->time_base);
+
+    int err = av_interleaved_write_frame(file.context, packet);
+    av_packet_free(&packet);
+    if (err < 0) {
+        char errorstring[512];
+        av_strerror(err, errorstring, sizeof(errorstring));
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unable to write to %s: %s",
+                     qPrintable(file.path),
+                     errorstring);
+        return false;
+    }
+
+    return true;
+}
+
+void StreamRecorder::closeFile(OutputFile& file)
+{
+    if (file.context == nullptr) {
+        return;
+    }
+
+    av_write_trailer(file.context);
+    avio_closep(&file.context->pb);
+    avformat_free_context(file.context);
+    file.context = nullptr;
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Saved %s",
+                qPrintable(file.path));
+}
+
+int StreamRecorder::writerThreadProc(void* context)
+{
+    StreamRecorder* me = (StreamRecorder*)context;
+
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_LOW);
+
+    SDL_LockMutex(me->m_Lock);
+    for (;;) {
+        while (me->m_Queue.isEmpty() && !me->m_ToggleRecordingRequested &&
+               !me->m_SaveReplayRequested && !me->m_Stopping) {
+            SDL_CondWait(me->m_Cond, me->m_Lock);
+        }
+
+        if (me->m_ToggleRecordingRequested) {
+            me->m_ToggleRecordingRequested = false;
+            SDL_UnlockMutex(me->m_Lock);
+            me->handleToggleRecording();
+            SDL_LockMutex(me->m_Lock);
+        }
+        else if (me->m_SaveReplayRequested) {
+            me->m_SaveReplayRequested = false;
+            SDL_UnlockMutex(me->m_Lock);
+            me->handleSaveReplay();
+            SDL_LockMutex(me->m_Lock);
+        }
+        else if (!me->m_Queue.isEmpty()) {
+            QueuedItem item = me->m_Queue.dequeue();
+            if (item.packet != nullptr) {
+                me->m_QueuedBytes -= item.packet->size;
+            }
+            SDL_UnlockMutex(me->m_Lock);
+            me->handleItem(item);
+            SDL_LockMutex(me->m_Lock);
+        }
+        else {
+            // Only stop once everything queued has been written
+            break;
+        }
+    }
+    SDL_UnlockMutex(me->m_Lock);
+
+    me->closeFile(me->m_Recording);
+    me->clearReplay();
+    return 0;
+}
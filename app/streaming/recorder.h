@@ -0,0 +1,134 @@
+#pragma once
+
+#include <Limelight.h>
+#include <SDL.h>
+
+#include <QByteArray>
+#include <QQueue>
+#include <QString>
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+// Saves the stream to Matroska files just as the host encoded it, so
+// recording costs a copy of each packet and no decoding or encoding.
+//
+// The streaming threads only copy packets into a bounded queue, and a
+// writer thread muxes them. If the disk can't keep up, packets are dropped
+// rather than stalling the streaming threads, and video picks up again at
+// the next key frame.
+//
+// Besides recording from when it's asked to, the writer thread can keep
+// the last few seconds of the stream in memory, starting at a key frame,
+// so what just happened can be saved after the fact. Hosts only send key
+// frames when asked, so one is requested whenever the newest one is older
+// than the replay length.
+class StreamRecorder
+{
+public:
+    // replayBufferSecs of 0 keeps no replay
+    explicit StreamRecorder(int replayBufferSecs);
+
+    // Finishes any recording in progress
+    ~StreamRecorder();
+
+    bool start();
+
+    void setVideoFormat(int videoFormat, int width, int height, int frameRate);
+    void setAudioConfig(const OPUS_MULTISTREAM_CONFIGURATION* opusConfig);
+
+    void writeVideo(PDECODE_UNIT du);
+    void writeAudio(const char* data, int length);
+
+    // Returns true once for each key frame the recorder needs
+    bool takeKeyFrameRequest();
+
+    // These can be called from any thread. The work is done on the
+    // writer thread.
+    void toggleRecording();
+    void saveReplay();
+
+private:
+    enum ItemType {
+        ItemVideo,
+        ItemAudio,
+        ItemVideoFormat
+    };
+
+    struct QueuedItem
+    {
+        ItemType type;
+        AVPacket* packet;
+        bool keyFrame;
+
+        // The SPS, PPS and VPS sent with a key frame
+        QByteArray parameterSets;
+
+        // For ItemVideoFormat
+        int videoFormat;
+        int width;
+        int height;
+        int frameRate;
+    };
+
+    struct OutputFile
+    {
+        QString path;
+        AVFormatContext* context;
+        Sint64 startTimeMs;
+        Sint64 lastTimeMs[2];
+    };
+
+    bool enqueue(const QueuedItem& item);
+    void freeItem(QueuedItem& item);
+
+    void handleItem(QueuedItem& item);
+    void handleToggleRecording();
+    void handleSaveReplay();
+    void trimReplay();
+    void requestKeyFrameIfNeeded(Sint64 nowMs);
+    void clearReplay();
+    void updateActive();
+
+    bool openFile(OutputFile& file, const QString& prefix, Sint64 startTimeMs);
+    bool writePacket(OutputFile& file, const QueuedItem& item);
+    void closeFile(OutputFile& file);
+
+    static int writerThreadProc(void* context);
+
+    int m_ReplayBufferMs;
+    SDL_Thread* m_Thread;
+
+    // Set when the streaming threads have something to queue
+    SDL_atomic_t m_Active;
+    SDL_atomic_t m_KeyFrameRequested;
+
+    // Shared between the streaming threads and the writer thread
+    SDL_mutex* m_Lock;
+    SDL_cond* m_Cond;
+    bool m_Stopping;
+    bool m_ToggleRecordingRequested;
+    bool m_SaveReplayRequested;
+    QQueue<QueuedItem> m_Queue;
+    int m_QueuedBytes;
+    Uint32 m_DroppedPackets;
+    OPUS_MULTISTREAM_CONFIGURATION m_AudioConfig;
+    bool m_HaveAudioConfig;
+
+    // Only touched by the decoder thread
+    bool m_VideoNeedsKeyFrame;
+
+    // Only touched by the writer thread
+    int m_VideoFormat;
+    int m_Width;
+    int m_Height;
+    int m_FrameRate;
+    QByteArray m_ParameterSets;
+    QQueue<QueuedItem> m_Replay;
+    QQueue<Sint64> m_ReplayKeyFrameTimes;
+    qint64 m_ReplayBytes;
+    Sint64 m_LastKeyFrameRequestMs;
+    OutputFile m_Recording;
+    bool m_RecordingPending;
+};
@@ -0,0 +1,64 @@
+#include "scriptedinput.h"
+
+#include <Limelight.h>
+
+// Pixels moved by each event and events along each side of the square
+#define SCRIPTED_INPUT_STEP_PIXELS 4
+#define SCRIPTED_INPUT_SIDE_STEPS 16
+
+#define SCRIPTED_INPUT_MAX_EVENTS_PER_SECOND 1000
+
+SDL_TimerID ScriptedInput::s_Timer;
+SDL_atomic_t ScriptedInput::s_EventsSent;
+int ScriptedInput::s_Step;
+
+void ScriptedInput::start(int eventsPerSecond)
+{
+    SDL_assert(s_Timer == 0);
+
+    SDL_AtomicSet(&s_EventsSent, 0);
+    s_Step = 0;
+
+    if (eventsPerSecond <= 0) {
+        return;
+    }
+
+    Uint32 intervalMs = 1000 / SDL_min(eventsPerSecond, SCRIPTED_INPUT_MAX_EVENTS_PER_SECOND);
+    s_Timer = SDL_AddTimer(intervalMs, sendInputTimerCallback, nullptr);
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Sending scripted mouse motion every %u ms",
+                intervalMs);
+}
+
+void ScriptedInput::stop()
+{
+    if (s_Timer == 0) {
+        return;
+    }
+
+    SDL_RemoveTimer(s_Timer);
+    s_Timer = 0;
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Sent %d scripted input events",
+                SDL_AtomicGet(&s_EventsSent));
+}
+
+Uint32 ScriptedInput::sendInputTimerCallback(Uint32 interval, void*)
+{
+    // Right, down, left and then up again
+    static const short k_Directions[4][2] = {
+        { 1, 0 }, { 0, 1 }, { -1, 0 }, { 0, -1 }
+    };
+
+    int side = (s_Step / SCRIPTED_INPUT_SIDE_STEPS) % 4;
+    s_Step = (s_Step + 1) % (4 * SCRIPTED_INPUT_SIDE_STEPS);
+
+    if (LiSendMouseMoveEvent(k_Directions[side][0] * SCRIPTED_INPUT_STEP_PIXELS,
+                             k_Directions[side][1] * SCRIPTED_INPUT_STEP_PIXELS) == 0) {
+        SDL_AtomicIncRef(&s_EventsSent);
+    }
+
+    return interval;
+}
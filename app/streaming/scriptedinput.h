@@ -0,0 +1,31 @@
+#pragma once
+
+#include <SDL.h>
+
+// Sends mouse motion to the host in place of a user during headless
+// streams, so the input path is loaded like it would be in a game. The
+// cursor traces a small square and ends up where it started, and nothing
+// is ever clicked or typed on the host.
+class ScriptedInput
+{
+public:
+    // Does nothing if eventsPerSecond is 0
+    static void start(int eventsPerSecond);
+
+    static void stop();
+
+    // Events the host accepted since the stream started
+    static int getEventsSent()
+    {
+        return SDL_AtomicGet(&s_EventsSent);
+    }
+
+private:
+    static Uint32 sendInputTimerCallback(Uint32 interval, void* param);
+
+    static SDL_TimerID s_Timer;
+    static SDL_atomic_t s_EventsSent;
+
+    // Owned by the timer
+    static int s_Step;
+};
@@ -2,19 +2,50 @@
 #include "settings/streamingpreferences.h"
 #include "streaming/streamutils.h"
 #include "backend/richpresencemanager.h"
+#include "backend/boxartmanager.h"
 
 #include <Limelight.h>
 #include <SDL.h>
 #include "utils.h"
+#include "video/decodercache.h"
+#include "video/frametracer.h"
+#include "metricsexporter.h"
+#include "sessionhistory.h"
+#include "maintenancethread.h"
+#include "bitratecontroller.h"
+#include "decodeoverloaddetector.h"
+#include "gpuusage.h"
+#include "avsyncclock.h"
+#include "threadplacement.h"
+#include "latencyprobe.h"
+#include "scriptedinput.h"
+#include "capturefile.h"
+#ifdef HAVE_AVFORMAT
+#include "recorder.h"
+#endif
+#include "pathmtu.h"
+#include "path.h"
+#include "video/nullvid.h"
 
 #ifdef HAVE_FFMPEG
 #include "video/ffmpeg.h"
+#include "video/bitstreamanalytics.h"
+#include "video/framegraph.h"
+#include "video/hwdevicecache.h"
 #endif
 
 #ifdef HAVE_SLVIDEO
 #include "video/slvid.h"
 #endif
 
+#ifdef HAVE_MMAL
+#include "video/mmalvid.h"
+#endif
+
+#ifdef Q_OS_DARWIN
+#include "video/vtvid.h"
+#endif
+
 #ifdef Q_OS_WIN32
 // Scaling the icon down on Win32 looks dreadful, so render at lower res
 #define ICON_SIZE 32
@@ -22,18 +53,49 @@
 #define ICON_SIZE 64
 #endif
 
+// Stay this far below the panel's maximum refresh rate in VRR mode
+// so frames never arrive faster than the display can follow them.
+#define VRR_FPS_CAP_MARGIN 3
+
+// Longest time the event-driven main loop sleeps without any events
+#define MAIN_LOOP_IDLE_TIMEOUT_MS 50
+#define MAIN_LOOP_POWER_SAVING_IDLE_TIMEOUT_MS 250
+
+// How long the polling main loop sleeps between polls in power saving mode
+#define MAIN_LOOP_POWER_SAVING_POLL_INTERVAL_MS 4
+
+// How long SDL video and the decoder device stay open after a session
+// ends, so switching to another app doesn't have to open them again
+#define RELAUNCH_GRACE_PERIOD_MS 60000
+
+// Video the socket receive buffer should be able to hold while the
+// receive thread is descheduled, so a stall doesn't turn into loss
+#define RECEIVE_BUFFER_TARGET_MS 50
+
 #include <openssl/rand.h>
 
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#endif
+
 #include <QtEndian>
 #include <QCoreApplication>
+#include <QGuiApplication>
+#include <QQuickWindow>
+#include <QThread>
 #include <QThreadPool>
+#include <QTimer>
 #include <QSvgRenderer>
 #include <QPainter>
 #include <QImage>
+#include <QDir>
+#include <QFile>
+#include <QDateTime>
+#include <QJsonObject>
 
 CONNECTION_LISTENER_CALLBACKS Session::k_ConnCallbacks = {
     Session::clStageStarting,
-    nullptr,
+    Session::clStageComplete,
     Session::clStageFailed,
     nullptr,
     Session::clConnectionTerminated,
@@ -46,23 +108,39 @@ CONNECTION_LISTENER_CALLBACKS Session::k_ConnCallbacks = {
 
 Session* Session::s_ActiveSession;
 QSemaphore Session::s_ActiveSessionSemaphore(1);
+bool Session::s_VideoKeptWarm;
+unsigned int Session::s_VideoWarmGeneration;
+SDL_Window* Session::s_PreparedTestWindow;
+bool Session::s_Headless;
+bool Session::s_HeadlessDiscardVideo;
+int Session::s_HeadlessInputRate;
 
 void Session::clStageStarting(int stage)
 {
-    // We know this is called on the same thread as LiStartConnection()
-    // which happens to be the main thread, so it's cool to interact
-    // with the GUI in these callbacks.
+    // The initial connection is made on a worker thread, so the UI gets
+    // this signal queued. Stream restarts connect from the main thread,
+    // so the UI must be pumped for it to see the new stage.
     emit s_ActiveSession->stageStarting(QString::fromLocal8Bit(LiGetStageName(stage)));
-    QCoreApplication::processEvents(QEventLoop::ExcludeUserInputEvents);
+    if (QThread::currentThread() == QCoreApplication::instance()->thread()) {
+        QCoreApplication::processEvents(QEventLoop::ExcludeUserInputEvents);
+    }
+}
+
+void Session::clStageComplete(int stage)
+{
+    s_ActiveSession->logStartupStage(LiGetStageName(stage));
 }
 
 void Session::clStageFailed(int stage, long errorCode)
 {
-    // We know this is called on the same thread as LiStartConnection()
-    // which happens to be the main thread, so it's cool to interact
-    // with the GUI in these callbacks.
+    QByteArray stageName = QString("%1 (failed)").arg(LiGetStageName(stage)).toUtf8();
+    s_ActiveSession->logStartupStage(stageName.constData());
+
+    // See clStageStarting() for which thread this is called on
     emit s_ActiveSession->stageFailed(QString::fromLocal8Bit(LiGetStageName(stage)), errorCode);
-    QCoreApplication::processEvents(QEventLoop::ExcludeUserInputEvents);
+    if (QThread::currentThread() == QCoreApplication::instance()->thread()) {
+        QCoreApplication::processEvents(QEventLoop::ExcludeUserInputEvents);
+    }
 }
 
 void Session::clConnectionTerminated(long errorCode)
@@ -113,6 +191,9 @@ void Session::clConnectionStatusUpdate(int connectionStatus)
                 "Connection status update: %d",
                 connectionStatus);
 
+    MetricsExporter::setConnectionStatus(connectionStatus);
+    BitrateController::setConnectionStatus(connectionStatus);
+
     if (!s_ActiveSession->m_Preferences->connectionWarnings) {
         return;
     }
@@ -125,13 +206,13 @@ void Session::clConnectionStatusUpdate(int connectionStatus)
     switch (connectionStatus)
     {
     case CONN_STATUS_POOR:
-        if (s_ActiveSession->m_StreamConfig.bitrate > 5000) {
-            strcpy(s_ActiveSession->m_OverlayManager.getOverlayText(Overlay::OverlayStatusUpdate), "Slow connection to PC\nReduce your bitrate");
+        // There's no point suggesting a lower bitrate if we're picking it
+        if (s_ActiveSession->m_StreamConfig.bitrate > 5000 && !BitrateController::isActive()) {
+            s_ActiveSession->m_OverlayManager.updateOverlayText(Overlay::OverlayStatusUpdate, "Slow connection to PC\nReduce your bitrate");
         }
         else {
-            strcpy(s_ActiveSession->m_OverlayManager.getOverlayText(Overlay::OverlayStatusUpdate), "Poor connection to PC");
+            s_ActiveSession->m_OverlayManager.updateOverlayText(Overlay::OverlayStatusUpdate, "Poor connection to PC");
         }
-        s_ActiveSession->m_OverlayManager.setOverlayTextUpdated(Overlay::OverlayStatusUpdate);
         s_ActiveSession->m_OverlayManager.setOverlayState(Overlay::OverlayStatusUpdate, true);
         break;
     case CONN_STATUS_OKAY:
@@ -142,7 +223,10 @@ void Session::clConnectionStatusUpdate(int connectionStatus)
 
 bool Session::chooseDecoder(StreamingPreferences::VideoDecoderSelection vds,
                             SDL_Window* window, int videoFormat, int width, int height,
-                            int frameRate, bool enableVsync, bool enableFramePacing, bool testOnly, IVideoDecoder*& chosenDecoder)
+                            int frameRate, bool enableVsync, bool enableFramePacing,
+                            StreamingPreferences::PacingMode pacingMode, bool enableVrr,
+                            bool enableSharpening, bool enableErrorConcealment,
+                            bool testOnly, IVideoDecoder*& chosenDecoder)
 {
     DECODER_PARAMETERS params;
 
@@ -153,11 +237,30 @@ bool Session::chooseDecoder(StreamingPreferences::VideoDecoderSelection vds,
     params.window = window;
     params.enableVsync = enableVsync;
     params.enableFramePacing = enableFramePacing;
+    params.pacingMode = pacingMode;
+    params.enableVrr = enableVrr;
+    params.enableSharpening = enableSharpening;
+    params.enableErrorConcealment = enableErrorConcealment;
     params.vds = vds;
 
     SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
-                "V-sync %s",
-                enableVsync ? "enabled" : "disabled");
+                "V-sync %s%s",
+                enableVsync ? "enabled" : "disabled",
+                enableVrr ? " (VRR)" : "");
+
+    // Video that's only being counted doesn't need a real decoder
+    if (s_Headless && s_HeadlessDiscardVideo) {
+        chosenDecoder = new NullVideoDecoder(testOnly);
+        if (chosenDecoder->initialize(&params)) {
+            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                        "Null video decoder chosen");
+            return true;
+        }
+        else {
+            delete chosenDecoder;
+            chosenDecoder = nullptr;
+        }
+    }
 
 #ifdef HAVE_SLVIDEO
     chosenDecoder = new SLVideoDecoder(testOnly);
@@ -174,6 +277,36 @@ bool Session::chooseDecoder(StreamingPreferences::VideoDecoderSelection vds,
     }
 #endif
 
+#ifdef HAVE_MMAL
+    chosenDecoder = new MmalVideoDecoder(testOnly);
+    if (chosenDecoder->initialize(&params)) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "MMAL video decoder chosen");
+        return true;
+    }
+    else {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unable to load MMAL decoder");
+        delete chosenDecoder;
+        chosenDecoder = nullptr;
+    }
+#endif
+
+#ifdef Q_OS_DARWIN
+    chosenDecoder = VTVideoDecoderFactory::createDecoder(testOnly);
+    if (chosenDecoder != nullptr) {
+        if (chosenDecoder->initialize(&params)) {
+            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                        "Native VideoToolbox video decoder chosen");
+            return true;
+        }
+        else {
+            delete chosenDecoder;
+            chosenDecoder = nullptr;
+        }
+    }
+#endif
+
 #ifdef HAVE_FFMPEG
     chosenDecoder = new FFmpegVideoDecoder(testOnly);
     if (chosenDecoder->initialize(&params)) {
@@ -189,7 +322,7 @@ bool Session::chooseDecoder(StreamingPreferences::VideoDecoderSelection vds,
     }
 #endif
 
-#if !defined(HAVE_FFMPEG) && !defined(HAVE_SLVIDEO)
+#if !defined(HAVE_FFMPEG) && !defined(HAVE_SLVIDEO) && !defined(HAVE_MMAL)
 #error No video decoding libraries available!
 #endif
 
@@ -199,6 +332,33 @@ bool Session::chooseDecoder(StreamingPreferences::VideoDecoderSelection vds,
 
 int Session::drSetup(int videoFormat, int width, int height, int frameRate, void *, int)
 {
+    if (s_ActiveSession->m_CaptureWriter != nullptr) {
+        s_ActiveSession->m_CaptureWriter->setVideoFormat(videoFormat, width, height, frameRate);
+    }
+#ifdef HAVE_AVFORMAT
+    if (s_ActiveSession->m_Recorder != nullptr) {
+        s_ActiveSession->m_Recorder->setVideoFormat(videoFormat, width, height, frameRate);
+    }
+#endif
+
+    // A decoder only exists here when the stream is being restarted. We're
+    // called on the same thread as LiStartConnection(), which is the main
+    // thread, so a decoder that can't handle the new format can be destroyed
+    // now. The main loop creates its replacement with the device kept.
+    if (s_ActiveSession->m_VideoDecoder != nullptr &&
+            (videoFormat != s_ActiveSession->m_ActiveVideoFormat ||
+             width != s_ActiveSession->m_ActiveVideoWidth ||
+             height != s_ActiveSession->m_ActiveVideoHeight ||
+             frameRate != s_ActiveSession->m_ActiveVideoFrameRate)) {
+#ifdef HAVE_FFMPEG
+        HwDeviceCache::enable();
+#endif
+        SDL_AtomicLock(&s_ActiveSession->m_DecoderLock);
+        delete s_ActiveSession->m_VideoDecoder;
+        s_ActiveSession->m_VideoDecoder = nullptr;
+        SDL_AtomicUnlock(&s_ActiveSession->m_DecoderLock);
+    }
+
     s_ActiveSession->m_ActiveVideoFormat = videoFormat;
     s_ActiveSession->m_ActiveVideoWidth = width;
     s_ActiveSession->m_ActiveVideoHeight = height;
@@ -224,6 +384,29 @@ int Session::drSubmitDecodeUnit(PDECODE_UNIT du)
     // safely return DR_OK and wait for m_NeedsIdr to be set by
     // the decoder reinitialization code.
 
+    // Capture every frame the host sent, even ones our decoder won't see
+    if (s_ActiveSession->m_CaptureWriter != nullptr) {
+        s_ActiveSession->m_CaptureWriter->writeVideo(du);
+    }
+#ifdef HAVE_AVFORMAT
+    if (s_ActiveSession->m_Recorder != nullptr) {
+        s_ActiveSession->m_Recorder->writeVideo(du);
+    }
+#endif
+
+    // The decoder thread belongs to the connection, so it's placed the
+    // first time it delivers a frame. A restarted connection brings a new one.
+    if (s_ActiveSession->m_DecodeThreadId != SDL_ThreadID()) {
+        s_ActiveSession->m_DecodeThreadId = SDL_ThreadID();
+        ThreadPlacement::applyToCurrentThread(ThreadPlacement::TR_DECODE);
+    }
+
+    // Nobody can see the picture, so don't spend GPU time and battery on it.
+    // Without a reference chain to keep up, the frames are just dropped.
+    if (SDL_AtomicGet(&s_ActiveSession->m_WindowHidden)) {
+        return DR_OK;
+    }
+
     if (SDL_AtomicTryLock(&s_ActiveSession->m_DecoderLock)) {
         if (s_ActiveSession->m_NeedsIdr) {
             // If we reset our decoder, we'll need to request an IDR frame
@@ -236,6 +419,15 @@ int Session::drSubmitDecodeUnit(PDECODE_UNIT du)
         if (decoder != nullptr) {
             int ret = decoder->submitDecodeUnit(du);
             SDL_AtomicUnlock(&s_ActiveSession->m_DecoderLock);
+
+#ifdef HAVE_AVFORMAT
+            // Recordings and replays can only start at a key frame
+            if (ret == DR_OK && s_ActiveSession->m_Recorder != nullptr &&
+                    s_ActiveSession->m_Recorder->takeKeyFrameRequest()) {
+                ret = DR_NEED_IDR;
+            }
+#endif
+
             return ret;
         }
         else {
@@ -250,38 +442,66 @@ int Session::drSubmitDecodeUnit(PDECODE_UNIT du)
     }
 }
 
-bool Session::isHardwareDecodeAvailable(SDL_Window* window,
-                                        StreamingPreferences::VideoDecoderSelection vds,
-                                        int videoFormat, int width, int height, int frameRate)
+bool Session::probeDecoder(SDL_Window* window,
+                           StreamingPreferences::VideoDecoderSelection vds,
+                           int videoFormat, int width, int height, int frameRate,
+                           bool& isHardwareAccelerated, int& decoderCapabilities)
 {
+    // Use the cached result from a previous launch if we have one. Headless
+    // streams don't probe the real display, so they leave the cache alone.
+    if (!s_Headless &&
+            DecoderCapabilityCache::lookup(vds, videoFormat, width, height, frameRate,
+                                           isHardwareAccelerated, decoderCapabilities)) {
+        return true;
+    }
+
     IVideoDecoder* decoder;
 
-    if (!chooseDecoder(vds, window, videoFormat, width, height, frameRate, true, false, true, decoder)) {
+    if (!chooseDecoder(vds, window, videoFormat, width, height, frameRate,
+                       true, false, StreamingPreferences::PM_BALANCED, false, false, false, true, decoder)) {
         return false;
     }
 
-    bool ret = decoder->isHardwareAccelerated();
+    isHardwareAccelerated = decoder->isHardwareAccelerated();
+    decoderCapabilities = decoder->getDecoderCapabilities();
 
     delete decoder;
 
-    return ret;
+    if (!s_Headless) {
+        DecoderCapabilityCache::store(vds, videoFormat, width, height, frameRate,
+                                      isHardwareAccelerated, decoderCapabilities);
+    }
+    return true;
+}
+
+bool Session::isHardwareDecodeAvailable(SDL_Window* window,
+                                        StreamingPreferences::VideoDecoderSelection vds,
+                                        int videoFormat, int width, int height, int frameRate)
+{
+    bool isHardwareAccelerated;
+    int decoderCapabilities;
+
+    if (!probeDecoder(window, vds, videoFormat, width, height, frameRate,
+                      isHardwareAccelerated, decoderCapabilities)) {
+        return false;
+    }
+
+    return isHardwareAccelerated;
 }
 
 int Session::getDecoderCapabilities(SDL_Window* window,
                                     StreamingPreferences::VideoDecoderSelection vds,
                                     int videoFormat, int width, int height, int frameRate)
 {
-    IVideoDecoder* decoder;
+    bool isHardwareAccelerated;
+    int decoderCapabilities;
 
-    if (!chooseDecoder(vds, window, videoFormat, width, height, frameRate, true, false, true, decoder)) {
+    if (!probeDecoder(window, vds, videoFormat, width, height, frameRate,
+                      isHardwareAccelerated, decoderCapabilities)) {
         return false;
     }
 
-    int caps = decoder->getDecoderCapabilities();
-
-    delete decoder;
-
-    return caps;
+    return decoderCapabilities;
 }
 
 Session::Session(NvComputer* computer, NvApp& app, StreamingPreferences *preferences)
@@ -292,6 +512,7 @@ Session::Session(NvComputer* computer, NvApp& app, StreamingPreferences *prefere
       m_VideoDecoder(nullptr),
       m_DecoderLock(0),
       m_NeedsIdr(false),
+      m_DecodeThreadId(0),
       m_AudioDisabled(false),
       m_DisplayOriginX(0),
       m_DisplayOriginY(0),
@@ -300,11 +521,43 @@ Session::Session(NvComputer* computer, NvApp& app, StreamingPreferences *prefere
       m_InputHandler(nullptr),
       m_InputHandlerLock(0),
       m_MouseEmulationRefCount(0),
-      m_OpusDecoder(nullptr),
+      m_VrrActive(false),
+      m_PowerSaving(false),
+      m_CaptureWriter(nullptr),
+      m_Recorder(nullptr),
+      m_ConnectionResult(0),
+      m_StartupTimeUs(0),
+      m_StartupStageTimeUs(0),
+      m_StartupProfileLock(0),
       m_AudioRenderer(nullptr),
       m_AudioSampleCount(0),
-      m_DropAudioEndTime(0)
+      m_AudioReinitSampleCount(0),
+      m_AudioDecoderThread(nullptr),
+      m_AudioReinitThread(nullptr),
+      m_PendingAudioRenderer(nullptr),
+      m_AudioLossPending(false),
+      m_AudioLastArrivalUs(0),
+      m_AudioPacketsSinceArrival(0),
+      m_AudioJitterUs(0),
+      m_AudioStatsLock(0),
+      m_InputStatsLock(0),
+      m_RestartingStream(false),
+      m_RestartPending(false),
+      m_RestartWidth(0),
+      m_RestartHeight(0),
+      m_RestartBitrateKbps(0),
+      m_RestartLock(0),
+      m_HaveFinalVideoStats(false),
+      m_StreamDurationMs(0)
 {
+    SDL_zero(m_FinalVideoStats);
+    SDL_zero(m_AudioStats);
+    SDL_zero(m_InputStats);
+    SDL_AtomicSet(&m_AudioDecoderStopping, 0);
+    SDL_AtomicSet(&m_AudioReinitDone, 0);
+    SDL_AtomicSet(&m_LaunchComplete, 0);
+    SDL_AtomicSet(&m_ConnectionComplete, 0);
+    SDL_AtomicSet(&m_WindowHidden, 0);
 }
 
 // NB: This may not get destroyed for a long time! Don't put any vital cleanup here.
@@ -317,6 +570,254 @@ Session::~Session()
     s_ActiveSessionSemaphore.release();
 }
 
+void Session::releaseProbedDevices()
+{
+#ifdef HAVE_FFMPEG
+    HwDeviceCache::clear();
+#endif
+}
+
+void Session::keepVideoWarm()
+{
+    // Our SDL video reference and the devices in the cache are handed
+    // over to the next session if it starts soon enough. Calling this
+    // again while they're held restarts the grace period.
+    s_VideoKeptWarm = true;
+    unsigned int generation = ++s_VideoWarmGeneration;
+
+    QTimer::singleShot(RELAUNCH_GRACE_PERIOD_MS, [generation]() {
+        if (generation == s_VideoWarmGeneration) {
+            releaseWarmVideo();
+        }
+    });
+}
+
+void Session::releaseWarmVideo()
+{
+    if (!s_VideoKeptWarm) {
+        return;
+    }
+
+    s_VideoKeptWarm = false;
+    s_VideoWarmGeneration++;
+
+    releaseProbedDevices();
+    if (s_PreparedTestWindow != nullptr) {
+        SDL_DestroyWindow(s_PreparedTestWindow);
+        s_PreparedTestWindow = nullptr;
+    }
+    SDL_QuitSubSystem(SDL_INIT_VIDEO);
+}
+
+void Session::prepareLaunch(NvComputer* computer)
+{
+    Q_ASSERT(QThread::currentThread() == QCoreApplication::instance()->thread());
+
+    // Headless streams don't use any of this, and a running session
+    // already has it all open
+    if (s_Headless || s_ActiveSession != nullptr) {
+        return;
+    }
+
+    // Resume a TLS session with the host now, so the launch request only
+    // needs an abbreviated handshake. GFE won't take a connection that's
+    // been opened ahead of time, so the session ticket is what we keep.
+    if (!computer->serverCert.isNull()) {
+        NvHTTP http(computer->activeAddress, computer->serverCert);
+        http.getServerInfoAsync(NvHTTP::NvLogLevel::NVLL_NONE);
+    }
+
+    if (!s_VideoKeptWarm) {
+        if (SDL_InitSubSystem(SDL_INIT_VIDEO) != 0) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "SDL_InitSubSystem(SDL_INIT_VIDEO) failed: %s",
+                        SDL_GetError());
+            return;
+        }
+
+        StreamUtils::invalidateDisplayModeCache();
+#ifdef HAVE_FFMPEG
+        HwDeviceCache::enable();
+#endif
+    }
+
+    // Taking our reference before anything can fail means a failure
+    // below is cleaned up by the usual release
+    keepVideoWarm();
+
+    // Fill the display mode cache for every display
+    for (int i = 0; i < SDL_GetNumVideoDisplays(); i++) {
+        SDL_DisplayMode mode;
+        StreamUtils::getRealDesktopMode(i, &mode);
+        StreamUtils::getDisplayMaxRefreshRate(i);
+    }
+
+    if (s_PreparedTestWindow == nullptr) {
+        s_PreparedTestWindow = SDL_CreateWindow("", 0, 0, 1280, 720,
+                                                SDL_WINDOW_HIDDEN | StreamUtils::getPlatformWindowFlags());
+        if (s_PreparedTestWindow == nullptr) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "Failed to create window for hardware decode test: %s",
+                        SDL_GetError());
+            return;
+        }
+    }
+
+    // Run the same probes initialize() will, so their results are in the
+    // decoder capability cache and the probed device is held for the stream.
+    // On a cache hit these don't create a decoder at all.
+    StreamingPreferences prefs;
+    bool hevc;
+    switch (prefs.videoCodecConfig)
+    {
+    case StreamingPreferences::VCC_AUTO:
+        hevc = isHardwareDecodeAvailable(s_PreparedTestWindow,
+                                         prefs.videoDecoderSelection,
+                                         VIDEO_FORMAT_H265,
+                                         prefs.width,
+                                         prefs.height,
+                                         prefs.fps);
+        break;
+    case StreamingPreferences::VCC_FORCE_H264:
+        hevc = false;
+        break;
+    default:
+        hevc = true;
+        break;
+    }
+
+    getDecoderCapabilities(s_PreparedTestWindow,
+                           prefs.videoDecoderSelection,
+                           hevc ? VIDEO_FORMAT_H265 : VIDEO_FORMAT_H264,
+                           prefs.width,
+                           prefs.height,
+                           prefs.fps);
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Prepared video state for a launch");
+}
+
+void Session::setHeadless(bool discardVideo, int inputRate)
+{
+    s_Headless = true;
+    s_HeadlessDiscardVideo = discardVideo;
+    s_HeadlessInputRate = inputRate;
+}
+
+bool Session::getFinalVideoStats(VIDEO_STATS& stats)
+{
+    if (!m_HaveFinalVideoStats) {
+        return false;
+    }
+
+    stats = m_FinalVideoStats;
+    return true;
+}
+
+bool Session::getVideoStats(VIDEO_STATS& stats)
+{
+    // The decoder is only ever replaced on the main thread
+    if (m_VideoDecoder != nullptr && m_VideoDecoder->getLiveVideoStats(stats)) {
+        return true;
+    }
+
+    return getFinalVideoStats(stats);
+}
+
+void Session::recordSessionHistory()
+{
+    // Streams that never got going have nothing to compare, and
+    // headless soak tests would crowd out real sessions
+    if (!m_HaveFinalVideoStats || s_Headless) {
+        return;
+    }
+
+    const VIDEO_STATS& video = m_FinalVideoStats;
+    AUDIO_STATS audio;
+    getAudioStats(audio);
+
+    const char* codec;
+    switch (m_ActiveVideoFormat) {
+    case VIDEO_FORMAT_H264:
+        codec = "H.264";
+        break;
+    case VIDEO_FORMAT_H265:
+        codec = "HEVC";
+        break;
+    case VIDEO_FORMAT_H265_MAIN10:
+        codec = "HEVC Main10";
+        break;
+    default:
+        codec = "unknown";
+        break;
+    }
+
+    QJsonObject entry;
+    entry["time"] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+    entry["version"] = VERSION_STR;
+    entry["clientFingerprint"] = m_FinalGpuFingerprint;
+    entry["host"] = m_Computer->name;
+    entry["hostGpu"] = m_Computer->gpuModel;
+    entry["codec"] = codec;
+    entry["width"] = m_ActiveVideoWidth;
+    entry["height"] = m_ActiveVideoHeight;
+    entry["fps"] = m_ActiveVideoFrameRate;
+    entry["bitrateKbps"] = m_StreamConfig.bitrate;
+    entry["decoder"] = m_FinalDecoderName;
+    entry["durationSecs"] = (int)(m_StreamDurationMs / 1000);
+
+    entry["frames"] = (qint64)video.totalFrames;
+    entry["networkDropPercent"] = video.totalFrames != 0 ?
+                (double)video.networkDroppedFrames / video.totalFrames * 100 : 0.0;
+    entry["jitterDropPercent"] = video.decodedFrames != 0 ?
+                (double)video.pacerDroppedFrames / video.decodedFrames * 100 : 0.0;
+    entry["concealedFrames"] = (qint64)video.concealedFrames;
+    entry["lossBursts"] = (qint64)video.lossBursts;
+    entry["maxLossBurst"] = (qint64)video.maxLossBurst;
+    entry["idrRequests"] = (qint64)video.idrRequests;
+
+    entry["receiveP99Ms"] = video.reassemblyTimes.getPercentileUs(99) / 1000.0;
+    entry["decodeP50Ms"] = video.decodeTimes.getPercentileUs(50) / 1000.0;
+    entry["decodeP99Ms"] = video.decodeTimes.getPercentileUs(99) / 1000.0;
+    entry["queueP99Ms"] = video.pacerTimes.getPercentileUs(99) / 1000.0;
+    entry["renderP50Ms"] = video.renderTimes.getPercentileUs(50) / 1000.0;
+    entry["renderP99Ms"] = video.renderTimes.getPercentileUs(99) / 1000.0;
+
+    entry["audioPackets"] = (qint64)(audio.receivedPackets + audio.lostPackets);
+    entry["audioLostPackets"] = (qint64)audio.lostPackets;
+    entry["audioConcealedPackets"] = (qint64)audio.concealedPackets;
+    entry["audioUnderruns"] = (qint64)audio.underruns;
+    entry["audioMaxJitterMs"] = audio.maxJitterUs / 1000.0;
+
+    SessionHistory::append(entry);
+}
+
+void Session::checkReceiveBufferLimit(int bitrateKbps)
+{
+#ifdef Q_OS_LINUX
+    // moonlight-common-c asks for a large receive buffer on the video
+    // socket, but Linux quietly caps it at net.core.rmem_max, which is
+    // only a couple hundred KB on most distros
+    QFile rmemMax("/proc/sys/net/core/rmem_max");
+    if (!rmemMax.open(QIODevice::ReadOnly)) {
+        return;
+    }
+
+    qint64 limitBytes = rmemMax.readAll().trimmed().toLongLong();
+    qint64 targetBytes = (qint64)bitrateKbps * 1000 / 8 * RECEIVE_BUFFER_TARGET_MS / 1000;
+    if (limitBytes > 0 && limitBytes < targetBytes) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Socket receive buffers are limited to %lld bytes, which holds less than %d ms of video. "
+                    "Raise net.core.rmem_max to at least %lld to avoid packet loss at this bitrate.",
+                    limitBytes,
+                    RECEIVE_BUFFER_TARGET_MS,
+                    targetBytes);
+    }
+#else
+    Q_UNUSED(bitrateKbps);
+#endif
+}
+
 bool Session::initialize()
 {
     if (SDL_InitSubSystem(SDL_INIT_VIDEO) != 0) {
@@ -326,8 +827,27 @@ bool Session::initialize()
         return false;
     }
 
-    // Create a hidden window to use for decoder initialization tests
-    SDL_Window* testWindow = SDL_CreateWindow("", 0, 0, 1280, 720, SDL_WINDOW_HIDDEN);
+    // Take over from the last session if it kept things open for us.
+    // The reference we just took on SDL video keeps it initialized.
+    if (s_VideoKeptWarm) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Reusing video state from the last session");
+        s_VideoKeptWarm = false;
+        s_VideoWarmGeneration++;
+        SDL_QuitSubSystem(SDL_INIT_VIDEO);
+    }
+    else {
+        StreamUtils::invalidateDisplayModeCache();
+    }
+
+    // Create a hidden window to use for decoder initialization tests,
+    // unless prepareLaunch() left us one
+    SDL_Window* testWindow = s_PreparedTestWindow;
+    s_PreparedTestWindow = nullptr;
+    if (testWindow == nullptr) {
+        testWindow = SDL_CreateWindow("", 0, 0, 1280, 720,
+                                      SDL_WINDOW_HIDDEN | StreamUtils::getPlatformWindowFlags());
+    }
     if (!testWindow) {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
                      "Failed to create window for hardware decode test: %s",
@@ -336,6 +856,13 @@ bool Session::initialize()
         return false;
     }
 
+    // Let the streaming decoder pick up the devices opened for these tests
+#ifdef HAVE_FFMPEG
+    HwDeviceCache::enable();
+#endif
+
+    logStartupStage("video init");
+
     qInfo() << "Server GPU:" << m_Computer->gpuModel;
     qInfo() << "Server GFE version:" << m_Computer->gfeVersion;
 
@@ -343,13 +870,6 @@ bool Session::initialize()
     m_VideoCallbacks.setup = drSetup;
     m_VideoCallbacks.submitDecodeUnit = drSubmitDecodeUnit;
 
-    // Slice up to 4 times for parallel decode, once slice per core
-    int slices = qMin(MAX_SLICES, SDL_GetCPUCount());
-    m_VideoCallbacks.capabilities |= CAPABILITY_SLICES_PER_FRAME(slices);
-    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
-                "Encoder configured for %d slices per frame",
-                slices);
-
     LiInitializeStreamConfiguration(&m_StreamConfig);
     m_StreamConfig.width = m_Preferences->width;
     m_StreamConfig.height = m_Preferences->height;
@@ -357,12 +877,42 @@ bool Session::initialize()
     m_StreamConfig.bitrate = m_Preferences->bitrateKbps;
     m_StreamConfig.hevcBitratePercentageMultiplier = 75;
     m_StreamConfig.streamingRemotely = STREAM_CFG_AUTO;
-    m_StreamConfig.packetSize = 1392;
+    m_StreamConfig.packetSize = PathMtu::getPacketSize(m_Computer->activeAddress);
 
     SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
                 "Video bitrate: %d kbps",
                 m_StreamConfig.bitrate);
 
+    checkReceiveBufferLimit(m_StreamConfig.bitrate);
+
+    m_VrrActive = false;
+    if (m_Preferences->variableRefreshRate) {
+        if (StreamUtils::isVariableRefreshRateSupported(testWindow)) {
+            int maxRefreshRate = StreamUtils::getDisplayMaxRefreshRate(SDL_GetWindowDisplayIndex(testWindow));
+
+            // The display follows our frame rate, so frames will be presented
+            // as soon as they're decoded without any pacing.
+            m_VrrActive = true;
+
+            // Going over the top of the VRR range falls back to fixed
+            // refresh with V-sync (or tearing), so cap the stream below it.
+            if (maxRefreshRate > VRR_FPS_CAP_MARGIN && m_StreamConfig.fps > maxRefreshRate - VRR_FPS_CAP_MARGIN) {
+                SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                            "Capping stream to %d FPS for %d Hz VRR display",
+                            maxRefreshRate - VRR_FPS_CAP_MARGIN,
+                            maxRefreshRate);
+                m_StreamConfig.fps = maxRefreshRate - VRR_FPS_CAP_MARGIN;
+            }
+
+            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                        "Variable refresh rate mode active");
+        }
+        else {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "Variable refresh rate mode requested, but no VRR support was detected");
+        }
+    }
+
     RAND_bytes(reinterpret_cast<unsigned char*>(m_StreamConfig.remoteInputAesKey),
                sizeof(m_StreamConfig.remoteInputAesKey));
 
@@ -385,6 +935,8 @@ bool Session::initialize()
     m_AudioCallbacks.decodeAndPlaySample = arDecodeAndPlaySample;
     m_AudioCallbacks.capabilities = getAudioRendererCapabilities(m_StreamConfig.audioConfiguration);
 
+    logStartupStage("audio probing");
+
     SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
                 "Audio configuration: %d",
                 m_StreamConfig.audioConfiguration);
@@ -392,6 +944,9 @@ bool Session::initialize()
     switch (m_Preferences->videoCodecConfig)
     {
     case StreamingPreferences::VCC_AUTO:
+        // The stream configuration can only choose between H.264 and HEVC.
+        // AV1 would need moonlight-common-c to negotiate it with the host
+        // and define a video format for it before we could decode it here.
         // TODO: Determine if HEVC is better depending on the decoder
         m_StreamConfig.supportsHevc =
                 isHardwareDecodeAvailable(testWindow,
@@ -441,6 +996,18 @@ bool Session::initialize()
                                                             m_StreamConfig.height,
                                                             m_StreamConfig.fps);
 
+    logStartupStage("decoder probing");
+
+    // Slice up to 4 times for parallel decode, once slice per core,
+    // unless the decoder asked for a specific slice count
+    if ((m_VideoCallbacks.capabilities & CAPABILITY_SLICES_PER_FRAME(0xFF)) == 0) {
+        int slices = qMin(MAX_SLICES, SDL_GetCPUCount());
+        m_VideoCallbacks.capabilities |= CAPABILITY_SLICES_PER_FRAME(slices);
+    }
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Encoder configured for %d slices per frame",
+                (m_VideoCallbacks.capabilities >> 24) & 0xFF);
+
     switch (m_Preferences->windowMode)
     {
     default:
@@ -459,6 +1026,7 @@ bool Session::initialize()
     SDL_DestroyWindow(testWindow);
 
     if (!ret) {
+        releaseProbedDevices();
         SDL_QuitSubSystem(SDL_INIT_VIDEO);
         return false;
     }
@@ -468,18 +1036,78 @@ bool Session::initialize()
 
 void Session::emitLaunchWarning(QString text)
 {
-    // Emit the warning to the UI
-    emit displayLaunchWarning(text);
-
-    // Wait a little bit so the user can actually read what we just said.
-    // This wait is a little longer than the actual toast timeout (3 seconds)
-    // to allow it to transition off the screen before continuing.
-    uint32_t start = SDL_GetTicks();
-    while (!SDL_TICKS_PASSED(SDL_GetTicks(), start + 3500)) {
-        // Pump the UI loop while we wait
-        SDL_Delay(5);
-        QCoreApplication::processEvents(QEventLoop::ExcludeUserInputEvents);
+    // Warnings are shown by displayLaunchWarnings() once the app is
+    // launching, so reading them doesn't hold up the launch
+    m_LaunchWarnings.append(text);
+}
+
+void Session::displayLaunchWarnings()
+{
+    for (const QString& text : m_LaunchWarnings) {
+        // Emit the warning to the UI
+        emit displayLaunchWarning(text);
+
+        // Nobody is watching a headless stream
+        if (s_Headless) {
+            continue;
+        }
+
+        // Wait a little bit so the user can actually read what we just said.
+        // This wait is a little longer than the actual toast timeout (3 seconds)
+        // to allow it to transition off the screen before continuing.
+        uint32_t start = SDL_GetTicks();
+        while (!SDL_TICKS_PASSED(SDL_GetTicks(), start + 3500)) {
+            // Pump the UI loop while we wait
+            SDL_Delay(5);
+            QCoreApplication::processEvents(QEventLoop::ExcludeUserInputEvents);
+        }
     }
+
+    m_LaunchWarnings.clear();
+}
+
+void Session::logStartupStage(const char* stage)
+{
+    SDL_AtomicLock(&m_StartupProfileLock);
+
+    Uint64 now = StreamUtils::getTimeUs();
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Startup stage '%s' took %.1f ms (%.1f ms since start)",
+                stage,
+                (now - m_StartupStageTimeUs) / 1000.0f,
+                (now - m_StartupTimeUs) / 1000.0f);
+
+    m_StartupProfile.append(QString("%1,%2,%3")
+                            .arg(stage)
+                            .arg((now - m_StartupStageTimeUs) / 1000.0, 0, 'f', 1)
+                            .arg((now - m_StartupTimeUs) / 1000.0, 0, 'f', 1));
+
+    m_StartupStageTimeUs = now;
+
+    SDL_AtomicUnlock(&m_StartupProfileLock);
+}
+
+void Session::logParallelStartupStage(const char* stage, Uint64 startTimeUs)
+{
+    SDL_AtomicLock(&m_StartupProfileLock);
+
+    Uint64 now = StreamUtils::getTimeUs();
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Startup stage '%s' took %.1f ms in parallel (%.1f ms since start)",
+                stage,
+                (now - startTimeUs) / 1000.0f,
+                (now - m_StartupTimeUs) / 1000.0f);
+
+    // This overlapped the sequential stages, so it doesn't end one
+    m_StartupProfile.append(QString("%1,%2,%3")
+                            .arg(stage)
+                            .arg((now - startTimeUs) / 1000.0, 0, 'f', 1)
+                            .arg((now - m_StartupTimeUs) / 1000.0, 0, 'f', 1));
+
+    SDL_AtomicUnlock(&m_StartupProfileLock);
+}
 }
 
 bool Session::validateLaunch(SDL_Window* testWindow)
@@ -593,7 +1221,8 @@ bool Session::validateLaunch(SDL_Window* testWindow)
         emitLaunchWarning("An attached gamepad has no mapping and won't be usable. Visit the Moonlight help to resolve this.");
     }
 
-    if (m_Preferences->videoDecoderSelection == StreamingPreferences::VDS_FORCE_HARDWARE &&
+    if ((m_Preferences->videoDecoderSelection == StreamingPreferences::VDS_FORCE_HARDWARE ||
+         m_Preferences->videoDecoderSelection == StreamingPreferences::VDS_FORCE_D3D11VA) &&
             !isHardwareDecodeAvailable(testWindow,
                                        m_Preferences->videoDecoderSelection,
                                        m_StreamConfig.supportsHevc ? VIDEO_FORMAT_H265 : VIDEO_FORMAT_H264,
@@ -647,6 +1276,30 @@ private:
         // Finish cleanup of the connection state
         LiStopConnection();
 
+        // All video pipeline threads are gone now, so the trace is complete
+        FrameTracer::stop();
+#ifdef HAVE_FFMPEG
+        BitstreamAnalytics::stop();
+#endif
+        MetricsExporter::stop();
+        GpuUsage::stop();
+        LatencyProbe::stop();
+        BitrateController::stop();
+        DecodeOverloadDetector::stop();
+
+        // The audio stats are final now that the connection is stopped
+        m_Session->recordSessionHistory();
+
+        // The capture is finished once its writer has drained
+        delete m_Session->m_CaptureWriter;
+        m_Session->m_CaptureWriter = nullptr;
+
+#ifdef HAVE_AVFORMAT
+        // Any recording in progress is finished here
+        delete m_Session->m_Recorder;
+        m_Session->m_Recorder = nullptr;
+#endif
+
         // Perform a best-effort app quit
         if (shouldQuit) {
             NvHTTP http(m_Session->m_Computer->activeAddress, m_Session->m_Computer->serverCert);
@@ -666,19 +1319,74 @@ private:
     Session* m_Session;
 };
 
-void Session::getWindowDimensions(int& x, int& y,
-                                  int& width, int& height)
+void Session::handleLaunchRequestCompleted()
 {
-    int displayIndex = 0;
-    bool fullScreen;
+    NvHttpRequest* request = qobject_cast<NvHttpRequest*>(sender());
 
-    if (m_Window != nullptr) {
-        displayIndex = SDL_GetWindowDisplayIndex(m_Window);
-        SDL_assert(displayIndex >= 0);
-        fullScreen = (SDL_GetWindowFlags(m_Window) & SDL_WINDOW_FULLSCREEN);
+    try {
+        request->throwIfFailed();
+    } catch (const GfeHttpResponseException& e) {
+        m_LaunchError = "GeForce Experience returned error: " + e.toQString();
+    } catch (const QtNetworkReplyException& e) {
+        m_LaunchError = e.toQString();
     }
-    // Create our window on the same display that Qt's UI
-    // was being displayed on.
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "App launch request took %d ms",
+                (int)request->getElapsedMs());
+
+    // exec() is waiting on this
+    SDL_AtomicSet(&m_LaunchComplete, 1);
+}
+
+class ConnectionStartTask : public QRunnable
+{
+public:
+    ConnectionStartTask(Session* session, PSERVER_INFORMATION hostInfo) :
+        m_Session(session),
+        m_HostInfo(hostInfo)
+    {
+        setAutoDelete(true);
+    }
+
+private:
+    void run() override
+    {
+        m_Session->m_ConnectionResult =
+                LiStartConnection(m_HostInfo, &m_Session->m_StreamConfig, &Session::k_ConnCallbacks,
+                                  &m_Session->m_VideoCallbacks,
+                                  m_Session->m_AudioDisabled ? nullptr : &m_Session->m_AudioCallbacks,
+                                  NULL, 0, NULL, 0);
+
+        // The main thread reads m_ConnectionResult once this is set
+        SDL_AtomicSet(&m_Session->m_ConnectionComplete, 1);
+    }
+
+    Session* m_Session;
+    PSERVER_INFORMATION m_HostInfo;
+};
+
+void Session::getWindowDimensions(int& x, int& y,
+                                  int& width, int& height)
+{
+    int displayIndex = 0;
+    bool fullScreen;
+
+    if (m_WindowGeometry.isValid()) {
+        x = m_WindowGeometry.x();
+        y = m_WindowGeometry.y();
+        width = m_WindowGeometry.width();
+        height = m_WindowGeometry.height();
+        return;
+    }
+
+    if (m_Window != nullptr) {
+        displayIndex = SDL_GetWindowDisplayIndex(m_Window);
+        SDL_assert(displayIndex >= 0);
+        fullScreen = (SDL_GetWindowFlags(m_Window) & SDL_WINDOW_FULLSCREEN);
+    }
+    // Create our window on the same display that Qt's UI
+    // was being displayed on.
     else {
         SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
                     "Qt UI screen is at (%d,%d)",
@@ -757,8 +1465,9 @@ void Session::updateOptimalWindowDisplayMode()
     // scaled desktop resolution setting.
     if (SDL_GetDesktopDisplayMode(displayIndex, &desktopMode) == 0) {
         // If this doesn't fit the selected resolution, use the native
-        // resolution of the panel (unscaled).
-        if (desktopMode.w < m_ActiveVideoWidth || desktopMode.h < m_ActiveVideoHeight) {
+        // resolution of the panel (unscaled). This runs before the video
+        // stream has started, so it goes by the resolution we asked for.
+        if (desktopMode.w < m_StreamConfig.width || desktopMode.h < m_StreamConfig.height) {
             if (!StreamUtils::getRealDesktopMode(displayIndex, &desktopMode)) {
                 return;
             }
@@ -771,16 +1480,20 @@ void Session::updateOptimalWindowDisplayMode()
         return;
     }
 
-    // Start with the native desktop resolution and try to find
-    // the highest refresh rate that our stream FPS evenly divides.
+    // Some displays take seconds to change modes, so if the stream FPS already
+    // evenly divides the desktop refresh rate, just stay there. Otherwise,
+    // start with the native desktop resolution and try to find the highest
+    // refresh rate that our stream FPS evenly divides.
     bestMode = desktopMode;
-    bestMode.refresh_rate = 0;
-    for (int i = 0; i < SDL_GetNumDisplayModes(displayIndex); i++) {
-        if (SDL_GetDisplayMode(displayIndex, i, &mode) == 0) {
-            if (mode.w == desktopMode.w && mode.h == desktopMode.h &&
-                    mode.refresh_rate % m_StreamConfig.fps == 0) {
-                if (mode.refresh_rate > bestMode.refresh_rate) {
-                    bestMode = mode;
+    if (desktopMode.refresh_rate == 0 || desktopMode.refresh_rate % m_StreamConfig.fps != 0) {
+        bestMode.refresh_rate = 0;
+        for (int i = 0; i < SDL_GetNumDisplayModes(displayIndex); i++) {
+            if (SDL_GetDisplayMode(displayIndex, i, &mode) == 0) {
+                if (mode.w == desktopMode.w && mode.h == desktopMode.h &&
+                        mode.refresh_rate % m_StreamConfig.fps == 0) {
+                    if (mode.refresh_rate > bestMode.refresh_rate) {
+                        bestMode = mode;
+                    }
                 }
             }
         }
@@ -831,8 +1544,7 @@ void Session::notifyMouseEmulationMode(bool enabled)
 
     // We re-use the status update overlay for mouse mode notification
     if (m_MouseEmulationRefCount > 0) {
-        strcpy(m_OverlayManager.getOverlayText(Overlay::OverlayStatusUpdate), "Gamepad mouse mode active\nLong press Start to deactivate");
-        m_OverlayManager.setOverlayTextUpdated(Overlay::OverlayStatusUpdate);
+        m_OverlayManager.updateOverlayText(Overlay::OverlayStatusUpdate, "Gamepad mouse mode active\nLong press Start to deactivate");
         m_OverlayManager.setOverlayState(Overlay::OverlayStatusUpdate, true);
     }
     else {
@@ -840,27 +1552,256 @@ void Session::notifyMouseEmulationMode(bool enabled)
     }
 }
 
+void Session::dispatchInputEvent(SDL_Event* event)
+{
+    switch (event->type) {
+    case SDL_KEYUP:
+    case SDL_KEYDOWN:
+        m_InputHandler->handleKeyEvent(&event->key);
+        break;
+    case SDL_MOUSEBUTTONDOWN:
+    case SDL_MOUSEBUTTONUP:
+        m_InputHandler->handleMouseButtonEvent(&event->button);
+        break;
+    case SDL_MOUSEMOTION:
+        m_InputHandler->handleMouseMotionEvent(&event->motion);
+        break;
+    case SDL_MOUSEWHEEL:
+        m_InputHandler->handleMouseWheelEvent(&event->wheel);
+        break;
+    case SDL_CONTROLLERAXISMOTION:
+        m_InputHandler->handleControllerAxisEvent(&event->caxis);
+        break;
+    case SDL_CONTROLLERBUTTONDOWN:
+    case SDL_CONTROLLERBUTTONUP:
+        m_InputHandler->handleControllerButtonEvent(&event->cbutton);
+        break;
+    case SDL_CONTROLLERDEVICEADDED:
+    case SDL_CONTROLLERDEVICEREMOVED:
+        m_InputHandler->handleControllerDeviceEvent(&event->cdevice);
+        break;
+    case SDL_JOYDEVICEADDED:
+        m_InputHandler->handleJoystickArrivalEvent(&event->jdevice);
+        break;
+    case SDL_FINGERDOWN:
+    case SDL_FINGERMOTION:
+    case SDL_FINGERUP:
+        m_InputHandler->handleTouchFingerEvent(&event->tfinger);
+        break;
+    default:
+        // Not an input event
+        return;
+    }
+
+    // SDL timestamps events in milliseconds when they're queued
+    Uint32 queueDelayMs = SDL_GetTicks() - event->common.timestamp;
+
+    SDL_AtomicLock(&m_InputStatsLock);
+    m_InputStats.events++;
+    m_InputStats.totalQueueDelayMs += queueDelayMs;
+    m_InputStats.maxQueueDelayMs = SDL_max(m_InputStats.maxQueueDelayMs, queueDelayMs);
+    SDL_AtomicUnlock(&m_InputStatsLock);
+}
+
+void Session::drainInputEvents()
+{
+    SDL_Event events[32];
+    int count;
+
+    // Pick up anything the OS has queued since we last pumped events
+    SDL_PumpEvents();
+
+    // This covers keyboard, mouse, gamepad, and touch events, but not
+    // SDL_USEREVENT, so frames that are ready stay queued in order.
+    while ((count = SDL_PeepEvents(events, SDL_arraysize(events),
+                                   SDL_GETEVENT, SDL_KEYDOWN, SDL_MULTIGESTURE)) > 0) {
+        for (int i = 0; i < count; i++) {
+            dispatchInputEvent(&events[i]);
+        }
+
+        SDL_AtomicLock(&m_InputStatsLock);
+        m_InputStats.eventsAheadOfRender += count;
+        SDL_AtomicUnlock(&m_InputStatsLock);
+    }
+}
+
+void Session::requestStreamRestart(int width, int height, int bitrateKbps)
+{
+    SDL_AtomicLock(&m_RestartLock);
+    bool alreadyPending = m_RestartPending;
+    m_RestartPending = true;
+    if (width != 0 && height != 0) {
+        m_RestartWidth = width;
+        m_RestartHeight = height;
+    }
+    if (bitrateKbps != 0) {
+        m_RestartBitrateKbps = bitrateKbps;
+    }
+    SDL_AtomicUnlock(&m_RestartLock);
+
+    // Requests made before the main loop gets to the first one are combined
+    if (!alreadyPending) {
+        SDL_Event event;
+        event.type = SDL_USEREVENT;
+        event.user.code = SDL_CODE_RESTART_STREAM;
+        SDL_PushEvent(&event);
+    }
+}
+
+bool Session::restartStream()
+{
+    SDL_AtomicLock(&m_RestartLock);
+    if (!m_RestartPending) {
+        SDL_AtomicUnlock(&m_RestartLock);
+        return true;
+    }
+    int width = m_RestartWidth != 0 ? m_RestartWidth : m_StreamConfig.width;
+    int height = m_RestartHeight != 0 ? m_RestartHeight : m_StreamConfig.height;
+    int bitrateKbps = m_RestartBitrateKbps != 0 ? m_RestartBitrateKbps : m_StreamConfig.bitrate;
+    m_RestartPending = false;
+    m_RestartWidth = m_RestartHeight = m_RestartBitrateKbps = 0;
+    SDL_AtomicUnlock(&m_RestartLock);
+
+    if (width == m_StreamConfig.width && height == m_StreamConfig.height &&
+            bitrateKbps == m_StreamConfig.bitrate) {
+        return true;
+    }
+
+    Uint64 startTimeUs = StreamUtils::getTimeUs();
+
+    // The connection stages are logged again relative to the restart
+    m_StartupTimeUs = m_StartupStageTimeUs = startTimeUs;
+    m_StartupProfile.clear();
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Restarting stream: %dx%d at %d Kbps -> %dx%d at %d Kbps",
+                m_StreamConfig.width, m_StreamConfig.height, m_StreamConfig.bitrate,
+                width, height, bitrateKbps);
+
+    // Nothing should be left held down on the host while we're gone
+    m_InputHandler->raiseAllKeys();
+
+    // The audio renderer survives the restart, and the decoder survives
+    // unless drSetup() finds it can't handle the new stream.
+    m_RestartingStream = true;
+    LiStopConnection();
+
+    m_StreamConfig.width = width;
+    m_StreamConfig.height = height;
+    m_StreamConfig.bitrate = bitrateKbps;
+    m_InputHandler->setStreamDimensions(width, height);
+
+    RAND_bytes(reinterpret_cast<unsigned char*>(m_StreamConfig.remoteInputAesKey),
+               sizeof(m_StreamConfig.remoteInputAesKey));
+    RAND_bytes(reinterpret_cast<unsigned char*>(m_StreamConfig.remoteInputAesIv), 4);
+
+    QString error;
+    try {
+        NvHTTP http(m_Computer->activeAddress, m_Computer->serverCert);
+        http.resumeApp(&m_StreamConfig);
+    } catch (const GfeHttpResponseException& e) {
+        error = "GeForce Experience returned error: " + e.toQString();
+    } catch (const QtNetworkReplyException& e) {
+        error = e.toQString();
+    }
+
+    int err = -1;
+    if (error.isEmpty()) {
+        QByteArray hostnameStr = m_Computer->activeAddress.toLatin1();
+        QByteArray siAppVersion = m_Computer->appVersion.toLatin1();
+        QByteArray siGfeVersion = m_Computer->gfeVersion.toLatin1();
+
+        SERVER_INFORMATION hostInfo;
+        hostInfo.address = hostnameStr.data();
+        hostInfo.serverInfoAppVersion = siAppVersion.data();
+        hostInfo.serverInfoGfeVersion = siGfeVersion.isEmpty() ? nullptr : siGfeVersion.data();
+
+        err = LiStartConnection(&hostInfo, &m_StreamConfig, &k_ConnCallbacks,
+                                &m_VideoCallbacks,
+                                m_AudioDisabled ? nullptr : &m_AudioCallbacks,
+                                NULL, 0, NULL, 0);
+    }
+
+    m_RestartingStream = false;
+
+    if (err != 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Failed to restart stream: %s",
+                     error.isEmpty() ? "connection failed" : qPrintable(error));
+
+        // arCleanup() won't run again to free the renderer we kept
+        delete m_AudioRenderer;
+        m_AudioRenderer = nullptr;
+
+        // Nothing is connected, so don't try to quit the app on the way out
+        m_UnexpectedTermination = true;
+        emit displayLaunchError(error.isEmpty() ? "Unable to restart the stream" : error);
+        return false;
+    }
+
+    if (m_VideoDecoder == nullptr) {
+        // drSetup() destroyed the decoder, so have the reset path build
+        // one for the new stream
+        SDL_Event event;
+        event.type = SDL_RENDER_TARGETS_RESET;
+        SDL_PushEvent(&event);
+    }
+    else {
+        SDL_AtomicLock(&m_DecoderLock);
+        m_NeedsIdr = true;
+        SDL_AtomicUnlock(&m_DecoderLock);
+    }
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Stream restarted in %.1f ms",
+                (StreamUtils::getTimeUs() - startTimeUs) / 1000.0f);
+    return true;
+}
+
+void Session::getInputStats(INPUT_STATS& stats)
+{
+    SDL_AtomicLock(&m_InputStatsLock);
+    stats = m_InputStats;
+    SDL_AtomicUnlock(&m_InputStatsLock);
+}
+
+void Session::setGuiRenderingSuspended(bool suspended)
+{
+    for (QWindow* window : QGuiApplication::topLevelWindows()) {
+        QQuickWindow* quickWindow = qobject_cast<QQuickWindow*>(window);
+        if (quickWindow == nullptr) {
+            continue;
+        }
+
+        quickWindow->setPersistentSceneGraph(!suspended);
+        quickWindow->setPersistentOpenGLContext(!suspended);
+
+        if (suspended) {
+            // Frees glyph caches and unused textures even if the render
+            // loop keeps the scene graph of a hidden window
+            quickWindow->releaseResources();
+        }
+    }
+}
+
 void Session::exec(int displayOriginX, int displayOriginY)
 {
     m_DisplayOriginX = displayOriginX;
     m_DisplayOriginY = displayOriginY;
 
+    m_StartupTimeUs = m_StartupStageTimeUs = StreamUtils::getTimeUs();
+    m_StartupProfile.clear();
+
     // Complete initialization in this deferred context to avoid
     // calling expensive functions in the constructor (during the
     // process of loading the StreamSegue).
     if (!initialize()) {
+        displayLaunchWarnings();
         emit sessionFinished();
         return;
     }
 
-    // Wait 1.5 seconds before connecting to let the user
-    // have time to read any messages present on the segue
-    uint32_t start = SDL_GetTicks();
-    while (!SDL_TICKS_PASSED(SDL_GetTicks(), start + 1500)) {
-        // Pump the UI loop while we wait
-        SDL_Delay(5);
-        QCoreApplication::processEvents(QEventLoop::ExcludeUserInputEvents);
-    }
+    logStartupStage("launch validation");
 
     // Wait for any old session to finish cleanup
     s_ActiveSessionSemaphore.acquire();
@@ -894,29 +1835,53 @@ void Session::exec(int displayOriginX, int displayOriginY)
         }
     }
 
-    try {
+    logStartupStage("input setup");
+
+    // The host takes a while to start the app, so launch it in the
+    // background while the UI shows any warnings from initialize()
+    m_LaunchError.clear();
+    SDL_AtomicSet(&m_LaunchComplete, 0);
+    {
         NvHTTP http(m_Computer->activeAddress, m_Computer->serverCert);
+        NvHttpRequest* launchRequest;
         if (m_Computer->currentGameId != 0) {
-            http.resumeApp(&m_StreamConfig);
+            launchRequest = http.resumeAppAsync(&m_StreamConfig);
         }
         else {
-            http.launchApp(m_App.id, &m_StreamConfig,
-                           enableGameOptimizations,
-                           prefs.playAudioOnHost,
-                           m_InputHandler->getAttachedGamepadMask());
+            launchRequest = http.launchAppAsync(m_App.id, &m_StreamConfig,
+                                                enableGameOptimizations,
+                                                prefs.playAudioOnHost,
+                                                m_InputHandler->getAttachedGamepadMask());
         }
-    } catch (const GfeHttpResponseException& e) {
-        delete m_InputHandler;
-        m_InputHandler = nullptr;
-        SDL_QuitSubSystem(SDL_INIT_VIDEO);
-        emit displayLaunchError("GeForce Experience returned error: " + e.toQString());
-        QThreadPool::globalInstance()->start(new DeferredSessionCleanupTask(this));
-        return;
-    } catch (const QtNetworkReplyException& e) {
+
+        connect(launchRequest, &NvHttpRequest::completed,
+                this, &Session::handleLaunchRequestCompleted);
+    }
+
+    displayLaunchWarnings();
+
+    // The icon doesn't depend on the launch, so get it ready now
+    QSvgRenderer svgIconRenderer(QString(":/res/moonlight.svg"));
+    QImage svgImage(ICON_SIZE, ICON_SIZE, QImage::Format_RGBA8888);
+    svgImage.fill(0);
+
+    QPainter svgPainter(&svgImage);
+    svgIconRenderer.render(&svgPainter);
+
+    while (!SDL_AtomicGet(&m_LaunchComplete)) {
+        // Pump the UI loop while we wait. This also runs the launch request.
+        SDL_Delay(5);
+        QCoreApplication::processEvents(QEventLoop::ExcludeUserInputEvents);
+    }
+
+    logStartupStage("app launch");
+
+    if (!m_LaunchError.isEmpty()) {
         delete m_InputHandler;
         m_InputHandler = nullptr;
+        releaseProbedDevices();
         SDL_QuitSubSystem(SDL_INIT_VIDEO);
-        emit displayLaunchError(e.toQString());
+        emit displayLaunchError(m_LaunchError);
         QThreadPool::globalInstance()->start(new DeferredSessionCleanupTask(this));
         return;
     }
@@ -937,88 +1902,163 @@ void Session::exec(int displayOriginX, int displayOriginY)
         hostInfo.serverInfoGfeVersion = siGfeVersion.data();
     }
 
-    int err = LiStartConnection(&hostInfo, &m_StreamConfig, &k_ConnCallbacks,
-                                &m_VideoCallbacks,
-                                m_AudioDisabled ? nullptr : &m_AudioCallbacks,
-                                NULL, 0, NULL, 0);
-    if (err != 0) {
-        // We already displayed an error dialog in the stage failure
-        // listener.
-        delete m_InputHandler;
-        m_InputHandler = nullptr;
-        SDL_QuitSubSystem(SDL_INIT_VIDEO);
-        QThreadPool::globalInstance()->start(new DeferredSessionCleanupTask(this));
-        return;
+    // Start collecting per-frame timings if requested
+    FrameTracer::start();
+#ifdef HAVE_FFMPEG
+    BitstreamAnalytics::start();
+    FrameGraph::reset();
+#endif
+    MetricsExporter::start();
+    AvSyncClock::start();
+    if (m_Preferences->autoBitrate) {
+        BitrateController::start(m_StreamConfig.bitrate);
+    }
+    DecodeOverloadDetector::start(m_StreamConfig.width, m_StreamConfig.height, m_StreamConfig.fps,
+                                  m_Preferences->autoResolution, m_Preferences->connectionWarnings);
+    LatencyProbe::start();
+
+    // Record the incoming stream for replay if requested
+    if (qgetenv("STREAM_CAPTURE") == "1") {
+        QDir logDir(Path::getLogDir());
+        m_CaptureWriter = new CaptureWriter();
+        if (!m_CaptureWriter->start(logDir.filePath(QString("Moonlight-Capture-%1-%2.mlcap").arg(QDateTime::currentSecsSinceEpoch()).arg(QCoreApplication::applicationPid())))) {
+            delete m_CaptureWriter;
+            m_CaptureWriter = nullptr;
+        }
     }
 
-    // Pump the message loop to update the UI
-    emit connectionStarted();
-    QCoreApplication::processEvents(QEventLoop::ExcludeUserInputEvents);
+#ifdef HAVE_AVFORMAT
+    // Always ready to record, but nothing is copied unless
+    // there's a replay to keep or a recording is started
+    m_Recorder = new StreamRecorder(m_Preferences->replayBufferSecs);
+    if (!m_Recorder->start()) {
+        delete m_Recorder;
+        m_Recorder = nullptr;
+    }
+#endif
+
+    // Set up the window while the connection is being established on
+    // a worker thread, since a full-screen mode change can take seconds
+    // on some displays
+    SDL_AtomicSet(&m_ConnectionComplete, 0);
+    QThreadPool::globalInstance()->start(new ConnectionStartTask(this, &hostInfo));
+
+    Uint64 windowStartTimeUs = StreamUtils::getTimeUs();
 
     int x, y, width, height;
     getWindowDimensions(x, y, width, height);
 
+    SDL_Surface* iconSurface = nullptr;
     m_Window = SDL_CreateWindow("Moonlight",
                                 x,
                                 y,
                                 width,
                                 height,
-                                SDL_WINDOW_ALLOW_HIGHDPI);
+                                SDL_WINDOW_ALLOW_HIGHDPI |
+                                    (m_WindowGeometry.isValid() ? SDL_WINDOW_BORDERLESS : 0) |
+                                    StreamUtils::getPlatformWindowFlags());
     if (!m_Window) {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
                      "SDL_CreateWindow() failed: %s",
                      SDL_GetError());
+    }
+    else {
+        iconSurface = SDL_CreateRGBSurfaceWithFormatFrom((void*)svgImage.constBits(),
+                                                         svgImage.width(),
+                                                         svgImage.height(),
+                                                         32,
+                                                         4 * svgImage.width(),
+                                                         SDL_PIXELFORMAT_RGBA32);
+#ifndef Q_OS_DARWIN
+        // Other platforms seem to preserve our Qt icon when creating a new window.
+        if (iconSurface != nullptr) {
+            // This must be called before entering full-screen mode on Windows
+            // or our icon will not persist when toggling to windowed mode
+            SDL_SetWindowIcon(m_Window, iconSurface);
+        }
+#endif
+
+        // For non-full screen windows, call getWindowDimensions()
+        // again after creating a window to allow it to account
+        // for window chrome size.
+        if (m_Preferences->windowMode == StreamingPreferences::WM_WINDOWED) {
+            getWindowDimensions(x, y, width, height);
+
+            // We must set the size before the position because centering
+            // won't work unless it knows the final size of the window.
+            SDL_SetWindowSize(m_Window, width, height);
+            SDL_SetWindowPosition(m_Window, x, y);
+
+            // Passing SDL_WINDOW_RESIZABLE to set this during window
+            // creation causes our window to be full screen for some reason
+            SDL_SetWindowResizable(m_Window, SDL_TRUE);
+        }
+        else {
+            // Update the window display mode based on our current monitor
+            updateOptimalWindowDisplayMode();
+
+            // Enter full screen
+            SDL_SetWindowFullscreen(m_Window, m_FullScreenFlag);
+        }
+
+        logParallelStartupStage("window and display mode", windowStartTimeUs);
+    }
+
+    while (!SDL_AtomicGet(&m_ConnectionComplete)) {
+        // Pump the UI loop while we wait
+        SDL_Delay(5);
+        QCoreApplication::processEvents(QEventLoop::ExcludeUserInputEvents);
+    }
+
+    if (m_ConnectionResult != 0 || m_Window == nullptr) {
+        if (m_ConnectionResult != 0) {
+            emit startupProfileReady(m_StartupProfile);
+        }
+
+        if (m_Window != nullptr) {
+            SDL_DestroyWindow(m_Window);
+            m_Window = nullptr;
+        }
+        if (iconSurface != nullptr) {
+            SDL_FreeSurface(iconSurface);
+        }
+
+        // We already displayed an error dialog in the stage failure
+        // listener if the connection failed.
         delete m_InputHandler;
         m_InputHandler = nullptr;
+        releaseProbedDevices();
         SDL_QuitSubSystem(SDL_INIT_VIDEO);
         QThreadPool::globalInstance()->start(new DeferredSessionCleanupTask(this));
         return;
     }
 
-    QSvgRenderer svgIconRenderer(QString(":/res/moonlight.svg"));
-    QImage svgImage(ICON_SIZE, ICON_SIZE, QImage::Format_RGBA8888);
-    svgImage.fill(0);
+    logStartupStage("connection start");
 
-    QPainter svgPainter(&svgImage);
-    svgIconRenderer.render(&svgPainter);
-    SDL_Surface* iconSurface = SDL_CreateRGBSurfaceWithFormatFrom((void*)svgImage.constBits(),
-                                                                  svgImage.width(),
-                                                                  svgImage.height(),
-                                                                  32,
-                                                                  4 * svgImage.width(),
-                                                                  SDL_PIXELFORMAT_RGBA32);
-#ifndef Q_OS_DARWIN
-    // Other platforms seem to preserve our Qt icon when creating a new window.
-    if (iconSurface != nullptr) {
-        // This must be called before entering full-screen mode on Windows
-        // or our icon will not persist when toggling to windowed mode
-        SDL_SetWindowIcon(m_Window, iconSurface);
-    }
-#endif
-
-    // For non-full screen windows, call getWindowDimensions()
-    // again after creating a window to allow it to account
-    // for window chrome size.
-    if (m_Preferences->windowMode == StreamingPreferences::WM_WINDOWED) {
-        getWindowDimensions(x, y, width, height);
+    // Our decoder and renderer have opened their GPU devices by now
+    GpuUsage::start();
 
-        // We must set the size before the position because centering
-        // won't work unless it knows the final size of the window.
-        SDL_SetWindowSize(m_Window, width, height);
-        SDL_SetWindowPosition(m_Window, x, y);
+    // Pump the message loop to update the UI. This hides the Qt window,
+    // which releases its scene graph now that it isn't persistent.
+    setGuiRenderingSuspended(true);
+    emit connectionStarted();
+    QCoreApplication::processEvents(QEventLoop::ExcludeUserInputEvents);
 
-        // Passing SDL_WINDOW_RESIZABLE to set this during window
-        // creation causes our window to be full screen for some reason
-        SDL_SetWindowResizable(m_Window, SDL_TRUE);
+    // Polling for the other hosts stops when the Qt window is hidden. In low
+    // memory mode, the decoded box art kept for the app grid goes too.
+    if (StreamUtils::isLowMemoryMode()) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Low memory mode is active (%d MB of RAM)",
+                    SDL_GetSystemRAM());
+        BoxArtImageProvider::releaseMemoryCache();
     }
-    else {
-        // Update the window display mode based on our current monitor
-        updateOptimalWindowDisplayMode();
 
-        // Enter full screen
-        SDL_SetWindowFullscreen(m_Window, m_FullScreenFlag);
+    if (s_Headless) {
+        ScriptedInput::start(s_HeadlessInputRate);
     }
 
+    m_InputHandler->setWindow(m_Window);
+
 #ifndef QT_DEBUG
     // Capture the mouse by default on release builds only.
     // This prevents the mouse from becoming trapped inside
@@ -1046,6 +2086,7 @@ void Session::exec(int displayOriginX, int displayOriginY)
     SDL_SetHint(SDL_HINT_TIMER_RESOLUTION, "1");
 
     int currentDisplayIndex = SDL_GetWindowDisplayIndex(m_Window);
+    bool windowResizedOnly;
 
     // Now that we're about to stream, any SDL_QUIT event is expected
     // unless it comes from the connection termination callback where
@@ -1055,23 +2096,71 @@ void Session::exec(int displayOriginX, int displayOriginY)
     // Start rich presence to indicate we're in game
     RichPresenceManager presence(prefs, m_App.name);
 
+    // Housekeeping runs on its own thread, leaving this one for input and
+    // main thread rendering
+    MaintenanceThread::setExpectedDisplay(currentDisplayIndex);
+    MaintenanceThread::start(m_Window, &presence);
+
+    // SDL 2.0.16 and later can block in SDL_WaitEventTimeout() until input
+    // arrives or another thread calls SDL_PushEvent() (like the Pacer does
+    // for main thread rendering). Older versions just poll internally with
+    // a sleep that's too long, so we poll ourselves there.
+    SDL_version sdlVersion;
+    SDL_GetVersion(&sdlVersion);
+    bool waitForEvents = SDL_VERSIONNUM(sdlVersion.major, sdlVersion.minor, sdlVersion.patch) >=
+            SDL_VERSIONNUM(2, 0, 16);
+    // Power saving only applies on battery, so the same settings can be
+    // used on a laptop that's plugged in without giving anything up
+    m_PowerSaving = m_Preferences->powerSaving &&
+            SDL_GetPowerInfo(nullptr, nullptr) == SDL_POWERSTATE_ON_BATTERY;
+
+    Uint32 idleTimeoutMs = m_PowerSaving ? MAIN_LOOP_POWER_SAVING_IDLE_TIMEOUT_MS : MAIN_LOOP_IDLE_TIMEOUT_MS;
+#ifndef STEAM_LINK
+    Uint32 pollIntervalMs = m_PowerSaving ? MAIN_LOOP_POWER_SAVING_POLL_INTERVAL_MS : 1;
+#else
+    // Waking every 1 ms to process input is too much for the low performance
+    // ARM core in the Steam Link, so we will wait 10 ms instead.
+    Uint32 pollIntervalMs = 10;
+#endif
+
+    Uint32 mainLoopStartTime = SDL_GetTicks();
+    Uint32 wakeups = 0;
+    Uint32 idleWakeups = 0;
+#ifdef Q_OS_UNIX
+    struct rusage startUsage;
+    getrusage(RUSAGE_SELF, &startUsage);
+#endif
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Main loop is %s%s",
+                waitForEvents ? "event-driven" : "polling",
+                m_PowerSaving ? " (power saving)" : "");
+
+    logStartupStage("window setup");
+    emit startupProfileReady(m_StartupProfile);
+
     // Hijack this thread to be the SDL main thread. We have to do this
     // because we want to suspend all Qt processing until the stream is over.
     SDL_Event event;
     for (;;) {
+        // Coalesced gamepad motion must go out within a millisecond
+        bool gamepadSendPending = m_InputHandler->flushPendingGamepadStates();
+
+        wakeups++;
+
+        if (waitForEvents) {
+            if (!SDL_WaitEventTimeout(&event, gamepadSendPending ? 1 : idleTimeoutMs)) {
+                idleWakeups++;
+                continue;
+            }
+        }
         // We explicitly use SDL_PollEvent() and SDL_Delay() because
         // SDL_WaitEvent() has an internal SDL_Delay(10) inside which
         // blocks this thread too long for high polling rate mice and high
         // refresh rate displays.
-        if (!SDL_PollEvent(&event)) {
-#ifndef STEAM_LINK
-            SDL_Delay(1);
-#else
-            // Waking every 1 ms to process input is too much for the low performance
-            // ARM core in the Steam Link, so we will wait 10 ms instead.
-            SDL_Delay(10);
-#endif
-            presence.runCallbacks();
+        else if (!SDL_PollEvent(&event)) {
+            SDL_Delay(pollIntervalMs);
+            idleWakeups++;
             continue;
         }
         switch (event.type) {
@@ -1081,8 +2170,29 @@ void Session::exec(int displayOriginX, int displayOriginY)
             goto DispatchDeferredCleanup;
 
         case SDL_USEREVENT:
+            if (event.user.code == SDL_CODE_RESTART_STREAM) {
+                if (!restartStream()) {
+                    goto DispatchDeferredCleanup;
+                }
+                break;
+            }
+            else if (event.user.code == SDL_CODE_DISPLAY_CHANGED) {
+                // The maintenance thread saw the window move to another
+                // display or the display's refresh rate change
+                windowResizedOnly = false;
+                goto ResetPresentation;
+            }
+
             SDL_assert(event.user.code == SDL_CODE_FRAME_READY);
-            m_VideoDecoder->renderFrameOnMainThread();
+
+            // Rendering on this thread can take a while, so send any
+            // input that's waiting before it rather than after
+            drainInputEvents();
+
+            // Frames from a decoder destroyed by a restart may still be queued
+            if (m_VideoDecoder != nullptr) {
+                m_VideoDecoder->renderFrameOnMainThread();
+            }
             break;
 
         case SDL_WINDOWEVENT:
@@ -1111,6 +2221,30 @@ void Session::exec(int displayOriginX, int displayOriginY)
             }
 #endif
 
+            if (event.window.event == SDL_WINDOWEVENT_MINIMIZED || event.window.event == SDL_WINDOWEVENT_HIDDEN) {
+                if (!SDL_AtomicGet(&m_WindowHidden)) {
+                    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                                "Window hidden; pausing video decoding");
+                    SDL_AtomicSet(&m_WindowHidden, 1);
+                }
+            }
+            else if (event.window.event == SDL_WINDOWEVENT_RESTORED ||
+                     event.window.event == SDL_WINDOWEVENT_MAXIMIZED ||
+                     event.window.event == SDL_WINDOWEVENT_SHOWN ||
+                     event.window.event == SDL_WINDOWEVENT_EXPOSED) {
+                if (SDL_AtomicGet(&m_WindowHidden)) {
+                    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                                "Window visible again; resuming video decoding");
+
+                    // The next decode unit asks for an IDR frame, which
+                    // only takes a frame interval to arrive
+                    SDL_AtomicLock(&m_DecoderLock);
+                    m_NeedsIdr = true;
+                    SDL_AtomicSet(&m_WindowHidden, 0);
+                    SDL_AtomicUnlock(&m_DecoderLock);
+                }
+            }
+
             if (event.window.event == SDL_WINDOWEVENT_FOCUS_LOST) {
                 // Release mouse cursor when another window is activated (e.g. by using ALT+TAB).
                 // This lets user to interact with our window's title bar and with the buttons in it.
@@ -1128,13 +2262,11 @@ void Session::exec(int displayOriginX, int displayOriginY)
             // We want to recreate the decoder for resizes (full-screen toggles) and the initial shown event.
             // We use SDL_WINDOWEVENT_SIZE_CHANGED rather than SDL_WINDOWEVENT_RESIZED because the latter doesn't
             // seem to fire when switching from windowed to full-screen on X11.
+            // Moving to another display is noticed by the maintenance thread,
+            // which sends us SDL_CODE_DISPLAY_CHANGED to recreate the decoder
+            // for it. That lets the Pacer pull the new display refresh rate.
             if (event.window.event != SDL_WINDOWEVENT_SIZE_CHANGED && event.window.event != SDL_WINDOWEVENT_SHOWN) {
-                // Check that the window display hasn't changed. If it has, we want
-                // to recreate the decoder to allow it to adapt to the new display.
-                // This will allow Pacer to pull the new display refresh rate.
-                if (SDL_GetWindowDisplayIndex(m_Window) == currentDisplayIndex) {
-                    break;
-                }
+                break;
             }
 
             // Complete any repositioning that was deferred until
@@ -1155,10 +2287,15 @@ void Session::exec(int displayOriginX, int displayOriginY)
         case SDL_RENDER_DEVICE_RESET:
         case SDL_RENDER_TARGETS_RESET:
 
-            SDL_AtomicLock(&m_DecoderLock);
+            // A resize (including a full-screen toggle) on the same display
+            // doesn't require anything of the decoder, so the renderer may
+            // be able to just adjust its output rect.
+            windowResizedOnly = event.type == SDL_WINDOWEVENT &&
+                                event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED &&
+                                SDL_GetWindowDisplayIndex(m_Window) == currentDisplayIndex;
 
-            // Destroy the old decoder
-            delete m_VideoDecoder;
+        ResetPresentation:
+            SDL_AtomicLock(&m_DecoderLock);
 
             // Flush any other pending window events that could
             // send us back here immediately
@@ -1168,13 +2305,7 @@ void Session::exec(int displayOriginX, int displayOriginY)
             // Update the window display mode based on our current monitor
             currentDisplayIndex = SDL_GetWindowDisplayIndex(m_Window);
             updateOptimalWindowDisplayMode();
-
-            // Now that the old decoder is dead, flush any events it may
-            // have queued to reset itself (if this reset was the result
-            // of state loss).
-            SDL_PumpEvents();
-            SDL_FlushEvent(SDL_RENDER_DEVICE_RESET);
-            SDL_FlushEvent(SDL_RENDER_TARGETS_RESET);
+            MaintenanceThread::setExpectedDisplay(currentDisplayIndex);
 
             {
                 // If the stream exceeds the display refresh rate (plus some slack),
@@ -1188,21 +2319,75 @@ void Session::exec(int displayOriginX, int displayOriginY)
                     enableVsync = false;
                 }
 
+                // Try to rebuild just the presentation objects first. If that
+                // works, the decoder keeps its reference frames and we don't
+                // need to wait for an IDR frame.
+                DECODER_PARAMETERS params;
+                params.width = m_ActiveVideoWidth;
+                params.height = m_ActiveVideoHeight;
+                params.frameRate = m_ActiveVideoFrameRate;
+                params.videoFormat = m_ActiveVideoFormat;
+                params.window = m_Window;
+                params.enableVsync = enableVsync;
+                params.enableFramePacing = enableVsync && m_Preferences->framePacing && !m_VrrActive && !m_PowerSaving;
+                params.pacingMode = m_Preferences->pacingMode;
+                params.enableVrr = m_VrrActive;
+                params.enableSharpening = m_Preferences->videoSharpening;
+                params.enableErrorConcealment = m_Preferences->errorConcealment;
+                params.vds = m_Preferences->videoDecoderSelection;
+                if (windowResizedOnly && m_VideoDecoder != nullptr && m_VideoDecoder->notifyWindowResized(&params)) {
+                    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                                "Adapted to window resize without resetting presentation");
+                    SDL_AtomicUnlock(&m_DecoderLock);
+                    break;
+                }
+
+                if (m_VideoDecoder != nullptr && m_VideoDecoder->reinitializePresentation(&params)) {
+                    SDL_PumpEvents();
+                    SDL_FlushEvent(SDL_RENDER_DEVICE_RESET);
+                    SDL_FlushEvent(SDL_RENDER_TARGETS_RESET);
+
+                    SDL_AtomicUnlock(&m_DecoderLock);
+                    break;
+                }
+
+                // Destroy the old decoder
+                delete m_VideoDecoder;
+
+                // Now that the old decoder is dead, flush any events it may
+                // have queued to reset itself (if this reset was the result
+                // of state loss).
+                SDL_PumpEvents();
+                SDL_FlushEvent(SDL_RENDER_DEVICE_RESET);
+                SDL_FlushEvent(SDL_RENDER_TARGETS_RESET);
+
                 // Choose a new decoder (hopefully the same one, but possibly
                 // not if a GPU was removed or something).
                 if (!chooseDecoder(m_Preferences->videoDecoderSelection,
                                    m_Window, m_ActiveVideoFormat, m_ActiveVideoWidth,
                                    m_ActiveVideoHeight, m_ActiveVideoFrameRate,
                                    enableVsync,
-                                   enableVsync && m_Preferences->framePacing,
+                                   enableVsync && m_Preferences->framePacing && !m_VrrActive && !m_PowerSaving,
+                                   m_Preferences->pacingMode,
+                                   m_VrrActive,
+                                   m_Preferences->videoSharpening,
+                                   m_Preferences->errorConcealment,
                                    false,
                                    s_ActiveSession->m_VideoDecoder)) {
+                    releaseProbedDevices();
                     SDL_AtomicUnlock(&m_DecoderLock);
                     SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
                                  "Failed to recreate decoder after reset");
+
+                    // Our cached probe results may no longer match reality
+                    DecoderCapabilityCache::invalidate();
                     emit displayLaunchError("Unable to initialize video decoder. Please check your streaming settings and try again.");
                     goto DispatchDeferredCleanup;
                 }
+
+                // Later decoders must create their own devices, since the
+                // ones from probing are only good until the stream starts
+                releaseProbedDevices();
             }
 
             // Request an IDR frame to complete the reset
@@ -1211,43 +2396,54 @@ void Session::exec(int displayOriginX, int displayOriginY)
             SDL_AtomicUnlock(&m_DecoderLock);
             break;
 
-        case SDL_KEYUP:
-        case SDL_KEYDOWN:
-            m_InputHandler->handleKeyEvent(&event.key);
-            break;
-        case SDL_MOUSEBUTTONDOWN:
-        case SDL_MOUSEBUTTONUP:
-            m_InputHandler->handleMouseButtonEvent(&event.button);
-            break;
-        case SDL_MOUSEMOTION:
-            m_InputHandler->handleMouseMotionEvent(&event.motion);
-            break;
-        case SDL_MOUSEWHEEL:
-            m_InputHandler->handleMouseWheelEvent(&event.wheel);
-            break;
-        case SDL_CONTROLLERAXISMOTION:
-            m_InputHandler->handleControllerAxisEvent(&event.caxis);
-            break;
-        case SDL_CONTROLLERBUTTONDOWN:
-        case SDL_CONTROLLERBUTTONUP:
-            m_InputHandler->handleControllerButtonEvent(&event.cbutton);
-            break;
-        case SDL_CONTROLLERDEVICEADDED:
-        case SDL_CONTROLLERDEVICEREMOVED:
-            m_InputHandler->handleControllerDeviceEvent(&event.cdevice);
-            break;
-        case SDL_JOYDEVICEADDED:
-            m_InputHandler->handleJoystickArrivalEvent(&event.jdevice);
-            break;
-        case SDL_FINGERDOWN:
-        case SDL_FINGERMOTION:
-        case SDL_FINGERUP:
-            m_InputHandler->handleTouchFingerEvent(&event.tfinger);
+        default:
+            dispatchInputEvent(&event);
             break;
         }
     }
 
 DispatchDeferredCleanup:
+    MaintenanceThread::stop();
+
+    m_StreamDurationMs = SDL_GetTicks() - mainLoopStartTime;
+
+    // Idle wakeups burn CPU without doing any useful work, which
+    // matters most on low power clients.
+    if (SDL_GetTicks() != mainLoopStartTime) {
+        float elapsedSecs = (SDL_GetTicks() - mainLoopStartTime) / 1000.0f;
+
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Main loop wakeups: %.1f per second (%.1f idle)",
+                    wakeups / elapsedSecs,
+                    idleWakeups / elapsedSecs);
+
+#ifdef Q_OS_UNIX
+        // Every time a thread blocks or is preempted is a context switch,
+        // which makes this the wakeup rate of the whole process
+        struct rusage endUsage;
+        getrusage(RUSAGE_SELF, &endUsage);
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Process context switches: %.1f per second%s",
+                    ((endUsage.ru_nvcsw + endUsage.ru_nivcsw) - (startUsage.ru_nvcsw + startUsage.ru_nivcsw)) / elapsedSecs,
+                    m_PowerSaving ? " (power saving)" : "");
+#endif
+    }
+
+    if (m_InputStats.events != 0) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Input queue delay: %.2f ms average, %u ms max (%u of %u events sent ahead of rendering)",
+                    (float)m_InputStats.totalQueueDelayMs / m_InputStats.events,
+                    m_InputStats.maxQueueDelayMs,
+                    m_InputStats.eventsAheadOfRender,
+                    m_InputStats.events);
+    }
+
+    // Scripted input must stop before the connection does
+    ScriptedInput::stop();
+
+    // The Qt window is shown again once sessionFinished is handled
+    setGuiRenderingSuspended(false);
+
     // Uncapture the mouse and hide the window immediately,
     // so we can return to the Qt GUI ASAP.
     m_InputHandler->setCaptureActive(false);
@@ -1266,13 +2462,31 @@ DispatchDeferredCleanup:
     m_InputHandler = nullptr;
     SDL_AtomicUnlock(&m_InputHandlerLock);
 
-    // Destroy the decoder, since this must be done on the main thread
+    // Destroy the decoder, since this must be done on the main thread.
+    // Its hardware device is kept for the next session.
+#ifdef HAVE_FFMPEG
+    HwDeviceCache::enable();
+#endif
     SDL_AtomicLock(&m_DecoderLock);
+    m_HaveFinalVideoStats = m_VideoDecoder != nullptr &&
+            m_VideoDecoder->getGlobalVideoStats(m_FinalVideoStats);
+    if (m_VideoDecoder != nullptr) {
+        const char* decoderName = m_VideoDecoder->getDecoderName();
+        if (decoderName != nullptr) {
+            m_FinalDecoderName = decoderName;
+        }
+        else {
+            m_FinalDecoderName = m_VideoDecoder->isHardwareAccelerated() ? "hardware" : "software";
+        }
+    }
+    m_FinalGpuFingerprint = DecoderCapabilityCache::getGpuFingerprint();
     delete m_VideoDecoder;
     m_VideoDecoder = nullptr;
     SDL_AtomicUnlock(&m_DecoderLock);
 
-    if (strcmp(SDL_GetCurrentVideoDriver(), "wayland") == 0) {
+    // Windowed mode doesn't hit the Mutter bug below, so skip the wait
+    if (strcmp(SDL_GetCurrentVideoDriver(), "wayland") == 0 &&
+            (SDL_GetWindowFlags(m_Window) & SDL_WINDOW_FULLSCREEN)) {
         // HACK: SDL (as of 2.0.10) has a bug that causes Mutter not to destroy the window
         // surface when in full-screen unless we render more frames after we request
         // to exit full-screen. The amount of frames required is variable but 500 ms
@@ -1299,7 +2513,7 @@ DispatchDeferredCleanup:
         SDL_FreeSurface(iconSurface);
     }
 
-    SDL_QuitSubSystem(SDL_INIT_VIDEO);
+    keepVideoWarm();
 
     // Cleanup can take a while, so dispatch it to a worker thread.
     // When it is complete, it will release our s_ActiveSessionSemaphore
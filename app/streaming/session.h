@@ -1,21 +1,59 @@
 #pragma once
 
+#include <QRect>
 #include <QSemaphore>
+#include <QStringList>
 
 #include <Limelight.h>
-#include <opus_multistream.h>
 #include "settings/streamingpreferences.h"
 #include "input.h"
 #include "video/decoder.h"
 #include "audio/renderers/renderer.h"
+#include "audio/audiodecoder.h"
+#include "audio/packetqueue.h"
 #include "video/overlaymanager.h"
 
+namespace CliBenchmark
+{
+class Runner;
+}
+
+class CaptureWriter;
+class StreamRecorder;
+
+typedef struct _AUDIO_STATS {
+    uint32_t receivedPackets;
+    uint32_t lostPackets;
+    // Lost packets rebuilt from the redundancy in the following packet.
+    // Opus falls back to concealment if that packet carried none.
+    uint32_t fecDecodedPackets;
+    // Lost packets synthesized by packet loss concealment
+    uint32_t concealedPackets;
+    // RFC 3550 interarrival jitter of the packets that moonlight-common-c's
+    // reorder queue hands us, and its highest value, in microseconds
+    uint32_t jitterUs;
+    uint32_t maxJitterUs;
+    // Times the audio device ran dry after playback started
+    uint32_t underruns;
+} AUDIO_STATS, *PAUDIO_STATS;
+
+typedef struct _INPUT_STATS {
+    uint32_t events;
+    // Time from SDL queuing an event to it being sent to the host
+    uint64_t totalQueueDelayMs;
+    uint32_t maxQueueDelayMs;
+    // Events sent early to avoid waiting on a main thread render
+    uint32_t eventsAheadOfRender;
+} INPUT_STATS, *PINPUT_STATS;
+
 class Session : public QObject
 {
     Q_OBJECT
 
     friend class SdlInputHandler;
     friend class DeferredSessionCleanupTask;
+    friend class ConnectionStartTask;
+    friend class CliBenchmark::Runner;
 
 public:
     explicit Session(NvComputer* computer, NvApp& app, StreamingPreferences *preferences = nullptr);
@@ -24,6 +62,11 @@ public:
 
     Q_INVOKABLE void exec(int displayOriginX, int displayOriginY);
 
+    Q_INVOKABLE QString getComputerUuid()
+    {
+        return m_Computer->uuid;
+    }
+
     static
     bool isHardwareDecodeAvailable(SDL_Window* window,
                                    StreamingPreferences::VideoDecoderSelection vds,
@@ -34,11 +77,71 @@ public:
         return s_ActiveSession;
     }
 
+    // Audio packets received but not yet decoded. Every renderer takes
+    // packets straight from the receive thread into our own queue, so
+    // LiGetPendingAudioFrames() no longer sees them.
+    static int getPendingAudioFrames();
+
     Overlay::OverlayManager& getOverlayManager()
     {
         return m_OverlayManager;
     }
 
+    void getAudioStats(AUDIO_STATS& stats);
+
+    // Called by audio renderers when the device runs dry mid-stream
+    void notifyAudioUnderrun();
+
+    void getInputStats(INPUT_STATS& stats);
+
+    // Picked from the path MTU to the host when the session started
+    int getPacketSize()
+    {
+        return m_StreamConfig.packetSize;
+    }
+
+    // Restarts the stream with new parameters without tearing down the
+    // window, input handler, or audio renderer. Zero keeps the current
+    // value. This may be called from any thread.
+    void requestStreamRestart(int width, int height, int bitrateKbps);
+
+    // Releases what the last session kept open for a quick relaunch
+    static
+    void releaseWarmVideo();
+
+    // Opens what a launch on this host is going to need before the user
+    // picks an app: SDL video, the display modes, the hidden window for
+    // decoder probing, the probed decoder's device and a TLS session with
+    // the host. It's all kept like the state of a finished session, so it
+    // goes away by itself if no launch follows. Must be called on the
+    // main thread while no session is running.
+    static
+    void prepareLaunch(NvComputer* computer);
+
+    // Streams without a display or audio device, like for soak testing.
+    // Video is decoded and thrown away, or only counted if discardVideo
+    // is set, and scripted mouse motion is sent at inputRate events per
+    // second. This must be set before the session is executed.
+    static
+    void setHeadless(bool discardVideo, int inputRate);
+
+    // Keeps the stream in a borderless window at this spot on the desktop,
+    // so streams from several hosts can be tiled by running a client for
+    // each. This must be set before the session is executed.
+    void setWindowGeometry(QRect geometry)
+    {
+        m_WindowGeometry = geometry;
+    }
+
+    // Video stats of the whole session, kept once its decoder is gone.
+    // Returns false if the stream never got a decoder that collects them.
+    bool getFinalVideoStats(VIDEO_STATS& stats);
+
+    // Main thread only. Video stats of the session so far, as of the
+    // decoder's last stats window while the stream is running and the
+    // final ones after that.
+    bool getVideoStats(VIDEO_STATS& stats);
+
 signals:
     void stageStarting(QString stage);
 
@@ -54,13 +157,51 @@ signals:
 
     void sessionFinished();
 
+    // One "stage,duration ms,elapsed ms" line per startup stage, sent
+    // once the stream is up or the connection has failed
+    void startupProfileReady(QStringList stages);
+
+private slots:
+    void handleLaunchRequestCompleted();
+
 private:
     bool initialize();
 
+    static
+    void checkReceiveBufferLimit(int bitrateKbps);
+
+    // Called by the deferred cleanup once the stream has stopped
+    void recordSessionHistory();
+
+    static
+    void releaseProbedDevices();
+
+    static
+    void keepVideoWarm();
+
     bool validateLaunch(SDL_Window* testWindow);
 
     void emitLaunchWarning(QString text);
 
+    void displayLaunchWarnings();
+
+    void logStartupStage(const char* stage);
+
+    // Lets the Qt Quick windows drop their scene graphs and textures while
+    // they're hidden behind the stream, so they don't compete with our
+    // renderer for the GPU, and keeps them around again afterwards
+    static
+    void setGuiRenderingSuspended(bool suspended);
+
+    // Records work that ran alongside the sequential stages
+    void logParallelStartupStage(const char* stage, Uint64 startTimeUs);
+
+    static
+    bool probeDecoder(SDL_Window* window,
+                      StreamingPreferences::VideoDecoderSelection vds,
+                      int videoFormat, int width, int height, int frameRate,
+                      bool& isHardwareAccelerated, int& decoderCapabilities);
+
     static
     int getDecoderCapabilities(SDL_Window* window,
                                StreamingPreferences::VideoDecoderSelection vds,
@@ -81,16 +222,26 @@ private:
 
     void updateOptimalWindowDisplayMode();
 
+    void dispatchInputEvent(SDL_Event* event);
+
+    void drainInputEvents();
+
+    bool restartStream();
+
     static
     bool chooseDecoder(StreamingPreferences::VideoDecoderSelection vds,
                        SDL_Window* window, int videoFormat, int width, int height,
                        int frameRate, bool enableVsync, bool enableFramePacing,
-                       bool testOnly,
-                       IVideoDecoder*& chosenDecoder);
+                       StreamingPreferences::PacingMode pacingMode, bool enableVrr,
+                       bool enableSharpening, bool enableErrorConcealment,
+                       bool testOnly, IVideoDecoder*& chosenDecoder);
 
     static
     void clStageStarting(int stage);
 
+    static
+    void clStageComplete(int stage);
+
     static
     void clStageFailed(int stage, long errorCode);
 
@@ -117,6 +268,21 @@ private:
     static
     void arDecodeAndPlaySample(char* sampleData, int sampleLength);
 
+    static
+    void arTrackArrivalJitter(bool received);
+
+    static
+    int arDecoderThreadProc(void*);
+
+    static
+    int arReinitThreadProc(void*);
+
+    static
+    void arHandlePacket(const unsigned char* sampleData, int sampleLength);
+
+    static
+    void arDecodeAndSubmit(const unsigned char* sampleData, int sampleLength, bool decodeFec);
+
     static
     int drSetup(int videoFormat, int width, int height, int frameRate, void*, int);
 
@@ -136,30 +302,95 @@ private:
     IVideoDecoder* m_VideoDecoder;
     SDL_SpinLock m_DecoderLock;
     bool m_NeedsIdr;
+
+    // Set while the window is minimized or hidden. Decode units are
+    // dropped instead of decoded, and an IDR frame brings the picture
+    // back once the window can be seen again.
+    SDL_atomic_t m_WindowHidden;
+
+    SDL_threadID m_DecodeThreadId;
     bool m_AudioDisabled;
     Uint32 m_FullScreenFlag;
     int m_DisplayOriginX;
     int m_DisplayOriginY;
+    QRect m_WindowGeometry;
     bool m_PendingWindowedTransition;
     bool m_UnexpectedTermination;
     SdlInputHandler* m_InputHandler;
     SDL_SpinLock m_InputHandlerLock;
     int m_MouseEmulationRefCount;
+    bool m_VrrActive;
+    bool m_PowerSaving;
+    CaptureWriter* m_CaptureWriter;
+    StreamRecorder* m_Recorder;
+    QStringList m_LaunchWarnings;
+    QString m_LaunchError;
+    SDL_atomic_t m_LaunchComplete;
+    int m_ConnectionResult;
+    SDL_atomic_t m_ConnectionComplete;
+    Uint64 m_StartupTimeUs;
+    Uint64 m_StartupStageTimeUs;
+    QStringList m_StartupProfile;
+    SDL_SpinLock m_StartupProfileLock;
 
     int m_ActiveVideoFormat;
     int m_ActiveVideoWidth;
     int m_ActiveVideoHeight;
     int m_ActiveVideoFrameRate;
 
-    OpusMSDecoder* m_OpusDecoder;
     IAudioRenderer* m_AudioRenderer;
     OPUS_MULTISTREAM_CONFIGURATION m_AudioConfig;
+    AudioDecoder m_AudioDecoder;
     int m_AudioSampleCount;
-    Uint32 m_DropAudioEndTime;
+    int m_AudioReinitSampleCount;
+    AudioPacketQueue m_AudioPacketQueue;
+    SDL_Thread* m_AudioDecoderThread;
+    SDL_atomic_t m_AudioDecoderStopping;
+    SDL_Thread* m_AudioReinitThread;
+    SDL_atomic_t m_AudioReinitDone;
+    IAudioRenderer* m_PendingAudioRenderer;
+    bool m_AudioLossPending;
+    Uint64 m_AudioLastArrivalUs;
+    int m_AudioPacketsSinceArrival;
+    Sint64 m_AudioJitterUs;
+    AUDIO_STATS m_AudioStats;
+    SDL_SpinLock m_AudioStatsLock;
+    INPUT_STATS m_InputStats;
+    SDL_SpinLock m_InputStatsLock;
+    bool m_RestartingStream;
+    bool m_RestartPending;
+    int m_RestartWidth;
+    int m_RestartHeight;
+    int m_RestartBitrateKbps;
+    SDL_SpinLock m_RestartLock;
 
     Overlay::OverlayManager m_OverlayManager;
 
+    VIDEO_STATS m_FinalVideoStats;
+    bool m_HaveFinalVideoStats;
+
+    // The rest of the session's summary in the history
+    QString m_FinalDecoderName;
+    QString m_FinalGpuFingerprint;
+    Uint32 m_StreamDurationMs;
+
+    // moonlight-common-c keeps its connection state in globals, so a
+    // process streams from one host at a time and its callbacks find the
+    // session here. Several hosts are streamed with a process for each.
     static CONNECTION_LISTENER_CALLBACKS k_ConnCallbacks;
     static Session* s_ActiveSession;
     static QSemaphore s_ActiveSessionSemaphore;
+
+    // Set while a finished session's SDL video reference and decoder
+    // device are held for the next one
+    static bool s_VideoKeptWarm;
+    static unsigned int s_VideoWarmGeneration;
+
+    // Hidden decoder test window made by prepareLaunch(), only while
+    // video is kept warm
+    static SDL_Window* s_PreparedTestWindow;
+
+    static bool s_Headless;
+    static bool s_HeadlessDiscardVideo;
+    static int s_HeadlessInputRate;
 };
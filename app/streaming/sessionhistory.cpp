@@ -0,0 +1,87 @@
+#include "sessionhistory.h"
+#include "path.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QList>
+
+#include <SDL.h>
+
+#include <stdio.h>
+
+void SessionHistory::append(const QJsonObject& entry)
+{
+    QString path = Path::getSessionHistoryPath();
+    QDir().mkpath(QFileInfo(path).absolutePath());
+
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Unable to open session history %s: %s",
+                    qPrintable(path),
+                    qPrintable(file.errorString()));
+        return;
+    }
+
+    // One write per entry, so an entry from another process can't end
+    // up in the middle of ours
+    file.write(QJsonDocument(entry).toJson(QJsonDocument::Compact) + '\n');
+}
+
+int SessionHistory::print(const QString& host, int limit)
+{
+    QFile file(Path::getSessionHistoryPath());
+    if (!file.open(QIODevice::ReadOnly)) {
+        fprintf(stderr, "No sessions have been recorded yet\n");
+        return 0;
+    }
+
+    // Entries are oldest first, so only the last ones we read are kept
+    QList<QJsonObject> entries;
+    while (!file.atEnd()) {
+        QJsonObject entry = QJsonDocument::fromJson(file.readLine()).object();
+        if (entry.isEmpty()) {
+            // A line cut short by a crash
+            continue;
+        }
+        if (!host.isEmpty() && entry["host"].toString().compare(host, Qt::CaseInsensitive) != 0) {
+            continue;
+        }
+
+        entries.append(entry);
+        if (limit > 0 && entries.count() > limit) {
+            entries.removeFirst();
+        }
+    }
+
+    fprintf(stdout, "%-20s %-16s %-20s %-32s %8s %13s %16s %10s %s\n",
+            "Time", "Host", "Stream", "Decoder", "Duration",
+            "Drops net/jit", "Decode p50/p99", "Render p99", "Audio lost/underruns");
+
+    for (const QJsonObject& entry : entries) {
+        QString stream = QString("%1 %2x%3@%4")
+                .arg(entry["codec"].toString())
+                .arg(entry["width"].toInt())
+                .arg(entry["height"].toInt())
+                .arg(entry["fps"].toInt());
+        int durationSecs = entry["durationSecs"].toInt();
+
+        fprintf(stdout, "%-20s %-16s %-20s %-32s %5d:%02d %5.2f%%/%5.2f%% %6.2f/%6.2f ms %7.2f ms %d/%d\n",
+                qPrintable(entry["time"].toString().left(19)),
+                qPrintable(entry["host"].toString().left(16)),
+                qPrintable(stream),
+                qPrintable(entry["decoder"].toString().left(32)),
+                durationSecs / 60, durationSecs % 60,
+                entry["networkDropPercent"].toDouble(),
+                entry["jitterDropPercent"].toDouble(),
+                entry["decodeP50Ms"].toDouble(),
+                entry["decodeP99Ms"].toDouble(),
+                entry["renderP99Ms"].toDouble(),
+                entry["audioLostPackets"].toInt(),
+                entry["audioUnderruns"].toInt());
+    }
+
+    return 0;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <QJsonObject>
+#include <QString>
+
+// Keeps a summary of every stream in an append-only file of JSON lines, so
+// performance can be compared across driver updates and client versions
+// long after the logs are gone. Each session adds one line of a few
+// hundred bytes when it ends.
+class SessionHistory
+{
+public:
+    // Adds a session to the end of the history. This does file I/O, so
+    // it's called from the deferred session cleanup rather than the main
+    // thread. Sessions are never rewritten, so concurrent processes can
+    // share the history.
+    static void append(const QJsonObject& entry);
+
+    // Prints the newest entries to stdout, oldest first, optionally only
+    // those streamed from host. Returns the process exit code.
+    static int print(const QString& host, int limit);
+};
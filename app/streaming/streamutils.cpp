@@ -1,11 +1,72 @@
 #include "streamutils.h"
 
 #include <Qt>
+#include <QFile>
+#include <QList>
 
 #ifdef Q_OS_DARWIN
 #include <ApplicationServices/ApplicationServices.h>
+#include <mach/mach.h>
 #endif
 
+#ifdef Q_OS_WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#include <dxgi1_5.h>
+#include <psapi.h>
+#endif
+
+#ifdef HAVE_DRM
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#endif
+
+#ifdef Q_OS_LINUX
+#include <unistd.h>
+#endif
+
+// Systems with this much RAM or less stream in low memory mode,
+// which covers the Steam Link and 1 GB single board computers
+#define LOW_MEMORY_SYSTEM_RAM_MB 1536
+
+StreamUtils::DisplayModeCacheEntry StreamUtils::s_DisplayModeCache[16];
+SDL_SpinLock StreamUtils::s_DisplayModeCacheLock;
+
+StreamUtils::DisplayModeCacheEntry* StreamUtils::lockDisplayModeCache(int displayIndex)
+{
+    SDL_AtomicLock(&s_DisplayModeCacheLock);
+
+    if (displayIndex < 0 || displayIndex >= (int)SDL_arraysize(s_DisplayModeCache)) {
+        return nullptr;
+    }
+
+    // A display that was added, removed, or moved may now be at this
+    // index, so its bounds tell us whether we're still looking at the same one
+    DisplayModeCacheEntry* entry = &s_DisplayModeCache[displayIndex];
+    SDL_Rect bounds;
+    if (SDL_GetDisplayBounds(displayIndex, &bounds) != 0) {
+        SDL_zero(bounds);
+    }
+    if (!entry->valid || SDL_memcmp(&bounds, &entry->bounds, sizeof(bounds)) != 0) {
+        SDL_zerop(entry);
+        entry->valid = true;
+        entry->bounds = bounds;
+        entry->maxRefreshRate = -1;
+    }
+
+    return entry;
+}
+
+void StreamUtils::invalidateDisplayModeCache()
+{
+    SDL_AtomicLock(&s_DisplayModeCacheLock);
+    SDL_zero(s_DisplayModeCache);
+    SDL_AtomicUnlock(&s_DisplayModeCacheLock);
+}
+
 void StreamUtils::scaleSourceToDestinationSurface(SDL_Rect* src, SDL_Rect* dst)
 {
     int dstH = dst->w * src->h / src->w;
@@ -74,6 +135,15 @@ int StreamUtils::getDisplayRefreshRate(SDL_Window* window)
 bool StreamUtils::getRealDesktopMode(int displayIndex, SDL_DisplayMode* mode)
 {
 #ifdef Q_OS_DARWIN
+    // Asking CoreGraphics for every mode is slow, so it's only done once
+    DisplayModeCacheEntry* entry = lockDisplayModeCache(displayIndex);
+    if (entry != nullptr && entry->hasRealDesktopMode) {
+        *mode = entry->realDesktopMode;
+        SDL_AtomicUnlock(&s_DisplayModeCacheLock);
+        return true;
+    }
+    SDL_AtomicUnlock(&s_DisplayModeCacheLock);
+
 #define MAX_DISPLAYS 16
     CGDirectDisplayID displayIds[MAX_DISPLAYS];
     uint32_t displayCount = 0;
@@ -114,6 +184,13 @@ bool StreamUtils::getRealDesktopMode(int displayIndex, SDL_DisplayMode* mode)
             }
         }
     }
+
+    entry = lockDisplayModeCache(displayIndex);
+    if (entry != nullptr) {
+        entry->hasRealDesktopMode = true;
+        entry->realDesktopMode = *mode;
+    }
+    SDL_AtomicUnlock(&s_DisplayModeCacheLock);
 #else
     if (SDL_GetDesktopDisplayMode(displayIndex, mode) != 0) {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
@@ -125,3 +202,178 @@ bool StreamUtils::getRealDesktopMode(int displayIndex, SDL_DisplayMode* mode)
 
     return true;
 }
+
+int StreamUtils::getDisplayMaxRefreshRate(int displayIndex)
+{
+    DisplayModeCacheEntry* entry = lockDisplayModeCache(displayIndex);
+    if (entry != nullptr && entry->maxRefreshRate >= 0) {
+        int maxRefreshRate = entry->maxRefreshRate;
+        SDL_AtomicUnlock(&s_DisplayModeCacheLock);
+        return maxRefreshRate;
+    }
+    SDL_AtomicUnlock(&s_DisplayModeCacheLock);
+
+    int maxRefreshRate = 0;
+
+    for (int i = 0; i < SDL_GetNumDisplayModes(displayIndex); i++) {
+        SDL_DisplayMode mode;
+        if (SDL_GetDisplayMode(displayIndex, i, &mode) == 0) {
+            maxRefreshRate = SDL_max(maxRefreshRate, mode.refresh_rate);
+        }
+    }
+
+    entry = lockDisplayModeCache(displayIndex);
+    if (entry != nullptr) {
+        entry->maxRefreshRate = maxRefreshRate;
+    }
+    SDL_AtomicUnlock(&s_DisplayModeCacheLock);
+
+    return maxRefreshRate;
+}
+
+bool StreamUtils::isVariableRefreshRateSupported(SDL_Window*)
+{
+#if defined(Q_OS_WIN32)
+    typedef HRESULT (WINAPI *PFNCREATEDXGIFACTORY1)(REFIID, void**);
+    bool supported = false;
+
+    // Tearing support in the flip model is what allows G-SYNC and FreeSync
+    // displays to follow our present rate, so treat it as VRR support.
+    HMODULE dxgiHandle = LoadLibraryA("dxgi.dll");
+    if (dxgiHandle == nullptr) {
+        return false;
+    }
+
+    PFNCREATEDXGIFACTORY1 createDxgiFactory1 = (PFNCREATEDXGIFACTORY1)GetProcAddress(dxgiHandle, "CreateDXGIFactory1");
+    IDXGIFactory1* factory1;
+    if (createDxgiFactory1 != nullptr && SUCCEEDED(createDxgiFactory1(__uuidof(IDXGIFactory1), (void**)&factory1))) {
+        IDXGIFactory5* factory5;
+        if (SUCCEEDED(factory1->QueryInterface(__uuidof(IDXGIFactory5), (void**)&factory5))) {
+            BOOL allowTearing = FALSE;
+            if (SUCCEEDED(factory5->CheckFeatureSupport(DXGI_FEATURE_PRESENT_ALLOW_TEARING,
+                                                        &allowTearing, sizeof(allowTearing)))) {
+                supported = allowTearing != FALSE;
+            }
+            factory5->Release();
+        }
+        factory1->Release();
+    }
+
+    FreeLibrary(dxgiHandle);
+    return supported;
+#elif defined(HAVE_DRM)
+    bool supported = false;
+
+    // Look for a connected connector that advertises VRR
+    int fd = open("/dev/dri/card0", O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    drmModeRes* resources = drmModeGetResources(fd);
+    for (int i = 0; resources != nullptr && i < resources->count_connectors && !supported; i++) {
+        drmModeConnector* connector = drmModeGetConnector(fd, resources->connectors[i]);
+        if (connector == nullptr) {
+            continue;
+        }
+
+        if (connector->connection == DRM_MODE_CONNECTED) {
+            drmModeObjectProperties* props = drmModeObjectGetProperties(fd, connector->connector_id,
+                                                                        DRM_MODE_OBJECT_CONNECTOR);
+            for (uint32_t j = 0; props != nullptr && j < props->count_props; j++) {
+                drmModePropertyRes* prop = drmModeGetProperty(fd, props->props[j]);
+                if (prop != nullptr) {
+                    if (strcmp(prop->name, "vrr_capable") == 0 && props->prop_values[j] != 0) {
+                        supported = true;
+                    }
+                    drmModeFreeProperty(prop);
+                }
+            }
+            drmModeFreeObjectProperties(props);
+        }
+
+        drmModeFreeConnector(connector);
+    }
+
+    drmModeFreeResources(resources);
+    close(fd);
+    return supported;
+#else
+    return false;
+#endif
+}
+
+Uint64 StreamUtils::getTimeUs()
+{
+    Uint64 counter = SDL_GetPerformanceCounter();
+    Uint64 frequency = SDL_GetPerformanceFrequency();
+
+    // Split the conversion to avoid overflowing the multiplication
+    return (counter / frequency) * 1000000 + (counter % frequency) * 1000000 / frequency;
+}
+
+Uint32 StreamUtils::getPlatformWindowFlags()
+{
+#ifdef HAVE_EGL
+    // The EGL renderer needs an OpenGL ES context created through EGL,
+    // even on X11 where SDL would otherwise use GLX. The window's visual
+    // is chosen at creation time, so this has to be set up front.
+    SDL_SetHint(SDL_HINT_OPENGL_ES_DRIVER, "1");
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_ES);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 2);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 0);
+    return SDL_WINDOW_OPENGL;
+#else
+    return 0;
+#endif
+}
+
+bool StreamUtils::isLowMemoryMode()
+{
+    // LOW_MEMORY_MODE=1 or 0 overrides the detection
+    QByteArray override = qgetenv("LOW_MEMORY_MODE");
+    if (!override.isEmpty()) {
+        return override == "1";
+    }
+
+#ifdef STEAM_LINK
+    return true;
+#else
+    return SDL_GetSystemRAM() <= LOW_MEMORY_SYSTEM_RAM_MB;
+#endif
+}
+
+int StreamUtils::getResidentMemoryMb()
+{
+#if defined(Q_OS_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return -1;
+    }
+
+    return (int)(counters.WorkingSetSize / (1024 * 1024));
+#elif defined(Q_OS_DARWIN)
+    mach_task_basic_info_data_t info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) != KERN_SUCCESS) {
+        return -1;
+    }
+
+    return (int)(info.resident_size / (1024 * 1024));
+#elif defined(Q_OS_LINUX)
+    // The second field is the resident page count
+    QFile statm("/proc/self/statm");
+    if (!statm.open(QFile::ReadOnly)) {
+        return -1;
+    }
+
+    QList<QByteArray> fields = statm.readAll().split(' ');
+    if (fields.size() < 2) {
+        return -1;
+    }
+
+    return (int)(fields[1].toLongLong() * sysconf(_SC_PAGESIZE) / (1024 * 1024));
+#else
+    return -1;
+#endif
+}
@@ -8,9 +8,63 @@ public:
     static
     void scaleSourceToDestinationSurface(SDL_Rect* src, SDL_Rect* dst);
 
+    // The result is cached per display until the display's bounds change
     static
     bool getRealDesktopMode(int displayIndex, SDL_DisplayMode* mode);
 
     static
     int getDisplayRefreshRate(SDL_Window* window);
+
+    // Highest refresh rate of any mode on the display, or 0 if unknown.
+    // This is cached like getRealDesktopMode().
+    static
+    int getDisplayMaxRefreshRate(int displayIndex);
+
+    // Forgets what was cached about each display. SDL builds a new mode
+    // list each time the video subsystem starts, so this should be called
+    // whenever it does.
+    static
+    void invalidateDisplayModeCache();
+
+    // Best effort detection of a G-SYNC/FreeSync capable display and driver
+    static
+    bool isVariableRefreshRateSupported(SDL_Window* window);
+
+    // Monotonic time in microseconds from the high resolution counter
+    static
+    Uint64 getTimeUs();
+
+    // Extra flags for windows that we render video into. This also sets
+    // any SDL GL attributes that must be in place before window creation.
+    static
+    Uint32 getPlatformWindowFlags();
+
+    // Whether streams should keep as little as possible resident, at
+    // the cost of smoothness, on devices that run out of RAM with 4K
+    // streams. Detected from the system RAM unless LOW_MEMORY_MODE is set.
+    static
+    bool isLowMemoryMode();
+
+    // Resident set size of this process, or -1 if it can't be read
+    static
+    int getResidentMemoryMb();
+
+private:
+    struct DisplayModeCacheEntry
+    {
+        bool valid;
+        SDL_Rect bounds;
+        bool hasRealDesktopMode;
+        SDL_DisplayMode realDesktopMode;
+        int maxRefreshRate;
+    };
+
+    // Returns the cache entry for the display, reset if the display has
+    // changed since it was filled. s_DisplayModeCacheLock is held on
+    // return, even if there's no entry for the display.
+    static
+    DisplayModeCacheEntry* lockDisplayModeCache(int displayIndex);
+
+    static DisplayModeCacheEntry s_DisplayModeCache[16];
+    static SDL_SpinLock s_DisplayModeCacheLock;
 };
@@ -0,0 +1,253 @@
+#include "threadplacement.h"
+
+#include <QtGlobal>
+#include <QDir>
+#include <QFile>
+#include <QStringList>
+
+#if defined(Q_OS_WIN32)
+#include <Windows.h>
+#include <avrt.h>
+#elif defined(Q_OS_DARWIN)
+#include <pthread.h>
+#include <pthread/qos.h>
+#elif defined(Q_OS_LINUX)
+#include <sched.h>
+#endif
+
+struct ThreadRoleConfig
+{
+    const char* name;
+    SDL_ThreadPriority priority;
+
+    // Task the thread is registered with in the Multimedia Class
+    // Scheduler Service on Windows
+    const wchar_t* mmcssTask;
+};
+
+// Indexed by ThreadRole. The audio and vsync threads wait on hardware
+// deadlines of a few milliseconds and get a real-time policy where the
+// system allows it (SCHED_RR through rtkit on Linux, MMCSS on Windows).
+static const ThreadRoleConfig k_RoleConfigs[] = {
+    { "decode", SDL_THREAD_PRIORITY_HIGH, L"Playback" },
+    { "render", SDL_THREAD_PRIORITY_HIGH, L"Games" },
+#if SDL_VERSION_ATLEAST(2, 0, 9)
+    { "vsync", SDL_THREAD_PRIORITY_TIME_CRITICAL, L"Games" },
+    { "audio", SDL_THREAD_PRIORITY_TIME_CRITICAL, L"Pro Audio" },
+#else
+    { "vsync", SDL_THREAD_PRIORITY_HIGH, L"Games" },
+    { "audio", SDL_THREAD_PRIORITY_HIGH, L"Pro Audio" },
+#endif
+    { "input", SDL_THREAD_PRIORITY_HIGH, L"Games" },
+};
+
+SDL_SpinLock ThreadPlacement::s_InitLock;
+bool ThreadPlacement::s_Initialized;
+
+#if defined(Q_OS_WIN32)
+typedef BOOL (WINAPI *PGETSYSTEMCPUSETINFORMATION)(PSYSTEM_CPU_SET_INFORMATION, ULONG, PULONG, HANDLE, ULONG);
+typedef BOOL (WINAPI *PSETTHREADSELECTEDCPUSETS)(HANDLE, const ULONG*, ULONG);
+
+// CPU set APIs are only present on Windows 10 and later
+static PSETTHREADSELECTEDCPUSETS s_SetThreadSelectedCpuSets;
+static ULONG s_PerformanceCpuSets[64];
+static ULONG s_PerformanceCpuSetCount;
+#elif defined(Q_OS_LINUX)
+static cpu_set_t s_PerformanceCores;
+static int s_PerformanceCoreCount;
+
+// Parses a sysfs CPU list like "0-7,16-19"
+static void parseCpuList(const QString& list, cpu_set_t* cpus)
+{
+    for (const QString& range : list.trimmed().split(',')) {
+        if (range.isEmpty()) {
+            continue;
+        }
+
+        QStringList bounds = range.split('-');
+        int first = bounds[0].toInt();
+        int last = bounds.size() > 1 ? bounds[1].toInt() : first;
+        for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+            CPU_SET(cpu, cpus);
+        }
+    }
+}
+#endif
+
+void ThreadPlacement::initialize()
+{
+    bool pinningEnabled = qgetenv("THREAD_AFFINITY") != "0";
+
+#if defined(Q_OS_WIN32)
+    HMODULE kernel32 = GetModuleHandleA("kernel32.dll");
+    auto getSystemCpuSetInformation = (PGETSYSTEMCPUSETINFORMATION)GetProcAddress(kernel32, "GetSystemCpuSetInformation");
+    s_SetThreadSelectedCpuSets = (PSETTHREADSELECTEDCPUSETS)GetProcAddress(kernel32, "SetThreadSelectedCpuSets");
+    s_PerformanceCpuSetCount = 0;
+
+    ULONG length = 0;
+    if (pinningEnabled && getSystemCpuSetInformation != nullptr && s_SetThreadSelectedCpuSets != nullptr) {
+        getSystemCpuSetInformation(nullptr, 0, &length, GetCurrentProcess(), 0);
+    }
+
+    if (length != 0) {
+        QByteArray buffer(length, 0);
+        if (getSystemCpuSetInformation((PSYSTEM_CPU_SET_INFORMATION)buffer.data(), length, &length, GetCurrentProcess(), 0)) {
+            // A higher efficiency class is a faster core. The classes are
+            // all 0 unless the CPU actually has different kinds of cores.
+            BYTE maxClass = 0;
+            ULONG totalCpuSets = 0;
+            for (ULONG offset = 0; offset < length;) {
+                auto info = (PSYSTEM_CPU_SET_INFORMATION)(buffer.data() + offset);
+                if (info->Type == CpuSetInformation) {
+                    maxClass = qMax(maxClass, info->CpuSet.EfficiencyClass);
+                    totalCpuSets++;
+                }
+                offset += info->Size;
+            }
+
+            for (ULONG offset = 0; offset < length;) {
+                auto info = (PSYSTEM_CPU_SET_INFORMATION)(buffer.data() + offset);
+                if (info->Type == CpuSetInformation &&
+                        info->CpuSet.EfficiencyClass == maxClass &&
+                        s_PerformanceCpuSetCount < ARRAYSIZE(s_PerformanceCpuSets)) {
+                    s_PerformanceCpuSets[s_PerformanceCpuSetCount++] = info->CpuSet.Id;
+                }
+                offset += info->Size;
+            }
+
+            if (s_PerformanceCpuSetCount == totalCpuSets) {
+                s_PerformanceCpuSetCount = 0;
+            }
+        }
+    }
+
+    if (s_PerformanceCpuSetCount != 0) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Streaming threads will run on %lu performance cores",
+                    s_PerformanceCpuSetCount);
+    }
+#elif defined(Q_OS_LINUX)
+    CPU_ZERO(&s_PerformanceCores);
+    s_PerformanceCoreCount = 0;
+
+    if (pinningEnabled) {
+        // Hybrid Intel CPUs expose their performance cores as a separate PMU
+        QFile coreCpus("/sys/devices/cpu_core/cpus");
+        if (coreCpus.open(QIODevice::ReadOnly)) {
+            parseCpuList(QString::fromLatin1(coreCpus.readAll()), &s_PerformanceCores);
+        }
+        else {
+            // ARM kernels report each core's relative speed instead. Cores
+            // at half the speed of the fastest or better are used, so the
+            // middle cluster of 3-cluster SoCs isn't left out.
+            QDir cpuDir("/sys/devices/system/cpu");
+            QStringList cpus = cpuDir.entryList(QStringList() << "cpu[0-9]*", QDir::Dirs);
+            int capacities[CPU_SETSIZE] = {};
+            int maxCapacity = 0;
+            for (const QString& cpu : cpus) {
+                int index = cpu.mid(3).toInt();
+                QFile capacity(cpuDir.filePath(cpu + "/cpu_capacity"));
+                if (index < CPU_SETSIZE && capacity.open(QIODevice::ReadOnly)) {
+                    capacities[index] = capacity.readAll().trimmed().toInt();
+                    maxCapacity = qMax(maxCapacity, capacities[index]);
+                }
+            }
+
+            for (int i = 0; i < CPU_SETSIZE; i++) {
+                if (maxCapacity != 0 && capacities[i] * 2 >= maxCapacity) {
+                    CPU_SET(i, &s_PerformanceCores);
+                }
+            }
+        }
+
+        // Don't pin anything if every core we're allowed to run on is
+        // already a performance core
+        cpu_set_t allowedCores;
+        if (sched_getaffinity(0, sizeof(allowedCores), &allowedCores) == 0) {
+            CPU_AND(&s_PerformanceCores, &s_PerformanceCores, &allowedCores);
+            if (CPU_EQUAL(&s_PerformanceCores, &allowedCores)) {
+                CPU_ZERO(&s_PerformanceCores);
+            }
+        }
+
+        s_PerformanceCoreCount = CPU_COUNT(&s_PerformanceCores);
+    }
+
+    if (s_PerformanceCoreCount != 0) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Streaming threads will run on %d performance cores",
+                    s_PerformanceCoreCount);
+    }
+
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+    // Let SDL give the time critical threads a real-time policy, through
+    // rtkit if we're not allowed to set it ourselves. SDL's policy hint is
+    // left alone since it would make every high priority thread real-time.
+    SDL_SetHint(SDL_HINT_THREAD_FORCE_REALTIME_TIME_CRITICAL, "1");
+#endif
+#else
+    Q_UNUSED(pinningEnabled);
+#endif
+}
+
+bool ThreadPlacement::setCurrentThreadAffinity()
+{
+#if defined(Q_OS_WIN32)
+    if (s_PerformanceCpuSetCount != 0) {
+        return s_SetThreadSelectedCpuSets(GetCurrentThread(), s_PerformanceCpuSets, s_PerformanceCpuSetCount);
+    }
+#elif defined(Q_OS_LINUX)
+    if (s_PerformanceCoreCount != 0) {
+        return sched_setaffinity(0, sizeof(s_PerformanceCores), &s_PerformanceCores) == 0;
+    }
+#elif defined(Q_OS_DARWIN)
+    // Core placement isn't exposed on macOS, but the scheduler keeps
+    // user interactive threads on the performance cores of Apple Silicon
+    return pthread_set_qos_class_self_np(QOS_CLASS_USER_INTERACTIVE, 0) == 0;
+#endif
+
+    return true;
+}
+
+void ThreadPlacement::applyToCurrentThread(ThreadRole role)
+{
+    const ThreadRoleConfig& config = k_RoleConfigs[role];
+
+    SDL_AtomicLock(&s_InitLock);
+    if (!s_Initialized) {
+        initialize();
+        s_Initialized = true;
+    }
+    SDL_AtomicUnlock(&s_InitLock);
+
+    if (!setCurrentThreadAffinity()) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Unable to place %s thread on performance cores",
+                    config.name);
+    }
+
+    // Raising priorities on the Steam Link starves the other threads of
+    // the little CPU time available there
+#ifndef STEAM_LINK
+#ifdef Q_OS_WIN32
+    // MMCSS boosts the thread above SDL's priorities without the risk of
+    // starving the rest of the system. The registration ends with the thread.
+    DWORD taskIndex = 0;
+    if (AvSetMmThreadCharacteristicsW(config.mmcssTask, &taskIndex) != nullptr) {
+        return;
+    }
+
+    SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                "AvSetMmThreadCharacteristics() failed for %s thread: %d",
+                config.name,
+                GetLastError());
+#endif
+
+    if (SDL_SetThreadPriority(config.priority) < 0) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Unable to set %s thread priority: %s",
+                    config.name,
+                    SDL_GetError());
+    }
+#endif
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <SDL.h>
+
+// Decides how each of the streaming threads is scheduled. Every thread on
+// the path from the network to the screen or speakers calls
+// applyToCurrentThread() when it starts, and this is the only place that
+// knows what priority, scheduling class and cores each role gets.
+//
+// On CPUs with cores of different speeds (big.LITTLE ARM boards, hybrid
+// Intel CPUs), these threads are kept on the performance cores so the
+// scheduler can't park them on an efficiency core mid-stream. Core
+// pinning can be turned off with THREAD_AFFINITY=0.
+class ThreadPlacement
+{
+public:
+    enum ThreadRole
+    {
+        TR_DECODE,
+        TR_RENDER,
+        TR_VSYNC,
+        TR_AUDIO,
+        TR_INPUT,
+    };
+
+    static void applyToCurrentThread(ThreadRole role);
+
+private:
+    static void initialize();
+
+    static bool setCurrentThreadAffinity();
+
+    static SDL_SpinLock s_InitLock;
+    static bool s_Initialized;
+};
@@ -0,0 +1,390 @@
+#include "bitstreamanalytics.h"
+#include "ffmpeg-renderers/pacer/spscqueue.h"
+
+#include <Limelight.h>
+
+#include <h264_stream.h>
+
+#include <QtGlobal>
+
+#include <math.h>
+
+// Frames waiting to be analyzed. Each one holds a packet buffer out of
+// the decoder's pool until it's done.
+#define ANALYTICS_QUEUE_SIZE 32
+
+// Enough of a slice NAL for the start of its header. Parsing the rest
+// would only cost us a conversion of the whole slice to an RBSP.
+#define ANALYTICS_SLICE_HEADER_BYTES 64
+
+// Indexes into s_FrameSizes
+#define ANALYTICS_IDR 0
+#define ANALYTICS_P 1
+
+struct FrameSizeStats
+{
+    int frames;
+    Uint64 totalBytes;
+    double totalSquaredBytes;
+    int minBytes;
+    int maxBytes;
+    int buckets[BITSTREAM_SIZE_BUCKETS];
+};
+
+struct QueuedFrame
+{
+    AVBufferRef* buffer;
+    int size;
+    int frameNumber;
+    int frameType;
+    int videoFormat;
+    Uint32 arrivalTimeMs;
+};
+
+SDL_Thread* BitstreamAnalytics::s_Thread;
+
+static SpscQueue<QueuedFrame, ANALYTICS_QUEUE_SIZE>* s_Queue;
+static SDL_atomic_t s_Stopping;
+
+// Written by the decoder thread
+static int s_SkippedFrames;
+
+// Everything below is only touched by the analytics thread until it exits
+static FrameSizeStats s_FrameSizes[2];
+static int s_SliceCounts[BITSTREAM_SLICE_BUCKETS];
+static int s_H264SliceTypes[3];
+static int s_IdrIntervals;
+static Uint64 s_TotalIdrIntervalFrames;
+static Uint64 s_TotalIdrIntervalMs;
+static int s_MinIdrIntervalFrames;
+static int s_LastIdrFrameNumber;
+static Uint32 s_LastIdrTimeMs;
+static Uint32 s_FirstArrivalTimeMs;
+static Uint32 s_LastArrivalTimeMs;
+static Uint32 s_WindowStartMs;
+static Uint64 s_WindowBytes;
+static Uint64 s_PeakWindowBytes;
+
+static int getSizeBucket(int bytes)
+{
+    int bucket = 0;
+
+    while (bucket < BITSTREAM_SIZE_BUCKETS - 1 && (bytes >> (10 + bucket)) != 0) {
+        bucket++;
+    }
+
+    return bucket;
+}
+
+// Counts the slices of the frame, looking into the slice headers of H.264
+// frames for their types. HEVC slice segment headers can't be read without
+// its own parameter sets, so only their NAL types are looked at.
+static int countSlices(h264_stream_t* stream, const QueuedFrame& frame)
+{
+    uint8_t* data = frame.buffer->data;
+    int remaining = frame.size;
+    int nalStart, nalEnd;
+    int slices = 0;
+
+    while (remaining > 0 && find_nal_unit(data, remaining, &nalStart, &nalEnd) > 0) {
+        uint8_t* nal = &data[nalStart];
+        int nalLength = nalEnd - nalStart;
+
+        if (frame.videoFormat & VIDEO_FORMAT_MASK_H264) {
+            int nalType = nal[0] & 0x1F;
+
+            if (nalType == NAL_UNIT_TYPE_SPS || nalType == NAL_UNIT_TYPE_PPS) {
+                // The slice headers of this frame need these
+                read_nal_unit(stream, nal, nalLength);
+            }
+            else if (nalType == NAL_UNIT_TYPE_CODED_SLICE_NON_IDR || nalType == NAL_UNIT_TYPE_CODED_SLICE_IDR) {
+                slices++;
+
+                if (read_nal_unit(stream, nal, qMin(nalLength, ANALYTICS_SLICE_HEADER_BYTES)) >= 0) {
+                    switch (stream->sh->slice_type % 5) {
+                    case SH_SLICE_TYPE_P:
+                    case SH_SLICE_TYPE_SP:
+                        s_H264SliceTypes[0]++;
+                        break;
+                    case SH_SLICE_TYPE_B:
+                        s_H264SliceTypes[1]++;
+                        break;
+                    default:
+                        s_H264SliceTypes[2]++;
+                        break;
+                    }
+                }
+            }
+        }
+        else {
+            // HEVC VCL NAL types are 0 through 31
+            if (((nal[0] >> 1) & 0x3F) < 32) {
+                slices++;
+            }
+        }
+
+        data += nalEnd;
+        remaining -= nalEnd;
+    }
+
+    return slices;
+}
+
+static void analyzeFrame(h264_stream_t* stream, const QueuedFrame& frame)
+{
+    FrameSizeStats* sizes = &s_FrameSizes[frame.frameType == FRAME_TYPE_IDR ? ANALYTICS_IDR : ANALYTICS_P];
+
+    if (sizes->frames == 0 || frame.size < sizes->minBytes) {
+        sizes->minBytes = frame.size;
+    }
+    sizes->maxBytes = qMax(sizes->maxBytes, frame.size);
+    sizes->frames++;
+    sizes->totalBytes += frame.size;
+    sizes->totalSquaredBytes += (double)frame.size * frame.size;
+    sizes->buckets[getSizeBucket(frame.size)]++;
+
+    // Some hosts only send a single slice per frame, and others send
+    // several so they can be decoded in parallel
+    int slices = countSlices(stream, frame);
+    s_SliceCounts[qMin(slices, BITSTREAM_SLICE_BUCKETS - 1)]++;
+
+    if (frame.frameType == FRAME_TYPE_IDR) {
+        if (s_LastIdrTimeMs != 0) {
+            int intervalFrames = frame.frameNumber - s_LastIdrFrameNumber;
+
+            if (s_IdrIntervals == 0 || intervalFrames < s_MinIdrIntervalFrames) {
+                s_MinIdrIntervalFrames = intervalFrames;
+            }
+            s_IdrIntervals++;
+            s_TotalIdrIntervalFrames += intervalFrames;
+            s_TotalIdrIntervalMs += frame.arrivalTimeMs - s_LastIdrTimeMs;
+        }
+
+        s_LastIdrFrameNumber = frame.frameNumber;
+        s_LastIdrTimeMs = frame.arrivalTimeMs;
+    }
+
+    // One second windows show how bursty the stream is as a whole,
+    // which the IDR and P-frame sizes alone don't
+    if (s_FirstArrivalTimeMs == 0) {
+        s_FirstArrivalTimeMs = s_WindowStartMs = frame.arrivalTimeMs;
+    }
+    else if (SDL_TICKS_PASSED(frame.arrivalTimeMs, s_WindowStartMs + 1000)) {
+        s_PeakWindowBytes = qMax(s_PeakWindowBytes, s_WindowBytes);
+        s_WindowBytes = 0;
+        s_WindowStartMs = frame.arrivalTimeMs;
+    }
+    s_WindowBytes += frame.size;
+    s_LastArrivalTimeMs = frame.arrivalTimeMs;
+}
+
+static void logFrameSizes(const char* name, const FrameSizeStats* sizes)
+{
+    if (sizes->frames == 0) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "%s: none",
+                    name);
+        return;
+    }
+
+    double meanBytes = (double)sizes->totalBytes / sizes->frames;
+    double variance = sizes->totalSquaredBytes / sizes->frames - meanBytes * meanBytes;
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "%s: %d frames, average %.1f KB (min %.1f KB, max %.1f KB, standard deviation %.1f KB)",
+                name,
+                sizes->frames,
+                meanBytes / 1024,
+                sizes->minBytes / 1024.0,
+                sizes->maxBytes / 1024.0,
+                sqrt(qMax(variance, 0.0)) / 1024);
+}
+
+static void logReport()
+{
+    int frames = s_FrameSizes[ANALYTICS_IDR].frames + s_FrameSizes[ANALYTICS_P].frames;
+    if (frames == 0) {
+        return;
+    }
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Bitstream analytics for %d frames over %.1f seconds (%d frames skipped)",
+                frames,
+                (s_LastArrivalTimeMs - s_FirstArrivalTimeMs) / 1000.0,
+                s_SkippedFrames);
+
+    logFrameSizes("IDR frames", &s_FrameSizes[ANALYTICS_IDR]);
+    logFrameSizes("P-frames", &s_FrameSizes[ANALYTICS_P]);
+
+    if (s_FrameSizes[ANALYTICS_IDR].frames != 0 && s_FrameSizes[ANALYTICS_P].frames != 0) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Average IDR frame is %.1fx the size of a P-frame",
+                    ((double)s_FrameSizes[ANALYTICS_IDR].totalBytes / s_FrameSizes[ANALYTICS_IDR].frames) /
+                    ((double)s_FrameSizes[ANALYTICS_P].totalBytes / s_FrameSizes[ANALYTICS_P].frames));
+    }
+
+    if (s_IdrIntervals != 0) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "IDR frames every %.1f frames (%.2f seconds) on average, %d frames at the least",
+                    (double)s_TotalIdrIntervalFrames / s_IdrIntervals,
+                    s_TotalIdrIntervalMs / 1000.0 / s_IdrIntervals,
+                    s_MinIdrIntervalFrames);
+    }
+
+    Uint32 durationMs = s_LastArrivalTimeMs - s_FirstArrivalTimeMs;
+    if (durationMs >= 1000) {
+        Uint64 totalBytes = s_FrameSizes[ANALYTICS_IDR].totalBytes + s_FrameSizes[ANALYTICS_P].totalBytes;
+        double averageWindowBytes = totalBytes * 1000.0 / durationMs;
+
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Peak second carried %.2fx the average of %.1f KB per second",
+                    qMax(s_PeakWindowBytes, s_WindowBytes) / averageWindowBytes,
+                    averageWindowBytes / 1024);
+    }
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Frame sizes (IDR frames / P-frames):");
+    for (int i = 0; i < BITSTREAM_SIZE_BUCKETS; i++) {
+        if (s_FrameSizes[ANALYTICS_IDR].buckets[i] == 0 && s_FrameSizes[ANALYTICS_P].buckets[i] == 0) {
+            continue;
+        }
+
+        char range[32];
+        if (i == 0) {
+            SDL_snprintf(range, sizeof(range), "< 1 KB");
+        }
+        else if (i == BITSTREAM_SIZE_BUCKETS - 1) {
+            SDL_snprintf(range, sizeof(range), ">= %d KB", 1 << (i - 1));
+        }
+        else {
+            SDL_snprintf(range, sizeof(range), "%d-%d KB", 1 << (i - 1), 1 << i);
+        }
+
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "  %s: %d / %d",
+                    range,
+                    s_FrameSizes[ANALYTICS_IDR].buckets[i],
+                    s_FrameSizes[ANALYTICS_P].buckets[i]);
+    }
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Slices per frame:");
+    for (int i = 0; i < BITSTREAM_SLICE_BUCKETS; i++) {
+        if (s_SliceCounts[i] != 0) {
+            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                        "  %d%s: %d frames",
+                        i,
+                        i == BITSTREAM_SLICE_BUCKETS - 1 ? " or more" : "",
+                        s_SliceCounts[i]);
+        }
+    }
+
+    if (s_H264SliceTypes[0] + s_H264SliceTypes[1] + s_H264SliceTypes[2] != 0) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "H.264 slice types: %d P, %d B, %d I",
+                    s_H264SliceTypes[0],
+                    s_H264SliceTypes[1],
+                    s_H264SliceTypes[2]);
+    }
+}
+
+void BitstreamAnalytics::start()
+{
+    SDL_assert(s_Thread == nullptr);
+
+    if (qgetenv("BITSTREAM_ANALYTICS") != "1") {
+        return;
+    }
+
+    SDL_zero(s_FrameSizes);
+    SDL_zero(s_SliceCounts);
+    SDL_zero(s_H264SliceTypes);
+    s_IdrIntervals = 0;
+    s_TotalIdrIntervalFrames = 0;
+    s_TotalIdrIntervalMs = 0;
+    s_MinIdrIntervalFrames = 0;
+    s_LastIdrFrameNumber = 0;
+    s_LastIdrTimeMs = 0;
+    s_FirstArrivalTimeMs = 0;
+    s_LastArrivalTimeMs = 0;
+    s_WindowStartMs = 0;
+    s_WindowBytes = 0;
+    s_PeakWindowBytes = 0;
+    s_SkippedFrames = 0;
+    SDL_AtomicSet(&s_Stopping, 0);
+
+    s_Queue = new SpscQueue<QueuedFrame, ANALYTICS_QUEUE_SIZE>();
+    s_Thread = SDL_CreateThread(analyticsThreadProc, "BitstreamAnalytics", nullptr);
+    if (s_Thread == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unable to create bitstream analytics thread: %s",
+                     SDL_GetError());
+        delete s_Queue;
+        s_Queue = nullptr;
+        return;
+    }
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Bitstream analytics enabled");
+}
+
+void BitstreamAnalytics::stop()
+{
+    if (s_Thread == nullptr) {
+        return;
+    }
+
+    // The thread finishes the frames it has queued before exiting
+    SDL_AtomicSet(&s_Stopping, 1);
+    s_Queue->stopWaiting();
+    SDL_WaitThread(s_Thread, nullptr);
+    s_Thread = nullptr;
+
+    delete s_Queue;
+    s_Queue = nullptr;
+
+    logReport();
+}
+
+void BitstreamAnalytics::submit(int frameNumber, int frameType, int videoFormat,
+                                AVBufferRef* buffer, int size)
+{
+    QueuedFrame frame;
+
+    frame.buffer = av_buffer_ref(buffer);
+    if (frame.buffer == nullptr) {
+        s_SkippedFrames++;
+        return;
+    }
+
+    frame.size = size;
+    frame.frameNumber = frameNumber;
+    frame.frameType = frameType;
+    frame.videoFormat = videoFormat;
+    frame.arrivalTimeMs = SDL_GetTicks();
+
+    if (!s_Queue->enqueue(frame)) {
+        av_buffer_unref(&frame.buffer);
+        s_SkippedFrames++;
+    }
+}
+
+int BitstreamAnalytics::analyticsThreadProc(void*)
+{
+    h264_stream_t* stream = h264_new();
+    QueuedFrame frame;
+
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_LOW);
+
+    while (s_Queue->waitForItems(-1) || !SDL_AtomicGet(&s_Stopping)) {
+        while (s_Queue->dequeue(frame)) {
+            analyzeFrame(stream, frame);
+
+            // This returns the packet buffer to the decoder's pool
+            av_buffer_unref(&frame.buffer);
+        }
+    }
+
+    h264_free(stream);
+    return 0;
+}
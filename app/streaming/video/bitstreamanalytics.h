@@ -0,0 +1,47 @@
+#pragma once
+
+#include <SDL.h>
+
+extern "C" {
+#include <libavutil/buffer.h>
+}
+
+// Frame sizes are bucketed by powers of 2 from 1 KB up to 512 KB
+#define BITSTREAM_SIZE_BUCKETS 11
+
+// Frames with this many slices or more share the last bucket
+#define BITSTREAM_SLICE_BUCKETS 17
+
+// Describes what the host actually sends us, to tune the bitrate and FEC
+// against: how large IDR frames are next to P-frames, how bursty the frame
+// sizes are, how often IDR frames come, and how many slices (and for H.264,
+// which slice types) each frame is made of. Analytics are enabled with
+// BITSTREAM_ANALYTICS=1 and logged when the session ends.
+//
+// The decoder only takes a reference to each packet buffer it has already
+// filled for FFmpeg, and the frames are parsed on a background thread. If
+// that thread falls behind, frames are left out of the analytics rather
+// than holding up the decoder.
+class BitstreamAnalytics
+{
+public:
+    static void start();
+
+    // Logs the report. The decoder must be stopped before calling this.
+    static void stop();
+
+    static bool isActive()
+    {
+        return s_Thread != nullptr;
+    }
+
+    // Called by the decoder with the Annex B data of each frame. buffer
+    // is referenced, not copied.
+    static void submit(int frameNumber, int frameType, int videoFormat,
+                       AVBufferRef* buffer, int size);
+
+private:
+    static int analyticsThreadProc(void* context);
+
+    static SDL_Thread* s_Thread;
+};
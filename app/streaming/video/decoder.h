@@ -3,11 +3,18 @@
 #include <Limelight.h>
 #include <SDL.h>
 #include "settings/streamingpreferences.h"
+#include "frametimehistogram.h"
 
 #define SDL_CODE_FRAME_READY 0
+#define SDL_CODE_RESTART_STREAM 1
+#define SDL_CODE_DISPLAY_CHANGED 2
 
 #define MAX_SLICES 4
 
+// Software decoding can use more slices to spread work across
+// all cores, since it doesn't have a fixed-function decoder
+#define MAX_SOFTWARE_SLICES 16
+
 typedef struct _VIDEO_STATS {
     uint32_t receivedFrames;
     uint32_t decodedFrames;
@@ -15,10 +22,37 @@ typedef struct _VIDEO_STATS {
     uint32_t totalFrames;
     uint32_t networkDroppedFrames;
     uint32_t pacerDroppedFrames;
-    uint32_t totalReassemblyTime;
-    uint32_t totalDecodeTime;
-    uint32_t totalPacerTime;
-    uint32_t totalRenderTime;
+    // All total*Time values are in microseconds
+    uint64_t totalReassemblyTime;
+    uint64_t totalDecodeTime;
+    uint64_t totalPacerTime;
+    uint64_t totalRenderTime;
+    // Time to hand each frame to decoders that decode and render out of
+    // our sight, since that's all we can measure of them
+    uint32_t submittedFrames;
+    uint64_t totalSubmitTime;
+    uint32_t multiFrameDecodes;
+    uint32_t queuedDecodeUnits;
+    uint32_t totalDecodeQueueDepth;
+    uint32_t maxDecodeQueueDepth;
+    uint64_t totalDecodeQueueTime;
+    uint32_t idrFrames;
+    uint32_t idrRequests;
+    uint32_t rfiRecoveries;
+    // Runs of consecutive frames lost in the network, and the longest run
+    uint32_t lossBursts;
+    uint32_t maxLossBurst;
+    // The RFC 3550 interarrival jitter estimate summed over received frames
+    uint64_t totalArrivalJitter;
+    uint32_t concealedFrames;
+    uint64_t totalConcealmentTime;
+    uint32_t presentLatencySamples;
+    uint64_t totalPresentLatency;
+    FrameTimeHistogram reassemblyTimes;
+    FrameTimeHistogram decodeTimes;
+    FrameTimeHistogram pacerTimes;
+    FrameTimeHistogram renderTimes;
+    FrameTimeHistogram submitTimes;
     float totalFps;
     float receivedFps;
     float decodedFps;
@@ -36,6 +70,10 @@ typedef struct _DECODER_PARAMETERS {
     int frameRate;
     bool enableVsync;
     bool enableFramePacing;
+    StreamingPreferences::PacingMode pacingMode;
+    bool enableVrr;
+    bool enableSharpening;
+    bool enableErrorConcealment;
 } DECODER_PARAMETERS, *PDECODER_PARAMETERS;
 
 class IVideoDecoder {
@@ -46,4 +84,41 @@ public:
     virtual int getDecoderCapabilities() = 0;
     virtual int submitDecodeUnit(PDECODE_UNIT du) = 0;
     virtual void renderFrameOnMainThread() = 0;
+
+    // Adapts the decoder to a window or display change without destroying
+    // the decoding state. Returns false if the decoder must be recreated.
+    virtual bool reinitializePresentation(PDECODER_PARAMETERS) {
+        return false;
+    }
+
+    // Adapts the output to a new window size on the same display while
+    // frames keep flowing. Returns false if presentation must be rebuilt.
+    virtual bool notifyWindowResized(PDECODER_PARAMETERS) {
+        return false;
+    }
+
+    // Copies the video stats of the whole session so far. Returns false
+    // if the decoder doesn't collect them.
+    virtual bool getGlobalVideoStats(VIDEO_STATS&) {
+        return false;
+    }
+
+    // Like getGlobalVideoStats(), but as of the last stats window, so it
+    // can be called from the main thread while frames are being decoded
+    virtual bool getLiveVideoStats(VIDEO_STATS&) {
+        return false;
+    }
+
+    // Saves the next frame shown as a screenshot without holding up
+    // rendering. Returns false if the decoder can't take screenshots.
+    virtual bool requestScreenshot() {
+        return false;
+    }
+
+    // Names the decoder and how it presents frames, for the session
+    // history, or returns nullptr if there's nothing more to say than
+    // isHardwareAccelerated(). Called on the main thread.
+    virtual const char* getDecoderName() {
+        return nullptr;
+    }
 };
@@ -0,0 +1,198 @@
+#include "decodercache.h"
+
+#include <QSettings>
+#include <QSysInfo>
+#include <QFile>
+#include <QDir>
+
+#include <SDL.h>
+
+#ifdef HAVE_FFMPEG
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+#endif
+
+#ifdef Q_OS_WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#include <d3d9.h>
+#endif
+
+#define SER_DECODERCACHE "decodercache"
+#define SER_FINGERPRINT "fingerprint"
+#define SER_HWACCEL "hwaccel"
+#define SER_CAPABILITIES "caps"
+#define SER_HWACCELRANKING "hwaccelranking"
+
+QString DecoderCapabilityCache::getEntryKey(StreamingPreferences::VideoDecoderSelection vds,
+                                            int videoFormat, int width, int height, int frameRate)
+{
+    return QString("%1-%2-%3x%4x%5").arg(vds).arg(videoFormat, 0, 16).arg(width).arg(height).arg(frameRate);
+}
+
+QString DecoderCapabilityCache::getDriverFingerprint()
+{
+    static QString fingerprint;
+
+    if (!fingerprint.isEmpty()) {
+        return fingerprint;
+    }
+
+    // The same GPU may behave differently across video drivers (X11 vs. Wayland)
+    const char* videoDriver = SDL_GetCurrentVideoDriver();
+    fingerprint = getGpuFingerprint() + "|" + (videoDriver != nullptr ? videoDriver : "");
+    return fingerprint;
+}
+
+QString DecoderCapabilityCache::getGpuFingerprint()
+{
+    static QString fingerprint;
+
+    if (!fingerprint.isEmpty()) {
+        return fingerprint;
+    }
+
+    QStringList components;
+
+    components.append(VERSION_STR);
+    components.append(QSysInfo::kernelVersion());
+    components.append(QSysInfo::productVersion());
+
+#ifdef HAVE_FFMPEG
+    components.append(QString::number(avcodec_version()));
+#endif
+
+#if defined(Q_OS_WIN32)
+    IDirect3D9* d3d9 = Direct3DCreate9(D3D_SDK_VERSION);
+    if (d3d9 != nullptr) {
+        D3DADAPTER_IDENTIFIER9 id;
+        if (SUCCEEDED(d3d9->GetAdapterIdentifier(D3DADAPTER_DEFAULT, 0, &id))) {
+            components.append(QString("%1:%2:%3")
+                              .arg(id.VendorId, 0, 16)
+                              .arg(id.DeviceId, 0, 16)
+                              .arg(id.DriverVersion.QuadPart));
+        }
+        d3d9->Release();
+    }
+#elif defined(Q_OS_UNIX) && !defined(Q_OS_DARWIN)
+    // In-tree DRM drivers are versioned with the kernel, but the
+    // NVIDIA proprietary driver has its own version.
+    QFile nvidiaVersion("/proc/driver/nvidia/version");
+    if (nvidiaVersion.open(QIODevice::ReadOnly)) {
+        components.append(QString::fromUtf8(nvidiaVersion.readLine()).trimmed());
+    }
+
+    QDir drmDir("/sys/class/drm");
+    for (const QString& card : drmDir.entryList(QStringList("card?"), QDir::Dirs | QDir::System)) {
+        QFile vendor(drmDir.filePath(card + "/device/vendor"));
+        QFile device(drmDir.filePath(card + "/device/device"));
+        if (vendor.open(QIODevice::ReadOnly) && device.open(QIODevice::ReadOnly)) {
+            components.append(QString::fromUtf8(vendor.readAll()).trimmed() + ":" +
+                              QString::fromUtf8(device.readAll()).trimmed());
+        }
+    }
+#endif
+
+    fingerprint = components.join('|');
+    return fingerprint;
+}
+
+bool DecoderCapabilityCache::lookup(StreamingPreferences::VideoDecoderSelection vds,
+                                    int videoFormat, int width, int height, int frameRate,
+                                    bool& isHardwareAccelerated, int& decoderCapabilities)
+{
+    QSettings settings;
+
+    settings.beginGroup(SER_DECODERCACHE);
+
+    if (settings.value(SER_FINGERPRINT).toString() != getDriverFingerprint()) {
+        // Our cached data is stale
+        return false;
+    }
+
+    settings.beginGroup(getEntryKey(vds, videoFormat, width, height, frameRate));
+    if (!settings.contains(SER_HWACCEL) || !settings.contains(SER_CAPABILITIES)) {
+        return false;
+    }
+
+    isHardwareAccelerated = settings.value(SER_HWACCEL).toBool();
+    decoderCapabilities = settings.value(SER_CAPABILITIES).toInt();
+    return true;
+}
+
+void DecoderCapabilityCache::beginFreshGroup(QSettings& settings)
+{
+    settings.beginGroup(SER_DECODERCACHE);
+
+    // Drop everything if the GPU or driver has changed since our last probe
+    QString fingerprint = getDriverFingerprint();
+    if (settings.value(SER_FINGERPRINT).toString() != fingerprint) {
+        settings.remove("");
+        settings.setValue(SER_FINGERPRINT, fingerprint);
+    }
+}
+
+void DecoderCapabilityCache::store(StreamingPreferences::VideoDecoderSelection vds,
+                                   int videoFormat, int width, int height, int frameRate,
+                                   bool isHardwareAccelerated, int decoderCapabilities)
+{
+    QSettings settings;
+
+    beginFreshGroup(settings);
+
+    settings.beginGroup(getEntryKey(vds, videoFormat, width, height, frameRate));
+    settings.setValue(SER_HWACCEL, isHardwareAccelerated);
+    settings.setValue(SER_CAPABILITIES, decoderCapabilities);
+}
+
+bool DecoderCapabilityCache::lookupHwAccelRanking(StreamingPreferences::VideoDecoderSelection vds,
+                                                  int videoFormat, int width, int height, int frameRate,
+                                                  QList<int>& ranking)
+{
+    QSettings settings;
+
+    settings.beginGroup(SER_DECODERCACHE);
+
+    if (settings.value(SER_FINGERPRINT).toString() != getDriverFingerprint()) {
+        // Our cached data is stale
+        return false;
+    }
+
+    settings.beginGroup(getEntryKey(vds, videoFormat, width, height, frameRate));
+    if (!settings.contains(SER_HWACCELRANKING)) {
+        return false;
+    }
+
+    ranking.clear();
+    for (const QVariant& key : settings.value(SER_HWACCELRANKING).toList()) {
+        ranking.append(key.toInt());
+    }
+    return true;
+}
+
+void DecoderCapabilityCache::storeHwAccelRanking(StreamingPreferences::VideoDecoderSelection vds,
+                                                 int videoFormat, int width, int height, int frameRate,
+                                                 const QList<int>& ranking)
+{
+    QSettings settings;
+
+    beginFreshGroup(settings);
+
+    QVariantList keys;
+    for (int key : ranking) {
+        keys.append(key);
+    }
+
+    settings.beginGroup(getEntryKey(vds, videoFormat, width, height, frameRate));
+    settings.setValue(SER_HWACCELRANKING, keys);
+}
+
+void DecoderCapabilityCache::invalidate()
+{
+    QSettings settings;
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Invalidating decoder capability cache");
+    settings.remove(SER_DECODERCACHE);
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "settings/streamingpreferences.h"
+
+#include <QSettings>
+
+#include <QList>
+#include <QString>
+
+// Persists the results of decoder probing across launches, so we can skip
+// the test decoder instantiations (and test frame decodes) on warm starts.
+// Entries are discarded whenever the GPU/driver fingerprint changes.
+class DecoderCapabilityCache
+{
+public:
+    static bool lookup(StreamingPreferences::VideoDecoderSelection vds,
+                       int videoFormat, int width, int height, int frameRate,
+                       bool& isHardwareAccelerated, int& decoderCapabilities);
+
+    static void store(StreamingPreferences::VideoDecoderSelection vds,
+                      int videoFormat, int width, int height, int frameRate,
+                      bool isHardwareAccelerated, int decoderCapabilities);
+
+    // The HWACCEL_PROBE_KEY()s of the hwaccels that worked, fastest first
+    static bool lookupHwAccelRanking(StreamingPreferences::VideoDecoderSelection vds,
+                                     int videoFormat, int width, int height, int frameRate,
+                                     QList<int>& ranking);
+
+    static void storeHwAccelRanking(StreamingPreferences::VideoDecoderSelection vds,
+                                    int videoFormat, int width, int height, int frameRate,
+                                    const QList<int>& ranking);
+
+    static void invalidate();
+
+    // Identifies the GPU, its driver and our own build. This can be used
+    // before SDL video is initialized.
+    static QString getGpuFingerprint();
+
+private:
+    static QString getEntryKey(StreamingPreferences::VideoDecoderSelection vds,
+                               int videoFormat, int width, int height, int frameRate);
+
+    static QString getDriverFingerprint();
+
+    // Opens the group of our entries, dropping them all first if
+    // the GPU or driver has changed since they were stored
+    static void beginFreshGroup(QSettings& settings);
+};
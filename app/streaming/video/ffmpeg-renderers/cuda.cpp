@@ -1,29 +1,77 @@
 #include "cuda.h"
 
+#include <Limelight.h>
+#include <streaming/video/hwdevicecache.h>
+
+#ifdef HAVE_CUDA_GL
+// This must come before FFmpeg's CUDA header, which otherwise
+// requires the CUDA toolkit's own cuda.h
+#include <ffnvcodec/dynlink_loader.h>
+
+extern "C" {
+#include <libavutil/hwcontext_cuda.h>
+}
+#endif
+
 CUDARenderer::CUDARenderer()
     : m_HwContext(nullptr)
+#ifdef HAVE_CUDA_GL
+    , m_VideoFormat(0),
+      m_Cuda(nullptr),
+      m_CudaContext(nullptr),
+      m_TexturesRegistered(false)
+#endif
 {
-
+#ifdef HAVE_CUDA_GL
+    SDL_zero(m_GraphicsResources);
+#endif
 }
 
 CUDARenderer::~CUDARenderer()
 {
-    if (m_HwContext != nullptr) {
-        av_buffer_unref(&m_HwContext);
+#ifdef HAVE_CUDA_GL
+    // The EGL renderer unregisters our textures before it's destroyed
+    SDL_assert(!m_TexturesRegistered);
+
+    if (m_Cuda != nullptr) {
+        cuda_free_functions(&m_Cuda);
     }
+#endif
+
+    // Creating a CUDA context is slow, so keep it for the next renderer
+    HwDeviceCache::put(AV_HWDEVICE_TYPE_CUDA, nullptr, &m_HwContext);
 }
 
-bool CUDARenderer::initialize(PDECODER_PARAMETERS)
+bool CUDARenderer::initialize(PDECODER_PARAMETERS params)
 {
     int err;
 
-    err = av_hwdevice_ctx_create(&m_HwContext, AV_HWDEVICE_TYPE_CUDA, nullptr, nullptr, 0);
-    if (err != 0) {
-        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                     "av_hwdevice_ctx_create(CUDA) failed: %d",
-                     err);
-        return false;
+    m_HwContext = HwDeviceCache::take(AV_HWDEVICE_TYPE_CUDA, nullptr);
+    if (m_HwContext == nullptr) {
+        err = av_hwdevice_ctx_create(&m_HwContext, AV_HWDEVICE_TYPE_CUDA, nullptr, nullptr, 0);
+        if (err != 0) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "av_hwdevice_ctx_create(CUDA) failed: %d",
+                         err);
+            return false;
+        }
+    }
+
+#ifdef HAVE_CUDA_GL
+    m_VideoFormat = params->videoFormat;
+
+    AVHWDeviceContext* deviceContext = (AVHWDeviceContext*)m_HwContext->data;
+    m_CudaContext = ((AVCUDADeviceContext*)deviceContext->hwctx)->cuda_ctx;
+
+    // Without these, we just fall back to reading back frames
+    if (cuda_load_functions(&m_Cuda, nullptr) != 0) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Unable to load CUDA GL interop functions");
+        m_Cuda = nullptr;
     }
+#else
+    Q_UNUSED(params);
+#endif
 
     return true;
 }
@@ -51,7 +99,128 @@ bool CUDARenderer::needsTestFrame()
 
 bool CUDARenderer::isDirectRenderingSupported()
 {
-    // We only support rendering via SDL read-back
+    // We only support rendering via the EGL renderer or SDL read-back
     return false;
 }
 
+#ifdef HAVE_CUDA_GL
+
+bool CUDARenderer::checkCudaResult(CUresult result, const char* function)
+{
+    if (result != CUDA_SUCCESS) {
+        const char* errorString = nullptr;
+
+        m_Cuda->cuGetErrorName(result, &errorString);
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "%s() failed: %s",
+                     function,
+                     errorString != nullptr ? errorString : "unknown error");
+        return false;
+    }
+
+    return true;
+}
+
+bool CUDARenderer::canCopyToGLTextures()
+{
+    // The EGL renderer's textures are 8 bits per component
+    return m_Cuda != nullptr && m_VideoFormat != VIDEO_FORMAT_H265_MAIN10;
+}
+
+bool CUDARenderer::registerGLTextures(const GLuint textures[2])
+{
+    CUcontext dummy;
+    bool ret = true;
+
+    SDL_assert(!m_TexturesRegistered);
+
+    if (!checkCudaResult(m_Cuda->cuCtxPushCurrent(m_CudaContext), "cuCtxPushCurrent")) {
+        return false;
+    }
+
+    for (int i = 0; i < 2; i++) {
+        // We overwrite the whole texture on every frame
+        if (!checkCudaResult(m_Cuda->cuGraphicsGLRegisterImage(&m_GraphicsResources[i], textures[i], GL_TEXTURE_2D,
+                                                               CU_GRAPHICS_REGISTER_FLAGS_WRITE_DISCARD),
+                             "cuGraphicsGLRegisterImage")) {
+            for (int j = 0; j < i; j++) {
+                m_Cuda->cuGraphicsUnregisterResource(m_GraphicsResources[j]);
+            }
+            ret = false;
+            break;
+        }
+    }
+
+    m_Cuda->cuCtxPopCurrent(&dummy);
+
+    m_TexturesRegistered = ret;
+    return ret;
+}
+
+bool CUDARenderer::copyToGLTextures(AVFrame* frame)
+{
+    CUcontext dummy;
+    bool ret = true;
+
+    SDL_assert(m_TexturesRegistered);
+
+    if (!checkCudaResult(m_Cuda->cuCtxPushCurrent(m_CudaContext), "cuCtxPushCurrent")) {
+        return false;
+    }
+
+    if (!checkCudaResult(m_Cuda->cuGraphicsMapResources(2, m_GraphicsResources, 0), "cuGraphicsMapResources")) {
+        m_Cuda->cuCtxPopCurrent(&dummy);
+        return false;
+    }
+
+    // Copy the NV12 planes device-to-device into the textures' arrays.
+    // The interleaved chroma plane is as many bytes wide as the luma plane.
+    for (int i = 0; i < 2; i++) {
+        CUarray array;
+
+        if (!checkCudaResult(m_Cuda->cuGraphicsSubResourceGetMappedArray(&array, m_GraphicsResources[i], 0, 0),
+                             "cuGraphicsSubResourceGetMappedArray")) {
+            ret = false;
+            break;
+        }
+
+        CUDA_MEMCPY2D copy = {};
+        copy.srcMemoryType = CU_MEMORYTYPE_DEVICE;
+        copy.srcDevice = (CUdeviceptr)frame->data[i];
+        copy.srcPitch = frame->linesize[i];
+        copy.dstMemoryType = CU_MEMORYTYPE_ARRAY;
+        copy.dstArray = array;
+        copy.WidthInBytes = frame->width;
+        copy.Height = i == 0 ? frame->height : frame->height / 2;
+
+        // Unmapping below orders this before GL's use of the texture
+        if (!checkCudaResult(m_Cuda->cuMemcpy2DAsync(&copy, 0), "cuMemcpy2DAsync")) {
+            ret = false;
+            break;
+        }
+    }
+
+    m_Cuda->cuGraphicsUnmapResources(2, m_GraphicsResources, 0);
+    m_Cuda->cuCtxPopCurrent(&dummy);
+
+    return ret;
+}
+
+void CUDARenderer::unregisterGLTextures()
+{
+    CUcontext dummy;
+
+    if (!m_TexturesRegistered) {
+        return;
+    }
+
+    m_Cuda->cuCtxPushCurrent(m_CudaContext);
+    for (int i = 0; i < 2; i++) {
+        m_Cuda->cuGraphicsUnregisterResource(m_GraphicsResources[i]);
+    }
+    m_Cuda->cuCtxPopCurrent(&dummy);
+
+    m_TexturesRegistered = false;
+}
+
+#endif
@@ -2,6 +2,12 @@
 
 #include "renderer.h"
 
+#ifdef HAVE_CUDA_GL
+#include <ffnvcodec/dynlink_cuda.h>
+
+struct CudaFunctions;
+#endif
+
 class CUDARenderer : public IFFmpegRenderer {
 public:
     CUDARenderer();
@@ -12,7 +18,26 @@ public:
     virtual bool needsTestFrame() override;
     virtual bool isDirectRenderingSupported() override;
 
+#ifdef HAVE_CUDA_GL
+    virtual bool canCopyToGLTextures() override;
+    virtual bool registerGLTextures(const GLuint textures[2]) override;
+    virtual bool copyToGLTextures(AVFrame* frame) override;
+    virtual void unregisterGLTextures() override;
+#endif
+
 private:
     AVBufferRef* m_HwContext;
-};
 
+#ifdef HAVE_CUDA_GL
+    bool checkCudaResult(CUresult result, const char* function);
+
+    int m_VideoFormat;
+
+    // Loaded at runtime, so we don't need the CUDA toolkit to build
+    // or libcuda to run on non-NVIDIA systems.
+    CudaFunctions* m_Cuda;
+    CUcontext m_CudaContext;
+    CUgraphicsResource m_GraphicsResources[2];
+    bool m_TexturesRegistered;
+#endif
+};
@@ -0,0 +1,1995 @@
+#include "d3d11va.h"
+#include <streaming/streamutils.h>
+#include <streaming/session.h>
+#include <streaming/video/framegraph.h>
+#include <streaming/video/frametracer.h>
+
+#include <SDL_syswm.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#include <dwmapi.h>
+#include <d3dcompiler.h>
+
+#include <Limelight.h>
+
+extern "C" {
+#include <libavutil/mastering_display_metadata.h>
+}
+
+#define SAFE_COM_RELEASE(x) if (x) { (x)->Release(); }
+
+// The overlays are drawn as textured quads positioned by a constant
+// buffer, so we need no vertex buffer or input layout.
+static const char k_OverlayVertexShader[] =
+    "cbuffer OverlayParams : register(b0) {\n"
+    "    float4 rect;\n"
+    "    float4 texScale;\n"
+    "};\n"
+    "struct VSOutput {\n"
+    "    float4 pos : SV_POSITION;\n"
+    "    float2 tex : TEXCOORD0;\n"
+    "};\n"
+    "VSOutput main(uint id : SV_VertexID) {\n"
+    "    VSOutput output;\n"
+    "    float2 corner = float2(id & 1, id >> 1);\n"
+    "    output.pos = float4(lerp(rect.x, rect.z, corner.x), lerp(rect.y, rect.w, corner.y), 0.0, 1.0);\n"
+    "    output.tex = corner * texScale.xy;\n"
+    "    return output;\n"
+    "}\n";
+
+// The rows convert the premultiplied overlay into the render target's
+// format. Their last element is the offset, scaled by alpha so the
+// result stays premultiplied for blending.
+static const char k_OverlayPixelShader[] =
+    "Texture2D overlayTexture : register(t0);\n"
+    "SamplerState overlaySampler : register(s0);\n"
+    "cbuffer OverlayColor : register(b1) {\n"
+    "    float4 colorRows[3];\n"
+    "};\n"
+    "struct VSOutput {\n"
+    "    float4 pos : SV_POSITION;\n"
+    "    float2 tex : TEXCOORD0;\n"
+    "};\n"
+    "float4 main(VSOutput input) : SV_TARGET {\n"
+    "    float4 color = overlayTexture.Sample(overlaySampler, input.tex);\n"
+    "    return float4(dot(color.rgb, colorRows[0].xyz) + colorRows[0].w * color.a,\n"
+    "                  dot(color.rgb, colorRows[1].xyz) + colorRows[1].w * color.a,\n"
+    "                  dot(color.rgb, colorRows[2].xyz) + colorRows[2].w * color.a,\n"
+    "                  color.a);\n"
+    "}\n";
+
+// The frame graph's vertices are already in normalized device coordinates
+static const char k_GraphVertexShader[] =
+    "float4 main(float2 pos : POSITION) : SV_POSITION {\n"
+    "    return float4(pos, 0.0, 1.0);\n"
+    "}\n";
+
+// Converts the premultiplied graph color like the overlay pixel shader
+static const char k_GraphPixelShader[] =
+    "cbuffer GraphColor : register(b0) {\n"
+    "    float4 color;\n"
+    "};\n"
+    "cbuffer OverlayColor : register(b1) {\n"
+    "    float4 colorRows[3];\n"
+    "};\n"
+    "float4 main(float4 pos : SV_POSITION) : SV_TARGET {\n"
+    "    return float4(dot(color.rgb, colorRows[0].xyz) + colorRows[0].w * color.a,\n"
+    "                  dot(color.rgb, colorRows[1].xyz) + colorRows[1].w * color.a,\n"
+    "                  dot(color.rgb, colorRows[2].xyz) + colorRows[2].w * color.a,\n"
+    "                  color.a);\n"
+    "}\n";
+
+// The background quad comes before the series in the graph's vertex buffer
+#define GRAPH_BACKGROUND_VERTICES 4
+
+static const float k_RgbColorRows[3][4] = {
+    { 1.0f, 0.0f, 0.0f, 0.0f },
+    { 0.0f, 1.0f, 0.0f, 0.0f },
+    { 0.0f, 0.0f, 1.0f, 0.0f },
+};
+
+// A PQ code value of 0.5 is about 100 nits
+#define HDR_OVERLAY_SCALE 0.5f
+
+// Edge enhancement level between the driver's default (0) and maximum (1)
+#define SHARPEN_STRENGTH 0.5f
+
+typedef struct _OVERLAY_PARAMS {
+    float rect[4];
+    float texScale[4];
+} OVERLAY_PARAMS;
+
+D3D11VARenderer::D3D11VARenderer() :
+    m_Factory(nullptr),
+    m_Device(nullptr),
+    m_DeviceContext(nullptr),
+    m_HwDeviceContext(nullptr),
+    m_D3D11VADeviceContext(nullptr),
+    m_SwapChain(nullptr),
+    m_FrameLatencyWaitable(nullptr),
+    m_BackBuffer(nullptr),
+    m_HdrDisplay(false),
+    m_HdrOutput(false),
+    m_UseOverlayPlane(false),
+    m_DirectCopy(false),
+    m_BackBufferRtv(nullptr),
+    m_BackBufferChromaRtv(nullptr),
+    m_SyncInterval(0),
+    m_PresentFlags(0),
+    m_PresentHistoryIndex(0),
+    m_LastDisplayedPresentCount(0),
+    m_PresentLatencyUs(0),
+    m_VblankTimeLock(0),
+    m_LastVblankTimeUs(0),
+    m_SwapChainMedia(nullptr),
+    m_VideoDevice(nullptr),
+    m_VideoContext(nullptr),
+    m_VideoContext1(nullptr),
+    m_ProcessorEnumerator(nullptr),
+    m_Processor(nullptr),
+    m_OutputView(nullptr),
+    m_OutputFormat(DXGI_FORMAT_B8G8R8A8_UNORM),
+    m_LastColorSpace(-1),
+    m_LastColorRange(-1),
+    m_LastColorTrc(-1),
+    m_EnableSharpening(false),
+    m_SharpenActive(false),
+    m_TimestampQueryIndex(0),
+    m_InputViewCount(0),
+    m_OverlayVertexShader(nullptr),
+    m_OverlayPixelShader(nullptr),
+    m_OverlayConstantBuffer(nullptr),
+    m_OverlayColorBuffer(nullptr),
+    m_OverlaySampler(nullptr),
+    m_OverlayBlendState(nullptr),
+    m_GraphVertexShader(nullptr),
+    m_GraphPixelShader(nullptr),
+    m_GraphInputLayout(nullptr),
+    m_GraphVertexBuffer(nullptr),
+    m_GraphColorBuffer(nullptr)
+{
+    RtlZeroMemory(m_InputViews, sizeof(m_InputViews));
+    RtlZeroMemory(m_TimestampQueries, sizeof(m_TimestampQueries));
+    RtlZeroMemory(m_PresentHistory, sizeof(m_PresentHistory));
+    RtlZeroMemory(m_OverlayLumaRows, sizeof(m_OverlayLumaRows));
+    RtlZeroMemory(m_OverlayChromaRows, sizeof(m_OverlayChromaRows));
+    memcpy(m_OverlayRgbRows, k_RgbColorRows, sizeof(m_OverlayRgbRows));
+    RtlZeroMemory(&m_LastHdrMetadata, sizeof(m_LastHdrMetadata));
+    SDL_AtomicSet(&m_CompositionMode, -1);
+    RtlZeroMemory(m_OverlayTextures, sizeof(m_OverlayTextures));
+    RtlZeroMemory(m_OverlayTextureViews, sizeof(m_OverlayTextureViews));
+    RtlZeroMemory(m_OverlayRects, sizeof(m_OverlayRects));
+    SDL_AtomicSet(&m_PendingOverlayUpdates, 0);
+
+    // Use MMCSS scheduling for lower scheduling latency while we're streaming
+    DwmEnableMMCSS(TRUE);
+}
+
+D3D11VARenderer::~D3D11VARenderer()
+{
+    DwmEnableMMCSS(FALSE);
+
+    for (int i = 0; i < Overlay::OverlayMax; i++) {
+        SAFE_COM_RELEASE(m_OverlayTextureViews[i]);
+        SAFE_COM_RELEASE(m_OverlayTextures[i]);
+    }
+
+    SAFE_COM_RELEASE(m_GraphColorBuffer);
+    SAFE_COM_RELEASE(m_GraphVertexBuffer);
+    SAFE_COM_RELEASE(m_GraphInputLayout);
+    SAFE_COM_RELEASE(m_GraphPixelShader);
+    SAFE_COM_RELEASE(m_GraphVertexShader);
+
+    SAFE_COM_RELEASE(m_OverlayBlendState);
+    SAFE_COM_RELEASE(m_OverlaySampler);
+    SAFE_COM_RELEASE(m_OverlayColorBuffer);
+    SAFE_COM_RELEASE(m_OverlayConstantBuffer);
+    SAFE_COM_RELEASE(m_OverlayPixelShader);
+    SAFE_COM_RELEASE(m_OverlayVertexShader);
+
+    for (int i = 0; i < m_InputViewCount; i++) {
+        SAFE_COM_RELEASE(m_InputViews[i].view);
+    }
+
+    for (int i = 0; i < TIMESTAMP_QUERY_COUNT; i++) {
+        SAFE_COM_RELEASE(m_TimestampQueries[i].disjoint);
+        SAFE_COM_RELEASE(m_TimestampQueries[i].begin);
+        SAFE_COM_RELEASE(m_TimestampQueries[i].end);
+    }
+
+    SAFE_COM_RELEASE(m_OutputView);
+    SAFE_COM_RELEASE(m_Processor);
+    SAFE_COM_RELEASE(m_ProcessorEnumerator);
+    SAFE_COM_RELEASE(m_VideoContext1);
+    SAFE_COM_RELEASE(m_VideoContext);
+    SAFE_COM_RELEASE(m_VideoDevice);
+
+    SAFE_COM_RELEASE(m_BackBufferChromaRtv);
+    SAFE_COM_RELEASE(m_BackBufferRtv);
+    SAFE_COM_RELEASE(m_BackBuffer);
+
+    if (m_FrameLatencyWaitable != nullptr) {
+        CloseHandle(m_FrameLatencyWaitable);
+    }
+
+    SAFE_COM_RELEASE(m_SwapChainMedia);
+    SAFE_COM_RELEASE(m_SwapChain);
+    SAFE_COM_RELEASE(m_DeviceContext);
+    SAFE_COM_RELEASE(m_Device);
+    SAFE_COM_RELEASE(m_Factory);
+
+    // This must be done last, because it holds the last reference
+    // to the device when decoding has already started.
+    if (m_HwDeviceContext != nullptr) {
+        av_buffer_unref(&m_HwDeviceContext);
+    }
+}
+
+bool D3D11VARenderer::createDevice(SDL_Window* window)
+{
+    HRESULT hr;
+    int adapterIndex, outputIndex;
+    int err;
+
+    hr = CreateDXGIFactory1(__uuidof(IDXGIFactory2), (void**)&m_Factory);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "CreateDXGIFactory1() failed: %x",
+                     hr);
+        m_Factory = nullptr;
+        return false;
+    }
+
+    // Decode and present on the GPU driving the window's display
+    if (!SDL_DXGIGetOutputInfo(SDL_GetWindowDisplayIndex(window), &adapterIndex, &outputIndex)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "SDL_DXGIGetOutputInfo() failed: %s",
+                     SDL_GetError());
+        return false;
+    }
+
+    IDXGIAdapter1* adapter;
+    hr = m_Factory->EnumAdapters1(adapterIndex, &adapter);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "EnumAdapters1() failed: %x",
+                     hr);
+        return false;
+    }
+
+    hr = D3D11CreateDevice(adapter,
+                           D3D_DRIVER_TYPE_UNKNOWN,
+                           nullptr,
+                           D3D11_CREATE_DEVICE_VIDEO_SUPPORT,
+                           nullptr,
+                           0,
+                           D3D11_SDK_VERSION,
+                           &m_Device,
+                           nullptr,
+                           &m_DeviceContext);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "D3D11CreateDevice() failed: %x",
+                     hr);
+        adapter->Release();
+        m_Device = nullptr;
+        m_DeviceContext = nullptr;
+        return false;
+    }
+
+    if (m_VideoFormat == VIDEO_FORMAT_H265_MAIN10) {
+        m_HdrDisplay = checkHdrDisplaySupport(adapter, outputIndex);
+    }
+    m_UseOverlayPlane = checkOverlayPlaneSupport(adapter, outputIndex);
+    adapter->Release();
+
+    // FFmpeg decodes on this device from its own threads
+    ID3D10Multithread* multithread;
+    hr = m_Device->QueryInterface(__uuidof(ID3D10Multithread), (void**)&multithread);
+    if (SUCCEEDED(hr)) {
+        multithread->SetMultithreadProtected(TRUE);
+        multithread->Release();
+    }
+
+    hr = m_Device->QueryInterface(__uuidof(ID3D11VideoDevice), (void**)&m_VideoDevice);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "QueryInterface(ID3D11VideoDevice) failed: %x",
+                     hr);
+        m_VideoDevice = nullptr;
+        return false;
+    }
+
+    hr = m_DeviceContext->QueryInterface(__uuidof(ID3D11VideoContext), (void**)&m_VideoContext);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "QueryInterface(ID3D11VideoContext) failed: %x",
+                     hr);
+        m_VideoContext = nullptr;
+        return false;
+    }
+
+    // This is needed for BT.2020 and PQ, but is only on Windows 8.1+
+    hr = m_VideoContext->QueryInterface(__uuidof(ID3D11VideoContext1), (void**)&m_VideoContext1);
+    if (FAILED(hr)) {
+        m_VideoContext1 = nullptr;
+    }
+
+    // Hand our device to FFmpeg, so the decoder's textures can be
+    // used directly by our video processor.
+    m_HwDeviceContext = av_hwdevice_ctx_alloc(AV_HWDEVICE_TYPE_D3D11VA);
+    if (m_HwDeviceContext == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Failed to allocate D3D11VA device context");
+        return false;
+    }
+
+    AVHWDeviceContext* deviceContext = (AVHWDeviceContext*)m_HwDeviceContext->data;
+    m_D3D11VADeviceContext = (AVD3D11VADeviceContext*)deviceContext->hwctx;
+
+    // FFmpeg takes ownership of this reference
+    m_D3D11VADeviceContext->device = m_Device;
+    m_Device->AddRef();
+
+    err = av_hwdevice_ctx_init(m_HwDeviceContext);
+    if (err < 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Failed to initialize D3D11VA device context: %d",
+                     err);
+        return false;
+    }
+
+    return true;
+}
+
+bool D3D11VARenderer::checkHdrDisplaySupport(IDXGIAdapter1* adapter, int outputIndex)
+{
+    IDXGIOutput* output;
+    HRESULT hr;
+
+    hr = adapter->EnumOutputs(outputIndex, &output);
+    if (FAILED(hr)) {
+        return false;
+    }
+
+    // The output's color space is only reported on Windows 10 1703+
+    IDXGIOutput6* output6;
+    hr = output->QueryInterface(__uuidof(IDXGIOutput6), (void**)&output6);
+    output->Release();
+    if (FAILED(hr)) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Unable to query display HDR state; assuming SDR");
+        return false;
+    }
+
+    DXGI_OUTPUT_DESC1 desc;
+    hr = output6->GetDesc1(&desc);
+    output6->Release();
+    if (FAILED(hr)) {
+        return false;
+    }
+
+    // This is only true when HDR is enabled for the display in Windows
+    if (desc.ColorSpace != DXGI_COLOR_SPACE_RGB_FULL_G2084_NONE_P2020) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Display is in SDR mode; HDR content will be tone mapped");
+        return false;
+    }
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Display is in HDR mode (%.0f nits peak)",
+                desc.MaxLuminance);
+    return true;
+}
+
+bool D3D11VARenderer::checkOverlayPlaneSupport(IDXGIAdapter1* adapter, int outputIndex)
+{
+    HRESULT hr;
+
+    if (qgetenv("D3D11VA_DISABLE_OVERLAY_PLANE") == "1") {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Overlay plane disabled by environment variable");
+        return false;
+    }
+
+    // Tone mapping for an SDR display happens in the video processor's
+    // RGB conversion, which the overlay plane path skips.
+    if (m_VideoFormat == VIDEO_FORMAT_H265_MAIN10 && !m_HdrDisplay) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Not using overlay plane for HDR content on an SDR display");
+        return false;
+    }
+
+    IDXGIOutput* output;
+    hr = adapter->EnumOutputs(outputIndex, &output);
+    if (FAILED(hr)) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "EnumOutputs() failed: %x",
+                    hr);
+        return false;
+    }
+
+    // Multiplane overlay support is only reported on Windows 8.1+
+    IDXGIOutput3* output3;
+    hr = output->QueryInterface(__uuidof(IDXGIOutput3), (void**)&output3);
+    output->Release();
+    if (FAILED(hr)) {
+        return false;
+    }
+
+    // We need the plane to scan out the decoder's format itself,
+    // otherwise DWM has to convert it and we gain nothing.
+    UINT flags = 0;
+    hr = output3->CheckOverlaySupport(m_VideoFormat == VIDEO_FORMAT_H265_MAIN10 ?
+                                          DXGI_FORMAT_P010 : DXGI_FORMAT_NV12,
+                                      m_Device, &flags);
+    output3->Release();
+    if (FAILED(hr) || !(flags & DXGI_OVERLAY_SUPPORT_FLAG_DIRECT)) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "No overlay plane for YUV on this output");
+        return false;
+    }
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Presenting YUV frames to an overlay plane");
+    return true;
+}
+
+bool D3D11VARenderer::checkDecoderSupport()
+{
+    HRESULT hr;
+    GUID profile;
+    DXGI_FORMAT format;
+
+    switch (m_VideoFormat) {
+    case VIDEO_FORMAT_H264:
+        profile = D3D11_DECODER_PROFILE_H264_VLD_NOFGT;
+        format = DXGI_FORMAT_NV12;
+        break;
+    case VIDEO_FORMAT_H265:
+        profile = D3D11_DECODER_PROFILE_HEVC_VLD_MAIN;
+        format = DXGI_FORMAT_NV12;
+        break;
+    case VIDEO_FORMAT_H265_MAIN10:
+        profile = D3D11_DECODER_PROFILE_HEVC_VLD_MAIN10;
+        format = DXGI_FORMAT_P010;
+        break;
+    default:
+        SDL_assert(false);
+        return false;
+    }
+
+    UINT i;
+    UINT profileCount = m_VideoDevice->GetVideoDecoderProfileCount();
+    for (i = 0; i < profileCount; i++) {
+        GUID supportedProfile;
+
+        hr = m_VideoDevice->GetVideoDecoderProfile(i, &supportedProfile);
+        if (SUCCEEDED(hr) && IsEqualGUID(supportedProfile, profile)) {
+            break;
+        }
+    }
+
+    if (i == profileCount) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "No matching D3D11 decoder profiles");
+        return false;
+    }
+
+    BOOL supported;
+    hr = m_VideoDevice->CheckVideoDecoderFormat(&profile, format, &supported);
+    if (FAILED(hr) || !supported) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "D3D11 decoder doesn't support output format: %d",
+                     format);
+        return false;
+    }
+
+    // FFmpeg only creates the decoder when the first frame arrives,
+    // so make sure one can be created for this resolution now.
+    D3D11_VIDEO_DECODER_DESC decoderDesc = {};
+    decoderDesc.Guid = profile;
+    decoderDesc.SampleWidth = m_VideoWidth;
+    decoderDesc.SampleHeight = m_VideoHeight;
+    decoderDesc.OutputFormat = format;
+
+    UINT configCount;
+    hr = m_VideoDevice->GetVideoDecoderConfigCount(&decoderDesc, &configCount);
+    if (FAILED(hr) || configCount == 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "No D3D11 decoder configurations for %dx%d",
+                     m_VideoWidth, m_VideoHeight);
+        return false;
+    }
+
+    return true;
+}
+
+bool D3D11VARenderer::createVideoProcessor()
+{
+    HRESULT hr;
+    UINT formatSupport;
+
+    D3D11_VIDEO_PROCESSOR_CONTENT_DESC contentDesc = {};
+    contentDesc.InputFrameFormat = D3D11_VIDEO_FRAME_FORMAT_PROGRESSIVE;
+    contentDesc.InputFrameRate.Numerator = m_FrameRate;
+    contentDesc.InputFrameRate.Denominator = 1;
+    contentDesc.InputWidth = m_VideoWidth;
+    contentDesc.InputHeight = m_VideoHeight;
+    contentDesc.OutputFrameRate = contentDesc.InputFrameRate;
+    contentDesc.OutputWidth = m_BackBufferWidth;
+    contentDesc.OutputHeight = m_BackBufferHeight;
+    contentDesc.Usage = D3D11_VIDEO_USAGE_OPTIMAL_SPEED;
+
+    hr = m_VideoDevice->CreateVideoProcessorEnumerator(&contentDesc, &m_ProcessorEnumerator);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "CreateVideoProcessorEnumerator() failed: %x",
+                     hr);
+        m_ProcessorEnumerator = nullptr;
+        return false;
+    }
+
+    DXGI_FORMAT inputFormat = m_VideoFormat == VIDEO_FORMAT_H265_MAIN10 ?
+                DXGI_FORMAT_P010 : DXGI_FORMAT_NV12;
+    hr = m_ProcessorEnumerator->CheckVideoProcessorFormat(inputFormat, &formatSupport);
+    if (FAILED(hr) || !(formatSupport & D3D11_VIDEO_PROCESSOR_FORMAT_SUPPORT_INPUT)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Video processor doesn't support input format: %d",
+                     inputFormat);
+        return false;
+    }
+
+    // For an overlay plane, the video processor only scales
+    // and the swap chain keeps the decoder's format.
+    if (m_UseOverlayPlane) {
+        hr = m_ProcessorEnumerator->CheckVideoProcessorFormat(inputFormat, &formatSupport);
+        if (FAILED(hr) || !(formatSupport & D3D11_VIDEO_PROCESSOR_FORMAT_SUPPORT_OUTPUT)) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "Video processor can't output YUV; not using overlay plane");
+            m_UseOverlayPlane = m_DirectCopy = false;
+            m_BackBufferWidth = m_DisplayWidth;
+            m_BackBufferHeight = m_DisplayHeight;
+        }
+    }
+
+    if (m_UseOverlayPlane) {
+        m_OutputFormat = inputFormat;
+    }
+    // Keep the extra precision of 10-bit content if we can
+    else if (m_VideoFormat == VIDEO_FORMAT_H265_MAIN10) {
+        hr = m_ProcessorEnumerator->CheckVideoProcessorFormat(DXGI_FORMAT_R10G10B10A2_UNORM, &formatSupport);
+        if (SUCCEEDED(hr) && (formatSupport & D3D11_VIDEO_PROCESSOR_FORMAT_SUPPORT_OUTPUT)) {
+            m_OutputFormat = DXGI_FORMAT_R10G10B10A2_UNORM;
+        }
+    }
+
+    hr = m_ProcessorEnumerator->CheckVideoProcessorFormat(m_OutputFormat, &formatSupport);
+    if (FAILED(hr) || !(formatSupport & D3D11_VIDEO_PROCESSOR_FORMAT_SUPPORT_OUTPUT)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Video processor doesn't support output format: %d",
+                     m_OutputFormat);
+        return false;
+    }
+
+    hr = m_VideoDevice->CreateVideoProcessor(m_ProcessorEnumerator, 0, &m_Processor);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "CreateVideoProcessor() failed: %x",
+                     hr);
+        m_Processor = nullptr;
+        return false;
+    }
+
+    // The automatic processing is where Intel's "enhancements" live that
+    // force DXVA2 onto StretchRect(), so turn all of it off.
+    m_VideoContext->VideoProcessorSetStreamAutoProcessingMode(m_Processor, 0, FALSE);
+    m_VideoContext->VideoProcessorSetStreamFrameFormat(m_Processor, 0, D3D11_VIDEO_FRAME_FORMAT_PROGRESSIVE);
+
+    // Full range RGB output on an opaque black background. The YUV output
+    // color space follows the stream, which updateColorSpace() handles.
+    D3D11_VIDEO_COLOR backgroundColor = {};
+    if (m_UseOverlayPlane) {
+        backgroundColor.YCbCr.Y = 16.0f / 255.0f;
+        backgroundColor.YCbCr.Cb = 0.5f;
+        backgroundColor.YCbCr.Cr = 0.5f;
+        backgroundColor.YCbCr.A = 1.0f;
+    }
+    else {
+        D3D11_VIDEO_PROCESSOR_COLOR_SPACE outputColorSpace = {};
+        outputColorSpace.RGB_Range = 0;
+        m_VideoContext->VideoProcessorSetOutputColorSpace(m_Processor, &outputColorSpace);
+
+        backgroundColor.RGBA.A = 1.0f;
+    }
+    m_VideoContext->VideoProcessorSetOutputBackgroundColor(m_Processor, m_UseOverlayPlane, &backgroundColor);
+
+    if (m_EnableSharpening) {
+        enableSharpening();
+    }
+
+    return true;
+}
+
+void D3D11VARenderer::enableSharpening()
+{
+    HRESULT hr;
+
+    // When the overlay plane scales the video, we never touch the pixels
+    if (m_DirectCopy) {
+        return;
+    }
+
+    SDL_Rect src, dst;
+    src.x = src.y = 0;
+    src.w = m_VideoWidth;
+    src.h = m_VideoHeight;
+    dst.x = dst.y = 0;
+    dst.w = m_BackBufferWidth;
+    dst.h = m_BackBufferHeight;
+
+    StreamUtils::scaleSourceToDestinationSurface(&src, &dst);
+
+    // Sharpening only helps when we're scaling the video up
+    if (dst.w <= m_VideoWidth && dst.h <= m_VideoHeight) {
+        return;
+    }
+
+    // The video processor's edge enhancement filter is the sharpening pass.
+    // It runs within the same blit that scales the frame, so it costs less
+    // than a separate shader pass over the back buffer would.
+    D3D11_VIDEO_PROCESSOR_CAPS caps;
+    hr = m_ProcessorEnumerator->GetVideoProcessorCaps(&caps);
+    if (FAILED(hr) || !(caps.FilterCaps & D3D11_VIDEO_PROCESSOR_FILTER_CAPS_EDGE_ENHANCEMENT)) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Video processor doesn't support edge enhancement");
+        return;
+    }
+
+    D3D11_VIDEO_PROCESSOR_FILTER_RANGE range;
+    hr = m_ProcessorEnumerator->GetVideoProcessorFilterRange(D3D11_VIDEO_PROCESSOR_FILTER_EDGE_ENHANCEMENT, &range);
+    if (FAILED(hr)) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "GetVideoProcessorFilterRange() failed: %x",
+                    hr);
+        return;
+    }
+
+    int level = range.Default + (int)((range.Maximum - range.Default) * SHARPEN_STRENGTH);
+    m_VideoContext->VideoProcessorSetStreamFilter(m_Processor, 0, D3D11_VIDEO_PROCESSOR_FILTER_EDGE_ENHANCEMENT, TRUE, level);
+    m_SharpenActive = true;
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Video processor edge enhancement enabled at level %d (range %d-%d)",
+                level,
+                range.Minimum,
+                range.Maximum);
+
+    // Without timestamps, the budget can't be enforced but we still sharpen
+    for (int i = 0; i < TIMESTAMP_QUERY_COUNT; i++) {
+        D3D11_QUERY_DESC queryDesc = {};
+
+        queryDesc.Query = D3D11_QUERY_TIMESTAMP_DISJOINT;
+        hr = m_Device->CreateQuery(&queryDesc, &m_TimestampQueries[i].disjoint);
+        if (SUCCEEDED(hr)) {
+            queryDesc.Query = D3D11_QUERY_TIMESTAMP;
+            hr = m_Device->CreateQuery(&queryDesc, &m_TimestampQueries[i].begin);
+        }
+        if (SUCCEEDED(hr)) {
+            hr = m_Device->CreateQuery(&queryDesc, &m_TimestampQueries[i].end);
+        }
+        if (FAILED(hr)) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "CreateQuery() failed: %x",
+                        hr);
+            for (int j = 0; j <= i; j++) {
+                SAFE_COM_RELEASE(m_TimestampQueries[j].disjoint);
+                SAFE_COM_RELEASE(m_TimestampQueries[j].begin);
+                SAFE_COM_RELEASE(m_TimestampQueries[j].end);
+            }
+            RtlZeroMemory(m_TimestampQueries, sizeof(m_TimestampQueries));
+            break;
+        }
+    }
+}
+
+void D3D11VARenderer::beginUpscaleTiming()
+{
+    if (m_TimestampQueries[0].end == nullptr) {
+        return;
+    }
+
+    // Collect the queries issued TIMESTAMP_QUERY_COUNT frames ago before
+    // reusing them. If the GPU isn't done with them, that sample is dropped
+    // rather than flushing or stalling for it.
+    auto& queries = m_TimestampQueries[m_TimestampQueryIndex];
+    if (queries.issued) {
+        D3D11_QUERY_DATA_TIMESTAMP_DISJOINT disjointData;
+        UINT64 beginTicks, endTicks;
+
+        if (m_DeviceContext->GetData(queries.disjoint, &disjointData, sizeof(disjointData), D3D11_ASYNC_GETDATA_DONOTFLUSH) == S_OK &&
+                !disjointData.Disjoint &&
+                m_DeviceContext->GetData(queries.begin, &beginTicks, sizeof(beginTicks), D3D11_ASYNC_GETDATA_DONOTFLUSH) == S_OK &&
+                m_DeviceContext->GetData(queries.end, &endTicks, sizeof(endTicks), D3D11_ASYNC_GETDATA_DONOTFLUSH) == S_OK &&
+                endTicks > beginTicks) {
+            // Stop sharpening for the rest of the stream if it's over budget
+            if (!m_UpscaleCost.addSample((endTicks - beginTicks) * 1000000 / disjointData.Frequency)) {
+                m_VideoContext->VideoProcessorSetStreamFilter(m_Processor, 0, D3D11_VIDEO_PROCESSOR_FILTER_EDGE_ENHANCEMENT, FALSE, 0);
+                m_SharpenActive = false;
+            }
+        }
+        queries.issued = false;
+    }
+
+    m_DeviceContext->Begin(queries.disjoint);
+    m_DeviceContext->End(queries.begin);
+}
+
+void D3D11VARenderer::endUpscaleTiming()
+{
+    if (m_TimestampQueries[0].end == nullptr) {
+        return;
+    }
+
+    auto& queries = m_TimestampQueries[m_TimestampQueryIndex];
+    m_DeviceContext->End(queries.end);
+    m_DeviceContext->End(queries.disjoint);
+    queries.issued = true;
+    m_TimestampQueryIndex = (m_TimestampQueryIndex + 1) % TIMESTAMP_QUERY_COUNT;
+}
+
+bool D3D11VARenderer::createSwapChain(SDL_Window* window, bool enableVsync, bool enableVrr)
+{
+    SDL_SysWMinfo info;
+    HRESULT hr;
+
+    SDL_VERSION(&info.version);
+    SDL_GetWindowWMInfo(window, &info);
+
+    // Tearing is only possible with the flip model on Windows 10 1607+
+    BOOL allowTearing = FALSE;
+    IDXGIFactory5* factory5;
+    hr = m_Factory->QueryInterface(__uuidof(IDXGIFactory5), (void**)&factory5);
+    if (SUCCEEDED(hr)) {
+        hr = factory5->CheckFeatureSupport(DXGI_FEATURE_PRESENT_ALLOW_TEARING,
+                                           &allowTearing, sizeof(allowTearing));
+        if (FAILED(hr)) {
+            allowTearing = FALSE;
+        }
+
+        factory5->Release();
+    }
+
+    DXGI_SWAP_CHAIN_DESC1 swapChainDesc = {};
+    swapChainDesc.Width = m_BackBufferWidth;
+    swapChainDesc.Height = m_BackBufferHeight;
+    swapChainDesc.Format = m_OutputFormat;
+    swapChainDesc.SampleDesc.Count = 1;
+    swapChainDesc.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT;
+
+    // One buffer on screen, one queued for the next V-sync, and one
+    // we render into. The frame latency limit keeps it from queuing more.
+    swapChainDesc.BufferCount = 3;
+    swapChainDesc.Scaling = DXGI_SCALING_STRETCH;
+    swapChainDesc.SwapEffect = DXGI_SWAP_EFFECT_FLIP_DISCARD;
+    swapChainDesc.AlphaMode = DXGI_ALPHA_MODE_UNSPECIFIED;
+    swapChainDesc.Flags = DXGI_SWAP_CHAIN_FLAG_FRAME_LATENCY_WAITABLE_OBJECT;
+    if (allowTearing) {
+        swapChainDesc.Flags |= DXGI_SWAP_CHAIN_FLAG_ALLOW_TEARING;
+    }
+    if (m_UseOverlayPlane) {
+        swapChainDesc.Flags |= DXGI_SWAP_CHAIN_FLAG_YUV_VIDEO | DXGI_SWAP_CHAIN_FLAG_FULLSCREEN_VIDEO;
+    }
+
+    hr = m_Factory->CreateSwapChainForHwnd(m_Device, info.info.win.window,
+                                           &swapChainDesc, nullptr, nullptr,
+                                           &m_SwapChain);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "CreateSwapChainForHwnd() failed: %x",
+                     hr);
+        m_SwapChain = nullptr;
+        return false;
+    }
+
+    // SDL handles full-screen transitions itself
+    m_Factory->MakeWindowAssociation(info.info.win.window, DXGI_MWA_NO_ALT_ENTER);
+
+    IDXGISwapChain2* swapChain2;
+    hr = m_SwapChain->QueryInterface(__uuidof(IDXGISwapChain2), (void**)&swapChain2);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "QueryInterface(IDXGISwapChain2) failed: %x",
+                     hr);
+        return false;
+    }
+
+    hr = swapChain2->SetMaximumFrameLatency(1);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "SetMaximumFrameLatency() failed: %x",
+                     hr);
+        swapChain2->Release();
+        return false;
+    }
+
+    m_FrameLatencyWaitable = swapChain2->GetFrameLatencyWaitableObject();
+    swapChain2->Release();
+
+    // This tells us whether DWM composed our frames or they were
+    // scanned out directly, but it's only available on Windows 8.1+
+    hr = m_SwapChain->QueryInterface(__uuidof(IDXGISwapChainMedia), (void**)&m_SwapChainMedia);
+    if (FAILED(hr)) {
+        m_SwapChainMedia = nullptr;
+    }
+
+    if (enableVsync && !enableVrr) {
+        m_SyncInterval = 1;
+        m_PresentFlags = 0;
+
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "V-Sync enabled");
+    }
+    else {
+        // With VRR, presenting immediately lets the display refresh when our
+        // frame is ready. Without tearing support, DWM shows our latest frame
+        // at the next V-sync instead, which still never blocks us.
+        m_SyncInterval = 0;
+        m_PresentFlags = allowTearing ? DXGI_PRESENT_ALLOW_TEARING : 0;
+
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "V-Sync disabled (tearing %s)",
+                    allowTearing ? "allowed" : "unsupported");
+    }
+
+    // In D3D11, buffer 0 always refers to the current back buffer,
+    // so these views stay valid as the flip model rotates buffers.
+    hr = m_SwapChain->GetBuffer(0, __uuidof(ID3D11Texture2D), (void**)&m_BackBuffer);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "GetBuffer() failed: %x",
+                     hr);
+        m_BackBuffer = nullptr;
+        return false;
+    }
+
+    if (m_UseOverlayPlane) {
+        // Overlays are drawn into each plane of the YUV back buffer.
+        // They're optional, so failing here isn't fatal.
+        bool p010 = m_OutputFormat == DXGI_FORMAT_P010;
+        D3D11_RENDER_TARGET_VIEW_DESC rtvDesc = {};
+        rtvDesc.ViewDimension = D3D11_RTV_DIMENSION_TEXTURE2D;
+        rtvDesc.Texture2D.MipSlice = 0;
+
+        rtvDesc.Format = p010 ? DXGI_FORMAT_R16_UNORM : DXGI_FORMAT_R8_UNORM;
+        hr = m_Device->CreateRenderTargetView(m_BackBuffer, &rtvDesc, &m_BackBufferRtv);
+        if (SUCCEEDED(hr)) {
+            rtvDesc.Format = p010 ? DXGI_FORMAT_R16G16_UNORM : DXGI_FORMAT_R8G8_UNORM;
+            hr = m_Device->CreateRenderTargetView(m_BackBuffer, &rtvDesc, &m_BackBufferChromaRtv);
+        }
+        if (FAILED(hr)) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "CreateRenderTargetView() failed for YUV back buffer: %x",
+                        hr);
+            SAFE_COM_RELEASE(m_BackBufferRtv);
+            m_BackBufferRtv = m_BackBufferChromaRtv = nullptr;
+        }
+    }
+    else {
+        hr = m_Device->CreateRenderTargetView(m_BackBuffer, nullptr, &m_BackBufferRtv);
+        if (FAILED(hr)) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "CreateRenderTargetView() failed: %x",
+                         hr);
+            m_BackBufferRtv = nullptr;
+            return false;
+        }
+    }
+
+    if (m_DirectCopy) {
+        // Frames are copied straight into the back buffer
+        return true;
+    }
+
+    D3D11_VIDEO_PROCESSOR_OUTPUT_VIEW_DESC outputViewDesc = {};
+    outputViewDesc.ViewDimension = D3D11_VPOV_DIMENSION_TEXTURE2D;
+    outputViewDesc.Texture2D.MipSlice = 0;
+    hr = m_VideoDevice->CreateVideoProcessorOutputView(m_BackBuffer, m_ProcessorEnumerator,
+                                                       &outputViewDesc, &m_OutputView);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "CreateVideoProcessorOutputView() failed: %x",
+                     hr);
+        m_OutputView = nullptr;
+        return false;
+    }
+
+    return true;
+}
+
+bool D3D11VARenderer::createOverlayPipeline()
+{
+    ID3DBlob* shaderBlob;
+    ID3DBlob* errorBlob;
+    HRESULT hr;
+
+    hr = D3DCompile(k_OverlayVertexShader, sizeof(k_OverlayVertexShader) - 1,
+                    "overlay_vs", nullptr, nullptr, "main", "vs_4_0",
+                    0, 0, &shaderBlob, &errorBlob);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "D3DCompile() failed for overlay vertex shader: %s",
+                     errorBlob != nullptr ? (const char*)errorBlob->GetBufferPointer() : "");
+        SAFE_COM_RELEASE(errorBlob);
+        return false;
+    }
+
+    hr = m_Device->CreateVertexShader(shaderBlob->GetBufferPointer(), shaderBlob->GetBufferSize(),
+                                      nullptr, &m_OverlayVertexShader);
+    shaderBlob->Release();
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "CreateVertexShader() failed: %x",
+                     hr);
+        m_OverlayVertexShader = nullptr;
+        return false;
+    }
+
+    hr = D3DCompile(k_OverlayPixelShader, sizeof(k_OverlayPixelShader) - 1,
+                    "overlay_ps", nullptr, nullptr, "main", "ps_4_0",
+                    0, 0, &shaderBlob, &errorBlob);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "D3DCompile() failed for overlay pixel shader: %s",
+                     errorBlob != nullptr ? (const char*)errorBlob->GetBufferPointer() : "");
+        SAFE_COM_RELEASE(errorBlob);
+        return false;
+    }
+
+    hr = m_Device->CreatePixelShader(shaderBlob->GetBufferPointer(), shaderBlob->GetBufferSize(),
+                                     nullptr, &m_OverlayPixelShader);
+    shaderBlob->Release();
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "CreatePixelShader() failed: %x",
+                     hr);
+        m_OverlayPixelShader = nullptr;
+        return false;
+    }
+
+    D3D11_BUFFER_DESC bufferDesc = {};
+    bufferDesc.ByteWidth = sizeof(OVERLAY_PARAMS);
+    bufferDesc.Usage = D3D11_USAGE_DYNAMIC;
+    bufferDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+    bufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+    hr = m_Device->CreateBuffer(&bufferDesc, nullptr, &m_OverlayConstantBuffer);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "CreateBuffer() failed: %x",
+                     hr);
+        m_OverlayConstantBuffer = nullptr;
+        return false;
+    }
+
+    // This only changes with the target plane or color space
+    bufferDesc.ByteWidth = sizeof(k_RgbColorRows);
+    bufferDesc.Usage = D3D11_USAGE_DEFAULT;
+    bufferDesc.CPUAccessFlags = 0;
+    hr = m_Device->CreateBuffer(&bufferDesc, nullptr, &m_OverlayColorBuffer);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "CreateBuffer() failed: %x",
+                     hr);
+        m_OverlayColorBuffer = nullptr;
+        return false;
+    }
+
+    // The overlays are drawn 1:1, so there's no filtering to do
+    D3D11_SAMPLER_DESC samplerDesc = {};
+    samplerDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_POINT;
+    samplerDesc.AddressU = D3D11_TEXTURE_ADDRESS_CLAMP;
+    samplerDesc.AddressV = D3D11_TEXTURE_ADDRESS_CLAMP;
+    samplerDesc.AddressW = D3D11_TEXTURE_ADDRESS_CLAMP;
+    samplerDesc.ComparisonFunc = D3D11_COMPARISON_NEVER;
+    samplerDesc.MaxLOD = D3D11_FLOAT32_MAX;
+    hr = m_Device->CreateSamplerState(&samplerDesc, &m_OverlaySampler);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "CreateSamplerState() failed: %x",
+                     hr);
+        m_OverlaySampler = nullptr;
+        return false;
+    }
+
+    // The overlay surfaces have premultiplied alpha
+    D3D11_BLEND_DESC blendDesc = {};
+    blendDesc.RenderTarget[0].BlendEnable = TRUE;
+    blendDesc.RenderTarget[0].SrcBlend = D3D11_BLEND_ONE;
+    blendDesc.RenderTarget[0].DestBlend = D3D11_BLEND_INV_SRC_ALPHA;
+    blendDesc.RenderTarget[0].BlendOp = D3D11_BLEND_OP_ADD;
+    blendDesc.RenderTarget[0].SrcBlendAlpha = D3D11_BLEND_ONE;
+    blendDesc.RenderTarget[0].DestBlendAlpha = D3D11_BLEND_INV_SRC_ALPHA;
+    blendDesc.RenderTarget[0].BlendOpAlpha = D3D11_BLEND_OP_ADD;
+    blendDesc.RenderTarget[0].RenderTargetWriteMask = D3D11_COLOR_WRITE_ENABLE_ALL;
+    hr = m_Device->CreateBlendState(&blendDesc, &m_OverlayBlendState);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "CreateBlendState() failed: %x",
+                     hr);
+        m_OverlayBlendState = nullptr;
+        return false;
+    }
+
+    return true;
+}
+
+bool D3D11VARenderer::createGraphPipeline()
+{
+    ID3DBlob* shaderBlob;
+    ID3DBlob* errorBlob;
+    HRESULT hr;
+
+    hr = D3DCompile(k_GraphVertexShader, sizeof(k_GraphVertexShader) - 1,
+                    "graph_vs", nullptr, nullptr, "main", "vs_4_0",
+                    0, 0, &shaderBlob, &errorBlob);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "D3DCompile() failed for graph vertex shader: %s",
+                     errorBlob != nullptr ? (const char*)errorBlob->GetBufferPointer() : "");
+        SAFE_COM_RELEASE(errorBlob);
+        return false;
+    }
+
+    hr = m_Device->CreateVertexShader(shaderBlob->GetBufferPointer(), shaderBlob->GetBufferSize(),
+                                      nullptr, &m_GraphVertexShader);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "CreateVertexShader() failed: %x",
+                     hr);
+        shaderBlob->Release();
+        m_GraphVertexShader = nullptr;
+        return false;
+    }
+
+    // The input layout is validated against the vertex shader's signature
+    const D3D11_INPUT_ELEMENT_DESC inputElements[] = {
+        { "POSITION", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+    };
+    hr = m_Device->CreateInputLayout(inputElements, ARRAYSIZE(inputElements),
+                                     shaderBlob->GetBufferPointer(), shaderBlob->GetBufferSize(),
+                                     &m_GraphInputLayout);
+    shaderBlob->Release();
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "CreateInputLayout() failed: %x",
+                     hr);
+        m_GraphInputLayout = nullptr;
+        return false;
+    }
+
+    hr = D3DCompile(k_GraphPixelShader, sizeof(k_GraphPixelShader) - 1,
+                    "graph_ps", nullptr, nullptr, "main", "ps_4_0",
+                    0, 0, &shaderBlob, &errorBlob);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "D3DCompile() failed for graph pixel shader: %s",
+                     errorBlob != nullptr ? (const char*)errorBlob->GetBufferPointer() : "");
+        SAFE_COM_RELEASE(errorBlob);
+        return false;
+    }
+
+    hr = m_Device->CreatePixelShader(shaderBlob->GetBufferPointer(), shaderBlob->GetBufferSize(),
+                                     nullptr, &m_GraphPixelShader);
+    shaderBlob->Release();
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "CreatePixelShader() failed: %x",
+                     hr);
+        m_GraphPixelShader = nullptr;
+        return false;
+    }
+
+    // Each series is drawn in its own color
+    D3D11_BUFFER_DESC bufferDesc = {};
+    bufferDesc.ByteWidth = 4 * sizeof(float);
+    bufferDesc.Usage = D3D11_USAGE_DEFAULT;
+    bufferDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+    hr = m_Device->CreateBuffer(&bufferDesc, nullptr, &m_GraphColorBuffer);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "CreateBuffer() failed: %x",
+                     hr);
+        m_GraphColorBuffer = nullptr;
+        return false;
+    }
+
+    // The vertex buffer is created last, since the graph is only drawn if it exists
+    bufferDesc.ByteWidth = (GRAPH_BACKGROUND_VERTICES * 2 + FRAME_GRAPH_VERTEX_FLOATS) * sizeof(float);
+    bufferDesc.Usage = D3D11_USAGE_DYNAMIC;
+    bufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+    bufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+    hr = m_Device->CreateBuffer(&bufferDesc, nullptr, &m_GraphVertexBuffer);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "CreateBuffer() failed: %x",
+                     hr);
+        m_GraphVertexBuffer = nullptr;
+        return false;
+    }
+
+    return true;
+}
+
+bool D3D11VARenderer::initialize(PDECODER_PARAMETERS params)
+{
+    m_VideoFormat = params->videoFormat;
+    m_VideoWidth = params->width;
+    m_VideoHeight = params->height;
+    m_FrameRate = params->frameRate;
+    m_EnableSharpening = params->enableSharpening;
+    m_UpscaleCost.initialize(m_FrameRate);
+
+    SDL_GetWindowSize(params->window, &m_DisplayWidth, &m_DisplayHeight);
+    m_BackBufferWidth = m_DisplayWidth;
+    m_BackBufferHeight = m_DisplayHeight;
+
+    if (!createDevice(params->window)) {
+        return false;
+    }
+
+    if (m_UseOverlayPlane) {
+        SDL_Rect src, dst;
+        src.x = src.y = 0;
+        src.w = m_VideoWidth;
+        src.h = m_VideoHeight;
+        dst.x = dst.y = 0;
+        dst.w = m_DisplayWidth;
+        dst.h = m_DisplayHeight;
+
+        StreamUtils::scaleSourceToDestinationSurface(&src, &dst);
+
+        // If the video fills the display, the plane can scale the decoded
+        // frame itself. Otherwise, we must scale to add the letterbox.
+        if (dst.w == m_DisplayWidth && dst.h == m_DisplayHeight) {
+            m_DirectCopy = true;
+            m_BackBufferWidth = m_VideoWidth;
+            m_BackBufferHeight = m_VideoHeight;
+        }
+    }
+
+    if (!checkDecoderSupport()) {
+        return false;
+    }
+
+    if (!createVideoProcessor()) {
+        return false;
+    }
+
+    if (!createSwapChain(params->window, params->enableVsync, params->enableVrr)) {
+        return false;
+    }
+
+    // The stream is still usable without the overlays
+    if (!createOverlayPipeline()) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Overlays will not be drawn");
+    }
+    else if (!createGraphPipeline()) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Frame graph will not be drawn");
+    }
+
+    return true;
+}
+
+bool D3D11VARenderer::prepareDecoderContext(AVCodecContext* context)
+{
+    context->hw_device_ctx = av_buffer_ref(m_HwDeviceContext);
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Using D3D11VA accelerated renderer");
+
+    return true;
+}
+
+int D3D11VARenderer::getDecoderCapabilities()
+{
+    // FFmpeg keeps the full DPB the host asks for, so the host
+    // can invalidate lost references instead of sending an IDR
+    return CAPABILITY_REFERENCE_FRAME_INVALIDATION_AVC |
+           CAPABILITY_REFERENCE_FRAME_INVALIDATION_HEVC;
+}
+
+bool D3D11VARenderer::isRenderThreadSupported()
+{
+    // The device is multithread protected and everything that draws on it
+    // (including the overlays) happens in renderFrame() under FFmpeg's
+    // device lock, so the Pacer can present from its render thread.
+    return true;
+}
+
+void D3D11VARenderer::waitToRender()
+{
+    // Block until the swap chain can take another frame. The Pacer picks
+    // the frame to render after this returns, so it's the newest one.
+    if (m_FrameLatencyWaitable != nullptr) {
+        WaitForSingleObjectEx(m_FrameLatencyWaitable, 1000, FALSE);
+    }
+}
+
+void D3D11VARenderer::notifyOverlayUpdated(Overlay::OverlayType type)
+{
+    // This may be called on any thread, so we just flag the overlay for
+    // upload by the render thread, which owns all drawing on the device.
+    int pendingUpdates;
+    do {
+        pendingUpdates = SDL_AtomicGet(&m_PendingOverlayUpdates);
+    } while (!SDL_AtomicCAS(&m_PendingOverlayUpdates, pendingUpdates, pendingUpdates | (1 << type)));
+}
+
+bool D3D11VARenderer::usesOverlaySurfaces()
+{
+    return true;
+}
+
+void D3D11VARenderer::updateOverlayTexture(Overlay::OverlayType type)
+{
+    HRESULT hr;
+
+    SDL_Surface* surface = Session::get()->getOverlayManager().getUpdatedOverlaySurface(type);
+
+    if (!Session::get()->getOverlayManager().isOverlayEnabled(type)) {
+        // Hide the overlay but keep the texture around for next time
+        m_OverlayRects[type].w = m_OverlayRects[type].h = 0;
+        if (surface != nullptr) {
+            SDL_FreeSurface(surface);
+        }
+        return;
+    }
+    else if (surface == nullptr) {
+        // Nothing new to upload
+        return;
+    }
+
+    // Reuse the existing texture if the new overlay fits inside it
+    if (m_OverlayTextures[type] != nullptr) {
+        D3D11_TEXTURE2D_DESC desc;
+
+        m_OverlayTextures[type]->GetDesc(&desc);
+        if ((int)desc.Width < surface->w || (int)desc.Height < surface->h) {
+            m_OverlayTextureViews[type]->Release();
+            m_OverlayTextureViews[type] = nullptr;
+            m_OverlayTextures[type]->Release();
+            m_OverlayTextures[type] = nullptr;
+        }
+    }
+
+    if (m_OverlayTextures[type] == nullptr) {
+        // The overlay surface is premultiplied ARGB8888, which is B8G8R8A8 in memory
+        D3D11_TEXTURE2D_DESC desc = {};
+        desc.Width = surface->w;
+        desc.Height = surface->h;
+        desc.MipLevels = 1;
+        desc.ArraySize = 1;
+        desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+        desc.SampleDesc.Count = 1;
+        desc.Usage = D3D11_USAGE_DYNAMIC;
+        desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+        desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+
+        hr = m_Device->CreateTexture2D(&desc, nullptr, &m_OverlayTextures[type]);
+        if (FAILED(hr)) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "CreateTexture2D() failed: %x",
+                         hr);
+            m_OverlayTextures[type] = nullptr;
+            m_OverlayRects[type].w = m_OverlayRects[type].h = 0;
+            SDL_FreeSurface(surface);
+            return;
+        }
+
+        hr = m_Device->CreateShaderResourceView(m_OverlayTextures[type], nullptr, &m_OverlayTextureViews[type]);
+        if (FAILED(hr)) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "CreateShaderResourceView() failed: %x",
+                         hr);
+            m_OverlayTextures[type]->Release();
+            m_OverlayTextures[type] = nullptr;
+            m_OverlayTextureViews[type] = nullptr;
+            m_OverlayRects[type].w = m_OverlayRects[type].h = 0;
+            SDL_FreeSurface(surface);
+            return;
+        }
+    }
+
+    D3D11_MAPPED_SUBRESOURCE mappedTexture;
+    hr = m_DeviceContext->Map(m_OverlayTextures[type], 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedTexture);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Map() failed: %x",
+                     hr);
+        m_OverlayRects[type].w = m_OverlayRects[type].h = 0;
+        SDL_FreeSurface(surface);
+        return;
+    }
+
+    for (int y = 0; y < surface->h; y++) {
+        memcpy((Uint8*)mappedTexture.pData + (y * mappedTexture.RowPitch),
+               (Uint8*)surface->pixels + (y * surface->pitch),
+               surface->w * 4);
+    }
+
+    m_DeviceContext->Unmap(m_OverlayTextures[type], 0);
+
+    m_OverlayRects[type].w = surface->w;
+    m_OverlayRects[type].h = surface->h;
+    SDL_FreeSurface(surface);
+}
+
+void D3D11VARenderer::renderOverlays(const RECT& videoRect)
+{
+    // Upload any overlays updated by notifyOverlayUpdated() since the last frame
+    int pendingUpdates = SDL_AtomicSet(&m_PendingOverlayUpdates, 0);
+    for (int i = 0; i < Overlay::OverlayMax; i++) {
+        if (pendingUpdates & (1 << i)) {
+            updateOverlayTexture((Overlay::OverlayType)i);
+        }
+    }
+
+    if (m_OverlayBlendState == nullptr || m_BackBufferRtv == nullptr) {
+        // The overlay pipeline failed to initialize
+        return;
+    }
+
+    // Debug at the top left and status at the bottom left of the video
+    m_OverlayRects[Overlay::OverlayDebug].x = videoRect.left;
+    m_OverlayRects[Overlay::OverlayDebug].y = videoRect.top;
+    m_OverlayRects[Overlay::OverlayStatusUpdate].x = videoRect.left;
+    m_OverlayRects[Overlay::OverlayStatusUpdate].y = videoRect.bottom - m_OverlayRects[Overlay::OverlayStatusUpdate].h;
+
+    bool graphVisible = m_GraphVertexBuffer != nullptr &&
+            Session::get()->getOverlayManager().isOverlayEnabled(Overlay::OverlayFrameGraph);
+    bool anyVisible = graphVisible;
+    for (int i = 0; i < Overlay::OverlayMax; i++) {
+        if (m_OverlayTextures[i] != nullptr && m_OverlayRects[i].w != 0) {
+            anyVisible = true;
+            break;
+        }
+    }
+
+    if (!anyVisible) {
+        return;
+    }
+
+    if (graphVisible) {
+        updateFrameGraph(videoRect);
+    }
+
+    if (m_UseOverlayPlane) {
+        // The chroma plane is subsampled, but the overlay's normalized
+        // coordinates are the same for both planes.
+        drawOverlays(m_BackBufferRtv, m_BackBufferWidth, m_BackBufferHeight, m_OverlayLumaRows, graphVisible);
+        drawOverlays(m_BackBufferChromaRtv, m_BackBufferWidth / 2, m_BackBufferHeight / 2, m_OverlayChromaRows, graphVisible);
+    }
+    else {
+        drawOverlays(m_BackBufferRtv, m_BackBufferWidth, m_BackBufferHeight, m_OverlayRgbRows, graphVisible);
+    }
+}
+
+void D3D11VARenderer::updateFrameGraph(const RECT& videoRect)
+{
+    SDL_Rect videoSdlRect = { videoRect.left, videoRect.top,
+                              videoRect.right - videoRect.left, videoRect.bottom - videoRect.top };
+    SDL_Rect graphRect = FrameGraph::getGraphRect(videoSdlRect);
+
+    D3D11_MAPPED_SUBRESOURCE mappedBuffer;
+    HRESULT hr = m_DeviceContext->Map(m_GraphVertexBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedBuffer);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Map() failed: %x",
+                     hr);
+        return;
+    }
+
+    float left = 2.0f * graphRect.x / m_BackBufferWidth - 1.0f;
+    float right = 2.0f * (graphRect.x + graphRect.w) / m_BackBufferWidth - 1.0f;
+    float top = 1.0f - 2.0f * graphRect.y / m_BackBufferHeight;
+    float bottom = 1.0f - 2.0f * (graphRect.y + graphRect.h) / m_BackBufferHeight;
+    float* vertices = (float*)mappedBuffer.pData;
+
+    // The background quad is a triangle strip
+    vertices[0] = left;
+    vertices[1] = top;
+    vertices[2] = right;
+    vertices[3] = top;
+    vertices[4] = left;
+    vertices[5] = bottom;
+    vertices[6] = right;
+    vertices[7] = bottom;
+    FrameGraph::getVertices(&vertices[GRAPH_BACKGROUND_VERTICES * 2], left, bottom, right - left, top - bottom);
+
+    m_DeviceContext->Unmap(m_GraphVertexBuffer, 0);
+}
+
+void D3D11VARenderer::drawFrameGraph()
+{
+    UINT stride = 2 * sizeof(float);
+    UINT offset = 0;
+
+    m_DeviceContext->IASetInputLayout(m_GraphInputLayout);
+    m_DeviceContext->IASetVertexBuffers(0, 1, &m_GraphVertexBuffer, &stride, &offset);
+    m_DeviceContext->VSSetShader(m_GraphVertexShader, nullptr, 0);
+    m_DeviceContext->PSSetShader(m_GraphPixelShader, nullptr, 0);
+    m_DeviceContext->PSSetConstantBuffers(0, 1, &m_GraphColorBuffer);
+
+    // Darken the video behind the graph so the lines stand out
+    const float background[4] = { 0.0f, 0.0f, 0.0f, 0.5f };
+    m_DeviceContext->UpdateSubresource(m_GraphColorBuffer, 0, nullptr, background, 0, 0);
+    m_DeviceContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP);
+    m_DeviceContext->Draw(GRAPH_BACKGROUND_VERTICES, 0);
+
+    m_DeviceContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_LINESTRIP);
+    for (int series = 0; series < FrameGraph::FGS_MAX; series++) {
+        const SDL_Color& color = FrameGraph::k_SeriesColors[series];
+        const float seriesColor[4] = { color.r / 255.0f, color.g / 255.0f, color.b / 255.0f, 1.0f };
+
+        m_DeviceContext->UpdateSubresource(m_GraphColorBuffer, 0, nullptr, seriesColor, 0, 0);
+        m_DeviceContext->Draw(FRAME_GRAPH_FRAMES, GRAPH_BACKGROUND_VERTICES + series * FRAME_GRAPH_FRAMES);
+    }
+}
+
+void D3D11VARenderer::drawOverlays(ID3D11RenderTargetView* rtv, int width, int height, const float colorRows[3][4], bool drawGraph)
+{
+    D3D11_VIEWPORT viewport = {};
+    viewport.Width = (float)width;
+    viewport.Height = (float)height;
+    viewport.MaxDepth = 1.0f;
+
+    // The flip model unbinds the back buffer on every Present(), so the
+    // pipeline must be bound again each frame. The frame graph binds its
+    // own shaders, so this is done again for each plane.
+    m_DeviceContext->OMSetBlendState(m_OverlayBlendState, nullptr, 0xFFFFFFFF);
+    m_DeviceContext->IASetInputLayout(nullptr);
+    m_DeviceContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP);
+    m_DeviceContext->VSSetShader(m_OverlayVertexShader, nullptr, 0);
+    m_DeviceContext->VSSetConstantBuffers(0, 1, &m_OverlayConstantBuffer);
+    m_DeviceContext->PSSetShader(m_OverlayPixelShader, nullptr, 0);
+    m_DeviceContext->PSSetConstantBuffers(1, 1, &m_OverlayColorBuffer);
+    m_DeviceContext->PSSetSamplers(0, 1, &m_OverlaySampler);
+
+    m_DeviceContext->OMSetRenderTargets(1, &rtv, nullptr);
+    m_DeviceContext->RSSetViewports(1, &viewport);
+    m_DeviceContext->UpdateSubresource(m_OverlayColorBuffer, 0, nullptr, colorRows, 0, 0);
+
+    for (int i = 0; i < Overlay::OverlayMax; i++) {
+        if (m_OverlayTextures[i] == nullptr || m_OverlayRects[i].w == 0) {
+            continue;
+        }
+
+        D3D11_TEXTURE2D_DESC desc;
+        m_OverlayTextures[i]->GetDesc(&desc);
+
+        D3D11_MAPPED_SUBRESOURCE mappedBuffer;
+        HRESULT hr = m_DeviceContext->Map(m_OverlayConstantBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedBuffer);
+        if (FAILED(hr)) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "Map() failed: %x",
+                         hr);
+            return;
+        }
+
+        // Convert the overlay's rectangle to normalized device coordinates
+        // and only sample the part of the texture that the overlay fills
+        OVERLAY_PARAMS* overlayParams = (OVERLAY_PARAMS*)mappedBuffer.pData;
+        overlayParams->rect[0] = 2.0f * m_OverlayRects[i].x / m_BackBufferWidth - 1.0f;
+        overlayParams->rect[1] = 1.0f - 2.0f * m_OverlayRects[i].y / m_BackBufferHeight;
+        overlayParams->rect[2] = 2.0f * (m_OverlayRects[i].x + m_OverlayRects[i].w) / m_BackBufferWidth - 1.0f;
+        overlayParams->rect[3] = 1.0f - 2.0f * (m_OverlayRects[i].y + m_OverlayRects[i].h) / m_BackBufferHeight;
+        overlayParams->texScale[0] = (float)m_OverlayRects[i].w / desc.Width;
+        overlayParams->texScale[1] = (float)m_OverlayRects[i].h / desc.Height;
+        overlayParams->texScale[2] = overlayParams->texScale[3] = 0.0f;
+        m_DeviceContext->Unmap(m_OverlayConstantBuffer, 0);
+
+        m_DeviceContext->PSSetShaderResources(0, 1, &m_OverlayTextureViews[i]);
+        m_DeviceContext->Draw(4, 0);
+    }
+
+    if (drawGraph) {
+        drawFrameGraph();
+    }
+}
+
+ID3D11VideoProcessorInputView* D3D11VARenderer::getInputView(ID3D11Texture2D* texture, UINT arraySlice)
+{
+    HRESULT hr;
+
+    // All of a frames context's frames share one texture array, so a new
+    // texture means the decoder rebuilt its pool and the old views are stale.
+    if (m_InputViewCount == INPUT_VIEW_CACHE_SIZE ||
+            (m_InputViewCount != 0 && m_InputViews[0].texture != texture)) {
+        for (int i = 0; i < m_InputViewCount; i++) {
+            m_InputViews[i].view->Release();
+        }
+        m_InputViewCount = 0;
+    }
+
+    for (int i = 0; i < m_InputViewCount; i++) {
+        if (m_InputViews[i].arraySlice == arraySlice) {
+            return m_InputViews[i].view;
+        }
+    }
+
+    D3D11_VIDEO_PROCESSOR_INPUT_VIEW_DESC inputViewDesc = {};
+    inputViewDesc.FourCC = 0;
+    inputViewDesc.ViewDimension = D3D11_VPIV_DIMENSION_TEXTURE2D;
+    inputViewDesc.Texture2D.MipSlice = 0;
+    inputViewDesc.Texture2D.ArraySlice = arraySlice;
+
+    ID3D11VideoProcessorInputView* view;
+    hr = m_VideoDevice->CreateVideoProcessorInputView(texture, m_ProcessorEnumerator,
+                                                      &inputViewDesc, &view);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "CreateVideoProcessorInputView() failed: %x",
+                     hr);
+        return nullptr;
+    }
+
+    m_InputViews[m_InputViewCount].texture = texture;
+    m_InputViews[m_InputViewCount].arraySlice = arraySlice;
+    m_InputViews[m_InputViewCount].view = view;
+    m_InputViewCount++;
+
+    return view;
+}
+
+void D3D11VARenderer::setSwapChainColorSpace(DXGI_COLOR_SPACE_TYPE colorSpace)
+{
+    IDXGISwapChain3* swapChain3;
+    HRESULT hr = m_SwapChain->QueryInterface(__uuidof(IDXGISwapChain3), (void**)&swapChain3);
+    if (FAILED(hr)) {
+        return;
+    }
+
+    UINT support = 0;
+    hr = swapChain3->CheckColorSpaceSupport(colorSpace, &support);
+    if (SUCCEEDED(hr) && (support & DXGI_SWAP_CHAIN_COLOR_SPACE_SUPPORT_FLAG_PRESENT)) {
+        hr = swapChain3->SetColorSpace1(colorSpace);
+        if (FAILED(hr)) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "SetColorSpace1() failed: %x",
+                        hr);
+        }
+    }
+    else {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Swap chain can't present color space: %d",
+                    colorSpace);
+    }
+
+    swapChain3->Release();
+}
+
+void D3D11VARenderer::updateColorSpace(AVFrame* frame)
+{
+    if (frame->colorspace == m_LastColorSpace &&
+            frame->color_range == m_LastColorRange &&
+            frame->color_trc == m_LastColorTrc) {
+        return;
+    }
+
+    D3D11_VIDEO_PROCESSOR_COLOR_SPACE colorSpace = {};
+    DXGI_COLOR_SPACE_TYPE dxgiColorSpace;
+    bool fullRange = frame->color_range == AVCOL_RANGE_JPEG;
+    bool pq = frame->color_trc == AVCOL_TRC_SMPTE2084;
+    float kr, kb;
+
+    switch (frame->colorspace) {
+    case AVCOL_SPC_BT709:
+        colorSpace.YCbCr_Matrix = 1;
+        kr = 0.2126f;
+        kb = 0.0722f;
+        dxgiColorSpace = fullRange ? DXGI_COLOR_SPACE_YCBCR_FULL_G22_LEFT_P709 :
+                                     DXGI_COLOR_SPACE_YCBCR_STUDIO_G22_LEFT_P709;
+        break;
+    case AVCOL_SPC_BT2020_NCL:
+        // The legacy color space can't describe BT.2020, so only
+        // ID3D11VideoContext1 will convert this correctly.
+        colorSpace.YCbCr_Matrix = 1;
+        kr = 0.2627f;
+        kb = 0.0593f;
+        if (pq) {
+            // There is no full range PQ color space in DXGI
+            dxgiColorSpace = DXGI_COLOR_SPACE_YCBCR_STUDIO_G2084_LEFT_P2020;
+        }
+        else {
+            dxgiColorSpace = fullRange ? DXGI_COLOR_SPACE_YCBCR_FULL_G22_LEFT_P2020 :
+                                         DXGI_COLOR_SPACE_YCBCR_STUDIO_G22_LEFT_P2020;
+        }
+        break;
+    default:
+        // BT.601
+        colorSpace.YCbCr_Matrix = 0;
+        kr = 0.299f;
+        kb = 0.114f;
+        dxgiColorSpace = fullRange ? DXGI_COLOR_SPACE_YCBCR_FULL_G22_LEFT_P601 :
+                                     DXGI_COLOR_SPACE_YCBCR_STUDIO_G22_LEFT_P601;
+        break;
+    }
+
+    colorSpace.Nominal_Range = fullRange ?
+                D3D11_VIDEO_PROCESSOR_NOMINAL_RANGE_0_255 :
+                D3D11_VIDEO_PROCESSOR_NOMINAL_RANGE_16_235;
+
+    if (m_VideoContext1 != nullptr) {
+        m_VideoContext1->VideoProcessorSetStreamColorSpace1(m_Processor, 0, dxgiColorSpace);
+    }
+    else {
+        m_VideoContext->VideoProcessorSetStreamColorSpace(m_Processor, 0, &colorSpace);
+    }
+
+    // PQ content is only passed through to an HDR display. Otherwise the
+    // video processor tone maps it to SDR as part of the RGB conversion.
+    m_HdrOutput = pq && m_HdrDisplay;
+
+    // SDR overlays would be near peak brightness in PQ, so dim them
+    // to roughly the level of SDR white.
+    float overlayScale = m_HdrOutput ? HDR_OVERLAY_SCALE : 1.0f;
+
+    if (m_UseOverlayPlane) {
+        // The YUV back buffer is passed through untouched, so the
+        // display needs to know how to convert it.
+        if (m_VideoContext1 != nullptr) {
+            m_VideoContext1->VideoProcessorSetOutputColorSpace1(m_Processor, dxgiColorSpace);
+        }
+        else {
+            m_VideoContext->VideoProcessorSetOutputColorSpace(m_Processor, &colorSpace);
+        }
+        setSwapChainColorSpace(dxgiColorSpace);
+
+        // Overlays are converted to the same color space to be drawn into it
+        float kg = 1.0f - kr - kb;
+        float yScale = overlayScale * (fullRange ? 1.0f : 219.0f / 255.0f);
+        float cScale = overlayScale * (fullRange ? 1.0f : 224.0f / 255.0f);
+
+        RtlZeroMemory(m_OverlayLumaRows, sizeof(m_OverlayLumaRows));
+        m_OverlayLumaRows[0][0] = yScale * kr;
+        m_OverlayLumaRows[0][1] = yScale * kg;
+        m_OverlayLumaRows[0][2] = yScale * kb;
+        m_OverlayLumaRows[0][3] = fullRange ? 0.0f : 16.0f / 255.0f;
+
+        RtlZeroMemory(m_OverlayChromaRows, sizeof(m_OverlayChromaRows));
+        m_OverlayChromaRows[0][0] = cScale * -kr / (2.0f * (1.0f - kb));
+        m_OverlayChromaRows[0][1] = cScale * -kg / (2.0f * (1.0f - kb));
+        m_OverlayChromaRows[0][2] = cScale * 0.5f;
+        m_OverlayChromaRows[0][3] = 0.5f;
+        m_OverlayChromaRows[1][0] = cScale * 0.5f;
+        m_OverlayChromaRows[1][1] = cScale * -kg / (2.0f * (1.0f - kr));
+        m_OverlayChromaRows[1][2] = cScale * -kb / (2.0f * (1.0f - kr));
+        m_OverlayChromaRows[1][3] = 0.5f;
+    }
+    else {
+        DXGI_COLOR_SPACE_TYPE outputColorSpace = m_HdrOutput ?
+                    DXGI_COLOR_SPACE_RGB_FULL_G2084_NONE_P2020 :
+                    DXGI_COLOR_SPACE_RGB_FULL_G22_NONE_P709;
+
+        if (m_VideoContext1 != nullptr) {
+            m_VideoContext1->VideoProcessorSetOutputColorSpace1(m_Processor, outputColorSpace);
+        }
+        setSwapChainColorSpace(outputColorSpace);
+
+        memcpy(m_OverlayRgbRows, k_RgbColorRows, sizeof(m_OverlayRgbRows));
+        for (int i = 0; i < 3; i++) {
+            m_OverlayRgbRows[i][i] *= overlayScale;
+        }
+    }
+
+    m_LastColorSpace = frame->colorspace;
+    m_LastColorRange = frame->color_range;
+    m_LastColorTrc = frame->color_trc;
+}
+
+void D3D11VARenderer::updateHdrMetadata(AVFrame* frame)
+{
+    AVFrameSideData* masteringData = av_frame_get_side_data(frame, AV_FRAME_DATA_MASTERING_DISPLAY_METADATA);
+    AVFrameSideData* lightLevelData = av_frame_get_side_data(frame, AV_FRAME_DATA_CONTENT_LIGHT_LEVEL);
+
+    // The metadata usually only comes with IDR frames
+    if (masteringData == nullptr && lightLevelData == nullptr) {
+        return;
+    }
+
+    DXGI_HDR_METADATA_HDR10 metadata = {};
+
+    if (masteringData != nullptr) {
+        AVMasteringDisplayMetadata* mastering = (AVMasteringDisplayMetadata*)masteringData->data;
+
+        // Chromaticities are in units of 0.00002
+        if (mastering->has_primaries) {
+            metadata.RedPrimary[0] = (UINT16)(av_q2d(mastering->display_primaries[0][0]) * 50000);
+            metadata.RedPrimary[1] = (UINT16)(av_q2d(mastering->display_primaries[0][1]) * 50000);
+            metadata.GreenPrimary[0] = (UINT16)(av_q2d(mastering->display_primaries[1][0]) * 50000);
+            metadata.GreenPrimary[1] = (UINT16)(av_q2d(mastering->display_primaries[1][1]) * 50000);
+            metadata.BluePrimary[0] = (UINT16)(av_q2d(mastering->display_primaries[2][0]) * 50000);
+            metadata.BluePrimary[1] = (UINT16)(av_q2d(mastering->display_primaries[2][1]) * 50000);
+            metadata.WhitePoint[0] = (UINT16)(av_q2d(mastering->white_point[0]) * 50000);
+            metadata.WhitePoint[1] = (UINT16)(av_q2d(mastering->white_point[1]) * 50000);
+        }
+
+        // Maximum is in nits and minimum in units of 0.0001 nits
+        if (mastering->has_luminance) {
+            metadata.MaxMasteringLuminance = (UINT)av_q2d(mastering->max_luminance);
+            metadata.MinMasteringLuminance = (UINT)(av_q2d(mastering->min_luminance) * 10000);
+        }
+    }
+
+    if (lightLevelData != nullptr) {
+        AVContentLightMetadata* lightLevel = (AVContentLightMetadata*)lightLevelData->data;
+
+        metadata.MaxContentLightLevel = (UINT16)lightLevel->MaxCLL;
+        metadata.MaxFrameAverageLightLevel = (UINT16)lightLevel->MaxFALL;
+    }
+
+    if (memcmp(&metadata, &m_LastHdrMetadata, sizeof(metadata)) == 0) {
+        return;
+    }
+
+    if (m_HdrOutput) {
+        // Let the display map the content to its own capabilities
+        IDXGISwapChain4* swapChain4;
+        HRESULT hr = m_SwapChain->QueryInterface(__uuidof(IDXGISwapChain4), (void**)&swapChain4);
+        if (SUCCEEDED(hr)) {
+            hr = swapChain4->SetHDRMetaData(DXGI_HDR_METADATA_TYPE_HDR10, sizeof(metadata), &metadata);
+            if (FAILED(hr)) {
+                SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                            "SetHDRMetaData() failed: %x",
+                            hr);
+            }
+
+            swapChain4->Release();
+        }
+    }
+    else {
+        // Give the driver's tone mapping the actual range of the content
+        ID3D11VideoContext2* videoContext2;
+        HRESULT hr = m_VideoContext->QueryInterface(__uuidof(ID3D11VideoContext2), (void**)&videoContext2);
+        if (SUCCEEDED(hr)) {
+            videoContext2->VideoProcessorSetStreamHDRMetaData(m_Processor, 0,
+                                                              DXGI_HDR_METADATA_TYPE_HDR10,
+                                                              sizeof(metadata), &metadata);
+            videoContext2->Release();
+        }
+    }
+
+    m_LastHdrMetadata = metadata;
+}
+
+void D3D11VARenderer::updatePresentStatistics(int frameNumber)
+{
+    UINT presentCount;
+    HRESULT hr;
+
+    if (SUCCEEDED(m_SwapChain->GetLastPresentCount(&presentCount))) {
+        m_PresentHistory[m_PresentHistoryIndex].presentCount = presentCount;
+        m_PresentHistory[m_PresentHistoryIndex].presentTimeUs = StreamUtils::getTimeUs();
+        m_PresentHistory[m_PresentHistoryIndex].frameNumber = frameNumber;
+        m_PresentHistoryIndex = (m_PresentHistoryIndex + 1) % PRESENT_HISTORY_SIZE;
+    }
+
+    // These fail until the first frame has been displayed
+    UINT displayedPresentCount;
+    LARGE_INTEGER syncQpcTime;
+    if (m_SwapChainMedia != nullptr) {
+        DXGI_FRAME_STATISTICS_MEDIA stats;
+
+        hr = m_SwapChainMedia->GetFrameStatisticsMedia(&stats);
+        if (FAILED(hr)) {
+            return;
+        }
+
+        displayedPresentCount = stats.PresentCount;
+        syncQpcTime = stats.SyncQPCTime;
+        SDL_AtomicSet(&m_CompositionMode, stats.CompositionMode);
+    }
+    else {
+        DXGI_FRAME_STATISTICS stats;
+
+        hr = m_SwapChain->GetFrameStatistics(&stats);
+        if (FAILED(hr)) {
+            return;
+        }
+
+        displayedPresentCount = stats.PresentCount;
+        syncQpcTime = stats.SyncQPCTime;
+    }
+
+    if (displayedPresentCount == m_LastDisplayedPresentCount) {
+        // No new frame reached the display
+        return;
+    }
+
+    m_LastDisplayedPresentCount = displayedPresentCount;
+
+    // SDL's performance counter is the same QPC that DXGI uses
+    Uint64 counter = syncQpcTime.QuadPart;
+    Uint64 frequency = SDL_GetPerformanceFrequency();
+    Uint64 displayTimeUs = (counter / frequency) * 1000000 + (counter % frequency) * 1000000 / frequency;
+
+    SDL_AtomicLock(&m_VblankTimeLock);
+    m_LastVblankTimeUs = displayTimeUs;
+    SDL_AtomicUnlock(&m_VblankTimeLock);
+
+    for (int i = 0; i < PRESENT_HISTORY_SIZE; i++) {
+        if (m_PresentHistory[i].presentCount == displayedPresentCount &&
+                m_PresentHistory[i].presentTimeUs != 0) {
+            if (displayTimeUs > m_PresentHistory[i].presentTimeUs) {
+                m_PresentLatencyUs = displayTimeUs - m_PresentHistory[i].presentTimeUs;
+                FrameTracer::mark(m_PresentHistory[i].frameNumber, FrameTracer::FTS_DISPLAYED, displayTimeUs);
+            }
+            break;
+        }
+    }
+}
+
+const char* D3D11VARenderer::getUpscalerStats(int* averageCostUs, int* budgetUs)
+{
+    *averageCostUs = m_UpscaleCost.getAverageCostUs();
+    *budgetUs = m_UpscaleCost.getBudgetUs();
+
+    // The cost includes the scaling and color conversion done by the same blit
+    switch (m_UpscaleCost.getState()) {
+    case UpscaleCostTracker::US_ACTIVE:
+        return "Video processor edge enhancement";
+    case UpscaleCostTracker::US_OVER_BUDGET:
+        return "Video processor edge enhancement (disabled, over budget)";
+    default:
+        return nullptr;
+    }
+}
+
+Uint64 D3D11VARenderer::takePresentLatencyUs()
+{
+    Uint64 latencyUs = m_PresentLatencyUs;
+    m_PresentLatencyUs = 0;
+    return latencyUs;
+}
+
+bool D3D11VARenderer::getLastVblankTimeUs(Uint64& vblankTimeUs)
+{
+    SDL_AtomicLock(&m_VblankTimeLock);
+    vblankTimeUs = m_LastVblankTimeUs;
+    SDL_AtomicUnlock(&m_VblankTimeLock);
+
+    return vblankTimeUs != 0;
+}
+
+const char* D3D11VARenderer::getPresentationPath()
+{
+    const char* swapChain;
+    if (!m_UseOverlayPlane) {
+        swapChain = "RGB swap chain";
+    }
+    else if (m_DirectCopy) {
+        swapChain = "YUV swap chain (unscaled copy)";
+    }
+    else {
+        swapChain = "YUV swap chain (scaled)";
+    }
+
+    const char* composition;
+    switch (SDL_AtomicGet(&m_CompositionMode)) {
+    case DXGI_FRAME_PRESENTATION_MODE_COMPOSED:
+        composition = "composed by DWM";
+        break;
+    case DXGI_FRAME_PRESENTATION_MODE_OVERLAY:
+        composition = "hardware overlay plane";
+        break;
+    case DXGI_FRAME_PRESENTATION_MODE_NONE:
+        composition = "independent flip";
+        break;
+    case DXGI_FRAME_PRESENTATION_MODE_COMPOSITION_FAILURE:
+        composition = "overlay plane rejected, composed by DWM";
+        break;
+    default:
+        composition = "unknown";
+        break;
+    }
+
+    snprintf(m_PresentationPath, sizeof(m_PresentationPath), "%s, %s", swapChain, composition);
+    return m_PresentationPath;
+}
+
+void D3D11VARenderer::renderFrame(AVFrame* frame)
+{
+    ID3D11Texture2D* texture = (ID3D11Texture2D*)frame->data[0];
+    UINT arraySlice = (UINT)(intptr_t)frame->data[1];
+    HRESULT hr;
+
+    // The decoder uses the immediate context from its own threads
+    m_D3D11VADeviceContext->lock(m_D3D11VADeviceContext->lock_ctx);
+
+    updateColorSpace(frame);
+    if (frame->color_trc == AVCOL_TRC_SMPTE2084) {
+        updateHdrMetadata(frame);
+    }
+
+    RECT destRect;
+    if (m_DirectCopy) {
+        // The back buffer is the size of the video and the overlay plane
+        // scales it to the display, so the frame only needs to be copied.
+        D3D11_BOX box = { 0, 0, 0, (UINT)m_VideoWidth, (UINT)m_VideoHeight, 1 };
+        m_DeviceContext->CopySubresourceRegion(m_BackBuffer, 0, 0, 0, 0, texture, arraySlice, &box);
+
+        destRect = { 0, 0, m_BackBufferWidth, m_BackBufferHeight };
+    }
+    else {
+        // Center in frame and preserve aspect ratio
+        SDL_Rect src, dst;
+        src.x = src.y = 0;
+        src.w = m_VideoWidth;
+        src.h = m_VideoHeight;
+        dst.x = dst.y = 0;
+        dst.w = m_BackBufferWidth;
+        dst.h = m_BackBufferHeight;
+
+        StreamUtils::scaleSourceToDestinationSurface(&src, &dst);
+
+        RECT sourceRect = { 0, 0, m_VideoWidth, m_VideoHeight };
+        destRect = { dst.x, dst.y, dst.x + dst.w, dst.y + dst.h };
+
+        ID3D11VideoProcessorInputView* inputView = getInputView(texture, arraySlice);
+        if (inputView == nullptr) {
+            m_D3D11VADeviceContext->unlock(m_D3D11VADeviceContext->lock_ctx);
+            return;
+        }
+
+        m_VideoContext->VideoProcessorSetStreamSourceRect(m_Processor, 0, TRUE, &sourceRect);
+        m_VideoContext->VideoProcessorSetStreamDestRect(m_Processor, 0, TRUE, &destRect);
+
+        D3D11_VIDEO_PROCESSOR_STREAM stream = {};
+        stream.Enable = TRUE;
+        stream.pInputSurface = inputView;
+
+        // This scales (and converts, for RGB) the frame and also fills the letterbox
+        bool timeBlt = m_SharpenActive;
+        if (timeBlt) {
+            beginUpscaleTiming();
+        }
+        hr = m_VideoContext->VideoProcessorBlt(m_Processor, m_OutputView, 0, 1, &stream);
+        if (timeBlt) {
+            endUpscaleTiming();
+        }
+        m_UpscaleCost.setActive(m_SharpenActive);
+        if (FAILED(hr)) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "VideoProcessorBlt() failed: %x",
+                         hr);
+            m_D3D11VADeviceContext->unlock(m_D3D11VADeviceContext->lock_ctx);
+
+            SDL_Event event;
+            event.type = SDL_RENDER_TARGETS_RESET;
+            SDL_PushEvent(&event);
+            return;
+        }
+    }
+
+    renderOverlays(destRect);
+
+    m_D3D11VADeviceContext->unlock(m_D3D11VADeviceContext->lock_ctx);
+
+    // The frame latency waitable object already made sure this won't
+    // block unless the GPU has fallen behind.
+    hr = m_SwapChain->Present(m_SyncInterval, m_PresentFlags);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Present() failed: %x",
+                     hr);
+        SDL_Event event;
+        event.type = SDL_RENDER_TARGETS_RESET;
+        SDL_PushEvent(&event);
+        return;
+    }
+
+    updatePresentStatistics((int)frame->pkt_dts);
+}
@@ -0,0 +1,165 @@
+#pragma once
+
+#include "renderer.h"
+#include "upscalecost.h"
+
+#include <d3d11_4.h>
+#include <dxgi1_6.h>
+
+extern "C" {
+#include <libavutil/hwcontext_d3d11va.h>
+}
+
+class D3D11VARenderer : public IFFmpegRenderer
+{
+public:
+    D3D11VARenderer();
+    virtual ~D3D11VARenderer() override;
+    virtual bool initialize(PDECODER_PARAMETERS params) override;
+    virtual bool prepareDecoderContext(AVCodecContext* context) override;
+    virtual void renderFrame(AVFrame* frame) override;
+    virtual void waitToRender() override;
+    virtual void notifyOverlayUpdated(Overlay::OverlayType) override;
+    virtual bool usesOverlaySurfaces() override;
+    virtual int getDecoderCapabilities() override;
+    virtual bool isRenderThreadSupported() override;
+    virtual Uint64 takePresentLatencyUs() override;
+    virtual bool getLastVblankTimeUs(Uint64& vblankTimeUs) override;
+    virtual const char* getPresentationPath() override;
+    virtual const char* getUpscalerStats(int* averageCostUs, int* budgetUs) override;
+
+private:
+    bool createDevice(SDL_Window* window);
+    bool checkHdrDisplaySupport(IDXGIAdapter1* adapter, int outputIndex);
+    bool checkOverlayPlaneSupport(IDXGIAdapter1* adapter, int outputIndex);
+    bool checkDecoderSupport();
+    bool createSwapChain(SDL_Window* window, bool enableVsync, bool enableVrr);
+    bool createVideoProcessor();
+    void enableSharpening();
+    void beginUpscaleTiming();
+    void endUpscaleTiming();
+    bool createOverlayPipeline();
+    bool createGraphPipeline();
+    ID3D11VideoProcessorInputView* getInputView(ID3D11Texture2D* texture, UINT arraySlice);
+    void setSwapChainColorSpace(DXGI_COLOR_SPACE_TYPE colorSpace);
+    void updateColorSpace(AVFrame* frame);
+    void updateHdrMetadata(AVFrame* frame);
+    void updateOverlayTexture(Overlay::OverlayType type);
+    void renderOverlays(const RECT& videoRect);
+    void drawOverlays(ID3D11RenderTargetView* rtv, int width, int height, const float colorRows[3][4], bool drawGraph);
+    void updateFrameGraph(const RECT& videoRect);
+    void drawFrameGraph();
+    void updatePresentStatistics(int frameNumber);
+
+    int m_VideoFormat;
+    int m_VideoWidth;
+    int m_VideoHeight;
+    int m_FrameRate;
+
+    int m_DisplayWidth;
+    int m_DisplayHeight;
+
+    // HDR content is presented as PQ to an HDR display. For an SDR
+    // display, the video processor tone maps it to SDR instead.
+    bool m_HdrDisplay;
+    bool m_HdrOutput;
+    DXGI_HDR_METADATA_HDR10 m_LastHdrMetadata;
+
+    // With an overlay plane, the swap chain holds the decoder's YUV format
+    // and may be smaller than the display if the plane can do the scaling.
+    bool m_UseOverlayPlane;
+    bool m_DirectCopy;
+    int m_BackBufferWidth;
+    int m_BackBufferHeight;
+
+    IDXGIFactory2* m_Factory;
+    ID3D11Device* m_Device;
+    ID3D11DeviceContext* m_DeviceContext;
+    AVBufferRef* m_HwDeviceContext;
+    AVD3D11VADeviceContext* m_D3D11VADeviceContext;
+
+    // The swap chain uses the flip model and signals the frame latency
+    // waitable object when it's ready to accept another frame.
+    IDXGISwapChain1* m_SwapChain;
+    HANDLE m_FrameLatencyWaitable;
+    ID3D11Texture2D* m_BackBuffer;
+    ID3D11RenderTargetView* m_BackBufferRtv;
+    ID3D11RenderTargetView* m_BackBufferChromaRtv;
+    UINT m_SyncInterval;
+    UINT m_PresentFlags;
+
+    // Presents are matched with DXGI's frame statistics to measure how
+    // long each frame took from Present() to the display.
+#define PRESENT_HISTORY_SIZE 8
+    struct {
+        UINT presentCount;
+        Uint64 presentTimeUs;
+        int frameNumber;
+    } m_PresentHistory[PRESENT_HISTORY_SIZE];
+    int m_PresentHistoryIndex;
+    UINT m_LastDisplayedPresentCount;
+    Uint64 m_PresentLatencyUs;
+    SDL_SpinLock m_VblankTimeLock;
+    Uint64 m_LastVblankTimeUs;
+    IDXGISwapChainMedia* m_SwapChainMedia;
+    SDL_atomic_t m_CompositionMode;
+    char m_PresentationPath[128];
+
+    ID3D11VideoDevice* m_VideoDevice;
+    ID3D11VideoContext* m_VideoContext;
+    ID3D11VideoContext1* m_VideoContext1;
+    ID3D11VideoProcessorEnumerator* m_ProcessorEnumerator;
+    ID3D11VideoProcessor* m_Processor;
+    ID3D11VideoProcessorOutputView* m_OutputView;
+    DXGI_FORMAT m_OutputFormat;
+    int m_LastColorSpace;
+    int m_LastColorRange;
+    int m_LastColorTrc;
+
+    // Sharpening uses the video processor's edge enhancement filter while
+    // upscaling. Its blits are timed on the GPU with a ring of timestamp
+    // queries, so reading back a result never waits for the GPU.
+    bool m_EnableSharpening;
+    bool m_SharpenActive;
+#define TIMESTAMP_QUERY_COUNT 4
+    struct {
+        ID3D11Query* disjoint;
+        ID3D11Query* begin;
+        ID3D11Query* end;
+        bool issued;
+    } m_TimestampQueries[TIMESTAMP_QUERY_COUNT];
+    int m_TimestampQueryIndex;
+    UpscaleCostTracker m_UpscaleCost;
+
+    // The decoder's frames are slices of a texture array that lives as
+    // long as the frames context, so each slice only needs one view.
+#define INPUT_VIEW_CACHE_SIZE 32
+    struct {
+        ID3D11Texture2D* texture;
+        UINT arraySlice;
+        ID3D11VideoProcessorInputView* view;
+    } m_InputViews[INPUT_VIEW_CACHE_SIZE];
+    int m_InputViewCount;
+
+    ID3D11VertexShader* m_OverlayVertexShader;
+    ID3D11PixelShader* m_OverlayPixelShader;
+    ID3D11Buffer* m_OverlayConstantBuffer;
+    ID3D11Buffer* m_OverlayColorBuffer;
+    float m_OverlayLumaRows[3][4];
+    float m_OverlayChromaRows[3][4];
+    float m_OverlayRgbRows[3][4];
+    ID3D11SamplerState* m_OverlaySampler;
+    ID3D11BlendState* m_OverlayBlendState;
+    ID3D11Texture2D* m_OverlayTextures[Overlay::OverlayMax];
+    ID3D11ShaderResourceView* m_OverlayTextureViews[Overlay::OverlayMax];
+    SDL_Rect m_OverlayRects[Overlay::OverlayMax];
+    SDL_atomic_t m_PendingOverlayUpdates;
+
+    // The frame graph is drawn with the overlays' blend state and color
+    // rows, from a vertex buffer that's refilled for each frame
+    ID3D11VertexShader* m_GraphVertexShader;
+    ID3D11PixelShader* m_GraphPixelShader;
+    ID3D11InputLayout* m_GraphInputLayout;
+    ID3D11Buffer* m_GraphVertexBuffer;
+    ID3D11Buffer* m_GraphColorBuffer;
+};
@@ -8,41 +8,108 @@ extern "C" {
 
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <time.h>
 
 #include "streaming/streamutils.h"
 #include "streaming/session.h"
+#include "streaming/video/frametracer.h"
 
 #include <Limelight.h>
 
-DrmRenderer::DrmRenderer()
-    : m_DrmFd(-1),
+// Longest we'll wait for the previous commit to reach the screen
+#define PAGE_FLIP_TIMEOUT_MS 100
+
+DrmRenderer::DrmRenderer(bool hwaccel, IFFmpegRenderer* backendRenderer)
+    : m_HwAccel(hwaccel),
+      m_BackendRenderer(backendRenderer),
+      m_HwContext(nullptr),
+      m_DrmFd(-1),
       m_CrtcId(0),
+      m_CrtcIndex(-1),
       m_PlaneId(0),
-      m_CurrentFbId(0)
+      m_CurrentFbId(0),
+      m_PreviousFbId(0),
+      m_Atomic(false),
+      m_FlipCompletedSem(SDL_CreateSemaphore(0)),
+      m_FlipFrameNumber(0),
+      m_BusyCommits(0),
+      m_FbCacheCount(0),
+      m_FbCacheClock(0),
+      m_FbCacheFramesContext(nullptr),
+      m_OverlayPlaneId(0),
+      m_OverlayBufferHandle(0),
+      m_OverlayFbId(0),
+      m_OverlayBufferMap(nullptr),
+      m_OverlayBufferSize(0),
+      m_OverlayBufferSurface(nullptr),
+      m_OverlayPlaneActive(false)
 {
+    SDL_zero(m_PlaneProps);
+    SDL_zero(m_OverlayPlaneProps);
+    SDL_zero(m_OverlaySurfaces);
+    SDL_zero(m_OverlayRects);
+    SDL_AtomicSet(&m_FlipPending, 0);
+    SDL_AtomicSet(&m_DrmEventsHandledExternally, 0);
+    SDL_AtomicSet(&m_PendingOverlayUpdates, 0);
+    SDL_AtomicSet(&m_Unscaled, 0);
 }
 
 DrmRenderer::~DrmRenderer()
 {
-    if (m_CurrentFbId != 0) {
-        drmModeRmFB(m_DrmFd, m_CurrentFbId);
+    // Don't free anything the last commit may still be using
+    waitForPageFlip();
+
+    if (m_BusyCommits != 0) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Dropped %d frames that were committed while a page flip was pending",
+                    m_BusyCommits);
+    }
+
+    destroyOverlayBuffer();
+
+    for (int i = 0; i < Overlay::OverlayMax; i++) {
+        if (m_OverlaySurfaces[i] != nullptr) {
+            SDL_FreeSurface(m_OverlaySurfaces[i]);
+        }
     }
 
+    // This removes the FB that's on the plane, which disables it
+    flushFramebufferCache();
+
     if (m_DrmFd != -1) {
         close(m_DrmFd);
     }
+
+    av_buffer_unref(&m_HwContext);
+
+    SDL_DestroySemaphore(m_FlipCompletedSem);
 }
 
-bool DrmRenderer::prepareDecoderContext(AVCodecContext*)
+bool DrmRenderer::prepareDecoderContext(AVCodecContext* context)
 {
-    /* Nothing to do */
+    // The backend sets up the decoder when we're only its frontend
+    SDL_assert(m_BackendRenderer == nullptr);
+
+    if (m_HwAccel) {
+        context->hw_device_ctx = av_buffer_ref(m_HwContext);
+    }
 
     SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
-                "Using DRM renderer");
+                "Using DRM renderer%s",
+                m_HwAccel ? " with DRM hwaccel" : "");
 
     return true;
 }
 
+bool DrmRenderer::needsTestFrame()
+{
+    // Request API drivers only expose the profiles their hardware
+    // handles, which we can't see until a frame is decoded
+    return m_HwAccel;
+}
+
 bool DrmRenderer::initialize(PDECODER_PARAMETERS)
 {
     const char* device = SDL_getenv("DRM_DEV");
@@ -64,6 +131,20 @@ bool DrmRenderer::initialize(PDECODER_PARAMETERS)
         return false;
     }
 
+    if (m_HwAccel) {
+        // The hwaccel gets its own fd for the device. Its DMA-BUFs are
+        // imported on ours just like those of the other decoders.
+        int err = av_hwdevice_ctx_create(&m_HwContext, AV_HWDEVICE_TYPE_DRM, device, nullptr, 0);
+        if (err < 0) {
+            char errorstring[512];
+            av_strerror(err, errorstring, sizeof(errorstring));
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "Failed to create DRM hwaccel device: %s",
+                         errorstring);
+            return false;
+        }
+    }
+
     drmModeRes* resources = drmModeGetResources(m_DrmFd);
     if (resources == nullptr) {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
@@ -112,11 +193,11 @@ bool DrmRenderer::initialize(PDECODER_PARAMETERS)
         return false;
     }
 
-    int crtcIndex = -1;
+    m_CrtcIndex = -1;
     for (int i = 0; i < resources->count_crtcs; i++) {
         if (resources->crtcs[i] == m_CrtcId) {
             drmModeCrtc* crtc = drmModeGetCrtc(m_DrmFd, resources->crtcs[i]);
-            crtcIndex = i;
+            m_CrtcIndex = i;
             m_OutputRect.x = m_OutputRect.y = 0;
             m_OutputRect.w = crtc->width;
             m_OutputRect.h = crtc->height;
@@ -127,7 +208,7 @@ bool DrmRenderer::initialize(PDECODER_PARAMETERS)
 
     drmModeFreeResources(resources);
 
-    if (crtcIndex == -1) {
+    if (m_CrtcIndex == -1) {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
                      "Failed to get CRTC!");
         return false;
@@ -144,13 +225,191 @@ bool DrmRenderer::initialize(PDECODER_PARAMETERS)
     }
 
     // Find an NV12 overlay plane to render on
-    m_PlaneId = 0;
-    for (uint32_t i = 0; i < planeRes->count_planes && m_PlaneId == 0; i++) {
+    m_PlaneId = findOverlayPlane(planeRes, DRM_FORMAT_NV12, 0);
+
+    // Find another ARGB plane for the debug and status overlays. Planes
+    // are usually stacked in the order they're listed, so the first one
+    // after the video plane is the most likely to be composed above it.
+    m_OverlayPlaneId = findOverlayPlane(planeRes, DRM_FORMAT_ARGB8888, m_PlaneId);
+    if (m_OverlayPlaneId == 0) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "No ARGB8888 overlay plane available for the overlays");
+    }
+
+    drmModeFreePlaneResources(planeRes);
+
+    // Atomic KMS lets us commit frames without blocking until V-blank
+    // and tells us exactly when each one reaches the screen
+    m_Atomic = false;
+    if (qgetenv("DRM_FORCE_LEGACY") == "1") {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Using legacy KMS due to DRM_FORCE_LEGACY=1");
+    }
+    else if (drmSetClientCap(m_DrmFd, DRM_CLIENT_CAP_ATOMIC, 1) < 0) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Atomic KMS is not supported: %d",
+                    errno);
+    }
+    else if (getPlaneProperties(m_PlaneId, m_PlaneProps)) {
+        m_Atomic = true;
+
+        if (m_OverlayPlaneId != 0 && !getPlaneProperties(m_OverlayPlaneId, m_OverlayPlaneProps)) {
+            m_OverlayPlaneId = 0;
+        }
+
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Using atomic KMS");
+    }
+
+    return true;
+}
+
+bool DrmRenderer::getPlaneProperties(uint32_t planeId, PlaneProperties& planeProps)
+{
+    struct {
+        const char* name;
+        uint32_t* id;
+    } propTable[] = {
+        { "FB_ID", &planeProps.fbId },
+        { "CRTC_ID", &planeProps.crtcId },
+        { "SRC_X", &planeProps.srcX },
+        { "SRC_Y", &planeProps.srcY },
+        { "SRC_W", &planeProps.srcW },
+        { "SRC_H", &planeProps.srcH },
+        { "CRTC_X", &planeProps.crtcX },
+        { "CRTC_Y", &planeProps.crtcY },
+        { "CRTC_W", &planeProps.crtcW },
+        { "CRTC_H", &planeProps.crtcH },
+    };
+
+    SDL_zero(planeProps);
+
+    drmModeObjectPropertiesPtr props = drmModeObjectGetProperties(m_DrmFd, planeId, DRM_MODE_OBJECT_PLANE);
+    if (props == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "drmModeObjectGetProperties() failed: %d",
+                     errno);
+        return false;
+    }
+
+    for (uint32_t i = 0; i < props->count_props; i++) {
+        drmModePropertyPtr prop = drmModeGetProperty(m_DrmFd, props->props[i]);
+        if (prop != nullptr) {
+            for (size_t j = 0; j < SDL_arraysize(propTable); j++) {
+                if (!strcmp(prop->name, propTable[j].name)) {
+                    *propTable[j].id = prop->prop_id;
+                    break;
+                }
+            }
+
+            drmModeFreeProperty(prop);
+        }
+    }
+
+    drmModeFreeObjectProperties(props);
+
+    for (size_t i = 0; i < SDL_arraysize(propTable); i++) {
+        if (*propTable[i].id == 0) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "Plane %u has no %s property",
+                        planeId,
+                        propTable[i].name);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void DrmRenderer::addPlaneProperties(drmModeAtomicReq* req, uint32_t planeId, const PlaneProperties& planeProps,
+                                     uint32_t fbId, int srcWidth, int srcHeight, const SDL_Rect& dst)
+{
+    // A plane is disabled by detaching both its FB and its CRTC
+    drmModeAtomicAddProperty(req, planeId, planeProps.fbId, fbId);
+    drmModeAtomicAddProperty(req, planeId, planeProps.crtcId, fbId != 0 ? m_CrtcId : 0);
+
+    // Source coordinates are 16.16 fixed point
+    drmModeAtomicAddProperty(req, planeId, planeProps.srcX, 0);
+    drmModeAtomicAddProperty(req, planeId, planeProps.srcY, 0);
+    drmModeAtomicAddProperty(req, planeId, planeProps.srcW, (uint64_t)srcWidth << 16);
+    drmModeAtomicAddProperty(req, planeId, planeProps.srcH, (uint64_t)srcHeight << 16);
+
+    drmModeAtomicAddProperty(req, planeId, planeProps.crtcX, dst.x);
+    drmModeAtomicAddProperty(req, planeId, planeProps.crtcY, dst.y);
+    drmModeAtomicAddProperty(req, planeId, planeProps.crtcW, dst.w);
+    drmModeAtomicAddProperty(req, planeId, planeProps.crtcH, dst.h);
+}
+
+void DrmRenderer::waitForPageFlip()
+{
+    drmEventContext eventContext = {};
+    Uint32 startTime = SDL_GetTicks();
+
+    eventContext.version = 2;
+    eventContext.page_flip_handler = DrmVsyncSource::pageFlipHandler;
+
+    while (SDL_AtomicGet(&m_FlipPending) != 0) {
+        int remainingMs = PAGE_FLIP_TIMEOUT_MS - (int)(SDL_GetTicks() - startTime);
+        if (remainingMs <= 0) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "Timed out waiting for page flip");
+            SDL_AtomicSet(&m_FlipPending, 0);
+            break;
+        }
+
+        if (SDL_AtomicGet(&m_DrmEventsHandledExternally) != 0) {
+            // The DRM V-sync source thread will deliver our event
+            SDL_SemWaitTimeout(m_FlipCompletedSem, remainingMs);
+        }
+        else {
+            struct pollfd pfd = {};
+            pfd.fd = m_DrmFd;
+            pfd.events = POLLIN;
+            if (poll(&pfd, 1, remainingMs) > 0) {
+                drmHandleEvent(m_DrmFd, &eventContext);
+            }
+        }
+    }
+}
+
+void DrmRenderer::pageFlipCompleted(unsigned int, Uint64 flipTimeUs)
+{
+    if (FrameTracer::isActive()) {
+        struct timespec now;
+
+        // Flip times are on CLOCK_MONOTONIC rather than our clock
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        Uint64 nowMonotonicUs = (Uint64)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+        Uint64 sinceFlipUs = nowMonotonicUs > flipTimeUs ? nowMonotonicUs - flipTimeUs : 0;
+
+        FrameTracer::mark(m_FlipFrameNumber, FrameTracer::FTS_DISPLAYED, StreamUtils::getTimeUs() - sinceFlipUs);
+    }
+
+    SDL_AtomicSet(&m_FlipPending, 0);
+    SDL_SemPost(m_FlipCompletedSem);
+}
+
+void DrmRenderer::setDrmEventsHandledExternally(bool handled)
+{
+    SDL_AtomicSet(&m_DrmEventsHandledExternally, handled ? 1 : 0);
+}
+
+uint32_t DrmRenderer::findOverlayPlane(drmModePlaneRes* planeRes, uint32_t format, uint32_t afterPlaneId)
+{
+    uint32_t planeId = 0;
+    uint32_t i = 0;
+
+    // Start searching after the specified plane, if any
+    if (afterPlaneId != 0) {
+        while (i < planeRes->count_planes && planeRes->planes[i++] != afterPlaneId);
+    }
+
+    for (; i < planeRes->count_planes && planeId == 0; i++) {
         drmModePlane* plane = drmModeGetPlane(m_DrmFd, planeRes->planes[i]);
         if (plane != nullptr) {
             bool matchingFormat = false;
             for (uint32_t j = 0; j < plane->count_formats; j++) {
-                if (plane->formats[j] == DRM_FORMAT_NV12) {
+                if (plane->formats[j] == format) {
                     matchingFormat = true;
                     break;
                 }
@@ -161,14 +420,14 @@ bool DrmRenderer::initialize(PDECODER_PARAMETERS)
                 continue;
             }
 
-            if ((plane->possible_crtcs & (1 << crtcIndex)) && plane->crtc_id == 0) {
+            if ((plane->possible_crtcs & (1 << m_CrtcIndex)) && plane->crtc_id == 0) {
                 drmModeObjectPropertiesPtr props = drmModeObjectGetProperties(m_DrmFd, planeRes->planes[i], DRM_MODE_OBJECT_PLANE);
                 if (props != nullptr) {
-                    for (uint32_t j = 0; j < props->count_props && m_PlaneId == 0; j++) {
+                    for (uint32_t j = 0; j < props->count_props && planeId == 0; j++) {
                         drmModePropertyPtr prop = drmModeGetProperty(m_DrmFd, props->props[j]);
                         if (prop != nullptr) {
                             if (!strcmp(prop->name, "type") && props->prop_values[j] == DRM_PLANE_TYPE_OVERLAY) {
-                                m_PlaneId = plane->plane_id;
+                                planeId = plane->plane_id;
                             }
 
                             drmModeFreeProperty(prop);
@@ -183,26 +442,530 @@ bool DrmRenderer::initialize(PDECODER_PARAMETERS)
         }
     }
 
-    drmModeFreePlaneResources(planeRes);
+    return planeId;
+}
+
+bool DrmRenderer::reinitializePresentation(PDECODER_PARAMETERS params)
+{
+    // The decoder hands us DRM PRIME buffers that don't depend on
+    // our DRM device, so we can reselect our CRTC and plane freely.
+    // We keep the overlay surfaces to recompose on the new CRTC.
+    waitForPageFlip();
+    destroyOverlayBuffer();
+
+    // FB objects and GEM handles belong to the DRM fd that we're closing
+    flushFramebufferCache();
+
+    if (m_DrmFd != -1) {
+        close(m_DrmFd);
+        m_DrmFd = -1;
+    }
+
+    if (!initialize(params)) {
+        return false;
+    }
+
+    // Redraw the overlays that were visible on the old CRTC
+    int pendingUpdates;
+    do {
+        pendingUpdates = SDL_AtomicGet(&m_PendingOverlayUpdates);
+    } while (!SDL_AtomicCAS(&m_PendingOverlayUpdates, pendingUpdates, pendingUpdates | ((1 << Overlay::OverlayMax) - 1)));
+
+    return true;
+}
+
+bool DrmRenderer::notifyWindowResized(PDECODER_PARAMETERS)
+{
+    // Our output rect comes from the CRTC mode, not the window
+    return true;
+}
+
+bool DrmRenderer::getDrmCrtc(int& drmFd, int& crtcIndex)
+{
+    if (m_DrmFd == -1 || m_CrtcIndex == -1) {
+        return false;
+    }
+
+    drmFd = m_DrmFd;
+    crtcIndex = m_CrtcIndex;
+    return true;
+}
+
+void DrmRenderer::notifyOverlayUpdated(Overlay::OverlayType type)
+{
+    // This may be called on any thread, so we just flag the overlay
+    // for composition by the thread calling renderFrame().
+    int pendingUpdates;
+    do {
+        pendingUpdates = SDL_AtomicGet(&m_PendingOverlayUpdates);
+    } while (!SDL_AtomicCAS(&m_PendingOverlayUpdates, pendingUpdates, pendingUpdates | (1 << type)));
+}
+
+bool DrmRenderer::usesOverlaySurfaces()
+{
+    return true;
+}
+
+const char* DrmRenderer::getPresentationPath()
+{
+    if (m_Atomic) {
+        return SDL_AtomicGet(&m_Unscaled) ? "KMS atomic plane, unscaled" : "KMS atomic plane, scaled";
+    }
+    else {
+        return SDL_AtomicGet(&m_Unscaled) ? "KMS plane, unscaled" : "KMS plane, scaled";
+    }
+}
+
+bool DrmRenderer::createOverlayBuffer()
+{
+    struct drm_mode_create_dumb createArg = {};
+    struct drm_mode_map_dumb mapArg = {};
+    uint32_t handles[4] = {};
+    uint32_t pitches[4] = {};
+    uint32_t offsets[4] = {};
+    int err;
+
+    createArg.width = m_OutputRect.w;
+    createArg.height = m_OutputRect.h;
+    createArg.bpp = 32;
+    err = drmIoctl(m_DrmFd, DRM_IOCTL_MODE_CREATE_DUMB, &createArg);
+    if (err < 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "DRM_IOCTL_MODE_CREATE_DUMB failed: %d",
+                     errno);
+        return false;
+    }
+
+    m_OverlayBufferHandle = createArg.handle;
+    m_OverlayBufferSize = createArg.size;
+
+    handles[0] = createArg.handle;
+    pitches[0] = createArg.pitch;
+    err = drmModeAddFB2(m_DrmFd, m_OutputRect.w, m_OutputRect.h,
+                        DRM_FORMAT_ARGB8888,
+                        handles, pitches, offsets, &m_OverlayFbId, 0);
+    if (err < 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "drmModeAddFB2() failed: %d",
+                     errno);
+        m_OverlayFbId = 0;
+        destroyOverlayBuffer();
+        return false;
+    }
+
+    mapArg.handle = createArg.handle;
+    err = drmIoctl(m_DrmFd, DRM_IOCTL_MODE_MAP_DUMB, &mapArg);
+    if (err < 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "DRM_IOCTL_MODE_MAP_DUMB failed: %d",
+                     errno);
+        destroyOverlayBuffer();
+        return false;
+    }
+
+    m_OverlayBufferMap = mmap(nullptr, m_OverlayBufferSize, PROT_READ | PROT_WRITE, MAP_SHARED, m_DrmFd, mapArg.offset);
+    if (m_OverlayBufferMap == MAP_FAILED) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "mmap() failed: %d",
+                     errno);
+        m_OverlayBufferMap = nullptr;
+        destroyOverlayBuffer();
+        return false;
+    }
+
+    // Wrap the mapping in a surface so we can compose the overlays with SDL
+    m_OverlayBufferSurface = SDL_CreateRGBSurfaceWithFormatFrom(m_OverlayBufferMap,
+                                                                m_OutputRect.w, m_OutputRect.h,
+                                                                32, createArg.pitch,
+                                                                SDL_PIXELFORMAT_ARGB8888);
+    if (m_OverlayBufferSurface == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "SDL_CreateRGBSurfaceWithFormatFrom() failed: %s",
+                     SDL_GetError());
+        destroyOverlayBuffer();
+        return false;
+    }
+
+    SDL_FillRect(m_OverlayBufferSurface, nullptr, 0);
+    SDL_zero(m_OverlayRects);
+    return true;
+}
+
+void DrmRenderer::destroyOverlayBuffer()
+{
+    if (m_OverlayPlaneActive) {
+        drmModeSetPlane(m_DrmFd, m_OverlayPlaneId, m_CrtcId, 0, 0,
+                        0, 0, 0, 0, 0, 0, 0, 0);
+        m_OverlayPlaneActive = false;
+    }
+
+    if (m_OverlayBufferSurface != nullptr) {
+        SDL_FreeSurface(m_OverlayBufferSurface);
+        m_OverlayBufferSurface = nullptr;
+    }
+
+    if (m_OverlayBufferMap != nullptr) {
+        munmap(m_OverlayBufferMap, m_OverlayBufferSize);
+        m_OverlayBufferMap = nullptr;
+    }
+
+    if (m_OverlayFbId != 0) {
+        drmModeRmFB(m_DrmFd, m_OverlayFbId);
+        m_OverlayFbId = 0;
+    }
+
+    if (m_OverlayBufferHandle != 0) {
+        struct drm_mode_destroy_dumb destroyArg = {};
+
+        destroyArg.handle = m_OverlayBufferHandle;
+        drmIoctl(m_DrmFd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroyArg);
+        m_OverlayBufferHandle = 0;
+    }
+}
+
+void DrmRenderer::updateOverlayPlane(int pendingUpdates, drmModeAtomicReq* req)
+{
+    bool overlayVisible = false;
+
+    // Pick up the latest overlay surfaces from the OverlayManager
+    for (int i = 0; i < Overlay::OverlayMax; i++) {
+        if (!(pendingUpdates & (1 << i))) {
+            continue;
+        }
+
+        Overlay::OverlayType type = (Overlay::OverlayType)i;
+        SDL_Surface* surface = Session::get()->getOverlayManager().getUpdatedOverlaySurface(type);
+
+        if (!Session::get()->getOverlayManager().isOverlayEnabled(type)) {
+            if (surface != nullptr) {
+                SDL_FreeSurface(surface);
+            }
+            surface = nullptr;
+        }
+        else if (surface == nullptr) {
+            // Keep the current surface
+            continue;
+        }
+
+        if (m_OverlaySurfaces[i] != nullptr) {
+            SDL_FreeSurface(m_OverlaySurfaces[i]);
+        }
+        m_OverlaySurfaces[i] = surface;
+    }
+
+    if (m_OverlayPlaneId == 0) {
+        return;
+    }
+
+    for (int i = 0; i < Overlay::OverlayMax; i++) {
+        overlayVisible |= m_OverlaySurfaces[i] != nullptr;
+    }
+
+    if (m_OverlayBufferSurface == nullptr) {
+        if (!overlayVisible || !createOverlayBuffer()) {
+            return;
+        }
+    }
+
+    // Erase the old overlays and compose the current ones. The overlay
+    // surfaces are already premultiplied, which is what KMS expects.
+    for (int i = 0; i < Overlay::OverlayMax; i++) {
+        if (m_OverlayRects[i].w != 0) {
+            SDL_FillRect(m_OverlayBufferSurface, &m_OverlayRects[i], 0);
+            SDL_zero(m_OverlayRects[i]);
+        }
+    }
+
+    for (int i = 0; i < Overlay::OverlayMax; i++) {
+        if (m_OverlaySurfaces[i] == nullptr) {
+            continue;
+        }
+
+        // Debug at the top left and status at the bottom left of the screen
+        m_OverlayRects[i].x = 0;
+        if (i == Overlay::OverlayStatusUpdate) {
+            m_OverlayRects[i].y = m_OutputRect.h - m_OverlaySurfaces[i]->h;
+        }
+        else {
+            m_OverlayRects[i].y = 0;
+        }
+
+        // This clips the destination rectangle to the overlay buffer
+        SDL_SetSurfaceBlendMode(m_OverlaySurfaces[i], SDL_BLENDMODE_NONE);
+        SDL_BlitSurface(m_OverlaySurfaces[i], nullptr, m_OverlayBufferSurface, &m_OverlayRects[i]);
+    }
 
+    if (overlayVisible != m_OverlayPlaneActive && !setOverlayPlaneActive(overlayVisible, req)) {
+        // Don't keep retrying on every update
+        destroyOverlayBuffer();
+        m_OverlayPlaneId = 0;
+    }
+}
+
+bool DrmRenderer::setOverlayPlaneActive(bool active, drmModeAtomicReq* req)
+{
+    if (req != nullptr) {
+        // This goes out with the video plane in the next commit
+        addPlaneProperties(req, m_OverlayPlaneId, m_OverlayPlaneProps,
+                           active ? m_OverlayFbId : 0,
+                           m_OutputRect.w, m_OutputRect.h,
+                           m_OutputRect);
+    }
+    else if (active) {
+        int err = drmModeSetPlane(m_DrmFd, m_OverlayPlaneId, m_CrtcId, m_OverlayFbId, 0,
+                                  0, 0,
+                                  m_OutputRect.w, m_OutputRect.h,
+                                  0, 0,
+                                  m_OutputRect.w << 16,
+                                  m_OutputRect.h << 16);
+        if (err < 0) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "drmModeSetPlane() failed for overlay plane: %d",
+                         errno);
+            return false;
+        }
+    }
+    else {
+        drmModeSetPlane(m_DrmFd, m_OverlayPlaneId, m_CrtcId, 0, 0,
+                        0, 0, 0, 0, 0, 0, 0, 0);
+    }
+
+    m_OverlayPlaneActive = active;
     return true;
 }
 
-enum AVPixelFormat DrmRenderer::getPreferredPixelFormat(int)
+enum AVPixelFormat DrmRenderer::getPreferredPixelFormat(int videoFormat)
 {
+    if (m_BackendRenderer != nullptr) {
+        return m_BackendRenderer->getPreferredPixelFormat(videoFormat);
+    }
+
     // DRM PRIME buffers
     return AV_PIX_FMT_DRM_PRIME;
 }
 
-void DrmRenderer::renderFrame(AVFrame* frame)
+void DrmRenderer::releaseFramebuffer(int index)
+{
+    struct drm_gem_close closeArg = {};
+
+    drmModeRmFB(m_DrmFd, m_FbCache[index].fbId);
+
+    for (int i = 0; i < m_FbCache[index].handleCount; i++) {
+        closeArg.handle = m_FbCache[index].handles[i];
+        drmIoctl(m_DrmFd, DRM_IOCTL_GEM_CLOSE, &closeArg);
+    }
+}
+
+void DrmRenderer::flushFramebufferCache()
 {
-    AVDRMFrameDescriptor* drmFrame = (AVDRMFrameDescriptor*)frame->data[0];
+    for (int i = 0; i < m_FbCacheCount; i++) {
+        releaseFramebuffer(i);
+    }
+
+    m_FbCacheCount = 0;
+    m_CurrentFbId = 0;
+    m_PreviousFbId = 0;
+}
+
+uint32_t DrmRenderer::getFramebuffer(AVFrame* frame)
+{
+    AVDRMFrameDescriptor mappedFrame;
+    AVDRMFrameDescriptor* drmFrame = nullptr;
+    void* framesContext = frame->hw_frames_ctx != nullptr ? frame->hw_frames_ctx->data : nullptr;
+    intptr_t key;
     int err;
-    uint32_t primeHandle;
+    int i;
+
+    if (m_BackendRenderer != nullptr) {
+        // Hardware frames keep their surface in data[3]. The fds are only
+        // mapped when there's no FB for the surface yet.
+        key = (intptr_t)frame->data[3];
+    }
+    else {
+        drmFrame = (AVDRMFrameDescriptor*)frame->data[0];
+        key = drmFrame->objects[0].fd;
+    }
+
+    // A new frames context means the decoder's pool was rebuilt, so the
+    // fds we have cached may now refer to different buffers (or none).
+    if (framesContext != m_FbCacheFramesContext) {
+        int keptCount = 0;
+
+        for (i = 0; i < m_FbCacheCount; i++) {
+            if (m_FbCache[i].fbId == m_CurrentFbId || m_FbCache[i].fbId == m_PreviousFbId) {
+                // The plane keeps scanning this FB out until the next frame
+                // replaces it, so it must stay until it's evicted later.
+                m_FbCache[keptCount] = m_FbCache[i];
+                m_FbCache[keptCount].key = -1;
+                keptCount++;
+            }
+            else {
+                releaseFramebuffer(i);
+            }
+        }
+
+        if (m_FbCacheCount != 0) {
+            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                        "Decoder frame pool changed; flushed %d cached FBs",
+                        m_FbCacheCount - keptCount);
+        }
+
+        m_FbCacheCount = keptCount;
+        m_FbCacheFramesContext = framesContext;
+    }
+
+    m_FbCacheClock++;
+
+    // A surface's format can't change within a frames context, so mapped
+    // frames are matched without it. KMS waits for the decoder's implicit
+    // fence on the DMA-BUF before scanning it out, so a cached surface
+    // needs no vaSyncSurface() either.
+    for (i = 0; i < m_FbCacheCount; i++) {
+        if (m_FbCache[i].key == key &&
+                (drmFrame == nullptr || m_FbCache[i].format == drmFrame->layers[0].format) &&
+                m_FbCache[i].width == frame->width &&
+                m_FbCache[i].height == frame->height) {
+            m_FbCache[i].lastUsed = m_FbCacheClock;
+            return m_FbCache[i].fbId;
+        }
+    }
+
+    if (drmFrame == nullptr) {
+        if (!m_BackendRenderer->mapDrmPrimeFrame(frame, &mappedFrame)) {
+            return 0;
+        }
+
+        drmFrame = &mappedFrame;
+    }
+
+    // V4L2 decoders may export each plane as its own object, but
+    // all of them describe the frame with a single layer
+    SDL_assert(drmFrame->nb_objects >= 1 && drmFrame->nb_objects <= 4);
+    SDL_assert(drmFrame->nb_layers == 1);
+
+    // Not cached yet, so find a slot for it. If the cache is full,
+    // evict the least recently used FB that isn't on screen. With
+    // atomic KMS, the previous FB may still be on screen until the
+    // current one flips in, so that one is kept too.
+    if (m_FbCacheCount < DRM_FB_CACHE_SIZE) {
+        i = m_FbCacheCount++;
+    }
+    else {
+        int lruIndex = -1;
+        for (int j = 0; j < m_FbCacheCount; j++) {
+            if (m_FbCache[j].fbId != m_CurrentFbId && m_FbCache[j].fbId != m_PreviousFbId &&
+                    (lruIndex < 0 || m_FbCache[j].lastUsed < m_FbCache[lruIndex].lastUsed)) {
+                lruIndex = j;
+            }
+        }
+
+        i = lruIndex;
+        releaseFramebuffer(i);
+    }
+
     uint32_t handles[4] = {};
     uint32_t pitches[4] = {};
     uint32_t offsets[4] = {};
+    uint64_t modifiers[4] = {};
+
+    // Convert the FDs in the AVDRMFrameDescriptor to PRIME handles
+    // that can be used in drmModeAddFB2()
+    m_FbCache[i].handleCount = 0;
+    for (int j = 0; j < drmFrame->nb_objects; j++) {
+        uint32_t handle;
+
+        err = drmPrimeFDToHandle(m_DrmFd, drmFrame->objects[j].fd, &handle);
+        if (err < 0) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "drmPrimeFDToHandle() failed: %d",
+                         errno);
+            break;
+        }
+
+        // Objects backed by the same buffer share a handle, and
+        // each handle must only be closed once
+        int k;
+        for (k = 0; k < m_FbCache[i].handleCount; k++) {
+            if (m_FbCache[i].handles[k] == handle) {
+                break;
+            }
+        }
+        if (k == m_FbCache[i].handleCount) {
+            m_FbCache[i].handles[m_FbCache[i].handleCount++] = handle;
+        }
+
+        for (int l = 0; l < drmFrame->layers[0].nb_planes; l++) {
+            if (drmFrame->layers[0].planes[l].object_index == j) {
+                handles[l] = handle;
+            }
+        }
+    }
+
+    if (err >= 0) {
+        bool hasModifier = false;
+
+        for (int j = 0; j < drmFrame->layers[0].nb_planes; j++) {
+            const AVDRMPlaneDescriptor* plane = &drmFrame->layers[0].planes[j];
+
+            pitches[j] = plane->pitch;
+            offsets[j] = plane->offset;
+            modifiers[j] = drmFrame->objects[plane->object_index].format_modifier;
+
+            // Tiled layouts (like the Pi's SAND formats for HEVC) can be
+            // scanned out directly, but only if KMS is told about them
+            if (modifiers[j] != DRM_FORMAT_MOD_INVALID && modifiers[j] != DRM_FORMAT_MOD_LINEAR) {
+                hasModifier = true;
+            }
+        }
+
+        // Create a frame buffer object from the PRIME buffers
+        if (hasModifier) {
+            err = drmModeAddFB2WithModifiers(m_DrmFd, frame->width, frame->height,
+                                             drmFrame->layers[0].format,
+                                             handles, pitches, offsets, modifiers,
+                                             &m_FbCache[i].fbId, DRM_MODE_FB_MODIFIERS);
+        }
+        else {
+            err = drmModeAddFB2(m_DrmFd, frame->width, frame->height,
+                                drmFrame->layers[0].format,
+                                handles, pitches, offsets, &m_FbCache[i].fbId, 0);
+        }
+        if (err < 0) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "drmModeAddFB2() failed: %d",
+                         errno);
+        }
+    }
+
+    m_FbCache[i].format = drmFrame->layers[0].format;
+
+    // The GEM handles keep the buffers alive once the fds are closed
+    if (drmFrame == &mappedFrame) {
+        m_BackendRenderer->unmapDrmPrimeFrame(&mappedFrame);
+        drmFrame = nullptr;
+    }
+
+    if (err < 0) {
+        struct drm_gem_close closeArg = {};
 
+        for (int j = 0; j < m_FbCache[i].handleCount; j++) {
+            closeArg.handle = m_FbCache[i].handles[j];
+            drmIoctl(m_DrmFd, DRM_IOCTL_GEM_CLOSE, &closeArg);
+        }
+        m_FbCache[i] = m_FbCache[--m_FbCacheCount];
+        return 0;
+    }
+
+    m_FbCache[i].key = key;
+    m_FbCache[i].width = frame->width;
+    m_FbCache[i].height = frame->height;
+    m_FbCache[i].lastUsed = m_FbCacheClock;
+    return m_FbCache[i].fbId;
+}
+
+void DrmRenderer::renderFrame(AVFrame* frame)
+{
+    int err;
     SDL_Rect src, dst;
 
     src.x = src.y = 0;
@@ -211,58 +974,90 @@ void DrmRenderer::renderFrame(AVFrame* frame)
     dst = m_OutputRect;
 
     StreamUtils::scaleSourceToDestinationSurface(&src, &dst);
+    SDL_AtomicSet(&m_Unscaled, dst.w == src.w && dst.h == src.h);
 
-    // Convert the FD in the AVDRMFrameDescriptor to a PRIME handle
-    // that can be used in drmModeAddFB2()
-    SDL_assert(drmFrame->nb_objects == 1);
-    err = drmPrimeFDToHandle(m_DrmFd, drmFrame->objects[0].fd, &primeHandle);
-    if (err < 0) {
-        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                     "drmPrimeFDToHandle() failed: %d",
-                     errno);
+    uint32_t fbId = getFramebuffer(frame);
+    if (fbId == 0) {
         return;
     }
 
-    SDL_assert(drmFrame->nb_layers == 1);
-    SDL_assert(drmFrame->layers[0].nb_planes == 2);
-    for (int i = 0; i < drmFrame->layers[0].nb_planes; i++) {
-        handles[i] = primeHandle;
-        pitches[i] = drmFrame->layers[0].planes[i].pitch;
-        offsets[i] = drmFrame->layers[0].planes[i].offset;
-    }
+    if (m_Atomic) {
+        bool overlayPlaneWasActive = m_OverlayPlaneActive;
 
-    // Remember the last FB object we created so we can free it
-    // when we are finished rendering this one (if successful).
-    uint32_t lastFbId = m_CurrentFbId;
+        // Only one commit can be in flight on a CRTC, so a frame that
+        // arrives before the last one reached the screen must wait.
+        waitForPageFlip();
 
-    // Create a frame buffer object from the PRIME buffer
-    err = drmModeAddFB2(m_DrmFd, frame->width, frame->height,
-                        drmFrame->layers[0].format,
-                        handles, pitches, offsets, &m_CurrentFbId, 0);
-    if (err < 0) {
-        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                     "drmModeAddFB2() failed: %d",
-                     errno);
-        m_CurrentFbId = lastFbId;
-        return;
-    }
+        drmModeAtomicReq* req = drmModeAtomicAlloc();
+        if (req == nullptr) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "drmModeAtomicAlloc() failed");
+            return;
+        }
 
-    // Update the overlay
-    err = drmModeSetPlane(m_DrmFd, m_PlaneId, m_CrtcId, m_CurrentFbId, 0,
-                          dst.x, dst.y,
-                          dst.w, dst.h,
-                          0, 0,
-                          frame->width << 16,
-                          frame->height << 16);
-    if (err < 0) {
-        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                     "drmModeSetPlane() failed: %d",
-                     errno);
-        drmModeRmFB(m_DrmFd, m_CurrentFbId);
-        m_CurrentFbId = lastFbId;
-        return;
+        addPlaneProperties(req, m_PlaneId, m_PlaneProps, fbId, frame->width, frame->height, dst);
+
+        // Overlay plane changes are committed along with this frame
+        int pendingUpdates = SDL_AtomicSet(&m_PendingOverlayUpdates, 0);
+        if (pendingUpdates != 0) {
+            updateOverlayPlane(pendingUpdates, req);
+        }
+
+        // The flip event may arrive on the V-sync thread before we return
+        m_FlipFrameNumber = (int)frame->pkt_dts;
+        SDL_AtomicSet(&m_FlipPending, 1);
+
+        err = drmModeAtomicCommit(m_DrmFd, req,
+                                  DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT,
+                                  static_cast<IDrmPageFlipListener*>(this));
+        drmModeAtomicFree(req);
+        if (err < 0) {
+            SDL_AtomicSet(&m_FlipPending, 0);
+
+            if (errno == EBUSY) {
+                // The last flip timed out and still hasn't completed
+                m_BusyCommits++;
+            }
+            else {
+                SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                             "drmModeAtomicCommit() failed: %d",
+                             errno);
+            }
+
+            // Try the overlay plane change again with the next frame
+            if (m_OverlayPlaneActive != overlayPlaneWasActive) {
+                m_OverlayPlaneActive = overlayPlaneWasActive;
+                notifyOverlayUpdated(Overlay::OverlayDebug);
+            }
+
+            return;
+        }
     }
+    else {
+        // Update the overlay
+        err = drmModeSetPlane(m_DrmFd, m_PlaneId, m_CrtcId, fbId, 0,
+                              dst.x, dst.y,
+                              dst.w, dst.h,
+                              0, 0,
+                              frame->width << 16,
+                              frame->height << 16);
+        if (err < 0) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "drmModeSetPlane() failed: %d",
+                         errno);
+            return;
+        }
+    }
+
+    // The cache must not evict the FBs that may be scanned out
+    m_PreviousFbId = m_CurrentFbId;
+    m_CurrentFbId = fbId;
 
-    // Free the previous FB object which has now been superseded
-    drmModeRmFB(m_DrmFd, lastFbId);
+    // Compose any overlays updated since the last frame
+    if (!m_Atomic) {
+        int pendingUpdates = SDL_AtomicSet(&m_PendingOverlayUpdates, 0);
+        if (pendingUpdates != 0) {
+            updateOverlayPlane(pendingUpdates, nullptr);
+        }
+    }
 }
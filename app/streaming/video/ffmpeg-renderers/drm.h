@@ -1,24 +1,109 @@
 #pragma once
 
 #include "renderer.h"
+#include "pacer/drmvsyncsource.h"
 
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 
-class DrmRenderer : public IFFmpegRenderer {
+class DrmRenderer : public IFFmpegRenderer, public IDrmPageFlipListener {
 public:
-    DrmRenderer();
+    // With hwaccel set, frames come from an FFmpeg DRM hwaccel (like the
+    // V4L2 request API decoders) instead of a decoder that exports its
+    // own DRM PRIME frames (like RKMPP or V4L2 M2M). With a backend
+    // renderer, we're the frontend for a decoder whose frames can be
+    // mapped as DMA-BUFs (like VAAPI without a display server).
+    DrmRenderer(bool hwaccel = false, IFFmpegRenderer* backendRenderer = nullptr);
     virtual ~DrmRenderer() override;
     virtual bool initialize(PDECODER_PARAMETERS params) override;
     virtual bool prepareDecoderContext(AVCodecContext* context) override;
+    virtual bool needsTestFrame() override;
     virtual void renderFrame(AVFrame* frame) override;
     virtual enum AVPixelFormat getPreferredPixelFormat(int videoFormat) override;
+    virtual bool reinitializePresentation(PDECODER_PARAMETERS params) override;
+    virtual bool notifyWindowResized(PDECODER_PARAMETERS params) override;
+    virtual bool getDrmCrtc(int& drmFd, int& crtcIndex) override;
+    virtual void setDrmEventsHandledExternally(bool handled) override;
+    virtual void notifyOverlayUpdated(Overlay::OverlayType type) override;
+    virtual bool usesOverlaySurfaces() override;
+    virtual void pageFlipCompleted(unsigned int sequence, Uint64 flipTimeUs) override;
+    virtual const char* getPresentationPath() override;
 
 private:
+    struct PlaneProperties {
+        uint32_t fbId;
+        uint32_t crtcId;
+        uint32_t srcX, srcY, srcW, srcH;
+        uint32_t crtcX, crtcY, crtcW, crtcH;
+    };
+
+    bool getPlaneProperties(uint32_t planeId, PlaneProperties& planeProps);
+    void addPlaneProperties(drmModeAtomicReq* req, uint32_t planeId, const PlaneProperties& planeProps,
+                            uint32_t fbId, int srcWidth, int srcHeight, const SDL_Rect& dst);
+    void waitForPageFlip();
+    bool setOverlayPlaneActive(bool active, drmModeAtomicReq* req);
+    uint32_t findOverlayPlane(drmModePlaneRes* planeRes, uint32_t format, uint32_t afterPlaneId);
+    bool createOverlayBuffer();
+    void destroyOverlayBuffer();
+    void updateOverlayPlane(int pendingUpdates, drmModeAtomicReq* req);
+    uint32_t getFramebuffer(AVFrame* frame);
+    void releaseFramebuffer(int index);
+    void flushFramebufferCache();
+
+    bool m_HwAccel;
+    IFFmpegRenderer* m_BackendRenderer;
+    AVBufferRef* m_HwContext;
     int m_DrmFd;
     uint32_t m_CrtcId;
+    int m_CrtcIndex;
     uint32_t m_PlaneId;
     uint32_t m_CurrentFbId;
+    uint32_t m_PreviousFbId;
     SDL_Rect m_OutputRect;
+
+    // With atomic KMS, each frame is a non-blocking commit that completes
+    // with a page flip event at the V-blank where it reaches the screen.
+    bool m_Atomic;
+    PlaneProperties m_PlaneProps;
+    PlaneProperties m_OverlayPlaneProps;
+    SDL_atomic_t m_FlipPending;
+    SDL_atomic_t m_Unscaled;
+    SDL_atomic_t m_DrmEventsHandledExternally;
+    SDL_sem* m_FlipCompletedSem;
+    int m_FlipFrameNumber;
+    int m_BusyCommits;
+
+    // The decoder cycles through a small pool of DMA-BUFs, so we keep
+    // the FB objects we've created for them rather than recreating an
+    // FB for every frame. The cache belongs to a single frames context.
+    // Entries are found by the first DMA-BUF's fd, or by the backend's
+    // surface handle for mapped frames, whose fds are new every time.
+    // A key of -1 never matches.
+#define DRM_FB_CACHE_SIZE 24
+    struct {
+        intptr_t key;
+        uint32_t handles[4];
+        int handleCount;
+        uint32_t fbId;
+        uint32_t format;
+        int width, height;
+        uint32_t lastUsed;
+    } m_FbCache[DRM_FB_CACHE_SIZE];
+    int m_FbCacheCount;
+    uint32_t m_FbCacheClock;
+    void* m_FbCacheFramesContext;
+
+    // The overlays are composed into a single dumb buffer that
+    // covers the whole CRTC and is scanned out by its own plane.
+    uint32_t m_OverlayPlaneId;
+    uint32_t m_OverlayBufferHandle;
+    uint32_t m_OverlayFbId;
+    void* m_OverlayBufferMap;
+    uint64_t m_OverlayBufferSize;
+    SDL_Surface* m_OverlayBufferSurface;
+    bool m_OverlayPlaneActive;
+    SDL_Surface* m_OverlaySurfaces[Overlay::OverlayMax];
+    SDL_Rect m_OverlayRects[Overlay::OverlayMax];
+    SDL_atomic_t m_PendingOverlayUpdates;
 };
 
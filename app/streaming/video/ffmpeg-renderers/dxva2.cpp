@@ -17,6 +17,10 @@ DEFINE_GUID(DXVADDI_Intel_ModeH264_E, 0x604F8E68,0x4951,0x4C54,0x88,0xFE,0xAB,0x
 
 #define SAFE_COM_RELEASE(x) if (x) { (x)->Release(); }
 
+// Longest we'll wait for the GPU to finish earlier presents before
+// rendering anyway, in case a query never signals
+#define PRESENT_WAIT_TIMEOUT_MS 100
+
 DXVA2Renderer::DXVA2Renderer() :
     m_DecService(nullptr),
     m_Decoder(nullptr),
@@ -27,12 +31,24 @@ DXVA2Renderer::DXVA2Renderer() :
     m_ProcService(nullptr),
     m_Processor(nullptr),
     m_FrameIndex(0),
-    m_DebugOverlayFont(nullptr),
-    m_StatusOverlayFont(nullptr),
-    m_BlockingPresent(false)
+    m_OverlaySprite(nullptr),
+    m_BlockingPresent(false),
+    m_FlipEx(false),
+    m_PresentQueryIndex(0),
+    m_PendingPresents(0),
+    m_Windowed(false)
 {
+    RtlZeroMemory(m_PresentQueries, sizeof(m_PresentQueries));
+    RtlZeroMemory(m_PresentationPath, sizeof(m_PresentationPath));
+    SDL_AtomicSet(&m_PresentQueueDepthTotal, 0);
+    SDL_AtomicSet(&m_PresentQueueDepthSamples, 0);
+    SDL_AtomicSet(&m_Unscaled, 0);
+    RtlZeroMemory(&m_AdapterLuid, sizeof(m_AdapterLuid));
     RtlZeroMemory(m_DecSurfaces, sizeof(m_DecSurfaces));
     RtlZeroMemory(&m_DXVAContext, sizeof(m_DXVAContext));
+    RtlZeroMemory(m_OverlayTextures, sizeof(m_OverlayTextures));
+    RtlZeroMemory(m_OverlayRects, sizeof(m_OverlayRects));
+    SDL_AtomicSet(&m_PendingOverlayUpdates, 0);
 
     // Use MMCSS scheduling for lower scheduling latency while we're streaming
     DwmEnableMMCSS(TRUE);
@@ -48,8 +64,15 @@ DXVA2Renderer::~DXVA2Renderer()
     SAFE_COM_RELEASE(m_RenderTarget);
     SAFE_COM_RELEASE(m_ProcService);
     SAFE_COM_RELEASE(m_Processor);
-    SAFE_COM_RELEASE(m_DebugOverlayFont);
-    SAFE_COM_RELEASE(m_StatusOverlayFont);
+    SAFE_COM_RELEASE(m_OverlaySprite);
+
+    for (int i = 0; i < Overlay::OverlayMax; i++) {
+        SAFE_COM_RELEASE(m_OverlayTextures[i]);
+    }
+
+    for (int i = 0; i < PRESENT_QUERY_COUNT; i++) {
+        SAFE_COM_RELEASE(m_PresentQueries[i]);
+    }
 
     for (int i = 0; i < ARRAYSIZE(m_DecSurfaces); i++) {
         SAFE_COM_RELEASE(m_DecSurfaces[i]);
@@ -382,8 +405,8 @@ bool DXVA2Renderer::isDecoderBlacklisted()
     HRESULT hr;
     bool result = false;
 
-    // TODO: Update for HEVC Main10
-    SDL_assert(m_VideoFormat != VIDEO_FORMAT_H265_MAIN10);
+    // Main10 support implies Pascal or later on NVIDIA, and the HEVC
+    // rules below cover Main10 as well through VIDEO_FORMAT_MASK_H265.
 
     if (qgetenv("DXVA2_DISABLE_DECODER_BLACKLIST") == "1") {
         SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
@@ -510,33 +533,22 @@ bool DXVA2Renderer::isDecoderBlacklisted()
     return result;
 }
 
-bool DXVA2Renderer::initializeDevice(SDL_Window* window, bool enableVsync)
+void DXVA2Renderer::getPresentParameters(IDirect3D9Ex* d3d9ex, int adapterIndex,
+                                         SDL_Window* window, bool enableVsync, bool enableVrr,
+                                         D3DPRESENT_PARAMETERS& d3dpp, D3DDISPLAYMODEEX& currentMode)
 {
     SDL_SysWMinfo info;
 
     SDL_VERSION(&info.version);
     SDL_GetWindowWMInfo(window, &info);
 
-    IDirect3D9Ex* d3d9ex;
-    HRESULT hr = Direct3DCreate9Ex(D3D_SDK_VERSION, &d3d9ex);
-    if (FAILED(hr)) {
-        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                     "Direct3DCreate9Ex() failed: %x",
-                     hr);
-        return false;
-    }
-
-    int adapterIndex = SDL_Direct3D9GetAdapterIndex(SDL_GetWindowDisplayIndex(window));
     Uint32 windowFlags = SDL_GetWindowFlags(window);
 
-    D3DCAPS9 deviceCaps;
-    d3d9ex->GetDeviceCaps(adapterIndex, D3DDEVTYPE_HAL, &deviceCaps);
-
-    D3DDISPLAYMODEEX currentMode;
+    currentMode = {};
     currentMode.Size = sizeof(currentMode);
     d3d9ex->GetAdapterDisplayModeEx(adapterIndex, &currentMode, nullptr);
 
-    D3DPRESENT_PARAMETERS d3dpp = {};
+    d3dpp = {};
     d3dpp.hDeviceWindow = info.info.win.window;
     d3dpp.Flags = D3DPRESENTFLAG_VIDEO;
 
@@ -562,18 +574,21 @@ bool DXVA2Renderer::initializeDevice(SDL_Window* window, bool enableVsync)
         d3dpp.PresentationInterval = D3DPRESENT_INTERVAL_IMMEDIATE;
 
         // If V-sync is enabled (not rendering faster than display),
-        // we can use FlipEx for more efficient swapping.
-        if (enableVsync) {
+        // we can use FlipEx for more efficient swapping. VRR displays
+        // also need FlipEx to follow our presents in windowed mode.
+        if (enableVsync || enableVrr) {
             // D3DSWAPEFFECT_FLIPEX requires at least 2 back buffers to allow us to
             // continue while DWM is waiting to render the surface to the display.
             d3dpp.SwapEffect = D3DSWAPEFFECT_FLIPEX;
             d3dpp.BackBufferCount = 2;
+            m_FlipEx = true;
         }
         else {
             // With V-sync off, we won't use FlipEx because that will block while
             // DWM is waiting to render our surface (effectively behaving like V-Sync).
             d3dpp.SwapEffect = D3DSWAPEFFECT_DISCARD;
             d3dpp.BackBufferCount = 1;
+            m_FlipEx = false;
         }
 
         m_BlockingPresent = false;
@@ -581,6 +596,19 @@ bool DXVA2Renderer::initializeDevice(SDL_Window* window, bool enableVsync)
         SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
                     "Windowed mode with DWM running");
     }
+    else if (enableVrr) {
+        // Full-screen exclusive mode on a VRR display. The stream is capped
+        // below the maximum refresh rate, so the display refreshes whenever
+        // we present and we never need to wait for V-sync ourselves.
+        d3dpp.PresentationInterval = D3DPRESENT_INTERVAL_IMMEDIATE;
+        d3dpp.SwapEffect = D3DSWAPEFFECT_DISCARD;
+        d3dpp.BackBufferCount = 1;
+        m_BlockingPresent = false;
+        m_FlipEx = false;
+
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "VRR enabled");
+    }
     else if (enableVsync) {
         // Uncomposited desktop or full-screen exclusive mode with V-sync enabled
         // We will enable V-sync in this scenario to avoid tearing.
@@ -588,6 +616,7 @@ bool DXVA2Renderer::initializeDevice(SDL_Window* window, bool enableVsync)
         d3dpp.SwapEffect = D3DSWAPEFFECT_DISCARD;
         d3dpp.BackBufferCount = 1;
         m_BlockingPresent = true;
+        m_FlipEx = false;
 
         SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
                     "V-Sync enabled");
@@ -599,6 +628,7 @@ bool DXVA2Renderer::initializeDevice(SDL_Window* window, bool enableVsync)
         d3dpp.SwapEffect = D3DSWAPEFFECT_DISCARD;
         d3dpp.BackBufferCount = 1;
         m_BlockingPresent = false;
+        m_FlipEx = false;
 
         SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
                     "V-Sync disabled in tearing mode");
@@ -607,6 +637,32 @@ bool DXVA2Renderer::initializeDevice(SDL_Window* window, bool enableVsync)
     SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
                 "Windowed: %d | Present Interval: %x",
                 d3dpp.Windowed, d3dpp.PresentationInterval);
+}
+
+bool DXVA2Renderer::initializeDevice(SDL_Window* window, bool enableVsync, bool enableVrr)
+{
+    IDirect3D9Ex* d3d9ex;
+    HRESULT hr = Direct3DCreate9Ex(D3D_SDK_VERSION, &d3d9ex);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Direct3DCreate9Ex() failed: %x",
+                     hr);
+        return false;
+    }
+
+    int adapterIndex = SDL_Direct3D9GetAdapterIndex(SDL_GetWindowDisplayIndex(window));
+
+    D3DCAPS9 deviceCaps;
+    d3d9ex->GetDeviceCaps(adapterIndex, D3DDEVTYPE_HAL, &deviceCaps);
+
+    // Each output of a GPU is a separate adapter to D3D9, so the LUID is
+    // what tells us which GPU the device lives on
+    d3d9ex->GetAdapterLUID(adapterIndex, &m_AdapterLuid);
+
+    D3DPRESENT_PARAMETERS d3dpp;
+    D3DDISPLAYMODEEX currentMode;
+    getPresentParameters(d3d9ex, adapterIndex, window, enableVsync, enableVrr, d3dpp, currentMode);
+    m_Windowed = d3dpp.Windowed;
 
     // FFmpeg requires this attribute for doing asynchronous decoding
     // in a separate thread with this device.
@@ -646,6 +702,22 @@ bool DXVA2Renderer::initializeDevice(SDL_Window* window, bool enableVsync)
         return false;
     }
 
+    for (int i = 0; i < PRESENT_QUERY_COUNT; i++) {
+        hr = m_Device->CreateQuery(D3DQUERYTYPE_EVENT, &m_PresentQueries[i]);
+        if (FAILED(hr)) {
+            // We just won't wait for the GPU before rendering
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "CreateQuery(D3DQUERYTYPE_EVENT) failed: %x",
+                        hr);
+            for (int j = 0; j < i; j++) {
+                SAFE_COM_RELEASE(m_PresentQueries[j]);
+                m_PresentQueries[j] = nullptr;
+            }
+            m_PresentQueries[i] = nullptr;
+            break;
+        }
+    }
+
     return true;
 }
 
@@ -680,9 +752,17 @@ bool DXVA2Renderer::initialize(PDECODER_PARAMETERS params)
     m_Desc.SampleFormat.VideoPrimaries = DXVA2_VideoPrimaries_Unknown;
     m_Desc.SampleFormat.VideoTransferFunction = DXVA2_VideoTransFunc_Unknown;
     m_Desc.SampleFormat.SampleFormat = DXVA2_SampleProgressiveFrame;
-    m_Desc.Format = (D3DFORMAT)MAKEFOURCC('N','V','1','2');
 
-    if (!initializeDevice(params->window, params->enableVsync)) {
+    // Main10 decodes into P010 surfaces. D3D9 has no way to present HDR,
+    // so HDR streams need D3D11VA to reach the display as HDR.
+    if (m_VideoFormat == VIDEO_FORMAT_H265_MAIN10) {
+        m_Desc.Format = (D3DFORMAT)MAKEFOURCC('P','0','1','0');
+    }
+    else {
+        m_Desc.Format = (D3DFORMAT)MAKEFOURCC('N','V','1','2');
+    }
+
+    if (!initializeDevice(params->window, params->enableVsync, params->enableVrr)) {
         return false;
     }
 
@@ -704,61 +784,321 @@ bool DXVA2Renderer::initialize(PDECODER_PARAMETERS params)
     return true;
 }
 
+bool DXVA2Renderer::reinitializePresentation(PDECODER_PARAMETERS params)
+{
+    // Full-screen exclusive mode owns the output of the adapter the device
+    // was created on, so there's nothing to keep when entering or leaving it
+    if (!m_Windowed ||
+            (SDL_GetWindowFlags(params->window) & SDL_WINDOW_FULLSCREEN_DESKTOP) == SDL_WINDOW_FULLSCREEN) {
+        return false;
+    }
+
+    IDirect3D9* d3d9;
+    HRESULT hr = m_Device->GetDirect3D(&d3d9);
+    if (FAILED(hr)) {
+        return false;
+    }
+
+    IDirect3D9Ex* d3d9ex;
+    hr = d3d9->QueryInterface(__uuidof(IDirect3D9Ex), (void**)&d3d9ex);
+    d3d9->Release();
+    if (FAILED(hr)) {
+        return false;
+    }
+
+    // If the window is now on a display driven by another GPU (like the
+    // discrete GPU's outputs on a hybrid laptop), the decoder's surfaces
+    // would be copied across adapters on every present. The decoder has to
+    // be recreated on the new GPU in that case.
+    int adapterIndex = SDL_Direct3D9GetAdapterIndex(SDL_GetWindowDisplayIndex(params->window));
+    LUID adapterLuid;
+    if (FAILED(d3d9ex->GetAdapterLUID(adapterIndex, &adapterLuid)) ||
+            adapterLuid.LowPart != m_AdapterLuid.LowPart ||
+            adapterLuid.HighPart != m_AdapterLuid.HighPart) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Window moved to a display on another GPU");
+        d3d9ex->Release();
+        return false;
+    }
+
+    SDL_SysWMinfo info;
+    SDL_VERSION(&info.version);
+    SDL_GetWindowWMInfo(params->window, &info);
+
+    // A lost or removed device must be recreated from scratch
+    hr = m_Device->CheckDeviceState(info.info.win.window);
+    if (hr != S_OK && hr != S_PRESENT_OCCLUDED && hr != S_PRESENT_MODE_CHANGED) {
+        d3d9ex->Release();
+        return false;
+    }
+
+    D3DPRESENT_PARAMETERS d3dpp;
+    D3DDISPLAYMODEEX currentMode;
+    getPresentParameters(d3d9ex, adapterIndex, params->window, params->enableVsync, params->enableVrr, d3dpp, currentMode);
+    d3d9ex->Release();
+
+    // D3D9Ex keeps D3DPOOL_DEFAULT resources across a reset, so only
+    // the back buffer reference must be dropped first
+    SAFE_COM_RELEASE(m_RenderTarget);
+    m_RenderTarget = nullptr;
+    if (m_OverlaySprite != nullptr) {
+        m_OverlaySprite->OnLostDevice();
+    }
+
+    hr = m_Device->ResetEx(&d3dpp, nullptr);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "ResetEx() failed: %x",
+                     hr);
+        return false;
+    }
+
+    hr = m_Device->GetBackBuffer(0, 0, D3DBACKBUFFER_TYPE_MONO, &m_RenderTarget);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "GetBackBuffer() failed: %x",
+                     hr);
+        m_RenderTarget = nullptr;
+        return false;
+    }
+
+    D3DSURFACE_DESC renderTargetDesc;
+    m_RenderTarget->GetDesc(&renderTargetDesc);
+    m_DisplayWidth = renderTargetDesc.Width;
+    m_DisplayHeight = renderTargetDesc.Height;
+
+    if (m_OverlaySprite != nullptr) {
+        m_OverlaySprite->OnResetDevice();
+    }
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Kept D3D9 device on the same GPU for adapter %d",
+                adapterIndex);
+    return true;
+}
+
+int DXVA2Renderer::getDecoderCapabilities()
+{
+    // DXVA2 decoders keep the full DPB the host asks for, so the
+    // host can invalidate lost references instead of sending an IDR
+    return CAPABILITY_REFERENCE_FRAME_INVALIDATION_AVC |
+           CAPABILITY_REFERENCE_FRAME_INVALIDATION_HEVC;
+}
+
+bool DXVA2Renderer::isRenderThreadSupported()
+{
+    // The device is created with D3DCREATE_MULTITHREADED and everything
+    // that draws on it (including the overlays) happens in renderFrame(),
+    // so the Pacer can present from its render thread.
+    return true;
+}
+
+// Called on the render thread
+int DXVA2Renderer::countPendingPresents()
+{
+    // Queries signal in the order they were issued, so stop at the
+    // oldest one that's still pending
+    while (m_PendingPresents > 0) {
+        int oldest = (m_PresentQueryIndex + PRESENT_QUERY_COUNT - m_PendingPresents) % PRESENT_QUERY_COUNT;
+        if (m_PresentQueries[oldest]->GetData(nullptr, 0, D3DGETDATA_FLUSH) != S_OK) {
+            break;
+        }
+
+        m_PendingPresents--;
+    }
+
+    return m_PendingPresents;
+}
+
+void DXVA2Renderer::waitToRender()
+{
+    if (m_PresentQueries[0] == nullptr) {
+        return;
+    }
+
+    // Presenting with D3DPRESENT_DONOTWAIT fails while the queue is full
+    // and holding the device lock in a retry loop stalls decoding, so
+    // wait outside of it until the GPU has finished the last present.
+    // The Pacer picks the frame to render after this returns, so it's
+    // the newest one.
+    Uint32 startTime = SDL_GetTicks();
+    while (countPendingPresents() > 0 &&
+           !SDL_TICKS_PASSED(SDL_GetTicks(), startTime + PRESENT_WAIT_TIMEOUT_MS)) {
+        SDL_Delay(1);
+    }
+}
+
+const char* DXVA2Renderer::getPresentationPath()
+{
+    const char* swapEffect;
+    if (!m_Windowed) {
+        swapEffect = "D3D9Ex full-screen exclusive";
+    }
+    else if (m_FlipEx) {
+        swapEffect = "D3D9Ex FlipEx";
+    }
+    else {
+        swapEffect = "D3D9Ex discard";
+    }
+
+    const char* scaling = SDL_AtomicGet(&m_Unscaled) ? "unscaled" : "scaled";
+
+    int samples = SDL_AtomicSet(&m_PresentQueueDepthSamples, 0);
+    int total = SDL_AtomicSet(&m_PresentQueueDepthTotal, 0);
+    if (m_PresentQueries[0] == nullptr) {
+        snprintf(m_PresentationPath, sizeof(m_PresentationPath), "%s, %s", swapEffect, scaling);
+    }
+    else if (samples != 0) {
+        snprintf(m_PresentationPath, sizeof(m_PresentationPath),
+                 "%s, %s, present queue depth %.2f", swapEffect, scaling, (float)total / samples);
+    }
+
+    // Keep the last measurement if nothing was presented since
+    return m_PresentationPath[0] != 0 ? m_PresentationPath : swapEffect;
+}
+
 void DXVA2Renderer::notifyOverlayUpdated(Overlay::OverlayType type)
+{
+    // This may be called on any thread, so we just flag the overlay for
+    // upload by the render thread, which owns all drawing on the device.
+    int pendingUpdates;
+    do {
+        pendingUpdates = SDL_AtomicGet(&m_PendingOverlayUpdates);
+    } while (!SDL_AtomicCAS(&m_PendingOverlayUpdates, pendingUpdates, pendingUpdates | (1 << type)));
+}
+
+bool DXVA2Renderer::usesOverlaySurfaces()
+{
+    return true;
+}
+
+void DXVA2Renderer::updateOverlayTexture(Overlay::OverlayType type)
 {
     HRESULT hr;
 
-    switch (type)
-    {
-    case Overlay::OverlayDebug:
-        if (m_DebugOverlayFont == nullptr) {
-            hr = D3DXCreateFontA(m_Device,
-                                 Session::get()->getOverlayManager().getOverlayFontSize(Overlay::OverlayDebug),
-                                 0,
-                                 FW_HEAVY,
-                                 1,
-                                 false,
-                                 ANSI_CHARSET,
-                                 OUT_DEFAULT_PRECIS,
-                                 DEFAULT_QUALITY,
-                                 DEFAULT_PITCH | FF_DONTCARE,
-                                 "",
-                                 &m_DebugOverlayFont);
-            if (FAILED(hr)) {
-                SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                             "D3DXCreateFontA() failed: %x",
-                             hr);
-                m_DebugOverlayFont = nullptr;
-            }
+    SDL_Surface* surface = Session::get()->getOverlayManager().getUpdatedOverlaySurface(type);
+
+    if (!Session::get()->getOverlayManager().isOverlayEnabled(type)) {
+        // Hide the overlay but keep the texture around for next time
+        m_OverlayRects[type].w = m_OverlayRects[type].h = 0;
+        if (surface != nullptr) {
+            SDL_FreeSurface(surface);
         }
-        break;
+        return;
+    }
+    else if (surface == nullptr) {
+        // Nothing new to upload
+        return;
+    }
+
+    // Reuse the existing texture if the new overlay fits inside it
+    if (m_OverlayTextures[type] != nullptr) {
+        D3DSURFACE_DESC desc;
+
+        m_OverlayTextures[type]->GetLevelDesc(0, &desc);
+        if ((int)desc.Width < surface->w || (int)desc.Height < surface->h) {
+            m_OverlayTextures[type]->Release();
+            m_OverlayTextures[type] = nullptr;
+        }
+    }
+
+    if (m_OverlayTextures[type] == nullptr) {
+        hr = m_Device->CreateTexture(surface->w, surface->h, 1,
+                                     D3DUSAGE_DYNAMIC, D3DFMT_A8R8G8B8, D3DPOOL_DEFAULT,
+                                     &m_OverlayTextures[type], nullptr);
+        if (FAILED(hr)) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "CreateTexture() failed: %x",
+                         hr);
+            m_OverlayTextures[type] = nullptr;
+            m_OverlayRects[type].w = m_OverlayRects[type].h = 0;
+            SDL_FreeSurface(surface);
+            return;
+        }
+    }
 
-    case Overlay::OverlayStatusUpdate:
-        if (m_StatusOverlayFont == nullptr) {
-            hr = D3DXCreateFontA(m_Device,
-                                 Session::get()->getOverlayManager().getOverlayFontSize(Overlay::OverlayStatusUpdate),
-                                 0,
-                                 FW_HEAVY,
-                                 1,
-                                 false,
-                                 ANSI_CHARSET,
-                                 OUT_DEFAULT_PRECIS,
-                                 DEFAULT_QUALITY,
-                                 DEFAULT_PITCH | FF_DONTCARE,
-                                 "",
-                                 &m_StatusOverlayFont);
+    D3DLOCKED_RECT lockedRect;
+    hr = m_OverlayTextures[type]->LockRect(0, &lockedRect, nullptr, D3DLOCK_DISCARD);
+    if (FAILED(hr)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "LockRect() failed: %x",
+                     hr);
+        m_OverlayRects[type].w = m_OverlayRects[type].h = 0;
+        SDL_FreeSurface(surface);
+        return;
+    }
+
+    // The overlay surface is premultiplied ARGB8888, which is D3DFMT_A8R8G8B8 in memory
+    for (int y = 0; y < surface->h; y++) {
+        memcpy((Uint8*)lockedRect.pBits + (y * lockedRect.Pitch),
+               (Uint8*)surface->pixels + (y * surface->pitch),
+               surface->w * 4);
+    }
+
+    m_OverlayTextures[type]->UnlockRect(0);
+
+    m_OverlayRects[type].w = surface->w;
+    m_OverlayRects[type].h = surface->h;
+    SDL_FreeSurface(surface);
+}
+
+void DXVA2Renderer::renderOverlays(const RECT& videoRect)
+{
+    HRESULT hr;
+
+    // Upload any overlays updated by notifyOverlayUpdated() since the last frame
+    int pendingUpdates = SDL_AtomicSet(&m_PendingOverlayUpdates, 0);
+    for (int i = 0; i < Overlay::OverlayMax; i++) {
+        if (pendingUpdates & (1 << i)) {
+            updateOverlayTexture((Overlay::OverlayType)i);
+        }
+    }
+
+    // Debug at the top left and status at the bottom left of the video
+    m_OverlayRects[Overlay::OverlayDebug].x = videoRect.left;
+    m_OverlayRects[Overlay::OverlayDebug].y = videoRect.top;
+    m_OverlayRects[Overlay::OverlayStatusUpdate].x = videoRect.left;
+    m_OverlayRects[Overlay::OverlayStatusUpdate].y = videoRect.bottom - m_OverlayRects[Overlay::OverlayStatusUpdate].h;
+
+    bool spriteStarted = false;
+    for (int i = 0; i < Overlay::OverlayMax; i++) {
+        if (m_OverlayTextures[i] == nullptr || m_OverlayRects[i].w == 0) {
+            continue;
+        }
+
+        if (!spriteStarted) {
+            if (m_OverlaySprite == nullptr) {
+                hr = D3DXCreateSprite(m_Device, &m_OverlaySprite);
+                if (FAILED(hr)) {
+                    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                                 "D3DXCreateSprite() failed: %x",
+                                 hr);
+                    m_OverlaySprite = nullptr;
+                    return;
+                }
+            }
+
+            hr = m_OverlaySprite->Begin(D3DXSPRITE_ALPHABLEND);
             if (FAILED(hr)) {
                 SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                             "D3DXCreateFontA() failed: %x",
+                             "ID3DXSprite::Begin() failed: %x",
                              hr);
-                m_StatusOverlayFont = nullptr;
+                return;
             }
+
+            // The overlay surfaces have premultiplied alpha. This overrides the
+            // straight alpha blending set by Begin() until the sprite is flushed.
+            m_Device->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_ONE);
+            spriteStarted = true;
         }
-        break;
 
-    default:
-        SDL_assert(false);
-        break;
+        RECT srcRect = { 0, 0, m_OverlayRects[i].w, m_OverlayRects[i].h };
+        D3DXVECTOR3 position((float)m_OverlayRects[i].x, (float)m_OverlayRects[i].y, 0.0f);
+        m_OverlaySprite->Draw(m_OverlayTextures[i], &srcRect, nullptr, &position, D3DCOLOR_ARGB(255, 255, 255, 255));
+    }
+
+    if (spriteStarted) {
+        m_OverlaySprite->End();
     }
 }
 
@@ -898,15 +1238,22 @@ void DXVA2Renderer::renderFrame(AVFrame *frame)
 
     bltParams.Alpha = DXVA2_Fixed32OpaqueAlpha();
 
-    hr = m_Device->Clear(0, nullptr, D3DCLEAR_TARGET, D3DCOLOR_ARGB(255, 0, 0, 0), 0.0f, 0);
-    if (FAILED(hr)) {
-        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                     "Clear() failed: %x",
-                     hr);
-        SDL_Event event;
-        event.type = SDL_RENDER_TARGETS_RESET;
-        SDL_PushEvent(&event);
-        return;
+    // At 1:1 the blit is a plain color conversion with no scaling
+    SDL_AtomicSet(&m_Unscaled, dst.w == m_VideoWidth && dst.h == m_VideoHeight);
+
+    // The letterbox is the only part of the back buffer that the blit
+    // doesn't write, so there's nothing to clear when the video fills it
+    if (dst.w != m_DisplayWidth || dst.h != m_DisplayHeight) {
+        hr = m_Device->Clear(0, nullptr, D3DCLEAR_TARGET, D3DCOLOR_ARGB(255, 0, 0, 0), 0.0f, 0);
+        if (FAILED(hr)) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "Clear() failed: %x",
+                         hr);
+            SDL_Event event;
+            event.type = SDL_RENDER_TARGETS_RESET;
+            SDL_PushEvent(&event);
+            return;
+        }
     }
 
     hr = m_Device->BeginScene();
@@ -945,29 +1292,7 @@ void DXVA2Renderer::renderFrame(AVFrame *frame)
         }
     }
 
-    if (m_DebugOverlayFont != nullptr) {
-        if (Session::get()->getOverlayManager().isOverlayEnabled(Overlay::OverlayDebug)) {
-            SDL_Color color = Session::get()->getOverlayManager().getOverlayColor(Overlay::OverlayDebug);
-            m_DebugOverlayFont->DrawTextA(nullptr,
-                                          Session::get()->getOverlayManager().getOverlayText(Overlay::OverlayDebug),
-                                          -1,
-                                          &sample.DstRect,
-                                          DT_LEFT | DT_NOCLIP,
-                                          D3DCOLOR_ARGB(color.a, color.r, color.g, color.b));
-        }
-    }
-
-    if (m_StatusOverlayFont != nullptr) {
-        if (Session::get()->getOverlayManager().isOverlayEnabled(Overlay::OverlayStatusUpdate)) {
-            SDL_Color color = Session::get()->getOverlayManager().getOverlayColor(Overlay::OverlayStatusUpdate);
-            m_StatusOverlayFont->DrawTextA(nullptr,
-                                           Session::get()->getOverlayManager().getOverlayText(Overlay::OverlayStatusUpdate),
-                                           -1,
-                                           &sample.DstRect,
-                                           DT_RIGHT | DT_NOCLIP,
-                                           D3DCOLOR_ARGB(color.a, color.r, color.g, color.b));
-        }
-    }
+    renderOverlays(sample.DstRect);
 
     hr = m_Device->EndScene();
     if (FAILED(hr)) {
@@ -997,4 +1322,16 @@ void DXVA2Renderer::renderFrame(AVFrame *frame)
         SDL_PushEvent(&event);
         return;
     }
+
+    if (m_PresentQueries[0] != nullptr) {
+        // The depth includes this present
+        SDL_AtomicAdd(&m_PresentQueueDepthTotal, countPendingPresents() + 1);
+        SDL_AtomicAdd(&m_PresentQueueDepthSamples, 1);
+
+        if (m_PendingPresents < PRESENT_QUERY_COUNT) {
+            m_PresentQueries[m_PresentQueryIndex]->Issue(D3DISSUE_END);
+            m_PresentQueryIndex = (m_PresentQueryIndex + 1) % PRESENT_QUERY_COUNT;
+            m_PendingPresents++;
+        }
+    }
 }
@@ -20,13 +20,25 @@ public:
     virtual bool prepareDecoderContext(AVCodecContext* context) override;
     virtual void renderFrame(AVFrame* frame) override;
     virtual void notifyOverlayUpdated(Overlay::OverlayType) override;
+    virtual bool usesOverlaySurfaces() override;
+    virtual int getDecoderCapabilities() override;
+    virtual bool isRenderThreadSupported() override;
+    virtual void waitToRender() override;
+    virtual const char* getPresentationPath() override;
+    virtual bool reinitializePresentation(PDECODER_PARAMETERS params) override;
 
 private:
     bool initializeDecoder();
     bool initializeRenderer();
-    bool initializeDevice(SDL_Window* window, bool enableVsync);
+    bool initializeDevice(SDL_Window* window, bool enableVsync, bool enableVrr);
+    void getPresentParameters(IDirect3D9Ex* d3d9ex, int adapterIndex,
+                              SDL_Window* window, bool enableVsync, bool enableVrr,
+                              D3DPRESENT_PARAMETERS& d3dpp, D3DDISPLAYMODEEX& currentMode);
     bool isDecoderBlacklisted();
     bool isDXVideoProcessorAPIBlacklisted();
+    void updateOverlayTexture(Overlay::OverlayType type);
+    void renderOverlays(const RECT& videoRect);
+    int countPendingPresents();
 
     static
     AVBufferRef* ffPoolAlloc(void* opaque, int size);
@@ -62,7 +74,23 @@ private:
     DXVA2_ValueRange m_SaturationRange;
     DXVA2_VideoDesc m_Desc;
     REFERENCE_TIME m_FrameIndex;
-    LPD3DXFONT m_DebugOverlayFont;
-    LPD3DXFONT m_StatusOverlayFont;
+    LPD3DXSPRITE m_OverlaySprite;
+    IDirect3DTexture9* m_OverlayTextures[Overlay::OverlayMax];
+    SDL_Rect m_OverlayRects[Overlay::OverlayMax];
+    SDL_atomic_t m_PendingOverlayUpdates;
     bool m_BlockingPresent;
+    bool m_FlipEx;
+
+    // An event query is issued after each present, so the queries that
+    // haven't signaled yet are the presents the GPU is still working on.
+#define PRESENT_QUERY_COUNT 4
+    IDirect3DQuery9* m_PresentQueries[PRESENT_QUERY_COUNT];
+    int m_PresentQueryIndex;
+    int m_PendingPresents;
+    SDL_atomic_t m_PresentQueueDepthTotal;
+    SDL_atomic_t m_PresentQueueDepthSamples;
+    SDL_atomic_t m_Unscaled;
+    char m_PresentationPath[128];
+    LUID m_AdapterLuid;
+    bool m_Windowed;
 };
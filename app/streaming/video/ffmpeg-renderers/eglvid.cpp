@@ -0,0 +1,1021 @@
+#include "eglvid.h"
+
+#include "streaming/session.h"
+#include "streaming/streamutils.h"
+#include "streaming/video/framegraph.h"
+
+extern "C" {
+#include <libavutil/hwcontext.h>
+#include <libavutil/mastering_display_metadata.h>
+}
+
+// Luminance of SDR reference white in nits (ITU-R BT.2408)
+#define SDR_WHITE_NITS 203.0f
+
+// Assumed peak luminance of HDR content without any metadata
+#define DEFAULT_PEAK_NITS 1000.0f
+
+// Strength of the sharpening filter from 0 (subtle) to 1 (strongest)
+#define SHARPEN_STRENGTH 0.5f
+
+static const char k_VertexShader[] =
+    "attribute vec2 aPosition;\n"
+    "attribute vec2 aTexCoord;\n"
+    "varying vec2 vTexCoord;\n"
+    "void main() {\n"
+    "    gl_Position = vec4(aPosition, 0.0, 1.0);\n"
+    "    vTexCoord = aTexCoord;\n"
+    "}\n";
+
+// Samples the separate Y (R8/R16) and interleaved UV (GR88/GR1616) layers
+static const char k_VideoFragmentShader[] =
+    "precision mediump float;\n"
+    "uniform sampler2D uPlaneY;\n"
+    "uniform sampler2D uPlaneUV;\n"
+    "uniform mat3 uYuvMatrix;\n"
+    "uniform vec3 uYuvOffset;\n"
+    "varying vec2 vTexCoord;\n"
+    "void main() {\n"
+    "    vec3 yuv = vec3(texture2D(uPlaneY, vTexCoord).r, texture2D(uPlaneUV, vTexCoord).rg);\n"
+    "    gl_FragColor = vec4(uYuvMatrix * (yuv - uYuvOffset), 1.0);\n"
+    "}\n";
+
+// Samples frames that the backend already converted to RGB
+static const char k_RgbFragmentShader[] =
+    "precision mediump float;\n"
+    "uniform sampler2D uTexture;\n"
+    "varying vec2 vTexCoord;\n"
+    "void main() {\n"
+    "    gl_FragColor = vec4(texture2D(uTexture, vTexCoord).rgb, 1.0);\n"
+    "}\n";
+
+// Contrast-adaptive sharpening of the luma plane as the frame is upscaled.
+// Each pixel is sharpened with its four neighbours in the source, backing
+// off where there's already a lot of local contrast to avoid ringing.
+// Chroma is left alone since it's subsampled anyway.
+static const char k_SharpenFragmentShader[] =
+    "precision mediump float;\n"
+    "uniform sampler2D uPlaneY;\n"
+    "uniform sampler2D uPlaneUV;\n"
+    "uniform mat3 uYuvMatrix;\n"
+    "uniform vec3 uYuvOffset;\n"
+    "uniform vec2 uTexelSize;\n"
+    "uniform float uSharpenPeak;\n"
+    "varying vec2 vTexCoord;\n"
+    "void main() {\n"
+    "    float c = texture2D(uPlaneY, vTexCoord).r;\n"
+    "    float n = texture2D(uPlaneY, vTexCoord - vec2(0.0, uTexelSize.y)).r;\n"
+    "    float s = texture2D(uPlaneY, vTexCoord + vec2(0.0, uTexelSize.y)).r;\n"
+    "    float w = texture2D(uPlaneY, vTexCoord - vec2(uTexelSize.x, 0.0)).r;\n"
+    "    float e = texture2D(uPlaneY, vTexCoord + vec2(uTexelSize.x, 0.0)).r;\n"
+    "    float mn = min(c, min(min(n, s), min(w, e)));\n"
+    "    float mx = max(c, max(max(n, s), max(w, e)));\n"
+    "    float amp = sqrt(clamp(min(mn, 1.0 - mx) / max(mx, 1.0 / 255.0), 0.0, 1.0));\n"
+    "    float weight = amp * uSharpenPeak;\n"
+    "    float y = (c + (n + s + w + e) * weight) / (1.0 + 4.0 * weight);\n"
+    "    vec3 yuv = vec3(clamp(y, 0.0, 1.0), texture2D(uPlaneUV, vTexCoord).rg);\n"
+    "    gl_FragColor = vec4(uYuvMatrix * (yuv - uYuvOffset), 1.0);\n"
+    "}\n";
+
+// Decodes PQ (SMPTE ST 2084) BT.2020 content and tone maps it for an SDR
+// display, with SDR_WHITE_NITS as 1.0 and uPeakLuminance relative to it.
+// PQ needs more precision than mediump reliably has.
+static const char k_ToneMapFragmentShader[] =
+    "#ifdef GL_FRAGMENT_PRECISION_HIGH\n"
+    "precision highp float;\n"
+    "#else\n"
+    "precision mediump float;\n"
+    "#endif\n"
+    "uniform sampler2D uPlaneY;\n"
+    "uniform sampler2D uPlaneUV;\n"
+    "uniform mat3 uYuvMatrix;\n"
+    "uniform vec3 uYuvOffset;\n"
+    "uniform float uPeakLuminance;\n"
+    "varying vec2 vTexCoord;\n"
+    "const mat3 kBt2020ToBt709 = mat3(1.6605, -0.1246, -0.0182,\n"
+    "                                 -0.5876, 1.1329, -0.1006,\n"
+    "                                 -0.0728, -0.0083, 1.1187);\n"
+    "vec3 pqToLinear(vec3 e) {\n"
+    "    vec3 p = pow(e, vec3(1.0 / 78.84375));\n"
+    "    return pow(max(p - 0.8359375, 0.0) / (18.8515625 - 18.6875 * p), vec3(1.0 / 0.1593017578125));\n"
+    "}\n"
+    "void main() {\n"
+    "    vec3 yuv = vec3(texture2D(uPlaneY, vTexCoord).r, texture2D(uPlaneUV, vTexCoord).rg);\n"
+    "    vec3 pq = clamp(uYuvMatrix * (yuv - uYuvOffset), 0.0, 1.0);\n"
+    "    vec3 rgb = max(kBt2020ToBt709 * pqToLinear(pq) * (10000.0 / 203.0), 0.0);\n"
+    "    float m = max(max(rgb.r, rgb.g), rgb.b);\n"
+    "    if (m > 0.0) {\n"
+    "        rgb *= (1.0 + m / (uPeakLuminance * uPeakLuminance)) / (1.0 + m);\n"
+    "    }\n"
+    "    gl_FragColor = vec4(pow(clamp(rgb, 0.0, 1.0), vec3(1.0 / 2.2)), 1.0);\n"
+    "}\n";
+
+// Overlay surfaces are ARGB8888, which is BGRA in memory
+static const char k_OverlayFragmentShader[] =
+    "precision mediump float;\n"
+    "uniform sampler2D uTexture;\n"
+    "varying vec2 vTexCoord;\n"
+    "void main() {\n"
+    "    gl_FragColor = texture2D(uTexture, vTexCoord).bgra;\n"
+    "}\n";
+
+// The frame graph is drawn in solid (premultiplied) colors
+static const char k_GraphVertexShader[] =
+    "attribute vec2 aPosition;\n"
+    "void main() {\n"
+    "    gl_Position = vec4(aPosition, 0.0, 1.0);\n"
+    "}\n";
+
+static const char k_GraphFragmentShader[] =
+    "precision mediump float;\n"
+    "uniform vec4 uColor;\n"
+    "void main() {\n"
+    "    gl_FragColor = uColor;\n"
+    "}\n";
+
+// Column-major YUV to RGB matrices for limited and full range content
+static const GLfloat k_Bt601Limited[9] = {
+    1.1644f, 1.1644f, 1.1644f,
+    0.0f, -0.3918f, 2.0172f,
+    1.5960f, -0.8130f, 0.0f
+};
+static const GLfloat k_Bt601Full[9] = {
+    1.0f, 1.0f, 1.0f,
+    0.0f, -0.3441f, 1.7720f,
+    1.4020f, -0.7141f, 0.0f
+};
+static const GLfloat k_Bt709Limited[9] = {
+    1.1644f, 1.1644f, 1.1644f,
+    0.0f, -0.2132f, 2.1124f,
+    1.7927f, -0.5329f, 0.0f
+};
+static const GLfloat k_Bt709Full[9] = {
+    1.0f, 1.0f, 1.0f,
+    0.0f, -0.1873f, 1.8556f,
+    1.5748f, -0.4681f, 0.0f
+};
+static const GLfloat k_Bt2020Limited[9] = {
+    1.1644f, 1.1644f, 1.1644f,
+    0.0f, -0.1873f, 2.1418f,
+    1.6787f, -0.6504f, 0.0f
+};
+static const GLfloat k_Bt2020Full[9] = {
+    1.0f, 1.0f, 1.0f,
+    0.0f, -0.1646f, 1.8814f,
+    1.4746f, -0.5714f, 0.0f
+};
+static const GLfloat k_LimitedOffsets[3] = { 16.0f / 255.0f, 128.0f / 255.0f, 128.0f / 255.0f };
+static const GLfloat k_FullOffsets[3] = { 0.0f, 128.0f / 255.0f, 128.0f / 255.0f };
+
+// P010 keeps its 10 bits in the top of each 16-bit sample
+static const GLfloat k_Limited10Offsets[3] = { 64.0f * 64 / 65535, 512.0f * 64 / 65535, 512.0f * 64 / 65535 };
+static const GLfloat k_Full10Offsets[3] = { 0.0f, 512.0f * 64 / 65535, 512.0f * 64 / 65535 };
+
+// A quad covering the viewport as a triangle strip, with the
+// first row of the texture at the top of the viewport
+static const GLfloat k_QuadPositions[8] = {
+    -1.0f, -1.0f,
+    1.0f, -1.0f,
+    -1.0f, 1.0f,
+    1.0f, 1.0f
+};
+static const GLfloat k_QuadTexCoords[8] = {
+    0.0f, 1.0f,
+    1.0f, 1.0f,
+    0.0f, 0.0f,
+    1.0f, 0.0f
+};
+
+EGLRenderer::EGLRenderer(IFFmpegRenderer* backendRenderer)
+    : m_BackendRenderer(backendRenderer),
+      m_Window(nullptr),
+      m_Context(nullptr),
+      m_EGLDisplay(EGL_NO_DISPLAY),
+      m_GLEGLImageTargetTexture2DOES(nullptr),
+      m_CopyToPlaneTextures(false),
+      m_MapBackendTexture(false),
+      m_VideoProgram(0),
+      m_RgbProgram(0),
+      m_ToneMapProgram(0),
+      m_LastColorspace(-1),
+      m_LastColorRange(-1),
+      m_LastPeakLuminance(0.0f),
+      m_SharpenProgram(0),
+      m_SharpenRequested(false),
+      m_GLGenQueriesEXT(nullptr),
+      m_GLDeleteQueriesEXT(nullptr),
+      m_GLBeginQueryEXT(nullptr),
+      m_GLEndQueryEXT(nullptr),
+      m_GLGetQueryObjectuivEXT(nullptr),
+      m_GLGetQueryObjectui64vEXT(nullptr),
+      m_TimerQueryIndex(0),
+      m_OverlayProgram(0),
+      m_GraphProgram(0),
+      m_GraphVertexBuffer(0)
+{
+    SDL_zero(m_PresentationPath);
+    SDL_AtomicSet(&m_Unscaled, 0);
+    SDL_zero(m_PlaneTextures);
+    SDL_zero(m_TimerQueries);
+    SDL_zero(m_TimerQueryIssued);
+    SDL_zero(m_OverlayTextures);
+    SDL_zero(m_OverlayWidths);
+    SDL_zero(m_OverlayHeights);
+    SDL_AtomicSet(&m_PendingOverlayUpdates, 0);
+}
+
+EGLRenderer::~EGLRenderer()
+{
+    if (m_Context != nullptr) {
+        // We may be destroyed on a different thread than we rendered on
+        SDL_GL_MakeCurrent(m_Window, m_Context);
+
+        if (m_CopyToPlaneTextures) {
+            m_BackendRenderer->unregisterGLTextures();
+        }
+        else if (m_MapBackendTexture) {
+            m_BackendRenderer->releaseGLTextures();
+        }
+
+        if (m_VideoProgram != 0) {
+            glDeleteProgram(m_VideoProgram);
+        }
+        if (m_RgbProgram != 0) {
+            glDeleteProgram(m_RgbProgram);
+        }
+        if (m_ToneMapProgram != 0) {
+            glDeleteProgram(m_ToneMapProgram);
+        }
+        if (m_SharpenProgram != 0) {
+            glDeleteProgram(m_SharpenProgram);
+        }
+        if (m_TimerQueries[0] != 0) {
+            m_GLDeleteQueriesEXT(TIMER_QUERY_COUNT, m_TimerQueries);
+        }
+        if (m_OverlayProgram != 0) {
+            glDeleteProgram(m_OverlayProgram);
+        }
+        if (m_GraphProgram != 0) {
+            glDeleteProgram(m_GraphProgram);
+        }
+        if (m_GraphVertexBuffer != 0) {
+            glDeleteBuffers(1, &m_GraphVertexBuffer);
+        }
+        glDeleteTextures(SDL_arraysize(m_PlaneTextures), m_PlaneTextures);
+        glDeleteTextures(Overlay::OverlayMax, m_OverlayTextures);
+
+        SDL_GL_MakeCurrent(m_Window, nullptr);
+        SDL_GL_DeleteContext(m_Context);
+    }
+}
+
+bool EGLRenderer::prepareDecoderContext(AVCodecContext*)
+{
+    // We're only ever a frontend renderer
+    SDL_assert(false);
+    return false;
+}
+
+bool EGLRenderer::isRenderThreadSupported()
+{
+    // Our GL context must stay current on a single thread, which is the
+    // main thread on most platforms that SDL's own GL renderer supports.
+    return false;
+}
+
+void EGLRenderer::notifyOverlayUpdated(Overlay::OverlayType type)
+{
+    // This may be called on any thread, so we just flag the overlay
+    // for upload by the thread that owns our GL context.
+    int pendingUpdates;
+    do {
+        pendingUpdates = SDL_AtomicGet(&m_PendingOverlayUpdates);
+    } while (!SDL_AtomicCAS(&m_PendingOverlayUpdates, pendingUpdates, pendingUpdates | (1 << type)));
+}
+
+bool EGLRenderer::usesOverlaySurfaces()
+{
+    return true;
+}
+
+bool EGLRenderer::notifyWindowResized(PDECODER_PARAMETERS)
+{
+    // We query the drawable size for each frame
+    return true;
+}
+
+const char* EGLRenderer::getUpscalerStats(int* averageCostUs, int* budgetUs)
+{
+    *averageCostUs = m_UpscaleCost.getAverageCostUs();
+    *budgetUs = m_UpscaleCost.getBudgetUs();
+
+    switch (m_UpscaleCost.getState()) {
+    case UpscaleCostTracker::US_ACTIVE:
+        return "Contrast-adaptive sharpening";
+    case UpscaleCostTracker::US_OVER_BUDGET:
+        return "Contrast-adaptive sharpening (disabled, over budget)";
+    default:
+        return nullptr;
+    }
+}
+
+const char* EGLRenderer::getPresentationPath()
+{
+    const char* import;
+    if (m_CopyToPlaneTextures) {
+        import = "GL texture copy";
+    }
+    else if (m_MapBackendTexture) {
+        import = "GL texture interop";
+    }
+    else {
+        import = "EGLImage import";
+    }
+
+    snprintf(m_PresentationPath, sizeof(m_PresentationPath), "EGL %s, %s",
+             import, SDL_AtomicGet(&m_Unscaled) ? "unscaled" : "scaled");
+    return m_PresentationPath;
+}
+
+bool EGLRenderer::initialize(PDECODER_PARAMETERS params)
+{
+    m_Window = params->window;
+
+    // Prefer zero-copy import if the backend supports both
+    m_CopyToPlaneTextures = !m_BackendRenderer->canExportEGL() && m_BackendRenderer->canCopyToGLTextures();
+    m_MapBackendTexture = !m_BackendRenderer->canExportEGL() && !m_CopyToPlaneTextures &&
+            m_BackendRenderer->canMapGLTexture();
+    if (!m_BackendRenderer->canExportEGL() && !m_CopyToPlaneTextures && !m_MapBackendTexture) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Backend renderer cannot export EGLImages or copy to GL textures");
+        return false;
+    }
+
+    if (!(SDL_GetWindowFlags(m_Window) & SDL_WINDOW_OPENGL)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "EGL renderer requires an OpenGL window");
+        return false;
+    }
+
+    m_Context = SDL_GL_CreateContext(m_Window);
+    if (m_Context == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "SDL_GL_CreateContext() failed: %s",
+                     SDL_GetError());
+        return false;
+    }
+
+    // This is EGL_NO_DISPLAY if SDL used GLX instead of EGL
+    m_EGLDisplay = eglGetCurrentDisplay();
+    if (m_EGLDisplay == EGL_NO_DISPLAY) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "SDL did not create an EGL context");
+        return false;
+    }
+
+    const char* glExtensions = (const char*)glGetString(GL_EXTENSIONS);
+    if (m_CopyToPlaneTextures) {
+        // The plane textures need one and two component formats
+        if (glExtensions == nullptr || strstr(glExtensions, "GL_EXT_texture_rg") == nullptr) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "GL_EXT_texture_rg is not supported");
+            return false;
+        }
+    }
+    else if (!m_MapBackendTexture) {
+        if (glExtensions == nullptr || strstr(glExtensions, "GL_OES_EGL_image") == nullptr) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "GL_OES_EGL_image is not supported");
+            return false;
+        }
+
+        m_GLEGLImageTargetTexture2DOES =
+                (PFNGLEGLIMAGETARGETTEXTURE2DOESPROC)eglGetProcAddress("glEGLImageTargetTexture2DOES");
+        if (m_GLEGLImageTargetTexture2DOES == nullptr) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "glEGLImageTargetTexture2DOES() is missing");
+            return false;
+        }
+    }
+
+    if (!initializeGL()) {
+        return false;
+    }
+
+    if (m_CopyToPlaneTextures && !initializePlaneTextureCopy(params->width, params->height)) {
+        return false;
+    }
+
+    if (m_MapBackendTexture) {
+        m_RgbProgram = linkProgram(k_VertexShader, k_RgbFragmentShader);
+        if (m_RgbProgram == 0) {
+            return false;
+        }
+
+        glUseProgram(m_RgbProgram);
+        glUniform1i(glGetUniformLocation(m_RgbProgram, "uTexture"), 0);
+    }
+
+    // The sharpening and tone mapping passes work on YUV planes
+    if (params->enableSharpening && !m_MapBackendTexture) {
+        initializeSharpening(glExtensions, params->frameRate);
+    }
+
+    // Like SdlRenderer, we only ask for V-sync from the swap interval
+    // in full-screen, since desktop compositors are tear-free already.
+    if ((SDL_GetWindowFlags(m_Window) & SDL_WINDOW_FULLSCREEN_DESKTOP) == SDL_WINDOW_FULLSCREEN) {
+        SDL_GL_SetSwapInterval(params->enableVsync ? 1 : 0);
+    }
+    else {
+        SDL_GL_SetSwapInterval(0);
+    }
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Using EGL renderer: %s",
+                glGetString(GL_RENDERER));
+
+    // Draw a black frame until the video stream starts rendering
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    SDL_GL_SwapWindow(m_Window);
+
+    // Release the context so the rendering thread can make it current
+    SDL_GL_MakeCurrent(m_Window, nullptr);
+    return true;
+}
+
+GLuint EGLRenderer::compileShader(GLenum type, const char* source)
+{
+    GLuint shader = glCreateShader(type);
+    GLint status;
+
+    glShaderSource(shader, 1, &source, nullptr);
+    glCompileShader(shader);
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if (!status) {
+        char log[512];
+
+        glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Shader compilation failed: %s",
+                     log);
+        glDeleteShader(shader);
+        return 0;
+    }
+
+    return shader;
+}
+
+GLuint EGLRenderer::linkProgram(const char* vertexSource, const char* fragmentSource)
+{
+    GLuint vertexShader = compileShader(GL_VERTEX_SHADER, vertexSource);
+    GLuint fragmentShader = compileShader(GL_FRAGMENT_SHADER, fragmentSource);
+    GLuint program = 0;
+    GLint status;
+
+    if (vertexShader == 0 || fragmentShader == 0) {
+        goto Exit;
+    }
+
+    program = glCreateProgram();
+    glAttachShader(program, vertexShader);
+    glAttachShader(program, fragmentShader);
+
+    // Fix the attribute locations so the video programs can be swapped
+    // without looking them up again
+    glBindAttribLocation(program, 0, "aPosition");
+    glBindAttribLocation(program, 1, "aTexCoord");
+    glLinkProgram(program);
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if (!status) {
+        char log[512];
+
+        glGetProgramInfoLog(program, sizeof(log), nullptr, log);
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Shader program link failed: %s",
+                     log);
+        glDeleteProgram(program);
+        program = 0;
+    }
+
+Exit:
+    // The program keeps the shaders alive as long as it needs them
+    if (vertexShader != 0) {
+        glDeleteShader(vertexShader);
+    }
+    if (fragmentShader != 0) {
+        glDeleteShader(fragmentShader);
+    }
+    return program;
+}
+
+bool EGLRenderer::initializeGL()
+{
+    m_VideoProgram = linkProgram(k_VertexShader, k_VideoFragmentShader);
+    m_OverlayProgram = linkProgram(k_VertexShader, k_OverlayFragmentShader);
+    if (m_VideoProgram == 0 || m_OverlayProgram == 0) {
+        return false;
+    }
+
+    m_VideoPositionAttrib = glGetAttribLocation(m_VideoProgram, "aPosition");
+    m_VideoTexCoordAttrib = glGetAttribLocation(m_VideoProgram, "aTexCoord");
+    m_YuvMatrixUniform = glGetUniformLocation(m_VideoProgram, "uYuvMatrix");
+    m_YuvOffsetUniform = glGetUniformLocation(m_VideoProgram, "uYuvOffset");
+
+    glUseProgram(m_VideoProgram);
+    glUniform1i(glGetUniformLocation(m_VideoProgram, "uPlaneY"), 0);
+    glUniform1i(glGetUniformLocation(m_VideoProgram, "uPlaneUV"), 1);
+
+    // We can still show HDR content with the wrong transfer function,
+    // so failing to build the tone mapping program isn't fatal.
+    m_ToneMapProgram = linkProgram(k_VertexShader, k_ToneMapFragmentShader);
+    if (m_ToneMapProgram != 0) {
+        m_ToneMapYuvMatrixUniform = glGetUniformLocation(m_ToneMapProgram, "uYuvMatrix");
+        m_ToneMapYuvOffsetUniform = glGetUniformLocation(m_ToneMapProgram, "uYuvOffset");
+        m_PeakLuminanceUniform = glGetUniformLocation(m_ToneMapProgram, "uPeakLuminance");
+
+        glUseProgram(m_ToneMapProgram);
+        glUniform1i(glGetUniformLocation(m_ToneMapProgram, "uPlaneY"), 0);
+        glUniform1i(glGetUniformLocation(m_ToneMapProgram, "uPlaneUV"), 1);
+    }
+    else {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "HDR tone mapping is unavailable");
+    }
+
+    m_OverlayPositionAttrib = glGetAttribLocation(m_OverlayProgram, "aPosition");
+    m_OverlayTexCoordAttrib = glGetAttribLocation(m_OverlayProgram, "aTexCoord");
+
+    glUseProgram(m_OverlayProgram);
+    glUniform1i(glGetUniformLocation(m_OverlayProgram, "uTexture"), 0);
+
+    // The stream works without the frame graph too
+    m_GraphProgram = linkProgram(k_GraphVertexShader, k_GraphFragmentShader);
+    if (m_GraphProgram != 0) {
+        m_GraphPositionAttrib = glGetAttribLocation(m_GraphProgram, "aPosition");
+        m_GraphColorUniform = glGetUniformLocation(m_GraphProgram, "uColor");
+
+        glGenBuffers(1, &m_GraphVertexBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, m_GraphVertexBuffer);
+        glBufferData(GL_ARRAY_BUFFER, (8 + FRAME_GRAPH_VERTEX_FLOATS) * sizeof(GLfloat), nullptr, GL_STREAM_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    else {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Frame graph is unavailable");
+    }
+
+    // Non-power-of-2 textures in GLES 2.0 need clamping and no mipmaps
+    glGenTextures(SDL_arraysize(m_PlaneTextures), m_PlaneTextures);
+    glGenTextures(Overlay::OverlayMax, m_OverlayTextures);
+    for (GLuint texture : m_PlaneTextures) {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+    for (GLuint texture : m_OverlayTextures) {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+
+    // The overlay surfaces have premultiplied alpha
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+    return glGetError() == GL_NO_ERROR;
+}
+
+void EGLRenderer::initializeSharpening(const char* glExtensions, int frameRate)
+{
+    // Sharpening is optional, so we just stream without it on failure
+    m_SharpenProgram = linkProgram(k_VertexShader, k_SharpenFragmentShader);
+    if (m_SharpenProgram == 0) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Video sharpening is unavailable");
+        return;
+    }
+
+    m_SharpenYuvMatrixUniform = glGetUniformLocation(m_SharpenProgram, "uYuvMatrix");
+    m_SharpenYuvOffsetUniform = glGetUniformLocation(m_SharpenProgram, "uYuvOffset");
+    m_TexelSizeUniform = glGetUniformLocation(m_SharpenProgram, "uTexelSize");
+
+    glUseProgram(m_SharpenProgram);
+    glUniform1i(glGetUniformLocation(m_SharpenProgram, "uPlaneY"), 0);
+    glUniform1i(glGetUniformLocation(m_SharpenProgram, "uPlaneUV"), 1);
+    glUniform1f(glGetUniformLocation(m_SharpenProgram, "uSharpenPeak"),
+                -1.0f / (8.0f - 3.0f * SHARPEN_STRENGTH));
+
+    m_SharpenRequested = true;
+    m_UpscaleCost.initialize(frameRate);
+
+    // Without timer queries, we can't enforce the budget, but the
+    // filter is cheap enough that we run it anyway.
+    if (glExtensions == nullptr || strstr(glExtensions, "GL_EXT_disjoint_timer_query") == nullptr) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "GL_EXT_disjoint_timer_query is not supported; sharpening cost won't be measured");
+        return;
+    }
+
+    m_GLGenQueriesEXT = (PFNGLGENQUERIESEXTPROC)eglGetProcAddress("glGenQueriesEXT");
+    m_GLDeleteQueriesEXT = (PFNGLDELETEQUERIESEXTPROC)eglGetProcAddress("glDeleteQueriesEXT");
+    m_GLBeginQueryEXT = (PFNGLBEGINQUERYEXTPROC)eglGetProcAddress("glBeginQueryEXT");
+    m_GLEndQueryEXT = (PFNGLENDQUERYEXTPROC)eglGetProcAddress("glEndQueryEXT");
+    m_GLGetQueryObjectuivEXT = (PFNGLGETQUERYOBJECTUIVEXTPROC)eglGetProcAddress("glGetQueryObjectuivEXT");
+    m_GLGetQueryObjectui64vEXT = (PFNGLGETQUERYOBJECTUI64VEXTPROC)eglGetProcAddress("glGetQueryObjectui64vEXT");
+    if (m_GLGenQueriesEXT == nullptr || m_GLDeleteQueriesEXT == nullptr ||
+            m_GLBeginQueryEXT == nullptr || m_GLEndQueryEXT == nullptr ||
+            m_GLGetQueryObjectuivEXT == nullptr || m_GLGetQueryObjectui64vEXT == nullptr) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "GL_EXT_disjoint_timer_query functions are missing");
+        return;
+    }
+
+    m_GLGenQueriesEXT(TIMER_QUERY_COUNT, m_TimerQueries);
+}
+
+void EGLRenderer::beginUpscaleTiming()
+{
+    if (m_TimerQueries[0] == 0) {
+        return;
+    }
+
+    // Collect the result of the query we issued TIMER_QUERY_COUNT frames
+    // ago before reusing it. If the GPU hasn't finished with it yet, that
+    // sample is dropped rather than stalling for it.
+    GLuint query = m_TimerQueries[m_TimerQueryIndex];
+    if (m_TimerQueryIssued[m_TimerQueryIndex]) {
+        GLuint available = 0;
+        GLint disjoint = 0;
+
+        m_GLGetQueryObjectuivEXT(query, GL_QUERY_RESULT_AVAILABLE_EXT, &available);
+        glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+        if (available && !disjoint) {
+            GLuint64 elapsedNs;
+
+            m_GLGetQueryObjectui64vEXT(query, GL_QUERY_RESULT_EXT, &elapsedNs);
+            m_UpscaleCost.addSample(elapsedNs / 1000);
+        }
+        m_TimerQueryIssued[m_TimerQueryIndex] = false;
+    }
+
+    m_GLBeginQueryEXT(GL_TIME_ELAPSED_EXT, query);
+}
+
+void EGLRenderer::endUpscaleTiming()
+{
+    if (m_TimerQueries[0] == 0) {
+        return;
+    }
+
+    m_GLEndQueryEXT(GL_TIME_ELAPSED_EXT);
+    m_TimerQueryIssued[m_TimerQueryIndex] = true;
+    m_TimerQueryIndex = (m_TimerQueryIndex + 1) % TIMER_QUERY_COUNT;
+}
+
+bool EGLRenderer::initializePlaneTextureCopy(int width, int height)
+{
+    // Allocate storage for the NV12 planes once, since the
+    // backend registers the textures themselves for copying.
+    glBindTexture(GL_TEXTURE_2D, m_PlaneTextures[0]);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RED_EXT, width, height, 0,
+                 GL_RED_EXT, GL_UNSIGNED_BYTE, nullptr);
+    glBindTexture(GL_TEXTURE_2D, m_PlaneTextures[1]);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG_EXT, width / 2, height / 2, 0,
+                 GL_RG_EXT, GL_UNSIGNED_BYTE, nullptr);
+
+    if (glGetError() != GL_NO_ERROR) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Failed to allocate plane textures");
+        return false;
+    }
+
+    // The textures must not be reallocated while registered
+    if (!m_BackendRenderer->registerGLTextures(m_PlaneTextures)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Backend renderer failed to register plane textures");
+        return false;
+    }
+
+    return true;
+}
+
+void EGLRenderer::updateYuvConversion(AVFrame* frame)
+{
+    if (frame->colorspace == m_LastColorspace && frame->color_range == m_LastColorRange) {
+        return;
+    }
+
+    bool fullRange = frame->color_range == AVCOL_RANGE_JPEG;
+    bool tenBit = frame->hw_frames_ctx != nullptr &&
+            ((AVHWFramesContext*)frame->hw_frames_ctx->data)->sw_format == AV_PIX_FMT_P010;
+    const GLfloat* matrix;
+    const GLfloat* offsets;
+
+    switch (frame->colorspace) {
+    case AVCOL_SPC_BT709:
+        matrix = fullRange ? k_Bt709Full : k_Bt709Limited;
+        break;
+    case AVCOL_SPC_BT2020_NCL:
+        matrix = fullRange ? k_Bt2020Full : k_Bt2020Limited;
+        break;
+    default:
+        // The host sends BT.601 unless it says otherwise
+        matrix = fullRange ? k_Bt601Full : k_Bt601Limited;
+        break;
+    }
+
+    if (tenBit) {
+        offsets = fullRange ? k_Full10Offsets : k_Limited10Offsets;
+    }
+    else {
+        offsets = fullRange ? k_FullOffsets : k_LimitedOffsets;
+    }
+
+    glUseProgram(m_VideoProgram);
+    glUniformMatrix3fv(m_YuvMatrixUniform, 1, GL_FALSE, matrix);
+    glUniform3fv(m_YuvOffsetUniform, 1, offsets);
+
+    if (m_ToneMapProgram != 0) {
+        glUseProgram(m_ToneMapProgram);
+        glUniformMatrix3fv(m_ToneMapYuvMatrixUniform, 1, GL_FALSE, matrix);
+        glUniform3fv(m_ToneMapYuvOffsetUniform, 1, offsets);
+    }
+
+    if (m_SharpenProgram != 0) {
+        glUseProgram(m_SharpenProgram);
+        glUniformMatrix3fv(m_SharpenYuvMatrixUniform, 1, GL_FALSE, matrix);
+        glUniform3fv(m_SharpenYuvOffsetUniform, 1, offsets);
+    }
+
+    m_LastColorspace = frame->colorspace;
+    m_LastColorRange = frame->color_range;
+}
+
+void EGLRenderer::updatePeakLuminance(AVFrame* frame)
+{
+    float peakNits = DEFAULT_PEAK_NITS;
+
+    // Prefer the brightest pixel of the content over the mastering
+    // display's capability, since the content rarely reaches it.
+    AVFrameSideData* sideData = av_frame_get_side_data(frame, AV_FRAME_DATA_CONTENT_LIGHT_LEVEL);
+    if (sideData != nullptr && ((AVContentLightMetadata*)sideData->data)->MaxCLL != 0) {
+        peakNits = ((AVContentLightMetadata*)sideData->data)->MaxCLL;
+    }
+    else {
+        sideData = av_frame_get_side_data(frame, AV_FRAME_DATA_MASTERING_DISPLAY_METADATA);
+        if (sideData != nullptr && ((AVMasteringDisplayMetadata*)sideData->data)->has_luminance) {
+            peakNits = av_q2d(((AVMasteringDisplayMetadata*)sideData->data)->max_luminance);
+        }
+        else if (m_LastPeakLuminance != 0.0f) {
+            // Metadata usually only comes with IDR frames
+            return;
+        }
+    }
+
+    // The shader works relative to SDR white and can't expand the range
+    float peakLuminance = SDL_max(peakNits, SDR_WHITE_NITS) / SDR_WHITE_NITS;
+    if (peakLuminance != m_LastPeakLuminance) {
+        glUseProgram(m_ToneMapProgram);
+        glUniform1f(m_PeakLuminanceUniform, peakLuminance);
+        m_LastPeakLuminance = peakLuminance;
+    }
+}
+
+void EGLRenderer::updateOverlayTexture(Overlay::OverlayType type)
+{
+    SDL_Surface* surface = Session::get()->getOverlayManager().getUpdatedOverlaySurface(type);
+
+    if (!Session::get()->getOverlayManager().isOverlayEnabled(type)) {
+        m_OverlayWidths[type] = m_OverlayHeights[type] = 0;
+        if (surface != nullptr) {
+            SDL_FreeSurface(surface);
+        }
+        return;
+    }
+    else if (surface == nullptr) {
+        // Nothing new to upload
+        return;
+    }
+
+    // GLES 2.0 can't upload with a row length, but 32 bpp surfaces are tightly packed
+    SDL_assert(surface->pitch == surface->w * 4);
+
+    glBindTexture(GL_TEXTURE_2D, m_OverlayTextures[type]);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, surface->w, surface->h, 0,
+                 GL_RGBA, GL_UNSIGNED_BYTE, surface->pixels);
+
+    m_OverlayWidths[type] = surface->w;
+    m_OverlayHeights[type] = surface->h;
+    SDL_FreeSurface(surface);
+}
+
+void EGLRenderer::renderOverlay(Overlay::OverlayType type, int drawableWidth, int drawableHeight, const SDL_Rect& videoRect)
+{
+    if (m_OverlayWidths[type] == 0) {
+        return;
+    }
+
+    // Debug at the top left and status at the bottom left of the video
+    int x = videoRect.x;
+    int y = type == Overlay::OverlayStatusUpdate ?
+                videoRect.y + videoRect.h - m_OverlayHeights[type] : videoRect.y;
+
+    GLfloat left = 2.0f * x / drawableWidth - 1.0f;
+    GLfloat right = 2.0f * (x + m_OverlayWidths[type]) / drawableWidth - 1.0f;
+    GLfloat top = 1.0f - 2.0f * y / drawableHeight;
+    GLfloat bottom = 1.0f - 2.0f * (y + m_OverlayHeights[type]) / drawableHeight;
+    GLfloat positions[8] = {
+        left, bottom,
+        right, bottom,
+        left, top,
+        right, top
+    };
+
+    glBindTexture(GL_TEXTURE_2D, m_OverlayTextures[type]);
+    glVertexAttribPointer(m_OverlayPositionAttrib, 2, GL_FLOAT, GL_FALSE, 0, positions);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
+
+void EGLRenderer::renderFrameGraph(int drawableWidth, int drawableHeight, const SDL_Rect& videoRect)
+{
+    SDL_Rect graphRect = FrameGraph::getGraphRect(videoRect);
+
+    // The background quad comes first, then each series in turn
+    GLfloat left = 2.0f * graphRect.x / drawableWidth - 1.0f;
+    GLfloat right = 2.0f * (graphRect.x + graphRect.w) / drawableWidth - 1.0f;
+    GLfloat top = 1.0f - 2.0f * graphRect.y / drawableHeight;
+    GLfloat bottom = 1.0f - 2.0f * (graphRect.y + graphRect.h) / drawableHeight;
+    GLfloat vertices[8 + FRAME_GRAPH_VERTEX_FLOATS] = {
+        left, bottom,
+        right, bottom,
+        left, top,
+        right, top
+    };
+    FrameGraph::getVertices(&vertices[8], left, bottom, right - left, top - bottom);
+
+    glBindBuffer(GL_ARRAY_BUFFER, m_GraphVertexBuffer);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), vertices);
+
+    glUseProgram(m_GraphProgram);
+    glVertexAttribPointer(m_GraphPositionAttrib, 2, GL_FLOAT, GL_FALSE, 0, nullptr);
+    glEnableVertexAttribArray(m_GraphPositionAttrib);
+
+    glUniform4f(m_GraphColorUniform, 0.0f, 0.0f, 0.0f, 0.5f);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+    for (int series = 0; series < FrameGraph::FGS_MAX; series++) {
+        const SDL_Color& color = FrameGraph::k_SeriesColors[series];
+
+        glUniform4f(m_GraphColorUniform, color.r / 255.0f, color.g / 255.0f, color.b / 255.0f, 1.0f);
+        glDrawArrays(GL_LINE_STRIP, 4 + series * FRAME_GRAPH_FRAMES, FRAME_GRAPH_FRAMES);
+    }
+
+    // Everything else draws from client memory
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void EGLRenderer::renderFrame(AVFrame* frame)
+{
+    EGLImageKHR images[EGL_MAX_PLANES];
+
+    if (SDL_GL_GetCurrentContext() != m_Context) {
+        SDL_GL_MakeCurrent(m_Window, m_Context);
+    }
+
+    if (m_CopyToPlaneTextures) {
+        // The backend copies the planes into our textures on the GPU
+        if (!m_BackendRenderer->copyToGLTextures(frame)) {
+            return;
+        }
+
+        for (int i = 0; i < 2; i++) {
+            glActiveTexture(GL_TEXTURE0 + i);
+            glBindTexture(GL_TEXTURE_2D, m_PlaneTextures[i]);
+        }
+    }
+    else if (m_MapBackendTexture) {
+        // The backend binds its own texture with the converted frame
+        glActiveTexture(GL_TEXTURE0);
+        if (!m_BackendRenderer->mapGLTexture(frame)) {
+            return;
+        }
+    }
+    else {
+        ssize_t planeCount = m_BackendRenderer->exportEGLImages(frame, m_EGLDisplay, images);
+        if (planeCount < 0) {
+            return;
+        }
+        else if (planeCount != 2) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "Unexpected plane count for EGL export: %d",
+                         (int)planeCount);
+            m_BackendRenderer->freeEGLImages(m_EGLDisplay, images);
+            return;
+        }
+
+        // Bind the DMA-BUFs directly as textures without any copies
+        for (int i = 0; i < planeCount; i++) {
+            glActiveTexture(GL_TEXTURE0 + i);
+            glBindTexture(GL_TEXTURE_2D, m_PlaneTextures[i]);
+            m_GLEGLImageTargetTexture2DOES(GL_TEXTURE_2D, images[i]);
+        }
+    }
+    glActiveTexture(GL_TEXTURE0);
+
+    if (!m_MapBackendTexture) {
+        updateYuvConversion(frame);
+    }
+
+    // We only have an SDR surface, so PQ content must be tone mapped
+    bool toneMap = frame->color_trc == AVCOL_TRC_SMPTE2084 && m_ToneMapProgram != 0 && !m_MapBackendTexture;
+    if (toneMap) {
+        updatePeakLuminance(frame);
+    }
+
+    int drawableWidth, drawableHeight;
+    SDL_GL_GetDrawableSize(m_Window, &drawableWidth, &drawableHeight);
+
+    glViewport(0, 0, drawableWidth, drawableHeight);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    // Center in frame and preserve aspect ratio
+    SDL_Rect src, dst;
+    src.x = src.y = 0;
+    src.w = frame->width;
+    src.h = frame->height;
+    dst.x = dst.y = 0;
+    dst.w = drawableWidth;
+    dst.h = drawableHeight;
+
+    StreamUtils::scaleSourceToDestinationSurface(&src, &dst);
+    SDL_AtomicSet(&m_Unscaled, dst.w == frame->width && dst.h == frame->height);
+
+    // GL viewports are measured from the bottom left
+    glViewport(dst.x, drawableHeight - dst.y - dst.h, dst.w, dst.h);
+
+    // Sharpening only helps when we're scaling the video up. Tone mapping
+    // takes priority, since HDR content is rarely sub-native anyway.
+    bool sharpen = m_SharpenRequested && !m_UpscaleCost.isOverBudget() && !toneMap &&
+            (dst.w > frame->width || dst.h > frame->height);
+
+    if (sharpen) {
+        glUseProgram(m_SharpenProgram);
+        glUniform2f(m_TexelSizeUniform, 1.0f / frame->width, 1.0f / frame->height);
+        beginUpscaleTiming();
+    }
+    else if (m_MapBackendTexture) {
+        glUseProgram(m_RgbProgram);
+    }
+    else {
+        glUseProgram(toneMap ? m_ToneMapProgram : m_VideoProgram);
+    }
+    glVertexAttribPointer(m_VideoPositionAttrib, 2, GL_FLOAT, GL_FALSE, 0, k_QuadPositions);
+    glVertexAttribPointer(m_VideoTexCoordAttrib, 2, GL_FLOAT, GL_FALSE, 0, k_QuadTexCoords);
+    glEnableVertexAttribArray(m_VideoPositionAttrib);
+    glEnableVertexAttribArray(m_VideoTexCoordAttrib);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+    if (m_MapBackendTexture) {
+        m_BackendRenderer->unmapGLTexture();
+    }
+
+    if (sharpen) {
+        endUpscaleTiming();
+    }
+    m_UpscaleCost.setActive(sharpen);
+
+    // Upload any overlays updated by notifyOverlayUpdated() since the last frame
+    int pendingUpdates = SDL_AtomicSet(&m_PendingOverlayUpdates, 0);
+    for (int i = 0; i < Overlay::OverlayMax; i++) {
+        if (pendingUpdates & (1 << i)) {
+            updateOverlayTexture((Overlay::OverlayType)i);
+        }
+    }
+
+    glViewport(0, 0, drawableWidth, drawableHeight);
+    glEnable(GL_BLEND);
+    glUseProgram(m_OverlayProgram);
+    glVertexAttribPointer(m_OverlayTexCoordAttrib, 2, GL_FLOAT, GL_FALSE, 0, k_QuadTexCoords);
+    glEnableVertexAttribArray(m_OverlayPositionAttrib);
+    glEnableVertexAttribArray(m_OverlayTexCoordAttrib);
+    for (int i = 0; i < Overlay::OverlayMax; i++) {
+        renderOverlay((Overlay::OverlayType)i, drawableWidth, drawableHeight, dst);
+    }
+    if (m_GraphProgram != 0 && Session::get()->getOverlayManager().isOverlayEnabled(Overlay::OverlayFrameGraph)) {
+        // The graph's program doesn't read the texture coordinates
+        glDisableVertexAttribArray(m_OverlayTexCoordAttrib);
+        renderFrameGraph(drawableWidth, drawableHeight, dst);
+    }
+    glDisable(GL_BLEND);
+
+    SDL_GL_SwapWindow(m_Window);
+
+    // The GL driver holds its own references to the buffers until it's done with them
+    if (!m_CopyToPlaneTextures && !m_MapBackendTexture) {
+        m_BackendRenderer->freeEGLImages(m_EGLDisplay, images);
+    }
+}
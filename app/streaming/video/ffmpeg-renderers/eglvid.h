@@ -0,0 +1,108 @@
+#pragma once
+
+#include "renderer.h"
+#include "upscalecost.h"
+
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+
+class EGLRenderer : public IFFmpegRenderer {
+public:
+    EGLRenderer(IFFmpegRenderer* backendRenderer);
+    virtual ~EGLRenderer() override;
+    virtual bool initialize(PDECODER_PARAMETERS params) override;
+    virtual bool prepareDecoderContext(AVCodecContext* context) override;
+    virtual void renderFrame(AVFrame* frame) override;
+    virtual bool isRenderThreadSupported() override;
+    virtual void notifyOverlayUpdated(Overlay::OverlayType type) override;
+    virtual bool usesOverlaySurfaces() override;
+    virtual bool notifyWindowResized(PDECODER_PARAMETERS params) override;
+    virtual const char* getUpscalerStats(int* averageCostUs, int* budgetUs) override;
+    virtual const char* getPresentationPath() override;
+
+private:
+    GLuint compileShader(GLenum type, const char* source);
+    GLuint linkProgram(const char* vertexSource, const char* fragmentSource);
+    bool initializeGL();
+    bool initializePlaneTextureCopy(int width, int height);
+    void initializeSharpening(const char* glExtensions, int frameRate);
+    void beginUpscaleTiming();
+    void endUpscaleTiming();
+    void updateYuvConversion(AVFrame* frame);
+    void updatePeakLuminance(AVFrame* frame);
+    void updateOverlayTexture(Overlay::OverlayType type);
+    void renderOverlay(Overlay::OverlayType type, int drawableWidth, int drawableHeight, const SDL_Rect& videoRect);
+    void renderFrameGraph(int drawableWidth, int drawableHeight, const SDL_Rect& videoRect);
+
+    IFFmpegRenderer* m_BackendRenderer;
+    SDL_Window* m_Window;
+    SDL_GLContext m_Context;
+    EGLDisplay m_EGLDisplay;
+    PFNGLEGLIMAGETARGETTEXTURE2DOESPROC m_GLEGLImageTargetTexture2DOES;
+
+    // Whether the backend copies frames into our plane textures
+    // instead of exporting them as EGLImages
+    bool m_CopyToPlaneTextures;
+
+    // Whether the backend maps frames that are already RGB as its own
+    // texture, which is drawn with m_RgbProgram instead
+    bool m_MapBackendTexture;
+    SDL_atomic_t m_Unscaled;
+    char m_PresentationPath[64];
+
+    GLuint m_VideoProgram;
+    GLint m_VideoPositionAttrib;
+    GLint m_VideoTexCoordAttrib;
+    GLint m_YuvMatrixUniform;
+    GLint m_YuvOffsetUniform;
+    GLuint m_PlaneTextures[2];
+
+    // Shares the attribute locations of m_VideoProgram
+    GLuint m_RgbProgram;
+    int m_LastColorspace;
+    int m_LastColorRange;
+
+    // Shares the attribute locations of m_VideoProgram
+    GLuint m_ToneMapProgram;
+    GLint m_ToneMapYuvMatrixUniform;
+    GLint m_ToneMapYuvOffsetUniform;
+    GLint m_PeakLuminanceUniform;
+    float m_LastPeakLuminance;
+
+    // Also shares the attribute locations of m_VideoProgram. It's only
+    // built if sharpening was requested, and only used when upscaling.
+    GLuint m_SharpenProgram;
+    GLint m_SharpenYuvMatrixUniform;
+    GLint m_SharpenYuvOffsetUniform;
+    GLint m_TexelSizeUniform;
+    bool m_SharpenRequested;
+
+    // The sharpening pass is timed on the GPU with a small ring of queries,
+    // so reading back a result never waits for the GPU to catch up.
+    PFNGLGENQUERIESEXTPROC m_GLGenQueriesEXT;
+    PFNGLDELETEQUERIESEXTPROC m_GLDeleteQueriesEXT;
+    PFNGLBEGINQUERYEXTPROC m_GLBeginQueryEXT;
+    PFNGLENDQUERYEXTPROC m_GLEndQueryEXT;
+    PFNGLGETQUERYOBJECTUIVEXTPROC m_GLGetQueryObjectuivEXT;
+    PFNGLGETQUERYOBJECTUI64VEXTPROC m_GLGetQueryObjectui64vEXT;
+#define TIMER_QUERY_COUNT 4
+    GLuint m_TimerQueries[TIMER_QUERY_COUNT];
+    bool m_TimerQueryIssued[TIMER_QUERY_COUNT];
+    int m_TimerQueryIndex;
+    UpscaleCostTracker m_UpscaleCost;
+
+    GLuint m_OverlayProgram;
+    GLint m_OverlayPositionAttrib;
+    GLint m_OverlayTexCoordAttrib;
+    GLuint m_OverlayTextures[Overlay::OverlayMax];
+    int m_OverlayWidths[Overlay::OverlayMax];
+    int m_OverlayHeights[Overlay::OverlayMax];
+    SDL_atomic_t m_PendingOverlayUpdates;
+
+    // The frame graph's background quad and line strips share a vertex
+    // buffer that's refilled for each frame
+    GLuint m_GraphProgram;
+    GLint m_GraphPositionAttrib;
+    GLint m_GraphColorUniform;
+    GLuint m_GraphVertexBuffer;
+};
@@ -0,0 +1,195 @@
+#include "main10converter.h"
+#include "streaming/cpudispatch.h"
+#include "streaming/threadplacement.h"
+
+#include <QtGlobal>
+
+// Beyond this, the conversion is limited by memory bandwidth rather
+// than by the cores doing it
+#define CONVERSION_MAX_THREADS 4
+
+Main10Converter::Main10Converter()
+    : m_PlaneCount(0),
+      m_Shift(0),
+      m_WorkerCount(0),
+      m_StripeCount(1),
+      m_WorkersStarted(false),
+      m_DoneSemaphore(nullptr)
+{
+    SDL_zero(m_Planes);
+    SDL_zero(m_Workers);
+    SDL_AtomicSet(&m_Stopping, 0);
+}
+
+Main10Converter::~Main10Converter()
+{
+    stopWorkers();
+}
+
+enum AVPixelFormat Main10Converter::get8BitFormat(int format)
+{
+    switch (format) {
+    case AV_PIX_FMT_P010:
+        return AV_PIX_FMT_NV12;
+    case AV_PIX_FMT_YUV420P10:
+        return AV_PIX_FMT_YUV420P;
+    default:
+        return AV_PIX_FMT_NONE;
+    }
+}
+
+bool Main10Converter::startWorkers()
+{
+    int stripes = qMin(SDL_GetCPUCount(), CONVERSION_MAX_THREADS);
+    if (stripes < 2) {
+        return true;
+    }
+
+    m_DoneSemaphore = SDL_CreateSemaphore(0);
+    if (m_DoneSemaphore == nullptr) {
+        return false;
+    }
+
+    SDL_AtomicSet(&m_Stopping, 0);
+    for (int i = 0; i < stripes - 1; i++) {
+        Worker* worker = &m_Workers[m_WorkerCount++];
+        worker->parent = this;
+
+        // The render thread converts the first stripe itself
+        worker->stripe = i + 1;
+
+        worker->startSemaphore = SDL_CreateSemaphore(0);
+        if (worker->startSemaphore == nullptr) {
+            return false;
+        }
+
+        worker->thread = SDL_CreateThread(Main10Converter::workerThreadProc, "Main10Convert", worker);
+        if (worker->thread == nullptr) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "Unable to create 10-bit conversion thread: %s",
+                         SDL_GetError());
+            return false;
+        }
+    }
+
+    m_StripeCount = stripes;
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Converting 10-bit frames to 8 bits on %d threads",
+                m_StripeCount);
+    return true;
+}
+
+void Main10Converter::stopWorkers()
+{
+    SDL_AtomicSet(&m_Stopping, 1);
+    for (int i = 0; i < m_WorkerCount; i++) {
+        if (m_Workers[i].thread != nullptr) {
+            SDL_SemPost(m_Workers[i].startSemaphore);
+            SDL_WaitThread(m_Workers[i].thread, nullptr);
+        }
+        if (m_Workers[i].startSemaphore != nullptr) {
+            SDL_DestroySemaphore(m_Workers[i].startSemaphore);
+        }
+    }
+    SDL_zero(m_Workers);
+    m_WorkerCount = 0;
+    m_StripeCount = 1;
+
+    if (m_DoneSemaphore != nullptr) {
+        SDL_DestroySemaphore(m_DoneSemaphore);
+        m_DoneSemaphore = nullptr;
+    }
+}
+
+bool Main10Converter::convert(const AVFrame* frame, Uint8* const dstData[3], const int dstPitches[3])
+{
+    int chromaWidth = (frame->width + 1) / 2;
+    int chromaHeight = (frame->height + 1) / 2;
+
+    switch (frame->format) {
+    case AV_PIX_FMT_P010:
+        // The 10 bits are the high bits of each sample, and the chroma
+        // plane holds interleaved U and V samples
+        m_Shift = 8;
+        m_PlaneCount = 2;
+        m_Planes[0].samples = frame->width;
+        m_Planes[0].height = frame->height;
+        m_Planes[1].samples = chromaWidth * 2;
+        m_Planes[1].height = chromaHeight;
+        break;
+    case AV_PIX_FMT_YUV420P10:
+        m_Shift = 2;
+        m_PlaneCount = 3;
+        m_Planes[0].samples = frame->width;
+        m_Planes[0].height = frame->height;
+        m_Planes[1].samples = m_Planes[2].samples = chromaWidth;
+        m_Planes[1].height = m_Planes[2].height = chromaHeight;
+        break;
+    default:
+        SDL_assert(false);
+        return false;
+    }
+
+    for (int i = 0; i < m_PlaneCount; i++) {
+        m_Planes[i].dst = dstData[i];
+        m_Planes[i].dstPitch = dstPitches[i];
+        m_Planes[i].src = (const Uint16*)frame->data[i];
+        m_Planes[i].srcPitch = frame->linesize[i];
+    }
+
+    // Without the workers, this still converts on the render thread
+    if (!m_WorkersStarted) {
+        m_WorkersStarted = true;
+        if (!startWorkers()) {
+            stopWorkers();
+        }
+    }
+
+    for (int i = 0; i < m_WorkerCount; i++) {
+        SDL_SemPost(m_Workers[i].startSemaphore);
+    }
+
+    convertStripe(0);
+
+    for (int i = 0; i < m_WorkerCount; i++) {
+        SDL_SemWait(m_DoneSemaphore);
+    }
+
+    return true;
+}
+
+void Main10Converter::convertStripe(int stripe)
+{
+    for (int i = 0; i < m_PlaneCount; i++) {
+        const Plane& plane = m_Planes[i];
+        int firstRow = plane.height * stripe / m_StripeCount;
+        int endRow = plane.height * (stripe + 1) / m_StripeCount;
+
+        CpuDispatch::convertTo8Bit(plane.dst + (size_t)firstRow * plane.dstPitch, plane.dstPitch,
+                                   (const Uint16*)((const Uint8*)plane.src + (size_t)firstRow * plane.srcPitch),
+                                   plane.srcPitch,
+                                   plane.samples, endRow - firstRow,
+                                   m_Shift, firstRow);
+    }
+}
+
+int Main10Converter::workerThreadProc(void* context)
+{
+    auto worker = reinterpret_cast<Worker*>(context);
+    auto me = worker->parent;
+
+    ThreadPlacement::applyToCurrentThread(ThreadPlacement::TR_RENDER);
+
+    for (;;) {
+        SDL_SemWait(worker->startSemaphore);
+        if (SDL_AtomicGet(&me->m_Stopping)) {
+            break;
+        }
+
+        me->convertStripe(worker->stripe);
+        SDL_SemPost(me->m_DoneSemaphore);
+    }
+
+    return 0;
+}
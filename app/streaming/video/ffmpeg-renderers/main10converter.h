@@ -0,0 +1,69 @@
+#pragma once
+
+#include <SDL.h>
+
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+// Converts 10-bit frames to 8 bits for renderers without 10-bit textures,
+// using CpuDispatch's dithering kernel. A 4K frame is more than one core
+// can convert in a frame interval on slower CPUs, so the planes are split
+// into stripes of rows that the render thread and a few workers convert
+// at once. The workers are only started by the first 10-bit frame.
+//
+// Only the bit depth changes. HDR frames keep their PQ transfer and
+// BT.2020 primaries, so they look washed out on an SDR display.
+class Main10Converter
+{
+public:
+    Main10Converter();
+    ~Main10Converter();
+
+    // Returns the 8-bit format that frames of this format convert to,
+    // or AV_PIX_FMT_NONE if they can't be converted
+    static enum AVPixelFormat get8BitFormat(int format);
+
+    // Converts a software frame into the planes of an 8-bit frame of
+    // the format returned by get8BitFormat()
+    bool convert(const AVFrame* frame, Uint8* const dstData[3], const int dstPitches[3]);
+
+private:
+    struct Worker {
+        Main10Converter* parent;
+        SDL_Thread* thread;
+        SDL_sem* startSemaphore;
+        int stripe;
+    };
+
+    struct Plane {
+        Uint8* dst;
+        int dstPitch;
+        const Uint16* src;
+        int srcPitch;
+        int samples;
+        int height;
+    };
+
+    bool startWorkers();
+
+    void stopWorkers();
+
+    void convertStripe(int stripe);
+
+    static
+    int workerThreadProc(void* context);
+
+    // The frame being converted, read by the workers once their start
+    // semaphore is posted
+    Plane m_Planes[3];
+    int m_PlaneCount;
+    int m_Shift;
+
+    Worker m_Workers[3];
+    int m_WorkerCount;
+    int m_StripeCount;
+    bool m_WorkersStarted;
+    SDL_sem* m_DoneSemaphore;
+    SDL_atomic_t m_Stopping;
+};
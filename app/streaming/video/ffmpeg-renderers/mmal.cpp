@@ -69,43 +69,66 @@ bool MmalRenderer::initialize(PDECODER_PARAMETERS params)
         return false;
     }
 
-    {
-        MMAL_DISPLAYREGION_T dr;
+    if (!setDisplayRegion(params)) {
+        return false;
+    }
 
-        dr.hdr.id = MMAL_PARAMETER_DISPLAYREGION;
-        dr.hdr.size = sizeof(MMAL_DISPLAYREGION_T);
+    status = mmal_port_enable(m_InputPort, InputPortCallback);
+    if (status != MMAL_SUCCESS) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "mmal_port_enable() failed: %x (%s)",
+                     status, mmal_status_to_string(status));
+        return false;
+    }
 
-        dr.set = MMAL_DISPLAY_SET_LAYER;
-        dr.layer = 128;
+    return true;
+}
+
+bool MmalRenderer::notifyWindowResized(PDECODER_PARAMETERS params)
+{
+    // The display region can be updated on the fly, so there's
+    // no need to rebuild anything for a resize.
+    return setDisplayRegion(params);
+}
+
+bool MmalRenderer::setDisplayRegion(PDECODER_PARAMETERS params)
+{
+    MMAL_DISPLAYREGION_T dr = {};
+    MMAL_STATUS_T status;
 
-        dr.set |= MMAL_DISPLAY_SET_ALPHA;
-        dr.alpha = 255;
+    dr.hdr.id = MMAL_PARAMETER_DISPLAYREGION;
+    dr.hdr.size = sizeof(MMAL_DISPLAYREGION_T);
 
-        dr.set |= MMAL_DISPLAY_SET_FULLSCREEN;
-        dr.fullscreen = (SDL_GetWindowFlags(params->window) & SDL_WINDOW_FULLSCREEN) != 0;
+    dr.set = MMAL_DISPLAY_SET_LAYER;
+    dr.layer = 128;
 
-        {
-            SDL_Rect src, dst;
-            src.x = src.y = 0;
-            src.w = params->width;
-            src.h = params->height;
-            dst.x = dst.y = 0;
-            SDL_GetWindowSize(params->window, &dst.w, &dst.h);
+    dr.set |= MMAL_DISPLAY_SET_ALPHA;
+    dr.alpha = 255;
 
-            StreamUtils::scaleSourceToDestinationSurface(&src, &dst);
+    dr.set |= MMAL_DISPLAY_SET_FULLSCREEN;
+    dr.fullscreen = (SDL_GetWindowFlags(params->window) & SDL_WINDOW_FULLSCREEN) != 0;
 
-            dr.set |= MMAL_DISPLAY_SET_DEST_RECT;
-            dr.dest_rect.x = dst.x;
-            dr.dest_rect.y = dst.y;
-            dr.dest_rect.width = dst.w;
-            dr.dest_rect.height = dst.h;
-        }
+    {
+        SDL_Rect src, dst;
+        src.x = src.y = 0;
+        src.w = params->width;
+        src.h = params->height;
+        dst.x = dst.y = 0;
+        SDL_GetWindowSize(params->window, &dst.w, &dst.h);
+
+        StreamUtils::scaleSourceToDestinationSurface(&src, &dst);
+
+        dr.set |= MMAL_DISPLAY_SET_DEST_RECT;
+        dr.dest_rect.x = dst.x;
+        dr.dest_rect.y = dst.y;
+        dr.dest_rect.width = dst.w;
+        dr.dest_rect.height = dst.h;
     }
 
-    status = mmal_port_enable(m_InputPort, InputPortCallback);
+    status = mmal_port_parameter_set(m_InputPort, &dr.hdr);
     if (status != MMAL_SUCCESS) {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                     "mmal_port_enable() failed: %x (%s)",
+                     "mmal_port_parameter_set() failed: %x (%s)",
                      status, mmal_status_to_string(status));
         return false;
     }
@@ -144,7 +167,7 @@ void MmalRenderer::renderFrame(AVFrame* frame)
                      status, mmal_status_to_string(status));
     }
     else {
-        // Prevent the buffer from being freed during av_frame_free()
+        // Prevent the buffer from being freed when the frame is released
         // until rendering is complete. The reference is dropped in
         // InputPortCallback().
         mmal_buffer_header_acquire(buffer);
@@ -16,8 +16,10 @@ public:
     virtual void renderFrame(AVFrame* frame) override;
     virtual enum AVPixelFormat getPreferredPixelFormat(int videoFormat) override;
     virtual bool needsTestFrame() override;
+    virtual bool notifyWindowResized(PDECODER_PARAMETERS params) override;
 
 private:
+    bool setDisplayRegion(PDECODER_PARAMETERS params);
     static void InputPortCallback(MMAL_PORT_T* port, MMAL_BUFFER_HEADER_T* buffer);
 
     MMAL_COMPONENT_T* m_Renderer;
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "pacer.h"
+
+#include <CoreVideo/CoreVideo.h>
+
+class DisplayLinkVsyncSource : public IVsyncSource
+{
+public:
+    DisplayLinkVsyncSource(Pacer* pacer);
+
+    virtual ~DisplayLinkVsyncSource();
+
+    virtual bool initialize(SDL_Window* window, int displayFps);
+
+    virtual int getDisplayFps();
+
+private:
+    static
+    CVReturn
+    displayLinkOutputCallback(
+        CVDisplayLinkRef displayLink,
+        const CVTimeStamp* now,
+        const CVTimeStamp* vsyncTime,
+        CVOptionFlags,
+        CVOptionFlags*,
+        void* displayLinkContext);
+
+    Pacer* m_Pacer;
+    CVDisplayLinkRef m_DisplayLink;
+    int m_DisplayFps;
+    Uint64 m_HostTimeNumer;
+    Uint64 m_HostTimeDenom;
+};
@@ -0,0 +1,139 @@
+#include "displaylinkvsyncsource.h"
+#include "streaming/streamutils.h"
+
+#include <SDL_syswm.h>
+
+#include <mach/mach_time.h>
+#import <Cocoa/Cocoa.h>
+
+DisplayLinkVsyncSource::DisplayLinkVsyncSource(Pacer* pacer) :
+    m_Pacer(pacer),
+    m_DisplayLink(nullptr),
+    m_DisplayFps(0)
+{
+    mach_timebase_info_data_t timebase;
+
+    mach_timebase_info(&timebase);
+
+    // Host time to microseconds
+    m_HostTimeNumer = timebase.numer;
+    m_HostTimeDenom = (Uint64)timebase.denom * 1000;
+}
+
+DisplayLinkVsyncSource::~DisplayLinkVsyncSource()
+{
+    if (m_DisplayLink != nullptr) {
+        // This waits for any running output callback to return
+        CVDisplayLinkStop(m_DisplayLink);
+        CVDisplayLinkRelease(m_DisplayLink);
+    }
+}
+
+CVReturn
+DisplayLinkVsyncSource::displayLinkOutputCallback(
+    CVDisplayLinkRef displayLink,
+    const CVTimeStamp* now,
+    const CVTimeStamp* /* vsyncTime */,
+    CVOptionFlags,
+    CVOptionFlags*,
+    void* displayLinkContext)
+{
+    auto me = reinterpret_cast<DisplayLinkVsyncSource*>(displayLinkContext);
+
+    SDL_assert(displayLink == me->m_DisplayLink);
+
+    // The refresh period can change from frame to frame on
+    // ProMotion displays, so use the one for this V-sync.
+    Uint64 periodUs;
+    if (now->videoRefreshPeriod != 0 && now->videoTimeScale != 0) {
+        periodUs = (Uint64)now->videoRefreshPeriod * 1000000 / now->videoTimeScale;
+    }
+    else {
+        periodUs = 1000000 / me->m_DisplayFps;
+    }
+
+    // "now" is the timestamp of the V-sync that just happened. The output
+    // time passed as vsyncTime is a frame or two further out than that,
+    // which is too far ahead for the pacer's render deadline.
+    Uint64 hostNow = mach_absolute_time();
+    Uint64 sinceVsyncUs = hostNow > now->hostTime ?
+                (hostNow - now->hostTime) * me->m_HostTimeNumer / me->m_HostTimeDenom : 0;
+
+    me->m_Pacer->vsyncCallback(StreamUtils::getTimeUs() + periodUs - qMin(sinceVsyncUs, periodUs));
+
+    return kCVReturnSuccess;
+}
+
+bool DisplayLinkVsyncSource::initialize(SDL_Window* window, int displayFps)
+{
+    SDL_SysWMinfo info;
+    CVReturn status;
+
+    m_DisplayFps = displayFps;
+
+    SDL_VERSION(&info.version);
+
+    if (!SDL_GetWindowWMInfo(window, &info)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "SDL_GetWindowWMInfo() failed: %s",
+                     SDL_GetError());
+        return false;
+    }
+
+    SDL_assert(info.subsystem == SDL_SYSWM_COCOA);
+
+    NSScreen* screen = [info.info.cocoa.window screen];
+    if (screen == nullptr) {
+        // Window not visible on any display, so use a
+        // CVDisplayLink that can work with all active displays.
+        // When we become visible, we'll be recreated and
+        // associated with the new screen.
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "NSWindow is not visible on any display");
+        status = CVDisplayLinkCreateWithActiveCGDisplays(&m_DisplayLink);
+    }
+    else {
+        CGDirectDisplayID displayId = [[screen deviceDescription][@"NSScreenNumber"] unsignedIntValue];
+        status = CVDisplayLinkCreateWithCGDisplay(displayId, &m_DisplayLink);
+    }
+    if (status != kCVReturnSuccess) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Failed to create CVDisplayLink: %d",
+                     status);
+        return false;
+    }
+
+    // SDL reports 0 Hz (and we assume 60 Hz) for many built-in
+    // panels, including 120 Hz ProMotion displays. CoreVideo knows
+    // the real refresh rate.
+    CVTime nominalPeriod = CVDisplayLinkGetNominalOutputVideoRefreshPeriod(m_DisplayLink);
+    if (!(nominalPeriod.flags & kCVTimeIsIndefinite) && nominalPeriod.timeValue != 0) {
+        m_DisplayFps = (int)((nominalPeriod.timeScale + nominalPeriod.timeValue / 2) / nominalPeriod.timeValue);
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "CVDisplayLink refresh rate: %d Hz",
+                    m_DisplayFps);
+    }
+
+    status = CVDisplayLinkSetOutputCallback(m_DisplayLink, displayLinkOutputCallback, this);
+    if (status != kCVReturnSuccess) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "CVDisplayLinkSetOutputCallback() failed: %d",
+                     status);
+        return false;
+    }
+
+    status = CVDisplayLinkStart(m_DisplayLink);
+    if (status != kCVReturnSuccess) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "CVDisplayLinkStart() failed: %d",
+                     status);
+        return false;
+    }
+
+    return true;
+}
+
+int DisplayLinkVsyncSource::getDisplayFps()
+{
+    return m_DisplayFps;
+}
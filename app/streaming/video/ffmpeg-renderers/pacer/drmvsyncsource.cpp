@@ -0,0 +1,145 @@
+#include "drmvsyncsource.h"
+#include "streaming/threadplacement.h"
+
+#include <xf86drm.h>
+
+#include <poll.h>
+
+DrmVsyncSource::DrmVsyncSource(Pacer* pacer, int drmFd, int crtcIndex) :
+    m_Pacer(pacer),
+    m_Thread(nullptr),
+    m_DrmFd(drmFd),
+    m_CrtcIndex(crtcIndex),
+    m_VblankRequested(false)
+{
+    SDL_AtomicSet(&m_Stopping, 0);
+}
+
+DrmVsyncSource::~DrmVsyncSource()
+{
+    if (m_Thread != nullptr) {
+        SDL_AtomicSet(&m_Stopping, 1);
+        SDL_WaitThread(m_Thread, nullptr);
+    }
+}
+
+bool DrmVsyncSource::initialize(SDL_Window*, int displayFps)
+{
+    m_DisplayFps = displayFps;
+
+    // Make sure this CRTC can actually deliver V-blank events
+    drmVBlank vbl = {};
+    vbl.request.type = (drmVBlankSeqType)(DRM_VBLANK_RELATIVE |
+                                          ((m_CrtcIndex << DRM_VBLANK_HIGH_CRTC_SHIFT) & DRM_VBLANK_HIGH_CRTC_MASK));
+    vbl.request.sequence = 0;
+    if (drmWaitVBlank(m_DrmFd, &vbl) < 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "drmWaitVBlank() failed: %d",
+                     errno);
+        return false;
+    }
+
+    m_Thread = SDL_CreateThread(vsyncThread, "DRMVsync", this);
+    if (m_Thread == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unable to create DRM V-sync thread: %s",
+                     SDL_GetError());
+        return false;
+    }
+
+    return true;
+}
+
+bool DrmVsyncSource::requestVblankEvent()
+{
+    drmVBlank vbl = {};
+
+    // Ask for an event on the DRM fd at the next V-blank on our CRTC
+    vbl.request.type = (drmVBlankSeqType)(DRM_VBLANK_RELATIVE | DRM_VBLANK_EVENT |
+                                          ((m_CrtcIndex << DRM_VBLANK_HIGH_CRTC_SHIFT) & DRM_VBLANK_HIGH_CRTC_MASK));
+    vbl.request.sequence = 1;
+    vbl.request.signal = (unsigned long)this;
+    if (drmWaitVBlank(m_DrmFd, &vbl) < 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "drmWaitVBlank() failed: %d",
+                     errno);
+        return false;
+    }
+
+    m_VblankRequested = true;
+    return true;
+}
+
+void DrmVsyncSource::vblankHandler(int, unsigned int,
+                                   unsigned int tvSec, unsigned int tvUsec,
+                                   void* userData)
+{
+    DrmVsyncSource* me = reinterpret_cast<DrmVsyncSource*>(userData);
+
+    me->m_VblankRequested = false;
+
+    // The event carries the CLOCK_MONOTONIC time of the V-blank itself
+    Uint64 vblankTimeUs = (Uint64)tvSec * 1000000 + tvUsec;
+    me->m_Pacer->vsyncCallback(getNextVsyncTimeUs(vblankTimeUs, me->m_DisplayFps));
+}
+
+void DrmVsyncSource::pageFlipHandler(int, unsigned int sequence,
+                                     unsigned int tvSec, unsigned int tvUsec,
+                                     void* userData)
+{
+    IDrmPageFlipListener* listener = reinterpret_cast<IDrmPageFlipListener*>(userData);
+
+    // Legacy page flips may not carry a listener
+    if (listener != nullptr) {
+        listener->pageFlipCompleted(sequence, (Uint64)tvSec * 1000000 + tvUsec);
+    }
+}
+
+int DrmVsyncSource::vsyncThread(void* context)
+{
+    DrmVsyncSource* me = reinterpret_cast<DrmVsyncSource*>(context);
+    drmEventContext eventContext = {};
+
+    ThreadPlacement::applyToCurrentThread(ThreadPlacement::TR_VSYNC);
+
+    // We're the only reader of events on this fd while we're running,
+    // so we also deliver the page flip events of the renderer's atomic
+    // commits. They complete on the same V-blanks that we report.
+    eventContext.version = 2;
+    eventContext.vblank_handler = vblankHandler;
+    eventContext.page_flip_handler = pageFlipHandler;
+
+    while (SDL_AtomicGet(&me->m_Stopping) == 0) {
+        if (!me->m_VblankRequested && !me->requestVblankEvent()) {
+            SDL_Delay(10);
+            continue;
+        }
+
+        // Wake up periodically to check if we're stopping
+        struct pollfd pfd = {};
+        pfd.fd = me->m_DrmFd;
+        pfd.events = POLLIN;
+        int err = poll(&pfd, 1, 100);
+        if (err < 0) {
+            if (errno != EINTR) {
+                SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                             "poll() failed on DRM fd: %d",
+                             errno);
+                SDL_Delay(10);
+            }
+            continue;
+        }
+        else if (err == 0) {
+            continue;
+        }
+
+        if (drmHandleEvent(me->m_DrmFd, &eventContext) < 0) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "drmHandleEvent() failed: %d",
+                         errno);
+            SDL_Delay(10);
+        }
+    }
+
+    return 0;
+}
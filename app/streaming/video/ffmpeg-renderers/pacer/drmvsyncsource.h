@@ -0,0 +1,48 @@
+#pragma once
+
+#include "pacer.h"
+
+// Atomic commits pass one of these as their user data, so the page flip
+// event reaches the renderer regardless of which thread reads it.
+class IDrmPageFlipListener
+{
+public:
+    virtual ~IDrmPageFlipListener() {}
+
+    // Called with the V-blank sequence and CLOCK_MONOTONIC time at
+    // which the committed frame started scanning out
+    virtual void pageFlipCompleted(unsigned int sequence, Uint64 flipTimeUs) = 0;
+};
+
+class DrmVsyncSource : public IVsyncSource
+{
+public:
+    DrmVsyncSource(Pacer* pacer, int drmFd, int crtcIndex);
+
+    virtual ~DrmVsyncSource();
+
+    virtual bool initialize(SDL_Window* window, int displayFps);
+
+    // drmEventContext page flip handler that dispatches to the
+    // IDrmPageFlipListener in the event's user data
+    static void pageFlipHandler(int fd, unsigned int sequence,
+                                unsigned int tvSec, unsigned int tvUsec,
+                                void* userData);
+
+private:
+    bool requestVblankEvent();
+
+    static void vblankHandler(int fd, unsigned int sequence,
+                              unsigned int tvSec, unsigned int tvUsec,
+                              void* userData);
+
+    static int vsyncThread(void* context);
+
+    Pacer* m_Pacer;
+    SDL_Thread* m_Thread;
+    SDL_atomic_t m_Stopping;
+    int m_DrmFd;
+    int m_CrtcIndex;
+    int m_DisplayFps;
+    bool m_VblankRequested;
+};
@@ -1,4 +1,6 @@
 #include "dxvsyncsource.h"
+#include "streaming/streamutils.h"
+#include "streaming/threadplacement.h"
 
 // Useful references:
 // https://bugs.chromium.org/p/chromium/issues/detail?id=467617
@@ -76,11 +78,7 @@ int DxVsyncSource::vsyncThread(void* context)
 {
     DxVsyncSource* me = reinterpret_cast<DxVsyncSource*>(context);
 
-#if SDL_VERSION_ATLEAST(2, 0, 9)
-    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_TIME_CRITICAL);
-#else
-    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_HIGH);
-#endif
+    ThreadPlacement::applyToCurrentThread(ThreadPlacement::TR_VSYNC);
 
     D3DKMT_OPENADAPTERFROMHDC openAdapterParams = {};
     HMONITOR lastMonitor = nullptr;
@@ -159,7 +157,7 @@ int DxVsyncSource::vsyncThread(void* context)
             continue;
         }
 
-        me->m_Pacer->vsyncCallback(1000 / me->m_DisplayFps);
+        me->m_Pacer->vsyncCallback(StreamUtils::getTimeUs() + 1000000 / me->m_DisplayFps);
     }
 
     if (openAdapterParams.hAdapter != 0) {
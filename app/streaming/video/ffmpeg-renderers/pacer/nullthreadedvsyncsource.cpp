@@ -1,10 +1,37 @@
 #include "nullthreadedvsyncsource.h"
+#include "streaming/streamutils.h"
+#include "streaming/threadplacement.h"
 
-NullThreadedVsyncSource::NullThreadedVsyncSource(Pacer* pacer) :
+#if defined(Q_OS_DARWIN)
+#include <mach/mach_time.h>
+#elif defined(Q_OS_UNIX)
+#include <errno.h>
+#include <time.h>
+#endif
+
+#if defined(Q_OS_WIN32) && !defined(CREATE_WAITABLE_TIMER_HIGH_RESOLUTION)
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+// Each V-blank reported by the renderer moves the schedule by this
+// fraction (as a shift) of its phase error, so a single late report
+// can't knock the ticks far off while drift is still tracked.
+#define PHASE_CORRECTION_SHIFT 3
+
+NullThreadedVsyncSource::NullThreadedVsyncSource(Pacer* pacer, IFFmpegRenderer* renderer) :
     m_Pacer(pacer),
-    m_Thread(nullptr)
+    m_Renderer(renderer),
+    m_Thread(nullptr),
+    m_DisplayFps(0),
+    m_BaseTimeUs(0),
+    m_Tick(0),
+    m_LastVblankTimeUs(0)
 {
     SDL_AtomicSet(&m_Stopping, 0);
+
+#ifdef Q_OS_WIN32
+    m_Timer = nullptr;
+#endif
 }
 
 NullThreadedVsyncSource::~NullThreadedVsyncSource()
@@ -13,15 +40,39 @@ NullThreadedVsyncSource::~NullThreadedVsyncSource()
         SDL_AtomicSet(&m_Stopping, 1);
         SDL_WaitThread(m_Thread, nullptr);
     }
+
+#ifdef Q_OS_WIN32
+    if (m_Timer != nullptr) {
+        CloseHandle(m_Timer);
+    }
+#endif
 }
 
 bool NullThreadedVsyncSource::initialize(SDL_Window*, int displayFps)
 {
     m_DisplayFps = displayFps;
+
+#ifdef Q_OS_WIN32
+    // High resolution timers are only available on Windows 10 1803 and later
+    m_Timer = CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+    if (m_Timer == nullptr) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "High resolution waitable timer unavailable: %d",
+                    (int)GetLastError());
+        m_Timer = CreateWaitableTimerExW(nullptr, nullptr, 0, TIMER_ALL_ACCESS);
+        if (m_Timer == nullptr) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "CreateWaitableTimerExW() failed: %d",
+                         (int)GetLastError());
+            return false;
+        }
+    }
+#endif
+
     m_Thread = SDL_CreateThread(vsyncThread, "NullVsync", this);
     if (m_Thread == nullptr) {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                     "Unable to create DX V-sync thread: %s",
+                     "Unable to create null V-sync thread: %s",
                      SDL_GetError());
         return false;
     }
@@ -29,18 +80,99 @@ bool NullThreadedVsyncSource::initialize(SDL_Window*, int displayFps)
     return true;
 }
 
-int NullThreadedVsyncSource::vsyncThread(void* context)
+void NullThreadedVsyncSource::sleepUntil(Uint64 deadlineUs)
 {
-    NullThreadedVsyncSource* me = reinterpret_cast<NullThreadedVsyncSource*>(context);
+    Uint64 now = StreamUtils::getTimeUs();
+    if (now >= deadlineUs) {
+        return;
+    }
+
+    Uint64 sleepUs = deadlineUs - now;
+
+#if defined(Q_OS_WIN32)
+    // Absolute due times follow the wall clock, which can be adjusted
+    // under us, so the deadline is turned into a relative one (in 100 ns
+    // units) as late as possible instead.
+    LARGE_INTEGER dueTime;
+    dueTime.QuadPart = -(LONGLONG)(sleepUs * 10);
+    if (SetWaitableTimer(m_Timer, &dueTime, 0, nullptr, nullptr, FALSE)) {
+        WaitForSingleObject(m_Timer, INFINITE);
+    }
+    else {
+        SDL_Delay((Uint32)(sleepUs / 1000));
+    }
+#elif defined(Q_OS_DARWIN)
+    static mach_timebase_info_data_t timebase;
+    if (timebase.denom == 0) {
+        mach_timebase_info(&timebase);
+    }
 
-#if SDL_VERSION_ATLEAST(2, 0, 9)
-    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_TIME_CRITICAL);
+    mach_wait_until(mach_absolute_time() + sleepUs * 1000 * timebase.denom / timebase.numer);
+#elif defined(Q_OS_UNIX)
+    // SDL's performance counter may run on CLOCK_MONOTONIC_RAW, which
+    // can't be slept on, but the two don't drift apart within a period.
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += sleepUs / 1000000;
+    deadline.tv_nsec += (sleepUs % 1000000) * 1000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr) == EINTR);
 #else
-    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_HIGH);
+    SDL_Delay((Uint32)(sleepUs / 1000));
 #endif
+}
+
+void NullThreadedVsyncSource::correctPhase()
+{
+    Uint64 vblankTimeUs;
+    if (!m_Renderer->getLastVblankTimeUs(vblankTimeUs) || vblankTimeUs == m_LastVblankTimeUs) {
+        return;
+    }
+
+    m_LastVblankTimeUs = vblankTimeUs;
+
+    // Wrap the offset from our schedule into (-period / 2, period / 2]
+    Sint64 periodUs = 1000000 / m_DisplayFps;
+    Sint64 errorUs = ((Sint64)vblankTimeUs - (Sint64)m_BaseTimeUs) % periodUs;
+    if (errorUs > periodUs / 2) {
+        errorUs -= periodUs;
+    }
+    else if (errorUs <= -periodUs / 2) {
+        errorUs += periodUs;
+    }
+
+    m_BaseTimeUs += errorUs / (1 << PHASE_CORRECTION_SHIFT);
+}
+
+int NullThreadedVsyncSource::vsyncThread(void* context)
+{
+    NullThreadedVsyncSource* me = reinterpret_cast<NullThreadedVsyncSource*>(context);
+
+    ThreadPlacement::applyToCurrentThread(ThreadPlacement::TR_VSYNC);
+
+    me->m_BaseTimeUs = StreamUtils::getTimeUs();
+    me->m_Tick = 0;
 
     while (SDL_AtomicGet(&me->m_Stopping) == 0) {
-        me->m_Pacer->vsyncCallback(1000 / me->m_DisplayFps);
+        me->correctPhase();
+
+        Uint64 vsyncTimeUs = me->m_BaseTimeUs + me->m_Tick * 1000000 / me->m_DisplayFps;
+        me->sleepUntil(vsyncTimeUs);
+
+        me->m_Tick++;
+        me->m_Pacer->vsyncCallback(me->m_BaseTimeUs + me->m_Tick * 1000000 / me->m_DisplayFps);
+
+        // If the callback overran whole periods, skip the ticks we missed
+        // rather than firing them back to back
+        Uint64 now = StreamUtils::getTimeUs();
+        Uint64 nextVsyncTimeUs = me->m_BaseTimeUs + me->m_Tick * 1000000 / me->m_DisplayFps;
+        if (now > nextVsyncTimeUs) {
+            me->m_Tick = (now - me->m_BaseTimeUs) * me->m_DisplayFps / 1000000 + 1;
+        }
     }
 
     return 0;
@@ -2,10 +2,20 @@
 
 #include "pacer.h"
 
+#ifdef Q_OS_WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#endif
+
+// Generates V-sync callbacks from a timer for displays that don't provide
+// them. Ticks are scheduled against absolute deadlines so sleeping late
+// doesn't push the following ticks back, and when the renderer can report
+// when its frames reached the display, the schedule is slowly pulled onto
+// the display's real phase.
 class NullThreadedVsyncSource : public IVsyncSource
 {
 public:
-    NullThreadedVsyncSource(Pacer* pacer);
+    NullThreadedVsyncSource(Pacer* pacer, IFFmpegRenderer* renderer);
 
     virtual ~NullThreadedVsyncSource();
 
@@ -14,8 +24,25 @@ public:
 private:
     static int vsyncThread(void* context);
 
+    // Sleeps until the given StreamUtils::getTimeUs() time
+    void sleepUntil(Uint64 deadlineUs);
+
+    // Moves the schedule toward the last V-blank seen by the renderer
+    void correctPhase();
+
     Pacer* m_Pacer;
+    IFFmpegRenderer* m_Renderer;
     SDL_Thread* m_Thread;
     SDL_atomic_t m_Stopping;
     int m_DisplayFps;
+
+    // Tick n is due at m_BaseTimeUs + n * 1000000 / m_DisplayFps, which
+    // keeps the fraction of a microsecond that a period doesn't divide into
+    Uint64 m_BaseTimeUs;
+    Uint64 m_Tick;
+    Uint64 m_LastVblankTimeUs;
+
+#ifdef Q_OS_WIN32
+    HANDLE m_Timer;
+#endif
 };
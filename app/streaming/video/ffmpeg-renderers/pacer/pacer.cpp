@@ -1,5 +1,11 @@
 #include "pacer.h"
+#include "streaming/avsyncclock.h"
+#include "streaming/latencyprobe.h"
 #include "streaming/streamutils.h"
+#include "streaming/threadplacement.h"
+#include "streaming/video/framegraph.h"
+#include "streaming/video/frametracer.h"
+#include "streaming/video/screenshot.h"
 
 #include "nullthreadedvsyncsource.h"
 
@@ -10,51 +16,118 @@
 #include "dxvsyncsource.h"
 #endif
 
-// Limit the number of queued frames to prevent excessive memory consumption
-// if the V-Sync source or renderer is blocked for a while.
-#define MAX_QUEUED_FRAMES 8
+#ifdef Q_OS_DARWIN
+#include "displaylinkvsyncsource.h"
+#endif
+
+#ifdef HAVE_DRM
+#include "drmvsyncsource.h"
+#endif
+
+#ifdef HAVE_X11_PRESENT
+#include "x11vsyncsource.h"
+#endif
+
+#ifdef HAVE_WAYLAND
+#include "waylandvsyncsource.h"
+#endif
+
+#ifdef Q_OS_UNIX
+#include <time.h>
+#endif
+
+#include <SDL_syswm.h>
 
 // We may be woken up slightly late so don't go all the way
 // up to the next V-sync since we may accidentally step into
 // the next V-sync period. It also takes some amount of time
 // to do the render itself, so we can't render right before
 // V-sync happens.
-#define TIMER_SLACK_MS 3
+#define TIMER_SLACK_US 2000
+
+// Extra time allowed for the wakeup itself in the adaptive pacing modes
+#define ADAPTIVE_WAKEUP_MARGIN_US 1000
 
-Pacer::Pacer(IFFmpegRenderer* renderer, PVIDEO_STATS videoStats) :
+// Glass-to-glass budget for queued frames in the adaptive pacing modes
+#define LOWEST_LATENCY_BUDGET_FRAMES 1
+#define SMOOTHEST_BUDGET_FRAMES 3
+
+// Weight of new samples in the exponential moving averages (1/16)
+#define EWMA_SHIFT 4
+
+// In the just in time mode, the V-sync thread sleeps until this long plus
+// the usual render cost before V-sync. It covers oversleeping, since only
+// millisecond sleeps are portable.
+#define JIT_WAKEUP_MARGIN_US 1500
+
+// Render costs sampled before the percentile is taken again
+#define JIT_RENDER_COST_WINDOW 240
+
+Pacer::Pacer(IFFmpegRenderer* renderer, FramePool* framePool, PVIDEO_STATS videoStats) :
     m_RenderThread(nullptr),
-    m_Stopping(false),
     m_VsyncSource(nullptr),
     m_VsyncRenderer(renderer),
+    m_FramePool(framePool),
     m_MaxVideoFps(0),
     m_DisplayFps(0),
-    m_VideoStats(videoStats)
+    m_VideoStats(videoStats),
+    m_MaxQueuedFrames(getMaxHeldFrames() / 2),
+    m_PacingMode(StreamingPreferences::PM_BALANCED),
+    m_LastSubmitTimeUs(0),
+    m_LastPresentLatencyUs(0)
 {
+    SDL_AtomicSet(&m_Stopping, 0);
+    SDL_AtomicSet(&m_ArrivalJitterUs, 0);
+    SDL_AtomicSet(&m_RenderTimeUs, 0);
+    SDL_AtomicSet(&m_RenderTimeDevUs, 0);
+    SDL_AtomicSet(&m_ScreenshotRequested, 0);
+    SDL_AtomicSet(&m_RenderCostP99Us, 0);
+    SDL_zero(m_HandoffHistogram);
+    SDL_zero(m_RenderCostHistogram);
+
+    // One screenshot is converted at a time
+    m_ScreenshotPool.setMaxThreadCount(1);
+}
 
+int Pacer::getMaxHeldFrames()
+{
+    int queuedFrames = StreamUtils::isLowMemoryMode() ? LOW_MEMORY_QUEUED_FRAMES : MAX_QUEUED_FRAMES;
+    return 2 * queuedFrames + 1;
 }
 
 Pacer::~Pacer()
 {
     // Stop V-sync callbacks
+    if (m_VsyncSource != nullptr) {
+        m_VsyncRenderer->setDrmEventsHandledExternally(false);
+    }
     delete m_VsyncSource;
     m_VsyncSource = nullptr;
 
     // Stop the render thread
-    m_Stopping = true;
+    SDL_AtomicSet(&m_Stopping, 1);
     if (m_RenderThread != nullptr) {
-        m_RenderQueueNotEmpty.wakeAll();
+        m_RenderQueue.stopWaiting();
         SDL_WaitThread(m_RenderThread, nullptr);
     }
 
-    // Delete any remaining unconsumed frames
-    while (!m_RenderQueue.isEmpty()) {
-        AVFrame* frame = m_RenderQueue.dequeue();
-        av_frame_free(&frame);
+    // Both threads are gone, so we can act as the consumer of both
+    // queues to return any remaining unconsumed frames to the pool
+    RenderQueueEntry entry;
+    while (m_RenderQueue.dequeue(entry)) {
+        m_FramePool->releaseFrame(entry.frame);
     }
-    while (!m_PacingQueue.isEmpty()) {
-        AVFrame* frame = m_PacingQueue.dequeue();
-        av_frame_free(&frame);
+
+    AVFrame* frame;
+    while (m_PacingQueue.dequeue(frame)) {
+        m_FramePool->releaseFrame(frame);
     }
+
+    // Screenshots hold a reference to their frame, which must be dropped
+    // before the renderer and its device go away
+    m_ScreenshotPool.waitForDone();
+
+    logHandoffLatency();
 }
 
 void Pacer::renderOnMainThread()
@@ -64,14 +137,8 @@ void Pacer::renderOnMainThread()
         return;
     }
 
-    m_FrameQueueLock.lock();
-
     if (!m_RenderQueue.isEmpty()) {
-        // Releases m_FrameQueueLock
-        renderLastFrameAndUnlock();
-    }
-    else {
-        m_FrameQueueLock.unlock();
+        renderLastFrame();
     }
 }
 
@@ -79,47 +146,46 @@ int Pacer::renderThread(void* context)
 {
     Pacer* me = reinterpret_cast<Pacer*>(context);
 
-    if (SDL_SetThreadPriority(SDL_THREAD_PRIORITY_HIGH) < 0) {
-        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
-                    "Unable to set render thread to high priority: %s",
-                    SDL_GetError());
-    }
-
-    while (!me->m_Stopping) {
-        // Acquire the frame queue lock to protect the queue and
-        // the not empty condition
-        me->m_FrameQueueLock.lock();
+    ThreadPlacement::applyToCurrentThread(ThreadPlacement::TR_RENDER);
 
+    while (!SDL_AtomicGet(&me->m_Stopping)) {
         // Wait for a frame to be ready to render
-        while (!me->m_Stopping && me->m_RenderQueue.isEmpty()) {
-            me->m_RenderQueueNotEmpty.wait(&me->m_FrameQueueLock);
+        if (!me->m_RenderQueue.waitForItems(-1)) {
+            // Woken up to exit or spuriously
+            continue;
         }
 
-        if (me->m_Stopping) {
+        if (SDL_AtomicGet(&me->m_Stopping)) {
             // Exit this thread
-            me->m_FrameQueueLock.unlock();
             break;
         }
 
+        // Wait for the renderer to be ready, so we pick the newest frame
+        // that arrived in the meantime rather than the one that woke us.
+        me->m_VsyncRenderer->waitToRender();
+
         // Render the latest frame and discard the others
-        // NB: m_FrameQueueLock still held here!
-        me->renderLastFrameAndUnlock();
+        me->renderLastFrame();
     }
 
     return 0;
 }
 
-void Pacer::enqueueFrameForRenderingAndUnlock(AVFrame *frame)
+void Pacer::enqueueFrameForRendering(AVFrame *frame)
 {
-    dropFrameForEnqueue(m_RenderQueue);
-    m_RenderQueue.enqueue(frame);
-
-    m_FrameQueueLock.unlock();
+    RenderQueueEntry entry;
+    entry.frame = frame;
+    entry.enqueueTime = StreamUtils::getTimeUs();
 
-    if (m_RenderThread != nullptr) {
-        m_RenderQueueNotEmpty.wakeOne();
+    if (m_RenderQueue.count() >= m_MaxQueuedFrames || !m_RenderQueue.enqueue(entry)) {
+        // The renderer is stuck. Only the consumer may remove frames
+        // from the queue, so we drop this one instead of the oldest.
+        m_VideoStats->pacerDroppedFrames++;
+        m_FramePool->releaseFrame(frame);
+        return;
     }
-    else {
+
+    if (m_RenderThread == nullptr) {
         SDL_Event event;
 
         // For main thread rendering, we'll push an event to trigger a callback
@@ -129,52 +195,58 @@ void Pacer::enqueueFrameForRenderingAndUnlock(AVFrame *frame)
     }
 }
 
-// Caller must hold m_FrameQueueLock
-void Pacer::renderLastFrameAndUnlock()
+// Must be called on the render queue's consumer thread
+void Pacer::renderLastFrame()
 {
     // Dequeue the most recent frame for rendering and free the others.
-    AVFrame* lastFrame = nullptr;
-    while (!m_RenderQueue.isEmpty()) {
-        if (lastFrame != nullptr) {
-            // Don't hold the frame queue lock across av_frame_free(),
-            // since it could need to talk to the GPU driver. This is safe
-            // because we're guaranteed that the queue will not shrink during
-            // this time (and so dequeue() below will always get something).
-            m_FrameQueueLock.unlock();
-            av_frame_free(&lastFrame);
+    RenderQueueEntry lastEntry = {};
+    RenderQueueEntry entry;
+    while (m_RenderQueue.dequeue(entry)) {
+        if (lastEntry.frame != nullptr) {
+            m_FramePool->releaseFrame(lastEntry.frame);
             m_VideoStats->pacerDroppedFrames++;
-            m_FrameQueueLock.lock();
         }
 
-        lastFrame = m_RenderQueue.dequeue();
+        lastEntry = entry;
     }
 
-    // Release the frame queue lock before rendering
-    m_FrameQueueLock.unlock();
+    if (lastEntry.frame == nullptr) {
+        return;
+    }
 
-    // Render and free the mot current frame
-    renderFrame(lastFrame);
+    // Render and release the most current frame
+    renderFrame(lastEntry.frame, lastEntry.enqueueTime);
 }
 
 // Called in an arbitrary thread by the IVsyncSource on V-sync
 // or an event synchronized with V-sync
-void Pacer::vsyncCallback(int timeUntilNextVsyncMillis)
+void Pacer::vsyncCallback(Uint64 nextVsyncTimeUs)
 {
     // Make sure initialize() has been called
     SDL_assert(m_MaxVideoFps != 0);
 
-    SDL_assert(timeUntilNextVsyncMillis >= TIMER_SLACK_MS);
+    if (m_PacingMode == StreamingPreferences::PM_JUST_IN_TIME) {
+        renderJustInTime(nextVsyncTimeUs);
+        return;
+    }
 
-    m_FrameQueueLock.lock();
+    // This is the last point we can hand a frame to the
+    // renderer and still expect it to make the next V-sync
+    Uint64 renderDeadlineUs = nextVsyncTimeUs - (m_PacingMode == StreamingPreferences::PM_BALANCED ?
+                                                     TIMER_SLACK_US : getAdaptiveRenderSlackUs());
 
     // If the queue length history entries are large, be strict
     // about dropping excess frames.
     int frameDropTarget = 1;
 
+    if (m_PacingMode != StreamingPreferences::PM_BALANCED) {
+        // Allow only as many queued frames as our latency budget can afford
+        frameDropTarget = getAdaptiveFrameDropTarget();
+    }
     // If we may get more frames per second than we can display, use
     // frame history to drop frames only if consistently above the
     // one queued frame mark.
-    if (m_MaxVideoFps >= m_DisplayFps) {
+    else if (m_MaxVideoFps >= m_DisplayFps) {
         for (int queueHistoryEntry : m_PacingQueueHistory) {
             if (queueHistoryEntry <= 1) {
                 // Be lenient as long as the queue length
@@ -193,53 +265,149 @@ void Pacer::vsyncCallback(int timeUntilNextVsyncMillis)
     }
 
     // Catch up if we're several frames ahead
-    while (m_PacingQueue.count() > frameDropTarget) {
-        AVFrame* frame = m_PacingQueue.dequeue();
-
-        // Drop the lock while we call av_frame_free()
-        m_FrameQueueLock.unlock();
+    AVFrame* frame;
+    while (m_PacingQueue.count() > frameDropTarget && m_PacingQueue.dequeue(frame)) {
         m_VideoStats->pacerDroppedFrames++;
-        av_frame_free(&frame);
-        m_FrameQueueLock.lock();
+        m_FramePool->releaseFrame(frame);
     }
 
-    if (m_PacingQueue.isEmpty()) {
-        // Wait for a frame to arrive or our V-sync timeout to expire
-        if (!m_PacingQueueNotEmpty.wait(&m_FrameQueueLock, timeUntilNextVsyncMillis - TIMER_SLACK_MS)) {
-            // Wait timed out - unlock and bail
-            m_FrameQueueLock.unlock();
-            return;
-        }
+    // Wait for a frame to arrive or our render deadline to pass. The wait
+    // itself has millisecond granularity, so round down to avoid overshooting.
+    Uint64 now = StreamUtils::getTimeUs();
+    int waitTimeMs = now < renderDeadlineUs ? (int)((renderDeadlineUs - now) / 1000) : 0;
+    if (!m_PacingQueue.waitForItems(waitTimeMs)) {
+        // Wait timed out - bail
+        return;
     }
 
     // Place the first frame on the render queue
-    enqueueFrameForRenderingAndUnlock(m_PacingQueue.dequeue());
+    if (m_PacingQueue.dequeue(frame)) {
+        enqueueFrameForRendering(frame);
+    }
+}
+
+// Instead of handing the oldest frame to the renderer as soon as V-sync
+// fires, wait until just enough time is left to render and present before
+// the next one, then take the newest frame. A frame decoded during the
+// wait is shown a whole period sooner than it would be otherwise.
+void Pacer::renderJustInTime(Uint64 nextVsyncTimeUs)
+{
+    Uint64 renderStartUs = nextVsyncTimeUs - getJustInTimeLeadUs();
+
+    Uint64 now = StreamUtils::getTimeUs();
+    if (now < renderStartUs) {
+        SDL_Delay((Uint32)((renderStartUs - now) / 1000));
+    }
+
+    // Everything but the newest frame is stale now
+    AVFrame* frame;
+    while (m_PacingQueue.count() > 1 && m_PacingQueue.dequeue(frame)) {
+        m_VideoStats->pacerDroppedFrames++;
+        m_FramePool->releaseFrame(frame);
+    }
+
+    // If nothing new arrived, the last frame stays on screen
+    if (m_PacingQueue.dequeue(frame)) {
+        enqueueFrameForRendering(frame);
+    }
+}
+
+Uint64 Pacer::getJustInTimeLeadUs()
+{
+    int periodUs = 1000000 / m_DisplayFps;
+    int costUs = SDL_AtomicGet(&m_RenderCostP99Us);
+
+    // Until a full window of renders has been seen, go by the average
+    if (costUs == 0) {
+        return qMin(getAdaptiveRenderSlackUs() + JIT_WAKEUP_MARGIN_US, (Uint64)periodUs);
+    }
+
+    return (Uint64)qMin(costUs + JIT_WAKEUP_MARGIN_US, periodUs);
 }
 
-bool Pacer::initialize(SDL_Window* window, int maxVideoFps, bool enablePacing)
+int Pacer::getAdaptiveFrameDropTarget()
+{
+    int displayPeriodUs = 1000000 / m_DisplayFps;
+
+    // Queue enough frames to ride out the jitter we see in frame arrival
+    // times, but no more than our latency budget allows.
+    int depth = 1 + (2 * SDL_AtomicGet(&m_ArrivalJitterUs)) / displayPeriodUs;
+
+    if (m_PacingMode == StreamingPreferences::PM_SMOOTHEST) {
+        // Always keep a spare frame to cover a late arrival
+        return qBound(2, depth, SMOOTHEST_BUDGET_FRAMES);
+    }
+    else {
+        return qBound(1, depth, LOWEST_LATENCY_BUDGET_FRAMES);
+    }
+}
+
+Uint64 Pacer::getAdaptiveRenderSlackUs()
+{
+    // Leave enough time before V-sync to cover nearly all renders
+    int slackUs = SDL_AtomicGet(&m_RenderTimeUs) +
+                  2 * SDL_AtomicGet(&m_RenderTimeDevUs) +
+                  ADAPTIVE_WAKEUP_MARGIN_US;
+
+    // Don't give up more than half of the frame period
+    return (Uint64)qMin(slackUs, 500000 / m_DisplayFps);
+}
+
+bool Pacer::initialize(SDL_Window* window, int maxVideoFps, bool enablePacing,
+                       StreamingPreferences::PacingMode pacingMode)
 {
     m_MaxVideoFps = maxVideoFps;
     m_DisplayFps = StreamUtils::getDisplayRefreshRate(window);
+    m_PacingMode = pacingMode;
 
     if (enablePacing) {
         SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
-                    "Frame pacing active: target %d Hz with %d FPS stream",
-                    m_DisplayFps, m_MaxVideoFps);
+                    "Frame pacing active: target %d Hz with %d FPS stream (mode %d)",
+                    m_DisplayFps, m_MaxVideoFps, m_PacingMode);
 
     #if defined(Q_OS_WIN32)
         // Don't use D3DKMTWaitForVerticalBlankEvent() on Windows 7, because
         // it blocks during other concurrent DX operations (like actually rendering).
+        // A timer keeps frames paced there instead.
         if (IsWindows8OrGreater()) {
             m_VsyncSource = new DxVsyncSource(this);
         }
+        else {
+            m_VsyncSource = new NullThreadedVsyncSource(this, m_VsyncRenderer);
+        }
+    #elif defined(Q_OS_DARWIN)
+        m_VsyncSource = new DisplayLinkVsyncSource(this);
     #else
-        // Platforms without a VsyncSource will just render frames
-        // immediately like they used to.
+        m_VsyncSource = createUnixVsyncSource(window);
     #endif
 
         if (m_VsyncSource != nullptr && !m_VsyncSource->initialize(window, m_DisplayFps)) {
+    #if defined(Q_OS_WIN32)
             return false;
+    #else
+            // The native V-sync sources depend on compositor and driver
+            // support, so fall back to rendering immediately without one.
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "V-sync source failed to initialize; frames will be rendered immediately");
+            delete m_VsyncSource;
+            m_VsyncSource = nullptr;
+    #endif
         }
+
+        if (m_VsyncSource != nullptr && m_VsyncSource->getDisplayFps() != 0 &&
+                m_VsyncSource->getDisplayFps() != m_DisplayFps) {
+            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                        "V-sync source overrides display refresh rate: %d Hz",
+                        m_VsyncSource->getDisplayFps());
+            m_DisplayFps = m_VsyncSource->getDisplayFps();
+        }
+
+    #ifdef HAVE_DRM
+        // The DRM V-sync source reads the renderer's page flip events too
+        if (dynamic_cast<DrmVsyncSource*>(m_VsyncSource) != nullptr) {
+            m_VsyncRenderer->setDrmEventsHandledExternally(true);
+        }
+    #endif
     }
     else {
         SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
@@ -254,30 +422,199 @@ bool Pacer::initialize(SDL_Window* window, int maxVideoFps, bool enablePacing)
     return true;
 }
 
-void Pacer::renderFrame(AVFrame* frame)
+#if defined(Q_OS_UNIX) && !defined(Q_OS_DARWIN)
+IVsyncSource* Pacer::createUnixVsyncSource(SDL_Window* window)
+{
+#ifdef HAVE_DRM
+    int drmFd, crtcIndex;
+
+    // Renderers that scan out directly can take V-sync straight from their CRTC
+    if (m_VsyncRenderer->getDrmCrtc(drmFd, crtcIndex)) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Using DRM V-blank V-sync source");
+        return new DrmVsyncSource(this, drmFd, crtcIndex);
+    }
+#endif
+
+    // Renderers that present on their own surfaces get feedback for each
+    // of their frames, which keeps a timer in phase with the display
+    if (m_VsyncRenderer->hasPresentationFeedback()) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Using presentation feedback V-sync source");
+        return new NullThreadedVsyncSource(this, m_VsyncRenderer);
+    }
+
+    SDL_SysWMinfo info;
+    SDL_VERSION(&info.version);
+    if (!SDL_GetWindowWMInfo(window, &info)) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "SDL_GetWindowWMInfo() failed: %s",
+                    SDL_GetError());
+        return nullptr;
+    }
+
+    switch (info.subsystem) {
+#ifdef HAVE_X11_PRESENT
+    case SDL_SYSWM_X11:
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Using X11 Present V-sync source");
+        return new X11VsyncSource(this);
+#endif
+#ifdef HAVE_WAYLAND
+    case SDL_SYSWM_WAYLAND:
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Using Wayland frame callback V-sync source");
+        return new WaylandVsyncSource(this);
+#endif
+    default:
+        // Platforms without a VsyncSource will just render frames
+        // immediately like they used to.
+        return nullptr;
+    }
+}
+#endif
+
+#ifdef Q_OS_UNIX
+Uint64 IVsyncSource::getNextVsyncTimeUs(Uint64 lastVsyncMonotonicUs, int displayFps)
+{
+    struct timespec now;
+    Uint64 periodUs = 1000000 / displayFps;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    Uint64 nowMonotonicUs = (Uint64)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+    Uint64 sinceVsyncUs = nowMonotonicUs > lastVsyncMonotonicUs ?
+                nowMonotonicUs - lastVsyncMonotonicUs : 0;
+
+    // If we're somehow more than a period late, the next V-sync is imminent
+    return StreamUtils::getTimeUs() + periodUs - qMin(sinceVsyncUs, periodUs);
+}
+#endif
+
+class ScreenshotTask : public QRunnable
+{
+public:
+    explicit ScreenshotTask(AVFrame* frame)
+        : m_Frame(frame)
+    {
+    }
+
+    ~ScreenshotTask() override
+    {
+        av_frame_free(&m_Frame);
+    }
+
+    void run() override
+    {
+        Screenshot::save(m_Frame);
+    }
+
+private:
+    AVFrame* m_Frame;
+};
+
+void Pacer::requestScreenshot()
+{
+    SDL_AtomicSet(&m_ScreenshotRequested, 1);
+}
+
+void Pacer::takeScreenshot(AVFrame* frame)
+{
+    // This only takes another reference to the frame's buffers, so a GPU
+    // surface stays as it is until the worker thread reads it back
+    AVFrame* screenshotFrame = av_frame_clone(frame);
+    if (screenshotFrame == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unable to reference frame for screenshot");
+        return;
+    }
+
+    m_ScreenshotPool.start(new ScreenshotTask(screenshotFrame));
+}
+
+void Pacer::renderFrame(AVFrame* frame, Uint64 enqueueTime)
 {
+    // Track how long the frame waited between being queued and picked up
+    Uint64 beforeRender = StreamUtils::getTimeUs();
+    Uint64 handoffUs = beforeRender - enqueueTime;
+    int bucket = 0;
+    while (handoffUs > 1 && bucket < HANDOFF_HISTOGRAM_BUCKETS - 1) {
+        handoffUs >>= 1;
+        bucket++;
+    }
+    m_HandoffHistogram[bucket]++;
+
     // Count time spent in Pacer's queues
-    Uint32 beforeRender = SDL_GetTicks();
     m_VideoStats->totalPacerTime += beforeRender - frame->pts;
+    m_VideoStats->pacerTimes.add(beforeRender - frame->pts);
 
     // Render it
+    int frameNumber = (int)frame->pkt_dts;
+    bool probeResponse = LatencyProbe::isActive() && LatencyProbe::probeFrame(frame);
+    FrameTracer::mark(frameNumber, FrameTracer::FTS_RENDER_STARTED, beforeRender);
+    FrameGraph::mark(frameNumber, FrameGraph::FGS_PACER, beforeRender - frame->pts);
     m_VsyncRenderer->renderFrame(frame);
-    Uint32 afterRender = SDL_GetTicks();
+    Uint64 afterRender = StreamUtils::getTimeUs();
+    FrameTracer::mark(frameNumber, FrameTracer::FTS_RENDERED, afterRender);
 
     m_VideoStats->totalRenderTime += afterRender - beforeRender;
+    m_VideoStats->renderTimes.add(afterRender - beforeRender);
     m_VideoStats->renderedFrames++;
-    av_frame_free(&frame);
 
-    // Drop frames if we have too many queued up for a while
-    m_FrameQueueLock.lock();
+    if (SDL_AtomicGet(&m_ScreenshotRequested) != 0 && SDL_AtomicSet(&m_ScreenshotRequested, 0) != 0) {
+        takeScreenshot(frame);
+    }
+
+    m_FramePool->releaseFrame(frame);
+
+    Uint64 presentLatencyUs = m_VsyncRenderer->takePresentLatencyUs();
+    if (presentLatencyUs != 0) {
+        m_VideoStats->totalPresentLatency += presentLatencyUs;
+        m_VideoStats->presentLatencySamples++;
+        m_LastPresentLatencyUs = presentLatencyUs;
+    }
+
+    // The scanout latency is measured for earlier frames, so assume this
+    // one takes as long as the last one that was measured
+    AvSyncClock::markVideoPresented(frameNumber, afterRender + m_LastPresentLatencyUs);
+    FrameGraph::mark(frameNumber, FrameGraph::FGS_RENDER, afterRender - beforeRender);
+    FrameGraph::mark(frameNumber, FrameGraph::FGS_PRESENT, m_LastPresentLatencyUs);
+    FrameGraph::markRendered(frameNumber);
+    if (probeResponse) {
+        LatencyProbe::markResponsePresented(afterRender + m_LastPresentLatencyUs);
+    }
+
+    // Track the average render time and its deviation for adaptive pacing
+    int renderTimeUs = (int)qMin(afterRender - beforeRender, (Uint64)1000000);
+    int averageUs = SDL_AtomicGet(&m_RenderTimeUs);
+    int deviationUs = SDL_AtomicGet(&m_RenderTimeDevUs);
+    averageUs += (renderTimeUs - averageUs) >> EWMA_SHIFT;
+    deviationUs += (qAbs(renderTimeUs - averageUs) - deviationUs) >> EWMA_SHIFT;
+    SDL_AtomicSet(&m_RenderTimeUs, averageUs);
+    SDL_AtomicSet(&m_RenderTimeDevUs, deviationUs);
+
+    // The just in time mode must also cover the handoff to the renderer,
+    // which can wait on the main loop or the swap chain
+    if (m_PacingMode == StreamingPreferences::PM_JUST_IN_TIME) {
+        m_RenderCostHistogram.add(afterRender - enqueueTime);
+        if (m_RenderCostHistogram.count >= JIT_RENDER_COST_WINDOW) {
+            SDL_AtomicSet(&m_RenderCostP99Us, (int)m_RenderCostHistogram.getPercentileUs(99));
+            SDL_zero(m_RenderCostHistogram);
+        }
+    }
 
+    // Drop frames if we have too many queued up for a while. Never let
+    // frames back up in the render queue when minimizing latency.
     int frameDropTarget = 0;
-    for (int queueHistoryEntry : m_RenderQueueHistory) {
-        if (queueHistoryEntry == 0) {
-            // Be lenient as long as the queue length
-            // resolves before the end of frame history
-            frameDropTarget = 2;
-            break;
+    if (m_PacingMode != StreamingPreferences::PM_LOWEST_LATENCY &&
+            m_PacingMode != StreamingPreferences::PM_JUST_IN_TIME) {
+        for (int queueHistoryEntry : m_RenderQueueHistory) {
+            if (queueHistoryEntry == 0) {
+                // Be lenient as long as the queue length
+                // resolves before the end of frame history
+                frameDropTarget = 2;
+                break;
+            }
         }
     }
 
@@ -289,25 +626,35 @@ void Pacer::renderFrame(AVFrame* frame)
     m_RenderQueueHistory.enqueue(m_RenderQueue.count());
 
     // Catch up if we're several frames ahead
-    while (m_RenderQueue.count() > frameDropTarget) {
-        AVFrame* frame = m_RenderQueue.dequeue();
-
-        // Drop the lock while we call av_frame_free()
-        m_FrameQueueLock.unlock();
+    RenderQueueEntry entry;
+    while (m_RenderQueue.count() > frameDropTarget && m_RenderQueue.dequeue(entry)) {
         m_VideoStats->pacerDroppedFrames++;
-        av_frame_free(&frame);
-        m_FrameQueueLock.lock();
+        m_FramePool->releaseFrame(entry.frame);
     }
-
-    m_FrameQueueLock.unlock();
 }
 
-void Pacer::dropFrameForEnqueue(QQueue<AVFrame*>& queue)
+void Pacer::logHandoffLatency()
 {
-    SDL_assert(queue.size() <= MAX_QUEUED_FRAMES);
-    if (queue.size() == MAX_QUEUED_FRAMES) {
-        AVFrame* frame = queue.dequeue();
-        av_frame_free(&frame);
+    uint32_t totalFrames = 0;
+    for (int i = 0; i < HANDOFF_HISTOGRAM_BUCKETS; i++) {
+        totalFrames += m_HandoffHistogram[i];
+    }
+
+    if (totalFrames == 0) {
+        return;
+    }
+
+    // Find the bucket containing the 99th percentile
+    uint32_t framesSeen = 0;
+    for (int i = 0; i < HANDOFF_HISTOGRAM_BUCKETS; i++) {
+        framesSeen += m_HandoffHistogram[i];
+        if (framesSeen >= totalFrames - totalFrames / 100) {
+            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                        "Render queue handoff latency (p99): < %u us over %u frames",
+                        2U << i,
+                        totalFrames);
+            break;
+        }
     }
 }
 
@@ -316,15 +663,25 @@ void Pacer::submitFrame(AVFrame* frame)
     // Make sure initialize() has been called
     SDL_assert(m_MaxVideoFps != 0);
 
+    // Track how far frame arrivals deviate from the stream frame rate
+    Uint64 now = StreamUtils::getTimeUs();
+    if (m_LastSubmitTimeUs != 0) {
+        int intervalUs = (int)qMin(now - m_LastSubmitTimeUs, (Uint64)1000000);
+        int jitterUs = SDL_AtomicGet(&m_ArrivalJitterUs);
+        jitterUs += (qAbs(intervalUs - 1000000 / m_MaxVideoFps) - jitterUs) >> EWMA_SHIFT;
+        SDL_AtomicSet(&m_ArrivalJitterUs, jitterUs);
+    }
+    m_LastSubmitTimeUs = now;
+
     // Queue the frame and possibly wake up the render thread
-    m_FrameQueueLock.lock();
     if (m_VsyncSource != nullptr) {
-        dropFrameForEnqueue(m_PacingQueue);
-        m_PacingQueue.enqueue(frame);
-        m_FrameQueueLock.unlock();
-        m_PacingQueueNotEmpty.wakeOne();
+        if (m_PacingQueue.count() >= m_MaxQueuedFrames || !m_PacingQueue.enqueue(frame)) {
+            // The V-sync source is stuck, so drop this frame
+            m_VideoStats->pacerDroppedFrames++;
+            m_FramePool->releaseFrame(frame);
+        }
     }
     else {
-        enqueueFrameForRenderingAndUnlock(frame);
+        enqueueFrameForRendering(frame);
     }
 }
@@ -2,56 +2,134 @@
 
 #include "../../decoder.h"
 #include "../renderer.h"
+#include "../../framepool.h"
+#include "spscqueue.h"
 
 #include <QQueue>
-#include <QMutex>
-#include <QWaitCondition>
+#include <QThreadPool>
+
+// Limit the number of queued frames to prevent excessive memory consumption
+// if the V-Sync source or renderer is blocked for a while. The frame drop
+// targets never keep more than 3 frames queued, and every frame held here
+// pins a decoder surface. Must be a power of 2.
+#define MAX_QUEUED_FRAMES 4
+
+// Queue depth in low memory mode
+#define LOW_MEMORY_QUEUED_FRAMES 2
+
+// Power of 2 microsecond buckets for render handoff latency
+#define HANDOFF_HISTOGRAM_BUCKETS 24
 
 class IVsyncSource {
 public:
     virtual ~IVsyncSource() {}
     virtual bool initialize(SDL_Window* window, int displayFps) = 0;
+
+    // Returns the refresh rate reported by the V-sync source itself
+    // after initialize(), or 0 to keep using the SDL display mode.
+    virtual int getDisplayFps() { return 0; }
+
+#ifdef Q_OS_UNIX
+protected:
+    // Converts the CLOCK_MONOTONIC time of the last V-sync into the
+    // predicted time of the next V-sync on the StreamUtils::getTimeUs() clock
+    static Uint64 getNextVsyncTimeUs(Uint64 lastVsyncMonotonicUs, int displayFps);
+#endif
 };
 
 class Pacer
 {
 public:
-    Pacer(IFFmpegRenderer* renderer, PVIDEO_STATS videoStats);
+    Pacer(IFFmpegRenderer* renderer, FramePool* framePool, PVIDEO_STATS videoStats);
 
     ~Pacer();
 
     void submitFrame(AVFrame* frame);
 
-    bool initialize(SDL_Window* window, int maxVideoFps, bool enablePacing);
+    bool initialize(SDL_Window* window, int maxVideoFps, bool enablePacing,
+                    StreamingPreferences::PacingMode pacingMode);
 
-    void vsyncCallback(int timeUntilNextVsyncMillis);
+    // nextVsyncTimeUs is the predicted time of the next V-sync
+    // on the StreamUtils::getTimeUs() clock
+    void vsyncCallback(Uint64 nextVsyncTimeUs);
 
     void renderOnMainThread();
 
+    // The next frame rendered is saved on a worker thread
+    void requestScreenshot();
+
+    // Most frames the Pacer can hold at once: both queues full plus
+    // the frame being rendered. This is lower in low memory mode.
+    static int getMaxHeldFrames();
+
 private:
     static int renderThread(void* context);
 
-    void enqueueFrameForRenderingAndUnlock(AVFrame* frame);
+    void enqueueFrameForRendering(AVFrame* frame);
+
+    void renderLastFrame();
+
+    void renderFrame(AVFrame* frame, Uint64 enqueueTime);
+
+    void takeScreenshot(AVFrame* frame);
 
-    void renderLastFrameAndUnlock();
+    void logHandoffLatency();
 
-    void renderFrame(AVFrame* frame);
+    int getAdaptiveFrameDropTarget();
 
-    void dropFrameForEnqueue(QQueue<AVFrame*>& queue);
+    Uint64 getAdaptiveRenderSlackUs();
 
-    QQueue<AVFrame*> m_RenderQueue;
-    QQueue<AVFrame*> m_PacingQueue;
+    void renderJustInTime(Uint64 nextVsyncTimeUs);
+
+    Uint64 getJustInTimeLeadUs();
+
+#if defined(Q_OS_UNIX) && !defined(Q_OS_DARWIN)
+    IVsyncSource* createUnixVsyncSource(SDL_Window* window);
+#endif
+
+    // The pacing queue is fed by the decoder and drained by the V-sync
+    // source. The render queue is fed by the V-sync source (or the decoder
+    // without one) and drained by the render thread (or main thread).
+    struct RenderQueueEntry {
+        AVFrame* frame;
+        Uint64 enqueueTime;
+    };
+
+    SpscQueue<AVFrame*, MAX_QUEUED_FRAMES> m_PacingQueue;
+    SpscQueue<RenderQueueEntry, MAX_QUEUED_FRAMES> m_RenderQueue;
     QQueue<int> m_PacingQueueHistory;
     QQueue<int> m_RenderQueueHistory;
-    QMutex m_FrameQueueLock;
-    QWaitCondition m_RenderQueueNotEmpty;
-    QWaitCondition m_PacingQueueNotEmpty;
+    uint32_t m_HandoffHistogram[HANDOFF_HISTOGRAM_BUCKETS];
     SDL_Thread* m_RenderThread;
-    bool m_Stopping;
+    SDL_atomic_t m_Stopping;
 
     IVsyncSource* m_VsyncSource;
     IFFmpegRenderer* m_VsyncRenderer;
+    FramePool* m_FramePool;
     int m_MaxVideoFps;
     int m_DisplayFps;
     PVIDEO_STATS m_VideoStats;
+
+    // Each queue holds at most this many frames, which may be fewer
+    // than its capacity
+    int m_MaxQueuedFrames;
+
+    // Measurements for the adaptive pacing modes
+    StreamingPreferences::PacingMode m_PacingMode;
+    Uint64 m_LastSubmitTimeUs;
+    SDL_atomic_t m_ArrivalJitterUs;
+    SDL_atomic_t m_RenderTimeUs;
+    SDL_atomic_t m_RenderTimeDevUs;
+
+    // Owned by whichever thread renders
+    Uint64 m_LastPresentLatencyUs;
+
+    // Time from handing a frame to the renderer until it's presented, for
+    // the just in time mode. The 99th percentile of each window of
+    // samples is published for the V-sync thread.
+    FrameTimeHistogram m_RenderCostHistogram;
+    SDL_atomic_t m_RenderCostP99Us;
+
+    SDL_atomic_t m_ScreenshotRequested;
+    QThreadPool m_ScreenshotPool;
 };
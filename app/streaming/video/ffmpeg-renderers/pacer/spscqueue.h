@@ -0,0 +1,104 @@
+#pragma once
+
+#include <SDL.h>
+
+// A bounded lock-free queue for exactly one producer thread and one
+// consumer thread. The producer never blocks, and the consumer can
+// sleep on a semaphore until the producer publishes an item.
+// Capacity must be a power of 2.
+template <typename T, int Capacity>
+class SpscQueue
+{
+public:
+    SpscQueue()
+    {
+        SDL_AtomicSet(&m_Head, 0);
+        SDL_AtomicSet(&m_Tail, 0);
+        SDL_AtomicSet(&m_StopWaiting, 0);
+        m_ItemsAvailable = SDL_CreateSemaphore(0);
+    }
+
+    ~SpscQueue()
+    {
+        SDL_DestroySemaphore(m_ItemsAvailable);
+    }
+
+    // Producer only. Returns false if the queue is full.
+    bool enqueue(const T& item)
+    {
+        unsigned int head = (unsigned int)SDL_AtomicGet(&m_Head);
+        if (head - (unsigned int)SDL_AtomicGet(&m_Tail) == Capacity) {
+            return false;
+        }
+
+        // The slot at head is owned by the producer until we publish it
+        m_Items[head % Capacity] = item;
+        SDL_AtomicSet(&m_Head, (int)(head + 1));
+
+        SDL_SemPost(m_ItemsAvailable);
+        return true;
+    }
+
+    // Consumer only. Returns false if the queue is empty.
+    bool dequeue(T& item)
+    {
+        unsigned int tail = (unsigned int)SDL_AtomicGet(&m_Tail);
+        if (tail == (unsigned int)SDL_AtomicGet(&m_Head)) {
+            return false;
+        }
+
+        item = m_Items[tail % Capacity];
+
+        // Return this slot to the producer
+        SDL_AtomicSet(&m_Tail, (int)(tail + 1));
+        return true;
+    }
+
+    // Exact when called by the consumer, a lower bound otherwise
+    int count()
+    {
+        return (int)((unsigned int)SDL_AtomicGet(&m_Head) - (unsigned int)SDL_AtomicGet(&m_Tail));
+    }
+
+    bool isEmpty()
+    {
+        return count() == 0;
+    }
+
+    // Consumer only. Waits up to timeoutMs (or forever if negative) for
+    // the queue to become non-empty or for stopWaiting() to be called.
+    // Returns true if the queue is non-empty.
+    bool waitForItems(int timeoutMs)
+    {
+        // Discard wakeups for items we've already consumed
+        while (SDL_SemTryWait(m_ItemsAvailable) == 0);
+
+        if (!isEmpty() || SDL_AtomicGet(&m_StopWaiting)) {
+            return !isEmpty();
+        }
+
+        if (timeoutMs < 0) {
+            SDL_SemWait(m_ItemsAvailable);
+        }
+        else {
+            SDL_SemWaitTimeout(m_ItemsAvailable, (Uint32)timeoutMs);
+        }
+
+        return !isEmpty();
+    }
+
+    // Wakes the consumer from waitForItems() without publishing an item.
+    // Any later calls to waitForItems() will return immediately.
+    void stopWaiting()
+    {
+        SDL_AtomicSet(&m_StopWaiting, 1);
+        SDL_SemPost(m_ItemsAvailable);
+    }
+
+private:
+    T m_Items[Capacity];
+    SDL_atomic_t m_Head;
+    SDL_atomic_t m_Tail;
+    SDL_atomic_t m_StopWaiting;
+    SDL_sem* m_ItemsAvailable;
+};
@@ -0,0 +1,170 @@
+#include "waylandvsyncsource.h"
+#include "streaming/streamutils.h"
+#include "streaming/threadplacement.h"
+
+#include <poll.h>
+
+#include <SDL_syswm.h>
+
+const struct wl_callback_listener WaylandVsyncSource::k_FrameListener = {
+    WaylandVsyncSource::frameDone
+};
+
+WaylandVsyncSource::WaylandVsyncSource(Pacer* pacer) :
+    m_Pacer(pacer),
+    m_Thread(nullptr),
+    m_Display(nullptr),
+    m_Queue(nullptr),
+    m_Surface(nullptr),
+    m_FrameCallback(nullptr)
+{
+    SDL_AtomicSet(&m_Stopping, 0);
+}
+
+WaylandVsyncSource::~WaylandVsyncSource()
+{
+    if (m_Thread != nullptr) {
+        // The thread never waits longer than a couple of frames
+        SDL_AtomicSet(&m_Stopping, 1);
+        SDL_WaitThread(m_Thread, nullptr);
+    }
+
+    if (m_FrameCallback != nullptr) {
+        wl_callback_destroy(m_FrameCallback);
+    }
+
+    if (m_Surface != nullptr) {
+        wl_proxy_wrapper_destroy(m_Surface);
+    }
+
+    if (m_Queue != nullptr) {
+        wl_event_queue_destroy(m_Queue);
+    }
+}
+
+bool WaylandVsyncSource::initialize(SDL_Window* window, int displayFps)
+{
+    SDL_SysWMinfo info;
+
+    SDL_VERSION(&info.version);
+
+    if (!SDL_GetWindowWMInfo(window, &info)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "SDL_GetWindowWMInfo() failed: %s",
+                     SDL_GetError());
+        return false;
+    }
+
+    SDL_assert(info.subsystem == SDL_SYSWM_WAYLAND);
+
+    m_DisplayFps = displayFps;
+    m_Display = info.info.wl.display;
+
+    // Frame callbacks are dispatched on our own queue through a
+    // wrapper of SDL's surface, so SDL never sees or steals them.
+    m_Queue = wl_display_create_queue(m_Display);
+    if (m_Queue == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "wl_display_create_queue() failed");
+        return false;
+    }
+
+    m_Surface = reinterpret_cast<struct wl_surface*>(wl_proxy_create_wrapper(info.info.wl.surface));
+    if (m_Surface == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "wl_proxy_create_wrapper() failed");
+        return false;
+    }
+
+    wl_proxy_set_queue(reinterpret_cast<struct wl_proxy*>(m_Surface), m_Queue);
+
+    m_Thread = SDL_CreateThread(vsyncThread, "WaylandVsync", this);
+    if (m_Thread == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unable to create Wayland V-sync thread: %s",
+                     SDL_GetError());
+        return false;
+    }
+
+    return true;
+}
+
+void WaylandVsyncSource::frameDone(void* data, struct wl_callback* callback, uint32_t)
+{
+    WaylandVsyncSource* me = reinterpret_cast<WaylandVsyncSource*>(data);
+
+    SDL_assert(callback == me->m_FrameCallback);
+
+    wl_callback_destroy(callback);
+    me->m_FrameCallback = nullptr;
+}
+
+bool WaylandVsyncSource::waitForFrameDone(int timeoutMs)
+{
+    Uint32 startTime = SDL_GetTicks();
+
+    while (m_FrameCallback != nullptr) {
+        if (wl_display_prepare_read_queue(m_Display, m_Queue) != 0) {
+            // Events for our queue were already read by another thread
+            wl_display_dispatch_queue_pending(m_Display, m_Queue);
+            continue;
+        }
+
+        wl_display_flush(m_Display);
+
+        struct pollfd pfd;
+        pfd.fd = wl_display_get_fd(m_Display);
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+
+        int remainingMs = timeoutMs - (int)(SDL_GetTicks() - startTime);
+        if (remainingMs <= 0 || poll(&pfd, 1, remainingMs) <= 0) {
+            wl_display_cancel_read(m_Display);
+            return false;
+        }
+
+        wl_display_read_events(m_Display);
+        wl_display_dispatch_queue_pending(m_Display, m_Queue);
+    }
+
+    return true;
+}
+
+int WaylandVsyncSource::vsyncThread(void* context)
+{
+    WaylandVsyncSource* me = reinterpret_cast<WaylandVsyncSource*>(context);
+    Uint64 periodUs = 1000000 / me->m_DisplayFps;
+    Uint64 lastVsyncTimeUs = 0;
+
+    // Frame callbacks only fire after a commit, so we can't wait for them
+    // forever when the renderer had no new frame to show last V-sync.
+    int timeoutMs = 1000 / me->m_DisplayFps + 2;
+
+    ThreadPlacement::applyToCurrentThread(ThreadPlacement::TR_VSYNC);
+
+    while (SDL_AtomicGet(&me->m_Stopping) == 0) {
+        if (me->m_FrameCallback == nullptr) {
+            // This applies to the renderer's next commit of the surface
+            me->m_FrameCallback = wl_surface_frame(me->m_Surface);
+            wl_callback_add_listener(me->m_FrameCallback, &k_FrameListener, me);
+            wl_display_flush(me->m_Display);
+        }
+
+        // The compositor sends the callback when it's a good time to draw the
+        // next frame, which closely follows its own repaint on V-blank.
+        bool frameDone = me->waitForFrameDone(timeoutMs);
+        Uint64 now = StreamUtils::getTimeUs();
+
+        if (frameDone || lastVsyncTimeUs == 0) {
+            lastVsyncTimeUs = now;
+        }
+        else {
+            // No callback came, so keep ticking in phase with the last one
+            lastVsyncTimeUs += ((now - lastVsyncTimeUs) / periodUs) * periodUs;
+        }
+
+        me->m_Pacer->vsyncCallback(lastVsyncTimeUs + periodUs);
+    }
+
+    return 0;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "pacer.h"
+
+#include <wayland-client.h>
+
+class WaylandVsyncSource : public IVsyncSource
+{
+public:
+    WaylandVsyncSource(Pacer* pacer);
+
+    virtual ~WaylandVsyncSource();
+
+    virtual bool initialize(SDL_Window* window, int displayFps);
+
+private:
+    static int vsyncThread(void* context);
+
+    static void frameDone(void* data, struct wl_callback* callback, uint32_t time);
+
+    bool waitForFrameDone(int timeoutMs);
+
+    static const struct wl_callback_listener k_FrameListener;
+
+    Pacer* m_Pacer;
+    SDL_Thread* m_Thread;
+    SDL_atomic_t m_Stopping;
+    struct wl_display* m_Display;
+    struct wl_event_queue* m_Queue;
+    struct wl_surface* m_Surface;
+    struct wl_callback* m_FrameCallback;
+    int m_DisplayFps;
+};
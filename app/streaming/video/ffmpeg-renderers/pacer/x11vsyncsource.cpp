@@ -0,0 +1,159 @@
+#include "x11vsyncsource.h"
+#include "streaming/threadplacement.h"
+
+#include <xcb/present.h>
+
+#include <SDL_syswm.h>
+
+X11VsyncSource::X11VsyncSource(Pacer* pacer) :
+    m_Pacer(pacer),
+    m_Thread(nullptr),
+    m_Connection(nullptr),
+    m_SpecialEvent(nullptr),
+    m_Window(XCB_NONE),
+    m_EventId(0)
+{
+    SDL_AtomicSet(&m_Stopping, 0);
+}
+
+X11VsyncSource::~X11VsyncSource()
+{
+    if (m_Thread != nullptr) {
+        // The thread will exit after the next MSC notification
+        SDL_AtomicSet(&m_Stopping, 1);
+        SDL_WaitThread(m_Thread, nullptr);
+    }
+
+    if (m_SpecialEvent != nullptr) {
+        xcb_present_select_input(m_Connection, m_EventId, m_Window, XCB_PRESENT_EVENT_MASK_NO_EVENT);
+        xcb_unregister_for_special_event(m_Connection, m_SpecialEvent);
+    }
+
+    if (m_Connection != nullptr) {
+        xcb_disconnect(m_Connection);
+    }
+}
+
+bool X11VsyncSource::initialize(SDL_Window* window, int displayFps)
+{
+    SDL_SysWMinfo info;
+
+    SDL_VERSION(&info.version);
+
+    if (!SDL_GetWindowWMInfo(window, &info)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "SDL_GetWindowWMInfo() failed: %s",
+                     SDL_GetError());
+        return false;
+    }
+
+    SDL_assert(info.subsystem == SDL_SYSWM_X11);
+
+    m_DisplayFps = displayFps;
+    m_Window = (xcb_window_t)info.info.x11.window;
+
+    // Use a private connection so our blocking waits never stall
+    // SDL's or the renderer's use of the display connection.
+    m_Connection = xcb_connect(nullptr, nullptr);
+    if (xcb_connection_has_error(m_Connection)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unable to open XCB connection for V-sync");
+        return false;
+    }
+
+    xcb_present_query_version_reply_t* versionReply =
+            xcb_present_query_version_reply(m_Connection,
+                                            xcb_present_query_version(m_Connection,
+                                                                      XCB_PRESENT_MAJOR_VERSION,
+                                                                      XCB_PRESENT_MINOR_VERSION),
+                                            nullptr);
+    if (versionReply == nullptr) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "X server doesn't support the Present extension");
+        return false;
+    }
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "X11 Present version: %u.%u",
+                versionReply->major_version,
+                versionReply->minor_version);
+    free(versionReply);
+
+    m_EventId = xcb_generate_id(m_Connection);
+    xcb_void_cookie_t cookie = xcb_present_select_input_checked(m_Connection, m_EventId, m_Window,
+                                                                XCB_PRESENT_EVENT_MASK_COMPLETE_NOTIFY);
+    xcb_generic_error_t* error = xcb_request_check(m_Connection, cookie);
+    if (error != nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "xcb_present_select_input() failed: %d",
+                     error->error_code);
+        free(error);
+        return false;
+    }
+
+    m_SpecialEvent = xcb_register_for_special_xge(m_Connection, &xcb_present_id, m_EventId, nullptr);
+    if (m_SpecialEvent == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "xcb_register_for_special_xge() failed");
+        return false;
+    }
+
+    m_Thread = SDL_CreateThread(vsyncThread, "X11Vsync", this);
+    if (m_Thread == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unable to create X11 V-sync thread: %s",
+                     SDL_GetError());
+        return false;
+    }
+
+    return true;
+}
+
+int X11VsyncSource::vsyncThread(void* context)
+{
+    X11VsyncSource* me = reinterpret_cast<X11VsyncSource*>(context);
+    uint32_t serial = 0;
+
+    ThreadPlacement::applyToCurrentThread(ThreadPlacement::TR_VSYNC);
+
+    while (SDL_AtomicGet(&me->m_Stopping) == 0) {
+        // Ask for a notification at the next MSC (V-blank) of the
+        // CRTC that the window is on. A target of 0 with a divisor
+        // of 1 always means the next V-blank.
+        xcb_present_notify_msc(me->m_Connection, me->m_Window, ++serial, 0, 1, 0);
+        xcb_flush(me->m_Connection);
+
+        xcb_generic_event_t* event;
+        for (;;) {
+            event = xcb_wait_for_special_event(me->m_Connection, me->m_SpecialEvent);
+            if (event == nullptr) {
+                break;
+            }
+
+            xcb_present_complete_notify_event_t* notify =
+                    reinterpret_cast<xcb_present_complete_notify_event_t*>(event);
+            if (notify->evtype == XCB_PRESENT_EVENT_COMPLETE_NOTIFY &&
+                    notify->kind == XCB_PRESENT_COMPLETE_KIND_NOTIFY_MSC &&
+                    notify->serial == serial) {
+                break;
+            }
+
+            // Completions of presents from the renderer or stale MSC requests
+            free(event);
+        }
+
+        if (event == nullptr) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "X11 V-sync connection was lost");
+            break;
+        }
+
+        // UST is the CLOCK_MONOTONIC time of the V-blank in microseconds
+        Uint64 vsyncTimeUs = reinterpret_cast<xcb_present_complete_notify_event_t*>(event)->ust;
+        free(event);
+
+        me->m_Pacer->vsyncCallback(getNextVsyncTimeUs(vsyncTimeUs, me->m_DisplayFps));
+    }
+
+    return 0;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "pacer.h"
+
+#include <xcb/xcb.h>
+
+class X11VsyncSource : public IVsyncSource
+{
+public:
+    X11VsyncSource(Pacer* pacer);
+
+    virtual ~X11VsyncSource();
+
+    virtual bool initialize(SDL_Window* window, int displayFps);
+
+private:
+    static int vsyncThread(void* context);
+
+    Pacer* m_Pacer;
+    SDL_Thread* m_Thread;
+    SDL_atomic_t m_Stopping;
+    xcb_connection_t* m_Connection;
+    xcb_special_event_t* m_SpecialEvent;
+    xcb_window_t m_Window;
+    uint32_t m_EventId;
+    int m_DisplayFps;
+};
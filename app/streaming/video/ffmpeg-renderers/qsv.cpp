@@ -0,0 +1,204 @@
+#include "qsv.h"
+#include "pacer/pacer.h"
+
+extern "C" {
+#include <libavutil/hwcontext_qsv.h>
+#include <libavutil/opt.h>
+}
+
+// Frames the decoder may work on ahead of the one it returns. The default
+// of 4 buys throughput with a frame of latency each.
+#define QSV_ASYNC_DEPTH 1
+
+// The media SDK needs every surface up front: the largest DPB the codecs
+// allow, the frames decoding ahead, and the frames queued for rendering
+#define QSV_SURFACE_COUNT (16 + QSV_ASYNC_DEPTH + Pacer::getMaxHeldFrames() + 1)
+
+QSVRenderer::QSVRenderer()
+    : m_VaapiRenderer(nullptr),
+      m_HwContext(nullptr)
+{
+
+}
+
+QSVRenderer::~QSVRenderer()
+{
+    // The QSV device keeps its own reference to the VAAPI device
+    av_buffer_unref(&m_HwContext);
+    delete m_VaapiRenderer;
+}
+
+bool QSVRenderer::initialize(PDECODER_PARAMETERS params)
+{
+    m_VideoFormat = params->videoFormat;
+    m_VideoWidth = params->width;
+    m_VideoHeight = params->height;
+
+    // This opens (or picks up) the VAAPI device and rejects the drivers
+    // that our VAAPI renderer can't work with
+    m_VaapiRenderer = new VAAPIRenderer();
+    if (!m_VaapiRenderer->initialize(params)) {
+        return false;
+    }
+
+    int err = av_hwdevice_ctx_create_derived(&m_HwContext, AV_HWDEVICE_TYPE_QSV,
+                                             m_VaapiRenderer->getHwDeviceContext(), 0);
+    if (err < 0) {
+        char errorstring[512];
+        av_strerror(err, errorstring, sizeof(errorstring));
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Failed to create QSV device from VAAPI: %s",
+                    errorstring);
+        return false;
+    }
+
+    return true;
+}
+
+bool QSVRenderer::prepareDecoderContext(AVCodecContext* context)
+{
+    // The QSV decoders don't size a pool from the device themselves, so
+    // we give them one of decoder target surfaces in video memory
+    AVBufferRef* framesRef = av_hwframe_ctx_alloc(m_HwContext);
+    if (framesRef == nullptr) {
+        return false;
+    }
+
+    AVHWFramesContext* framesContext = (AVHWFramesContext*)framesRef->data;
+    AVQSVFramesContext* qsvFramesContext = (AVQSVFramesContext*)framesContext->hwctx;
+
+    framesContext->format = AV_PIX_FMT_QSV;
+    framesContext->sw_format = (m_VideoFormat == VIDEO_FORMAT_H265_MAIN10) ? AV_PIX_FMT_P010 : AV_PIX_FMT_NV12;
+
+    // Surfaces are allocated in whole macroblocks (HEVC's are up to 32x32)
+    framesContext->width = FFALIGN(m_VideoWidth, 32);
+    framesContext->height = FFALIGN(m_VideoHeight, 32);
+    framesContext->initial_pool_size = QSV_SURFACE_COUNT;
+    qsvFramesContext->frame_type = MFX_MEMTYPE_VIDEO_MEMORY_DECODER_TARGET;
+
+    int err = av_hwframe_ctx_init(framesRef);
+    if (err < 0) {
+        char errorstring[512];
+        av_strerror(err, errorstring, sizeof(errorstring));
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Failed to create QSV frames: %s",
+                     errorstring);
+        av_buffer_unref(&framesRef);
+        return false;
+    }
+
+    context->hw_device_ctx = av_buffer_ref(m_HwContext);
+    context->hw_frames_ctx = framesRef;
+
+    // Return each frame as soon as it's decoded
+    av_opt_set_int(context, "async_depth", QSV_ASYNC_DEPTH, AV_OPT_SEARCH_CHILDREN);
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Using QSV accelerated renderer on %s",
+                SDL_GetCurrentVideoDriver());
+
+    return true;
+}
+
+bool QSVRenderer::mapVaapiFrame(AVFrame* frame, AVFrame* vaapiFrame)
+{
+    // This only looks up the VAAPI surface under the QSV surface
+    vaapiFrame->format = AV_PIX_FMT_VAAPI;
+    int err = av_hwframe_map(vaapiFrame, frame, AV_HWFRAME_MAP_READ | AV_HWFRAME_MAP_DIRECT);
+    if (err < 0) {
+        char errorstring[512];
+        av_strerror(err, errorstring, sizeof(errorstring));
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Failed to map QSV frame to VAAPI: %s",
+                     errorstring);
+        return false;
+    }
+
+    return true;
+}
+
+void QSVRenderer::renderFrame(AVFrame* frame)
+{
+    AVFrame* vaapiFrame = av_frame_alloc();
+    if (vaapiFrame == nullptr) {
+        return;
+    }
+
+    if (mapVaapiFrame(frame, vaapiFrame)) {
+        m_VaapiRenderer->renderFrame(vaapiFrame);
+    }
+
+    av_frame_free(&vaapiFrame);
+}
+
+bool QSVRenderer::needsTestFrame()
+{
+    // We need a test frame to see if the media SDK supports
+    // the profile used for streaming on this GPU
+    return true;
+}
+
+bool QSVRenderer::isDirectRenderingSupported()
+{
+    return m_VaapiRenderer->isDirectRenderingSupported();
+}
+
+bool QSVRenderer::notifyWindowResized(PDECODER_PARAMETERS params)
+{
+    return m_VaapiRenderer->notifyWindowResized(params);
+}
+
+bool QSVRenderer::canExportDrmPrime()
+{
+    return m_VaapiRenderer->canExportDrmPrime();
+}
+
+bool QSVRenderer::mapDrmPrimeFrame(AVFrame* frame, AVDRMFrameDescriptor* drmFrame)
+{
+    AVFrame* vaapiFrame = av_frame_alloc();
+    if (vaapiFrame == nullptr) {
+        return false;
+    }
+
+    // The DMA-BUFs stay valid after the mapping is gone, since the
+    // QSV frame holds onto the surface
+    bool ret = mapVaapiFrame(frame, vaapiFrame) &&
+            m_VaapiRenderer->mapDrmPrimeFrame(vaapiFrame, drmFrame);
+
+    av_frame_free(&vaapiFrame);
+    return ret;
+}
+
+void QSVRenderer::unmapDrmPrimeFrame(AVDRMFrameDescriptor* drmFrame)
+{
+    m_VaapiRenderer->unmapDrmPrimeFrame(drmFrame);
+}
+
+#ifdef HAVE_EGL
+
+bool QSVRenderer::canExportEGL()
+{
+    return m_VaapiRenderer->canExportEGL();
+}
+
+ssize_t QSVRenderer::exportEGLImages(AVFrame* frame, EGLDisplay dpy, EGLImageKHR images[EGL_MAX_PLANES])
+{
+    AVFrame* vaapiFrame = av_frame_alloc();
+    if (vaapiFrame == nullptr) {
+        return -1;
+    }
+
+    // Like the DMA-BUFs, the images live on without the mapping
+    ssize_t ret = mapVaapiFrame(frame, vaapiFrame) ?
+                m_VaapiRenderer->exportEGLImages(vaapiFrame, dpy, images) : -1;
+
+    av_frame_free(&vaapiFrame);
+    return ret;
+}
+
+void QSVRenderer::freeEGLImages(EGLDisplay dpy, EGLImageKHR images[EGL_MAX_PLANES])
+{
+    m_VaapiRenderer->freeEGLImages(dpy, images);
+}
+
+#endif
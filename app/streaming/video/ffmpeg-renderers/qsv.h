@@ -0,0 +1,40 @@
+#pragma once
+
+#include "renderer.h"
+#include "vaapi.h"
+
+// Decodes with Intel's Quick Sync decoders (h264_qsv and hevc_qsv) rather
+// than the VAAPI hwaccel. The QSV device is derived from a VAAPI device, so
+// the decoded surfaces are VAAPI surfaces underneath. Each frame is mapped
+// back to its VAAPI surface and handed to a VAAPIRenderer, which presents
+// or exports it just like its own frames.
+class QSVRenderer : public IFFmpegRenderer
+{
+public:
+    QSVRenderer();
+    virtual ~QSVRenderer() override;
+    virtual bool initialize(PDECODER_PARAMETERS params) override;
+    virtual bool prepareDecoderContext(AVCodecContext* context) override;
+    virtual void renderFrame(AVFrame* frame) override;
+    virtual bool needsTestFrame() override;
+    virtual bool isDirectRenderingSupported() override;
+    virtual bool notifyWindowResized(PDECODER_PARAMETERS params) override;
+    virtual bool canExportDrmPrime() override;
+    virtual bool mapDrmPrimeFrame(AVFrame* frame, AVDRMFrameDescriptor* drmFrame) override;
+    virtual void unmapDrmPrimeFrame(AVDRMFrameDescriptor* drmFrame) override;
+
+#ifdef HAVE_EGL
+    virtual bool canExportEGL() override;
+    virtual ssize_t exportEGLImages(AVFrame* frame, EGLDisplay dpy, EGLImageKHR images[EGL_MAX_PLANES]) override;
+    virtual void freeEGLImages(EGLDisplay dpy, EGLImageKHR images[EGL_MAX_PLANES]) override;
+#endif
+
+private:
+    bool mapVaapiFrame(AVFrame* frame, AVFrame* vaapiFrame);
+
+    VAAPIRenderer* m_VaapiRenderer;
+    AVBufferRef* m_HwContext;
+    int m_VideoFormat;
+    int m_VideoWidth;
+    int m_VideoHeight;
+};
@@ -7,8 +7,21 @@
 
 extern "C" {
 #include <libavcodec/avcodec.h>
+#include <libavutil/hwcontext_drm.h>
 }
 
+#ifdef HAVE_EGL
+// Keep X11 out of the EGL headers, since its macros conflict with Qt
+#define MESA_EGL_NO_X11_HEADERS
+#define EGL_NO_X11
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GLES2/gl2.h>
+
+// NV12 and P010 frames are exported as separate Y and UV layers
+#define EGL_MAX_PLANES 4
+#endif
+
 class IFFmpegRenderer : public Overlay::IOverlayRenderer {
 public:
     enum FramePacingConstraint {
@@ -41,11 +54,160 @@ public:
         return true;
     }
 
+    // Blocks until the renderer can accept another frame without queuing
+    // it behind others. Called before the Pacer picks the frame to render.
+    virtual void waitToRender() {}
+
+    // Called on the decoder thread for each frame before it's queued for
+    // rendering. Work that doesn't need the render thread, like reading a
+    // hardware frame back to system memory, can start here.
+    virtual void prepareFrame(AVFrame*) {}
+
+    // Returns the time between presenting and scanning out the most
+    // recent frame that reached the display since the last call, or 0
+    // if the renderer can't measure it or no new frame was displayed.
+    virtual Uint64 takePresentLatencyUs() {
+        return 0;
+    }
+
+    // Returns the StreamUtils::getTimeUs() time of the latest V-blank at
+    // which one of our frames reached the display, so a timer based V-sync
+    // source can follow the display's phase. Called from any thread.
+    virtual bool getLastVblankTimeUs(Uint64&) {
+        // No presentation feedback by default
+        return false;
+    }
+
+    // Returns a short description of how frames reach the display
+    // for the debug overlay, or nullptr if there is only one way.
+    virtual const char* getPresentationPath() {
+        return nullptr;
+    }
+
+    // Returns the name of the optional upscaling pass for the debug overlay,
+    // or nullptr if it isn't running. The average cost is the GPU time per
+    // frame, or -1 if the renderer hasn't measured it (yet).
+    virtual const char* getUpscalerStats(int*, int*) {
+        return nullptr;
+    }
+
     virtual bool isDirectRenderingSupported() {
         // The renderer can render directly to the display
         return true;
     }
 
+    // Rebuilds only the objects used to present frames (swap chain,
+    // presentation queue, display plane, etc.) for the current state
+    // of the window, leaving any objects used by the decoder intact.
+    virtual bool reinitializePresentation(PDECODER_PARAMETERS) {
+        // Presentation can't be rebuilt independently by default
+        return false;
+    }
+
+    // Called on the main thread when the window was resized on the same
+    // display. Frames may be rendering concurrently on another thread.
+    virtual bool notifyWindowResized(PDECODER_PARAMETERS) {
+        // The window size is baked into presentation by default
+        return false;
+    }
+
+    // Returns the DRM device and CRTC index that the renderer scans out
+    // to, if any, so the pacer can wait for V-blank on that CRTC.
+    virtual bool getDrmCrtc(int&, int&) {
+        // Not a KMS renderer by default
+        return false;
+    }
+
+    // Called by the pacer when its DRM V-sync source starts or stops
+    // reading the events on the fd returned by getDrmCrtc()
+    virtual void setDrmEventsHandledExternally(bool) {}
+
+    // Whether getLastVblankTimeUs() comes from the display server's
+    // presentation feedback for our own frames, so a timer V-sync source
+    // locked to it beats any that the window system provides
+    virtual bool hasPresentationFeedback() {
+        return false;
+    }
+
+    // Whether the renderer can describe its frames as DMA-BUFs with
+    // mapDrmPrimeFrame(), so a frontend renderer can hand them to the
+    // display server or KMS without a copy
+    virtual bool canExportDrmPrime() {
+        return false;
+    }
+
+    // Fills the descriptor with the DMA-BUFs of the frame as a single
+    // layer holding every plane. The frame must stay referenced while the
+    // DMA-BUFs are in use, and the FDs must be closed with
+    // unmapDrmPrimeFrame().
+    virtual bool mapDrmPrimeFrame(AVFrame*, AVDRMFrameDescriptor*) {
+        return false;
+    }
+
+    virtual void unmapDrmPrimeFrame(AVDRMFrameDescriptor*) {}
+
+#ifdef HAVE_EGL
+    // Whether the renderer can export its frames as EGLImages so the
+    // EGL frontend renderer can draw them without a copy
+    virtual bool canExportEGL() {
+        return false;
+    }
+
+    // Creates an EGLImage for each plane of the frame, returning the number
+    // of images created or -1 on failure. The images must be released
+    // with freeEGLImages() after the frame has been drawn.
+    virtual ssize_t exportEGLImages(AVFrame*, EGLDisplay, EGLImageKHR[EGL_MAX_PLANES]) {
+        return -1;
+    }
+
+    virtual void freeEGLImages(EGLDisplay, EGLImageKHR[EGL_MAX_PLANES]) {
+        // Nothing to free by default
+    }
+
+    // Whether the renderer can copy its frames into the EGL frontend
+    // renderer's GL textures without leaving the GPU, for decoders
+    // whose frames can't be exported as EGLImages
+    virtual bool canCopyToGLTextures() {
+        return false;
+    }
+
+    // Registers the textures for the luma and chroma planes that
+    // copyToGLTextures() writes into. Their storage is already allocated
+    // for the stream's resolution. Called with the GL context current.
+    virtual bool registerGLTextures(const GLuint[2]) {
+        return false;
+    }
+
+    // Copies the frame's planes into the registered textures.
+    // Called with the GL context current.
+    virtual bool copyToGLTextures(AVFrame*) {
+        return false;
+    }
+
+    // Called with the GL context current before the textures are deleted
+    virtual void unregisterGLTextures() {}
+
+    // Whether the renderer can map its frames as a GL texture that it
+    // owns, already converted to RGB, for backends whose decoded surfaces
+    // can't be copied or exported as planes
+    virtual bool canMapGLTexture() {
+        return false;
+    }
+
+    // Binds the frame's RGB texture to GL_TEXTURE_2D on the active texture
+    // unit. The texture stays valid until unmapGLTexture(). Called with
+    // the GL context current.
+    virtual bool mapGLTexture(AVFrame*) {
+        return false;
+    }
+
+    // Called with the GL context current once the mapped frame is drawn
+    virtual void unmapGLTexture() {}
+
+    // Called with the GL context current before the context is destroyed
+    virtual void releaseGLTextures() {}
+#endif
+
     virtual enum AVPixelFormat getPreferredPixelFormat(int videoFormat) {
         // Planar YUV 4:2:0
         SDL_assert(videoFormat != VIDEO_FORMAT_H265_MAIN10);
@@ -56,4 +218,9 @@ public:
     virtual void notifyOverlayUpdated(Overlay::OverlayType) override {
         // Nothing
     }
+
+    virtual bool usesOverlaySurfaces() override {
+        // No overlay support by default
+        return false;
+    }
 };
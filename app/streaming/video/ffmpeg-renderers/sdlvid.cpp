@@ -1,29 +1,51 @@
 #include "sdlvid.h"
 
 #include "streaming/session.h"
+#include "streaming/cpudispatch.h"
+#include "streaming/video/framegraph.h"
 #include "path.h"
+#include "utils.h"
 
 #include <QDir>
 
 #include <Limelight.h>
 
+extern "C" {
+#include <libavutil/imgutils.h>
+}
+
+static void noopBufferFree(void*, uint8_t*)
+{
+    // The buffer is texture memory owned by SDL
+}
+
 SdlRenderer::SdlRenderer()
     : m_Renderer(nullptr),
-      m_Texture(nullptr),
+      m_TextureIndex(0),
       m_SwPixelFormat(AV_PIX_FMT_NONE),
+      m_DownloadPool(nullptr),
+      m_DownloadPoolBufferSize(0),
+      m_DownloadFrame(nullptr),
       m_FontData(Path::readDataFile("ModeSeven.ttf"))
 {
-    SDL_assert(TTF_WasInit() == 0);
+    SDL_zero(m_RendererName);
+    SDL_zero(m_PresentationPath);
+    SDL_AtomicSet(&m_Unscaled, 0);
+    SDL_zero(m_Textures);
+    SDL_zero(m_OverlayFonts);
+    SDL_zero(m_OverlayAtlases);
+    for (int i = 0; i < Overlay::OverlayMax; i++) {
+        SDL_AtomicSet(&m_OverlayDirty[i], 0);
+    }
+
+    // SDL_ttf reference counts TTF_Init(), so this is safe even if the
+    // OverlayManager has initialized it too.
     if (TTF_Init() != 0) {
         SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
                     "TTF_Init() failed: %s",
                     TTF_GetError());
         return;
     }
-
-    SDL_zero(m_OverlayFonts);
-    SDL_zero(m_OverlaySurfaces);
-    SDL_zero(m_OverlayTextures);
 }
 
 SdlRenderer::~SdlRenderer()
@@ -35,27 +57,28 @@ SdlRenderer::~SdlRenderer()
     }
 
     TTF_Quit();
-    SDL_assert(TTF_WasInit() == 0);
 
     for (int i = 0; i < Overlay::OverlayMax; i++) {
-        if (m_OverlayTextures[i] != nullptr) {
-            SDL_DestroyTexture(m_OverlayTextures[i]);
+        if (m_OverlayAtlases[i] != nullptr) {
+            SDL_DestroyTexture(m_OverlayAtlases[i]);
         }
     }
 
-    for (int i = 0; i < Overlay::OverlayMax; i++) {
-        if (m_OverlaySurfaces[i] != nullptr) {
-            SDL_FreeSurface(m_OverlaySurfaces[i]);
+    for (int i = 0; i < 2; i++) {
+        if (m_Textures[i] != nullptr) {
+            SDL_DestroyTexture(m_Textures[i]);
         }
     }
 
-    if (m_Texture != nullptr) {
-        SDL_DestroyTexture(m_Texture);
-    }
-
     if (m_Renderer != nullptr) {
         SDL_DestroyRenderer(m_Renderer);
     }
+
+    av_frame_free(&m_DownloadFrame);
+
+    // Buffers still held by queued frames keep the pool alive until
+    // they're released
+    av_buffer_pool_uninit(&m_DownloadPool);
 }
 
 bool SdlRenderer::prepareDecoderContext(AVCodecContext*)
@@ -68,45 +91,17 @@ bool SdlRenderer::prepareDecoderContext(AVCodecContext*)
     return true;
 }
 
-void SdlRenderer::notifyOverlayUpdated(Overlay::OverlayType type)
+enum AVPixelFormat SdlRenderer::getPreferredPixelFormat(int videoFormat)
 {
-    // Construct the required font to render the overlay
-    if (m_OverlayFonts[type] == nullptr) {
-        if (m_FontData.isEmpty()) {
-            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                         "SDL overlay font failed to load");
-            return;
-        }
-
-        // m_FontData must stay around until the font is closed
-        m_OverlayFonts[type] = TTF_OpenFontRW(SDL_RWFromConstMem(m_FontData.constData(), m_FontData.size()),
-                                              1,
-                                              Session::get()->getOverlayManager().getOverlayFontSize(type));
-        if (m_OverlayFonts[type] == nullptr) {
-            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
-                        "TTF_OpenFont() failed: %s",
-                        TTF_GetError());
-
-            // Can't proceed without a font
-            return;
-        }
-    }
-
-    SDL_Surface* oldSurface = (SDL_Surface*)SDL_AtomicGetPtr((void**)&m_OverlaySurfaces[type]);
-
-    // Free the old surface
-    if (oldSurface != nullptr && SDL_AtomicCASPtr((void**)&m_OverlaySurfaces[type], oldSurface, nullptr)) {
-        SDL_FreeSurface(oldSurface);
-    }
+    // 10-bit frames are converted to 8 bits as they're uploaded
+    return videoFormat == VIDEO_FORMAT_H265_MAIN10 ? AV_PIX_FMT_YUV420P10 : AV_PIX_FMT_YUV420P;
+}
 
-    if (Session::get()->getOverlayManager().isOverlayEnabled(type)) {
-        // The _Wrapped variant is required for line breaks to work
-        SDL_Surface* surface = TTF_RenderText_Blended_Wrapped(m_OverlayFonts[type],
-                                                              Session::get()->getOverlayManager().getOverlayText(type),
-                                                              Session::get()->getOverlayManager().getOverlayColor(type),
-                                                              1000);
-        SDL_AtomicSetPtr((void**)&m_OverlaySurfaces[type], surface);
-    }
+void SdlRenderer::notifyOverlayUpdated(Overlay::OverlayType type)
+{
+    // Text layout and drawing happen on the render thread against the
+    // glyph atlas, so all we need to do here is flag the overlay as stale.
+    SDL_AtomicSet(&m_OverlayDirty[type], 1);
 }
 
 bool SdlRenderer::isRenderThreadSupported()
@@ -118,7 +113,10 @@ bool SdlRenderer::isRenderThreadSupported()
                 "SDL renderer backend: %s",
                 info.name);
 
-    if (info.name != QString("direct3d")) {
+    // The Direct3D backends can present from any thread once they're
+    // created (with SDL_HINT_RENDER_DIRECT3D_THREADSAFE for D3D9). The
+    // OpenGL and Metal backends bind their contexts to the main thread.
+    if (info.name != QString("direct3d") && info.name != QString("direct3d11")) {
         SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
                     "SDL renderer backend requires main thread rendering");
         return false;
@@ -156,6 +154,11 @@ bool SdlRenderer::initialize(PDECODER_PARAMETERS params)
         return false;
     }
 
+    SDL_RendererInfo info;
+    if (SDL_GetRendererInfo(m_Renderer, &info) == 0) {
+        SDL_strlcpy(m_RendererName, info.name, sizeof(m_RendererName));
+    }
+
     // The window may be smaller than the stream size, so ensure our
     // logical rendering surface size is equal to the stream size
     SDL_RenderSetLogicalSize(m_Renderer, params->width, params->height);
@@ -177,49 +180,340 @@ bool SdlRenderer::initialize(PDECODER_PARAMETERS params)
     return true;
 }
 
-void SdlRenderer::renderOverlay(Overlay::OverlayType type)
+bool SdlRenderer::reinitializePresentation(PDECODER_PARAMETERS params)
 {
-    if (Session::get()->getOverlayManager().isOverlayEnabled(type)) {
-        // If a new surface has been created for updated overlay data, convert it into a texture.
-        // NB: We have to do this conversion at render-time because we can only interact
-        // with the renderer on a single thread.
-        SDL_Surface* surface = (SDL_Surface*)SDL_AtomicGetPtr((void**)&m_OverlaySurfaces[type]);
-        if (surface != nullptr && SDL_AtomicCASPtr((void**)&m_OverlaySurfaces[type], surface, nullptr)) {
-            if (m_OverlayTextures[type] != nullptr) {
-                SDL_DestroyTexture(m_OverlayTextures[type]);
-            }
+    // Textures belong to the old renderer, so they must go with it.
+    // The overlay fonts are not tied to the renderer, so the atlases
+    // will be rebuilt from them on the next overlay render.
+    for (int i = 0; i < Overlay::OverlayMax; i++) {
+        if (m_OverlayAtlases[i] != nullptr) {
+            SDL_DestroyTexture(m_OverlayAtlases[i]);
+            m_OverlayAtlases[i] = nullptr;
+        }
+        SDL_AtomicSet(&m_OverlayDirty[i], 1);
+    }
 
-            if (type == Overlay::OverlayStatusUpdate) {
-                // Bottom Left
-                int unused;
-                SDL_RenderGetLogicalSize(m_Renderer, &unused, &m_OverlayRects[type].y);
-                m_OverlayRects[type].x = 0;
-                m_OverlayRects[type].y -= surface->h;
-            }
-            else if (type == Overlay::OverlayDebug) {
-                // Top left
-                m_OverlayRects[type].x = 0;
-                m_OverlayRects[type].y = 0;
+    for (int i = 0; i < 2; i++) {
+        if (m_Textures[i] != nullptr) {
+            SDL_DestroyTexture(m_Textures[i]);
+            m_Textures[i] = nullptr;
+        }
+    }
+
+    if (m_Renderer != nullptr) {
+        SDL_DestroyRenderer(m_Renderer);
+        m_Renderer = nullptr;
+    }
+
+    return initialize(params);
+}
+
+bool SdlRenderer::notifyWindowResized(PDECODER_PARAMETERS)
+{
+    // SDL rescales the logical size to the new window size itself
+    return true;
+}
+
+const char* SdlRenderer::getPresentationPath()
+{
+    snprintf(m_PresentationPath, sizeof(m_PresentationPath), "SDL %s, %s",
+             m_RendererName, SDL_AtomicGet(&m_Unscaled) ? "unscaled" : "scaled");
+    return m_PresentationPath;
+}
+
+bool SdlRenderer::createOverlayAtlas(Overlay::OverlayType type)
+{
+    // Construct the required font to render the overlay
+    if (m_OverlayFonts[type] == nullptr) {
+        if (m_FontData.isEmpty()) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "SDL overlay font failed to load");
+            return false;
+        }
+
+        // m_FontData must stay around until the font is closed
+        m_OverlayFonts[type] = TTF_OpenFontRW(SDL_RWFromConstMem(m_FontData.constData(), m_FontData.size()),
+                                              1,
+                                              Session::get()->getOverlayManager().getOverlayFontSize(type));
+        if (m_OverlayFonts[type] == nullptr) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "TTF_OpenFont() failed: %s",
+                        TTF_GetError());
+
+            // Can't proceed without a font
+            return false;
+        }
+    }
+
+    TTF_Font* font = m_OverlayFonts[type];
+    SDL_Surface* glyphSurfaces[OVERLAY_ATLAS_GLYPH_COUNT] = {};
+    int cellWidth = 1;
+    int cellHeight = TTF_FontHeight(font);
+
+    // Render each glyph in white as its own one character string. Using the
+    // text renderer (rather than TTF_RenderGlyph_Blended) keeps every glyph
+    // surface aligned to the same baseline and line height. The overlay color
+    // is applied later using the atlas texture's color and alpha modulation.
+    for (int i = 0; i < OVERLAY_ATLAS_GLYPH_COUNT; i++) {
+        char text[2] = { (char)(OVERLAY_ATLAS_FIRST_GLYPH + i), 0 };
+        int advance;
+
+        if (TTF_GlyphMetrics(font, (Uint16)text[0], nullptr, nullptr, nullptr, nullptr, &advance) != 0) {
+            advance = 0;
+        }
+        m_OverlayGlyphs[type][i].advance = advance;
+
+        // Spaces have nothing to draw (and some SDL_ttf versions fail to render them)
+        if (text[0] == ' ') {
+            continue;
+        }
+
+        glyphSurfaces[i] = TTF_RenderText_Blended(font, text, {0xFF, 0xFF, 0xFF, 0xFF});
+        if (glyphSurfaces[i] != nullptr) {
+            cellWidth = SDL_max(cellWidth, glyphSurfaces[i]->w);
+            cellHeight = SDL_max(cellHeight, glyphSurfaces[i]->h);
+        }
+    }
+
+    // Lay the glyphs out in a grid of equally sized cells
+    const int columns = 16;
+    const int rows = (OVERLAY_ATLAS_GLYPH_COUNT + columns - 1) / columns;
+    SDL_Surface* atlasSurface = SDL_CreateRGBSurfaceWithFormat(0, columns * cellWidth, rows * cellHeight,
+                                                               32, SDL_PIXELFORMAT_ARGB8888);
+    if (atlasSurface != nullptr) {
+        SDL_FillRect(atlasSurface, nullptr, 0);
+    }
+    else {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "SDL_CreateRGBSurfaceWithFormat() failed: %s",
+                     SDL_GetError());
+    }
+
+    for (int i = 0; i < OVERLAY_ATLAS_GLYPH_COUNT; i++) {
+        SDL_Rect& srcRect = m_OverlayGlyphs[type][i].srcRect;
+
+        srcRect.x = (i % columns) * cellWidth;
+        srcRect.y = (i / columns) * cellHeight;
+        srcRect.w = srcRect.h = 0;
+
+        if (glyphSurfaces[i] != nullptr) {
+            if (atlasSurface != nullptr) {
+                srcRect.w = glyphSurfaces[i]->w;
+                srcRect.h = glyphSurfaces[i]->h;
+
+                // Copy the glyph's alpha channel rather than blending it
+                SDL_SetSurfaceBlendMode(glyphSurfaces[i], SDL_BLENDMODE_NONE);
+                SDL_BlitSurface(glyphSurfaces[i], nullptr, atlasSurface, &srcRect);
             }
 
-            m_OverlayRects[type].w = surface->w;
-            m_OverlayRects[type].h = surface->h;
+            SDL_FreeSurface(glyphSurfaces[i]);
+        }
+    }
+
+    if (atlasSurface == nullptr) {
+        return false;
+    }
+
+    m_OverlayAtlases[type] = SDL_CreateTextureFromSurface(m_Renderer, atlasSurface);
+    SDL_FreeSurface(atlasSurface);
+    if (m_OverlayAtlases[type] == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "SDL_CreateTextureFromSurface() failed: %s",
+                     SDL_GetError());
+        return false;
+    }
+
+    SDL_Color color = Session::get()->getOverlayManager().getOverlayColor(type);
+    SDL_SetTextureBlendMode(m_OverlayAtlases[type], SDL_BLENDMODE_BLEND);
+    SDL_SetTextureColorMod(m_OverlayAtlases[type], color.r, color.g, color.b);
+    SDL_SetTextureAlphaMod(m_OverlayAtlases[type], color.a);
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Created %dx%d overlay glyph atlas for font size %d",
+                columns * cellWidth, rows * cellHeight,
+                Session::get()->getOverlayManager().getOverlayFontSize(type));
+    return true;
+}
+
+void SdlRenderer::layoutOverlay(Overlay::OverlayType type)
+{
+    m_OverlayQuads[type].clear();
+
+    // NB: We build the atlas at render-time because we can only interact
+    // with the renderer on a single thread.
+    if (m_OverlayAtlases[type] == nullptr && !createOverlayAtlas(type)) {
+        return;
+    }
+
+    char text[OVERLAY_TEXT_SIZE];
+    Session::get()->getOverlayManager().getOverlayText(type, text, sizeof(text));
+
+    int lineSkip = TTF_FontLineSkip(m_OverlayFonts[type]);
+    int lineHeight = TTF_FontHeight(m_OverlayFonts[type]);
+    int x = 0, y = 0;
 
-            m_OverlayTextures[type] = SDL_CreateTextureFromSurface(m_Renderer, surface);
-            SDL_FreeSurface(surface);
+    for (const char* p = text; *p != 0; p++) {
+        if (*p == '\n') {
+            x = 0;
+            y += lineSkip;
+            continue;
+        }
+
+        unsigned char c = (unsigned char)*p;
+        if (c < OVERLAY_ATLAS_FIRST_GLYPH || c > OVERLAY_ATLAS_LAST_GLYPH) {
+            continue;
+        }
+
+        const OverlayGlyph& glyph = m_OverlayGlyphs[type][c - OVERLAY_ATLAS_FIRST_GLYPH];
+        if (glyph.srcRect.w != 0) {
+            OverlayQuad quad;
+
+            quad.srcRect = glyph.srcRect;
+            quad.dstRect = { x, y, glyph.srcRect.w, glyph.srcRect.h };
+            m_OverlayQuads[type].append(quad);
+        }
+
+        x += glyph.advance;
+    }
+
+    if (type == Overlay::OverlayStatusUpdate) {
+        // Bottom Left
+        int unused, logicalHeight;
+        SDL_RenderGetLogicalSize(m_Renderer, &unused, &logicalHeight);
+
+        int yOffset = logicalHeight - (y + lineHeight);
+        for (OverlayQuad& quad : m_OverlayQuads[type]) {
+            quad.dstRect.y += yOffset;
+        }
+    }
+
+    // The debug overlay stays at the top left where it was laid out
+}
+
+void SdlRenderer::renderFrameGraph()
+{
+    int logicalWidth, logicalHeight;
+    SDL_RenderGetLogicalSize(m_Renderer, &logicalWidth, &logicalHeight);
+
+    SDL_Rect videoRect = { 0, 0, logicalWidth, logicalHeight };
+    SDL_Rect graphRect = FrameGraph::getGraphRect(videoRect);
+    float vertices[FRAME_GRAPH_VERTEX_FLOATS];
+    FrameGraph::getVertices(vertices, graphRect.x, graphRect.y + graphRect.h, graphRect.w, -graphRect.h);
+
+    // Darken the video behind the graph so the lines stand out
+    SDL_SetRenderDrawBlendMode(m_Renderer, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderDrawColor(m_Renderer, 0, 0, 0, 0x80);
+    SDL_RenderFillRect(m_Renderer, &graphRect);
+
+    for (int series = 0; series < FrameGraph::FGS_MAX; series++) {
+        const float* seriesVertices = &vertices[series * FRAME_GRAPH_FRAMES * 2];
+        const SDL_Color& color = FrameGraph::k_SeriesColors[series];
+        SDL_Point points[FRAME_GRAPH_FRAMES];
+
+        for (int i = 0; i < FRAME_GRAPH_FRAMES; i++) {
+            points[i].x = (int)seriesVertices[i * 2];
+            points[i].y = (int)seriesVertices[i * 2 + 1];
+        }
+
+        SDL_SetRenderDrawColor(m_Renderer, color.r, color.g, color.b, color.a);
+        SDL_RenderDrawLines(m_Renderer, points, FRAME_GRAPH_FRAMES);
+    }
+
+    // Restore the state that SDL_RenderClear() relies on
+    SDL_SetRenderDrawColor(m_Renderer, 0, 0, 0, SDL_ALPHA_OPAQUE);
+    SDL_SetRenderDrawBlendMode(m_Renderer, SDL_BLENDMODE_NONE);
+}
+
+void SdlRenderer::renderOverlay(Overlay::OverlayType type)
+{
+    if (type == Overlay::OverlayFrameGraph) {
+        // The graph is drawn from FrameGraph rather than laid out as text
+        if (Session::get()->getOverlayManager().isOverlayEnabled(type)) {
+            renderFrameGraph();
+        }
+    }
+    else if (Session::get()->getOverlayManager().isOverlayEnabled(type)) {
+        // Rebuild the glyph quads if the overlay text has changed
+        if (SDL_AtomicSet(&m_OverlayDirty[type], 0)) {
+            layoutOverlay(type);
+        }
+
+        // Every quad samples the same atlas texture, so SDL's render
+        // command batching submits the whole overlay in one draw.
+        for (const OverlayQuad& quad : m_OverlayQuads[type]) {
+            SDL_RenderCopy(m_Renderer, m_OverlayAtlases[type], &quad.srcRect, &quad.dstRect);
+        }
+    }
+}
+
+void SdlRenderer::prepareFrame(AVFrame* frame)
+{
+    if (frame->hw_frames_ctx == nullptr) {
+        return;
+    }
+
+    auto hwFrameCtx = (AVHWFramesContext*)frame->hw_frames_ctx->data;
+    enum AVPixelFormat swFormat = hwFrameCtx->sw_format;
+
+    int bufferSize = av_image_get_buffer_size(swFormat, frame->width, frame->height, 32);
+    if (bufferSize <= 0) {
+        return;
+    }
+
+    if (m_DownloadFrame == nullptr) {
+        m_DownloadFrame = av_frame_alloc();
+        if (m_DownloadFrame == nullptr) {
+            return;
         }
+    }
 
-        // If we have an overlay texture, render it too
-        if (m_OverlayTextures[type] != nullptr) {
-            SDL_RenderCopy(m_Renderer, m_OverlayTextures[type], nullptr, &m_OverlayRects[type]);
+    // A new pool is only needed if the frame size changes
+    if (m_DownloadPool == nullptr || m_DownloadPoolBufferSize != bufferSize) {
+        av_buffer_pool_uninit(&m_DownloadPool);
+        m_DownloadPool = av_buffer_pool_init(bufferSize, nullptr);
+        m_DownloadPoolBufferSize = bufferSize;
+        if (m_DownloadPool == nullptr) {
+            return;
         }
     }
+
+    m_DownloadFrame->buf[0] = av_buffer_pool_get(m_DownloadPool);
+    if (m_DownloadFrame->buf[0] == nullptr) {
+        return;
+    }
+
+    m_DownloadFrame->width = frame->width;
+    m_DownloadFrame->height = frame->height;
+    m_DownloadFrame->format = swFormat;
+    av_image_fill_arrays(m_DownloadFrame->data, m_DownloadFrame->linesize,
+                         m_DownloadFrame->buf[0]->data,
+                         swFormat, frame->width, frame->height, 32);
+
+    int err = av_hwframe_transfer_data(m_DownloadFrame, frame, 0);
+    if (err == 0) {
+        err = av_frame_copy_props(m_DownloadFrame, frame);
+    }
+    if (err != 0) {
+        SDL_LOG_RATE_LIMITED(SDL_LogError, SDL_LOG_CATEGORY_APPLICATION,
+                             "av_hwframe_transfer_data() failed: %d",
+                             err);
+
+        // renderFrame() will read back the hardware frame itself
+        av_frame_unref(m_DownloadFrame);
+        return;
+    }
+
+    // The frame now carries the system memory copy, and its hardware
+    // surface goes back to the decoder right away
+    av_frame_unref(frame);
+    av_frame_move_ref(frame, m_DownloadFrame);
 }
 
 void SdlRenderer::renderFrame(AVFrame* frame)
 {
     int err;
     AVFrame* swFrame = nullptr;
+    int format = frame->format;
 
     if (frame->hw_frames_ctx != nullptr) {
         // If we are acting as the frontend for a hardware
@@ -238,30 +532,16 @@ void SdlRenderer::renderFrame(AVFrame* frame)
                         m_SwPixelFormat);
         }
 
-        swFrame = av_frame_alloc();
-        if (swFrame == nullptr) {
-            return;
-        }
-
-        swFrame->width = frame->width;
-        swFrame->height = frame->height;
-        swFrame->format = m_SwPixelFormat;
-
-        err = av_hwframe_transfer_data(swFrame, frame, 0);
-        if (err != 0) {
-            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                         "av_hwframe_transfer_data() failed: %d",
-                         err);
-            goto Exit;
-        }
-
-        frame = swFrame;
+        format = m_SwPixelFormat;
     }
 
-    if (m_Texture == nullptr) {
+    // Upload into the texture we didn't draw last time
+    m_TextureIndex ^= 1;
+
+    if (m_Textures[m_TextureIndex] == nullptr) {
         Uint32 sdlFormat;
 
-        switch (frame->format)
+        switch (format)
         {
         case AV_PIX_FMT_YUV420P:
             sdlFormat = SDL_PIXELFORMAT_YV12;
@@ -272,17 +552,24 @@ void SdlRenderer::renderFrame(AVFrame* frame)
         case AV_PIX_FMT_NV21:
             sdlFormat = SDL_PIXELFORMAT_NV21;
             break;
+        case AV_PIX_FMT_P010:
+            sdlFormat = SDL_PIXELFORMAT_NV12;
+            break;
+        case AV_PIX_FMT_YUV420P10:
+            // Planes in the same order as FFmpeg's, unlike YV12
+            sdlFormat = SDL_PIXELFORMAT_IYUV;
+            break;
         default:
             SDL_assert(false);
             goto Exit;
         }
 
-        m_Texture = SDL_CreateTexture(m_Renderer,
-                                      sdlFormat,
-                                      SDL_TEXTUREACCESS_STREAMING,
-                                      frame->width,
-                                      frame->height);
-        if (!m_Texture) {
+        m_Textures[m_TextureIndex] = SDL_CreateTexture(m_Renderer,
+                                                       sdlFormat,
+                                                       SDL_TEXTUREACCESS_STREAMING,
+                                                       frame->width,
+                                                       frame->height);
+        if (!m_Textures[m_TextureIndex]) {
             SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
                          "SDL_CreateTexture() failed: %s",
                          SDL_GetError());
@@ -290,8 +577,84 @@ void SdlRenderer::renderFrame(AVFrame* frame)
         }
     }
 
-    if (frame->format == AV_PIX_FMT_YUV420P) {
-        SDL_UpdateYUVTexture(m_Texture, nullptr,
+    if (Main10Converter::get8BitFormat(format) != AV_PIX_FMT_NONE) {
+        if (frame->hw_frames_ctx != nullptr) {
+            swFrame = av_frame_alloc();
+            if (swFrame == nullptr) {
+                goto Exit;
+            }
+
+            swFrame->width = frame->width;
+            swFrame->height = frame->height;
+            swFrame->format = format;
+
+            err = av_hwframe_transfer_data(swFrame, frame, 0);
+            if (err != 0) {
+                SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                             "av_hwframe_transfer_data() failed: %d",
+                             err);
+                goto Exit;
+            }
+
+            frame = swFrame;
+        }
+
+        Uint8* pixels;
+        int pitch;
+
+        err = SDL_LockTexture(m_Textures[m_TextureIndex], nullptr, (void**)&pixels, &pitch);
+        if (err < 0) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "SDL_LockTexture() failed: %s",
+                         SDL_GetError());
+            goto Exit;
+        }
+
+        // The locked texture holds the planes one after another. NV12's
+        // chroma plane has the luma pitch and IYUV's have half of it.
+        Uint8* planes[3];
+        int pitches[3];
+        planes[0] = pixels;
+        pitches[0] = pitch;
+        planes[1] = pixels + (pitch * frame->height);
+        if (format == AV_PIX_FMT_P010) {
+            pitches[1] = pitch;
+            planes[2] = nullptr;
+            pitches[2] = 0;
+        }
+        else {
+            pitches[1] = pitches[2] = (pitch + 1) / 2;
+            planes[2] = planes[1] + (pitches[1] * ((frame->height + 1) / 2));
+        }
+
+        m_Main10Converter.convert(frame, planes, pitches);
+
+        SDL_UnlockTexture(m_Textures[m_TextureIndex]);
+    }
+    else if (format == AV_PIX_FMT_YUV420P) {
+        if (frame->hw_frames_ctx != nullptr) {
+            swFrame = av_frame_alloc();
+            if (swFrame == nullptr) {
+                goto Exit;
+            }
+
+            swFrame->width = frame->width;
+            swFrame->height = frame->height;
+            swFrame->format = format;
+
+            err = av_hwframe_transfer_data(swFrame, frame, 0);
+            if (err != 0) {
+                SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                             "av_hwframe_transfer_data() failed: %d",
+                             err);
+                goto Exit;
+            }
+
+            frame = swFrame;
+        }
+
+        // SDL passes the planes and their pitches straight to the driver
+        SDL_UpdateYUVTexture(m_Textures[m_TextureIndex], nullptr,
                              frame->data[0],
                              frame->linesize[0],
                              frame->data[1],
@@ -300,10 +663,10 @@ void SdlRenderer::renderFrame(AVFrame* frame)
                              frame->linesize[2]);
     }
     else {
-        char* pixels;
+        Uint8* pixels;
         int pitch;
 
-        err = SDL_LockTexture(m_Texture, nullptr, (void**)&pixels, &pitch);
+        err = SDL_LockTexture(m_Textures[m_TextureIndex], nullptr, (void**)&pixels, &pitch);
         if (err < 0) {
             SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
                          "SDL_LockTexture() failed: %s",
@@ -311,20 +674,58 @@ void SdlRenderer::renderFrame(AVFrame* frame)
             goto Exit;
         }
 
-        memcpy(pixels,
-               frame->data[0],
-               frame->linesize[0] * frame->height);
-        memcpy(pixels + (frame->linesize[0] * frame->height),
-               frame->data[1],
-               frame->linesize[1] * frame->height / 2);
+        // The locked texture holds the luma plane followed by
+        // the interleaved chroma plane with the same pitch
+        if (frame->hw_frames_ctx != nullptr) {
+            // Read the frame back straight into the texture rather
+            // than into a temporary frame that we'd have to copy again.
+            swFrame = av_frame_alloc();
+            if (swFrame != nullptr) {
+                swFrame->width = frame->width;
+                swFrame->height = frame->height;
+                swFrame->format = format;
+                swFrame->data[0] = pixels;
+                swFrame->linesize[0] = pitch;
+                swFrame->data[1] = pixels + (pitch * frame->height);
+                swFrame->linesize[1] = pitch;
+
+                // FFmpeg only transfers into frames that have a buffer
+                swFrame->buf[0] = av_buffer_create(pixels, pitch * frame->height * 3 / 2,
+                                                   noopBufferFree, nullptr, 0);
+                if (swFrame->buf[0] != nullptr) {
+                    err = av_hwframe_transfer_data(swFrame, frame, 0);
+                    if (err != 0) {
+                        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                                     "av_hwframe_transfer_data() failed: %d",
+                                     err);
+                    }
+                }
+            }
+        }
+        else {
+            CpuDispatch::copyPlane(pixels, pitch,
+                                   frame->data[0], frame->linesize[0],
+                                   frame->width, frame->height);
+            CpuDispatch::copyPlane(pixels + (pitch * frame->height), pitch,
+                                   frame->data[1], frame->linesize[1],
+                                   frame->width, frame->height / 2);
+        }
 
-        SDL_UnlockTexture(m_Texture);
+        SDL_UnlockTexture(m_Textures[m_TextureIndex]);
     }
 
-    SDL_RenderClear(m_Renderer);
+    // At 1:1 the copy below is a plain blit that covers the whole output,
+    // so there's no letterbox to clear first
+    int outputWidth, outputHeight;
+    bool unscaled = SDL_GetRendererOutputSize(m_Renderer, &outputWidth, &outputHeight) == 0 &&
+            outputWidth == frame->width && outputHeight == frame->height;
+    SDL_AtomicSet(&m_Unscaled, unscaled);
+    if (!unscaled) {
+        SDL_RenderClear(m_Renderer);
+    }
 
     // Draw the video content itself
-    SDL_RenderCopy(m_Renderer, m_Texture, nullptr, nullptr);
+    SDL_RenderCopy(m_Renderer, m_Textures[m_TextureIndex], nullptr, nullptr);
 
     // Draw the overlays
     for (int i = 0; i < Overlay::OverlayMax; i++) {
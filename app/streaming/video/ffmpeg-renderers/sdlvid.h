@@ -1,29 +1,76 @@
 #pragma once
 
 #include "renderer.h"
+#include "main10converter.h"
 
 #include <SDL_ttf.h>
 
+#include <QVector>
+
+// The overlay glyph atlas covers printable ASCII
+#define OVERLAY_ATLAS_FIRST_GLYPH 32
+#define OVERLAY_ATLAS_LAST_GLYPH 126
+#define OVERLAY_ATLAS_GLYPH_COUNT (OVERLAY_ATLAS_LAST_GLYPH - OVERLAY_ATLAS_FIRST_GLYPH + 1)
+
 class SdlRenderer : public IFFmpegRenderer {
 public:
     SdlRenderer();
     virtual ~SdlRenderer() override;
     virtual bool initialize(PDECODER_PARAMETERS params) override;
     virtual bool prepareDecoderContext(AVCodecContext* context) override;
+    virtual void prepareFrame(AVFrame* frame) override;
     virtual void renderFrame(AVFrame* frame) override;
     virtual void notifyOverlayUpdated(Overlay::OverlayType) override;
     virtual bool isRenderThreadSupported() override;
+    virtual bool reinitializePresentation(PDECODER_PARAMETERS params) override;
+    virtual bool notifyWindowResized(PDECODER_PARAMETERS params) override;
+    virtual const char* getPresentationPath() override;
+    virtual enum AVPixelFormat getPreferredPixelFormat(int videoFormat) override;
 
 private:
     void renderOverlay(Overlay::OverlayType type);
 
+    void renderFrameGraph();
+
+    bool createOverlayAtlas(Overlay::OverlayType type);
+
+    void layoutOverlay(Overlay::OverlayType type);
+
+    struct OverlayGlyph {
+        SDL_Rect srcRect;
+        int advance;
+    };
+
+    struct OverlayQuad {
+        SDL_Rect srcRect;
+        SDL_Rect dstRect;
+    };
+
     SDL_Renderer* m_Renderer;
-    SDL_Texture* m_Texture;
+    char m_RendererName[32];
+    SDL_atomic_t m_Unscaled;
+    char m_PresentationPath[64];
+
+    // Frames are uploaded to alternating textures, so updating one never
+    // waits for the GPU to finish drawing the last frame from it
+    SDL_Texture* m_Textures[2];
+    int m_TextureIndex;
     int m_SwPixelFormat;
+
+    // Hardware frames are read back on the decoder thread into buffers
+    // from this pool, rather than on the render thread into a new frame
+    AVBufferPool* m_DownloadPool;
+    int m_DownloadPoolBufferSize;
+    AVFrame* m_DownloadFrame;
+
+    // For 10-bit frames, which SDL has no texture format for
+    Main10Converter m_Main10Converter;
+
     QByteArray m_FontData;
     TTF_Font* m_OverlayFonts[Overlay::OverlayMax];
-    SDL_Surface* m_OverlaySurfaces[Overlay::OverlayMax];
-    SDL_Texture* m_OverlayTextures[Overlay::OverlayMax];
-    SDL_Rect m_OverlayRects[Overlay::OverlayMax];
+    SDL_atomic_t m_OverlayDirty[Overlay::OverlayMax];
+    SDL_Texture* m_OverlayAtlases[Overlay::OverlayMax];
+    OverlayGlyph m_OverlayGlyphs[Overlay::OverlayMax][OVERLAY_ATLAS_GLYPH_COUNT];
+    QVector<OverlayQuad> m_OverlayQuads[Overlay::OverlayMax];
 };
 
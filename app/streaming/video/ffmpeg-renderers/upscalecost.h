@@ -0,0 +1,106 @@
+#pragma once
+
+#include <SDL.h>
+
+// Share of the frame interval the upscaling pass may take on the GPU
+#define UPSCALE_BUDGET_PERCENT 10
+
+// Number of frames averaged before they're compared against the budget
+#define UPSCALE_COST_WINDOW 60
+
+// Averages the GPU time of a renderer's optional upscaling pass and turns
+// it off for good when it costs too much. Samples and state changes come
+// from the render thread, while the state and the average may be read from
+// any thread for the debug overlay.
+class UpscaleCostTracker
+{
+public:
+    enum UpscaleState
+    {
+        US_INACTIVE,
+        US_ACTIVE,
+        US_OVER_BUDGET
+    };
+
+    UpscaleCostTracker()
+        : m_BudgetUs(0),
+          m_WindowTotalUs(0),
+          m_WindowSamples(0),
+          m_OverBudget(false)
+    {
+        SDL_AtomicSet(&m_AverageCostUs, -1);
+        SDL_AtomicSet(&m_State, US_INACTIVE);
+    }
+
+    void initialize(int frameRate)
+    {
+        m_BudgetUs = 1000000 / SDL_max(frameRate, 1) * UPSCALE_BUDGET_PERCENT / 100;
+        m_WindowTotalUs = 0;
+        m_WindowSamples = 0;
+        m_OverBudget = false;
+        SDL_AtomicSet(&m_AverageCostUs, -1);
+        SDL_AtomicSet(&m_State, US_INACTIVE);
+    }
+
+    // Records whether the pass ran for the current frame
+    void setActive(bool active)
+    {
+        SDL_AtomicSet(&m_State, m_OverBudget ? US_OVER_BUDGET :
+                                (active ? US_ACTIVE : US_INACTIVE));
+    }
+
+    // Returns false if this sample completed a window that averaged over
+    // budget. The caller must stop running the pass after that.
+    bool addSample(Uint64 costUs)
+    {
+        m_WindowTotalUs += costUs;
+        if (++m_WindowSamples < UPSCALE_COST_WINDOW) {
+            return true;
+        }
+
+        int averageUs = (int)(m_WindowTotalUs / m_WindowSamples);
+        SDL_AtomicSet(&m_AverageCostUs, averageUs);
+        m_WindowTotalUs = 0;
+        m_WindowSamples = 0;
+
+        if (averageUs > m_BudgetUs) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "Upscaling pass takes %d us per frame, over its budget of %d us",
+                        averageUs,
+                        m_BudgetUs);
+            m_OverBudget = true;
+            return false;
+        }
+
+        return true;
+    }
+
+    bool isOverBudget()
+    {
+        return m_OverBudget;
+    }
+
+    UpscaleState getState()
+    {
+        return (UpscaleState)SDL_AtomicGet(&m_State);
+    }
+
+    // -1 until the first window is complete, or if the pass isn't timed
+    int getAverageCostUs()
+    {
+        return SDL_AtomicGet(&m_AverageCostUs);
+    }
+
+    int getBudgetUs()
+    {
+        return m_BudgetUs;
+    }
+
+private:
+    int m_BudgetUs;
+    Uint64 m_WindowTotalUs;
+    int m_WindowSamples;
+    bool m_OverBudget;
+    SDL_atomic_t m_AverageCostUs;
+    SDL_atomic_t m_State;
+};
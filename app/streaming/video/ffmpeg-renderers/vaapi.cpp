@@ -2,6 +2,7 @@
 
 #include "vaapi.h"
 #include <streaming/streamutils.h>
+#include <streaming/video/hwdevicecache.h>
 
 #include <SDL_syswm.h>
 
@@ -10,29 +11,41 @@
 
 VAAPIRenderer::VAAPIRenderer()
     : m_HwContext(nullptr),
-      m_DrmFd(-1)
+      m_DisplayKey(nullptr),
+      m_DeviceReady(false)
+#ifdef HAVE_EGL
+      , m_EGLCreateImage(nullptr),
+      m_EGLDestroyImage(nullptr),
+      m_EGLImageCount(0)
+#endif
 {
 
 }
 
 VAAPIRenderer::~VAAPIRenderer()
 {
-    if (m_HwContext != nullptr) {
-        AVHWDeviceContext* deviceContext = (AVHWDeviceContext*)m_HwContext->data;
-        AVVAAPIDeviceContext* vaDeviceContext = (AVVAAPIDeviceContext*)deviceContext->hwctx;
-
-        // Hold onto this VADisplay since we'll need it to uninitialize VAAPI
-        VADisplay display = vaDeviceContext->display;
-
+    // Keep a working device around for the next renderer. One that failed
+    // our checks in initialize() must not be picked up again.
+    if (m_DeviceReady) {
+        HwDeviceCache::put(AV_HWDEVICE_TYPE_VAAPI, m_DisplayKey, &m_HwContext);
+    }
+    else {
         av_buffer_unref(&m_HwContext);
+    }
+}
 
-        if (display) {
-            vaTerminate(display);
-        }
+void VAAPIRenderer::freeDevice(AVHWDeviceContext* deviceContext)
+{
+    AVVAAPIDeviceContext* vaDeviceContext = (AVVAAPIDeviceContext*)deviceContext->hwctx;
+    int drmFd = (int)(intptr_t)deviceContext->user_opaque;
+
+    // FFmpeg has already uninitialized its state on this VADisplay
+    if (vaDeviceContext->display) {
+        vaTerminate(vaDeviceContext->display);
     }
 
-    if (m_DrmFd != -1) {
-        close(m_DrmFd);
+    if (drmFd != -1) {
+        close(drmFd);
     }
 }
 
@@ -45,7 +58,7 @@ VAAPIRenderer::initialize(PDECODER_PARAMETERS params)
     m_VideoWidth = params->width;
     m_VideoHeight = params->height;
 
-    SDL_GetWindowSize(params->window, &m_DisplayWidth, &m_DisplayHeight);
+    notifyWindowResized(params);
 
     SDL_VERSION(&info.version);
 
@@ -56,6 +69,29 @@ VAAPIRenderer::initialize(PDECODER_PARAMETERS params)
         return false;
     }
 
+    m_WindowSystem = info.subsystem;
+
+    // A device can be shared by every window on the same display connection
+#ifdef HAVE_LIBVA_X11
+    if (info.subsystem == SDL_SYSWM_X11) {
+        m_XWindow = info.info.x11.window;
+        m_DisplayKey = info.info.x11.display;
+    }
+#endif
+#ifdef HAVE_LIBVA_WAYLAND
+    if (info.subsystem == SDL_SYSWM_WAYLAND) {
+        m_DisplayKey = info.info.wl.display;
+    }
+#endif
+
+    // Pick up the device from decoder probing if there is one. It's
+    // already been through the checks below.
+    m_HwContext = HwDeviceCache::take(AV_HWDEVICE_TYPE_VAAPI, m_DisplayKey);
+    if (m_HwContext != nullptr) {
+        m_DeviceReady = true;
+        return true;
+    }
+
     m_HwContext = av_hwdevice_ctx_alloc(AV_HWDEVICE_TYPE_VAAPI);
     if (!m_HwContext) {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
@@ -66,10 +102,12 @@ VAAPIRenderer::initialize(PDECODER_PARAMETERS params)
     AVHWDeviceContext* deviceContext = (AVHWDeviceContext*)m_HwContext->data;
     AVVAAPIDeviceContext* vaDeviceContext = (AVVAAPIDeviceContext*)deviceContext->hwctx;
 
-    m_WindowSystem = info.subsystem;
+    // The VADisplay (and DRM FD, if any) are freed along with the device
+    deviceContext->free = freeDevice;
+    deviceContext->user_opaque = (void*)(intptr_t)-1;
+
     if (info.subsystem == SDL_SYSWM_X11) {
 #ifdef HAVE_LIBVA_X11
-        m_XWindow = info.info.x11.window;
         vaDeviceContext->display = vaGetDisplay(info.info.x11.display);
         if (!vaDeviceContext->display) {
             SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
@@ -109,15 +147,16 @@ VAAPIRenderer::initialize(PDECODER_PARAMETERS params)
                     "Opening DRM device: %s",
                     device);
 
-        m_DrmFd = open(device, O_RDWR | O_CLOEXEC);
-        if (m_DrmFd < 0) {
+        int drmFd = open(device, O_RDWR | O_CLOEXEC);
+        if (drmFd < 0) {
             SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
                          "Failed to open DRM device: %d",
                          errno);
             return false;
         }
 
-        vaDeviceContext->display = vaGetDisplayDRM(m_DrmFd);
+        deviceContext->user_opaque = (void*)(intptr_t)drmFd;
+        vaDeviceContext->display = vaGetDisplayDRM(drmFd);
         if (!vaDeviceContext->display) {
             SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
                          "Unable to open DRM display for VAAPI");
@@ -188,6 +227,7 @@ VAAPIRenderer::initialize(PDECODER_PARAMETERS params)
         return false;
     }
 
+    m_DeviceReady = true;
     return true;
 }
 
@@ -211,14 +251,252 @@ VAAPIRenderer::needsTestFrame()
     return true;
 }
 
+int
+VAAPIRenderer::getDecoderCapabilities()
+{
+    // VAAPI handles the reference frame invalidation
+    // streams produced by the host correctly
+    return CAPABILITY_REFERENCE_FRAME_INVALIDATION_AVC |
+           CAPABILITY_REFERENCE_FRAME_INVALIDATION_HEVC;
+}
+
 bool
 VAAPIRenderer::isDirectRenderingSupported()
 {
     // Many Wayland renderers don't support YUV surfaces, so use
-    // another frontend renderer to draw our frames.
-    return m_WindowSystem == SDL_SYSWM_X11;
+    // another frontend renderer to draw our frames. We prefer the
+    // EGL frontend on X11 too, since vaPutSurface() copies and blocks.
+    return m_WindowSystem == SDL_SYSWM_X11
+#ifdef HAVE_EGL
+            && !canExportEGL()
+#endif
+            ;
+}
+
+bool
+VAAPIRenderer::notifyWindowResized(PDECODER_PARAMETERS params)
+{
+    int width, height;
+
+    // vaPutSurface() scales to whatever rect we give it, so we just
+    // need to pick up the new size on the next frame.
+    SDL_GetWindowSize(params->window, &width, &height);
+    SDL_AtomicSet(&m_DisplaySize, (width << 16) | (height & 0xFFFF));
+    return true;
+}
+
+bool
+VAAPIRenderer::canExportDrmPrime()
+{
+#if VA_CHECK_VERSION(1, 1, 0)
+    return true;
+#else
+    // vaExportSurfaceHandle() requires libva 1.1
+    return false;
+#endif
+}
+
+bool
+VAAPIRenderer::mapDrmPrimeFrame(AVFrame* frame, AVDRMFrameDescriptor* drmFrame)
+{
+#if VA_CHECK_VERSION(1, 1, 0)
+    VASurfaceID surface = (VASurfaceID)(uintptr_t)frame->data[3];
+    AVHWDeviceContext* deviceContext = (AVHWDeviceContext*)m_HwContext->data;
+    AVVAAPIDeviceContext* vaDeviceContext = (AVVAAPIDeviceContext*)deviceContext->hwctx;
+    VADRMPRIMESurfaceDescriptor vaSurfaceDescriptor;
+    VAStatus status;
+
+    // The surface must be fully decoded before it's scanned out
+    status = vaSyncSurface(vaDeviceContext->display, surface);
+    if (status != VA_STATUS_SUCCESS) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "vaSyncSurface() failed: %d",
+                     status);
+        return false;
+    }
+
+    // Display servers and KMS take every plane of a buffer at once,
+    // unlike EGL where we import each plane as its own image
+    status = vaExportSurfaceHandle(vaDeviceContext->display,
+                                   surface,
+                                   VA_SURFACE_ATTRIB_MEM_TYPE_DRM_PRIME_2,
+                                   VA_EXPORT_SURFACE_READ_ONLY | VA_EXPORT_SURFACE_COMPOSED_LAYERS,
+                                   &vaSurfaceDescriptor);
+    if (status != VA_STATUS_SUCCESS) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "vaExportSurfaceHandle() failed: %d",
+                     status);
+        return false;
+    }
+
+    SDL_assert(vaSurfaceDescriptor.num_layers == 1);
+    SDL_assert(vaSurfaceDescriptor.num_objects <= AV_DRM_MAX_PLANES);
+    SDL_assert(vaSurfaceDescriptor.layers[0].num_planes <= AV_DRM_MAX_PLANES);
+
+    memset(drmFrame, 0, sizeof(*drmFrame));
+
+    drmFrame->nb_objects = (int)vaSurfaceDescriptor.num_objects;
+    for (uint32_t i = 0; i < vaSurfaceDescriptor.num_objects; i++) {
+        drmFrame->objects[i].fd = vaSurfaceDescriptor.objects[i].fd;
+        drmFrame->objects[i].size = vaSurfaceDescriptor.objects[i].size;
+        drmFrame->objects[i].format_modifier = vaSurfaceDescriptor.objects[i].drm_format_modifier;
+    }
+
+    auto& layer = vaSurfaceDescriptor.layers[0];
+    drmFrame->nb_layers = 1;
+    drmFrame->layers[0].format = layer.drm_format;
+    drmFrame->layers[0].nb_planes = (int)layer.num_planes;
+    for (uint32_t i = 0; i < layer.num_planes; i++) {
+        drmFrame->layers[0].planes[i].object_index = (int)layer.object_index[i];
+        drmFrame->layers[0].planes[i].offset = layer.offset[i];
+        drmFrame->layers[0].planes[i].pitch = layer.pitch[i];
+    }
+
+    return true;
+#else
+    SDL_assert(false);
+    return false;
+#endif
+}
+
+void
+VAAPIRenderer::unmapDrmPrimeFrame(AVDRMFrameDescriptor* drmFrame)
+{
+    for (int i = 0; i < drmFrame->nb_objects; i++) {
+        close(drmFrame->objects[i].fd);
+    }
+
+    drmFrame->nb_objects = 0;
+}
+
+#ifdef HAVE_EGL
+
+bool
+VAAPIRenderer::canExportEGL()
+{
+#if VA_CHECK_VERSION(1, 1, 0)
+    if (qgetenv("VAAPI_FORCE_DIRECT") == "1") {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Using vaPutSurface() due to VAAPI_FORCE_DIRECT");
+        return false;
+    }
+
+    return true;
+#else
+    // vaExportSurfaceHandle() requires libva 1.1
+    return false;
+#endif
+}
+
+ssize_t
+VAAPIRenderer::exportEGLImages(AVFrame* frame, EGLDisplay dpy, EGLImageKHR images[EGL_MAX_PLANES])
+{
+#if VA_CHECK_VERSION(1, 1, 0)
+    VASurfaceID surface = (VASurfaceID)(uintptr_t)frame->data[3];
+    AVHWDeviceContext* deviceContext = (AVHWDeviceContext*)m_HwContext->data;
+    AVVAAPIDeviceContext* vaDeviceContext = (AVVAAPIDeviceContext*)deviceContext->hwctx;
+    VADRMPRIMESurfaceDescriptor vaSurfaceDescriptor;
+    VAStatus status;
+
+    SDL_assert(m_EGLImageCount == 0);
+
+    if (m_EGLCreateImage == nullptr) {
+        const char* extensions = eglQueryString(dpy, EGL_EXTENSIONS);
+        if (extensions == nullptr || strstr(extensions, "EGL_EXT_image_dma_buf_import") == nullptr) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "EGL_EXT_image_dma_buf_import is not supported");
+            return -1;
+        }
+
+        m_EGLCreateImage = (PFNEGLCREATEIMAGEKHRPROC)eglGetProcAddress("eglCreateImageKHR");
+        m_EGLDestroyImage = (PFNEGLDESTROYIMAGEKHRPROC)eglGetProcAddress("eglDestroyImageKHR");
+        if (m_EGLCreateImage == nullptr || m_EGLDestroyImage == nullptr) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "EGL_KHR_image_base is not supported");
+            m_EGLCreateImage = nullptr;
+            return -1;
+        }
+    }
+
+    // The surface must be fully decoded before the GPU samples it
+    status = vaSyncSurface(vaDeviceContext->display, surface);
+    if (status != VA_STATUS_SUCCESS) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "vaSyncSurface() failed: %d",
+                     status);
+        return -1;
+    }
+
+    status = vaExportSurfaceHandle(vaDeviceContext->display,
+                                   surface,
+                                   VA_SURFACE_ATTRIB_MEM_TYPE_DRM_PRIME_2,
+                                   VA_EXPORT_SURFACE_READ_ONLY | VA_EXPORT_SURFACE_SEPARATE_LAYERS,
+                                   &vaSurfaceDescriptor);
+    if (status != VA_STATUS_SUCCESS) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "vaExportSurfaceHandle() failed: %d",
+                     status);
+        return -1;
+    }
+
+    SDL_assert(vaSurfaceDescriptor.num_layers <= EGL_MAX_PLANES);
+
+    for (uint32_t i = 0; i < vaSurfaceDescriptor.num_layers; i++) {
+        auto& layer = vaSurfaceDescriptor.layers[i];
+
+        // Separate layers always have a single plane each. Every layer
+        // after the first is a chroma plane at half size (4:2:0).
+        SDL_assert(layer.num_planes == 1);
+        EGLint attribs[] = {
+            EGL_LINUX_DRM_FOURCC_EXT, (EGLint)layer.drm_format,
+            EGL_WIDTH, i == 0 ? frame->width : (frame->width + 1) / 2,
+            EGL_HEIGHT, i == 0 ? frame->height : (frame->height + 1) / 2,
+            EGL_DMA_BUF_PLANE0_FD_EXT, vaSurfaceDescriptor.objects[layer.object_index[0]].fd,
+            EGL_DMA_BUF_PLANE0_OFFSET_EXT, (EGLint)layer.offset[0],
+            EGL_DMA_BUF_PLANE0_PITCH_EXT, (EGLint)layer.pitch[0],
+            EGL_NONE
+        };
+
+        images[i] = m_EGLCreateImage(dpy, EGL_NO_CONTEXT, EGL_LINUX_DMA_BUF_EXT, nullptr, attribs);
+        if (images[i] == EGL_NO_IMAGE_KHR) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "eglCreateImageKHR() failed: %x",
+                         eglGetError());
+            break;
+        }
+
+        m_EGLImageCount++;
+    }
+
+    // The EGLImages hold their own references to the DMA-BUFs
+    for (uint32_t i = 0; i < vaSurfaceDescriptor.num_objects; i++) {
+        close(vaSurfaceDescriptor.objects[i].fd);
+    }
+
+    if (m_EGLImageCount != (ssize_t)vaSurfaceDescriptor.num_layers) {
+        freeEGLImages(dpy, images);
+        return -1;
+    }
+
+    return m_EGLImageCount;
+#else
+    SDL_assert(false);
+    return -1;
+#endif
 }
 
+void
+VAAPIRenderer::freeEGLImages(EGLDisplay dpy, EGLImageKHR images[EGL_MAX_PLANES])
+{
+    for (ssize_t i = 0; i < m_EGLImageCount; i++) {
+        m_EGLDestroyImage(dpy, images[i]);
+    }
+
+    m_EGLImageCount = 0;
+}
+
+#endif
+
 void
 VAAPIRenderer::renderFrame(AVFrame* frame)
 {
@@ -231,8 +509,10 @@ VAAPIRenderer::renderFrame(AVFrame* frame)
     src.w = m_VideoWidth;
     src.h = m_VideoHeight;
     dst.x = dst.y = 0;
-    dst.w = m_DisplayWidth;
-    dst.h = m_DisplayHeight;
+
+    int displaySize = SDL_AtomicGet(&m_DisplaySize);
+    dst.w = displaySize >> 16;
+    dst.h = displaySize & 0xFFFF;
 
     StreamUtils::scaleSourceToDestinationSurface(&src, &dst);
 
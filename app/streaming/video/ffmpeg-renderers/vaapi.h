@@ -37,12 +37,32 @@ public:
     virtual bool prepareDecoderContext(AVCodecContext* context) override;
     virtual void renderFrame(AVFrame* frame) override;
     virtual bool needsTestFrame() override;
+    virtual int getDecoderCapabilities() override;
     virtual bool isDirectRenderingSupported() override;
+    virtual bool notifyWindowResized(PDECODER_PARAMETERS params) override;
+    virtual bool canExportDrmPrime() override;
+    virtual bool mapDrmPrimeFrame(AVFrame* frame, AVDRMFrameDescriptor* drmFrame) override;
+    virtual void unmapDrmPrimeFrame(AVDRMFrameDescriptor* drmFrame) override;
+
+#ifdef HAVE_EGL
+    virtual bool canExportEGL() override;
+    virtual ssize_t exportEGLImages(AVFrame* frame, EGLDisplay dpy, EGLImageKHR images[EGL_MAX_PLANES]) override;
+    virtual void freeEGLImages(EGLDisplay dpy, EGLImageKHR images[EGL_MAX_PLANES]) override;
+#endif
+
+    // The VAAPI device, for decoders whose devices are derived from it
+    AVBufferRef* getHwDeviceContext()
+    {
+        return m_HwContext;
+    }
 
 private:
+    static void freeDevice(AVHWDeviceContext* deviceContext);
+
     int m_WindowSystem;
     AVBufferRef* m_HwContext;
-    int m_DrmFd;
+    const void* m_DisplayKey;
+    bool m_DeviceReady;
 
 #ifdef HAVE_LIBVA_X11
     Window m_XWindow;
@@ -50,6 +70,14 @@ private:
 
     int m_VideoWidth;
     int m_VideoHeight;
-    int m_DisplayWidth;
-    int m_DisplayHeight;
+
+    // Packed as (width << 16) | height so it can be updated from the
+    // main thread while frames are rendering.
+    SDL_atomic_t m_DisplaySize;
+
+#ifdef HAVE_EGL
+    PFNEGLCREATEIMAGEKHRPROC m_EGLCreateImage;
+    PFNEGLDESTROYIMAGEKHRPROC m_EGLDestroyImage;
+    ssize_t m_EGLImageCount;
+#endif
 };
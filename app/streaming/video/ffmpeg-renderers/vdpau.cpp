@@ -1,5 +1,8 @@
 #include "vdpau.h"
 #include <streaming/streamutils.h>
+#include <streaming/session.h>
+#include <streaming/video/frametracer.h>
+#include <streaming/video/hwdevicecache.h>
 
 #include <SDL_syswm.h>
 
@@ -19,37 +22,58 @@ const VdpRGBAFormat VDPAURenderer::k_OutputFormats[] = {
 
 VDPAURenderer::VDPAURenderer()
     : m_HwContext(nullptr),
+      m_DeviceReady(false),
       m_PresentationQueueTarget(0),
       m_PresentationQueue(0),
       m_VideoMixer(0),
-      m_NextSurfaceIndex(0)
+      m_VdpGetProcAddress(nullptr),
+      m_GLInterop(false),
+      m_NextSurfaceIndex(0),
+      m_LastPresentationTime(0),
+      m_RefreshPeriod(0),
+      m_DroppedFrames(0)
 {
     SDL_zero(m_OutputSurface);
+    SDL_zero(m_OutputSurfaceFrameNumber);
+    SDL_zero(m_OutputSurfaceQueued);
+    SDL_zero(m_Overlays);
+    SDL_AtomicSet(&m_PendingOverlayUpdates, 0);
+
+#ifdef HAVE_EGL
+    m_GLInteropReady = false;
+    m_GLInteropFailed = false;
+    SDL_zero(m_GLTextures);
+    SDL_zero(m_GLSurfaces);
+    m_MappedSurfaceIndex = -1;
+#endif
 }
 
 VDPAURenderer::~VDPAURenderer()
 {
-    if (m_PresentationQueue != 0) {
-        m_VdpPresentationQueueDestroy(m_PresentationQueue);
+    if (m_DroppedFrames != 0) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Dropped %d frames with no idle output surface",
+                    m_DroppedFrames);
     }
 
     if (m_VideoMixer != 0) {
         m_VdpVideoMixerDestroy(m_VideoMixer);
     }
 
-    if (m_PresentationQueueTarget != 0) {
-        m_VdpPresentationQueueTargetDestroy(m_PresentationQueueTarget);
-    }
+    destroyPresentation();
 
-    for (int i = 0; i < OUTPUT_SURFACE_COUNT; i++) {
-        if (m_OutputSurface[i] != 0) {
-            m_VdpOutputSurfaceDestroy(m_OutputSurface[i]);
+    for (int i = 0; i < Overlay::OverlayMax; i++) {
+        if (m_Overlays[i].surface != 0) {
+            m_VdpBitmapSurfaceDestroy(m_Overlays[i].surface);
         }
     }
 
     // This must be done last as it frees VDPAU context required to call
-    // the functions above.
-    if (m_HwContext != nullptr) {
+    // the functions above. A working device is kept for the next renderer.
+    if (m_DeviceReady) {
+        HwDeviceCache::put(AV_HWDEVICE_TYPE_VDPAU, nullptr, &m_HwContext);
+    }
+    else {
         av_buffer_unref(&m_HwContext);
     }
 }
@@ -58,24 +82,29 @@ bool VDPAURenderer::initialize(PDECODER_PARAMETERS params)
 {
     int err;
     VdpStatus status;
-    SDL_SysWMinfo info;
 
     m_VideoWidth = params->width;
     m_VideoHeight = params->height;
 
-    err = av_hwdevice_ctx_create(&m_HwContext,
-                                 AV_HWDEVICE_TYPE_VDPAU,
-                                 nullptr, nullptr, 0);
-    if (err < 0) {
-        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                     "Failed to create VDPAU context: %d",
-                     err);
-        return false;
+    // FFmpeg opens its own X11 connection for the device, so a device
+    // from decoder probing works with any window
+    m_HwContext = HwDeviceCache::take(AV_HWDEVICE_TYPE_VDPAU, nullptr);
+    if (m_HwContext == nullptr) {
+        err = av_hwdevice_ctx_create(&m_HwContext,
+                                     AV_HWDEVICE_TYPE_VDPAU,
+                                     nullptr, nullptr, 0);
+        if (err < 0) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "Failed to create VDPAU context: %d",
+                         err);
+            return false;
+        }
     }
 
     AVHWDeviceContext* devCtx = (AVHWDeviceContext*)m_HwContext->data;
     AVVDPAUDeviceContext* vdpauCtx = (AVVDPAUDeviceContext*)devCtx->hwctx;
     m_Device = vdpauCtx->device;
+    m_VdpGetProcAddress = vdpauCtx->get_proc_address;
 
     GET_PROC_ADDRESS(VDP_FUNC_ID_GET_ERROR_STRING, &m_VdpGetErrorString);
     GET_PROC_ADDRESS(VDP_FUNC_ID_PRESENTATION_QUEUE_TARGET_DESTROY, &m_VdpPresentationQueueTargetDestroy);
@@ -86,56 +115,116 @@ bool VDPAURenderer::initialize(PDECODER_PARAMETERS params)
     GET_PROC_ADDRESS(VDP_FUNC_ID_PRESENTATION_QUEUE_DESTROY, &m_VdpPresentationQueueDestroy);
     GET_PROC_ADDRESS(VDP_FUNC_ID_PRESENTATION_QUEUE_DISPLAY, &m_VdpPresentationQueueDisplay);
     GET_PROC_ADDRESS(VDP_FUNC_ID_PRESENTATION_QUEUE_SET_BACKGROUND_COLOR, &m_VdpPresentationQueueSetBackgroundColor);
-    GET_PROC_ADDRESS(VDP_FUNC_ID_PRESENTATION_QUEUE_BLOCK_UNTIL_SURFACE_IDLE, &m_VdpPresentationQueueBlockUntilSurfaceIdle);
+    GET_PROC_ADDRESS(VDP_FUNC_ID_PRESENTATION_QUEUE_QUERY_SURFACE_STATUS, &m_VdpPresentationQueueQuerySurfaceStatus);
+    GET_PROC_ADDRESS(VDP_FUNC_ID_PRESENTATION_QUEUE_GET_TIME, &m_VdpPresentationQueueGetTime);
     GET_PROC_ADDRESS(VDP_FUNC_ID_OUTPUT_SURFACE_CREATE, &m_VdpOutputSurfaceCreate);
     GET_PROC_ADDRESS(VDP_FUNC_ID_OUTPUT_SURFACE_DESTROY, &m_VdpOutputSurfaceDestroy);
     GET_PROC_ADDRESS(VDP_FUNC_ID_OUTPUT_SURFACE_QUERY_CAPABILITIES, &m_VdpOutputSurfaceQueryCapabilities);
     GET_PROC_ADDRESS(VDP_FUNC_ID_VIDEO_SURFACE_GET_PARAMETERS, &m_VdpVideoSurfaceGetParameters);
     GET_PROC_ADDRESS(VDP_FUNC_ID_GET_INFORMATION_STRING, &m_VdpGetInformationString);
+    GET_PROC_ADDRESS(VDP_FUNC_ID_BITMAP_SURFACE_CREATE, &m_VdpBitmapSurfaceCreate);
+    GET_PROC_ADDRESS(VDP_FUNC_ID_BITMAP_SURFACE_DESTROY, &m_VdpBitmapSurfaceDestroy);
+    GET_PROC_ADDRESS(VDP_FUNC_ID_BITMAP_SURFACE_PUT_BITS_NATIVE, &m_VdpBitmapSurfacePutBitsNative);
+    GET_PROC_ADDRESS(VDP_FUNC_ID_OUTPUT_SURFACE_RENDER_BITMAP_SURFACE, &m_VdpOutputSurfaceRenderBitmapSurface);
+    GET_PROC_ADDRESS(VDP_FUNC_ID_PRESENTATION_QUEUE_TARGET_CREATE_X11, &m_VdpPresentationQueueTargetCreateX11);
 
-    SDL_GetWindowSize(params->window, (int*)&m_DisplayWidth, (int*)&m_DisplayHeight);
+    // The device itself is usable from here on, even if this window isn't
+    m_DeviceReady = true;
 
-    SDL_VERSION(&info.version);
+    const char* infoString;
+    if (m_VdpGetInformationString(&infoString) == VDP_STATUS_OK) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Driver: %s",
+                    infoString);
+    }
 
-    if (!SDL_GetWindowWMInfo(params->window, &info)) {
-        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                     "SDL_GetWindowWMInfo() failed: %s",
-                     SDL_GetError());
+#ifdef HAVE_EGL
+    m_GLInterop = shouldUseGLInterop(params->window);
+#endif
+
+    return initializePresentation(params->window);
+}
+
+#ifdef HAVE_EGL
+bool VDPAURenderer::shouldUseGLInterop(SDL_Window* window)
+{
+    QByteArray interopEnv = qgetenv("VDPAU_GL_INTEROP");
+    if (interopEnv == "0") {
         return false;
     }
+    else if (interopEnv != "1") {
+        // The presentation queue is best when nothing composites our
+        // window, since it flips straight to the screen
+        SDL_SysWMinfo info;
+        SDL_VERSION(&info.version);
+        if (!SDL_GetWindowWMInfo(window, &info) || info.subsystem != SDL_SYSWM_X11) {
+            return false;
+        }
 
-    SDL_assert(info.subsystem == SDL_SYSWM_X11);
-
-    if (info.subsystem == SDL_SYSWM_X11) {
-        GET_PROC_ADDRESS(VDP_FUNC_ID_PRESENTATION_QUEUE_TARGET_CREATE_X11,
-                         &m_VdpPresentationQueueTargetCreateX11);
-        status = m_VdpPresentationQueueTargetCreateX11(m_Device,
-                                                       info.info.x11.window,
-                                                       &m_PresentationQueueTarget);
-        if (status != VDP_STATUS_OK) {
-            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                         "VdpPresentationQueueTargetCreateX11() failed: %s",
-                         m_VdpGetErrorString(status));
+        Display* display = info.info.x11.display;
+        char atomName[32];
+        SDL_snprintf(atomName, sizeof(atomName), "_NET_WM_CM_S%d", DefaultScreen(display));
+        Atom compositorAtom = XInternAtom(display, atomName, False);
+        if (compositorAtom == None || XGetSelectionOwner(display, compositorAtom) == None) {
             return false;
         }
     }
-    else if (info.subsystem == SDL_SYSWM_WAYLAND) {
-        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                     "VDPAU backend does not currently support Wayland");
+
+    // The EGL renderer draws into the window with GL
+    if (!(SDL_GetWindowFlags(window) & SDL_WINDOW_OPENGL)) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "VDPAU-GL interop requires an OpenGL window");
         return false;
     }
-    else {
-        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                     "Unsupported VDPAU rendering subsystem: %d",
-                     info.subsystem);
+
+    // A throwaway context tells us whether the driver can share surfaces
+    // with the contexts that the EGL renderer will create on this window
+    SDL_GLContext context = SDL_GL_CreateContext(window);
+    if (context == nullptr) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "SDL_GL_CreateContext() failed: %s",
+                    SDL_GetError());
         return false;
     }
 
-    const char* infoString;
-    if (m_VdpGetInformationString(&infoString) == VDP_STATUS_OK) {
+    const char* glExtensions = (const char*)glGetString(GL_EXTENSIONS);
+    bool supported = glExtensions != nullptr && strstr(glExtensions, "GL_NV_vdpau_interop") != nullptr;
+
+    SDL_GL_MakeCurrent(window, nullptr);
+    SDL_GL_DeleteContext(context);
+
+    if (!supported) {
         SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
-                    "Driver: %s",
-                    infoString);
+                    "GL_NV_vdpau_interop is not supported");
+        return false;
+    }
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Using VDPAU-GL interop for presentation");
+    return true;
+}
+#endif
+
+bool VDPAURenderer::initializePresentation(SDL_Window* window)
+{
+    VdpStatus status;
+
+    if (m_GLInterop) {
+        // The EGL renderer scales the frames to the window itself
+        m_DisplayWidth = m_VideoWidth;
+        m_DisplayHeight = m_VideoHeight;
+    }
+    else {
+        SDL_GetWindowSize(window, (int*)&m_DisplayWidth, (int*)&m_DisplayHeight);
+
+        // VdpTime is in nanoseconds
+        int refreshRate = StreamUtils::getDisplayRefreshRate(window);
+        m_RefreshPeriod = refreshRate > 0 ? 1000000000ULL / refreshRate : 0;
+        m_LastPresentationTime = 0;
+
+        if (!createPresentationQueueTarget(window)) {
+            return false;
+        }
     }
 
     // Try our available output formats to find something the GPU supports
@@ -200,6 +289,11 @@ bool VDPAURenderer::initialize(PDECODER_PARAMETERS params)
         }
     }
 
+    // The EGL renderer presents the frames
+    if (m_GLInterop) {
+        return true;
+    }
+
     status = m_VdpPresentationQueueCreate(m_Device, m_PresentationQueueTarget,
                                           &m_PresentationQueue);
     if (status != VDP_STATUS_OK) {
@@ -216,12 +310,260 @@ bool VDPAURenderer::initialize(PDECODER_PARAMETERS params)
     return true;
 }
 
+bool VDPAURenderer::createPresentationQueueTarget(SDL_Window* window)
+{
+    VdpStatus status;
+    SDL_SysWMinfo info;
+
+    SDL_VERSION(&info.version);
+
+    if (!SDL_GetWindowWMInfo(window, &info)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "SDL_GetWindowWMInfo() failed: %s",
+                     SDL_GetError());
+        return false;
+    }
+
+    SDL_assert(info.subsystem == SDL_SYSWM_X11);
+
+    if (info.subsystem == SDL_SYSWM_X11) {
+        status = m_VdpPresentationQueueTargetCreateX11(m_Device,
+                                                       info.info.x11.window,
+                                                       &m_PresentationQueueTarget);
+        if (status != VDP_STATUS_OK) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "VdpPresentationQueueTargetCreateX11() failed: %s",
+                         m_VdpGetErrorString(status));
+            return false;
+        }
+    }
+    else if (info.subsystem == SDL_SYSWM_WAYLAND) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "VDPAU backend does not currently support Wayland");
+        return false;
+    }
+    else {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unsupported VDPAU rendering subsystem: %d",
+                     info.subsystem);
+        return false;
+    }
+
+    return true;
+}
+
+void VDPAURenderer::destroyPresentation()
+{
+    if (m_PresentationQueue != 0) {
+        m_VdpPresentationQueueDestroy(m_PresentationQueue);
+        m_PresentationQueue = 0;
+    }
+
+    if (m_PresentationQueueTarget != 0) {
+        m_VdpPresentationQueueTargetDestroy(m_PresentationQueueTarget);
+        m_PresentationQueueTarget = 0;
+    }
+
+    for (int i = 0; i < OUTPUT_SURFACE_COUNT; i++) {
+        if (m_OutputSurface[i] != 0) {
+            m_VdpOutputSurfaceDestroy(m_OutputSurface[i]);
+            m_OutputSurface[i] = 0;
+        }
+    }
+
+    SDL_zero(m_OutputSurfaceQueued);
+    m_NextSurfaceIndex = 0;
+}
+
+bool VDPAURenderer::reinitializePresentation(PDECODER_PARAMETERS params)
+{
+    // The output surfaces and presentation queue are sized for and bound
+    // to the window. The decoder's video surfaces and mixer are not.
+    destroyPresentation();
+    return initializePresentation(params->window);
+}
+
+void VDPAURenderer::notifyOverlayUpdated(Overlay::OverlayType type)
+{
+    // This may be called on any thread, so we just flag the overlay
+    // for upload by the thread calling renderFrame().
+    int pendingUpdates;
+    do {
+        pendingUpdates = SDL_AtomicGet(&m_PendingOverlayUpdates);
+    } while (!SDL_AtomicCAS(&m_PendingOverlayUpdates, pendingUpdates, pendingUpdates | (1 << type)));
+}
+
+bool VDPAURenderer::usesOverlaySurfaces()
+{
+    return true;
+}
+
+void VDPAURenderer::updateOverlaySurface(Overlay::OverlayType type)
+{
+    VdpStatus status;
+
+    SDL_Surface* surface = Session::get()->getOverlayManager().getUpdatedOverlaySurface(type);
+
+    if (!Session::get()->getOverlayManager().isOverlayEnabled(type)) {
+        // Hide the overlay but keep the bitmap surface around for next time
+        m_Overlays[type].width = m_Overlays[type].height = 0;
+        if (surface != nullptr) {
+            SDL_FreeSurface(surface);
+        }
+        return;
+    }
+    else if (surface == nullptr) {
+        // Nothing new to upload
+        return;
+    }
+
+    // Reuse the existing bitmap surface if the new overlay fits inside it
+    if (m_Overlays[type].surface != 0 &&
+            (m_Overlays[type].surfaceWidth < (uint32_t)surface->w ||
+             m_Overlays[type].surfaceHeight < (uint32_t)surface->h)) {
+        m_VdpBitmapSurfaceDestroy(m_Overlays[type].surface);
+        m_Overlays[type].surface = 0;
+    }
+
+    if (m_Overlays[type].surface == 0) {
+        // The overlay surface is premultiplied ARGB8888, which is B8G8R8A8 in memory
+        status = m_VdpBitmapSurfaceCreate(m_Device, VDP_RGBA_FORMAT_B8G8R8A8,
+                                          surface->w, surface->h, VDP_TRUE,
+                                          &m_Overlays[type].surface);
+        if (status != VDP_STATUS_OK) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "VdpBitmapSurfaceCreate() failed: %s",
+                         m_VdpGetErrorString(status));
+            m_Overlays[type].surface = 0;
+            m_Overlays[type].width = m_Overlays[type].height = 0;
+            SDL_FreeSurface(surface);
+            return;
+        }
+
+        m_Overlays[type].surfaceWidth = surface->w;
+        m_Overlays[type].surfaceHeight = surface->h;
+    }
+
+    const void* data[1] = { surface->pixels };
+    uint32_t pitches[1] = { (uint32_t)surface->pitch };
+    VdpRect destRect = { 0, 0, (uint32_t)surface->w, (uint32_t)surface->h };
+    status = m_VdpBitmapSurfacePutBitsNative(m_Overlays[type].surface, data, pitches, &destRect);
+    if (status != VDP_STATUS_OK) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "VdpBitmapSurfacePutBitsNative() failed: %s",
+                     m_VdpGetErrorString(status));
+        m_Overlays[type].width = m_Overlays[type].height = 0;
+        SDL_FreeSurface(surface);
+        return;
+    }
+
+    m_Overlays[type].width = surface->w;
+    m_Overlays[type].height = surface->h;
+    SDL_FreeSurface(surface);
+}
+
+void VDPAURenderer::renderOverlays(VdpOutputSurface destination, const VdpRect& videoRect)
+{
+    // Upload any overlays updated by notifyOverlayUpdated() since the last frame
+    int pendingUpdates = SDL_AtomicSet(&m_PendingOverlayUpdates, 0);
+    for (int i = 0; i < Overlay::OverlayMax; i++) {
+        if (pendingUpdates & (1 << i)) {
+            updateOverlaySurface((Overlay::OverlayType)i);
+        }
+    }
+
+    // The overlay surfaces have premultiplied alpha
+    VdpOutputSurfaceRenderBlendState blendState = {};
+    blendState.struct_version = VDP_OUTPUT_SURFACE_RENDER_BLEND_STATE_VERSION;
+    blendState.blend_factor_source_color = VDP_OUTPUT_SURFACE_RENDER_BLEND_FACTOR_ONE;
+    blendState.blend_factor_destination_color = VDP_OUTPUT_SURFACE_RENDER_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+    blendState.blend_factor_source_alpha = VDP_OUTPUT_SURFACE_RENDER_BLEND_FACTOR_ONE;
+    blendState.blend_factor_destination_alpha = VDP_OUTPUT_SURFACE_RENDER_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+    blendState.blend_equation_color = VDP_OUTPUT_SURFACE_RENDER_BLEND_EQUATION_ADD;
+    blendState.blend_equation_alpha = VDP_OUTPUT_SURFACE_RENDER_BLEND_EQUATION_ADD;
+
+    for (int i = 0; i < Overlay::OverlayMax; i++) {
+        if (m_Overlays[i].surface == 0 || m_Overlays[i].width == 0) {
+            continue;
+        }
+
+        VdpRect sourceRect = { 0, 0, m_Overlays[i].width, m_Overlays[i].height };
+        VdpRect destRect;
+
+        // Debug at the top left and status at the bottom left of the video
+        destRect.x0 = videoRect.x0;
+        if (i == Overlay::OverlayStatusUpdate) {
+            destRect.y0 = videoRect.y1 - SDL_min(m_Overlays[i].height, videoRect.y1);
+        }
+        else {
+            destRect.y0 = videoRect.y0;
+        }
+        destRect.x1 = destRect.x0 + m_Overlays[i].width;
+        destRect.y1 = destRect.y0 + m_Overlays[i].height;
+
+        VdpStatus status = m_VdpOutputSurfaceRenderBitmapSurface(destination, &destRect,
+                                                                 m_Overlays[i].surface, &sourceRect,
+                                                                 nullptr, &blendState,
+                                                                 VDP_OUTPUT_SURFACE_RENDER_ROTATE_0);
+        if (status != VDP_STATUS_OK) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "VdpOutputSurfaceRenderBitmapSurface() failed: %s",
+                         m_VdpGetErrorString(status));
+        }
+    }
+}
+
+int VDPAURenderer::findIdleOutputSurface(VdpTime now)
+{
+    int idleIndex = -1;
+
+    // Prefer the oldest surface to give the GPU the most time to finish with it
+    for (int i = 0; i < OUTPUT_SURFACE_COUNT; i++) {
+        int index = (m_NextSurfaceIndex + i) % OUTPUT_SURFACE_COUNT;
+        VdpPresentationQueueStatus queueStatus;
+        VdpTime firstPresentationTime;
+
+        VdpStatus status = m_VdpPresentationQueueQuerySurfaceStatus(m_PresentationQueue, m_OutputSurface[index],
+                                                                    &queueStatus, &firstPresentationTime);
+        if (status != VDP_STATUS_OK) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "VdpPresentationQueueQuerySurfaceStatus() failed: %s",
+                         m_VdpGetErrorString(status));
+            continue;
+        }
+
+        // Once a queued frame has reached the screen, we know exactly when
+        // it did. That gives us the V-sync phase for scheduling later frames.
+        if (m_OutputSurfaceQueued[index] && queueStatus != VDP_PRESENTATION_QUEUE_STATUS_QUEUED) {
+            m_OutputSurfaceQueued[index] = false;
+
+            if (firstPresentationTime != 0) {
+                if (firstPresentationTime > m_LastPresentationTime) {
+                    m_LastPresentationTime = firstPresentationTime;
+                }
+
+                if (now > firstPresentationTime) {
+                    FrameTracer::mark(m_OutputSurfaceFrameNumber[index], FrameTracer::FTS_DISPLAYED,
+                                      StreamUtils::getTimeUs() - (now - firstPresentationTime) / 1000);
+                }
+            }
+        }
+
+        if (queueStatus == VDP_PRESENTATION_QUEUE_STATUS_IDLE && idleIndex < 0) {
+            idleIndex = index;
+        }
+    }
+
+    return idleIndex;
+}
+
 bool VDPAURenderer::prepareDecoderContext(AVCodecContext* context)
 {
     context->hw_device_ctx = av_buffer_ref(m_HwContext);
 
     // Allow HEVC usage on VDPAU. This was disabled by FFmpeg due to
-    // GL interop issues, but we use VDPAU for rendering so it's no issue.
+    // GL interop issues with video surfaces, but we only ever render them
+    // with VDPAU's mixer so it's no issue.
     // https://github.com/FFmpeg/FFmpeg/commit/64ecb78b7179cab2dbdf835463104679dbb7c895
     context->hwaccel_flags |= AV_HWACCEL_FLAG_ALLOW_PROFILE_MISMATCH;
 
@@ -241,59 +583,82 @@ bool VDPAURenderer::needsTestFrame()
     return true;
 }
 
+bool VDPAURenderer::createVideoMixer(VdpVideoSurface videoSurface)
+{
+    VdpStatus status;
+    VdpChromaType videoSurfaceChroma;
+    uint32_t videoSurfaceWidth, videoSurfaceHeight;
+
+    status = m_VdpVideoSurfaceGetParameters(videoSurface, &videoSurfaceChroma,
+                                            &videoSurfaceWidth, &videoSurfaceHeight);
+    if (status != VDP_STATUS_OK) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "VdpVideoSurfaceGetParameters() failed: %s",
+                     m_VdpGetErrorString(status));
+        return false;
+    }
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "VDPAU surface size: %dx%d",
+                videoSurfaceWidth, videoSurfaceHeight);
+
+#define PARAM_COUNT 3
+    const VdpVideoMixerParameter params[PARAM_COUNT] = {
+        VDP_VIDEO_MIXER_PARAMETER_VIDEO_SURFACE_WIDTH,
+        VDP_VIDEO_MIXER_PARAMETER_VIDEO_SURFACE_HEIGHT,
+        VDP_VIDEO_MIXER_PARAMETER_CHROMA_TYPE,
+    };
+    const void* const paramValues[PARAM_COUNT] = {
+        &videoSurfaceWidth,
+        &videoSurfaceHeight,
+        &videoSurfaceChroma,
+    };
+
+    status = m_VdpVideoMixerCreate(m_Device, 0, nullptr,
+                                   PARAM_COUNT, params, paramValues,
+                                   &m_VideoMixer);
+    if (status != VDP_STATUS_OK) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "VdpVideoMixerCreate() failed: %s",
+                     m_VdpGetErrorString(status));
+        m_VideoMixer = 0;
+        return false;
+    }
+
+    return true;
+}
+
 void VDPAURenderer::renderFrame(AVFrame* frame)
 {
     VdpStatus status;
     VdpVideoSurface videoSurface = (VdpVideoSurface)(uintptr_t)frame->data[3];
 
-    // This is safe without locking because this is always called on the main thread
-    VdpOutputSurface chosenSurface = m_OutputSurface[m_NextSurfaceIndex];
-    m_NextSurfaceIndex = (m_NextSurfaceIndex + 1) % OUTPUT_SURFACE_COUNT;
-
     // We need to create the mixer on the fly, because we don't know the dimensions
     // of our video surfaces in advance of decoding
-    if (m_VideoMixer == 0) {
-        VdpChromaType videoSurfaceChroma;
-        uint32_t videoSurfaceWidth, videoSurfaceHeight;
-        status = m_VdpVideoSurfaceGetParameters(videoSurface, &videoSurfaceChroma,
-                                                &videoSurfaceWidth, &videoSurfaceHeight);
-        if (status != VDP_STATUS_OK) {
-            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                         "VdpVideoSurfaceGetParameters() failed: %s",
-                         m_VdpGetErrorString(status));
-            return;
-        }
+    if (m_VideoMixer == 0 && !createVideoMixer(videoSurface)) {
+        return;
+    }
 
-        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
-                    "VDPAU surface size: %dx%d",
-                    videoSurfaceWidth, videoSurfaceHeight);
-
-    #define PARAM_COUNT 3
-        const VdpVideoMixerParameter params[PARAM_COUNT] = {
-            VDP_VIDEO_MIXER_PARAMETER_VIDEO_SURFACE_WIDTH,
-            VDP_VIDEO_MIXER_PARAMETER_VIDEO_SURFACE_HEIGHT,
-            VDP_VIDEO_MIXER_PARAMETER_CHROMA_TYPE,
-        };
-        const void* const paramValues[PARAM_COUNT] = {
-            &videoSurfaceWidth,
-            &videoSurfaceHeight,
-            &videoSurfaceChroma,
-        };
-
-        status = m_VdpVideoMixerCreate(m_Device, 0, nullptr,
-                                       PARAM_COUNT, params, paramValues,
-                                       &m_VideoMixer);
-        if (status != VDP_STATUS_OK) {
-            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                         "VdpVideoMixerCreate() failed: %s",
-                         m_VdpGetErrorString(status));
-            return;
-        }
+    VdpTime now;
+    status = m_VdpPresentationQueueGetTime(m_PresentationQueue, &now);
+    if (status != VDP_STATUS_OK) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "VdpPresentationQueueGetTime() failed: %s",
+                     m_VdpGetErrorString(status));
+        return;
     }
 
-    // Wait for this frame to be off the screen
-    VdpTime pts;
-    m_VdpPresentationQueueBlockUntilSurfaceIdle(m_PresentationQueue, chosenSurface, &pts);
+    // This is safe without locking because this is always called on the main thread
+    int surfaceIndex = findIdleOutputSurface(now);
+    if (surfaceIndex < 0) {
+        // Blocking here would just add latency to this frame and
+        // every one after it, so drop this one instead.
+        m_DroppedFrames++;
+        return;
+    }
+
+    VdpOutputSurface chosenSurface = m_OutputSurface[surfaceIndex];
+    m_NextSurfaceIndex = (surfaceIndex + 1) % OUTPUT_SURFACE_COUNT;
 
     VdpRect sourceRect, outputRect;
 
@@ -336,12 +701,169 @@ void VDPAURenderer::renderFrame(AVFrame* frame)
         return;
     }
 
-    // Queue the frame for display immediately
-    status = m_VdpPresentationQueueDisplay(m_PresentationQueue, chosenSurface, 0, 0, 0);
+    renderOverlays(chosenSurface, outputRect);
+
+    // Schedule the frame for the next V-sync. We aim half a period early
+    // so a little jitter in our V-sync estimate can't push it back a
+    // whole refresh. Until we know the V-sync phase, display ASAP.
+    VdpTime presentationTime = 0;
+    if (m_LastPresentationTime != 0 && m_RefreshPeriod != 0 && now > m_LastPresentationTime) {
+        VdpTime nextVsync = m_LastPresentationTime +
+                ((now - m_LastPresentationTime) / m_RefreshPeriod + 1) * m_RefreshPeriod;
+        presentationTime = nextVsync - m_RefreshPeriod / 2;
+    }
+
+    status = m_VdpPresentationQueueDisplay(m_PresentationQueue, chosenSurface, 0, 0, presentationTime);
     if (status != VDP_STATUS_OK) {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
                      "VdpPresentationQueueDisplay() failed: %s",
                      m_VdpGetErrorString(status));
         return;
     }
+
+    m_OutputSurfaceFrameNumber[surfaceIndex] = (int)frame->pkt_dts;
+    m_OutputSurfaceQueued[surfaceIndex] = true;
+}
+
+bool VDPAURenderer::isDirectRenderingSupported()
+{
+    // With GL interop, the EGL renderer draws our frames
+    return !m_GLInterop;
+}
+
+#ifdef HAVE_EGL
+bool VDPAURenderer::canMapGLTexture()
+{
+    return m_GLInterop;
+}
+
+bool VDPAURenderer::initializeGLInterop()
+{
+    m_GLVDPAUInitNV = (PFNGLVDPAUINITNVPROC)SDL_GL_GetProcAddress("glVDPAUInitNV");
+    m_GLVDPAUFiniNV = (PFNGLVDPAUFININVPROC)SDL_GL_GetProcAddress("glVDPAUFiniNV");
+    m_GLVDPAURegisterOutputSurfaceNV = (PFNGLVDPAUREGISTEROUTPUTSURFACENVPROC)SDL_GL_GetProcAddress("glVDPAURegisterOutputSurfaceNV");
+    m_GLVDPAUUnregisterSurfaceNV = (PFNGLVDPAUUNREGISTERSURFACENVPROC)SDL_GL_GetProcAddress("glVDPAUUnregisterSurfaceNV");
+    m_GLVDPAUSurfaceAccessNV = (PFNGLVDPAUSURFACEACCESSNVPROC)SDL_GL_GetProcAddress("glVDPAUSurfaceAccessNV");
+    m_GLVDPAUMapSurfacesNV = (PFNGLVDPAUMAPSURFACESNVPROC)SDL_GL_GetProcAddress("glVDPAUMapSurfacesNV");
+    m_GLVDPAUUnmapSurfacesNV = (PFNGLVDPAUUNMAPSURFACESNVPROC)SDL_GL_GetProcAddress("glVDPAUUnmapSurfacesNV");
+    if (m_GLVDPAUInitNV == nullptr || m_GLVDPAUFiniNV == nullptr ||
+            m_GLVDPAURegisterOutputSurfaceNV == nullptr || m_GLVDPAUUnregisterSurfaceNV == nullptr ||
+            m_GLVDPAUSurfaceAccessNV == nullptr || m_GLVDPAUMapSurfacesNV == nullptr ||
+            m_GLVDPAUUnmapSurfacesNV == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "GL_NV_vdpau_interop functions are missing");
+        return false;
+    }
+
+    m_GLVDPAUInitNV((const void*)(uintptr_t)m_Device, (const void*)m_VdpGetProcAddress);
+    m_GLInteropReady = true;
+
+    // The textures take on the storage of the output surfaces
+    glGenTextures(OUTPUT_SURFACE_COUNT, m_GLTextures);
+    for (int i = 0; i < OUTPUT_SURFACE_COUNT; i++) {
+        glBindTexture(GL_TEXTURE_2D, m_GLTextures[i]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        m_GLSurfaces[i] = m_GLVDPAURegisterOutputSurfaceNV((const void*)(uintptr_t)m_OutputSurface[i],
+                                                           GL_TEXTURE_2D, 1, &m_GLTextures[i]);
+        if (m_GLSurfaces[i] == 0) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "glVDPAURegisterOutputSurfaceNV() failed: %x",
+                         glGetError());
+            return false;
+        }
+
+        m_GLVDPAUSurfaceAccessNV(m_GLSurfaces[i], GL_READ_ONLY);
+    }
+
+    return true;
+}
+
+bool VDPAURenderer::mapGLTexture(AVFrame* frame)
+{
+    VdpStatus status;
+    VdpVideoSurface videoSurface = (VdpVideoSurface)(uintptr_t)frame->data[3];
+
+    SDL_assert(m_MappedSurfaceIndex < 0);
+
+    // Frames are dropped rather than failing the same way for each one
+    if (m_GLInteropFailed) {
+        return false;
+    }
+    else if (!m_GLInteropReady && !initializeGLInterop()) {
+        releaseGLTextures();
+        m_GLInteropFailed = true;
+        return false;
+    }
+
+    if (m_VideoMixer == 0 && !createVideoMixer(videoSurface)) {
+        return false;
+    }
+
+    // Mapping waits for the mixer to finish with the surface and unmapping
+    // waits for GL, so rotating through the surfaces lets the mixer render
+    // the next frame while the last one is still being drawn
+    int surfaceIndex = m_NextSurfaceIndex;
+    m_NextSurfaceIndex = (surfaceIndex + 1) % OUTPUT_SURFACE_COUNT;
+
+    VdpRect sourceRect = { 0, 0, m_VideoWidth, m_VideoHeight };
+    status = m_VdpVideoMixerRender(m_VideoMixer,
+                                   VDP_INVALID_HANDLE, nullptr,
+                                   VDP_VIDEO_MIXER_PICTURE_STRUCTURE_FRAME,
+                                   0, nullptr,
+                                   videoSurface,
+                                   0, nullptr,
+                                   &sourceRect,
+                                   m_OutputSurface[surfaceIndex],
+                                   nullptr,
+                                   &sourceRect,
+                                   0,
+                                   nullptr);
+    if (status != VDP_STATUS_OK) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "VdpVideoMixerRender() failed: %s",
+                     m_VdpGetErrorString(status));
+        return false;
+    }
+
+    m_GLVDPAUMapSurfacesNV(1, &m_GLSurfaces[surfaceIndex]);
+    glBindTexture(GL_TEXTURE_2D, m_GLTextures[surfaceIndex]);
+    m_MappedSurfaceIndex = surfaceIndex;
+
+    return true;
+}
+
+void VDPAURenderer::unmapGLTexture()
+{
+    if (m_MappedSurfaceIndex >= 0) {
+        m_GLVDPAUUnmapSurfacesNV(1, &m_GLSurfaces[m_MappedSurfaceIndex]);
+        m_MappedSurfaceIndex = -1;
+    }
+}
+
+void VDPAURenderer::releaseGLTextures()
+{
+    unmapGLTexture();
+
+    for (int i = 0; i < OUTPUT_SURFACE_COUNT; i++) {
+        if (m_GLSurfaces[i] != 0) {
+            m_GLVDPAUUnregisterSurfaceNV(m_GLSurfaces[i]);
+            m_GLSurfaces[i] = 0;
+        }
+    }
+
+    if (m_GLTextures[0] != 0) {
+        glDeleteTextures(OUTPUT_SURFACE_COUNT, m_GLTextures);
+        SDL_zero(m_GLTextures);
+    }
+
+    // The next EGL renderer registers the surfaces again in its own context
+    if (m_GLInteropReady) {
+        m_GLVDPAUFiniNV();
+        m_GLInteropReady = false;
+    }
 }
+#endif
@@ -8,6 +8,22 @@ extern "C" {
 #include <libavutil/hwcontext_vdpau.h>
 }
 
+#ifdef HAVE_EGL
+// GL_NV_vdpau_interop isn't in the GLES headers
+#ifndef GL_READ_ONLY
+#define GL_READ_ONLY 0x88B8
+#endif
+typedef GLintptr GLvdpauSurfaceNV;
+typedef void (*PFNGLVDPAUINITNVPROC)(const void* vdpDevice, const void* getProcAddress);
+typedef void (*PFNGLVDPAUFININVPROC)(void);
+typedef GLvdpauSurfaceNV (*PFNGLVDPAUREGISTEROUTPUTSURFACENVPROC)(const void* vdpSurface, GLenum target,
+                                                                  GLsizei numTextureNames, const GLuint* textureNames);
+typedef void (*PFNGLVDPAUUNREGISTERSURFACENVPROC)(GLvdpauSurfaceNV surface);
+typedef void (*PFNGLVDPAUSURFACEACCESSNVPROC)(GLvdpauSurfaceNV surface, GLenum access);
+typedef void (*PFNGLVDPAUMAPSURFACESNVPROC)(GLsizei numSurfaces, const GLvdpauSurfaceNV* surfaces);
+typedef void (*PFNGLVDPAUUNMAPSURFACESNVPROC)(GLsizei numSurfaces, const GLvdpauSurfaceNV* surfaces);
+#endif
+
 class VDPAURenderer : public IFFmpegRenderer
 {
 public:
@@ -17,24 +33,86 @@ public:
     virtual bool prepareDecoderContext(AVCodecContext* context) override;
     virtual void renderFrame(AVFrame* frame) override;
     virtual bool needsTestFrame() override;
+    virtual bool reinitializePresentation(PDECODER_PARAMETERS params) override;
+    virtual void notifyOverlayUpdated(Overlay::OverlayType type) override;
+    virtual bool usesOverlaySurfaces() override;
+    virtual bool isDirectRenderingSupported() override;
+
+#ifdef HAVE_EGL
+    virtual bool canMapGLTexture() override;
+    virtual bool mapGLTexture(AVFrame* frame) override;
+    virtual void unmapGLTexture() override;
+    virtual void releaseGLTextures() override;
+#endif
 
 private:
+    bool initializePresentation(SDL_Window* window);
+    bool createPresentationQueueTarget(SDL_Window* window);
+    bool createVideoMixer(VdpVideoSurface videoSurface);
+#ifdef HAVE_EGL
+    bool shouldUseGLInterop(SDL_Window* window);
+    bool initializeGLInterop();
+#endif
+    void destroyPresentation();
+    void updateOverlaySurface(Overlay::OverlayType type);
+    void renderOverlays(VdpOutputSurface destination, const VdpRect& videoRect);
+    int findIdleOutputSurface(VdpTime now);
+
     uint32_t m_VideoWidth, m_VideoHeight;
     uint32_t m_DisplayWidth, m_DisplayHeight;
     AVBufferRef* m_HwContext;
+    bool m_DeviceReady;
     VdpPresentationQueueTarget m_PresentationQueueTarget;
     VdpPresentationQueue m_PresentationQueue;
     VdpVideoMixer m_VideoMixer;
     VdpRGBAFormat m_OutputSurfaceFormat;
     VdpDevice m_Device;
+    VdpGetProcAddress* m_VdpGetProcAddress;
+
+    // Frames are handed to the EGL renderer as GL textures instead of
+    // going through the presentation queue, which avoids the extra trip
+    // through the compositor and its tearing on composited desktops
+    bool m_GLInterop;
 
-#define OUTPUT_SURFACE_COUNT 3
+    // We never wait for an output surface to come off the screen. If
+    // every surface is visible or queued, the frame is dropped instead.
+#define OUTPUT_SURFACE_COUNT 4
     VdpOutputSurface m_OutputSurface[OUTPUT_SURFACE_COUNT];
+    int m_OutputSurfaceFrameNumber[OUTPUT_SURFACE_COUNT];
+    bool m_OutputSurfaceQueued[OUTPUT_SURFACE_COUNT];
     int m_NextSurfaceIndex;
+    VdpTime m_LastPresentationTime;
+    VdpTime m_RefreshPeriod;
+    int m_DroppedFrames;
+
+#ifdef HAVE_EGL
+    // Each output surface is registered as a texture in the EGL renderer's
+    // context the first time a frame is mapped
+    bool m_GLInteropReady;
+    bool m_GLInteropFailed;
+    GLuint m_GLTextures[OUTPUT_SURFACE_COUNT];
+    GLvdpauSurfaceNV m_GLSurfaces[OUTPUT_SURFACE_COUNT];
+    int m_MappedSurfaceIndex;
+
+    PFNGLVDPAUINITNVPROC m_GLVDPAUInitNV;
+    PFNGLVDPAUFININVPROC m_GLVDPAUFiniNV;
+    PFNGLVDPAUREGISTEROUTPUTSURFACENVPROC m_GLVDPAURegisterOutputSurfaceNV;
+    PFNGLVDPAUUNREGISTERSURFACENVPROC m_GLVDPAUUnregisterSurfaceNV;
+    PFNGLVDPAUSURFACEACCESSNVPROC m_GLVDPAUSurfaceAccessNV;
+    PFNGLVDPAUMAPSURFACESNVPROC m_GLVDPAUMapSurfacesNV;
+    PFNGLVDPAUUNMAPSURFACESNVPROC m_GLVDPAUUnmapSurfacesNV;
+#endif
 
 #define OUTPUT_SURFACE_FORMAT_COUNT 2
     static const VdpRGBAFormat k_OutputFormats[OUTPUT_SURFACE_FORMAT_COUNT];
 
+    struct {
+        VdpBitmapSurface surface;
+        uint32_t surfaceWidth, surfaceHeight;
+        uint32_t width, height;
+    } m_Overlays[Overlay::OverlayMax];
+    SDL_atomic_t m_PendingOverlayUpdates;
+
     VdpGetErrorString* m_VdpGetErrorString;
     VdpPresentationQueueTargetDestroy* m_VdpPresentationQueueTargetDestroy;
     VdpVideoMixerCreate* m_VdpVideoMixerCreate;
@@ -44,12 +122,17 @@ private:
     VdpPresentationQueueDestroy* m_VdpPresentationQueueDestroy;
     VdpPresentationQueueDisplay* m_VdpPresentationQueueDisplay;
     VdpPresentationQueueSetBackgroundColor* m_VdpPresentationQueueSetBackgroundColor;
-    VdpPresentationQueueBlockUntilSurfaceIdle* m_VdpPresentationQueueBlockUntilSurfaceIdle;
+    VdpPresentationQueueQuerySurfaceStatus* m_VdpPresentationQueueQuerySurfaceStatus;
+    VdpPresentationQueueGetTime* m_VdpPresentationQueueGetTime;
     VdpOutputSurfaceCreate* m_VdpOutputSurfaceCreate;
     VdpOutputSurfaceDestroy* m_VdpOutputSurfaceDestroy;
     VdpOutputSurfaceQueryCapabilities* m_VdpOutputSurfaceQueryCapabilities;
     VdpVideoSurfaceGetParameters* m_VdpVideoSurfaceGetParameters;
     VdpGetInformationString* m_VdpGetInformationString;
+    VdpBitmapSurfaceCreate* m_VdpBitmapSurfaceCreate;
+    VdpBitmapSurfaceDestroy* m_VdpBitmapSurfaceDestroy;
+    VdpBitmapSurfacePutBitsNative* m_VdpBitmapSurfacePutBitsNative;
+    VdpOutputSurfaceRenderBitmapSurface* m_VdpOutputSurfaceRenderBitmapSurface;
 
     // X11 stuff
     VdpPresentationQueueTargetCreateX11* m_VdpPresentationQueueTargetCreateX11;
@@ -8,4 +8,8 @@ class VTRendererFactory {
 public:
     static
     IFFmpegRenderer* createRenderer();
+
+    // Presents through Metal instead of AVSampleBufferDisplayLayer
+    static
+    IFFmpegRenderer* createMetalRenderer();
 };
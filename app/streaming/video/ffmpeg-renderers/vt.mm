@@ -8,26 +8,253 @@
 #include <SDL_syswm.h>
 #include <Limelight.h>
 #include <streaming/session.h>
+#include <streaming/streamutils.h>
+
+#include <memory>
 
 #include <mach/mach_time.h>
+#include <libkern/OSByteOrder.h>
 #import <Cocoa/Cocoa.h>
 #import <VideoToolbox/VideoToolbox.h>
 #import <AVFoundation/AVFoundation.h>
+#import <Metal/Metal.h>
+#import <QuartzCore/CAMetalLayer.h>
 #import <dispatch/dispatch.h>
 
-class VTRenderer : public IFFmpegRenderer
+extern "C" {
+#include <libavutil/mastering_display_metadata.h>
+}
+
+// Everything shared by our VideoToolbox renderers: the decoder device,
+// the view they present in and the overlays drawn on top of it.
+class VTBaseRenderer : public IFFmpegRenderer
 {
 public:
-    VTRenderer()
+    VTBaseRenderer()
         : m_HwContext(nullptr),
-          m_DisplayLayer(nullptr),
+          m_StreamView(nullptr)
+    {
+        SDL_zero(m_OverlayTextFields);
+    }
+
+    virtual ~VTBaseRenderer() override
+    {
+        if (m_HwContext != nullptr) {
+            av_buffer_unref(&m_HwContext);
+        }
+
+        for (int i = 0; i < Overlay::OverlayMax; i++) {
+            if (m_OverlayTextFields[i] != nullptr) {
+                [m_OverlayTextFields[i] removeFromSuperview];
+            }
+        }
+
+        if (m_StreamView != nullptr) {
+            [m_StreamView removeFromSuperview];
+        }
+    }
+
+    // Checks for hardware decoding support and creates the decoder device
+    bool initializeDecoder(PDECODER_PARAMETERS params, SDL_SysWMinfo* info)
+    {
+        int err;
+
+        if (params->videoFormat & VIDEO_FORMAT_MASK_H264) {
+            // Prior to 10.13, we'll just assume everything has
+            // H.264 support and fail open to allow VT decode.
+    #if __MAC_OS_X_VERSION_MAX_ALLOWED >= 101300
+            if (__builtin_available(macOS 10.13, *)) {
+                if (!VTIsHardwareDecodeSupported(kCMVideoCodecType_H264)) {
+                    SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                                "No HW accelerated H.264 decode via VT");
+                    return false;
+                }
+            }
+            else
+    #endif
+            {
+                SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                            "Assuming H.264 HW decode on < macOS 10.13");
+            }
+        }
+        else if (params->videoFormat & VIDEO_FORMAT_MASK_H265) {
+    #if __MAC_OS_X_VERSION_MAX_ALLOWED >= 101300
+            if (__builtin_available(macOS 10.13, *)) {
+                if (!VTIsHardwareDecodeSupported(kCMVideoCodecType_HEVC)) {
+                    SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                                "No HW accelerated HEVC decode via VT");
+                    return false;
+                }
+            }
+            else
+    #endif
+            {
+                // Fail closed for HEVC if we're not on 10.13+
+                SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                            "No HEVC support on < macOS 10.13");
+                return false;
+            }
+        }
+
+        SDL_VERSION(&info->version);
+
+        if (!SDL_GetWindowWMInfo(params->window, info)) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "SDL_GetWindowWMInfo() failed: %s",
+                        SDL_GetError());
+            return false;
+        }
+
+        SDL_assert(info->subsystem == SDL_SYSWM_COCOA);
+
+        err = av_hwdevice_ctx_create(&m_HwContext,
+                                     AV_HWDEVICE_TYPE_VIDEOTOOLBOX,
+                                     nullptr,
+                                     nullptr,
+                                     0);
+        if (err < 0) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "av_hwdevice_ctx_create() failed for VT decoder: %d",
+                        err);
+            return false;
+        }
+
+        return true;
+    }
+
+    // SDL adds its own content view to listen for events.
+    // We need to add a subview for our display layer.
+    void attachDisplayLayer(SDL_SysWMinfo* info, CALayer* layer)
+    {
+        NSView* contentView = info->info.cocoa.window.contentView;
+        m_StreamView = [[NSView alloc] initWithFrame:contentView.bounds];
+
+        layer.bounds = m_StreamView.bounds;
+        layer.position = CGPointMake(CGRectGetMidX(m_StreamView.bounds), CGRectGetMidY(m_StreamView.bounds));
+
+        // Create a layer-hosted view by setting the layer before wantsLayer
+        // This avoids us having to add our display layer as a sublayer of
+        // a layer-backed view which leaves a useless layer in the middle.
+        m_StreamView.layer = layer;
+        m_StreamView.wantsLayer = YES;
+
+        [contentView addSubview: m_StreamView];
+    }
+
+    void updateOverlayOnMainThread(Overlay::OverlayType type)
+    {
+        // Lazy initialization for the overlay
+        if (m_OverlayTextFields[type] == nullptr) {
+            m_OverlayTextFields[type] = [[NSTextField alloc] initWithFrame:m_StreamView.bounds];
+            [m_OverlayTextFields[type] setBezeled:NO];
+            [m_OverlayTextFields[type] setDrawsBackground:NO];
+            [m_OverlayTextFields[type] setEditable:NO];
+            [m_OverlayTextFields[type] setSelectable:NO];
+
+            switch (type) {
+            case Overlay::OverlayDebug:
+                [m_OverlayTextFields[type] setAlignment:NSLeftTextAlignment];
+                break;
+            case Overlay::OverlayStatusUpdate:
+                [m_OverlayTextFields[type] setAlignment:NSRightTextAlignment];
+                break;
+            default:
+                break;
+            }
+
+            SDL_Color color = Session::get()->getOverlayManager().getOverlayColor(type);
+            [m_OverlayTextFields[type] setTextColor:[NSColor colorWithSRGBRed:color.r / 255.0 green:color.g / 255.0 blue:color.b / 255.0 alpha:color.a / 255.0]];
+            [m_OverlayTextFields[type] setFont:[NSFont messageFontOfSize:Session::get()->getOverlayManager().getOverlayFontSize(type)]];
+
+            [m_StreamView addSubview: m_OverlayTextFields[type]];
+        }
+
+        // Update text contents
+        char text[OVERLAY_TEXT_SIZE];
+        Session::get()->getOverlayManager().getOverlayText(type, text, sizeof(text));
+        [m_OverlayTextFields[type] setStringValue: [NSString stringWithUTF8String:text]];
+
+        // Unhide if it's enabled
+        [m_OverlayTextFields[type] setHidden: !Session::get()->getOverlayManager().isOverlayEnabled(type)];
+    }
+
+    static void updateDebugOverlayOnMainThread(void* context)
+    {
+        VTBaseRenderer* me = (VTBaseRenderer*)context;
+
+        me->updateOverlayOnMainThread(Overlay::OverlayDebug);
+    }
+
+    static void updateStatusOverlayOnMainThread(void* context)
+    {
+        VTBaseRenderer* me = (VTBaseRenderer*)context;
+
+        me->updateOverlayOnMainThread(Overlay::OverlayStatusUpdate);
+    }
+
+    virtual void notifyOverlayUpdated(Overlay::OverlayType type) override
+    {
+        // We must do the actual UI updates on the main thread, so queue an
+        // async callback on the main thread via GCD to do the UI update.
+        switch (type) {
+        case Overlay::OverlayDebug:
+            dispatch_async_f(dispatch_get_main_queue(), this, updateDebugOverlayOnMainThread);
+            break;
+        case Overlay::OverlayStatusUpdate:
+            dispatch_async_f(dispatch_get_main_queue(), this, updateStatusOverlayOnMainThread);
+            break;
+        default:
+            break;
+        }
+    }
+
+    virtual bool prepareDecoderContext(AVCodecContext* context) override
+    {
+        context->hw_device_ctx = av_buffer_ref(m_HwContext);
+
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Using VideoToolbox accelerated renderer");
+
+        return true;
+    }
+
+    virtual bool needsTestFrame() override
+    {
+        // We used to trust VT to tell us whether decode will work, but
+        // there are cases where it can lie because the hardware technically
+        // can decode the format but VT is unserviceable for some other reason.
+        // Decoding the test frame will tell us for sure whether it will work.
+        return true;
+    }
+
+    virtual int getDecoderCapabilities() override
+    {
+        // VT tolerates references being invalidated by the host,
+        // so we can avoid IDR frames when recovering from loss.
+        return CAPABILITY_REFERENCE_FRAME_INVALIDATION_AVC |
+               CAPABILITY_REFERENCE_FRAME_INVALIDATION_HEVC;
+    }
+
+protected:
+    AVBufferRef* m_HwContext;
+    NSView* m_StreamView;
+    NSTextField* m_OverlayTextFields[Overlay::OverlayMax];
+};
+
+// Presents through AVSampleBufferDisplayLayer, which handles HDR and any
+// pixel format VT gives us but leaves the present time to the compositor.
+class VTRenderer : public VTBaseRenderer
+{
+public:
+    VTRenderer()
+        : m_DisplayLayer(nullptr),
           m_FormatDesc(nullptr),
-          m_StreamView(nullptr),
+          m_MasteringDisplayColorVolume(nullptr),
+          m_ContentLightLevelInfo(nullptr),
           m_DisplayLink(nullptr),
           m_VsyncMutex(nullptr),
           m_VsyncPassed(nullptr)
     {
-        SDL_zero(m_OverlayTextFields);
     }
 
     virtual ~VTRenderer() override
@@ -45,22 +272,16 @@ public:
             SDL_DestroyMutex(m_VsyncMutex);
         }
 
-        if (m_HwContext != nullptr) {
-            av_buffer_unref(&m_HwContext);
-        }
-
         if (m_FormatDesc != nullptr) {
             CFRelease(m_FormatDesc);
         }
 
-        for (int i = 0; i < Overlay::OverlayMax; i++) {
-            if (m_OverlayTextFields[i] != nullptr) {
-                [m_OverlayTextFields[i] removeFromSuperview];
-            }
+        if (m_MasteringDisplayColorVolume != nullptr) {
+            CFRelease(m_MasteringDisplayColorVolume);
         }
 
-        if (m_StreamView != nullptr) {
-            [m_StreamView removeFromSuperview];
+        if (m_ContentLightLevelInfo != nullptr) {
+            CFRelease(m_ContentLightLevelInfo);
         }
     }
 
@@ -85,6 +306,75 @@ public:
         return kCVReturnSuccess;
     }
 
+    // AVSampleBufferDisplayLayer maps HDR content to the display (EDR or
+    // tone mapped SDR) based on the pixel buffer's attachments, so make
+    // sure they describe PQ BT.2020 and carry the static metadata.
+    void attachHdrMetadata(AVFrame* frame, CVPixelBufferRef pixBuf)
+    {
+        AVFrameSideData* sideData;
+
+        // The metadata usually only comes with IDR frames, so we keep it
+        sideData = av_frame_get_side_data(frame, AV_FRAME_DATA_MASTERING_DISPLAY_METADATA);
+        if (sideData != nullptr) {
+            AVMasteringDisplayMetadata* mastering = (AVMasteringDisplayMetadata*)sideData->data;
+
+            // SMPTE ST 2086 in big endian with primaries in G, B, R order
+            struct {
+                uint16_t primaries[3][2];
+                uint16_t whitePoint[2];
+                uint32_t maxLuminance;
+                uint32_t minLuminance;
+            } __attribute__((packed)) volume;
+            static const int k_PrimaryOrder[3] = { 1, 2, 0 };
+
+            for (int i = 0; i < 3; i++) {
+                for (int j = 0; j < 2; j++) {
+                    volume.primaries[i][j] = OSSwapHostToBigInt16(
+                                (uint16_t)(av_q2d(mastering->display_primaries[k_PrimaryOrder[i]][j]) * 50000));
+                }
+            }
+            for (int j = 0; j < 2; j++) {
+                volume.whitePoint[j] = OSSwapHostToBigInt16((uint16_t)(av_q2d(mastering->white_point[j]) * 50000));
+            }
+            volume.maxLuminance = OSSwapHostToBigInt32((uint32_t)(av_q2d(mastering->max_luminance) * 10000));
+            volume.minLuminance = OSSwapHostToBigInt32((uint32_t)(av_q2d(mastering->min_luminance) * 10000));
+
+            if (m_MasteringDisplayColorVolume != nullptr) {
+                CFRelease(m_MasteringDisplayColorVolume);
+            }
+            m_MasteringDisplayColorVolume = CFDataCreate(kCFAllocatorDefault, (const UInt8*)&volume, sizeof(volume));
+        }
+
+        sideData = av_frame_get_side_data(frame, AV_FRAME_DATA_CONTENT_LIGHT_LEVEL);
+        if (sideData != nullptr) {
+            AVContentLightMetadata* lightLevel = (AVContentLightMetadata*)sideData->data;
+            uint16_t info[2] = {
+                OSSwapHostToBigInt16((uint16_t)lightLevel->MaxCLL),
+                OSSwapHostToBigInt16((uint16_t)lightLevel->MaxFALL)
+            };
+
+            if (m_ContentLightLevelInfo != nullptr) {
+                CFRelease(m_ContentLightLevelInfo);
+            }
+            m_ContentLightLevelInfo = CFDataCreate(kCFAllocatorDefault, (const UInt8*)info, sizeof(info));
+        }
+
+        CVBufferSetAttachment(pixBuf, kCVImageBufferColorPrimariesKey,
+                              kCVImageBufferColorPrimaries_ITU_R_2020, kCVAttachmentMode_ShouldPropagate);
+        CVBufferSetAttachment(pixBuf, kCVImageBufferTransferFunctionKey,
+                              kCVImageBufferTransferFunction_SMPTE_ST_2084_PQ, kCVAttachmentMode_ShouldPropagate);
+        CVBufferSetAttachment(pixBuf, kCVImageBufferYCbCrMatrixKey,
+                              kCVImageBufferYCbCrMatrix_ITU_R_2020, kCVAttachmentMode_ShouldPropagate);
+        if (m_MasteringDisplayColorVolume != nullptr) {
+            CVBufferSetAttachment(pixBuf, kCVImageBufferMasteringDisplayColorVolumeKey,
+                                  m_MasteringDisplayColorVolume, kCVAttachmentMode_ShouldPropagate);
+        }
+        if (m_ContentLightLevelInfo != nullptr) {
+            CVBufferSetAttachment(pixBuf, kCVImageBufferContentLightLevelInfoKey,
+                                  m_ContentLightLevelInfo, kCVAttachmentMode_ShouldPropagate);
+        }
+    }
+
     bool initializeVsyncCallback(SDL_SysWMinfo* info)
     {
         NSScreen* screen = [info->info.cocoa.window screen];
@@ -153,6 +443,10 @@ public:
             return;
         }
 
+        if (frame->color_trc == AVCOL_TRC_SMPTE2084) {
+            attachHdrMetadata(frame, pixBuf);
+        }
+
         // If the format has changed or doesn't exist yet, construct it with the
         // pixel buffer data
         if (!m_FormatDesc || !CMVideoFormatDescriptionMatchesImageBuffer(m_FormatDesc, pixBuf)) {
@@ -206,193 +500,395 @@ public:
 
     virtual bool initialize(PDECODER_PARAMETERS params) override
     {
-        int err;
+        SDL_SysWMinfo info;
 
-        if (params->videoFormat & VIDEO_FORMAT_MASK_H264) {
-            // Prior to 10.13, we'll just assume everything has
-            // H.264 support and fail open to allow VT decode.
-    #if __MAC_OS_X_VERSION_MAX_ALLOWED >= 101300
-            if (__builtin_available(macOS 10.13, *)) {
-                if (!VTIsHardwareDecodeSupported(kCMVideoCodecType_H264)) {
-                    SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
-                                "No HW accelerated H.264 decode via VT");
-                    return false;
-                }
-            }
-            else
-    #endif
-            {
-                SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
-                            "Assuming H.264 HW decode on < macOS 10.13");
-            }
+        if (!initializeDecoder(params, &info)) {
+            return false;
         }
-        else if (params->videoFormat & VIDEO_FORMAT_MASK_H265) {
-    #if __MAC_OS_X_VERSION_MAX_ALLOWED >= 101300
-            if (__builtin_available(macOS 10.13, *)) {
-                if (!VTIsHardwareDecodeSupported(kCMVideoCodecType_HEVC)) {
-                    SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
-                                "No HW accelerated HEVC decode via VT");
-                    return false;
-                }
-            }
-            else
-    #endif
-            {
-                // Fail closed for HEVC if we're not on 10.13+
-                SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
-                            "No HEVC support on < macOS 10.13");
+
+        m_DisplayLayer = [[AVSampleBufferDisplayLayer alloc] init];
+        m_DisplayLayer.videoGravity = AVLayerVideoGravityResizeAspect;
+        attachDisplayLayer(&info, m_DisplayLayer);
+
+        // With frame pacing, the pacer's own CVDisplayLink already schedules
+        // our renders on V-sync, so waiting for another one here would just
+        // add a frame of latency.
+        if (params->enableVsync && !params->enableFramePacing) {
+            if (!initializeVsyncCallback(&info)) {
                 return false;
             }
         }
 
-        SDL_SysWMinfo info;
+        return true;
+    }
 
-        SDL_VERSION(&info.version);
+private:
+    AVSampleBufferDisplayLayer* m_DisplayLayer;
+    CMVideoFormatDescriptionRef m_FormatDesc;
+    CFDataRef m_MasteringDisplayColorVolume;
+    CFDataRef m_ContentLightLevelInfo;
+    CVDisplayLinkRef m_DisplayLink;
+    SDL_mutex* m_VsyncMutex;
+    SDL_cond* m_VsyncPassed;
+};
 
-        if (!SDL_GetWindowWMInfo(params->window, &info)) {
-            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
-                        "SDL_GetWindowWMInfo() failed: %s",
-                        SDL_GetError());
-            return false;
-        }
+// Column-major YUV to RGB matrices for the Metal renderer, laid out
+// like a Metal float3x3 followed by a float3 (each padded to 4 floats)
+typedef struct _CSC_PARAMS {
+    float matrix[3][4];
+    float offsets[4];
+} CSC_PARAMS;
 
-        SDL_assert(info.subsystem == SDL_SYSWM_COCOA);
+static const CSC_PARAMS k_Bt601Limited = {
+    { { 1.1644f, 1.1644f, 1.1644f, 0.0f }, { 0.0f, -0.3918f, 2.0172f, 0.0f }, { 1.5960f, -0.8130f, 0.0f, 0.0f } },
+    { 16.0f / 255.0f, 128.0f / 255.0f, 128.0f / 255.0f, 0.0f }
+};
+static const CSC_PARAMS k_Bt601Full = {
+    { { 1.0f, 1.0f, 1.0f, 0.0f }, { 0.0f, -0.3441f, 1.7720f, 0.0f }, { 1.4020f, -0.7141f, 0.0f, 0.0f } },
+    { 0.0f, 128.0f / 255.0f, 128.0f / 255.0f, 0.0f }
+};
+static const CSC_PARAMS k_Bt709Limited = {
+    { { 1.1644f, 1.1644f, 1.1644f, 0.0f }, { 0.0f, -0.2132f, 2.1124f, 0.0f }, { 1.7927f, -0.5329f, 0.0f, 0.0f } },
+    { 16.0f / 255.0f, 128.0f / 255.0f, 128.0f / 255.0f, 0.0f }
+};
+static const CSC_PARAMS k_Bt709Full = {
+    { { 1.0f, 1.0f, 1.0f, 0.0f }, { 0.0f, -0.1873f, 1.8556f, 0.0f }, { 1.5748f, -0.4681f, 0.0f, 0.0f } },
+    { 0.0f, 128.0f / 255.0f, 128.0f / 255.0f, 0.0f }
+};
 
-        // SDL adds its own content view to listen for events.
-        // We need to add a subview for our display layer.
-        NSView* contentView = info.info.cocoa.window.contentView;
-        m_StreamView = [[NSView alloc] initWithFrame:contentView.bounds];
+// Draws the NV12 planes as a quad covering the viewport. The vertex
+// shader generates the corners itself, so there's no vertex buffer.
+static const char k_MetalShaderSource[] =
+    "#include <metal_stdlib>\n"
+    "using namespace metal;\n"
+    "struct Vertex {\n"
+    "    float4 position [[position]];\n"
+    "    float2 texCoord;\n"
+    "};\n"
+    "struct CscParams {\n"
+    "    float3x3 matrix;\n"
+    "    float3 offsets;\n"
+    "};\n"
+    "vertex Vertex vs_draw(uint id [[vertex_id]]) {\n"
+    "    float2 corner = float2(id & 1, id >> 1);\n"
+    "    Vertex out;\n"
+    "    out.position = float4(corner.x * 2.0 - 1.0, 1.0 - corner.y * 2.0, 0.0, 1.0);\n"
+    "    out.texCoord = corner;\n"
+    "    return out;\n"
+    "}\n"
+    "fragment float4 ps_draw_biplanar(Vertex v [[stage_in]],\n"
+    "                                 constant CscParams& csc [[buffer(0)]],\n"
+    "                                 texture2d<float> luma [[texture(0)]],\n"
+    "                                 texture2d<float> chroma [[texture(1)]]) {\n"
+    "    constexpr sampler s(filter::linear, address::clamp_to_edge);\n"
+    "    float3 yuv = float3(luma.sample(s, v.texCoord).r, chroma.sample(s, v.texCoord).rg);\n"
+    "    return float4(csc.matrix * (yuv - csc.offsets), 1.0);\n"
+    "}\n";
+
+// Presents through a CAMetalLayer, so we decide when each frame is
+// presented and can measure when it actually reached the display.
+// It only handles SDR NV12, which is what VT gives us for everything
+// except HEVC Main10.
+class VTMetalRenderer : public VTBaseRenderer
+{
+public:
+    VTMetalRenderer()
+        : m_MetalLayer(nullptr),
+          m_Device(nullptr),
+          m_CommandQueue(nullptr),
+          m_PipelineState(nullptr),
+          m_TextureCache(nullptr),
+          m_NextDrawable(nullptr),
+          m_DisplaySync(true),
+          m_PresentLatencyUs(std::make_shared<SDL_atomic_t>())
+    {
+        SDL_AtomicSet(m_PresentLatencyUs.get(), 0);
+    }
 
-        m_DisplayLayer = [[AVSampleBufferDisplayLayer alloc] init];
-        m_DisplayLayer.bounds = m_StreamView.bounds;
-        m_DisplayLayer.position = CGPointMake(CGRectGetMidX(m_StreamView.bounds), CGRectGetMidY(m_StreamView.bounds));
-        m_DisplayLayer.videoGravity = AVLayerVideoGravityResizeAspect;
+    virtual ~VTMetalRenderer() override
+    {
+        if (m_NextDrawable != nullptr) {
+            [m_NextDrawable release];
+        }
 
-        // Create a layer-hosted view by setting the layer before wantsLayer
-        // This avoids us having to add our AVSampleBufferDisplayLayer as a
-        // sublayer of a layer-backed view which leaves a useless layer in
-        // the middle.
-        m_StreamView.layer = m_DisplayLayer;
-        m_StreamView.wantsLayer = YES;
+        if (m_TextureCache != nullptr) {
+            CFRelease(m_TextureCache);
+        }
 
-        [contentView addSubview: m_StreamView];
+        if (m_PipelineState != nullptr) {
+            [m_PipelineState release];
+        }
 
-        err = av_hwdevice_ctx_create(&m_HwContext,
-                                     AV_HWDEVICE_TYPE_VIDEOTOOLBOX,
-                                     nullptr,
-                                     nullptr,
-                                     0);
-        if (err < 0) {
-            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
-                        "av_hwdevice_ctx_create() failed for VT decoder: %d",
-                        err);
-            return false;
+        if (m_CommandQueue != nullptr) {
+            [m_CommandQueue release];
         }
 
-        if (params->enableVsync) {
-            if (!initializeVsyncCallback(&info)) {
-                return false;
-            }
+        if (m_Device != nullptr) {
+            [m_Device release];
         }
 
-        return true;
+        // Our stream view keeps its own reference until it's removed
+        if (m_MetalLayer != nullptr) {
+            [m_MetalLayer release];
+        }
     }
 
-    void updateOverlayOnMainThread(Overlay::OverlayType type)
+    virtual bool initialize(PDECODER_PARAMETERS params) override
     {
-        // Lazy initialization for the overlay
-        if (m_OverlayTextFields[type] == nullptr) {
-            m_OverlayTextFields[type] = [[NSTextField alloc] initWithFrame:m_StreamView.bounds];
-            [m_OverlayTextFields[type] setBezeled:NO];
-            [m_OverlayTextFields[type] setDrawsBackground:NO];
-            [m_OverlayTextFields[type] setEditable:NO];
-            [m_OverlayTextFields[type] setSelectable:NO];
+        SDL_SysWMinfo info;
+        NSError* error = nullptr;
 
-            switch (type) {
-            case Overlay::OverlayDebug:
-                [m_OverlayTextFields[type] setAlignment:NSLeftTextAlignment];
-                break;
-            case Overlay::OverlayStatusUpdate:
-                [m_OverlayTextFields[type] setAlignment:NSRightTextAlignment];
-                break;
-            default:
-                break;
-            }
+        if (qgetenv("VT_DISABLE_METAL") == "1") {
+            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                        "Metal renderer disabled by VT_DISABLE_METAL");
+            return false;
+        }
 
-            SDL_Color color = Session::get()->getOverlayManager().getOverlayColor(type);
-            [m_OverlayTextFields[type] setTextColor:[NSColor colorWithSRGBRed:color.r / 255.0 green:color.g / 255.0 blue:color.b / 255.0 alpha:color.a / 255.0]];
-            [m_OverlayTextFields[type] setFont:[NSFont messageFontOfSize:Session::get()->getOverlayManager().getOverlayFontSize(type)]];
+        // AVSampleBufferDisplayLayer takes care of HDR for us
+        if (params->videoFormat == VIDEO_FORMAT_H265_MAIN10) {
+            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                        "Metal renderer doesn't support HDR");
+            return false;
+        }
 
-            [m_StreamView addSubview: m_OverlayTextFields[type]];
+        if (!initializeDecoder(params, &info)) {
+            return false;
         }
 
-        // Update text contents
-        [m_OverlayTextFields[type] setStringValue: [NSString stringWithUTF8String:Session::get()->getOverlayManager().getOverlayText(type)]];
+        // Render on the GPU driving the window's display
+        NSScreen* screen = [info.info.cocoa.window screen];
+        if (screen != nullptr) {
+            CGDirectDisplayID displayId = [[screen deviceDescription][@"NSScreenNumber"] unsignedIntValue];
+            m_Device = CGDirectDisplayCopyCurrentMetalDevice(displayId);
+        }
+        if (m_Device == nullptr) {
+            m_Device = MTLCreateSystemDefaultDevice();
+        }
+        if (m_Device == nullptr) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "No Metal device available");
+            return false;
+        }
 
-        // Unhide if it's enabled
-        [m_OverlayTextFields[type] setHidden: !Session::get()->getOverlayManager().isOverlayEnabled(type)];
-    }
+        id<MTLLibrary> library = [m_Device newLibraryWithSource:@(k_MetalShaderSource) options:nullptr error:&error];
+        if (library == nullptr) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "Failed to compile Metal shaders: %s",
+                         error.localizedDescription.UTF8String);
+            return false;
+        }
 
-    static void updateDebugOverlayOnMainThread(void* context)
-    {
-        VTRenderer* me = (VTRenderer*)context;
+        MTLRenderPipelineDescriptor* pipelineDesc = [[MTLRenderPipelineDescriptor alloc] init];
+        pipelineDesc.vertexFunction = [[library newFunctionWithName:@"vs_draw"] autorelease];
+        pipelineDesc.fragmentFunction = [[library newFunctionWithName:@"ps_draw_biplanar"] autorelease];
+        pipelineDesc.colorAttachments[0].pixelFormat = MTLPixelFormatBGRA8Unorm;
+        m_PipelineState = [m_Device newRenderPipelineStateWithDescriptor:pipelineDesc error:&error];
+        [pipelineDesc release];
+        [library release];
+        if (m_PipelineState == nullptr) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "Failed to create Metal pipeline state: %s",
+                         error.localizedDescription.UTF8String);
+            return false;
+        }
 
-        me->updateOverlayOnMainThread(Overlay::OverlayDebug);
-    }
+        m_CommandQueue = [m_Device newCommandQueue];
 
-    static void updateStatusOverlayOnMainThread(void* context)
-    {
-        VTRenderer* me = (VTRenderer*)context;
+        CVReturn status = CVMetalTextureCacheCreate(kCFAllocatorDefault, nullptr, m_Device, nullptr, &m_TextureCache);
+        if (status != kCVReturnSuccess) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "CVMetalTextureCacheCreate() failed: %d",
+                         status);
+            return false;
+        }
 
-        me->updateOverlayOnMainThread(Overlay::OverlayStatusUpdate);
+        m_MetalLayer = [[CAMetalLayer alloc] init];
+        m_MetalLayer.device = m_Device;
+        m_MetalLayer.pixelFormat = MTLPixelFormatBGRA8Unorm;
+        m_MetalLayer.framebufferOnly = YES;
+        m_MetalLayer.opaque = YES;
+        attachDisplayLayer(&info, m_MetalLayer);
+
+        // Render at the native resolution of the display
+        CGFloat scale = info.info.cocoa.window.backingScaleFactor;
+        m_MetalLayer.contentsScale = scale;
+        m_MetalLayer.drawableSize = CGSizeMake(m_StreamView.bounds.size.width * scale,
+                                               m_StreamView.bounds.size.height * scale);
+
+        // Without display sync, drawables are presented immediately
+        // rather than on the next V-sync. Frame pacing already times our
+        // renders to V-sync, so it doesn't need the layer to wait too.
+        // Before 10.13, the layer always waits for V-sync.
+        if (__builtin_available(macOS 10.13, *)) {
+            m_DisplaySync = params->enableVsync && !params->enableFramePacing;
+            m_MetalLayer.displaySyncEnabled = m_DisplaySync;
+        }
+
+        // Don't let more than one frame queue behind the one on screen
+        if (__builtin_available(macOS 10.13.2, *)) {
+            m_MetalLayer.maximumDrawableCount = 2;
+        }
+
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Using Metal renderer on %s (display sync %s)",
+                    m_Device.name.UTF8String,
+                    m_DisplaySync ? "on" : "off");
+        return true;
     }
 
-    virtual void notifyOverlayUpdated(Overlay::OverlayType type) override
+    virtual void waitToRender() override
     {
-        // We must do the actual UI updates on the main thread, so queue an
-        // async callback on the main thread via GCD to do the UI update.
-        switch (type) {
-        case Overlay::OverlayDebug:
-            dispatch_async_f(dispatch_get_main_queue(), this, updateDebugOverlayOnMainThread);
-            break;
-        case Overlay::OverlayStatusUpdate:
-            dispatch_async_f(dispatch_get_main_queue(), this, updateStatusOverlayOnMainThread);
-            break;
-        default:
-            break;
+        // Blocks until the layer has a drawable for us, so the Pacer
+        // picks its frame as late as possible.
+        if (m_NextDrawable == nullptr) {
+            @autoreleasepool {
+                m_NextDrawable = [[m_MetalLayer nextDrawable] retain];
+            }
         }
     }
 
-    virtual bool prepareDecoderContext(AVCodecContext* context) override
+    // Caller frees frame after we return
+    virtual void renderFrame(AVFrame* frame) override
     {
-        context->hw_device_ctx = av_buffer_ref(m_HwContext);
+        CVPixelBufferRef pixBuf = reinterpret_cast<CVPixelBufferRef>(frame->data[3]);
+        CVMetalTextureRef textures[2] = {};
+        CVReturn status;
 
-        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
-                    "Using VideoToolbox accelerated renderer");
+        OSType pixelFormat = CVPixelBufferGetPixelFormatType(pixBuf);
+        if (pixelFormat != kCVPixelFormatType_420YpCbCr8BiPlanarVideoRange &&
+                pixelFormat != kCVPixelFormatType_420YpCbCr8BiPlanarFullRange) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "Unsupported pixel format for Metal renderer: %x",
+                         pixelFormat);
+            return;
+        }
 
-        return true;
+        // Wrap the planes as Metal textures without copying them
+        static const MTLPixelFormat k_PlaneFormats[2] = { MTLPixelFormatR8Unorm, MTLPixelFormatRG8Unorm };
+        for (int i = 0; i < 2; i++) {
+            status = CVMetalTextureCacheCreateTextureFromImage(kCFAllocatorDefault, m_TextureCache, pixBuf, nullptr,
+                                                               k_PlaneFormats[i],
+                                                               CVPixelBufferGetWidthOfPlane(pixBuf, i),
+                                                               CVPixelBufferGetHeightOfPlane(pixBuf, i),
+                                                               i, &textures[i]);
+            if (status != kCVReturnSuccess) {
+                SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                             "CVMetalTextureCacheCreateTextureFromImage() failed: %d",
+                             status);
+                if (textures[0] != nullptr) {
+                    CFRelease(textures[0]);
+                }
+                return;
+            }
+        }
+
+        const CSC_PARAMS* cscParams;
+        bool fullRange = pixelFormat == kCVPixelFormatType_420YpCbCr8BiPlanarFullRange;
+        if (frame->colorspace == AVCOL_SPC_BT709) {
+            cscParams = fullRange ? &k_Bt709Full : &k_Bt709Limited;
+        }
+        else {
+            // The host sends BT.601 unless it says otherwise
+            cscParams = fullRange ? &k_Bt601Full : &k_Bt601Limited;
+        }
+
+        @autoreleasepool {
+            // We'll only be missing a drawable if the Pacer didn't call waitToRender()
+            waitToRender();
+            if (m_NextDrawable == nullptr) {
+                SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                             "Failed to get a Metal drawable");
+                CFRelease(textures[0]);
+                CFRelease(textures[1]);
+                return;
+            }
+
+            // Center in frame and preserve aspect ratio
+            SDL_Rect src, dst;
+            src.x = src.y = 0;
+            src.w = frame->width;
+            src.h = frame->height;
+            dst.x = dst.y = 0;
+            dst.w = (int)m_NextDrawable.texture.width;
+            dst.h = (int)m_NextDrawable.texture.height;
+
+            StreamUtils::scaleSourceToDestinationSurface(&src, &dst);
+
+            MTLRenderPassDescriptor* renderPass = [MTLRenderPassDescriptor renderPassDescriptor];
+            renderPass.colorAttachments[0].texture = m_NextDrawable.texture;
+            renderPass.colorAttachments[0].loadAction = MTLLoadActionClear;
+            renderPass.colorAttachments[0].clearColor = MTLClearColorMake(0.0, 0.0, 0.0, 1.0);
+            renderPass.colorAttachments[0].storeAction = MTLStoreActionStore;
+
+            id<MTLCommandBuffer> commandBuffer = [m_CommandQueue commandBuffer];
+            id<MTLRenderCommandEncoder> encoder = [commandBuffer renderCommandEncoderWithDescriptor:renderPass];
+            [encoder setRenderPipelineState:m_PipelineState];
+            MTLViewport viewport = { (double)dst.x, (double)dst.y, (double)dst.w, (double)dst.h, 0.0, 1.0 };
+            [encoder setViewport:viewport];
+            [encoder setFragmentBytes:cscParams length:sizeof(*cscParams) atIndex:0];
+            [encoder setFragmentTexture:CVMetalTextureGetTexture(textures[0]) atIndex:0];
+            [encoder setFragmentTexture:CVMetalTextureGetTexture(textures[1]) atIndex:1];
+            [encoder drawPrimitives:MTLPrimitiveTypeTriangleStrip vertexStart:0 vertexCount:4];
+            [encoder endEncoding];
+
+            // The textures keep the pixel buffer alive until the GPU is done
+            // with it, since the frame goes back to VT's pool when we return.
+            CVMetalTextureRef luma = textures[0];
+            CVMetalTextureRef chroma = textures[1];
+            [commandBuffer addCompletedHandler:^(id<MTLCommandBuffer>) {
+                CFRelease(luma);
+                CFRelease(chroma);
+            }];
+
+            // The presented handler can run after we're destroyed,
+            // so it holds its own reference to the latency counter.
+            if (__builtin_available(macOS 10.15.4, *)) {
+                std::shared_ptr<SDL_atomic_t> presentLatencyUs = m_PresentLatencyUs;
+                CFTimeInterval submitTime = CACurrentMediaTime();
+                [m_NextDrawable addPresentedHandler:^(id<MTLDrawable> drawable) {
+                    // A presented time of 0 means the drawable was dropped
+                    if (drawable.presentedTime > submitTime) {
+                        SDL_AtomicSet(presentLatencyUs.get(),
+                                      (int)((drawable.presentedTime - submitTime) * 1000000));
+                    }
+                }];
+            }
+
+            [commandBuffer presentDrawable:m_NextDrawable];
+            [commandBuffer commit];
+
+            [m_NextDrawable release];
+            m_NextDrawable = nullptr;
+        }
     }
 
-    virtual bool needsTestFrame() override
+    virtual Uint64 takePresentLatencyUs() override
     {
-        // We used to trust VT to tell us whether decode will work, but
-        // there are cases where it can lie because the hardware technically
-        // can decode the format but VT is unserviceable for some other reason.
-        // Decoding the test frame will tell us for sure whether it will work.
-        return true;
+        return (Uint64)SDL_AtomicSet(m_PresentLatencyUs.get(), 0);
+    }
+
+    virtual const char* getPresentationPath() override
+    {
+        return m_DisplaySync ? "CAMetalLayer (display sync)" : "CAMetalLayer (immediate)";
     }
 
 private:
-    AVBufferRef* m_HwContext;
-    AVSampleBufferDisplayLayer* m_DisplayLayer;
-    CMVideoFormatDescriptionRef m_FormatDesc;
-    NSView* m_StreamView;
-    NSTextField* m_OverlayTextFields[Overlay::OverlayMax];
-    CVDisplayLinkRef m_DisplayLink;
-    SDL_mutex* m_VsyncMutex;
-    SDL_cond* m_VsyncPassed;
+    CAMetalLayer* m_MetalLayer;
+    id<MTLDevice> m_Device;
+    id<MTLCommandQueue> m_CommandQueue;
+    id<MTLRenderPipelineState> m_PipelineState;
+    CVMetalTextureCacheRef m_TextureCache;
+    id<CAMetalDrawable> m_NextDrawable;
+    bool m_DisplaySync;
+
+    // Written from Metal's presented handlers, read by the Pacer
+    std::shared_ptr<SDL_atomic_t> m_PresentLatencyUs;
 };
 
 IFFmpegRenderer* VTRendererFactory::createRenderer() {
     return new VTRenderer();
 }
+
+IFFmpegRenderer* VTRendererFactory::createMetalRenderer() {
+    return new VTMetalRenderer();
+}
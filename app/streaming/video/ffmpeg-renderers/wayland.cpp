@@ -0,0 +1,826 @@
+#include "wayland.h"
+
+#include "streaming/session.h"
+#include "streaming/streamutils.h"
+#include "utils.h"
+
+#include <drm_fourcc.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <SDL_syswm.h>
+
+const struct wl_registry_listener WaylandRenderer::k_RegistryListener = {
+    WaylandRenderer::registryGlobal,
+    WaylandRenderer::registryGlobalRemove
+};
+
+const struct zwp_linux_dmabuf_v1_listener WaylandRenderer::k_DmabufListener = {
+    WaylandRenderer::dmabufFormat,
+    WaylandRenderer::dmabufModifier
+};
+
+const struct wp_presentation_listener WaylandRenderer::k_PresentationListener = {
+    WaylandRenderer::presentationClockId
+};
+
+const struct wl_buffer_listener WaylandRenderer::k_FrameBufferListener = {
+    WaylandRenderer::frameBufferReleased
+};
+
+const struct wl_buffer_listener WaylandRenderer::k_ShmBufferListener = {
+    WaylandRenderer::shmBufferReleased
+};
+
+const struct wp_presentation_feedback_listener WaylandRenderer::k_FeedbackListener = {
+    WaylandRenderer::feedbackSyncOutput,
+    WaylandRenderer::feedbackPresented,
+    WaylandRenderer::feedbackDiscarded
+};
+
+WaylandRenderer::WaylandRenderer(IFFmpegRenderer* backendRenderer)
+    : m_BackendRenderer(backendRenderer),
+      m_Window(nullptr),
+      m_BackgroundRenderer(nullptr),
+      m_VideoWidth(0),
+      m_VideoHeight(0),
+      m_DrmFormat(DRM_FORMAT_NV12),
+      m_DrmFormatSupported(false),
+      m_Display(nullptr),
+      m_Queue(nullptr),
+      m_Registry(nullptr),
+      m_Compositor(nullptr),
+      m_Subcompositor(nullptr),
+      m_Shm(nullptr),
+      m_Dmabuf(nullptr),
+      m_Viewporter(nullptr),
+      m_Presentation(nullptr),
+      m_PresentationClock(CLOCK_MONOTONIC),
+      m_ParentSurface(nullptr),
+      m_VideoSurface(nullptr),
+      m_VideoSubsurface(nullptr),
+      m_VideoViewport(nullptr),
+      m_OverlaySurface(nullptr),
+      m_OverlaySubsurface(nullptr),
+      m_VblankTimeLock(0),
+      m_LastVblankTimeUs(0),
+      m_PresentLatencyUs(0),
+      m_OverlayVisible(false)
+{
+    SDL_zero(m_HeldFrames);
+    SDL_zero(m_OverlayBuffers);
+    SDL_zero(m_OverlaySurfaces);
+    SDL_AtomicSet(&m_WindowSize, 0);
+    SDL_AtomicSet(&m_PendingOverlayUpdates, 0);
+}
+
+WaylandRenderer::~WaylandRenderer()
+{
+    for (PresentationFeedback* feedback : m_Feedbacks) {
+        wp_presentation_feedback_destroy(feedback->feedback);
+        delete feedback;
+    }
+
+    for (int i = 0; i < WAYLAND_MAX_HELD_FRAMES; i++) {
+        if (m_HeldFrames[i].buffer != nullptr) {
+            wl_buffer_destroy(m_HeldFrames[i].buffer);
+            av_frame_free(&m_HeldFrames[i].frame);
+        }
+    }
+
+    for (int i = 0; i < 2; i++) {
+        destroyShmBuffer(m_OverlayBuffers[i]);
+    }
+
+    for (int i = 0; i < Overlay::OverlayMax; i++) {
+        if (m_OverlaySurfaces[i] != nullptr) {
+            SDL_FreeSurface(m_OverlaySurfaces[i]);
+        }
+    }
+
+    if (m_VideoViewport != nullptr) {
+        wp_viewport_destroy(m_VideoViewport);
+    }
+    if (m_OverlaySubsurface != nullptr) {
+        wl_subsurface_destroy(m_OverlaySubsurface);
+    }
+    if (m_OverlaySurface != nullptr) {
+        wl_surface_destroy(m_OverlaySurface);
+    }
+    if (m_VideoSubsurface != nullptr) {
+        wl_subsurface_destroy(m_VideoSubsurface);
+    }
+    if (m_VideoSurface != nullptr) {
+        wl_surface_destroy(m_VideoSurface);
+    }
+
+    if (m_Presentation != nullptr) {
+        wp_presentation_destroy(m_Presentation);
+    }
+    if (m_Viewporter != nullptr) {
+        wp_viewporter_destroy(m_Viewporter);
+    }
+    if (m_Dmabuf != nullptr) {
+        zwp_linux_dmabuf_v1_destroy(m_Dmabuf);
+    }
+    if (m_Shm != nullptr) {
+        wl_shm_destroy(m_Shm);
+    }
+    if (m_Subcompositor != nullptr) {
+        wl_subcompositor_destroy(m_Subcompositor);
+    }
+    if (m_Compositor != nullptr) {
+        wl_compositor_destroy(m_Compositor);
+    }
+    if (m_Registry != nullptr) {
+        wl_registry_destroy(m_Registry);
+    }
+
+    if (m_Display != nullptr) {
+        wl_display_flush(m_Display);
+    }
+
+    if (m_Queue != nullptr) {
+        wl_event_queue_destroy(m_Queue);
+    }
+
+    if (m_BackgroundRenderer != nullptr) {
+        SDL_DestroyRenderer(m_BackgroundRenderer);
+    }
+}
+
+void WaylandRenderer::registryGlobal(void* data, struct wl_registry* registry, uint32_t name,
+                                     const char* interface, uint32_t version)
+{
+    WaylandRenderer* me = reinterpret_cast<WaylandRenderer*>(data);
+
+    if (strcmp(interface, wl_compositor_interface.name) == 0) {
+        me->m_Compositor = reinterpret_cast<struct wl_compositor*>(
+                    wl_registry_bind(registry, name, &wl_compositor_interface, 1));
+    }
+    else if (strcmp(interface, wl_subcompositor_interface.name) == 0) {
+        me->m_Subcompositor = reinterpret_cast<struct wl_subcompositor*>(
+                    wl_registry_bind(registry, name, &wl_subcompositor_interface, 1));
+    }
+    else if (strcmp(interface, wl_shm_interface.name) == 0) {
+        me->m_Shm = reinterpret_cast<struct wl_shm*>(
+                    wl_registry_bind(registry, name, &wl_shm_interface, 1));
+    }
+    else if (strcmp(interface, zwp_linux_dmabuf_v1_interface.name) == 0 && version >= 2) {
+        // Version 3 lists the modifiers of each format. Version 4 replaces
+        // the format events with per-surface feedback, which we don't need.
+        me->m_Dmabuf = reinterpret_cast<struct zwp_linux_dmabuf_v1*>(
+                    wl_registry_bind(registry, name, &zwp_linux_dmabuf_v1_interface, SDL_min(version, 3)));
+        zwp_linux_dmabuf_v1_add_listener(me->m_Dmabuf, &k_DmabufListener, me);
+    }
+    else if (strcmp(interface, wp_viewporter_interface.name) == 0) {
+        me->m_Viewporter = reinterpret_cast<struct wp_viewporter*>(
+                    wl_registry_bind(registry, name, &wp_viewporter_interface, 1));
+    }
+    else if (strcmp(interface, wp_presentation_interface.name) == 0) {
+        me->m_Presentation = reinterpret_cast<struct wp_presentation*>(
+                    wl_registry_bind(registry, name, &wp_presentation_interface, 1));
+        wp_presentation_add_listener(me->m_Presentation, &k_PresentationListener, me);
+    }
+}
+
+void WaylandRenderer::registryGlobalRemove(void*, struct wl_registry*, uint32_t)
+{
+    // None of the globals we use go away while the compositor is running
+}
+
+void WaylandRenderer::dmabufFormat(void* data, struct zwp_linux_dmabuf_v1*, uint32_t format)
+{
+    WaylandRenderer* me = reinterpret_cast<WaylandRenderer*>(data);
+
+    if (format == me->m_DrmFormat) {
+        me->m_DrmFormatSupported = true;
+    }
+}
+
+void WaylandRenderer::dmabufModifier(void* data, struct zwp_linux_dmabuf_v1* dmabuf, uint32_t format,
+                                     uint32_t, uint32_t)
+{
+    // A format is importable with at least one of its modifiers
+    dmabufFormat(data, dmabuf, format);
+}
+
+void WaylandRenderer::presentationClockId(void* data, struct wp_presentation*, uint32_t clockId)
+{
+    WaylandRenderer* me = reinterpret_cast<WaylandRenderer*>(data);
+
+    me->m_PresentationClock = (clockid_t)clockId;
+}
+
+void WaylandRenderer::frameBufferReleased(void* data, struct wl_buffer* buffer)
+{
+    HeldFrame* heldFrame = reinterpret_cast<HeldFrame*>(data);
+
+    SDL_assert(heldFrame->buffer == buffer);
+
+    // The decoder can have its surface back now
+    wl_buffer_destroy(buffer);
+    av_frame_free(&heldFrame->frame);
+    heldFrame->buffer = nullptr;
+}
+
+void WaylandRenderer::shmBufferReleased(void* data, struct wl_buffer*)
+{
+    ShmBuffer* shmBuffer = reinterpret_cast<ShmBuffer*>(data);
+
+    shmBuffer->busy = false;
+}
+
+void WaylandRenderer::feedbackSyncOutput(void*, struct wp_presentation_feedback*, struct wl_output*)
+{
+    // We only have a single output to care about
+}
+
+void WaylandRenderer::feedbackPresented(void* data, struct wp_presentation_feedback*,
+                                        uint32_t tvSecHi, uint32_t tvSecLo, uint32_t tvNsec,
+                                        uint32_t, uint32_t, uint32_t, uint32_t)
+{
+    PresentationFeedback* feedback = reinterpret_cast<PresentationFeedback*>(data);
+    WaylandRenderer* me = feedback->renderer;
+
+    // The timestamp is on the compositor's clock, so move it to the one
+    // behind StreamUtils::getTimeUs()
+    struct timespec now;
+    clock_gettime(me->m_PresentationClock, &now);
+    Uint64 nowUs = StreamUtils::getTimeUs();
+    Uint64 clockNowUs = (Uint64)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+    Uint64 presentedUs = (((Uint64)tvSecHi << 32) | tvSecLo) * 1000000 + tvNsec / 1000;
+    Uint64 vblankTimeUs = (Uint64)((Sint64)presentedUs + ((Sint64)nowUs - (Sint64)clockNowUs));
+
+    SDL_AtomicLock(&me->m_VblankTimeLock);
+    me->m_LastVblankTimeUs = vblankTimeUs;
+    if (vblankTimeUs > feedback->commitTimeUs) {
+        me->m_PresentLatencyUs = vblankTimeUs - feedback->commitTimeUs;
+    }
+    SDL_AtomicUnlock(&me->m_VblankTimeLock);
+
+    me->releaseFeedback(feedback);
+}
+
+void WaylandRenderer::feedbackDiscarded(void* data, struct wp_presentation_feedback*)
+{
+    PresentationFeedback* feedback = reinterpret_cast<PresentationFeedback*>(data);
+
+    // Replaced by a newer frame before it reached the display
+    feedback->renderer->releaseFeedback(feedback);
+}
+
+void WaylandRenderer::releaseFeedback(PresentationFeedback* feedback)
+{
+    m_Feedbacks.removeOne(feedback);
+    wp_presentation_feedback_destroy(feedback->feedback);
+    delete feedback;
+}
+
+struct wl_surface* WaylandRenderer::createSubsurface(struct wl_subsurface** subsurface)
+{
+    struct wl_surface* surface = wl_compositor_create_surface(m_Compositor);
+    if (surface == nullptr) {
+        return nullptr;
+    }
+
+    // Input must reach SDL's surface underneath, since SDL ignores
+    // events for surfaces it doesn't know
+    struct wl_region* emptyRegion = wl_compositor_create_region(m_Compositor);
+    wl_surface_set_input_region(surface, emptyRegion);
+    wl_region_destroy(emptyRegion);
+
+    *subsurface = wl_subcompositor_get_subsurface(m_Subcompositor, surface, m_ParentSurface);
+
+    // Our commits show up right away instead of waiting for SDL's surface
+    wl_subsurface_set_desync(*subsurface);
+
+    return surface;
+}
+
+bool WaylandRenderer::initialize(PDECODER_PARAMETERS params)
+{
+    SDL_SysWMinfo info;
+
+    m_Window = params->window;
+    m_VideoWidth = params->width;
+    m_VideoHeight = params->height;
+
+    if (!m_BackendRenderer->canExportDrmPrime()) {
+        return false;
+    }
+
+    if (params->videoFormat == VIDEO_FORMAT_H265_MAIN10) {
+        // There's no way to tell the compositor about HDR content, so
+        // leave these streams to the renderers that can tone map them
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Wayland DMA-BUF presentation doesn't support HDR streams");
+        return false;
+    }
+
+    if (qgetenv("WAYLAND_DISABLE_DMABUF") == "1") {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Wayland DMA-BUF presentation is disabled by WAYLAND_DISABLE_DMABUF");
+        return false;
+    }
+
+    SDL_VERSION(&info.version);
+    if (!SDL_GetWindowWMInfo(m_Window, &info)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "SDL_GetWindowWMInfo() failed: %s",
+                     SDL_GetError());
+        return false;
+    }
+
+    if (info.subsystem != SDL_SYSWM_WAYLAND) {
+        return false;
+    }
+
+    // Subsurfaces are only shown while their parent is mapped, and nothing
+    // else attaches a buffer to SDL's surface. SDL's renderer fills it with
+    // black, which also letterboxes the video. This comes first, because
+    // creating the renderer can recreate the window's surface.
+    m_BackgroundRenderer = SDL_CreateRenderer(m_Window, -1, SDL_RENDERER_ACCELERATED);
+    if (m_BackgroundRenderer == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "SDL_CreateRenderer() failed: %s",
+                     SDL_GetError());
+        return false;
+    }
+
+    SDL_VERSION(&info.version);
+    if (!SDL_GetWindowWMInfo(m_Window, &info)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "SDL_GetWindowWMInfo() failed: %s",
+                     SDL_GetError());
+        return false;
+    }
+
+    m_Display = info.info.wl.display;
+    m_ParentSurface = info.info.wl.surface;
+
+    // Our globals and everything created from them dispatch on our own
+    // queue, so SDL never sees or steals their events
+    m_Queue = wl_display_create_queue(m_Display);
+    if (m_Queue == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "wl_display_create_queue() failed");
+        return false;
+    }
+
+    struct wl_display* displayWrapper = reinterpret_cast<struct wl_display*>(wl_proxy_create_wrapper(m_Display));
+    if (displayWrapper == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "wl_proxy_create_wrapper() failed");
+        return false;
+    }
+    wl_proxy_set_queue(reinterpret_cast<struct wl_proxy*>(displayWrapper), m_Queue);
+    m_Registry = wl_display_get_registry(displayWrapper);
+    wl_proxy_wrapper_destroy(displayWrapper);
+
+    wl_registry_add_listener(m_Registry, &k_RegistryListener, this);
+
+    // The first roundtrip binds the globals, and the second one collects
+    // the DMA-BUF formats and presentation clock they announce
+    if (wl_display_roundtrip_queue(m_Display, m_Queue) < 0 ||
+            wl_display_roundtrip_queue(m_Display, m_Queue) < 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "wl_display_roundtrip_queue() failed");
+        return false;
+    }
+
+    if (m_Compositor == nullptr || m_Subcompositor == nullptr || m_Shm == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Compositor is missing core Wayland globals");
+        return false;
+    }
+    else if (m_Dmabuf == nullptr) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Compositor doesn't support zwp_linux_dmabuf_v1 version 2");
+        return false;
+    }
+    else if (m_Viewporter == nullptr) {
+        // Without a viewport, the compositor can't scale the video
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Compositor doesn't support wp_viewporter");
+        return false;
+    }
+    else if (!m_DrmFormatSupported) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Compositor can't import NV12 DMA-BUFs");
+        return false;
+    }
+
+    if (m_Presentation == nullptr) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Compositor doesn't support wp_presentation; frames will be paced without its feedback");
+    }
+
+    m_VideoSurface = createSubsurface(&m_VideoSubsurface);
+    m_OverlaySurface = createSubsurface(&m_OverlaySubsurface);
+    if (m_VideoSurface == nullptr || m_OverlaySurface == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unable to create Wayland subsurfaces");
+        return false;
+    }
+
+    // Decoder surfaces can be padded past the size of the picture
+    m_VideoViewport = wp_viewporter_get_viewport(m_Viewporter, m_VideoSurface);
+    wp_viewport_set_source(m_VideoViewport,
+                           wl_fixed_from_int(0), wl_fixed_from_int(0),
+                           wl_fixed_from_int(m_VideoWidth), wl_fixed_from_int(m_VideoHeight));
+
+    updateLayout();
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Presenting DMA-BUFs on a Wayland subsurface");
+    return true;
+}
+
+bool WaylandRenderer::prepareDecoderContext(AVCodecContext*)
+{
+    // We're only ever a frontend renderer
+    SDL_assert(false);
+    return false;
+}
+
+void WaylandRenderer::updateLayout()
+{
+    int width, height;
+
+    SDL_GetWindowSize(m_Window, &width, &height);
+    SDL_AtomicSet(&m_WindowSize, (width << 16) | (height & 0xFFFF));
+
+    SDL_Rect src, dst;
+    src.x = src.y = 0;
+    src.w = m_VideoWidth;
+    src.h = m_VideoHeight;
+    dst.x = dst.y = 0;
+    dst.w = width;
+    dst.h = height;
+    StreamUtils::scaleSourceToDestinationSurface(&src, &dst);
+
+    // The viewport applies with the video surface's next commit
+    wp_viewport_set_destination(m_VideoViewport, dst.w, dst.h);
+    wl_subsurface_set_position(m_VideoSubsurface, dst.x, dst.y);
+
+    // Compose the overlays again for the new window size
+    SDL_AtomicSet(&m_PendingOverlayUpdates, (1 << Overlay::OverlayMax) - 1);
+
+    // Presenting the background commits SDL's surface, which applies
+    // the new position of the subsurface
+    SDL_SetRenderDrawColor(m_BackgroundRenderer, 0, 0, 0, SDL_ALPHA_OPAQUE);
+    SDL_RenderClear(m_BackgroundRenderer);
+    SDL_RenderPresent(m_BackgroundRenderer);
+}
+
+bool WaylandRenderer::notifyWindowResized(PDECODER_PARAMETERS)
+{
+    updateLayout();
+    return true;
+}
+
+void WaylandRenderer::dispatchEvents()
+{
+    // Read whatever has arrived without waiting for more
+    while (wl_display_prepare_read_queue(m_Display, m_Queue) != 0) {
+        wl_display_dispatch_queue_pending(m_Display, m_Queue);
+    }
+
+    wl_display_flush(m_Display);
+
+    struct pollfd pfd;
+    pfd.fd = wl_display_get_fd(m_Display);
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    if (poll(&pfd, 1, 0) > 0) {
+        wl_display_read_events(m_Display);
+    }
+    else {
+        wl_display_cancel_read(m_Display);
+    }
+
+    wl_display_dispatch_queue_pending(m_Display, m_Queue);
+}
+
+void WaylandRenderer::renderFrame(AVFrame* frame)
+{
+    // Pick up buffer releases and presentation feedback
+    dispatchEvents();
+
+    int pendingUpdates = SDL_AtomicSet(&m_PendingOverlayUpdates, 0);
+    if (pendingUpdates != 0) {
+        updateOverlay(pendingUpdates);
+    }
+
+    HeldFrame* heldFrame = nullptr;
+    for (int i = 0; i < WAYLAND_MAX_HELD_FRAMES; i++) {
+        if (m_HeldFrames[i].buffer == nullptr) {
+            heldFrame = &m_HeldFrames[i];
+            break;
+        }
+    }
+
+    if (heldFrame == nullptr) {
+        // Holding on to another frame could starve the decoder of surfaces
+        SDL_LOG_RATE_LIMITED(SDL_LogWarn, SDL_LOG_CATEGORY_APPLICATION,
+                             "Compositor is still holding %d frames; dropping this one",
+                             WAYLAND_MAX_HELD_FRAMES);
+        return;
+    }
+
+    AVDRMFrameDescriptor mappedFrame;
+    const AVDRMFrameDescriptor* drmFrame;
+    bool mapped = false;
+    if (frame->format == AV_PIX_FMT_DRM_PRIME) {
+        drmFrame = (const AVDRMFrameDescriptor*)frame->data[0];
+    }
+    else if (m_BackendRenderer->mapDrmPrimeFrame(frame, &mappedFrame)) {
+        drmFrame = &mappedFrame;
+        mapped = true;
+    }
+    else {
+        return;
+    }
+
+    if (drmFrame->nb_layers != 1) {
+        SDL_LOG_RATE_LIMITED(SDL_LogError, SDL_LOG_CATEGORY_APPLICATION,
+                             "Frames with %d DRM layers can't be presented",
+                             drmFrame->nb_layers);
+        if (mapped) {
+            m_BackendRenderer->unmapDrmPrimeFrame(&mappedFrame);
+        }
+        return;
+    }
+
+    struct zwp_linux_buffer_params_v1* bufferParams = zwp_linux_dmabuf_v1_create_params(m_Dmabuf);
+    const AVDRMLayerDescriptor* layer = &drmFrame->layers[0];
+    for (int i = 0; i < layer->nb_planes; i++) {
+        const AVDRMObjectDescriptor* object = &drmFrame->objects[layer->planes[i].object_index];
+        zwp_linux_buffer_params_v1_add(bufferParams,
+                                       object->fd,
+                                       (uint32_t)i,
+                                       (uint32_t)layer->planes[i].offset,
+                                       (uint32_t)layer->planes[i].pitch,
+                                       (uint32_t)(object->format_modifier >> 32),
+                                       (uint32_t)(object->format_modifier & 0xFFFFFFFF));
+    }
+
+    struct wl_buffer* buffer = zwp_linux_buffer_params_v1_create_immed(bufferParams,
+                                                                      frame->width,
+                                                                      frame->height,
+                                                                      layer->format,
+                                                                      0);
+    zwp_linux_buffer_params_v1_destroy(bufferParams);
+
+    // libwayland sent its own copies of the FDs along with the request
+    if (mapped) {
+        m_BackendRenderer->unmapDrmPrimeFrame(&mappedFrame);
+    }
+
+    if (buffer == nullptr) {
+        return;
+    }
+
+    // The compositor reads the surface until it releases the buffer
+    heldFrame->renderer = this;
+    heldFrame->buffer = buffer;
+    heldFrame->frame = av_frame_alloc();
+    if (heldFrame->frame != nullptr) {
+        av_frame_ref(heldFrame->frame, frame);
+    }
+    wl_buffer_add_listener(buffer, &k_FrameBufferListener, heldFrame);
+
+    wl_surface_attach(m_VideoSurface, buffer, 0, 0);
+    wl_surface_damage(m_VideoSurface, 0, 0, INT32_MAX, INT32_MAX);
+
+    if (m_Presentation != nullptr) {
+        PresentationFeedback* feedback = new PresentationFeedback();
+        feedback->renderer = this;
+        feedback->commitTimeUs = StreamUtils::getTimeUs();
+        feedback->feedback = wp_presentation_feedback(m_Presentation, m_VideoSurface);
+        wp_presentation_feedback_add_listener(feedback->feedback, &k_FeedbackListener, feedback);
+        m_Feedbacks.append(feedback);
+    }
+
+    wl_surface_commit(m_VideoSurface);
+    wl_display_flush(m_Display);
+}
+
+Uint64 WaylandRenderer::takePresentLatencyUs()
+{
+    SDL_AtomicLock(&m_VblankTimeLock);
+    Uint64 latencyUs = m_PresentLatencyUs;
+    m_PresentLatencyUs = 0;
+    SDL_AtomicUnlock(&m_VblankTimeLock);
+
+    return latencyUs;
+}
+
+bool WaylandRenderer::getLastVblankTimeUs(Uint64& vblankTimeUs)
+{
+    SDL_AtomicLock(&m_VblankTimeLock);
+    vblankTimeUs = m_LastVblankTimeUs;
+    SDL_AtomicUnlock(&m_VblankTimeLock);
+
+    return vblankTimeUs != 0;
+}
+
+bool WaylandRenderer::hasPresentationFeedback()
+{
+    return m_Presentation != nullptr;
+}
+
+const char* WaylandRenderer::getPresentationPath()
+{
+    return "Wayland DMA-BUF subsurface";
+}
+
+void WaylandRenderer::notifyOverlayUpdated(Overlay::OverlayType type)
+{
+    // This may be called on any thread, so we just flag the overlay
+    // for composition by the thread calling renderFrame().
+    int pendingUpdates;
+    do {
+        pendingUpdates = SDL_AtomicGet(&m_PendingOverlayUpdates);
+    } while (!SDL_AtomicCAS(&m_PendingOverlayUpdates, pendingUpdates, pendingUpdates | (1 << type)));
+}
+
+bool WaylandRenderer::usesOverlaySurfaces()
+{
+    return true;
+}
+
+bool WaylandRenderer::createShmBuffer(ShmBuffer& buffer, int width, int height)
+{
+    int stride = width * 4;
+    size_t size = (size_t)stride * height;
+
+    int fd = memfd_create("moonlight-overlay", MFD_CLOEXEC);
+    if (fd < 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "memfd_create() failed: %d",
+                     errno);
+        return false;
+    }
+
+    if (ftruncate(fd, (off_t)size) < 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "ftruncate() failed: %d",
+                     errno);
+        close(fd);
+        return false;
+    }
+
+    void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "mmap() failed: %d",
+                     errno);
+        close(fd);
+        return false;
+    }
+
+    struct wl_shm_pool* pool = wl_shm_create_pool(m_Shm, fd, (int32_t)size);
+    buffer.buffer = wl_shm_pool_create_buffer(pool, 0, width, height, stride, WL_SHM_FORMAT_ARGB8888);
+    wl_shm_pool_destroy(pool);
+    close(fd);
+
+    wl_buffer_add_listener(buffer.buffer, &k_ShmBufferListener, &buffer);
+
+    buffer.data = data;
+    buffer.size = size;
+    buffer.busy = false;
+    buffer.surface = SDL_CreateRGBSurfaceWithFormatFrom(data, width, height, 32, stride,
+                                                        SDL_PIXELFORMAT_ARGB8888);
+    if (buffer.surface == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "SDL_CreateRGBSurfaceWithFormatFrom() failed: %s",
+                     SDL_GetError());
+        destroyShmBuffer(buffer);
+        return false;
+    }
+
+    return true;
+}
+
+void WaylandRenderer::destroyShmBuffer(ShmBuffer& buffer)
+{
+    if (buffer.surface != nullptr) {
+        SDL_FreeSurface(buffer.surface);
+    }
+    if (buffer.buffer != nullptr) {
+        wl_buffer_destroy(buffer.buffer);
+    }
+    if (buffer.data != nullptr) {
+        munmap(buffer.data, buffer.size);
+    }
+
+    SDL_zero(buffer);
+}
+
+void WaylandRenderer::updateOverlay(int pendingUpdates)
+{
+    bool overlayVisible = false;
+
+    // Pick up the latest overlay surfaces from the OverlayManager
+    for (int i = 0; i < Overlay::OverlayMax; i++) {
+        if (!(pendingUpdates & (1 << i))) {
+            continue;
+        }
+
+        Overlay::OverlayType type = (Overlay::OverlayType)i;
+        SDL_Surface* surface = Session::get()->getOverlayManager().getUpdatedOverlaySurface(type);
+
+        if (!Session::get()->getOverlayManager().isOverlayEnabled(type)) {
+            if (surface != nullptr) {
+                SDL_FreeSurface(surface);
+            }
+            surface = nullptr;
+        }
+        else if (surface == nullptr) {
+            // Keep the current surface
+            continue;
+        }
+
+        if (m_OverlaySurfaces[i] != nullptr) {
+            SDL_FreeSurface(m_OverlaySurfaces[i]);
+        }
+        m_OverlaySurfaces[i] = surface;
+    }
+
+    for (int i = 0; i < Overlay::OverlayMax; i++) {
+        overlayVisible |= m_OverlaySurfaces[i] != nullptr;
+    }
+
+    if (!overlayVisible) {
+        if (m_OverlayVisible) {
+            // Unmap the overlay subsurface
+            wl_surface_attach(m_OverlaySurface, nullptr, 0, 0);
+            wl_surface_commit(m_OverlaySurface);
+            m_OverlayVisible = false;
+        }
+        return;
+    }
+
+    int windowSize = SDL_AtomicGet(&m_WindowSize);
+    int width = windowSize >> 16;
+    int height = windowSize & 0xFFFF;
+
+    ShmBuffer* buffer = nullptr;
+    for (int i = 0; i < 2; i++) {
+        if (m_OverlayBuffers[i].busy) {
+            continue;
+        }
+
+        if (m_OverlayBuffers[i].surface != nullptr &&
+                (m_OverlayBuffers[i].surface->w != width || m_OverlayBuffers[i].surface->h != height)) {
+            destroyShmBuffer(m_OverlayBuffers[i]);
+        }
+
+        if (m_OverlayBuffers[i].surface != nullptr || createShmBuffer(m_OverlayBuffers[i], width, height)) {
+            buffer = &m_OverlayBuffers[i];
+            break;
+        }
+    }
+
+    if (buffer == nullptr) {
+        // Try again with the next frame, once the compositor is done
+        // reading one of the buffers
+        notifyOverlayUpdated(Overlay::OverlayDebug);
+        return;
+    }
+
+    // The overlay surfaces are already premultiplied, which is what
+    // Wayland expects of ARGB8888 buffers
+    SDL_FillRect(buffer->surface, nullptr, 0);
+    for (int i = 0; i < Overlay::OverlayMax; i++) {
+        if (m_OverlaySurfaces[i] == nullptr) {
+            continue;
+        }
+
+        // Debug at the top left and status at the bottom left of the window
+        SDL_Rect dst;
+        dst.x = 0;
+        if (i == Overlay::OverlayStatusUpdate) {
+            dst.y = height - m_OverlaySurfaces[i]->h;
+        }
+        else {
+            dst.y = 0;
+        }
+
+        // This clips the destination rectangle to the overlay buffer
+        SDL_SetSurfaceBlendMode(m_OverlaySurfaces[i], SDL_BLENDMODE_NONE);
+        SDL_BlitSurface(m_OverlaySurfaces[i], nullptr, buffer->surface, &dst);
+    }
+
+    buffer->busy = true;
+    wl_surface_attach(m_OverlaySurface, buffer->buffer, 0, 0);
+    wl_surface_damage(m_OverlaySurface, 0, 0, INT32_MAX, INT32_MAX);
+    wl_surface_commit(m_OverlaySurface);
+    m_OverlayVisible = true;
+}
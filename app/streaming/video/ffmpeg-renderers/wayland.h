@@ -0,0 +1,143 @@
+#pragma once
+
+#include "renderer.h"
+
+#include <QVector>
+
+#include <time.h>
+
+#include <wayland-client.h>
+
+#include "linux-dmabuf-unstable-v1-client-protocol.h"
+#include "presentation-time-client-protocol.h"
+#include "viewporter-client-protocol.h"
+
+// Frames are attached to the compositor as DMA-BUF wl_buffers at most
+// this many at a time: the one on screen and the one waiting to replace
+// it. The decoder's surface pool only has room for one frame on screen
+// besides the ones the Pacer holds.
+#define WAYLAND_MAX_HELD_FRAMES 2
+
+// Shows the backend's DMA-BUF frames on a subsurface of the window, so
+// the compositor can put them on a plane without composing (or copying)
+// them. The video subsurface is desynchronized from SDL's surface, which
+// is only filled with black to map the window and letterbox the video.
+// The overlays are composed into a shared memory buffer on a subsurface
+// above the video.
+//
+// wp_presentation reports when each frame reached the display, which
+// paces frames through a timer V-sync source instead of frame callbacks,
+// since our commits never go to the surface that SDL owns.
+class WaylandRenderer : public IFFmpegRenderer {
+public:
+    WaylandRenderer(IFFmpegRenderer* backendRenderer);
+    virtual ~WaylandRenderer() override;
+    virtual bool initialize(PDECODER_PARAMETERS params) override;
+    virtual bool prepareDecoderContext(AVCodecContext* context) override;
+    virtual void renderFrame(AVFrame* frame) override;
+    virtual bool notifyWindowResized(PDECODER_PARAMETERS params) override;
+    virtual Uint64 takePresentLatencyUs() override;
+    virtual bool getLastVblankTimeUs(Uint64& vblankTimeUs) override;
+    virtual bool hasPresentationFeedback() override;
+    virtual const char* getPresentationPath() override;
+    virtual void notifyOverlayUpdated(Overlay::OverlayType type) override;
+    virtual bool usesOverlaySurfaces() override;
+
+private:
+    struct HeldFrame {
+        WaylandRenderer* renderer;
+        struct wl_buffer* buffer;
+        AVFrame* frame;
+    };
+
+    struct ShmBuffer {
+        struct wl_buffer* buffer;
+        void* data;
+        size_t size;
+        SDL_Surface* surface;
+        bool busy;
+    };
+
+    struct PresentationFeedback {
+        WaylandRenderer* renderer;
+        struct wp_presentation_feedback* feedback;
+        Uint64 commitTimeUs;
+    };
+
+    static void registryGlobal(void* data, struct wl_registry* registry, uint32_t name,
+                               const char* interface, uint32_t version);
+    static void registryGlobalRemove(void* data, struct wl_registry* registry, uint32_t name);
+    static void dmabufFormat(void* data, struct zwp_linux_dmabuf_v1* dmabuf, uint32_t format);
+    static void dmabufModifier(void* data, struct zwp_linux_dmabuf_v1* dmabuf, uint32_t format,
+                               uint32_t modifierHi, uint32_t modifierLo);
+    static void presentationClockId(void* data, struct wp_presentation* presentation, uint32_t clockId);
+    static void frameBufferReleased(void* data, struct wl_buffer* buffer);
+    static void shmBufferReleased(void* data, struct wl_buffer* buffer);
+    static void feedbackSyncOutput(void* data, struct wp_presentation_feedback* feedback,
+                                   struct wl_output* output);
+    static void feedbackPresented(void* data, struct wp_presentation_feedback* feedback,
+                                  uint32_t tvSecHi, uint32_t tvSecLo, uint32_t tvNsec,
+                                  uint32_t refresh, uint32_t seqHi, uint32_t seqLo, uint32_t flags);
+    static void feedbackDiscarded(void* data, struct wp_presentation_feedback* feedback);
+
+    static const struct wl_registry_listener k_RegistryListener;
+    static const struct zwp_linux_dmabuf_v1_listener k_DmabufListener;
+    static const struct wp_presentation_listener k_PresentationListener;
+    static const struct wl_buffer_listener k_FrameBufferListener;
+    static const struct wl_buffer_listener k_ShmBufferListener;
+    static const struct wp_presentation_feedback_listener k_FeedbackListener;
+
+    struct wl_surface* createSubsurface(struct wl_subsurface** subsurface);
+    void dispatchEvents();
+    void updateLayout();
+    void releaseFeedback(PresentationFeedback* feedback);
+    bool createShmBuffer(ShmBuffer& buffer, int width, int height);
+    void destroyShmBuffer(ShmBuffer& buffer);
+    void updateOverlay(int pendingUpdates);
+
+    IFFmpegRenderer* m_BackendRenderer;
+    SDL_Window* m_Window;
+    SDL_Renderer* m_BackgroundRenderer;
+    int m_VideoWidth;
+    int m_VideoHeight;
+    uint32_t m_DrmFormat;
+    bool m_DrmFormatSupported;
+
+    struct wl_display* m_Display;
+    struct wl_event_queue* m_Queue;
+    struct wl_registry* m_Registry;
+    struct wl_compositor* m_Compositor;
+    struct wl_subcompositor* m_Subcompositor;
+    struct wl_shm* m_Shm;
+    struct zwp_linux_dmabuf_v1* m_Dmabuf;
+    struct wp_viewporter* m_Viewporter;
+    struct wp_presentation* m_Presentation;
+    clockid_t m_PresentationClock;
+
+    struct wl_surface* m_ParentSurface;
+    struct wl_surface* m_VideoSurface;
+    struct wl_subsurface* m_VideoSubsurface;
+    struct wp_viewport* m_VideoViewport;
+    struct wl_surface* m_OverlaySurface;
+    struct wl_subsurface* m_OverlaySubsurface;
+
+    HeldFrame m_HeldFrames[WAYLAND_MAX_HELD_FRAMES];
+    QVector<PresentationFeedback*> m_Feedbacks;
+
+    // Written by the presentation feedback on the render thread and read
+    // by the V-sync source's thread
+    SDL_SpinLock m_VblankTimeLock;
+    Uint64 m_LastVblankTimeUs;
+    Uint64 m_PresentLatencyUs;
+
+    // Packed as (width << 16) | height so it can be updated from the
+    // main thread while frames are rendering.
+    SDL_atomic_t m_WindowSize;
+
+    // Double-buffered, since the compositor reads the overlay buffer
+    // until it releases it
+    ShmBuffer m_OverlayBuffers[2];
+    SDL_Surface* m_OverlaySurfaces[Overlay::OverlayMax];
+    bool m_OverlayVisible;
+    SDL_atomic_t m_PendingOverlayUpdates;
+};
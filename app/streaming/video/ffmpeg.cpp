@@ -1,15 +1,29 @@
 #include <Limelight.h>
 #include "ffmpeg.h"
+#include "bitstreamanalytics.h"
+#include "decodercache.h"
+#include "framegraph.h"
+#include "frametracer.h"
 #include "streaming/streamutils.h"
 #include "streaming/session.h"
+#include "utils.h"
 
 #include <h264_stream.h>
 
+#include <QMutex>
+
+#include <algorithm>
+
+extern "C" {
+#include <libavutil/hwcontext.h>
+}
+
 #include "ffmpeg-renderers/sdlvid.h"
 #include "ffmpeg-renderers/cuda.h"
 
 #ifdef Q_OS_WIN32
 #include "ffmpeg-renderers/dxva2.h"
+#include "ffmpeg-renderers/d3d11va.h"
 #endif
 
 #ifdef Q_OS_DARWIN
@@ -24,6 +38,10 @@
 #include "ffmpeg-renderers/vdpau.h"
 #endif
 
+#ifdef HAVE_QSV
+#include "ffmpeg-renderers/qsv.h"
+#endif
+
 #ifdef HAVE_MMAL
 #include "ffmpeg-renderers/mmal.h"
 #endif
@@ -32,6 +50,14 @@
 #include "ffmpeg-renderers/drm.h"
 #endif
 
+#ifdef HAVE_EGL
+#include "ffmpeg-renderers/eglvid.h"
+#endif
+
+#ifdef HAVE_WAYLAND_DMABUF
+#include "ffmpeg-renderers/wayland.h"
+#endif
+
 // This is gross but it allows us to use sizeof()
 #include "ffmpeg_videosamples.cpp"
 
@@ -39,6 +65,58 @@
 
 #define FAILED_DECODES_RESET_THRESHOLD 20
 
+// How often a key frame is asked for again while concealed frames
+// keep coming, in case the host missed the first request
+#define CONCEALMENT_IDR_RETRY_US 500000
+
+// Smallest size of the pooled packet buffers. The pool starts out big
+// enough for the IDR frames expected at the stream's resolution and is
+// recreated with headroom to spare if a frame exceeds it, so it settles
+// after the first few frames instead of growing with each larger one.
+#define INITIAL_PACKET_BUFFER_SIZE (1024 * 1024)
+#define EXPECTED_IDR_FRAME_BYTES_PER_8_PIXELS 3
+#define PACKET_BUFFER_GROWTH_PERCENT 150
+
+// Enough frames to fill both of Pacer's queues, plus one
+// frame being rendered and another being decoded
+#define FRAME_POOL_SIZE (Pacer::getMaxHeldFrames() + 1)
+
+// Decoder surfaces needed besides the stream's references: the one
+// being decoded, the ones the Pacer can hold, and one still on screen
+#define EXTRA_DECODER_SURFACES (1 + Pacer::getMaxHeldFrames() + 1)
+
+// Number of times the test frame is decoded per configuration
+// when benchmarking software decoding
+#define SW_DECODE_BENCHMARK_ITERATIONS 200
+
+// Number of times each working hwaccel decodes the test frame
+// when ranking them by decode time
+#define HWACCEL_BENCHMARK_ITERATIONS 30
+
+#if defined(Q_OS_UNIX) && !defined(Q_OS_DARWIN)
+// Hwaccel device setup on Linux doesn't need to happen on the thread
+// that owns the window, so test decoders can probe them concurrently.
+#define PARALLEL_HWACCEL_PROBING
+#endif
+
+// Identifies a hwaccel config index and renderer pass in m_FailedHwAccelProbes
+#define HWACCEL_PROBE_KEY(index, pass) ((index) * 2 + (pass))
+
+// Identifies the QSV decoder, which isn't a hwaccel of the native decoder
+#define QSV_PROBE_KEY -1
+
+struct HwAccelProbe {
+    AVCodec* decoder;
+    DECODER_PARAMETERS params;
+    const AVCodecHWConfig* config;
+    int key;
+    int pass;
+    SDL_Thread* thread;
+    bool success;
+    Uint32 probeTimeMs;
+    int decodeTimeUs;
+};
+
 bool FFmpegVideoDecoder::isHardwareAccelerated()
 {
     return m_HwDecodeCfg != nullptr ||
@@ -47,7 +125,42 @@ bool FFmpegVideoDecoder::isHardwareAccelerated()
 
 int FFmpegVideoDecoder::getDecoderCapabilities()
 {
-    return m_BackendRenderer->getDecoderCapabilities();
+    int caps = m_BackendRenderer->getDecoderCapabilities();
+
+    // With pipelined decoding, submitDecodeUnit() only copies the frame
+    // into our preallocated ring and returns, so it can run right on the
+    // receive thread. That skips moonlight-common-c's decode unit queue,
+    // which allocates a node per frame and wakes another thread for it.
+    if (isPipelinedDecodeEnabled()) {
+        caps |= CAPABILITY_DIRECT_SUBMIT;
+    }
+
+    if (!isHardwareAccelerated()) {
+        // Ask the host for one slice per core so slice threading
+        // can use the whole CPU. The slices still reach us together,
+        // since moonlight-common-c only hands over complete frames, so
+        // decoding can't start on the first slices while the last ones
+        // are in flight. That would take partial decode units (and
+        // AV_CODEC_FLAG2_CHUNKS here) from the depacketizer.
+        caps |= CAPABILITY_SLICES_PER_FRAME(getSoftwareDecodeSliceCount());
+    }
+
+    return caps;
+}
+
+bool FFmpegVideoDecoder::isPipelinedDecodeEnabled()
+{
+    return qgetenv("ASYNC_DECODE") == "1";
+}
+
+bool FFmpegVideoDecoder::isHwAccelBenchmarkEnabled()
+{
+    return qgetenv("HWACCEL_BENCHMARK") == "1";
+}
+
+int FFmpegVideoDecoder::getSoftwareDecodeSliceCount()
+{
+    return qMin(MAX_SOFTWARE_SLICES, SDL_GetCPUCount());
 }
 
 enum AVPixelFormat FFmpegVideoDecoder::ffGetFormat(AVCodecContext* context,
@@ -64,6 +177,9 @@ enum AVPixelFormat FFmpegVideoDecoder::ffGetFormat(AVCodecContext* context,
         if (*p == (decoder->m_HwDecodeCfg ?
                    decoder->m_HwDecodeCfg->pix_fmt :
                    context->pix_fmt)) {
+            if (decoder->m_HwDecodeCfg != nullptr) {
+                decoder->createHwFramesContext(context, *p);
+            }
             return *p;
         }
     }
@@ -71,24 +187,204 @@ enum AVPixelFormat FFmpegVideoDecoder::ffGetFormat(AVCodecContext* context,
     return AV_PIX_FMT_NONE;
 }
 
+// FFmpeg sizes hardware frame pools for the largest DPB the codec
+// allows, but the host only encodes with a reference frame or two.
+// Called from get_format(), after the SPS has been parsed. If this
+// fails, FFmpeg just creates its own pool.
+void FFmpegVideoDecoder::createHwFramesContext(AVCodecContext* context, enum AVPixelFormat hwFormat)
+{
+    if (context->hw_device_ctx == nullptr || context->hw_frames_ctx != nullptr) {
+        // The renderer manages its own surfaces
+        return;
+    }
+
+    int refFrames;
+    if (context->codec_id == AV_CODEC_ID_H264) {
+        refFrames = context->refs;
+    }
+    else {
+        refFrames = SDL_AtomicGet(&m_HevcSpsRefFrames);
+    }
+
+    if (refFrames <= 0) {
+        // Not known yet (like for the test frame)
+        return;
+    }
+
+    AVBufferRef* framesRef;
+    if (avcodec_get_hw_frames_parameters(context, context->hw_device_ctx, hwFormat, &framesRef) < 0) {
+        return;
+    }
+
+    AVHWFramesContext* framesContext = (AVHWFramesContext*)framesRef->data;
+
+    // A pool size of 0 means frames are allocated on demand
+    int surfaceCount = refFrames + EXTRA_DECODER_SURFACES;
+    if (framesContext->initial_pool_size > surfaceCount) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Allocating %d decoder surfaces instead of %d for %d reference frames",
+                    surfaceCount,
+                    framesContext->initial_pool_size,
+                    refFrames);
+        framesContext->initial_pool_size = surfaceCount;
+    }
+
+    int err = av_hwframe_ctx_init(framesRef);
+    if (err < 0) {
+        char errorstring[512];
+        av_strerror(err, errorstring, sizeof(errorstring));
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "av_hwframe_ctx_init() failed: %s",
+                    errorstring);
+        av_buffer_unref(&framesRef);
+        return;
+    }
+
+    context->hw_frames_ctx = framesRef;
+}
+
+// Returns the number of pictures besides the current one that the
+// HEVC SPS says the decoder must hold, or 0 if it can't be parsed
+int FFmpegVideoDecoder::getHevcSpsRefFrames(const char* data, int length)
+{
+    // Skip the Annex B start code and NAL unit header, and strip
+    // emulation prevention bytes from what follows
+    int start = 0;
+    while (start < length - 1 && !(data[start] == 0 && data[start + 1] == 1)) {
+        start++;
+    }
+    start += 2 + 2;
+
+    QByteArray rbsp;
+    int zeroes = 0;
+    for (int i = start; i < length; i++) {
+        if (zeroes >= 2 && data[i] == 3) {
+            zeroes = 0;
+            continue;
+        }
+        zeroes = data[i] == 0 ? zeroes + 1 : 0;
+        rbsp.append(data[i]);
+    }
+
+    const uint8_t* bits = (const uint8_t*)rbsp.constData();
+    int totalBits = rbsp.size() * 8;
+    int bitOffset = 0;
+    bool overrun = false;
+
+    auto readBits = [&](int count) {
+        uint32_t value = 0;
+        while (count-- > 0) {
+            if (bitOffset >= totalBits) {
+                overrun = true;
+                return value;
+            }
+            value = (value << 1) | ((bits[bitOffset / 8] >> (7 - bitOffset % 8)) & 1);
+            bitOffset++;
+        }
+        return value;
+    };
+    auto readUe = [&]() {
+        int leadingZeroes = 0;
+        while (readBits(1) == 0 && !overrun && leadingZeroes < 32) {
+            leadingZeroes++;
+        }
+        return ((1u << leadingZeroes) - 1) + readBits(leadingZeroes);
+    };
+
+    readBits(4); // sps_video_parameter_set_id
+    int maxSubLayersMinus1 = readBits(3);
+    readBits(1); // sps_temporal_id_nesting_flag
+
+    // profile_tier_level(): the general profile and level are 96 bits
+    readBits(32);
+    readBits(32);
+    readBits(32);
+
+    bool subLayerProfilePresent[8] = {};
+    bool subLayerLevelPresent[8] = {};
+    for (int i = 0; i < maxSubLayersMinus1; i++) {
+        subLayerProfilePresent[i] = readBits(1);
+        subLayerLevelPresent[i] = readBits(1);
+    }
+    if (maxSubLayersMinus1 > 0) {
+        readBits(2 * (8 - maxSubLayersMinus1));
+    }
+    for (int i = 0; i < maxSubLayersMinus1; i++) {
+        if (subLayerProfilePresent[i]) {
+            readBits(32);
+            readBits(32);
+            readBits(24);
+        }
+        if (subLayerLevelPresent[i]) {
+            readBits(8);
+        }
+    }
+
+    readUe(); // sps_seq_parameter_set_id
+    if (readUe() == 3) { // chroma_format_idc
+        readBits(1); // separate_colour_plane_flag
+    }
+    readUe(); // pic_width_in_luma_samples
+    readUe(); // pic_height_in_luma_samples
+    if (readBits(1)) { // conformance_window_flag
+        readUe();
+        readUe();
+        readUe();
+        readUe();
+    }
+    readUe(); // bit_depth_luma_minus8
+    readUe(); // bit_depth_chroma_minus8
+    readUe(); // log2_max_pic_order_cnt_lsb_minus4
+
+    // Only the values for the highest sub-layer matter
+    bool subLayerOrderingInfoPresent = readBits(1);
+    uint32_t maxDecPicBufferingMinus1 = 0;
+    for (int i = subLayerOrderingInfoPresent ? 0 : maxSubLayersMinus1; i <= maxSubLayersMinus1; i++) {
+        maxDecPicBufferingMinus1 = readUe();
+        readUe(); // sps_max_num_reorder_pics
+        readUe(); // sps_max_latency_increase_plus1
+    }
+
+    if (overrun || maxDecPicBufferingMinus1 > 15) {
+        return 0;
+    }
+
+    return (int)maxDecPicBufferingMinus1;
+}
+
 FFmpegVideoDecoder::FFmpegVideoDecoder(bool testOnly)
     : m_VideoDecoderCtx(nullptr),
-      m_DecodeBuffer(1024 * 1024, 0),
+      m_PacketBufferPool(nullptr),
+      m_PacketBufferSize(0),
       m_HwDecodeCfg(nullptr),
       m_BackendRenderer(nullptr),
       m_FrontendRenderer(nullptr),
       m_ConsecutiveFailedDecodes(0),
       m_Pacer(nullptr),
-      m_LastFrameNumber(0),
-      m_StreamFps(0),
+      m_FramePool(nullptr),
+      m_ActiveWndVideoStats(*m_VideoStats.getActiveWindowStats()),
+      m_VideoFormat(0),
       m_NeedsSpsFixup(false),
-      m_TestOnly(testOnly)
+      m_ErrorConcealment(false),
+      m_ConcealmentStartUs(0),
+      m_LastConcealmentIdrRequestUs(0),
+      m_TestOnly(testOnly),
+      m_BackendProbeOnly(false),
+      m_AsyncDecode(false),
+      m_DecoderThread(nullptr),
+      m_DecodeQueueSem(nullptr),
+      m_RendererLock(0)
 {
     av_init_packet(&m_Pkt);
 
-    SDL_zero(m_ActiveWndVideoStats);
-    SDL_zero(m_LastWndVideoStats);
-    SDL_zero(m_GlobalVideoStats);
+    SDL_AtomicSet(&m_DecoderThreadStopping, 0);
+    SDL_AtomicSet(&m_DecoderThreadNeedsIdr, 0);
+    SDL_AtomicSet(&m_DecodeQueueHead, 0);
+    SDL_AtomicSet(&m_DecodeQueueTail, 0);
+    SDL_AtomicSet(&m_HevcSpsRefFrames, 0);
+    for (int i = 0; i < MAX_QUEUED_DECODE_UNITS; i++) {
+        av_init_packet(&m_DecodeQueue[i].packet);
+    }
 
     // Use linear filtering when renderer scaling is required
     SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "1");
@@ -98,6 +394,10 @@ FFmpegVideoDecoder::~FFmpegVideoDecoder()
 {
     reset();
 
+    // Any buffers still referenced by the decoder were released in reset(),
+    // and those still in flight will be freed when their last reference goes.
+    av_buffer_pool_uninit(&m_PacketBufferPool);
+
     // Set log level back to default.
     // NB: We don't do this in reset() because we want
     // to preserve the log level across reset() during
@@ -112,9 +412,41 @@ IFFmpegRenderer* FFmpegVideoDecoder::getBackendRenderer()
 
 void FFmpegVideoDecoder::reset()
 {
+    // Stop the decoder thread first, since it submits frames to Pacer
+    if (m_DecoderThread != nullptr) {
+        SDL_AtomicSet(&m_DecoderThreadStopping, 1);
+        SDL_SemPost(m_DecodeQueueSem);
+        SDL_WaitThread(m_DecoderThread, nullptr);
+        m_DecoderThread = nullptr;
+    }
+
+    // Release any packets that never made it to the decoder
+    while (SDL_AtomicGet(&m_DecodeQueueTail) != SDL_AtomicGet(&m_DecodeQueueHead)) {
+        int tail = SDL_AtomicGet(&m_DecodeQueueTail);
+        av_packet_unref(&m_DecodeQueue[tail % MAX_QUEUED_DECODE_UNITS].packet);
+        SDL_AtomicSet(&m_DecodeQueueTail, tail + 1);
+    }
+
+    if (m_DecodeQueueSem != nullptr) {
+        SDL_DestroySemaphore(m_DecodeQueueSem);
+        m_DecodeQueueSem = nullptr;
+    }
+
+    SDL_AtomicSet(&m_DecoderThreadStopping, 0);
+    SDL_AtomicSet(&m_DecoderThreadNeedsIdr, 0);
+    SDL_AtomicSet(&m_DecodeQueueHead, 0);
+    SDL_AtomicSet(&m_DecodeQueueTail, 0);
+    m_AsyncDecode = false;
+
+    m_VideoStats.stop();
+
     delete m_Pacer;
     m_Pacer = nullptr;
 
+    // Pacer has returned all of its frames to the pool now
+    delete m_FramePool;
+    m_FramePool = nullptr;
+
     // This must be called after deleting Pacer because it
     // may be holding AVFrames to free in its destructor.
     // However, it must be called before deleting the IFFmpegRenderer
@@ -136,26 +468,69 @@ void FFmpegVideoDecoder::reset()
     m_FrontendRenderer = m_BackendRenderer = nullptr;
 
     if (!m_TestOnly) {
-        logVideoStats(m_GlobalVideoStats, "Global video stats");
-    }
-    else {
-        // Test-only decoders can't have any frames submitted
-        SDL_assert(m_GlobalVideoStats.totalFrames == 0);
+        m_VideoStats.logGlobalVideoStats();
     }
 }
 
 bool FFmpegVideoDecoder::createFrontendRenderer(PDECODER_PARAMETERS params)
 {
-    if (m_BackendRenderer->isDirectRenderingSupported()) {
-        // The backend renderer can render to the display
+    if (m_BackendRenderer->isDirectRenderingSupported() || m_BackendProbeOnly) {
+        // The backend renderer can render to the display (or we're just
+        // probing the backend and will never render anything)
         m_FrontendRenderer = m_BackendRenderer;
     }
     else {
-        // The backend renderer cannot directly render to the display, so
-        // we will create an SDL renderer to draw the frames.
-        m_FrontendRenderer = new SdlRenderer();
-        if (!m_FrontendRenderer->initialize(params)) {
-            return false;
+#ifdef HAVE_DRM
+        // Without a display server, the frames can be scanned out from a
+        // KMS plane directly with no GPU copy at all
+        if (strcmp(SDL_GetCurrentVideoDriver(), "KMSDRM") == 0 && m_BackendRenderer->canExportDrmPrime()) {
+            m_FrontendRenderer = new DrmRenderer(false, m_BackendRenderer);
+            if (m_FrontendRenderer->initialize(params)) {
+                SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                            "Using DRM renderer for frames from the backend");
+            }
+            else {
+                delete m_FrontendRenderer;
+                m_FrontendRenderer = nullptr;
+            }
+        }
+#endif
+
+#ifdef HAVE_WAYLAND_DMABUF
+        // The compositor can put DMA-BUF frames on a plane itself, which
+        // beats drawing them with GL and having them composed after that
+        if (m_FrontendRenderer == nullptr && m_BackendRenderer->canExportDrmPrime()) {
+            m_FrontendRenderer = new WaylandRenderer(m_BackendRenderer);
+            if (!m_FrontendRenderer->initialize(params)) {
+                delete m_FrontendRenderer;
+                m_FrontendRenderer = nullptr;
+            }
+        }
+#endif
+
+#ifdef HAVE_EGL
+        // If the backend can export its frames to EGL or copy them into GL
+        // textures, we can draw them without copying them back to system
+        // memory first.
+        if (m_FrontendRenderer == nullptr &&
+                (m_BackendRenderer->canExportEGL() || m_BackendRenderer->canCopyToGLTextures())) {
+            m_FrontendRenderer = new EGLRenderer(m_BackendRenderer);
+            if (!m_FrontendRenderer->initialize(params)) {
+                SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                            "Falling back to SDL renderer for frames from the backend");
+                delete m_FrontendRenderer;
+                m_FrontendRenderer = nullptr;
+            }
+        }
+#endif
+
+        if (m_FrontendRenderer == nullptr) {
+            // The backend renderer cannot directly render to the display, so
+            // we will create an SDL renderer to draw the frames.
+            m_FrontendRenderer = new SdlRenderer();
+            if (!m_FrontendRenderer->initialize(params)) {
+                return false;
+            }
         }
     }
 
@@ -189,12 +564,19 @@ bool FFmpegVideoDecoder::completeInitialization(AVCodec* decoder, PDECODER_PARAM
         return false;
     }
 
-    m_StreamFps = params->frameRate;
-
     // Don't bother initializing Pacer if we're not actually going to render
     if (!testFrame) {
-        m_Pacer = new Pacer(m_FrontendRenderer, &m_ActiveWndVideoStats);
-        if (!m_Pacer->initialize(params->window, params->frameRate, params->enableFramePacing)) {
+        // Size the frame buffers up front, so frames aren't held up by
+        // regrowing the pool when the first large ones arrive
+        if (!ensurePacketBuffer((params->width * params->height / 8) * EXPECTED_IDR_FRAME_BYTES_PER_8_PIXELS +
+                                MAX_SPS_EXTRA_SIZE + AV_INPUT_BUFFER_PADDING_SIZE)) {
+            return false;
+        }
+
+        m_FramePool = new FramePool(FRAME_POOL_SIZE);
+        m_Pacer = new Pacer(m_FrontendRenderer, m_FramePool, &m_ActiveWndVideoStats);
+        if (!m_Pacer->initialize(params->window, params->frameRate,
+                                   params->enableFramePacing, params->pacingMode)) {
             return false;
         }
     }
@@ -213,19 +595,35 @@ bool FFmpegVideoDecoder::completeInitialization(AVCodec* decoder, PDECODER_PARAM
     m_VideoDecoderCtx->flags |= AV_CODEC_FLAG_OUTPUT_CORRUPT;
     m_VideoDecoderCtx->flags2 |= AV_CODEC_FLAG2_SHOW_ALL;
 
-    // Report decoding errors to allow us to request a key frame
-    //
-    // With HEVC streams, FFmpeg can drop a frame (hwaccel->start_frame() fails)
-    // without telling us. Since we have an infinite GOP length, this causes artifacts
-    // on screen that persist for a long time. It's easy to cause this condition
-    // by using NVDEC and delaying 100 ms randomly in the render path so the decoder
-    // runs out of output buffers.
-    m_VideoDecoderCtx->err_recognition = AV_EF_EXPLODE;
+    if (params->enableErrorConcealment && !testFrame) {
+        // Conceal errors as well as the decoder can and keep showing the
+        // damaged frames. We notice them in decodePacket() and ask for a
+        // key frame ourselves without stopping the stream.
+        m_ErrorConcealment = true;
+        m_VideoDecoderCtx->error_concealment = FF_EC_GUESS_MVS | FF_EC_DEBLOCK;
+    }
+    else {
+        m_ErrorConcealment = false;
+
+        // Report decoding errors to allow us to request a key frame
+        //
+        // With HEVC streams, FFmpeg can drop a frame (hwaccel->start_frame() fails)
+        // without telling us. Since we have an infinite GOP length, this causes artifacts
+        // on screen that persist for a long time. It's easy to cause this condition
+        // by using NVDEC and delaying 100 ms randomly in the render path so the decoder
+        // runs out of output buffers.
+        m_VideoDecoderCtx->err_recognition = AV_EF_EXPLODE;
+    }
 
-    // Enable slice multi-threading for software decoding
+    // Enable slice multi-threading for software decoding. We explicitly
+    // avoid frame threading because it adds a frame of latency per thread.
+    // The host encodes one slice per thread (see getDecoderCapabilities()).
     if (!isHardwareAccelerated()) {
         m_VideoDecoderCtx->thread_type = FF_THREAD_SLICE;
-        m_VideoDecoderCtx->thread_count = qMin(MAX_SLICES, SDL_GetCPUCount());
+        m_VideoDecoderCtx->thread_count = getSoftwareDecodeSliceCount();
+
+        // Allow non-spec compliant speedups
+        m_VideoDecoderCtx->flags2 |= AV_CODEC_FLAG2_FAST;
     }
     else {
         // No threading for HW decode
@@ -283,6 +681,8 @@ bool FFmpegVideoDecoder::completeInitialization(AVCodec* decoder, PDECODER_PARAM
         }
     }
     else {
+        m_VideoFormat = params->videoFormat;
+
         if ((params->videoFormat & VIDEO_FORMAT_MASK_H264) &&
                 !(m_BackendRenderer->getDecoderCapabilities() & CAPABILITY_REFERENCE_FRAME_INVALIDATION_AVC)) {
             SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
@@ -293,93 +693,138 @@ bool FFmpegVideoDecoder::completeInitialization(AVCodec* decoder, PDECODER_PARAM
             m_NeedsSpsFixup = false;
         }
 
+        // If the renderer can handle reference frame invalidation for this
+        // codec, the host will invalidate lost references rather than sending
+        // an IDR frame. We track this to tell the two recovery paths apart.
+        int caps = m_BackendRenderer->getDecoderCapabilities();
+        bool supportsRfi;
+        if (params->videoFormat & VIDEO_FORMAT_MASK_H264) {
+            supportsRfi = (caps & CAPABILITY_REFERENCE_FRAME_INVALIDATION_AVC) != 0;
+        }
+        else {
+            supportsRfi = (caps & CAPABILITY_REFERENCE_FRAME_INVALIDATION_HEVC) != 0;
+        }
+
+        if (supportsRfi) {
+            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                        "Using reference frame invalidation");
+        }
+
         // Tell overlay manager to use this frontend renderer
         Session::get()->getOverlayManager().setOverlayRenderer(m_FrontendRenderer);
+
+        if (!m_VideoStats.start(params->frameRate, supportsRfi,
+                                [this](char* output, size_t size) { return getOverlayDetails(output, size); })) {
+            return false;
+        }
+
+        // Optionally move decoding off of the network receive thread
+        if (isPipelinedDecodeEnabled()) {
+            m_DecodeQueueSem = SDL_CreateSemaphore(0);
+            if (m_DecodeQueueSem == nullptr) {
+                SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                             "SDL_CreateSemaphore() failed: %s",
+                             SDL_GetError());
+                return false;
+            }
+
+            m_DecoderThread = SDL_CreateThread(FFmpegVideoDecoder::decoderThread, "FFDecoder", this);
+            if (m_DecoderThread == nullptr) {
+                SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                             "SDL_CreateThread() failed: %s",
+                             SDL_GetError());
+                return false;
+            }
+
+            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                        "Using pipelined decoding");
+            m_AsyncDecode = true;
+        }
     }
 
     return true;
 }
 
-void FFmpegVideoDecoder::addVideoStats(VIDEO_STATS& src, VIDEO_STATS& dst)
+bool FFmpegVideoDecoder::getOverlayDetails(char* output, size_t size)
 {
-    dst.receivedFrames += src.receivedFrames;
-    dst.decodedFrames += src.decodedFrames;
-    dst.renderedFrames += src.renderedFrames;
-    dst.totalFrames += src.totalFrames;
-    dst.networkDroppedFrames += src.networkDroppedFrames;
-    dst.pacerDroppedFrames += src.pacerDroppedFrames;
-    dst.totalReassemblyTime += src.totalReassemblyTime;
-    dst.totalDecodeTime += src.totalDecodeTime;
-    dst.totalPacerTime += src.totalPacerTime;
-    dst.totalRenderTime += src.totalRenderTime;
+    // The frontend renderer's details can't be read while
+    // reinitializePresentation() is replacing it. That window is just skipped.
+    if (!SDL_AtomicTryLock(&m_RendererLock)) {
+        return false;
+    }
 
-    Uint32 now = SDL_GetTicks();
+    if (m_FrontendRenderer != nullptr) {
+        const char* presentationPath = m_FrontendRenderer->getPresentationPath();
+        if (presentationPath != nullptr) {
+            size_t offset = strlen(output);
+            snprintf(&output[offset], size - offset,
+                     "Presentation path: %s\n",
+                     presentationPath);
+        }
 
-    // Initialize the measurement start point if this is the first video stat window
-    if (!dst.measurementStartTimestamp) {
-        dst.measurementStartTimestamp = src.measurementStartTimestamp;
+        int averageCostUs, budgetUs;
+        const char* upscaler = m_FrontendRenderer->getUpscalerStats(&averageCostUs, &budgetUs);
+        if (upscaler != nullptr && averageCostUs < 0) {
+            size_t offset = strlen(output);
+            snprintf(&output[offset], size - offset,
+                     "Upscaling: %s\n",
+                     upscaler);
+        }
+        else if (upscaler != nullptr) {
+            size_t offset = strlen(output);
+            snprintf(&output[offset], size - offset,
+                     "Upscaling: %s (%.2f ms per frame, budget %.2f ms)\n",
+                     upscaler,
+                     (float)averageCostUs / 1000,
+                     (float)budgetUs / 1000);
+        }
     }
 
-    // The following code assumes the global measure was already started first
-    SDL_assert(dst.measurementStartTimestamp <= src.measurementStartTimestamp);
-
-    dst.totalFps = (float)dst.totalFrames / ((float)(now - dst.measurementStartTimestamp) / 1000);
-    dst.receivedFps = (float)dst.receivedFrames / ((float)(now - dst.measurementStartTimestamp) / 1000);
-    dst.decodedFps = (float)dst.decodedFrames / ((float)(now - dst.measurementStartTimestamp) / 1000);
-    dst.renderedFps = (float)dst.renderedFrames / ((float)(now - dst.measurementStartTimestamp) / 1000);
+    SDL_AtomicUnlock(&m_RendererLock);
+    return true;
 }
 
-void FFmpegVideoDecoder::stringifyVideoStats(VIDEO_STATS& stats, char* output)
+bool FFmpegVideoDecoder::getGlobalVideoStats(VIDEO_STATS& stats)
 {
-    int offset = 0;
+    m_VideoStats.getGlobalVideoStats(stats);
+    return true;
+}
 
-    // Start with an empty string
-    output[offset] = 0;
+bool FFmpegVideoDecoder::getLiveVideoStats(VIDEO_STATS& stats)
+{
+    m_VideoStats.getPublishedVideoStats(stats);
+    return true;
+}
 
-    if (stats.receivedFps > 0) {
-        offset += sprintf(&output[offset],
-                          "Estimated host PC frame rate: %.2f FPS\n"
-                          "Incoming frame rate from network: %.2f FPS\n"
-                          "Decoding frame rate: %.2f FPS\n"
-                          "Rendering frame rate: %.2f FPS\n",
-                          stats.totalFps,
-                          stats.receivedFps,
-                          stats.decodedFps,
-                          stats.renderedFps);
+const char* FFmpegVideoDecoder::getDecoderName()
+{
+    if (m_VideoDecoderCtx == nullptr) {
+        return nullptr;
     }
 
-    if (stats.renderedFrames != 0) {
-        offset += sprintf(&output[offset],
-                          "Frames dropped by your network connection: %.2f%%\n"
-                          "Frames dropped due to network jitter: %.2f%%\n"
-                          "Average receive time: %.2f ms\n"
-                          "Average decoding time: %.2f ms\n"
-                          "Average frame queue delay: %.2f ms\n"
-                          "Average rendering time (including monitor V-sync latency): %.2f ms\n",
-                          (float)stats.networkDroppedFrames / stats.totalFrames * 100,
-                          (float)stats.pacerDroppedFrames / stats.decodedFrames * 100,
-                          (float)stats.totalReassemblyTime / stats.receivedFrames,
-                          (float)stats.totalDecodeTime / stats.decodedFrames,
-                          (float)stats.totalPacerTime / stats.renderedFrames,
-                          (float)stats.totalRenderTime / stats.renderedFrames);
-    }
+    const char* presentationPath = m_FrontendRenderer != nullptr ?
+                m_FrontendRenderer->getPresentationPath() : nullptr;
+    snprintf(m_DecoderName, sizeof(m_DecoderName), "%s (%s%s%s)",
+             m_VideoDecoderCtx->codec->name,
+             m_HwDecodeCfg != nullptr ? av_hwdevice_get_type_name(m_HwDecodeCfg->device_type) : "software",
+             presentationPath != nullptr ? ", " : "",
+             presentationPath != nullptr ? presentationPath : "");
+    return m_DecoderName;
 }
 
-void FFmpegVideoDecoder::logVideoStats(VIDEO_STATS& stats, const char* title)
+bool FFmpegVideoDecoder::requestScreenshot()
 {
-    if (stats.renderedFps > 0 || stats.renderedFrames != 0) {
-        char videoStatsStr[512];
-        stringifyVideoStats(stats, videoStatsStr);
-
-        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
-                    "%s", title);
-        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
-                    "----------------------------------------------------------\n%s",
-                    videoStatsStr);
+    if (m_Pacer == nullptr) {
+        return false;
     }
+
+    m_Pacer->requestScreenshot();
+    return true;
 }
 
-IFFmpegRenderer* FFmpegVideoDecoder::createHwAccelRenderer(const AVCodecHWConfig* hwDecodeCfg, int pass)
+IFFmpegRenderer* FFmpegVideoDecoder::createHwAccelRenderer(const AVCodecHWConfig* hwDecodeCfg, int pass,
+                                                           StreamingPreferences::VideoDecoderSelection vds,
+                                                           int videoFormat)
 {
     if (!(hwDecodeCfg->methods & AV_CODEC_HW_CONFIG_METHOD_HW_DEVICE_CTX)) {
         return nullptr;
@@ -389,12 +834,22 @@ IFFmpegRenderer* FFmpegVideoDecoder::createHwAccelRenderer(const AVCodecHWConfig
     if (pass == 0) {
         switch (hwDecodeCfg->device_type) {
 #ifdef Q_OS_WIN32
+        // D3D11VA is opt-in for now, and replaces DXVA2 when selected.
+        // Only D3D11VA can present HDR, so it's always used for Main10.
         case AV_HWDEVICE_TYPE_DXVA2:
+            if (vds == StreamingPreferences::VDS_FORCE_D3D11VA || videoFormat == VIDEO_FORMAT_H265_MAIN10) {
+                return nullptr;
+            }
             return new DXVA2Renderer();
+        case AV_HWDEVICE_TYPE_D3D11VA:
+            if (vds != StreamingPreferences::VDS_FORCE_D3D11VA && videoFormat != VIDEO_FORMAT_H265_MAIN10) {
+                return nullptr;
+            }
+            return new D3D11VARenderer();
 #endif
 #ifdef Q_OS_DARWIN
         case AV_HWDEVICE_TYPE_VIDEOTOOLBOX:
-            return VTRendererFactory::createRenderer();
+            return VTRendererFactory::createMetalRenderer();
 #endif
 #ifdef HAVE_LIBVA
         case AV_HWDEVICE_TYPE_VAAPI:
@@ -404,6 +859,16 @@ IFFmpegRenderer* FFmpegVideoDecoder::createHwAccelRenderer(const AVCodecHWConfig
         case AV_HWDEVICE_TYPE_VDPAU:
             return new VDPAURenderer();
 #endif
+#ifdef HAVE_DRM
+        case AV_HWDEVICE_TYPE_DRM:
+            // V4L2 request API decoders on ARM boards
+            return new DrmRenderer(true);
+#endif
+        // There's no Vulkan renderer for AV_HWDEVICE_TYPE_VULKAN. FFmpeg only
+        // gained Vulkan Video decoding in 6.1, long after the 4.x API we build
+        // against, and without it a Vulkan presenter would still need another
+        // hwaccel's surfaces imported through the interop that the renderers
+        // above already do natively.
         default:
             return nullptr;
         }
@@ -411,10 +876,24 @@ IFFmpegRenderer* FFmpegVideoDecoder::createHwAccelRenderer(const AVCodecHWConfig
     // Second pass for our second-tier hwaccel implementations
     else if (pass == 1) {
         switch (hwDecodeCfg->device_type) {
+#ifdef Q_OS_DARWIN
+        case AV_HWDEVICE_TYPE_VIDEOTOOLBOX:
+            // AVSampleBufferDisplayLayer adds compositor latency, but it
+            // handles HDR and anything else our Metal renderer can't.
+            return VTRendererFactory::createRenderer();
+#endif
+#ifdef HAVE_QSV
+        case AV_HWDEVICE_TYPE_QSV:
+            // Only the QSV decoders have this config. VAAPI decodes the
+            // same streams on the same GPU, so this is second-tier unless
+            // the benchmark ranks it first.
+            return new QSVRenderer();
+#endif
         case AV_HWDEVICE_TYPE_CUDA:
             // CUDA should only be used if all other options fail, since it requires
-            // read-back of frames. This should only be used for the NVIDIA+Wayland case
-            // with VDPAU covering the NVIDIA+X11 scenario.
+            // read-back of frames unless CUDA-GL interop is available. This should
+            // only be used for the NVIDIA+Wayland case with VDPAU covering the
+            // NVIDIA+X11 scenario.
             return new CUDARenderer();
         default:
             return nullptr;
@@ -470,6 +949,221 @@ bool FFmpegVideoDecoder::tryInitializeRenderer(AVCodec* decoder,
     return false;
 }
 
+int FFmpegVideoDecoder::hwAccelProbeThread(void* context)
+{
+    HwAccelProbe* probe = reinterpret_cast<HwAccelProbe*>(context);
+    const AVCodecHWConfig* config = probe->config;
+    int pass = probe->pass;
+    StreamingPreferences::VideoDecoderSelection vds = probe->params.vds;
+    int videoFormat = probe->params.videoFormat;
+
+    Uint32 startTime = SDL_GetTicks();
+
+    FFmpegVideoDecoder probeDecoder(true);
+    probeDecoder.m_BackendProbeOnly = true;
+    probe->success = probeDecoder.tryInitializeRenderer(probe->decoder, &probe->params, config,
+                                                        [config, pass, vds, videoFormat]() -> IFFmpegRenderer* { return createHwAccelRenderer(config, pass, vds, videoFormat); });
+
+    probe->probeTimeMs = SDL_GetTicks() - startTime;
+
+    if (probe->success && isHwAccelBenchmarkEnabled()) {
+        // One at a time, so the hwaccels don't compete for the CPU
+        static QMutex benchmarkLock;
+        QMutexLocker locker(&benchmarkLock);
+        probe->decodeTimeUs = probeDecoder.benchmarkTestFrameDecode();
+    }
+
+    return 0;
+}
+
+// Returns the average time to decode the test frame with the decoder
+// that was just tested, or -1 if it couldn't be measured
+int FFmpegVideoDecoder::benchmarkTestFrameDecode()
+{
+    AVFrame* frame = av_frame_alloc();
+    if (frame == nullptr) {
+        return -1;
+    }
+
+    // Drain the frame from the test decode
+    while (avcodec_receive_frame(m_VideoDecoderCtx, frame) == 0) {
+        av_frame_unref(frame);
+    }
+
+    if (m_VideoDecoderCtx->codec_id == AV_CODEC_ID_H264) {
+        m_Pkt.data = (uint8_t*)k_H264TestFrame;
+        m_Pkt.size = sizeof(k_H264TestFrame);
+    }
+    else {
+        m_Pkt.data = (uint8_t*)k_HEVCTestFrame;
+        m_Pkt.size = sizeof(k_HEVCTestFrame);
+    }
+
+    // The test frame is an IDR frame, so every decode starts over
+    int framesDecoded = 0;
+    Uint64 start = StreamUtils::getTimeUs();
+    for (int i = 0; i < HWACCEL_BENCHMARK_ITERATIONS; i++) {
+        if (avcodec_send_packet(m_VideoDecoderCtx, &m_Pkt) < 0) {
+            break;
+        }
+        while (avcodec_receive_frame(m_VideoDecoderCtx, frame) == 0) {
+            av_frame_unref(frame);
+            framesDecoded++;
+        }
+    }
+    Uint64 end = StreamUtils::getTimeUs();
+
+    av_frame_free(&frame);
+    return framesDecoded > 0 ? (int)((end - start) / framesDecoded) : -1;
+}
+
+void FFmpegVideoDecoder::probeHwAccelsInParallel(AVCodec* decoder, PDECODER_PARAMETERS params)
+{
+    QList<HwAccelProbe*> probes;
+
+    Uint32 startTime = SDL_GetTicks();
+
+    auto startProbe = [&probes, params](AVCodec* probeDecoder, const AVCodecHWConfig* config, int key, int pass) {
+        HwAccelProbe* probe = new HwAccelProbe();
+        probe->decoder = probeDecoder;
+        probe->params = *params;
+        probe->config = config;
+        probe->key = key;
+        probe->pass = pass;
+        probe->success = false;
+        probe->probeTimeMs = 0;
+        probe->decodeTimeUs = -1;
+        probe->thread = SDL_CreateThread(FFmpegVideoDecoder::hwAccelProbeThread, "HwAccelProbe", probe);
+        if (probe->thread == nullptr) {
+            // We'll just let the sequential path try this one
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "SDL_CreateThread() failed: %s",
+                        SDL_GetError());
+            delete probe;
+            return;
+        }
+
+        probes.append(probe);
+    };
+
+    for (int pass = 0; pass <= 1; pass++) {
+        for (int i = 0;; i++) {
+            const AVCodecHWConfig *config = avcodec_get_hw_config(decoder, i);
+            if (!config) {
+                break;
+            }
+
+            // Skip configs that have no renderer for this pass
+            IFFmpegRenderer* renderer = createHwAccelRenderer(config, pass, params->vds, params->videoFormat);
+            if (renderer == nullptr) {
+                m_FailedHwAccelProbes.insert(HWACCEL_PROBE_KEY(i, pass));
+                continue;
+            }
+            delete renderer;
+
+            startProbe(decoder, config, HWACCEL_PROBE_KEY(i, pass), pass);
+        }
+    }
+
+#ifdef HAVE_QSV
+    // The QSV decoder competes with the hwaccels on Intel GPUs
+    const AVCodecHWConfig* qsvConfig;
+    AVCodec* qsvDecoder = findQsvDecoder(params->videoFormat, &qsvConfig);
+    if (qsvDecoder != nullptr) {
+        startProbe(qsvDecoder, qsvConfig, QSV_PROBE_KEY, 1);
+    }
+    else {
+        m_FailedHwAccelProbes.insert(QSV_PROBE_KEY);
+    }
+#endif
+
+    QList<QPair<int, int>> decodeTimes;
+    for (HwAccelProbe* probe : probes) {
+        SDL_WaitThread(probe->thread, nullptr);
+
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Probe of %s hwaccel (pass %d) %s in %u ms",
+                    av_hwdevice_get_type_name(probe->config->device_type),
+                    probe->pass,
+                    probe->success ? "succeeded" : "failed",
+                    probe->probeTimeMs);
+
+        if (!probe->success) {
+            m_FailedHwAccelProbes.insert(probe->key);
+        }
+        else if (probe->decodeTimeUs >= 0) {
+            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                        "%s hwaccel (pass %d) decodes the test frame in %.2f ms",
+                        av_hwdevice_get_type_name(probe->config->device_type),
+                        probe->pass,
+                        probe->decodeTimeUs / 1000.0f);
+            decodeTimes.append(qMakePair(probe->decodeTimeUs, probe->key));
+        }
+
+        delete probe;
+    }
+
+    // Try the fastest hwaccels first, and remember the order so the
+    // decoder used for streaming doesn't have to measure them again
+    if (isHwAccelBenchmarkEnabled()) {
+        std::sort(decodeTimes.begin(), decodeTimes.end());
+
+        m_HwAccelRanking.clear();
+        for (const QPair<int, int>& decodeTime : decodeTimes) {
+            m_HwAccelRanking.append(decodeTime.second);
+        }
+
+        DecoderCapabilityCache::storeHwAccelRanking(params->vds, params->videoFormat,
+                                                    params->width, params->height, params->frameRate,
+                                                    m_HwAccelRanking);
+    }
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Parallel hwaccel probing completed in %u ms",
+                SDL_GetTicks() - startTime);
+
+    // The probe decoders restore the default log level when destroyed
+    av_log_set_level(AV_LOG_DEBUG);
+}
+
+#ifdef HAVE_QSV
+// Returns the QSV decoder for the format along with its config for
+// decoding to QSV surfaces, or nullptr if FFmpeg was built without it
+AVCodec* FFmpegVideoDecoder::findQsvDecoder(int videoFormat, const AVCodecHWConfig** hwConfig)
+{
+    AVCodec* decoder = avcodec_find_decoder_by_name((videoFormat & VIDEO_FORMAT_MASK_H264) ?
+                                                        "h264_qsv" : "hevc_qsv");
+    if (decoder == nullptr) {
+        return nullptr;
+    }
+
+    for (int i = 0;; i++) {
+        const AVCodecHWConfig* config = avcodec_get_hw_config(decoder, i);
+        if (!config) {
+            break;
+        }
+
+        if (config->pix_fmt == AV_PIX_FMT_QSV &&
+                (config->methods & AV_CODEC_HW_CONFIG_METHOD_HW_FRAMES_CTX)) {
+            *hwConfig = config;
+            return decoder;
+        }
+    }
+
+    return nullptr;
+}
+
+bool FFmpegVideoDecoder::tryInitializeQsvRenderer(PDECODER_PARAMETERS params)
+{
+    const AVCodecHWConfig* qsvConfig;
+    AVCodec* qsvDecoder = findQsvDecoder(params->videoFormat, &qsvConfig);
+
+    return qsvDecoder != nullptr &&
+            tryInitializeRenderer(qsvDecoder, params, qsvConfig,
+                                  []() -> IFFmpegRenderer* { return new QSVRenderer(); });
+}
+#endif
+
 bool FFmpegVideoDecoder::initialize(PDECODER_PARAMETERS params)
 {
     AVCodec* decoder;
@@ -497,6 +1191,48 @@ bool FFmpegVideoDecoder::initialize(PDECODER_PARAMETERS params)
 
     // Look for a hardware decoder first unless software-only
     if (params->vds != StreamingPreferences::VDS_FORCE_SOFTWARE) {
+#ifdef PARALLEL_HWACCEL_PROBING
+        // Weed out the hwaccels that don't work all at once, rather than
+        // waiting for each failure in turn below. The winner is still
+        // chosen in priority order by the sequential walk.
+        if (m_TestOnly) {
+            probeHwAccelsInParallel(decoder, params);
+        }
+        else if (isHwAccelBenchmarkEnabled()) {
+            DecoderCapabilityCache::lookupHwAccelRanking(params->vds, params->videoFormat,
+                                                         params->width, params->height, params->frameRate,
+                                                         m_HwAccelRanking);
+        }
+
+        // Measured decode times override the priority order
+        for (int key : m_HwAccelRanking) {
+            if (key == QSV_PROBE_KEY) {
+#ifdef HAVE_QSV
+                if (!m_FailedHwAccelProbes.contains(key) && tryInitializeQsvRenderer(params)) {
+                    return true;
+                }
+#endif
+                m_FailedHwAccelProbes.insert(key);
+                continue;
+            }
+
+            int index = key / 2;
+            int pass = key % 2;
+            const AVCodecHWConfig *config = avcodec_get_hw_config(decoder, index);
+            if (!config || m_FailedHwAccelProbes.contains(key)) {
+                continue;
+            }
+
+            if (tryInitializeRenderer(decoder, params, config,
+                                      [config, pass, params]() -> IFFmpegRenderer* { return createHwAccelRenderer(config, pass, params->vds, params->videoFormat); })) {
+                return true;
+            }
+
+            // Don't try it again in the walk below
+            m_FailedHwAccelProbes.insert(key);
+        }
+#endif
+
         // Look for the first matching hwaccel hardware decoder (pass 0)
         for (int i = 0;; i++) {
             const AVCodecHWConfig *config = avcodec_get_hw_config(decoder, i);
@@ -505,15 +1241,25 @@ bool FFmpegVideoDecoder::initialize(PDECODER_PARAMETERS params)
                 break;
             }
 
+            if (m_FailedHwAccelProbes.contains(HWACCEL_PROBE_KEY(i, 0))) {
+                continue;
+            }
+
             // Initialize the hardware codec and submit a test frame if the renderer needs it
             if (tryInitializeRenderer(decoder, params, config,
-                                      [config]() -> IFFmpegRenderer* { return createHwAccelRenderer(config, 0); })) {
+                                      [config, params]() -> IFFmpegRenderer* { return createHwAccelRenderer(config, 0, params->vds, params->videoFormat); })) {
                 return true;
             }
         }
 
         // Continue with special non-hwaccel hardware decoders
 
+#ifdef HAVE_QSV
+        if (!m_FailedHwAccelProbes.contains(QSV_PROBE_KEY) && tryInitializeQsvRenderer(params)) {
+            return true;
+        }
+#endif
+
 #ifdef HAVE_MMAL
         // MMAL is the decoder for the Raspberry Pi
         if (params->videoFormat & VIDEO_FORMAT_MASK_H264) {
@@ -542,6 +1288,24 @@ bool FFmpegVideoDecoder::initialize(PDECODER_PARAMETERS params)
                                       []() -> IFFmpegRenderer* { return new DrmRenderer(); })) {
             return true;
         }
+
+        // V4L2 M2M drives stateful decoders (like the Raspberry Pi 4's HEVC
+        // block or Amlogic's) and exports DRM PRIME buffers when asked to.
+        // Stateless decoders use the V4L2 request API through the DRM hwaccel.
+        AVCodec* v4l2m2mDecoder;
+
+        if (params->videoFormat & VIDEO_FORMAT_MASK_H264) {
+            v4l2m2mDecoder = avcodec_find_decoder_by_name("h264_v4l2m2m");
+        }
+        else {
+            v4l2m2mDecoder = avcodec_find_decoder_by_name("hevc_v4l2m2m");
+        }
+
+        if (v4l2m2mDecoder != nullptr &&
+                tryInitializeRenderer(v4l2m2mDecoder, params, nullptr,
+                                      []() -> IFFmpegRenderer* { return new DrmRenderer(); })) {
+            return true;
+        }
 #endif
 
         // Look for the first matching hwaccel hardware decoder (pass 1)
@@ -553,17 +1317,27 @@ bool FFmpegVideoDecoder::initialize(PDECODER_PARAMETERS params)
                 break;
             }
 
+            if (m_FailedHwAccelProbes.contains(HWACCEL_PROBE_KEY(i, 1))) {
+                continue;
+            }
+
             // Initialize the hardware codec and submit a test frame if the renderer needs it
             if (tryInitializeRenderer(decoder, params, config,
-                                      [config]() -> IFFmpegRenderer* { return createHwAccelRenderer(config, 1); })) {
+                                      [config, params]() -> IFFmpegRenderer* { return createHwAccelRenderer(config, 1, params->vds, params->videoFormat); })) {
                 return true;
             }
         }
     }
 
     // Fallback to software if no matching hardware decoder was found
-    // and if software fallback is allowed
-    if (params->vds != StreamingPreferences::VDS_FORCE_HARDWARE) {
+    // and if software fallback is allowed. The SDL renderer converts
+    // 10-bit frames to 8 bits on the CPU.
+    if (params->vds != StreamingPreferences::VDS_FORCE_HARDWARE &&
+            params->vds != StreamingPreferences::VDS_FORCE_D3D11VA) {
+        if (!m_TestOnly && qgetenv("SW_DECODE_BENCHMARK") == "1") {
+            benchmarkSoftwareDecode(decoder, params->videoFormat);
+        }
+
         if (tryInitializeRenderer(decoder, params, nullptr,
                                   []() -> IFFmpegRenderer* { return new SdlRenderer(); })) {
             return true;
@@ -574,9 +1348,158 @@ bool FFmpegVideoDecoder::initialize(PDECODER_PARAMETERS params)
     return false;
 }
 
-void FFmpegVideoDecoder::writeBuffer(PLENTRY entry, int& offset)
+bool FFmpegVideoDecoder::ensurePacketBuffer(int size)
 {
-    if (m_NeedsSpsFixup && entry->bufferType == BUFFER_TYPE_SPS) {
+    if (m_PacketBufferPool != nullptr && size <= m_PacketBufferSize) {
+        return true;
+    }
+
+    // Grow the pool to fit this frame. Outstanding buffers from the old pool
+    // remain valid until the decoder drops its references to them.
+    if (m_PacketBufferPool != nullptr) {
+        size = size * PACKET_BUFFER_GROWTH_PERCENT / 100;
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Growing packet buffers from %d to %d bytes",
+                    m_PacketBufferSize,
+                    size);
+    }
+    av_buffer_pool_uninit(&m_PacketBufferPool);
+
+    m_PacketBufferSize = qMax(size, INITIAL_PACKET_BUFFER_SIZE);
+    m_PacketBufferPool = av_buffer_pool_init(m_PacketBufferSize, av_buffer_alloc);
+    if (m_PacketBufferPool == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Failed to allocate packet buffer pool of %d bytes",
+                     m_PacketBufferSize);
+        m_PacketBufferSize = 0;
+        return false;
+    }
+
+    return true;
+}
+
+double FFmpegVideoDecoder::measureSoftwareDecodeRate(int videoFormat)
+{
+    AVCodec* decoder = avcodec_find_decoder((videoFormat & VIDEO_FORMAT_MASK_H264) ?
+                                                AV_CODEC_ID_H264 : AV_CODEC_ID_HEVC);
+    if (decoder == nullptr) {
+        return 0;
+    }
+
+    return benchmarkSoftwareDecode(decoder, videoFormat);
+}
+
+double FFmpegVideoDecoder::benchmarkSoftwareDecode(AVCodec* decoder, int videoFormat)
+{
+    double bestRate = 0;
+
+    const uint8_t* testFrame;
+    int testFrameSize;
+
+    if (videoFormat & VIDEO_FORMAT_MASK_H264) {
+        testFrame = k_H264TestFrame;
+        testFrameSize = sizeof(k_H264TestFrame);
+    }
+    else {
+        testFrame = k_HEVCTestFrame;
+        testFrameSize = sizeof(k_HEVCTestFrame);
+    }
+
+    // The decoder requires zeroed padding after the packet data
+    uint8_t* packetData = (uint8_t*)av_mallocz(testFrameSize + AV_INPUT_BUFFER_PADDING_SIZE);
+    AVFrame* frame = av_frame_alloc();
+    if (packetData == nullptr || frame == nullptr) {
+        av_free(packetData);
+        av_frame_free(&frame);
+        return 0;
+    }
+
+    memcpy(packetData, testFrame, testFrameSize);
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Benchmarking software decoding (%d CPUs)",
+                SDL_GetCPUCount());
+
+    for (int threadType : { FF_THREAD_SLICE, FF_THREAD_FRAME }) {
+        for (int threadCount = 1; threadCount <= SDL_GetCPUCount(); threadCount *= 2) {
+            AVCodecContext* ctx = avcodec_alloc_context3(decoder);
+            if (ctx == nullptr) {
+                break;
+            }
+
+            // FFmpeg disables frame threading in low delay mode
+            if (threadType == FF_THREAD_SLICE) {
+                ctx->flags |= AV_CODEC_FLAG_LOW_DELAY;
+            }
+            ctx->flags2 |= AV_CODEC_FLAG2_FAST;
+            ctx->thread_type = threadType;
+            ctx->thread_count = threadCount;
+
+            if (avcodec_open2(ctx, decoder, nullptr) < 0) {
+                avcodec_free_context(&ctx);
+                break;
+            }
+
+            AVPacket pkt;
+            av_init_packet(&pkt);
+            pkt.data = packetData;
+            pkt.size = testFrameSize;
+
+            int framesDecoded = 0;
+            Uint64 start = SDL_GetPerformanceCounter();
+            for (int i = 0; i < SW_DECODE_BENCHMARK_ITERATIONS; i++) {
+                if (avcodec_send_packet(ctx, &pkt) < 0) {
+                    break;
+                }
+                while (avcodec_receive_frame(ctx, frame) == 0) {
+                    framesDecoded++;
+                }
+            }
+
+            // Flush any frames still buffered by frame threading
+            avcodec_send_packet(ctx, nullptr);
+            while (avcodec_receive_frame(ctx, frame) == 0) {
+                framesDecoded++;
+            }
+            Uint64 end = SDL_GetPerformanceCounter();
+
+            if (framesDecoded > 0) {
+                SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                            "%s threading with %d threads: %.3f ms per frame",
+                            threadType == FF_THREAD_SLICE ? "Slice" : "Frame",
+                            threadCount,
+                            (end - start) * 1000.0 / SDL_GetPerformanceFrequency() / framesDecoded);
+                bestRate = qMax(bestRate, framesDecoded * (double)SDL_GetPerformanceFrequency() / (end - start));
+            }
+
+            avcodec_free_context(&ctx);
+        }
+    }
+
+    av_frame_free(&frame);
+    av_free(packetData);
+    return bestRate;
+}
+
+void FFmpegVideoDecoder::writeBuffer(PLENTRY entry, uint8_t* buffer, int& offset)
+{
+    if (entry->bufferType == BUFFER_TYPE_SPS && m_VideoDecoderCtx->codec_id == AV_CODEC_ID_HEVC) {
+        // Read before the packet is queued, so it's ready when the decoder
+        // calls get_format() on this SPS
+        SDL_AtomicSet(&m_HevcSpsRefFrames, getHevcSpsRefFrames(entry->data, entry->length));
+    }
+
+    if (m_NeedsSpsFixup && entry->bufferType == BUFFER_TYPE_SPS &&
+            m_LastSpsInput.size() == entry->length &&
+            memcmp(m_LastSpsInput.constData(), entry->data, entry->length) == 0) {
+        // The host sends the same SPS with every IDR frame, so we can
+        // reuse the last fixed up SPS rather than parsing it again.
+        memcpy(&buffer[offset],
+               m_LastSpsOutput.constData(),
+               m_LastSpsOutput.size());
+        offset += m_LastSpsOutput.size();
+    }
+    else if (m_NeedsSpsFixup && entry->bufferType == BUFFER_TYPE_SPS) {
         const char naluHeader[] = {0x00, 0x00, 0x00, 0x01};
         h264_stream_t* stream = h264_new();
         int nalStart, nalEnd;
@@ -599,18 +1522,22 @@ void FFmpegVideoDecoder::writeBuffer(PLENTRY entry, int& offset)
         // Copy the modified NALU data. This assumes a 3 byte prefix and
         // begins writing from the 2nd byte, so we must write the data
         // first, then go back and write the Annex B prefix.
-        offset += write_nal_unit(stream, (uint8_t*)&m_DecodeBuffer.data()[initialOffset + 3],
+        offset += write_nal_unit(stream, &buffer[initialOffset + 3],
                                  MAX_SPS_EXTRA_SIZE + entry->length - sizeof(naluHeader));
 
         // Copy the NALU prefix over from the original SPS
-        memcpy(&m_DecodeBuffer.data()[initialOffset], naluHeader, sizeof(naluHeader));
+        memcpy(&buffer[initialOffset], naluHeader, sizeof(naluHeader));
         offset += sizeof(naluHeader);
 
         h264_free(stream);
+
+        // Remember this SPS and its fixed up version for next time
+        m_LastSpsInput = QByteArray(entry->data, entry->length);
+        m_LastSpsOutput = QByteArray((const char*)&buffer[initialOffset], offset - initialOffset);
     }
     else {
         // Write the buffer as-is
-        memcpy(&m_DecodeBuffer.data()[offset],
+        memcpy(&buffer[offset],
                entry->data,
                entry->length);
         offset += entry->length;
@@ -620,73 +1547,183 @@ void FFmpegVideoDecoder::writeBuffer(PLENTRY entry, int& offset)
 int FFmpegVideoDecoder::submitDecodeUnit(PDECODE_UNIT du)
 {
     PLENTRY entry = du->bufferList;
-    int err;
 
     SDL_assert(!m_TestOnly);
 
-    if (!m_LastFrameNumber) {
-        m_ActiveWndVideoStats.measurementStartTimestamp = SDL_GetTicks();
-        m_LastFrameNumber = du->frameNumber;
+    m_VideoStats.reportDecodeUnit(du);
+
+    int requiredBufferSize = du->fullLength;
+    if (du->frameType == FRAME_TYPE_IDR) {
+        // Add some extra space in case we need to do an SPS fixup
+        requiredBufferSize += MAX_SPS_EXTRA_SIZE;
+    }
+
+    // Grab a pooled buffer large enough for this frame plus padding. Since
+    // the packet is refcounted, avcodec_send_packet() will take a reference
+    // to our buffer rather than making its own copy of the frame data.
+    if (!ensurePacketBuffer(requiredBufferSize + AV_INPUT_BUFFER_PADDING_SIZE)) {
+        m_ActiveWndVideoStats.idrRequests++;
+        return DR_NEED_IDR;
+    }
+
+    m_Pkt.buf = av_buffer_pool_get(m_PacketBufferPool);
+    if (m_Pkt.buf == nullptr) {
+        SDL_LOG_RATE_LIMITED(SDL_LogWarn, SDL_LOG_CATEGORY_APPLICATION,
+                             "Failed to get packet buffer from pool");
+        m_ActiveWndVideoStats.idrRequests++;
+        return DR_NEED_IDR;
+    }
+
+    int offset = 0;
+    while (entry != nullptr) {
+        writeBuffer(entry, m_Pkt.buf->data, offset);
+        entry = entry->next;
+    }
+
+    // The padding must be zeroed to avoid overreads of garbage data
+    memset(&m_Pkt.buf->data[offset], 0, AV_INPUT_BUFFER_PADDING_SIZE);
+
+    m_Pkt.data = m_Pkt.buf->data;
+    m_Pkt.size = offset;
+
+    if (BitstreamAnalytics::isActive()) {
+        BitstreamAnalytics::submit(du->frameNumber, du->frameType, m_VideoFormat, m_Pkt.buf, offset);
+    }
+
+    // FFmpeg carries the packet DTS through to the decoded frame's pkt_dts,
+    // which lets the later pipeline stages identify the frame.
+    m_Pkt.dts = du->frameNumber;
+
+    int ret;
+    if (m_AsyncDecode) {
+        ret = enqueuePacketForDecode(&m_Pkt);
     }
     else {
-        // Any frame number greater than m_LastFrameNumber + 1 represents a dropped frame
-        m_ActiveWndVideoStats.networkDroppedFrames += du->frameNumber - (m_LastFrameNumber + 1);
-        m_ActiveWndVideoStats.totalFrames += du->frameNumber - (m_LastFrameNumber + 1);
-        m_LastFrameNumber = du->frameNumber;
+        ret = decodePacket(&m_Pkt);
+
+        // The decoder holds its own reference to the buffer now (if it needs it),
+        // so we can drop ours. It will return to the pool when the decoder is done.
+        av_packet_unref(&m_Pkt);
     }
 
-    // Flip stats windows roughly every second
-    if (SDL_TICKS_PASSED(SDL_GetTicks(), m_ActiveWndVideoStats.measurementStartTimestamp + 1000)) {
-        // Update overlay stats if it's enabled
-        if (Session::get()->getOverlayManager().isOverlayEnabled(Overlay::OverlayDebug)) {
-            VIDEO_STATS lastTwoWndStats = {};
-            addVideoStats(m_LastWndVideoStats, lastTwoWndStats);
-            addVideoStats(m_ActiveWndVideoStats, lastTwoWndStats);
+    if (ret == DR_NEED_IDR) {
+        m_ActiveWndVideoStats.idrRequests++;
+    }
 
-            stringifyVideoStats(lastTwoWndStats, Session::get()->getOverlayManager().getOverlayText(Overlay::OverlayDebug));
-            Session::get()->getOverlayManager().setOverlayTextUpdated(Overlay::OverlayDebug);
+    return ret;
+}
+
+int FFmpegVideoDecoder::enqueuePacketForDecode(AVPacket* packet)
+{
+    int head = SDL_AtomicGet(&m_DecodeQueueHead);
+    int depth = head - SDL_AtomicGet(&m_DecodeQueueTail);
+
+    if (depth == MAX_QUEUED_DECODE_UNITS) {
+        // The decoder has fallen too far behind. We can't just drop this
+        // frame because subsequent frames will reference it, so we'll
+        // drop it and request an IDR frame to resynchronize.
+        SDL_LOG_RATE_LIMITED(SDL_LogWarn, SDL_LOG_CATEGORY_APPLICATION,
+                             "Decode queue is full; dropping frame");
+        av_packet_unref(packet);
+        return DR_NEED_IDR;
+    }
+
+    m_ActiveWndVideoStats.queuedDecodeUnits++;
+    m_ActiveWndVideoStats.totalDecodeQueueDepth += depth;
+    m_ActiveWndVideoStats.maxDecodeQueueDepth = qMax(m_ActiveWndVideoStats.maxDecodeQueueDepth, (uint32_t)depth);
+
+    // The slot at head is owned by us until we publish it below
+    QueuedPacket* slot = &m_DecodeQueue[head % MAX_QUEUED_DECODE_UNITS];
+    av_packet_move_ref(&slot->packet, packet);
+    slot->enqueueTime = StreamUtils::getTimeUs();
+
+    SDL_AtomicSet(&m_DecodeQueueHead, head + 1);
+    SDL_SemPost(m_DecodeQueueSem);
+
+    // Report any decoding failures from the decoder thread
+    return SDL_AtomicSet(&m_DecoderThreadNeedsIdr, 0) ? DR_NEED_IDR : DR_OK;
+}
+
+int FFmpegVideoDecoder::decoderThread(void* context)
+{
+    FFmpegVideoDecoder* me = reinterpret_cast<FFmpegVideoDecoder*>(context);
+
+    if (SDL_SetThreadPriority(SDL_THREAD_PRIORITY_HIGH) < 0) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Unable to set decoder thread to high priority: %s",
+                    SDL_GetError());
+    }
+
+    for (;;) {
+        SDL_SemWait(me->m_DecodeQueueSem);
+
+        if (SDL_AtomicGet(&me->m_DecoderThreadStopping)) {
+            break;
         }
 
-        // Accumulate these values into the global stats
-        addVideoStats(m_ActiveWndVideoStats, m_GlobalVideoStats);
+        int tail = SDL_AtomicGet(&me->m_DecodeQueueTail);
+        SDL_assert(tail != SDL_AtomicGet(&me->m_DecodeQueueHead));
+
+        QueuedPacket* slot = &me->m_DecodeQueue[tail % MAX_QUEUED_DECODE_UNITS];
+        me->m_ActiveWndVideoStats.totalDecodeQueueTime += StreamUtils::getTimeUs() - slot->enqueueTime;
 
-        // Move this window into the last window slot and clear it for next window
-        SDL_memcpy(&m_LastWndVideoStats, &m_ActiveWndVideoStats, sizeof(m_ActiveWndVideoStats));
-        SDL_zero(m_ActiveWndVideoStats);
-        m_ActiveWndVideoStats.measurementStartTimestamp = SDL_GetTicks();
+        if (me->decodePacket(&slot->packet) != DR_OK) {
+            SDL_AtomicSet(&me->m_DecoderThreadNeedsIdr, 1);
+        }
+
+        av_packet_unref(&slot->packet);
+
+        // Return this slot to the producer
+        SDL_AtomicSet(&me->m_DecodeQueueTail, tail + 1);
     }
 
-    m_ActiveWndVideoStats.receivedFrames++;
-    m_ActiveWndVideoStats.totalFrames++;
+    return 0;
+}
 
-    int requiredBufferSize = du->fullLength;
-    if (du->frameType == FRAME_TYPE_IDR) {
-        // Add some extra space in case we need to do an SPS fixup
-        requiredBufferSize += MAX_SPS_EXTRA_SIZE;
+// Called for each decoded frame when error concealment is enabled
+void FFmpegVideoDecoder::trackConcealment(AVFrame* frame)
+{
+    bool corrupt = frame->decode_error_flags != 0 || (frame->flags & AV_FRAME_FLAG_CORRUPT);
+
+    if (!corrupt) {
+        if (m_ConcealmentStartUs != 0) {
+            // A clean frame ends the concealment period
+            m_ActiveWndVideoStats.totalConcealmentTime += frame->pts - m_ConcealmentStartUs;
+            m_ConcealmentStartUs = 0;
+        }
+        return;
     }
 
-    // Ensure the decoder buffer is large enough
-    m_DecodeBuffer.reserve(requiredBufferSize + AV_INPUT_BUFFER_PADDING_SIZE);
+    m_ActiveWndVideoStats.concealedFrames++;
 
-    int offset = 0;
-    while (entry != nullptr) {
-        writeBuffer(entry, offset);
-        entry = entry->next;
+    if (m_ConcealmentStartUs == 0) {
+        m_ConcealmentStartUs = frame->pts;
+    }
+    else if (frame->pts - m_LastConcealmentIdrRequestUs < CONCEALMENT_IDR_RETRY_US) {
+        return;
     }
 
-    m_Pkt.data = reinterpret_cast<uint8_t*>(m_DecodeBuffer.data());
-    m_Pkt.size = offset;
+    // Unlike returning DR_NEED_IDR, this doesn't make moonlight-common-c
+    // drop the frames that keep coming until the key frame arrives
+    LiRequestIdrFrame();
+    m_ActiveWndVideoStats.idrRequests++;
+    m_LastConcealmentIdrRequestUs = frame->pts;
+}
 
-    m_ActiveWndVideoStats.totalReassemblyTime += LiGetMillis() - du->receiveTimeMs;
+int FFmpegVideoDecoder::decodePacket(AVPacket* packet)
+{
+    int err;
+
+    Uint64 beforeDecode = StreamUtils::getTimeUs();
 
-    Uint32 beforeDecode = SDL_GetTicks();
+    FrameTracer::mark((int)packet->dts, FrameTracer::FTS_DECODE_STARTED, beforeDecode);
 
-    err = avcodec_send_packet(m_VideoDecoderCtx, &m_Pkt);
+    err = avcodec_send_packet(m_VideoDecoderCtx, packet);
     if (err < 0) {
         char errorstring[512];
         av_strerror(err, errorstring, sizeof(errorstring));
-        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
-                    "avcodec_send_packet() failed: %s", errorstring);
+        SDL_LOG_RATE_LIMITED(SDL_LogWarn, SDL_LOG_CATEGORY_APPLICATION,
+                             "avcodec_send_packet() failed: %s", errorstring);
 
         // If we've failed a bunch of decodes in a row, the decoder/renderer is
         // clearly unhealthy, so let's generate a synthetic reset event to trigger
@@ -703,49 +1740,80 @@ int FFmpegVideoDecoder::submitDecodeUnit(PDECODE_UNIT du)
         return DR_NEED_IDR;
     }
 
-    AVFrame* frame = av_frame_alloc();
-    if (!frame) {
-        // Failed to allocate a frame but we did submit,
-        // so we can return DR_OK
-        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
-                    "Failed to allocate frame");
-        return DR_OK;
-    }
+    // Drain all available frames from the decoder. Decoders that buffer
+    // frames internally would otherwise be stuck a frame behind forever.
+    for (int framesReceived = 0;; framesReceived++) {
+        AVFrame* frame = m_FramePool->getFrame();
+        if (!frame) {
+            // Failed to allocate a frame but we did submit,
+            // so we can return DR_OK
+            SDL_LOG_RATE_LIMITED(SDL_LogWarn, SDL_LOG_CATEGORY_APPLICATION,
+                                 "Failed to allocate frame");
+            break;
+        }
 
-    err = avcodec_receive_frame(m_VideoDecoderCtx, frame);
-    if (err == 0) {
-        // Reset failed decodes count if we reached this far
-        m_ConsecutiveFailedDecodes = 0;
+        err = avcodec_receive_frame(m_VideoDecoderCtx, frame);
+        if (err == 0) {
+            // Reset failed decodes count if we reached this far
+            m_ConsecutiveFailedDecodes = 0;
 
-        // Restore default log level after a successful decode
-        av_log_set_level(AV_LOG_INFO);
+            // Restore default log level after a successful decode
+            av_log_set_level(AV_LOG_INFO);
 
-        // Capture a frame timestamp to measuring pacing delay
-        frame->pts = SDL_GetTicks();
+            // Capture a frame timestamp to measuring pacing delay
+            frame->pts = StreamUtils::getTimeUs();
 
-        // Count time in avcodec_send_packet() and avcodec_receive_frame()
-        // as time spent decoding
-        m_ActiveWndVideoStats.totalDecodeTime += SDL_GetTicks() - beforeDecode;
-        m_ActiveWndVideoStats.decodedFrames++;
+            if (m_ErrorConcealment) {
+                trackConcealment(frame);
+            }
 
-        // Queue the frame for rendering (or render now if pacer is disabled)
-        m_Pacer->submitFrame(frame);
-    }
-    else {
-        av_frame_free(&frame);
+            // Count time in avcodec_send_packet() and avcodec_receive_frame()
+            // as time spent decoding
+            m_ActiveWndVideoStats.totalDecodeTime += frame->pts - beforeDecode;
+            m_ActiveWndVideoStats.decodeTimes.add(frame->pts - beforeDecode);
+            m_ActiveWndVideoStats.decodedFrames++;
+            FrameTracer::mark((int)frame->pkt_dts, FrameTracer::FTS_DECODED, frame->pts);
+            FrameGraph::mark((int)frame->pkt_dts, FrameGraph::FGS_DECODE, frame->pts - beforeDecode);
 
-        char errorstring[512];
-        av_strerror(err, errorstring, sizeof(errorstring));
-        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
-                    "avcodec_receive_frame() failed: %s", errorstring);
+            // Let the renderer start on the frame before it's queued
+            m_FrontendRenderer->prepareFrame(frame);
 
-        if (++m_ConsecutiveFailedDecodes == FAILED_DECODES_RESET_THRESHOLD) {
-            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
-                         "Resetting decoder due to consistent failure");
+            // Queue the frame for rendering (or render now if pacer is disabled)
+            m_Pacer->submitFrame(frame);
 
-            SDL_Event event;
-            event.type = SDL_RENDER_DEVICE_RESET;
-            SDL_PushEvent(&event);
+            // Keep track of how often a decoder was holding more than one frame
+            if (framesReceived == 1) {
+                m_ActiveWndVideoStats.multiFrameDecodes++;
+            }
+
+            // Don't count time spent rendering or waiting in Pacer as
+            // decode time for any subsequent frames
+            beforeDecode = StreamUtils::getTimeUs();
+        }
+        else {
+            m_FramePool->releaseFrame(frame);
+
+            // Running out of frames after receiving at least one
+            // is the expected way for the drain loop to end
+            if (err == AVERROR(EAGAIN) && framesReceived > 0) {
+                break;
+            }
+
+            char errorstring[512];
+            av_strerror(err, errorstring, sizeof(errorstring));
+            SDL_LOG_RATE_LIMITED(SDL_LogWarn, SDL_LOG_CATEGORY_APPLICATION,
+                                 "avcodec_receive_frame() failed: %s", errorstring);
+
+            if (++m_ConsecutiveFailedDecodes == FAILED_DECODES_RESET_THRESHOLD) {
+                SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                             "Resetting decoder due to consistent failure");
+
+                SDL_Event event;
+                event.type = SDL_RENDER_DEVICE_RESET;
+                SDL_PushEvent(&event);
+            }
+
+            break;
         }
     }
 
@@ -757,3 +1825,67 @@ void FFmpegVideoDecoder::renderFrameOnMainThread()
     m_Pacer->renderOnMainThread();
 }
 
+bool FFmpegVideoDecoder::reinitializePresentation(PDECODER_PARAMETERS params)
+{
+    // If the decoder itself is what failed, it must be recreated
+    if (m_ConsecutiveFailedDecodes >= FAILED_DECODES_RESET_THRESHOLD) {
+        return false;
+    }
+
+    // The decoder thread submits frames to Pacer without
+    // holding the decoder lock, so we can't swap Pacer under it.
+    if (m_AsyncDecode) {
+        return false;
+    }
+
+    bool separateFrontend = m_FrontendRenderer != m_BackendRenderer;
+
+    // Keep the stats thread away from the renderers while they change
+    SDL_AtomicLock(&m_RendererLock);
+
+    // Pacer may be rendering on its own thread, so it must be
+    // destroyed before we touch the frontend renderer.
+    delete m_Pacer;
+    m_Pacer = nullptr;
+
+    Session::get()->getOverlayManager().setOverlayRenderer(nullptr);
+
+    if (separateFrontend) {
+        // The frontend renderer has no ties to the decoder, so we can
+        // simply create a new one for the new window state.
+        delete m_FrontendRenderer;
+        m_FrontendRenderer = nullptr;
+    }
+    else if (!m_BackendRenderer->reinitializePresentation(params)) {
+        // We must tear down the decoder to rebuild this renderer
+        m_FrontendRenderer = m_BackendRenderer;
+        SDL_AtomicUnlock(&m_RendererLock);
+        return false;
+    }
+
+    if (!createFrontendRenderer(params)) {
+        SDL_AtomicUnlock(&m_RendererLock);
+        return false;
+    }
+
+    m_Pacer = new Pacer(m_FrontendRenderer, m_FramePool, &m_ActiveWndVideoStats);
+    if (!m_Pacer->initialize(params->window, params->frameRate,
+                                   params->enableFramePacing, params->pacingMode)) {
+        SDL_AtomicUnlock(&m_RendererLock);
+        return false;
+    }
+
+    Session::get()->getOverlayManager().setOverlayRenderer(m_FrontendRenderer);
+    SDL_AtomicUnlock(&m_RendererLock);
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Reinitialized presentation without recreating the decoder");
+    return true;
+}
+
+bool FFmpegVideoDecoder::notifyWindowResized(PDECODER_PARAMETERS params)
+{
+    // Only the frontend renderer presents to the window
+    return m_FrontendRenderer != nullptr && m_FrontendRenderer->notifyWindowResized(params);
+}
+
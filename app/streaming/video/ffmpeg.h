@@ -2,7 +2,13 @@
 
 #include <functional>
 
+#include <QList>
+#include <QSet>
+#include <QByteArray>
+
 #include "decoder.h"
+#include "framepool.h"
+#include "videostats.h"
 #include "ffmpeg-renderers/renderer.h"
 #include "ffmpeg-renderers/pacer/pacer.h"
 
@@ -10,6 +16,10 @@ extern "C" {
 #include <libavcodec/avcodec.h>
 }
 
+// Maximum number of decode units waiting for the decoder thread.
+// Must be a power of 2.
+#define MAX_QUEUED_DECODE_UNITS 4
+
 class FFmpegVideoDecoder : public IVideoDecoder {
 public:
     FFmpegVideoDecoder(bool testOnly);
@@ -19,17 +29,25 @@ public:
     virtual int getDecoderCapabilities() override;
     virtual int submitDecodeUnit(PDECODE_UNIT du) override;
     virtual void renderFrameOnMainThread() override;
+    virtual bool reinitializePresentation(PDECODER_PARAMETERS params) override;
+    virtual bool notifyWindowResized(PDECODER_PARAMETERS params) override;
+    virtual bool getGlobalVideoStats(VIDEO_STATS& stats) override;
+    virtual bool getLiveVideoStats(VIDEO_STATS& stats) override;
+    virtual bool requestScreenshot() override;
+    virtual const char* getDecoderName() override;
 
     virtual IFFmpegRenderer* getBackendRenderer();
 
+    // Frames per second that FFmpeg's software decoder sustains on the
+    // 720p test frame with its fastest threading setup, or 0 if it can't
+    // decode this format at all
+    static double measureSoftwareDecodeRate(int videoFormat);
+
 private:
     bool completeInitialization(AVCodec* decoder, PDECODER_PARAMETERS params, bool testFrame);
 
-    void stringifyVideoStats(VIDEO_STATS& stats, char* output);
-
-    void logVideoStats(VIDEO_STATS& stats, const char* title);
-
-    void addVideoStats(VIDEO_STATS& src, VIDEO_STATS& dst);
+    // Adds the frontend renderer's lines to the overlay from the stats thread
+    bool getOverlayDetails(char* output, size_t size);
 
     bool createFrontendRenderer(PDECODER_PARAMETERS params);
 
@@ -38,11 +56,54 @@ private:
                                const AVCodecHWConfig* hwConfig,
                                std::function<IFFmpegRenderer*()> createRendererFunc);
 
-    static IFFmpegRenderer* createHwAccelRenderer(const AVCodecHWConfig* hwDecodeCfg, int pass);
+    static IFFmpegRenderer* createHwAccelRenderer(const AVCodecHWConfig* hwDecodeCfg, int pass,
+                                                  StreamingPreferences::VideoDecoderSelection vds,
+                                                  int videoFormat);
+
+    void probeHwAccelsInParallel(AVCodec* decoder, PDECODER_PARAMETERS params);
+
+#ifdef HAVE_QSV
+    static AVCodec* findQsvDecoder(int videoFormat, const AVCodecHWConfig** hwConfig);
+
+    bool tryInitializeQsvRenderer(PDECODER_PARAMETERS params);
+#endif
+
+    static
+    int hwAccelProbeThread(void* context);
+
+    static int getSoftwareDecodeSliceCount();
+
+    // Decoding on our own thread instead of the one that submits
+    // frames, enabled with ASYNC_DECODE=1
+    static bool isPipelinedDecodeEnabled();
+
+    // Ranking hwaccels by how fast they decode the test frame instead
+    // of using the first one that works, enabled with HWACCEL_BENCHMARK=1
+    static bool isHwAccelBenchmarkEnabled();
+
+    int benchmarkTestFrameDecode();
+
+    // Returns the best rate in frames per second
+    static double benchmarkSoftwareDecode(AVCodec* decoder, int videoFormat);
 
     void reset();
 
-    void writeBuffer(PLENTRY entry, int& offset);
+    bool ensurePacketBuffer(int size);
+
+    void writeBuffer(PLENTRY entry, uint8_t* buffer, int& offset);
+
+    void createHwFramesContext(AVCodecContext* context, enum AVPixelFormat hwFormat);
+
+    static int getHevcSpsRefFrames(const char* data, int length);
+
+    int decodePacket(AVPacket* packet);
+
+    void trackConcealment(AVFrame* frame);
+
+    int enqueuePacketForDecode(AVPacket* packet);
+
+    static
+    int decoderThread(void* context);
 
     static
     enum AVPixelFormat ffGetFormat(AVCodecContext* context,
@@ -50,20 +111,53 @@ private:
 
     AVPacket m_Pkt;
     AVCodecContext* m_VideoDecoderCtx;
-    QByteArray m_DecodeBuffer;
+    AVBufferPool* m_PacketBufferPool;
+    int m_PacketBufferSize;
     const AVCodecHWConfig* m_HwDecodeCfg;
     IFFmpegRenderer* m_BackendRenderer;
     IFFmpegRenderer* m_FrontendRenderer;
     int m_ConsecutiveFailedDecodes;
     Pacer* m_Pacer;
-    VIDEO_STATS m_ActiveWndVideoStats;
-    VIDEO_STATS m_LastWndVideoStats;
-    VIDEO_STATS m_GlobalVideoStats;
+    FramePool* m_FramePool;
+    VideoStatsCollector m_VideoStats;
+
+    // The window being collected, which decoding adds its timings to
+    VIDEO_STATS& m_ActiveWndVideoStats;
 
-    int m_LastFrameNumber;
-    int m_StreamFps;
+    int m_VideoFormat;
+    char m_DecoderName[64];
     bool m_NeedsSpsFixup;
+    QByteArray m_LastSpsInput;
+    QByteArray m_LastSpsOutput;
+    SDL_atomic_t m_HevcSpsRefFrames;
+    bool m_ErrorConcealment;
+    Uint64 m_ConcealmentStartUs;
+    Uint64 m_LastConcealmentIdrRequestUs;
     bool m_TestOnly;
+    bool m_BackendProbeOnly;
+    QSet<int> m_FailedHwAccelProbes;
+
+    // HWACCEL_PROBE_KEY()s of the working hwaccels, fastest first
+    QList<int> m_HwAccelRanking;
+
+    // Pipelined decoding state. The decode queue is a single-producer
+    // (submitDecodeUnit) single-consumer (decoder thread) ring.
+    struct QueuedPacket {
+        AVPacket packet;
+        Uint64 enqueueTime;
+    };
+
+    bool m_AsyncDecode;
+    SDL_Thread* m_DecoderThread;
+    SDL_sem* m_DecodeQueueSem;
+    SDL_atomic_t m_DecoderThreadStopping;
+    SDL_atomic_t m_DecoderThreadNeedsIdr;
+    SDL_atomic_t m_DecodeQueueHead;
+    SDL_atomic_t m_DecodeQueueTail;
+    QueuedPacket m_DecodeQueue[MAX_QUEUED_DECODE_UNITS];
+
+    // Held by reinitializePresentation() while the renderers are replaced
+    SDL_SpinLock m_RendererLock;
 
     static const uint8_t k_H264TestFrame[];
     static const uint8_t k_HEVCTestFrame[];
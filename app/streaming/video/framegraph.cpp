@@ -0,0 +1,51 @@
+#include "framegraph.h"
+
+FrameGraph::FrameRecord FrameGraph::s_Records[FRAME_GRAPH_CAPACITY];
+SDL_atomic_t FrameGraph::s_LastRenderedFrame;
+
+const SDL_Color FrameGraph::k_SeriesColors[FGS_MAX] = {
+    { 0xFF, 0xFF, 0xFF, 0xFF }, // Network arrival interval
+    { 0x00, 0xC0, 0xFF, 0xFF }, // Decode
+    { 0xFF, 0xC0, 0x00, 0xFF }, // Pacer wait
+    { 0x40, 0xFF, 0x40, 0xFF }, // Render
+    { 0xFF, 0x40, 0xFF, 0xFF }, // Present
+};
+
+void FrameGraph::reset()
+{
+    SDL_zero(s_Records);
+    SDL_AtomicSet(&s_LastRenderedFrame, 0);
+}
+
+SDL_Rect FrameGraph::getGraphRect(const SDL_Rect& videoRect)
+{
+    SDL_Rect rect;
+
+    rect.w = videoRect.w * 2 / 5;
+    rect.h = videoRect.h / 5;
+    rect.x = videoRect.x + videoRect.w - rect.w;
+    rect.y = videoRect.y;
+
+    return rect;
+}
+
+void FrameGraph::getVertices(float* vertices, float left, float bottom, float width, float height)
+{
+    int lastFrame = SDL_AtomicGet(&s_LastRenderedFrame);
+    float xStep = width / (FRAME_GRAPH_FRAMES - 1);
+    float yScale = height / FRAME_GRAPH_SCALE_US;
+
+    for (int i = 0; i < FRAME_GRAPH_FRAMES; i++) {
+        int frameNumber = lastFrame - (FRAME_GRAPH_FRAMES - 1) + i;
+        const FrameRecord* record = &s_Records[frameNumber & (FRAME_GRAPH_CAPACITY - 1)];
+        bool valid = frameNumber > 0 && record->frameNumber == frameNumber;
+        float x = left + i * xStep;
+
+        for (int series = 0; series < FGS_MAX; series++) {
+            float* vertex = &vertices[(series * FRAME_GRAPH_FRAMES + i) * 2];
+
+            vertex[0] = x;
+            vertex[1] = bottom + (valid ? record->timesUs[series] * yScale : 0.0f);
+        }
+    }
+}
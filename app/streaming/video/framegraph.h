@@ -0,0 +1,91 @@
+#pragma once
+
+#include <SDL.h>
+
+// Number of most recent frames kept. Must be a power of 2 and larger
+// than FRAME_GRAPH_FRAMES, so frames still in the pipeline don't claim
+// the slots of frames being drawn.
+#define FRAME_GRAPH_CAPACITY 512
+
+// Frames across the graph (5 seconds at 60 FPS)
+#define FRAME_GRAPH_FRAMES 300
+
+// Time at the top of the graph. Longer times are clipped to it.
+#define FRAME_GRAPH_SCALE_US 33333
+
+// Size of the vertex array that getVertices() fills
+#define FRAME_GRAPH_VERTEX_FLOATS (FrameGraph::FGS_MAX * FRAME_GRAPH_FRAMES * 2)
+
+// Keeps the stage times of the last few seconds of frames for the frame
+// graph overlay (Overlay::OverlayFrameGraph), which shows the single frame
+// hitches that the once a second stats overlay averages away. The GPU
+// renderers draw each series as a line strip straight from the vertices
+// built here, so the overlay costs no rasterizing or texture uploads.
+//
+// Like FrameTracer, each value of a frame is only written by a single
+// thread and the ring needs no locking. The arrival interval and decode
+// time come from the decoder, and the rest from the render thread, which
+// is also the one that draws the graph.
+class FrameGraph
+{
+public:
+    enum Series
+    {
+        FGS_ARRIVAL,
+        FGS_DECODE,
+        FGS_PACER,
+        FGS_RENDER,
+        FGS_PRESENT,
+        FGS_MAX
+    };
+
+    static const SDL_Color k_SeriesColors[FGS_MAX];
+
+    // Forgets the frames of the last session
+    static void reset();
+
+    // Claims the frame's slot, so this must be the first mark for a frame
+    static void markArrival(int frameNumber, Uint64 intervalUs)
+    {
+        FrameRecord* record = &s_Records[frameNumber & (FRAME_GRAPH_CAPACITY - 1)];
+
+        SDL_zerop(record);
+        record->frameNumber = frameNumber;
+        record->timesUs[FGS_ARRIVAL] = (Uint32)SDL_min(intervalUs, (Uint64)FRAME_GRAPH_SCALE_US);
+    }
+
+    static void mark(int frameNumber, Series series, Uint64 timeUs)
+    {
+        FrameRecord* record = &s_Records[frameNumber & (FRAME_GRAPH_CAPACITY - 1)];
+
+        if (record->frameNumber == frameNumber) {
+            record->timesUs[series] = (Uint32)SDL_min(timeUs, (Uint64)FRAME_GRAPH_SCALE_US);
+        }
+    }
+
+    // Called by the render thread once all of a frame's values are marked
+    static void markRendered(int frameNumber)
+    {
+        SDL_AtomicSet(&s_LastRenderedFrame, frameNumber);
+    }
+
+    // Where the graph goes over the video, which is the top right corner
+    static SDL_Rect getGraphRect(const SDL_Rect& videoRect);
+
+    // Fills vertices with FRAME_GRAPH_FRAMES (x, y) points for each series
+    // in turn, with the newest frame at the right. The graph is mapped to
+    // the rectangle starting at (left, bottom). A negative height draws it
+    // upwards on axes that grow downwards. Frames that never made it to
+    // the renderer are drawn as 0.
+    static void getVertices(float* vertices, float left, float bottom, float width, float height);
+
+private:
+    struct FrameRecord
+    {
+        int frameNumber;
+        Uint32 timesUs[FGS_MAX];
+    };
+
+    static FrameRecord s_Records[FRAME_GRAPH_CAPACITY];
+    static SDL_atomic_t s_LastRenderedFrame;
+};
@@ -0,0 +1,66 @@
+#include "framepool.h"
+
+FramePool::FramePool(int initialSize)
+    : m_Lock(0),
+      m_TotalFrames(0)
+{
+    m_FreeFrames.reserve(initialSize);
+
+    for (int i = 0; i < initialSize; i++) {
+        AVFrame* frame = av_frame_alloc();
+        if (frame == nullptr) {
+            break;
+        }
+
+        m_FreeFrames.append(frame);
+        m_TotalFrames++;
+    }
+}
+
+FramePool::~FramePool()
+{
+    // All frames must have been returned to the pool by now
+    SDL_assert(m_FreeFrames.count() == m_TotalFrames);
+
+    for (AVFrame* frame : m_FreeFrames) {
+        av_frame_free(&frame);
+    }
+}
+
+AVFrame* FramePool::getFrame()
+{
+    AVFrame* frame = nullptr;
+
+    SDL_AtomicLock(&m_Lock);
+    if (!m_FreeFrames.isEmpty()) {
+        frame = m_FreeFrames.takeLast();
+    }
+    SDL_AtomicUnlock(&m_Lock);
+
+    if (frame == nullptr) {
+        // We've run dry, so grow the pool. This should only happen
+        // while the queues are filling up initially.
+        frame = av_frame_alloc();
+        if (frame != nullptr) {
+            SDL_AtomicLock(&m_Lock);
+            int totalFrames = ++m_TotalFrames;
+            SDL_AtomicUnlock(&m_Lock);
+
+            SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                        "Frame pool grown to %d frames",
+                        totalFrames);
+        }
+    }
+
+    return frame;
+}
+
+void FramePool::releaseFrame(AVFrame* frame)
+{
+    // Drop the frame's buffer references outside of the lock
+    av_frame_unref(frame);
+
+    SDL_AtomicLock(&m_Lock);
+    m_FreeFrames.append(frame);
+    SDL_AtomicUnlock(&m_Lock);
+}
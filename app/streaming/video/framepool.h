@@ -0,0 +1,34 @@
+#pragma once
+
+#include <QVector>
+
+#include <SDL.h>
+
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+// A pool of reusable AVFrames shared between the decoder and Pacer.
+// Frames are preallocated and returned to the pool by unreferencing
+// their buffers instead of being freed, so the steady state does not
+// touch the heap.
+class FramePool
+{
+public:
+    explicit FramePool(int initialSize);
+
+    ~FramePool();
+
+    // Returns an empty frame or nullptr on allocation failure
+    AVFrame* getFrame();
+
+    // Unreferences the frame's buffers and returns it to the pool.
+    // This may call into the GPU driver to release a surface, so
+    // callers should avoid holding locks across it.
+    void releaseFrame(AVFrame* frame);
+
+private:
+    QVector<AVFrame*> m_FreeFrames;
+    SDL_SpinLock m_Lock;
+    int m_TotalFrames;
+};
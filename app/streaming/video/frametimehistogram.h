@@ -0,0 +1,79 @@
+#pragma once
+
+#include <SDL.h>
+
+// Each power of 2 range of microseconds is split into this many linear
+// buckets, so reported percentiles are within 1/8 of the real value.
+#define FRAME_TIME_HISTOGRAM_SUB_BUCKETS 8
+
+// Covers times up to about 4 seconds. Longer times land in the last bucket.
+#define FRAME_TIME_HISTOGRAM_BUCKETS 160
+
+// A fixed-size histogram of per-frame times in microseconds. Recording a
+// sample is a couple of bit operations and an increment with no locking
+// or allocation, so it's cheap enough for every frame. Like the rest of
+// VIDEO_STATS, each histogram must only be updated by a single thread.
+struct FrameTimeHistogram
+{
+    uint32_t buckets[FRAME_TIME_HISTOGRAM_BUCKETS];
+    uint32_t count;
+    uint32_t maxUs;
+
+    void add(Uint64 timeUs)
+    {
+        Uint32 value = (Uint32)SDL_min(timeUs, (Uint64)0xFFFFFFFF);
+        int index;
+
+        if (value < FRAME_TIME_HISTOGRAM_SUB_BUCKETS) {
+            index = (int)value;
+        }
+        else {
+            // Top bit picks the power of 2 range and the next 3 bits pick the sub-bucket
+            int exponent = SDL_MostSignificantBitIndex32(value);
+            int subBucket = (value >> (exponent - 3)) & (FRAME_TIME_HISTOGRAM_SUB_BUCKETS - 1);
+            index = SDL_min((exponent - 2) * FRAME_TIME_HISTOGRAM_SUB_BUCKETS + subBucket,
+                            FRAME_TIME_HISTOGRAM_BUCKETS - 1);
+        }
+
+        buckets[index]++;
+        count++;
+        maxUs = SDL_max(maxUs, value);
+    }
+
+    void merge(const FrameTimeHistogram& other)
+    {
+        for (int i = 0; i < FRAME_TIME_HISTOGRAM_BUCKETS; i++) {
+            buckets[i] += other.buckets[i];
+        }
+        count += other.count;
+        maxUs = SDL_max(maxUs, other.maxUs);
+    }
+
+    // Returns the midpoint of the bucket holding the given percentile
+    Uint32 getPercentileUs(int percentile) const
+    {
+        if (count == 0) {
+            return 0;
+        }
+
+        // Rank of the sample at this percentile (rounded up)
+        Uint64 rank = ((Uint64)count * percentile + 99) / 100;
+        Uint64 seen = 0;
+
+        for (int i = 0; i < FRAME_TIME_HISTOGRAM_BUCKETS; i++) {
+            seen += buckets[i];
+            if (seen >= rank && seen != 0) {
+                if (i < FRAME_TIME_HISTOGRAM_SUB_BUCKETS) {
+                    return (Uint32)i;
+                }
+
+                int exponent = i / FRAME_TIME_HISTOGRAM_SUB_BUCKETS + 2;
+                Uint32 width = 1U << (exponent - 3);
+                Uint32 low = (FRAME_TIME_HISTOGRAM_SUB_BUCKETS + i % FRAME_TIME_HISTOGRAM_SUB_BUCKETS) * width;
+                return SDL_min(low + width / 2, maxUs);
+            }
+        }
+
+        return maxUs;
+    }
+};
@@ -0,0 +1,103 @@
+#include "frametracer.h"
+#include "path.h"
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QTextStream>
+
+FrameTracer::FrameRecord* FrameTracer::s_Records;
+
+// Each span covers the time between two consecutive stages
+static const char* k_SpanNames[FrameTracer::FTS_MAX - 1] = {
+    "Network reassembly",
+    "Decode queue",
+    "Decode",
+    "Frame queue",
+    "Render",
+    "Scanout wait"
+};
+
+void FrameTracer::start()
+{
+    SDL_assert(s_Records == nullptr);
+
+    if (qgetenv("FRAME_TRACE") != "1") {
+        return;
+    }
+
+    s_Records = (FrameRecord*)SDL_calloc(FRAME_TRACE_CAPACITY, sizeof(*s_Records));
+    if (s_Records == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unable to allocate frame trace buffer");
+        return;
+    }
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Frame tracing enabled");
+}
+
+void FrameTracer::stop()
+{
+    FrameRecord* records = s_Records;
+    if (records == nullptr) {
+        return;
+    }
+
+    s_Records = nullptr;
+
+    QDir logDir(Path::getLogDir());
+    QFile traceFile(logDir.filePath(QString("Moonlight-Trace-%1-%2.json").arg(QDateTime::currentSecsSinceEpoch()).arg(QCoreApplication::applicationPid())));
+    if (!traceFile.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unable to open frame trace file: %s",
+                     qPrintable(traceFile.errorString()));
+        SDL_free(records);
+        return;
+    }
+
+    QTextStream stream(&traceFile);
+    int spans = 0;
+
+    stream << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+    // Name a track for each span type
+    for (int i = 0; i < FTS_MAX - 1; i++) {
+        stream << (i != 0 ? ",\n" : "")
+               << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << i + 1
+               << ",\"args\":{\"name\":\"" << k_SpanNames[i] << "\"}}";
+    }
+
+    for (int i = 0; i < FRAME_TRACE_CAPACITY; i++) {
+        FrameRecord* record = &records[i];
+        if (record->timesUs[FTS_RECEIVED] == 0) {
+            continue;
+        }
+
+        for (int stage = 0; stage < FTS_MAX - 1; stage++) {
+            Uint64 startUs = record->timesUs[stage];
+            Uint64 endUs = record->timesUs[stage + 1];
+
+            // Skip stages this frame never made it through
+            if (startUs == 0 || endUs < startUs) {
+                continue;
+            }
+
+            spans++;
+            stream << ",\n{\"name\":\"" << k_SpanNames[stage] << "\",\"cat\":\"frame\",\"ph\":\"X\",\"pid\":1,\"tid\":" << stage + 1
+                   << ",\"ts\":" << startUs << ",\"dur\":" << endUs - startUs
+                   << ",\"args\":{\"frame\":" << record->frameNumber << "}}";
+        }
+    }
+
+    stream << "\n]}\n";
+    stream.flush();
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Wrote %d frame trace spans to %s",
+                spans,
+                qPrintable(traceFile.fileName()));
+
+    SDL_free(records);
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <SDL.h>
+
+// Number of most recent frames kept in the trace (about 18 minutes at
+// 60 FPS). Must be a power of 2.
+#define FRAME_TRACE_CAPACITY 65536
+
+// Records when each frame passes through each stage of the video pipeline
+// and writes them out as a Chrome trace (chrome://tracing or Perfetto)
+// when the session ends. Tracing is enabled with FRAME_TRACE=1.
+//
+// Every stage of a frame is marked by exactly one thread, so the trace
+// buffer needs no locking. It is preallocated at start() to keep the
+// per-frame cost down to a few stores.
+class FrameTracer
+{
+public:
+    enum Stage
+    {
+        FTS_RECEIVED,
+        FTS_SUBMITTED,
+        FTS_DECODE_STARTED,
+        FTS_DECODED,
+        FTS_RENDER_STARTED,
+        FTS_RENDERED,
+        FTS_DISPLAYED,
+        FTS_MAX
+    };
+
+    // Allocates the trace buffer if tracing is enabled
+    static void start();
+
+    // Writes the trace to the log directory and frees the buffer. The
+    // pipeline threads must all be stopped before calling this.
+    static void stop();
+
+    static bool isActive()
+    {
+        return s_Records != nullptr;
+    }
+
+    // timeUs is on the StreamUtils::getTimeUs() clock
+    static void mark(int frameNumber, Stage stage, Uint64 timeUs)
+    {
+        FrameRecord* records = s_Records;
+        if (records == nullptr) {
+            return;
+        }
+
+        FrameRecord* record = &records[frameNumber & (FRAME_TRACE_CAPACITY - 1)];
+        if (stage == FTS_RECEIVED) {
+            // Claim this slot from the frame that used it before
+            SDL_zerop(record);
+            record->frameNumber = frameNumber;
+        }
+        else if (record->frameNumber != frameNumber) {
+            // This frame's slot was already reused
+            return;
+        }
+
+        record->timesUs[stage] = timeUs;
+    }
+
+private:
+    struct FrameRecord
+    {
+        int frameNumber;
+        Uint64 timesUs[FTS_MAX];
+    };
+
+    static FrameRecord* s_Records;
+};
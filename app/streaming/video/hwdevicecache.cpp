@@ -0,0 +1,94 @@
+#include "hwdevicecache.h"
+
+HwDeviceCache::Entry HwDeviceCache::s_Entries[8];
+bool HwDeviceCache::s_Enabled;
+SDL_SpinLock HwDeviceCache::s_Lock;
+
+void HwDeviceCache::enable()
+{
+    SDL_AtomicLock(&s_Lock);
+    s_Enabled = true;
+    SDL_AtomicUnlock(&s_Lock);
+}
+
+void HwDeviceCache::clear()
+{
+    AVBufferRef* devices[SDL_arraysize(s_Entries)];
+    int deviceCount = 0;
+
+    SDL_AtomicLock(&s_Lock);
+    s_Enabled = false;
+    for (int i = 0; i < (int)SDL_arraysize(s_Entries); i++) {
+        if (s_Entries[i].device != nullptr) {
+            devices[deviceCount++] = s_Entries[i].device;
+            s_Entries[i].device = nullptr;
+        }
+    }
+    SDL_AtomicUnlock(&s_Lock);
+
+    // Freeing a device can take a while, so it's done outside the lock
+    for (int i = 0; i < deviceCount; i++) {
+        av_buffer_unref(&devices[i]);
+    }
+}
+
+void HwDeviceCache::put(AVHWDeviceType type, const void* displayKey, AVBufferRef** device)
+{
+    if (*device == nullptr) {
+        return;
+    }
+
+    SDL_AtomicLock(&s_Lock);
+    if (s_Enabled) {
+        Entry* freeEntry = nullptr;
+
+        for (int i = 0; i < (int)SDL_arraysize(s_Entries); i++) {
+            if (s_Entries[i].device == nullptr) {
+                if (freeEntry == nullptr) {
+                    freeEntry = &s_Entries[i];
+                }
+            }
+            else if (s_Entries[i].type == type) {
+                // Keep the one we already have
+                freeEntry = nullptr;
+                break;
+            }
+        }
+
+        if (freeEntry != nullptr) {
+            freeEntry->type = type;
+            freeEntry->displayKey = displayKey;
+            freeEntry->device = *device;
+            *device = nullptr;
+        }
+    }
+    SDL_AtomicUnlock(&s_Lock);
+
+    // Release it if nobody took it above
+    av_buffer_unref(device);
+}
+
+AVBufferRef* HwDeviceCache::take(AVHWDeviceType type, const void* displayKey)
+{
+    AVBufferRef* device = nullptr;
+
+    SDL_AtomicLock(&s_Lock);
+    for (int i = 0; i < (int)SDL_arraysize(s_Entries); i++) {
+        if (s_Entries[i].device != nullptr &&
+                s_Entries[i].type == type &&
+                s_Entries[i].displayKey == displayKey) {
+            device = s_Entries[i].device;
+            s_Entries[i].device = nullptr;
+            break;
+        }
+    }
+    SDL_AtomicUnlock(&s_Lock);
+
+    if (device != nullptr) {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Reusing %s device from decoder probing",
+                    av_hwdevice_get_type_name(type));
+    }
+
+    return device;
+}
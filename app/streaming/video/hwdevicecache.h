@@ -0,0 +1,47 @@
+#pragma once
+
+#include <SDL.h>
+
+extern "C" {
+#include <libavutil/hwcontext.h>
+}
+
+// Carries hardware device contexts from the test decoders that Session
+// builds while probing over to the decoder used for streaming, so the
+// device (VAAPI display, VDPAU device, etc.) is only opened once per
+// launch. Renderers hand their device over when they're destroyed and
+// look for one in initialize() before creating their own.
+//
+// Devices are only held between enable() and clear(). Devices can depend
+// on the window system connection, so clear() must be called before the
+// SDL video subsystem is shut down.
+class HwDeviceCache
+{
+public:
+    static void enable();
+
+    // Releases any devices that weren't picked up and stops holding new ones
+    static void clear();
+
+    // Takes over the caller's reference and sets *device to nullptr. The
+    // reference is released instead if the cache isn't enabled or already
+    // holds a device of this type. displayKey identifies the window system
+    // connection that the device belongs to, if any.
+    static void put(AVHWDeviceType type, const void* displayKey, AVBufferRef** device);
+
+    // Returns a reference to a held device for the same display
+    // or nullptr if there isn't one. The caller owns the reference.
+    static AVBufferRef* take(AVHWDeviceType type, const void* displayKey);
+
+private:
+    struct Entry {
+        AVHWDeviceType type;
+        const void* displayKey;
+        AVBufferRef* device;
+    };
+
+    // There's only ever one device of each type in use at once
+    static Entry s_Entries[8];
+    static bool s_Enabled;
+    static SDL_SpinLock s_Lock;
+};
@@ -0,0 +1,411 @@
+#include "mmalvid.h"
+
+#include "streaming/streamutils.h"
+
+// Frames larger than one input buffer are split across several buffers
+// so this only needs to cover a typical frame at high bitrates.
+#define INPUT_BUFFER_SIZE (512 * 1024)
+#define INPUT_BUFFER_COUNT 8
+
+// How long to wait for the decoder to return an input buffer
+#define INPUT_BUFFER_TIMEOUT_MS 100
+
+MmalVideoDecoder::MmalVideoDecoder(bool)
+    : m_Decoder(nullptr),
+      m_Renderer(nullptr),
+      m_Connection(nullptr),
+      m_InputPool(nullptr)
+{
+    SDL_AtomicSet(&m_DecoderError, 0);
+}
+
+MmalVideoDecoder::~MmalVideoDecoder()
+{
+    m_VideoStats.stop();
+    m_VideoStats.logGlobalVideoStats();
+
+    if (m_Decoder != nullptr) {
+        if (m_Decoder->input[0]->is_enabled) {
+            mmal_port_disable(m_Decoder->input[0]);
+        }
+
+        if (m_Decoder->control->is_enabled) {
+            mmal_port_disable(m_Decoder->control);
+        }
+    }
+
+    if (m_Connection != nullptr) {
+        mmal_connection_destroy(m_Connection);
+    }
+
+    if (m_InputPool != nullptr) {
+        mmal_port_pool_destroy(m_Decoder->input[0], m_InputPool);
+    }
+
+    if (m_Renderer != nullptr) {
+        mmal_component_destroy(m_Renderer);
+    }
+
+    if (m_Decoder != nullptr) {
+        mmal_component_destroy(m_Decoder);
+    }
+}
+
+bool
+MmalVideoDecoder::isHardwareAccelerated()
+{
+    // MMAL is always hardware accelerated
+    return true;
+}
+
+int
+MmalVideoDecoder::getDecoderCapabilities()
+{
+    // Submitting to MMAL only copies into an input buffer, so we can do
+    // it directly from the receive thread and skip the decode unit queue.
+    return CAPABILITY_DIRECT_SUBMIT;
+}
+
+bool
+MmalVideoDecoder::initialize(PDECODER_PARAMETERS params)
+{
+    MMAL_STATUS_T status;
+
+    // MMAL only supports hardware decoding
+    if (params->vds == StreamingPreferences::VDS_FORCE_SOFTWARE) {
+        return false;
+    }
+
+    // The VideoCore decoder is only usable for H.264
+    if (params->videoFormat != VIDEO_FORMAT_H264) {
+        return false;
+    }
+
+    status = mmal_component_create(MMAL_COMPONENT_DEFAULT_VIDEO_DECODER, &m_Decoder);
+    if (status != MMAL_SUCCESS) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "mmal_component_create() failed: %x (%s)",
+                     status, mmal_status_to_string(status));
+        return false;
+    }
+
+    m_Decoder->control->userdata = (struct MMAL_PORT_USERDATA_T*)this;
+    status = mmal_port_enable(m_Decoder->control, controlPortCallback);
+    if (status != MMAL_SUCCESS) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "mmal_port_enable() failed: %x (%s)",
+                     status, mmal_status_to_string(status));
+        return false;
+    }
+
+    MMAL_PORT_T* input = m_Decoder->input[0];
+    input->format->type = MMAL_ES_TYPE_VIDEO;
+    input->format->encoding = MMAL_ENCODING_H264;
+    input->format->flags |= MMAL_ES_FORMAT_FLAG_FRAMED;
+    input->format->es->video.width = VCOS_ALIGN_UP(params->width, 32);
+    input->format->es->video.height = VCOS_ALIGN_UP(params->height, 16);
+    input->format->es->video.crop.x = 0;
+    input->format->es->video.crop.y = 0;
+    input->format->es->video.crop.width = params->width;
+    input->format->es->video.crop.height = params->height;
+    input->format->es->video.frame_rate.num = params->frameRate;
+    input->format->es->video.frame_rate.den = 1;
+    status = mmal_port_format_commit(input);
+    if (status != MMAL_SUCCESS) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "mmal_port_format_commit() failed: %x (%s)",
+                     status, mmal_status_to_string(status));
+        return false;
+    }
+
+    // We don't have timestamps and we want each frame displayed as soon
+    // as it is decoded, rather than with some interpolated timing.
+    mmal_port_parameter_set_boolean(input, MMAL_PARAMETER_VIDEO_INTERPOLATE_TIMESTAMPS, MMAL_FALSE);
+    mmal_port_parameter_set_boolean(input, MMAL_PARAMETER_NO_IMAGE_PADDING, MMAL_TRUE);
+
+    // Don't display concealed frames. We'll get an IDR frame or reference
+    // frame invalidation from the host instead.
+    mmal_port_parameter_set_boolean(input, MMAL_PARAMETER_VIDEO_DECODE_ERROR_CONCEALMENT, MMAL_FALSE);
+
+    // Avoid a copy of each input buffer into VideoCore memory
+    mmal_port_parameter_set_boolean(input, MMAL_PARAMETER_ZERO_COPY, MMAL_TRUE);
+
+    MMAL_PORT_T* output = m_Decoder->output[0];
+    mmal_format_copy(output->format, input->format);
+    output->format->encoding = MMAL_ENCODING_OPAQUE;
+    status = mmal_port_format_commit(output);
+    if (status != MMAL_SUCCESS) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "mmal_port_format_commit() failed: %x (%s)",
+                     status, mmal_status_to_string(status));
+        return false;
+    }
+
+    status = mmal_component_create(MMAL_COMPONENT_DEFAULT_VIDEO_RENDERER, &m_Renderer);
+    if (status != MMAL_SUCCESS) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "mmal_component_create() failed: %x (%s)",
+                     status, mmal_status_to_string(status));
+        return false;
+    }
+
+    // Decoded frames go straight from the decoder to the renderer
+    status = mmal_connection_create(&m_Connection, output, m_Renderer->input[0],
+                                    MMAL_CONNECTION_FLAG_TUNNELLING |
+                                    MMAL_CONNECTION_FLAG_ALLOCATION_ON_INPUT);
+    if (status != MMAL_SUCCESS) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "mmal_connection_create() failed: %x (%s)",
+                     status, mmal_status_to_string(status));
+        return false;
+    }
+
+    if (!setDisplayRegion(params)) {
+        return false;
+    }
+
+    input->buffer_num = SDL_max(input->buffer_num_min, INPUT_BUFFER_COUNT);
+    input->buffer_size = SDL_max(input->buffer_size_min, INPUT_BUFFER_SIZE);
+    m_InputPool = mmal_port_pool_create(input, input->buffer_num, input->buffer_size);
+    if (m_InputPool == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "mmal_port_pool_create() failed");
+        return false;
+    }
+
+    status = mmal_port_enable(input, inputPortCallback);
+    if (status != MMAL_SUCCESS) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "mmal_port_enable() failed: %x (%s)",
+                     status, mmal_status_to_string(status));
+        return false;
+    }
+
+    status = mmal_connection_enable(m_Connection);
+    if (status != MMAL_SUCCESS) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "mmal_connection_enable() failed: %x (%s)",
+                     status, mmal_status_to_string(status));
+        return false;
+    }
+
+    // Enabling the components allocates their VideoCore memory, so this
+    // will fail here if the GPU memory split is too small to decode.
+    status = mmal_component_enable(m_Decoder);
+    if (status != MMAL_SUCCESS) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "mmal_component_enable() failed: %x (%s)",
+                     status, mmal_status_to_string(status));
+        return false;
+    }
+
+    status = mmal_component_enable(m_Renderer);
+    if (status != MMAL_SUCCESS) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "mmal_component_enable() failed: %x (%s)",
+                     status, mmal_status_to_string(status));
+        return false;
+    }
+
+    // The host never uses reference frame invalidation with us
+    return m_VideoStats.start(params->frameRate, false);
+}
+
+bool
+MmalVideoDecoder::reinitializePresentation(PDECODER_PARAMETERS params)
+{
+    // The renderer draws to its own display layer, so only the
+    // destination rectangle depends on the window.
+    return setDisplayRegion(params);
+}
+
+bool
+MmalVideoDecoder::notifyWindowResized(PDECODER_PARAMETERS params)
+{
+    // The display region can be changed while the renderer is running
+    return setDisplayRegion(params);
+}
+
+bool
+MmalVideoDecoder::setDisplayRegion(PDECODER_PARAMETERS params)
+{
+    MMAL_DISPLAYREGION_T dr = {};
+    MMAL_STATUS_T status;
+
+    dr.hdr.id = MMAL_PARAMETER_DISPLAYREGION;
+    dr.hdr.size = sizeof(MMAL_DISPLAYREGION_T);
+
+    dr.set = MMAL_DISPLAY_SET_LAYER;
+    dr.layer = 128;
+
+    dr.set |= MMAL_DISPLAY_SET_ALPHA;
+    dr.alpha = 255;
+
+    dr.set |= MMAL_DISPLAY_SET_FULLSCREEN;
+    dr.fullscreen = (SDL_GetWindowFlags(params->window) & SDL_WINDOW_FULLSCREEN) != 0;
+
+    {
+        SDL_Rect src, dst;
+        src.x = src.y = 0;
+        src.w = params->width;
+        src.h = params->height;
+        dst.x = dst.y = 0;
+        SDL_GetWindowSize(params->window, &dst.w, &dst.h);
+
+        StreamUtils::scaleSourceToDestinationSurface(&src, &dst);
+
+        dr.set |= MMAL_DISPLAY_SET_DEST_RECT;
+        dr.dest_rect.x = dst.x;
+        dr.dest_rect.y = dst.y;
+        dr.dest_rect.width = dst.w;
+        dr.dest_rect.height = dst.h;
+    }
+
+    status = mmal_port_parameter_set(m_Renderer->input[0], &dr.hdr);
+    if (status != MMAL_SUCCESS) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "mmal_port_parameter_set() failed: %x (%s)",
+                     status, mmal_status_to_string(status));
+        return false;
+    }
+
+    return true;
+}
+
+MMAL_BUFFER_HEADER_T*
+MmalVideoDecoder::getInputBuffer()
+{
+    MMAL_BUFFER_HEADER_T* buffer;
+
+    buffer = mmal_queue_timedwait(m_InputPool->queue, INPUT_BUFFER_TIMEOUT_MS);
+    if (buffer == nullptr) {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Timed out waiting for an MMAL input buffer");
+        return nullptr;
+    }
+
+    mmal_buffer_header_reset(buffer);
+    buffer->flags = 0;
+    buffer->pts = buffer->dts = MMAL_TIME_UNKNOWN;
+    return buffer;
+}
+
+int
+MmalVideoDecoder::submitDecodeUnit(PDECODE_UNIT du)
+{
+    m_VideoStats.reportDecodeUnit(du);
+
+    // Only the submission is ours to time, since the frames are decoded and
+    // rendered inside VideoCore
+    Uint64 submitStartUs = StreamUtils::getTimeUs();
+    int ret = submitFrame(du);
+    if (ret == DR_NEED_IDR) {
+        m_VideoStats.getActiveWindowStats()->idrRequests++;
+    }
+    else {
+        m_VideoStats.reportSubmitTime(StreamUtils::getTimeUs() - submitStartUs);
+    }
+
+    return ret;
+}
+
+bool
+MmalVideoDecoder::getGlobalVideoStats(VIDEO_STATS& stats)
+{
+    m_VideoStats.getGlobalVideoStats(stats);
+    return true;
+}
+
+bool
+MmalVideoDecoder::getLiveVideoStats(VIDEO_STATS& stats)
+{
+    m_VideoStats.getPublishedVideoStats(stats);
+    return true;
+}
+
+int
+MmalVideoDecoder::submitFrame(PDECODE_UNIT du)
+{
+    MMAL_STATUS_T status;
+
+    if (SDL_AtomicGet(&m_DecoderError)) {
+        // Only an IDR frame will get the decoder back on track
+        if (du->frameType != FRAME_TYPE_IDR) {
+            return DR_NEED_IDR;
+        }
+
+        SDL_AtomicSet(&m_DecoderError, 0);
+    }
+
+    MMAL_BUFFER_HEADER_T* buffer = getInputBuffer();
+    if (buffer == nullptr) {
+        return DR_NEED_IDR;
+    }
+
+    buffer->flags = MMAL_BUFFER_HEADER_FLAG_FRAME_START;
+
+    // Copy each entry straight into the decoder's input buffers,
+    // sending a buffer on each time it fills up.
+    for (PLENTRY entry = du->bufferList; entry != nullptr; entry = entry->next) {
+        const char* data = entry->data;
+        uint32_t remaining = (uint32_t)entry->length;
+
+        while (remaining > 0) {
+            if (buffer->length == buffer->alloc_size) {
+                status = mmal_port_send_buffer(m_Decoder->input[0], buffer);
+                if (status != MMAL_SUCCESS) {
+                    SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                                 "mmal_port_send_buffer() failed: %x (%s)",
+                                 status, mmal_status_to_string(status));
+                    mmal_buffer_header_release(buffer);
+                    return DR_NEED_IDR;
+                }
+
+                buffer = getInputBuffer();
+                if (buffer == nullptr) {
+                    return DR_NEED_IDR;
+                }
+            }
+
+            uint32_t length = SDL_min(remaining, buffer->alloc_size - buffer->length);
+            memcpy(buffer->data + buffer->length, data, length);
+            buffer->length += length;
+            data += length;
+            remaining -= length;
+        }
+    }
+
+    buffer->flags |= MMAL_BUFFER_HEADER_FLAG_FRAME_END;
+    status = mmal_port_send_buffer(m_Decoder->input[0], buffer);
+    if (status != MMAL_SUCCESS) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "mmal_port_send_buffer() failed: %x (%s)",
+                     status, mmal_status_to_string(status));
+        mmal_buffer_header_release(buffer);
+        return DR_NEED_IDR;
+    }
+
+    return DR_OK;
+}
+
+void MmalVideoDecoder::inputPortCallback(MMAL_PORT_T*, MMAL_BUFFER_HEADER_T* buffer)
+{
+    // Return the buffer to m_InputPool
+    mmal_buffer_header_release(buffer);
+}
+
+void MmalVideoDecoder::controlPortCallback(MMAL_PORT_T* port, MMAL_BUFFER_HEADER_T* buffer)
+{
+    MmalVideoDecoder* me = (MmalVideoDecoder*)port->userdata;
+
+    if (buffer->cmd == MMAL_EVENT_ERROR) {
+        MMAL_STATUS_T status = *(MMAL_STATUS_T*)buffer->data;
+
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "MMAL decoder error: %x (%s)",
+                    status, mmal_status_to_string(status));
+        SDL_AtomicSet(&me->m_DecoderError, 1);
+    }
+
+    mmal_buffer_header_release(buffer);
+}
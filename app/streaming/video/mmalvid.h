@@ -0,0 +1,48 @@
+#pragma once
+
+#include "decoder.h"
+#include "videostats.h"
+
+#include <interface/mmal/mmal.h>
+#include <interface/mmal/util/mmal_util.h>
+#include <interface/mmal/util/mmal_util_params.h>
+#include <interface/mmal/util/mmal_connection.h>
+#include <interface/mmal/util/mmal_default_components.h>
+
+// Feeds decode units straight into the VideoCore decoder, which is
+// tunnelled to the video renderer without FFmpeg or the host CPU
+// ever touching the decoded frames.
+class MmalVideoDecoder : public IVideoDecoder
+{
+public:
+    MmalVideoDecoder(bool testOnly);
+    virtual ~MmalVideoDecoder();
+    virtual bool initialize(PDECODER_PARAMETERS params);
+    virtual bool isHardwareAccelerated();
+    virtual int getDecoderCapabilities();
+    virtual int submitDecodeUnit(PDECODE_UNIT du);
+    virtual bool reinitializePresentation(PDECODER_PARAMETERS params);
+    virtual bool notifyWindowResized(PDECODER_PARAMETERS params);
+    virtual bool getGlobalVideoStats(VIDEO_STATS& stats);
+    virtual bool getLiveVideoStats(VIDEO_STATS& stats);
+
+    // Unused since rendering is done by the tunnelled renderer component
+    virtual void renderFrameOnMainThread() {}
+
+private:
+    static void inputPortCallback(MMAL_PORT_T* port, MMAL_BUFFER_HEADER_T* buffer);
+    static void controlPortCallback(MMAL_PORT_T* port, MMAL_BUFFER_HEADER_T* buffer);
+
+    bool setDisplayRegion(PDECODER_PARAMETERS params);
+    int submitFrame(PDECODE_UNIT du);
+    MMAL_BUFFER_HEADER_T* getInputBuffer();
+
+    MMAL_COMPONENT_T* m_Decoder;
+    MMAL_COMPONENT_T* m_Renderer;
+    MMAL_CONNECTION_T* m_Connection;
+    MMAL_POOL_T* m_InputPool;
+    VideoStatsCollector m_VideoStats;
+
+    // Set from the control port callback when the decoder reports an error
+    SDL_atomic_t m_DecoderError;
+};
@@ -0,0 +1,55 @@
+#include "nullvid.h"
+
+NullVideoDecoder::NullVideoDecoder(bool)
+{
+}
+
+NullVideoDecoder::~NullVideoDecoder()
+{
+    m_VideoStats.stop();
+    m_VideoStats.logGlobalVideoStats();
+}
+
+bool
+NullVideoDecoder::isHardwareAccelerated()
+{
+    // Nothing is decoded on the CPU, so codec selection shouldn't
+    // steer away from anything because of us
+    return true;
+}
+
+int
+NullVideoDecoder::getDecoderCapabilities()
+{
+    // Discarding a frame is cheaper than queuing it
+    return CAPABILITY_DIRECT_SUBMIT;
+}
+
+bool
+NullVideoDecoder::initialize(PDECODER_PARAMETERS params)
+{
+    // The windows still feed the metrics exporter and bitrate controller
+    return m_VideoStats.start(params->frameRate, false);
+}
+
+int
+NullVideoDecoder::submitDecodeUnit(PDECODE_UNIT du)
+{
+    m_VideoStats.reportDecodeUnit(du);
+
+    return DR_OK;
+}
+
+bool
+NullVideoDecoder::getGlobalVideoStats(VIDEO_STATS& stats)
+{
+    m_VideoStats.getGlobalVideoStats(stats);
+    return true;
+}
+
+bool
+NullVideoDecoder::getLiveVideoStats(VIDEO_STATS& stats)
+{
+    m_VideoStats.getPublishedVideoStats(stats);
+    return true;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "decoder.h"
+#include "videostats.h"
+
+// Counts decode units the way the other decoders do and throws them
+// away, so a headless stream only costs what receiving it does
+class NullVideoDecoder : public IVideoDecoder
+{
+public:
+    NullVideoDecoder(bool testOnly);
+    virtual ~NullVideoDecoder();
+    virtual bool initialize(PDECODER_PARAMETERS params);
+    virtual bool isHardwareAccelerated();
+    virtual int getDecoderCapabilities();
+    virtual int submitDecodeUnit(PDECODE_UNIT du);
+    virtual bool getGlobalVideoStats(VIDEO_STATS& stats);
+    virtual bool getLiveVideoStats(VIDEO_STATS& stats);
+
+    // Unused since nothing is ever rendered
+    virtual void renderFrameOnMainThread() {}
+
+private:
+    VideoStatsCollector m_VideoStats;
+};
@@ -1,9 +1,11 @@
 #include "overlaymanager.h"
+#include "path.h"
 
 using namespace Overlay;
 
 OverlayManager::OverlayManager() :
-    m_Renderer(nullptr)
+    m_Renderer(nullptr),
+    m_TtfInitialized(false)
 {
     memset(m_Overlays, 0, sizeof(m_Overlays));
 
@@ -12,6 +14,27 @@ OverlayManager::OverlayManager() :
 
     m_Overlays[OverlayType::OverlayStatusUpdate].color = {0xCC, 0x00, 0x00, 0xFF};
     m_Overlays[OverlayType::OverlayStatusUpdate].fontSize = 36;
+
+    m_RasterizerLock = SDL_CreateMutex();
+}
+
+OverlayManager::~OverlayManager()
+{
+    for (int i = 0; i < OverlayType::OverlayMax; i++) {
+        if (m_Overlays[i].surface != nullptr) {
+            SDL_FreeSurface(m_Overlays[i].surface);
+        }
+
+        if (m_Overlays[i].font != nullptr) {
+            TTF_CloseFont(m_Overlays[i].font);
+        }
+    }
+
+    if (m_TtfInitialized) {
+        TTF_Quit();
+    }
+
+    SDL_DestroyMutex(m_RasterizerLock);
 }
 
 bool OverlayManager::isOverlayEnabled(OverlayType type)
@@ -19,9 +42,26 @@ bool OverlayManager::isOverlayEnabled(OverlayType type)
     return m_Overlays[type].enabled;
 }
 
-char* OverlayManager::getOverlayText(OverlayType type)
+unsigned int OverlayManager::getOverlayText(OverlayType type, char* buffer, int bufferSize)
+{
+    int startSequence, endSequence;
+
+    SDL_assert(bufferSize > 0);
+
+    // The writer never waits for us, so retry if it published a new buffer
+    // and started writing into ours again while we were copying it.
+    do {
+        startSequence = SDL_AtomicGet(&m_Overlays[type].sequence);
+        SDL_strlcpy(buffer, m_Overlays[type].text[(startSequence >> 1) & 1], bufferSize);
+        endSequence = SDL_AtomicGet(&m_Overlays[type].sequence);
+    } while (endSequence > (startSequence | 1) + 1);
+
+    return (unsigned int)endSequence >> 1;
+}
+
+unsigned int OverlayManager::getOverlayTextGeneration(OverlayType type)
 {
-    return m_Overlays[type].text;
+    return (unsigned int)SDL_AtomicGet(&m_Overlays[type].sequence) >> 1;
 }
 
 int OverlayManager::getOverlayFontSize(OverlayType type)
@@ -29,12 +69,38 @@ int OverlayManager::getOverlayFontSize(OverlayType type)
     return m_Overlays[type].fontSize;
 }
 
-void OverlayManager::setOverlayTextUpdated(OverlayType type)
+bool OverlayManager::publishOverlayText(OverlayType type, const char* text)
 {
-    // Only update the overlay state if it's enabled. If it's not enabled,
-    // the renderer has already been notified by setOverlayState().
-    if (m_Overlays[type].enabled && m_Renderer != nullptr) {
-        m_Renderer->notifyOverlayUpdated(type);
+    bool changed = false;
+
+    SDL_AtomicLock(&m_Overlays[type].writerLock);
+
+    // Other writers are locked out, so the front buffer is stable here
+    int sequence = SDL_AtomicGet(&m_Overlays[type].sequence);
+    if (SDL_strcmp(m_Overlays[type].text[(sequence >> 1) & 1], text) != 0) {
+        char* backBuffer = m_Overlays[type].text[((sequence >> 1) + 1) & 1];
+
+        // An odd sequence tells readers that the back buffer is being written.
+        // Readers of the front buffer are unaffected unless they're too slow
+        // to finish before the next update starts on their buffer again.
+        SDL_AtomicIncRef(&m_Overlays[type].sequence);
+        SDL_strlcpy(backBuffer, text, OVERLAY_TEXT_SIZE);
+        SDL_AtomicIncRef(&m_Overlays[type].sequence);
+        changed = true;
+    }
+
+    SDL_AtomicUnlock(&m_Overlays[type].writerLock);
+
+    return changed;
+}
+
+void OverlayManager::updateOverlayText(OverlayType type, const char* text)
+{
+    // Only notify the renderer if the text changed and the overlay is
+    // enabled. If it's not enabled, the renderer will be notified by
+    // setOverlayState() when it is.
+    if (publishOverlayText(type, text) && m_Overlays[type].enabled) {
+        notifyOverlayUpdated(type);
     }
 }
 
@@ -47,12 +113,10 @@ void OverlayManager::setOverlayState(OverlayType type, bool enabled)
     if (stateChanged) {
         if (!enabled) {
             // Set the text to empty string on disable
-            m_Overlays[type].text[0] = 0;
+            publishOverlayText(type, "");
         }
 
-        if (m_Renderer != nullptr) {
-            m_Renderer->notifyOverlayUpdated(type);
-        }
+        notifyOverlayUpdated(type);
     }
 }
 
@@ -65,3 +129,122 @@ void OverlayManager::setOverlayRenderer(IOverlayRenderer* renderer)
 {
     m_Renderer = renderer;
 }
+
+SDL_Surface* OverlayManager::getUpdatedOverlaySurface(OverlayType type)
+{
+    SDL_Surface* surface;
+
+    do {
+        surface = (SDL_Surface*)SDL_AtomicGetPtr((void**)&m_Overlays[type].surface);
+    } while (!SDL_AtomicCASPtr((void**)&m_Overlays[type].surface, surface, nullptr));
+
+    return surface;
+}
+
+void OverlayManager::notifyOverlayUpdated(OverlayType type)
+{
+    if (m_Renderer == nullptr) {
+        return;
+    }
+
+    // Rasterize the overlay here, on the thread that updated it, so the
+    // renderer only has to upload and blend the finished surface.
+    if (m_Overlays[type].enabled && m_Renderer->usesOverlaySurfaces() && type != OverlayFrameGraph) {
+        SDL_Surface* newSurface = rasterizeOverlay(type);
+        if (newSurface != nullptr) {
+            SDL_Surface* oldSurface;
+
+            // Replace any surface that the renderer hasn't picked up yet
+            do {
+                oldSurface = (SDL_Surface*)SDL_AtomicGetPtr((void**)&m_Overlays[type].surface);
+            } while (!SDL_AtomicCASPtr((void**)&m_Overlays[type].surface, oldSurface, newSurface));
+
+            if (oldSurface != nullptr) {
+                SDL_FreeSurface(oldSurface);
+            }
+        }
+    }
+
+    m_Renderer->notifyOverlayUpdated(type);
+}
+
+SDL_Surface* OverlayManager::rasterizeOverlay(OverlayType type)
+{
+    SDL_Surface* surface = nullptr;
+
+    // Overlays can be updated from several threads, but SDL_ttf isn't thread-safe
+    SDL_LockMutex(m_RasterizerLock);
+
+    if (!m_TtfInitialized) {
+        if (TTF_Init() != 0) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "TTF_Init() failed: %s",
+                        TTF_GetError());
+            goto Exit;
+        }
+
+        m_TtfInitialized = true;
+        m_FontData = Path::readDataFile("ModeSeven.ttf");
+    }
+
+    // Construct the required font to render the overlay
+    if (m_Overlays[type].font == nullptr) {
+        if (m_FontData.isEmpty()) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "Overlay font failed to load");
+            goto Exit;
+        }
+
+        // m_FontData must stay around until the font is closed
+        m_Overlays[type].font = TTF_OpenFontRW(SDL_RWFromConstMem(m_FontData.constData(), m_FontData.size()),
+                                               1,
+                                               m_Overlays[type].fontSize);
+        if (m_Overlays[type].font == nullptr) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "TTF_OpenFont() failed: %s",
+                        TTF_GetError());
+            goto Exit;
+        }
+    }
+
+    {
+        char text[OVERLAY_TEXT_SIZE];
+
+        getOverlayText(type, text, sizeof(text));
+
+        // The _Wrapped variant is required for line breaks to work
+        SDL_Surface* textSurface = TTF_RenderText_Blended_Wrapped(m_Overlays[type].font,
+                                                                  text,
+                                                                  m_Overlays[type].color,
+                                                                  1000);
+        if (textSurface == nullptr) {
+            goto Exit;
+        }
+
+        // We document the output as ARGB8888, so don't rely on SDL_ttf's choice
+        surface = SDL_ConvertSurfaceFormat(textSurface, SDL_PIXELFORMAT_ARGB8888, 0);
+        SDL_FreeSurface(textSurface);
+        if (surface == nullptr) {
+            goto Exit;
+        }
+    }
+
+    // Premultiply alpha so renderers can blend with (ONE, ONE_MINUS_SRC_ALPHA)
+    // and hand the buffer directly to hardware planes that expect it.
+    for (int y = 0; y < surface->h; y++) {
+        Uint32* row = (Uint32*)((Uint8*)surface->pixels + (y * surface->pitch));
+
+        for (int x = 0; x < surface->w; x++) {
+            Uint32 a = row[x] >> 24;
+            Uint32 r = (((row[x] >> 16) & 0xFF) * a + 127) / 255;
+            Uint32 g = (((row[x] >> 8) & 0xFF) * a + 127) / 255;
+            Uint32 b = ((row[x] & 0xFF) * a + 127) / 255;
+
+            row[x] = (a << 24) | (r << 16) | (g << 8) | b;
+        }
+    }
+
+Exit:
+    SDL_UnlockMutex(m_RasterizerLock);
+    return surface;
+}
@@ -1,14 +1,22 @@
 #pragma once
 
 #include <QString>
+#include <QByteArray>
 
 #include <SDL.h>
+#include <SDL_ttf.h>
+
+// Maximum overlay text length, including the null terminator
+#define OVERLAY_TEXT_SIZE 2048
 
 namespace Overlay {
 
 enum OverlayType {
     OverlayDebug,
     OverlayStatusUpdate,
+
+    // Has no text. The renderers that support it draw it from FrameGraph.
+    OverlayFrameGraph,
     OverlayMax
 };
 
@@ -18,29 +26,65 @@ public:
     virtual ~IOverlayRenderer() = default;
 
     virtual void notifyOverlayUpdated(OverlayType type) = 0;
+
+    // Renderers that draw the overlay text themselves return false here
+    // to skip rasterizing it into overlay surfaces.
+    virtual bool usesOverlaySurfaces() = 0;
 };
 
 class OverlayManager
 {
 public:
     OverlayManager();
+    ~OverlayManager();
 
     bool isOverlayEnabled(OverlayType type);
-    char* getOverlayText(OverlayType type);
-    void setOverlayTextUpdated(OverlayType type);
+
+    // Replaces the overlay text and notifies the renderer if it changed.
+    // Writers only wait for other writers of the same overlay, never for
+    // the threads reading it.
+    void updateOverlayText(OverlayType type, const char* text);
+
+    // Copies the current overlay text into the buffer and returns its
+    // generation, which changes each time the text does.
+    unsigned int getOverlayText(OverlayType type, char* buffer, int bufferSize);
+    unsigned int getOverlayTextGeneration(OverlayType type);
+
     void setOverlayState(OverlayType type, bool enabled);
     SDL_Color getOverlayColor(OverlayType type);
     int getOverlayFontSize(OverlayType type);
 
+    // Returns the most recently rasterized overlay as a premultiplied
+    // ARGB8888 surface and transfers ownership of it to the caller.
+    // Returns nullptr if the overlay hasn't changed since the last call.
+    SDL_Surface* getUpdatedOverlaySurface(OverlayType type);
+
     void setOverlayRenderer(IOverlayRenderer* renderer);
 
+private:
+    void notifyOverlayUpdated(OverlayType type);
+    bool publishOverlayText(OverlayType type, const char* text);
+
+    SDL_Surface* rasterizeOverlay(OverlayType type);
+
     struct {
         bool enabled;
         int fontSize;
         SDL_Color color;
-        char text[512];
+
+        // Double-buffered under a seqlock. The sequence is odd while the
+        // back buffer is written, and the front buffer is text[(sequence >> 1) & 1].
+        char text[2][OVERLAY_TEXT_SIZE];
+        SDL_atomic_t sequence;
+        SDL_SpinLock writerLock;
+
+        TTF_Font* font;
+        SDL_Surface* surface;
     } m_Overlays[OverlayMax];
     IOverlayRenderer* m_Renderer;
+    QByteArray m_FontData;
+    bool m_TtfInitialized;
+    SDL_mutex* m_RasterizerLock;
 };
 
 }
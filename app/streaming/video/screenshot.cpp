@@ -0,0 +1,169 @@
+#include "screenshot.h"
+#include "path.h"
+
+#include <QDateTime>
+#include <QDir>
+
+#include <SDL.h>
+
+extern "C" {
+#include <libavutil/hwcontext.h>
+}
+
+bool Screenshot::convertSoftwareFrame(const AVFrame* frame, QImage& image)
+{
+    bool fullRange = frame->color_range == AVCOL_RANGE_JPEG;
+
+    switch (frame->format) {
+    case AV_PIX_FMT_YUVJ420P:
+        fullRange = true;
+        break;
+    case AV_PIX_FMT_YUV420P:
+    case AV_PIX_FMT_NV12:
+    case AV_PIX_FMT_P010:
+        break;
+    default:
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                    "Screenshots aren't supported for pixel format %d",
+                    frame->format);
+        return false;
+    }
+
+    // Luma weights of red and blue for the frame's colorspace
+    float kr, kb;
+    switch (frame->colorspace) {
+    case AVCOL_SPC_BT709:
+        kr = 0.2126f;
+        kb = 0.0722f;
+        break;
+    case AVCOL_SPC_BT2020_NCL:
+        kr = 0.2627f;
+        kb = 0.0593f;
+        break;
+    default:
+        kr = 0.299f;
+        kb = 0.114f;
+        break;
+    }
+    float kg = 1.0f - kr - kb;
+
+    float lumaOffset = fullRange ? 0.0f : 16.0f;
+    float lumaScale = fullRange ? 1.0f / 255.0f : 1.0f / 219.0f;
+    float chromaScale = fullRange ? 1.0f / 255.0f : 1.0f / 224.0f;
+
+    image = QImage(frame->width, frame->height, QImage::Format_RGB32);
+    if (image.isNull()) {
+        return false;
+    }
+
+    for (int y = 0; y < frame->height; y++) {
+        const uint8_t* lumaRow = frame->data[0] + y * frame->linesize[0];
+        const uint8_t* chromaRow1 = frame->data[1] + (y / 2) * frame->linesize[1];
+        const uint8_t* chromaRow2 = frame->data[2] != nullptr ?
+                    frame->data[2] + (y / 2) * frame->linesize[2] : nullptr;
+        QRgb* out = (QRgb*)image.scanLine(y);
+
+        for (int x = 0; x < frame->width; x++) {
+            int luma, cb, cr;
+
+            // 10-bit samples are cut down to 8 bits, and HDR isn't tone mapped
+            switch (frame->format) {
+            case AV_PIX_FMT_NV12:
+                luma = lumaRow[x];
+                cb = chromaRow1[x & ~1];
+                cr = chromaRow1[x | 1];
+                break;
+            case AV_PIX_FMT_P010:
+                luma = ((const uint16_t*)lumaRow)[x] >> 8;
+                cb = ((const uint16_t*)chromaRow1)[x & ~1] >> 8;
+                cr = ((const uint16_t*)chromaRow1)[x | 1] >> 8;
+                break;
+            default:
+                luma = lumaRow[x];
+                cb = chromaRow1[x / 2];
+                cr = chromaRow2[x / 2];
+                break;
+            }
+
+            float yf = (luma - lumaOffset) * lumaScale;
+            float uf = (cb - 128) * chromaScale;
+            float vf = (cr - 128) * chromaScale;
+
+            float r = yf + 2.0f * (1.0f - kr) * vf;
+            float b = yf + 2.0f * (1.0f - kb) * uf;
+            float g = (yf - kr * r - kb * b) / kg;
+
+            out[x] = qRgb(qBound(0, (int)(r * 255.0f + 0.5f), 255),
+                          qBound(0, (int)(g * 255.0f + 0.5f), 255),
+                          qBound(0, (int)(b * 255.0f + 0.5f), 255));
+        }
+    }
+
+    return true;
+}
+
+bool Screenshot::convertFrame(const AVFrame* frame, QImage& image)
+{
+    if (frame->hw_frames_ctx == nullptr) {
+        return convertSoftwareFrame(frame, image);
+    }
+
+    AVFrame* swFrame = av_frame_alloc();
+    if (swFrame == nullptr) {
+        return false;
+    }
+
+    // Mapping avoids a copy where the hardware allows it
+    swFrame->format = AV_PIX_FMT_NONE;
+    if (av_hwframe_map(swFrame, frame, AV_HWFRAME_MAP_READ) < 0) {
+        av_frame_unref(swFrame);
+        int err = av_hwframe_transfer_data(swFrame, frame, 0);
+        if (err < 0) {
+            char errorstring[512];
+            av_strerror(err, errorstring, sizeof(errorstring));
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "Unable to read back frame for screenshot: %s",
+                         errorstring);
+            av_frame_free(&swFrame);
+            return false;
+        }
+    }
+
+    // Downloaded frames don't carry these over
+    swFrame->color_range = frame->color_range;
+    swFrame->colorspace = frame->colorspace;
+
+    bool ret = convertSoftwareFrame(swFrame, image);
+    av_frame_free(&swFrame);
+    return ret;
+}
+
+bool Screenshot::save(const AVFrame* frame)
+{
+    QImage image;
+    if (!convertFrame(frame, image)) {
+        return false;
+    }
+
+    QDir dir(Path::getScreenshotDir());
+    if (!dir.mkpath(".")) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unable to create %s",
+                     qPrintable(dir.path()));
+        return false;
+    }
+
+    QString path = dir.filePath(QString("Moonlight-%1.png")
+                                .arg(QDateTime::currentDateTime().toString("yyyyMMdd-HHmmss-zzz")));
+    if (!image.save(path, "PNG")) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "Unable to save screenshot to %s",
+                     qPrintable(path));
+        return false;
+    }
+
+    SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                "Saved screenshot to %s",
+                qPrintable(path));
+    return true;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <QImage>
+#include <QString>
+
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+// Turns decoded frames into images. This copies and converts every pixel
+// on the CPU, so it belongs on a worker thread and not the render path.
+class Screenshot
+{
+public:
+    // Frames on a GPU surface are mapped or downloaded first. Returns
+    // false if the frame's format can't be converted.
+    static bool convertFrame(const AVFrame* frame, QImage& image);
+
+    // Saves the frame as a PNG in the screenshot folder
+    static bool save(const AVFrame* frame);
+
+private:
+    static bool convertSoftwareFrame(const AVFrame* frame, QImage& image);
+};
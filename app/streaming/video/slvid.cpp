@@ -1,5 +1,7 @@
 #include "slvid.h"
 
+#include "streaming/streamutils.h"
+
 SLVideoDecoder::SLVideoDecoder(bool)
     : m_VideoContext(nullptr),
       m_VideoStream(nullptr)
@@ -9,6 +11,9 @@ SLVideoDecoder::SLVideoDecoder(bool)
 
 SLVideoDecoder::~SLVideoDecoder()
 {
+    m_VideoStats.stop();
+    m_VideoStats.logGlobalVideoStats();
+
     if (m_VideoStream != nullptr) {
         SLVideo_FreeStream(m_VideoStream);
     }
@@ -28,7 +33,9 @@ SLVideoDecoder::isHardwareAccelerated()
 int
 SLVideoDecoder::getDecoderCapabilities()
 {
-    return 0;
+    // SLVideo just streams the frame data to the decoder, so we can
+    // submit directly from the receive thread.
+    return CAPABILITY_DIRECT_SUBMIT;
 }
 
 bool
@@ -61,11 +68,45 @@ SLVideoDecoder::initialize(PDECODER_PARAMETERS params)
 
     SLVideo_SetStreamTargetFramerate(m_VideoStream, params->frameRate, 1);
 
-    return true;
+    // SLVideo doesn't do reference frame invalidation
+    return m_VideoStats.start(params->frameRate, false);
 }
 
 int
 SLVideoDecoder::submitDecodeUnit(PDECODE_UNIT du)
+{
+    m_VideoStats.reportDecodeUnit(du);
+
+    // Only the submission is ours to time, since SLVideo decodes and renders
+    // the frames itself
+    Uint64 submitStartUs = StreamUtils::getTimeUs();
+    int ret = submitFrame(du);
+    if (ret == DR_NEED_IDR) {
+        m_VideoStats.getActiveWindowStats()->idrRequests++;
+    }
+    else {
+        m_VideoStats.reportSubmitTime(StreamUtils::getTimeUs() - submitStartUs);
+    }
+
+    return ret;
+}
+
+bool
+SLVideoDecoder::getGlobalVideoStats(VIDEO_STATS& stats)
+{
+    m_VideoStats.getGlobalVideoStats(stats);
+    return true;
+}
+
+bool
+SLVideoDecoder::getLiveVideoStats(VIDEO_STATS& stats)
+{
+    m_VideoStats.getPublishedVideoStats(stats);
+    return true;
+}
+
+int
+SLVideoDecoder::submitFrame(PDECODE_UNIT du)
 {
     int err;
 
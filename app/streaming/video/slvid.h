@@ -1,6 +1,7 @@
 #pragma once
 
 #include "decoder.h"
+#include "videostats.h"
 
 #include <SLVideo.h>
 
@@ -13,6 +14,8 @@ public:
     virtual bool isHardwareAccelerated();
     virtual int getDecoderCapabilities();
     virtual int submitDecodeUnit(PDECODE_UNIT du);
+    virtual bool getGlobalVideoStats(VIDEO_STATS& stats);
+    virtual bool getLiveVideoStats(VIDEO_STATS& stats);
 
     // Unused since rendering is done directly from the decode thread
     virtual void renderFrameOnMainThread() {}
@@ -20,6 +23,9 @@ public:
 private:
     static void slLogCallback(void* context, ESLVideoLog logLevel, const char* message);
 
+    int submitFrame(PDECODE_UNIT du);
+
     CSLVideoContext* m_VideoContext;
     CSLVideoStream* m_VideoStream;
+    VideoStatsCollector m_VideoStats;
 };
@@ -0,0 +1,629 @@
+#include "videostats.h"
+#include "frametracer.h"
+#include "streaming/avsyncclock.h"
+#include "streaming/metricsexporter.h"
+#include "streaming/bitratecontroller.h"
+#include "streaming/decodeoverloaddetector.h"
+#include "streaming/gpuusage.h"
+#include "streaming/streamutils.h"
+#include "streaming/session.h"
+
+#ifdef HAVE_FFMPEG
+#include "framegraph.h"
+#endif
+
+#include <QtGlobal>
+
+// Frames arriving more than this many frame intervals apart are taken
+// as the host having nothing new to send rather than network jitter
+#define ARRIVAL_JITTER_MAX_GAP_INTERVALS 3
+
+VideoStatsCollector::VideoStatsCollector()
+    : m_LastFrameNumber(0),
+      m_LastArrivalTimeUs(0),
+      m_ArrivalJitterUs(0),
+      m_FrameRate(0),
+      m_SupportsRfi(false),
+      m_StatsThread(nullptr),
+      m_StatsSem(nullptr),
+      m_StatsLock(0)
+{
+    SDL_AtomicSet(&m_StatsThreadStopping, 0);
+
+    SDL_zero(m_ActiveWndVideoStats);
+    SDL_zero(m_LastWndVideoStats);
+    SDL_zero(m_GlobalVideoStats);
+    SDL_zero(m_PublishedGlobalVideoStats);
+}
+
+VideoStatsCollector::~VideoStatsCollector()
+{
+    stop();
+}
+
+bool VideoStatsCollector::start(int frameRate, bool supportsRfi, OverlayDetailsCallback overlayDetails)
+{
+    SDL_assert(m_StatsThread == nullptr);
+
+    m_FrameRate = frameRate;
+    m_SupportsRfi = supportsRfi;
+    m_OverlayDetails = overlayDetails;
+
+    m_StatsSem = SDL_CreateSemaphore(0);
+    if (m_StatsSem == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "SDL_CreateSemaphore() failed: %s",
+                     SDL_GetError());
+        return false;
+    }
+
+    m_StatsThread = SDL_CreateThread(VideoStatsCollector::statsThread, "VideoStats", this);
+    if (m_StatsThread == nullptr) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                     "SDL_CreateThread() failed: %s",
+                     SDL_GetError());
+        return false;
+    }
+
+    return true;
+}
+
+void VideoStatsCollector::stop()
+{
+    // The last window is dropped along with the stats thread, but it's
+    // been counted in the global stats already
+    if (m_StatsThread != nullptr) {
+        SDL_AtomicSet(&m_StatsThreadStopping, 1);
+        SDL_SemPost(m_StatsSem);
+        SDL_WaitThread(m_StatsThread, nullptr);
+        m_StatsThread = nullptr;
+    }
+
+    if (m_StatsSem != nullptr) {
+        SDL_DestroySemaphore(m_StatsSem);
+        m_StatsSem = nullptr;
+    }
+
+    SDL_AtomicSet(&m_StatsThreadStopping, 0);
+    m_OverlayDetails = nullptr;
+}
+
+void VideoStatsCollector::reportDecodeUnit(PDECODE_UNIT du)
+{
+    if (!m_LastFrameNumber) {
+        m_ActiveWndVideoStats.measurementStartTimestamp = SDL_GetTicks();
+        m_LastFrameNumber = du->frameNumber;
+        m_LastArrivalTimeUs = StreamUtils::getTimeUs();
+#ifdef HAVE_FFMPEG
+        FrameGraph::markArrival(du->frameNumber, 0);
+#endif
+    }
+    else {
+        // Any frame number greater than m_LastFrameNumber + 1 represents a dropped frame
+        int lostFrames = du->frameNumber - (m_LastFrameNumber + 1);
+        m_ActiveWndVideoStats.networkDroppedFrames += lostFrames;
+        m_ActiveWndVideoStats.totalFrames += lostFrames;
+        if (lostFrames > 0) {
+            m_ActiveWndVideoStats.lossBursts++;
+            m_ActiveWndVideoStats.maxLossBurst = qMax(m_ActiveWndVideoStats.maxLossBurst, (uint32_t)lostFrames);
+        }
+
+        // Interarrival jitter as in RFC 3550, measured against the nominal
+        // frame interval since the host's frame timestamps don't reach us.
+        // Frames on either side of a loss aren't compared.
+        Uint64 arrivalTimeUs = StreamUtils::getTimeUs();
+        if (m_FrameRate > 0) {
+            Sint64 frameIntervalUs = 1000000 / m_FrameRate;
+            Sint64 deviationUs = (Sint64)(arrivalTimeUs - m_LastArrivalTimeUs) - frameIntervalUs;
+            if (lostFrames == 0 && deviationUs < (ARRIVAL_JITTER_MAX_GAP_INTERVALS - 1) * frameIntervalUs) {
+                m_ArrivalJitterUs += (qAbs(deviationUs) - m_ArrivalJitterUs) / 16;
+            }
+        }
+        m_ActiveWndVideoStats.totalArrivalJitter += m_ArrivalJitterUs;
+#ifdef HAVE_FFMPEG
+        FrameGraph::markArrival(du->frameNumber, arrivalTimeUs - m_LastArrivalTimeUs);
+#endif
+        m_LastArrivalTimeUs = arrivalTimeUs;
+
+        // Without RFI, the first frame after a loss is always an IDR frame.
+        // If we get a P-frame instead, the host invalidated the lost references.
+        if (m_SupportsRfi && du->frameNumber != m_LastFrameNumber + 1 &&
+                du->frameType != FRAME_TYPE_IDR) {
+            m_ActiveWndVideoStats.rfiRecoveries++;
+        }
+
+        if (du->frameType == FRAME_TYPE_IDR) {
+            m_ActiveWndVideoStats.idrFrames++;
+        }
+
+        m_LastFrameNumber = du->frameNumber;
+    }
+
+    // Flip stats windows roughly every second
+    if (SDL_TICKS_PASSED(SDL_GetTicks(), m_ActiveWndVideoStats.measurementStartTimestamp + 1000)) {
+        publishWindowStats();
+
+        // Accumulate these values into the global stats
+        addVideoStats(m_ActiveWndVideoStats, m_GlobalVideoStats);
+
+        SDL_AtomicLock(&m_StatsLock);
+        SDL_memcpy(&m_PublishedGlobalVideoStats, &m_GlobalVideoStats, sizeof(m_GlobalVideoStats));
+        SDL_AtomicUnlock(&m_StatsLock);
+
+        // Move this window into the last window slot and clear it for next window
+        SDL_memcpy(&m_LastWndVideoStats, &m_ActiveWndVideoStats, sizeof(m_ActiveWndVideoStats));
+        SDL_zero(m_ActiveWndVideoStats);
+        m_ActiveWndVideoStats.measurementStartTimestamp = SDL_GetTicks();
+    }
+
+    m_ActiveWndVideoStats.receivedFrames++;
+    m_ActiveWndVideoStats.totalFrames++;
+
+    // The receive time is only reported with millisecond precision. It's
+    // stamped by moonlight-common-c once the FEC queue releases the frame,
+    // so time spent there waiting on parity shards doesn't show up here.
+    Uint64 reassemblyTimeUs = (LiGetMillis() - du->receiveTimeMs) * 1000;
+    m_ActiveWndVideoStats.totalReassemblyTime += reassemblyTimeUs;
+    m_ActiveWndVideoStats.reassemblyTimes.add(reassemblyTimeUs);
+
+    Uint64 now = StreamUtils::getTimeUs();
+    AvSyncClock::markVideoReceived(du->frameNumber, now - reassemblyTimeUs);
+
+    if (FrameTracer::isActive()) {
+        FrameTracer::mark(du->frameNumber, FrameTracer::FTS_RECEIVED, now - reassemblyTimeUs);
+        FrameTracer::mark(du->frameNumber, FrameTracer::FTS_SUBMITTED, now);
+    }
+}
+
+void VideoStatsCollector::reportSubmitTime(Uint64 submitTimeUs)
+{
+    m_ActiveWndVideoStats.submittedFrames++;
+    m_ActiveWndVideoStats.totalSubmitTime += submitTimeUs;
+    m_ActiveWndVideoStats.submitTimes.add(submitTimeUs);
+}
+
+VIDEO_STATS* VideoStatsCollector::getActiveWindowStats()
+{
+    return &m_ActiveWndVideoStats;
+}
+
+void VideoStatsCollector::getGlobalVideoStats(VIDEO_STATS& stats)
+{
+    // Include the window that's still being collected
+    stats = m_GlobalVideoStats;
+    addVideoStats(m_ActiveWndVideoStats, stats);
+}
+
+void VideoStatsCollector::getPublishedVideoStats(VIDEO_STATS& stats)
+{
+    SDL_AtomicLock(&m_StatsLock);
+    SDL_memcpy(&stats, &m_PublishedGlobalVideoStats, sizeof(stats));
+    SDL_AtomicUnlock(&m_StatsLock);
+}
+
+void VideoStatsCollector::logGlobalVideoStats()
+{
+    logVideoStats(m_GlobalVideoStats, m_FrameRate, "Global video stats");
+}
+
+void VideoStatsCollector::addVideoStats(VIDEO_STATS& src, VIDEO_STATS& dst)
+{
+    dst.receivedFrames += src.receivedFrames;
+    dst.decodedFrames += src.decodedFrames;
+    dst.renderedFrames += src.renderedFrames;
+    dst.totalFrames += src.totalFrames;
+    dst.networkDroppedFrames += src.networkDroppedFrames;
+    dst.pacerDroppedFrames += src.pacerDroppedFrames;
+    dst.totalReassemblyTime += src.totalReassemblyTime;
+    dst.totalDecodeTime += src.totalDecodeTime;
+    dst.totalPacerTime += src.totalPacerTime;
+    dst.totalRenderTime += src.totalRenderTime;
+    dst.submittedFrames += src.submittedFrames;
+    dst.totalSubmitTime += src.totalSubmitTime;
+    dst.multiFrameDecodes += src.multiFrameDecodes;
+    dst.queuedDecodeUnits += src.queuedDecodeUnits;
+    dst.totalDecodeQueueDepth += src.totalDecodeQueueDepth;
+    dst.maxDecodeQueueDepth = qMax(dst.maxDecodeQueueDepth, src.maxDecodeQueueDepth);
+    dst.totalDecodeQueueTime += src.totalDecodeQueueTime;
+    dst.idrFrames += src.idrFrames;
+    dst.idrRequests += src.idrRequests;
+    dst.reassemblyTimes.merge(src.reassemblyTimes);
+    dst.decodeTimes.merge(src.decodeTimes);
+    dst.pacerTimes.merge(src.pacerTimes);
+    dst.renderTimes.merge(src.renderTimes);
+    dst.submitTimes.merge(src.submitTimes);
+    dst.rfiRecoveries += src.rfiRecoveries;
+    dst.lossBursts += src.lossBursts;
+    dst.maxLossBurst = qMax(dst.maxLossBurst, src.maxLossBurst);
+    dst.totalArrivalJitter += src.totalArrivalJitter;
+    dst.concealedFrames += src.concealedFrames;
+    dst.totalConcealmentTime += src.totalConcealmentTime;
+    dst.presentLatencySamples += src.presentLatencySamples;
+    dst.totalPresentLatency += src.totalPresentLatency;
+
+    Uint32 now = SDL_GetTicks();
+
+    // Initialize the measurement start point if this is the first video stat window
+    if (!dst.measurementStartTimestamp) {
+        dst.measurementStartTimestamp = src.measurementStartTimestamp;
+    }
+
+    // The following code assumes the global measure was already started first
+    SDL_assert(dst.measurementStartTimestamp <= src.measurementStartTimestamp);
+
+    dst.totalFps = (float)dst.totalFrames / ((float)(now - dst.measurementStartTimestamp) / 1000);
+    dst.receivedFps = (float)dst.receivedFrames / ((float)(now - dst.measurementStartTimestamp) / 1000);
+    dst.decodedFps = (float)dst.decodedFrames / ((float)(now - dst.measurementStartTimestamp) / 1000);
+    dst.renderedFps = (float)dst.renderedFrames / ((float)(now - dst.measurementStartTimestamp) / 1000);
+}
+
+void VideoStatsCollector::stringifyVideoStats(VIDEO_STATS& stats, int frameRate, char* output)
+{
+    int offset = 0;
+
+    // Start with an empty string
+    output[offset] = 0;
+
+    if (stats.receivedFps > 0) {
+        offset += sprintf(&output[offset],
+                          "Estimated host PC frame rate: %.2f FPS\n"
+                          "Incoming frame rate from network: %.2f FPS\n",
+                          stats.totalFps,
+                          stats.receivedFps);
+
+        // Decoders that render out of our sight can't count these
+        if (stats.decodedFrames != 0 || stats.renderedFrames != 0) {
+            offset += sprintf(&output[offset],
+                              "Decoding frame rate: %.2f FPS\n"
+                              "Rendering frame rate: %.2f FPS\n",
+                              stats.decodedFps,
+                              stats.renderedFps);
+        }
+    }
+
+    if (stats.receivedFrames != 0) {
+        offset += sprintf(&output[offset],
+                          "Frames dropped by your network connection: %.2f%%\n"
+                          "Average receive time: %.2f ms\n"
+                          "Average frame arrival jitter: %.2f ms\n",
+                          (float)stats.networkDroppedFrames / stats.totalFrames * 100,
+                          (float)stats.totalReassemblyTime / 1000 / stats.receivedFrames,
+                          (float)stats.totalArrivalJitter / 1000 / stats.receivedFrames);
+    }
+
+    if (stats.submittedFrames != 0) {
+        offset += sprintf(&output[offset],
+                          "Average submit time: %.2f ms\n",
+                          (float)stats.totalSubmitTime / 1000 / stats.submittedFrames);
+    }
+
+    if (stats.renderedFrames != 0) {
+        offset += sprintf(&output[offset],
+                          "Frames dropped due to network jitter: %.2f%%\n"
+                          "Average decoding time: %.2f ms\n"
+                          "Average frame queue delay: %.2f ms\n"
+                          "Average rendering time (including monitor V-sync latency): %.2f ms\n",
+                          (float)stats.pacerDroppedFrames / stats.decodedFrames * 100,
+                          (float)stats.totalDecodeTime / 1000 / stats.decodedFrames,
+                          (float)stats.totalPacerTime / 1000 / stats.renderedFrames,
+                          (float)stats.totalRenderTime / 1000 / stats.renderedFrames);
+    }
+
+    if (stats.lossBursts != 0) {
+        offset += sprintf(&output[offset],
+                          "Network loss bursts: %u (longest %u frames)\n",
+                          stats.lossBursts,
+                          stats.maxLossBurst);
+    }
+
+    if (stats.multiFrameDecodes != 0) {
+        offset += sprintf(&output[offset],
+                          "Decodes producing multiple frames: %u\n",
+                          stats.multiFrameDecodes);
+    }
+
+    if (stats.queuedDecodeUnits != 0) {
+        offset += sprintf(&output[offset],
+                          "Average decode queue delay: %.2f ms\n"
+                          "Average decode queue depth: %.2f (max %u)\n",
+                          (float)stats.totalDecodeQueueTime / 1000 / stats.queuedDecodeUnits,
+                          (float)stats.totalDecodeQueueDepth / stats.queuedDecodeUnits,
+                          stats.maxDecodeQueueDepth);
+    }
+
+    if (stats.concealedFrames != 0) {
+        offset += sprintf(&output[offset],
+                          "Frames shown with concealed errors: %u (%.2f ms concealing)\n",
+                          stats.concealedFrames,
+                          (float)stats.totalConcealmentTime / 1000);
+    }
+
+    if (stats.idrFrames != 0 || stats.idrRequests != 0 || stats.rfiRecoveries != 0) {
+        offset += sprintf(&output[offset],
+                          "IDR frames received: %u (%u requested by decoder)\n"
+                          "Frame losses recovered by reference invalidation: %u\n",
+                          stats.idrFrames,
+                          stats.idrRequests,
+                          stats.rfiRecoveries);
+    }
+
+    if (stats.presentLatencySamples != 0) {
+        offset += sprintf(&output[offset],
+                          "Average present latency: %.2f ms\n",
+                          (float)stats.totalPresentLatency / 1000 / stats.presentLatencySamples);
+    }
+
+    offset += stringifyLatencyBreakdown(stats, frameRate, &output[offset]);
+
+    if (stats.receivedFrames != 0) {
+        offset += sprintf(&output[offset],
+                          "Frame times (p50/p95/p99/max):\n");
+        offset += stringifyFrameTimeHistogram(stats.reassemblyTimes, "Receive", &output[offset]);
+        if (stats.submittedFrames != 0) {
+            offset += stringifyFrameTimeHistogram(stats.submitTimes, "Submit", &output[offset]);
+        }
+        if (stats.renderedFrames != 0) {
+            offset += stringifyFrameTimeHistogram(stats.decodeTimes, "Decode", &output[offset]);
+            offset += stringifyFrameTimeHistogram(stats.pacerTimes, "Frame queue", &output[offset]);
+            offset += stringifyFrameTimeHistogram(stats.renderTimes, "Render", &output[offset]);
+        }
+    }
+}
+
+int VideoStatsCollector::stringifyLatencyBreakdown(VIDEO_STATS& stats, int frameRate, char* output)
+{
+    // Each stage's budget as a percentage of the frame interval. A stage that
+    // goes over its budget is worth a look, while one that takes longer than
+    // a whole frame interval is adding at least a frame of latency.
+    static const struct {
+        const char* name;
+        int budgetPercent;
+    } k_Segments[] = {
+        { "Receive", 25 },
+        { "Decode queue", 10 },
+        { "Decode", 50 },
+        { "Frame queue", 100 },
+        { "Render", 50 },
+        { "Present", 100 },
+    };
+
+    if (stats.renderedFrames == 0 || frameRate <= 0) {
+        return 0;
+    }
+
+    float frameIntervalMs = 1000.0f / frameRate;
+    float segmentsMs[] = {
+        (float)stats.totalReassemblyTime / 1000 / stats.receivedFrames,
+        stats.queuedDecodeUnits != 0 ? (float)stats.totalDecodeQueueTime / 1000 / stats.queuedDecodeUnits : 0,
+        (float)stats.totalDecodeTime / 1000 / stats.decodedFrames,
+        (float)stats.totalPacerTime / 1000 / stats.renderedFrames,
+        (float)stats.totalRenderTime / 1000 / stats.renderedFrames,
+        stats.presentLatencySamples != 0 ? (float)stats.totalPresentLatency / 1000 / stats.presentLatencySamples : -1,
+    };
+    SDL_COMPILE_TIME_ASSERT(latency_segments, SDL_arraysize(segmentsMs) == SDL_arraysize(k_Segments));
+
+    int offset = sprintf(output,
+                         "Client latency breakdown (%.2f ms frame interval):\n",
+                         frameIntervalMs);
+
+    float totalMs = 0;
+    for (int i = 0; i < (int)SDL_arraysize(k_Segments); i++) {
+        // Renderers that can't measure the present latency don't report it
+        if (segmentsMs[i] < 0) {
+            continue;
+        }
+
+        float budgetMs = frameIntervalMs * k_Segments[i].budgetPercent / 100;
+        const char* rating;
+        if (segmentsMs[i] > frameIntervalMs) {
+            rating = "OVER";
+        }
+        else if (segmentsMs[i] > budgetMs) {
+            rating = "HIGH";
+        }
+        else {
+            rating = "ok";
+        }
+
+        offset += sprintf(&output[offset],
+                          "  %s: %.2f ms / %.2f ms [%s]\n",
+                          k_Segments[i].name,
+                          segmentsMs[i],
+                          budgetMs,
+                          rating);
+        totalMs += segmentsMs[i];
+    }
+
+    offset += sprintf(&output[offset],
+                      "  Total: %.2f ms (%.1f frames)\n",
+                      totalMs,
+                      totalMs / frameIntervalMs);
+    return offset;
+}
+
+int VideoStatsCollector::stringifyFrameTimeHistogram(const FrameTimeHistogram& histogram, const char* name, char* output)
+{
+    return sprintf(output,
+                   "  %s: %.2f/%.2f/%.2f/%.2f ms\n",
+                   name,
+                   (float)histogram.getPercentileUs(50) / 1000,
+                   (float)histogram.getPercentileUs(95) / 1000,
+                   (float)histogram.getPercentileUs(99) / 1000,
+                   (float)histogram.maxUs / 1000);
+}
+
+void VideoStatsCollector::logVideoStats(VIDEO_STATS& stats, int frameRate, const char* title)
+{
+    if (stats.receivedFps > 0 || stats.receivedFrames != 0) {
+        char videoStatsStr[OVERLAY_TEXT_SIZE];
+        stringifyVideoStats(stats, frameRate, videoStatsStr);
+
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "%s", title);
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "----------------------------------------------------------\n%s",
+                    videoStatsStr);
+    }
+}
+
+void VideoStatsCollector::publishWindowStats()
+{
+    // Decoders that never started the stats thread only keep global stats
+    if (m_StatsSem == nullptr) {
+        return;
+    }
+
+    VIDEO_STATS windowStats = {};
+    addVideoStats(m_ActiveWndVideoStats, windowStats);
+
+    // The overlay covers the last two windows so it isn't as jumpy
+    VIDEO_STATS lastTwoWndStats = {};
+    addVideoStats(m_LastWndVideoStats, lastTwoWndStats);
+    addVideoStats(m_ActiveWndVideoStats, lastTwoWndStats);
+
+    // If the stats thread is still busy with the previous window, it'll
+    // just pick up this one instead
+    SDL_AtomicLock(&m_StatsLock);
+    SDL_memcpy(&m_PendingWndStats, &windowStats, sizeof(windowStats));
+    SDL_memcpy(&m_PendingLastTwoWndStats, &lastTwoWndStats, sizeof(lastTwoWndStats));
+    SDL_AtomicUnlock(&m_StatsLock);
+
+    SDL_SemPost(m_StatsSem);
+}
+
+int VideoStatsCollector::statsThread(void* context)
+{
+    VideoStatsCollector* me = reinterpret_cast<VideoStatsCollector*>(context);
+
+    // Nothing here is urgent, so it shouldn't compete with the streaming threads
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_LOW);
+
+    for (;;) {
+        SDL_SemWait(me->m_StatsSem);
+
+        if (SDL_AtomicGet(&me->m_StatsThreadStopping)) {
+            break;
+        }
+
+        // Skip ahead to the newest window if we've fallen behind
+        while (SDL_SemTryWait(me->m_StatsSem) == 0);
+
+        VIDEO_STATS windowStats;
+        VIDEO_STATS lastTwoWndStats;
+        SDL_AtomicLock(&me->m_StatsLock);
+        SDL_memcpy(&windowStats, &me->m_PendingWndStats, sizeof(windowStats));
+        SDL_memcpy(&lastTwoWndStats, &me->m_PendingLastTwoWndStats, sizeof(lastTwoWndStats));
+        SDL_AtomicUnlock(&me->m_StatsLock);
+
+        if (Session::get()->getOverlayManager().isOverlayEnabled(Overlay::OverlayDebug)) {
+            me->updateOverlayStats(lastTwoWndStats);
+        }
+
+        // Hand the finished window to the metrics exporter
+        MetricsExporter::publishVideoStats(windowStats);
+
+        BitrateController::reportVideoStats(windowStats);
+        DecodeOverloadDetector::reportVideoStats(windowStats);
+    }
+
+    return 0;
+}
+
+void VideoStatsCollector::updateOverlayStats(VIDEO_STATS& lastTwoWndStats)
+{
+    char videoStatsStr[OVERLAY_TEXT_SIZE];
+    stringifyVideoStats(lastTwoWndStats, m_FrameRate, videoStatsStr);
+
+    if (m_OverlayDetails) {
+        size_t offset = strlen(videoStatsStr);
+        if (!m_OverlayDetails(&videoStatsStr[offset], sizeof(videoStatsStr) - offset)) {
+            return;
+        }
+    }
+
+    // Audio losses are rare enough that they're counted for the whole session
+    AUDIO_STATS audioStats;
+    Session::get()->getAudioStats(audioStats);
+    if (audioStats.lostPackets != 0) {
+        size_t offset = strlen(videoStatsStr);
+        snprintf(&videoStatsStr[offset], sizeof(videoStatsStr) - offset,
+                 "Audio packets lost: %u of %u (%u FEC decoded, %u concealed)\n",
+                 audioStats.lostPackets,
+                 audioStats.receivedPackets + audioStats.lostPackets,
+                 audioStats.fecDecodedPackets,
+                 audioStats.concealedPackets);
+    }
+
+    // Arrival jitter under a millisecond is just scheduling noise
+    if (audioStats.jitterUs >= 1000) {
+        size_t offset = strlen(videoStatsStr);
+        snprintf(&videoStatsStr[offset], sizeof(videoStatsStr) - offset,
+                 "Audio arrival jitter: %.2f ms (peak %.2f ms)\n",
+                 audioStats.jitterUs / 1000.0f,
+                 audioStats.maxJitterUs / 1000.0f);
+    }
+
+    INPUT_STATS inputStats;
+    Session::get()->getInputStats(inputStats);
+    if (inputStats.events != 0) {
+        size_t offset = strlen(videoStatsStr);
+        snprintf(&videoStatsStr[offset], sizeof(videoStatsStr) - offset,
+                 "Average input queue delay: %.2f ms (max %u ms, %u sent ahead of rendering)\n",
+                 (float)inputStats.totalQueueDelayMs / inputStats.events,
+                 inputStats.maxQueueDelayMs,
+                 inputStats.eventsAheadOfRender);
+    }
+
+    {
+        size_t offset = strlen(videoStatsStr);
+        snprintf(&videoStatsStr[offset], sizeof(videoStatsStr) - offset,
+                 "Video packet size: %d bytes\n",
+                 Session::get()->getPacketSize());
+    }
+
+    int skewUs, audioLatencyUs, videoLatencyUs;
+    if (AvSyncClock::getSkew(&skewUs, &audioLatencyUs, &videoLatencyUs)) {
+        size_t offset = strlen(videoStatsStr);
+        snprintf(&videoStatsStr[offset], sizeof(videoStatsStr) - offset,
+                 "A/V skew: %+.1f ms (audio %.1f ms, video %.1f ms)\n",
+                 skewUs / 1000.0f,
+                 audioLatencyUs / 1000.0f,
+                 videoLatencyUs / 1000.0f);
+    }
+
+    int gpuDecodePercent, gpuRenderPercent;
+    if (GpuUsage::getUtilization(&gpuDecodePercent, &gpuRenderPercent)) {
+        char decodeStr[8] = "N/A";
+        char renderStr[8] = "N/A";
+        if (gpuDecodePercent >= 0) {
+            snprintf(decodeStr, sizeof(decodeStr), "%d%%", gpuDecodePercent);
+        }
+        if (gpuRenderPercent >= 0) {
+            snprintf(renderStr, sizeof(renderStr), "%d%%", gpuRenderPercent);
+        }
+
+        size_t offset = strlen(videoStatsStr);
+        snprintf(&videoStatsStr[offset], sizeof(videoStatsStr) - offset,
+                 "GPU utilization: %s video decode, %s 3D\n",
+                 decodeStr,
+                 renderStr);
+    }
+
+    int residentMb = StreamUtils::getResidentMemoryMb();
+    if (residentMb >= 0) {
+        char videoMemoryStr[32] = "";
+        int videoMemoryMb = GpuUsage::getVideoMemoryMb();
+        if (videoMemoryMb >= 0) {
+            snprintf(videoMemoryStr, sizeof(videoMemoryStr), ", %d MB video memory", videoMemoryMb);
+        }
+
+        size_t offset = strlen(videoStatsStr);
+        snprintf(&videoStatsStr[offset], sizeof(videoStatsStr) - offset,
+                 "Memory usage: %d MB resident%s%s\n",
+                 residentMb,
+                 videoMemoryStr,
+                 StreamUtils::isLowMemoryMode() ? " (low memory mode)" : "");
+    }
+
+    Session::get()->getOverlayManager().updateOverlayText(Overlay::OverlayDebug, videoStatsStr);
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <functional>
+
+#include "decoder.h"
+
+// Collects a decoder's VIDEO_STATS in windows of about a second. Each
+// finished window goes to a low priority thread that formats the overlay
+// and feeds the metrics exporter, bitrate controller and decode overload
+// detector, so the submit thread only counts frames and copies each window
+// out. Only the newest window is kept if that thread falls behind.
+//
+// reportDecodeUnit() counts everything that's known when a frame arrives.
+// The decoder adds its own timings to getActiveWindowStats() from then on,
+// which may be done from the threads decoding and rendering its frames.
+class VideoStatsCollector
+{
+public:
+    // Appends the decoder's own lines to the overlay text. Returning false
+    // skips updating the overlay for this window.
+    typedef std::function<bool(char* output, size_t size)> OverlayDetailsCallback;
+
+    VideoStatsCollector();
+    ~VideoStatsCollector();
+
+    // Starts the stats thread. The callback is run from that thread.
+    bool start(int frameRate, bool supportsRfi, OverlayDetailsCallback overlayDetails = nullptr);
+
+    // Stops the stats thread. The window being collected is kept, so
+    // collection can pick up where it left off after another start().
+    void stop();
+
+    // Must be called for each decode unit before it's decoded
+    void reportDecodeUnit(PDECODE_UNIT du);
+
+    // For decoders that decode and render out of our sight, the time it
+    // took to hand the frame over is all there is to measure
+    void reportSubmitTime(Uint64 submitTimeUs);
+
+    VIDEO_STATS* getActiveWindowStats();
+
+    // The whole session so far, including the window being collected
+    void getGlobalVideoStats(VIDEO_STATS& stats);
+
+    // The whole session up to the last finished window. Unlike the above,
+    // this may be called from any thread while frames are coming in.
+    void getPublishedVideoStats(VIDEO_STATS& stats);
+
+    void logGlobalVideoStats();
+
+    static void addVideoStats(VIDEO_STATS& src, VIDEO_STATS& dst);
+
+    static void stringifyVideoStats(VIDEO_STATS& stats, int frameRate, char* output);
+
+    static void logVideoStats(VIDEO_STATS& stats, int frameRate, const char* title);
+
+private:
+    static int stringifyFrameTimeHistogram(const FrameTimeHistogram& histogram, const char* name, char* output);
+
+    static int stringifyLatencyBreakdown(VIDEO_STATS& stats, int frameRate, char* output);
+
+    // Hands the window that just ended to the stats thread
+    void publishWindowStats();
+
+    static int statsThread(void* context);
+
+    void updateOverlayStats(VIDEO_STATS& lastTwoWndStats);
+
+    VIDEO_STATS m_ActiveWndVideoStats;
+    VIDEO_STATS m_LastWndVideoStats;
+    VIDEO_STATS m_GlobalVideoStats;
+
+    int m_LastFrameNumber;
+    Uint64 m_LastArrivalTimeUs;
+    Sint64 m_ArrivalJitterUs;
+    int m_FrameRate;
+    bool m_SupportsRfi;
+    OverlayDetailsCallback m_OverlayDetails;
+
+    SDL_Thread* m_StatsThread;
+    SDL_sem* m_StatsSem;
+    SDL_atomic_t m_StatsThreadStopping;
+    SDL_SpinLock m_StatsLock;
+    VIDEO_STATS m_PendingWndStats;
+    VIDEO_STATS m_PendingLastTwoWndStats;
+    VIDEO_STATS m_PublishedGlobalVideoStats;
+};
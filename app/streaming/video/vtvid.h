@@ -0,0 +1,15 @@
+#pragma once
+
+#include "decoder.h"
+
+// A factory is required to avoid pulling in
+// incompatible Objective-C headers.
+class VTVideoDecoderFactory {
+public:
+    // Decodes with a VTDecompressionSession of our own rather than through
+    // FFmpeg's VideoToolbox hwaccel, and hands the decoded CVPixelBuffers
+    // to our VT renderers through the Pacer. Returns nullptr if native
+    // decoding is disabled with VT_DISABLE_NATIVE_DECODE=1.
+    static
+    IVideoDecoder* createDecoder(bool testOnly);
+};
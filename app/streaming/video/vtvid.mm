@@ -0,0 +1,561 @@
+// Nasty hack to avoid conflict between AVFoundation and
+// libavutil both defining AVMediaType
+#define AVMediaType AVMediaType_FFmpeg
+#include "vtvid.h"
+#include "ffmpeg-renderers/vt.h"
+#include "ffmpeg-renderers/pacer/pacer.h"
+#include "videostats.h"
+#undef AVMediaType
+
+#include <Limelight.h>
+#include <streaming/session.h>
+#include <streaming/streamutils.h>
+
+#include <QByteArray>
+#include <QVector>
+
+#include <libkern/OSByteOrder.h>
+#import <Foundation/Foundation.h>
+#import <VideoToolbox/VideoToolbox.h>
+
+// Enough frames for everything the Pacer can hold plus the one being
+// handed to it from the output callback
+#define FRAME_POOL_SIZE (Pacer::getMaxHeldFrames() + 1)
+
+// Decode start times are kept by frame number for the output callback.
+// VT never has more than a few frames in flight.
+#define DECODE_TIME_SLOTS 16
+
+// Length of the NAL unit size prefix in the AVCC/HVCC samples we submit
+#define NAL_LENGTH_SIZE 4
+
+class VTVideoDecoder : public IVideoDecoder
+{
+public:
+    VTVideoDecoder(bool testOnly)
+        : m_TestOnly(testOnly),
+          m_Session(nullptr),
+          m_FormatDesc(nullptr),
+          m_Renderer(nullptr),
+          m_FramePool(nullptr),
+          m_Pacer(nullptr),
+          m_ActiveWndVideoStats(*m_VideoStats.getActiveWindowStats()),
+          m_VideoFormat(0)
+    {
+        SDL_zero(m_DecodeStartTimeUs);
+        SDL_AtomicSet(&m_DecoderError, 0);
+    }
+
+    virtual ~VTVideoDecoder() override
+    {
+        destroySession();
+
+        m_VideoStats.stop();
+        if (!m_TestOnly) {
+            m_VideoStats.logGlobalVideoStats();
+        }
+
+        if (m_FormatDesc != nullptr) {
+            CFRelease(m_FormatDesc);
+        }
+
+        // Pacer returns all of its frames to the pool
+        delete m_Pacer;
+        delete m_FramePool;
+
+        if (!m_TestOnly) {
+            Session::get()->getOverlayManager().setOverlayRenderer(nullptr);
+        }
+
+        delete m_Renderer;
+    }
+
+    virtual bool initialize(PDECODER_PARAMETERS params) override
+    {
+        // Capabilities are probed through FFmpeg's VT hwaccel, which
+        // decodes a test frame to prove VT actually works. Both paths
+        // use the same decoder, so the result holds for us too.
+        if (m_TestOnly) {
+            return false;
+        }
+
+        if (params->vds != StreamingPreferences::VDS_AUTO &&
+                params->vds != StreamingPreferences::VDS_FORCE_HARDWARE) {
+            return false;
+        }
+
+        if (!(params->videoFormat & (VIDEO_FORMAT_MASK_H264 | VIDEO_FORMAT_MASK_H265))) {
+            return false;
+        }
+
+        m_VideoFormat = params->videoFormat;
+
+        // The renderers check that VT can decode this codec in hardware
+        m_Renderer = VTRendererFactory::createMetalRenderer();
+        if (!m_Renderer->initialize(params)) {
+            delete m_Renderer;
+            m_Renderer = VTRendererFactory::createRenderer();
+            if (!m_Renderer->initialize(params)) {
+                return false;
+            }
+        }
+
+        if (m_Renderer->getFramePacingConstraint() == IFFmpegRenderer::PACING_FORCE_OFF) {
+            params->enableFramePacing = false;
+        }
+
+        m_FramePool = new FramePool(FRAME_POOL_SIZE);
+        m_Pacer = new Pacer(m_Renderer, m_FramePool, &m_ActiveWndVideoStats);
+        if (!m_Pacer->initialize(params->window, params->frameRate,
+                                 params->enableFramePacing, params->pacingMode)) {
+            return false;
+        }
+
+        Session::get()->getOverlayManager().setOverlayRenderer(m_Renderer);
+
+        // We advertise the renderer's reference frame invalidation support
+        int caps = m_Renderer->getDecoderCapabilities();
+        bool supportsRfi = (params->videoFormat & VIDEO_FORMAT_MASK_H264) ?
+                    (caps & CAPABILITY_REFERENCE_FRAME_INVALIDATION_AVC) != 0 :
+                    (caps & CAPABILITY_REFERENCE_FRAME_INVALIDATION_HEVC) != 0;
+        if (!m_VideoStats.start(params->frameRate, supportsRfi)) {
+            return false;
+        }
+
+        // The session is created from the parameter sets of the first IDR frame
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Using native VideoToolbox decoder");
+        return true;
+    }
+
+    virtual bool isHardwareAccelerated() override
+    {
+        // VT is only used when it decodes in hardware
+        return true;
+    }
+
+    virtual int getDecoderCapabilities() override
+    {
+        return m_Renderer != nullptr ? m_Renderer->getDecoderCapabilities() : 0;
+    }
+
+    virtual int submitDecodeUnit(PDECODE_UNIT du) override
+    {
+        QVector<QByteArray> parameterSets;
+
+        m_VideoStats.reportDecodeUnit(du);
+
+        // The output callback reports decode failures. Frames after one
+        // would reference a broken picture, so wait for the next IDR frame.
+        if (SDL_AtomicSet(&m_DecoderError, 0) && du->frameType != FRAME_TYPE_IDR) {
+            m_ActiveWndVideoStats.idrRequests++;
+            return DR_NEED_IDR;
+        }
+
+        m_FrameData.resize(0);
+        for (PLENTRY entry = du->bufferList; entry != nullptr; entry = entry->next) {
+            if (entry->bufferType == BUFFER_TYPE_PICDATA) {
+                m_FrameData.append(entry->data, entry->length);
+            }
+            else {
+                // Parameter sets each come in their own buffer
+                int start = skipStartCode(entry->data, entry->length);
+                parameterSets.append(QByteArray(entry->data + start, entry->length - start));
+            }
+        }
+
+        if (du->frameType == FRAME_TYPE_IDR && !updateFormatDescription(parameterSets)) {
+            m_ActiveWndVideoStats.idrRequests++;
+            return DR_NEED_IDR;
+        }
+
+        if (m_Session == nullptr) {
+            // No usable IDR frame yet
+            m_ActiveWndVideoStats.idrRequests++;
+            return DR_NEED_IDR;
+        }
+
+        CMSampleBufferRef sampleBuffer = createSampleBuffer();
+        if (sampleBuffer == nullptr) {
+            m_ActiveWndVideoStats.idrRequests++;
+            return DR_NEED_IDR;
+        }
+
+        m_DecodeStartTimeUs[du->frameNumber % DECODE_TIME_SLOTS] = StreamUtils::getTimeUs();
+
+        // Decoding is asynchronous and the output callback feeds the
+        // Pacer directly, so this thread only waits for the submission
+        OSStatus status = VTDecompressionSessionDecodeFrame(m_Session, sampleBuffer,
+                                                            kVTDecodeFrame_EnableAsynchronousDecompression,
+                                                            (void*)(intptr_t)du->frameNumber, nullptr);
+        CFRelease(sampleBuffer);
+
+        if (status != noErr) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "VTDecompressionSessionDecodeFrame() failed: %d",
+                        (int)status);
+
+            // The session dies when the GPU is reset or the system sleeps,
+            // so we'll build a new one on the next IDR frame.
+            if (status == kVTInvalidSessionErr) {
+                destroySession();
+            }
+
+            m_ActiveWndVideoStats.idrRequests++;
+            return DR_NEED_IDR;
+        }
+
+        return DR_OK;
+    }
+
+    virtual void renderFrameOnMainThread() override
+    {
+        m_Pacer->renderOnMainThread();
+    }
+
+    virtual bool getGlobalVideoStats(VIDEO_STATS& stats) override
+    {
+        m_VideoStats.getGlobalVideoStats(stats);
+        return true;
+    }
+
+    virtual bool getLiveVideoStats(VIDEO_STATS& stats) override
+    {
+        m_VideoStats.getPublishedVideoStats(stats);
+        return true;
+    }
+
+    virtual bool requestScreenshot() override
+    {
+        m_Pacer->requestScreenshot();
+        return true;
+    }
+
+private:
+    // Returns the length of the Annex B start code at the start of the buffer
+    static int skipStartCode(const char* data, int length)
+    {
+        if (length >= 4 && data[0] == 0 && data[1] == 0 && data[2] == 0 && data[3] == 1) {
+            return 4;
+        }
+        else if (length >= 3 && data[0] == 0 && data[1] == 0 && data[2] == 1) {
+            return 3;
+        }
+        else {
+            return 0;
+        }
+    }
+
+    // Builds the format description from an IDR frame's parameter sets,
+    // and replaces the session if it can't take the new format
+    bool updateFormatDescription(const QVector<QByteArray>& parameterSets)
+    {
+        const uint8_t* pointers[3];
+        size_t sizes[3];
+        CMVideoFormatDescriptionRef formatDesc;
+        OSStatus status;
+
+        // These arrive as VPS (HEVC only), SPS, then PPS
+        if (parameterSets.size() > 3) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "Unexpected number of parameter sets: %d",
+                         parameterSets.size());
+            return false;
+        }
+
+        for (int i = 0; i < parameterSets.size(); i++) {
+            pointers[i] = (const uint8_t*)parameterSets[i].constData();
+            sizes[i] = parameterSets[i].size();
+        }
+
+        if (m_VideoFormat & VIDEO_FORMAT_MASK_H264) {
+            status = CMVideoFormatDescriptionCreateFromH264ParameterSets(kCFAllocatorDefault,
+                                                                         parameterSets.size(),
+                                                                         pointers, sizes,
+                                                                         NAL_LENGTH_SIZE,
+                                                                         &formatDesc);
+        }
+        else if (__builtin_available(macOS 10.13, *)) {
+            status = CMVideoFormatDescriptionCreateFromHEVCParameterSets(kCFAllocatorDefault,
+                                                                         parameterSets.size(),
+                                                                         pointers, sizes,
+                                                                         NAL_LENGTH_SIZE,
+                                                                         nullptr,
+                                                                         &formatDesc);
+        }
+        else {
+            // The renderers already rule out HEVC before 10.13
+            return false;
+        }
+
+        if (status != noErr) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "Unable to create format description from parameter sets: %d",
+                         (int)status);
+            return false;
+        }
+
+        // The host repeats the same parameter sets with every IDR frame
+        if (m_Session != nullptr && m_FormatDesc != nullptr && CMFormatDescriptionEqual(formatDesc, m_FormatDesc)) {
+            CFRelease(formatDesc);
+            return true;
+        }
+
+        if (m_FormatDesc != nullptr) {
+            CFRelease(m_FormatDesc);
+        }
+        m_FormatDesc = formatDesc;
+
+        if (m_Session != nullptr && VTDecompressionSessionCanAcceptFormatDescription(m_Session, m_FormatDesc)) {
+            return true;
+        }
+
+        destroySession();
+        return createSession();
+    }
+
+    bool createSession()
+    {
+        OSStatus status;
+
+        @autoreleasepool {
+            // Ask for the formats our renderers can show without a
+            // conversion, backed by IOSurfaces that Metal can sample
+            OSType pixelFormat = m_VideoFormat == VIDEO_FORMAT_H265_MAIN10 ?
+                        kCVPixelFormatType_420YpCbCr10BiPlanarVideoRange :
+                        kCVPixelFormatType_420YpCbCr8BiPlanarVideoRange;
+            NSDictionary* imageBufferAttributes = @{
+                (NSString*)kCVPixelBufferPixelFormatTypeKey: @(pixelFormat),
+                (NSString*)kCVPixelBufferIOSurfacePropertiesKey: @{},
+                (NSString*)kCVPixelBufferMetalCompatibilityKey: @YES,
+            };
+
+            // Fail rather than falling back to a software decoder
+            NSDictionary* decoderSpecification = @{
+                (NSString*)kVTVideoDecoderSpecification_RequireHardwareAcceleratedVideoDecoder: @YES,
+            };
+
+            VTDecompressionOutputCallbackRecord callback = { outputCallback, this };
+            status = VTDecompressionSessionCreate(kCFAllocatorDefault, m_FormatDesc,
+                                                  (CFDictionaryRef)decoderSpecification,
+                                                  (CFDictionaryRef)imageBufferAttributes,
+                                                  &callback, &m_Session);
+        }
+        if (status != noErr) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "VTDecompressionSessionCreate() failed: %d",
+                         (int)status);
+            m_Session = nullptr;
+            return false;
+        }
+
+        // Output each frame as soon as it's decoded
+        status = VTSessionSetProperty(m_Session, kVTDecompressionPropertyKey_RealTime, kCFBooleanTrue);
+        if (status != noErr) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "Unable to enable real-time decoding: %d",
+                        (int)status);
+        }
+
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Created VT decompression session");
+        return true;
+    }
+
+    void destroySession()
+    {
+        if (m_Session != nullptr) {
+            // Let the output callbacks finish before the session goes
+            VTDecompressionSessionWaitForAsynchronousFrames(m_Session);
+            VTDecompressionSessionInvalidate(m_Session);
+            CFRelease(m_Session);
+            m_Session = nullptr;
+        }
+    }
+
+    // Wraps the frame data in a sample buffer, with each NAL unit's
+    // Annex B start code replaced by its length as VT requires
+    CMSampleBufferRef createSampleBuffer()
+    {
+        const char* data = m_FrameData.constData();
+        int length = m_FrameData.size();
+        QVector<int> nalStarts;
+        QVector<int> nalEnds;
+        size_t sampleSize = 0;
+
+        for (int i = 0; i + 2 < length; i++) {
+            if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1) {
+                if (!nalStarts.isEmpty()) {
+                    // A 4 byte start code begins with a zero that isn't part of the NAL unit
+                    nalEnds.append(data[i - 1] == 0 ? i - 1 : i);
+                }
+                nalStarts.append(i + 3);
+                i += 2;
+            }
+        }
+        if (nalStarts.isEmpty()) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "Frame has no Annex B start codes");
+            return nullptr;
+        }
+        nalEnds.append(length);
+
+        for (int i = 0; i < nalStarts.size(); i++) {
+            sampleSize += NAL_LENGTH_SIZE + nalEnds[i] - nalStarts[i];
+        }
+
+        // VT takes ownership of this memory and frees it with the sample
+        CMBlockBufferRef blockBuffer;
+        OSStatus status = CMBlockBufferCreateWithMemoryBlock(kCFAllocatorDefault, nullptr, sampleSize,
+                                                             kCFAllocatorDefault, nullptr, 0, sampleSize,
+                                                             kCMBlockBufferAssureMemoryNowFlag, &blockBuffer);
+        if (status != noErr) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "CMBlockBufferCreateWithMemoryBlock() failed: %d",
+                         (int)status);
+            return nullptr;
+        }
+
+        char* sample;
+        CMBlockBufferGetDataPointer(blockBuffer, 0, nullptr, nullptr, &sample);
+
+        for (int i = 0; i < nalStarts.size(); i++) {
+            uint32_t nalLength = nalEnds[i] - nalStarts[i];
+            OSWriteBigInt32(sample, 0, nalLength);
+            memcpy(sample + NAL_LENGTH_SIZE, data + nalStarts[i], nalLength);
+            sample += NAL_LENGTH_SIZE + nalLength;
+        }
+
+        CMSampleBufferRef sampleBuffer;
+        status = CMSampleBufferCreateReady(kCFAllocatorDefault, blockBuffer, m_FormatDesc,
+                                           1, 0, nullptr, 1, &sampleSize, &sampleBuffer);
+        CFRelease(blockBuffer);
+        if (status != noErr) {
+            SDL_LogError(SDL_LOG_CATEGORY_APPLICATION,
+                         "CMSampleBufferCreateReady() failed: %d",
+                         (int)status);
+            return nullptr;
+        }
+
+        return sampleBuffer;
+    }
+
+    static void releasePixelBuffer(void*, uint8_t* data)
+    {
+        CVPixelBufferRelease((CVPixelBufferRef)data);
+    }
+
+    // Called by VT on its own thread as each frame finishes decoding
+    static void outputCallback(void* decompressionOutputRefCon, void* sourceFrameRefCon,
+                               OSStatus status, VTDecodeInfoFlags infoFlags,
+                               CVImageBufferRef imageBuffer, CMTime, CMTime)
+    {
+        VTVideoDecoder* me = (VTVideoDecoder*)decompressionOutputRefCon;
+        int frameNumber = (int)(intptr_t)sourceFrameRefCon;
+
+        if (status != noErr) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "VT failed to decode frame %d: %d",
+                        frameNumber,
+                        (int)status);
+            SDL_AtomicSet(&me->m_DecoderError, 1);
+            return;
+        }
+
+        if (imageBuffer == nullptr || (infoFlags & kVTDecodeInfo_FrameDropped)) {
+            return;
+        }
+
+        AVFrame* frame = me->m_FramePool->getFrame();
+        if (frame == nullptr) {
+            SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION,
+                        "Failed to allocate frame");
+            return;
+        }
+
+        // This is the same wrapping FFmpeg's VT hwaccel produces, which
+        // is what our renderers expect
+        frame->buf[0] = av_buffer_create((uint8_t*)CVPixelBufferRetain(imageBuffer), sizeof(CVPixelBufferRef),
+                                         releasePixelBuffer, nullptr, AV_BUFFER_FLAG_READONLY);
+        if (frame->buf[0] == nullptr) {
+            CVPixelBufferRelease(imageBuffer);
+            me->m_FramePool->releaseFrame(frame);
+            return;
+        }
+
+        frame->data[3] = (uint8_t*)imageBuffer;
+        frame->format = AV_PIX_FMT_VIDEOTOOLBOX;
+        frame->width = (int)CVPixelBufferGetWidth(imageBuffer);
+        frame->height = (int)CVPixelBufferGetHeight(imageBuffer);
+        frame->pkt_dts = frameNumber;
+        setColorProperties(frame, imageBuffer);
+
+        // Capture a frame timestamp to measure pacing delay
+        frame->pts = StreamUtils::getTimeUs();
+
+        Uint64 decodeTimeUs = frame->pts - me->m_DecodeStartTimeUs[frameNumber % DECODE_TIME_SLOTS];
+        me->m_ActiveWndVideoStats.totalDecodeTime += decodeTimeUs;
+        me->m_ActiveWndVideoStats.decodeTimes.add(decodeTimeUs);
+        me->m_ActiveWndVideoStats.decodedFrames++;
+
+        me->m_Pacer->submitFrame(frame);
+    }
+
+    // VT attaches the colorimetry from the stream's VUI to the buffer
+    static void setColorProperties(AVFrame* frame, CVImageBufferRef imageBuffer)
+    {
+        CFTypeRef matrix = CVBufferGetAttachment(imageBuffer, kCVImageBufferYCbCrMatrixKey, nullptr);
+        if (matrix != nullptr && CFEqual(matrix, kCVImageBufferYCbCrMatrix_ITU_R_709_2)) {
+            frame->colorspace = AVCOL_SPC_BT709;
+        }
+        else if (matrix != nullptr && CFEqual(matrix, kCVImageBufferYCbCrMatrix_ITU_R_2020)) {
+            frame->colorspace = AVCOL_SPC_BT2020_NCL;
+        }
+        else {
+            frame->colorspace = AVCOL_SPC_SMPTE170M;
+        }
+
+        OSType pixelFormat = CVPixelBufferGetPixelFormatType(imageBuffer);
+        frame->color_range = pixelFormat == kCVPixelFormatType_420YpCbCr8BiPlanarFullRange ?
+                    AVCOL_RANGE_JPEG : AVCOL_RANGE_MPEG;
+
+        if (__builtin_available(macOS 10.13, *)) {
+            CFTypeRef transfer = CVBufferGetAttachment(imageBuffer, kCVImageBufferTransferFunctionKey, nullptr);
+            if (transfer != nullptr && CFEqual(transfer, kCVImageBufferTransferFunction_SMPTE_ST_2084_PQ)) {
+                frame->color_trc = AVCOL_TRC_SMPTE2084;
+            }
+        }
+    }
+
+    bool m_TestOnly;
+    VTDecompressionSessionRef m_Session;
+    CMVideoFormatDescriptionRef m_FormatDesc;
+    IFFmpegRenderer* m_Renderer;
+    FramePool* m_FramePool;
+    Pacer* m_Pacer;
+    VideoStatsCollector m_VideoStats;
+
+    // The window being collected, which decoding adds its timings to
+    VIDEO_STATS& m_ActiveWndVideoStats;
+
+    int m_VideoFormat;
+
+    // Reused for each frame so it only allocates while growing
+    QByteArray m_FrameData;
+
+    // Written before each frame is submitted and read by its output callback
+    Uint64 m_DecodeStartTimeUs[DECODE_TIME_SLOTS];
+
+    // Set from the output callback when VT fails to decode a frame
+    SDL_atomic_t m_DecoderError;
+};
+
+IVideoDecoder* VTVideoDecoderFactory::createDecoder(bool testOnly) {
+    if (qgetenv("VT_DISABLE_NATIVE_DECODE") == "1") {
+        SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION,
+                    "Native VT decoder disabled by VT_DISABLE_NATIVE_DECODE");
+        return nullptr;
+    }
+
+    return new VTVideoDecoder(testOnly);
+}
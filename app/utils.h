@@ -1,5 +1,56 @@
 #pragma once
 
+#include <SDL.h>
+
 #define THROW_BAD_ALLOC_IF_NULL(x) \
     if ((x) == nullptr) throw std::bad_alloc()
 
+// Messages allowed from one call site in each interval before the rest
+// are counted instead of logged
+#define LOG_RATE_LIMIT_BURST 5
+#define LOG_RATE_LIMIT_INTERVAL_MS 1000
+
+// Zero-initialized as a static, so each call site can own one without
+// any setup. Racing threads may let a message or two past the limit.
+struct LogRateLimiter
+{
+    SDL_atomic_t windowStartMs;
+    SDL_atomic_t messages;
+    SDL_atomic_t suppressed;
+
+    // Returns true if the message should be logged, along with how many
+    // were suppressed since the last one that was
+    bool allow(int* suppressedCount)
+    {
+        Uint32 now = SDL_GetTicks();
+        int windowStart = SDL_AtomicGet(&windowStartMs);
+        if (now - (Uint32)windowStart >= LOG_RATE_LIMIT_INTERVAL_MS &&
+                SDL_AtomicCAS(&windowStartMs, windowStart, (int)now)) {
+            SDL_AtomicSet(&messages, 0);
+        }
+
+        if (SDL_AtomicIncRef(&messages) >= LOG_RATE_LIMIT_BURST) {
+            SDL_AtomicIncRef(&suppressed);
+            return false;
+        }
+
+        *suppressedCount = SDL_AtomicSet(&suppressed, 0);
+        return true;
+    }
+};
+
+// Logs at most LOG_RATE_LIMIT_BURST messages per interval from this call
+// site, for errors that can repeat on every frame or packet
+#define SDL_LOG_RATE_LIMITED(logFunction, ...) \
+    do { \
+        static LogRateLimiter limiter; \
+        int suppressedCount; \
+        if (limiter.allow(&suppressedCount)) { \
+            if (suppressedCount != 0) { \
+                SDL_LogInfo(SDL_LOG_CATEGORY_APPLICATION, \
+                            "Suppressed %d similar messages", \
+                            suppressedCount); \
+            } \
+            logFunction(__VA_ARGS__); \
+        } \
+    } while (0)